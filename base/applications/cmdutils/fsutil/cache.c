@@ -0,0 +1,76 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS FS utility tool
+ * FILE:            base/applications/cmdutils/cache.c
+ * PURPOSE:         FSutil file cache residency
+ */
+
+#include "fsutil.h"
+#include <winioctl.h>
+#include <reactos/rosioctl.h>
+
+/* Add handlers here for subcommands */
+static HandlerProc QueryMain;
+static HandlerItem HandlersList[] =
+{
+    /* Proc, name, help */
+    { QueryMain, _T("query"), _T("Shows how much of a file is in the cache") },
+};
+
+static int
+QueryMain(int argc, const TCHAR *argv[])
+{
+    HANDLE File;
+    DWORD BytesRead;
+    FILE_CACHE_RESIDENCY_INFORMATION Residency;
+
+    /* We need a file */
+    if (argc < 2)
+    {
+        _ftprintf(stderr, _T("Usage: fsutil cache query <file>\n"));
+        _ftprintf(stderr, _T("\tFor example: fsutil cache query c:\\file.txt\n"));
+        return 1;
+    }
+
+    /* No access is needed, just open it */
+    File = CreateFile(argv[1], 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                      NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (File == INVALID_HANDLE_VALUE)
+    {
+        PrintErrorMessage(GetLastError());
+        return 1;
+    }
+
+    if (!DeviceIoControl(File, FSCTL_QUERY_CACHE_RESIDENCY, NULL, 0,
+                         &Residency, sizeof(Residency), &BytesRead, NULL))
+    {
+        PrintErrorMessage(GetLastError());
+        CloseHandle(File);
+        return 1;
+    }
+
+    CloseHandle(File);
+
+    /* Print the residency, in KB */
+    _ftprintf(stdout, _T("File size:      %I64u KB\n"), Residency.FileSize.QuadPart / 1024);
+    _ftprintf(stdout, _T("Resident bytes: %I64u KB\n"), Residency.ResidentBytes.QuadPart / 1024);
+    _ftprintf(stdout, _T("Dirty bytes:    %I64u KB\n"), Residency.DirtyBytes.QuadPart / 1024);
+    _ftprintf(stdout, _T("Views:          %lu (of %lu KB)\n"), Residency.ViewCount, Residency.ViewSize / 1024);
+
+    return 0;
+}
+
+static void
+PrintUsage(const TCHAR * Command)
+{
+    PrintDefaultUsage(_T(" CACHE "), Command, (HandlerItem *)&HandlersList,
+                      (sizeof(HandlersList) / sizeof(HandlersList[0])));
+}
+
+int
+CacheMain(int argc, const TCHAR *argv[])
+{
+    return FindHandler(argc, argv, (HandlerItem *)&HandlersList,
+                       (sizeof(HandlersList) / sizeof(HandlersList[0])),
+                       PrintUsage);
+}
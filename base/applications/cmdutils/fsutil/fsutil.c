@@ -9,6 +9,7 @@
 #include "fsutil.h"
 
 /* Add handlers here for commands */
+HandlerProc CacheMain;
 HandlerProc DirtyMain;
 HandlerProc FsInfoMain;
 HandlerProc HardLinkMain;
@@ -16,6 +17,7 @@ HandlerProc VolumeMain;
 static HandlerItem HandlersList[] =
 {
     /* Proc, name, help */
+    { CacheMain, _T("cache"), _T("Shows the cache usage of files") },
     { DirtyMain, _T("dirty"), _T("Manipulates the dirty bit") },
     { FsInfoMain, _T("fsinfo"), _T("Gathers informations about file systems") },
     { HardLinkMain, _T("hardlink"), _T("Handles hard links") },
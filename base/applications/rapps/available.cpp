@@ -17,6 +17,143 @@
 #include <atlsimpcoll.h>
 #include <atlstr.h>
 
+// The database is indexed into a single binary file, so that it doesn't
+// have to be parsed from the .txt files every time the catalog is loaded
+#define APPS_INDEX_NAME     L"rappmgr.idx"
+#define APPS_INDEX_MAGIC    0x58444952  // "RIDX"
+#define APPS_INDEX_VERSION  1
+
+struct AppsIndexHeader
+{
+    DWORD Magic;
+    DWORD Version;
+    LCID Locale;            // the strings are the localized ones
+    DWORD Count;            // number of .txt files in the database
+    FILETIME ftNewest;      // most recent write time of the .txt files
+};
+
+class CAppsIndexWriter
+{
+    HANDLE m_hFile;
+    BYTE m_Buffer[4096];
+    DWORD m_cbBuffer;
+    BOOL m_bFailed;
+
+public:
+    CAppsIndexWriter(HANDLE hFile) : m_hFile(hFile), m_cbBuffer(0), m_bFailed(FALSE)
+    {
+    }
+
+    VOID Write(LPCVOID pData, DWORD cbData)
+    {
+        const BYTE* pBytes = static_cast<const BYTE*>(pData);
+
+        while (cbData && !m_bFailed)
+        {
+            DWORD cbChunk = min(cbData, sizeof(m_Buffer) - m_cbBuffer);
+
+            CopyMemory(m_Buffer + m_cbBuffer, pBytes, cbChunk);
+            m_cbBuffer += cbChunk;
+            pBytes += cbChunk;
+            cbData -= cbChunk;
+
+            if (m_cbBuffer == sizeof(m_Buffer))
+                Flush();
+        }
+    }
+
+    VOID WriteDWORD(DWORD Value)
+    {
+        Write(&Value, sizeof(Value));
+    }
+
+    VOID WriteString(const ATL::CStringW& String)
+    {
+        WriteDWORD(String.GetLength());
+        Write(String.GetString(), String.GetLength() * sizeof(WCHAR));
+    }
+
+    BOOL Flush()
+    {
+        DWORD cbWritten;
+
+        if (m_cbBuffer && !m_bFailed)
+        {
+            if (!WriteFile(m_hFile, m_Buffer, m_cbBuffer, &cbWritten, NULL) || cbWritten != m_cbBuffer)
+                m_bFailed = TRUE;
+            m_cbBuffer = 0;
+        }
+        return !m_bFailed;
+    }
+};
+
+class CAppsIndexReader
+{
+    const BYTE* m_Position;
+    const BYTE* m_End;
+
+public:
+    CAppsIndexReader(const BYTE* pData, DWORD cbData) : m_Position(pData), m_End(pData + cbData)
+    {
+    }
+
+    BOOL Read(LPVOID pData, DWORD cbData)
+    {
+        if ((DWORD) (m_End - m_Position) < cbData)
+            return FALSE;
+
+        CopyMemory(pData, m_Position, cbData);
+        m_Position += cbData;
+        return TRUE;
+    }
+
+    BOOL ReadDWORD(DWORD& Value)
+    {
+        return Read(&Value, sizeof(Value));
+    }
+
+    BOOL ReadString(ATL::CStringW& String)
+    {
+        DWORD cchString;
+
+        if (!ReadDWORD(cchString) || cchString > (DWORD) (m_End - m_Position) / sizeof(WCHAR))
+            return FALSE;
+
+        Read(String.GetBuffer(cchString), cchString * sizeof(WCHAR));
+        String.ReleaseBuffer(cchString);
+        return TRUE;
+    }
+
+    BOOL IsAtEnd() const
+    {
+        return m_Position == m_End;
+    }
+};
+
+static BOOL ScanAppsDB(const ATL::CStringW& szSearchPath, DWORD* pCount, FILETIME* pftNewest)
+{
+    HANDLE hFind = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAW FindFileData;
+
+    hFind = FindFirstFileW(szSearchPath.GetString(), &FindFileData);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        return FALSE;
+    }
+
+    *pCount = 0;
+    ZeroMemory(pftNewest, sizeof(*pftNewest));
+    do
+    {
+        (*pCount)++;
+        if (CompareFileTime(&FindFileData.ftLastWriteTime, pftNewest) == 1)
+            *pftNewest = FindFileData.ftLastWriteTime;
+    } while (FindNextFileW(hFind, &FindFileData) != 0);
+
+    FindClose(hFind);
+    return TRUE;
+}
+
  // CAvailableApplicationInfo
 CAvailableApplicationInfo::CAvailableApplicationInfo(const ATL::CStringW& sFileNameParam)
     : m_IsSelected(FALSE), m_LicenseType(LICENSE_NONE), m_sFileName(sFileNameParam),
@@ -25,6 +162,13 @@ CAvailableApplicationInfo::CAvailableApplicationInfo(const ATL::CStringW& sFileN
     RetrieveGeneralInfo();
 }
 
+CAvailableApplicationInfo::CAvailableApplicationInfo()
+    : m_Category(0), m_IsSelected(FALSE), m_LicenseType(LICENSE_NONE),
+    m_IsInstalled(FALSE), m_HasLanguageInfo(FALSE), m_HasInstalledVersion(FALSE)
+{
+    ZeroMemory(&m_ftCacheStamp, sizeof(m_ftCacheStamp));
+}
+
 VOID CAvailableApplicationInfo::RefreshAppInfo()
 {
     if (m_szUrlDownload.IsEmpty())
@@ -213,6 +357,77 @@ VOID CAvailableApplicationInfo::SetLastWriteTime(FILETIME* ftTime)
     RtlCopyMemory(&m_ftCacheStamp, ftTime, sizeof(FILETIME));
 }
 
+VOID CAvailableApplicationInfo::WriteToIndex(CAppsIndexWriter& Writer) const
+{
+    Writer.WriteString(m_sFileName);
+    Writer.Write(&m_ftCacheStamp, sizeof(m_ftCacheStamp));
+    Writer.WriteDWORD(m_Category);
+    Writer.WriteDWORD(m_LicenseType);
+    Writer.WriteString(m_szName);
+    Writer.WriteString(m_szRegName);
+    Writer.WriteString(m_szVersion);
+    Writer.WriteString(m_szLicense);
+    Writer.WriteString(m_szDesc);
+    Writer.WriteString(m_szSize);
+    Writer.WriteString(m_szUrlSite);
+    Writer.WriteString(m_szUrlDownload);
+    Writer.WriteString(m_szCDPath);
+    Writer.WriteString(m_szSHA1);
+
+    Writer.WriteDWORD(m_HasLanguageInfo);
+    Writer.WriteDWORD(m_LanguageLCIDs.GetSize());
+    for (INT i = 0; i < m_LanguageLCIDs.GetSize(); ++i)
+    {
+        Writer.WriteDWORD(m_LanguageLCIDs[i]);
+    }
+}
+
+BOOL CAvailableApplicationInfo::ReadFromIndex(CAppsIndexReader& Reader)
+{
+    DWORD dwCategory, dwLicenseType, dwHasLanguageInfo, dwLanguages, dwLCID;
+
+    if (!Reader.ReadString(m_sFileName)
+        || !Reader.Read(&m_ftCacheStamp, sizeof(m_ftCacheStamp))
+        || !Reader.ReadDWORD(dwCategory)
+        || !Reader.ReadDWORD(dwLicenseType)
+        || !Reader.ReadString(m_szName)
+        || !Reader.ReadString(m_szRegName)
+        || !Reader.ReadString(m_szVersion)
+        || !Reader.ReadString(m_szLicense)
+        || !Reader.ReadString(m_szDesc)
+        || !Reader.ReadString(m_szSize)
+        || !Reader.ReadString(m_szUrlSite)
+        || !Reader.ReadString(m_szUrlDownload)
+        || !Reader.ReadString(m_szCDPath)
+        || !Reader.ReadString(m_szSHA1)
+        || !Reader.ReadDWORD(dwHasLanguageInfo)
+        || !Reader.ReadDWORD(dwLanguages))
+    {
+        return FALSE;
+    }
+
+    m_Category = dwCategory;
+    m_LicenseType = IsLicenseType(dwLicenseType) ? static_cast<LicenseType>(dwLicenseType) : LICENSE_NONE;
+    m_HasLanguageInfo = dwHasLanguageInfo;
+
+    for (DWORD i = 0; i < dwLanguages; ++i)
+    {
+        if (!Reader.ReadDWORD(dwLCID))
+            return FALSE;
+        m_LanguageLCIDs.Add(static_cast<LCID>(dwLCID));
+    }
+
+    // the installed state is not part of the database
+    RetrieveInstalledStatus();
+
+    if (m_IsInstalled)
+    {
+        RetrieveInstalledVersion();
+    }
+
+    return TRUE;
+}
+
 inline BOOL CAvailableApplicationInfo::GetString(LPCWSTR lpKeyName, ATL::CStringW& ReturnedString)
 {
     if (!m_Parser->GetString(lpKeyName, ReturnedString))
@@ -235,6 +450,7 @@ AvailableStrings::AvailableStrings()
         szCabDir = szPath;
         szCabPath = (szCabDir + L"\\") + szCabName;
         szSearchPath = szAppsPath + L"*.txt";
+        szIndexPath = (szPath + L"\\") + APPS_INDEX_NAME;
     }
 }
 // AvailableStrings
@@ -244,20 +460,182 @@ AvailableStrings CAvailableApps::m_Strings;
 
 CAvailableApps::CAvailableApps()
 {
+    ZeroMemory(&m_ftIndexStamp, sizeof(m_ftIndexStamp));
 }
 
-VOID CAvailableApps::FreeCachedEntries()
+VOID CAvailableApps::FreeInfoList(ATL::CAtlList<CAvailableApplicationInfo*>& InfoList)
 {
-    POSITION InfoListPosition = m_InfoList.GetHeadPosition();
+    POSITION InfoListPosition = InfoList.GetHeadPosition();
 
     /* loop and deallocate all the cached app infos in the list */
     while (InfoListPosition)
     {
-        CAvailableApplicationInfo* Info = m_InfoList.GetNext(InfoListPosition);
+        CAvailableApplicationInfo* Info = InfoList.GetNext(InfoListPosition);
         delete Info;
     }
 
-    m_InfoList.RemoveAll();
+    InfoList.RemoveAll();
+}
+
+VOID CAvailableApps::FreeCachedEntries()
+{
+    FreeInfoList(m_InfoList);
+}
+
+VOID CAvailableApps::GetIndexStamp(FILETIME* pftStamp)
+{
+    WIN32_FILE_ATTRIBUTE_DATA IndexData;
+
+    if (GetFileAttributesExW(m_Strings.szIndexPath.GetString(), GetFileExInfoStandard, &IndexData))
+    {
+        *pftStamp = IndexData.ftLastWriteTime;
+    }
+    else
+    {
+        ZeroMemory(pftStamp, sizeof(*pftStamp));
+    }
+}
+
+BOOL CAvailableApps::LoadAppsIndex(ATL::CAtlList<CAvailableApplicationInfo*>& InfoList)
+{
+    HANDLE hFile;
+    LARGE_INTEGER liSize;
+    PBYTE pData;
+    DWORD dwRead, dwCount;
+    FILETIME ftNewest;
+    AppsIndexHeader Header;
+    BOOL bSuccess = FALSE;
+
+    // the index is only good for the files it was made from
+    if (!ScanAppsDB(m_Strings.szSearchPath, &dwCount, &ftNewest))
+    {
+        return FALSE;
+    }
+
+    hFile = CreateFileW(m_Strings.szIndexPath.GetString(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return FALSE;
+    }
+
+    if (!GetFileSizeEx(hFile, &liSize) || liSize.HighPart || liSize.LowPart < sizeof(Header))
+    {
+        CloseHandle(hFile);
+        return FALSE;
+    }
+
+    pData = static_cast<PBYTE>(HeapAlloc(GetProcessHeap(), 0, liSize.LowPart));
+    if (!pData)
+    {
+        CloseHandle(hFile);
+        return FALSE;
+    }
+
+    if (ReadFile(hFile, pData, liSize.LowPart, &dwRead, NULL) && dwRead == liSize.LowPart)
+    {
+        CAppsIndexReader Reader(pData, dwRead);
+
+        if (Reader.Read(&Header, sizeof(Header))
+            && Header.Magic == APPS_INDEX_MAGIC
+            && Header.Version == APPS_INDEX_VERSION
+            && Header.Locale == GetUserDefaultLCID()
+            && Header.Count == dwCount
+            && CompareFileTime(&Header.ftNewest, &ftNewest) == 0)
+        {
+            bSuccess = TRUE;
+            for (DWORD i = 0; i < Header.Count && bSuccess; ++i)
+            {
+                CAvailableApplicationInfo* Info = new CAvailableApplicationInfo();
+
+                bSuccess = Info->ReadFromIndex(Reader);
+                if (bSuccess)
+                    InfoList.AddTail(Info);
+                else
+                    delete Info;
+            }
+
+            bSuccess = bSuccess && Reader.IsAtEnd();
+        }
+    }
+
+    HeapFree(GetProcessHeap(), 0, pData);
+    CloseHandle(hFile);
+
+    if (!bSuccess)
+    {
+        FreeInfoList(InfoList);
+    }
+
+    return bSuccess;
+}
+
+BOOL CAvailableApps::BuildAppsIndex(ATL::CAtlList<CAvailableApplicationInfo*>& InfoList)
+{
+    HANDLE hFind = INVALID_HANDLE_VALUE;
+    HANDLE hFile;
+    WIN32_FIND_DATAW FindFileData;
+    AppsIndexHeader Header;
+    ATL::CStringW szTempPath;
+    POSITION CurrentListPosition;
+    BOOL bWritten;
+
+    hFind = FindFirstFileW(m_Strings.szSearchPath.GetString(), &FindFileData);
+
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        //no db yet
+        return FALSE;
+    }
+
+    Header.Magic = APPS_INDEX_MAGIC;
+    Header.Version = APPS_INDEX_VERSION;
+    Header.Locale = GetUserDefaultLCID();
+    Header.Count = 0;
+    ZeroMemory(&Header.ftNewest, sizeof(Header.ftNewest));
+
+    do
+    {
+        // parse the file, this is the slow path
+        CAvailableApplicationInfo* Info = new CAvailableApplicationInfo(FindFileData.cFileName);
+
+        // set a timestamp for the next time
+        Info->SetLastWriteTime(&FindFileData.ftLastWriteTime);
+        InfoList.AddTail(Info);
+
+        Header.Count++;
+        if (CompareFileTime(&FindFileData.ftLastWriteTime, &Header.ftNewest) == 1)
+            Header.ftNewest = FindFileData.ftLastWriteTime;
+    } while (FindNextFileW(hFind, &FindFileData) != 0);
+
+    FindClose(hFind);
+
+    // write a new index aside and replace the old one with it at once
+    szTempPath = m_Strings.szIndexPath + L".tmp";
+    hFile = CreateFileW(szTempPath.GetString(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CAppsIndexWriter Writer(hFile);
+
+        Writer.Write(&Header, sizeof(Header));
+
+        CurrentListPosition = InfoList.GetHeadPosition();
+        while (CurrentListPosition != NULL)
+        {
+            InfoList.GetNext(CurrentListPosition)->WriteToIndex(Writer);
+        }
+
+        bWritten = Writer.Flush();
+        CloseHandle(hFile);
+
+        if (!bWritten || !MoveFileExW(szTempPath.GetString(), m_Strings.szIndexPath.GetString(), MOVEFILE_REPLACE_EXISTING))
+        {
+            DeleteFileW(szTempPath.GetString());
+        }
+    }
+
+    // the entries are good even when the index couldn't be written
+    return TRUE;
 }
 
 VOID CAvailableApps::DeleteCurrentAppsDB()
@@ -278,6 +656,7 @@ VOID CAvailableApps::DeleteCurrentAppsDB()
         FindClose(hFind);
     }
 
+    DeleteFileW(m_Strings.szIndexPath);
     RemoveDirectoryW(m_Strings.szAppsPath);
     RemoveDirectoryW(m_Strings.szPath);
 }
@@ -311,6 +690,11 @@ BOOL CAvailableApps::UpdateAppsDB()
 
     DeleteFileW(m_Strings.szCabPath);
 
+    // index the new database right away, loading the catalog only reads the index then
+    ATL::CAtlList<CAvailableApplicationInfo*> InfoList;
+    BuildAppsIndex(InfoList);
+    FreeInfoList(InfoList);
+
     return TRUE;
 }
 
@@ -322,58 +706,32 @@ BOOL CAvailableApps::ForceUpdateAppsDB()
 
 BOOL CAvailableApps::Enum(INT EnumType, AVAILENUMPROC lpEnumProc)
 {
+    FILETIME ftIndexStamp;
 
-    HANDLE hFind = INVALID_HANDLE_VALUE;
-    WIN32_FIND_DATAW FindFileData;
-
-    hFind = FindFirstFileW(m_Strings.szSearchPath.GetString(), &FindFileData);
-
-    if (hFind == INVALID_HANDLE_VALUE)
+    // has the database been updated since we loaded it?
+    GetIndexStamp(&ftIndexStamp);
+    if (!m_InfoList.IsEmpty() && CompareFileTime(&ftIndexStamp, &m_ftIndexStamp) != 0)
     {
-        //no db yet
-        return FALSE;
+        FreeCachedEntries();
     }
 
-    do
+    if (m_InfoList.IsEmpty())
     {
-        // loop for all the cached entries
-        POSITION CurrentListPosition = m_InfoList.GetHeadPosition();
-        CAvailableApplicationInfo* Info = NULL;
-
-        while (CurrentListPosition != NULL)
+        // parse the files only when the index is missing or out of date
+        if (!LoadAppsIndex(m_InfoList) && !BuildAppsIndex(m_InfoList))
         {
-            POSITION LastListPosition = CurrentListPosition;
-            Info = m_InfoList.GetNext(CurrentListPosition);
-
-            // do we already have this entry in cache?
-            if (Info->m_sFileName == FindFileData.cFileName)
-            {
-                // is it current enough, or the file has been modified since our last time here?
-                if (CompareFileTime(&FindFileData.ftLastWriteTime, &Info->m_ftCacheStamp) == 1)
-                {
-                    // recreate our cache, this is the slow path
-                    m_InfoList.RemoveAt(LastListPosition);
-
-                    delete Info;
-                    Info = NULL;
-                    break;
-                }
-                else
-                {
-                    // speedy path, compare directly, we already have the data
-                    goto skip_if_cached;
-                }
-            }
+            //no db yet
+            return FALSE;
         }
 
-        // create a new entry
-        Info = new CAvailableApplicationInfo(FindFileData.cFileName);
+        GetIndexStamp(&m_ftIndexStamp);
+    }
 
-        // set a timestamp for the next time
-        Info->SetLastWriteTime(&FindFileData.ftLastWriteTime);
-        m_InfoList.AddTail(Info);
+    POSITION CurrentListPosition = m_InfoList.GetHeadPosition();
+    while (CurrentListPosition != NULL)
+    {
+        CAvailableApplicationInfo* Info = m_InfoList.GetNext(CurrentListPosition);
 
-skip_if_cached:
         if (EnumType == Info->m_Category
             || EnumType == ENUM_ALL_AVAILABLE
             || (EnumType == ENUM_CAT_SELECTED && Info->m_IsSelected))
@@ -383,9 +741,8 @@ skip_if_cached:
             if (lpEnumProc)
                 lpEnumProc(Info, m_Strings.szAppsPath.GetString());
         }
-    } while (FindNextFileW(hFind, &FindFileData) != 0);
+    }
 
-    FindClose(hFind);
     return TRUE;
 }
 
@@ -22,6 +22,10 @@ inline BOOL IsLicenseType(INT x)
     return (x >= LICENSE_MIN && x <= LICENSE_MAX);
 }
 
+// Binary index of the database (available.cpp)
+class CAppsIndexReader;
+class CAppsIndexWriter;
+
 struct CAvailableApplicationInfo
 {
     INT m_Category;
@@ -48,6 +52,8 @@ struct CAvailableApplicationInfo
 
     // Create an object from file
     CAvailableApplicationInfo(const ATL::CStringW& sFileNameParam);
+    // Create an empty object, to be read from the index
+    CAvailableApplicationInfo();
 
     // Load all info from the file
     VOID RefreshAppInfo();
@@ -61,6 +67,10 @@ struct CAvailableApplicationInfo
     // Set a timestamp
     VOID SetLastWriteTime(FILETIME* ftTime);
 
+    // Store the info in the index, or load it from there
+    VOID WriteToIndex(CAppsIndexWriter& Writer) const;
+    BOOL ReadFromIndex(CAppsIndexReader& Reader);
+
 private:
     BOOL m_IsInstalled;
     BOOL m_HasLanguageInfo;
@@ -89,6 +99,7 @@ struct AvailableStrings
     ATL::CStringW szSearchPath;
     ATL::CStringW szCabName;
     ATL::CStringW szCabDir;
+    ATL::CStringW szIndexPath;
 
     AvailableStrings();
 };
@@ -97,6 +108,12 @@ class CAvailableApps
 {
     static AvailableStrings m_Strings;
     ATL::CAtlList<CAvailableApplicationInfo*> m_InfoList;
+    FILETIME m_ftIndexStamp;
+
+    static VOID FreeInfoList(ATL::CAtlList<CAvailableApplicationInfo*>& InfoList);
+    static VOID GetIndexStamp(FILETIME* pftStamp);
+    static BOOL LoadAppsIndex(ATL::CAtlList<CAvailableApplicationInfo*>& InfoList);
+    static BOOL BuildAppsIndex(ATL::CAtlList<CAvailableApplicationInfo*>& InfoList);
 
 public:
     CAvailableApps();
@@ -3,11 +3,14 @@
 #include "available.h"
 
 #include <windef.h>
+#include <wininet.h>
 #include <atlsimpcoll.h>
 
 // Download dialog (loaddlg.cpp)
 class CDowloadingAppsListView;
 struct DownloadInfo;
+struct DownloadParam;
+struct DownloadTask;
 
 class CDownloadManager
 {
@@ -16,6 +19,8 @@ class CDownloadManager
 
     static VOID Download(const DownloadInfo& DLInfo, BOOL bIsModal = FALSE);
     static VOID SetProgressMarquee(HWND Item, BOOL Enable);
+    static BOOL DownloadFile(DownloadParam* param, DownloadTask& Task, HINTERNET hOpen);
+    static DWORD WINAPI DownloadThreadFunc(LPVOID Context);
 
 public:
     static INT_PTR CALLBACK DownloadDlgProc(HWND Dlg, UINT uMsg, WPARAM wParam, LPARAM lParam);
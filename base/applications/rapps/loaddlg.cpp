@@ -51,6 +51,12 @@
 #define CERT_SUBJECT_INFO "rapps.reactos.org"
 #endif
 
+#define MAX_CONCURRENT_DOWNLOADS 3
+
+#ifndef HTTP_STATUS_RANGE_NOT_SATISFIABLE
+#define HTTP_STATUS_RANGE_NOT_SATISFIABLE 416
+#endif
+
 enum DownloadStatus
 {
     DLSTATUS_WAITING = IDS_STATUS_WAITING,
@@ -81,17 +87,41 @@ struct DownloadInfo
     ATL::CStringW szSHA1;
 };
 
+struct DownloadTask
+{
+    DownloadTask() : iAppId(0), bCab(FALSE), bDownloaded(FALSE), bSucceeded(FALSE), hDone(NULL) {}
+
+    INT iAppId;
+    ATL::CStringW szPath;
+    BOOL bCab;
+    BOOL bDownloaded;   // the file was fetched now, it wasn't already in the download folder
+    BOOL bSucceeded;
+    HANDLE hDone;       // set once the file is ready or the download failed
+};
+
 struct DownloadParam
 {
-    DownloadParam() : Dialog(NULL), AppInfo(), szCaption(NULL) {}
+    DownloadParam()
+        : Dialog(NULL), AppInfo(), szCaption(NULL),
+        Tasks(NULL), NextTask(0), bCancelled(FALSE), TotalProgress(0), TotalProgressMax(0)
+    {
+    }
     DownloadParam(HWND dlg, const ATL::CSimpleArray<DownloadInfo> &info, LPCWSTR caption)
-        : Dialog(dlg), AppInfo(info), szCaption(caption)
+        : Dialog(dlg), AppInfo(info), szCaption(caption),
+        Tasks(NULL), NextTask(0), bCancelled(FALSE), TotalProgress(0), TotalProgressMax(0)
     {
     }
 
     HWND Dialog;
     ATL::CSimpleArray<DownloadInfo> AppInfo;
     LPCWSTR szCaption;
+
+    // shared by the download threads
+    DownloadTask* Tasks;
+    volatile LONG NextTask;
+    BOOL bCancelled;
+    volatile LONG TotalProgress;    // sum over the downloads of a known size
+    volatile LONG TotalProgressMax;
 };
 
 
@@ -156,7 +186,7 @@ public:
             /* use our subclassed progress bar text subroutine */
             ATL::CStringW m_ProgressText;
 
-            if (ulProgressMax)
+            if (ulProgressMax && ulProgress <= ulProgressMax)
             {
                 /* total size is known */
                 WCHAR szProgressMax[100];
@@ -572,164 +602,124 @@ VOID CDownloadManager::SetProgressMarquee(HWND Item, BOOL Enable)
     SendMessageW(Item, PBM_SETMARQUEE, Enable, 0);
 }
 
-DWORD WINAPI CDownloadManager::ThreadFunc(LPVOID param)
+BOOL CDownloadManager::DownloadFile(DownloadParam* param, DownloadTask& Task, HINTERNET hOpen)
 {
     CComPtr<IBindStatusCallback> dl;
     ATL::CStringW Path;
-    PWSTR p, q;
+    ATL::CStringW szPartPath;
+    ATL::CStringW szHeaders;
+    PWSTR p;
 
-    HWND hDlg = static_cast<DownloadParam*>(param)->Dialog;
-    HWND Item;
-    INT iAppId;
+    const DownloadInfo &Info = param->AppInfo[Task.iAppId];
+    HWND hDlg = param->Dialog;
+    HWND Item = GetDlgItem(hDlg, IDC_DOWNLOAD_PROGRESS);
 
     ULONG dwContentLen, dwBytesWritten, dwBytesRead, dwStatus;
     ULONG dwCurrentBytesRead = 0;
-    ULONG dwStatusLen = sizeof(dwStatus);
+    ULONG dwOffset = 0;
+    ULONG dwStatusLen;
+    ULONG ulProgress;
 
-    BOOL bCancelled = FALSE;
-    BOOL bTempfile = FALSE;
-    BOOL bCab = FALSE;
+    BOOL bSuccess = FALSE;
 
-    HINTERNET hOpen = NULL;
     HINTERNET hFile = NULL;
     HANDLE hOut = INVALID_HANDLE_VALUE;
+    WIN32_FILE_ATTRIBUTE_DATA PartData;
 
     unsigned char lpBuffer[4096];
-    LPCWSTR lpszAgent = L"RApps/1.0";
     URL_COMPONENTS urlComponents;
-    size_t urlLength, filenameLength;
-
-    const ATL::CSimpleArray<DownloadInfo> &InfoArray = static_cast<DownloadParam*>(param)->AppInfo;
-    LPCWSTR szCaption = static_cast<DownloadParam*>(param)->szCaption;
-    ATL::CStringW szNewCaption;
+    size_t urlLength;
 
     const DWORD dwUrlConnectFlags = INTERNET_FLAG_DONT_CACHE | INTERNET_FLAG_PRAGMA_NOCACHE | INTERNET_FLAG_KEEP_CONNECTION;
 
-    if (InfoArray.GetSize() <= 0)
+    memset(&urlComponents, 0, sizeof(urlComponents));
+
+    // is this URL an update package for RAPPS? if so store it in a different place
+    if (Task.bCab)
     {
-        MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_DOWNLOAD);
-        goto end;
+        if (!GetStorageDirectory(Path))
+            goto end;
     }
-
-    for (iAppId = 0; iAppId < InfoArray.GetSize(); ++iAppId)
+    else
     {
-        // Reset progress bar
-        Item = GetDlgItem(hDlg, IDC_DOWNLOAD_PROGRESS);
-        if (Item)
-        {
-            SetProgressMarquee(Item, FALSE);
-            SendMessageW(Item, WM_SETTEXT, 0, (LPARAM) L"");
-            SendMessageW(Item, PBM_SETPOS, 0, 0);
-        }
-
-        // is this URL an update package for RAPPS? if so store it in a different place
-        if (InfoArray[iAppId].szUrl == APPLICATION_DATABASE_URL)
-        {
-            bCab = TRUE;
-            if (!GetStorageDirectory(Path))
-                goto end;
-        }
-        else
-        {
-            bCab = FALSE;
-            Path = SettingsInfo.szDownloadDir;
-        }
-
-        // Change caption to show the currently downloaded app
-        if (!bCab)
-        {
-            szNewCaption.Format(szCaption, InfoArray[iAppId].szName.GetString());
-        }
-        else
-        {
-            szNewCaption.LoadStringW(IDS_DL_DIALOG_DB_DOWNLOAD_DISP);
-        }
+        Path = SettingsInfo.szDownloadDir;
+    }
 
-        SetWindowTextW(hDlg, szNewCaption.GetString());
+    // build the path for the download
+    p = wcsrchr(Info.szUrl.GetString(), L'/');
 
-        // build the path for the download
-        p = wcsrchr(InfoArray[iAppId].szUrl.GetString(), L'/');
-        q = wcsrchr(InfoArray[iAppId].szUrl.GetString(), L'?');
+    // do we have a final slash separator?
+    if (!p)
+        goto end;
 
-        // do we have a final slash separator?
-        if (!p)
+    // is the path valid? can we access it?
+    if (GetFileAttributesW(Path.GetString()) == INVALID_FILE_ATTRIBUTES)
+    {
+        if (!CreateDirectoryW(Path.GetString(), NULL))
             goto end;
+    }
 
-        // prepare the tentative length of the filename, maybe we've to remove part of it later on
-        filenameLength = wcslen(p) * sizeof(WCHAR);
-
-        /* do we have query arguments in the target URL after the filename? account for them
-        (e.g. https://example.org/myfile.exe?no_adware_plz) */
-        if (q && q > p && (q - p) > 0)
-            filenameLength -= wcslen(q - 1) * sizeof(WCHAR);
-
-        // is the path valid? can we access it?
-        if (GetFileAttributesW(Path.GetString()) == INVALID_FILE_ATTRIBUTES)
-        {
-            if (!CreateDirectoryW(Path.GetString(), NULL))
-                goto end;
-        }
-
-        // append a \ to the provided file system path, and the filename portion from the URL after that
-        Path += L"\\";
-        Path += (LPWSTR) (p + 1);
-
-        if (!bCab && InfoArray[iAppId].szSHA1[0] && GetFileAttributesW(Path.GetString()) != INVALID_FILE_ATTRIBUTES)
-        {
-            // only open it in case of total correctness
-            if (VerifyInteg(InfoArray[iAppId].szSHA1.GetString(), Path))
-                goto run;
-        }
-
-        // Add the download URL
-        SetDlgItemTextW(hDlg, IDC_DOWNLOAD_STATUS, InfoArray[iAppId].szUrl.GetString());
+    // append a \ to the provided file system path, and the filename portion from the URL after that
+    Path += L"\\";
+    Path += (LPWSTR) (p + 1);
+    Task.szPath = Path;
 
-        DownloadsListView.SetDownloadStatus(iAppId, DLSTATUS_DOWNLOADING);
+    if (!Task.bCab && Info.szSHA1[0] && GetFileAttributesW(Path.GetString()) != INVALID_FILE_ATTRIBUTES)
+    {
+        // only open it in case of total correctness
+        if (VerifyInteg(Info.szSHA1.GetString(), Path))
+            return TRUE;
+    }
 
-        // download it
-        bTempfile = TRUE;
-        CDownloadDialog_Constructor(hDlg, &bCancelled, IID_PPV_ARG(IBindStatusCallback, &dl));
+    // Add the download URL
+    SetDlgItemTextW(hDlg, IDC_DOWNLOAD_STATUS, Info.szUrl.GetString());
 
-        if (dl == NULL)
-            goto end;
+    DownloadsListView.SetDownloadStatus(Task.iAppId, DLSTATUS_DOWNLOADING);
 
-        /* FIXME: this should just be using the system-wide proxy settings */
-        switch (SettingsInfo.Proxy)
-        {
-        case 0: // preconfig
-        default:
-            hOpen = InternetOpenW(lpszAgent, INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0);
-            break;
-        case 1: // direct (no proxy)
-            hOpen = InternetOpenW(lpszAgent, INTERNET_OPEN_TYPE_DIRECT, NULL, NULL, 0);
-            break;
-        case 2: // use proxy
-            hOpen = InternetOpenW(lpszAgent, INTERNET_OPEN_TYPE_PROXY, SettingsInfo.szProxyServer, SettingsInfo.szNoProxyFor, 0);
-            break;
-        }
+    // download it
+    CDownloadDialog_Constructor(hDlg, &param->bCancelled, IID_PPV_ARG(IBindStatusCallback, &dl));
 
-        if (!hOpen)
-            goto end;
+    if (dl == NULL)
+        goto end;
 
-        dwStatusLen = sizeof(dwStatus);
+    // the file is downloaded next to its final place, so an interrupted download can be resumed
+    szPartPath = Path + L".part";
+    if (Task.bCab)
+    {
+        // the database is always fetched anew
+        DeleteFileW(szPartPath.GetString());
+    }
+    else if (GetFileAttributesExW(szPartPath.GetString(), GetFileExInfoStandard, &PartData) &&
+             !PartData.nFileSizeHigh)
+    {
+        dwOffset = PartData.nFileSizeLow;
+    }
 
-        memset(&urlComponents, 0, sizeof(urlComponents));
-        urlComponents.dwStructSize = sizeof(urlComponents);
+    urlComponents.dwStructSize = sizeof(urlComponents);
 
-        urlLength = InfoArray[iAppId].szUrl.GetLength();
-        urlComponents.dwSchemeLength = urlLength + 1;
-        urlComponents.lpszScheme = (LPWSTR) malloc(urlComponents.dwSchemeLength * sizeof(WCHAR));
-        urlComponents.dwHostNameLength = urlLength + 1;
-        urlComponents.lpszHostName = (LPWSTR) malloc(urlComponents.dwHostNameLength * sizeof(WCHAR));
+    urlLength = Info.szUrl.GetLength();
+    urlComponents.dwSchemeLength = urlLength + 1;
+    urlComponents.lpszScheme = (LPWSTR) malloc(urlComponents.dwSchemeLength * sizeof(WCHAR));
+    urlComponents.dwHostNameLength = urlLength + 1;
+    urlComponents.lpszHostName = (LPWSTR) malloc(urlComponents.dwHostNameLength * sizeof(WCHAR));
 
-        if (!InternetCrackUrlW(InfoArray[iAppId].szUrl, urlLength + 1, ICU_DECODE | ICU_ESCAPE, &urlComponents))
-            goto end;
+    if (!InternetCrackUrlW(Info.szUrl, urlLength + 1, ICU_DECODE | ICU_ESCAPE, &urlComponents))
+        goto end;
 
-        dwContentLen = 0;
+    dwContentLen = 0;
 
-        if (urlComponents.nScheme == INTERNET_SCHEME_HTTP || urlComponents.nScheme == INTERNET_SCHEME_HTTPS)
+    if (urlComponents.nScheme == INTERNET_SCHEME_HTTP || urlComponents.nScheme == INTERNET_SCHEME_HTTPS)
+    {
+        for (;;)
         {
-            hFile = InternetOpenUrlW(hOpen, InfoArray[iAppId].szUrl.GetString(), NULL, 0,
+            // ask only for what is missing from the partial file
+            if (dwOffset)
+                szHeaders.Format(L"Range: bytes=%lu-\r\n", dwOffset);
+            else
+                szHeaders.Empty();
+
+            hFile = InternetOpenUrlW(hOpen, Info.szUrl.GetString(),
+                                     szHeaders.IsEmpty() ? NULL : szHeaders.GetString(), szHeaders.GetLength(),
                                      dwUrlConnectFlags,
                                      0);
             if (!hFile)
@@ -739,150 +729,328 @@ DWORD WINAPI CDownloadManager::ThreadFunc(LPVOID param)
             }
 
             // query connection
+            dwStatusLen = sizeof(dwStatus);
             if (!HttpQueryInfoW(hFile, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &dwStatus, &dwStatusLen, NULL))
                 goto end;
 
-            if (dwStatus != HTTP_STATUS_OK)
+            if (dwStatus == HTTP_STATUS_PARTIAL_CONTENT && dwOffset)
+                break;
+
+            if (dwStatus == HTTP_STATUS_OK)
+            {
+                // the server ignored the range, start over
+                dwOffset = 0;
+                break;
+            }
+
+            if (dwStatus != HTTP_STATUS_RANGE_NOT_SATISFIABLE || !dwOffset)
             {
                 MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_DOWNLOAD);
                 goto end;
             }
 
-            // query content length
-            HttpQueryInfoW(hFile, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER, &dwContentLen, &dwStatusLen, NULL);
+            // the partial file doesn't match the one on the server
+            InternetCloseHandle(hFile);
+            hFile = NULL;
+            dwOffset = 0;
         }
 
-        if (urlComponents.nScheme == INTERNET_SCHEME_FTP)
+        // query content length, a partial content reports the missing part
+        dwStatusLen = sizeof(dwContentLen);
+        if (HttpQueryInfoW(hFile, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER, &dwContentLen, &dwStatusLen, NULL) &&
+            dwContentLen)
         {
-            // force passive mode on FTP
-            hFile = InternetOpenUrlW(hOpen, InfoArray[iAppId].szUrl.GetString(), NULL, 0,
-                                     dwUrlConnectFlags | INTERNET_FLAG_PASSIVE,
-                                     0);
-            if (!hFile)
-            {
-                MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_DOWNLOAD2);
-                goto end;
-            }
-
-            dwContentLen = FtpGetFileSize(hFile, &dwStatus);
+            dwContentLen += dwOffset;
+        }
+        else
+        {
+            dwContentLen = 0;
         }
+    }
 
-        if (!dwContentLen)
+    if (urlComponents.nScheme == INTERNET_SCHEME_FTP)
+    {
+        // force passive mode on FTP
+        hFile = InternetOpenUrlW(hOpen, Info.szUrl.GetString(), NULL, 0,
+                                 dwUrlConnectFlags | INTERNET_FLAG_PASSIVE,
+                                 0);
+        if (!hFile)
         {
-            // content-length is not known, enable marquee mode
-            SetProgressMarquee(Item, TRUE);
+            MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_DOWNLOAD2);
+            goto end;
         }
 
-        free(urlComponents.lpszScheme);
-        free(urlComponents.lpszHostName);
+        // no resuming over FTP
+        dwOffset = 0;
+        dwContentLen = FtpGetFileSize(hFile, &dwStatus);
+    }
+
+    if (dwContentLen)
+    {
+        InterlockedExchangeAdd(&param->TotalProgressMax, dwContentLen);
+        InterlockedExchangeAdd(&param->TotalProgress, dwOffset);
+    }
+    else if (!param->TotalProgressMax)
+    {
+        // content-length is not known, enable marquee mode
+        SetProgressMarquee(Item, TRUE);
+    }
 
 #ifdef USE_CERT_PINNING
-        // are we using HTTPS to download the RAPPS update package? check if the certificate is original
-        if ((urlComponents.nScheme == INTERNET_SCHEME_HTTPS) &&
-            (wcscmp(InfoArray[iAppId].szUrl, APPLICATION_DATABASE_URL) == 0))
+    // are we using HTTPS to download the RAPPS update package? check if the certificate is original
+    if ((urlComponents.nScheme == INTERNET_SCHEME_HTTPS) && Task.bCab)
+    {
+        CLocalPtr subjectName, issuerName;
+        CStringW szMsgText;
+        bool bAskQuestion = false;
+        if (!CertGetSubjectAndIssuer(hFile, subjectName, issuerName))
         {
-            CLocalPtr subjectName, issuerName;
-            CStringW szMsgText;
-            bool bAskQuestion = false;
-            if (!CertGetSubjectAndIssuer(hFile, subjectName, issuerName))
+            szMsgText.LoadStringW(IDS_UNABLE_TO_QUERY_CERT);
+            bAskQuestion = true;
+        }
+        else
+        {
+            if (strcmp(subjectName, CERT_SUBJECT_INFO) ||
+                strcmp(issuerName, CERT_ISSUER_INFO))
             {
-                szMsgText.LoadStringW(IDS_UNABLE_TO_QUERY_CERT);
+                szMsgText.Format(IDS_MISMATCH_CERT_INFO, (char*)subjectName, (const char*)issuerName);
                 bAskQuestion = true;
             }
-            else
-            {
-                if (strcmp(subjectName, CERT_SUBJECT_INFO) ||
-                    strcmp(issuerName, CERT_ISSUER_INFO))
-                {
-                    szMsgText.Format(IDS_MISMATCH_CERT_INFO, (char*)subjectName, (const char*)issuerName);
-                    bAskQuestion = true;
-                }
-            }
+        }
 
-            if (bAskQuestion)
+        if (bAskQuestion)
+        {
+            if (MessageBoxW(hMainWnd, szMsgText.GetString(), NULL, MB_YESNO | MB_ICONERROR) != IDYES)
             {
-                if (MessageBoxW(hMainWnd, szMsgText.GetString(), NULL, MB_YESNO | MB_ICONERROR) != IDYES)
-                {
-                    goto end;
-                }
+                goto end;
             }
         }
+    }
 #endif
 
-        hOut = CreateFileW(Path.GetString(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, 0, NULL);
+    hOut = CreateFileW(szPartPath.GetString(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                       dwOffset ? OPEN_EXISTING : CREATE_ALWAYS, 0, NULL);
 
-        if (hOut == INVALID_HANDLE_VALUE)
+    if (hOut == INVALID_HANDLE_VALUE)
+        goto end;
+
+    if (dwOffset)
+    {
+        SetFilePointer(hOut, dwOffset, NULL, FILE_BEGIN);
+        SetEndOfFile(hOut);
+    }
+
+    dwCurrentBytesRead = dwOffset;
+    do
+    {
+        if (!InternetReadFile(hFile, lpBuffer, _countof(lpBuffer), &dwBytesRead))
+        {
+            MessageBox_LoadString(hMainWnd, IDS_INTERRUPTED_DOWNLOAD);
             goto end;
+        }
 
-        dwCurrentBytesRead = 0;
-        do
+        if (!WriteFile(hOut, &lpBuffer[0], dwBytesRead, &dwBytesWritten, NULL))
         {
-            if (!InternetReadFile(hFile, lpBuffer, _countof(lpBuffer), &dwBytesRead))
-            {
-                MessageBox_LoadString(hMainWnd, IDS_INTERRUPTED_DOWNLOAD);
-                goto end;
-            }
+            MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_WRITE);
+            goto end;
+        }
 
-            if (!WriteFile(hOut, &lpBuffer[0], dwBytesRead, &dwBytesWritten, NULL))
-            {
-                MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_WRITE);
-                goto end;
-            }
+        dwCurrentBytesRead += dwBytesRead;
 
-            dwCurrentBytesRead += dwBytesRead;
-            dl->OnProgress(dwCurrentBytesRead, dwContentLen, 0, InfoArray[iAppId].szUrl.GetString());
-        } while (dwBytesRead && !bCancelled);
+        // the progress bar shows all the downloads, or this one when no size is known
+        if (dwContentLen)
+            ulProgress = InterlockedExchangeAdd(&param->TotalProgress, dwBytesRead) + dwBytesRead;
+        else
+            ulProgress = param->TotalProgressMax ? param->TotalProgress : dwCurrentBytesRead;
 
-        CloseHandle(hOut);
-        hOut = INVALID_HANDLE_VALUE;
+        dl->OnProgress(ulProgress, param->TotalProgressMax, 0, Info.szUrl.GetString());
+    } while (dwBytesRead && !param->bCancelled);
 
-        if (bCancelled)
-            goto end;
+    CloseHandle(hOut);
+    hOut = INVALID_HANDLE_VALUE;
+
+    if (param->bCancelled)
+        goto end;
+
+    if (!dwContentLen && !param->TotalProgressMax)
+    {
+        // set progress bar to 100%
+        SetProgressMarquee(Item, FALSE);
+
+        dl->OnProgress(dwCurrentBytesRead, dwCurrentBytesRead, 0, Info.szUrl.GetString());
+    }
+
+    if (!MoveFileExW(szPartPath.GetString(), Path.GetString(), MOVEFILE_REPLACE_EXISTING))
+    {
+        MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_WRITE);
+        goto end;
+    }
+    Task.bDownloaded = TRUE;
+
+    /* if this thing isn't a RAPPS update and it has a SHA-1 checksum
+    verify its integrity by using the native advapi32.A_SHA1 functions */
+    if (!Task.bCab && Info.szSHA1[0] != 0)
+    {
+        ATL::CStringW szMsgText;
 
-        if (!dwContentLen)
+        // this may take a while, depending on the file size
+        if (!VerifyInteg(Info.szSHA1.GetString(), Path.GetString()))
         {
-            // set progress bar to 100%
-            SetProgressMarquee(Item, FALSE);
+            // don't resume from a broken file next time
+            DeleteFileW(Path.GetString());
 
-            dwContentLen = dwCurrentBytesRead;
-            dl->OnProgress(dwCurrentBytesRead, dwContentLen, 0, InfoArray[iAppId].szUrl.GetString());
+            if (!szMsgText.LoadStringW(IDS_INTEG_CHECK_FAIL))
+                goto end;
+
+            MessageBoxW(hDlg, szMsgText.GetString(), NULL, MB_OK | MB_ICONERROR);
+            goto end;
         }
+    }
+
+    bSuccess = TRUE;
+
+end:
+    if (hOut != INVALID_HANDLE_VALUE)
+        CloseHandle(hOut);
+
+    InternetCloseHandle(hFile);
+
+    free(urlComponents.lpszScheme);
+    free(urlComponents.lpszHostName);
+
+    // an interrupted application download is kept to be resumed, a database one is not
+    if (!bSuccess && Task.bCab && !szPartPath.IsEmpty())
+        DeleteFileW(szPartPath.GetString());
+
+    return bSuccess;
+}
+
+DWORD WINAPI CDownloadManager::DownloadThreadFunc(LPVOID param)
+{
+    DownloadParam *pParam = static_cast<DownloadParam*>(param);
+    HINTERNET hOpen = NULL;
+    LPCWSTR lpszAgent = L"RApps/1.0";
+    LONG iTask;
+
+    /* FIXME: this should just be using the system-wide proxy settings */
+    switch (SettingsInfo.Proxy)
+    {
+    case 0: // preconfig
+    default:
+        hOpen = InternetOpenW(lpszAgent, INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0);
+        break;
+    case 1: // direct (no proxy)
+        hOpen = InternetOpenW(lpszAgent, INTERNET_OPEN_TYPE_DIRECT, NULL, NULL, 0);
+        break;
+    case 2: // use proxy
+        hOpen = InternetOpenW(lpszAgent, INTERNET_OPEN_TYPE_PROXY, SettingsInfo.szProxyServer, SettingsInfo.szNoProxyFor, 0);
+        break;
+    }
+
+    // take the next application that nobody downloads yet
+    while ((iTask = InterlockedIncrement(&pParam->NextTask) - 1) < pParam->AppInfo.GetSize())
+    {
+        DownloadTask &Task = pParam->Tasks[iTask];
+
+        if (hOpen && !pParam->bCancelled)
+            Task.bSucceeded = DownloadFile(pParam, Task, hOpen);
+
+        if (Task.bSucceeded)
+            DownloadsListView.SetDownloadStatus(iTask, DLSTATUS_WAITING_INSTALL);
 
-        /* if this thing isn't a RAPPS update and it has a SHA-1 checksum
-        verify its integrity by using the native advapi32.A_SHA1 functions */
-        if (!bCab && InfoArray[iAppId].szSHA1[0] != 0)
+        SetEvent(Task.hDone);
+    }
+
+    if (hOpen)
+        InternetCloseHandle(hOpen);
+
+    return 0;
+}
+
+DWORD WINAPI CDownloadManager::ThreadFunc(LPVOID param)
+{
+    DownloadParam *pParam = static_cast<DownloadParam*>(param);
+    HWND hDlg = pParam->Dialog;
+    HWND Item;
+    INT iAppId;
+    INT nTasks;
+    INT nThreads = 0;
+    HANDLE hThreads[MAX_CONCURRENT_DOWNLOADS];
+
+    const ATL::CSimpleArray<DownloadInfo> &InfoArray = pParam->AppInfo;
+    LPCWSTR szCaption = pParam->szCaption;
+    ATL::CStringW szNewCaption;
+
+    nTasks = InfoArray.GetSize();
+    if (nTasks <= 0)
+    {
+        MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_DOWNLOAD);
+        goto end;
+    }
+
+    pParam->Tasks = new DownloadTask[nTasks];
+    for (iAppId = 0; iAppId < nTasks; ++iAppId)
+    {
+        pParam->Tasks[iAppId].iAppId = iAppId;
+        pParam->Tasks[iAppId].bCab = (InfoArray[iAppId].szUrl == APPLICATION_DATABASE_URL);
+        pParam->Tasks[iAppId].hDone = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (!pParam->Tasks[iAppId].hDone)
         {
-            ATL::CStringW szMsgText;
+            MessageBox_LoadString(hMainWnd, IDS_UNABLE_TO_DOWNLOAD);
+            goto end;
+        }
+    }
 
-            // change a few strings in the download dialog to reflect the verification process
-            if (!szMsgText.LoadStringW(IDS_INTEG_CHECK_TITLE))
-                goto end;
+    // Reset progress bar
+    Item = GetDlgItem(hDlg, IDC_DOWNLOAD_PROGRESS);
+    if (Item)
+    {
+        SetProgressMarquee(Item, FALSE);
+        SendMessageW(Item, WM_SETTEXT, 0, (LPARAM) L"");
+        SendMessageW(Item, PBM_SETPOS, 0, 0);
+    }
 
-            SetWindowTextW(hDlg, szMsgText.GetString());
-            SendMessageW(GetDlgItem(hDlg, IDC_DOWNLOAD_STATUS), WM_SETTEXT, 0, (LPARAM) Path.GetString());
+    // several applications are downloaded at once, while this thread installs them in order
+    while (nThreads < min(nTasks, MAX_CONCURRENT_DOWNLOADS))
+    {
+        hThreads[nThreads] = CreateThread(NULL, 0, DownloadThreadFunc, (LPVOID) pParam, 0, NULL);
+        if (!hThreads[nThreads])
+            break;
+        nThreads++;
+    }
 
-            // this may take a while, depending on the file size
-            if (!VerifyInteg(InfoArray[iAppId].szSHA1.GetString(), Path.GetString()))
-            {
-                if (!szMsgText.LoadStringW(IDS_INTEG_CHECK_FAIL))
-                    goto end;
+    if (!nThreads)
+    {
+        // download everything first, then
+        DownloadThreadFunc(pParam);
+    }
 
-                MessageBoxW(hDlg, szMsgText.GetString(), NULL, MB_OK | MB_ICONERROR);
-                goto end;
-            }
+    for (iAppId = 0; iAppId < nTasks; ++iAppId)
+    {
+        DownloadTask &Task = pParam->Tasks[iAppId];
+
+        // Change caption to show the app we wait for
+        if (!Task.bCab)
+        {
+            szNewCaption.Format(szCaption, InfoArray[iAppId].szName.GetString());
+        }
+        else
+        {
+            szNewCaption.LoadStringW(IDS_DL_DIALOG_DB_DOWNLOAD_DISP);
         }
 
-run:
-        DownloadsListView.SetDownloadStatus(iAppId, DLSTATUS_WAITING_INSTALL);
+        SetWindowTextW(hDlg, szNewCaption.GetString());
+
+        WaitForSingleObject(Task.hDone, INFINITE);
 
         // run it
-        if (!bCab)
+        if (Task.bSucceeded && !pParam->bCancelled && !Task.bCab)
         {
             SHELLEXECUTEINFOW shExInfo = {0};
             shExInfo.cbSize = sizeof(shExInfo);
             shExInfo.fMask = SEE_MASK_NOCLOSEPROCESS;
             shExInfo.lpVerb = L"open";
-            shExInfo.lpFile = Path.GetString();
+            shExInfo.lpFile = Task.szPath.GetString();
             shExInfo.lpParameters = L"";
             shExInfo.nShow = SW_SHOW;
 
@@ -895,7 +1063,6 @@ run:
 
                 DownloadsListView.SetDownloadStatus(iAppId, DLSTATUS_INSTALLING);
 
-                //TODO: issue an install operation separately so that the apps could be downloaded in the background
                 WaitForSingleObject(shExInfo.hProcess, INFINITE);
                 CloseHandle(shExInfo.hProcess);
             }
@@ -905,23 +1072,31 @@ run:
             }
         }
 
-end:
-        if (hOut != INVALID_HANDLE_VALUE)
-            CloseHandle(hOut);
+        if (Task.bDownloaded && SettingsInfo.bDelInstaller && !Task.bCab)
+            DeleteFileW(Task.szPath.GetString());
 
-        InternetCloseHandle(hFile);
-        InternetCloseHandle(hOpen);
+        DownloadsListView.SetDownloadStatus(iAppId, DLSTATUS_FINISHED);
+    }
 
-        if (bTempfile)
+end:
+    if (nThreads)
+    {
+        WaitForMultipleObjects(nThreads, hThreads, TRUE, INFINITE);
+        while (nThreads--)
+            CloseHandle(hThreads[nThreads]);
+    }
+
+    if (pParam->Tasks)
+    {
+        for (iAppId = 0; iAppId < nTasks; ++iAppId)
         {
-            if (bCancelled || (SettingsInfo.bDelInstaller && !bCab))
-                DeleteFileW(Path.GetString());
+            if (pParam->Tasks[iAppId].hDone)
+                CloseHandle(pParam->Tasks[iAppId].hDone);
         }
-
-        DownloadsListView.SetDownloadStatus(iAppId, DLSTATUS_FINISHED);
+        delete[] pParam->Tasks;
     }
 
-    delete static_cast<DownloadParam*>(param);
+    delete pParam;
     SendMessageW(hDlg, WM_CLOSE, 0, 0);
     return 0;
 }
@@ -55,6 +55,10 @@ const PresetColumnEntry ColumnPresets[COLUMN_NMAX] = {
     DECLARE_COLUMN_PRESET(IOWRITEBYTES,      70, FALSE)
     DECLARE_COLUMN_PRESET(IOOTHERBYTES,      70, FALSE)
     DECLARE_COLUMN_PRESET(COMMANDLINE,      450, FALSE)
+    DECLARE_COLUMN_PRESET(HANDLECREATES,     70, FALSE)
+    DECLARE_COLUMN_PRESET(HANDLECLOSES,      70, FALSE)
+    DECLARE_COLUMN_PRESET(HANDLEDUPLICATES,  70, FALSE)
+    DECLARE_COLUMN_PRESET(HANDLELOOKUPS,     70, FALSE)
 };
 
 static int          InsertColumn(int nCol, LPCWSTR lpszColumnHeading, int nFormat, int nWidth, int nSubItem);
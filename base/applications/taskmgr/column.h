@@ -48,7 +48,11 @@
 #define COLUMN_IOWRITEBYTES         23
 #define COLUMN_IOOTHERBYTES         24
 #define COLUMN_COMMANDLINE          25
-#define COLUMN_NMAX                 26
+#define COLUMN_HANDLECREATES        26
+#define COLUMN_HANDLECLOSES         27
+#define COLUMN_HANDLEDUPLICATES     28
+#define COLUMN_HANDLELOOKUPS        29
+#define COLUMN_NMAX                 30
 
 /*
  * temporary fix:
@@ -106,6 +110,10 @@ extern const PresetColumnEntry ColumnPresets[COLUMN_NMAX];
 #define Column_IOOther              Columns[COLUMN_IOOTHER]
 #define Column_IOOtherBytes         Columns[COLUMN_IOOTHERBYTES]
 #define Column_CommandLine          Columns[COLUMN_COMMANDLINE]
+#define Column_HandleCreates        Columns[COLUMN_HANDLECREATES]
+#define Column_HandleCloses         Columns[COLUMN_HANDLECLOSES]
+#define Column_HandleDuplicates     Columns[COLUMN_HANDLEDUPLICATES]
+#define Column_HandleLookups        Columns[COLUMN_HANDLELOOKUPS]
 
 void ProcessPage_OnViewSelectColumns(void);
 void AddColumns(void);
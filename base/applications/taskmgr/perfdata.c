@@ -191,6 +191,7 @@ void PerfDataRefresh(void)
     double                                     CurrentKernelTime;
     PSECURITY_DESCRIPTOR                       ProcessSD;
     PSID                                       ProcessUser;
+    PROCESS_HANDLE_STATISTICS                  HandleStatistics;
     ULONG                                      Buffer[64]; /* must be 4 bytes aligned! */
     ULONG                                      cwcUserName;
 
@@ -382,6 +383,10 @@ void PerfDataRefresh(void)
         pPerfData[Idx].UserName[0] = UNICODE_NULL;
         pPerfData[Idx].USERObjectCount = 0;
         pPerfData[Idx].GDIObjectCount = 0;
+        pPerfData[Idx].HandleCreates = 0;
+        pPerfData[Idx].HandleCloses = 0;
+        pPerfData[Idx].HandleDuplicates = 0;
+        pPerfData[Idx].HandleLookups = 0;
         ProcessUser = SystemUserSid;
         ProcessSD = NULL;
 
@@ -416,6 +421,20 @@ ReadProcOwner:
                 }
 
                 GetProcessIoCounters(hProcess, &pPerfData[Idx].IOCounters);
+
+                /* Get the handle churn counters the kernel keeps for the process */
+                if (NT_SUCCESS(NtQueryInformationProcess(hProcess,
+                                                         ProcessHandleStatistics,
+                                                         &HandleStatistics,
+                                                         sizeof(HandleStatistics),
+                                                         NULL)))
+                {
+                    pPerfData[Idx].HandleCreates = HandleStatistics.HandleCreates;
+                    pPerfData[Idx].HandleCloses = HandleStatistics.HandleCloses;
+                    pPerfData[Idx].HandleDuplicates = HandleStatistics.HandleDuplicates;
+                    pPerfData[Idx].HandleLookups = HandleStatistics.HandleLookups;
+                }
+
                 CloseHandle(hProcess);
             } else {
                 goto ClearInfo;
@@ -943,6 +962,70 @@ BOOL PerfDataGetIOCounters(ULONG Index, PIO_COUNTERS pIoCounters)
     return bSuccessful;
 }
 
+ULONG PerfDataGetHandleCreates(ULONG Index)
+{
+    ULONG  HandleCreates;
+
+    EnterCriticalSection(&PerfDataCriticalSection);
+
+    if (Index < ProcessCount)
+        HandleCreates = pPerfData[Index].HandleCreates;
+    else
+        HandleCreates = 0;
+
+    LeaveCriticalSection(&PerfDataCriticalSection);
+
+    return HandleCreates;
+}
+
+ULONG PerfDataGetHandleCloses(ULONG Index)
+{
+    ULONG  HandleCloses;
+
+    EnterCriticalSection(&PerfDataCriticalSection);
+
+    if (Index < ProcessCount)
+        HandleCloses = pPerfData[Index].HandleCloses;
+    else
+        HandleCloses = 0;
+
+    LeaveCriticalSection(&PerfDataCriticalSection);
+
+    return HandleCloses;
+}
+
+ULONG PerfDataGetHandleDuplicates(ULONG Index)
+{
+    ULONG  HandleDuplicates;
+
+    EnterCriticalSection(&PerfDataCriticalSection);
+
+    if (Index < ProcessCount)
+        HandleDuplicates = pPerfData[Index].HandleDuplicates;
+    else
+        HandleDuplicates = 0;
+
+    LeaveCriticalSection(&PerfDataCriticalSection);
+
+    return HandleDuplicates;
+}
+
+ULONG PerfDataGetHandleLookups(ULONG Index)
+{
+    ULONG  HandleLookups;
+
+    EnterCriticalSection(&PerfDataCriticalSection);
+
+    if (Index < ProcessCount)
+        HandleLookups = pPerfData[Index].HandleLookups;
+    else
+        HandleLookups = 0;
+
+    LeaveCriticalSection(&PerfDataCriticalSection);
+
+    return HandleLookups;
+}
+
 ULONG PerfDataGetCommitChargeTotalK(void)
 {
     ULONG  Total;
@@ -50,6 +50,10 @@ typedef struct _PERFDATA
 	ULONG				USERObjectCount;
 	ULONG				GDIObjectCount;
 	IO_COUNTERS			IOCounters;
+	ULONG				HandleCreates;
+	ULONG				HandleCloses;
+	ULONG				HandleDuplicates;
+	ULONG				HandleLookups;
 
 	LARGE_INTEGER		UserTime;
 	LARGE_INTEGER		KernelTime;
@@ -97,6 +101,10 @@ ULONG	PerfDataGetThreadCount(ULONG Index);
 ULONG	PerfDataGetUSERObjectCount(ULONG Index);
 ULONG	PerfDataGetGDIObjectCount(ULONG Index);
 BOOL	PerfDataGetIOCounters(ULONG Index, PIO_COUNTERS pIoCounters);
+ULONG	PerfDataGetHandleCreates(ULONG Index);
+ULONG	PerfDataGetHandleCloses(ULONG Index);
+ULONG	PerfDataGetHandleDuplicates(ULONG Index);
+ULONG	PerfDataGetHandleLookups(ULONG Index);
 
 ULONG	PerfDataGetCommitChargeTotalK(void);
 ULONG	PerfDataGetCommitChargeLimitK(void);
@@ -694,6 +694,26 @@ BOOL PerfDataGetText(ULONG Index, ULONG ColumnIndex, LPTSTR lpText, ULONG nMaxCo
         _ui64tow(iocounters.OtherTransferCount, lpText, 10);
         CommaSeparateNumberString(lpText, nMaxCount);
     }
+    if (ColumnDataHints[ColumnIndex] == COLUMN_HANDLECREATES)
+    {
+        wsprintfW(lpText, L"%lu", PerfDataGetHandleCreates(Index));
+        CommaSeparateNumberString(lpText, nMaxCount);
+    }
+    if (ColumnDataHints[ColumnIndex] == COLUMN_HANDLECLOSES)
+    {
+        wsprintfW(lpText, L"%lu", PerfDataGetHandleCloses(Index));
+        CommaSeparateNumberString(lpText, nMaxCount);
+    }
+    if (ColumnDataHints[ColumnIndex] == COLUMN_HANDLEDUPLICATES)
+    {
+        wsprintfW(lpText, L"%lu", PerfDataGetHandleDuplicates(Index));
+        CommaSeparateNumberString(lpText, nMaxCount);
+    }
+    if (ColumnDataHints[ColumnIndex] == COLUMN_HANDLELOOKUPS)
+    {
+        wsprintfW(lpText, L"%lu", PerfDataGetHandleLookups(Index));
+        CommaSeparateNumberString(lpText, nMaxCount);
+    }
 
     return FALSE;
 }
@@ -932,5 +952,29 @@ int CALLBACK ProcessPageCompareFunc(LPARAM lParam1, LPARAM lParam2, LPARAM lPara
         ull2 = iocounters2.OtherTransferCount;
         ret = CMP(ull1, ull2);
     }
+    else if (TaskManagerSettings.SortColumn == COLUMN_HANDLECREATES)
+    {
+        l1 = PerfDataGetHandleCreates(IndexParam1);
+        l2 = PerfDataGetHandleCreates(IndexParam2);
+        ret = CMP(l1, l2);
+    }
+    else if (TaskManagerSettings.SortColumn == COLUMN_HANDLECLOSES)
+    {
+        l1 = PerfDataGetHandleCloses(IndexParam1);
+        l2 = PerfDataGetHandleCloses(IndexParam2);
+        ret = CMP(l1, l2);
+    }
+    else if (TaskManagerSettings.SortColumn == COLUMN_HANDLEDUPLICATES)
+    {
+        l1 = PerfDataGetHandleDuplicates(IndexParam1);
+        l2 = PerfDataGetHandleDuplicates(IndexParam2);
+        ret = CMP(l1, l2);
+    }
+    else if (TaskManagerSettings.SortColumn == COLUMN_HANDLELOOKUPS)
+    {
+        l1 = PerfDataGetHandleLookups(IndexParam1);
+        l2 = PerfDataGetHandleLookups(IndexParam2);
+        ret = CMP(l1, l2);
+    }
     return ret;
 }
@@ -120,6 +120,10 @@
 #define IDC_MEM_USAGE_HISTORY_GRAPH      1049
 #define IDC_CPU_USAGE_HISTORY_GRAPH      1050
 #define IDC_CPU31                        1051
+#define IDC_HANDLECREATES                1052
+#define IDC_HANDLECLOSES                 1053
+#define IDC_HANDLEDUPLICATES             1054
+#define IDC_HANDLELOOKUPS                1055
 
 #define IDS_TOTALS_HANDLE_COUNT          1060
 #define IDS_TOTALS_THREAD_COUNT          1061
@@ -224,6 +228,10 @@
 #define IDS_TAB_IOWRITESBYTES 338
 #define IDS_TAB_IOOTHERBYTES  339
 #define IDS_TAB_COMMANDLINE   368
+#define IDS_TAB_HANDLECREATES 370
+#define IDS_TAB_HANDLECLOSES  371
+#define IDS_TAB_HANDLEDUPLICATES 372
+#define IDS_TAB_HANDLELOOKUPS 373
 
 #define IDS_MENU_SELECTCOLUMNS   340
 #define IDS_MENU_16BITTASK       341
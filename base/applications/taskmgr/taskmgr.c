@@ -852,6 +852,7 @@ void LoadSettings(void)
     WCHAR  szSubKey[] = L"Software\\ReactOS\\TaskManager";
     int    i;
     DWORD  dwSize;
+    TASKMANAGER_SETTINGS Settings;
 
     /* Window size & position settings */
     TaskManagerSettings.Maximized = FALSE;
@@ -894,9 +895,17 @@ void LoadSettings(void)
     /* Open the key */
     if (RegOpenKeyExW(HKEY_CURRENT_USER, szSubKey, 0, KEY_READ, &hKey) != ERROR_SUCCESS)
         return;
-    /* Read the settings */
+    /*
+     * Read the settings. Only take them if they have the layout we expect,
+     * since a blob saved by a build with a different set of columns would
+     * put everything after the column arrays at the wrong place.
+     */
     dwSize = sizeof(TASKMANAGER_SETTINGS);
-    RegQueryValueExW(hKey, L"Preferences", NULL, NULL, (LPBYTE)&TaskManagerSettings, &dwSize);
+    if (RegQueryValueExW(hKey, L"Preferences", NULL, NULL, (LPBYTE)&Settings, &dwSize) == ERROR_SUCCESS &&
+        dwSize == sizeof(TASKMANAGER_SETTINGS))
+    {
+        TaskManagerSettings = Settings;
+    }
 
     /*
      * ATM, the 'ImageName' column is always visible
@@ -0,0 +1,541 @@
+/*
+ * PROJECT:     ReactOS DNS Resolver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        base/services/dnsrslvr/cache.c
+ * PURPOSE:     DNS cache functions
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "precomp.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(dnsrslvr);
+
+/* GLOBALS ******************************************************************/
+
+/*
+ * Every process used to send its own queries to the network, and nothing
+ * remembered the answers. The cache keeps them for as long as their TTL
+ * says, and keeps names that don't exist for DNS_CACHE_NEGATIVE_TTL.
+ * Processes asking for a name that is already being looked up wait for that
+ * one query instead of sending their own, and a name in use is looked up
+ * again shortly before it expires so that its users never see it miss.
+ */
+
+#define DNS_CACHE_HASH_SIZE     256
+#define DNS_CACHE_MAX_ENTRIES   1024
+#define DNS_CACHE_MAX_TTL       86400
+#define DNS_CACHE_NEGATIVE_TTL  300
+
+/* Refresh an entry that is used once less than a tenth of its TTL is left */
+#define DNS_CACHE_PREFETCH_DIVISOR 10
+
+/* The options which change the answer are part of the key */
+#define DNS_CACHE_KEY_OPTIONS   (DNS_QUERY_NO_RECURSION | \
+                                 DNS_QUERY_NO_HOSTS_FILE | \
+                                 DNS_QUERY_WIRE_ONLY)
+
+typedef struct _RESOLVER_CACHE_ENTRY
+{
+    LIST_ENTRY CacheLink;
+    LONG RefCount;
+    LPWSTR Name;
+    WORD Type;
+    DWORD Options;
+    ULONG Hash;
+    DNS_STATUS Status;
+    PDNS_RECORDW Record;
+    DWORD Ttl;
+    DWORD Timestamp;
+    BOOL Pending;
+    BOOL Refreshing;
+    HANDLE Event;
+} RESOLVER_CACHE_ENTRY, *PRESOLVER_CACHE_ENTRY;
+
+static CRITICAL_SECTION CacheLock;
+static LIST_ENTRY CacheTable[DNS_CACHE_HASH_SIZE];
+static ULONG CacheEntryCount;
+
+/* FUNCTIONS *****************************************************************/
+
+VOID
+DnsIntCacheInitialize(VOID)
+{
+    ULONG i;
+
+    TRACE("DnsIntCacheInitialize()\n");
+
+    InitializeCriticalSection(&CacheLock);
+
+    for (i = 0; i < DNS_CACHE_HASH_SIZE; i++)
+        InitializeListHead(&CacheTable[i]);
+
+    CacheEntryCount = 0;
+}
+
+
+static
+ULONG
+DnsIntCacheHash(
+    LPCWSTR Name)
+{
+    ULONG Hash = 0;
+
+    /* Names compare without case, so they hash without it too */
+    while (*Name)
+    {
+        Hash = (Hash * 31) + towlower(*Name);
+        Name++;
+    }
+
+    return Hash;
+}
+
+
+static
+VOID
+DnsIntCacheDereference(
+    PRESOLVER_CACHE_ENTRY Entry)
+{
+    if (InterlockedDecrement(&Entry->RefCount) != 0)
+        return;
+
+    if (Entry->Record != NULL)
+        DnsRecordListFree((PDNS_RECORD)Entry->Record, DnsFreeRecordList);
+
+    if (Entry->Event != NULL)
+        CloseHandle(Entry->Event);
+
+    HeapFree(GetProcessHeap(), 0, Entry->Name);
+    HeapFree(GetProcessHeap(), 0, Entry);
+}
+
+
+static
+VOID
+DnsIntCacheUnlink(
+    PRESOLVER_CACHE_ENTRY Entry)
+{
+    /* Called with the lock held. Running queries keep their reference */
+    if (IsListEmpty(&Entry->CacheLink))
+        return;
+
+    RemoveEntryList(&Entry->CacheLink);
+    InitializeListHead(&Entry->CacheLink);
+    CacheEntryCount--;
+
+    DnsIntCacheDereference(Entry);
+}
+
+
+static
+BOOL
+DnsIntCacheIsExpired(
+    PRESOLVER_CACHE_ENTRY Entry,
+    DWORD Now)
+{
+    return ((Now - Entry->Timestamp) / 1000) >= Entry->Ttl;
+}
+
+
+static
+BOOL
+DnsIntCacheIsNegative(
+    DNS_STATUS Status)
+{
+    return (Status == DNS_ERROR_RCODE_NAME_ERROR ||
+            Status == DNS_INFO_NO_RECORDS);
+}
+
+
+static
+DWORD
+DnsIntCacheGetTtl(
+    DNS_STATUS Status,
+    PDNS_RECORDW Record)
+{
+    DWORD Ttl = DNS_CACHE_MAX_TTL;
+
+    if (DnsIntCacheIsNegative(Status))
+        return DNS_CACHE_NEGATIVE_TTL;
+
+    if (Status != ERROR_SUCCESS || Record == NULL)
+        return 0;
+
+    /* The set lives as long as its shortest lived record. Answers from the
+     * hosts file or for the local name come with no TTL and aren't kept */
+    for (; Record != NULL; Record = Record->pNext)
+    {
+        if (Record->dwTtl < Ttl)
+            Ttl = Record->dwTtl;
+    }
+
+    return Ttl;
+}
+
+
+static
+PRESOLVER_CACHE_ENTRY
+DnsIntCacheLookup(
+    LPCWSTR Name,
+    WORD Type,
+    DWORD Options,
+    ULONG Hash)
+{
+    PLIST_ENTRY ListEntry, ListHead;
+    PRESOLVER_CACHE_ENTRY Entry;
+
+    ListHead = &CacheTable[Hash % DNS_CACHE_HASH_SIZE];
+
+    for (ListEntry = ListHead->Flink;
+         ListEntry != ListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, RESOLVER_CACHE_ENTRY, CacheLink);
+
+        if (Entry->Hash == Hash &&
+            Entry->Type == Type &&
+            Entry->Options == Options &&
+            _wcsicmp(Entry->Name, Name) == 0)
+            return Entry;
+    }
+
+    return NULL;
+}
+
+
+static
+VOID
+DnsIntCacheTrim(VOID)
+{
+    PLIST_ENTRY ListEntry;
+    PRESOLVER_CACHE_ENTRY Entry, Oldest = NULL;
+    DWORD Now = GetTickCount();
+    ULONG i;
+
+    /* Called with the lock held when the cache is full. Drop what has
+     * expired, and the oldest entry if nothing has */
+    for (i = 0; i < DNS_CACHE_HASH_SIZE; i++)
+    {
+        ListEntry = CacheTable[i].Flink;
+        while (ListEntry != &CacheTable[i])
+        {
+            Entry = CONTAINING_RECORD(ListEntry, RESOLVER_CACHE_ENTRY, CacheLink);
+            ListEntry = ListEntry->Flink;
+
+            if (Entry->Pending)
+                continue;
+
+            if (DnsIntCacheIsExpired(Entry, Now))
+            {
+                DnsIntCacheUnlink(Entry);
+                continue;
+            }
+
+            if (Oldest == NULL ||
+                (Now - Entry->Timestamp) > (Now - Oldest->Timestamp))
+                Oldest = Entry;
+        }
+    }
+
+    if (CacheEntryCount >= DNS_CACHE_MAX_ENTRIES && Oldest != NULL)
+        DnsIntCacheUnlink(Oldest);
+}
+
+
+static
+DNS_STATUS
+DnsIntCacheCopy(
+    PRESOLVER_CACHE_ENTRY Entry,
+    PDNS_RECORDW *Record)
+{
+    /* Called with the lock held. The RPC stub frees what it returns */
+    *Record = NULL;
+
+    if (Entry->Status != ERROR_SUCCESS || Entry->Record == NULL)
+        return Entry->Status;
+
+    *Record = (PDNS_RECORDW)DnsRecordSetCopyEx((PDNS_RECORD)Entry->Record,
+                                               DnsCharSetUnicode,
+                                               DnsCharSetUnicode);
+    if (*Record == NULL)
+        return ERROR_OUTOFMEMORY;
+
+    return ERROR_SUCCESS;
+}
+
+
+static
+VOID
+DnsIntCacheComplete(
+    PRESOLVER_CACHE_ENTRY Entry,
+    DNS_STATUS Status,
+    PDNS_RECORDW Record)
+{
+    DWORD Ttl;
+
+    /* Called with the lock held */
+    Ttl = DnsIntCacheGetTtl(Status, Record);
+
+    if (Entry->Pending || Ttl != 0)
+    {
+        if (Entry->Record != NULL)
+            DnsRecordListFree((PDNS_RECORD)Entry->Record, DnsFreeRecordList);
+
+        Entry->Status = Status;
+        Entry->Record = Record;
+        Entry->Ttl = min(Ttl, DNS_CACHE_MAX_TTL);
+        Entry->Timestamp = GetTickCount();
+    }
+    else
+    {
+        /* A failed refresh keeps serving the old answer until it expires */
+        if (Record != NULL)
+            DnsRecordListFree((PDNS_RECORD)Record, DnsFreeRecordList);
+    }
+
+    Entry->Refreshing = FALSE;
+
+    /* Answers that can't be cached are only handed to the waiting queries */
+    if (Entry->Ttl == 0)
+        DnsIntCacheUnlink(Entry);
+
+    if (Entry->Pending)
+    {
+        Entry->Pending = FALSE;
+        SetEvent(Entry->Event);
+    }
+}
+
+
+static
+DNS_STATUS
+DnsIntCacheResolve(
+    PRESOLVER_CACHE_ENTRY Entry,
+    PDNS_RECORDW *Record)
+{
+    /* The query goes to dnsapi, which mustn't come back to us */
+    return DnsQuery_W(Entry->Name,
+                      Entry->Type,
+                      Entry->Options | DNS_QUERY_BYPASS_CACHE,
+                      NULL,
+                      (PDNS_RECORD *)Record,
+                      NULL);
+}
+
+
+static
+DWORD
+WINAPI
+DnsIntCachePrefetch(
+    LPVOID lpParameter)
+{
+    PRESOLVER_CACHE_ENTRY Entry = lpParameter;
+    PDNS_RECORDW Record = NULL;
+    DNS_STATUS Status;
+
+    TRACE("DnsIntCachePrefetch(%S)\n", Entry->Name);
+
+    Status = DnsIntCacheResolve(Entry, &Record);
+
+    EnterCriticalSection(&CacheLock);
+    DnsIntCacheComplete(Entry, Status, Record);
+    LeaveCriticalSection(&CacheLock);
+
+    DnsIntCacheDereference(Entry);
+
+    return 0;
+}
+
+
+VOID
+DnsIntCacheFlush(VOID)
+{
+    PRESOLVER_CACHE_ENTRY Entry;
+    ULONG i;
+
+    TRACE("DnsIntCacheFlush()\n");
+
+    EnterCriticalSection(&CacheLock);
+
+    for (i = 0; i < DNS_CACHE_HASH_SIZE; i++)
+    {
+        while (!IsListEmpty(&CacheTable[i]))
+        {
+            Entry = CONTAINING_RECORD(CacheTable[i].Flink, RESOLVER_CACHE_ENTRY, CacheLink);
+            DnsIntCacheUnlink(Entry);
+        }
+    }
+
+    LeaveCriticalSection(&CacheLock);
+}
+
+
+VOID
+DnsIntCacheFlushEntry(
+    LPCWSTR Name,
+    WORD Type)
+{
+    PLIST_ENTRY ListEntry, ListHead;
+    PRESOLVER_CACHE_ENTRY Entry;
+    ULONG Hash;
+
+    TRACE("DnsIntCacheFlushEntry(%S %u)\n", Name, Type);
+
+    Hash = DnsIntCacheHash(Name);
+    ListHead = &CacheTable[Hash % DNS_CACHE_HASH_SIZE];
+
+    EnterCriticalSection(&CacheLock);
+
+    /* Type 0 flushes every type cached for the name */
+    ListEntry = ListHead->Flink;
+    while (ListEntry != ListHead)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, RESOLVER_CACHE_ENTRY, CacheLink);
+        ListEntry = ListEntry->Flink;
+
+        if (Entry->Hash == Hash &&
+            (Type == 0 || Entry->Type == Type) &&
+            _wcsicmp(Entry->Name, Name) == 0)
+            DnsIntCacheUnlink(Entry);
+    }
+
+    LeaveCriticalSection(&CacheLock);
+}
+
+
+DNS_STATUS
+DnsIntCacheQuery(
+    LPCWSTR Name,
+    WORD Type,
+    DWORD Flags,
+    PDNS_RECORDW *Record)
+{
+    PRESOLVER_CACHE_ENTRY Entry;
+    PDNS_RECORDW NewRecord = NULL;
+    DNS_STATUS Status;
+    DWORD Options, Now, Age;
+    ULONG Hash;
+
+    *Record = NULL;
+
+    Options = Flags & DNS_CACHE_KEY_OPTIONS;
+    Hash = DnsIntCacheHash(Name);
+
+    EnterCriticalSection(&CacheLock);
+
+    Entry = DnsIntCacheLookup(Name, Type, Options, Hash);
+    if (Entry != NULL)
+    {
+        if (Entry->Pending)
+        {
+            /* Somebody is already asking, wait for their answer */
+            InterlockedIncrement(&Entry->RefCount);
+            LeaveCriticalSection(&CacheLock);
+
+            WaitForSingleObject(Entry->Event, INFINITE);
+
+            EnterCriticalSection(&CacheLock);
+            Status = DnsIntCacheCopy(Entry, Record);
+            LeaveCriticalSection(&CacheLock);
+
+            DnsIntCacheDereference(Entry);
+            return Status;
+        }
+
+        Now = GetTickCount();
+        if (!DnsIntCacheIsExpired(Entry, Now))
+        {
+            TRACE("Cache hit for %S\n", Name);
+            Status = DnsIntCacheCopy(Entry, Record);
+
+            /* Look it up again before it expires if it's still in use */
+            Age = (Now - Entry->Timestamp) / 1000;
+            if (!Entry->Refreshing &&
+                Entry->Status == ERROR_SUCCESS &&
+                (Entry->Ttl - Age) * DNS_CACHE_PREFETCH_DIVISOR < Entry->Ttl)
+            {
+                InterlockedIncrement(&Entry->RefCount);
+                Entry->Refreshing = TRUE;
+
+                if (!QueueUserWorkItem(DnsIntCachePrefetch, Entry, WT_EXECUTEDEFAULT))
+                {
+                    Entry->Refreshing = FALSE;
+                    InterlockedDecrement(&Entry->RefCount);
+                }
+            }
+
+            LeaveCriticalSection(&CacheLock);
+            return Status;
+        }
+
+        /* It's stale, look it up again */
+        DnsIntCacheUnlink(Entry);
+    }
+
+    /* Queries that mustn't go to the network can only be answered from the
+     * cache, otherwise dnsapi handles them on its own */
+    if (Flags & DNS_QUERY_NO_WIRE_QUERY)
+    {
+        LeaveCriticalSection(&CacheLock);
+
+        return DnsQuery_W(Name,
+                          Type,
+                          Flags | DNS_QUERY_BYPASS_CACHE,
+                          NULL,
+                          (PDNS_RECORD *)Record,
+                          NULL);
+    }
+
+    /* Create an entry the other queries for this name can wait on */
+    Entry = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*Entry));
+    if (Entry != NULL)
+    {
+        Entry->Name = HeapAlloc(GetProcessHeap(), 0, (wcslen(Name) + 1) * sizeof(WCHAR));
+        Entry->Event = CreateEventW(NULL, TRUE, FALSE, NULL);
+    }
+
+    if (Entry == NULL || Entry->Name == NULL || Entry->Event == NULL)
+    {
+        LeaveCriticalSection(&CacheLock);
+
+        if (Entry != NULL)
+        {
+            if (Entry->Event != NULL)
+                CloseHandle(Entry->Event);
+            HeapFree(GetProcessHeap(), 0, Entry->Name);
+            HeapFree(GetProcessHeap(), 0, Entry);
+        }
+
+        return ERROR_OUTOFMEMORY;
+    }
+
+    wcscpy(Entry->Name, Name);
+    Entry->Type = Type;
+    Entry->Options = Options;
+    Entry->Hash = Hash;
+    Entry->Pending = TRUE;
+
+    /* One reference for the cache and one for us */
+    Entry->RefCount = 2;
+
+    if (CacheEntryCount >= DNS_CACHE_MAX_ENTRIES)
+        DnsIntCacheTrim();
+
+    InsertTailList(&CacheTable[Hash % DNS_CACHE_HASH_SIZE], &Entry->CacheLink);
+    CacheEntryCount++;
+
+    LeaveCriticalSection(&CacheLock);
+
+    TRACE("Cache miss for %S\n", Name);
+    Status = DnsIntCacheResolve(Entry, &NewRecord);
+
+    EnterCriticalSection(&CacheLock);
+    DnsIntCacheComplete(Entry, Status, NewRecord);
+    Status = DnsIntCacheCopy(Entry, Record);
+    LeaveCriticalSection(&CacheLock);
+
+    DnsIntCacheDereference(Entry);
+
+    return Status;
+}
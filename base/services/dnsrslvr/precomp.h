@@ -0,0 +1,47 @@
+#ifndef _DNSRSLVR_PCH_
+#define _DNSRSLVR_PCH_
+
+#define WIN32_NO_STATUS
+#define _INC_WINDOWS
+#define COM_NO_WINDOWS_H
+#include <stdarg.h>
+#include <windef.h>
+#include <winbase.h>
+#include <winreg.h>
+#include <winsvc.h>
+#include <windns.h>
+
+#include <ndk/rtlfuncs.h>
+
+#include <dnsrslvr_s.h>
+
+#include <wine/debug.h>
+
+/* cache.c */
+
+VOID
+DnsIntCacheInitialize(VOID);
+
+VOID
+DnsIntCacheFlush(VOID);
+
+VOID
+DnsIntCacheFlushEntry(
+    LPCWSTR Name,
+    WORD Type);
+
+DNS_STATUS
+DnsIntCacheQuery(
+    LPCWSTR Name,
+    WORD Type,
+    DWORD Flags,
+    PDNS_RECORDW *Record);
+
+/* rpcserver.c */
+
+DWORD
+WINAPI
+RpcThreadRoutine(
+    LPVOID lpParameter);
+
+#endif /* _DNSRSLVR_PCH_ */
@@ -0,0 +1,117 @@
+/*
+ * PROJECT:     ReactOS DNS Resolver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        base/services/dnsrslvr/rpcserver.c
+ * PURPOSE:     RPC server interface
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "precomp.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(dnsrslvr);
+
+/* FUNCTIONS *****************************************************************/
+
+DWORD
+WINAPI
+RpcThreadRoutine(
+    LPVOID lpParameter)
+{
+    RPC_STATUS Status;
+
+    Status = RpcServerUseProtseqEpW(L"ncalrpc", 20, L"DNSResolver", NULL);
+    if (Status != RPC_S_OK)
+    {
+        ERR("RpcServerUseProtseqEpW() failed (Status %lx)\n", Status);
+        return 0;
+    }
+
+    Status = RpcServerRegisterIf(DnsResolver_v2_0_s_ifspec, NULL, NULL);
+    if (Status != RPC_S_OK)
+    {
+        ERR("RpcServerRegisterIf() failed (Status %lx)\n", Status);
+        return 0;
+    }
+
+    Status = RpcServerListen(1, RPC_C_LISTEN_MAX_CALLS_DEFAULT, FALSE);
+    if (Status != RPC_S_OK)
+    {
+        ERR("RpcServerListen() failed (Status %lx)\n", Status);
+    }
+
+    return 0;
+}
+
+
+void __RPC_FAR * __RPC_USER midl_user_allocate(SIZE_T len)
+{
+    return HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, len);
+}
+
+
+void __RPC_USER midl_user_free(void __RPC_FAR * ptr)
+{
+    HeapFree(GetProcessHeap(), 0, ptr);
+}
+
+
+/* Function 4 */
+DWORD
+R_ResolverFlushCache(
+    DNSRSLVR_HANDLE pwszServerName)
+{
+    TRACE("R_ResolverFlushCache()\n");
+
+    DnsIntCacheFlush();
+
+    return ERROR_SUCCESS;
+}
+
+
+/* Function 5 */
+DWORD
+R_ResolverFlushCacheEntry(
+    DNSRSLVR_HANDLE pwszServerName,
+    LPCWSTR pwszName,
+    WORD wType)
+{
+    TRACE("R_ResolverFlushCacheEntry(%S %u)\n", pwszName, wType);
+
+    if (pwszName == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    DnsIntCacheFlushEntry(pwszName, wType);
+
+    return ERROR_SUCCESS;
+}
+
+
+/* Function 7 */
+DWORD
+R_ResolverQuery(
+    DNSRSLVR_HANDLE pwszServerName,
+    LPCWSTR pwsName,
+    WORD wType,
+    DWORD Flags,
+    DWORD *dwRecords,
+    DNS_RECORDW **ppResultRecords)
+{
+    PDNS_RECORDW Record;
+    DNS_STATUS Status;
+
+    TRACE("R_ResolverQuery(%S %u %lx)\n", pwsName, wType, Flags);
+
+    if (pwsName == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    *ppResultRecords = NULL;
+    *dwRecords = 0;
+
+    Status = DnsIntCacheQuery(pwsName, wType, Flags, ppResultRecords);
+
+    for (Record = *ppResultRecords; Record != NULL; Record = Record->pNext)
+        (*dwRecords)++;
+
+    return Status;
+}
@@ -77,6 +77,7 @@ ServiceControlHandler(DWORD dwControl,
 
             /* Stop listening to incoming RPC messages */
             RpcMgmtStopServerListening(NULL);
+            LogfFlushAll();
             UpdateServiceStatus(SERVICE_STOPPED);
             return ERROR_SUCCESS;
 
@@ -103,6 +104,9 @@ ServiceControlHandler(DWORD dwControl,
                             0,
                             EVENT_EventlogStopped, 0, NULL, 0, NULL);
 
+            /* Commit the pending records before the system goes down */
+            LogfFlushAll();
+
             UpdateServiceStatus(SERVICE_STOPPED);
             return ERROR_SUCCESS;
 
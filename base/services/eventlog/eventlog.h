@@ -35,6 +35,11 @@ typedef struct _LOGFILE
 {
     EVTLOGFILE LogFile;
     HANDLE FileHandle;
+    HANDLE SectionHandle;   /* Writable logs are accessed through a view of the whole file */
+    PVOID ViewBase;
+    SIZE_T ViewSize;
+    ULONG WriteSequence;    /* Number of records written... */
+    ULONG FlushSequence;    /* ...and how many of them are known to be on disk */
     WCHAR *LogName;
     RTL_RESOURCE Lock;
     BOOL Permanent;
@@ -102,6 +107,8 @@ LogfClose(PLOGFILE LogFile,
 
 VOID LogfCloseAll(VOID);
 
+VOID LogfFlushAll(VOID);
+
 NTSTATUS
 LogfClearFile(PLOGFILE LogFile,
               PUNICODE_STRING BackupFileName);
@@ -123,7 +130,8 @@ LogfReadEvents(PLOGFILE LogFile,
 NTSTATUS
 LogfWriteRecord(PLOGFILE LogFile,
                 PEVENTLOGRECORD Record,
-                SIZE_T BufSize);
+                SIZE_T BufSize,
+                BOOLEAN Durable);
 
 PEVENTLOGRECORD
 LogfAllocAndBuildNewRecord(PSIZE_T pRecSize,
@@ -13,6 +13,8 @@
 #include "eventlog.h"
 #include <ndk/iofuncs.h>
 #include <ndk/kefuncs.h>
+#include <ndk/mmfuncs.h>
+#include <pseh/pseh2.h>
 
 #define NDEBUG
 #include <debug.h>
@@ -22,12 +24,64 @@
 static LIST_ENTRY LogFileListHead;
 static CRITICAL_SECTION LogFileListCs;
 
+/*
+ * The logs are flushed by a background thread LOGF_FLUSH_INTERVAL ms after
+ * a first record got written to them, or right away once LOGF_FLUSH_THRESHOLD
+ * records are pending.
+ */
+#define LOGF_FLUSH_INTERVAL     1000
+#define LOGF_FLUSH_THRESHOLD    64
+
+static HANDLE LogfFlushThread = NULL;
+static HANDLE LogfFlushEvent = NULL;
+static HANDLE LogfStopEvent = NULL;
+
 /* LOG FILE LIST - FUNCTIONS *************************************************/
 
+static DWORD WINAPI
+LogfFlushThreadRoutine(LPVOID lpParameter)
+{
+    HANDLE Events[2];
+
+    UNREFERENCED_PARAMETER(lpParameter);
+
+    Events[0] = LogfStopEvent;
+    Events[1] = LogfFlushEvent;
+
+    for (;;)
+    {
+        if (WaitForMultipleObjects(ARRAYSIZE(Events), Events, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+            break;
+
+        /* Let more records come in, so that they all get flushed at once */
+        if (WaitForSingleObject(LogfStopEvent, LOGF_FLUSH_INTERVAL) != WAIT_TIMEOUT)
+            break;
+
+        LogfFlushAll();
+    }
+
+    return 0;
+}
+
 VOID LogfListInitialize(VOID)
 {
     InitializeCriticalSection(&LogFileListCs);
     InitializeListHead(&LogFileListHead);
+
+    /* Without the flush thread, each record is flushed as it gets written */
+    LogfFlushEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    LogfStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (LogfFlushEvent && LogfStopEvent)
+    {
+        LogfFlushThread = CreateThread(NULL,
+                                       0,
+                                       LogfFlushThreadRoutine,
+                                       NULL,
+                                       0,
+                                       NULL);
+    }
+    if (!LogfFlushThread)
+        DPRINT1("Cannot create the log flush thread, flushing each record\n");
 }
 
 PLOGFILE LogfListItemByName(LPCWSTR Name)
@@ -174,6 +228,75 @@ LogfpFree(IN PVOID Ptr,
     RtlFreeHeap(GetProcessHeap(), Flags, Ptr);
 }
 
+static NTSTATUS
+LogfpMapFile(IN PLOGFILE LogFile,
+             IN ULONG FileSize)
+{
+    NTSTATUS Status;
+
+    ASSERT(LogFile->SectionHandle == NULL && LogFile->ViewBase == NULL);
+
+    Status = NtCreateSection(&LogFile->SectionHandle,
+                             SECTION_MAP_READ | SECTION_MAP_WRITE | SECTION_QUERY,
+                             NULL,
+                             NULL,
+                             PAGE_READWRITE,
+                             SEC_COMMIT,
+                             LogFile->FileHandle);
+    if (!NT_SUCCESS(Status))
+    {
+        LogFile->SectionHandle = NULL;
+        return Status;
+    }
+
+    LogFile->ViewSize = 0;
+    Status = NtMapViewOfSection(LogFile->SectionHandle,
+                                NtCurrentProcess(),
+                                &LogFile->ViewBase,
+                                0,
+                                0,
+                                NULL,
+                                &LogFile->ViewSize,
+                                ViewUnmap,
+                                0,
+                                PAGE_READWRITE);
+    if (!NT_SUCCESS(Status))
+    {
+        NtClose(LogFile->SectionHandle);
+        LogFile->SectionHandle = NULL;
+        LogFile->ViewBase = NULL;
+        LogFile->ViewSize = 0;
+        return Status;
+    }
+
+    /* The view is rounded up to a page, only use the part backed by the file */
+    LogFile->ViewSize = min(LogFile->ViewSize, FileSize);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+LogfpUnmapFile(IN PLOGFILE LogFile)
+{
+    if (LogFile->ViewBase)
+        NtUnmapViewOfSection(NtCurrentProcess(), LogFile->ViewBase);
+    if (LogFile->SectionHandle)
+        NtClose(LogFile->SectionHandle);
+
+    LogFile->SectionHandle = NULL;
+    LogFile->ViewBase = NULL;
+    LogFile->ViewSize = 0;
+}
+
+static BOOLEAN
+LogfpIsInView(IN PLOGFILE LogFile,
+              IN PLARGE_INTEGER FileOffset,
+              IN SIZE_T Length)
+{
+    return (LogFile->ViewBase != NULL &&
+            (ULONGLONG)FileOffset->QuadPart <= LogFile->ViewSize &&
+            Length <= LogFile->ViewSize - (SIZE_T)FileOffset->QuadPart);
+}
+
 // PELF_FILE_READ_ROUTINE
 static
 NTSTATUS NTAPI
@@ -190,6 +313,27 @@ LogfpReadFile(IN  PEVTLOGFILE LogFile,
     if (ReadLength)
         *ReadLength = 0;
 
+    if (LogfpIsInView(pLogFile, FileOffset, Length))
+    {
+        _SEH2_TRY
+        {
+            RtlCopyMemory(Buffer,
+                          (PUCHAR)pLogFile->ViewBase + FileOffset->LowPart,
+                          Length);
+            Status = STATUS_SUCCESS;
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        if (ReadLength && NT_SUCCESS(Status))
+            *ReadLength = Length;
+
+        return Status;
+    }
+
     Status = NtReadFile(pLogFile->FileHandle,
                         NULL,
                         NULL,
@@ -222,6 +366,27 @@ LogfpWriteFile(IN  PEVTLOGFILE LogFile,
     if (WrittenLength)
         *WrittenLength = 0;
 
+    if (LogfpIsInView(pLogFile, FileOffset, Length))
+    {
+        _SEH2_TRY
+        {
+            RtlCopyMemory((PUCHAR)pLogFile->ViewBase + FileOffset->LowPart,
+                          Buffer,
+                          Length);
+            Status = STATUS_SUCCESS;
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        if (WrittenLength && NT_SUCCESS(Status))
+            *WrittenLength = Length;
+
+        return Status;
+    }
+
     Status = NtWriteFile(pLogFile->FileHandle,
                          NULL,
                          NULL,
@@ -250,9 +415,15 @@ LogfpSetFileSize(IN PEVTLOGFILE LogFile,
     IO_STATUS_BLOCK IoStatusBlock;
     FILE_END_OF_FILE_INFORMATION FileEofInfo;
     FILE_ALLOCATION_INFORMATION FileAllocInfo;
+    BOOLEAN Mapped;
 
     UNREFERENCED_PARAMETER(OldFileSize);
 
+    /* The file cannot be resized while it is mapped, map it again afterwards */
+    Mapped = (pLogFile->ViewBase != NULL);
+    if (Mapped)
+        LogfpUnmapFile(pLogFile);
+
     // FIXME: Should we round up FileSize ??
 
     FileEofInfo.EndOfFile.QuadPart = FileSize;
@@ -262,7 +433,7 @@ LogfpSetFileSize(IN PEVTLOGFILE LogFile,
                                   sizeof(FileEofInfo),
                                   FileEndOfFileInformation);
     if (!NT_SUCCESS(Status))
-        return Status;
+        goto Quit;
 
     FileAllocInfo.AllocationSize.QuadPart = FileSize;
     Status = NtSetInformationFile(pLogFile->FileHandle,
@@ -271,6 +442,10 @@ LogfpSetFileSize(IN PEVTLOGFILE LogFile,
                                   sizeof(FileAllocInfo),
                                   FileAllocationInformation);
 
+Quit:
+    if (Mapped)
+        LogfpMapFile(pLogFile, FileSize);
+
     return Status;
 }
 
@@ -281,15 +456,46 @@ LogfpFlushFile(IN PEVTLOGFILE LogFile,
                IN PLARGE_INTEGER FileOffset,
                IN ULONG Length)
 {
+    NTSTATUS Status;
     PLOGFILE pLogFile = (PLOGFILE)LogFile;
     IO_STATUS_BLOCK IoStatusBlock;
+    PVOID BaseAddress;
+    SIZE_T FlushSize;
 
     UNREFERENCED_PARAMETER(FileOffset);
     UNREFERENCED_PARAMETER(Length);
 
+    /* Write back the modified pages of the view first */
+    if (pLogFile->ViewBase)
+    {
+        BaseAddress = pLogFile->ViewBase;
+        FlushSize = pLogFile->ViewSize;
+        Status = NtFlushVirtualMemory(NtCurrentProcess(),
+                                      &BaseAddress,
+                                      &FlushSize,
+                                      &IoStatusBlock);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
     return NtFlushBuffersFile(pLogFile->FileHandle, &IoStatusBlock);
 }
 
+/* The log must be locked exclusive */
+static NTSTATUS
+LogfpFlushLog(IN PLOGFILE LogFile)
+{
+    NTSTATUS Status;
+
+    Status = ElfFlushFile(&LogFile->LogFile);
+    if (NT_SUCCESS(Status))
+        LogFile->FlushSequence = LogFile->WriteSequence;
+    else
+        DPRINT1("ElfFlushFile failed (Status 0x%08lx)\n", Status);
+
+    return Status;
+}
+
 NTSTATUS
 LogfCreate(PLOGFILE* LogFile,
            PCWSTR    LogName,
@@ -399,6 +605,17 @@ LogfCreate(PLOGFILE* LogFile,
     if (!NT_SUCCESS(Status))
         goto Quit;
 
+    /* Access writable logs through a mapped view, or fall back to file I/O */
+    if (!Backup)
+    {
+        Status = LogfpMapFile(pLogFile, pLogFile->LogFile.CurrentSize);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Cannot map `%wZ', using file I/O (Status 0x%08lx)\n", FileName, Status);
+            Status = STATUS_SUCCESS;
+        }
+    }
+
     pLogFile->Permanent = Permanent;
 
     RtlInitializeResource(&pLogFile->Lock);
@@ -439,6 +656,7 @@ LogfClose(PLOGFILE LogFile,
     LogfListRemoveItem(LogFile);
 
     ElfCloseFile(&LogFile->LogFile);
+    LogfpUnmapFile(LogFile);
     NtClose(LogFile->FileHandle);
     LogfpFree(LogFile->LogName, 0, 0);
 
@@ -451,6 +669,19 @@ LogfClose(PLOGFILE LogFile,
 
 VOID LogfCloseAll(VOID)
 {
+    /* Stop the flush thread, the logs get flushed when closing them */
+    if (LogfFlushThread)
+    {
+        SetEvent(LogfStopEvent);
+        WaitForSingleObject(LogfFlushThread, INFINITE);
+        CloseHandle(LogfFlushThread);
+        LogfFlushThread = NULL;
+    }
+    if (LogfFlushEvent)
+        CloseHandle(LogfFlushEvent);
+    if (LogfStopEvent)
+        CloseHandle(LogfStopEvent);
+
     EnterCriticalSection(&LogFileListCs);
 
     while (!IsListEmpty(&LogFileListHead))
@@ -463,6 +694,35 @@ VOID LogfCloseAll(VOID)
     DeleteCriticalSection(&LogFileListCs);
 }
 
+VOID LogfFlushAll(VOID)
+{
+    PLIST_ENTRY CurrentEntry;
+    PLOGFILE Item;
+
+    EnterCriticalSection(&LogFileListCs);
+
+    CurrentEntry = LogFileListHead.Flink;
+    while (CurrentEntry != &LogFileListHead)
+    {
+        Item = CONTAINING_RECORD(CurrentEntry, LOGFILE, ListEntry);
+        CurrentEntry = CurrentEntry->Flink;
+
+        /*
+         * Only the permanent logs get written to. They are only closed by
+         * LogfCloseAll, so waiting for their lock with the list locked is safe.
+         */
+        if (!Item->Permanent)
+            continue;
+
+        RtlAcquireResourceExclusive(&Item->Lock, TRUE);
+        if (Item->LogFile.DirtyRecords != 0)
+            LogfpFlushLog(Item);
+        RtlReleaseResource(&Item->Lock);
+    }
+
+    LeaveCriticalSection(&LogFileListCs);
+}
+
 NTSTATUS
 LogfClearFile(PLOGFILE LogFile,
               PUNICODE_STRING BackupFileName)
@@ -506,6 +766,9 @@ LogfBackupFile(PLOGFILE LogFile,
 
     DPRINT("LogfBackupFile(%p, %wZ)\n", LogFile, BackupFileName);
 
+    /* The backup file is written with plain file I/O */
+    RtlZeroMemory(&BackupLogFile, sizeof(BackupLogFile));
+
     /* Lock the log file shared */
     RtlAcquireResourceShared(&LogFile->Lock, TRUE);
 
@@ -857,10 +1120,12 @@ Quit:
 NTSTATUS
 LogfWriteRecord(PLOGFILE LogFile,
                 PEVENTLOGRECORD Record,
-                SIZE_T BufSize)
+                SIZE_T BufSize,
+                BOOLEAN Durable)
 {
     NTSTATUS Status;
     LARGE_INTEGER SystemTime;
+    ULONG Sequence = 0;
 
     // ASSERT(sizeof(*Record) == sizeof(RecBuf));
 
@@ -885,9 +1150,38 @@ LogfWriteRecord(PLOGFILE LogFile,
         DPRINT1("Log file `%S' is full!\n", LogFile->LogName);
     }
 
+    if (NT_SUCCESS(Status))
+    {
+        Sequence = ++LogFile->WriteSequence;
+
+        /* Flush now if too many records are pending, or have it done later */
+        if (!LogfFlushThread ||
+            LogFile->LogFile.DirtyRecords >= LOGF_FLUSH_THRESHOLD)
+        {
+            LogfpFlushLog(LogFile);
+        }
+        else if (LogFile->LogFile.DirtyRecords == 1)
+        {
+            SetEvent(LogfFlushEvent);
+        }
+    }
+
     /* Unlock the log file */
     RtlReleaseResource(&LogFile->Lock);
 
+    /*
+     * The caller wants the record on disk before returning. The log got
+     * unlocked meanwhile so that other writers can append their records,
+     * hence a single flush commits all the records written in between.
+     */
+    if (Durable && NT_SUCCESS(Status))
+    {
+        RtlAcquireResourceExclusive(&LogFile->Lock, TRUE);
+        if ((LONG)(LogFile->FlushSequence - Sequence) < 0)
+            Status = LogfpFlushLog(LogFile);
+        RtlReleaseResource(&LogFile->Lock);
+    }
+
     return Status;
 }
 
@@ -1084,7 +1378,7 @@ LogfReportEvent(USHORT wType,
         return;
     }
 
-    Status = LogfWriteRecord(EventLogSource->LogFile, LogBuffer, RecSize);
+    Status = LogfWriteRecord(EventLogSource->LogFile, LogBuffer, RecSize, FALSE);
     if (!NT_SUCCESS(Status))
     {
         DPRINT1("ERROR writing to event log `%S' (Status 0x%08lx)\n",
@@ -222,7 +222,7 @@ NTSTATUS ProcessPortMessage(VOID)
 
             if (!onLiveCD && SystemLog)
             {
-                Status = LogfWriteRecord(SystemLog, LogBuffer, RecSize);
+                Status = LogfWriteRecord(SystemLog, LogBuffer, RecSize, FALSE);
                 if (!NT_SUCCESS(Status))
                 {
                     DPRINT1("ERROR writing to event log `%S' (Status 0x%08lx)\n",
@@ -694,7 +694,12 @@ ElfrIntReportEventW(
         return STATUS_NO_MEMORY;
     }
 
-    Status = LogfWriteRecord(pLogHandle->LogFile, LogBuffer, RecSize);
+    /* Audit records must not get lost, have them committed to disk */
+    Status = LogfWriteRecord(pLogHandle->LogFile,
+                             LogBuffer,
+                             RecSize,
+                             (EventType == EVENTLOG_AUDIT_SUCCESS ||
+                              EventType == EVENTLOG_AUDIT_FAILURE));
     if (!NT_SUCCESS(Status))
     {
         DPRINT1("ERROR writing to event log `%S' (Status 0x%08lx)\n",
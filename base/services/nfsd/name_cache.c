@@ -39,7 +39,20 @@ enum {
 };
 
 
-#define NAME_CACHE_EXPIRATION 20 /* TODO: get from configuration */
+/* attribute cache timeouts, in seconds
+ *
+ *   like the acregmin/acregmax/acdirmin/acdirmax mount options on unix
+ * clients, attributes are trusted for a period that grows with the time
+ * since the file was last modified: files that haven't changed in a while
+ * are unlikely to change soon.  the timeout is a tenth of the file's age,
+ * clamped to the min/max for its type.  these can be overridden with the
+ * --acregmin, --acregmax, --acdirmin and --acdirmax command line options */
+uint32_t attr_cache_acregmin = 3;
+uint32_t attr_cache_acregmax = 60;
+uint32_t attr_cache_acdirmin = 30;
+uint32_t attr_cache_acdirmax = 60;
+
+#define NAME_CACHE_EXPIRATION attr_cache_acdirmin
 
 /* allow up to 256K of memory for name and attribute cache entries */
 #define NAME_CACHE_MAX_SIZE 262144
@@ -56,7 +69,7 @@ enum {
  *
  *   delegations provide a guarantee that no links or attributes will change
  * without notice.  the name cache takes advantage of this by preventing
- * delegated entries from being removed on NAME_CACHE_EXPIRATION, though
+ * delegated entries from being removed on expiration, though
  * they're still removed when a parent is invalidated.  the attribute cache
  * holds an extra reference on delegated entries to prevent their removal
  * entirely, until the delegation is returned.
@@ -279,11 +292,29 @@ out_err_free:
     goto out;
 }
 
+static time_t attr_cache_timeout(
+    IN const struct attr_cache_entry *entry)
+{
+    const bool_t is_dir = entry->type == NF4DIR;
+    const time_t min = is_dir ? attr_cache_acdirmin : attr_cache_acregmin;
+    const time_t max = is_dir ? attr_cache_acdirmax : attr_cache_acregmax;
+    const time_t age = time(NULL) - (time_t)entry->time_modify_s;
+    time_t timeout = age > 0 ? age / 10 : 0;
+
+    if (timeout < min)
+        timeout = min;
+    if (timeout > max)
+        timeout = max;
+    return timeout;
+}
+
 static void attr_cache_update(
     IN struct attr_cache_entry *entry,
     IN const nfs41_file_info *info,
     IN enum open_delegation_type4 delegation)
 {
+    bool_t expire = FALSE;
+
     /* update the attributes present in mask */
     if (info->attrmask.count >= 1) {
         if (info->attrmask.arr[0] & FATTR4_WORD0_TYPE)
@@ -292,7 +323,7 @@ static void attr_cache_update(
             entry->change = info->change;
             /* revalidate whenever we get a change attribute */
             entry->invalidated = 0;
-            entry->expiration = time(NULL) + NAME_CACHE_EXPIRATION;
+            expire = TRUE;
         }
         if (info->attrmask.arr[0] & FATTR4_WORD0_SIZE)
             entry->size = info->size;
@@ -322,6 +353,10 @@ static void attr_cache_update(
             entry->system = info->system;
     }
 
+    /* compute the timeout after the type and mtime are updated */
+    if (expire)
+        entry->expiration = time(NULL) + attr_cache_timeout(entry);
+
     if (is_delegation(delegation))
         entry->delegated = TRUE;
 }
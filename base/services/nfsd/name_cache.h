@@ -39,6 +39,12 @@ static __inline struct nfs41_name_cache* session_name_cache(
 
 
 /* attribute cache */
+/* timeouts in seconds for regular files and directories */
+extern uint32_t attr_cache_acregmin;
+extern uint32_t attr_cache_acregmax;
+extern uint32_t attr_cache_acdirmin;
+extern uint32_t attr_cache_acdirmax;
+
 int nfs41_attr_cache_lookup(
     IN struct nfs41_name_cache *cache,
     IN uint64_t fileid,
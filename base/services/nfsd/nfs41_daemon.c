@@ -31,6 +31,7 @@
 #include "nfs41_np.h" /* for NFS41NP_SHARED_MEMORY */
 
 #include "idmap.h"
+#include "name_cache.h"
 #include "daemon_debug.h"
 #include "upcall.h"
 #include "util.h"
@@ -176,7 +177,19 @@ static bool_t check_for_files()
 static void PrintUsage()
 {
     fprintf(stderr, "Usage: nfsd.exe -d <debug_level> --noldap "
-        "--uid <non-zero value> --gid\n");
+        "--uid <non-zero value> --gid --acregmin <sec> --acregmax <sec> "
+        "--acdirmin <sec> --acdirmax <sec>\n");
+}
+static bool_t parse_timeout_arg(int argc, TCHAR *argv[], int *i,
+                                const char *name, uint32_t *out)
+{
+    if (++(*i) >= argc) {
+        fprintf(stderr, "Missing %s value\n", name);
+        PrintUsage();
+        return FALSE;
+    }
+    *out = (uint32_t)_ttoi(argv[*i]);
+    return TRUE;
 }
 static bool_t parse_cmdlineargs(int argc, TCHAR *argv[], nfsd_args *out)
 {
@@ -228,12 +241,40 @@ static bool_t parse_cmdlineargs(int argc, TCHAR *argv[], nfsd_args *out)
                 }
                 default_gid = _ttoi(argv[i]);
             }
+            else if (_tcscmp(argv[i], TEXT("--acregmin")) == 0) {
+                if (!parse_timeout_arg(argc, argv, &i, "acregmin",
+                        &attr_cache_acregmin))
+                    return FALSE;
+            }
+            else if (_tcscmp(argv[i], TEXT("--acregmax")) == 0) {
+                if (!parse_timeout_arg(argc, argv, &i, "acregmax",
+                        &attr_cache_acregmax))
+                    return FALSE;
+            }
+            else if (_tcscmp(argv[i], TEXT("--acdirmin")) == 0) {
+                if (!parse_timeout_arg(argc, argv, &i, "acdirmin",
+                        &attr_cache_acdirmin))
+                    return FALSE;
+            }
+            else if (_tcscmp(argv[i], TEXT("--acdirmax")) == 0) {
+                if (!parse_timeout_arg(argc, argv, &i, "acdirmax",
+                        &attr_cache_acdirmax))
+                    return FALSE;
+            }
             else
                 fprintf(stderr, "Unrecognized option '%s', disregarding.\n", argv[i]);
         }
     }
+    if (attr_cache_acregmax < attr_cache_acregmin)
+        attr_cache_acregmax = attr_cache_acregmin;
+    if (attr_cache_acdirmax < attr_cache_acdirmin)
+        attr_cache_acdirmax = attr_cache_acdirmin;
+
     fprintf(stdout, "parse_cmdlineargs: debug_level %d ldap is %d\n", 
         out->debug_level, out->ldap_enable);
+    fprintf(stdout, "parse_cmdlineargs: attribute cache timeouts "
+        "reg %u-%us dir %u-%us\n", attr_cache_acregmin, attr_cache_acregmax,
+        attr_cache_acdirmin, attr_cache_acdirmax);
     return TRUE;
 }
 
@@ -27,6 +27,7 @@
 #include "daemon_debug.h"
 #include "upcall.h"
 #include "util.h"
+#include "name_cache.h"
 
 
 typedef union _FILE_DIR_INFO_UNION {
@@ -576,6 +577,17 @@ fetch_entries:
             }
             state->cookie.cookie = entry->cookie;
 
+            /* refresh any cached attributes for entries that came from the
+             * server, so that a directory listing followed by opens or stats
+             * of its entries doesn't have to go back to the server for each
+             * one.  the dot entries and single lookups (with cookie 0) were
+             * filled in from the cache or by lookup */
+            if (entry->cookie && entry->cookie != COOKIE_DOT &&
+                entry->cookie != COOKIE_DOTDOT &&
+                !entry->attr_info.rdattr_error)
+                nfs41_attr_cache_update(session_name_cache(state->session),
+                    entry->attr_info.fileid, &entry->attr_info);
+
             /* last entry we got from the server */
             if (!entry->next_entry_offset)
                 break;
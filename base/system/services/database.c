@@ -34,6 +34,37 @@ static DWORD NoInteractiveServices = 0;
 static CRITICAL_SECTION ControlServiceCriticalSection;
 static DWORD PipeTimeout = 30000; /* 30 Seconds */
 
+/* The critical section protects the image list while services start concurrently */
+static CRITICAL_SECTION ImageListCriticalSection;
+
+/* How many auto-start services may be starting at the same time */
+static DWORD StartParallelism = 4;
+
+/* An auto-start service waiting for its turn */
+typedef struct _AUTOSTART_ENTRY
+{
+    PSERVICE Service;
+    LPWSTR lpImagePath;
+    DWORD dwStage;          /* Only the lowest unfinished stage may run */
+    DWORD dwAfter;          /* Entry to start after within the stage, or MAXDWORD */
+    PDWORD pdwDependencies; /* Entries which must have been started before */
+    DWORD dwDependencyCount;
+    DWORD dwState;
+    DWORD dwStartTime;
+    DWORD dwElapsed;
+    DWORD dwError;
+} AUTOSTART_ENTRY, *PAUTOSTART_ENTRY;
+
+#define AUTOSTART_PENDING 0
+#define AUTOSTART_RUNNING 1
+#define AUTOSTART_DONE    2
+
+typedef struct _AUTOSTART_PLAN
+{
+    PAUTOSTART_ENTRY Entries;
+    DWORD dwCount;
+} AUTOSTART_PLAN, *PAUTOSTART_PLAN;
+
 
 /* FUNCTIONS *****************************************************************/
 
@@ -442,7 +473,9 @@ ScmRemoveServiceImage(PSERVICE_IMAGE pServiceImage)
     /* FIXME: Terminate the process */
 
     /* Remove the service image from the list */
+    EnterCriticalSection(&ImageListCriticalSection);
     RemoveEntryList(&pServiceImage->ImageListEntry);
+    LeaveCriticalSection(&ImageListCriticalSection);
 
     /* Close the process handle */
     if (pServiceImage->hProcess != INVALID_HANDLE_VALUE)
@@ -1818,7 +1851,9 @@ ScmLoadService(PSERVICE Service,
     else // if (Service->Status.dwServiceType & (SERVICE_WIN32 | SERVICE_INTERACTIVE_PROCESS))
     {
         /* Start user-mode service */
+        EnterCriticalSection(&ImageListCriticalSection);
         dwError = ScmCreateOrReferenceServiceImage(Service);
+        LeaveCriticalSection(&ImageListCriticalSection);
         if (dwError == ERROR_SUCCESS)
         {
             dwError = ScmStartUserModeService(Service, argc, argv);
@@ -1829,12 +1864,14 @@ ScmLoadService(PSERVICE Service,
             }
             else
             {
+                EnterCriticalSection(&ImageListCriticalSection);
                 Service->lpImage->dwImageRunCount--;
                 if (Service->lpImage->dwImageRunCount == 0)
                 {
                     ScmRemoveServiceImage(Service->lpImage);
                     Service->lpImage = NULL;
                 }
+                LeaveCriticalSection(&ImageListCriticalSection);
             }
         }
     }
@@ -1941,6 +1978,285 @@ done:
 }
 
 
+static DWORD
+ScmQueueAutoStart(PAUTOSTART_PLAN Plan,
+                  PSERVICE Service,
+                  DWORD dwStage,
+                  DWORD dwAfter)
+{
+    PAUTOSTART_ENTRY Entry;
+
+    Service->ServiceVisited = TRUE;
+
+    /* Without a plan, start the service right away */
+    if (Plan->Entries == NULL)
+    {
+        ScmLoadService(Service, 0, NULL);
+        return MAXDWORD;
+    }
+
+    Entry = &Plan->Entries[Plan->dwCount];
+    Entry->Service = Service;
+    Entry->dwStage = dwStage;
+    Entry->dwAfter = dwAfter;
+    Entry->dwState = AUTOSTART_PENDING;
+
+    return Plan->dwCount++;
+}
+
+
+static VOID
+ScmAddAutoStartDependency(PDWORD pdwList,
+                          PDWORD pdwCount,
+                          DWORD dwIndex)
+{
+    DWORD i;
+
+    for (i = 0; i < *pdwCount; i++)
+    {
+        if (pdwList[i] == dwIndex)
+            return;
+    }
+
+    pdwList[(*pdwCount)++] = dwIndex;
+}
+
+
+static VOID
+ScmResolveAutoStartDependencies(PAUTOSTART_PLAN Plan)
+{
+    PAUTOSTART_ENTRY Entries = Plan->Entries;
+    PSERVICE_GROUP Group;
+    LPWSTR lpDependencies;
+    LPWSTR lpDependency;
+    DWORD dwDependenciesLength;
+    PDWORD pdwList;
+    DWORD dwCount;
+    HKEY hServiceKey;
+    DWORD i, j;
+    BOOL bMatch;
+
+    /* No entry can depend on more than all the others */
+    pdwList = HeapAlloc(GetProcessHeap(), 0, Plan->dwCount * sizeof(DWORD));
+    if (pdwList == NULL)
+        return;
+
+    for (i = 0; i < Plan->dwCount; i++)
+    {
+        dwCount = 0;
+
+        /* Keep the tag order within a group */
+        if (Entries[i].dwAfter != MAXDWORD)
+            ScmAddAutoStartDependency(pdwList, &dwCount, Entries[i].dwAfter);
+
+        if (ScmOpenServiceKey(Entries[i].Service->lpServiceName,
+                              KEY_READ,
+                              &hServiceKey) == ERROR_SUCCESS)
+        {
+            /*
+             * Services sharing a process must not start concurrently: all
+             * but the first one are started through the control pipe of the
+             * process the first one creates.
+             */
+            if (!(Entries[i].Service->Status.dwServiceType & SERVICE_DRIVER) &&
+                ScmReadString(hServiceKey,
+                              L"ImagePath",
+                              &Entries[i].lpImagePath) == ERROR_SUCCESS)
+            {
+                for (j = i; j-- > 0; )
+                {
+                    if (Entries[j].lpImagePath != NULL &&
+                        _wcsicmp(Entries[j].lpImagePath, Entries[i].lpImagePath) == 0)
+                    {
+                        ScmAddAutoStartDependency(pdwList, &dwCount, j);
+                        break;
+                    }
+                }
+            }
+
+            /* Add the services and groups it depends on */
+            if (ScmReadDependencies(hServiceKey,
+                                    &lpDependencies,
+                                    &dwDependenciesLength) == ERROR_SUCCESS &&
+                lpDependencies != NULL)
+            {
+                lpDependency = lpDependencies;
+                while (*lpDependency != 0)
+                {
+                    for (j = 0; j < Plan->dwCount; j++)
+                    {
+                        if (j == i)
+                            continue;
+
+                        if (*lpDependency == SC_GROUP_IDENTIFIERW)
+                        {
+                            Group = Entries[j].Service->lpGroup;
+                            bMatch = (Group != NULL &&
+                                      _wcsicmp(Group->lpGroupName, lpDependency + 1) == 0);
+                        }
+                        else
+                        {
+                            bMatch = (_wcsicmp(Entries[j].Service->lpServiceName, lpDependency) == 0);
+                        }
+
+                        if (bMatch)
+                            ScmAddAutoStartDependency(pdwList, &dwCount, j);
+                    }
+
+                    lpDependency += wcslen(lpDependency) + 1;
+                }
+
+                HeapFree(GetProcessHeap(), 0, lpDependencies);
+            }
+
+            RegCloseKey(hServiceKey);
+        }
+
+        if (dwCount == 0)
+            continue;
+
+        Entries[i].pdwDependencies = HeapAlloc(GetProcessHeap(), 0, dwCount * sizeof(DWORD));
+        if (Entries[i].pdwDependencies == NULL)
+        {
+            /* Fall back to waiting for everything before it */
+            Entries[i].dwAfter = (i > 0) ? i - 1 : MAXDWORD;
+            continue;
+        }
+
+        CopyMemory(Entries[i].pdwDependencies, pdwList, dwCount * sizeof(DWORD));
+        Entries[i].dwDependencyCount = dwCount;
+    }
+
+    HeapFree(GetProcessHeap(), 0, pdwList);
+}
+
+
+static BOOL
+ScmIsAutoStartReady(PAUTOSTART_PLAN Plan,
+                    PAUTOSTART_ENTRY Entry)
+{
+    DWORD i;
+
+    if (Entry->dwAfter != MAXDWORD &&
+        Plan->Entries[Entry->dwAfter].dwState != AUTOSTART_DONE)
+        return FALSE;
+
+    for (i = 0; i < Entry->dwDependencyCount; i++)
+    {
+        if (Plan->Entries[Entry->pdwDependencies[i]].dwState != AUTOSTART_DONE)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static DWORD WINAPI
+ScmAutoStartThread(LPVOID lpParameter)
+{
+    PAUTOSTART_ENTRY Entry = (PAUTOSTART_ENTRY)lpParameter;
+
+    Entry->dwError = ScmLoadService(Entry->Service, 0, NULL);
+    Entry->dwElapsed = GetTickCount() - Entry->dwStartTime;
+
+    return 0;
+}
+
+
+static VOID
+ScmRunAutoStartPlan(PAUTOSTART_PLAN Plan)
+{
+    HANDLE hThreads[MAXIMUM_WAIT_OBJECTS];
+    DWORD dwRunning[MAXIMUM_WAIT_OBJECTS];
+    DWORD dwRunningCount = 0;
+    DWORD dwRemaining = Plan->dwCount;
+    PAUTOSTART_ENTRY Entry;
+    DWORD dwStage;
+    DWORD dwWait;
+    DWORD i;
+
+    while (dwRemaining > 0)
+    {
+        /* Groups start in order, find the first one not done yet */
+        dwStage = MAXDWORD;
+        for (i = 0; i < Plan->dwCount; i++)
+        {
+            if (Plan->Entries[i].dwState != AUTOSTART_DONE &&
+                Plan->Entries[i].dwStage < dwStage)
+                dwStage = Plan->Entries[i].dwStage;
+        }
+
+        /* Start whatever is ready in it, as far as the parallelism allows */
+        for (i = 0; i < Plan->dwCount && dwRunningCount < StartParallelism; i++)
+        {
+            Entry = &Plan->Entries[i];
+            if (Entry->dwState != AUTOSTART_PENDING ||
+                Entry->dwStage != dwStage ||
+                !ScmIsAutoStartReady(Plan, Entry))
+                continue;
+
+            Entry->dwState = AUTOSTART_RUNNING;
+            Entry->dwStartTime = GetTickCount();
+
+            hThreads[dwRunningCount] = CreateThread(NULL, 0, ScmAutoStartThread, Entry, 0, NULL);
+            if (hThreads[dwRunningCount] == NULL)
+            {
+                /* Start it from here then */
+                ScmAutoStartThread(Entry);
+                Entry->dwState = AUTOSTART_DONE;
+                dwRemaining--;
+                continue;
+            }
+
+            dwRunning[dwRunningCount++] = i;
+        }
+
+        if (dwRunningCount == 0)
+        {
+            if (dwRemaining == 0)
+                break;
+
+            /*
+             * Nothing is ready, because of a dependency loop or a dependency
+             * on a later group. Start the first pending service of the stage
+             * anyway, as the services were started in order before.
+             */
+            for (i = 0; i < Plan->dwCount; i++)
+            {
+                Entry = &Plan->Entries[i];
+                if (Entry->dwState == AUTOSTART_PENDING && Entry->dwStage == dwStage)
+                {
+                    DPRINT1("Starting '%S' before its dependencies\n", Entry->Service->lpServiceName);
+                    Entry->dwAfter = MAXDWORD;
+                    Entry->dwDependencyCount = 0;
+                    break;
+                }
+            }
+            continue;
+        }
+
+        /* Wait for one of the starting services */
+        dwWait = WaitForMultipleObjects(dwRunningCount, hThreads, FALSE, INFINITE);
+        if (dwWait >= WAIT_OBJECT_0 + dwRunningCount)
+        {
+            DPRINT1("WaitForMultipleObjects() failed (Error %lu)\n", GetLastError());
+            dwWait = WAIT_OBJECT_0;
+            WaitForSingleObject(hThreads[0], INFINITE);
+        }
+
+        i = dwWait - WAIT_OBJECT_0;
+        CloseHandle(hThreads[i]);
+        Plan->Entries[dwRunning[i]].dwState = AUTOSTART_DONE;
+        dwRemaining--;
+
+        /* Fill the hole with the last one */
+        dwRunningCount--;
+        hThreads[i] = hThreads[dwRunningCount];
+        dwRunning[i] = dwRunning[dwRunningCount];
+    }
+}
+
+
 VOID
 ScmAutoStartServices(VOID)
 {
@@ -1954,6 +2270,11 @@ ScmAutoStartServices(VOID)
     HKEY hKey;
     DWORD dwKeySize;
     ULONG i;
+    AUTOSTART_PLAN Plan;
+    DWORD dwServiceCount;
+    DWORD dwStage;
+    DWORD dwLastTagged;
+    DWORD dwStartTime;
 
     /*
      * This function MUST be called ONLY at initialization time.
@@ -1987,10 +2308,12 @@ ScmAutoStartServices(VOID)
     EnterCriticalSection(&ControlServiceCriticalSection);
 
     /* Clear 'ServiceVisited' flag (or set if not to start in Safe Mode) */
+    dwServiceCount = 0;
     ServiceEntry = ServiceListHead.Flink;
     while (ServiceEntry != &ServiceListHead)
     {
         CurrentService = CONTAINING_RECORD(ServiceEntry, SERVICE, ServiceListEntry);
+        dwServiceCount++;
 
         /* Build the safe boot path */
         StringCchCopyW(szSafeBootServicePath, ARRAYSIZE(szSafeBootServicePath),
@@ -2055,6 +2378,20 @@ ScmAutoStartServices(VOID)
         ServiceEntry = ServiceEntry->Flink;
     }
 
+    /*
+     * Collect the services to start, in the order they used to be started.
+     * Each group is a stage of its own which starts after the previous one
+     * is done, within a stage the services start concurrently as soon as
+     * their dependencies have. If the plan can't be allocated, the services
+     * are started one by one right away.
+     */
+    Plan.dwCount = 0;
+    Plan.Entries = HeapAlloc(GetProcessHeap(),
+                             HEAP_ZERO_MEMORY,
+                             (dwServiceCount + 1) * sizeof(AUTOSTART_ENTRY));
+    dwStage = 0;
+    dwStartTime = GetTickCount();
+
     /* Start all services which are members of an existing group */
     GroupEntry = GroupListHead.Flink;
     while (GroupEntry != &GroupListHead)
@@ -2062,6 +2399,7 @@ ScmAutoStartServices(VOID)
         CurrentGroup = CONTAINING_RECORD(GroupEntry, SERVICE_GROUP, GroupListEntry);
 
         DPRINT("Group '%S'\n", CurrentGroup->lpGroupName);
+        dwLastTagged = MAXDWORD;
 
         /* Start all services witch have a valid tag */
         for (i = 0; i < CurrentGroup->TagCount; i++)
@@ -2076,8 +2414,8 @@ ScmAutoStartServices(VOID)
                     (CurrentService->ServiceVisited == FALSE) &&
                     (CurrentService->dwTag == CurrentGroup->TagArray[i]))
                 {
-                    CurrentService->ServiceVisited = TRUE;
-                    ScmLoadService(CurrentService, 0, NULL);
+                    /* Tagged services start one after the other */
+                    dwLastTagged = ScmQueueAutoStart(&Plan, CurrentService, dwStage, dwLastTagged);
                 }
 
                 ServiceEntry = ServiceEntry->Flink;
@@ -2094,13 +2432,13 @@ ScmAutoStartServices(VOID)
                 (CurrentService->dwStartType == SERVICE_AUTO_START) &&
                 (CurrentService->ServiceVisited == FALSE))
             {
-                CurrentService->ServiceVisited = TRUE;
-                ScmLoadService(CurrentService, 0, NULL);
+                ScmQueueAutoStart(&Plan, CurrentService, dwStage, dwLastTagged);
             }
 
             ServiceEntry = ServiceEntry->Flink;
         }
 
+        dwStage++;
         GroupEntry = GroupEntry->Flink;
     }
 
@@ -2114,13 +2452,14 @@ ScmAutoStartServices(VOID)
             (CurrentService->dwStartType == SERVICE_AUTO_START) &&
             (CurrentService->ServiceVisited == FALSE))
         {
-            CurrentService->ServiceVisited = TRUE;
-            ScmLoadService(CurrentService, 0, NULL);
+            ScmQueueAutoStart(&Plan, CurrentService, dwStage, MAXDWORD);
         }
 
         ServiceEntry = ServiceEntry->Flink;
     }
 
+    dwStage++;
+
     /* Start all services which are not a member of any group */
     ServiceEntry = ServiceListHead.Flink;
     while (ServiceEntry != &ServiceListHead)
@@ -2131,13 +2470,39 @@ ScmAutoStartServices(VOID)
             (CurrentService->dwStartType == SERVICE_AUTO_START) &&
             (CurrentService->ServiceVisited == FALSE))
         {
-            CurrentService->ServiceVisited = TRUE;
-            ScmLoadService(CurrentService, 0, NULL);
+            ScmQueueAutoStart(&Plan, CurrentService, dwStage, MAXDWORD);
         }
 
         ServiceEntry = ServiceEntry->Flink;
     }
 
+    if (Plan.Entries != NULL)
+    {
+        /* Start them */
+        ScmResolveAutoStartDependencies(&Plan);
+        ScmRunAutoStartPlan(&Plan);
+
+        /* Report how long each one took */
+        for (i = 0; i < Plan.dwCount; i++)
+        {
+            DPRINT1("Service '%S' took %lu ms to start (Error %lu)\n",
+                    Plan.Entries[i].Service->lpServiceName,
+                    Plan.Entries[i].dwElapsed,
+                    Plan.Entries[i].dwError);
+
+            if (Plan.Entries[i].pdwDependencies != NULL)
+                HeapFree(GetProcessHeap(), 0, Plan.Entries[i].pdwDependencies);
+
+            if (Plan.Entries[i].lpImagePath != NULL)
+                HeapFree(GetProcessHeap(), 0, Plan.Entries[i].lpImagePath);
+        }
+
+        HeapFree(GetProcessHeap(), 0, Plan.Entries);
+    }
+
+    DPRINT1("Auto-start services started in %lu ms, %lu at a time\n",
+            GetTickCount() - dwStartTime, StartParallelism);
+
     /* Clear 'ServiceVisited' flag again */
     ServiceEntry = ServiceListHead.Flink;
     while (ServiceEntry != &ServiceListHead)
@@ -2219,6 +2584,7 @@ ScmInitNamedPipeCriticalSection(VOID)
     DWORD dwError;
 
     InitializeCriticalSection(&ControlServiceCriticalSection);
+    InitializeCriticalSection(&ImageListCriticalSection);
 
     dwError = RegOpenKeyExW(HKEY_LOCAL_MACHINE,
                             L"SYSTEM\\CurrentControlSet\\Control",
@@ -2234,14 +2600,29 @@ ScmInitNamedPipeCriticalSection(VOID)
                          NULL,
                          (LPBYTE)&PipeTimeout,
                          &dwKeySize);
+
+        dwKeySize = sizeof(StartParallelism);
+        RegQueryValueExW(hKey,
+                         L"ServicesStartParallelism",
+                         0,
+                         NULL,
+                         (LPBYTE)&StartParallelism,
+                         &dwKeySize);
        RegCloseKey(hKey);
    }
+
+    /* We can't wait for more threads than that */
+    if (StartParallelism == 0)
+        StartParallelism = 1;
+    else if (StartParallelism > MAXIMUM_WAIT_OBJECTS)
+        StartParallelism = MAXIMUM_WAIT_OBJECTS;
 }
 
 
 VOID
 ScmDeleteNamedPipeCriticalSection(VOID)
 {
+    DeleteCriticalSection(&ImageListCriticalSection);
     DeleteCriticalSection(&ControlServiceCriticalSection);
 }
 
@@ -102,6 +102,24 @@ ScmWaitForLsa(VOID)
 }
 
 
+static
+VOID
+ScmReportBootPhase(ULONG Phase)
+{
+    PREFETCHER_INFORMATION PrefetcherInfo;
+
+    /* Let the kernel put the phase on its boot timeline */
+    PrefetcherInfo.Version = PF_CURRENT_VERSION;
+    PrefetcherInfo.Magic = PF_SYSINFO_MAGIC_NUMBER;
+    PrefetcherInfo.PrefetcherInformationClass = PrefetcherBootPhase;
+    PrefetcherInfo.PrefetcherInformation = &Phase;
+    PrefetcherInfo.PrefetcherInformationLength = sizeof(Phase);
+    NtSetSystemInformation(SystemPrefetcherInformation,
+                           &PrefetcherInfo,
+                           sizeof(PrefetcherInfo));
+}
+
+
 BOOL WINAPI
 ShutdownHandlerRoutine(DWORD dwCtrlType)
 {
@@ -411,7 +429,9 @@ wWinMain(HINSTANCE hInstance,
     ScmApplyServiceAccountsHack();
 
     /* Start auto-start services */
+    ScmReportBootPhase(PfPostVideoInitPhase);
     ScmAutoStartServices();
+    ScmReportBootPhase(PfBootAcceptedRegistryInitPhase);
 
     /* Signal auto-start complete event */
     SetEvent(hScmAutoStartCompleteEvent);
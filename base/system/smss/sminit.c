@@ -40,6 +40,9 @@ PISECURITY_DESCRIPTOR SmpKnownDllsSecurityDescriptor, SmpApiPortSecurityDescript
 ULONG SmpAllowProtectedRenames, SmpProtectionMode = 1;
 BOOLEAN MiniNTBoot = FALSE;
 
+HANDLE SmpKnownDllsDirHandle, SmpKnownDllsDirFileHandle;
+HANDLE SmpKnownDllsThread, SmpPagingFilesThread;
+
 #define SMSS_CHECKPOINT(x, y)           \
 {                                       \
     SmpInitProgressByLine = __LINE__;   \
@@ -781,6 +784,39 @@ SmpRegistryConfigurationTable[] =
 
 /* FUNCTIONS ******************************************************************/
 
+VOID
+NTAPI
+SmpTraceInitTime(IN PCSTR Phase,
+                 IN PLARGE_INTEGER StartTime)
+{
+    LARGE_INTEGER Counter, Frequency;
+
+    /* Tell how long this initialization phase took */
+    NtQueryPerformanceCounter(&Counter, &Frequency);
+    if (!Frequency.QuadPart) return;
+    DPRINT1("SMSS: %s took %lu ms\n",
+            Phase,
+            (ULONG)((Counter.QuadPart - StartTime->QuadPart) * 1000 /
+                    Frequency.QuadPart));
+}
+
+VOID
+NTAPI
+SmpReportBootPhase(IN ULONG Phase)
+{
+    PREFETCHER_INFORMATION PrefetcherInfo;
+
+    /* Let the kernel put the phase on its boot timeline */
+    PrefetcherInfo.Version = PF_CURRENT_VERSION;
+    PrefetcherInfo.Magic = PF_SYSINFO_MAGIC_NUMBER;
+    PrefetcherInfo.PrefetcherInformationClass = PrefetcherBootPhase;
+    PrefetcherInfo.PrefetcherInformation = &Phase;
+    PrefetcherInfo.PrefetcherInformationLength = sizeof(Phase);
+    NtSetSystemInformation(SystemPrefetcherInformation,
+                           &PrefetcherInfo,
+                           sizeof(PrefetcherInfo));
+}
+
 VOID
 NTAPI
 SmpTranslateSystemPartitionInformation(VOID)
@@ -1384,13 +1420,12 @@ SmpProcessModuleImports(IN PVOID Unused,
     SmpSaveRegistryValue(&SmpKnownDllsList, DllName, DllValue, TRUE);
 }
 
-NTSTATUS
+VOID
 NTAPI
-SmpInitializeKnownDllsInternal(IN PUNICODE_STRING Directory,
-                               IN PUNICODE_STRING Path)
+SmpCreateKnownDllSections(IN HANDLE DirHandle,
+                          IN HANDLE DirFileHandle)
 {
-    HANDLE DirFileHandle, DirHandle, SectionHandle, FileHandle, LinkHandle;
-    UNICODE_STRING NtPath, DestinationString;
+    HANDLE SectionHandle, FileHandle;
     OBJECT_ATTRIBUTES ObjectAttributes;
     NTSTATUS Status, Status1;
     PLIST_ENTRY NextEntry;
@@ -1398,100 +1433,22 @@ SmpInitializeKnownDllsInternal(IN PUNICODE_STRING Directory,
     ULONG_PTR ErrorParameters[3];
     UNICODE_STRING ErrorResponse;
     IO_STATUS_BLOCK IoStatusBlock;
-    SECURITY_DESCRIPTOR_CONTROL OldFlag = 0;
     USHORT ImageCharacteristics;
+    SECURITY_DESCRIPTOR SectionSDBody;
+    PSECURITY_DESCRIPTOR SectionDescriptor = NULL;
 
-    /* Initialize to NULL */
-    DirFileHandle = NULL;
-    DirHandle = NULL;
-    NtPath.Buffer = NULL;
-
-    /* Create the \KnownDLLs directory */
-    InitializeObjectAttributes(&ObjectAttributes,
-                               Directory,
-                               OBJ_CASE_INSENSITIVE | OBJ_OPENIF | OBJ_PERMANENT,
-                               NULL,
-                               SmpKnownDllsSecurityDescriptor);
-    Status = NtCreateDirectoryObject(&DirHandle,
-                                     DIRECTORY_ALL_ACCESS,
-                                     &ObjectAttributes);
-    if (!NT_SUCCESS(Status))
-    {
-        /* Handle failure */
-        DPRINT1("SMSS: Unable to create %wZ directory - Status == %lx\n",
-                Directory, Status);
-        return Status;
-    }
-
-    /* Convert the path to native format */
-    if (!RtlDosPathNameToNtPathName_U(Path->Buffer, &NtPath, NULL, NULL))
-    {
-        /* Fail if this didn't work */
-        DPRINT1("SMSS: Unable to to convert %wZ to an Nt path\n", Path);
-        Status = STATUS_OBJECT_NAME_INVALID;
-        goto Quickie;
-    }
-
-    /* Open the path that was specified, which should be a directory */
-    InitializeObjectAttributes(&ObjectAttributes,
-                               &NtPath,
-                               OBJ_CASE_INSENSITIVE,
-                               NULL,
-                               NULL);
-    Status = NtOpenFile(&DirFileHandle,
-                        FILE_LIST_DIRECTORY | SYNCHRONIZE,
-                        &ObjectAttributes,
-                        &IoStatusBlock,
-                        FILE_SHARE_READ | FILE_SHARE_WRITE,
-                        FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
-    if (!NT_SUCCESS(Status))
-    {
-        /* Fail if we couldn't open it */
-        DPRINT1("SMSS: Unable to open a handle to the KnownDll directory (%wZ)"
-                "- Status == %lx\n",
-                Path,
-                Status);
-        FileHandle = NULL;
-        goto Quickie;
-    }
-
-    /* Temporarily hack the SD to use a default DACL for this symbolic link */
-    if (SmpPrimarySecurityDescriptor)
-    {
-        OldFlag = SmpPrimarySecurityDescriptor->Control;
-        SmpPrimarySecurityDescriptor->Control |= SE_DACL_DEFAULTED;
-    }
-
-    /* Create a symbolic link to the directory in the object manager */
-    RtlInitUnicodeString(&DestinationString, L"KnownDllPath");
-    InitializeObjectAttributes(&ObjectAttributes,
-                               &DestinationString,
-                               OBJ_CASE_INSENSITIVE | OBJ_OPENIF | OBJ_PERMANENT,
-                               DirHandle,
-                               SmpPrimarySecurityDescriptor);
-    Status = NtCreateSymbolicLinkObject(&LinkHandle,
-                                        SYMBOLIC_LINK_ALL_ACCESS,
-                                        &ObjectAttributes,
-                                        Path);
-
-    /* Undo the hack */
-    if (SmpPrimarySecurityDescriptor) SmpPrimarySecurityDescriptor->Control = OldFlag;
-
-    /* Check if the symlink was created */
-    if (!NT_SUCCESS(Status))
+    /*
+     * Use a default DACL for the sections. This is done on a private copy of
+     * the SD, since the main thread keeps using the shared one meanwhile.
+     */
+    if (SmpLiberalSecurityDescriptor)
     {
-        /* It wasn't, so bail out since the OS needs it to exist */
-        DPRINT1("SMSS: Unable to create %wZ symbolic link - Status == %lx\n",
-                &DestinationString, Status);
-        LinkHandle = NULL;
-        goto Quickie;
+        SectionSDBody = *SmpLiberalSecurityDescriptor;
+        SectionSDBody.Control |= SE_DACL_DEFAULTED;
+        SectionDescriptor = &SectionSDBody;
     }
 
-    /* We created it permanent, we can go ahead and close the handle now */
-    Status1 = NtClose(LinkHandle);
-    ASSERT(NT_SUCCESS(Status1));
-
-    /* Now loop the known DLLs */
+    /* Loop the known DLLs */
     NextEntry = SmpKnownDllsList.Flink;
     while (NextEntry != &SmpKnownDllsList)
     {
@@ -1552,19 +1509,12 @@ SmpInitializeKnownDllsInternal(IN PUNICODE_STRING Directory,
             SmpTerminate(ErrorParameters, 5, RTL_NUMBER_OF(ErrorParameters));
         }
 
-        /* Temporarily hack the SD to use a default DACL for this section */
-        if (SmpLiberalSecurityDescriptor)
-        {
-            OldFlag = SmpLiberalSecurityDescriptor->Control;
-            SmpLiberalSecurityDescriptor->Control |= SE_DACL_DEFAULTED;
-        }
-
         /* Create the section for this known DLL */
         InitializeObjectAttributes(&ObjectAttributes,
                                    &RegEntry->Value,
                                    OBJ_PERMANENT,
                                    DirHandle,
-                                   SmpLiberalSecurityDescriptor)
+                                   SectionDescriptor)
         Status = NtCreateSection(&SectionHandle,
                                  SECTION_ALL_ACCESS,
                                  &ObjectAttributes,
@@ -1573,9 +1523,6 @@ SmpInitializeKnownDllsInternal(IN PUNICODE_STRING Directory,
                                  SEC_IMAGE,
                                  FileHandle);
 
-        /* Undo the hack */
-        if (SmpLiberalSecurityDescriptor) SmpLiberalSecurityDescriptor->Control = OldFlag;
-
         /* Check if we created the section okay */
         if (NT_SUCCESS(Status))
         {
@@ -1595,6 +1542,200 @@ SmpInitializeKnownDllsInternal(IN PUNICODE_STRING Directory,
         ASSERT(NT_SUCCESS(Status1));
     }
 
+}
+
+VOID
+NTAPI
+SmpFreeKnownDllsList(VOID)
+{
+    PSMP_REGISTRY_VALUE RegEntry;
+    PLIST_ENTRY Head, NextEntry;
+
+    /* Wipe out the list */
+    Head = &SmpKnownDllsList;
+    while (!IsListEmpty(Head))
+    {
+        /* Remove this entry */
+        NextEntry = RemoveHeadList(Head);
+
+        /* Free it */
+        RegEntry = CONTAINING_RECORD(NextEntry, SMP_REGISTRY_VALUE, Entry);
+        RtlFreeHeap(RtlGetProcessHeap(), 0, RegEntry->AnsiValue);
+        RtlFreeHeap(RtlGetProcessHeap(), 0, RegEntry->Value.Buffer);
+        RtlFreeHeap(RtlGetProcessHeap(), 0, RegEntry);
+    }
+}
+
+ULONG
+NTAPI
+SmpKnownDllsWorker(IN PVOID Parameter)
+{
+    LARGE_INTEGER StartTime;
+    NTSTATUS Status;
+
+    /* Create the sections, then drop the handles we were handed over */
+    NtQueryPerformanceCounter(&StartTime, NULL);
+    SmpCreateKnownDllSections(SmpKnownDllsDirHandle, SmpKnownDllsDirFileHandle);
+    Status = NtClose(SmpKnownDllsDirHandle);
+    ASSERT(NT_SUCCESS(Status));
+    Status = NtClose(SmpKnownDllsDirFileHandle);
+    ASSERT(NT_SUCCESS(Status));
+
+    /* The list isn't needed anymore */
+    SmpFreeKnownDllsList();
+    SmpTraceInitTime("KnownDll section creation", &StartTime);
+    RtlExitUserThread(STATUS_SUCCESS);
+    return STATUS_SUCCESS;
+}
+
+ULONG
+NTAPI
+SmpPagingFilesWorker(IN PVOID Parameter)
+{
+    LARGE_INTEGER StartTime;
+
+    /* Create all the paging files for the descriptors that we have */
+    NtQueryPerformanceCounter(&StartTime, NULL);
+    SmpCreatePagingFiles();
+    SmpTraceInitTime("Paging file creation", &StartTime);
+    RtlExitUserThread(STATUS_SUCCESS);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+SmpInitializeKnownDllsInternal(IN PUNICODE_STRING Directory,
+                               IN PUNICODE_STRING Path)
+{
+    HANDLE DirFileHandle, DirHandle, LinkHandle;
+    UNICODE_STRING NtPath, DestinationString;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    NTSTATUS Status, Status1;
+    IO_STATUS_BLOCK IoStatusBlock;
+    SECURITY_DESCRIPTOR_CONTROL OldFlag = 0;
+
+    /* Initialize to NULL */
+    DirFileHandle = NULL;
+    DirHandle = NULL;
+    NtPath.Buffer = NULL;
+
+    /* Create the \KnownDLLs directory */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               Directory,
+                               OBJ_CASE_INSENSITIVE | OBJ_OPENIF | OBJ_PERMANENT,
+                               NULL,
+                               SmpKnownDllsSecurityDescriptor);
+    Status = NtCreateDirectoryObject(&DirHandle,
+                                     DIRECTORY_ALL_ACCESS,
+                                     &ObjectAttributes);
+    if (!NT_SUCCESS(Status))
+    {
+        /* Handle failure */
+        DPRINT1("SMSS: Unable to create %wZ directory - Status == %lx\n",
+                Directory, Status);
+        return Status;
+    }
+
+    /* Convert the path to native format */
+    if (!RtlDosPathNameToNtPathName_U(Path->Buffer, &NtPath, NULL, NULL))
+    {
+        /* Fail if this didn't work */
+        DPRINT1("SMSS: Unable to to convert %wZ to an Nt path\n", Path);
+        Status = STATUS_OBJECT_NAME_INVALID;
+        goto Quickie;
+    }
+
+    /* Open the path that was specified, which should be a directory */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &NtPath,
+                               OBJ_CASE_INSENSITIVE,
+                               NULL,
+                               NULL);
+    Status = NtOpenFile(&DirFileHandle,
+                        FILE_LIST_DIRECTORY | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    if (!NT_SUCCESS(Status))
+    {
+        /* Fail if we couldn't open it */
+        DPRINT1("SMSS: Unable to open a handle to the KnownDll directory (%wZ)"
+                "- Status == %lx\n",
+                Path,
+                Status);
+        goto Quickie;
+    }
+
+    /* Temporarily hack the SD to use a default DACL for this symbolic link */
+    if (SmpPrimarySecurityDescriptor)
+    {
+        OldFlag = SmpPrimarySecurityDescriptor->Control;
+        SmpPrimarySecurityDescriptor->Control |= SE_DACL_DEFAULTED;
+    }
+
+    /* Create a symbolic link to the directory in the object manager */
+    RtlInitUnicodeString(&DestinationString, L"KnownDllPath");
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &DestinationString,
+                               OBJ_CASE_INSENSITIVE | OBJ_OPENIF | OBJ_PERMANENT,
+                               DirHandle,
+                               SmpPrimarySecurityDescriptor);
+    Status = NtCreateSymbolicLinkObject(&LinkHandle,
+                                        SYMBOLIC_LINK_ALL_ACCESS,
+                                        &ObjectAttributes,
+                                        Path);
+
+    /* Undo the hack */
+    if (SmpPrimarySecurityDescriptor) SmpPrimarySecurityDescriptor->Control = OldFlag;
+
+    /* Check if the symlink was created */
+    if (!NT_SUCCESS(Status))
+    {
+        /* It wasn't, so bail out since the OS needs it to exist */
+        DPRINT1("SMSS: Unable to create %wZ symbolic link - Status == %lx\n",
+                &DestinationString, Status);
+        LinkHandle = NULL;
+        goto Quickie;
+    }
+
+    /* We created it permanent, we can go ahead and close the handle now */
+    Status1 = NtClose(LinkHandle);
+    ASSERT(NT_SUCCESS(Status1));
+
+    /*
+     * The sections get created by a worker thread while the boot goes on. A
+     * process mapping one of the DLLs before its section shows up will just
+     * find no section and load the DLL from the KnownDllPath directory.
+     */
+    SmpKnownDllsDirHandle = DirHandle;
+    SmpKnownDllsDirFileHandle = DirFileHandle;
+    Status = RtlCreateUserThread(NtCurrentProcess(),
+                                 NULL,
+                                 FALSE,
+                                 0,
+                                 0,
+                                 0,
+                                 SmpKnownDllsWorker,
+                                 NULL,
+                                 &SmpKnownDllsThread,
+                                 NULL);
+    if (NT_SUCCESS(Status))
+    {
+        /* The worker owns both handles now */
+        DirHandle = NULL;
+        DirFileHandle = NULL;
+    }
+    else
+    {
+        /* Do it synchronously then */
+        DPRINT1("SMSS: Unable to create the KnownDll thread - Status == %lx\n",
+                Status);
+        SmpKnownDllsThread = NULL;
+        SmpCreateKnownDllSections(DirHandle, DirFileHandle);
+        Status = STATUS_SUCCESS;
+    }
+
 Quickie:
     /* Close both handles and free the NT path buffer */
     if (DirHandle)
@@ -1616,27 +1757,14 @@ NTAPI
 SmpInitializeKnownDlls(VOID)
 {
     NTSTATUS Status;
-    PSMP_REGISTRY_VALUE RegEntry;
     UNICODE_STRING DestinationString;
-    PLIST_ENTRY Head, NextEntry;
 
     /* Call the internal function */
     RtlInitUnicodeString(&DestinationString, L"\\KnownDlls");
     Status = SmpInitializeKnownDllsInternal(&DestinationString, &SmpKnownDllPath);
 
-    /* Wipe out the list regardless of success */
-    Head = &SmpKnownDllsList;
-    while (!IsListEmpty(Head))
-    {
-        /* Remove this entry */
-        NextEntry = RemoveHeadList(Head);
-
-        /* Free it */
-        RegEntry = CONTAINING_RECORD(NextEntry, SMP_REGISTRY_VALUE, Entry);
-        RtlFreeHeap(RtlGetProcessHeap(), 0, RegEntry->AnsiValue);
-        RtlFreeHeap(RtlGetProcessHeap(), 0, RegEntry->Value.Buffer);
-        RtlFreeHeap(RtlGetProcessHeap(), 0, RegEntry);
-    }
+    /* Wipe out the list regardless of success, unless the worker still uses it */
+    if (!SmpKnownDllsThread) SmpFreeKnownDllsList();
 
     /* All done */
     return Status;
@@ -2193,8 +2321,10 @@ SmpLoadDataFromRegistry(OUT PUNICODE_STRING InitialCommand)
     OBJECT_ATTRIBUTES ObjectAttributes;
     HANDLE KeyHandle;
     UNICODE_STRING DestinationString;
+    LARGE_INTEGER StartTime, PhaseTime;
 
     /* Initialize the keywords we'll be looking for */
+    NtQueryPerformanceCounter(&StartTime, NULL);
     RtlInitUnicodeString(&SmpDebugKeyword, L"debug");
     RtlInitUnicodeString(&SmpASyncKeyword, L"async");
     RtlInitUnicodeString(&SmpAutoChkKeyword, L"autocheck");
@@ -2311,6 +2441,7 @@ SmpLoadDataFromRegistry(OUT PUNICODE_STRING InitialCommand)
     }
 
     /* Next loop all the boot execute binaries */
+    NtQueryPerformanceCounter(&PhaseTime, NULL);
     Head = &SmpBootExecuteList;
     while (!IsListEmpty(Head))
     {
@@ -2327,11 +2458,17 @@ SmpLoadDataFromRegistry(OUT PUNICODE_STRING InitialCommand)
         RtlFreeHeap(RtlGetProcessHeap(), 0, RegEntry);
     }
 
+    SmpTraceInitTime("Boot execute", &PhaseTime);
+
     /* Now do any pending file rename operations... */
+    NtQueryPerformanceCounter(&PhaseTime, NULL);
     if (!MiniNTBoot) SmpProcessFileRenames();
+    SmpTraceInitTime("File renames", &PhaseTime);
 
     /* And initialize known DLLs... */
+    NtQueryPerformanceCounter(&PhaseTime, NULL);
     Status = SmpInitializeKnownDlls();
+    SmpTraceInitTime("KnownDll initialization", &PhaseTime);
     if (!NT_SUCCESS(Status))
     {
         /* Fail if that didn't work */
@@ -2361,8 +2498,24 @@ SmpLoadDataFromRegistry(OUT PUNICODE_STRING InitialCommand)
             RtlFreeHeap(RtlGetProcessHeap(), 0, RegEntry);
         }
 
-        /* Now create all the paging files for the descriptors that we have */
-        SmpCreatePagingFiles();
+        /* Now create all the paging files, in the background if we can */
+        Status = RtlCreateUserThread(NtCurrentProcess(),
+                                     NULL,
+                                     FALSE,
+                                     0,
+                                     0,
+                                     0,
+                                     SmpPagingFilesWorker,
+                                     NULL,
+                                     &SmpPagingFilesThread,
+                                     NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("SMSS: Unable to create the paging file thread - Status == %lx\n",
+                    Status);
+            SmpPagingFilesThread = NULL;
+            SmpCreatePagingFiles();
+        }
     }
 
     /* Tell Cm it's now safe to fully enable write access to the registry */
@@ -2377,12 +2530,32 @@ SmpLoadDataFromRegistry(OUT PUNICODE_STRING InitialCommand)
         return Status;
     }
 
+    /* The registry is set up, the subsystems come next */
+    SmpReportBootPhase(PfSMRegistryInitPhase);
+
     /* And finally load all the subsystems for our first session! */
+    NtQueryPerformanceCounter(&PhaseTime, NULL);
     Status = SmpLoadSubSystemsForMuSession(&MuSessionId,
                                            &SmpWindowsSubSysProcessId,
                                            InitialCommand);
     ASSERT(MuSessionId == 0);
     if (!NT_SUCCESS(Status)) SMSS_CHECKPOINT(SmpLoadSubSystemsForMuSession, Status);
+    SmpTraceInitTime("Subsystem loading", &PhaseTime);
+
+    /* The initial command gets to run only once the workers are done */
+    if (SmpKnownDllsThread)
+    {
+        NtWaitForSingleObject(SmpKnownDllsThread, FALSE, NULL);
+        NtClose(SmpKnownDllsThread);
+        SmpKnownDllsThread = NULL;
+    }
+    if (SmpPagingFilesThread)
+    {
+        NtWaitForSingleObject(SmpPagingFilesThread, FALSE, NULL);
+        NtClose(SmpPagingFilesThread);
+        SmpPagingFilesThread = NULL;
+    }
+    SmpTraceInitTime("Registry driven initialization", &StartTime);
     return Status;
 }
 
@@ -0,0 +1,234 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS Winlogon
+ * FILE:            base/system/winlogon/prefetch.c
+ * PURPOSE:         Logon prefetching
+ */
+
+/*
+ * The kernel prefetcher traces the files read during the first seconds after
+ * a user logs on, in a logon scenario of that user. The user who logged on
+ * last is remembered, and while the next logon credentials are being entered
+ * its scenario is prefetched and its registry hive is read into the cache.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "winlogon.h"
+
+/* GLOBALS ******************************************************************/
+
+#define PREFETCH_READ_SIZE  (64 * 1024)
+
+static const WCHAR szWinlogonKey[] = L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion\\Winlogon";
+static const WCHAR szProfileListKey[] = L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion\\ProfileList";
+
+/* FUNCTIONS ****************************************************************/
+
+static
+ULONG
+HashUserSid(
+    IN LPCWSTR pszSid)
+{
+    ULONG Hash = 0;
+
+    /* Same hash as the one used for the application scenarios */
+    while (*pszSid)
+        Hash = Hash * 65599 + towupper(*pszSid++);
+
+    return Hash;
+}
+
+static
+VOID
+SendLogonScenario(
+    IN ULONG UserHash,
+    IN BOOLEAN Trace)
+{
+    PREFETCHER_INFORMATION PrefetcherInfo;
+    PF_LOGON_SCENARIO_INFORMATION LogonInfo;
+    NTSTATUS Status;
+
+    LogonInfo.UserHash = UserHash;
+    LogonInfo.Trace = Trace;
+
+    PrefetcherInfo.Version = PF_CURRENT_VERSION;
+    PrefetcherInfo.Magic = PF_SYSINFO_MAGIC_NUMBER;
+    PrefetcherInfo.PrefetcherInformationClass = PrefetcherLogonScenario;
+    PrefetcherInfo.PrefetcherInformation = &LogonInfo;
+    PrefetcherInfo.PrefetcherInformationLength = sizeof(LogonInfo);
+    Status = NtSetSystemInformation(SystemPrefetcherInformation,
+                                    &PrefetcherInfo,
+                                    sizeof(PrefetcherInfo));
+    if (!NT_SUCCESS(Status))
+        TRACE("WL: Logon prefetch request failed (Status 0x%08lx)\n", Status);
+}
+
+static
+VOID
+ReadUserHive(
+    IN LPCWSTR pszSid)
+{
+    WCHAR szKeyName[MAX_PATH];
+    WCHAR szProfilePath[MAX_PATH];
+    WCHAR szHivePath[MAX_PATH];
+    DWORD dwSize, dwType, dwRead;
+    HANDLE hFile;
+    HKEY hKey;
+    PVOID Buffer;
+    LONG lError;
+
+    /* Find the profile of the user */
+    if (FAILED(StringCchPrintfW(szKeyName, ARRAYSIZE(szKeyName), L"%s\\%s",
+                                szProfileListKey, pszSid)))
+        return;
+
+    lError = RegOpenKeyExW(HKEY_LOCAL_MACHINE, szKeyName, 0, KEY_QUERY_VALUE, &hKey);
+    if (lError != ERROR_SUCCESS)
+        return;
+
+    dwSize = sizeof(szProfilePath) - sizeof(WCHAR);
+    lError = RegQueryValueExW(hKey,
+                              L"ProfileImagePath",
+                              NULL,
+                              &dwType,
+                              (LPBYTE)szProfilePath,
+                              &dwSize);
+    RegCloseKey(hKey);
+    if (lError != ERROR_SUCCESS || (dwType != REG_SZ && dwType != REG_EXPAND_SZ))
+        return;
+    szProfilePath[dwSize / sizeof(WCHAR)] = UNICODE_NULL;
+
+    if (!ExpandEnvironmentStringsW(szProfilePath, szHivePath, ARRAYSIZE(szHivePath)) ||
+        FAILED(StringCchCatW(szHivePath, ARRAYSIZE(szHivePath), L"\\NTUSER.DAT")))
+        return;
+
+    /*
+     * The hive is loaded with cached reads, so reading it now lets the
+     * profile load find it in the cache
+     */
+    hFile = CreateFileW(szHivePath,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN,
+                        NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return;
+
+    Buffer = HeapAlloc(GetProcessHeap(), 0, PREFETCH_READ_SIZE);
+    if (Buffer)
+    {
+        while (ReadFile(hFile, Buffer, PREFETCH_READ_SIZE, &dwRead, NULL) && dwRead)
+            ;
+        HeapFree(GetProcessHeap(), 0, Buffer);
+    }
+
+    CloseHandle(hFile);
+}
+
+static
+DWORD
+WINAPI
+LogonPrefetchThread(
+    IN LPVOID lpParameter)
+{
+    WCHAR szSid[128];
+    DWORD dwSize, dwType;
+    HKEY hKey;
+    LONG lError;
+
+    UNREFERENCED_PARAMETER(lpParameter);
+
+    /* Get the user who logged on last */
+    lError = RegOpenKeyExW(HKEY_LOCAL_MACHINE, szWinlogonKey, 0, KEY_QUERY_VALUE, &hKey);
+    if (lError != ERROR_SUCCESS)
+        return 0;
+
+    dwSize = sizeof(szSid) - sizeof(WCHAR);
+    lError = RegQueryValueExW(hKey,
+                              L"LastLogonSid",
+                              NULL,
+                              &dwType,
+                              (LPBYTE)szSid,
+                              &dwSize);
+    RegCloseKey(hKey);
+    if (lError != ERROR_SUCCESS || dwType != REG_SZ)
+        return 0;
+    szSid[dwSize / sizeof(WCHAR)] = UNICODE_NULL;
+    if (szSid[0] == UNICODE_NULL)
+        return 0;
+
+    TRACE("WL: Prefetching the logon of %S\n", szSid);
+
+    /* The kernel reads the files from a worker thread, we take care of the hive */
+    SendLogonScenario(HashUserSid(szSid), FALSE);
+    ReadUserHive(szSid);
+
+    return 0;
+}
+
+/*
+ * Called before the credentials are asked for. Warms the cache for the user
+ * who logged on last, in the background.
+ */
+VOID
+StartLogonPrefetch(VOID)
+{
+    HANDLE hThread;
+
+    hThread = CreateThread(NULL, 0, LogonPrefetchThread, NULL, 0, NULL);
+    if (hThread)
+    {
+        /* Stay out of the way of the logon dialog */
+        SetThreadPriority(hThread, THREAD_PRIORITY_BELOW_NORMAL);
+        CloseHandle(hThread);
+    }
+}
+
+/*
+ * Called when a user logs on. Starts tracing the logon scenario of the user
+ * and remembers the user for the next logon.
+ */
+VOID
+TraceLogonPrefetch(
+    IN PWLSESSION Session)
+{
+    BYTE Buffer[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+    PTOKEN_USER pTokenUser = (PTOKEN_USER)Buffer;
+    UNICODE_STRING SidString;
+    DWORD dwLength;
+    HKEY hKey;
+    NTSTATUS Status;
+
+    if (!GetTokenInformation(Session->UserToken,
+                             TokenUser,
+                             pTokenUser,
+                             sizeof(Buffer),
+                             &dwLength))
+    {
+        return;
+    }
+
+    Status = RtlConvertSidToUnicodeString(&SidString, pTokenUser->User.Sid, TRUE);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    SendLogonScenario(HashUserSid(SidString.Buffer), TRUE);
+
+    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, szWinlogonKey, 0, KEY_SET_VALUE, &hKey) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey,
+                       L"LastLogonSid",
+                       0,
+                       REG_SZ,
+                       (LPBYTE)SidString.Buffer,
+                       SidString.Length + sizeof(WCHAR));
+        RegCloseKey(hKey);
+    }
+
+    RtlFreeUnicodeString(&SidString);
+}
+
+/* EOF */
@@ -433,6 +433,9 @@ HandleLogon(
     PROFILEINFOW ProfileInfo;
     BOOL ret = FALSE;
 
+    /* Record what this logon needs, for the next one */
+    TraceLogonPrefetch(Session);
+
     /* Loading personal settings */
     DisplayStatusMessage(Session, Session->WinlogonDesktop, IDS_LOADINGYOURPERSONALSETTINGS);
     ProfileInfo.hProfile = INVALID_HANDLE_VALUE;
@@ -494,6 +497,9 @@ HandleLogon(
         goto cleanup;
     }
 
+    /* The first shell is the end of the boot, later logons are ignored */
+    ReportBootPhase(PfUserShellReadyPhase);
+
     CallNotificationDlls(Session, StartShellHandler);
 
     if (!InitializeScreenSaver(Session))
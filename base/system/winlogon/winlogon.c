@@ -212,6 +212,24 @@ InitKeyboardLayouts(VOID)
 }
 
 
+VOID
+ReportBootPhase(
+    IN ULONG Phase)
+{
+    PREFETCHER_INFORMATION PrefetcherInfo;
+
+    /* Let the kernel put the phase on its boot timeline */
+    PrefetcherInfo.Version = PF_CURRENT_VERSION;
+    PrefetcherInfo.Magic = PF_SYSINFO_MAGIC_NUMBER;
+    PrefetcherInfo.PrefetcherInformationClass = PrefetcherBootPhase;
+    PrefetcherInfo.PrefetcherInformation = &Phase;
+    PrefetcherInfo.PrefetcherInformationLength = sizeof(Phase);
+    NtSetSystemInformation(SystemPrefetcherInformation,
+                           &PrefetcherInfo,
+                           sizeof(PrefetcherInfo));
+}
+
+
 BOOL
 DisplayStatusMessage(
      IN PWLSESSION Session,
@@ -318,6 +336,9 @@ WinMain(
 
     hAppInstance = hInstance;
 
+    /* The session manager is done with the subsystems */
+    ReportBootPhase(PfVideoInitPhase);
+
     /* Make us critical */
     RtlSetProcessIsCritical(TRUE, NULL, FALSE);
     RtlSetThreadIsCritical(TRUE, NULL, FALSE);
@@ -384,6 +405,9 @@ WinMain(
     /* Wait for the LSA server */
     WaitForLsass();
 
+    /* Warm the cache for the next logon while the user gets to it */
+    StartLogonPrefetch();
+
     /* Init Notifications */
     InitNotifications();
 
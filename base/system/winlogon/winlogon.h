@@ -287,6 +287,13 @@ CallNotificationDlls(
     PWLSESSION pSession,
     NOTIFICATION_TYPE Type);
 
+/* prefetch.c */
+VOID
+StartLogonPrefetch(VOID);
+
+VOID
+TraceLogonPrefetch(IN PWLSESSION Session);
+
 /* rpcserver.c */
 BOOL
 StartRpcServer(VOID);
@@ -325,6 +332,9 @@ StartSystemShutdown(
     ULONG dwReason);
 
 /* winlogon.c */
+VOID
+ReportBootPhase(IN ULONG Phase);
+
 BOOL
 PlaySoundRoutine(IN LPCWSTR FileName,
                  IN UINT Logon,
@@ -146,6 +146,22 @@ DiskRead(ULONG FileId, VOID* Buffer, ULONG N, ULONG* Count)
     MaxSectors   = DiskReadBufferSize / Context->SectorSize;
     SectorOffset = Context->SectorNumber + Context->SectorOffset;
 
+    /*
+     * Small reads from hard disks go through the disk cache, which merges
+     * them into large transfers and reads ahead. Whole transfers gain
+     * nothing from it and would only push the file system data out.
+     */
+    if (Context->DriveNumber >= 0x80 &&
+        (N % Context->SectorSize) == 0 &&
+        TotalSectors < MaxSectors &&
+        CacheInitializeDrive(Context->DriveNumber) &&
+        CacheManagerDrive.BytesPerSector == Context->SectorSize &&
+        CacheReadDiskSectors(Context->DriveNumber, SectorOffset, TotalSectors, Buffer))
+    {
+        *Count = N;
+        return ESUCCESS;
+    }
+
     ret = TRUE;
 
     while (TotalSectors)
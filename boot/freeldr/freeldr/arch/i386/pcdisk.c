@@ -556,11 +556,12 @@ PcDiskGetCacheableBlockCount(UCHAR DriveNumber)
 {
     GEOMETRY Geometry;
 
-    /* If LBA is supported then the block size will be 64 sectors (32k)
+    /* If LBA is supported then the block size will be 8 sectors (4k),
+     * the cache reads several of them with one call.
      * If not then the block size is the size of one track. */
     if (DiskInt13ExtensionsSupported(DriveNumber))
     {
-        return 64;
+        return 8;
     }
     /* Get the disk geometry. If this fails then we will
      * just return 1 sector to be safe. */
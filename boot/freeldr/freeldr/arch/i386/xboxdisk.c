@@ -559,8 +559,8 @@ XboxDiskGetDriveGeometry(UCHAR DriveNumber, PGEOMETRY Geometry)
 ULONG
 XboxDiskGetCacheableBlockCount(UCHAR DriveNumber)
 {
-    /* 64 seems a nice number, it is used by the machpc code for LBA devices */
-    return 64;
+    /* Same as the machpc code for LBA devices */
+    return 8;
 }
 
 /* EOF */
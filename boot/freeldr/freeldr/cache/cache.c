@@ -38,6 +38,8 @@ BOOLEAN CacheInitializeDrive(UCHAR DriveNumber)
 {
     PCACHE_BLOCK    NextCacheBlock;
     GEOMETRY    DriveGeometry;
+    ULONG        BlockBytes;
+    ULONG        Idx;
 
     // If we already have a cache for this drive then
     // by all means lets keep it, unless it is a removable
@@ -80,6 +82,10 @@ BOOLEAN CacheInitializeDrive(UCHAR DriveNumber)
     // Initialize the structure
     RtlZeroMemory(&CacheManagerDrive, sizeof(CACHE_DRIVE));
     InitializeListHead(&CacheManagerDrive.CacheBlockHead);
+    for (Idx = 0; Idx < CACHE_HASH_TABLE_SIZE; Idx++)
+    {
+        InitializeListHead(&CacheManagerDrive.HashTable[Idx]);
+    }
     CacheManagerDrive.DriveNumber = DriveNumber;
     if (!MachDiskGetDriveGeometry(DriveNumber, &DriveGeometry))
     {
@@ -90,12 +96,37 @@ BOOLEAN CacheInitializeDrive(UCHAR DriveNumber)
     // Get the number of sectors in each cache block
     CacheManagerDrive.BlockSize = MachDiskGetCacheableBlockCount(DriveNumber);
 
+    // A block must fit in the disk read buffer
+    if (CacheManagerDrive.BlockSize * CacheManagerDrive.BytesPerSector > DiskReadBufferSize)
+    {
+        CacheManagerDrive.BlockSize = (ULONG)(DiskReadBufferSize / CacheManagerDrive.BytesPerSector);
+    }
+    if (CacheManagerDrive.BlockSize == 0)
+    {
+        return FALSE;
+    }
+    BlockBytes = CacheManagerDrive.BlockSize * CacheManagerDrive.BytesPerSector;
+
+    // The cache may take a quarter of the memory, but has
+    // to leave the temporary heap to its other users
     CacheBlockCount = 0;
-    CacheSizeLimit = TotalPagesInLookupTable / 8 * MM_PAGE_SIZE;
+    CacheSizeLimit = TotalPagesInLookupTable / 4 * MM_PAGE_SIZE;
     CacheSizeCurrent = 0;
-    if (CacheSizeLimit > TEMP_HEAP_SIZE - (128 * 1024))
+    if (CacheSizeLimit > TEMP_HEAP_SIZE / 2)
     {
-        CacheSizeLimit = TEMP_HEAP_SIZE - (128 * 1024);
+        CacheSizeLimit = TEMP_HEAP_SIZE / 2;
+    }
+
+    // Read as many blocks per call as the disk read buffer holds,
+    // but never more than the cache can keep at once
+    CacheManagerDrive.MaxTransferBlocks = (ULONG)(DiskReadBufferSize / BlockBytes);
+    if (CacheManagerDrive.MaxTransferBlocks > CacheSizeLimit / BlockBytes / 2)
+    {
+        CacheManagerDrive.MaxTransferBlocks = (ULONG)(CacheSizeLimit / BlockBytes / 2);
+    }
+    if (CacheManagerDrive.MaxTransferBlocks == 0)
+    {
+        CacheManagerDrive.MaxTransferBlocks = 1;
     }
 
     CacheManagerInitialized = TRUE;
@@ -103,6 +134,7 @@ BOOLEAN CacheInitializeDrive(UCHAR DriveNumber)
     TRACE("Initializing BIOS drive 0x%x.\n", DriveNumber);
     TRACE("BytesPerSector: %d.\n", CacheManagerDrive.BytesPerSector);
     TRACE("BlockSize: %d.\n", CacheManagerDrive.BlockSize);
+    TRACE("MaxTransferBlocks: %d.\n", CacheManagerDrive.MaxTransferBlocks);
     TRACE("CacheSizeLimit: %d.\n", CacheSizeLimit);
 
     return TRUE;
@@ -117,11 +149,9 @@ BOOLEAN CacheReadDiskSectors(UCHAR DiskNumber, ULONGLONG StartSector, ULONG Sect
 {
     PCACHE_BLOCK    CacheBlock;
     ULONG                StartBlock;
-    ULONG                SectorOffsetInStartBlock;
-    ULONG                CopyLengthInStartBlock;
     ULONG                EndBlock;
-    ULONG                SectorOffsetInEndBlock;
-    ULONG                BlockCount;
+    ULONG                SectorOffsetInBlock;
+    ULONG                CopyLength;
     ULONG                Idx;
 
     TRACE("CacheReadDiskSectors() DiskNumber: 0x%x StartSector: %I64d SectorCount: %d Buffer: 0x%x\n", DiskNumber, StartSector, SectorCount, Buffer);
@@ -132,26 +162,29 @@ BOOLEAN CacheReadDiskSectors(UCHAR DiskNumber, ULONGLONG StartSector, ULONG Sect
         return FALSE;
     }
 
+    if (SectorCount == 0)
+    {
+        return TRUE;
+    }
+
     //
     // Calculate which blocks we must cache
     //
     StartBlock = (ULONG)(StartSector / CacheManagerDrive.BlockSize);
-    SectorOffsetInStartBlock = (ULONG)(StartSector % CacheManagerDrive.BlockSize);
-    CopyLengthInStartBlock = (ULONG)((SectorCount > (CacheManagerDrive.BlockSize - SectorOffsetInStartBlock)) ? (CacheManagerDrive.BlockSize - SectorOffsetInStartBlock) : SectorCount);
+    SectorOffsetInBlock = (ULONG)(StartSector % CacheManagerDrive.BlockSize);
     EndBlock = (ULONG)((StartSector + (SectorCount - 1)) / CacheManagerDrive.BlockSize);
-    SectorOffsetInEndBlock = (ULONG)(1 + (StartSector + (SectorCount - 1)) % CacheManagerDrive.BlockSize);
-    BlockCount = (EndBlock - StartBlock) + 1;
-    TRACE("StartBlock: %d SectorOffsetInStartBlock: %d CopyLengthInStartBlock: %d EndBlock: %d SectorOffsetInEndBlock: %d BlockCount: %d\n", StartBlock, SectorOffsetInStartBlock, CopyLengthInStartBlock, EndBlock, SectorOffsetInEndBlock, BlockCount);
+    TRACE("StartBlock: %d SectorOffsetInBlock: %d EndBlock: %d\n", StartBlock, SectorOffsetInBlock, EndBlock);
 
     //
-    // Read the first block into the buffer
+    // Loop through the blocks and copy them into the buffer
     //
-    if (BlockCount > 0)
+    for (Idx = StartBlock; Idx <= EndBlock; Idx++)
     {
         //
-        // Get cache block pointer (this forces the disk sectors into the cache memory)
+        // Get cache block pointer (this forces the disk sectors into the cache memory,
+        // together with the following missing blocks when they can be read at once)
         //
-        CacheBlock = CacheInternalGetBlockPointer(&CacheManagerDrive, StartBlock);
+        CacheBlock = CacheInternalGetBlockPointer(&CacheManagerDrive, Idx, EndBlock - Idx + 1);
         if (CacheBlock == NULL)
         {
             return FALSE;
@@ -160,87 +193,27 @@ BOOLEAN CacheReadDiskSectors(UCHAR DiskNumber, ULONGLONG StartSector, ULONG Sect
         //
         // Copy the portion requested into the buffer
         //
-        RtlCopyMemory(Buffer,
-            (PVOID)((ULONG_PTR)CacheBlock->BlockData + (SectorOffsetInStartBlock * CacheManagerDrive.BytesPerSector)),
-            (CopyLengthInStartBlock * CacheManagerDrive.BytesPerSector));
-        TRACE("1 - RtlCopyMemory(0x%x, 0x%x, %d)\n", Buffer, ((ULONG_PTR)CacheBlock->BlockData + (SectorOffsetInStartBlock * CacheManagerDrive.BytesPerSector)), (CopyLengthInStartBlock * CacheManagerDrive.BytesPerSector));
-
-        //
-        // Update the buffer address
-        //
-        Buffer = (PVOID)((ULONG_PTR)Buffer + (CopyLengthInStartBlock * CacheManagerDrive.BytesPerSector));
-
-        //
-        // Update the block count
-        //
-        BlockCount--;
-    }
-
-    //
-    // Loop through the middle blocks and read them into the buffer
-    //
-    for (Idx=StartBlock+1; BlockCount>1; Idx++)
-    {
-        //
-        // Get cache block pointer (this forces the disk sectors into the cache memory)
-        //
-        CacheBlock = CacheInternalGetBlockPointer(&CacheManagerDrive, Idx);
-        if (CacheBlock == NULL)
+        CopyLength = CacheManagerDrive.BlockSize - SectorOffsetInBlock;
+        if (CopyLength > SectorCount)
         {
-            return FALSE;
+            CopyLength = SectorCount;
         }
 
-        //
-        // Copy the portion requested into the buffer
-        //
         RtlCopyMemory(Buffer,
-            CacheBlock->BlockData,
-            CacheManagerDrive.BlockSize * CacheManagerDrive.BytesPerSector);
-        TRACE("2 - RtlCopyMemory(0x%x, 0x%x, %d)\n", Buffer, CacheBlock->BlockData, CacheManagerDrive.BlockSize * CacheManagerDrive.BytesPerSector);
-
-        //
-        // Update the buffer address
-        //
-        Buffer = (PVOID)((ULONG_PTR)Buffer + (CacheManagerDrive.BlockSize * CacheManagerDrive.BytesPerSector));
+            (PVOID)((ULONG_PTR)CacheBlock->BlockData + (SectorOffsetInBlock * CacheManagerDrive.BytesPerSector)),
+            (CopyLength * CacheManagerDrive.BytesPerSector));
+        TRACE("RtlCopyMemory(0x%x, 0x%x, %d)\n", Buffer, ((ULONG_PTR)CacheBlock->BlockData + (SectorOffsetInBlock * CacheManagerDrive.BytesPerSector)), (CopyLength * CacheManagerDrive.BytesPerSector));
 
         //
-        // Update the block count
+        // Update the buffer address and the remaining sector count
         //
-        BlockCount--;
+        Buffer = (PVOID)((ULONG_PTR)Buffer + (CopyLength * CacheManagerDrive.BytesPerSector));
+        SectorCount -= CopyLength;
+        SectorOffsetInBlock = 0;
     }
 
-    //
-    // Read the last block into the buffer
-    //
-    if (BlockCount > 0)
-    {
-        //
-        // Get cache block pointer (this forces the disk sectors into the cache memory)
-        //
-        CacheBlock = CacheInternalGetBlockPointer(&CacheManagerDrive, EndBlock);
-        if (CacheBlock == NULL)
-        {
-            return FALSE;
-        }
-
-        //
-        // Copy the portion requested into the buffer
-        //
-        RtlCopyMemory(Buffer,
-            CacheBlock->BlockData,
-            SectorOffsetInEndBlock * CacheManagerDrive.BytesPerSector);
-        TRACE("3 - RtlCopyMemory(0x%x, 0x%x, %d)\n", Buffer, CacheBlock->BlockData, SectorOffsetInEndBlock * CacheManagerDrive.BytesPerSector);
-
-        //
-        // Update the buffer address
-        //
-        Buffer = (PVOID)((ULONG_PTR)Buffer + (SectorOffsetInEndBlock * CacheManagerDrive.BytesPerSector));
-
-        //
-        // Update the block count
-        //
-        BlockCount--;
-    }
+    // Remember where this read ended, so that a sequential access reads ahead
+    CacheManagerDrive.NextBlock = EndBlock + 1;
 
     return TRUE;
 }
@@ -277,7 +250,7 @@ BOOLEAN CacheForceDiskSectorsIntoCache(UCHAR DiskNumber, ULONGLONG StartSector,
         //
         // Get cache block pointer (this forces the disk sectors into the cache memory)
         //
-        CacheBlock = CacheInternalGetBlockPointer(&CacheManagerDrive, Idx);
+        CacheBlock = CacheInternalGetBlockPointer(&CacheManagerDrive, Idx, 1);
         if (CacheBlock == NULL)
         {
             return FALSE;
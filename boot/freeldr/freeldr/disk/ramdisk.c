@@ -10,9 +10,12 @@
 /* INCLUDES *******************************************************************/
 
 #include <freeldr.h>
+#include <bootbundle.h>
 
 #include <debug.h>
 
+DBG_DEFAULT_CHANNEL(DISK);
+
 /* GLOBALS ********************************************************************/
 
 PVOID gRamDiskBase;
@@ -116,17 +119,87 @@ RamDiskInitialize(VOID)
     FsRegisterDevice("ramdisk(0)", &RamDiskVtbl);
 }
 
+static
+BOOLEAN
+RamDiskReadFile(IN PFILE RamFile,
+                IN ULONG FileOffset,
+                IN ULONG Size,
+                OUT PVOID Buffer,
+                IN PCHAR MsgBuffer)
+{
+    ULONG TotalRead, ChunkSize, Count;
+    ULONG PercentPerChunk, Percent;
+    LARGE_INTEGER Position;
+    ARC_STATUS Status;
+
+    ChunkSize = 8 * 1024 * 1024;
+    if (Size < ChunkSize)
+        Percent = PercentPerChunk = 0;
+    else
+        Percent = PercentPerChunk = 100 / (Size / ChunkSize);
+
+    //
+    // Read it in chunks
+    //
+    for (TotalRead = 0; TotalRead < Size; TotalRead += ChunkSize)
+    {
+        //
+        // Check if we're at the last chunk
+        //
+        if ((Size - TotalRead) < ChunkSize)
+        {
+            //
+            // Only need the actual data required
+            //
+            ChunkSize = Size - TotalRead;
+        }
+
+        //
+        // Draw progress
+        //
+        UiDrawProgressBarCenter(Percent, 100, MsgBuffer);
+        Percent += PercentPerChunk;
+
+        //
+        // Copy the contents
+        //
+        Position.HighPart = 0;
+        Position.LowPart = FileOffset + TotalRead;
+        Status = ArcSeek(RamFile, &Position, SeekAbsolute);
+        if (Status == ESUCCESS)
+        {
+            Status = ArcRead(RamFile,
+                             (PVOID)((ULONG_PTR)Buffer + TotalRead),
+                             ChunkSize,
+                             &Count);
+        }
+
+        //
+        // Check for success
+        //
+        if (Status != ESUCCESS || Count != ChunkSize)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 BOOLEAN
 NTAPI
 RamDiskLoadVirtualFile(IN PCHAR FileName)
 {
     PFILE RamFile;
-    ULONG TotalRead, ChunkSize, Count;
+    ULONG FileSize, Count;
     PCHAR MsgBuffer = "Loading RamDisk...";
-    ULONG PercentPerChunk, Percent;
     FILEINFORMATION Information;
+    COMPRESSED_IMAGE_HEADER Header;
+    PVOID CompressedData;
+    ULONG UncompressedSize;
     LARGE_INTEGER Position;
     ARC_STATUS Status;
+    NTSTATUS NtStatus;
 
     //
     // Display progress
@@ -159,72 +232,107 @@ RamDiskLoadVirtualFile(IN PCHAR FileName)
         FsCloseFile(RamFile);
         return FALSE;
     }
-    gRamDiskSize = Information.EndingAddress.LowPart;
+    FileSize = Information.EndingAddress.LowPart;
 
     //
-    // Allocate memory for it
+    // Check whether this is a compressed image
     //
-    ChunkSize = 8 * 1024 * 1024;
-    if (gRamDiskSize < ChunkSize)
-        Percent = PercentPerChunk = 0;
-    else
-        Percent = PercentPerChunk = 100 / (gRamDiskSize / ChunkSize);
-    gRamDiskBase = MmAllocateMemoryWithType(gRamDiskSize, LoaderXIPRom);
-    if (!gRamDiskBase)
+    RtlZeroMemory(&Header, sizeof(Header));
+    if (FileSize >= sizeof(Header))
     {
-        UiMessageBox("Failed to allocate memory for RAM disk.");
-        FsCloseFile(RamFile);
-        return FALSE;
+        Position.QuadPart = 0;
+        Status = ArcSeek(RamFile, &Position, SeekAbsolute);
+        if (Status == ESUCCESS)
+            Status = ArcRead(RamFile, &Header, sizeof(Header), &Count);
+        if (Status != ESUCCESS || Count != sizeof(Header))
+        {
+            FsCloseFile(RamFile);
+            UiMessageBox("Failed to read RAM disk.");
+            return FALSE;
+        }
     }
 
-    //
-    // Read it in chunks
-    //
-    for (TotalRead = 0; TotalRead < gRamDiskSize; TotalRead += ChunkSize)
+    if (Header.Signature != COMPRESSED_IMAGE_SIGNATURE)
     {
         //
-        // Check if we're at the last chunk
+        // Allocate memory for it and read it as it is
         //
-        if ((gRamDiskSize - TotalRead) < ChunkSize)
+        gRamDiskSize = FileSize;
+        gRamDiskBase = MmAllocateMemoryWithType(gRamDiskSize, LoaderXIPRom);
+        if (!gRamDiskBase)
         {
-            //
-            // Only need the actual data required
-            //
-            ChunkSize = gRamDiskSize - TotalRead;
+            UiMessageBox("Failed to allocate memory for RAM disk.");
+            FsCloseFile(RamFile);
+            return FALSE;
         }
 
+        if (!RamDiskReadFile(RamFile, 0, gRamDiskSize, gRamDiskBase, MsgBuffer))
+        {
+            MmFreeMemory(gRamDiskBase);
+            gRamDiskBase = NULL;
+            gRamDiskSize = 0;
+            FsCloseFile(RamFile);
+            UiMessageBox("Failed to read RAM disk.");
+            return FALSE;
+        }
+    }
+    else
+    {
         //
-        // Draw progress
+        // Only the compressed data is read, it is expanded in memory
         //
-        UiDrawProgressBarCenter(Percent, 100, MsgBuffer);
-        Percent += PercentPerChunk;
+        if (Header.HeaderSize < sizeof(Header) ||
+            Header.HeaderSize > FileSize ||
+            Header.CompressedSize > FileSize - Header.HeaderSize ||
+            Header.UncompressedSize == 0)
+        {
+            UiMessageBox("Invalid compressed RAM disk.");
+            FsCloseFile(RamFile);
+            return FALSE;
+        }
 
-        //
-        // Copy the contents
-        //
-        Position.HighPart = 0;
-        Position.LowPart = TotalRead;
-        Status = ArcSeek(RamFile, &Position, SeekAbsolute);
-        if (Status == ESUCCESS)
+        CompressedData = MmAllocateMemoryWithType(Header.CompressedSize, LoaderFirmwareTemporary);
+        gRamDiskBase = MmAllocateMemoryWithType(Header.UncompressedSize, LoaderXIPRom);
+        if (!CompressedData || !gRamDiskBase)
         {
-            Status = ArcRead(RamFile,
-                             (PVOID)((ULONG_PTR)gRamDiskBase + TotalRead),
-                             ChunkSize,
-                             &Count);
+            if (CompressedData)
+                MmFreeMemory(CompressedData);
+            if (gRamDiskBase)
+                MmFreeMemory(gRamDiskBase);
+            gRamDiskBase = NULL;
+            UiMessageBox("Failed to allocate memory for RAM disk.");
+            FsCloseFile(RamFile);
+            return FALSE;
         }
 
-        //
-        // Check for success
-        //
-        if (Status != ESUCCESS || Count != ChunkSize)
+        if (!RamDiskReadFile(RamFile, Header.HeaderSize, Header.CompressedSize, CompressedData, MsgBuffer))
         {
+            MmFreeMemory(CompressedData);
             MmFreeMemory(gRamDiskBase);
             gRamDiskBase = NULL;
-            gRamDiskSize = 0;
             FsCloseFile(RamFile);
             UiMessageBox("Failed to read RAM disk.");
             return FALSE;
         }
+
+        UiDrawProgressBarCenter(100, 100, "Decompressing RamDisk...");
+        NtStatus = RtlDecompressBuffer(Header.CompressionFormat,
+                                       gRamDiskBase,
+                                       Header.UncompressedSize,
+                                       CompressedData,
+                                       Header.CompressedSize,
+                                       &UncompressedSize);
+        MmFreeMemory(CompressedData);
+        if (!NT_SUCCESS(NtStatus) || UncompressedSize != Header.UncompressedSize)
+        {
+            ERR("RAM disk decompression failed, Status 0x%lx\n", NtStatus);
+            MmFreeMemory(gRamDiskBase);
+            gRamDiskBase = NULL;
+            FsCloseFile(RamFile);
+            UiMessageBox("Failed to decompress RAM disk.");
+            return FALSE;
+        }
+        gRamDiskSize = UncompressedSize;
     }
 
     FsCloseFile(RamFile);
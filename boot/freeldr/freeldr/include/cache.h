@@ -23,20 +23,24 @@
 #define TAG_CACHE_DATA 'DcaC'
 #define TAG_CACHE_BLOCK 'BcaC'
 
+#define CACHE_HASH_TABLE_SIZE    256            // Number of block lookup buckets, must be a power of two
+
 ///////////////////////////////////////////////////////////////////////////////////////
 //
 // This structure describes a cached block element. The disk is divided up into
 // cache blocks. For disks which LBA is not supported each block is the size of
 // one track. This will force the cache manager to make track sized reads, and
 // therefore maximizes throughput. For disks which support LBA the block size
-// is 64k because they have no cylinder, head, or sector boundaries.
+// is small (4k) because they have no cylinder, head, or sector boundaries,
+// and several consecutive blocks are read with a single BIOS call instead.
 //
 ///////////////////////////////////////////////////////////////////////////////////////
 typedef struct
 {
-    LIST_ENTRY    ListEntry;                    // Doubly linked list synchronization member
+    LIST_ENTRY    ListEntry;                    // Doubly linked list synchronization member, in LRU order
+    LIST_ENTRY    HashListEntry;                // Links the blocks of the same hash bucket
 
-    ULONG            BlockNumber;                // Track index for CHS, 64k block index for LBA
+    ULONG            BlockNumber;                // Track index for CHS, block index for LBA
     BOOLEAN        LockedInCache;                // Indicates that this block is locked in cache memory
     ULONG            AccessCount;                // Access count for this block
 
@@ -57,7 +61,10 @@ typedef struct
     ULONG            BytesPerSector;
 
     ULONG            BlockSize;            // Block size (in sectors)
-    LIST_ENTRY        CacheBlockHead;            // Contains CACHE_BLOCK structures
+    ULONG            MaxTransferBlocks;    // Maximum number of blocks read with a single call
+    ULONG            NextBlock;            // Block following the last read, for read-ahead
+    LIST_ENTRY        CacheBlockHead;            // Contains CACHE_BLOCK structures, most recently used first
+    LIST_ENTRY        HashTable[CACHE_HASH_TABLE_SIZE];    // CACHE_BLOCK structures by block number
 
 } CACHE_DRIVE, *PCACHE_DRIVE;
 
@@ -78,9 +85,9 @@ extern    SIZE_T                CacheSizeCurrent;
 // Internal functions
 //
 ///////////////////////////////////////////////////////////////////////////////////////
-PCACHE_BLOCK    CacheInternalGetBlockPointer(PCACHE_DRIVE CacheDrive, ULONG BlockNumber);                // Returns a pointer to a CACHE_BLOCK structure given a block number
-PCACHE_BLOCK    CacheInternalFindBlock(PCACHE_DRIVE CacheDrive, ULONG BlockNumber);                    // Searches the block list for a particular block
-PCACHE_BLOCK    CacheInternalAddBlockToCache(PCACHE_DRIVE CacheDrive, ULONG BlockNumber);                // Adds a block to the cache's block list
+PCACHE_BLOCK    CacheInternalGetBlockPointer(PCACHE_DRIVE CacheDrive, ULONG BlockNumber, ULONG BlockCount);    // Returns a pointer to a CACHE_BLOCK structure given a block number, BlockCount blocks are about to be read
+PCACHE_BLOCK    CacheInternalFindBlock(PCACHE_DRIVE CacheDrive, ULONG BlockNumber);                    // Looks up a particular block in the hash table
+PCACHE_BLOCK    CacheInternalAddBlockToCache(PCACHE_DRIVE CacheDrive, ULONG BlockNumber, ULONG BlockCount);    // Reads consecutive blocks with one call and adds them to the cache's block list
 BOOLEAN            CacheInternalFreeBlock(PCACHE_DRIVE CacheDrive);                                    // Removes a block from the cache's block list & frees the memory
 VOID            CacheInternalCheckCacheSizeLimits(PCACHE_DRIVE CacheDrive);                            // Checks the cache size limits to see if we can add a new block, if not calls CacheInternalFreeBlock()
 VOID            CacheInternalDumpBlockList(PCACHE_DRIVE CacheDrive);                                // Dumps the list of cached blocks to the debug output port
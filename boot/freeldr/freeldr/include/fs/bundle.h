@@ -0,0 +1,11 @@
+/*
+ * PROJECT:         ReactOS Boot Loader
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            boot/freeldr/freeldr/include/fs/bundle.h
+ * PURPOSE:         Boot bundle support
+ */
+
+#pragma once
+
+BOOLEAN BundleLoad(PCSTR BundleFileName, PCSTR SystemRoot);
+const DEVVTBL* BundleLookupFile(PCSTR Path);
@@ -0,0 +1,272 @@
+/*
+ * PROJECT:         ReactOS Boot Loader
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            boot/freeldr/freeldr/lib/fs/bundle.c
+ * PURPOSE:         Serves the files of a boot bundle from memory
+ */
+
+/*
+ * A boot bundle is read in one go, then ArcOpen looks up every file opened
+ * for reading below the system root in it before going to the disk. Files
+ * which are not in the bundle are still read from the disk.
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <freeldr.h>
+#include <bootbundle.h>
+
+#include <debug.h>
+
+DBG_DEFAULT_CHANNEL(FILESYSTEM);
+
+/* GLOBALS ********************************************************************/
+
+#define TAG_BUNDLE_FILE 'FdnB'
+
+typedef struct _BUNDLE_FILE
+{
+    PBOOT_BUNDLE_ENTRY Entry;
+    ULONG Position;
+} BUNDLE_FILE, *PBUNDLE_FILE;
+
+static PBOOT_BUNDLE_HEADER BundleHeader;
+static PBOOT_BUNDLE_ENTRY BundleEntries;
+static CHAR BundleSystemRoot[MAX_PATH];
+
+static DEVVTBL BundleFuncTable;
+
+/* FUNCTIONS ******************************************************************/
+
+/*
+ * Compares the start of a path with a bundle path, ignoring the case,
+ * the kind of the separators and repeated separators. Returns the rest
+ * of the path when Prefix matches, NULL otherwise.
+ */
+static PCSTR BundleMatchPath(PCSTR Path, PCSTR Prefix)
+{
+    while (*Prefix)
+    {
+        if ((*Path == '\\' || *Path == '/') && (*Prefix == '\\' || *Prefix == '/'))
+        {
+            while (*Path == '\\' || *Path == '/')
+                Path++;
+            while (*Prefix == '\\' || *Prefix == '/')
+                Prefix++;
+            continue;
+        }
+
+        if (toupper(*Path) != toupper(*Prefix))
+            return NULL;
+
+        Path++;
+        Prefix++;
+    }
+
+    return Path;
+}
+
+static PBOOT_BUNDLE_ENTRY BundleFindEntry(PCSTR Path)
+{
+    PCSTR FileName, Rest;
+    ULONG i;
+
+    if (!BundleHeader)
+        return NULL;
+
+    FileName = BundleMatchPath(Path, BundleSystemRoot);
+    if (!FileName)
+        return NULL;
+    while (*FileName == '\\' || *FileName == '/')
+        FileName++;
+
+    for (i = 0; i < BundleHeader->EntryCount; i++)
+    {
+        Rest = BundleMatchPath(FileName, BundleEntries[i].Name);
+        if (Rest && *Rest == ANSI_NULL)
+            return &BundleEntries[i];
+    }
+
+    return NULL;
+}
+
+static ARC_STATUS BundleClose(ULONG FileId)
+{
+    PBUNDLE_FILE File = FsGetDeviceSpecific(FileId);
+
+    FrLdrTempFree(File, TAG_BUNDLE_FILE);
+    return ESUCCESS;
+}
+
+static ARC_STATUS BundleGetFileInformation(ULONG FileId, FILEINFORMATION* Information)
+{
+    PBUNDLE_FILE File = FsGetDeviceSpecific(FileId);
+
+    RtlZeroMemory(Information, sizeof(FILEINFORMATION));
+    Information->EndingAddress.LowPart = File->Entry->DataSize;
+    Information->CurrentAddress.LowPart = File->Position;
+
+    return ESUCCESS;
+}
+
+static ARC_STATUS BundleOpen(CHAR* Path, OPENMODE OpenMode, ULONG* FileId)
+{
+    PBOOT_BUNDLE_ENTRY Entry;
+    PBUNDLE_FILE File;
+
+    if (OpenMode != OpenReadOnly)
+        return EACCES;
+
+    Entry = BundleFindEntry(Path);
+    if (!Entry)
+        return ENOENT;
+
+    File = FrLdrTempAlloc(sizeof(BUNDLE_FILE), TAG_BUNDLE_FILE);
+    if (!File)
+        return ENOMEM;
+
+    File->Entry = Entry;
+    File->Position = 0;
+    FsSetDeviceSpecific(*FileId, File);
+
+    TRACE("Opening '%s' from the boot bundle\n", Path);
+
+    return ESUCCESS;
+}
+
+static ARC_STATUS BundleRead(ULONG FileId, VOID* Buffer, ULONG N, ULONG* Count)
+{
+    PBUNDLE_FILE File = FsGetDeviceSpecific(FileId);
+
+    if (N > File->Entry->DataSize - File->Position)
+        N = File->Entry->DataSize - File->Position;
+
+    RtlCopyMemory(Buffer,
+                  (PUCHAR)BundleHeader + File->Entry->DataOffset + File->Position,
+                  N);
+    File->Position += N;
+    *Count = N;
+
+    return ESUCCESS;
+}
+
+static ARC_STATUS BundleSeek(ULONG FileId, LARGE_INTEGER* Position, SEEKMODE SeekMode)
+{
+    PBUNDLE_FILE File = FsGetDeviceSpecific(FileId);
+    LARGE_INTEGER NewPosition = *Position;
+
+    if (SeekMode == SeekRelative)
+        NewPosition.QuadPart += File->Position;
+    else if (SeekMode != SeekAbsolute)
+        return EINVAL;
+
+    if (NewPosition.QuadPart < 0 || NewPosition.QuadPart > File->Entry->DataSize)
+        return EINVAL;
+
+    File->Position = NewPosition.LowPart;
+    return ESUCCESS;
+}
+
+/*
+ * Returns the function table serving Path when it is part of the loaded
+ * boot bundle, NULL otherwise.
+ */
+const DEVVTBL* BundleLookupFile(PCSTR Path)
+{
+    return BundleFindEntry(Path) ? &BundleFuncTable : NULL;
+}
+
+/*
+ * Reads a boot bundle with a single read. The files of the bundle are
+ * relative to SystemRoot, the full ARC path of the system directory.
+ */
+BOOLEAN BundleLoad(PCSTR BundleFileName, PCSTR SystemRoot)
+{
+    BOOT_BUNDLE_HEADER Header;
+    PBOOT_BUNDLE_HEADER Bundle;
+    PBOOT_BUNDLE_ENTRY Entries;
+    FILEINFORMATION Information;
+    LARGE_INTEGER Position;
+    ULONG FileId, Count, i;
+    ARC_STATUS Status;
+
+    TRACE("BundleLoad(): '%s' for '%s'\n", BundleFileName, SystemRoot);
+
+    if (strlen(SystemRoot) >= sizeof(BundleSystemRoot))
+        return FALSE;
+
+    Status = ArcOpen((PCHAR)BundleFileName, OpenReadOnly, &FileId);
+    if (Status != ESUCCESS)
+    {
+        WARN("Cannot open boot bundle '%s'\n", BundleFileName);
+        return FALSE;
+    }
+
+    /* Validate the header before allocating the bundle */
+    Status = ArcGetFileInformation(FileId, &Information);
+    if (Status == ESUCCESS)
+        Status = ArcRead(FileId, &Header, sizeof(Header), &Count);
+    if (Status != ESUCCESS || Count != sizeof(Header) ||
+        Header.Signature != BOOT_BUNDLE_SIGNATURE ||
+        Header.Version != BOOT_BUNDLE_VERSION ||
+        Header.HeaderSize < sizeof(Header) ||
+        Header.HeaderSize > Header.TotalSize ||
+        Information.EndingAddress.HighPart != 0 ||
+        Header.TotalSize != Information.EndingAddress.LowPart ||
+        Header.EntryCount > (Header.TotalSize - Header.HeaderSize) / sizeof(BOOT_BUNDLE_ENTRY))
+    {
+        ERR("Invalid boot bundle '%s'\n", BundleFileName);
+        ArcClose(FileId);
+        return FALSE;
+    }
+
+    Bundle = MmAllocateMemoryWithType(Header.TotalSize, LoaderFirmwareTemporary);
+    if (!Bundle)
+    {
+        ArcClose(FileId);
+        return FALSE;
+    }
+
+    /* Read the whole bundle at once */
+    Position.QuadPart = 0;
+    Status = ArcSeek(FileId, &Position, SeekAbsolute);
+    if (Status == ESUCCESS)
+        Status = ArcRead(FileId, Bundle, Header.TotalSize, &Count);
+    if (Status != ESUCCESS || Count != Header.TotalSize)
+    {
+        ERR("Failed to read boot bundle '%s'\n", BundleFileName);
+        MmFreeMemory(Bundle);
+        ArcClose(FileId);
+        return FALSE;
+    }
+
+    /* The files are served on behalf of the file system the bundle comes from */
+    BundleFuncTable.Close = BundleClose;
+    BundleFuncTable.GetFileInformation = BundleGetFileInformation;
+    BundleFuncTable.Open = BundleOpen;
+    BundleFuncTable.Read = BundleRead;
+    BundleFuncTable.Seek = BundleSeek;
+    BundleFuncTable.ServiceName = FsGetServiceName(FileId);
+    ArcClose(FileId);
+
+    Entries = (PBOOT_BUNDLE_ENTRY)((PUCHAR)Bundle + Bundle->HeaderSize);
+    for (i = 0; i < Bundle->EntryCount; i++)
+    {
+        if (Entries[i].DataOffset > Bundle->TotalSize ||
+            Entries[i].DataSize > Bundle->TotalSize - Entries[i].DataOffset)
+        {
+            ERR("Invalid boot bundle entry %lu\n", i);
+            MmFreeMemory(Bundle);
+            return FALSE;
+        }
+        Entries[i].Name[BOOT_BUNDLE_MAX_NAME - 1] = ANSI_NULL;
+    }
+
+    strcpy(BundleSystemRoot, SystemRoot);
+    BundleEntries = Entries;
+    BundleHeader = Bundle;
+
+    TRACE("Boot bundle loaded, %lu files\n", Bundle->EntryCount);
+
+    return TRUE;
+}
@@ -40,6 +40,10 @@ BOOLEAN    FatReadVolumeSectors(PFAT_VOLUME_INFO Volume, ULONG SectorNumber, ULO
 #define TAG_FAT_FILE 'FtaF'
 #define TAG_FAT_VOLUME 'VtaF'
 #define TAG_FAT_BUFFER 'BtaF'
+#define TAG_FAT_CACHE 'CtaF'
+
+/* Number of FAT sectors kept in memory while walking cluster chains */
+#define FAT_CACHE_SECTORS 32
 
 typedef struct _FAT_VOLUME_INFO
 {
@@ -55,6 +59,9 @@ typedef struct _FAT_VOLUME_INFO
     ULONG DataSectorStart; /* Starting sector of the data area */
     ULONG FatType; /* FAT12, FAT16, FAT32, FATX16 or FATX32 */
     ULONG DeviceId;
+    PUCHAR FatCache; /* Cached sectors of the active FAT table */
+    ULONG FatCacheStart; /* First sector in the FAT cache */
+    ULONG FatCacheCount; /* Number of sectors in the FAT cache */
 } FAT_VOLUME_INFO;
 
 PFAT_VOLUME_INFO FatVolumes[MAX_FDS];
@@ -899,6 +906,57 @@ void FatParseShortFileName(PCHAR Buffer, PDIRENTRY DirEntry)
     //TRACE("FatParseShortFileName() ShortName = %s\n", Buffer);
 }
 
+/*
+ * FatGetFatSectors()
+ * returns a pointer to the given sectors of the active FAT table,
+ * reading them into the FAT cache of the volume if needed
+ */
+static PUCHAR FatGetFatSectors(PFAT_VOLUME_INFO Volume, ULONG SectorNumber, ULONG SectorCount)
+{
+    ULONG FatSectorEnd;
+    ULONG CacheStart;
+    ULONG CacheCount;
+
+    if (SectorNumber >= Volume->FatCacheStart &&
+        SectorNumber + SectorCount <= Volume->FatCacheStart + Volume->FatCacheCount)
+    {
+        return Volume->FatCache + (SectorNumber - Volume->FatCacheStart) * Volume->BytesPerSector;
+    }
+
+    if (!Volume->FatCache)
+    {
+        Volume->FatCache = FrLdrTempAlloc(FAT_CACHE_SECTORS * Volume->BytesPerSector, TAG_FAT_CACHE);
+        if (!Volume->FatCache)
+        {
+            return NULL;
+        }
+    }
+
+    // Read an aligned window of the FAT table, unless the
+    // sectors asked for cross the end of that window
+    FatSectorEnd = Volume->ActiveFatSectorStart + Volume->SectorsPerFat;
+    CacheStart = SectorNumber - ((SectorNumber - Volume->ActiveFatSectorStart) % FAT_CACHE_SECTORS);
+    if (SectorNumber + SectorCount > CacheStart + FAT_CACHE_SECTORS)
+    {
+        CacheStart = SectorNumber;
+    }
+    CacheCount = FAT_CACHE_SECTORS;
+    if (CacheStart + CacheCount > FatSectorEnd && FatSectorEnd >= SectorNumber + SectorCount)
+    {
+        CacheCount = FatSectorEnd - CacheStart;
+    }
+
+    Volume->FatCacheCount = 0;
+    if (!FatReadVolumeSectors(Volume, CacheStart, CacheCount, Volume->FatCache))
+    {
+        return NULL;
+    }
+    Volume->FatCacheStart = CacheStart;
+    Volume->FatCacheCount = CacheCount;
+
+    return Volume->FatCache + (SectorNumber - CacheStart) * Volume->BytesPerSector;
+}
+
 /*
  * FatGetFatEntry()
  * returns the Fat entry for a given cluster number
@@ -911,17 +969,9 @@ BOOLEAN FatGetFatEntry(PFAT_VOLUME_INFO Volume, ULONG Cluster, ULONG* ClusterPoi
     UINT32        ThisFatEntOffset;
     ULONG SectorCount;
     PUCHAR ReadBuffer;
-    BOOLEAN Success = TRUE;
 
     //TRACE("FatGetFatEntry() Retrieving FAT entry for cluster %d.\n", Cluster);
 
-    // We need a buffer for 2 sectors
-    ReadBuffer = FrLdrTempAlloc(2 * Volume->BytesPerSector, TAG_FAT_BUFFER);
-    if (!ReadBuffer)
-    {
-        return FALSE;
-    }
-
     switch(Volume->FatType)
     {
     case FAT12:
@@ -943,10 +993,10 @@ BOOLEAN FatGetFatEntry(PFAT_VOLUME_INFO Volume, ULONG Cluster, ULONG* ClusterPoi
             SectorCount = 1;
         }
 
-        if (!FatReadVolumeSectors(Volume, ThisFatSecNum, SectorCount, ReadBuffer))
+        ReadBuffer = FatGetFatSectors(Volume, ThisFatSecNum, SectorCount);
+        if (!ReadBuffer)
         {
-            Success = FALSE;
-            break;
+            return FALSE;
         }
 
         fat = *((USHORT *) (ReadBuffer + ThisFatEntOffset));
@@ -965,10 +1015,10 @@ BOOLEAN FatGetFatEntry(PFAT_VOLUME_INFO Volume, ULONG Cluster, ULONG* ClusterPoi
         ThisFatSecNum = Volume->ActiveFatSectorStart + (FatOffset / Volume->BytesPerSector);
         ThisFatEntOffset = (FatOffset % Volume->BytesPerSector);
 
-        if (!FatReadVolumeSectors(Volume, ThisFatSecNum, 1, ReadBuffer))
+        ReadBuffer = FatGetFatSectors(Volume, ThisFatSecNum, 1);
+        if (!ReadBuffer)
         {
-            Success = FALSE;
-            break;
+            return FALSE;
         }
 
         fat = *((USHORT *) (ReadBuffer + ThisFatEntOffset));
@@ -983,7 +1033,8 @@ BOOLEAN FatGetFatEntry(PFAT_VOLUME_INFO Volume, ULONG Cluster, ULONG* ClusterPoi
         ThisFatSecNum = Volume->ActiveFatSectorStart + (FatOffset / Volume->BytesPerSector);
         ThisFatEntOffset = (FatOffset % Volume->BytesPerSector);
 
-        if (!FatReadVolumeSectors(Volume, ThisFatSecNum, 1, ReadBuffer))
+        ReadBuffer = FatGetFatSectors(Volume, ThisFatSecNum, 1);
+        if (!ReadBuffer)
         {
             return FALSE;
         }
@@ -996,17 +1047,14 @@ BOOLEAN FatGetFatEntry(PFAT_VOLUME_INFO Volume, ULONG Cluster, ULONG* ClusterPoi
 
     default:
         ERR("Unknown FAT type %d\n", Volume->FatType);
-        Success = FALSE;
-        break;
+        return FALSE;
     }
 
     //TRACE("FAT entry is 0x%x.\n", fat);
 
-    FrLdrTempFree(ReadBuffer, TAG_FAT_BUFFER);
-
     *ClusterPointer = fat;
 
-    return Success;
+    return TRUE;
 }
 
 ULONG FatCountClustersInChain(PFAT_VOLUME_INFO Volume, ULONG StartCluster)
@@ -1109,6 +1157,8 @@ ULONG* FatGetClusterChainArray(PFAT_VOLUME_INFO Volume, ULONG StartCluster)
 BOOLEAN FatReadClusterChain(PFAT_VOLUME_INFO Volume, ULONG StartClusterNumber, ULONG NumberOfClusters, PVOID Buffer)
 {
     ULONG        ClusterStartSector;
+    ULONG        RunStartCluster;
+    ULONG        RunLength;
 
     TRACE("FatReadClusterChain() StartClusterNumber = %d NumberOfClusters = %d Buffer = 0x%x\n", StartClusterNumber, NumberOfClusters, Buffer);
 
@@ -1117,14 +1167,33 @@ BOOLEAN FatReadClusterChain(PFAT_VOLUME_INFO Volume, ULONG StartClusterNumber, U
 
         //TRACE("FatReadClusterChain() StartClusterNumber = %d NumberOfClusters = %d Buffer = 0x%x\n", StartClusterNumber, NumberOfClusters, Buffer);
         //
-        // Calculate starting sector for cluster
+        // Follow the chain as long as the clusters are contiguous on disk
         //
-        ClusterStartSector = ((StartClusterNumber - 2) * Volume->SectorsPerCluster) + Volume->DataSectorStart;
+        RunStartCluster = StartClusterNumber;
+        RunLength = 0;
+        do
+        {
+            RunLength++;
+
+            //
+            // Get next cluster
+            //
+            if (!FatGetFatEntry(Volume, StartClusterNumber, &StartClusterNumber))
+            {
+                return FALSE;
+            }
+        }
+        while (RunLength < NumberOfClusters && StartClusterNumber == RunStartCluster + RunLength);
+
+        //
+        // Calculate starting sector for the run of clusters
+        //
+        ClusterStartSector = ((RunStartCluster - 2) * Volume->SectorsPerCluster) + Volume->DataSectorStart;
 
         //
-        // Read cluster into memory
+        // Read the whole run into memory at once
         //
-        if (!FatReadVolumeSectors(Volume, ClusterStartSector, Volume->SectorsPerCluster, Buffer))
+        if (!FatReadVolumeSectors(Volume, ClusterStartSector, RunLength * Volume->SectorsPerCluster, Buffer))
         {
             return FALSE;
         }
@@ -1132,20 +1201,12 @@ BOOLEAN FatReadClusterChain(PFAT_VOLUME_INFO Volume, ULONG StartClusterNumber, U
         //
         // Decrement count of clusters left to read
         //
-        NumberOfClusters--;
+        NumberOfClusters -= RunLength;
 
         //
-        // Increment buffer address by cluster size
+        // Increment buffer address by the size of the run
         //
-        Buffer = (PVOID)((ULONG_PTR)Buffer + (Volume->SectorsPerCluster * Volume->BytesPerSector));
-
-        //
-        // Get next cluster
-        //
-        if (!FatGetFatEntry(Volume, StartClusterNumber, &StartClusterNumber))
-        {
-            return FALSE;
-        }
+        Buffer = (PVOID)((ULONG_PTR)Buffer + (RunLength * Volume->SectorsPerCluster * Volume->BytesPerSector));
 
         //
         // If end of chain then break out of our cluster reading loop
@@ -73,6 +73,33 @@ ARC_STATUS ArcOpen(CHAR* Path, OPENMODE OpenMode, ULONG* FileId)
 
     *FileId = MAX_FDS;
 
+    /* Files of the boot bundle are read from memory */
+    if (OpenMode == OpenReadOnly)
+    {
+        const DEVVTBL* FuncTable = BundleLookupFile(Path);
+        if (FuncTable)
+        {
+            for (i = 0; i < MAX_FDS; i++)
+            {
+                if (!FileData[i].FuncTable)
+                    break;
+            }
+            if (i == MAX_FDS)
+                return EMFILE;
+
+            FileData[i].FuncTable = FuncTable;
+            FileData[i].DeviceId = i;
+            *FileId = i;
+            Status = FuncTable->Open(Path, OpenMode, FileId);
+            if (Status != ESUCCESS)
+            {
+                FileData[i].FuncTable = NULL;
+                *FileId = MAX_FDS;
+            }
+            return Status;
+        }
+    }
+
     /* Search last ')', which delimits device and path */
     FileName = strrchr(Path, ')');
     if (!FileName)
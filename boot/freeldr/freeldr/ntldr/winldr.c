@@ -40,6 +40,9 @@ extern void WinLdrSetupEms(IN PCHAR BootOptions);
 
 PLOADER_SYSTEM_BLOCK WinLdrSystemBlock;
 
+/* TSC when loading started, passed to the kernel for its boot timeline */
+static ULONGLONG WinLdrStartTime;
+
 // debug stuff
 VOID DumpMemoryAllocMap(VOID);
 
@@ -211,6 +214,9 @@ WinLdrInitializePhase1(PLOADER_PARAMETER_BLOCK LoaderBlock,
                                                     &Extension->DrvDBSize,
                                                     LoaderRegistryData));
 
+    /* The times are filled right before passing control */
+    Extension->LoaderPerformanceData = PaToVa(&WinLdrSystemBlock->LoaderPerformanceData);
+
     /* Convert extension and setup block pointers */
     LoaderBlock->Extension = PaToVa(Extension);
 
@@ -655,11 +661,16 @@ LoadAndBootWindows(IN OperatingSystemItem* OperatingSystem,
     BOOLEAN HasSection;
     CHAR  BootPath[MAX_PATH];
     CHAR  FileName[MAX_PATH];
+    CHAR  BundlePath[MAX_PATH];
     CHAR  BootOptions[256];
     PCHAR File;
     BOOLEAN Success;
     PLOADER_PARAMETER_BLOCK LoaderBlock;
 
+#if defined(_M_IX86) || defined(_M_AMD64)
+    WinLdrStartTime = __rdtsc();
+#endif
+
     /* Get OS setting value */
     SettingsValue[0] = ANSI_NULL;
     IniOpenSection("Operating Systems", &SectionId);
@@ -738,6 +749,27 @@ LoadAndBootWindows(IN OperatingSystemItem* OperatingSystem,
         }
     }
 
+    /* Check if the boot files come in a boot bundle */
+    if (HasSection &&
+        IniReadSettingByName(SectionId, "BootBundle", FileName, sizeof(FileName)))
+    {
+        /* A relative bundle path is relative to the system root */
+        if (strrchr(FileName, ')') == NULL)
+        {
+            strcpy(BundlePath, BootPath);
+            strcat(BundlePath, (FileName[0] == '\\') ? FileName + 1 : FileName);
+        }
+        else
+        {
+            strcpy(BundlePath, FileName);
+        }
+
+        /* Not fatal, the files are then read one by one */
+        UiDrawProgressBarCenter(10, 100, "Loading boot bundle...");
+        if (!BundleLoad(BundlePath, BootPath))
+            WARN("Failed to load boot bundle %s\n", BundlePath);
+    }
+
     /* Let user know we started loading */
     //UiDrawStatusText("Loading...");
 
@@ -785,6 +817,12 @@ LoadAndBootWindowsCommon(
     LPCSTR SystemRoot;
     TRACE("LoadAndBootWindowsCommon()\n");
 
+#if defined(_M_IX86) || defined(_M_AMD64)
+    /* Setup doesn't go through LoadAndBootWindows */
+    if (WinLdrStartTime == 0)
+        WinLdrStartTime = __rdtsc();
+#endif
+
 #ifdef _M_IX86
     /* Setup redirection support */
     WinLdrSetupEms((PCHAR)BootOptions);
@@ -863,6 +901,12 @@ LoadAndBootWindowsCommon(
     WinLdrpDumpArcDisks(LoaderBlockVA);
 #endif
 
+#if defined(_M_IX86) || defined(_M_AMD64)
+    /* Let the kernel know how long we took */
+    LoaderBlockVA->Extension->LoaderPerformanceData->StartTime = WinLdrStartTime;
+    LoaderBlockVA->Extension->LoaderPerformanceData->EndTime = __rdtsc();
+#endif
+
     /* Pass control */
     (*KiSystemStartup)(LoaderBlockVA);
 }
@@ -8,8 +8,7 @@
 
 #pragma once
 
-#define LDR_HASH_TABLE_ENTRIES 32
-#define LDR_GET_HASH_ENTRY(x) (RtlUpcaseUnicodeChar((x)) & (LDR_HASH_TABLE_ENTRIES - 1))
+#define LDR_HASH_TABLE_ENTRIES 256
 
 /* LdrpUpdateLoadCount2 flags */
 #define LDRP_UPDATE_REFCOUNT   0x01
@@ -143,6 +142,12 @@ LdrpMapDll(IN PWSTR SearchPath OPTIONAL,
 PVOID NTAPI
 LdrpFetchAddressOfEntryPoint(PVOID ImageBase);
 
+BOOLEAN NTAPI
+LdrpResolveDllName(PWSTR DllPath,
+                   PWSTR DllName,
+                   PUNICODE_STRING FullDllName,
+                   PUNICODE_STRING BaseDllName);
+
 VOID NTAPI
 LdrpFreeUnicodeString(PUNICODE_STRING String);
 
@@ -158,6 +163,23 @@ LdrpLoadShimEngine(IN PWSTR ImageName,
 VOID NTAPI
 LdrpUnloadShimEngine(VOID);
 
+/* ldrprefetch.c */
+BOOLEAN NTAPI
+LdrpIsLoaderWorker(VOID);
+
+VOID NTAPI
+LdrpPrefetchImports(IN PWSTR DllPath OPTIONAL,
+                    IN PLDR_DATA_TABLE_ENTRY LdrEntry,
+                    IN PIMAGE_IMPORT_DESCRIPTOR ImportEntry OPTIONAL);
+
+HANDLE NTAPI
+LdrpGetPrefetchedSection(IN PWSTR DllPath OPTIONAL,
+                         IN PWSTR DllName,
+                         IN PUNICODE_STRING FullDllName);
+
+VOID NTAPI
+LdrpEndPrefetch(VOID);
+
 
 /* FIXME: Cleanup this mess */
 typedef NTSTATUS (NTAPI *PEPFUNC)(PPEB);
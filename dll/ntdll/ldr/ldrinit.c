@@ -82,6 +82,7 @@ ULONG LdrpActiveUnloadCount;
 VOID NTAPI RtlpInitializeVectoredExceptionHandling(VOID);
 VOID NTAPI RtlpInitDeferedCriticalSection(VOID);
 VOID NTAPI RtlInitializeHeapManager(VOID);
+VOID NTAPI RtlpFreeHeapThreadCache(VOID);
 extern BOOLEAN RtlpPageHeapEnabled;
 
 ULONG RtlpDisableHeapLookaside; // TODO: Move to heap.c
@@ -1144,6 +1145,9 @@ LdrShutdownThread(VOID)
 
     /* Free the activation context stack */
     RtlFreeThreadActivationContextStack();
+
+    /* Give the blocks cached for this thread back to the process heap */
+    RtlpFreeHeapThreadCache();
     DPRINT("LdrShutdownThread() done\n");
 
     return STATUS_SUCCESS;
@@ -2314,6 +2318,9 @@ LdrpInit(PCONTEXT Context,
         Teb->DeallocationStack = MemoryBasicInfo.AllocationBase;
     }
 
+    /* Loader workers don't run any DLL code and can't wait for the loader */
+    if (LdrpIsLoaderWorker()) return;
+
     /* Now check if the process is already being initialized */
     while (_InterlockedCompareExchange(&LdrpProcessInitialized,
                                       1,
@@ -17,6 +17,7 @@
 
 PLDR_MANIFEST_PROBER_ROUTINE LdrpManifestProberRoutine;
 ULONG LdrpNormalSnap;
+ULONG LdrpSnapBypass;
 
 /* FUNCTIONS *****************************************************************/
 
@@ -65,6 +66,9 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
         return STATUS_INVALID_IMAGE_FORMAT;
     }
 
+    /* Don't touch the IAT if the bound thunks are valid and none is forwarded */
+    if (EntriesValid && IatEntry->ForwarderChain == (ULONG)-1) return STATUS_SUCCESS;
+
     /* Get the IAT */
     Iat = RtlImageDirectoryEntryToData(ImportLdrEntry->DllBase,
                                        TRUE,
@@ -401,16 +405,13 @@ LdrpHandleOneNewFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
         }
         else
         {
-            /* Show debug message */
+            /* Show debug message, but don't forget an earlier stale binding */
             if (ShowSnaps)
             {
                 DPRINT1("LDR: %wZ has correct binding to %s\n",
                         &LdrEntry->BaseDllName,
                         ForwarderName);
             }
-
-            /* Remember it's valid */
-            Stale = FALSE;
         }
 
         /* Move to the next one */
@@ -421,7 +422,12 @@ LdrpHandleOneNewFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
     FirstEntry = (PIMAGE_BOUND_IMPORT_DESCRIPTOR)ForwarderEntry;
 
     /* Check if the binding was stale */
-    if (Stale)
+    if (!Stale)
+    {
+        /* The IAT is correct as it was written by the binder */
+        ++LdrpSnapBypass;
+    }
+    else
     {
         /* It was, so find the IAT entry for it */
         ++LdrpNormalSnap;
@@ -530,7 +536,7 @@ LdrpHandleOneOldFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
 {
     LPSTR ImportName;
     NTSTATUS Status;
-    BOOLEAN AlreadyLoaded = FALSE;
+    BOOLEAN AlreadyLoaded = FALSE, EntriesValid;
     PLDR_DATA_TABLE_ENTRY DllLdrEntry;
     PIMAGE_THUNK_DATA FirstThunk;
     PPEB Peb = NtCurrentPeb();
@@ -582,7 +588,6 @@ LdrpHandleOneOldFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
     }
 
     /* Check if it wasn't already loaded */
-    ++LdrpNormalSnap;
     if (!AlreadyLoaded)
     {
         /* Add the DLL to our list */
@@ -590,8 +595,33 @@ LdrpHandleOneOldFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                        &DllLdrEntry->InInitializationOrderLinks);
     }
 
+    /*
+     * Old style bindings are still good if the DLL is the one they were made
+     * against and it's at its base, then only the forwarders need snapping.
+     * A stamp of -1 means the binding is in the bound import directory.
+     */
+    EntriesValid = ((*ImportEntry)->TimeDateStamp != 0) &&
+                   ((*ImportEntry)->TimeDateStamp != (ULONG)-1) &&
+                   ((*ImportEntry)->OriginalFirstThunk != 0) &&
+                   ((*ImportEntry)->TimeDateStamp == DllLdrEntry->TimeDateStamp) &&
+                   !(DllLdrEntry->Flags & LDRP_IMAGE_NOT_AT_BASE);
+    if (EntriesValid)
+    {
+        ++LdrpSnapBypass;
+        if (ShowSnaps)
+        {
+            DPRINT1("LDR: %wZ has correct binding to %s\n",
+                    &LdrEntry->BaseDllName,
+                    ImportName);
+        }
+    }
+    else
+    {
+        ++LdrpNormalSnap;
+    }
+
     /* Now snap the IAT Entry */
-    Status = LdrpSnapIAT(DllLdrEntry, LdrEntry, *ImportEntry, FALSE);
+    Status = LdrpSnapIAT(DllLdrEntry, LdrEntry, *ImportEntry, EntriesValid);
     if (!NT_SUCCESS(Status))
     {
         /* Fail */
@@ -758,6 +788,9 @@ LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                                                IMAGE_DIRECTORY_ENTRY_IMPORT,
                                                &IatSize);
 
+    /* Have the sections of the new imports created in the background */
+    LdrpPrefetchImports(DllPath, LdrEntry, ImportEntry);
+
     /* Check if we got at least one */
     if ((BoundEntry) || (ImportEntry))
     {
@@ -806,6 +839,9 @@ LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
         }
     }
 
+    /* Close the sections that weren't used */
+    LdrpEndPrefetch();
+
     /* Release the activation context */
     RtlDeactivateActivationContextUnsafeFast(&ActCtx);
 
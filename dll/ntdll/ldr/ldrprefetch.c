@@ -0,0 +1,515 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS NT User-Mode Library
+ * FILE:            dll/ntdll/ldr/ldrprefetch.c
+ * PURPOSE:         Parallel Creation of Import Sections
+ */
+
+/*
+ * Opening a DLL and creating its image section is the part of the loading
+ * that waits for the disk, and it doesn't depend on anything else being
+ * loaded. When a DLL's imports are about to be walked, the ones that are
+ * not loaded yet are queued to a few loader worker threads, which find
+ * them on the search path and create their sections while the loader
+ * thread is still busy with the previous imports. LdrpMapDll then takes
+ * the section instead of creating it again. Everything else (mapping,
+ * relocation, snapping and initialization) is still done by the loader
+ * thread, in the usual order.
+ *
+ * The worker threads never run any DLL code: LdrpInit lets them start
+ * without the loader lock, and they don't notify the DLLs when they exit.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntdll.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *******************************************************************/
+
+#define LDRP_MAX_WORKERS            4
+#define LDRP_WORKER_IDLE_TIMEOUT    (-5LL * 1000 * 1000 * 10)
+
+#define LDRP_PREFETCH_QUEUED        0
+#define LDRP_PREFETCH_RUNNING       1
+#define LDRP_PREFETCH_DONE          2
+#define LDRP_PREFETCH_CANCELLED     3
+
+typedef struct _LDRP_PREFETCH_ENTRY
+{
+    SLIST_ENTRY QueueEntry;
+    LIST_ENTRY Links;
+    LONG State;
+    PWSTR DllPath;
+    UNICODE_STRING DllName;
+    UNICODE_STRING FullDllName;
+    HANDLE SectionHandle;
+} LDRP_PREFETCH_ENTRY, *PLDRP_PREFETCH_ENTRY;
+
+/* Only touched by the loader thread, with the loader lock held */
+static LIST_ENTRY LdrpPrefetchList = { &LdrpPrefetchList, &LdrpPrefetchList };
+static ULONG LdrpPrefetchDepth;
+
+/* Shared with the workers */
+static SLIST_HEADER LdrpPrefetchQueue;
+static HANDLE LdrpPrefetchSemaphore;
+static HANDLE LdrpPrefetchDoneEvent;
+static LONG LdrpPrefetchActiveWorkers;
+static LONG LdrpWorkerCount;
+static HANDLE LdrpWorkerThreads[LDRP_MAX_WORKERS];
+
+/* FUNCTIONS *****************************************************************/
+
+static
+VOID
+LdrpCreatePrefetchSection(IN PLDRP_PREFETCH_ENTRY Entry)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    UNICODE_STRING BaseDllName, NtPathDllName;
+    HANDLE FileHandle, SectionHandle;
+    NTSTATUS Status;
+
+    /* Known DLLs have their sections already */
+    if (LdrpKnownDllObjectDirectory)
+    {
+        InitializeObjectAttributes(&ObjectAttributes,
+                                   &Entry->DllName,
+                                   OBJ_CASE_INSENSITIVE,
+                                   LdrpKnownDllObjectDirectory,
+                                   NULL);
+        Status = NtOpenSection(&SectionHandle,
+                               SECTION_MAP_READ | SECTION_MAP_EXECUTE | SECTION_MAP_WRITE,
+                               &ObjectAttributes);
+        if (NT_SUCCESS(Status))
+        {
+            NtClose(SectionHandle);
+            return;
+        }
+    }
+
+    /* Find it the same way LdrpMapDll will */
+    if (!LdrpResolveDllName(Entry->DllPath,
+                            Entry->DllName.Buffer,
+                            &Entry->FullDllName,
+                            &BaseDllName))
+    {
+        RtlInitEmptyUnicodeString(&Entry->FullDllName, NULL, 0);
+        return;
+    }
+    RtlFreeUnicodeString(&BaseDllName);
+
+    if (!RtlDosPathNameToNtPathName_U(Entry->FullDllName.Buffer,
+                                      &NtPathDllName,
+                                      NULL,
+                                      NULL))
+    {
+        return;
+    }
+
+    /* Errors are left for LdrpMapDll to report */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &NtPathDllName,
+                               OBJ_CASE_INSENSITIVE,
+                               NULL,
+                               NULL);
+    Status = NtOpenFile(&FileHandle,
+                        SYNCHRONIZE | FILE_EXECUTE | FILE_READ_DATA,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        FILE_SHARE_READ | FILE_SHARE_DELETE,
+                        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    if (!NT_SUCCESS(Status))
+    {
+        Status = NtOpenFile(&FileHandle,
+                            SYNCHRONIZE | FILE_EXECUTE,
+                            &ObjectAttributes,
+                            &IoStatusBlock,
+                            FILE_SHARE_READ | FILE_SHARE_DELETE,
+                            FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    }
+    RtlFreeHeap(RtlGetProcessHeap(), 0, NtPathDllName.Buffer);
+    if (!NT_SUCCESS(Status)) return;
+
+    Status = NtCreateSection(&SectionHandle,
+                             SECTION_MAP_READ | SECTION_MAP_EXECUTE |
+                             SECTION_MAP_WRITE | SECTION_QUERY,
+                             NULL,
+                             NULL,
+                             PAGE_EXECUTE,
+                             SEC_IMAGE,
+                             FileHandle);
+    NtClose(FileHandle);
+
+    if (NT_SUCCESS(Status)) Entry->SectionHandle = SectionHandle;
+}
+
+static
+NTSTATUS
+NTAPI
+LdrpPrefetchWorker(IN PVOID Parameter)
+{
+    ULONG Slot = PtrToUlong(Parameter);
+    PLDRP_PREFETCH_ENTRY Entry;
+    LARGE_INTEGER Timeout;
+    NTSTATUS Status;
+
+    Timeout.QuadPart = LDRP_WORKER_IDLE_TIMEOUT;
+
+    for (;;)
+    {
+        Status = NtWaitForSingleObject(LdrpPrefetchSemaphore, FALSE, &Timeout);
+        if (Status != STATUS_WAIT_0) break;
+
+        /* The loader doesn't free any entry while we may be looking at it */
+        InterlockedIncrement(&LdrpPrefetchActiveWorkers);
+
+        Entry = (PLDRP_PREFETCH_ENTRY)RtlInterlockedPopEntrySList(&LdrpPrefetchQueue);
+        if (Entry &&
+            InterlockedCompareExchange(&Entry->State,
+                                       LDRP_PREFETCH_RUNNING,
+                                       LDRP_PREFETCH_QUEUED) == LDRP_PREFETCH_QUEUED)
+        {
+            LdrpCreatePrefetchSection(Entry);
+            InterlockedExchange(&Entry->State, LDRP_PREFETCH_DONE);
+            NtSetEvent(LdrpPrefetchDoneEvent, NULL);
+        }
+
+        InterlockedDecrement(&LdrpPrefetchActiveWorkers);
+    }
+
+    /* We were never announced to the DLLs, so just go away */
+    InterlockedExchangePointer(&LdrpWorkerThreads[Slot], NULL);
+    InterlockedDecrement(&LdrpWorkerCount);
+    NtCurrentTeb()->FreeStackOnTermination = TRUE;
+    NtTerminateThread(NtCurrentThread(), STATUS_SUCCESS);
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+LdrpStartPrefetchWorkers(VOID)
+{
+    ULONG Wanted, Slot;
+    CLIENT_ID ClientId;
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+
+    /* The loader thread keeps one processor busy itself */
+    Wanted = min(LdrpNumberOfProcessors - 1, LDRP_MAX_WORKERS);
+
+    for (Slot = 0; Slot < LDRP_MAX_WORKERS && (ULONG)LdrpWorkerCount < Wanted; Slot++)
+    {
+        if (LdrpWorkerThreads[Slot]) continue;
+
+        /* LdrpInit has to know it's a worker before it runs */
+        Status = RtlCreateUserThread(NtCurrentProcess(),
+                                     NULL,
+                                     TRUE,
+                                     0,
+                                     0,
+                                     0,
+                                     (PTHREAD_START_ROUTINE)LdrpPrefetchWorker,
+                                     UlongToPtr(Slot),
+                                     &ThreadHandle,
+                                     &ClientId);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("LDR: Failed to create a loader worker, Status 0x%08lx\n", Status);
+            return;
+        }
+
+        LdrpWorkerThreads[Slot] = ClientId.UniqueThread;
+        InterlockedIncrement(&LdrpWorkerCount);
+        NtResumeThread(ThreadHandle, NULL);
+        NtClose(ThreadHandle);
+    }
+}
+
+BOOLEAN
+NTAPI
+LdrpIsLoaderWorker(VOID)
+{
+    HANDLE UniqueThread = NtCurrentTeb()->RealClientId.UniqueThread;
+    ULONG i;
+
+    for (i = 0; i < LDRP_MAX_WORKERS; i++)
+    {
+        if (LdrpWorkerThreads[i] == UniqueThread) return TRUE;
+    }
+
+    return FALSE;
+}
+
+static
+PLDRP_PREFETCH_ENTRY
+LdrpAllocatePrefetchEntry(IN PWSTR DllPath OPTIONAL,
+                          IN LPSTR ImportName)
+{
+    PLDRP_PREFETCH_ENTRY Entry;
+    ANSI_STRING AnsiString;
+    PLDR_DATA_TABLE_ENTRY LdrEntry;
+    UNICODE_STRING RedirectedName, *NamePtr;
+    PWCHAR p;
+    SIZE_T Size;
+    NTSTATUS Status;
+
+    RtlInitAnsiString(&AnsiString, ImportName);
+
+    /* Leave room for the default extension */
+    Size = (AnsiString.Length + 1) * sizeof(WCHAR) + LdrApiDefaultExtension.Length;
+    if (Size > UNICODE_STRING_MAX_BYTES) return NULL;
+
+    Entry = RtlAllocateHeap(RtlGetProcessHeap(),
+                            HEAP_ZERO_MEMORY,
+                            sizeof(LDRP_PREFETCH_ENTRY) + Size);
+    if (!Entry) return NULL;
+
+    Entry->DllPath = DllPath;
+    RtlInitEmptyUnicodeString(&Entry->DllName, (PWCHAR)(Entry + 1), (USHORT)Size);
+    Status = RtlAnsiStringToUnicodeString(&Entry->DllName, &AnsiString, FALSE);
+    if (!NT_SUCCESS(Status)) goto Skip;
+
+    /* Name it the way LdrpLoadImportModule will */
+    for (p = Entry->DllName.Buffer + Entry->DllName.Length / sizeof(WCHAR);
+         p > Entry->DllName.Buffer;
+         p--)
+    {
+        if (p[-1] == L'.' || p[-1] == L'\\') break;
+    }
+    if (p == Entry->DllName.Buffer || p[-1] != L'.')
+        RtlAppendUnicodeStringToString(&Entry->DllName, &LdrApiDefaultExtension);
+
+    /* Nothing to do if it's already there */
+    if (LdrpCheckForLoadedDll(DllPath, &Entry->DllName, TRUE, FALSE, &LdrEntry))
+        goto Skip;
+
+    /* Redirected DLLs are found differently, leave them alone */
+    RtlInitEmptyUnicodeString(&RedirectedName, NULL, 0);
+    NamePtr = &Entry->DllName;
+    Status = RtlDosApplyFileIsolationRedirection_Ustr(TRUE,
+                                                      &Entry->DllName,
+                                                      &LdrApiDefaultExtension,
+                                                      NULL,
+                                                      &RedirectedName,
+                                                      &NamePtr,
+                                                      NULL,
+                                                      NULL,
+                                                      NULL);
+    RtlFreeUnicodeString(&RedirectedName);
+    if (Status != STATUS_SXS_KEY_NOT_FOUND) goto Skip;
+
+    return Entry;
+
+Skip:
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Entry);
+    return NULL;
+}
+
+static
+PLDRP_PREFETCH_ENTRY
+LdrpFindPrefetchEntry(IN PWSTR DllPath OPTIONAL,
+                      IN PUNICODE_STRING DllName)
+{
+    PLIST_ENTRY ListEntry;
+    PLDRP_PREFETCH_ENTRY Entry;
+
+    for (ListEntry = LdrpPrefetchList.Flink;
+         ListEntry != &LdrpPrefetchList;
+         ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, LDRP_PREFETCH_ENTRY, Links);
+        if (Entry->DllPath == DllPath &&
+            RtlEqualUnicodeString(&Entry->DllName, DllName, TRUE))
+        {
+            return Entry;
+        }
+    }
+
+    return NULL;
+}
+
+static
+VOID
+LdrpWaitForPrefetchEntry(IN PLDRP_PREFETCH_ENTRY Entry)
+{
+    /* Take it back if no worker got to it yet */
+    if (InterlockedCompareExchange(&Entry->State,
+                                   LDRP_PREFETCH_CANCELLED,
+                                   LDRP_PREFETCH_QUEUED) == LDRP_PREFETCH_QUEUED)
+    {
+        return;
+    }
+
+    while (Entry->State == LDRP_PREFETCH_RUNNING)
+        NtWaitForSingleObject(LdrpPrefetchDoneEvent, FALSE, NULL);
+}
+
+VOID
+NTAPI
+LdrpPrefetchImports(IN PWSTR DllPath OPTIONAL,
+                    IN PLDR_DATA_TABLE_ENTRY LdrEntry,
+                    IN PIMAGE_IMPORT_DESCRIPTOR ImportEntry OPTIONAL)
+{
+    PLDRP_PREFETCH_ENTRY Entry;
+    PIMAGE_THUNK_DATA FirstThunk;
+    LIST_ENTRY NewEntries;
+    ULONG Count = 0;
+    NTSTATUS Status;
+
+    LdrpEnsureLoaderLockIsHeld();
+
+    /* Matched by LdrpEndPrefetch, whatever happens */
+    LdrpPrefetchDepth++;
+
+    if (!ImportEntry || LdrpNumberOfProcessors < 2) return;
+
+    if (!LdrpPrefetchSemaphore)
+    {
+        RtlInitializeSListHead(&LdrpPrefetchQueue);
+        Status = NtCreateSemaphore(&LdrpPrefetchSemaphore,
+                                   SEMAPHORE_ALL_ACCESS,
+                                   NULL,
+                                   0,
+                                   MAXLONG);
+        if (!NT_SUCCESS(Status))
+        {
+            LdrpPrefetchSemaphore = NULL;
+            return;
+        }
+
+        Status = NtCreateEvent(&LdrpPrefetchDoneEvent,
+                               EVENT_ALL_ACCESS,
+                               NULL,
+                               SynchronizationEvent,
+                               FALSE);
+        if (!NT_SUCCESS(Status))
+        {
+            NtClose(LdrpPrefetchSemaphore);
+            LdrpPrefetchSemaphore = NULL;
+            return;
+        }
+    }
+
+    /* Collect the imports nobody is loading yet */
+    InitializeListHead(&NewEntries);
+    _SEH2_TRY
+    {
+        while (ImportEntry->Name && ImportEntry->FirstThunk)
+        {
+            FirstThunk = (PIMAGE_THUNK_DATA)((ULONG_PTR)LdrEntry->DllBase +
+                                             ImportEntry->FirstThunk);
+            if (FirstThunk->u1.Function)
+            {
+                Entry = LdrpAllocatePrefetchEntry(DllPath,
+                                                  (LPSTR)((ULONG_PTR)LdrEntry->DllBase +
+                                                          ImportEntry->Name));
+                if (Entry)
+                {
+                    if (LdrpFindPrefetchEntry(DllPath, &Entry->DllName))
+                    {
+                        RtlFreeHeap(RtlGetProcessHeap(), 0, Entry);
+                    }
+                    else
+                    {
+                        InsertTailList(&NewEntries, &Entry->Links);
+                        Count++;
+                    }
+                }
+            }
+            ImportEntry++;
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* The walk itself will complain about a bad import table */
+    }
+    _SEH2_END;
+
+    /* The first one will be needed right away, it's not worth it for one */
+    if (Count < 2)
+    {
+        while (!IsListEmpty(&NewEntries))
+        {
+            Entry = CONTAINING_RECORD(RemoveHeadList(&NewEntries), LDRP_PREFETCH_ENTRY, Links);
+            RtlFreeHeap(RtlGetProcessHeap(), 0, Entry);
+        }
+        return;
+    }
+
+    /* The queue is LIFO, push them backwards so the first import goes first */
+    while (!IsListEmpty(&NewEntries))
+    {
+        Entry = CONTAINING_RECORD(RemoveTailList(&NewEntries), LDRP_PREFETCH_ENTRY, Links);
+        InsertHeadList(&LdrpPrefetchList, &Entry->Links);
+        RtlInterlockedPushEntrySList(&LdrpPrefetchQueue, &Entry->QueueEntry);
+    }
+
+    LdrpStartPrefetchWorkers();
+    NtReleaseSemaphore(LdrpPrefetchSemaphore, Count, NULL);
+}
+
+HANDLE
+NTAPI
+LdrpGetPrefetchedSection(IN PWSTR DllPath OPTIONAL,
+                         IN PWSTR DllName,
+                         IN PUNICODE_STRING FullDllName)
+{
+    PLDRP_PREFETCH_ENTRY Entry;
+    UNICODE_STRING DllNameString;
+    HANDLE SectionHandle = NULL;
+
+    if (IsListEmpty(&LdrpPrefetchList)) return NULL;
+
+    RtlInitUnicodeString(&DllNameString, DllName);
+    Entry = LdrpFindPrefetchEntry(DllPath, &DllNameString);
+    if (!Entry) return NULL;
+
+    LdrpWaitForPrefetchEntry(Entry);
+
+    /* Only use it if it's the same file */
+    if (Entry->SectionHandle &&
+        RtlEqualUnicodeString(&Entry->FullDllName, FullDllName, TRUE))
+    {
+        SectionHandle = Entry->SectionHandle;
+        Entry->SectionHandle = NULL;
+    }
+
+    return SectionHandle;
+}
+
+VOID
+NTAPI
+LdrpEndPrefetch(VOID)
+{
+    PLDRP_PREFETCH_ENTRY Entry;
+    PLIST_ENTRY ListEntry;
+
+    /* Keep everything until the outermost walk is done */
+    if (--LdrpPrefetchDepth) return;
+    if (IsListEmpty(&LdrpPrefetchList)) return;
+
+    for (ListEntry = LdrpPrefetchList.Flink;
+         ListEntry != &LdrpPrefetchList;
+         ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, LDRP_PREFETCH_ENTRY, Links);
+        LdrpWaitForPrefetchEntry(Entry);
+    }
+
+    /* Make sure no worker still holds one of them */
+    RtlInterlockedFlushSList(&LdrpPrefetchQueue);
+    while (LdrpPrefetchActiveWorkers) NtYieldExecution();
+
+    while (!IsListEmpty(&LdrpPrefetchList))
+    {
+        Entry = CONTAINING_RECORD(RemoveHeadList(&LdrpPrefetchList), LDRP_PREFETCH_ENTRY, Links);
+        if (Entry->SectionHandle) NtClose(Entry->SectionHandle);
+        RtlFreeUnicodeString(&Entry->FullDllName);
+        RtlFreeHeap(RtlGetProcessHeap(), 0, Entry);
+    }
+}
+
+/* EOF */
@@ -28,6 +28,19 @@ PVOID g_pfnSE_ProcessDying;
 
 /* FUNCTIONS *****************************************************************/
 
+static
+ULONG
+LdrpGetHashEntry(IN PUNICODE_STRING DllName)
+{
+    ULONG Hash = 0, i;
+
+    /* Hash the whole base name, so that lookups stay short with many DLLs */
+    for (i = 0; i < DllName->Length / sizeof(WCHAR); i++)
+        Hash = Hash * 65599 + RtlUpcaseUnicodeChar(DllName->Buffer[i]);
+
+    return (Hash ^ (Hash >> 16)) & (LDR_HASH_TABLE_ENTRIES - 1);
+}
+
 NTSTATUS
 NTAPI
 LdrpAllocateUnicodeString(IN OUT PUNICODE_STRING StringOut,
@@ -1113,32 +1126,39 @@ SkipCheck:
                         &FullDllName);
             }
 
-            /* Convert to NT Name */
-            if (!RtlDosPathNameToNtPathName_U(FullDllName.Buffer,
-                                              &NtPathDllName,
-                                              NULL,
-                                              NULL))
+            /* Imports may have had their section created already */
+            if (!DllCharacteristics)
+                SectionHandle = LdrpGetPrefetchedSection(SearchPath, DllName, &FullDllName);
+
+            if (!SectionHandle)
             {
-                /* Path was invalid */
-                return STATUS_OBJECT_PATH_SYNTAX_BAD;
-            }
+                /* Convert to NT Name */
+                if (!RtlDosPathNameToNtPathName_U(FullDllName.Buffer,
+                                                  &NtPathDllName,
+                                                  NULL,
+                                                  NULL))
+                {
+                    /* Path was invalid */
+                    return STATUS_OBJECT_PATH_SYNTAX_BAD;
+                }
 
-            /* Create a section for this dLL */
-            Status = LdrpCreateDllSection(&NtPathDllName,
-                                          DllHandle,
-                                          DllCharacteristics,
-                                          &SectionHandle);
+                /* Create a section for this dLL */
+                Status = LdrpCreateDllSection(&NtPathDllName,
+                                              DllHandle,
+                                              DllCharacteristics,
+                                              &SectionHandle);
 
-            /* Free the NT Name */
-            RtlFreeHeap(RtlGetProcessHeap(), 0, NtPathDllName.Buffer);
+                /* Free the NT Name */
+                RtlFreeHeap(RtlGetProcessHeap(), 0, NtPathDllName.Buffer);
 
-            /* If we failed */
-            if (!NT_SUCCESS(Status))
-            {
-                /* Free the name strings and return */
-                RtlFreeUnicodeString(&FullDllName);
-                RtlFreeUnicodeString(&BaseDllName);
-                return Status;
+                /* If we failed */
+                if (!NT_SUCCESS(Status))
+                {
+                    /* Free the name strings and return */
+                    RtlFreeUnicodeString(&FullDllName);
+                    RtlFreeUnicodeString(&BaseDllName);
+                    return Status;
+                }
             }
         }
         else
@@ -1579,7 +1599,7 @@ LdrpInsertMemoryTableEntry(IN PLDR_DATA_TABLE_ENTRY LdrEntry)
     ULONG i;
 
     /* Insert into hash table */
-    i = LDR_GET_HASH_ENTRY(LdrEntry->BaseDllName.Buffer[0]);
+    i = LdrpGetHashEntry(&LdrEntry->BaseDllName);
     InsertTailList(&LdrpHashTable[i], &LdrEntry->HashLinks);
 
     /* Insert into other lists */
@@ -2005,7 +2025,7 @@ lookinhash:
         /* FIXME: if we get redirected dll it means that we also get a full path so we need to find its filename for the hash lookup */
 
         /* Get hash index */
-        HashIndex = LDR_GET_HASH_ENTRY(DllName->Buffer[0]);
+        HashIndex = LdrpGetHashEntry(DllName);
 
         /* Traverse that list */
         ListHead = &LdrpHashTable[HashIndex];
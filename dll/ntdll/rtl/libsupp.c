@@ -361,7 +361,7 @@ typedef struct _RTL_ATOM_HANDLE
 NTSTATUS
 RtlpInitAtomTableLock(PRTL_ATOM_TABLE AtomTable)
 {
-   RtlInitializeCriticalSection(&AtomTable->CriticalSection);
+   RtlInitializeResource(&AtomTable->Resource);
    return STATUS_SUCCESS;
 }
 
@@ -369,22 +369,28 @@ RtlpInitAtomTableLock(PRTL_ATOM_TABLE AtomTable)
 VOID
 RtlpDestroyAtomTableLock(PRTL_ATOM_TABLE AtomTable)
 {
-   RtlDeleteCriticalSection(&AtomTable->CriticalSection);
+   RtlDeleteResource(&AtomTable->Resource);
 }
 
 
 BOOLEAN
 RtlpLockAtomTable(PRTL_ATOM_TABLE AtomTable)
 {
-   RtlEnterCriticalSection(&AtomTable->CriticalSection);
-   return TRUE;
+   return RtlAcquireResourceExclusive(&AtomTable->Resource, TRUE);
+}
+
+
+BOOLEAN
+RtlpLockAtomTableShared(PRTL_ATOM_TABLE AtomTable)
+{
+   return RtlAcquireResourceShared(&AtomTable->Resource, TRUE);
 }
 
 
 VOID
 RtlpUnlockAtomTable(PRTL_ATOM_TABLE AtomTable)
 {
-   RtlLeaveCriticalSection(&AtomTable->CriticalSection);
+   RtlReleaseResource(&AtomTable->Resource);
 }
 
 
@@ -422,6 +428,22 @@ RtlpFreeAtomTable(PRTL_ATOM_TABLE AtomTable)
                AtomTable);
 }
 
+PRTL_ATOM_TABLE_ENTRY *
+RtlpAllocAtomTableBuckets(ULONG Count)
+{
+   return (PRTL_ATOM_TABLE_ENTRY *)RtlAllocateHeap(RtlGetProcessHeap(),
+                                                   HEAP_ZERO_MEMORY,
+                                                   Count * sizeof(PRTL_ATOM_TABLE_ENTRY));
+}
+
+VOID
+RtlpFreeAtomTableBuckets(PRTL_ATOM_TABLE_ENTRY *Buckets)
+{
+   RtlFreeHeap(RtlGetProcessHeap(),
+               0,
+               Buckets);
+}
+
 PRTL_ATOM_TABLE_ENTRY
 RtlpAllocAtomTableEntry(ULONG Size)
 {
@@ -12,22 +12,36 @@ class CEnumZipContents :
     public IEnumIDList
 {
 private:
-    CZipEnumerator mEnumerator;
+    CZipIndex* m_Index;
     DWORD dwFlags;
-    CStringA m_Prefix;
+    ULONG m_First;
+    ULONG m_Count;
+    ULONG m_Current;
 public:
     CEnumZipContents()
-        :dwFlags(0)
+        :m_Index(NULL)
+        ,dwFlags(0)
+        ,m_First(0)
+        ,m_Count(0)
+        ,m_Current(0)
     {
     }
 
+    ~CEnumZipContents()
+    {
+        if (m_Index)
+            m_Index->Release();
+    }
+
     STDMETHODIMP Initialize(IZip* zip, DWORD flags, const char* prefix)
     {
         dwFlags = flags;
-        m_Prefix = prefix;
-        if (mEnumerator.initialize(zip))
-            return S_OK;
-        return E_FAIL;
+        m_Index = zip->getIndex();
+        if (!m_Index)
+            return E_FAIL;
+        m_Index->AddRef();
+        m_Index->FindFolder(prefix, m_First, m_Count);
+        return S_OK;
     }
 
     // *** IEnumIDList methods ***
@@ -41,13 +55,13 @@ public:
         if (celt != 1)
             return E_FAIL;
 
-        CStringA name;
-        bool dir;
-        unz_file_info64 info;
-        if (mEnumerator.next_unique(m_Prefix, name, dir, info))
+        if (m_Current < m_Count)
         {
+            const CZipIndexItem& item = m_Index->GetItem(m_First + m_Current++);
+            CStringA name(item.Path + item.ParentLength, item.NameLength);
+            unz_file_info64 info = m_Index->GetEntry(item.Entry).Info;
             *pceltFetched = 1;
-            *rgelt = _ILCreate(dir ? ZIP_PIDL_DIRECTORY : ZIP_PIDL_FILE, name, info);
+            *rgelt = _ILCreate(item.Folder ? ZIP_PIDL_DIRECTORY : ZIP_PIDL_FILE, name, info);
             return S_OK;
         }
 
@@ -55,22 +69,18 @@ public:
     }
     STDMETHODIMP Skip(ULONG celt)
     {
-        CStringA name;
-        bool dir;
-        unz_file_info64 info;
-        while (celt--)
+        if (celt > m_Count - m_Current)
         {
-            if (!mEnumerator.next_unique(m_Prefix, name, dir, info))
-                return E_FAIL;
-            ;
+            m_Current = m_Count;
+            return E_FAIL;
         }
+        m_Current += celt;
         return S_OK;
     }
     STDMETHODIMP Reset()
     {
-        if (mEnumerator.reset())
-            return S_OK;
-        return E_FAIL;
+        m_Current = 0;
+        return S_OK;
     }
     STDMETHODIMP Clone(IEnumIDList **ppenum)
     {
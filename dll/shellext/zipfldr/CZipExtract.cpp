@@ -7,17 +7,18 @@
 
 #include "precomp.h"
 
-class CZipExtract :
-    public IZip
+#define MAX_EXTRACT_THREADS     8
+#define EXTRACT_QUEUE_SIZE      64
+#define EXTRACT_BUFFER_SIZE     (64 * 1024)
+
+class CZipExtract
 {
     CStringW m_Filename;
     CStringW m_Directory;
     bool m_DirectoryChanged;
-    unzFile uf;
 public:
     CZipExtract(PCWSTR Filename)
         :m_DirectoryChanged(false)
-        ,uf(NULL)
     {
         m_Filename = Filename;
         m_Directory = m_Filename;
@@ -26,45 +27,262 @@ public:
         m_Directory.ReleaseBuffer();
     }
 
-    ~CZipExtract()
+    /*
+     * Decompresses the files on worker threads, each with its own handle to
+     * the zip. The files are created by the thread that asks the user what
+     * to do with those that already exist, and then queued.
+     */
+    class CExtractQueue
     {
-        if (uf)
+    private:
+        struct Job
+        {
+            const CZipIndexEntry* Entry;
+            HANDLE hFile;
+            CStringA Path;
+        };
+
+        CStringW m_Filename;
+        Job m_Jobs[EXTRACT_QUEUE_SIZE];
+        ULONG m_Head;
+        ULONG m_Tail;
+        bool m_Closing;
+        CRITICAL_SECTION m_Lock;
+        HANDLE m_hJobs;
+        HANDLE m_hSlots;
+        HANDLE m_Threads[MAX_EXTRACT_THREADS];
+        ULONG m_ThreadCount;
+        volatile LONG m_Done;
+        volatile LONG m_Failed;
+        volatile LONG m_Abort;
+
+        /* Used when no worker could be started */
+        unzFile m_uf;
+        BYTE* m_Buffer;
+
+        static bool ExtractEntry(unzFile uf, Job& job, BYTE* Buffer)
         {
-            DPRINT1("WARNING: uf not closed!\n");
-            Close();
+            int err = unzGoToFilePos64(uf, &job.Entry->Pos);
+            if (err != UNZ_OK)
+            {
+                DPRINT1("ERROR, unzGoToFilePos64: 0x%x\n", err);
+                return false;
+            }
+
+            const char* password = NULL;
+            /* FIXME: Process password, if required and not specified, prompt the user */
+            err = unzOpenCurrentFilePassword(uf, password);
+            if (err != UNZ_OK)
+            {
+                DPRINT1("ERROR, unzOpenCurrentFilePassword: 0x%x\n", err);
+                return false;
+            }
+
+            do
+            {
+                err = unzReadCurrentFile(uf, Buffer, EXTRACT_BUFFER_SIZE);
+
+                if (err < 0)
+                {
+                    DPRINT1("ERROR, unzReadCurrentFile: 0x%x\n", err);
+                    break;
+                }
+                else if (err > 0)
+                {
+                    DWORD dwWritten;
+                    if (!WriteFile(job.hFile, Buffer, err, &dwWritten, NULL))
+                    {
+                        DPRINT1("ERROR, WriteFile: 0x%x\n", GetLastError());
+                        break;
+                    }
+                    if (dwWritten != (DWORD)err)
+                    {
+                        DPRINT1("ERROR, WriteFile: dwWritten:%d err:%d\n", dwWritten, err);
+                        break;
+                    }
+                }
+
+            } while (err > 0);
+
+            /* Update Filetime */
+            FILETIME LastAccessTime;
+            GetFileTime(job.hFile, NULL, &LastAccessTime, NULL);
+            FILETIME LocalFileTime;
+            DosDateTimeToFileTime((WORD)(job.Entry->Info.dosDate >> 16), (WORD)job.Entry->Info.dosDate, &LocalFileTime);
+            FILETIME FileTime;
+            LocalFileTimeToFileTime(&LocalFileTime, &FileTime);
+            SetFileTime(job.hFile, &FileTime, &LastAccessTime, &FileTime);
+
+            if (err)
+            {
+                unzCloseCurrentFile(uf);
+                DPRINT1("ERROR, unzReadCurrentFile2: 0x%x\n", err);
+                return false;
+            }
+
+            err = unzCloseCurrentFile(uf);
+            if (err != UNZ_OK)
+            {
+                DPRINT1("ERROR(non-fatal), unzCloseCurrentFile: 0x%x\n", err);
+            }
+            return true;
         }
-    }
 
-    void Close()
-    {
-        if (uf)
-            unzClose(uf);
-        uf = NULL;
-    }
+        void RunJob(unzFile uf, Job& job, BYTE* Buffer)
+        {
+            if (uf && Buffer && !m_Abort)
+            {
+                if (!ExtractEntry(uf, job, Buffer))
+                {
+                    InterlockedExchange(&m_Failed, TRUE);
+                    InterlockedExchange(&m_Abort, TRUE);
+                }
+                CloseHandle(job.hFile);
+            }
+            else
+            {
+                /* The file was created for nothing */
+                CloseHandle(job.hFile);
+                DeleteFileA(job.Path);
+                if (!m_Abort)
+                    InterlockedExchange(&m_Failed, TRUE);
+            }
+            InterlockedIncrement(&m_Done);
+        }
 
-    // *** IZip methods ***
-    STDMETHODIMP QueryInterface(REFIID riid, void  **ppvObject)
-    {
-        if (riid == IID_IUnknown)
+        void Worker()
         {
-            *ppvObject = this;
-            AddRef();
-            return S_OK;
+            unzFile uf = unzOpen2_64(m_Filename.GetString(), &g_FFunc);
+            BYTE* Buffer = (BYTE*)HeapAlloc(GetProcessHeap(), 0, EXTRACT_BUFFER_SIZE);
+            if (!uf || !Buffer)
+                DPRINT1("ERROR, unable to start extracting\n");
+
+            for (;;)
+            {
+                WaitForSingleObject(m_hJobs, INFINITE);
+
+                EnterCriticalSection(&m_Lock);
+                if (m_Head == m_Tail)
+                {
+                    /* Only woken up like this when Finish was called */
+                    LeaveCriticalSection(&m_Lock);
+                    break;
+                }
+                Job job = m_Jobs[m_Head++ % EXTRACT_QUEUE_SIZE];
+                LeaveCriticalSection(&m_Lock);
+                ReleaseSemaphore(m_hSlots, 1, NULL);
+
+                RunJob(uf, job, Buffer);
+            }
+
+            if (Buffer)
+                HeapFree(GetProcessHeap(), 0, Buffer);
+            if (uf)
+                unzClose(uf);
         }
-        return E_NOINTERFACE;
-    }
-    STDMETHODIMP_(ULONG) AddRef(void)
-    {
-        return 2;
-    }
-    STDMETHODIMP_(ULONG) Release(void)
-    {
-        return 1;
-    }
-    STDMETHODIMP_(unzFile) getZip()
-    {
-        return uf;
-    }
+
+        static DWORD WINAPI s_Worker(LPVOID lpParameter)
+        {
+            ((CExtractQueue*)lpParameter)->Worker();
+            return 0;
+        }
+
+    public:
+        CExtractQueue(PCWSTR Filename)
+            :m_Filename(Filename)
+            ,m_Head(0)
+            ,m_Tail(0)
+            ,m_Closing(false)
+            ,m_ThreadCount(0)
+            ,m_Done(0)
+            ,m_Failed(FALSE)
+            ,m_Abort(FALSE)
+            ,m_uf(NULL)
+            ,m_Buffer(NULL)
+        {
+            InitializeCriticalSection(&m_Lock);
+            m_hJobs = CreateSemaphoreW(NULL, 0, EXTRACT_QUEUE_SIZE + MAX_EXTRACT_THREADS, NULL);
+            m_hSlots = CreateSemaphoreW(NULL, EXTRACT_QUEUE_SIZE, EXTRACT_QUEUE_SIZE, NULL);
+            if (!m_hJobs || !m_hSlots)
+                return;
+
+            SYSTEM_INFO si;
+            GetSystemInfo(&si);
+            ULONG Count = min(max(si.dwNumberOfProcessors, 1), MAX_EXTRACT_THREADS);
+            while (m_ThreadCount < Count)
+            {
+                HANDLE hThread = CreateThread(NULL, 0, s_Worker, this, 0, NULL);
+                if (!hThread)
+                    break;
+                m_Threads[m_ThreadCount++] = hThread;
+            }
+        }
+
+        ~CExtractQueue()
+        {
+            for (ULONG n = 0; n < m_ThreadCount; ++n)
+                CloseHandle(m_Threads[n]);
+            if (m_hJobs)
+                CloseHandle(m_hJobs);
+            if (m_hSlots)
+                CloseHandle(m_hSlots);
+            if (m_Buffer)
+                HeapFree(GetProcessHeap(), 0, m_Buffer);
+            if (m_uf)
+                unzClose(m_uf);
+            DeleteCriticalSection(&m_Lock);
+        }
+
+        ULONG GetDone() const
+        {
+            return m_Done;
+        }
+
+        /* Hands the file over, it is closed whatever happens */
+        bool Add(const CZipIndexEntry& Entry, HANDLE hFile, const CStringA& Path)
+        {
+            Job job;
+            job.Entry = &Entry;
+            job.hFile = hFile;
+            job.Path = Path;
+
+            if (!m_ThreadCount)
+            {
+                if (!m_uf)
+                    m_uf = unzOpen2_64(m_Filename.GetString(), &g_FFunc);
+                if (!m_Buffer)
+                    m_Buffer = (BYTE*)HeapAlloc(GetProcessHeap(), 0, EXTRACT_BUFFER_SIZE);
+                RunJob(m_uf, job, m_Buffer);
+                return !m_Failed;
+            }
+
+            WaitForSingleObject(m_hSlots, INFINITE);
+            EnterCriticalSection(&m_Lock);
+            m_Jobs[m_Tail++ % EXTRACT_QUEUE_SIZE] = job;
+            LeaveCriticalSection(&m_Lock);
+            ReleaseSemaphore(m_hJobs, 1, NULL);
+
+            return !m_Failed;
+        }
+
+        /* Waits for the queued files, or throws them away when Abort is set */
+        bool Finish(bool Abort, CWindow& Progress, ULONG Skipped)
+        {
+            if (Abort)
+                InterlockedExchange(&m_Abort, TRUE);
+
+            if (m_ThreadCount && !m_Closing)
+            {
+                m_Closing = true;
+                ReleaseSemaphore(m_hJobs, m_ThreadCount, NULL);
+                while (WaitForMultipleObjects(m_ThreadCount, m_Threads, TRUE, 100) == WAIT_TIMEOUT)
+                    Progress.SendMessage(PBM_SETPOS, Skipped + m_Done, 0);
+            }
+            Progress.SendMessage(PBM_SETPOS, Skipped + m_Done, 0);
+
+            return !m_Failed;
+        }
+    };
 
     class CConfirmReplace : public CDialogImpl<CConfirmReplace>
     {
@@ -336,36 +554,26 @@ public:
 
     bool Extract(HWND hDlg, HWND hProgress)
     {
-        unz_global_info64 gi;
-        uf = unzOpen2_64(m_Filename.GetString(), &g_FFunc);
-        int err = unzGetGlobalInfo64(uf, &gi);
-        if (err != UNZ_OK)
-        {
-            DPRINT1("ERROR, unzGetGlobalInfo64: 0x%x\n", err);
-            Close();
-            return false;
-        }
-
-        CZipEnumerator zipEnum;
-        if (!zipEnum.initialize(this))
+        CZipIndex* Index = CZipIndex::Open(m_Filename);
+        if (!Index)
         {
-            DPRINT1("ERROR, zipEnum.initialize\n");
-            Close();
+            DPRINT1("ERROR, CZipIndex::Open\n");
             return false;
         }
 
         CWindow Progress(hProgress);
-        Progress.SendMessage(PBM_SETRANGE32, 0, gi.number_entry);
+        Progress.SendMessage(PBM_SETRANGE32, 0, Index->GetEntryCount());
         Progress.SendMessage(PBM_SETPOS, 0, 0);
 
-        BYTE Buffer[2048];
+        CExtractQueue Queue(m_Filename);
         CStringA BaseDirectory = m_Directory;
-        CStringA Name;
-        unz_file_info64 Info;
-        int CurrentFile = 0;
+        ULONG Skipped = 0;
         bool bOverwriteAll = false;
-        while (zipEnum.next(Name, Info))
+        bool bSuccess = true;
+        for (ULONG CurrentFile = 0; bSuccess && CurrentFile < Index->GetEntryCount(); ++CurrentFile)
         {
+            const CZipIndexEntry& Entry = Index->GetEntry(CurrentFile);
+            const CStringA& Name = Entry.Name;
             bool is_dir = Name.GetLength() > 0 && Name[Name.GetLength()-1] == '/';
 
             char CombinedPath[MAX_PATH * 2] = { 0 };
@@ -376,21 +584,13 @@ public:
             HRESULT hr = SHPathPrepareForWriteA(hDlg, NULL, FullPath, dwFlags);
             if (FAILED_UNEXPECTEDLY(hr))
             {
-                Close();
-                return false;
+                bSuccess = false;
+                break;
             }
-            CurrentFile++;
             if (is_dir)
-                continue;
-
-            const char* password = NULL;
-            /* FIXME: Process password, if required and not specified, prompt the user */
-            err = unzOpenCurrentFilePassword(uf, password);
-            if (err != UNZ_OK)
             {
-                DPRINT1("ERROR, unzOpenCurrentFilePassword: 0x%x\n", err);
-                Close();
-                return false;
+                Skipped++;
+                continue;
             }
 
             HANDLE hFile = CreateFileA(FullPath, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -413,10 +613,11 @@ public:
                         case CConfirmReplace::No:
                             break;
                         case CConfirmReplace::Cancel:
-                            unzCloseCurrentFile(uf);
-                            Close();
-                            return false;
+                            bSuccess = false;
+                            break;
                         }
+                        if (!bSuccess)
+                            break;
                     }
 
                     if (bOverwrite)
@@ -429,77 +630,28 @@ public:
                     }
                     else
                     {
-                        unzCloseCurrentFile(uf);
+                        Skipped++;
                         continue;
                     }
                 }
                 if (hFile == INVALID_HANDLE_VALUE)
                 {
-                    unzCloseCurrentFile(uf);
                     DPRINT1("ERROR, CreateFileA: 0x%x (%s)\n", dwErr, bOverwriteAll ? "Y" : "N");
-                    Close();
-                    return false;
-                }
-            }
-
-            do
-            {
-                err = unzReadCurrentFile(uf, Buffer, sizeof(Buffer));
-
-                if (err < 0)
-                {
-                    DPRINT1("ERROR, unzReadCurrentFile: 0x%x\n", err);
+                    bSuccess = false;
                     break;
                 }
-                else if (err > 0)
-                {
-                    DWORD dwWritten;
-                    if (!WriteFile(hFile, Buffer, err, &dwWritten, NULL))
-                    {
-                        DPRINT1("ERROR, WriteFile: 0x%x\n", GetLastError());
-                        break;
-                    }
-                    if (dwWritten != (DWORD)err)
-                    {
-                        DPRINT1("ERROR, WriteFile: dwWritten:%d err:%d\n", dwWritten, err);
-                        break;
-                    }
-                }
-
-            } while (err > 0);
-
-            /* Update Filetime */
-            FILETIME LastAccessTime;
-            GetFileTime(hFile, NULL, &LastAccessTime, NULL);
-            FILETIME LocalFileTime;
-            DosDateTimeToFileTime((WORD)(Info.dosDate >> 16), (WORD)Info.dosDate, &LocalFileTime);
-            FILETIME FileTime;
-            LocalFileTimeToFileTime(&LocalFileTime, &FileTime);
-            SetFileTime(hFile, &FileTime, &LastAccessTime, &FileTime);
-
-            /* Done.. */
-            CloseHandle(hFile);
-
-            if (err)
-            {
-                unzCloseCurrentFile(uf);
-                DPRINT1("ERROR, unzReadCurrentFile2: 0x%x\n", err);
-                Close();
-                return false;
             }
-            else
-            {
-                err = unzCloseCurrentFile(uf);
-                if (err != UNZ_OK)
-                {
-                    DPRINT1("ERROR(non-fatal), unzCloseCurrentFile: 0x%x\n", err);
-                }
-            }
-            Progress.SendMessage(PBM_SETPOS, CurrentFile, 0);
+
+            if (!Queue.Add(Entry, hFile, FullPath))
+                bSuccess = false;
+            Progress.SendMessage(PBM_SETPOS, Skipped + Queue.GetDone(), 0);
         }
 
-        Close();
-        return true;
+        if (!Queue.Finish(!bSuccess, Progress, Skipped))
+            bSuccess = false;
+
+        Index->Release();
+        return bSuccess;
     }
 };
 
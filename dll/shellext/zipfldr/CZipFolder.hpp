@@ -43,11 +43,11 @@ class CZipFolder :
     CStringW m_ZipFile;
     CStringA m_ZipDir;
     CComHeapPtr<ITEMIDLIST> m_CurDir;
-    unzFile m_UnzipFile;
+    CZipIndex* m_Index;
 
 public:
     CZipFolder()
-        :m_UnzipFile(NULL)
+        :m_Index(NULL)
     {
     }
 
@@ -58,20 +58,22 @@ public:
 
     void Close()
     {
-        if (m_UnzipFile)
-            unzClose(m_UnzipFile);
-        m_UnzipFile = NULL;
+        if (m_Index)
+            m_Index->Release();
+        m_Index = NULL;
     }
 
     // *** IZip methods ***
-    STDMETHODIMP_(unzFile) getZip()
+    STDMETHODIMP_(CZipIndex*) getIndex()
     {
-        if (!m_UnzipFile)
+        if (!m_Index)
         {
-            m_UnzipFile = unzOpen2_64(m_ZipFile, &g_FFunc);
+            CZipIndex* Index = CZipIndex::Open(m_ZipFile);
+            if (Index && InterlockedCompareExchangePointer((PVOID*)&m_Index, Index, NULL))
+                Index->Release();
         }
 
-        return m_UnzipFile;
+        return m_Index;
     }
 
     // *** IShellFolder2 methods ***
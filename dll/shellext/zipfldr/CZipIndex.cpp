@@ -0,0 +1,279 @@
+/*
+ * PROJECT:     ReactOS Zip Shell Extension
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Index of the entries of a zip file
+ */
+
+#include "precomp.h"
+
+CRITICAL_SECTION CZipIndex::s_CacheLock;
+CZipIndex* CZipIndex::s_Cache = NULL;
+
+static int CompareNames(PCSTR Name1, ULONG Length1, PCSTR Name2, ULONG Length2)
+{
+    int Result = _strnicmp(Name1, Name2, min(Length1, Length2));
+    if (!Result)
+        Result = (int)Length1 - (int)Length2;
+    return Result;
+}
+
+static int CompareParents(const CZipIndexItem* Item1, const CZipIndexItem* Item2)
+{
+    return CompareNames(Item1->Path, Item1->ParentLength, Item2->Path, Item2->ParentLength);
+}
+
+static int CompareEntries(const CZipIndexItem* Item1, const CZipIndexItem* Item2)
+{
+    if (Item1->Entry != Item2->Entry)
+        return Item1->Entry < Item2->Entry ? -1 : 1;
+    return 0;
+}
+
+static int __cdecl CompareByName(const void* p1, const void* p2)
+{
+    const CZipIndexItem* Item1 = (const CZipIndexItem*)p1;
+    const CZipIndexItem* Item2 = (const CZipIndexItem*)p2;
+    int Result = CompareParents(Item1, Item2);
+    if (!Result)
+    {
+        Result = CompareNames(Item1->Path + Item1->ParentLength, Item1->NameLength,
+                              Item2->Path + Item2->ParentLength, Item2->NameLength);
+    }
+    if (!Result)
+        Result = CompareEntries(Item1, Item2);
+    return Result;
+}
+
+static int __cdecl CompareByEntry(const void* p1, const void* p2)
+{
+    const CZipIndexItem* Item1 = (const CZipIndexItem*)p1;
+    const CZipIndexItem* Item2 = (const CZipIndexItem*)p2;
+    int Result = CompareParents(Item1, Item2);
+    if (!Result)
+        Result = CompareEntries(Item1, Item2);
+    return Result;
+}
+
+/* Adds an item for every folder in Path and for the file at its end. Items is NULL to count them */
+static ULONG AddItems(PCSTR Path, ULONG Length, ULONG Entry, CZipIndexItem* Items)
+{
+    ULONG Count = 0, Start = 0;
+    for (ULONG n = 0; n <= Length; ++n)
+    {
+        if (n < Length && Path[n] != '/')
+            continue;
+
+        /* Nothing below an empty name can be browsed to */
+        if (n == Start || n > 0xffff)
+            break;
+
+        if (Items)
+        {
+            Items[Count].Path = Path;
+            Items[Count].ParentLength = (USHORT)Start;
+            Items[Count].NameLength = (USHORT)(n - Start);
+            Items[Count].Folder = n < Length;
+            Items[Count].Entry = Entry;
+        }
+        Count++;
+        Start = n + 1;
+    }
+    return Count;
+}
+
+
+CZipIndex::CZipIndex(PCWSTR ZipFile, const WIN32_FILE_ATTRIBUTE_DATA& FileData)
+    :m_cRef(1)
+    ,m_ZipFile(ZipFile)
+    ,m_FileData(FileData)
+    ,m_Entries(NULL)
+    ,m_EntryCount(0)
+    ,m_Items(NULL)
+    ,m_ItemCount(0)
+{
+}
+
+CZipIndex::~CZipIndex()
+{
+    delete[] m_Items;
+    delete[] m_Entries;
+}
+
+bool CZipIndex::Load()
+{
+    unzFile uf = unzOpen2_64(m_ZipFile, &g_FFunc);
+    if (!uf)
+    {
+        DPRINT1("ERROR, unzOpen2_64\n");
+        return false;
+    }
+
+    unz_global_info64 gi;
+    int err = unzGetGlobalInfo64(uf, &gi);
+    if (err != UNZ_OK)
+    {
+        DPRINT1("ERROR, unzGetGlobalInfo64: 0x%x\n", err);
+        unzClose(uf);
+        return false;
+    }
+
+    /* Archives with more than 0xffff entries but without zip64 records hold a wrong count */
+    ULONG Capacity = (ULONG)min(gi.number_entry, 0xffff) + 1;
+    m_Entries = new CZipIndexEntry[Capacity];
+
+    err = unzGoToFirstFile(uf);
+    while (err == UNZ_OK)
+    {
+        if (m_EntryCount == Capacity)
+        {
+            CZipIndexEntry* Entries = new CZipIndexEntry[Capacity * 2];
+            for (ULONG n = 0; n < m_EntryCount; ++n)
+                Entries[n] = m_Entries[n];
+            delete[] m_Entries;
+            m_Entries = Entries;
+            Capacity *= 2;
+        }
+
+        CZipIndexEntry& Entry = m_Entries[m_EntryCount];
+        err = unzGetCurrentFileInfo64(uf, &Entry.Info, NULL, 0, NULL, 0, NULL, 0);
+        if (err == UNZ_OK)
+        {
+            PSTR buf = Entry.Name.GetBuffer(Entry.Info.size_filename);
+            err = unzGetCurrentFileInfo64(uf, NULL, buf, Entry.Name.GetAllocLength(), NULL, 0, NULL, 0);
+            Entry.Name.ReleaseBuffer(Entry.Info.size_filename);
+            Entry.Name.Replace('\\', '/');
+        }
+        if (err == UNZ_OK)
+            err = unzGetFilePos64(uf, &Entry.Pos);
+        if (err != UNZ_OK)
+            break;
+
+        m_EntryCount++;
+        err = unzGoToNextFile(uf);
+    }
+    unzClose(uf);
+
+    /* Just like before, show what could be read of a damaged archive */
+    if (err != UNZ_END_OF_LIST_OF_FILE)
+        DPRINT1("ERROR, reading entry %lu: 0x%x\n", m_EntryCount, err);
+
+    BuildItems();
+    return true;
+}
+
+void CZipIndex::BuildItems()
+{
+    ULONG Count = 0;
+    for (ULONG n = 0; n < m_EntryCount; ++n)
+        Count += AddItems(m_Entries[n].Name, m_Entries[n].Name.GetLength(), n, NULL);
+
+    m_Items = new CZipIndexItem[Count + 1];
+    for (ULONG n = 0; n < m_EntryCount; ++n)
+        m_ItemCount += AddItems(m_Entries[n].Name, m_Entries[n].Name.GetLength(), n, m_Items + m_ItemCount);
+
+    /* A folder shows up once, at the first entry inside it */
+    qsort(m_Items, m_ItemCount, sizeof(*m_Items), CompareByName);
+    ULONG Unique = 0;
+    for (ULONG n = 0; n < m_ItemCount; ++n)
+    {
+        if (Unique &&
+            !CompareParents(&m_Items[Unique - 1], &m_Items[n]) &&
+            !CompareNames(m_Items[Unique - 1].Path + m_Items[Unique - 1].ParentLength, m_Items[Unique - 1].NameLength,
+                          m_Items[n].Path + m_Items[n].ParentLength, m_Items[n].NameLength))
+        {
+            continue;
+        }
+        m_Items[Unique++] = m_Items[n];
+    }
+    m_ItemCount = Unique;
+
+    qsort(m_Items, m_ItemCount, sizeof(*m_Items), CompareByEntry);
+}
+
+bool CZipIndex::FindFolder(PCSTR Prefix, ULONG& First, ULONG& Count) const
+{
+    CZipIndexItem Key = { Prefix, (USHORT)strlen(Prefix), 0, false, 0 };
+
+    /* Lower bound of the items in the folder */
+    ULONG Low = 0, High = m_ItemCount;
+    while (Low < High)
+    {
+        ULONG Mid = Low + (High - Low) / 2;
+        if (CompareParents(&m_Items[Mid], &Key) < 0)
+            Low = Mid + 1;
+        else
+            High = Mid;
+    }
+
+    First = Low;
+    Count = 0;
+    while (First + Count < m_ItemCount && !CompareParents(&m_Items[First + Count], &Key))
+        Count++;
+    return Count != 0;
+}
+
+ULONG CZipIndex::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+ULONG CZipIndex::Release()
+{
+    ULONG cRef = InterlockedDecrement(&m_cRef);
+    if (!cRef)
+        delete this;
+    return cRef;
+}
+
+void CZipIndex::InitCache()
+{
+    InitializeCriticalSection(&s_CacheLock);
+}
+
+void CZipIndex::FreeCache()
+{
+    if (s_Cache)
+        s_Cache->Release();
+    s_Cache = NULL;
+    DeleteCriticalSection(&s_CacheLock);
+}
+
+CZipIndex* CZipIndex::Open(PCWSTR ZipFile)
+{
+    WIN32_FILE_ATTRIBUTE_DATA FileData;
+    if (!GetFileAttributesExW(ZipFile, GetFileExInfoStandard, &FileData))
+    {
+        DPRINT1("ERROR, GetFileAttributesExW: 0x%x\n", GetLastError());
+        return NULL;
+    }
+
+    EnterCriticalSection(&s_CacheLock);
+    CZipIndex* Index = s_Cache;
+    if (Index && !_wcsicmp(Index->m_ZipFile, ZipFile) &&
+        !CompareFileTime(&Index->m_FileData.ftLastWriteTime, &FileData.ftLastWriteTime) &&
+        Index->m_FileData.nFileSizeLow == FileData.nFileSizeLow &&
+        Index->m_FileData.nFileSizeHigh == FileData.nFileSizeHigh)
+    {
+        Index->AddRef();
+        LeaveCriticalSection(&s_CacheLock);
+        return Index;
+    }
+    LeaveCriticalSection(&s_CacheLock);
+
+    Index = new CZipIndex(ZipFile, FileData);
+    if (!Index->Load())
+    {
+        Index->Release();
+        return NULL;
+    }
+
+    Index->AddRef();
+    EnterCriticalSection(&s_CacheLock);
+    CZipIndex* Old = s_Cache;
+    s_Cache = Index;
+    LeaveCriticalSection(&s_CacheLock);
+    if (Old)
+        Old->Release();
+
+    return Index;
+}
@@ -0,0 +1,72 @@
+/*
+ * PROJECT:     ReactOS Zip Shell Extension
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Index of the entries of a zip file
+ */
+
+struct CZipIndexEntry
+{
+    CStringA Name;              /* Full name, with '/' as separator */
+    unz_file_info64 Info;
+    unz64_file_pos Pos;         /* Used to go straight to the entry */
+};
+
+/* A file or folder shown in a folder of the zip */
+struct CZipIndexItem
+{
+    PCSTR Path;                 /* Name of the first entry below the item */
+    USHORT ParentLength;        /* Length of the parent folder in Path, including the '/' */
+    USHORT NameLength;
+    bool Folder;
+    ULONG Entry;
+};
+
+/*
+ * The central directory is read once, then every folder of the zip is an
+ * adjacent range of items, in the order the entries are stored in.
+ */
+class CZipIndex
+{
+private:
+    LONG m_cRef;
+    CStringW m_ZipFile;
+    WIN32_FILE_ATTRIBUTE_DATA m_FileData;
+
+    CZipIndexEntry* m_Entries;
+    ULONG m_EntryCount;
+    CZipIndexItem* m_Items;
+    ULONG m_ItemCount;
+
+    /* The last archive opened, browsing it opens it over and over again */
+    static CRITICAL_SECTION s_CacheLock;
+    static CZipIndex* s_Cache;
+
+    CZipIndex(PCWSTR ZipFile, const WIN32_FILE_ATTRIBUTE_DATA& FileData);
+    ~CZipIndex();
+
+    bool Load();
+    void BuildItems();
+
+public:
+    static void InitCache();
+    static void FreeCache();
+    static CZipIndex* Open(PCWSTR ZipFile);
+
+    ULONG AddRef();
+    ULONG Release();
+
+    ULONG GetEntryCount() const
+    {
+        return m_EntryCount;
+    }
+    const CZipIndexEntry& GetEntry(ULONG Index) const
+    {
+        return m_Entries[Index];
+    }
+    const CZipIndexItem& GetItem(ULONG Index) const
+    {
+        return m_Items[Index];
+    }
+
+    bool FindFolder(PCSTR Prefix, ULONG& First, ULONG& Count) const;
+};
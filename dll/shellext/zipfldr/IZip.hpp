@@ -7,6 +7,6 @@
 
 struct IZip : public IUnknown
 {
-    virtual STDMETHODIMP_(unzFile) getZip() PURE;
+    virtual STDMETHODIMP_(CZipIndex*) getIndex() PURE;
 };
 
@@ -45,10 +45,12 @@ WCHAR* guid2string(REFCLSID iid);
 #include "minizip/ioapi.h"
 
 extern zlib_filefunc64_def g_FFunc;
+void fill_buffered_filefunc64W(zlib_filefunc64_def* pzlib_filefunc_def);
 
 #include "resource.h"
 
 #include "zippidl.hpp"
+#include "CZipIndex.hpp"
 #include "IZip.hpp"
 
 HRESULT _CEnumZipContents_CreateInstance(IZip* zip, DWORD flags, const char* prefix, REFIID riid, LPVOID * ppvOut);
@@ -56,7 +58,6 @@ HRESULT _CExplorerCommandProvider_CreateInstance(IContextMenu* zipObject, REFIID
 HRESULT _CFolderViewCB_CreateInstance(REFIID riid, LPVOID * ppvOut);
 void _CZipExtract_runWizard(PCWSTR Filename);
 
-#include "CZipEnumerator.hpp"
 #include "CZipFolder.hpp"
 
 #endif /* ZIPFLDR_PRECOMP_H */
@@ -37,13 +37,12 @@ CZipFldrModule gModule;
 
 
 #include "minizip/ioapi.h"
-#include "minizip/iowin32.h"
 
 zlib_filefunc64_def g_FFunc;
 
 static void init_zlib()
 {
-    fill_win32_filefunc64W(&g_FFunc);
+    fill_buffered_filefunc64W(&g_FFunc);
 }
 
 EXTERN_C
@@ -56,6 +55,10 @@ BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD dwReason, LPVOID lpReserved)
         g_hModule = hInstance;
         gModule.Init(ObjectMap, hInstance, NULL);
         init_zlib();
+        CZipIndex::InitCache();
+        break;
+    case DLL_PROCESS_DETACH:
+        CZipIndex::FreeCache();
         break;
     }
 
@@ -0,0 +1,173 @@
+/*
+ * PROJECT:     ReactOS Zip Shell Extension
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Buffered file access for minizip
+ */
+
+#include "precomp.h"
+
+/*
+ * minizip reads the central directory a few bytes at a time, and seeks
+ * before every chunk of compressed data it reads. Going to the file for each
+ * of those makes listing and extracting large archives crawl, so reads are
+ * served from a buffer that grows while the archive is read sequentially.
+ * Mapping the archive instead is not an option, an archive of a few GB does
+ * not fit in the address space of a 32 bit process.
+ */
+#define ZIPIO_MIN_READ  (64 * 1024)
+#define ZIPIO_MAX_READ  (1024 * 1024)
+
+struct CBufferedZipFile
+{
+    HANDLE hFile;
+    ULONG64 Size;
+    ULONG64 Position;       /* Where the next read starts */
+    ULONG64 BufferStart;    /* File offset of Buffer[0] */
+    ULONG BufferLength;     /* Valid bytes in Buffer */
+    ULONG ReadSize;         /* Size of the next read from the file */
+    DWORD Error;
+    BYTE* Buffer;
+};
+
+static bool fill_buffer(CBufferedZipFile* File)
+{
+    /* Double the read size as long as the reads follow each other */
+    if (File->BufferLength && File->Position == File->BufferStart + File->BufferLength)
+        File->ReadSize = min(File->ReadSize * 2, ZIPIO_MAX_READ);
+    else
+        File->ReadSize = ZIPIO_MIN_READ;
+
+    LARGE_INTEGER Offset;
+    Offset.QuadPart = File->Position;
+    DWORD dwRead;
+    if (!SetFilePointerEx(File->hFile, Offset, NULL, FILE_BEGIN) ||
+        !ReadFile(File->hFile, File->Buffer, File->ReadSize, &dwRead, NULL))
+    {
+        File->Error = GetLastError();
+        File->BufferLength = 0;
+        return false;
+    }
+
+    File->BufferStart = File->Position;
+    File->BufferLength = dwRead;
+    return dwRead != 0;
+}
+
+static voidpf ZCALLBACK buffered_open64_file_funcW(voidpf opaque, const void* filename, int mode)
+{
+    /* The archive is only ever read */
+    if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ ||
+        (mode & ZLIB_FILEFUNC_MODE_CREATE))
+    {
+        return NULL;
+    }
+
+    HANDLE hFile = CreateFileW((PCWSTR)filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    LARGE_INTEGER Size;
+    CBufferedZipFile* File = NULL;
+    if (GetFileSizeEx(hFile, &Size))
+        File = (CBufferedZipFile*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*File));
+    if (File)
+        File->Buffer = (BYTE*)HeapAlloc(GetProcessHeap(), 0, ZIPIO_MAX_READ);
+    if (!File || !File->Buffer)
+    {
+        if (File)
+            HeapFree(GetProcessHeap(), 0, File);
+        CloseHandle(hFile);
+        return NULL;
+    }
+
+    File->hFile = hFile;
+    File->Size = Size.QuadPart;
+    File->ReadSize = ZIPIO_MIN_READ;
+    return File;
+}
+
+static uLong ZCALLBACK buffered_read_file_func(voidpf opaque, voidpf stream, void* buf, uLong size)
+{
+    CBufferedZipFile* File = (CBufferedZipFile*)stream;
+    BYTE* Output = (BYTE*)buf;
+    uLong Total = 0;
+
+    while (Total < size)
+    {
+        if (File->Position < File->BufferStart ||
+            File->Position >= File->BufferStart + File->BufferLength)
+        {
+            if (!fill_buffer(File))
+                break;
+        }
+
+        ULONG Offset = (ULONG)(File->Position - File->BufferStart);
+        ULONG Length = min(File->BufferLength - Offset, size - Total);
+        CopyMemory(Output + Total, File->Buffer + Offset, Length);
+        File->Position += Length;
+        Total += Length;
+    }
+
+    return Total;
+}
+
+static uLong ZCALLBACK buffered_write_file_func(voidpf opaque, voidpf stream, const void* buf, uLong size)
+{
+    return 0;
+}
+
+static ZPOS64_T ZCALLBACK buffered_tell64_file_func(voidpf opaque, voidpf stream)
+{
+    CBufferedZipFile* File = (CBufferedZipFile*)stream;
+    return File->Position;
+}
+
+static long ZCALLBACK buffered_seek64_file_func(voidpf opaque, voidpf stream, ZPOS64_T offset, int origin)
+{
+    CBufferedZipFile* File = (CBufferedZipFile*)stream;
+
+    /* Only the position moves, the buffer is reused if it still covers it */
+    switch (origin)
+    {
+    case ZLIB_FILEFUNC_SEEK_SET:
+        File->Position = offset;
+        break;
+    case ZLIB_FILEFUNC_SEEK_CUR:
+        File->Position += offset;
+        break;
+    case ZLIB_FILEFUNC_SEEK_END:
+        File->Position = File->Size + offset;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+static int ZCALLBACK buffered_close_file_func(voidpf opaque, voidpf stream)
+{
+    CBufferedZipFile* File = (CBufferedZipFile*)stream;
+    CloseHandle(File->hFile);
+    HeapFree(GetProcessHeap(), 0, File->Buffer);
+    HeapFree(GetProcessHeap(), 0, File);
+    return 0;
+}
+
+static int ZCALLBACK buffered_error_file_func(voidpf opaque, voidpf stream)
+{
+    CBufferedZipFile* File = (CBufferedZipFile*)stream;
+    return (int)File->Error;
+}
+
+void fill_buffered_filefunc64W(zlib_filefunc64_def* pzlib_filefunc_def)
+{
+    pzlib_filefunc_def->zopen64_file = buffered_open64_file_funcW;
+    pzlib_filefunc_def->zread_file = buffered_read_file_func;
+    pzlib_filefunc_def->zwrite_file = buffered_write_file_func;
+    pzlib_filefunc_def->ztell64_file = buffered_tell64_file_func;
+    pzlib_filefunc_def->zseek64_file = buffered_seek64_file_func;
+    pzlib_filefunc_def->zclose_file = buffered_close_file_func;
+    pzlib_filefunc_def->zerror_file = buffered_error_file_func;
+    pzlib_filefunc_def->opaque = NULL;
+}
@@ -35,8 +35,8 @@
 @ stdcall DnsFindAuthoritativeZone()
 @ stdcall DnsFlushResolverCache()
 @ stdcall DnsFlushResolverCacheEntry_A(str)
-@ stdcall DnsFlushResolverCacheEntry_UTF8()
-@ stdcall DnsFlushResolverCacheEntry_W()
+@ stdcall DnsFlushResolverCacheEntry_UTF8(str)
+@ stdcall DnsFlushResolverCacheEntry_W(wstr)
 @ stdcall DnsFreeAdapterInformation()
 @ stdcall DnsFreeNetworkInformation()
 @ stdcall DnsFreeSearchInformation()
@@ -12,6 +12,7 @@
 #include <winreg.h>
 #include <iphlpapi.h>
 #include <strsafe.h>
+#include <time.h>
 
 #define NDEBUG
 #include <debug.h>
@@ -589,8 +590,8 @@ FindEntryInHosts(CONST CHAR * name)
     return Address;
 }
 
-DNS_STATUS WINAPI
-DnsQuery_W(LPCWSTR Name,
+static DNS_STATUS
+Query_Main(LPCWSTR Name,
            WORD Type,
            DWORD Options,
            PIP4_ARRAY Servers,
@@ -612,13 +613,7 @@ DnsQuery_W(LPCWSTR Name,
     PCHAR HostWithDomainName;
     PCHAR AnsiName;
     size_t NameLen = 0;
-
-    if (Name == NULL)
-        return ERROR_INVALID_PARAMETER;
-    if (QueryResultSet == NULL)
-        return ERROR_INVALID_PARAMETER;
-    if ((Options & DNS_QUERY_WIRE_ONLY) != 0 && (Options & DNS_QUERY_NO_WIRE_QUERY) != 0)
-        return ERROR_INVALID_PARAMETER;
+    time_t Now;
 
     *QueryResultSet = 0;
 
@@ -660,6 +655,9 @@ DnsQuery_W(LPCWSTR Name,
             }
 
             (*QueryResultSet)->pNext = NULL;
+            (*QueryResultSet)->Flags.DW = 0;
+            (*QueryResultSet)->Flags.S.CharSet = DnsCharSetUnicode;
+            (*QueryResultSet)->dwTtl = 0;
             (*QueryResultSet)->wType = Type;
             (*QueryResultSet)->wDataLength = sizeof(DNS_A_DATA);
             (*QueryResultSet)->Data.A.IpAddress = Address;
@@ -705,6 +703,9 @@ DnsQuery_W(LPCWSTR Name,
                 }
 
                 (*QueryResultSet)->pNext = NULL;
+                (*QueryResultSet)->Flags.DW = 0;
+                (*QueryResultSet)->Flags.S.CharSet = DnsCharSetUnicode;
+                (*QueryResultSet)->dwTtl = 0;
                 (*QueryResultSet)->wType = Type;
                 (*QueryResultSet)->wDataLength = sizeof(DNS_A_DATA);
                 (*QueryResultSet)->Data.A.IpAddress = Address;
@@ -754,6 +755,9 @@ DnsQuery_W(LPCWSTR Name,
             }
 
             (*QueryResultSet)->pNext = NULL;
+            (*QueryResultSet)->Flags.DW = 0;
+            (*QueryResultSet)->Flags.S.CharSet = DnsCharSetUnicode;
+            (*QueryResultSet)->dwTtl = 0;
             (*QueryResultSet)->wType = Type;
             (*QueryResultSet)->wDataLength = sizeof(DNS_A_DATA);
             (*QueryResultSet)->Data.A.IpAddress = Address;
@@ -853,10 +857,18 @@ DnsQuery_W(LPCWSTR Name,
                 }
 
                 (*QueryResultSet)->pNext = NULL;
+                (*QueryResultSet)->Flags.DW = 0;
+                (*QueryResultSet)->Flags.S.CharSet = DnsCharSetUnicode;
+                (*QueryResultSet)->dwTtl = 0;
                 (*QueryResultSet)->wType = Type;
                 (*QueryResultSet)->wDataLength = sizeof(DNS_A_DATA);
                 (*QueryResultSet)->Data.A.IpAddress = answer->rrs.addr->addr.inet.sin_addr.s_addr;
 
+                /* adns gives the absolute expiry time, the TTL is what's left */
+                Now = time(NULL);
+                if (answer->expires > Now)
+                    (*QueryResultSet)->dwTtl = (DWORD)(answer->expires - Now);
+
                 adns_finish(astate);
 
                 (*QueryResultSet)->pName = (LPSTR)xstrsave(Name);
@@ -866,13 +878,22 @@ DnsQuery_W(LPCWSTR Name,
 
             if (NULL == answer || adns_s_prohibitedcname != answer->status || NULL == answer->cname)
             {
+                /* Tell a name that doesn't exist apart from other failures,
+                 * the resolver caches these negative answers */
+                if (answer && answer->status == adns_s_nxdomain)
+                    adns_error = DNS_ERROR_RCODE_NAME_ERROR;
+                else if (answer && answer->status == adns_s_nodata)
+                    adns_error = DNS_INFO_NO_RECORDS;
+                else
+                    adns_error = ERROR_FILE_NOT_FOUND;
+
                 adns_finish(astate);
 
                 if (CurrentName != AnsiName)
                     RtlFreeHeap(RtlGetProcessHeap(), 0, CurrentName);
 
                 RtlFreeHeap(RtlGetProcessHeap(), 0, AnsiName);
-                return ERROR_FILE_NOT_FOUND;
+                return adns_error;
             }
 
             if (CurrentName != AnsiName)
@@ -898,6 +919,34 @@ DnsQuery_W(LPCWSTR Name,
     }
 }
 
+DNS_STATUS WINAPI
+DnsQuery_W(LPCWSTR Name,
+           WORD Type,
+           DWORD Options,
+           PIP4_ARRAY Servers,
+           PDNS_RECORD *QueryResultSet,
+           PVOID *Reserved)
+{
+    DNS_STATUS Status;
+
+    if (Name == NULL)
+        return ERROR_INVALID_PARAMETER;
+    if (QueryResultSet == NULL)
+        return ERROR_INVALID_PARAMETER;
+    if ((Options & DNS_QUERY_WIRE_ONLY) != 0 && (Options & DNS_QUERY_NO_WIRE_QUERY) != 0)
+        return ERROR_INVALID_PARAMETER;
+
+    /* Ask the resolver service first, unless the caller wants to bypass its
+     * cache or to use its own servers. The service itself bypasses it too */
+    if ((Options & DNS_QUERY_BYPASS_CACHE) == 0 && Servers == NULL)
+    {
+        if (DnsIntResolverQuery(Name, Type, Options, QueryResultSet, &Status))
+            return Status;
+    }
+
+    return Query_Main(Name, Type, Options, Servers, QueryResultSet, Reserved);
+}
+
 DNS_STATUS WINAPI
 DnsQuery_UTF8(LPCSTR Name,
               WORD Type,
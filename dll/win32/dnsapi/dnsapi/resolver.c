@@ -0,0 +1,191 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS system libraries
+ * FILE:        lib/dnsapi/dnsapi/resolver.c
+ * PURPOSE:     DNS Resolver Service client.
+ */
+
+#include "precomp.h"
+#include <dnsrslvr_c.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* The records returned by the resolver are freed with DnsRecordListFree */
+void __RPC_FAR * __RPC_USER
+midl_user_allocate(SIZE_T len)
+{
+    return RtlAllocateHeap(RtlGetProcessHeap(), HEAP_ZERO_MEMORY, len);
+}
+
+void __RPC_USER
+midl_user_free(void __RPC_FAR * ptr)
+{
+    RtlFreeHeap(RtlGetProcessHeap(), 0, ptr);
+}
+
+handle_t __RPC_USER
+DNSRSLVR_HANDLE_bind(DNSRSLVR_HANDLE pszServerName)
+{
+    handle_t hBinding = NULL;
+    LPWSTR pszStringBinding;
+    RPC_STATUS status;
+
+    DPRINT("DNSRSLVR_HANDLE_bind() called\n");
+
+    status = RpcStringBindingComposeW(NULL,
+                                      L"ncalrpc",
+                                      NULL,
+                                      L"DNSResolver",
+                                      NULL,
+                                      &pszStringBinding);
+    if (status)
+    {
+        DPRINT("RpcStringBindingCompose returned 0x%x\n", status);
+        return NULL;
+    }
+
+    /* Set the binding handle that will be used to bind to the server. */
+    status = RpcBindingFromStringBindingW(pszStringBinding,
+                                          &hBinding);
+    if (status)
+    {
+        DPRINT("RpcBindingFromStringBinding returned 0x%x\n", status);
+    }
+
+    RpcStringFreeW(&pszStringBinding);
+
+    return hBinding;
+}
+
+void __RPC_USER
+DNSRSLVR_HANDLE_unbind(DNSRSLVR_HANDLE pszServerName,
+                       handle_t hBinding)
+{
+    RPC_STATUS status;
+
+    DPRINT("DNSRSLVR_HANDLE_unbind() called\n");
+
+    status = RpcBindingFree(&hBinding);
+    if (status)
+    {
+        DPRINT("RpcBindingFree returned 0x%x\n", status);
+    }
+}
+
+/* DnsIntResolverQuery *****************
+ * Hand a query to the resolver service, which answers it from its cache or
+ * queries the network once on behalf of every process asking for the name.
+ *
+ * Returns FALSE if the service couldn't be reached, so that the caller
+ * can resolve the name itself.
+ */
+BOOL
+DnsIntResolverQuery(LPCWSTR Name,
+                    WORD Type,
+                    DWORD Options,
+                    PDNS_RECORD *QueryResultSet,
+                    DNS_STATUS *Status)
+{
+    DWORD dwRecords = 0;
+    BOOL Reached = TRUE;
+
+    *QueryResultSet = NULL;
+
+    RpcTryExcept
+    {
+        *Status = R_ResolverQuery(NULL,
+                                  Name,
+                                  Type,
+                                  Options,
+                                  &dwRecords,
+                                  (DNS_RECORDW **)QueryResultSet);
+    }
+    RpcExcept(EXCEPTION_EXECUTE_HANDLER)
+    {
+        DPRINT("R_ResolverQuery raised 0x%x\n", RpcExceptionCode());
+        Reached = FALSE;
+    }
+    RpcEndExcept;
+
+    return Reached;
+}
+
+BOOL WINAPI
+DnsFlushResolverCache(VOID)
+{
+    DWORD Status = ERROR_SUCCESS;
+
+    RpcTryExcept
+    {
+        Status = R_ResolverFlushCache(NULL);
+    }
+    RpcExcept(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = RpcExceptionCode();
+    }
+    RpcEndExcept;
+
+    if (Status != ERROR_SUCCESS)
+    {
+        DPRINT("R_ResolverFlushCache failed (Status %lu)\n", Status);
+        SetLastError(Status);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL WINAPI
+DnsFlushResolverCacheEntry_W(PCWSTR entry)
+{
+    if (!entry) return FALSE;
+
+    RpcTryExcept
+    {
+        /* Every type cached for the name goes */
+        R_ResolverFlushCacheEntry(NULL, entry, 0);
+    }
+    RpcExcept(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* Without the service nothing is cached */
+        DPRINT("R_ResolverFlushCacheEntry raised 0x%x\n", RpcExceptionCode());
+    }
+    RpcEndExcept;
+
+    return TRUE;
+}
+
+BOOL WINAPI
+DnsFlushResolverCacheEntry_A(PCSTR entry)
+{
+    LPWSTR Buffer;
+    BOOL Result;
+
+    if (!entry) return FALSE;
+
+    Buffer = dns_strdup_aw(entry);
+    if (!Buffer) return FALSE;
+
+    Result = DnsFlushResolverCacheEntry_W(Buffer);
+    HeapFree(GetProcessHeap(), 0, Buffer);
+
+    return Result;
+}
+
+BOOL WINAPI
+DnsFlushResolverCacheEntry_UTF8(PCSTR entry)
+{
+    LPWSTR Buffer;
+    BOOL Result;
+
+    if (!entry) return FALSE;
+
+    Buffer = dns_strdup_uw(entry);
+    if (!Buffer) return FALSE;
+
+    Result = DnsFlushResolverCacheEntry_W(Buffer);
+    HeapFree(GetProcessHeap(), 0, Buffer);
+
+    return Result;
+}
@@ -10,5 +10,10 @@ typedef struct
 
 DNS_STATUS DnsIntTranslateAdnsToDNS_STATUS(int Status);
 void DnsIntFreeRecordList(PDNS_RECORD ToFree);
+BOOL DnsIntResolverQuery(LPCWSTR Name,
+                         WORD Type,
+                         DWORD Options,
+                         PDNS_RECORD *QueryResultSet,
+                         DNS_STATUS *Status);
 
 #endif /* WINDNS_INTERNAL_H */
@@ -21,14 +21,987 @@
 #include "config.h"
 
 #include <stdarg.h>
+#include <stdio.h>
 
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
 #include "windef.h"
 #include "winbase.h"
+#include "winternl.h"
 #include "http.h"
 #include "wine/debug.h"
+#include "wine/heap.h"
+#include "wine/list.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(httpapi);
 
+/* Requests are served in the process, Windows does it in http.sys. Every
+ * port something is registered for gets a listening socket, every accepted
+ * connection a thread which reads and parses requests and hands them to the
+ * request queue the longest matching url belongs to. */
+
+#define MAX_REQUEST_SIZE    0x100000
+#define MAX_REQUEST_HEADERS 64
+
+struct request_queue
+{
+    struct list entry;
+    HANDLE handle;          /* manual reset event, set while requests wait to be received */
+    struct list requests;   /* connections with a request that wasn't responded to yet */
+    struct list receives;   /* overlapped HttpReceiveHttpRequest calls waiting for a request */
+};
+
+struct url
+{
+    struct list entry;
+    WCHAR *url;
+    char *host;             /* lower case, "+" and "*" match any host */
+    char *path;             /* lower case, ends with '/' */
+    USHORT port;
+    struct request_queue *queue;
+};
+
+struct listener
+{
+    struct list entry;
+    USHORT port;
+    SOCKET socket;
+    HANDLE thread;
+};
+
+struct header
+{
+    const char *name;
+    int name_len;
+    const char *value;
+    int value_len;
+};
+
+struct connection
+{
+    struct list entry;      /* in connections */
+    struct list queue_entry;/* in request_queue->requests */
+    SOCKET socket;
+    SOCKADDR_IN local;
+    SOCKADDR_IN remote;
+    HTTP_CONNECTION_ID id;
+    HANDLE done;            /* set once the request has been responded to */
+    BOOL close;             /* close the connection after the response */
+    char *buffer;
+    ULONG size;
+    ULONG len;
+
+    /* current request, points into buffer */
+    struct request_queue *queue;
+    HTTP_REQUEST_ID req_id;
+    BOOL reserved;          /* a receive got the id of the request */
+    BOOL received;          /* a receive got the whole request */
+    BOOL responding;        /* the response headers were sent */
+    ULONG request_len;
+    const char *verb;
+    int verb_len;
+    const char *url;
+    int url_len;
+    HTTP_VERSION version;
+    struct header headers[MAX_REQUEST_HEADERS];
+    int header_count;
+    const char *body;
+    ULONG body_len;
+    ULONG body_read;
+};
+
+struct pending_receive
+{
+    struct list entry;
+    ULONG flags;
+    HTTP_REQUEST *request;
+    ULONG size;
+    OVERLAPPED *ovl;
+};
+
+static struct list queues = LIST_INIT(queues);
+static struct list urls = LIST_INIT(urls);
+static struct list listeners = LIST_INIT(listeners);
+static struct list connections = LIST_INIT(connections);
+static ULONGLONG last_id;
+static LONG server_init;
+
+static CRITICAL_SECTION http_cs;
+static CRITICAL_SECTION_DEBUG http_cs_debug =
+{
+    0, 0, &http_cs,
+    { &http_cs_debug.ProcessLocksList, &http_cs_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": http_cs") }
+};
+static CRITICAL_SECTION http_cs = { &http_cs_debug, -1, 0, 0, 0, 0 };
+
+static const char *const verbs[HttpVerbMaximum] =
+{
+    NULL, NULL, NULL, "OPTIONS", "GET", "HEAD", "POST", "PUT", "DELETE", "TRACE", "CONNECT",
+    "TRACK", "MOVE", "COPY", "PROPFIND", "PROPPATCH", "MKCOL", "LOCK", "UNLOCK", "SEARCH"
+};
+
+static const char *const request_headers[HttpHeaderRequestMaximum] =
+{
+    "Cache-Control", "Connection", "Date", "Keep-Alive", "Pragma", "Trailer",
+    "Transfer-Encoding", "Upgrade", "Via", "Warning", "Allow", "Content-Length",
+    "Content-Type", "Content-Encoding", "Content-Language", "Content-Location",
+    "Content-MD5", "Content-Range", "Expires", "Last-Modified", "Accept",
+    "Accept-Charset", "Accept-Encoding", "Accept-Language", "Authorization", "Cookie",
+    "Expect", "From", "Host", "If-Match", "If-Modified-Since", "If-None-Match",
+    "If-Range", "If-Unmodified-Since", "Max-Forwards", "Proxy-Authorization",
+    "Referer", "Range", "TE", "Translate", "User-Agent"
+};
+
+static const char *const response_headers[HttpHeaderResponseMaximum] =
+{
+    "Cache-Control", "Connection", "Date", "Keep-Alive", "Pragma", "Trailer",
+    "Transfer-Encoding", "Upgrade", "Via", "Warning", "Allow", "Content-Length",
+    "Content-Type", "Content-Encoding", "Content-Language", "Content-Location",
+    "Content-MD5", "Content-Range", "Expires", "Last-Modified", "Accept-Ranges",
+    "Age", "ETag", "Location", "Proxy-Authenticate", "Retry-After", "Server",
+    "Set-Cookie", "Vary", "WWW-Authenticate"
+};
+
+static inline ULONG align_size( ULONG size )
+{
+    return (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+static struct request_queue *get_queue( HANDLE handle )
+{
+    struct request_queue *queue;
+
+    LIST_FOR_EACH_ENTRY( queue, &queues, struct request_queue, entry )
+    {
+        if (queue->handle == handle) return queue;
+    }
+    return NULL;
+}
+
+static int find_request_header( const char *name, int len )
+{
+    int i;
+
+    for (i = 0; i < HttpHeaderRequestMaximum; i++)
+    {
+        if (strlen( request_headers[i] ) == len && !_strnicmp( request_headers[i], name, len ))
+            return i;
+    }
+    return -1;
+}
+
+static const char *get_request_header( const struct connection *conn, HTTP_HEADER_ID id, int *len )
+{
+    int i;
+
+    for (i = 0; i < conn->header_count; i++)
+    {
+        if (find_request_header( conn->headers[i].name, conn->headers[i].name_len ) == id)
+        {
+            *len = conn->headers[i].value_len;
+            return conn->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+/* host part of the Host header, or the local address */
+static const char *get_request_host( const struct connection *conn, int *len )
+{
+    const char *host;
+    int i;
+
+    if (!(host = get_request_header( conn, HttpHeaderHost, len )) || !*len)
+    {
+        host = inet_ntoa( conn->local.sin_addr );
+        *len = strlen( host );
+        return host;
+    }
+
+    for (i = 0; i < *len; i++)
+    {
+        if (host[i] == ':')
+        {
+            *len = i;
+            break;
+        }
+    }
+    return host;
+}
+
+static BOOL send_all( SOCKET socket, const char *data, ULONG len )
+{
+    int ret;
+
+    while (len)
+    {
+        if ((ret = send( socket, data, len, 0 )) <= 0) return FALSE;
+        data += ret;
+        len -= ret;
+    }
+    return TRUE;
+}
+
+static void send_error( struct connection *conn, USHORT status, const char *reason )
+{
+    char buffer[128];
+    int len;
+
+    len = sprintf( buffer, "HTTP/1.1 %u %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status, reason );
+    send_all( conn->socket, buffer, len );
+}
+
+/* Returns 0 if more data is needed, 200 once a whole request was parsed and
+ * the status to fail it with otherwise */
+static USHORT parse_request( struct connection *conn )
+{
+    const char *p, *end, *line_end, *colon;
+    ULONG header_len, content_len = 0;
+    const char *value;
+    int value_len;
+
+    for (end = conn->buffer; end + 4 <= conn->buffer + conn->len; end++)
+    {
+        if (!memcmp( end, "\r\n\r\n", 4 )) break;
+    }
+    if (end + 4 > conn->buffer + conn->len)
+        return conn->len >= MAX_REQUEST_SIZE ? 400 : 0;
+    header_len = end + 4 - conn->buffer;
+
+    /* request line */
+    p = conn->buffer;
+    line_end = memchr( p, '\r', end + 2 - p );
+    conn->verb = p;
+    while (p < line_end && *p != ' ') p++;
+    conn->verb_len = p - conn->verb;
+    if (p++ == line_end || !conn->verb_len) return 400;
+
+    conn->url = p;
+    while (p < line_end && *p != ' ') p++;
+    conn->url_len = p - conn->url;
+    if (p++ == line_end || !conn->url_len || *conn->url != '/') return 400;
+
+    if (line_end - p != 8 || memcmp( p, "HTTP/", 5 ) || p[5] < '0' || p[5] > '9' || p[6] != '.' ||
+        p[7] < '0' || p[7] > '9')
+        return 400;
+    conn->version.MajorVersion = p[5] - '0';
+    conn->version.MinorVersion = p[7] - '0';
+    if (conn->version.MajorVersion != 1) return 505;
+
+    /* headers */
+    conn->header_count = 0;
+    for (p = line_end + 2; p < end + 2; p = line_end + 2)
+    {
+        struct header *header;
+
+        line_end = memchr( p, '\r', end + 2 - p );
+        if (!(colon = memchr( p, ':', line_end - p )) || colon == p) return 400;
+        if (conn->header_count == MAX_REQUEST_HEADERS) return 400;
+
+        header = &conn->headers[conn->header_count++];
+        header->name = p;
+        header->name_len = colon - p;
+        for (p = colon + 1; p < line_end && (*p == ' ' || *p == '\t'); p++);
+        header->value = p;
+        for (p = line_end; p > header->value && (p[-1] == ' ' || p[-1] == '\t'); p--);
+        header->value_len = p - header->value;
+    }
+
+    if (get_request_header( conn, HttpHeaderTransferEncoding, &value_len )) return 501;
+    if ((value = get_request_header( conn, HttpHeaderContentLength, &value_len )))
+    {
+        content_len = strtoul( value, NULL, 10 );
+        if (content_len > MAX_REQUEST_SIZE) return 413;
+    }
+
+    if (conn->len < header_len + content_len) return 0;
+
+    conn->body = conn->buffer + header_len;
+    conn->body_len = content_len;
+    conn->body_read = 0;
+    conn->request_len = header_len + content_len;
+    return 200;
+}
+
+static BOOL request_keep_alive( const struct connection *conn )
+{
+    const char *value;
+    int len;
+
+    if ((value = get_request_header( conn, HttpHeaderConnection, &len )))
+    {
+        if (len == 5 && !_strnicmp( value, "close", 5 )) return FALSE;
+        if (len == 10 && !_strnicmp( value, "keep-alive", 10 )) return TRUE;
+    }
+    return conn->version.MinorVersion >= 1;
+}
+
+static struct url *find_url( const struct connection *conn )
+{
+    struct url *url, *ret = NULL;
+    const char *host;
+    int host_len;
+
+    host = get_request_host( conn, &host_len );
+
+    LIST_FOR_EACH_ENTRY( url, &urls, struct url, entry )
+    {
+        int path_len = strlen( url->path );
+
+        if (url->port != ntohs( conn->local.sin_port )) continue;
+        if (strcmp( url->host, "+" ) && strcmp( url->host, "*" ) &&
+            (strlen( url->host ) != host_len || _strnicmp( url->host, host, host_len )))
+            continue;
+
+        /* "/dir" is served by "/dir/" as well */
+        if (conn->url_len < path_len - 1 || _strnicmp( conn->url, url->path, path_len - 1 )) continue;
+        if (conn->url_len >= path_len && conn->url[path_len - 1] != '/') continue;
+        if (conn->url_len > path_len - 1 && conn->url[path_len - 1] != '/' &&
+            conn->url[path_len - 1] != '?')
+            continue;
+
+        if (!ret || path_len > strlen( ret->path )) ret = url;
+    }
+
+    return ret;
+}
+
+static ULONG fill_request( struct connection *conn, HTTP_REQUEST *request, ULONG size,
+                           ULONG flags, ULONG *ret_size )
+{
+    BOOL copy_body = (flags & HTTP_RECEIVE_REQUEST_FLAG_COPY_BODY) && conn->body_len;
+    HTTP_UNKNOWN_HEADER *unknown;
+    int i, id, host_len, port_len, unknown_count = 0;
+    ULONG needed, url_len, path_len;
+    const char *host, *query;
+    char port[8], *p;
+    WCHAR *url;
+    HTTP_VERB verb = HttpVerbUnknown;
+
+    for (i = HttpVerbOPTIONS; i < HttpVerbMaximum; i++)
+    {
+        if (strlen( verbs[i] ) == conn->verb_len && !memcmp( verbs[i], conn->verb, conn->verb_len ))
+            verb = i;
+    }
+
+    host = get_request_host( conn, &host_len );
+    port_len = sprintf( port, ":%u", ntohs( conn->local.sin_port ) );
+    url_len = 7 + host_len + port_len + conn->url_len;
+    if (!(query = memchr( conn->url, '?', conn->url_len ))) query = conn->url + conn->url_len;
+    path_len = query - conn->url;
+
+    needed = align_size( sizeof(*request) );
+    needed += 2 * align_size( sizeof(SOCKADDR_IN) );
+    needed += align_size( (url_len + 1) * sizeof(WCHAR) );
+    if (copy_body) needed += align_size( sizeof(HTTP_DATA_CHUNK) );
+    for (i = 0; i < conn->header_count; i++)
+    {
+        if (find_request_header( conn->headers[i].name, conn->headers[i].name_len ) < 0)
+        {
+            needed += conn->headers[i].name_len + 1;
+            unknown_count++;
+        }
+        needed += conn->headers[i].value_len + 1;
+    }
+    needed += align_size( unknown_count * sizeof(HTTP_UNKNOWN_HEADER) );
+    needed += conn->url_len + 1;
+    if (verb == HttpVerbUnknown) needed += conn->verb_len + 1;
+    if (copy_body) needed += conn->body_len;
+
+    *ret_size = needed;
+    if (size < needed)
+    {
+        if (size >= sizeof(*request)) request->RequestId = conn->req_id;
+        return ERROR_MORE_DATA;
+    }
+
+    memset( request, 0, sizeof(*request) );
+    request->ConnectionId = conn->id;
+    request->RequestId = conn->req_id;
+    request->Version = conn->version;
+    request->Verb = verb;
+    request->BytesReceived = conn->request_len;
+    p = (char *)request + align_size( sizeof(*request) );
+
+    request->Address.pRemoteAddress = (SOCKADDR *)p;
+    memcpy( p, &conn->remote, sizeof(conn->remote) );
+    p += align_size( sizeof(SOCKADDR_IN) );
+    request->Address.pLocalAddress = (SOCKADDR *)p;
+    memcpy( p, &conn->local, sizeof(conn->local) );
+    p += align_size( sizeof(SOCKADDR_IN) );
+
+    /* the cooked url is always absolute */
+    url = (WCHAR *)p;
+    p += align_size( (url_len + 1) * sizeof(WCHAR) );
+    for (i = 0; i < 7; i++) url[i] = "http://"[i];
+    for (i = 0; i < host_len; i++) url[7 + i] = (BYTE)host[i];
+    for (i = 0; i < port_len; i++) url[7 + host_len + i] = port[i];
+    for (i = 0; i < conn->url_len; i++) url[7 + host_len + port_len + i] = (BYTE)conn->url[i];
+    url[url_len] = 0;
+    request->CookedUrl.pFullUrl = url;
+    request->CookedUrl.FullUrlLength = url_len * sizeof(WCHAR);
+    request->CookedUrl.pHost = url + 7;
+    request->CookedUrl.HostLength = (host_len + port_len) * sizeof(WCHAR);
+    request->CookedUrl.pAbsPath = url + 7 + host_len + port_len;
+    request->CookedUrl.AbsPathLength = path_len * sizeof(WCHAR);
+    if (path_len < conn->url_len)
+    {
+        request->CookedUrl.pQueryString = request->CookedUrl.pAbsPath + path_len;
+        request->CookedUrl.QueryStringLength = (conn->url_len - path_len) * sizeof(WCHAR);
+    }
+
+    if (copy_body)
+    {
+        request->pEntityChunks = (HTTP_DATA_CHUNK *)p;
+        request->EntityChunkCount = 1;
+        p += align_size( sizeof(HTTP_DATA_CHUNK) );
+    }
+
+    unknown = (HTTP_UNKNOWN_HEADER *)p;
+    request->Headers.pUnknownHeaders = unknown_count ? unknown : NULL;
+    p += align_size( unknown_count * sizeof(HTTP_UNKNOWN_HEADER) );
+
+    request->pRawUrl = p;
+    request->RawUrlLength = conn->url_len;
+    memcpy( p, conn->url, conn->url_len );
+    p += conn->url_len;
+    *p++ = 0;
+
+    if (verb == HttpVerbUnknown)
+    {
+        request->pUnknownVerb = p;
+        request->UnknownVerbLength = conn->verb_len;
+        memcpy( p, conn->verb, conn->verb_len );
+        p += conn->verb_len;
+        *p++ = 0;
+    }
+
+    for (i = 0; i < conn->header_count; i++)
+    {
+        const struct header *header = &conn->headers[i];
+        const char *value = p;
+
+        memcpy( p, header->value, header->value_len );
+        p += header->value_len;
+        *p++ = 0;
+
+        if ((id = find_request_header( header->name, header->name_len )) >= 0)
+        {
+            /* a repeated header keeps its first value */
+            if (request->Headers.KnownHeaders[id].pRawValue) continue;
+            request->Headers.KnownHeaders[id].pRawValue = value;
+            request->Headers.KnownHeaders[id].RawValueLength = header->value_len;
+        }
+        else
+        {
+            unknown->pRawValue = value;
+            unknown->RawValueLength = header->value_len;
+            unknown->pName = p;
+            unknown->NameLength = header->name_len;
+            memcpy( p, header->name, header->name_len );
+            p += header->name_len;
+            *p++ = 0;
+            unknown++;
+            request->Headers.UnknownHeaderCount++;
+        }
+    }
+
+    if (copy_body)
+    {
+        request->pEntityChunks->DataChunkType = HttpDataChunkFromMemory;
+        request->pEntityChunks->FromMemory.pBuffer = p;
+        request->pEntityChunks->FromMemory.BufferLength = conn->body_len;
+        memcpy( p, conn->body, conn->body_len );
+        conn->body_read = conn->body_len;
+    }
+    else if (conn->body_len)
+        request->Flags |= HTTP_REQUEST_FLAG_MORE_ENTITY_BODY_EXISTS;
+
+    return NO_ERROR;
+}
+
+static void complete_overlapped( OVERLAPPED *ovl, ULONG error, ULONG size )
+{
+    switch (error)
+    {
+    case NO_ERROR:           ovl->Internal = STATUS_SUCCESS; break;
+    case ERROR_MORE_DATA:    ovl->Internal = STATUS_BUFFER_OVERFLOW; break;
+    case ERROR_HANDLE_EOF:   ovl->Internal = STATUS_END_OF_FILE; break;
+    case ERROR_OPERATION_ABORTED: ovl->Internal = STATUS_CANCELLED; break;
+    default:                 ovl->Internal = STATUS_UNSUCCESSFUL; break;
+    }
+    ovl->InternalHigh = size;
+    if (ovl->hEvent) SetEvent( (HANDLE)((ULONG_PTR)ovl->hEvent & ~1) );
+}
+
+/* Hands requests to waiting receives and updates the queue event, called with http_cs held */
+static void update_queue( struct request_queue *queue )
+{
+    struct connection *conn;
+    BOOL waiting = FALSE;
+
+    LIST_FOR_EACH_ENTRY( conn, &queue->requests, struct connection, queue_entry )
+    {
+        struct pending_receive *receive;
+        ULONG ret, size;
+
+        if (conn->reserved) continue;
+
+        if (list_empty( &queue->receives ))
+        {
+            waiting = TRUE;
+            break;
+        }
+
+        receive = LIST_ENTRY( list_head( &queue->receives ), struct pending_receive, entry );
+        list_remove( &receive->entry );
+
+        ret = fill_request( conn, receive->request, receive->size, receive->flags, &size );
+        conn->reserved = TRUE;
+        conn->received = !ret;
+        complete_overlapped( receive->ovl, ret, size );
+        heap_free( receive );
+    }
+
+    if (waiting) SetEvent( queue->handle );
+    else ResetEvent( queue->handle );
+}
+
+static USHORT queue_request( struct connection *conn )
+{
+    struct url *url;
+
+    EnterCriticalSection( &http_cs );
+
+    if (!(url = find_url( conn )))
+    {
+        LeaveCriticalSection( &http_cs );
+        return 404;
+    }
+
+    conn->queue = url->queue;
+    conn->req_id = ++last_id;
+    conn->reserved = conn->received = conn->responding = FALSE;
+    conn->close = !request_keep_alive( conn );
+    ResetEvent( conn->done );
+    list_add_tail( &conn->queue->requests, &conn->queue_entry );
+    update_queue( conn->queue );
+
+    LeaveCriticalSection( &http_cs );
+    return 200;
+}
+
+static void finish_request( struct connection *conn, BOOL disconnect )
+{
+    EnterCriticalSection( &http_cs );
+    if (conn->queue)
+    {
+        list_remove( &conn->queue_entry );
+        conn->queue = NULL;
+    }
+    if (disconnect) conn->close = TRUE;
+    LeaveCriticalSection( &http_cs );
+
+    SetEvent( conn->done );
+}
+
+static struct connection *find_request( struct request_queue *queue, HTTP_REQUEST_ID id )
+{
+    struct connection *conn;
+
+    LIST_FOR_EACH_ENTRY( conn, &queue->requests, struct connection, queue_entry )
+    {
+        if (conn->req_id == id) return conn;
+    }
+    return NULL;
+}
+
+static void free_connection( struct connection *conn )
+{
+    EnterCriticalSection( &http_cs );
+    list_remove( &conn->entry );
+    LeaveCriticalSection( &http_cs );
+
+    closesocket( conn->socket );
+    CloseHandle( conn->done );
+    heap_free( conn->buffer );
+    heap_free( conn );
+}
+
+static DWORD WINAPI connection_proc( void *arg )
+{
+    struct connection *conn = arg;
+    USHORT status;
+    int ret;
+
+    for (;;)
+    {
+        while (!(status = parse_request( conn )))
+        {
+            if (conn->len == conn->size)
+            {
+                char *buffer;
+
+                if (!(buffer = heap_realloc( conn->buffer, conn->size * 2 ))) goto done;
+                conn->buffer = buffer;
+                conn->size *= 2;
+            }
+
+            if ((ret = recv( conn->socket, conn->buffer + conn->len, conn->size - conn->len, 0 )) <= 0)
+                goto done;
+            conn->len += ret;
+        }
+
+        if (status == 200) status = queue_request( conn );
+
+        if (status != 200)
+        {
+            TRACE( "failing request with %u\n", status );
+            send_error( conn, status, status == 404 ? "Not Found" : status == 413 ? "Request Entity Too Large" :
+                       status == 501 ? "Not Implemented" : status == 505 ? "HTTP Version Not Supported" :
+                       "Bad Request" );
+            break;
+        }
+
+        WaitForSingleObject( conn->done, INFINITE );
+        if (conn->close) break;
+
+        /* keep what was sent after the request */
+        conn->len -= conn->request_len;
+        memmove( conn->buffer, conn->buffer + conn->request_len, conn->len );
+    }
+
+done:
+    free_connection( conn );
+    return 0;
+}
+
+static DWORD WINAPI listener_proc( void *arg )
+{
+    struct listener *listener = arg;
+    struct connection *conn;
+    SOCKET socket;
+    int len;
+
+    while ((socket = accept( listener->socket, NULL, NULL )) != INVALID_SOCKET)
+    {
+        HANDLE thread = NULL;
+
+        if (!(conn = heap_alloc_zero( sizeof(*conn) )) ||
+            !(conn->buffer = heap_alloc( 4096 )) ||
+            !(conn->done = CreateEventW( NULL, TRUE, FALSE, NULL )))
+        {
+            closesocket( socket );
+            if (conn)
+            {
+                heap_free( conn->buffer );
+                heap_free( conn );
+            }
+            continue;
+        }
+
+        conn->socket = socket;
+        conn->size = 4096;
+        len = sizeof(conn->local);
+        getsockname( socket, (SOCKADDR *)&conn->local, &len );
+        len = sizeof(conn->remote);
+        getpeername( socket, (SOCKADDR *)&conn->remote, &len );
+
+        EnterCriticalSection( &http_cs );
+        conn->id = ++last_id;
+        list_add_tail( &connections, &conn->entry );
+        LeaveCriticalSection( &http_cs );
+
+        if (!(thread = CreateThread( NULL, 0, connection_proc, conn, 0, NULL )))
+        {
+            free_connection( conn );
+            continue;
+        }
+        CloseHandle( thread );
+    }
+
+    return 0;
+}
+
+/* called with http_cs held */
+static ULONG start_listener( USHORT port )
+{
+    struct listener *listener;
+    SOCKADDR_IN addr;
+    ULONG ret;
+
+    LIST_FOR_EACH_ENTRY( listener, &listeners, struct listener, entry )
+    {
+        if (listener->port == port) return NO_ERROR;
+    }
+
+    if (!(listener = heap_alloc( sizeof(*listener) ))) return ERROR_OUTOFMEMORY;
+    listener->port = port;
+
+    if ((listener->socket = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP )) == INVALID_SOCKET)
+    {
+        ret = WSAGetLastError();
+        heap_free( listener );
+        return ret;
+    }
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_ANY );
+    addr.sin_port = htons( port );
+    if (bind( listener->socket, (SOCKADDR *)&addr, sizeof(addr) ) ||
+        listen( listener->socket, SOMAXCONN ))
+    {
+        ret = WSAGetLastError() == WSAEADDRINUSE ? ERROR_SHARING_VIOLATION : WSAGetLastError();
+        closesocket( listener->socket );
+        heap_free( listener );
+        return ret;
+    }
+
+    if (!(listener->thread = CreateThread( NULL, 0, listener_proc, listener, 0, NULL )))
+    {
+        ret = GetLastError();
+        closesocket( listener->socket );
+        heap_free( listener );
+        return ret;
+    }
+
+    list_add_tail( &listeners, &listener->entry );
+    return NO_ERROR;
+}
+
+static void stop_listener( struct listener *listener )
+{
+    closesocket( listener->socket );
+    WaitForSingleObject( listener->thread, INFINITE );
+    CloseHandle( listener->thread );
+    heap_free( listener );
+}
+
+/* Detaches the listener of port if no url uses it anymore, called with http_cs held */
+static struct listener *get_unused_listener( USHORT port )
+{
+    struct listener *listener;
+    struct url *url;
+
+    LIST_FOR_EACH_ENTRY( url, &urls, struct url, entry )
+    {
+        if (url->port == port) return NULL;
+    }
+
+    LIST_FOR_EACH_ENTRY( listener, &listeners, struct listener, entry )
+    {
+        if (listener->port == port)
+        {
+            list_remove( &listener->entry );
+            return listener;
+        }
+    }
+    return NULL;
+}
+
+static void free_url( struct url *url )
+{
+    list_remove( &url->entry );
+    heap_free( url->url );
+    heap_free( url->host );
+    heap_free( url->path );
+    heap_free( url );
+}
+
+static char *strdup_lower( const WCHAR *str, int len )
+{
+    char *ret;
+    int size;
+
+    size = WideCharToMultiByte( CP_ACP, 0, str, len, NULL, 0, NULL, NULL );
+    if (!(ret = heap_alloc( size + 1 ))) return NULL;
+    WideCharToMultiByte( CP_ACP, 0, str, len, ret, size, NULL, NULL );
+    ret[size] = 0;
+    return _strlwr( ret );
+}
+
+static ULONG parse_url( const WCHAR *str, struct url *url )
+{
+    const WCHAR *host, *p;
+
+    if (!_wcsnicmp( str, L"https://", 8 ))
+    {
+        FIXME( "SSL isn't supported\n" );
+        return ERROR_NOT_SUPPORTED;
+    }
+    if (_wcsnicmp( str, L"http://", 7 )) return ERROR_INVALID_PARAMETER;
+
+    host = str + 7;
+    for (p = host; *p && *p != ':' && *p != '/'; p++);
+    if (p == host) return ERROR_INVALID_PARAMETER;
+    if (!(url->host = strdup_lower( host, p - host ))) return ERROR_OUTOFMEMORY;
+
+    url->port = 80;
+    if (*p == ':')
+    {
+        ULONG port = 0;
+
+        for (p++; *p >= '0' && *p <= '9'; p++) port = port * 10 + *p - '0';
+        if (!port || port > 0xffff) return ERROR_INVALID_PARAMETER;
+        url->port = port;
+    }
+
+    if (*p != '/' || p[wcslen( p ) - 1] != '/') return ERROR_INVALID_PARAMETER;
+    if (!(url->path = strdup_lower( p, -1 ))) return ERROR_OUTOFMEMORY;
+
+    return NO_ERROR;
+}
+
+static ULONG send_chunks( struct connection *conn, USHORT count, const HTTP_DATA_CHUNK *chunks, ULONG *sent )
+{
+    char *buffer = NULL;
+    USHORT i;
+
+    for (i = 0; i < count; i++)
+    {
+        const HTTP_DATA_CHUNK *chunk = &chunks[i];
+        ULONGLONG offset, remaining;
+        LARGE_INTEGER file_size;
+
+        switch (chunk->DataChunkType)
+        {
+        case HttpDataChunkFromMemory:
+            if (!send_all( conn->socket, chunk->FromMemory.pBuffer, chunk->FromMemory.BufferLength ))
+                goto failed;
+            *sent += chunk->FromMemory.BufferLength;
+            break;
+
+        case HttpDataChunkFromFileHandle:
+            offset = chunk->FromFileHandle.ByteRange.StartingOffset.QuadPart;
+            remaining = chunk->FromFileHandle.ByteRange.Length.QuadPart;
+            if (remaining == HTTP_BYTE_RANGE_TO_EOF)
+            {
+                if (!GetFileSizeEx( chunk->FromFileHandle.FileHandle, &file_size )) goto failed;
+                remaining = file_size.QuadPart > offset ? file_size.QuadPart - offset : 0;
+            }
+
+            if (!buffer && !(buffer = heap_alloc( 0x10000 )))
+            {
+                heap_free( buffer );
+                return ERROR_OUTOFMEMORY;
+            }
+
+            while (remaining)
+            {
+                OVERLAPPED ovl;
+                DWORD read;
+
+                memset( &ovl, 0, sizeof(ovl) );
+                ovl.Offset = (DWORD)offset;
+                ovl.OffsetHigh = (DWORD)(offset >> 32);
+                if (!ReadFile( chunk->FromFileHandle.FileHandle, buffer,
+                               min( remaining, 0x10000 ), &read, &ovl ))
+                {
+                    if (GetLastError() != ERROR_IO_PENDING ||
+                        !GetOverlappedResult( chunk->FromFileHandle.FileHandle, &ovl, &read, TRUE ))
+                        goto failed;
+                }
+                if (!read || !send_all( conn->socket, buffer, read )) goto failed;
+
+                *sent += read;
+                offset += read;
+                remaining -= read;
+            }
+            break;
+
+        default:
+            FIXME( "unhandled chunk type %u\n", chunk->DataChunkType );
+            heap_free( buffer );
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    heap_free( buffer );
+    return NO_ERROR;
+
+failed:
+    heap_free( buffer );
+    return ERROR_CONNECTION_INVALID;
+}
+
+static ULONGLONG get_chunks_size( USHORT count, const HTTP_DATA_CHUNK *chunks )
+{
+    ULONGLONG size = 0;
+    LARGE_INTEGER file_size;
+    USHORT i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (chunks[i].DataChunkType == HttpDataChunkFromMemory)
+            size += chunks[i].FromMemory.BufferLength;
+        else if (chunks[i].DataChunkType == HttpDataChunkFromFileHandle)
+        {
+            const HTTP_BYTE_RANGE *range = &chunks[i].FromFileHandle.ByteRange;
+
+            if (range->Length.QuadPart != HTTP_BYTE_RANGE_TO_EOF)
+                size += range->Length.QuadPart;
+            else if (GetFileSizeEx( chunks[i].FromFileHandle.FileHandle, &file_size ) &&
+                     file_size.QuadPart > range->StartingOffset.QuadPart)
+                size += file_size.QuadPart - range->StartingOffset.QuadPart;
+        }
+    }
+    return size;
+}
+
+static char *format_response( struct connection *conn, ULONG flags, const HTTP_RESPONSE *response, ULONG *len )
+{
+    const HTTP_RESPONSE_HEADERS *headers = &response->Headers;
+    ULONG size, i;
+    char *buffer, *p;
+
+    size = 64 + response->ReasonLength;
+    for (i = 0; i < HttpHeaderResponseMaximum; i++)
+        size += strlen( response_headers[i] ) + headers->KnownHeaders[i].RawValueLength + 4;
+    for (i = 0; i < headers->UnknownHeaderCount; i++)
+        size += headers->pUnknownHeaders[i].NameLength + headers->pUnknownHeaders[i].RawValueLength + 4;
+    size += 64;
+
+    if (!(p = buffer = heap_alloc( size ))) return NULL;
+
+    p += sprintf( p, "HTTP/1.1 %u %.*s\r\n", response->StatusCode, response->ReasonLength,
+                  response->pReason ? response->pReason : "" );
+
+    for (i = 0; i < HttpHeaderResponseMaximum; i++)
+    {
+        if (!headers->KnownHeaders[i].RawValueLength) continue;
+        p += sprintf( p, "%s: %.*s\r\n", response_headers[i], headers->KnownHeaders[i].RawValueLength,
+                      headers->KnownHeaders[i].pRawValue );
+    }
+    for (i = 0; i < headers->UnknownHeaderCount; i++)
+    {
+        const HTTP_UNKNOWN_HEADER *header = &headers->pUnknownHeaders[i];
+        p += sprintf( p, "%.*s: %.*s\r\n", header->NameLength, header->pName, header->RawValueLength,
+                      header->pRawValue );
+    }
+
+    if (!headers->KnownHeaders[HttpHeaderContentLength].RawValueLength &&
+        !headers->KnownHeaders[HttpHeaderTransferEncoding].RawValueLength)
+    {
+        /* the length of the body isn't known before it's all there */
+        if (flags & HTTP_SEND_RESPONSE_FLAG_MORE_DATA)
+            conn->close = TRUE;
+        else
+            p += sprintf( p, "Content-Length: %s\r\n",
+                          wine_dbgstr_longlong( get_chunks_size( response->EntityChunkCount,
+                                                                 response->pEntityChunks ) ) );
+    }
+
+    if (flags & HTTP_SEND_RESPONSE_FLAG_DISCONNECT) conn->close = TRUE;
+    if (conn->close && !headers->KnownHeaders[HttpHeaderConnection].RawValueLength)
+        p += sprintf( p, "Connection: close\r\n" );
+
+    p += sprintf( p, "\r\n" );
+    *len = p - buffer;
+    return buffer;
+}
+
 BOOL WINAPI DllMain( HINSTANCE hinst, DWORD reason, LPVOID lpv )
 {
     switch(reason)
@@ -58,8 +1031,20 @@ BOOL WINAPI DllMain( HINSTANCE hinst, DWORD reason, LPVOID lpv )
  */
 ULONG WINAPI HttpInitialize( HTTPAPI_VERSION version, ULONG flags, PVOID reserved )
 {
-    FIXME( "({%d,%d}, 0x%x, %p): stub!\n", version.HttpApiMajorVersion,
+    WSADATA data;
+    ULONG ret;
+
+    TRACE( "({%d,%d}, 0x%x, %p)\n", version.HttpApiMajorVersion,
            version.HttpApiMinorVersion, flags, reserved );
+
+    if (flags & HTTP_INITIALIZE_SERVER)
+    {
+        if ((ret = WSAStartup( MAKEWORD(2, 2), &data ))) return ret;
+        InterlockedIncrement( &server_init );
+    }
+    if (flags & HTTP_INITIALIZE_CONFIG)
+        FIXME( "configuration store isn't supported\n" );
+
     return NO_ERROR;
 }
 
@@ -78,7 +1063,75 @@ ULONG WINAPI HttpInitialize( HTTPAPI_VERSION version, ULONG flags, PVOID reserve
  */
 ULONG WINAPI HttpTerminate( ULONG flags, PVOID reserved )
 {
-    FIXME( "(0x%x, %p): stub!\n", flags, reserved );
+    struct request_queue *queue, *next_queue;
+    struct listener *listener, *next_listener;
+    struct url *url, *next_url;
+    struct connection *conn;
+    struct list stopped = LIST_INIT(stopped);
+
+    TRACE( "(0x%x, %p)\n", flags, reserved );
+
+    if (!(flags & HTTP_INITIALIZE_SERVER) || InterlockedDecrement( &server_init ) < 0)
+    {
+        if (flags & HTTP_INITIALIZE_SERVER) InterlockedIncrement( &server_init );
+        return NO_ERROR;
+    }
+
+    EnterCriticalSection( &http_cs );
+
+    if (!server_init)
+    {
+        LIST_FOR_EACH_ENTRY_SAFE( url, next_url, &urls, struct url, entry )
+            free_url( url );
+        LIST_FOR_EACH_ENTRY_SAFE( listener, next_listener, &listeners, struct listener, entry )
+        {
+            list_remove( &listener->entry );
+            list_add_tail( &stopped, &listener->entry );
+        }
+
+        /* the connection threads exit once their requests are finished */
+        LIST_FOR_EACH_ENTRY( conn, &connections, struct connection, entry )
+        {
+            shutdown( conn->socket, SD_BOTH );
+            conn->close = TRUE;
+            if (conn->queue && !conn->responding)
+            {
+                list_remove( &conn->queue_entry );
+                conn->queue = NULL;
+                SetEvent( conn->done );
+            }
+        }
+
+        LIST_FOR_EACH_ENTRY_SAFE( queue, next_queue, &queues, struct request_queue, entry )
+        {
+            struct pending_receive *receive, *next_receive;
+
+            LIST_FOR_EACH_ENTRY_SAFE( receive, next_receive, &queue->receives, struct pending_receive, entry )
+            {
+                list_remove( &receive->entry );
+                complete_overlapped( receive->ovl, ERROR_OPERATION_ABORTED, 0 );
+                heap_free( receive );
+            }
+
+            /* requests being responded to are finished by the sender */
+            while (!list_empty( &queue->requests ))
+            {
+                conn = LIST_ENTRY( list_head( &queue->requests ), struct connection, queue_entry );
+                list_remove( &conn->queue_entry );
+                list_init( &conn->queue_entry );
+            }
+
+            list_remove( &queue->entry );
+            heap_free( queue );
+        }
+    }
+
+    LeaveCriticalSection( &http_cs );
+
+    LIST_FOR_EACH_ENTRY_SAFE( listener, next_listener, &stopped, struct listener, entry )
+        stop_listener( listener );
+
+    WSACleanup();
     return NO_ERROR;
 }
 
@@ -171,17 +1224,379 @@ ULONG WINAPI HttpSetServiceConfiguration( HANDLE handle, HTTP_SERVICE_CONFIG_ID
  */
 ULONG WINAPI HttpCreateHttpHandle( PHANDLE handle, ULONG reserved )
 {
-    FIXME( "(%p, %d): stub!\n", handle, reserved);
-    return ERROR_CALL_NOT_IMPLEMENTED;
+    struct request_queue *queue;
+
+    TRACE( "(%p, %d)\n", handle, reserved );
+
+    if (!handle) return ERROR_INVALID_PARAMETER;
+
+    if (!(queue = heap_alloc( sizeof(*queue) ))) return ERROR_OUTOFMEMORY;
+    if (!(queue->handle = CreateEventW( NULL, TRUE, FALSE, NULL )))
+    {
+        heap_free( queue );
+        return GetLastError();
+    }
+    list_init( &queue->requests );
+    list_init( &queue->receives );
+
+    EnterCriticalSection( &http_cs );
+    list_add_tail( &queues, &queue->entry );
+    LeaveCriticalSection( &http_cs );
+
+    *handle = queue->handle;
+    return NO_ERROR;
 }
 
 /***********************************************************************
  *        HttpAddUrl     (HTTPAPI.@)
+ *
+ * Registers an url prefix for a request queue
+ *
+ * PARAMS
+ *   handle     [I] request queue
+ *   url        [I] url prefix, http://host:port/path/ where host can be + or *
+ *   reserved   [I] reserved, must be NULL
+ *
+ * RETURNS
+ *   NO_ERROR if function succeeds, or error code if function fails
+ *
  */
 ULONG WINAPI HttpAddUrl( HANDLE handle, PCWSTR url, PVOID reserved )
 {
-    FIXME( "(%p, %s, %p): stub!\n", handle, debugstr_w(url), reserved );
-    return ERROR_CALL_NOT_IMPLEMENTED;
+    struct request_queue *queue;
+    struct url *entry, *new_url;
+    ULONG ret;
+
+    TRACE( "(%p, %s, %p)\n", handle, debugstr_w(url), reserved );
+
+    if (!url) return ERROR_INVALID_PARAMETER;
+
+    if (!(new_url = heap_alloc_zero( sizeof(*new_url) ))) return ERROR_OUTOFMEMORY;
+    list_init( &new_url->entry );
+    if ((ret = parse_url( url, new_url )) ||
+        !(new_url->url = heap_alloc( (wcslen( url ) + 1) * sizeof(WCHAR) )))
+    {
+        free_url( new_url );
+        return ret ? ret : ERROR_OUTOFMEMORY;
+    }
+    wcscpy( new_url->url, url );
+
+    EnterCriticalSection( &http_cs );
+
+    if (!(queue = get_queue( handle )))
+    {
+        LeaveCriticalSection( &http_cs );
+        free_url( new_url );
+        return ERROR_INVALID_HANDLE;
+    }
+
+    LIST_FOR_EACH_ENTRY( entry, &urls, struct url, entry )
+    {
+        if (entry->port == new_url->port && !strcmp( entry->host, new_url->host ) &&
+            !strcmp( entry->path, new_url->path ))
+        {
+            LeaveCriticalSection( &http_cs );
+            free_url( new_url );
+            return ERROR_ALREADY_EXISTS;
+        }
+    }
+
+    if ((ret = start_listener( new_url->port )))
+    {
+        LeaveCriticalSection( &http_cs );
+        free_url( new_url );
+        return ret;
+    }
+
+    new_url->queue = queue;
+    list_add_tail( &urls, &new_url->entry );
+
+    LeaveCriticalSection( &http_cs );
+    return NO_ERROR;
+}
+
+/***********************************************************************
+ *        HttpRemoveUrl     (HTTPAPI.@)
+ */
+ULONG WINAPI HttpRemoveUrl( HANDLE handle, PCWSTR url )
+{
+    struct listener *listener = NULL;
+    struct url *entry;
+    ULONG ret = ERROR_FILE_NOT_FOUND;
+
+    TRACE( "(%p, %s)\n", handle, debugstr_w(url) );
+
+    if (!url) return ERROR_INVALID_PARAMETER;
+
+    EnterCriticalSection( &http_cs );
+
+    LIST_FOR_EACH_ENTRY( entry, &urls, struct url, entry )
+    {
+        if (entry->queue->handle == handle && !wcsicmp( entry->url, url ))
+        {
+            USHORT port = entry->port;
+
+            free_url( entry );
+            listener = get_unused_listener( port );
+            ret = NO_ERROR;
+            break;
+        }
+    }
+
+    LeaveCriticalSection( &http_cs );
+
+    if (listener) stop_listener( listener );
+    return ret;
+}
+
+/***********************************************************************
+ *        HttpReceiveHttpRequest     (HTTPAPI.@)
+ *
+ * Retrieves the next request of a request queue
+ *
+ * PARAMS
+ *   handle     [I] request queue
+ *   id         [I] HTTP_NULL_ID for the next request, or the id of a request
+ *                  which didn't fit into the buffer before
+ *   flags      [I] HTTP_RECEIVE_REQUEST_FLAG_COPY_BODY to receive the entity body as well
+ *   request    [O] buffer which receives the request
+ *   size       [I] size of the buffer
+ *   ret_size   [O] size of the request
+ *   ovl        [I] optional overlapped structure
+ *
+ * RETURNS
+ *   NO_ERROR if function succeeds, ERROR_IO_PENDING if it completes
+ *   asynchronously, or error code if function fails
+ *
+ */
+ULONG WINAPI HttpReceiveHttpRequest( HANDLE handle, HTTP_REQUEST_ID id, ULONG flags,
+                 PHTTP_REQUEST request, ULONG size, PULONG ret_size, LPOVERLAPPED ovl )
+{
+    struct request_queue *queue;
+    struct connection *conn;
+    ULONG ret, needed;
+
+    TRACE( "(%p, %s, 0x%x, %p, %u, %p, %p)\n", handle, wine_dbgstr_longlong(id), flags,
+           request, size, ret_size, ovl );
+
+    if (!request || size < sizeof(*request)) return ERROR_INSUFFICIENT_BUFFER;
+    if (!ovl && !ret_size) return ERROR_INVALID_PARAMETER;
+
+    for (;;)
+    {
+        EnterCriticalSection( &http_cs );
+
+        if (!(queue = get_queue( handle )))
+        {
+            LeaveCriticalSection( &http_cs );
+            return ERROR_INVALID_HANDLE;
+        }
+
+        if (id != HTTP_NULL_ID)
+        {
+            if (!(conn = find_request( queue, id )) || conn->received)
+            {
+                LeaveCriticalSection( &http_cs );
+                return ERROR_CONNECTION_INVALID;
+            }
+        }
+        else
+        {
+            LIST_FOR_EACH_ENTRY( conn, &queue->requests, struct connection, queue_entry )
+            {
+                if (!conn->reserved) break;
+            }
+            if (&conn->queue_entry == &queue->requests) conn = NULL;
+        }
+
+        if (conn)
+        {
+            ret = fill_request( conn, request, size, flags, &needed );
+            conn->reserved = TRUE;
+            conn->received = !ret;
+            update_queue( queue );
+            LeaveCriticalSection( &http_cs );
+
+            if (ret_size) *ret_size = needed;
+            if (ovl) complete_overlapped( ovl, ret, needed );
+            return ret;
+        }
+
+        if (ovl)
+        {
+            struct pending_receive *receive;
+
+            if (!(receive = heap_alloc( sizeof(*receive) )))
+            {
+                LeaveCriticalSection( &http_cs );
+                return ERROR_OUTOFMEMORY;
+            }
+            receive->flags = flags;
+            receive->request = request;
+            receive->size = size;
+            receive->ovl = ovl;
+            ovl->Internal = STATUS_PENDING;
+            list_add_tail( &queue->receives, &receive->entry );
+
+            LeaveCriticalSection( &http_cs );
+            return ERROR_IO_PENDING;
+        }
+
+        LeaveCriticalSection( &http_cs );
+
+        if (WaitForSingleObject( handle, INFINITE ) != WAIT_OBJECT_0)
+            return ERROR_INVALID_HANDLE;
+    }
+}
+
+/***********************************************************************
+ *        HttpReceiveRequestEntityBody     (HTTPAPI.@)
+ */
+ULONG WINAPI HttpReceiveRequestEntityBody( HANDLE handle, HTTP_REQUEST_ID id, ULONG flags,
+                 PVOID buffer, ULONG size, PULONG ret_size, LPOVERLAPPED ovl )
+{
+    struct request_queue *queue;
+    struct connection *conn;
+    ULONG ret = NO_ERROR, len;
+
+    TRACE( "(%p, %s, 0x%x, %p, %u, %p, %p)\n", handle, wine_dbgstr_longlong(id), flags,
+           buffer, size, ret_size, ovl );
+
+    EnterCriticalSection( &http_cs );
+
+    if (!(queue = get_queue( handle )))
+    {
+        LeaveCriticalSection( &http_cs );
+        return ERROR_INVALID_HANDLE;
+    }
+    if (!(conn = find_request( queue, id )) || !conn->received)
+    {
+        LeaveCriticalSection( &http_cs );
+        return ERROR_CONNECTION_INVALID;
+    }
+
+    /* the whole body was read along with the request */
+    len = min( size, conn->body_len - conn->body_read );
+    memcpy( buffer, conn->body + conn->body_read, len );
+    conn->body_read += len;
+    if (!len) ret = ERROR_HANDLE_EOF;
+
+    LeaveCriticalSection( &http_cs );
+
+    if (ret_size) *ret_size = len;
+    if (ovl) complete_overlapped( ovl, ret, len );
+    return ret;
+}
+
+static ULONG get_response_request( HANDLE handle, HTTP_REQUEST_ID id, BOOL responding,
+                                   struct connection **ret )
+{
+    struct request_queue *queue;
+    struct connection *conn;
+
+    EnterCriticalSection( &http_cs );
+
+    if (!(queue = get_queue( handle )))
+    {
+        LeaveCriticalSection( &http_cs );
+        return ERROR_INVALID_HANDLE;
+    }
+    if (!(conn = find_request( queue, id )) || !conn->received || conn->responding != responding)
+    {
+        LeaveCriticalSection( &http_cs );
+        return ERROR_CONNECTION_INVALID;
+    }
+
+    /* keeps HttpTerminate from finishing the request under us */
+    conn->responding = TRUE;
+
+    LeaveCriticalSection( &http_cs );
+
+    *ret = conn;
+    return NO_ERROR;
+}
+
+/***********************************************************************
+ *        HttpSendHttpResponse     (HTTPAPI.@)
+ *
+ * Sends the response to a request
+ *
+ * PARAMS
+ *   handle        [I] request queue
+ *   id            [I] id of the request
+ *   flags         [I] HTTP_SEND_RESPONSE_FLAG_MORE_DATA if the entity body is sent separately,
+ *                     HTTP_SEND_RESPONSE_FLAG_DISCONNECT to close the connection afterwards
+ *   response      [I] response
+ *   cache_policy  [I] reserved, response caching isn't supported
+ *   ret_size      [O] number of bytes sent
+ *   reserved1     [I] reserved, must be NULL
+ *   reserved2     [I] reserved, must be 0
+ *   ovl           [I] optional overlapped structure
+ *   log_data      [I] reserved, must be NULL
+ *
+ * RETURNS
+ *   NO_ERROR if function succeeds, or error code if function fails
+ *
+ */
+ULONG WINAPI HttpSendHttpResponse( HANDLE handle, HTTP_REQUEST_ID id, ULONG flags,
+                 PHTTP_RESPONSE response, PHTTP_CACHE_POLICY cache_policy, PULONG ret_size,
+                 PVOID reserved1, ULONG reserved2, LPOVERLAPPED ovl, PHTTP_LOG_DATA log_data )
+{
+    struct connection *conn;
+    ULONG ret, len, sent = 0;
+    char *buffer;
+
+    TRACE( "(%p, %s, 0x%x, %p, %p, %p, %p, %u, %p, %p)\n", handle, wine_dbgstr_longlong(id), flags,
+           response, cache_policy, ret_size, reserved1, reserved2, ovl, log_data );
+
+    if (!response) return ERROR_INVALID_PARAMETER;
+    if (cache_policy && cache_policy->Policy != HttpCachePolicyNocache)
+        FIXME( "response caching isn't supported\n" );
+
+    if ((ret = get_response_request( handle, id, FALSE, &conn ))) return ret;
+
+    if (!(buffer = format_response( conn, flags, response, &len )))
+        ret = ERROR_OUTOFMEMORY;
+    else if (!send_all( conn->socket, buffer, len ))
+        ret = ERROR_CONNECTION_INVALID;
+    else
+    {
+        sent = len;
+        ret = send_chunks( conn, response->EntityChunkCount, response->pEntityChunks, &sent );
+    }
+    heap_free( buffer );
+
+    if (ret || !(flags & HTTP_SEND_RESPONSE_FLAG_MORE_DATA))
+        finish_request( conn, ret || (flags & HTTP_SEND_RESPONSE_FLAG_DISCONNECT) );
+
+    if (ret_size) *ret_size = sent;
+    if (ovl) complete_overlapped( ovl, ret, sent );
+    return ret;
+}
+
+/***********************************************************************
+ *        HttpSendResponseEntityBody     (HTTPAPI.@)
+ */
+ULONG WINAPI HttpSendResponseEntityBody( HANDLE handle, HTTP_REQUEST_ID id, ULONG flags,
+                 USHORT count, PHTTP_DATA_CHUNK chunks, PULONG ret_size, PVOID reserved1,
+                 ULONG reserved2, LPOVERLAPPED ovl, PHTTP_LOG_DATA log_data )
+{
+    struct connection *conn;
+    ULONG ret, sent = 0;
+
+    TRACE( "(%p, %s, 0x%x, %u, %p, %p, %p, %u, %p, %p)\n", handle, wine_dbgstr_longlong(id), flags,
+           count, chunks, ret_size, reserved1, reserved2, ovl, log_data );
+
+    if ((ret = get_response_request( handle, id, TRUE, &conn ))) return ret;
+
+    ret = send_chunks( conn, count, chunks, &sent );
+
+    if (ret || !(flags & HTTP_SEND_RESPONSE_FLAG_MORE_DATA))
+        finish_request( conn, ret || (flags & HTTP_SEND_RESPONSE_FLAG_DISCONNECT) );
+
+    if (ret_size) *ret_size = sent;
+    if (ovl) complete_overlapped( ovl, ret, sent );
+    return ret;
 }
 
 /***********************************************************************
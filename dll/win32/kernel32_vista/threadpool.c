@@ -0,0 +1,342 @@
+#include "k32_vista.h"
+
+#define NDEBUG
+#include <debug.h>
+
+typedef VOID
+(NTAPI *PTP_IO_CALLBACK)(
+    IN OUT PTP_CALLBACK_INSTANCE Instance,
+    IN OUT PVOID Context OPTIONAL,
+    IN PVOID ApcContext,
+    IN PIO_STATUS_BLOCK IoStatusBlock,
+    IN PTP_IO Io);
+
+/* The first field of the native I/O object is left to us */
+typedef struct _K32_TP_IO
+{
+    PTP_WIN32_IO_CALLBACK Callback;
+} K32_TP_IO, *PK32_TP_IO;
+
+NTSTATUS NTAPI TpAllocPool(OUT PTP_POOL *Pool, IN PVOID Reserved);
+VOID NTAPI TpReleasePool(IN OUT PTP_POOL Pool);
+VOID NTAPI TpSetPoolMaxThreads(IN OUT PTP_POOL Pool, IN ULONG MaxThreads);
+NTSTATUS NTAPI TpSetPoolMinThreads(IN OUT PTP_POOL Pool, IN ULONG MinThreads);
+
+NTSTATUS NTAPI TpAllocCleanupGroup(OUT PTP_CLEANUP_GROUP *CleanupGroup);
+VOID NTAPI TpReleaseCleanupGroup(IN OUT PTP_CLEANUP_GROUP CleanupGroup);
+VOID NTAPI TpReleaseCleanupGroupMembers(IN OUT PTP_CLEANUP_GROUP CleanupGroup, IN BOOLEAN CancelPending, IN OUT PVOID CleanupParameter OPTIONAL);
+
+NTSTATUS NTAPI TpSimpleTryPost(IN PTP_SIMPLE_CALLBACK Callback, IN OUT PVOID Context OPTIONAL, IN PTP_CALLBACK_ENVIRON Environment OPTIONAL);
+
+NTSTATUS NTAPI TpAllocWork(OUT PTP_WORK *Work, IN PTP_WORK_CALLBACK Callback, IN OUT PVOID Context OPTIONAL, IN PTP_CALLBACK_ENVIRON Environment OPTIONAL);
+VOID NTAPI TpPostWork(IN OUT PTP_WORK Work);
+VOID NTAPI TpWaitForWork(IN OUT PTP_WORK Work, IN BOOLEAN CancelPending);
+VOID NTAPI TpReleaseWork(IN OUT PTP_WORK Work);
+
+NTSTATUS NTAPI TpAllocWait(OUT PTP_WAIT *Wait, IN PTP_WAIT_CALLBACK Callback, IN OUT PVOID Context OPTIONAL, IN PTP_CALLBACK_ENVIRON Environment OPTIONAL);
+VOID NTAPI TpSetWait(IN OUT PTP_WAIT Wait, IN HANDLE Handle OPTIONAL, IN PLARGE_INTEGER Timeout OPTIONAL);
+VOID NTAPI TpWaitForWait(IN OUT PTP_WAIT Wait, IN BOOLEAN CancelPending);
+VOID NTAPI TpReleaseWait(IN OUT PTP_WAIT Wait);
+
+NTSTATUS NTAPI TpAllocIoCompletion(OUT PTP_IO *Io, IN HANDLE File, IN PTP_IO_CALLBACK Callback, IN OUT PVOID Context OPTIONAL, IN PTP_CALLBACK_ENVIRON Environment OPTIONAL);
+VOID NTAPI TpStartAsyncIoOperation(IN OUT PTP_IO Io);
+VOID NTAPI TpCancelAsyncIoOperation(IN OUT PTP_IO Io);
+VOID NTAPI TpWaitForIoCompletion(IN OUT PTP_IO Io, IN BOOLEAN CancelPending);
+VOID NTAPI TpReleaseIoCompletion(IN OUT PTP_IO Io);
+
+NTSTATUS NTAPI TpCallbackMayRunLong(IN OUT PTP_CALLBACK_INSTANCE Instance);
+VOID NTAPI TpCallbackSetEventOnCompletion(IN OUT PTP_CALLBACK_INSTANCE Instance, IN HANDLE Event);
+VOID NTAPI TpCallbackReleaseSemaphoreOnCompletion(IN OUT PTP_CALLBACK_INSTANCE Instance, IN HANDLE Semaphore, IN ULONG ReleaseCount);
+VOID NTAPI TpCallbackReleaseMutexOnCompletion(IN OUT PTP_CALLBACK_INSTANCE Instance, IN HANDLE Mutex);
+VOID NTAPI TpCallbackLeaveCriticalSectionOnCompletion(IN OUT PTP_CALLBACK_INSTANCE Instance, IN OUT PRTL_CRITICAL_SECTION CriticalSection);
+VOID NTAPI TpDisassociateCallback(IN OUT PTP_CALLBACK_INSTANCE Instance);
+
+
+PTP_POOL
+WINAPI
+CreateThreadpool(PVOID Reserved)
+{
+    PTP_POOL Pool;
+    NTSTATUS Status;
+
+    Status = TpAllocPool(&Pool, Reserved);
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(RtlNtStatusToDosError(Status));
+        return NULL;
+    }
+    return Pool;
+}
+
+VOID
+WINAPI
+CloseThreadpool(PTP_POOL Pool)
+{
+    TpReleasePool(Pool);
+}
+
+VOID
+WINAPI
+SetThreadpoolThreadMaximum(PTP_POOL Pool, DWORD MaxThreads)
+{
+    TpSetPoolMaxThreads(Pool, MaxThreads);
+}
+
+BOOL
+WINAPI
+SetThreadpoolThreadMinimum(PTP_POOL Pool, DWORD MinThreads)
+{
+    NTSTATUS Status;
+
+    Status = TpSetPoolMinThreads(Pool, MinThreads);
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(RtlNtStatusToDosError(Status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+PTP_CLEANUP_GROUP
+WINAPI
+CreateThreadpoolCleanupGroup(VOID)
+{
+    PTP_CLEANUP_GROUP CleanupGroup;
+    NTSTATUS Status;
+
+    Status = TpAllocCleanupGroup(&CleanupGroup);
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(RtlNtStatusToDosError(Status));
+        return NULL;
+    }
+    return CleanupGroup;
+}
+
+VOID
+WINAPI
+CloseThreadpoolCleanupGroup(PTP_CLEANUP_GROUP CleanupGroup)
+{
+    TpReleaseCleanupGroup(CleanupGroup);
+}
+
+VOID
+WINAPI
+CloseThreadpoolCleanupGroupMembers(PTP_CLEANUP_GROUP CleanupGroup, BOOL CancelPending, PVOID CleanupContext)
+{
+    TpReleaseCleanupGroupMembers(CleanupGroup, CancelPending != FALSE, CleanupContext);
+}
+
+BOOL
+WINAPI
+TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK Callback, PVOID Context, PTP_CALLBACK_ENVIRON Environment)
+{
+    NTSTATUS Status;
+
+    Status = TpSimpleTryPost(Callback, Context, Environment);
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(RtlNtStatusToDosError(Status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+PTP_WORK
+WINAPI
+CreateThreadpoolWork(PTP_WORK_CALLBACK Callback, PVOID Context, PTP_CALLBACK_ENVIRON Environment)
+{
+    PTP_WORK Work;
+    NTSTATUS Status;
+
+    Status = TpAllocWork(&Work, Callback, Context, Environment);
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(RtlNtStatusToDosError(Status));
+        return NULL;
+    }
+    return Work;
+}
+
+VOID
+WINAPI
+SubmitThreadpoolWork(PTP_WORK Work)
+{
+    TpPostWork(Work);
+}
+
+VOID
+WINAPI
+WaitForThreadpoolWorkCallbacks(PTP_WORK Work, BOOL CancelPending)
+{
+    TpWaitForWork(Work, CancelPending != FALSE);
+}
+
+VOID
+WINAPI
+CloseThreadpoolWork(PTP_WORK Work)
+{
+    TpReleaseWork(Work);
+}
+
+PTP_WAIT
+WINAPI
+CreateThreadpoolWait(PTP_WAIT_CALLBACK Callback, PVOID Context, PTP_CALLBACK_ENVIRON Environment)
+{
+    PTP_WAIT Wait;
+    NTSTATUS Status;
+
+    Status = TpAllocWait(&Wait, Callback, Context, Environment);
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(RtlNtStatusToDosError(Status));
+        return NULL;
+    }
+    return Wait;
+}
+
+VOID
+WINAPI
+SetThreadpoolWait(PTP_WAIT Wait, HANDLE Handle, PFILETIME Timeout)
+{
+    LARGE_INTEGER Time;
+
+    /* A NULL timeout means waiting forever */
+    if (Timeout)
+    {
+        Time.LowPart = Timeout->dwLowDateTime;
+        Time.HighPart = Timeout->dwHighDateTime;
+    }
+
+    TpSetWait(Wait, Handle, Timeout ? &Time : NULL);
+}
+
+VOID
+WINAPI
+WaitForThreadpoolWaitCallbacks(PTP_WAIT Wait, BOOL CancelPending)
+{
+    TpWaitForWait(Wait, CancelPending != FALSE);
+}
+
+VOID
+WINAPI
+CloseThreadpoolWait(PTP_WAIT Wait)
+{
+    TpReleaseWait(Wait);
+}
+
+static
+VOID
+NTAPI
+ThreadpoolIoCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PVOID ApcContext,
+                     PIO_STATUS_BLOCK IoStatusBlock, PTP_IO Io)
+{
+    PK32_TP_IO K32Io = (PK32_TP_IO)Io;
+
+    /* The APC context is the OVERLAPPED of the operation */
+    K32Io->Callback(Instance, Context, ApcContext,
+                    RtlNtStatusToDosError(IoStatusBlock->Status),
+                    IoStatusBlock->Information, Io);
+}
+
+PTP_IO
+WINAPI
+CreateThreadpoolIo(HANDLE File, PTP_WIN32_IO_CALLBACK Callback, PVOID Context, PTP_CALLBACK_ENVIRON Environment)
+{
+    PTP_IO Io;
+    NTSTATUS Status;
+
+    if (!Callback)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    Status = TpAllocIoCompletion(&Io, File, ThreadpoolIoCallback, Context, Environment);
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(RtlNtStatusToDosError(Status));
+        return NULL;
+    }
+
+    ((PK32_TP_IO)Io)->Callback = Callback;
+    return Io;
+}
+
+VOID
+WINAPI
+StartThreadpoolIo(PTP_IO Io)
+{
+    TpStartAsyncIoOperation(Io);
+}
+
+VOID
+WINAPI
+CancelThreadpoolIo(PTP_IO Io)
+{
+    TpCancelAsyncIoOperation(Io);
+}
+
+VOID
+WINAPI
+WaitForThreadpoolIoCallbacks(PTP_IO Io, BOOL CancelPending)
+{
+    TpWaitForIoCompletion(Io, CancelPending != FALSE);
+}
+
+VOID
+WINAPI
+CloseThreadpoolIo(PTP_IO Io)
+{
+    TpReleaseIoCompletion(Io);
+}
+
+BOOL
+WINAPI
+CallbackMayRunLong(PTP_CALLBACK_INSTANCE Instance)
+{
+    NTSTATUS Status;
+
+    Status = TpCallbackMayRunLong(Instance);
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(RtlNtStatusToDosError(Status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+VOID
+WINAPI
+SetEventWhenCallbackReturns(PTP_CALLBACK_INSTANCE Instance, HANDLE Event)
+{
+    TpCallbackSetEventOnCompletion(Instance, Event);
+}
+
+VOID
+WINAPI
+ReleaseSemaphoreWhenCallbackReturns(PTP_CALLBACK_INSTANCE Instance, HANDLE Semaphore, DWORD ReleaseCount)
+{
+    TpCallbackReleaseSemaphoreOnCompletion(Instance, Semaphore, ReleaseCount);
+}
+
+VOID
+WINAPI
+ReleaseMutexWhenCallbackReturns(PTP_CALLBACK_INSTANCE Instance, HANDLE Mutex)
+{
+    TpCallbackReleaseMutexOnCompletion(Instance, Mutex);
+}
+
+VOID
+WINAPI
+LeaveCriticalSectionWhenCallbackReturns(PTP_CALLBACK_INSTANCE Instance, PCRITICAL_SECTION CriticalSection)
+{
+    TpCallbackLeaveCriticalSectionOnCompletion(Instance, (PRTL_CRITICAL_SECTION)CriticalSection);
+}
+
+VOID
+WINAPI
+DisassociateCurrentThreadFromCallback(PTP_CALLBACK_INSTANCE Instance)
+{
+    TpDisassociateCallback(Instance);
+}
@@ -63,6 +63,10 @@ SamrLookupNamesInDomain(IN SAMPR_HANDLE DomainHandle,
                         OUT PSAMPR_ULONG_ARRAY RelativeIds,
                         OUT PSAMPR_ULONG_ARRAY Use);
 
+ULONG
+NTAPI
+SamIGetAccountNameChangeCount(VOID);
+
 
 typedef struct _WELL_KNOWN_SID
 {
@@ -84,6 +88,30 @@ PSID LsapLocalSystemSid = NULL;
 PSID LsapAdministratorsSid = NULL;
 
 
+/*
+ * Cache of SAM account lookups. Entries expire after a while and the whole
+ * cache is dropped whenever SAM reports that an account name has changed.
+ */
+#define LSAP_LOOKUP_CACHE_MAX_ENTRIES   256
+#define LSAP_LOOKUP_CACHE_TIMEOUT       (10 * 60 * 1000) /* 10 minutes */
+
+typedef struct _LOOKUP_CACHE_ENTRY
+{
+    LIST_ENTRY ListEntry;
+    PSID DomainSid;         /* BuiltinDomainSid or AccountDomainSid */
+    ULONG RelativeId;
+    SID_NAME_USE Use;
+    BOOLEAN ExactName;      /* Name is the spelling stored in SAM */
+    ULONG TimeStamp;
+    UNICODE_STRING Name;
+} LOOKUP_CACHE_ENTRY, *PLOOKUP_CACHE_ENTRY;
+
+static RTL_CRITICAL_SECTION LookupCacheLock;
+static LIST_ENTRY LookupCacheListHead;
+static ULONG LookupCacheEntries = 0;
+static ULONG LookupCacheChangeCount = 0;
+
+
 /* FUNCTIONS ***************************************************************/
 
 BOOLEAN
@@ -169,6 +197,332 @@ LsapCreateSid(PSID_IDENTIFIER_AUTHORITY IdentifierAuthority,
 }
 
 
+VOID
+LsapInitLookupCache(VOID)
+{
+    RtlInitializeCriticalSection(&LookupCacheLock);
+    InitializeListHead(&LookupCacheListHead);
+    LookupCacheChangeCount = SamIGetAccountNameChangeCount();
+}
+
+
+static
+VOID
+LsapRemoveCacheEntry(PLOOKUP_CACHE_ENTRY Entry)
+{
+    RemoveEntryList(&Entry->ListEntry);
+    LookupCacheEntries--;
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Entry);
+}
+
+
+/* Must be called with the cache lock held */
+static
+VOID
+LsapValidateLookupCache(VOID)
+{
+    ULONG ChangeCount;
+
+    ChangeCount = SamIGetAccountNameChangeCount();
+    if (ChangeCount == LookupCacheChangeCount)
+        return;
+
+    TRACE("SAM account names changed, flushing the lookup cache\n");
+
+    while (!IsListEmpty(&LookupCacheListHead))
+    {
+        LsapRemoveCacheEntry(CONTAINING_RECORD(LookupCacheListHead.Flink,
+                                               LOOKUP_CACHE_ENTRY,
+                                               ListEntry));
+    }
+
+    LookupCacheChangeCount = ChangeCount;
+}
+
+
+/* Must be called with the cache lock held */
+static
+PLOOKUP_CACHE_ENTRY
+LsapFindCacheEntry(PSID DomainSid,
+                   PUNICODE_STRING Name,
+                   ULONG RelativeId)
+{
+    PLIST_ENTRY ListEntry;
+    PLOOKUP_CACHE_ENTRY Entry;
+    ULONG Now;
+
+    LsapValidateLookupCache();
+
+    Now = GetTickCount();
+
+    ListEntry = LookupCacheListHead.Flink;
+    while (ListEntry != &LookupCacheListHead)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, LOOKUP_CACHE_ENTRY, ListEntry);
+        ListEntry = ListEntry->Flink;
+
+        if (Now - Entry->TimeStamp > LSAP_LOOKUP_CACHE_TIMEOUT)
+        {
+            LsapRemoveCacheEntry(Entry);
+            continue;
+        }
+
+        if (Entry->DomainSid != DomainSid)
+            continue;
+
+        if (Name != NULL)
+        {
+            if (!RtlEqualUnicodeString(&Entry->Name, Name, TRUE))
+                continue;
+        }
+        else
+        {
+            if (Entry->RelativeId != RelativeId || !Entry->ExactName)
+                continue;
+        }
+
+        /* Keep recently used entries at the head of the list */
+        RemoveEntryList(&Entry->ListEntry);
+        InsertHeadList(&LookupCacheListHead, &Entry->ListEntry);
+        return Entry;
+    }
+
+    return NULL;
+}
+
+
+static
+VOID
+LsapAddCacheEntry(PSID DomainSid,
+                  PUNICODE_STRING Name,
+                  ULONG RelativeId,
+                  SID_NAME_USE Use,
+                  BOOLEAN ExactName,
+                  ULONG ChangeCount)
+{
+    PLOOKUP_CACHE_ENTRY Entry;
+
+    Entry = RtlAllocateHeap(RtlGetProcessHeap(),
+                            0,
+                            sizeof(LOOKUP_CACHE_ENTRY) + Name->Length);
+    if (Entry == NULL)
+        return;
+
+    Entry->DomainSid = DomainSid;
+    Entry->RelativeId = RelativeId;
+    Entry->Use = Use;
+    Entry->ExactName = ExactName;
+    Entry->TimeStamp = GetTickCount();
+    Entry->Name.Length = Name->Length;
+    Entry->Name.MaximumLength = Name->Length;
+    Entry->Name.Buffer = (PWSTR)(Entry + 1);
+    RtlCopyMemory(Entry->Name.Buffer, Name->Buffer, Name->Length);
+
+    RtlEnterCriticalSection(&LookupCacheLock);
+
+    LsapValidateLookupCache();
+
+    /* Do not cache the result if SAM changed while it was looked up */
+    if (ChangeCount != LookupCacheChangeCount)
+    {
+        RtlLeaveCriticalSection(&LookupCacheLock);
+        RtlFreeHeap(RtlGetProcessHeap(), 0, Entry);
+        return;
+    }
+
+    if (LookupCacheEntries >= LSAP_LOOKUP_CACHE_MAX_ENTRIES)
+    {
+        /* Evict the least recently used entry */
+        LsapRemoveCacheEntry(CONTAINING_RECORD(LookupCacheListHead.Blink,
+                                               LOOKUP_CACHE_ENTRY,
+                                               ListEntry));
+    }
+
+    InsertHeadList(&LookupCacheListHead, &Entry->ListEntry);
+    LookupCacheEntries++;
+
+    RtlLeaveCriticalSection(&LookupCacheLock);
+}
+
+
+static
+NTSTATUS
+LsapOpenSamDomain(PSID DomainSid,
+                  SAMPR_HANDLE *ServerHandle,
+                  SAMPR_HANDLE *DomainHandle)
+{
+    NTSTATUS Status;
+
+    if (*DomainHandle != NULL)
+        return STATUS_SUCCESS;
+
+    if (*ServerHandle == NULL)
+    {
+        Status = SamrConnect(NULL,
+                             ServerHandle,
+                             SAM_SERVER_CONNECT | SAM_SERVER_LOOKUP_DOMAIN);
+        if (!NT_SUCCESS(Status))
+        {
+            TRACE("SamrConnect failed (Status %08lx)\n", Status);
+            return Status;
+        }
+    }
+
+    Status = SamrOpenDomain(*ServerHandle,
+                            DOMAIN_LOOKUP,
+                            DomainSid,
+                            DomainHandle);
+    if (!NT_SUCCESS(Status))
+    {
+        TRACE("SamOpenDomain failed (Status %08lx)\n", Status);
+    }
+
+    return Status;
+}
+
+
+/*
+ * Looks up the name of a SAM account by its relative ID. The SAM domain is
+ * only opened when the account is not in the cache. Name->Buffer is
+ * allocated with MIDL_user_allocate.
+ */
+static
+NTSTATUS
+LsapLookupAccountRid(PSID DomainSid,
+                     ULONG RelativeId,
+                     SAMPR_HANDLE *ServerHandle,
+                     SAMPR_HANDLE *DomainHandle,
+                     PRPC_UNICODE_STRING Name,
+                     PSID_NAME_USE Use)
+{
+    SAMPR_RETURNED_USTRING_ARRAY Names = {0, NULL};
+    SAMPR_ULONG_ARRAY Uses = {0, NULL};
+    PLOOKUP_CACHE_ENTRY Entry;
+    UNICODE_STRING AccountName;
+    ULONG ChangeCount;
+    NTSTATUS Status;
+
+    RtlEnterCriticalSection(&LookupCacheLock);
+    Entry = LsapFindCacheEntry(DomainSid, NULL, RelativeId);
+    if (Entry != NULL)
+    {
+        Name->Buffer = MIDL_user_allocate(Entry->Name.Length + sizeof(WCHAR));
+        if (Name->Buffer != NULL)
+        {
+            RtlCopyMemory(Name->Buffer, Entry->Name.Buffer, Entry->Name.Length);
+            Name->Buffer[Entry->Name.Length / sizeof(WCHAR)] = UNICODE_NULL;
+            Name->Length = Entry->Name.Length;
+            Name->MaximumLength = Entry->Name.Length + sizeof(WCHAR);
+            *Use = Entry->Use;
+        }
+        RtlLeaveCriticalSection(&LookupCacheLock);
+
+        return (Name->Buffer != NULL) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+    }
+    ChangeCount = LookupCacheChangeCount;
+    RtlLeaveCriticalSection(&LookupCacheLock);
+
+    Status = LsapOpenSamDomain(DomainSid, ServerHandle, DomainHandle);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Status = SamrLookupIdsInDomain(*DomainHandle,
+                                   1,
+                                   &RelativeId,
+                                   &Names,
+                                   &Uses);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Name->Length = Names.Element[0].Length;
+    Name->MaximumLength = Names.Element[0].MaximumLength;
+    Name->Buffer = MIDL_user_allocate(Names.Element[0].MaximumLength);
+    if (Name->Buffer == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto done;
+    }
+
+    RtlCopyMemory(Name->Buffer,
+                  Names.Element[0].Buffer,
+                  Names.Element[0].MaximumLength);
+
+    *Use = Uses.Element[0];
+
+    AccountName.Length = Names.Element[0].Length;
+    AccountName.MaximumLength = Names.Element[0].MaximumLength;
+    AccountName.Buffer = Names.Element[0].Buffer;
+    LsapAddCacheEntry(DomainSid, &AccountName, RelativeId, *Use, TRUE, ChangeCount);
+
+done:
+    SamIFree_SAMPR_RETURNED_USTRING_ARRAY(&Names);
+    SamIFree_SAMPR_ULONG_ARRAY(&Uses);
+
+    return Status;
+}
+
+
+/*
+ * Looks up the relative ID of a SAM account by its name. The SAM domain is
+ * only opened when the account is not in the cache.
+ */
+static
+NTSTATUS
+LsapLookupAccountName(PSID DomainSid,
+                      PRPC_UNICODE_STRING AccountName,
+                      SAMPR_HANDLE *ServerHandle,
+                      SAMPR_HANDLE *DomainHandle,
+                      PULONG RelativeId,
+                      PSID_NAME_USE Use)
+{
+    SAMPR_ULONG_ARRAY RelativeIds = {0, NULL};
+    SAMPR_ULONG_ARRAY Uses = {0, NULL};
+    PLOOKUP_CACHE_ENTRY Entry;
+    ULONG ChangeCount;
+    NTSTATUS Status;
+
+    RtlEnterCriticalSection(&LookupCacheLock);
+    Entry = LsapFindCacheEntry(DomainSid, (PUNICODE_STRING)AccountName, 0);
+    if (Entry != NULL)
+    {
+        *RelativeId = Entry->RelativeId;
+        *Use = Entry->Use;
+        RtlLeaveCriticalSection(&LookupCacheLock);
+        return STATUS_SUCCESS;
+    }
+    ChangeCount = LookupCacheChangeCount;
+    RtlLeaveCriticalSection(&LookupCacheLock);
+
+    Status = LsapOpenSamDomain(DomainSid, ServerHandle, DomainHandle);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Status = SamrLookupNamesInDomain(*DomainHandle,
+                                     1,
+                                     AccountName,
+                                     &RelativeIds,
+                                     &Uses);
+    if (NT_SUCCESS(Status))
+    {
+        *RelativeId = RelativeIds.Element[0];
+        *Use = Uses.Element[0];
+
+        /* The caller's spelling of the name may differ from the stored one */
+        LsapAddCacheEntry(DomainSid,
+                          (PUNICODE_STRING)AccountName,
+                          *RelativeId,
+                          *Use,
+                          FALSE,
+                          ChangeCount);
+    }
+
+    SamIFree_SAMPR_ULONG_ARRAY(&RelativeIds);
+    SamIFree_SAMPR_ULONG_ARRAY(&Uses);
+
+    return Status;
+}
+
+
 NTSTATUS
 LsapInitSids(VOID)
 {
@@ -1265,31 +1619,12 @@ LsapLookupIsolatedBuiltinNames(DWORD Count,
 {
     SAMPR_HANDLE ServerHandle = NULL;
     SAMPR_HANDLE DomainHandle = NULL;
-    SAMPR_ULONG_ARRAY RelativeIds = {0, NULL};
-    SAMPR_ULONG_ARRAY Use = {0, NULL};
+    SID_NAME_USE Use;
+    ULONG RelativeId;
     ULONG DomainIndex;
     ULONG i;
     NTSTATUS Status = STATUS_SUCCESS;
 
-    Status = SamrConnect(NULL,
-                         &ServerHandle,
-                         SAM_SERVER_CONNECT | SAM_SERVER_LOOKUP_DOMAIN);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamrConnect failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
-    Status = SamrOpenDomain(ServerHandle,
-                            DOMAIN_LOOKUP,
-                            BuiltinDomainSid,
-                            &DomainHandle);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamOpenDomain failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
     for (i = 0; i < Count; i++)
     {
         /* Ignore names which were already mapped */
@@ -1302,18 +1637,19 @@ LsapLookupIsolatedBuiltinNames(DWORD Count,
 
         TRACE("Mapping name: %wZ\n", &AccountNames[i]);
 
-        Status = SamrLookupNamesInDomain(DomainHandle,
-                                         1,
-                                         &AccountNames[i],
-                                         &RelativeIds,
-                                         &Use);
+        Status = LsapLookupAccountName(BuiltinDomainSid,
+                                       &AccountNames[i],
+                                       &ServerHandle,
+                                       &DomainHandle,
+                                       &RelativeId,
+                                       &Use);
         if (NT_SUCCESS(Status))
         {
-            TRACE("Found relative ID: %lu\n", RelativeIds.Element[0]);
+            TRACE("Found relative ID: %lu\n", RelativeId);
 
-            SidsBuffer[i].Use = Use.Element[0];
+            SidsBuffer[i].Use = Use;
             SidsBuffer[i].Sid = CreateSidFromSidAndRid(BuiltinDomainSid,
-                                                       RelativeIds.Element[0]);
+                                                       RelativeId);
             if (SidsBuffer[i].Sid == NULL)
             {
                 Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -1334,9 +1670,6 @@ LsapLookupIsolatedBuiltinNames(DWORD Count,
 
             (*Mapped)++;
         }
-
-        SamIFree_SAMPR_ULONG_ARRAY(&RelativeIds);
-        SamIFree_SAMPR_ULONG_ARRAY(&Use);
     }
 
 done:
@@ -1361,33 +1694,14 @@ LsapLookupIsolatedAccountNames(DWORD Count,
 {
     SAMPR_HANDLE ServerHandle = NULL;
     SAMPR_HANDLE DomainHandle = NULL;
-    SAMPR_ULONG_ARRAY RelativeIds = {0, NULL};
-    SAMPR_ULONG_ARRAY Use = {0, NULL};
+    SID_NAME_USE Use;
+    ULONG RelativeId;
     ULONG DomainIndex;
     ULONG i;
     NTSTATUS Status = STATUS_SUCCESS;
 
     TRACE("()\n");
 
-    Status = SamrConnect(NULL,
-                         &ServerHandle,
-                         SAM_SERVER_CONNECT | SAM_SERVER_LOOKUP_DOMAIN);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamrConnect failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
-    Status = SamrOpenDomain(ServerHandle,
-                            DOMAIN_LOOKUP,
-                            AccountDomainSid,
-                            &DomainHandle);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamOpenDomain failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
     for (i = 0; i < Count; i++)
     {
         /* Ignore names which were already mapped */
@@ -1400,18 +1714,19 @@ LsapLookupIsolatedAccountNames(DWORD Count,
 
         TRACE("Mapping name: %wZ\n", &AccountNames[i]);
 
-        Status = SamrLookupNamesInDomain(DomainHandle,
-                                         1,
-                                         &AccountNames[i],
-                                         &RelativeIds,
-                                         &Use);
+        Status = LsapLookupAccountName(AccountDomainSid,
+                                       &AccountNames[i],
+                                       &ServerHandle,
+                                       &DomainHandle,
+                                       &RelativeId,
+                                       &Use);
         if (NT_SUCCESS(Status))
         {
-            TRACE("Found relative ID: %lu\n", RelativeIds.Element[0]);
+            TRACE("Found relative ID: %lu\n", RelativeId);
 
-            SidsBuffer[i].Use = Use.Element[0];
+            SidsBuffer[i].Use = Use;
             SidsBuffer[i].Sid = CreateSidFromSidAndRid(AccountDomainSid,
-                                                       RelativeIds.Element[0]);
+                                                       RelativeId);
             if (SidsBuffer[i].Sid == NULL)
             {
                 Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -1432,9 +1747,6 @@ LsapLookupIsolatedAccountNames(DWORD Count,
 
             (*Mapped)++;
         }
-
-        SamIFree_SAMPR_ULONG_ARRAY(&RelativeIds);
-        SamIFree_SAMPR_ULONG_ARRAY(&Use);
     }
 
 done:
@@ -1567,31 +1879,12 @@ LsapLookupBuiltinNames(DWORD Count,
 {
     SAMPR_HANDLE ServerHandle = NULL;
     SAMPR_HANDLE DomainHandle = NULL;
-    SAMPR_ULONG_ARRAY RelativeIds = {0, NULL};
-    SAMPR_ULONG_ARRAY Use = {0, NULL};
+    SID_NAME_USE Use;
+    ULONG RelativeId;
     ULONG DomainIndex;
     ULONG i;
     NTSTATUS Status = STATUS_SUCCESS;
 
-    Status = SamrConnect(NULL,
-                         &ServerHandle,
-                         SAM_SERVER_CONNECT | SAM_SERVER_LOOKUP_DOMAIN);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamrConnect failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
-    Status = SamrOpenDomain(ServerHandle,
-                            DOMAIN_LOOKUP,
-                            BuiltinDomainSid,
-                            &DomainHandle);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamOpenDomain failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
     for (i = 0; i < Count; i++)
     {
         /* Ignore names which were already mapped */
@@ -1607,16 +1900,17 @@ LsapLookupBuiltinNames(DWORD Count,
 
         TRACE("Mapping name: %wZ\\%wZ\n", &DomainNames[i], &AccountNames[i]);
 
-        Status = SamrLookupNamesInDomain(DomainHandle,
-                                         1,
-                                         &AccountNames[i],
-                                         &RelativeIds,
-                                         &Use);
+        Status = LsapLookupAccountName(BuiltinDomainSid,
+                                       &AccountNames[i],
+                                       &ServerHandle,
+                                       &DomainHandle,
+                                       &RelativeId,
+                                       &Use);
         if (NT_SUCCESS(Status))
         {
-            SidsBuffer[i].Use = Use.Element[0];
+            SidsBuffer[i].Use = Use;
             SidsBuffer[i].Sid = CreateSidFromSidAndRid(BuiltinDomainSid,
-                                                       RelativeIds.Element[0]);
+                                                       RelativeId);
             if (SidsBuffer[i].Sid == NULL)
             {
                 Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -1637,9 +1931,6 @@ LsapLookupBuiltinNames(DWORD Count,
 
             (*Mapped)++;
         }
-
-        SamIFree_SAMPR_ULONG_ARRAY(&RelativeIds);
-        SamIFree_SAMPR_ULONG_ARRAY(&Use);
     }
 
 done:
@@ -1664,31 +1955,12 @@ LsapLookupAccountNames(DWORD Count,
 {
     SAMPR_HANDLE ServerHandle = NULL;
     SAMPR_HANDLE DomainHandle = NULL;
-    SAMPR_ULONG_ARRAY RelativeIds = {0, NULL};
-    SAMPR_ULONG_ARRAY Use = {0, NULL};
+    SID_NAME_USE Use;
+    ULONG RelativeId;
     ULONG DomainIndex;
     ULONG i;
     NTSTATUS Status = STATUS_SUCCESS;
 
-    Status = SamrConnect(NULL,
-                         &ServerHandle,
-                         SAM_SERVER_CONNECT | SAM_SERVER_LOOKUP_DOMAIN);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamrConnect failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
-    Status = SamrOpenDomain(ServerHandle,
-                            DOMAIN_LOOKUP,
-                            AccountDomainSid,
-                            &DomainHandle);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamOpenDomain failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
     for (i = 0; i < Count; i++)
     {
         /* Ignore names which were already mapped */
@@ -1704,16 +1976,17 @@ LsapLookupAccountNames(DWORD Count,
 
         TRACE("Mapping name: %wZ\\%wZ\n", &DomainNames[i], &AccountNames[i]);
 
-        Status = SamrLookupNamesInDomain(DomainHandle,
-                                         1,
-                                         &AccountNames[i],
-                                         &RelativeIds,
-                                         &Use);
+        Status = LsapLookupAccountName(AccountDomainSid,
+                                       &AccountNames[i],
+                                       &ServerHandle,
+                                       &DomainHandle,
+                                       &RelativeId,
+                                       &Use);
         if (NT_SUCCESS(Status))
         {
-            SidsBuffer[i].Use = Use.Element[0];
+            SidsBuffer[i].Use = Use;
             SidsBuffer[i].Sid = CreateSidFromSidAndRid(AccountDomainSid,
-                                                       RelativeIds.Element[0]);
+                                                       RelativeId);
             if (SidsBuffer[i].Sid == NULL)
             {
                 Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -1734,9 +2007,6 @@ LsapLookupAccountNames(DWORD Count,
 
             (*Mapped)++;
         }
-
-        SamIFree_SAMPR_ULONG_ARRAY(&RelativeIds);
-        SamIFree_SAMPR_ULONG_ARRAY(&Use);
     }
 
 done:
@@ -2066,33 +2336,13 @@ LsapLookupBuiltinDomainSids(PLSAPR_SID_ENUM_BUFFER SidEnumBuffer,
 {
     SAMPR_HANDLE ServerHandle = NULL;
     SAMPR_HANDLE DomainHandle = NULL;
-    SAMPR_RETURNED_USTRING_ARRAY Names = {0, NULL};
-    SAMPR_ULONG_ARRAY Use = {0, NULL};
+    SID_NAME_USE Use;
     LPWSTR SidString = NULL;
     ULONG DomainIndex;
-    ULONG RelativeIds[1];
+    ULONG RelativeId;
     ULONG i;
     NTSTATUS Status = STATUS_SUCCESS;
 
-    Status = SamrConnect(NULL,
-                         &ServerHandle,
-                         SAM_SERVER_CONNECT | SAM_SERVER_LOOKUP_DOMAIN);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamrConnect failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
-    Status = SamrOpenDomain(ServerHandle,
-                            DOMAIN_LOOKUP,
-                            BuiltinDomainSid,
-                            &DomainHandle);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamOpenDomain failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
     for (i = 0; i < SidEnumBuffer->Entries; i++)
     {
         /* Ignore SIDs which are already mapped */
@@ -2139,37 +2389,22 @@ LsapLookupBuiltinDomainSids(PLSAPR_SID_ENUM_BUFFER SidEnumBuffer,
         {
             TRACE("Found builtin domain account!\n");
 
-            RelativeIds[0] = LsapGetRelativeIdFromSid(SidEnumBuffer->SidInfo[i].Sid);
+            RelativeId = LsapGetRelativeIdFromSid(SidEnumBuffer->SidInfo[i].Sid);
+
+            Status = LsapLookupAccountRid(BuiltinDomainSid,
+                                          RelativeId,
+                                          &ServerHandle,
+                                          &DomainHandle,
+                                          &NamesBuffer[i].Name,
+                                          &Use);
+            if (Status == STATUS_INSUFFICIENT_RESOURCES)
+                goto done;
 
-            Status = SamrLookupIdsInDomain(DomainHandle,
-                                           1,
-                                           RelativeIds,
-                                           &Names,
-                                           &Use);
             if (NT_SUCCESS(Status))
             {
-                NamesBuffer[i].Use = Use.Element[0];
+                NamesBuffer[i].Use = Use;
                 NamesBuffer[i].Flags = 0;
 
-                NamesBuffer[i].Name.Length = Names.Element[0].Length;
-                NamesBuffer[i].Name.MaximumLength = Names.Element[0].MaximumLength;
-                NamesBuffer[i].Name.Buffer = MIDL_user_allocate(Names.Element[0].MaximumLength);
-                if (NamesBuffer[i].Name.Buffer == NULL)
-                {
-                    SamIFree_SAMPR_RETURNED_USTRING_ARRAY(&Names);
-                    SamIFree_SAMPR_ULONG_ARRAY(&Use);
-
-                    Status = STATUS_INSUFFICIENT_RESOURCES;
-                    goto done;
-                }
-
-                RtlCopyMemory(NamesBuffer[i].Name.Buffer,
-                              Names.Element[0].Buffer,
-                              Names.Element[0].MaximumLength);
-
-                SamIFree_SAMPR_RETURNED_USTRING_ARRAY(&Names);
-                SamIFree_SAMPR_ULONG_ARRAY(&Use);
-
                 Status = LsapAddDomainToDomainsList(DomainsBuffer,
                                                     &BuiltinDomainName,
                                                     BuiltinDomainSid,
@@ -2205,33 +2440,13 @@ LsapLookupAccountDomainSids(PLSAPR_SID_ENUM_BUFFER SidEnumBuffer,
 {
     SAMPR_HANDLE ServerHandle = NULL;
     SAMPR_HANDLE DomainHandle = NULL;
-    SAMPR_RETURNED_USTRING_ARRAY Names = {0, NULL};
-    SAMPR_ULONG_ARRAY Use = {0, NULL};
+    SID_NAME_USE Use;
     LPWSTR SidString = NULL;
     ULONG DomainIndex;
-    ULONG RelativeIds[1];
+    ULONG RelativeId;
     ULONG i;
     NTSTATUS Status = STATUS_SUCCESS;
 
-    Status = SamrConnect(NULL,
-                         &ServerHandle,
-                         SAM_SERVER_CONNECT | SAM_SERVER_LOOKUP_DOMAIN);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamrConnect failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
-    Status = SamrOpenDomain(ServerHandle,
-                            DOMAIN_LOOKUP,
-                            AccountDomainSid,
-                            &DomainHandle);
-    if (!NT_SUCCESS(Status))
-    {
-        TRACE("SamOpenDomain failed (Status %08lx)\n", Status);
-        goto done;
-    }
-
     for (i = 0; i < SidEnumBuffer->Entries; i++)
     {
         /* Ignore SIDs which are already mapped */
@@ -2278,37 +2493,22 @@ LsapLookupAccountDomainSids(PLSAPR_SID_ENUM_BUFFER SidEnumBuffer,
         {
             TRACE("Found account domain account!\n");
 
-            RelativeIds[0] = LsapGetRelativeIdFromSid(SidEnumBuffer->SidInfo[i].Sid);
+            RelativeId = LsapGetRelativeIdFromSid(SidEnumBuffer->SidInfo[i].Sid);
+
+            Status = LsapLookupAccountRid(AccountDomainSid,
+                                          RelativeId,
+                                          &ServerHandle,
+                                          &DomainHandle,
+                                          &NamesBuffer[i].Name,
+                                          &Use);
+            if (Status == STATUS_INSUFFICIENT_RESOURCES)
+                goto done;
 
-            Status = SamrLookupIdsInDomain(DomainHandle,
-                                           1,
-                                           RelativeIds,
-                                           &Names,
-                                           &Use);
             if (NT_SUCCESS(Status))
             {
-                NamesBuffer[i].Use = Use.Element[0];
+                NamesBuffer[i].Use = Use;
                 NamesBuffer[i].Flags = 0;
 
-                NamesBuffer[i].Name.Length = Names.Element[0].Length;
-                NamesBuffer[i].Name.MaximumLength = Names.Element[0].MaximumLength;
-                NamesBuffer[i].Name.Buffer = MIDL_user_allocate(Names.Element[0].MaximumLength);
-                if (NamesBuffer[i].Name.Buffer == NULL)
-                {
-                    SamIFree_SAMPR_RETURNED_USTRING_ARRAY(&Names);
-                    SamIFree_SAMPR_ULONG_ARRAY(&Use);
-
-                    Status = STATUS_INSUFFICIENT_RESOURCES;
-                    goto done;
-                }
-
-                RtlCopyMemory(NamesBuffer[i].Name.Buffer,
-                              Names.Element[0].Buffer,
-                              Names.Element[0].MaximumLength);
-
-                SamIFree_SAMPR_RETURNED_USTRING_ARRAY(&Names);
-                SamIFree_SAMPR_ULONG_ARRAY(&Use);
-
                 Status = LsapAddDomainToDomainsList(DomainsBuffer,
                                                     &AccountDomainName,
                                                     AccountDomainSid,
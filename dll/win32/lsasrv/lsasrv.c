@@ -280,6 +280,9 @@ LsapInitLsa(VOID)
     /* Initialize the well known SIDs */
     LsapInitSids();
 
+    /* Initialize the SID and name lookup cache */
+    LsapInitLookupCache();
+
     /* Initialize the SRM server */
     Status = LsapRmInitializeServer();
     if (!NT_SUCCESS(Status))
@@ -180,6 +180,9 @@ VOID
 DsSetupInit(VOID);
 
 /* lookup.c */
+VOID
+LsapInitLookupCache(VOID);
+
 NTSTATUS
 LsapInitSids(VOID);
 
@@ -2464,8 +2464,43 @@ WSPIoctl(IN  SOCKET Handle,
             Ret = NO_ERROR;
             break;
         case SIO_GET_EXTENSION_FUNCTION_POINTER:
-            Errno = WSAEINVAL;
+        {
+            static const GUID TransmitFileGuid = WSAID_TRANSMITFILE;
+            static const GUID TransmitPacketsGuid = WSAID_TRANSMITPACKETS;
+            static const GUID SendDatagramsGuid = WSAID_WSASENDDATAGRAMS;
+            static const GUID RecvDatagramsGuid = WSAID_WSARECVDATAGRAMS;
+            PVOID Function = NULL;
+
+            if (IS_INTRESOURCE(lpvInBuffer) || cbInBuffer < sizeof(GUID) ||
+                IS_INTRESOURCE(lpvOutBuffer) || cbOutBuffer < sizeof(PVOID))
+            {
+                cbRet = sizeof(PVOID);
+                Errno = WSAEFAULT;
+                break;
+            }
+
+            if (IsEqualGUID(lpvInBuffer, &TransmitFileGuid))
+                Function = MsafdTransmitFile;
+            else if (IsEqualGUID(lpvInBuffer, &TransmitPacketsGuid))
+                Function = MsafdTransmitPackets;
+            else if (IsEqualGUID(lpvInBuffer, &SendDatagramsGuid))
+                Function = MsafdSendDatagrams;
+            else if (IsEqualGUID(lpvInBuffer, &RecvDatagramsGuid))
+                Function = MsafdRecvDatagrams;
+
+            if (!Function)
+            {
+                Errno = WSAEINVAL;
+                break;
+            }
+
+            *(PVOID*)lpvOutBuffer = Function;
+
+            cbRet = sizeof(PVOID);
+            Errno = NO_ERROR;
+            Ret = NO_ERROR;
             break;
+        }
         case SIO_ADDRESS_LIST_QUERY:
             if (IS_INTRESOURCE(lpvOutBuffer) || cbOutBuffer == 0)
             {
@@ -2809,9 +2844,32 @@ WSPSetSockOpt(
                   return SOCKET_ERROR;
               }
 
-              /* TODO: The total per-socket buffer space reserved for sends */
-              ERR("Setting send buf to %x is not implemented yet\n", optval);
-              return NO_ERROR;
+              /* The transport sizes its send buffer from this */
+              Socket->SharedData->SizeOfSendBuffer = *(PULONG)optval;
+              goto SendToHelper;
+
+           case SO_RCVBUF:
+              if (optlen < sizeof(DWORD))
+              {
+                  if (lpErrno) *lpErrno = WSAEFAULT;
+                  return SOCKET_ERROR;
+              }
+
+              /* The transport sizes its receive window from this */
+              Socket->SharedData->SizeOfRecvBuffer = *(PULONG)optval;
+
+              /* and AFD the data it buffers ahead of recv() */
+              if (Socket->SharedData->SocketType == SOCK_STREAM)
+              {
+                  SetSocketInformation(Socket,
+                                       AFD_INFO_RECEIVE_WINDOW_SIZE,
+                                       NULL,
+                                       (PULONG)optval,
+                                       NULL,
+                                       NULL,
+                                       NULL);
+              }
+              goto SendToHelper;
 
            case SO_ERROR:
               if (optlen < sizeof(INT))
@@ -914,6 +914,436 @@ WSPSendTo(SOCKET Handle,
     return MsafdReturnWithErrno(Status, lpErrno, IOSB->Information, lpNumberOfBytesSent);
 }
 
+/* Hands the elements to AFD, which sends file data straight out of the
+ * file system cache. The element array is captured before the IOCTL returns */
+static
+BOOL
+MsafdTransmit(SOCKET Handle,
+              PAFD_TRANSMIT_ELEMENT Elements,
+              DWORD ElementCount,
+              DWORD SendSize,
+              LPOVERLAPPED lpOverlapped,
+              DWORD dwFlags)
+{
+    PIO_STATUS_BLOCK        IOSB;
+    IO_STATUS_BLOCK         DummyIOSB;
+    AFD_TRANSMIT_INFO       TransmitInfo;
+    NTSTATUS                Status;
+    HANDLE                  Event;
+    HANDLE                  SockEvent;
+    PSOCKET_INFORMATION     Socket;
+
+    Socket = GetSocketStructure(Handle);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    Status = NtCreateEvent( &SockEvent, EVENT_ALL_ACCESS,
+                            NULL, SynchronizationEvent, FALSE );
+
+    if( !NT_SUCCESS(Status) )
+    {
+        SetLastError(TranslateNtStatusError(Status));
+        return FALSE;
+    }
+
+    TransmitInfo.ElementArray = Elements;
+    TransmitInfo.ElementCount = ElementCount;
+    TransmitInfo.SendSize = SendSize;
+    TransmitInfo.Flags = 0;
+    if (dwFlags & TF_DISCONNECT)
+        TransmitInfo.Flags |= AFD_TP_DISCONNECT;
+    if (dwFlags & TF_REUSE_SOCKET)
+        TransmitInfo.Flags |= AFD_TP_REUSE_SOCKET;
+
+    if (lpOverlapped == NULL)
+    {
+        Event = SockEvent;
+        IOSB = &DummyIOSB;
+    }
+    else
+    {
+        Event = lpOverlapped->hEvent;
+        IOSB = (PIO_STATUS_BLOCK)&lpOverlapped->Internal;
+    }
+
+    IOSB->Status = STATUS_PENDING;
+
+    Status = NtDeviceIoControlFile((HANDLE)Handle,
+                                   Event,
+                                   NULL,
+                                   lpOverlapped,
+                                   IOSB,
+                                   IOCTL_AFD_TRANSMIT_PACKETS,
+                                   &TransmitInfo,
+                                   sizeof(TransmitInfo),
+                                   NULL,
+                                   0);
+
+    /* Wait for completion of not overlapped */
+    if (Status == STATUS_PENDING && lpOverlapped == NULL)
+    {
+        WaitForSingleObject(SockEvent, INFINITE);
+        Status = IOSB->Status;
+    }
+
+    NtClose( SockEvent );
+
+    if (Status != STATUS_SUCCESS)
+    {
+        TRACE("Leaving (0x%x)\n", Status);
+        SetLastError(TranslateNtStatusError(Status));
+        return FALSE;
+    }
+
+    SockReenableAsyncSelectEvent(Socket, FD_WRITE);
+
+    TRACE("Leaving (Success, %d)\n", IOSB->Information);
+    return TRUE;
+}
+
+BOOL
+PASCAL
+MsafdTransmitFile(SOCKET hSocket,
+                  HANDLE hFile,
+                  DWORD nNumberOfBytesToWrite,
+                  DWORD nNumberOfBytesPerSend,
+                  LPOVERLAPPED lpOverlapped,
+                  LPTRANSMIT_FILE_BUFFERS lpTransmitBuffers,
+                  DWORD dwFlags)
+{
+    AFD_TRANSMIT_ELEMENT Elements[3];
+    DWORD Count = 0;
+
+    TRACE("Called (%p %p %lu)\n", hSocket, hFile, nNumberOfBytesToWrite);
+
+    RtlZeroMemory(Elements, sizeof(Elements));
+
+    if (lpTransmitBuffers && lpTransmitBuffers->Head && lpTransmitBuffers->HeadLength)
+    {
+        Elements[Count].Flags = AFD_TP_ELEMENT_MEMORY;
+        Elements[Count].Length = lpTransmitBuffers->HeadLength;
+        Elements[Count].Buffer = lpTransmitBuffers->Head;
+        Count++;
+    }
+
+    if (hFile)
+    {
+        Elements[Count].Flags = AFD_TP_ELEMENT_FILE;
+        Elements[Count].Length = nNumberOfBytesToWrite;
+        Elements[Count].FileHandle = hFile;
+
+        /* Overlapped transfers start at the offset in the OVERLAPPED */
+        if (lpOverlapped)
+        {
+            Elements[Count].FileOffset.LowPart = lpOverlapped->Offset;
+            Elements[Count].FileOffset.HighPart = lpOverlapped->OffsetHigh;
+        }
+        else
+        {
+            Elements[Count].FileOffset.QuadPart = -1;
+        }
+        Count++;
+    }
+
+    if (lpTransmitBuffers && lpTransmitBuffers->Tail && lpTransmitBuffers->TailLength)
+    {
+        Elements[Count].Flags = AFD_TP_ELEMENT_MEMORY;
+        Elements[Count].Length = lpTransmitBuffers->TailLength;
+        Elements[Count].Buffer = lpTransmitBuffers->Tail;
+        Count++;
+    }
+
+    return MsafdTransmit(hSocket,
+                         Elements,
+                         Count,
+                         nNumberOfBytesPerSend,
+                         lpOverlapped,
+                         dwFlags);
+}
+
+BOOL
+PASCAL
+MsafdTransmitPackets(SOCKET hSocket,
+                     LPTRANSMIT_PACKETS_ELEMENT lpPacketArray,
+                     DWORD nElementCount,
+                     DWORD nSendSize,
+                     LPOVERLAPPED lpOverlapped,
+                     DWORD dwFlags)
+{
+    PAFD_TRANSMIT_ELEMENT Elements = NULL;
+    DWORD i;
+    BOOL Result;
+
+    TRACE("Called (%p %p %lu)\n", hSocket, lpPacketArray, nElementCount);
+
+    if (nElementCount && !lpPacketArray)
+    {
+        SetLastError(WSAEFAULT);
+        return FALSE;
+    }
+
+    if (nElementCount)
+    {
+        Elements = HeapAlloc(GlobalHeap, 0, nElementCount * sizeof(*Elements));
+        if (!Elements)
+        {
+            SetLastError(WSAENOBUFS);
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < nElementCount; i++)
+    {
+        Elements[i].Flags = lpPacketArray[i].dwElFlags;
+        Elements[i].Length = lpPacketArray[i].cLength;
+        Elements[i].FileOffset.QuadPart = 0;
+        Elements[i].FileHandle = NULL;
+        Elements[i].Buffer = NULL;
+
+        if (lpPacketArray[i].dwElFlags & TP_ELEMENT_FILE)
+        {
+            Elements[i].FileOffset = lpPacketArray[i].nFileOffset;
+            Elements[i].FileHandle = lpPacketArray[i].hFile;
+        }
+        else
+        {
+            Elements[i].Buffer = lpPacketArray[i].pBuffer;
+        }
+    }
+
+    Result = MsafdTransmit(hSocket,
+                           Elements,
+                           nElementCount,
+                           nSendSize,
+                           lpOverlapped,
+                           dwFlags);
+
+    if (Elements)
+        HeapFree(GlobalHeap, 0, Elements);
+
+    return Result;
+}
+
+/* Moves a whole array of datagrams with one IOCTL. WSADATAGRAM has the
+ * layout of AFD_DATAGRAM, so the caller's array is handed over as it is */
+static
+INT
+MsafdDatagramBatch(SOCKET Handle,
+                   ULONG IoControlCode,
+                   LPWSADATAGRAM lpDatagrams,
+                   DWORD dwCount)
+{
+    IO_STATUS_BLOCK         IOSB;
+    AFD_DATAGRAM_BATCH_INFO BatchInfo;
+    NTSTATUS                Status;
+    HANDLE                  SockEvent;
+
+    C_ASSERT(sizeof(WSADATAGRAM) == sizeof(AFD_DATAGRAM));
+
+    Status = NtCreateEvent( &SockEvent, EVENT_ALL_ACCESS,
+                            NULL, SynchronizationEvent, FALSE );
+
+    if( !NT_SUCCESS(Status) )
+    {
+        SetLastError(TranslateNtStatusError(Status));
+        return SOCKET_ERROR;
+    }
+
+    BatchInfo.DatagramArray = (PAFD_DATAGRAM)lpDatagrams;
+    BatchInfo.DatagramCount = dwCount;
+
+    IOSB.Status = STATUS_PENDING;
+
+    Status = NtDeviceIoControlFile((HANDLE)Handle,
+                                   SockEvent,
+                                   NULL,
+                                   NULL,
+                                   &IOSB,
+                                   IoControlCode,
+                                   &BatchInfo,
+                                   sizeof(BatchInfo),
+                                   NULL,
+                                   0);
+
+    if (Status == STATUS_PENDING)
+    {
+        WaitForSingleObject(SockEvent, INFINITE);
+        Status = IOSB.Status;
+    }
+
+    NtClose( SockEvent );
+
+    if (!NT_SUCCESS(Status))
+    {
+        SetLastError(TranslateNtStatusError(Status));
+        return SOCKET_ERROR;
+    }
+
+    return (INT)IOSB.Information;
+}
+
+INT
+PASCAL
+MsafdSendDatagrams(SOCKET Handle,
+                   LPWSADATAGRAM lpDatagrams,
+                   DWORD dwCount,
+                   DWORD dwFlags)
+{
+    PSOCKET_INFORMATION     Socket;
+    PSOCKADDR               BindAddress;
+    INT                     BindAddressLength;
+    INT                     Errno;
+    INT                     Count;
+
+    TRACE("Called (%p %p %lu)\n", Handle, lpDatagrams, dwCount);
+
+    Socket = GetSocketStructure(Handle);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return SOCKET_ERROR;
+    }
+    if (!(Socket->SharedData->ServiceFlags1 & XP1_CONNECTIONLESS))
+    {
+        SetLastError(WSAEOPNOTSUPP);
+        return SOCKET_ERROR;
+    }
+    if (dwFlags)
+    {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    /* Bind us First */
+    if (Socket->SharedData->State == SocketOpen)
+    {
+        BindAddressLength = Socket->HelperData->MaxWSAddressLength;
+        BindAddress = HeapAlloc(GlobalHeap, 0, BindAddressLength);
+        if (!BindAddress)
+        {
+            SetLastError(WSAENOBUFS);
+            return SOCKET_ERROR;
+        }
+
+        Socket->HelperData->WSHGetWildcardSockaddr(Socket->HelperContext,
+                                                   BindAddress,
+                                                   &BindAddressLength);
+
+        if (WSPBind(Handle, BindAddress, BindAddressLength, &Errno) == SOCKET_ERROR)
+        {
+            HeapFree(GlobalHeap, 0, BindAddress);
+            SetLastError(Errno);
+            return SOCKET_ERROR;
+        }
+
+        HeapFree(GlobalHeap, 0, BindAddress);
+    }
+
+    Count = MsafdDatagramBatch(Handle,
+                               IOCTL_AFD_SEND_DATAGRAM_BATCH,
+                               lpDatagrams,
+                               dwCount);
+
+    if (Count != SOCKET_ERROR)
+        SockReenableAsyncSelectEvent(Socket, FD_WRITE);
+
+    return Count;
+}
+
+INT
+PASCAL
+MsafdRecvDatagrams(SOCKET Handle,
+                   LPWSADATAGRAM lpDatagrams,
+                   DWORD dwCount,
+                   DWORD dwFlags)
+{
+    PSOCKET_INFORMATION     Socket;
+    DWORD                   Flags = 0;
+    INT                     Errno;
+    INT                     Count;
+    INT                     More;
+
+    TRACE("Called (%p %p %lu)\n", Handle, lpDatagrams, dwCount);
+
+    Socket = GetSocketStructure(Handle);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return SOCKET_ERROR;
+    }
+    if (!(Socket->SharedData->ServiceFlags1 & XP1_CONNECTIONLESS))
+    {
+        SetLastError(WSAEOPNOTSUPP);
+        return SOCKET_ERROR;
+    }
+    if (dwFlags || !dwCount || !lpDatagrams)
+    {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+    if (Socket->SharedData->State == SocketOpen)
+    {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    Count = MsafdDatagramBatch(Handle,
+                               IOCTL_AFD_RECV_DATAGRAM_BATCH,
+                               lpDatagrams,
+                               dwCount);
+
+    /* AFD only hands out what is already queued. A blocking socket waits
+     * for the first datagram the usual way and takes the rest in a batch */
+    if (Count == SOCKET_ERROR &&
+        GetLastError() == WSAEWOULDBLOCK &&
+        !Socket->SharedData->NonBlocking)
+    {
+        lpDatagrams[0].dwFlags = 0;
+
+        if (WSPRecvFrom(Handle,
+                        &lpDatagrams[0].buf,
+                        1,
+                        &lpDatagrams[0].dwBytesTransferred,
+                        &Flags,
+                        lpDatagrams[0].name,
+                        &lpDatagrams[0].namelen,
+                        NULL,
+                        NULL,
+                        NULL,
+                        &Errno) == SOCKET_ERROR)
+        {
+            if (Errno != WSAEMSGSIZE)
+            {
+                SetLastError(Errno);
+                return SOCKET_ERROR;
+            }
+
+            lpDatagrams[0].dwBytesTransferred = lpDatagrams[0].buf.len;
+            lpDatagrams[0].dwFlags = MSG_TRUNC;
+        }
+
+        Count = 1;
+
+        if (dwCount > 1)
+        {
+            More = MsafdDatagramBatch(Handle,
+                                      IOCTL_AFD_RECV_DATAGRAM_BATCH,
+                                      &lpDatagrams[1],
+                                      dwCount - 1);
+            if (More != SOCKET_ERROR)
+                Count += More;
+        }
+    }
+
+    if (Count != SOCKET_ERROR)
+        SockReenableAsyncSelectEvent(Socket, FD_READ);
+
+    return Count;
+}
+
 INT
 WSPAPI
 WSPRecvDisconnect(IN  SOCKET s,
@@ -496,6 +496,43 @@ SockReenableAsyncSelectEvent (
     IN ULONG Event
     );
 
+BOOL
+PASCAL
+MsafdTransmitFile(
+    IN  SOCKET hSocket,
+    IN  HANDLE hFile,
+    IN  DWORD nNumberOfBytesToWrite,
+    IN  DWORD nNumberOfBytesPerSend,
+    IN  LPOVERLAPPED lpOverlapped,
+    IN  LPTRANSMIT_FILE_BUFFERS lpTransmitBuffers,
+    IN  DWORD dwFlags);
+
+BOOL
+PASCAL
+MsafdTransmitPackets(
+    IN  SOCKET hSocket,
+    IN  LPTRANSMIT_PACKETS_ELEMENT lpPacketArray,
+    IN  DWORD nElementCount,
+    IN  DWORD nSendSize,
+    IN  LPOVERLAPPED lpOverlapped,
+    IN  DWORD dwFlags);
+
+INT
+PASCAL
+MsafdSendDatagrams(
+    IN  SOCKET Handle,
+    IN  LPWSADATAGRAM lpDatagrams,
+    IN  DWORD dwCount,
+    IN  DWORD dwFlags);
+
+INT
+PASCAL
+MsafdRecvDatagrams(
+    IN  SOCKET Handle,
+    IN  LPWSADATAGRAM lpDatagrams,
+    IN  DWORD dwCount,
+    IN  DWORD dwFlags);
+
 typedef VOID (*PASYNC_COMPLETION_ROUTINE)(PVOID Context, PIO_STATUS_BLOCK IoStatusBlock);
 
 FORCEINLINE
@@ -264,9 +264,9 @@ InternalWake(IN OUT PRTL_CONDITION_VARIABLE ConditionVariable,
        order. */
     PCOND_VAR_WAIT_ENTRY CONST HeadEntry = InternalLockCondVar(ConditionVariable, NULL, NULL);
     PCOND_VAR_WAIT_ENTRY Entry;
-    PCOND_VAR_WAIT_ENTRY NextEntry;
-    LARGE_INTEGER Timeout;
     PCOND_VAR_WAIT_ENTRY RemoveOnUnlockEntry;
+    LIST_ENTRY WakeList;
+    PLIST_ENTRY ListEntry;
 
     ASSERT(CondVarKeyedEventHandle != NULL);
 
@@ -277,76 +277,46 @@ InternalWake(IN OUT PRTL_CONDITION_VARIABLE ConditionVariable,
         return;
     }
 
-    Timeout.QuadPart = 0;
+    InitializeListHead(&WakeList);
     RemoveOnUnlockEntry = NULL;
 
-    /* Release sleeping threads. We will iterate from the last entry on
-       the list to the first. Note that the loop condition is always
-       true for the initial test. */
-    for (Entry = CONTAINING_COND_VAR_WAIT_ENTRY(HeadEntry->ListEntry.Blink, ListEntry);
-         Entry != NULL;
-         Entry = NextEntry)
+    /* Take the threads to wake off the list while it's locked. We will
+       iterate from the last entry on the list to the first. */
+    do
     {
-        NTSTATUS Status;
-
-        if (HeadEntry == Entry)
-        {
-            /* After the current entry we've iterated through the
-               entire list in backward direction. Then exit.*/
-            NextEntry = NULL;
-        }
-        else
-        {
-            /* Store away the next reference right now, since we may
-               not touch Entry anymore at the end of the block. */
-            NextEntry = CONTAINING_COND_VAR_WAIT_ENTRY(Entry->ListEntry.Blink, ListEntry);
-        }
-
-        /* Wake the thread associated with this event. We will
-           immediately return if we failed (zero timeout). */
-        Status = NtReleaseKeyedEvent(CondVarKeyedEventHandle,
-                                     &Entry->WaitKey,
-                                     FALSE,
-                                     &Timeout);
-
-        if (!NT_SUCCESS(Status))
-        {
-            /* We failed to wake a thread. We'll keep trying. */
-            ASSERT(STATUS_INVALID_HANDLE != Status);
-            continue;
-        }
-
-        /* We've woken a thread and will make sure this thread
-           is removed from the list. */
+        Entry = CONTAINING_COND_VAR_WAIT_ENTRY(HeadEntry->ListEntry.Blink, ListEntry);
         if (HeadEntry == Entry)
         {
             /* This is the list head. We can't remove it as easily as
-               other entries and will pass it to the unlock routine
-               later (we will exit the loop after this round anyway). */
+               other entries and will pass it to the unlock routine. */
             RemoveOnUnlockEntry = HeadEntry;
-        }
-        else
-        {
-            /* We can remove the entry right away. */
-            RemoveEntryList(&Entry->ListEntry);
-
-            /* Now tell the woken thread that removal from the list was
-               already taken care of here so that this thread can resume
-               its normal operation more quickly. We may not touch
-               Entry after signaling this, since it may lie in invalid
-               memory from there on. */
-            *InternalGetListRemovalHandledFlag(Entry) = TRUE;
-        }
-
-        if (!ReleaseAll)
-        {
-            /* We've successfully woken one thread as the caller
-               demanded. */
             break;
         }
-    }
+
+        RemoveEntryList(&Entry->ListEntry);
+        *InternalGetListRemovalHandledFlag(Entry) = TRUE;
+        InsertTailList(&WakeList, &Entry->ListEntry);
+    } while (ReleaseAll);
 
     InternalUnlockCondVar(ConditionVariable, RemoveOnUnlockEntry);
+
+    /* The list head is off the list now, so its list entry is ours too */
+    if (RemoveOnUnlockEntry != NULL)
+        InsertTailList(&WakeList, &RemoveOnUnlockEntry->ListEntry);
+
+    /* Every thread taken off the list waits for its release, even if its
+       wait timed out meanwhile. So the releases can't get lost, and the
+       entries stay valid until their thread is released. */
+    while (!IsListEmpty(&WakeList))
+    {
+        ListEntry = RemoveHeadList(&WakeList);
+        Entry = CONTAINING_COND_VAR_WAIT_ENTRY(ListEntry, ListEntry);
+
+        NtReleaseKeyedEvent(CondVarKeyedEventHandle,
+                            &Entry->WaitKey,
+                            FALSE,
+                            NULL);
+    }
 }
 
 VOID
@@ -376,6 +346,7 @@ InternalSleep(IN OUT PRTL_CONDITION_VARIABLE ConditionVariable,
 
     COND_VAR_WAIT_ENTRY OwnEntry;
     NTSTATUS Status;
+    BOOLEAN Woken;
 
     ASSERT(CondVarKeyedEventHandle != NULL);
     ASSERT((CriticalSection == NULL) != (SRWLock == NULL));
@@ -412,20 +383,32 @@ InternalSleep(IN OUT PRTL_CONDITION_VARIABLE ConditionVariable,
 
     ASSERT(STATUS_INVALID_HANDLE != Status);
 
-    if (!*InternalGetListRemovalHandledFlag(&OwnEntry))
+    if (Status != STATUS_SUCCESS)
     {
-        /* Remove OwnEntry from the list again, since it still seems to
-           be on the list. We will know for sure once we've acquired
-           the lock. */
-        if (InternalLockCondVar(ConditionVariable,
-                                NULL,
-                                InternalGetListRemovalHandledFlag(&OwnEntry)))
+        /* The wait timed out. Remove OwnEntry from the list again, unless
+           a waking thread took it off in the meanwhile. We will know for
+           sure once we've acquired the lock. */
+        if (InternalLockCondVar(ConditionVariable, NULL, NULL))
         {
-            /* Unlock and potentially remove OwnEntry. Self-removal is
-               usually only necessary when a timeout occurred. */
+            Woken = OwnEntry.ListRemovalHandled;
             InternalUnlockCondVar(ConditionVariable,
-                                  !OwnEntry.ListRemovalHandled ?
-                                  &OwnEntry : NULL);
+                                  !Woken ? &OwnEntry : NULL);
+        }
+        else
+        {
+            /* The list is empty, so we have been taken off it */
+            Woken = *InternalGetListRemovalHandledFlag(&OwnEntry);
+        }
+
+        if (Woken)
+        {
+            /* We've been woken after all, and the waking thread is about
+               to release us. Wait for it so that it doesn't block. */
+            NtWaitForKeyedEvent(CondVarKeyedEventHandle,
+                                &OwnEntry.WaitKey,
+                                FALSE,
+                                NULL);
+            Status = STATUS_SUCCESS;
         }
     }
 
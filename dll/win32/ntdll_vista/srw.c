@@ -44,6 +44,16 @@
                              RTL_SRWLOCK_SHARED | RTL_SRWLOCK_CONTENTION_LOCK)
 #define RTL_SRWLOCK_BITS    4
 
+/* Values of the wake fields. A waiter that stops spinning marks its
+   field as sleeping, so the waker knows it has to release it from the
+   keyed event. */
+#define RTL_SRWLOCK_WAKE_SPINNING   0
+#define RTL_SRWLOCK_WAKE_SIGNALED   1
+#define RTL_SRWLOCK_WAKE_SLEEPING   2
+
+/* Number of times to check the wake field before going to sleep */
+#define RTL_SRWLOCK_SPIN_COUNT  1024
+
 typedef struct _RTLP_SRWLOCK_SHARED_WAKE
 {
     LONG Wake;
@@ -78,6 +88,42 @@ typedef struct _RTLP_SRWLOCK_WAITBLOCK
 } volatile RTLP_SRWLOCK_WAITBLOCK, *PRTLP_SRWLOCK_WAITBLOCK;
 
 
+static VOID
+RtlpSRWLockWait(IN PLONG Wake)
+{
+    ULONG SpinCount;
+
+    /* The lock is usually handed over quickly, so spin for a while first */
+    for (SpinCount = 0; SpinCount < RTL_SRWLOCK_SPIN_COUNT; SpinCount++)
+    {
+        if (*(volatile LONG *)Wake != RTL_SRWLOCK_WAKE_SPINNING)
+            return;
+
+        YieldProcessor();
+    }
+
+    /* Sleep on the global keyed event, unless we were woken meanwhile */
+    if (InterlockedCompareExchange(Wake,
+                                   RTL_SRWLOCK_WAKE_SLEEPING,
+                                   RTL_SRWLOCK_WAKE_SPINNING) == RTL_SRWLOCK_WAKE_SPINNING)
+    {
+        NtWaitForKeyedEvent(NULL, (PVOID)Wake, FALSE, NULL);
+    }
+}
+
+
+static VOID
+RtlpSRWLockWake(IN PLONG Wake)
+{
+    /* The wait block may go away as soon as the waiter sees the field
+       change, only its address can be used afterwards */
+    if (InterlockedExchange(Wake, RTL_SRWLOCK_WAKE_SIGNALED) == RTL_SRWLOCK_WAKE_SLEEPING)
+    {
+        NtReleaseKeyedEvent(NULL, (PVOID)Wake, FALSE, NULL);
+    }
+}
+
+
 static VOID
 NTAPI
 RtlpReleaseWaitBlockLockExclusive(IN OUT PRTL_SRWLOCK SRWLock,
@@ -125,8 +171,7 @@ RtlpReleaseWaitBlockLockExclusive(IN OUT PRTL_SRWLOCK SRWLock,
 
     if (FirstWaitBlock->Exclusive)
     {
-        (void)InterlockedOr(&FirstWaitBlock->Wake,
-                            TRUE);
+        RtlpSRWLockWake((PLONG)&FirstWaitBlock->Wake);
     }
     else
     {
@@ -139,8 +184,7 @@ RtlpReleaseWaitBlockLockExclusive(IN OUT PRTL_SRWLOCK SRWLock,
         {
             NextWake = WakeChain->Next;
 
-            (void)InterlockedOr((PLONG)&WakeChain->Wake,
-                                TRUE);
+            RtlpSRWLockWake((PLONG)&WakeChain->Wake);
 
             WakeChain = NextWake;
         } while (WakeChain != NULL);
@@ -178,8 +222,7 @@ RtlpReleaseWaitBlockLockLastShared(IN OUT PRTL_SRWLOCK SRWLock,
 
     (void)InterlockedExchangePointer(&SRWLock->Ptr, (PVOID)NewValue);
 
-    (void)InterlockedOr(&FirstWaitBlock->Wake,
-                        TRUE);
+    RtlpSRWLockWake((PLONG)&FirstWaitBlock->Wake);
 }
 
 
@@ -230,33 +273,11 @@ NTAPI
 RtlpAcquireSRWLockExclusiveWait(IN OUT PRTL_SRWLOCK SRWLock,
                                 IN PRTLP_SRWLOCK_WAITBLOCK WaitBlock)
 {
-    LONG_PTR CurrentValue;
-
-    while (1)
-    {
-        CurrentValue = *(volatile LONG_PTR *)&SRWLock->Ptr;
-        if (!(CurrentValue & RTL_SRWLOCK_SHARED))
-        {
-            if (CurrentValue & RTL_SRWLOCK_CONTENDED)
-            {
-                if (WaitBlock->Wake != 0)
-                {
-                    /* Our wait block became the first one
-                       in the chain, we own the lock now! */
-                    break;
-                }
-            }
-            else
-            {
-                /* The last wait block was removed and/or we're
-                   finally a simple exclusive lock. This means we
-                   don't need to wait anymore, we acquired the lock! */
-                break;
-            }
-        }
-
-        YieldProcessor();
-    }
+    /* Every exclusive waiter is handed the lock through its wake field
+       once its wait block is the first one in the chain, including when
+       the chain goes away. Don't look at the lock itself, a waiter that
+       leaves early would have its wake field written after returning. */
+    RtlpSRWLockWait((PLONG)&WaitBlock->Wake);
 }
 
 
@@ -266,47 +287,9 @@ RtlpAcquireSRWLockSharedWait(IN OUT PRTL_SRWLOCK SRWLock,
                              IN OUT PRTLP_SRWLOCK_WAITBLOCK FirstWait  OPTIONAL,
                              IN OUT PRTLP_SRWLOCK_SHARED_WAKE WakeChain)
 {
-    if (FirstWait != NULL)
-    {
-        while (WakeChain->Wake == 0)
-        {
-            YieldProcessor();
-        }
-    }
-    else
-    {
-        LONG_PTR CurrentValue;
-
-        while (1)
-        {
-            CurrentValue = *(volatile LONG_PTR *)&SRWLock->Ptr;
-            if (CurrentValue & RTL_SRWLOCK_SHARED)
-            {
-                /* The RTL_SRWLOCK_OWNED bit always needs to be set when
-                   RTL_SRWLOCK_SHARED is set! */
-                ASSERT(CurrentValue & RTL_SRWLOCK_OWNED);
-
-                if (CurrentValue & RTL_SRWLOCK_CONTENDED)
-                {
-                    if (WakeChain->Wake != 0)
-                    {
-                        /* Our wait block became the first one
-                           in the chain, we own the lock now! */
-                        break;
-                    }
-                }
-                else
-                {
-                    /* The last wait block was removed and/or we're
-                       finally a simple shared lock. This means we
-                       don't need to wait anymore, we acquired the lock! */
-                    break;
-                }
-            }
-
-            YieldProcessor();
-        }
-    }
+    /* The same goes for shared waiters, the whole wake chain of the
+       first wait block gets woken when it's done waiting */
+    RtlpSRWLockWait((PLONG)&WakeChain->Wake);
 }
 
 
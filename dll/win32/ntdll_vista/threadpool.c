@@ -0,0 +1,1322 @@
+/*
+ * COPYRIGHT:         See COPYING in the top level directory
+ * PROJECT:           ReactOS system libraries
+ * PURPOSE:           Thread Pool Routines
+ */
+
+/* NOTE: Every pool has one work queue per processor (up to TP_MAX_QUEUES).
+   Callbacks are queued on the queue of the processor the submitter runs
+   on, and workers take from the queue of their own processor first and
+   steal from the others when it's empty. Idle workers sleep on the pool's
+   I/O completion port, which also delivers the completions of the files
+   bound to the pool. Waits are multiplexed on a few wait threads shared
+   by all pools. */
+
+/* INCLUDES ******************************************************************/
+
+#include <rtl_vista.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* INTERNAL TYPES ************************************************************/
+
+#define TP_MAX_QUEUES           8
+#define TP_DEFAULT_MAX_THREADS  500
+#define TP_WAIT_THREAD_HANDLES  (MAXIMUM_WAIT_OBJECTS - 1)
+
+/* Completion key of the packets that only wake a worker up */
+#define TP_WAKE_KEY             0
+
+/* Idle workers above the minimum go away after 20 seconds */
+#define TP_WORKER_IDLE_TIMEOUT  (-20LL * 1000 * 1000 * 10)
+
+typedef VOID
+(NTAPI *PTP_IO_CALLBACK)(
+    _Inout_ PTP_CALLBACK_INSTANCE Instance,
+    _Inout_opt_ PVOID Context,
+    _In_ PVOID ApcContext,
+    _In_ PIO_STATUS_BLOCK IoStatusBlock,
+    _In_ PTP_IO Io);
+
+typedef enum _TP_OBJECT_TYPE
+{
+    TpWorkObject,
+    TpSimpleObject,
+    TpWaitObject,
+    TpIoObject
+} TP_OBJECT_TYPE;
+
+typedef struct _TP_QUEUE
+{
+    RTL_SRWLOCK Lock;
+    LIST_ENTRY List;
+} TP_QUEUE, *PTP_QUEUE;
+
+struct _TP_POOL
+{
+    LONG Refs;
+    BOOLEAN Shutdown;
+    HANDLE CompletionPort;
+    ULONG QueueCount;
+    TP_QUEUE Queues[TP_MAX_QUEUES];
+    LONG Threads;
+    LONG IdleThreads;
+    LONG PendingWakes;
+    LONG LongCallbacks;
+    LONG MinThreads;
+    LONG MaxThreads;
+
+    /* Protects nothing but the waits for callbacks to complete */
+    RTL_SRWLOCK Lock;
+    RTL_CONDITION_VARIABLE CallbacksDone;
+};
+
+struct _TP_CLEANUP_GROUP
+{
+    RTL_SRWLOCK Lock;
+    LIST_ENTRY Members;
+};
+
+struct _TP_WAIT_THREAD;
+
+typedef struct _TP_OBJECT
+{
+    /* Reserved for kernel32, which keeps its I/O callback here */
+    PVOID Reserved;
+
+    TP_OBJECT_TYPE Type;
+    LONG Refs;
+    PTP_POOL Pool;
+    PVOID Callback;
+    PVOID Context;
+
+    /* Taken from the callback environment */
+    PTP_CLEANUP_GROUP CleanupGroup;
+    PTP_CLEANUP_GROUP_CANCEL_CALLBACK CancelCallback;
+    PTP_SIMPLE_CALLBACK FinalizationCallback;
+    BOOLEAN LongFunction;
+    LIST_ENTRY GroupEntry;
+
+    /* Queueing state, protected by Lock */
+    RTL_SRWLOCK Lock;
+    LIST_ENTRY QueueEntry;
+    ULONG QueueIndex;
+    BOOLEAN Queued;
+    LONG Pending;
+
+    /* Callbacks that started and didn't return yet */
+    LONG Running;
+    LONG Waiters;
+
+    union
+    {
+        struct
+        {
+            HANDLE Handle;
+            LARGE_INTEGER DueTime;
+            TP_WAIT_RESULT Result;
+            ULONG Sequence;
+            struct _TP_WAIT_THREAD *Thread;
+        } Wait;
+        struct
+        {
+            LONG PendingIo;
+        } Io;
+    } u;
+} TP_OBJECT, *PTP_OBJECT;
+
+struct _TP_CALLBACK_INSTANCE
+{
+    PTP_OBJECT Object;
+    BOOLEAN Associated;
+    BOOLEAN MayRunLong;
+    HANDLE Event;
+    HANDLE Semaphore;
+    LONG SemaphoreCount;
+    HANDLE Mutex;
+    PRTL_CRITICAL_SECTION CriticalSection;
+};
+
+typedef struct _TP_WAIT_THREAD
+{
+    LIST_ENTRY Entry;
+    HANDLE UpdateEvent;
+    ULONG Count;
+    PTP_OBJECT Waits[TP_WAIT_THREAD_HANDLES];
+} TP_WAIT_THREAD, *PTP_WAIT_THREAD;
+
+VOID
+NTAPI
+RtlInitializeSRWLock(OUT PRTL_SRWLOCK SRWLock);
+VOID
+NTAPI
+RtlAcquireSRWLockExclusive(IN OUT PRTL_SRWLOCK SRWLock);
+VOID
+NTAPI
+RtlAcquireSRWLockShared(IN OUT PRTL_SRWLOCK SRWLock);
+VOID
+NTAPI
+RtlReleaseSRWLockExclusive(IN OUT PRTL_SRWLOCK SRWLock);
+VOID
+NTAPI
+RtlReleaseSRWLockShared(IN OUT PRTL_SRWLOCK SRWLock);
+VOID
+NTAPI
+RtlInitializeConditionVariable(OUT PRTL_CONDITION_VARIABLE ConditionVariable);
+VOID
+NTAPI
+RtlWakeAllConditionVariable(IN OUT PRTL_CONDITION_VARIABLE ConditionVariable);
+NTSTATUS
+NTAPI
+RtlSleepConditionVariableSRW(IN OUT PRTL_CONDITION_VARIABLE ConditionVariable,
+                             IN OUT PRTL_SRWLOCK SRWLock,
+                             IN PLARGE_INTEGER TimeOut OPTIONAL,
+                             IN ULONG Flags);
+VOID
+NTAPI
+TpSetWait(IN OUT PTP_WAIT Wait,
+          IN HANDLE Handle OPTIONAL,
+          IN PLARGE_INTEGER Timeout OPTIONAL);
+
+/* GLOBALS *******************************************************************/
+
+static PTP_POOL TppDefaultPool;
+
+/* The wait threads, with the waits registered with them */
+static RTL_SRWLOCK TppWaitLock = RTL_SRWLOCK_INIT;
+static LIST_ENTRY TppWaitThreads = { &TppWaitThreads, &TppWaitThreads };
+static ULONG TppWaitSequence;
+
+/* INTERNAL FUNCTIONS ********************************************************/
+
+static
+NTSTATUS
+TppCreateThread(IN PTHREAD_START_ROUTINE StartRoutine,
+                IN PVOID Parameter)
+{
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+
+    Status = RtlCreateUserThread(NtCurrentProcess(),
+                                 NULL,
+                                 FALSE,
+                                 0,
+                                 0,
+                                 0,
+                                 StartRoutine,
+                                 Parameter,
+                                 &ThreadHandle,
+                                 NULL);
+    if (NT_SUCCESS(Status))
+        NtClose(ThreadHandle);
+
+    return Status;
+}
+
+static
+VOID
+TppReleasePool(IN PTP_POOL Pool)
+{
+    if (InterlockedDecrement(&Pool->Refs) != 0)
+        return;
+
+    NtClose(Pool->CompletionPort);
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Pool);
+}
+
+static
+PTP_OBJECT
+TppDequeue(IN PTP_POOL Pool)
+{
+    PTP_QUEUE Queue;
+    PTP_OBJECT Object = NULL;
+    PLIST_ENTRY ListEntry;
+    ULONG First, i;
+
+    /* Start with the queue of our own processor, then steal from the others */
+    First = RtlGetCurrentProcessorNumber() % Pool->QueueCount;
+    for (i = 0; i < Pool->QueueCount && !Object; i++)
+    {
+        Queue = &Pool->Queues[(First + i) % Pool->QueueCount];
+
+        /* Don't bother locking empty queues */
+        if (IsListEmpty(&Queue->List))
+            continue;
+
+        RtlAcquireSRWLockExclusive(&Queue->Lock);
+        if (!IsListEmpty(&Queue->List))
+        {
+            ListEntry = RemoveHeadList(&Queue->List);
+            InitializeListHead(ListEntry);
+            Object = CONTAINING_RECORD(ListEntry, TP_OBJECT, QueueEntry);
+        }
+        RtlReleaseSRWLockExclusive(&Queue->Lock);
+    }
+
+    return Object;
+}
+
+static
+VOID
+TppEnqueue(IN PTP_OBJECT Object)
+{
+    PTP_POOL Pool = Object->Pool;
+    PTP_QUEUE Queue;
+
+    /* The caller holds the object lock */
+    Object->QueueIndex = RtlGetCurrentProcessorNumber() % Pool->QueueCount;
+    Object->Queued = TRUE;
+
+    Queue = &Pool->Queues[Object->QueueIndex];
+    RtlAcquireSRWLockExclusive(&Queue->Lock);
+    InsertTailList(&Queue->List, &Object->QueueEntry);
+    RtlReleaseSRWLockExclusive(&Queue->Lock);
+}
+
+static ULONG NTAPI TppWorkerThread(IN PVOID Parameter);
+
+static
+VOID
+TppWakeWorker(IN PTP_POOL Pool)
+{
+    LONG Threads;
+
+    /* Wake an idle worker, unless all of them are being woken already */
+    if (Pool->IdleThreads > Pool->PendingWakes)
+    {
+        InterlockedIncrement(&Pool->PendingWakes);
+        NtSetIoCompletion(Pool->CompletionPort, TP_WAKE_KEY, NULL, STATUS_SUCCESS, 0);
+        return;
+    }
+
+    /* Otherwise start a new worker, but keep the busy ones to about one per
+       processor, plus one for each callback that may run for a long time */
+    Threads = Pool->Threads;
+    if (Threads >= Pool->MaxThreads ||
+        (Threads >= Pool->MinThreads &&
+         Threads >= (LONG)Pool->QueueCount + Pool->LongCallbacks))
+    {
+        return;
+    }
+
+    if (InterlockedCompareExchange(&Pool->Threads, Threads + 1, Threads) != Threads)
+        return;
+
+    InterlockedIncrement(&Pool->Refs);
+    if (!NT_SUCCESS(TppCreateThread(TppWorkerThread, Pool)))
+    {
+        DPRINT1("Failed to create a thread pool worker\n");
+        InterlockedDecrement(&Pool->Threads);
+        TppReleasePool(Pool);
+    }
+}
+
+static
+VOID
+TppFreeObject(IN PTP_OBJECT Object)
+{
+    PTP_CLEANUP_GROUP Group = Object->CleanupGroup;
+
+    if (Group)
+    {
+        RtlAcquireSRWLockExclusive(&Group->Lock);
+        RemoveEntryList(&Object->GroupEntry);
+        RtlReleaseSRWLockExclusive(&Group->Lock);
+    }
+
+    TppReleasePool(Object->Pool);
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Object);
+}
+
+static
+VOID
+TppReleaseObject(IN PTP_OBJECT Object)
+{
+    if (InterlockedDecrement(&Object->Refs) == 0)
+        TppFreeObject(Object);
+}
+
+static NTSTATUS TppGetDefaultPool(OUT PTP_POOL *Pool);
+
+static
+NTSTATUS
+TppAllocObject(OUT PTP_OBJECT *Object,
+               IN TP_OBJECT_TYPE Type,
+               IN PVOID Callback,
+               IN PVOID Context,
+               IN PTP_CALLBACK_ENVIRON Environment OPTIONAL)
+{
+    PTP_OBJECT NewObject;
+    PTP_POOL Pool = NULL;
+    NTSTATUS Status;
+
+    if (!Callback)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Environment && Environment->Version != 1 && Environment->Version != 3)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Environment)
+        Pool = Environment->Pool;
+
+    if (!Pool)
+    {
+        Status = TppGetDefaultPool(&Pool);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    NewObject = RtlAllocateHeap(RtlGetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*NewObject));
+    if (!NewObject)
+        return STATUS_NO_MEMORY;
+
+    NewObject->Type = Type;
+    NewObject->Refs = 1;
+    NewObject->Pool = Pool;
+    NewObject->Callback = Callback;
+    NewObject->Context = Context;
+    RtlInitializeSRWLock(&NewObject->Lock);
+    InitializeListHead(&NewObject->QueueEntry);
+    InitializeListHead(&NewObject->GroupEntry);
+    InterlockedIncrement(&Pool->Refs);
+
+    if (Environment)
+    {
+        NewObject->CleanupGroup = Environment->CleanupGroup;
+        NewObject->CancelCallback = Environment->CleanupGroupCancelCallback;
+        NewObject->FinalizationCallback = Environment->FinalizationCallback;
+        NewObject->LongFunction = Environment->u.s.LongFunction;
+    }
+
+    if (NewObject->CleanupGroup)
+    {
+        RtlAcquireSRWLockExclusive(&NewObject->CleanupGroup->Lock);
+        InsertTailList(&NewObject->CleanupGroup->Members, &NewObject->GroupEntry);
+        RtlReleaseSRWLockExclusive(&NewObject->CleanupGroup->Lock);
+    }
+
+    *Object = NewObject;
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+TppPostObject(IN PTP_OBJECT Object)
+{
+    /* Every callback holds a reference until it returns */
+    InterlockedIncrement(&Object->Refs);
+
+    RtlAcquireSRWLockExclusive(&Object->Lock);
+    Object->Pending++;
+    if (!Object->Queued)
+        TppEnqueue(Object);
+    RtlReleaseSRWLockExclusive(&Object->Lock);
+
+    TppWakeWorker(Object->Pool);
+}
+
+static
+VOID
+TppCancelPending(IN PTP_OBJECT Object)
+{
+    PTP_QUEUE Queue;
+    LONG Pending;
+
+    RtlAcquireSRWLockExclusive(&Object->Lock);
+
+    Pending = Object->Pending;
+    Object->Pending = 0;
+
+    if (Object->Queued)
+    {
+        /* A worker may have taken it off the queue already, it'll find
+           that nothing is pending then */
+        Queue = &Object->Pool->Queues[Object->QueueIndex];
+        RtlAcquireSRWLockExclusive(&Queue->Lock);
+        if (!IsListEmpty(&Object->QueueEntry))
+        {
+            RemoveEntryList(&Object->QueueEntry);
+            InitializeListHead(&Object->QueueEntry);
+            Object->Queued = FALSE;
+        }
+        RtlReleaseSRWLockExclusive(&Queue->Lock);
+    }
+
+    RtlReleaseSRWLockExclusive(&Object->Lock);
+
+    /* Drop the references of the callbacks that won't run */
+    while (Pending--)
+        TppReleaseObject(Object);
+}
+
+static
+VOID
+TppWaitForCallbacks(IN PTP_OBJECT Object,
+                    IN BOOLEAN CancelPending)
+{
+    PTP_POOL Pool = Object->Pool;
+
+    if (CancelPending)
+        TppCancelPending(Object);
+
+    InterlockedIncrement(&Object->Waiters);
+
+    RtlAcquireSRWLockExclusive(&Pool->Lock);
+    while (Object->Pending || Object->Running ||
+           (Object->Type == TpIoObject && Object->u.Io.PendingIo))
+    {
+        RtlSleepConditionVariableSRW(&Pool->CallbacksDone, &Pool->Lock, NULL, 0);
+    }
+    RtlReleaseSRWLockExclusive(&Pool->Lock);
+
+    InterlockedDecrement(&Object->Waiters);
+}
+
+static
+VOID
+TppSignalCallbacksDone(IN PTP_OBJECT Object)
+{
+    PTP_POOL Pool = Object->Pool;
+
+    /* The counters were updated with interlocked operations, so anyone
+       who starts waiting after this sees them */
+    if (!Object->Waiters)
+        return;
+
+    RtlAcquireSRWLockExclusive(&Pool->Lock);
+    RtlWakeAllConditionVariable(&Pool->CallbacksDone);
+    RtlReleaseSRWLockExclusive(&Pool->Lock);
+}
+
+static
+VOID
+TppCallbackReturned(IN PTP_CALLBACK_INSTANCE Instance)
+{
+    PTP_OBJECT Object = Instance->Object;
+
+    /* Do what the callback asked for */
+    if (Instance->CriticalSection)
+        RtlLeaveCriticalSection(Instance->CriticalSection);
+    if (Instance->Mutex)
+        NtReleaseMutant(Instance->Mutex, NULL);
+    if (Instance->Semaphore)
+        NtReleaseSemaphore(Instance->Semaphore, Instance->SemaphoreCount, NULL);
+    if (Instance->Event)
+        NtSetEvent(Instance->Event, NULL);
+
+    if (Object->FinalizationCallback)
+        Object->FinalizationCallback(Instance, Object->Context);
+
+    if (Instance->MayRunLong || Object->LongFunction)
+        InterlockedDecrement(&Object->Pool->LongCallbacks);
+
+    if (Instance->Associated)
+    {
+        InterlockedDecrement(&Object->Running);
+        TppSignalCallbacksDone(Object);
+    }
+
+    TppReleaseObject(Object);
+}
+
+static
+VOID
+TppRunObject(IN PTP_OBJECT Object)
+{
+    TP_CALLBACK_INSTANCE Instance;
+    BOOLEAN Requeued;
+
+    RtlAcquireSRWLockExclusive(&Object->Lock);
+
+    if (!Object->Pending)
+    {
+        /* The callbacks were cancelled meanwhile */
+        Object->Queued = FALSE;
+        RtlReleaseSRWLockExclusive(&Object->Lock);
+        return;
+    }
+
+    /* Count it as running before it stops being pending, so that waiters
+       always see one of them */
+    InterlockedIncrement(&Object->Running);
+    Object->Pending--;
+
+    /* Queue it again for the next callback */
+    Requeued = (Object->Pending != 0);
+    if (Requeued)
+        TppEnqueue(Object);
+    else
+        Object->Queued = FALSE;
+
+    RtlReleaseSRWLockExclusive(&Object->Lock);
+
+    if (Requeued)
+        TppWakeWorker(Object->Pool);
+
+    RtlZeroMemory(&Instance, sizeof(Instance));
+    Instance.Object = Object;
+    Instance.Associated = TRUE;
+
+    if (Object->LongFunction)
+        InterlockedIncrement(&Object->Pool->LongCallbacks);
+
+    switch (Object->Type)
+    {
+        case TpWorkObject:
+            ((PTP_WORK_CALLBACK)Object->Callback)(&Instance, Object->Context, (PTP_WORK)Object);
+            break;
+
+        case TpSimpleObject:
+            ((PTP_SIMPLE_CALLBACK)Object->Callback)(&Instance, Object->Context);
+            break;
+
+        case TpWaitObject:
+            ((PTP_WAIT_CALLBACK)Object->Callback)(&Instance, Object->Context,
+                                                  (PTP_WAIT)Object, Object->u.Wait.Result);
+            break;
+
+        default:
+            ASSERT(FALSE);
+            break;
+    }
+
+    TppCallbackReturned(&Instance);
+}
+
+static
+VOID
+TppRunIoCompletion(IN PTP_OBJECT Object,
+                   IN PVOID ApcContext,
+                   IN PIO_STATUS_BLOCK IoStatusBlock)
+{
+    TP_CALLBACK_INSTANCE Instance;
+
+    /* The reference was taken when the operation was started */
+    InterlockedIncrement(&Object->Running);
+    InterlockedDecrement(&Object->u.Io.PendingIo);
+
+    RtlZeroMemory(&Instance, sizeof(Instance));
+    Instance.Object = Object;
+    Instance.Associated = TRUE;
+
+    if (Object->LongFunction)
+        InterlockedIncrement(&Object->Pool->LongCallbacks);
+
+    ((PTP_IO_CALLBACK)Object->Callback)(&Instance, Object->Context, ApcContext,
+                                        IoStatusBlock, (PTP_IO)Object);
+
+    TppCallbackReturned(&Instance);
+}
+
+static
+ULONG
+NTAPI
+TppWorkerThread(IN PVOID Parameter)
+{
+    PTP_POOL Pool = (PTP_POOL)Parameter;
+    PTP_OBJECT Object;
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER Timeout;
+    PVOID Key, ApcContext;
+    NTSTATUS Status;
+    LONG Threads;
+
+    Timeout.QuadPart = TP_WORKER_IDLE_TIMEOUT;
+
+    for (;;)
+    {
+        Object = TppDequeue(Pool);
+        if (Object)
+        {
+            TppRunObject(Object);
+            continue;
+        }
+
+        /* Look at the queues once more after announcing that we're idle,
+           someone may have queued a callback without waking anybody */
+        InterlockedIncrement(&Pool->IdleThreads);
+        Object = TppDequeue(Pool);
+        if (Object)
+        {
+            InterlockedDecrement(&Pool->IdleThreads);
+            TppRunObject(Object);
+            continue;
+        }
+
+        Status = NtRemoveIoCompletion(Pool->CompletionPort,
+                                      &Key,
+                                      &ApcContext,
+                                      &IoStatusBlock,
+                                      &Timeout);
+        InterlockedDecrement(&Pool->IdleThreads);
+
+        if (Status == STATUS_SUCCESS)
+        {
+            if ((ULONG_PTR)Key != TP_WAKE_KEY)
+                TppRunIoCompletion((PTP_OBJECT)Key, ApcContext, &IoStatusBlock);
+            else
+                InterlockedDecrement(&Pool->PendingWakes);
+
+            if (!Pool->Shutdown)
+                continue;
+        }
+        else if (Status != STATUS_TIMEOUT)
+        {
+            DPRINT1("NtRemoveIoCompletion failed with 0x%lx\n", Status);
+        }
+
+        /* Go away if we're not needed, but keep the minimum around */
+        Threads = Pool->Threads;
+        if ((Pool->Shutdown || Threads > Pool->MinThreads) &&
+            InterlockedCompareExchange(&Pool->Threads, Threads - 1, Threads) == Threads)
+        {
+            break;
+        }
+    }
+
+    TppReleasePool(Pool);
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+static
+NTSTATUS
+TppAllocPool(OUT PTP_POOL *Pool)
+{
+    PTP_POOL NewPool;
+    NTSTATUS Status;
+    ULONG i;
+
+    NewPool = RtlAllocateHeap(RtlGetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*NewPool));
+    if (!NewPool)
+        return STATUS_NO_MEMORY;
+
+    Status = NtCreateIoCompletion(&NewPool->CompletionPort,
+                                  IO_COMPLETION_ALL_ACCESS,
+                                  NULL,
+                                  0);
+    if (!NT_SUCCESS(Status))
+    {
+        RtlFreeHeap(RtlGetProcessHeap(), 0, NewPool);
+        return Status;
+    }
+
+    NewPool->Refs = 1;
+    NewPool->MaxThreads = TP_DEFAULT_MAX_THREADS;
+    NewPool->QueueCount = min(NtCurrentPeb()->NumberOfProcessors, TP_MAX_QUEUES);
+    if (!NewPool->QueueCount)
+        NewPool->QueueCount = 1;
+
+    for (i = 0; i < NewPool->QueueCount; i++)
+    {
+        RtlInitializeSRWLock(&NewPool->Queues[i].Lock);
+        InitializeListHead(&NewPool->Queues[i].List);
+    }
+
+    RtlInitializeSRWLock(&NewPool->Lock);
+    RtlInitializeConditionVariable(&NewPool->CallbacksDone);
+
+    *Pool = NewPool;
+    return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS
+TppGetDefaultPool(OUT PTP_POOL *Pool)
+{
+    PTP_POOL NewPool;
+    NTSTATUS Status;
+
+    if (!TppDefaultPool)
+    {
+        Status = TppAllocPool(&NewPool);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        /* Someone else may have been faster */
+        if (InterlockedCompareExchangePointer((PVOID *)&TppDefaultPool, NewPool, NULL) != NULL)
+            TppReleasePool(NewPool);
+    }
+
+    *Pool = TppDefaultPool;
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+TppRemoveWait(IN PTP_WAIT_THREAD WaitThread,
+              IN ULONG Index)
+{
+    /* The caller holds the wait lock */
+    WaitThread->Waits[Index]->u.Wait.Thread = NULL;
+    WaitThread->Count--;
+    WaitThread->Waits[Index] = WaitThread->Waits[WaitThread->Count];
+    WaitThread->Waits[WaitThread->Count] = NULL;
+}
+
+static
+VOID
+TppFireWait(IN PTP_WAIT_THREAD WaitThread,
+            IN ULONG Index,
+            IN TP_WAIT_RESULT Result)
+{
+    PTP_OBJECT Object = WaitThread->Waits[Index];
+
+    /* Waits are one-shot, they have to be set again */
+    TppRemoveWait(WaitThread, Index);
+    Object->u.Wait.Result = Result;
+    TppPostObject(Object);
+}
+
+static
+ULONG
+NTAPI
+TppWaitThread(IN PVOID Parameter)
+{
+    PTP_WAIT_THREAD WaitThread = (PTP_WAIT_THREAD)Parameter;
+    HANDLE Handles[TP_WAIT_THREAD_HANDLES + 1];
+    PTP_OBJECT Objects[TP_WAIT_THREAD_HANDLES];
+    ULONG Sequences[TP_WAIT_THREAD_HANDLES];
+    LARGE_INTEGER Now, DueTime, Timeout;
+    ULONG Count, i;
+    NTSTATUS Status;
+
+    Handles[0] = WaitThread->UpdateEvent;
+
+    for (;;)
+    {
+        /* Take a snapshot of the waits, and find the closest timeout */
+        DueTime.QuadPart = MAXLONGLONG;
+        RtlAcquireSRWLockShared(&TppWaitLock);
+        Count = WaitThread->Count;
+        for (i = 0; i < Count; i++)
+        {
+            Objects[i] = WaitThread->Waits[i];
+            Sequences[i] = Objects[i]->u.Wait.Sequence;
+            Handles[i + 1] = Objects[i]->u.Wait.Handle;
+            if (Objects[i]->u.Wait.DueTime.QuadPart < DueTime.QuadPart)
+                DueTime = Objects[i]->u.Wait.DueTime;
+        }
+        RtlReleaseSRWLockShared(&TppWaitLock);
+
+        if (DueTime.QuadPart != MAXLONGLONG)
+        {
+            NtQuerySystemTime(&Now);
+            Timeout.QuadPart = min(Now.QuadPart - DueTime.QuadPart, 0);
+        }
+
+        Status = NtWaitForMultipleObjects(Count + 1,
+                                          Handles,
+                                          WaitAny,
+                                          FALSE,
+                                          (DueTime.QuadPart != MAXLONGLONG) ? &Timeout : NULL);
+
+        RtlAcquireSRWLockExclusive(&TppWaitLock);
+
+        if ((Status >= STATUS_WAIT_0 + 1 && Status <= STATUS_WAIT_0 + Count) ||
+            (Status >= STATUS_ABANDONED_WAIT_0 + 1 && Status <= STATUS_ABANDONED_WAIT_0 + Count))
+        {
+            /* Only fire it if it wasn't changed meanwhile */
+            i = ((Status >= STATUS_ABANDONED_WAIT_0) ? Status - STATUS_ABANDONED_WAIT_0 : Status) - 1;
+            if (Objects[i]->u.Wait.Thread == WaitThread)
+            {
+                for (Count = 0; Count < WaitThread->Count; Count++)
+                {
+                    if (WaitThread->Waits[Count] == Objects[i] &&
+                        Objects[i]->u.Wait.Sequence == Sequences[i])
+                    {
+                        TppFireWait(WaitThread, Count, WAIT_OBJECT_0);
+                        break;
+                    }
+                }
+            }
+        }
+        else if (!NT_SUCCESS(Status))
+        {
+            /* Most likely one of the handles was closed. There's no way to tell
+               which one, so fail all the waits that were waited for */
+            DPRINT1("NtWaitForMultipleObjects failed with 0x%lx\n", Status);
+            for (i = WaitThread->Count; i-- > 0;)
+                TppFireWait(WaitThread, i, WAIT_FAILED);
+        }
+
+        /* Fire the waits that timed out */
+        NtQuerySystemTime(&Now);
+        for (i = WaitThread->Count; i-- > 0;)
+        {
+            if (WaitThread->Waits[i]->u.Wait.DueTime.QuadPart <= Now.QuadPart)
+                TppFireWait(WaitThread, i, WAIT_TIMEOUT);
+        }
+
+        RtlReleaseSRWLockExclusive(&TppWaitLock);
+    }
+
+    return 0;
+}
+
+static
+NTSTATUS
+TppGetWaitThread(OUT PTP_WAIT_THREAD *WaitThread)
+{
+    PTP_WAIT_THREAD NewThread;
+    PLIST_ENTRY ListEntry;
+    NTSTATUS Status;
+
+    /* The caller holds the wait lock. Find a thread with room for one more */
+    for (ListEntry = TppWaitThreads.Flink;
+         ListEntry != &TppWaitThreads;
+         ListEntry = ListEntry->Flink)
+    {
+        NewThread = CONTAINING_RECORD(ListEntry, TP_WAIT_THREAD, Entry);
+        if (NewThread->Count < TP_WAIT_THREAD_HANDLES)
+        {
+            *WaitThread = NewThread;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    NewThread = RtlAllocateHeap(RtlGetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*NewThread));
+    if (!NewThread)
+        return STATUS_NO_MEMORY;
+
+    Status = NtCreateEvent(&NewThread->UpdateEvent,
+                           EVENT_ALL_ACCESS,
+                           NULL,
+                           SynchronizationEvent,
+                           FALSE);
+    if (!NT_SUCCESS(Status))
+    {
+        RtlFreeHeap(RtlGetProcessHeap(), 0, NewThread);
+        return Status;
+    }
+
+    /* The wait threads stay around for the lifetime of the process */
+    Status = TppCreateThread(TppWaitThread, NewThread);
+    if (!NT_SUCCESS(Status))
+    {
+        NtClose(NewThread->UpdateEvent);
+        RtlFreeHeap(RtlGetProcessHeap(), 0, NewThread);
+        return Status;
+    }
+
+    InsertTailList(&TppWaitThreads, &NewThread->Entry);
+    *WaitThread = NewThread;
+    return STATUS_SUCCESS;
+}
+
+/* FUNCTIONS *****************************************************************/
+
+NTSTATUS
+NTAPI
+TpAllocPool(OUT PTP_POOL *Pool,
+            IN PVOID Reserved)
+{
+    return TppAllocPool(Pool);
+}
+
+VOID
+NTAPI
+TpReleasePool(IN OUT PTP_POOL Pool)
+{
+    LONG i;
+
+    /* Let the workers go, the last one frees the pool */
+    Pool->Shutdown = TRUE;
+    for (i = 0; i < Pool->Threads; i++)
+    {
+        InterlockedIncrement(&Pool->PendingWakes);
+        NtSetIoCompletion(Pool->CompletionPort, TP_WAKE_KEY, NULL, STATUS_SUCCESS, 0);
+    }
+
+    TppReleasePool(Pool);
+}
+
+VOID
+NTAPI
+TpSetPoolMaxThreads(IN OUT PTP_POOL Pool,
+                    IN ULONG MaxThreads)
+{
+    Pool->MaxThreads = max(MaxThreads, 1);
+    if (Pool->MinThreads > Pool->MaxThreads)
+        Pool->MinThreads = Pool->MaxThreads;
+}
+
+NTSTATUS
+NTAPI
+TpSetPoolMinThreads(IN OUT PTP_POOL Pool,
+                    IN ULONG MinThreads)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    Pool->MinThreads = MinThreads;
+    if (Pool->MaxThreads < Pool->MinThreads)
+        Pool->MaxThreads = Pool->MinThreads;
+
+    /* Start the minimum number of workers right away */
+    while (Pool->Threads < Pool->MinThreads)
+    {
+        InterlockedIncrement(&Pool->Threads);
+        InterlockedIncrement(&Pool->Refs);
+        Status = TppCreateThread(TppWorkerThread, Pool);
+        if (!NT_SUCCESS(Status))
+        {
+            InterlockedDecrement(&Pool->Threads);
+            TppReleasePool(Pool);
+            break;
+        }
+    }
+
+    return Status;
+}
+
+NTSTATUS
+NTAPI
+TpAllocCleanupGroup(OUT PTP_CLEANUP_GROUP *CleanupGroup)
+{
+    PTP_CLEANUP_GROUP Group;
+
+    Group = RtlAllocateHeap(RtlGetProcessHeap(), 0, sizeof(*Group));
+    if (!Group)
+        return STATUS_NO_MEMORY;
+
+    RtlInitializeSRWLock(&Group->Lock);
+    InitializeListHead(&Group->Members);
+
+    *CleanupGroup = Group;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+TpReleaseCleanupGroupMembers(IN OUT PTP_CLEANUP_GROUP CleanupGroup,
+                             IN BOOLEAN CancelPending,
+                             IN OUT PVOID CleanupParameter OPTIONAL)
+{
+    LIST_ENTRY Members;
+    PLIST_ENTRY ListEntry;
+    PTP_OBJECT Object;
+
+    /* Take the members off the group, they don't belong to it anymore */
+    RtlAcquireSRWLockExclusive(&CleanupGroup->Lock);
+    InitializeListHead(&Members);
+    while (!IsListEmpty(&CleanupGroup->Members))
+    {
+        ListEntry = RemoveHeadList(&CleanupGroup->Members);
+        Object = CONTAINING_RECORD(ListEntry, TP_OBJECT, GroupEntry);
+        Object->CleanupGroup = NULL;
+        InsertTailList(&Members, ListEntry);
+    }
+    RtlReleaseSRWLockExclusive(&CleanupGroup->Lock);
+
+    while (!IsListEmpty(&Members))
+    {
+        ListEntry = RemoveHeadList(&Members);
+        Object = CONTAINING_RECORD(ListEntry, TP_OBJECT, GroupEntry);
+        InitializeListHead(ListEntry);
+
+        if (Object->Type == TpWaitObject)
+            TpSetWait((PTP_WAIT)Object, NULL, NULL);
+
+        TppWaitForCallbacks(Object, CancelPending);
+
+        if (CancelPending && Object->CancelCallback)
+            Object->CancelCallback(Object->Context, CleanupParameter);
+
+        TppReleaseObject(Object);
+    }
+}
+
+VOID
+NTAPI
+TpReleaseCleanupGroup(IN OUT PTP_CLEANUP_GROUP CleanupGroup)
+{
+    ASSERT(IsListEmpty(&CleanupGroup->Members));
+    RtlFreeHeap(RtlGetProcessHeap(), 0, CleanupGroup);
+}
+
+NTSTATUS
+NTAPI
+TpSimpleTryPost(IN PTP_SIMPLE_CALLBACK Callback,
+                IN OUT PVOID Context OPTIONAL,
+                IN PTP_CALLBACK_ENVIRON Environment OPTIONAL)
+{
+    PTP_OBJECT Object;
+    NTSTATUS Status;
+
+    Status = TppAllocObject(&Object, TpSimpleObject, Callback, Context, Environment);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    /* The callback's reference is the only one left */
+    TppPostObject(Object);
+    TppReleaseObject(Object);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+TpAllocWork(OUT PTP_WORK *Work,
+            IN PTP_WORK_CALLBACK Callback,
+            IN OUT PVOID Context OPTIONAL,
+            IN PTP_CALLBACK_ENVIRON Environment OPTIONAL)
+{
+    return TppAllocObject((PTP_OBJECT *)Work, TpWorkObject, Callback, Context, Environment);
+}
+
+VOID
+NTAPI
+TpPostWork(IN OUT PTP_WORK Work)
+{
+    TppPostObject((PTP_OBJECT)Work);
+}
+
+VOID
+NTAPI
+TpWaitForWork(IN OUT PTP_WORK Work,
+              IN BOOLEAN CancelPending)
+{
+    TppWaitForCallbacks((PTP_OBJECT)Work, CancelPending);
+}
+
+VOID
+NTAPI
+TpReleaseWork(IN OUT PTP_WORK Work)
+{
+    TppReleaseObject((PTP_OBJECT)Work);
+}
+
+NTSTATUS
+NTAPI
+TpAllocWait(OUT PTP_WAIT *Wait,
+            IN PTP_WAIT_CALLBACK Callback,
+            IN OUT PVOID Context OPTIONAL,
+            IN PTP_CALLBACK_ENVIRON Environment OPTIONAL)
+{
+    return TppAllocObject((PTP_OBJECT *)Wait, TpWaitObject, Callback, Context, Environment);
+}
+
+VOID
+NTAPI
+TpSetWait(IN OUT PTP_WAIT Wait,
+          IN HANDLE Handle OPTIONAL,
+          IN PLARGE_INTEGER Timeout OPTIONAL)
+{
+    PTP_OBJECT Object = (PTP_OBJECT)Wait;
+    PTP_WAIT_THREAD WaitThread;
+    LARGE_INTEGER Now;
+    ULONG i;
+
+    RtlAcquireSRWLockExclusive(&TppWaitLock);
+
+    /* Take it off the wait thread it's currently on */
+    WaitThread = Object->u.Wait.Thread;
+    if (WaitThread)
+    {
+        for (i = 0; i < WaitThread->Count; i++)
+        {
+            if (WaitThread->Waits[i] == Object)
+            {
+                TppRemoveWait(WaitThread, i);
+                break;
+            }
+        }
+        NtSetEvent(WaitThread->UpdateEvent, NULL);
+    }
+
+    Object->u.Wait.Sequence = ++TppWaitSequence;
+
+    if (Handle)
+    {
+        /* Timeouts are either absolute, or relative when negative */
+        if (!Timeout)
+        {
+            Object->u.Wait.DueTime.QuadPart = MAXLONGLONG;
+        }
+        else if (Timeout->QuadPart < 0)
+        {
+            NtQuerySystemTime(&Now);
+            Object->u.Wait.DueTime.QuadPart = Now.QuadPart - Timeout->QuadPart;
+        }
+        else
+        {
+            Object->u.Wait.DueTime = *Timeout;
+        }
+
+        Object->u.Wait.Handle = Handle;
+
+        if (NT_SUCCESS(TppGetWaitThread(&WaitThread)))
+        {
+            WaitThread->Waits[WaitThread->Count++] = Object;
+            Object->u.Wait.Thread = WaitThread;
+            NtSetEvent(WaitThread->UpdateEvent, NULL);
+        }
+        else
+        {
+            DPRINT1("Failed to get a wait thread for %p\n", Wait);
+        }
+    }
+
+    RtlReleaseSRWLockExclusive(&TppWaitLock);
+}
+
+VOID
+NTAPI
+TpWaitForWait(IN OUT PTP_WAIT Wait,
+              IN BOOLEAN CancelPending)
+{
+    TppWaitForCallbacks((PTP_OBJECT)Wait, CancelPending);
+}
+
+VOID
+NTAPI
+TpReleaseWait(IN OUT PTP_WAIT Wait)
+{
+    TpSetWait(Wait, NULL, NULL);
+    TppReleaseObject((PTP_OBJECT)Wait);
+}
+
+NTSTATUS
+NTAPI
+TpAllocIoCompletion(OUT PTP_IO *Io,
+                    IN HANDLE File,
+                    IN PTP_IO_CALLBACK Callback,
+                    IN OUT PVOID Context OPTIONAL,
+                    IN PTP_CALLBACK_ENVIRON Environment OPTIONAL)
+{
+    FILE_COMPLETION_INFORMATION CompletionInfo;
+    IO_STATUS_BLOCK IoStatusBlock;
+    PTP_OBJECT Object;
+    NTSTATUS Status;
+
+    Status = TppAllocObject(&Object, TpIoObject, Callback, Context, Environment);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    /* The completions of the file go to the pool's workers */
+    CompletionInfo.Port = Object->Pool->CompletionPort;
+    CompletionInfo.Key = Object;
+    Status = NtSetInformationFile(File,
+                                  &IoStatusBlock,
+                                  &CompletionInfo,
+                                  sizeof(CompletionInfo),
+                                  FileCompletionInformation);
+    if (!NT_SUCCESS(Status))
+    {
+        TppReleaseObject(Object);
+        return Status;
+    }
+
+    *Io = (PTP_IO)Object;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+TpStartAsyncIoOperation(IN OUT PTP_IO Io)
+{
+    PTP_OBJECT Object = (PTP_OBJECT)Io;
+
+    /* The completion holds a reference until its callback returns */
+    InterlockedIncrement(&Object->Refs);
+    InterlockedIncrement(&Object->u.Io.PendingIo);
+}
+
+VOID
+NTAPI
+TpCancelAsyncIoOperation(IN OUT PTP_IO Io)
+{
+    PTP_OBJECT Object = (PTP_OBJECT)Io;
+
+    /* The operation failed to start, no completion will come */
+    InterlockedDecrement(&Object->u.Io.PendingIo);
+    TppSignalCallbacksDone(Object);
+    TppReleaseObject(Object);
+}
+
+VOID
+NTAPI
+TpWaitForIoCompletion(IN OUT PTP_IO Io,
+                      IN BOOLEAN CancelPending)
+{
+    /* Completions can't be taken back from the port, so there's nothing
+       to cancel */
+    TppWaitForCallbacks((PTP_OBJECT)Io, FALSE);
+}
+
+VOID
+NTAPI
+TpReleaseIoCompletion(IN OUT PTP_IO Io)
+{
+    TppReleaseObject((PTP_OBJECT)Io);
+}
+
+NTSTATUS
+NTAPI
+TpCallbackMayRunLong(IN OUT PTP_CALLBACK_INSTANCE Instance)
+{
+    PTP_POOL Pool = Instance->Object->Pool;
+
+    if (!Instance->MayRunLong && !Instance->Object->LongFunction)
+    {
+        Instance->MayRunLong = TRUE;
+        InterlockedIncrement(&Pool->LongCallbacks);
+    }
+
+    /* Make sure the other callbacks don't have to wait for this one */
+    if (Pool->IdleThreads > Pool->PendingWakes)
+        return STATUS_SUCCESS;
+
+    TppWakeWorker(Pool);
+    return (Pool->Threads < Pool->MaxThreads) ? STATUS_SUCCESS : STATUS_TOO_MANY_THREADS;
+}
+
+VOID
+NTAPI
+TpCallbackSetEventOnCompletion(IN OUT PTP_CALLBACK_INSTANCE Instance,
+                               IN HANDLE Event)
+{
+    Instance->Event = Event;
+}
+
+VOID
+NTAPI
+TpCallbackReleaseSemaphoreOnCompletion(IN OUT PTP_CALLBACK_INSTANCE Instance,
+                                       IN HANDLE Semaphore,
+                                       IN ULONG ReleaseCount)
+{
+    Instance->Semaphore = Semaphore;
+    Instance->SemaphoreCount = ReleaseCount;
+}
+
+VOID
+NTAPI
+TpCallbackReleaseMutexOnCompletion(IN OUT PTP_CALLBACK_INSTANCE Instance,
+                                   IN HANDLE Mutex)
+{
+    Instance->Mutex = Mutex;
+}
+
+VOID
+NTAPI
+TpCallbackLeaveCriticalSectionOnCompletion(IN OUT PTP_CALLBACK_INSTANCE Instance,
+                                           IN OUT PRTL_CRITICAL_SECTION CriticalSection)
+{
+    Instance->CriticalSection = CriticalSection;
+}
+
+VOID
+NTAPI
+TpDisassociateCallback(IN OUT PTP_CALLBACK_INSTANCE Instance)
+{
+    PTP_OBJECT Object = Instance->Object;
+
+    /* Waiting for the object's callbacks doesn't wait for this one anymore */
+    if (Instance->Associated)
+    {
+        Instance->Associated = FALSE;
+        InterlockedDecrement(&Object->Running);
+        TppSignalCallbacksDone(Object);
+    }
+}
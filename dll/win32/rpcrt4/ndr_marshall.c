@@ -1814,6 +1814,137 @@ void WINAPI NdrSimpleStructFree(PMIDL_STUB_MESSAGE pStubMsg,
     EmbeddedPointerFree(pStubMsg, pMemory, pFormat+4);
 }
 
+#ifdef __REACTOS__
+/* Bogus arrays are walked one element at a time by the Complex* helpers,
+ * even when an element is made of nothing but fixed-size base types.  Such
+ * an element looks the same in memory and on the wire, so the whole array
+ * can be copied as a single block instead.  Whether that holds depends only
+ * on the format string, so the answer is cached by element description. */
+#define BLOCK_COPY_CACHE_SIZE 64
+
+typedef struct _BLOCK_COPY_ENTRY
+{
+  PFORMAT_STRING pFormat;
+  ULONG size; /* element size, or 0 if the element must be walked */
+} BLOCK_COPY_ENTRY;
+
+static BLOCK_COPY_ENTRY block_copy_cache[BLOCK_COPY_CACHE_SIZE];
+
+static CRITICAL_SECTION block_copy_cs;
+static CRITICAL_SECTION_DEBUG block_copy_cs_debug =
+{
+    0, 0, &block_copy_cs,
+    { &block_copy_cs_debug.ProcessLocksList, &block_copy_cs_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": block_copy_cs") }
+};
+static CRITICAL_SECTION block_copy_cs = { &block_copy_cs_debug, -1, 0, 0, 0, 0 };
+
+/* Returns the memory size of the member list at pFormat if its memory and
+ * wire layouts are identical, 0 otherwise.  *pAlignment receives the largest
+ * wire alignment required by any embedded structure. */
+static ULONG ComplexBlockCopySize(PFORMAT_STRING pFormat, unsigned char *pAlignment)
+{
+  PFORMAT_STRING desc;
+  unsigned char alignment;
+  ULONG size = 0, member_size;
+
+  while (*pFormat != RPC_FC_END) {
+    switch (*pFormat) {
+    case RPC_FC_BYTE:
+    case RPC_FC_CHAR:
+    case RPC_FC_SMALL:
+    case RPC_FC_USMALL:
+      size += 1;
+      break;
+    case RPC_FC_WCHAR:
+    case RPC_FC_SHORT:
+    case RPC_FC_USHORT:
+      size += 2;
+      break;
+    case RPC_FC_LONG:
+    case RPC_FC_ULONG:
+    case RPC_FC_ENUM32:
+    case RPC_FC_FLOAT:
+      size += 4;
+      break;
+#ifndef _WIN64
+    case RPC_FC_INT3264:
+    case RPC_FC_UINT3264:
+      size += 4;
+      break;
+#endif
+    case RPC_FC_HYPER:
+    case RPC_FC_DOUBLE:
+      size += 8;
+      break;
+    case RPC_FC_PAD:
+      break;
+    case RPC_FC_EMBEDDED_COMPLEX:
+      /* memory padding has no wire counterpart */
+      if (pFormat[1]) return 0;
+      desc = pFormat + 2 + *(const SHORT*)(pFormat + 2);
+      alignment = desc[1] + 1;
+      if (size % alignment) return 0;
+      if (desc[0] == RPC_FC_STRUCT)
+        member_size = *(const WORD*)(desc + 2);
+      else if (desc[0] == RPC_FC_BOGUS_STRUCT &&
+               !*(const SHORT*)(desc + 4) && !*(const WORD*)(desc + 6))
+      {
+        /* no conformant array and no pointers */
+        if (ComplexBlockCopySize(desc + 8, pAlignment) != *(const WORD*)(desc + 2))
+          return 0;
+        member_size = *(const WORD*)(desc + 2);
+      }
+      else
+        return 0;
+      if (member_size % alignment) return 0;
+      if (alignment > *pAlignment) *pAlignment = alignment;
+      size += member_size;
+      pFormat += 4;
+      continue;
+    default:
+      return 0;
+    }
+    pFormat++;
+  }
+
+  return size;
+}
+
+/* Returns the element size if the bogus array elements described at pFormat
+ * can be copied as one block, 0 otherwise. */
+static ULONG array_block_copy_size(PFORMAT_STRING pFormat, unsigned char array_alignment)
+{
+  BLOCK_COPY_ENTRY *entry;
+  unsigned char alignment = 1;
+  ULONG size;
+
+  entry = &block_copy_cache[((ULONG_PTR)pFormat >> 2) % BLOCK_COPY_CACHE_SIZE];
+
+  EnterCriticalSection(&block_copy_cs);
+  if (entry->pFormat == pFormat)
+  {
+    size = entry->size;
+    LeaveCriticalSection(&block_copy_cs);
+    return size;
+  }
+  LeaveCriticalSection(&block_copy_cs);
+
+  size = ComplexBlockCopySize(pFormat, &alignment);
+  /* each element has to start as aligned as the first one */
+  if (size && (alignment > array_alignment || size % alignment))
+    size = 0;
+  TRACE("element %p: block copy size %u\n", pFormat, size);
+
+  EnterCriticalSection(&block_copy_cs);
+  entry->pFormat = pFormat;
+  entry->size = size;
+  LeaveCriticalSection(&block_copy_cs);
+
+  return size;
+}
+#endif
+
 /* Array helpers */
 
 static inline void array_compute_and_size_conformance(
@@ -1929,6 +2060,13 @@ static inline void array_buffer_size(
     align_length(&pStubMsg->BufferLength, alignment);
 
     size = pStubMsg->ActualCount;
+#ifdef __REACTOS__
+    if ((esize = array_block_copy_size(pFormat, alignment)))
+    {
+      safe_buffer_length_increment(pStubMsg, safe_multiply(esize, size));
+      break;
+    }
+#endif
     for (i = 0; i < size; i++)
       pMemory = ComplexBufferSize(pStubMsg, pMemory, pFormat, NULL);
     break;
@@ -2056,6 +2194,13 @@ static inline void array_write_variance_and_marshall(
     align_pointer_clear(&pStubMsg->Buffer, alignment);
 
     size = pStubMsg->ActualCount;
+#ifdef __REACTOS__
+    if ((esize = array_block_copy_size(pFormat, alignment)))
+    {
+      safe_copy_to_buffer(pStubMsg, pMemory, safe_multiply(esize, size));
+      break;
+    }
+#endif
     for (i = 0; i < size; i++)
       pMemory = ComplexMarshall(pStubMsg, pMemory, pFormat, NULL);
     break;
@@ -2260,6 +2405,13 @@ static inline ULONG array_read_variance_and_unmarshall(
 
     pMemory = *ppMemory;
     count = pStubMsg->ActualCount;
+#ifdef __REACTOS__
+    if (array_block_copy_size(pFormat, alignment) == esize && esize)
+    {
+      safe_copy_from_buffer(pStubMsg, pMemory, safe_multiply(esize, count));
+      return pStubMsg->Buffer - saved_buffer;
+    }
+#endif
     for (i = 0; i < count; i++)
         pMemory = ComplexUnmarshall(pStubMsg, pMemory, pFormat, NULL, fMustAlloc);
     return pStubMsg->Buffer - saved_buffer;
@@ -2360,6 +2512,11 @@ static inline void array_memory_size(
     memsize = safe_multiply(pStubMsg->MaxCount, esize);
 
     count = pStubMsg->ActualCount;
+#ifdef __REACTOS__
+    if (array_block_copy_size(pFormat, alignment) == esize && esize)
+      safe_buffer_increment(pStubMsg, safe_multiply(esize, count));
+    else
+#endif
     for (i = 0; i < count; i++)
         ComplexStructMemorySize(pStubMsg, pFormat, NULL);
 
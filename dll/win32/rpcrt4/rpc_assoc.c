@@ -240,7 +240,12 @@ static RPC_STATUS RpcAssoc_BindConnection(const RpcAssoc *assoc, RpcConnection *
     TRACE("sending bind request to server\n");
 
     hdr = RPCRT4_BuildBindHeader(NDR_LOCAL_DATA_REPRESENTATION,
+#ifdef __REACTOS__
+                                 rpcrt4_conn_get_max_packet_size(conn),
+                                 rpcrt4_conn_get_max_packet_size(conn),
+#else
                                  RPC_MAX_PACKET_SIZE, RPC_MAX_PACKET_SIZE,
+#endif
                                  assoc->assoc_group_id,
                                  InterfaceId, TransferSyntax);
 
@@ -282,7 +287,13 @@ static RPC_STATUS RpcAssoc_BindConnection(const RpcAssoc *assoc, RpcConnection *
                     if (status == RPC_S_OK)
                     {
                         conn->assoc_group_id = response_hdr->bind_ack.assoc_gid;
+#ifdef __REACTOS__
+                        /* Don't send fragments larger than what either side can receive */
+                        conn->MaxTransmissionSize = min(response_hdr->bind_ack.max_rsize,
+                                                        rpcrt4_conn_get_max_packet_size(conn));
+#else
                         conn->MaxTransmissionSize = response_hdr->bind_ack.max_tsize;
+#endif
                         conn->ActiveInterface = *InterfaceId;
                     }
                     break;
@@ -118,6 +118,9 @@ struct connection_ops {
   RPC_STATUS (*impersonate_client)(RpcConnection *conn);
   RPC_STATUS (*revert_to_self)(RpcConnection *conn);
   RPC_STATUS (*inquire_auth_client)(RpcConnection *, RPC_AUTHZ_HANDLE *, RPC_WSTR *, ULONG *, ULONG *, ULONG *, ULONG);
+#ifdef __REACTOS__
+  unsigned short max_packet_size; /* 0 for RPC_MAX_PACKET_SIZE */
+#endif
 };
 
 /* don't know what MS's structure looks like */
@@ -184,6 +187,15 @@ static inline const char *rpcrt4_conn_get_name(const RpcConnection *Connection)
   return Connection->ops->name;
 }
 
+static inline unsigned short rpcrt4_conn_get_max_packet_size(const RpcConnection *Connection)
+{
+#ifdef __REACTOS__
+  if (Connection->ops->max_packet_size)
+    return Connection->ops->max_packet_size;
+#endif
+  return RPC_MAX_PACKET_SIZE;
+}
+
 static inline int rpcrt4_conn_read(RpcConnection *Connection,
                      void *buffer, unsigned int len)
 {
@@ -182,6 +182,10 @@ typedef struct
 
 #define RPC_MIN_PACKET_SIZE  0x1000
 #define RPC_MAX_PACKET_SIZE  0x16D0
+#ifdef __REACTOS__
+/* Local transports aren't bound to a network MTU, only by frag_len being 16-bit */
+#define RPC_MAX_LOCAL_PACKET_SIZE  0xFFF0
+#endif
 
 enum rpc_packet_type
 {
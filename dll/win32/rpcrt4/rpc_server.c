@@ -322,15 +322,25 @@ static RPC_STATUS process_bind_packet_no_send(
   }
 
   *ack_response = RPCRT4_BuildBindAckHeader(NDR_LOCAL_DATA_REPRESENTATION,
+#ifdef __REACTOS__
+                                            rpcrt4_conn_get_max_packet_size(conn),
+                                            rpcrt4_conn_get_max_packet_size(conn),
+#else
                                             RPC_MAX_PACKET_SIZE,
                                             RPC_MAX_PACKET_SIZE,
+#endif
                                             conn->server_binding->Assoc->assoc_group_id,
                                             conn->Endpoint, hdr->num_elements,
                                             results);
   HeapFree(GetProcessHeap(), 0, results);
 
   if (*ack_response)
+#ifdef __REACTOS__
+      /* Don't send fragments larger than what either side can receive */
+      conn->MaxTransmissionSize = min(hdr->max_rsize, rpcrt4_conn_get_max_packet_size(conn));
+#else
       conn->MaxTransmissionSize = hdr->max_tsize;
+#endif
   else
       status = RPC_S_OUT_OF_RESOURCES;
 
@@ -543,6 +553,92 @@ static DWORD CALLBACK RPCRT4_worker_thread(LPVOID the_arg)
   return 0;
 }
 
+#ifdef __REACTOS__
+/* Requests are dispatched to a pool of worker threads waiting on a completion
+ * port: the port lets no more of them run at once than there are processors,
+ * and the pool only grows when no worker is waiting for a new call. Workers
+ * that have been idle for a while go away. */
+#define RPC_CALL_WORKERS_MAX            256
+#define RPC_CALL_WORKER_IDLE_TIMEOUT    30000
+
+static HANDLE call_port;
+static LONG call_workers;
+static LONG idle_call_workers;
+
+static DWORD CALLBACK RPCRT4_call_worker(LPVOID the_arg)
+{
+  DWORD size;
+  ULONG_PTR key;
+  OVERLAPPED *ovl;
+
+  for (;;)
+  {
+    InterlockedIncrement(&idle_call_workers);
+    ovl = NULL;
+    GetQueuedCompletionStatus(call_port, &size, &key, &ovl, RPC_CALL_WORKER_IDLE_TIMEOUT);
+    InterlockedDecrement(&idle_call_workers);
+
+    /* a call may have been queued while we were counted as waiting for it */
+    if (!ovl)
+      GetQueuedCompletionStatus(call_port, &size, &key, &ovl, 0);
+    if (!ovl)
+      break;
+
+    RPCRT4_worker_thread(ovl);
+  }
+
+  InterlockedDecrement(&call_workers);
+  return 0;
+}
+
+static DWORD CALLBACK RPCRT4_call_fallback(LPVOID the_arg)
+{
+  DWORD size;
+  ULONG_PTR key;
+  OVERLAPPED *ovl = NULL;
+
+  /* no worker could be started, pick up one call from the pool thread */
+  GetQueuedCompletionStatus(call_port, &size, &key, &ovl, 0);
+  if (ovl)
+    RPCRT4_worker_thread(ovl);
+  return 0;
+}
+
+static BOOL RPCRT4_queue_call(RpcPacket *packet)
+{
+  HANDLE port = call_port, thread;
+
+  if (!port)
+  {
+    port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (!port)
+      return FALSE;
+    if (InterlockedCompareExchangePointer(&call_port, port, NULL))
+    {
+      CloseHandle(port);
+      port = call_port;
+    }
+  }
+
+  if (!PostQueuedCompletionStatus(port, 0, 0, (OVERLAPPED *)packet))
+    return FALSE;
+
+  /* start another worker if none is waiting for the call */
+  if (InterlockedCompareExchange(&idle_call_workers, 0, 0) == 0)
+  {
+    thread = NULL;
+    if (InterlockedIncrement(&call_workers) <= RPC_CALL_WORKERS_MAX)
+      thread = CreateThread(NULL, 0, RPCRT4_call_worker, NULL, 0, NULL);
+    if (thread)
+      CloseHandle(thread);
+    else if (InterlockedDecrement(&call_workers) == 0)
+      QueueUserWorkItem(RPCRT4_call_fallback, NULL, WT_EXECUTELONGFUNCTION);
+  }
+
+  return TRUE;
+}
+#endif
+
 static DWORD CALLBACK RPCRT4_io_thread(LPVOID the_arg)
 {
   RpcConnection* conn = the_arg;
@@ -590,8 +686,14 @@ static DWORD CALLBACK RPCRT4_io_thread(LPVOID the_arg)
       packet->msg = msg;
       packet->auth_data = auth_data;
       packet->auth_length = auth_length;
+#ifdef __REACTOS__
+      if (!RPCRT4_queue_call(packet)) {
+        ERR("couldn't queue call for worker thread, error was %d\n", GetLastError());
+        RPCRT4_ReleaseConnection(packet->conn);
+#else
       if (!QueueUserWorkItem(RPCRT4_worker_thread, packet, WT_EXECUTELONGFUNCTION)) {
         ERR("couldn't queue work item for worker thread, error was %d\n", GetLastError());
+#endif
         HeapFree(GetProcessHeap(), 0, packet);
         status = RPC_S_OUT_OF_RESOURCES;
       } else {
@@ -122,7 +122,13 @@ static RPC_STATUS rpcrt4_conn_create_pipe(RpcConnection *conn)
     connection->pipe = CreateNamedPipeA(connection->listen_pipe, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
                                         PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE,
                                         PIPE_UNLIMITED_INSTANCES,
+#ifdef __REACTOS__
+                                        rpcrt4_conn_get_max_packet_size(conn),
+                                        rpcrt4_conn_get_max_packet_size(conn),
+                                        5000, NULL);
+#else
                                         RPC_MAX_PACKET_SIZE, RPC_MAX_PACKET_SIZE, 5000, NULL);
+#endif
     if (connection->pipe == INVALID_HANDLE_VALUE)
     {
         WARN("CreateNamedPipe failed with error %d\n", GetLastError());
@@ -501,6 +507,90 @@ static int rpcrt4_conn_np_wait_for_incoming_data(RpcConnection *Connection)
     return -1;
 }
 
+#ifdef __REACTOS__
+/* Each fragment is written as a single pipe message, so it can be received
+ * with one read instead of one for each of the common header, the rest of
+ * the header and the payload. */
+static RPC_STATUS rpcrt4_conn_np_receive_fragment(RpcConnection *conn, RpcPktHdr **Header, void **Payload)
+{
+    RPC_STATUS status;
+    unsigned short max_size = rpcrt4_conn_get_max_packet_size(conn);
+    unsigned char *buffer, *new_buffer;
+    DWORD hdr_length;
+    unsigned short frag_len;
+    int count, rest;
+
+    *Header = NULL;
+    *Payload = NULL;
+
+    buffer = HeapAlloc(GetProcessHeap(), 0, max_size);
+    if (!buffer)
+        return RPC_S_OUT_OF_RESOURCES;
+
+    count = rpcrt4_conn_np_read(conn, buffer, max_size);
+    if (count < (int)sizeof(RpcPktCommonHdr))
+    {
+        WARN("Short read of header, %d bytes\n", count);
+        status = RPC_S_CALL_FAILED;
+        goto fail;
+    }
+
+    status = RPCRT4_ValidateCommonHeader((RpcPktCommonHdr *)buffer);
+    if (status != RPC_S_OK) goto fail;
+
+    frag_len = ((RpcPktCommonHdr *)buffer)->frag_len;
+    hdr_length = RPCRT4_GetHeaderSize((RpcPktHdr *)buffer);
+    if (hdr_length == 0 || hdr_length > frag_len)
+    {
+        WARN("bad header length %d, frag_len %d\n", hdr_length, frag_len);
+        status = RPC_S_PROTOCOL_ERROR;
+        goto fail;
+    }
+
+    /* the peer sent a larger fragment than we asked for, read the rest */
+    if (count < frag_len)
+    {
+        new_buffer = HeapReAlloc(GetProcessHeap(), 0, buffer, frag_len);
+        if (!new_buffer)
+        {
+            status = RPC_S_OUT_OF_RESOURCES;
+            goto fail;
+        }
+        buffer = new_buffer;
+
+        rest = rpcrt4_conn_np_read(conn, buffer + count, frag_len - count);
+        if (rest < 0) rest = 0;
+        count += rest;
+    }
+    if (count != frag_len)
+    {
+        WARN("bad data length, %d/%d\n", count, frag_len);
+        status = RPC_S_CALL_FAILED;
+        goto fail;
+    }
+
+    if (frag_len - hdr_length)
+    {
+        *Payload = HeapAlloc(GetProcessHeap(), 0, frag_len - hdr_length);
+        if (!*Payload)
+        {
+            status = RPC_S_OUT_OF_RESOURCES;
+            goto fail;
+        }
+        memcpy(*Payload, buffer + hdr_length, frag_len - hdr_length);
+    }
+
+    /* the header keeps the buffer, don't keep it larger than needed */
+    new_buffer = HeapReAlloc(GetProcessHeap(), HEAP_REALLOC_IN_PLACE_ONLY, buffer, hdr_length);
+    *Header = (RpcPktHdr *)(new_buffer ? new_buffer : buffer);
+    return RPC_S_OK;
+
+fail:
+    HeapFree(GetProcessHeap(), 0, buffer);
+    return status;
+}
+#endif
+
 static size_t rpcrt4_ncacn_np_get_top_of_tower(unsigned char *tower_data,
                                                const char *networkaddr,
                                                const char *endpoint)
@@ -3200,13 +3290,20 @@ static const struct connection_ops conn_protseq_list[] = {
     rpcrt4_conn_np_wait_for_incoming_data,
     rpcrt4_ncalrpc_get_top_of_tower,
     rpcrt4_ncalrpc_parse_top_of_tower,
+#ifdef __REACTOS__
+    rpcrt4_conn_np_receive_fragment,
+#else
     NULL,
+#endif
     rpcrt4_ncalrpc_is_authorized,
     rpcrt4_ncalrpc_authorize,
     rpcrt4_ncalrpc_secure_packet,
     rpcrt4_conn_np_impersonate_client,
     rpcrt4_conn_np_revert_to_self,
     rpcrt4_ncalrpc_inquire_auth_client,
+#ifdef __REACTOS__
+    RPC_MAX_LOCAL_PACKET_SIZE,
+#endif
   },
   { "ncacn_ip_tcp",
     { EPM_PROTOCOL_NCACN, EPM_PROTOCOL_TCP },
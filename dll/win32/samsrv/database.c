@@ -466,6 +466,8 @@ SampDeleteAccountDbObject(PSAM_DB_OBJECT DbObject)
         goto done;
     }
 
+    InterlockedIncrement(&SampAccountNameChangeCount);
+
     /* Remove the account key from the container */
     Status = SampRegDeleteKey(ContainerKey,
                               DbObject->Name);
@@ -44,6 +44,8 @@ SampSetAccountNameInDomain(IN PSAM_DB_OBJECT DomainObject,
                              REG_DWORD,
                              (LPVOID)&ulRelativeId,
                              sizeof(ULONG));
+    if (NT_SUCCESS(Status))
+        InterlockedIncrement(&SampAccountNameChangeCount);
 
 done:
     SampRegCloseKey(&NamesKeyHandle);
@@ -83,6 +85,8 @@ SampRemoveAccountNameFromDomain(IN PSAM_DB_OBJECT DomainObject,
     /* Delete the account name value */
     Status = SampRegDeleteValue(NamesKeyHandle,
                                 lpAccountName);
+    if (NT_SUCCESS(Status))
+        InterlockedIncrement(&SampAccountNameChangeCount);
 
 done:
     SampRegCloseKey(&NamesKeyHandle);
@@ -26,6 +26,7 @@
 ENCRYPTED_NT_OWF_PASSWORD EmptyNtHash;
 ENCRYPTED_LM_OWF_PASSWORD EmptyLmHash;
 RTL_RESOURCE SampResource;
+LONG SampAccountNameChangeCount = 0;
 
 
 /* FUNCTIONS *****************************************************************/
@@ -96,6 +97,19 @@ SamIConnect(IN PSAMPR_SERVER_NAME ServerName,
 }
 
 
+/*
+ * Returns a counter that changes whenever an account name is added to,
+ * renamed in or removed from a domain. LSA uses it to invalidate its
+ * cache of SID and name lookups.
+ */
+ULONG
+NTAPI
+SamIGetAccountNameChangeCount(VOID)
+{
+    return (ULONG)SampAccountNameChangeCount;
+}
+
+
 NTSTATUS
 NTAPI
 SamIInitialize(VOID)
@@ -119,6 +119,7 @@ extern PGENERIC_MAPPING pServerMapping;
 extern ENCRYPTED_NT_OWF_PASSWORD EmptyNtHash;
 extern ENCRYPTED_LM_OWF_PASSWORD EmptyLmHash;
 extern RTL_RESOURCE SampResource;
+extern LONG SampAccountNameChangeCount;
 
 
 /* alias.c */
@@ -32,6 +32,7 @@
 @ stub SamIFree_UserInternal6Information
 @ stub SamIGCLookupNames
 @ stub SamIGCLookupSids
+@ stdcall SamIGetAccountNameChangeCount()
 @ stub SamIGetAliasMembership
 @ stub SamIGetBootKeyInformation
 @ stub SamIGetDefaultAdministratorName
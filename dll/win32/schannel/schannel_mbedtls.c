@@ -75,8 +75,100 @@ typedef struct
     mbedtls_entropy_context  entropy;
     mbedtls_ctr_drbg_context ctr_drbg;
     struct schan_transport  *transport;
+    BOOL                     cache_session;
 } MBEDTLS_SESSION, *PMBEDTLS_SESSION;
 
+/* client sessions are remembered per target, so that reconnecting to the same
+   host (e.g. wininet refilling its keep-alive pool) resumes the session with
+   an abbreviated handshake instead of a full key exchange */
+#define ROS_SCHAN_SESSION_CACHE_SIZE 16
+
+typedef struct
+{
+    char                target[256];
+    DWORD               last_used;
+    mbedtls_ssl_session session;
+} MBEDTLS_CACHED_SESSION;
+
+static MBEDTLS_CACHED_SESSION session_cache[ROS_SCHAN_SESSION_CACHE_SIZE];
+static CRITICAL_SECTION session_cache_cs;
+
+static MBEDTLS_CACHED_SESSION *schan_find_cached_session(const char *target)
+{
+    unsigned int i;
+
+    for (i = 0; i < _countof(session_cache); i++)
+    {
+        if (session_cache[i].target[0] && !strcmp(session_cache[i].target, target))
+            return &session_cache[i];
+    }
+
+    return NULL;
+}
+
+static void schan_resume_session(MBEDTLS_SESSION *s, const char *target)
+{
+    MBEDTLS_CACHED_SESSION *cached;
+
+    EnterCriticalSection(&session_cache_cs);
+
+    if ((cached = schan_find_cached_session(target)))
+    {
+        TRACE("MBEDTLS resuming session for %s\n", target);
+
+        cached->last_used = GetTickCount();
+        mbedtls_ssl_set_session(&s->ssl, &cached->session);
+    }
+
+    LeaveCriticalSection(&session_cache_cs);
+}
+
+static void schan_save_session(MBEDTLS_SESSION *s)
+{
+    MBEDTLS_CACHED_SESSION *cached;
+    const char *target = s->ssl.hostname;
+    DWORD now = GetTickCount();
+    unsigned int i;
+
+    if (!target || strlen(target) >= sizeof(cached->target))
+        return;
+
+    EnterCriticalSection(&session_cache_cs);
+
+    /* reuse the slot of the target, a free one or the least recently used */
+    if (!(cached = schan_find_cached_session(target)))
+    {
+        cached = &session_cache[0];
+
+        for (i = 0; i < _countof(session_cache); i++)
+        {
+            if (!session_cache[i].target[0])
+            {
+                cached = &session_cache[i];
+                break;
+            }
+
+            if (now - session_cache[i].last_used > now - cached->last_used)
+                cached = &session_cache[i];
+        }
+    }
+
+    mbedtls_ssl_session_free(&cached->session);
+
+    if (mbedtls_ssl_get_session(&s->ssl, &cached->session) == 0)
+    {
+        strcpy(cached->target, target);
+        cached->last_used = now;
+    }
+    else
+    {
+        mbedtls_ssl_session_free(&cached->session);
+        cached->target[0] = 0;
+    }
+
+    LeaveCriticalSection(&session_cache_cs);
+}
+
 /* custom `net_recv` callback adapter, mbedTLS uses it in mbedtls_ssl_read for
    pulling data from the underlying win32 net stack */
 static int schan_pull_adapter(void *session, unsigned char *buff, size_t buff_len)
@@ -219,6 +311,8 @@ BOOL schan_imp_create_session(schan_imp_session *session, schan_credentials *cre
     mbedtls_ssl_conf_endpoint(&s->conf,   (cred->credential_use & SECPKG_CRED_INBOUND) ? MBEDTLS_SSL_IS_SERVER :
                                                                                          MBEDTLS_SSL_IS_CLIENT);
 
+    s->cache_session = !(cred->credential_use & SECPKG_CRED_INBOUND);
+
     TRACE("MBEDTLS set authmode\n");
     mbedtls_ssl_conf_authmode(&s->conf, MBEDTLS_SSL_VERIFY_NONE);
 
@@ -273,6 +367,9 @@ void schan_imp_set_session_target(schan_imp_session session, const char *target)
      * sends a non-fatal alert which preemptively forces mbedTLS to close connection. */
 
     mbedtls_ssl_set_hostname(&s->ssl, target);
+
+    if (s->cache_session && target)
+        schan_resume_session(s, target);
 }
 
 SECURITY_STATUS schan_imp_handshake(schan_imp_session session)
@@ -302,6 +399,10 @@ SECURITY_STATUS schan_imp_handshake(schan_imp_session session)
     WARN("schan_imp_handshake: Handshake completed!\n");
     WARN("schan_imp_handshake: Protocol is %s, Cipher suite is %s\n", mbedtls_ssl_get_version(&s->ssl),
                                                                       mbedtls_ssl_get_ciphersuite(&s->ssl));
+
+    if (s->cache_session)
+        schan_save_session(s);
+
     return SEC_E_OK;
 }
 
@@ -714,12 +815,20 @@ void schan_imp_free_certificate_credentials(schan_credentials *c)
 BOOL schan_imp_init(void)
 {
     TRACE("Schannel MBEDTLS schan_imp_init\n");
+    InitializeCriticalSection(&session_cache_cs);
     return TRUE;
 }
 
 void schan_imp_deinit(void)
 {
+    unsigned int i;
+
     WARN("Schannel MBEDTLS schan_imp_deinit\n");
+
+    for (i = 0; i < _countof(session_cache); i++)
+        mbedtls_ssl_session_free(&session_cache[i].session);
+
+    DeleteCriticalSection(&session_cache_cs);
 }
 
 #endif /* SONAME_LIBMBEDTLS && !HAVE_SECURITY_SECURITY_H && !SONAME_LIBGNUTLS */
\ No newline at end of file
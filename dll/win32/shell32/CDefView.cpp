@@ -52,6 +52,48 @@ typedef struct
 } LISTVIEW_SORT_INFO, *LPLISTVIEW_SORT_INFO;
 
 #define SHV_CHANGE_NOTIFY WM_USER + 0x1111
+#define SHV_FILL_ITEMS    WM_USER + 0x1112  /* wParam: fill generation, lParam: HDPA of pidls */
+#define SHV_FILL_DONE     WM_USER + 0x1113  /* wParam: fill generation */
+#define SHV_ICON_DONE     WM_USER + 0x1114  /* lParam: LPDEFVIEW_ICON_REQUEST */
+
+/* The folder is enumerated on a background thread and the items are inserted
+   in batches. The view waits a moment for the enumeration to finish, so small
+   folders are still shown complete and sorted right away */
+#define FILL_WAIT_TIMEOUT   250
+#define FILL_BATCH_SIZE     512
+#define FILL_BATCH_INTERVAL 100
+
+typedef struct
+{
+    LONG            cRef;
+    volatile BOOL   bCancel;
+    HWND            hwnd;
+    UINT            uGeneration;
+    DWORD           dwFlags;
+    IShellFolder   *psf;
+    HANDLE          hDone;          /* Set when all the batches are posted */
+} DEFVIEW_FILL_DATA, *LPDEFVIEW_FILL_DATA;
+
+/* Icons are extracted on a background thread too. The list view asks for the
+   icon of an item when it paints it, so requests are taken newest first and
+   the items on screen are resolved before the ones scrolled away from */
+typedef struct
+{
+    PITEMID_CHILD   pidl;
+    LPARAM          lParam;         /* Item data of the list view item */
+    INT             iImage;
+} DEFVIEW_ICON_REQUEST, *LPDEFVIEW_ICON_REQUEST;
+
+typedef struct
+{
+    LONG            cRef;
+    volatile BOOL   bCancel;
+    BOOL            bThreadRunning;
+    HWND            hwnd;
+    IShellFolder   *psf;
+    CRITICAL_SECTION cs;
+    HDPA            hdpaRequests;
+} DEFVIEW_ICON_QUEUE, *LPDEFVIEW_ICON_QUEUE;
 
 /* For the context menu of the def view, the id of the items are based on 1 because we need
    to call TrackPopupMenu and let it use the 0 value as an indication that the menu was canceled */
@@ -111,10 +153,20 @@ class CDefView :
         CLSID m_Category;
         BOOL  m_Destroyed;
 
+        LPDEFVIEW_FILL_DATA       m_pFillData;          /* Enumeration in progress */
+        UINT                      m_uFillGeneration;
+        BOOL                      m_bFillCheckItems;    /* Items were added while enumerating */
+        LPDEFVIEW_ICON_QUEUE      m_pIconQueue;
+        INT                       m_iFolderIcon;        /* Shown until the icon is extracted */
+
     private:
         HRESULT _MergeToolbar();
         BOOL _Sort();
         VOID _DoFolderViewCB(UINT uMsg, WPARAM wParam, LPARAM lParam);
+        static DWORD WINAPI _FillListThreadProc(LPVOID lpParameter);
+        static DWORD WINAPI _IconThreadProc(LPVOID lpParameter);
+        void _CancelFill();
+        INT _QueueIcon(PCUITEMID_CHILD pidl, LPARAM lParam);
 
     public:
         CDefView();
@@ -270,6 +322,9 @@ class CDefView :
         LRESULT OnCommand(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
         LRESULT OnNotify(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
         LRESULT OnChangeNotify(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
+        LRESULT OnFillItems(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
+        LRESULT OnFillDone(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
+        LRESULT OnIconDone(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
         LRESULT OnCustomItem(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
         LRESULT OnSettingChange(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
         LRESULT OnInitMenuPopup(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
@@ -316,6 +371,9 @@ class CDefView :
         MESSAGE_HANDLER(WM_NOTIFY, OnNotify)
         MESSAGE_HANDLER(WM_COMMAND, OnCommand)
         MESSAGE_HANDLER(SHV_CHANGE_NOTIFY, OnChangeNotify)
+        MESSAGE_HANDLER(SHV_FILL_ITEMS, OnFillItems)
+        MESSAGE_HANDLER(SHV_FILL_DONE, OnFillDone)
+        MESSAGE_HANDLER(SHV_ICON_DONE, OnIconDone)
         MESSAGE_HANDLER(WM_CONTEXTMENU, OnContextMenu)
         MESSAGE_HANDLER(WM_DRAWITEM, OnCustomItem)
         MESSAGE_HANDLER(WM_MEASUREITEM, OnCustomItem)
@@ -378,7 +436,12 @@ CDefView::CDefView() :
     m_iDragOverItem(0),
     m_cScrollDelay(0),
     m_isEditing(FALSE),
-    m_Destroyed(FALSE)
+    m_Destroyed(FALSE),
+    m_pFillData(NULL),
+    m_uFillGeneration(0),
+    m_bFillCheckItems(FALSE),
+    m_pIconQueue(NULL),
+    m_iFolderIcon(0)
 {
     ZeroMemory(&m_FolderSettings, sizeof(m_FolderSettings));
     ZeroMemory(&m_sortInfo, sizeof(m_sortInfo));
@@ -662,6 +725,10 @@ BOOL CDefView::InitList()
     m_ListView.SetImageList(big_icons, LVSIL_NORMAL);
     m_ListView.SetImageList(small_icons, LVSIL_SMALL);
 
+    m_iFolderIcon = SIC_GetIconIndex(swShell32Name, -IDI_SHELL_FOLDER, 0);
+    if (m_iFolderIcon == INVALID_INDEX)
+        m_iFolderIcon = 0;
+
     return TRUE;
 }
 
@@ -821,7 +888,7 @@ BOOLEAN CDefView::LV_RenameItem(PCUITEMID_CHILD pidlOld, PCUITEMID_CHILD pidlNew
         lvItem.iItem = nItem;
         lvItem.iSubItem = 0;
         lvItem.lParam = reinterpret_cast<LPARAM>(ILClone(pidlNew));    /* set the item's data */
-        lvItem.iImage = SHMapPIDLToSystemImageListIndex(m_pSFParent, pidlNew, 0);
+        lvItem.iImage = I_IMAGECALLBACK;                                /* extract the icon again */
         m_ListView.SetItem(&lvItem);
         m_ListView.Update(nItem);
         return TRUE;                    /* FIXME: better handling */
@@ -847,7 +914,7 @@ BOOLEAN CDefView::LV_ProdItem(PCUITEMID_CHILD pidl)
         lvItem.mask = LVIF_IMAGE;
         lvItem.iItem = nItem;
         lvItem.iSubItem = 0;
-        lvItem.iImage = SHMapPIDLToSystemImageListIndex(m_pSFParent, pidl, 0);
+        lvItem.iImage = I_IMAGECALLBACK;
         m_ListView.SetItem(&lvItem);
         m_ListView.Update(nItem);
         return TRUE;
@@ -859,10 +926,26 @@ BOOLEAN CDefView::LV_ProdItem(PCUITEMID_CHILD pidl)
 /**********************************************************
 * ShellView_FillList()
 *
-* - gets the objectlist from the shellfolder
-* - sorts the list
-* - fills the list into the view
+* - gets the objectlist from the shellfolder on a background thread
+* - fills the list into the view in batches
+* - sorts the list once the enumeration is done
 */
+static INT CALLBACK free_pidl(LPVOID ptr, LPVOID arg)
+{
+    SHFree(ptr);
+    return TRUE;
+}
+
+static void FillData_Release(LPDEFVIEW_FILL_DATA pData)
+{
+    if (InterlockedDecrement(&pData->cRef) == 0)
+    {
+        pData->psf->Release();
+        CloseHandle(pData->hDone);
+        HeapFree(GetProcessHeap(), 0, pData);
+    }
+}
+
 INT CALLBACK CDefView::fill_list(LPVOID ptr, LPVOID arg)
 {
     PITEMID_CHILD pidl = static_cast<PITEMID_CHILD>(ptr);
@@ -870,21 +953,91 @@ INT CALLBACK CDefView::fill_list(LPVOID ptr, LPVOID arg)
 
     /* in a commdlg This works as a filemask*/
     if (pThis->IncludeObject(pidl) == S_OK)
-        pThis->LV_AddItem(pidl);
+    {
+        /* A change notification may have added the item already */
+        if (!pThis->m_bFillCheckItems || pThis->LV_FindItemByPidl(pidl) == -1)
+            pThis->LV_AddItem(pidl);
+    }
 
     SHFree(pidl);
     return TRUE;
 }
 
-HRESULT CDefView::FillList()
+DWORD WINAPI CDefView::_FillListThreadProc(LPVOID lpParameter)
 {
-    CComPtr<IEnumIDList> pEnumIDList;
+    LPDEFVIEW_FILL_DATA pData = static_cast<LPDEFVIEW_FILL_DATA>(lpParameter);
+    IEnumIDList  *pEnumIDList;
     PITEMID_CHILD pidl;
     DWORD         dwFetched;
-    HRESULT       hRes;
-    HDPA          hdpa;
+    DWORD         dwLastPost;
+    HDPA          hdpa = NULL;
+
+    TRACE("%p\n", pData);
+
+    /* get the itemlist from the shfolder */
+    if (pData->psf->EnumObjects(pData->hwnd, pData->dwFlags, &pEnumIDList) == S_OK)
+    {
+        dwLastPost = GetTickCount();
+
+        while (!pData->bCancel && (S_OK == pEnumIDList->Next(1, &pidl, &dwFetched)) && dwFetched)
+        {
+            if (!hdpa)
+                hdpa = DPA_Create(FILL_BATCH_SIZE);
+
+            if (!hdpa || DPA_InsertPtr(hdpa, DA_LAST, pidl) == -1)
+            {
+                SHFree(pidl);
+                continue;
+            }
+
+            /* hand over the items regularly, so a slow folder shows them as they come */
+            if (DPA_GetPtrCount(hdpa) >= FILL_BATCH_SIZE ||
+                GetTickCount() - dwLastPost >= FILL_BATCH_INTERVAL)
+            {
+                if (!::PostMessageW(pData->hwnd, SHV_FILL_ITEMS, pData->uGeneration, reinterpret_cast<LPARAM>(hdpa)))
+                    DPA_DestroyCallback(hdpa, free_pidl, NULL);
+                hdpa = NULL;
+                dwLastPost = GetTickCount();
+            }
+        }
+
+        pEnumIDList->Release();
+    }
+
+    if (hdpa)
+    {
+        if (pData->bCancel ||
+            !::PostMessageW(pData->hwnd, SHV_FILL_ITEMS, pData->uGeneration, reinterpret_cast<LPARAM>(hdpa)))
+        {
+            DPA_DestroyCallback(hdpa, free_pidl, NULL);
+        }
+    }
+
+    ::PostMessageW(pData->hwnd, SHV_FILL_DONE, pData->uGeneration, 0);
+    SetEvent(pData->hDone);
+
+    FillData_Release(pData);
+    return 0;
+}
+
+void CDefView::_CancelFill()
+{
+    if (m_pFillData)
+    {
+        m_pFillData->bCancel = TRUE;
+        FillData_Release(m_pFillData);
+        m_pFillData = NULL;
+    }
+    m_bFillCheckItems = FALSE;
+}
+
+HRESULT CDefView::FillList()
+{
+    LPDEFVIEW_FILL_DATA pData;
     HKEY          hKey;
     DWORD         dFlags = SHCONTF_NONFOLDERS | SHCONTF_FOLDERS;
+    DWORD         dwStart, dwElapsed;
+    MSG           msg;
 
     TRACE("%p\n", this);
 
@@ -908,35 +1061,85 @@ HRESULT CDefView::FillList()
         RegCloseKey(hKey);
     }
 
-    /* get the itemlist from the shfolder */
-    hRes = m_pSFParent->EnumObjects(m_hWnd, dFlags, &pEnumIDList);
-    if (hRes != S_OK)
-    {
-        if (hRes == S_FALSE)
-            return(NOERROR);
-        return(hRes);
-    }
+    /* a refresh replaces the enumeration in progress */
+    _CancelFill();
+
+    pData = static_cast<LPDEFVIEW_FILL_DATA>(HeapAlloc(GetProcessHeap(), 0, sizeof(*pData)));
+    if (!pData)
+        return E_OUTOFMEMORY;
 
-    /* create a pointer array */
-    hdpa = DPA_Create(16);
-    if (!hdpa)
+    pData->hDone = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!pData->hDone)
     {
-        return(E_OUTOFMEMORY);
+        HeapFree(GetProcessHeap(), 0, pData);
+        return E_OUTOFMEMORY;
     }
 
-    /* copy the items into the array*/
-    while((S_OK == pEnumIDList->Next(1, &pidl, &dwFetched)) && dwFetched)
+    /* one reference for the view, one for the thread and one while we wait */
+    pData->cRef = 3;
+    pData->bCancel = FALSE;
+    pData->hwnd = m_hWnd;
+    pData->uGeneration = ++m_uFillGeneration;
+    pData->dwFlags = dFlags;
+    pData->psf = m_pSFParent;
+    pData->psf->AddRef();
+
+    m_pFillData = pData;
+    m_bFillCheckItems = (m_ListView.GetItemCount() != 0);
+
+    /* CTF_INSIST enumerates on this thread if no thread can be created */
+    SHCreateThread(_FillListThreadProc, pData, CTF_COINIT | CTF_INSIST, NULL);
+
+    /* wait a moment, still letting through what the enumeration sends us */
+    dwStart = GetTickCount();
+    while ((dwElapsed = GetTickCount() - dwStart) < FILL_WAIT_TIMEOUT)
     {
-        if (DPA_InsertPtr(hdpa, 0x7fff, pidl) == -1)
+        if (MsgWaitForMultipleObjects(1, &pData->hDone, FALSE, FILL_WAIT_TIMEOUT - dwElapsed,
+                                      QS_SENDMESSAGE) != WAIT_OBJECT_0 + 1)
         {
-            SHFree(pidl);
+            break;
         }
+        PeekMessageW(&msg, NULL, 0, 0, PM_NOREMOVE);
+    }
+    FillData_Release(pData);
+
+    /* insert what was found so far, everything if the enumeration is done */
+    while (m_pFillData == pData && PeekMessageW(&msg, m_hWnd, SHV_FILL_ITEMS, SHV_FILL_DONE, PM_REMOVE))
+        DispatchMessageW(&msg);
+
+    return S_OK;
+}
+
+LRESULT CDefView::OnFillItems(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled)
+{
+    HDPA hdpa = reinterpret_cast<HDPA>(lParam);
+
+    /* drop the batches of a cancelled enumeration */
+    if (!m_pFillData || m_pFillData->uGeneration != (UINT)wParam)
+    {
+        DPA_DestroyCallback(hdpa, free_pidl, NULL);
+        return 0;
     }
 
-    /*turn the listview's redrawing off*/
     m_ListView.SetRedraw(FALSE);
+    DPA_DestroyCallback(hdpa, fill_list, this);
+    m_ListView.SetRedraw(TRUE);
+
+    UpdateStatusbar();
+    return 0;
+}
+
+LRESULT CDefView::OnFillDone(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled)
+{
+    if (!m_pFillData || m_pFillData->uGeneration != (UINT)wParam)
+        return 0;
 
-    DPA_DestroyCallback( hdpa, fill_list, this);
+    FillData_Release(m_pFillData);
+    m_pFillData = NULL;
+    m_bFillCheckItems = FALSE;
+
+    /*turn the listview's redrawing off*/
+    m_ListView.SetRedraw(FALSE);
 
     /* sort the array */
     if (m_pSF2Parent)
@@ -955,7 +1158,161 @@ HRESULT CDefView::FillList()
 
     _DoFolderViewCB(SFVM_LISTREFRESHED, NULL, NULL);
 
-    return S_OK;
+    UpdateStatusbar();
+    return 0;
+}
+
+/**********************************************************
+* Background icon extraction
+*
+* - the list view asks for the icon of an item when it is painted
+* - a placeholder is shown, and the item is queued for the icon thread
+* - the icon thread takes the newest request first, which are the items on screen
+*/
+static INT CALLBACK free_icon_request(LPVOID ptr, LPVOID arg)
+{
+    LPDEFVIEW_ICON_REQUEST pRequest = static_cast<LPDEFVIEW_ICON_REQUEST>(ptr);
+
+    SHFree(pRequest->pidl);
+    HeapFree(GetProcessHeap(), 0, pRequest);
+    return TRUE;
+}
+
+static void IconQueue_Release(LPDEFVIEW_ICON_QUEUE pQueue)
+{
+    if (InterlockedDecrement(&pQueue->cRef) == 0)
+    {
+        DPA_DestroyCallback(pQueue->hdpaRequests, free_icon_request, NULL);
+        pQueue->psf->Release();
+        DeleteCriticalSection(&pQueue->cs);
+        HeapFree(GetProcessHeap(), 0, pQueue);
+    }
+}
+
+DWORD WINAPI CDefView::_IconThreadProc(LPVOID lpParameter)
+{
+    LPDEFVIEW_ICON_QUEUE pQueue = static_cast<LPDEFVIEW_ICON_QUEUE>(lpParameter);
+    LPDEFVIEW_ICON_REQUEST pRequest;
+    INT cRequests;
+
+    for (;;)
+    {
+        EnterCriticalSection(&pQueue->cs);
+        cRequests = DPA_GetPtrCount(pQueue->hdpaRequests);
+        if (pQueue->bCancel || cRequests == 0)
+        {
+            /* the next request starts a new thread */
+            pQueue->bThreadRunning = FALSE;
+            LeaveCriticalSection(&pQueue->cs);
+            break;
+        }
+        pRequest = static_cast<LPDEFVIEW_ICON_REQUEST>(DPA_DeletePtr(pQueue->hdpaRequests, cRequests - 1));
+        LeaveCriticalSection(&pQueue->cs);
+
+        pRequest->iImage = SHMapPIDLToSystemImageListIndex(pQueue->psf, pRequest->pidl, 0);
+        if (!::PostMessageW(pQueue->hwnd, SHV_ICON_DONE, 0, reinterpret_cast<LPARAM>(pRequest)))
+            free_icon_request(pRequest, NULL);
+    }
+
+    IconQueue_Release(pQueue);
+    return 0;
+}
+
+INT CDefView::_QueueIcon(PCUITEMID_CHILD pidl, LPARAM lParam)
+{
+    LPDEFVIEW_ICON_REQUEST pRequest;
+    ULONG attributes = SFGAO_FOLDER;
+    INT iPlaceholder = 0;   /* the document icon */
+    BOOL bStart;
+
+    if (!m_pIconQueue)
+    {
+        m_pIconQueue = static_cast<LPDEFVIEW_ICON_QUEUE>(HeapAlloc(GetProcessHeap(), 0, sizeof(*m_pIconQueue)));
+        if (!m_pIconQueue)
+            return SHMapPIDLToSystemImageListIndex(m_pSFParent, pidl, 0);
+
+        m_pIconQueue->hdpaRequests = DPA_Create(64);
+        if (!m_pIconQueue->hdpaRequests)
+        {
+            HeapFree(GetProcessHeap(), 0, m_pIconQueue);
+            m_pIconQueue = NULL;
+            return SHMapPIDLToSystemImageListIndex(m_pSFParent, pidl, 0);
+        }
+
+        m_pIconQueue->cRef = 1;
+        m_pIconQueue->bCancel = FALSE;
+        m_pIconQueue->bThreadRunning = FALSE;
+        m_pIconQueue->hwnd = m_hWnd;
+        m_pIconQueue->psf = m_pSFParent;
+        m_pIconQueue->psf->AddRef();
+        InitializeCriticalSection(&m_pIconQueue->cs);
+    }
+
+    pRequest = static_cast<LPDEFVIEW_ICON_REQUEST>(HeapAlloc(GetProcessHeap(), 0, sizeof(*pRequest)));
+    if (!pRequest)
+        return SHMapPIDLToSystemImageListIndex(m_pSFParent, pidl, 0);
+
+    pRequest->pidl = ILClone(pidl);
+    pRequest->lParam = lParam;
+    pRequest->iImage = INVALID_INDEX;
+    if (!pRequest->pidl)
+    {
+        HeapFree(GetProcessHeap(), 0, pRequest);
+        return SHMapPIDLToSystemImageListIndex(m_pSFParent, pidl, 0);
+    }
+
+    EnterCriticalSection(&m_pIconQueue->cs);
+    if (DPA_InsertPtr(m_pIconQueue->hdpaRequests, DA_LAST, pRequest) == -1)
+    {
+        LeaveCriticalSection(&m_pIconQueue->cs);
+        free_icon_request(pRequest, NULL);
+        return SHMapPIDLToSystemImageListIndex(m_pSFParent, pidl, 0);
+    }
+    bStart = !m_pIconQueue->bThreadRunning;
+    if (bStart)
+    {
+        m_pIconQueue->bThreadRunning = TRUE;
+        InterlockedIncrement(&m_pIconQueue->cRef);
+    }
+    LeaveCriticalSection(&m_pIconQueue->cs);
+
+    /* CTF_INSIST extracts the icons on this thread if no thread can be created */
+    if (bStart)
+        SHCreateThread(_IconThreadProc, m_pIconQueue, CTF_COINIT | CTF_INSIST, NULL);
+
+    if (SUCCEEDED(m_pSFParent->GetAttributesOf(1, &pidl, &attributes)) && (attributes & SFGAO_FOLDER))
+        iPlaceholder = m_iFolderIcon;
+
+    return iPlaceholder;
+}
+
+LRESULT CDefView::OnIconDone(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled)
+{
+    LPDEFVIEW_ICON_REQUEST pRequest = reinterpret_cast<LPDEFVIEW_ICON_REQUEST>(lParam);
+    LVFINDINFOW lvfi;
+    LVITEMW lvItem;
+    HRESULT hr;
+    int nItem;
+
+    /* the item may have been removed or renamed since */
+    lvfi.flags = LVFI_PARAM;
+    lvfi.lParam = pRequest->lParam;
+    nItem = (int)m_ListView.SendMessageW(LVM_FINDITEMW, -1, reinterpret_cast<LPARAM>(&lvfi));
+    if (nItem != -1)
+    {
+        hr = m_pSFParent->CompareIDs(0, pRequest->pidl, _PidlByItem(nItem));
+        if (SUCCEEDED(hr) && !HRESULT_CODE(hr))
+        {
+            lvItem.mask = LVIF_IMAGE;
+            lvItem.iItem = nItem;
+            lvItem.iSubItem = 0;
+            lvItem.iImage = pRequest->iImage;
+            m_ListView.SetItem(&lvItem);
+        }
+    }
+
+    free_icon_request(pRequest, NULL);
+    return 0;
 }
 
 LRESULT CDefView::OnShowWindow(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled)
@@ -975,6 +1332,17 @@ LRESULT CDefView::OnDestroy(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHand
     if (!m_Destroyed)
     {
         m_Destroyed = TRUE;
+        _CancelFill();
+        if (m_pIconQueue)
+        {
+            m_pIconQueue->bCancel = TRUE;
+            IconQueue_Release(m_pIconQueue);
+            m_pIconQueue = NULL;
+        }
+        /* free the results the threads posted already */
+        MSG msg;
+        while (PeekMessageW(&msg, m_hWnd, SHV_FILL_ITEMS, SHV_ICON_DONE, PM_REMOVE))
+            DispatchMessageW(&msg);
         if (m_hMenu)
         {
             DestroyMenu(m_hMenu);
@@ -1745,7 +2113,8 @@ LRESULT CDefView::OnNotify(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandl
             }
             if(lpdi->item.mask & LVIF_IMAGE)    /* image requested */
             {
-                lpdi->item.iImage = SHMapPIDLToSystemImageListIndex(m_pSFParent, pidl, 0);
+                /* a placeholder until the icon thread extracted the icon */
+                lpdi->item.iImage = _QueueIcon(pidl, lpdi->item.lParam);
             }
             if(lpdi->item.mask & LVIF_STATE)
             {
@@ -1915,6 +2284,10 @@ LRESULT CDefView::OnChangeNotify(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &
 
     TRACE("(%p)(%p,%p,0x%08x)\n", this, Pidls[0], Pidls[1], lParam);
 
+    /* the enumeration in progress may find the items added now */
+    if (m_pFillData)
+        m_bFillCheckItems = TRUE;
+
     switch (lParam &~ SHCNE_INTERRUPT)
     {
         case SHCNE_MKDIR:
@@ -341,6 +341,17 @@ static INT SIC_IconAppend (LPCWSTR sSourceFile, INT dwSourceIndex, HICON hSmallI
 
     EnterCriticalSection(&SHELL32_SicCS);
 
+    /* Another thread may have loaded the same icon meanwhile */
+    indexDPA = DPA_Search (sic_hdpa, lpsice, 0, SIC_CompareEntries, 0, DPAS_SORTED);
+    if ( -1 != indexDPA )
+    {
+        ret = ((LPSIC_ENTRY)DPA_GetPtr(sic_hdpa, indexDPA))->dwListIndex;
+        HeapFree(GetProcessHeap(), 0, lpsice->sSourceFile);
+        SHFree(lpsice);
+        LeaveCriticalSection(&SHELL32_SicCS);
+        return ret;
+    }
+
     indexDPA = DPA_Search (sic_hdpa, lpsice, 0, SIC_CompareEntries, 0, DPAS_SORTED|DPAS_INSERTAFTER);
     indexDPA = DPA_InsertPtr(sic_hdpa, indexDPA, lpsice);
     if ( -1 == indexDPA )
@@ -466,14 +477,15 @@ INT SIC_GetIconIndex (LPCWSTR sSourceFile, INT dwSourceIndex, DWORD dwFlags )
 
     if ( INVALID_INDEX == index )
     {
-          ret = SIC_LoadIcon (sSourceFile, dwSourceIndex, dwFlags);
-    }
-    else
-    {
-      TRACE("-- found\n");
-      ret = ((LPSIC_ENTRY)DPA_GetPtr(sic_hdpa, index))->dwListIndex;
+          /* Don't hold the lock while extracting the icon, views look up
+             the cache from the UI thread while their icon thread loads */
+          LeaveCriticalSection(&SHELL32_SicCS);
+          return SIC_LoadIcon (sSourceFile, dwSourceIndex, dwFlags);
     }
 
+    TRACE("-- found\n");
+    ret = ((LPSIC_ENTRY)DPA_GetPtr(sic_hdpa, index))->dwListIndex;
+
     LeaveCriticalSection(&SHELL32_SicCS);
     return ret;
 }
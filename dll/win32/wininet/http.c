@@ -310,6 +310,20 @@ server_t *get_server(substr_t name, INTERNET_PORT port, BOOL is_https, BOOL do_c
     return server;
 }
 
+#ifdef __REACTOS__
+/* keep_until holds a GetTickCount value here, compare the difference so that
+ * the pool keeps working when the tick count wraps around */
+static inline BOOL is_netconn_expired(netconn_t *netconn, DWORD64 now)
+{
+    return (LONG)((DWORD)netconn->keep_until - (DWORD)now) < 0;
+}
+#else
+static inline BOOL is_netconn_expired(netconn_t *netconn, DWORD64 now)
+{
+    return netconn->keep_until < now;
+}
+#endif
+
 BOOL collect_connections(collect_type_t collect_type)
 {
     netconn_t *netconn, *netconn_safe;
@@ -325,7 +339,7 @@ BOOL collect_connections(collect_type_t collect_type)
 
     LIST_FOR_EACH_ENTRY_SAFE(server, server_safe, &connection_pool, server_t, entry) {
         LIST_FOR_EACH_ENTRY_SAFE(netconn, netconn_safe, &server->conn_pool, netconn_t, pool_entry) {
-            if(collect_type > COLLECT_TIMEOUT || netconn->keep_until < now) {
+            if(collect_type > COLLECT_TIMEOUT || is_netconn_expired(netconn, now)) {
                 TRACE("freeing %p\n", netconn);
                 list_remove(&netconn->pool_entry);
                 free_netconn(netconn);
@@ -1955,7 +1969,6 @@ static void http_release_netconn(http_request_t *req, BOOL reuse)
     if(!is_valid_netconn(req->netconn))
         return;
 
-#ifndef __REACTOS__
     if(reuse && req->netconn->keep_alive) {
         BOOL run_collector;
 
@@ -1990,10 +2003,6 @@ static void http_release_netconn(http_request_t *req, BOOL reuse)
         }
         return;
     }
-#else
-    /* Silence unused function warning */
-    (void)collect_connections_proc;
-#endif
 
     INTERNET_SendCallback(&req->hdr, req->hdr.dwContext,
                           INTERNET_STATUS_CLOSING_CONNECTION, 0, 0);
@@ -83,6 +83,10 @@ static const char urlcache_ver[] = "0.2012001";
 #define CACHE_CONTAINER_NO_SUBDIR   0xFE
 
 #define CACHE_HEADER_DATA_ROOT_LEAK_OFFSET 0x16
+/* bumped whenever an entry is added to the hash tables */
+#define CACHE_HEADER_DATA_HASH_GENERATION  0x17
+
+#define LOOKUP_MIN_SIZE         256
 
 #define FILETIME_SECOND 10000000
 
@@ -189,6 +193,10 @@ typedef struct
     DWORD file_size; /* size of file when mapping was opened */
     HANDLE mutex; /* handle of mutex */
     DWORD default_entry_type;
+    DWORD *lookup; /* open addressing table of index offsets of hash entries */
+    DWORD lookup_size; /* number of slots in lookup, power of 2 */
+    DWORD lookup_count; /* number of used slots in lookup */
+    DWORD lookup_generation; /* hash generation of the index lookup matches */
 } cache_container;
 
 typedef struct
@@ -486,6 +494,9 @@ static DWORD cache_container_set_size(cache_container *container, HANDLE file, D
 
     urlcache_create_hash_table(header, NULL, &hashtable_entry);
 
+    /* Don't let lookups built for a previous index match this one */
+    header->options[CACHE_HEADER_DATA_HASH_GENERATION] = GetTickCount();
+
     /* Last step - create the directories */
     strcpyW(dir_path, container->path);
     dir_name = dir_path + strlenW(dir_path);
@@ -688,6 +699,11 @@ static void cache_container_close_index(cache_container *pContainer)
 {
     CloseHandle(pContainer->mapping);
     pContainer->mapping = NULL;
+
+    heap_free(pContainer->lookup);
+    pContainer->lookup = NULL;
+    pContainer->lookup_size = 0;
+    pContainer->lookup_count = 0;
 }
 
 static BOOL cache_containers_add(const char *cache_prefix, LPCWSTR path,
@@ -704,6 +720,10 @@ static BOOL cache_containers_add(const char *cache_prefix, LPCWSTR path,
     pContainer->mapping = NULL;
     pContainer->file_size = 0;
     pContainer->default_entry_type = default_entry_type;
+    pContainer->lookup = NULL;
+    pContainer->lookup_size = 0;
+    pContainer->lookup_count = 0;
+    pContainer->lookup_generation = 0;
 
     pContainer->path = heap_strdupW(path);
     if (!pContainer->path)
@@ -1524,7 +1544,29 @@ static inline entry_hash_table* urlcache_get_hash_table(const urlcache_header *p
     return (entry_hash_table*)((LPBYTE)pHeader + dwOffset);
 }
 
-static BOOL urlcache_find_hash_entry(const urlcache_header *pHeader, LPCSTR lpszUrl, struct hash_entry **ppHashEntry)
+static BOOL urlcache_hash_entry_matches(const urlcache_header *header, const struct hash_entry *hash_entry,
+        DWORD key, LPCSTR url)
+{
+    const entry_url *url_entry;
+
+    if(hash_entry->key == HASHTABLE_FREE || hash_entry->key == HASHTABLE_DEL)
+        return FALSE;
+    if(key != hash_entry->key>>HASHTABLE_FLAG_BITS)
+        return FALSE;
+    if(hash_entry->offset >= header->size)
+        return FALSE;
+
+    /* only part of the hash is kept in the key, so make sure that
+     * this is the right entry when it's an url entry */
+    url_entry = (const entry_url*)((const BYTE*)header + hash_entry->offset);
+    if(url_entry->header.signature == URL_SIGNATURE &&
+            strcmp((const char*)url_entry + url_entry->url_off, url))
+        return FALSE;
+
+    return TRUE;
+}
+
+static BOOL urlcache_scan_hash_tables(const urlcache_header *pHeader, LPCSTR lpszUrl, struct hash_entry **ppHashEntry)
 {
     /* structure of hash table:
      *  448 entries divided into 64 blocks
@@ -1564,14 +1606,8 @@ static BOOL urlcache_find_hash_entry(const urlcache_header *pHeader, LPCSTR lpsz
         for (i = 0; i < HASHTABLE_BLOCKSIZE; i++)
         {
             struct hash_entry *pHashElement = &pHashEntry->hash_table[offset + i];
-            if (key == pHashElement->key>>HASHTABLE_FLAG_BITS)
+            if (urlcache_hash_entry_matches(pHeader, pHashElement, key, lpszUrl))
             {
-                /* FIXME: we should make sure that this is the right element
-                 * before returning and claiming that it is. We can do this
-                 * by doing a simple compare between the URL we were given
-                 * and the URL stored in the entry. However, this assumes
-                 * we know the format of all the entries stored in the
-                 * hash table */
                 *ppHashEntry = pHashElement;
                 return TRUE;
             }
@@ -1580,6 +1616,123 @@ static BOOL urlcache_find_hash_entry(const urlcache_header *pHeader, LPCSTR lpsz
     return FALSE;
 }
 
+/***********************************************************************
+ *           urlcache_lookup_* (Internal)
+ *
+ *  The hash tables in the index only have 64 buckets each and get chained
+ * as the cache grows, so finding an url means walking every table in the
+ * file. To keep lookups fast the container keeps its own open addressing
+ * table of the index offsets of all hash entries, sized to the number of
+ * entries. It's valid as long as the hash generation in the index header
+ * matches; other processes bump it when they add entries, the lookup is
+ * rebuilt on the next use then. Deleted entries are only dropped on a
+ * rebuild, every hit is checked against the index anyway.
+ */
+static inline DWORD urlcache_lookup_slot(const cache_container *container, DWORD key)
+{
+    return (key * 0x9e3779b1) & (container->lookup_size-1);
+}
+
+static void urlcache_lookup_insert(cache_container *container, const urlcache_header *header, DWORD hash_entry_off)
+{
+    const struct hash_entry *hash_entry = (const struct hash_entry*)((const BYTE*)header + hash_entry_off);
+    DWORD i;
+
+    /* keep at least half of the slots free, so that probe chains stay short */
+    if((container->lookup_count+1)*2 > container->lookup_size) {
+        heap_free(container->lookup);
+        container->lookup = NULL;
+        return;
+    }
+
+    for(i = urlcache_lookup_slot(container, hash_entry->key>>HASHTABLE_FLAG_BITS);
+            container->lookup[i]; i = (i+1) & (container->lookup_size-1)) {
+        /* deleted slots get reused by new entries */
+        if(container->lookup[i] == hash_entry_off)
+            return;
+    }
+
+    container->lookup[i] = hash_entry_off;
+    container->lookup_count++;
+}
+
+static BOOL urlcache_lookup_build(cache_container *container, const urlcache_header *header)
+{
+    entry_hash_table *hash_table;
+    DWORD entries = 0, id, size, i;
+
+    heap_free(container->lookup);
+    container->lookup = NULL;
+    container->lookup_count = 0;
+
+    for(id = 0, hash_table = urlcache_get_hash_table(header, header->hash_table_off);
+            hash_table; hash_table = urlcache_get_hash_table(header, hash_table->next), id++) {
+        if(hash_table->id != id || hash_table->header.signature != HASH_SIGNATURE)
+            return FALSE;
+
+        for(i = 0; i < HASHTABLE_SIZE; i++) {
+            if(hash_table->hash_table[i].key != HASHTABLE_FREE && hash_table->hash_table[i].key != HASHTABLE_DEL)
+                entries++;
+        }
+    }
+
+    for(size = LOOKUP_MIN_SIZE; size < entries*4; size *= 2);
+
+    container->lookup = heap_alloc_zero(size*sizeof(DWORD));
+    if(!container->lookup)
+        return FALSE;
+    container->lookup_size = size;
+    container->lookup_generation = header->options[CACHE_HEADER_DATA_HASH_GENERATION];
+
+    for(hash_table = urlcache_get_hash_table(header, header->hash_table_off);
+            hash_table; hash_table = urlcache_get_hash_table(header, hash_table->next)) {
+        for(i = 0; i < HASHTABLE_SIZE; i++) {
+            if(hash_table->hash_table[i].key != HASHTABLE_FREE && hash_table->hash_table[i].key != HASHTABLE_DEL)
+                urlcache_lookup_insert(container, header, (BYTE*)&hash_table->hash_table[i] - (BYTE*)header);
+        }
+    }
+
+    TRACE("%d entries in %d slots\n", container->lookup_count, container->lookup_size);
+    return TRUE;
+}
+
+/* Records that hash_entry was added to the index */
+static void urlcache_lookup_add(cache_container *container, urlcache_header *header, struct hash_entry *hash_entry)
+{
+    BOOL up_to_date = container->lookup &&
+        container->lookup_generation == header->options[CACHE_HEADER_DATA_HASH_GENERATION];
+
+    header->options[CACHE_HEADER_DATA_HASH_GENERATION]++;
+
+    if(up_to_date) {
+        urlcache_lookup_insert(container, header, (BYTE*)hash_entry - (BYTE*)header);
+        container->lookup_generation = header->options[CACHE_HEADER_DATA_HASH_GENERATION];
+    }
+}
+
+static BOOL urlcache_find_hash_entry(cache_container *container, const urlcache_header *header,
+        LPCSTR url, struct hash_entry **hash_entry)
+{
+    DWORD key = urlcache_hash_key(url) >> HASHTABLE_FLAG_BITS;
+    DWORD i;
+
+    if((!container->lookup || container->lookup_generation != header->options[CACHE_HEADER_DATA_HASH_GENERATION])
+            && !urlcache_lookup_build(container, header))
+        return urlcache_scan_hash_tables(header, url, hash_entry);
+
+    for(i = urlcache_lookup_slot(container, key); container->lookup[i];
+            i = (i+1) & (container->lookup_size-1)) {
+        struct hash_entry *entry = (struct hash_entry*)((BYTE*)header + container->lookup[i]);
+
+        if(urlcache_hash_entry_matches(header, entry, key, url)) {
+            *hash_entry = entry;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
 /***********************************************************************
  *           urlcache_hash_entry_set_flags (Internal)
  *
@@ -1623,9 +1776,10 @@ static BOOL urlcache_hash_entry_delete(struct hash_entry *pHashEntry)
  *    Any other Win32 error code if the entry could not be added
  *
  */
-static DWORD urlcache_hash_entry_create(urlcache_header *pHeader, LPCSTR lpszUrl, DWORD dwOffsetEntry, DWORD dwFieldType)
+static DWORD urlcache_hash_entry_create(cache_container *pContainer, urlcache_header *pHeader, LPCSTR lpszUrl,
+        DWORD dwOffsetEntry, DWORD dwFieldType)
 {
-    /* see urlcache_find_hash_entry for structure of hash tables */
+    /* see urlcache_scan_hash_tables for structure of hash tables */
 
     DWORD key = urlcache_hash_key(lpszUrl);
     DWORD offset = (key & (HASHTABLE_NUM_ENTRIES-1)) * HASHTABLE_BLOCKSIZE;
@@ -1660,6 +1814,7 @@ static DWORD urlcache_hash_entry_create(urlcache_header *pHeader, LPCSTR lpszUrl
             {
                 pHashElement->key = key;
                 pHashElement->offset = dwOffsetEntry;
+                urlcache_lookup_add(pContainer, pHeader, pHashElement);
                 return ERROR_SUCCESS;
             }
         }
@@ -1670,6 +1825,7 @@ static DWORD urlcache_hash_entry_create(urlcache_header *pHeader, LPCSTR lpszUrl
 
     pHashEntry->hash_table[offset].key = key;
     pHashEntry->hash_table[offset].offset = dwOffsetEntry;
+    urlcache_lookup_add(pContainer, pHeader, &pHashEntry->hash_table[offset]);
     return ERROR_SUCCESS;
 }
 
@@ -1827,7 +1983,7 @@ static BOOL urlcache_get_entry_info(const char *url, void *entry_info,
     if(!(header = cache_container_lock_index(container)))
         return FALSE;
 
-    if(!urlcache_find_hash_entry(header, url, &hash_entry)) {
+    if(!urlcache_find_hash_entry(container, header, url, &hash_entry)) {
         cache_container_unlock_index(container, header);
         WARN("entry %s not found!\n", debugstr_a(url));
         SetLastError(ERROR_FILE_NOT_FOUND);
@@ -2058,7 +2214,7 @@ BOOL WINAPI SetUrlCacheEntryInfoA(LPCSTR lpszUrlName,
     if (!(pHeader = cache_container_lock_index(pContainer)))
         return FALSE;
 
-    if (!urlcache_find_hash_entry(pHeader, lpszUrlName, &pHashEntry))
+    if (!urlcache_find_hash_entry(pContainer, pHeader, lpszUrlName, &pHashEntry))
     {
         cache_container_unlock_index(pContainer, pHeader);
         WARN("entry %s not found!\n", debugstr_a(lpszUrlName));
@@ -2130,7 +2286,7 @@ static BOOL urlcache_entry_get_file(const char *url, void *entry_info, DWORD *si
     if (!(header = cache_container_lock_index(container)))
         return FALSE;
 
-    if (!urlcache_find_hash_entry(header, url, &hash_entry)) {
+    if (!urlcache_find_hash_entry(container, header, url, &hash_entry)) {
         cache_container_unlock_index(container, header);
         TRACE("entry %s not found!\n", debugstr_a(url));
         SetLastError(ERROR_FILE_NOT_FOUND);
@@ -2434,7 +2590,7 @@ BOOL WINAPI FreeUrlCacheSpaceW(LPCWSTR cache_path, DWORD size, DWORD filter)
         entry_url *url_entry;
         ULONGLONG desired_size, cur_size;
         DWORD delete_factor, hash_table_off, hash_table_entry;
-        DWORD rate[100], rate_no;
+        DWORD rate[100], rate_no, rated_no;
         FILETIME cur_time;
 
         if((path_len || container->cache_prefix[0]!=0) &&
@@ -2467,9 +2623,11 @@ BOOL WINAPI FreeUrlCacheSpaceW(LPCWSTR cache_path, DWORD size, DWORD filter)
         hash_table_off = 0;
         hash_table_entry = 0;
         rate_no = 0;
+        rated_no = 0;
         GetSystemTimeAsFileTime(&cur_time);
-        while(rate_no<sizeof(rate)/sizeof(*rate) &&
-                urlcache_next_entry(header, &hash_table_off, &hash_table_entry, &hash_entry, &entry)) {
+        while(urlcache_next_entry(header, &hash_table_off, &hash_table_entry, &hash_entry, &entry)) {
+            DWORD entry_rate;
+
             if(entry->signature != URL_SIGNATURE) {
                 WARN("only url entries are currently supported\n");
                 continue;
@@ -2479,9 +2637,17 @@ BOOL WINAPI FreeUrlCacheSpaceW(LPCWSTR cache_path, DWORD size, DWORD filter)
             if(url_entry->cache_entry_type & filter)
                 continue;
 
-            rate[rate_no] = urlcache_rate_entry(url_entry, &cur_time);
-            if(rate[rate_no] != -1)
-                rate_no++;
+            entry_rate = urlcache_rate_entry(url_entry, &cur_time);
+            if(entry_rate == -1)
+                continue;
+
+            /* Sample the ratings of the whole cache, not just of the
+             * entries that happen to be at the start of the index */
+            rated_no++;
+            if(rate_no < sizeof(rate)/sizeof(*rate))
+                rate[rate_no++] = entry_rate;
+            else if(((rand() << 15) | rand()) % rated_no < rate_no)
+                rate[rand() % rate_no] = entry_rate;
         }
 
         if(!rate_no) {
@@ -2586,7 +2752,7 @@ BOOL WINAPI UnlockUrlCacheEntryFileA(LPCSTR lpszUrlName, DWORD dwReserved)
     if (!(pHeader = cache_container_lock_index(pContainer)))
         return FALSE;
 
-    if (!urlcache_find_hash_entry(pHeader, lpszUrlName, &pHashEntry))
+    if (!urlcache_find_hash_entry(pContainer, pHeader, lpszUrlName, &pHashEntry))
     {
         cache_container_unlock_index(pContainer, pHeader);
         TRACE("entry %s not found!\n", debugstr_a(lpszUrlName));
@@ -2906,7 +3072,7 @@ static BOOL urlcache_entry_commit(const char *url, const WCHAR *file_name,
     if(!(header = cache_container_lock_index(container)))
         return FALSE;
 
-    if(urlcache_find_hash_entry(header, url, &hash_entry)) {
+    if(urlcache_find_hash_entry(container, header, url, &hash_entry)) {
         entry_url *url_entry = (entry_url*)((LPBYTE)header + hash_entry->offset);
 
         if(urlcache_hash_entry_is_locked(hash_entry, url_entry)) {
@@ -3039,12 +3205,12 @@ static BOOL urlcache_entry_commit(const char *url, const WCHAR *file_name,
     if(file_ext_off)
         strcpy((LPSTR)((LPBYTE)url_entry + file_ext_off), file_ext);
 
-    error = urlcache_hash_entry_create(header, url, url_entry_offset, HASHTABLE_URL);
+    error = urlcache_hash_entry_create(container, header, url, url_entry_offset, HASHTABLE_URL);
     while(error == ERROR_HANDLE_DISK_FULL) {
         error = cache_container_clean_index(container, &header);
         if(error == ERROR_SUCCESS) {
             url_entry = (entry_url *)((LPBYTE)header + url_entry_offset);
-            error = urlcache_hash_entry_create(header, url,
+            error = urlcache_hash_entry_create(container, header, url,
                     url_entry_offset, HASHTABLE_URL);
         }
     }
@@ -3333,7 +3499,7 @@ BOOL WINAPI DeleteUrlCacheEntryA(LPCSTR lpszUrlName)
     if (!(pHeader = cache_container_lock_index(pContainer)))
         return FALSE;
 
-    if (!urlcache_find_hash_entry(pHeader, lpszUrlName, &pHashEntry))
+    if (!urlcache_find_hash_entry(pContainer, pHeader, lpszUrlName, &pHashEntry))
     {
         cache_container_unlock_index(pContainer, pHeader);
         TRACE("entry %s not found!\n", debugstr_a(lpszUrlName));
@@ -3934,7 +4100,7 @@ BOOL WINAPI IsUrlCacheEntryExpiredA(LPCSTR url, DWORD dwFlags, FILETIME* pftLast
         return TRUE;
     }
 
-    if (!urlcache_find_hash_entry(pHeader, url, &pHashEntry))
+    if (!urlcache_find_hash_entry(pContainer, pHeader, url, &pHashEntry))
     {
         cache_container_unlock_index(pContainer, pHeader);
         memset(pftLastModified, 0, sizeof(*pftLastModified));
@@ -10,6 +10,11 @@
 #define WINSOCK_ROOT "System\\CurrentControlSet\\Services\\WinSock2\\Parameters"
 #define MAXALIASES 35
 
+/* Catalog snapshots shared between processes, see wsautil.c */
+#define WS_SNAPSHOT_SIGNATURE   'tanS'
+#define WS_TC_SNAPSHOT_NAME     "Protocol_Catalog"
+#define WS_NC_SNAPSHOT_NAME     "NameSpace_Catalog"
+
 typedef enum _WSASYNCOPS
 {
     WsAsyncGetHostByAddr,
@@ -82,6 +87,35 @@ typedef struct _TPROVIDER
     WSPUPCALLTABLE UpcallTable;
 } TPROVIDER, *PTPROVIDER;
 
+typedef struct _WS_CATALOG_SNAPSHOT
+{
+    DWORD Signature;
+    DWORD Size;
+    DWORD UniqueId;
+    DWORD NextId;
+    DWORD EntryCount;
+    volatile LONG Complete;
+} WS_CATALOG_SNAPSHOT, *PWS_CATALOG_SNAPSHOT;
+
+typedef struct _WS_TC_SNAPSHOT_ENTRY
+{
+    CHAR DllPath[MAX_PATH];
+    WSAPROTOCOL_INFOW ProtocolInfo;
+} WS_TC_SNAPSHOT_ENTRY, *PWS_TC_SNAPSHOT_ENTRY;
+
+typedef struct _WS_NC_SNAPSHOT_ENTRY
+{
+    DWORD Size;
+    LONG AddressFamily;
+    DWORD NamespaceId;
+    DWORD Version;
+    BOOLEAN Enabled;
+    BOOLEAN StoresServiceClassInfo;
+    GUID ProviderId;
+    WCHAR DllPath[MAX_PATH];
+    WCHAR ProviderName[ANYSIZE_ARRAY];
+} WS_NC_SNAPSHOT_ENTRY, *PWS_NC_SNAPSHOT_ENTRY;
+
 typedef struct _TCATALOG_ENTRY
 {
     LIST_ENTRY CatalogLink;
@@ -98,6 +132,7 @@ typedef struct _TCATALOG
     DWORD UniqueId;
     DWORD NextId;
     HKEY CatalogKey;
+    HANDLE SnapshotSection;
     CRITICAL_SECTION Lock;
     BOOLEAN Initialized;
 } TCATALOG, *PTCATALOG;
@@ -139,6 +174,7 @@ typedef struct _NSCATALOG
     DWORD ItemCount;
     DWORD UniqueId;
     HKEY CatalogKey;
+    HANDLE SnapshotSection;
     CRITICAL_SECTION Lock;
 } NSCATALOG, *PNSCATALOG;
 
@@ -363,6 +399,28 @@ BOOL
 WSAAPI
 WsCheckCatalogState(IN HANDLE Event);
 
+PWS_CATALOG_SNAPSHOT
+WSAAPI
+WsOpenCatalogSnapshot(IN LPCSTR CatalogName,
+                      IN DWORD UniqueId,
+                      OUT PHANDLE SectionHandle);
+
+PWS_CATALOG_SNAPSHOT
+WSAAPI
+WsCreateCatalogSnapshot(IN LPCSTR CatalogName,
+                        IN DWORD UniqueId,
+                        IN DWORD Size,
+                        OUT PHANDLE SectionHandle);
+
+VOID
+WSAAPI
+WsPublishCatalogSnapshot(IN PWS_CATALOG_SNAPSHOT Snapshot);
+
+VOID
+WSAAPI
+WsSetCatalogSnapshot(IN PHANDLE CatalogSection,
+                     IN HANDLE SectionHandle);
+
 PNSCATALOG
 WSAAPI
 WsNcAllocate(VOID);
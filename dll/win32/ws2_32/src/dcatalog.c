@@ -220,6 +220,217 @@ WsTcInitializeFromRegistry(IN PTCATALOG Catalog,
     return ErrorCode;
 }
 
+static
+DWORD
+WsTcReadRegistryEntries(IN HKEY CatalogKey,
+                        IN PLIST_ENTRY List,
+                        OUT PDWORD NextId)
+{
+    INT ErrorCode = ERROR_SUCCESS;
+    HKEY EntriesKey;
+    DWORD CatalogEntries;
+    PTCATALOG_ENTRY CatalogEntry;
+    DWORD RegType = REG_DWORD;
+    DWORD RegSize = sizeof(DWORD);
+    DWORD i;
+
+    /* Now Open the Entries */
+    ErrorCode = RegOpenKeyEx(CatalogKey,
+                             "Catalog_Entries",
+                             0,
+                             MAXIMUM_ALLOWED,
+                             &EntriesKey);
+    if (ErrorCode != ERROR_SUCCESS) return WSASYSCALLFAILURE;
+
+    /* Get the next entry */
+    ErrorCode = RegQueryValueEx(CatalogKey,
+                                "Next_Catalog_Entry_ID",
+                                0,
+                                &RegType,
+                                (LPBYTE)NextId,
+                                &RegSize);
+    if (ErrorCode != ERROR_SUCCESS)
+    {
+        /* Critical failure */
+        RegCloseKey(EntriesKey);
+        return WSASYSCALLFAILURE;
+    }
+
+    /* Find out how many there are */
+    ErrorCode = RegQueryValueEx(CatalogKey,
+                                "Num_Catalog_Entries",
+                                0,
+                                &RegType,
+                                (LPBYTE)&CatalogEntries,
+                                &RegSize);
+    if (ErrorCode != ERROR_SUCCESS)
+    {
+        /* Critical failure */
+        RegCloseKey(EntriesKey);
+        return WSASYSCALLFAILURE;
+    }
+
+    /* Initialize them all */
+    for (i = 1; i <= CatalogEntries; i++)
+    {
+        /* Allocate a Catalog Entry Structure */
+        CatalogEntry = WsTcEntryAllocate();
+        if (!CatalogEntry)
+        {
+            /* Not enough memory, fail */
+            ErrorCode = WSA_NOT_ENOUGH_MEMORY;
+            break;
+        }
+
+        /* Initialize it from the Registry Key */
+        ErrorCode = WsTcEntryInitializeFromRegistry(CatalogEntry,
+                                                    EntriesKey,
+                                                    i);
+        if (ErrorCode != ERROR_SUCCESS)
+        {
+            /* We failed to get it, dereference the entry and leave */
+            WsTcEntryDereference(CatalogEntry);
+            break;
+        }
+
+        /* Insert it to our List */
+        InsertTailList(List, &CatalogEntry->CatalogLink);
+    }
+
+    /* Close the catalog key */
+    RegCloseKey(EntriesKey);
+    return ErrorCode;
+}
+
+static
+VOID
+WsTcFreeLocalList(IN PLIST_ENTRY List)
+{
+    PLIST_ENTRY Entry;
+    PTCATALOG_ENTRY CatalogEntry;
+
+    /* Free everything we read */
+    while (!IsListEmpty(List))
+    {
+        /* Get the LP Catalog Item */
+        Entry = RemoveHeadList(List);
+        CatalogEntry = CONTAINING_RECORD(Entry, TCATALOG_ENTRY, CatalogLink);
+
+        /* Dereference it */
+        WsTcEntryDereference(CatalogEntry);
+    }
+}
+
+static
+BOOL
+WsTcReadSnapshot(IN PTCATALOG Catalog,
+                 IN DWORD UniqueId,
+                 IN PLIST_ENTRY List,
+                 OUT PDWORD NextId)
+{
+    PWS_CATALOG_SNAPSHOT Snapshot;
+    PWS_TC_SNAPSHOT_ENTRY SnapshotEntry;
+    PTCATALOG_ENTRY CatalogEntry;
+    HANDLE SectionHandle;
+    DWORD i;
+
+    /* Check if another process already read this version of the catalog */
+    Snapshot = WsOpenCatalogSnapshot(WS_TC_SNAPSHOT_NAME,
+                                     UniqueId,
+                                     &SectionHandle);
+    if (!Snapshot) return FALSE;
+
+    /* Make sure all the entries are inside it */
+    if (Snapshot->EntryCount > (Snapshot->Size - sizeof(*Snapshot)) /
+                               sizeof(*SnapshotEntry))
+    {
+        /* It's corrupted, use the registry */
+        UnmapViewOfFile(Snapshot);
+        CloseHandle(SectionHandle);
+        return FALSE;
+    }
+
+    /* Copy the entries out of it */
+    SnapshotEntry = (PWS_TC_SNAPSHOT_ENTRY)(Snapshot + 1);
+    for (i = 0; i < Snapshot->EntryCount; i++)
+    {
+        /* Allocate a Catalog Entry Structure */
+        CatalogEntry = WsTcEntryAllocate();
+        if (!CatalogEntry) break;
+
+        /* Initialize it from the snapshot */
+        RtlCopyMemory(CatalogEntry->DllPath,
+                      SnapshotEntry[i].DllPath,
+                      sizeof(CatalogEntry->DllPath));
+        CatalogEntry->DllPath[MAX_PATH - 1] = ANSI_NULL;
+        CatalogEntry->ProtocolInfo = SnapshotEntry[i].ProtocolInfo;
+
+        /* Insert it to our List */
+        InsertTailList(List, &CatalogEntry->CatalogLink);
+    }
+
+    /* Check if we got all of them */
+    if (i != Snapshot->EntryCount)
+    {
+        /* Not enough memory, let the registry path deal with it */
+        WsTcFreeLocalList(List);
+        UnmapViewOfFile(Snapshot);
+        CloseHandle(SectionHandle);
+        return FALSE;
+    }
+
+    /* Done with it, but keep it around for the processes after us */
+    *NextId = Snapshot->NextId;
+    UnmapViewOfFile(Snapshot);
+    WsSetCatalogSnapshot(&Catalog->SnapshotSection, SectionHandle);
+    return TRUE;
+}
+
+static
+VOID
+WsTcWriteSnapshot(IN PTCATALOG Catalog,
+                  IN DWORD UniqueId,
+                  IN DWORD NextId,
+                  IN PLIST_ENTRY List)
+{
+    PWS_CATALOG_SNAPSHOT Snapshot;
+    PWS_TC_SNAPSHOT_ENTRY SnapshotEntry;
+    PTCATALOG_ENTRY CatalogEntry;
+    HANDLE SectionHandle;
+    PLIST_ENTRY Entry;
+    DWORD EntryCount = 0;
+
+    /* Count the entries */
+    for (Entry = List->Flink; Entry != List; Entry = Entry->Flink) EntryCount++;
+
+    /* Create the snapshot, unless another process is already doing it */
+    Snapshot = WsCreateCatalogSnapshot(WS_TC_SNAPSHOT_NAME,
+                                       UniqueId,
+                                       sizeof(*Snapshot) +
+                                       EntryCount * sizeof(*SnapshotEntry),
+                                       &SectionHandle);
+    if (!Snapshot) return;
+
+    /* Fill it out */
+    Snapshot->NextId = NextId;
+    Snapshot->EntryCount = EntryCount;
+    SnapshotEntry = (PWS_TC_SNAPSHOT_ENTRY)(Snapshot + 1);
+    for (Entry = List->Flink; Entry != List; Entry = Entry->Flink)
+    {
+        /* Copy this entry */
+        CatalogEntry = CONTAINING_RECORD(Entry, TCATALOG_ENTRY, CatalogLink);
+        RtlCopyMemory(SnapshotEntry->DllPath,
+                      CatalogEntry->DllPath,
+                      sizeof(SnapshotEntry->DllPath));
+        SnapshotEntry->ProtocolInfo = CatalogEntry->ProtocolInfo;
+        SnapshotEntry++;
+    }
+
+    /* Let the other processes use it, and keep it alive */
+    WsPublishCatalogSnapshot(Snapshot);
+    WsSetCatalogSnapshot(&Catalog->SnapshotSection, SectionHandle);
+}
+
 DWORD
 WSAAPI
 WsTcRefreshFromRegistry(IN PTCATALOG Catalog,
@@ -229,15 +440,9 @@ WsTcRefreshFromRegistry(IN PTCATALOG Catalog,
     BOOLEAN LocalEvent = FALSE;
     LIST_ENTRY LocalList;
     DWORD UniqueId;
-    HKEY EntriesKey;
-    DWORD CatalogEntries;
-    PTCATALOG_ENTRY CatalogEntry;
     DWORD NextCatalogEntry;
     BOOL NewChangesMade;
-    PLIST_ENTRY Entry;
-    DWORD RegType = REG_DWORD;
-    DWORD RegSize = sizeof(DWORD);
-    DWORD i;
+    BOOL FromSnapshot;
 
     /* Check if we got an event */
     if (!CatalogEvent)
@@ -271,81 +476,38 @@ WsTcRefreshFromRegistry(IN PTCATALOG Catalog,
             break;
         }
 
-        /* Now Open the Entries */
-        ErrorCode = RegOpenKeyEx(Catalog->CatalogKey,
-                                 "Catalog_Entries",
-                                 0,
-                                 MAXIMUM_ALLOWED,
-                                 &EntriesKey);
-        if (ErrorCode != ERROR_SUCCESS)
-        {
-            /* Critical failure */
-            ErrorCode = WSASYSCALLFAILURE;
-            break;
-        }
-
-        /* Get the next entry */
-        ErrorCode = RegQueryValueEx(Catalog->CatalogKey,
-                                    "Next_Catalog_Entry_ID",
-                                    0,
-                                    &RegType,
-                                    (LPBYTE)&NextCatalogEntry,
-                                    &RegSize);
-        if (ErrorCode != ERROR_SUCCESS)
-        {
-            /* Critical failure */
-            ErrorCode = WSASYSCALLFAILURE;
-            break;
-        }
-
-        /* Find out how many there are */
-        ErrorCode = RegQueryValueEx(Catalog->CatalogKey,
-                                    "Num_Catalog_Entries",
-                                    0,
-                                    &RegType,
-                                    (LPBYTE)&CatalogEntries,
-                                    &RegSize);
-        if (ErrorCode != ERROR_SUCCESS)
+        /* Use the snapshot of this version if another process left one */
+        FromSnapshot = WsTcReadSnapshot(Catalog,
+                                        UniqueId,
+                                        &LocalList,
+                                        &NextCatalogEntry);
+        if (FromSnapshot)
         {
-            /* Critical failure */
-            ErrorCode = WSASYSCALLFAILURE;
-            break;
+            /* We have all the entries */
+            ErrorCode = ERROR_SUCCESS;
         }
-
-        /* Initialize them all */
-        for (i = 1; i <= CatalogEntries; i++)
+        else
         {
-            /* Allocate a Catalog Entry Structure */
-            CatalogEntry = WsTcEntryAllocate();
-            if (!CatalogEntry)
-            {
-                /* Not enough memory, fail */
-                ErrorCode = WSA_NOT_ENOUGH_MEMORY;
-                break;
-            }
-
-            /* Initialize it from the Registry Key */
-            ErrorCode = WsTcEntryInitializeFromRegistry(CatalogEntry,
-                                                        EntriesKey,
-                                                        i);
-            if (ErrorCode != ERROR_SUCCESS)
-            {
-                /* We failed to get it, dereference the entry and leave */
-                WsTcEntryDereference(CatalogEntry);
-                break;
-            }
-
-            /* Insert it to our List */
-            InsertTailList(&LocalList, &CatalogEntry->CatalogLink);
+            /* Read them from the registry */
+            ErrorCode = WsTcReadRegistryEntries(Catalog->CatalogKey,
+                                                &LocalList,
+                                                &NextCatalogEntry);
+            if (ErrorCode == WSASYSCALLFAILURE) break;
         }
 
-        /* Close the catalog key */
-        RegCloseKey(EntriesKey);
-
         /* Check if we changed during our read and if we have success */
         NewChangesMade = WsCheckCatalogState(CatalogEvent);
         if (!NewChangesMade && ErrorCode == ERROR_SUCCESS)
         {
+            /* Save what we read for the processes after us */
+            if (!FromSnapshot)
+            {
+                WsTcWriteSnapshot(Catalog,
+                                  UniqueId,
+                                  NextCatalogEntry,
+                                  &LocalList);
+            }
+
             /* All is good, update the protocol list */
             WsTcUpdateProtocolList(Catalog, &LocalList);
 
@@ -356,15 +518,7 @@ WsTcRefreshFromRegistry(IN PTCATALOG Catalog,
         }
 
         /* We failed and/or catalog data changed, free what we did till now */
-        while (!IsListEmpty(&LocalList))
-        {
-            /* Get the LP Catalog Item */
-            Entry = RemoveHeadList(&LocalList);
-            CatalogEntry = CONTAINING_RECORD(Entry, TCATALOG_ENTRY, CatalogLink);
-
-            /* Dereference it */
-            WsTcEntryDereference(CatalogEntry);
-        }
+        WsTcFreeLocalList(&LocalList);
     } while (NewChangesMade);
 
     /* Release the lock */
@@ -893,6 +1047,9 @@ WsTcDelete(IN PTCATALOG Catalog)
         Catalog->CatalogKey = NULL;
     }
 
+    /* Let go of the snapshot */
+    WsSetCatalogSnapshot(&Catalog->SnapshotSection, NULL);
+
     /* Release and delete the lock */
     WsTcUnlock();
     DeleteCriticalSection(&Catalog->Lock);
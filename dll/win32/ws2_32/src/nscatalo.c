@@ -204,6 +204,259 @@ WsNcInitializeFromRegistry(IN PNSCATALOG Catalog,
     return ErrorCode;
 }
 
+static
+INT
+WsNcReadRegistryEntries(IN HKEY CatalogKey,
+                        IN PLIST_ENTRY List)
+{
+    INT ErrorCode = ERROR_SUCCESS;
+    HKEY EntriesKey;
+    DWORD CatalogEntries;
+    PNSCATALOG_ENTRY CatalogEntry;
+    DWORD RegType = REG_DWORD;
+    DWORD RegSize = sizeof(DWORD);
+    DWORD i;
+
+    /* Now Open the Entries */
+    ErrorCode = RegOpenKeyEx(CatalogKey,
+                             "Catalog_Entries",
+                             0,
+                             MAXIMUM_ALLOWED,
+                             &EntriesKey);
+    if (ErrorCode != ERROR_SUCCESS) return WSASYSCALLFAILURE;
+
+    /* Find out how many there are */
+    ErrorCode = RegQueryValueEx(CatalogKey,
+                                "Num_Catalog_Entries",
+                                0,
+                                &RegType,
+                                (LPBYTE)&CatalogEntries,
+                                &RegSize);
+    if (ErrorCode != ERROR_SUCCESS)
+    {
+        /* Critical failure */
+        RegCloseKey(EntriesKey);
+        return WSASYSCALLFAILURE;
+    }
+
+    /* Initialize them all */
+    for (i = 1; i <= CatalogEntries; i++)
+    {
+        /* Allocate a Catalog Entry Structure */
+        CatalogEntry = WsNcEntryAllocate();
+        if (!CatalogEntry)
+        {
+            /* Not enough memory, fail */
+            ErrorCode = WSA_NOT_ENOUGH_MEMORY;
+            break;
+        }
+
+        /* Initialize it from the Registry Key */
+        ErrorCode = WsNcEntryInitializeFromRegistry(CatalogEntry,
+                                                    EntriesKey,
+                                                    i);
+        if (ErrorCode != ERROR_SUCCESS)
+        {
+            /* We failed to get it, dereference the entry and leave */
+            WsNcEntryDereference(CatalogEntry);
+            break;
+        }
+
+        /* Insert it to our List */
+        InsertTailList(List, &CatalogEntry->CatalogLink);
+    }
+
+    /* Close the catalog key */
+    RegCloseKey(EntriesKey);
+    return ErrorCode;
+}
+
+static
+VOID
+WsNcFreeLocalList(IN PLIST_ENTRY List)
+{
+    PLIST_ENTRY Entry;
+    PNSCATALOG_ENTRY CatalogEntry;
+
+    /* Free everything we read */
+    while (!IsListEmpty(List))
+    {
+        /* Get the LP Catalog Item */
+        Entry = RemoveHeadList(List);
+        CatalogEntry = CONTAINING_RECORD(Entry, NSCATALOG_ENTRY, CatalogLink);
+
+        /* Dereference it */
+        WsNcEntryDereference(CatalogEntry);
+    }
+}
+
+static
+DWORD
+WsNcGetSnapshotEntrySize(IN PNSCATALOG_ENTRY CatalogEntry)
+{
+    DWORD Size;
+
+    /* The display string follows the fixed part, rounded for alignment */
+    Size = FIELD_OFFSET(WS_NC_SNAPSHOT_ENTRY, ProviderName) + sizeof(WCHAR);
+    if (CatalogEntry->ProviderName)
+    {
+        Size += (DWORD)wcslen(CatalogEntry->ProviderName) * sizeof(WCHAR);
+    }
+    return (Size + 7) & ~7;
+}
+
+static
+BOOL
+WsNcReadSnapshot(IN PNSCATALOG Catalog,
+                 IN DWORD UniqueId,
+                 IN PLIST_ENTRY List)
+{
+    PWS_CATALOG_SNAPSHOT Snapshot;
+    PWS_NC_SNAPSHOT_ENTRY SnapshotEntry;
+    PNSCATALOG_ENTRY CatalogEntry;
+    HANDLE SectionHandle;
+    DWORD Offset, NameSize;
+    DWORD i;
+
+    /* Check if another process already read this version of the catalog */
+    Snapshot = WsOpenCatalogSnapshot(WS_NC_SNAPSHOT_NAME,
+                                     UniqueId,
+                                     &SectionHandle);
+    if (!Snapshot) return FALSE;
+
+    /* Copy the entries out of it */
+    Offset = sizeof(*Snapshot);
+    for (i = 0; i < Snapshot->EntryCount; i++)
+    {
+        /* Make sure this entry is inside the snapshot */
+        SnapshotEntry = (PWS_NC_SNAPSHOT_ENTRY)((ULONG_PTR)Snapshot + Offset);
+        if ((Snapshot->Size - Offset < FIELD_OFFSET(WS_NC_SNAPSHOT_ENTRY,
+                                                    ProviderName) +
+                                       sizeof(WCHAR)) ||
+            (SnapshotEntry->Size < FIELD_OFFSET(WS_NC_SNAPSHOT_ENTRY,
+                                                ProviderName) +
+                                   sizeof(WCHAR)) ||
+            (SnapshotEntry->Size > Snapshot->Size - Offset))
+        {
+            /* It's corrupted */
+            break;
+        }
+
+        /* Allocate a Catalog Entry Structure */
+        CatalogEntry = WsNcEntryAllocate();
+        if (!CatalogEntry) break;
+
+        /* Allocate the display string */
+        NameSize = SnapshotEntry->Size -
+                   FIELD_OFFSET(WS_NC_SNAPSHOT_ENTRY, ProviderName);
+        CatalogEntry->ProviderName = HeapAlloc(WsSockHeap, 0, NameSize);
+        if (!CatalogEntry->ProviderName)
+        {
+            /* Not enough memory */
+            WsNcEntryDereference(CatalogEntry);
+            break;
+        }
+
+        /* Initialize it from the snapshot */
+        RtlCopyMemory(CatalogEntry->ProviderName,
+                      SnapshotEntry->ProviderName,
+                      NameSize);
+        CatalogEntry->ProviderName[NameSize / sizeof(WCHAR) - 1] = UNICODE_NULL;
+        RtlCopyMemory(CatalogEntry->DllPath,
+                      SnapshotEntry->DllPath,
+                      sizeof(CatalogEntry->DllPath));
+        CatalogEntry->DllPath[MAX_PATH - 1] = UNICODE_NULL;
+        CatalogEntry->AddressFamily = SnapshotEntry->AddressFamily;
+        CatalogEntry->NamespaceId = SnapshotEntry->NamespaceId;
+        CatalogEntry->Version = SnapshotEntry->Version;
+        CatalogEntry->Enabled = SnapshotEntry->Enabled;
+        CatalogEntry->StoresServiceClassInfo = SnapshotEntry->StoresServiceClassInfo;
+        CatalogEntry->ProviderId = SnapshotEntry->ProviderId;
+
+        /* Insert it to our List */
+        InsertTailList(List, &CatalogEntry->CatalogLink);
+
+        /* Move to the next one */
+        Offset += SnapshotEntry->Size;
+    }
+
+    /* Check if we got all of them */
+    if (i != Snapshot->EntryCount)
+    {
+        /* Let the registry path deal with it */
+        WsNcFreeLocalList(List);
+        UnmapViewOfFile(Snapshot);
+        CloseHandle(SectionHandle);
+        return FALSE;
+    }
+
+    /* Done with it, but keep it around for the processes after us */
+    UnmapViewOfFile(Snapshot);
+    WsSetCatalogSnapshot(&Catalog->SnapshotSection, SectionHandle);
+    return TRUE;
+}
+
+static
+VOID
+WsNcWriteSnapshot(IN PNSCATALOG Catalog,
+                  IN DWORD UniqueId,
+                  IN PLIST_ENTRY List)
+{
+    PWS_CATALOG_SNAPSHOT Snapshot;
+    PWS_NC_SNAPSHOT_ENTRY SnapshotEntry;
+    PNSCATALOG_ENTRY CatalogEntry;
+    HANDLE SectionHandle;
+    PLIST_ENTRY Entry;
+    DWORD EntryCount = 0;
+    DWORD Size = sizeof(*Snapshot);
+
+    /* Count the entries and their size */
+    for (Entry = List->Flink; Entry != List; Entry = Entry->Flink)
+    {
+        CatalogEntry = CONTAINING_RECORD(Entry, NSCATALOG_ENTRY, CatalogLink);
+        Size += WsNcGetSnapshotEntrySize(CatalogEntry);
+        EntryCount++;
+    }
+
+    /* Create the snapshot, unless another process is already doing it */
+    Snapshot = WsCreateCatalogSnapshot(WS_NC_SNAPSHOT_NAME,
+                                       UniqueId,
+                                       Size,
+                                       &SectionHandle);
+    if (!Snapshot) return;
+
+    /* Fill it out, the section comes zeroed */
+    Snapshot->EntryCount = EntryCount;
+    SnapshotEntry = (PWS_NC_SNAPSHOT_ENTRY)(Snapshot + 1);
+    for (Entry = List->Flink; Entry != List; Entry = Entry->Flink)
+    {
+        /* Copy this entry */
+        CatalogEntry = CONTAINING_RECORD(Entry, NSCATALOG_ENTRY, CatalogLink);
+        SnapshotEntry->Size = WsNcGetSnapshotEntrySize(CatalogEntry);
+        SnapshotEntry->AddressFamily = CatalogEntry->AddressFamily;
+        SnapshotEntry->NamespaceId = CatalogEntry->NamespaceId;
+        SnapshotEntry->Version = CatalogEntry->Version;
+        SnapshotEntry->Enabled = CatalogEntry->Enabled;
+        SnapshotEntry->StoresServiceClassInfo = CatalogEntry->StoresServiceClassInfo;
+        SnapshotEntry->ProviderId = CatalogEntry->ProviderId;
+        RtlCopyMemory(SnapshotEntry->DllPath,
+                      CatalogEntry->DllPath,
+                      sizeof(SnapshotEntry->DllPath));
+        if (CatalogEntry->ProviderName)
+        {
+            wcscpy(SnapshotEntry->ProviderName, CatalogEntry->ProviderName);
+        }
+
+        /* Move to the next one */
+        SnapshotEntry = (PWS_NC_SNAPSHOT_ENTRY)((ULONG_PTR)SnapshotEntry +
+                                                SnapshotEntry->Size);
+    }
+
+    /* Let the other processes use it, and keep it alive */
+    WsPublishCatalogSnapshot(Snapshot);
+    WsSetCatalogSnapshot(&Catalog->SnapshotSection, SectionHandle);
+}
+
 INT
 WSAAPI
 WsNcRefreshFromRegistry(IN PNSCATALOG Catalog,
@@ -213,14 +466,8 @@ WsNcRefreshFromRegistry(IN PNSCATALOG Catalog,
     BOOLEAN LocalEvent = FALSE;
     LIST_ENTRY LocalList;
     DWORD UniqueId;
-    HKEY EntriesKey;
-    DWORD CatalogEntries;
-    PNSCATALOG_ENTRY CatalogEntry;
     BOOL NewChangesMade;
-    PLIST_ENTRY Entry;
-    DWORD RegType = REG_DWORD;
-    DWORD RegSize = sizeof(DWORD);
-    DWORD i;
+    BOOL FromSnapshot;
 
     /* Check if we got an event */
     if (!CatalogEvent)
@@ -254,67 +501,28 @@ WsNcRefreshFromRegistry(IN PNSCATALOG Catalog,
             break;
         }
 
-        /* Now Open the Entries */
-        ErrorCode = RegOpenKeyEx(Catalog->CatalogKey,
-                                 "Catalog_Entries",
-                                 0,
-                                 MAXIMUM_ALLOWED,
-                                 &EntriesKey);
-        if (ErrorCode != ERROR_SUCCESS)
+        /* Use the snapshot of this version if another process left one */
+        FromSnapshot = WsNcReadSnapshot(Catalog, UniqueId, &LocalList);
+        if (FromSnapshot)
         {
-            /* Critical failure */
-            ErrorCode = WSASYSCALLFAILURE;
-            break;
+            /* We have all the entries */
+            ErrorCode = ERROR_SUCCESS;
         }
-
-        /* Find out how many there are */
-        ErrorCode = RegQueryValueEx(Catalog->CatalogKey,
-                                    "Num_Catalog_Entries",
-                                    0,
-                                    &RegType,
-                                    (LPBYTE)&CatalogEntries,
-                                    &RegSize);
-        if (ErrorCode != ERROR_SUCCESS)
+        else
         {
-            /* Critical failure */
-            ErrorCode = WSASYSCALLFAILURE;
-            break;
+            /* Read them from the registry */
+            ErrorCode = WsNcReadRegistryEntries(Catalog->CatalogKey,
+                                                &LocalList);
+            if (ErrorCode == WSASYSCALLFAILURE) break;
         }
 
-        /* Initialize them all */
-        for (i = 1; i <= CatalogEntries; i++)
-        {
-            /* Allocate a Catalog Entry Structure */
-            CatalogEntry = WsNcEntryAllocate();
-            if (!CatalogEntry)
-            {
-                /* Not enough memory, fail */
-                ErrorCode = WSA_NOT_ENOUGH_MEMORY;
-                break;
-            }
-
-            /* Initialize it from the Registry Key */
-            ErrorCode = WsNcEntryInitializeFromRegistry(CatalogEntry,
-                                                        EntriesKey,
-                                                        i);
-            if (ErrorCode != ERROR_SUCCESS)
-            {
-                /* We failed to get it, dereference the entry and leave */
-                WsNcEntryDereference(CatalogEntry);
-                break;
-            }
-
-            /* Insert it to our List */
-            InsertTailList(&LocalList, &CatalogEntry->CatalogLink);
-        }
-
-        /* Close the catalog key */
-        RegCloseKey(EntriesKey);
-
         /* Check if we changed during our read and if we have success */
         NewChangesMade = WsCheckCatalogState(CatalogEvent);
         if (!NewChangesMade && ErrorCode == ERROR_SUCCESS)
         {
+            /* Save what we read for the processes after us */
+            if (!FromSnapshot) WsNcWriteSnapshot(Catalog, UniqueId, &LocalList);
+
             /* All is good, update the protocol list */
             WsNcUpdateNamespaceList(Catalog, &LocalList);
 
@@ -324,15 +532,7 @@ WsNcRefreshFromRegistry(IN PNSCATALOG Catalog,
         }
 
         /* We failed and/or catalog data changed, free what we did till now */
-        while (!IsListEmpty(&LocalList))
-        {
-            /* Get the LP Catalog Item */
-            Entry = RemoveHeadList(&LocalList);
-            CatalogEntry = CONTAINING_RECORD(Entry, NSCATALOG_ENTRY, CatalogLink);
-
-            /* Dereference it */
-            WsNcEntryDereference(CatalogEntry);
-        }
+        WsNcFreeLocalList(&LocalList);
     } while (NewChangesMade);
 
     /* Release the lock */
@@ -634,6 +834,9 @@ WsNcDelete(IN PNSCATALOG Catalog)
         Catalog->CatalogKey = NULL;
     }
 
+    /* Let go of the snapshot */
+    WsSetCatalogSnapshot(&Catalog->SnapshotSection, NULL);
+
     /* Release and delete the lock */
     WsNcUnlock();
     DeleteCriticalSection(&Catalog->Lock);
@@ -86,6 +86,132 @@ WsCheckCatalogState(IN HANDLE Event)
     return FALSE;
 }
 
+/*
+ * Every process used to read the whole catalog from the registry in
+ * WSAStartup. The first process to read a version of a catalog now leaves a
+ * copy in a named section, and the processes after it map that instead.
+ * The version is the Serial_Access_Num of the catalog and is part of the
+ * section name, so a catalog change is picked up the same way as before and
+ * old snapshots go away with the last process that has them open.
+ */
+static
+VOID
+WsGetCatalogSnapshotName(IN LPCSTR CatalogName,
+                         IN DWORD UniqueId,
+                         OUT LPSTR SectionName)
+{
+    sprintf(SectionName, "WS2_32_%s_%8.8lX", CatalogName, UniqueId);
+}
+
+PWS_CATALOG_SNAPSHOT
+WSAAPI
+WsOpenCatalogSnapshot(IN LPCSTR CatalogName,
+                      IN DWORD UniqueId,
+                      OUT PHANDLE SectionHandle)
+{
+    CHAR SectionName[64];
+    MEMORY_BASIC_INFORMATION MemoryInfo;
+    PWS_CATALOG_SNAPSHOT Snapshot;
+    HANDLE Section;
+
+    /* Open the section for this version of the catalog, if there's one */
+    WsGetCatalogSnapshotName(CatalogName, UniqueId, SectionName);
+    Section = OpenFileMappingA(FILE_MAP_READ, FALSE, SectionName);
+    if (!Section) return NULL;
+
+    /* Map it read-only */
+    Snapshot = MapViewOfFile(Section, FILE_MAP_READ, 0, 0, 0);
+    if (!Snapshot)
+    {
+        CloseHandle(Section);
+        return NULL;
+    }
+
+    /* Make sure whoever created it got to finish it */
+    if (!VirtualQuery(Snapshot, &MemoryInfo, sizeof(MemoryInfo)) ||
+        (MemoryInfo.RegionSize < sizeof(*Snapshot)) ||
+        !(Snapshot->Complete) ||
+        (Snapshot->Signature != WS_SNAPSHOT_SIGNATURE) ||
+        (Snapshot->UniqueId != UniqueId) ||
+        (Snapshot->Size < sizeof(*Snapshot)) ||
+        (Snapshot->Size > MemoryInfo.RegionSize))
+    {
+        /* It's no good, the caller reads the registry */
+        UnmapViewOfFile(Snapshot);
+        CloseHandle(Section);
+        return NULL;
+    }
+
+    /* Return it */
+    *SectionHandle = Section;
+    return Snapshot;
+}
+
+PWS_CATALOG_SNAPSHOT
+WSAAPI
+WsCreateCatalogSnapshot(IN LPCSTR CatalogName,
+                        IN DWORD UniqueId,
+                        IN DWORD Size,
+                        OUT PHANDLE SectionHandle)
+{
+    CHAR SectionName[64];
+    PWS_CATALOG_SNAPSHOT Snapshot;
+    HANDLE Section;
+
+    /* Create the section for this version of the catalog */
+    WsGetCatalogSnapshotName(CatalogName, UniqueId, SectionName);
+    Section = CreateFileMappingA(INVALID_HANDLE_VALUE,
+                                 NULL,
+                                 PAGE_READWRITE,
+                                 0,
+                                 Size,
+                                 SectionName);
+    if (!Section) return NULL;
+
+    /* Check if another process beat us to it */
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(Section);
+        return NULL;
+    }
+
+    /* Map it so the caller can fill it in */
+    Snapshot = MapViewOfFile(Section, FILE_MAP_WRITE, 0, 0, Size);
+    if (!Snapshot)
+    {
+        CloseHandle(Section);
+        return NULL;
+    }
+
+    /* Fill out the header, it's not complete until it's published */
+    Snapshot->Signature = WS_SNAPSHOT_SIGNATURE;
+    Snapshot->Size = Size;
+    Snapshot->UniqueId = UniqueId;
+
+    /* Return it */
+    *SectionHandle = Section;
+    return Snapshot;
+}
+
+VOID
+WSAAPI
+WsPublishCatalogSnapshot(IN PWS_CATALOG_SNAPSHOT Snapshot)
+{
+    /* Let other processes use it and unmap it, the section stays */
+    InterlockedExchange(&Snapshot->Complete, TRUE);
+    UnmapViewOfFile(Snapshot);
+}
+
+VOID
+WSAAPI
+WsSetCatalogSnapshot(IN PHANDLE CatalogSection,
+                     IN HANDLE SectionHandle)
+{
+    /* Keep the section of the current version alive for later processes */
+    if (*CatalogSection) CloseHandle(*CatalogSection);
+    *CatalogSection = SectionHandle;
+}
+
 INT
 WSAAPI
 WsApiProlog(OUT PWSPROCESS *Process,
@@ -1187,9 +1187,10 @@ end:
             ERR("do_write returned %08x\n", Status);
     }
 
-    if (NT_SUCCESS(Status))
+    if (NT_SUCCESS(Status)) {
         clear_rollback(&rollback);
-    else
+        Vcb->balance.data_moved += loaded * Vcb->superblock.node_size;
+    } else
         do_rollback(Vcb, &rollback);
 
     free_trees(Vcb);
@@ -2108,6 +2109,7 @@ end:
 
     if (NT_SUCCESS(Status)) {
         clear_rollback(&rollback);
+        Vcb->balance.data_moved += loaded;
 
         // update open FCBs
         // FIXME - speed this up(?)
@@ -2930,6 +2932,8 @@ static NTSTATUS try_consolidation(device_extension* Vcb, UINT64 flags, chunk** n
         ExReleaseResourceLite(&Vcb->tree_lock);
 
         do {
+            UINT64 moved = Vcb->balance.data_moved, start_time = KeQueryInterruptTime();
+
             changed = FALSE;
 
             Status = balance_data_chunk(Vcb, rc, &changed);
@@ -2941,6 +2945,10 @@ static NTSTATUS try_consolidation(device_extension* Vcb, UINT64 flags, chunk** n
                 return Status;
             }
 
+            moved = Vcb->balance.data_moved - moved;
+            io_throttle_done(&Vcb->balance.throttle, moved, (ULONG)(2 * ((moved + BALANCE_UNIT - 1) / BALANCE_UNIT)), start_time);
+            io_throttle_wait(Vcb, &Vcb->balance.throttle, &Vcb->balance.stopping);
+
             KeWaitForSingleObject(&Vcb->balance.event, Executive, KernelMode, FALSE, NULL);
 
             if (Vcb->readonly)
@@ -3072,6 +3080,8 @@ void NTAPI balance_thread(void* context) {
 
     num_chunks[0] = num_chunks[1] = num_chunks[2] = 0;
     Vcb->balance.total_chunks = Vcb->balance.chunks_left = 0;
+    Vcb->balance.data_moved = 0;
+    init_io_throttle(&Vcb->balance.throttle);
 
     InitializeListHead(&chunks);
 
@@ -3281,6 +3291,8 @@ void NTAPI balance_thread(void* context) {
             BOOL changed;
 
             do {
+                UINT64 moved = Vcb->balance.data_moved, start_time = KeQueryInterruptTime();
+
                 changed = FALSE;
 
                 Status = balance_data_chunk(Vcb, c, &changed);
@@ -3290,6 +3302,11 @@ void NTAPI balance_thread(void* context) {
                     goto end;
                 }
 
+                // each unit is read and then written
+                moved = Vcb->balance.data_moved - moved;
+                io_throttle_done(&Vcb->balance.throttle, moved, (ULONG)(2 * ((moved + BALANCE_UNIT - 1) / BALANCE_UNIT)), start_time);
+                io_throttle_wait(Vcb, &Vcb->balance.throttle, &Vcb->balance.stopping);
+
                 KeWaitForSingleObject(&Vcb->balance.event, Executive, KernelMode, FALSE, NULL);
 
                 if (Vcb->readonly)
@@ -3327,6 +3344,8 @@ void NTAPI balance_thread(void* context) {
 
         if (c->chunk_item->type & BLOCK_FLAG_METADATA || c->chunk_item->type & BLOCK_FLAG_SYSTEM) {
             do {
+                UINT64 moved = Vcb->balance.data_moved, start_time = KeQueryInterruptTime();
+
                 Status = balance_metadata_chunk(Vcb, c, &changed);
                 if (!NT_SUCCESS(Status)) {
                     ERR("balance_metadata_chunk returned %08x\n", Status);
@@ -3334,6 +3353,10 @@ void NTAPI balance_thread(void* context) {
                     goto end;
                 }
 
+                moved = Vcb->balance.data_moved - moved;
+                io_throttle_done(&Vcb->balance.throttle, moved, (ULONG)(2 * (moved / Vcb->superblock.node_size)), start_time);
+                io_throttle_wait(Vcb, &Vcb->balance.throttle, &Vcb->balance.stopping);
+
                 KeWaitForSingleObject(&Vcb->balance.event, Executive, KernelMode, FALSE, NULL);
 
                 if (Vcb->readonly)
@@ -3722,6 +3745,8 @@ NTSTATUS query_balance(device_extension* Vcb, void* data, ULONG length) {
     RtlCopyMemory(&bqb->data_opts, &Vcb->balance.opts[BALANCE_OPTS_DATA], sizeof(btrfs_balance_opts));
     RtlCopyMemory(&bqb->metadata_opts, &Vcb->balance.opts[BALANCE_OPTS_METADATA], sizeof(btrfs_balance_opts));
     RtlCopyMemory(&bqb->system_opts, &Vcb->balance.opts[BALANCE_OPTS_SYSTEM], sizeof(btrfs_balance_opts));
+    bqb->data_moved = Vcb->balance.data_moved;
+    bqb->rate = Vcb->balance.paused ? 0 : Vcb->balance.throttle.rate;
 
     return STATUS_SUCCESS;
 }
@@ -48,7 +48,8 @@
 
 #define INCOMPAT_SUPPORTED (BTRFS_INCOMPAT_FLAGS_MIXED_BACKREF | BTRFS_INCOMPAT_FLAGS_DEFAULT_SUBVOL | BTRFS_INCOMPAT_FLAGS_MIXED_GROUPS | \
                             BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO | BTRFS_INCOMPAT_FLAGS_BIG_METADATA | BTRFS_INCOMPAT_FLAGS_RAID56 | \
-                            BTRFS_INCOMPAT_FLAGS_EXTENDED_IREF | BTRFS_INCOMPAT_FLAGS_SKINNY_METADATA | BTRFS_INCOMPAT_FLAGS_NO_HOLES)
+                            BTRFS_INCOMPAT_FLAGS_EXTENDED_IREF | BTRFS_INCOMPAT_FLAGS_SKINNY_METADATA | BTRFS_INCOMPAT_FLAGS_NO_HOLES | \
+                            BTRFS_INCOMPAT_FLAGS_COMPRESS_ZSTD)
 #define COMPAT_RO_SUPPORTED (BTRFS_COMPAT_RO_FLAGS_FREE_SPACE_CACHE | BTRFS_COMPAT_RO_FLAGS_FREE_SPACE_CACHE_VALID)
 
 static WCHAR device_name[] = {'\\','B','t','r','f','s',0};
@@ -70,6 +71,10 @@ UINT32 mount_compress = 0;
 UINT32 mount_compress_force = 0;
 UINT32 mount_compress_type = 0;
 UINT32 mount_zlib_level = 3;
+UINT32 mount_zstd_level = 3;
+UINT32 mount_maint_bandwidth = 0;
+UINT32 mount_maint_iops = 0;
+UINT32 mount_maint_backoff = 1;
 UINT32 mount_flush_interval = 30;
 UINT32 mount_max_inline = 2048;
 UINT32 mount_skip_balance = 0;
@@ -86,6 +91,7 @@ tCcCopyReadEx fCcCopyReadEx;
 tCcCopyWriteEx fCcCopyWriteEx;
 tCcSetAdditionalCacheAttributesEx fCcSetAdditionalCacheAttributesEx;
 tFsRtlUpdateDiskCounters fFsRtlUpdateDiskCounters;
+tIoSetIoPriorityHint fIoSetIoPriorityHint;
 BOOL diskacc = FALSE;
 void *notification_entry = NULL, *notification_entry2 = NULL, *notification_entry3 = NULL;
 ERESOURCE pdo_list_lock, mapping_lock;
@@ -1787,17 +1793,17 @@ void uninit(_In_ device_extension* Vcb, _In_ BOOL flush) {
 
     for (i = 0; i < Vcb->calcthreads.num_threads; i++) {
         Vcb->calcthreads.threads[i].quit = TRUE;
+        KeSetEvent(&Vcb->calcthreads.threads[i].event, 0, FALSE);
     }
 
-    KeSetEvent(&Vcb->calcthreads.event, 0, FALSE);
-
     for (i = 0; i < Vcb->calcthreads.num_threads; i++) {
         KeWaitForSingleObject(&Vcb->calcthreads.threads[i].finished, Executive, KernelMode, FALSE, NULL);
 
         ZwClose(Vcb->calcthreads.threads[i].handle);
     }
 
-    ExDeleteResourceLite(&Vcb->calcthreads.lock);
+    ExDeleteNPagedLookasideList(&Vcb->calcthreads.job_lookaside);
+    ExFreePool(Vcb->calcthreads.queues);
     ExFreePool(Vcb->calcthreads.threads);
 
     time.QuadPart = 0;
@@ -1860,8 +1866,11 @@ void uninit(_In_ device_extension* Vcb, _In_ BOOL flush) {
             release_fcb_lock(Vcb);
         }
 
+        free_stripe_cache(c);
+
         ExDeleteResourceLite(&c->range_locks_lock);
         ExDeleteResourceLite(&c->partial_stripes_lock);
+        ExDeleteResourceLite(&c->stripe_cache_lock);
         ExDeleteResourceLite(&c->lock);
         ExDeleteResourceLite(&c->changed_extents_lock);
 
@@ -3341,6 +3350,10 @@ static NTSTATUS load_chunk_root(_In_ _Requires_lock_held_(_Curr_->tree_lock) dev
                 InitializeListHead(&c->partial_stripes);
                 ExInitializeResourceLite(&c->partial_stripes_lock);
 
+                InitializeListHead(&c->stripe_cache);
+                c->stripe_cache_count = 0;
+                ExInitializeResourceLite(&c->stripe_cache_lock);
+
                 c->last_alloc_set = FALSE;
 
                 c->last_stripe = 0;
@@ -3687,9 +3700,20 @@ static NTSTATUS create_calc_threads(_In_ PDEVICE_OBJECT DeviceObject) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    InitializeListHead(&Vcb->calcthreads.job_list);
-    ExInitializeResourceLite(&Vcb->calcthreads.lock);
-    KeInitializeEvent(&Vcb->calcthreads.event, NotificationEvent, FALSE);
+    // one job queue per processor
+    Vcb->calcthreads.queues = ExAllocatePoolWithTag(NonPagedPool, sizeof(calc_queue) * Vcb->calcthreads.num_threads, ALLOC_TAG);
+    if (!Vcb->calcthreads.queues) {
+        ERR("out of memory\n");
+        ExFreePool(Vcb->calcthreads.threads);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < Vcb->calcthreads.num_threads; i++) {
+        KeInitializeSpinLock(&Vcb->calcthreads.queues[i].lock);
+        InitializeListHead(&Vcb->calcthreads.queues[i].job_list);
+    }
+
+    ExInitializeNPagedLookasideList(&Vcb->calcthreads.job_lookaside, NULL, NULL, 0, sizeof(calc_job), ALLOC_TAG, 0);
 
     RtlZeroMemory(Vcb->calcthreads.threads, sizeof(drv_calc_thread) * Vcb->calcthreads.num_threads);
 
@@ -3697,6 +3721,8 @@ static NTSTATUS create_calc_threads(_In_ PDEVICE_OBJECT DeviceObject) {
         NTSTATUS Status;
 
         Vcb->calcthreads.threads[i].DeviceObject = DeviceObject;
+        Vcb->calcthreads.threads[i].number = i;
+        KeInitializeEvent(&Vcb->calcthreads.threads[i].event, SynchronizationEvent, FALSE);
         KeInitializeEvent(&Vcb->calcthreads.threads[i].finished, NotificationEvent, FALSE);
 
         Status = PsCreateSystemThread(&Vcb->calcthreads.threads[i].handle, 0, NULL, NULL, NULL, calc_thread, &Vcb->calcthreads.threads[i]);
@@ -3706,11 +3732,10 @@ static NTSTATUS create_calc_threads(_In_ PDEVICE_OBJECT DeviceObject) {
             ERR("PsCreateSystemThread returned %08x\n", Status);
 
             for (j = 0; j < i; j++) {
-                Vcb->calcthreads.threads[i].quit = TRUE;
+                Vcb->calcthreads.threads[j].quit = TRUE;
+                KeSetEvent(&Vcb->calcthreads.threads[j].event, 0, FALSE);
             }
 
-            KeSetEvent(&Vcb->calcthreads.event, 0, FALSE);
-
             return Status;
         }
     }
@@ -5491,6 +5516,14 @@ NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING Regi
         fFsRtlUpdateDiskCounters = NULL;
     }
 
+    if (RtlIsNtDdiVersionAvailable(NTDDI_VISTA)) {
+        UNICODE_STRING name;
+
+        RtlInitUnicodeString(&name, L"IoSetIoPriorityHint");
+        fIoSetIoPriorityHint = (tIoSetIoPriorityHint)MmGetSystemRoutineAddress(&name);
+    } else
+        fIoSetIoPriorityHint = NULL;
+
     drvobj = DriverObject;
 
     DriverObject->DriverUnload = DriverUnload;
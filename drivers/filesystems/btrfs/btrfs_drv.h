@@ -234,7 +234,8 @@ typedef struct {
 enum prop_compression_type {
     PropCompression_None,
     PropCompression_Zlib,
-    PropCompression_LZO
+    PropCompression_LZO,
+    PropCompression_ZSTD
 };
 
 typedef struct {
@@ -508,6 +509,14 @@ typedef struct {
     UINT8 data[1];
 } partial_stripe;
 
+typedef struct {
+    UINT64 address;
+    ULONG* bmparr;
+    RTL_BITMAP bmp;
+    LIST_ENTRY list_entry;
+    UINT8 data[1];
+} stripe_cache_entry;
+
 typedef struct {
     CHUNK_ITEM* chunk_item;
     UINT16 size;
@@ -537,6 +546,9 @@ typedef struct {
     UINT16 last_stripe;
     LIST_ENTRY partial_stripes;
     ERESOURCE partial_stripes_lock;
+    LIST_ENTRY stripe_cache;
+    ULONG stripe_cache_count;
+    ERESOURCE stripe_cache_lock;
     ULONG balance_num;
 
     LIST_ENTRY list_entry;
@@ -574,29 +586,57 @@ typedef struct {
     LIST_ENTRY list_entry;
 } sys_chunk;
 
+// From experimenting, it seems that 40 sectors is roughly the crossover
+// point where offloading the crc32 calculation becomes worth it.
+#define CALC_INLINE_SECTORS 40
+
+typedef struct {
+    KSPIN_LOCK lock;
+    LIST_ENTRY job_list;
+} calc_queue;
+
 typedef struct {
+    UINT8* data;
+    UINT32 length;
+    UINT8 type;
+    UINT8 compression; // BTRFS_COMPRESSION_NONE if it wasn't worth it, when comp_data is data
+    UINT8* comp_data;
+    UINT32 comp_length;
+    NTSTATUS Status;
+} comp_part;
+
+#define CALC_JOB_CSUM       0
+#define CALC_JOB_COMPRESS   1
+
+typedef struct {
+    UINT8 type;
     UINT8* data;
     UINT32* csum;
     UINT32 sectors;
+    UINT32 chunk_sectors;
+    comp_part* parts;
+    LONG chunks;
     LONG pos, done;
     KEVENT event;
     LONG refcount;
+    calc_queue* queue;
     LIST_ENTRY list_entry;
 } calc_job;
 
 typedef struct {
     PDEVICE_OBJECT DeviceObject;
     HANDLE handle;
+    ULONG number;
+    KEVENT event;
     KEVENT finished;
     BOOL quit;
 } drv_calc_thread;
 
 typedef struct {
     ULONG num_threads;
-    LIST_ENTRY job_list;
-    ERESOURCE lock;
+    calc_queue* queues;
     drv_calc_thread* threads;
-    KEVENT event;
+    NPAGED_LOOKASIDE_LIST job_lookaside;
 } drv_calc_threads;
 
 typedef struct {
@@ -606,6 +646,7 @@ typedef struct {
     UINT8 compress_type;
     BOOL readonly;
     UINT32 zlib_level;
+    UINT32 zstd_level;
     UINT32 flush_interval;
     UINT32 max_inline;
     UINT64 subvol_id;
@@ -614,6 +655,9 @@ typedef struct {
     BOOL no_trim;
     BOOL clear_cache;
     BOOL allow_degraded;
+    UINT32 maint_bandwidth;
+    UINT32 maint_iops;
+    BOOL maint_backoff;
 } mount_options;
 
 #define VCB_TYPE_FS         1
@@ -647,6 +691,16 @@ typedef struct {
 #define BALANCE_OPTS_METADATA   1
 #define BALANCE_OPTS_SYSTEM     2
 
+typedef struct {
+    UINT64 window_start;
+    UINT64 window_bytes;
+    UINT64 window_ios;
+    UINT64 best_latency;
+    UINT64 last_latency;
+    UINT64 last_duration;
+    UINT64 rate;
+} io_throttle;
+
 typedef struct {
     HANDLE thread;
     UINT64 total_chunks;
@@ -661,6 +715,8 @@ typedef struct {
     NTSTATUS status;
     KEVENT event;
     KEVENT finished;
+    UINT64 data_moved;
+    io_throttle throttle;
 } balance_info;
 
 typedef struct {
@@ -704,6 +760,7 @@ typedef struct {
     NTSTATUS error;
     ULONG num_errors;
     LIST_ENTRY errors;
+    io_throttle throttle;
 } scrub_info;
 
 struct _volume_device_extension;
@@ -1123,6 +1180,10 @@ extern UINT32 mount_compress;
 extern UINT32 mount_compress_force;
 extern UINT32 mount_compress_type;
 extern UINT32 mount_zlib_level;
+extern UINT32 mount_zstd_level;
+extern UINT32 mount_maint_bandwidth;
+extern UINT32 mount_maint_iops;
+extern UINT32 mount_maint_backoff;
 extern UINT32 mount_flush_interval;
 extern UINT32 mount_max_inline;
 extern UINT32 mount_skip_balance;
@@ -1290,7 +1351,6 @@ BOOL insert_extent_chunk(_In_ device_extension* Vcb, _In_ fcb* fcb, _In_ chunk*
                          _In_opt_ PIRP Irp, _In_ LIST_ENTRY* rollback, _In_ UINT8 compression, _In_ UINT64 decoded_size, _In_ BOOL file_write, _In_ UINT64 irp_offset);
 
 NTSTATUS do_write_file(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, PIRP Irp, BOOL file_write, UINT32 irp_offset, LIST_ENTRY* rollback);
-NTSTATUS write_compressed(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, PIRP Irp, LIST_ENTRY* rollback);
 BOOL find_data_address_in_chunk(device_extension* Vcb, chunk* c, UINT64 length, UINT64* address);
 void get_raid56_lock_range(chunk* c, UINT64 address, UINT64 length, UINT64* lockaddr, UINT64* locklen);
 NTSTATUS calc_csum(_In_ device_extension* Vcb, _In_reads_bytes_(sectors*Vcb->superblock.sector_size) UINT8* data,
@@ -1299,6 +1359,10 @@ void add_insert_extent_rollback(LIST_ENTRY* rollback, fcb* fcb, extent* ext);
 NTSTATUS add_extent_to_fcb(_In_ fcb* fcb, _In_ UINT64 offset, _In_reads_bytes_(edsize) EXTENT_DATA* ed, _In_ UINT16 edsize,
                            _In_ BOOL unique, _In_opt_ _When_(return >= 0, __drv_aliasesMem) UINT32* csum, _In_ LIST_ENTRY* rollback);
 void add_extent(_In_ fcb* fcb, _In_ LIST_ENTRY* prevextle, _In_ __drv_aliasesMem extent* newext);
+void stripe_cache_update(device_extension* Vcb, chunk* c, UINT64 address, UINT32 length, UINT8* data, BOOL add);
+BOOL stripe_cache_read(device_extension* Vcb, chunk* c, UINT64 address, UINT32 length, UINT8* buf);
+void stripe_cache_invalidate(chunk* c, UINT64 address, UINT64 length);
+void free_stripe_cache(chunk* c);
 
 // in dirctrl.c
 
@@ -1479,7 +1543,9 @@ void watch_registry(HANDLE regh);
 // in compress.c
 NTSTATUS zlib_decompress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen);
 NTSTATUS lzo_decompress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen, UINT32 inpageoff);
-NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback);
+NTSTATUS zstd_decompress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen);
+NTSTATUS compress_part(device_extension* Vcb, comp_part* part);
+NTSTATUS write_compressed(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, PIRP Irp, LIST_ENTRY* rollback);
 
 // in galois.c
 void galois_double(UINT8* data, UINT32 len);
@@ -1503,8 +1569,8 @@ void NTAPI calc_thread(void* context);
 void calc_thread(void* context);
 #endif
 
-NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj);
-void free_calc_job(calc_job* cj);
+NTSTATUS do_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum);
+NTSTATUS do_compress_job(device_extension* Vcb, comp_part* parts, ULONG num_parts);
 
 // in balance.c
 NTSTATUS start_balance(device_extension* Vcb, void* data, ULONG length, KPROCESSOR_MODE processor_mode);
@@ -1559,6 +1625,10 @@ NTSTATUS query_scrub(device_extension* Vcb, KPROCESSOR_MODE processor_mode, void
 NTSTATUS pause_scrub(device_extension* Vcb, KPROCESSOR_MODE processor_mode);
 NTSTATUS resume_scrub(device_extension* Vcb, KPROCESSOR_MODE processor_mode);
 NTSTATUS stop_scrub(device_extension* Vcb, KPROCESSOR_MODE processor_mode);
+void init_io_throttle(io_throttle* t);
+void io_throttle_done(io_throttle* t, UINT64 bytes, ULONG ios, UINT64 start_time);
+BOOL io_throttle_due(device_extension* Vcb, io_throttle* t);
+void io_throttle_wait(device_extension* Vcb, io_throttle* t, BOOL* stopping);
 
 // in send.c
 NTSTATUS send_subvol(device_extension* Vcb, void* data, ULONG datalen, PFILE_OBJECT FileObject, PIRP Irp);
@@ -1748,6 +1818,8 @@ typedef VOID (*tCcSetAdditionalCacheAttributesEx)(PFILE_OBJECT FileObject, ULONG
 
 typedef VOID (*tFsRtlUpdateDiskCounters)(ULONG64 BytesRead, ULONG64 BytesWritten);
 
+typedef NTSTATUS (*tIoSetIoPriorityHint)(PIRP Irp, IO_PRIORITY_HINT PriorityHint);
+
 #ifndef __REACTOS__
 #ifndef _MSC_VER
 
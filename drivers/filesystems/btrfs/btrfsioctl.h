@@ -63,6 +63,7 @@ typedef struct {
 #define BTRFS_COMPRESSION_ANY   0
 #define BTRFS_COMPRESSION_ZLIB  1
 #define BTRFS_COMPRESSION_LZO   2
+#define BTRFS_COMPRESSION_ZSTD  3
 
 typedef struct {
     UINT64 subvol;
@@ -165,6 +166,8 @@ typedef struct {
     btrfs_balance_opts data_opts;
     btrfs_balance_opts metadata_opts;
     btrfs_balance_opts system_opts;
+    UINT64 data_moved;
+    UINT64 rate;
 } btrfs_query_balance;
 
 typedef struct {
@@ -221,6 +224,7 @@ typedef struct {
     UINT64 total_chunks;
     UINT64 data_scrubbed;
     UINT64 duration;
+    UINT64 rate;
     NTSTATUS error;
     UINT32 num_errors;
     btrfs_scrub_error errors;
@@ -17,76 +17,197 @@
 
 #include "btrfs_drv.h"
 
-#define SECTOR_BLOCK 16
+// Checksum jobs are cut into chunks of this many bytes, small enough for a
+// chunk to stay in the cache while it is checksummed; compression jobs have
+// a chunk for each part. Idle threads take chunks from the jobs on other
+// processors' queues when their own queue is empty.
+#define CALC_CHUNK_SIZE 0x10000
 
-NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj) {
+static void free_calc_job(device_extension* Vcb, calc_job* cj) {
+    LONG rc = InterlockedDecrement(&cj->refcount);
+
+    if (rc == 0)
+        ExFreeToNPagedLookasideList(&Vcb->calcthreads.job_lookaside, cj);
+}
+
+static BOOL do_calc(device_extension* Vcb, calc_job* cj) {
+    LONG pos, done;
+    UINT32* csum;
+    UINT8* data;
+    ULONG blocksize, i;
+
+    pos = InterlockedIncrement(&cj->pos) - 1;
+
+    if (pos >= cj->chunks)
+        return FALSE;
+
+    // Whoever takes the last chunk takes the job off its queue, so that
+    // the other threads stop looking at it
+
+    if (pos == cj->chunks - 1) {
+        KIRQL irql;
+
+        KeAcquireSpinLock(&cj->queue->lock, &irql);
+        RemoveEntryList(&cj->list_entry);
+        KeReleaseSpinLock(&cj->queue->lock, irql);
+
+        free_calc_job(Vcb, cj);
+    }
+
+    if (cj->type == CALC_JOB_COMPRESS)
+        cj->parts[pos].Status = compress_part(Vcb, &cj->parts[pos]);
+    else {
+        csum = &cj->csum[pos * cj->chunk_sectors];
+        data = cj->data + (pos * cj->chunk_sectors * Vcb->superblock.sector_size);
+
+        blocksize = min(cj->chunk_sectors, cj->sectors - (pos * cj->chunk_sectors));
+        for (i = 0; i < blocksize; i++) {
+            *csum = ~calc_crc32c(0xffffffff, data, Vcb->superblock.sector_size);
+            csum++;
+            data += Vcb->superblock.sector_size;
+        }
+    }
+
+    done = InterlockedIncrement(&cj->done);
+
+    if (done == cj->chunks)
+        KeSetEvent(&cj->event, 0, FALSE);
+
+    return TRUE;
+}
+
+static void run_calc_job(device_extension* Vcb, calc_job* cj) {
+    drv_calc_threads* ct = &Vcb->calcthreads;
+    KIRQL irql;
+    ULONG first, wake, i;
+
+    cj->pos = 0;
+    cj->done = 0;
+    cj->refcount = 2; // one for us, one for the queue
+    KeInitializeEvent(&cj->event, NotificationEvent, FALSE);
+
+    // Queue the job on the current processor, and wake up as many threads
+    // as there are chunks left over after the one we do ourselves
+
+    first = KeGetCurrentProcessorNumber() % ct->num_threads;
+    cj->queue = &ct->queues[first];
+
+    KeAcquireSpinLock(&cj->queue->lock, &irql);
+    InsertTailList(&cj->queue->job_list, &cj->list_entry);
+    KeReleaseSpinLock(&cj->queue->lock, irql);
+
+    wake = min((ULONG)cj->chunks - 1, ct->num_threads);
+    for (i = 0; i < wake; i++) {
+        KeSetEvent(&ct->threads[(first + i) % ct->num_threads].event, 0, FALSE);
+    }
+
+    while (do_calc(Vcb, cj)) { }
+
+    KeWaitForSingleObject(&cj->event, Executive, KernelMode, FALSE, NULL);
+
+    free_calc_job(Vcb, cj);
+}
+
+NTSTATUS do_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum) {
+    drv_calc_threads* ct = &Vcb->calcthreads;
     calc_job* cj;
+    ULONG i;
 
-    cj = ExAllocatePoolWithTag(NonPagedPool, sizeof(calc_job), ALLOC_TAG);
+    if (sectors < CALC_INLINE_SECTORS || ct->num_threads < 2) {
+        for (i = 0; i < sectors; i++) {
+            csum[i] = ~calc_crc32c(0xffffffff, data + (i * Vcb->superblock.sector_size), Vcb->superblock.sector_size);
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    cj = ExAllocateFromNPagedLookasideList(&ct->job_lookaside);
     if (!cj) {
         ERR("out of memory\n");
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
+    cj->type = CALC_JOB_CSUM;
     cj->data = data;
     cj->sectors = sectors;
     cj->csum = csum;
-    cj->pos = 0;
-    cj->done = 0;
-    cj->refcount = 1;
-    KeInitializeEvent(&cj->event, NotificationEvent, FALSE);
+    cj->chunk_sectors = max(1, CALC_CHUNK_SIZE / Vcb->superblock.sector_size);
+    cj->chunks = (sectors + cj->chunk_sectors - 1) / cj->chunk_sectors;
 
-    ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
-    InsertTailList(&Vcb->calcthreads.job_list, &cj->list_entry);
-    ExReleaseResourceLite(&Vcb->calcthreads.lock);
-
-    KeSetEvent(&Vcb->calcthreads.event, 0, FALSE);
-    KeClearEvent(&Vcb->calcthreads.event);
-
-    *pcj = cj;
+    run_calc_job(Vcb, cj);
 
     return STATUS_SUCCESS;
 }
 
-void free_calc_job(calc_job* cj) {
-    LONG rc = InterlockedDecrement(&cj->refcount);
+// The calc threads never wait on any of our locks, unlike the system worker
+// threads, which may be busy with IRPs we've posted that are waiting for
+// the very locks that the writer compressing holds.
+NTSTATUS do_compress_job(device_extension* Vcb, comp_part* parts, ULONG num_parts) {
+    drv_calc_threads* ct = &Vcb->calcthreads;
+    calc_job* cj;
+    ULONG i;
 
-    if (rc == 0)
-        ExFreePool(cj);
-}
+    if (num_parts < 2 || ct->num_threads < 2) {
+        for (i = 0; i < num_parts; i++) {
+            NTSTATUS Status = compress_part(Vcb, &parts[i]);
 
-static BOOL do_calc(device_extension* Vcb, calc_job* cj) {
-    LONG pos, done;
-    UINT32* csum;
-    UINT8* data;
-    ULONG blocksize, i;
+            if (!NT_SUCCESS(Status))
+                return Status;
+        }
 
-    pos = InterlockedIncrement(&cj->pos) - 1;
+        return STATUS_SUCCESS;
+    }
 
-    if ((UINT32)pos * SECTOR_BLOCK >= cj->sectors)
-        return FALSE;
+    cj = ExAllocateFromNPagedLookasideList(&ct->job_lookaside);
+    if (!cj) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    cj->type = CALC_JOB_COMPRESS;
+    cj->parts = parts;
+    cj->chunks = num_parts;
 
-    csum = &cj->csum[pos * SECTOR_BLOCK];
-    data = cj->data + (pos * SECTOR_BLOCK * Vcb->superblock.sector_size);
+    run_calc_job(Vcb, cj);
 
-    blocksize = min(SECTOR_BLOCK, cj->sectors - (pos * SECTOR_BLOCK));
-    for (i = 0; i < blocksize; i++) {
-        *csum = ~calc_crc32c(0xffffffff, data, Vcb->superblock.sector_size);
-        csum++;
-        data += Vcb->superblock.sector_size;
+    for (i = 0; i < num_parts; i++) {
+        if (!NT_SUCCESS(parts[i].Status))
+            return parts[i].Status;
     }
 
-    done = InterlockedIncrement(&cj->done);
+    return STATUS_SUCCESS;
+}
 
-    if ((UINT32)done * SECTOR_BLOCK >= cj->sectors) {
-        ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
-        RemoveEntryList(&cj->list_entry);
-        ExReleaseResourceLite(&Vcb->calcthreads.lock);
+static calc_job* get_calc_job(device_extension* Vcb, drv_calc_thread* thread) {
+    drv_calc_threads* ct = &Vcb->calcthreads;
+    ULONG i;
 
-        KeSetEvent(&cj->event, 0, FALSE);
+    // Our own queue first, then steal from the others
+
+    for (i = 0; i < ct->num_threads; i++) {
+        calc_queue* q = &ct->queues[(thread->number + i) % ct->num_threads];
+        calc_job* cj;
+        KIRQL irql;
+
+        if (IsListEmpty(&q->job_list))
+            continue;
+
+        KeAcquireSpinLock(&q->lock, &irql);
+
+        if (IsListEmpty(&q->job_list)) {
+            KeReleaseSpinLock(&q->lock, irql);
+            continue;
+        }
+
+        cj = CONTAINING_RECORD(q->job_list.Flink, calc_job, list_entry);
+        InterlockedIncrement(&cj->refcount);
+
+        KeReleaseSpinLock(&q->lock, irql);
+
+        return cj;
     }
 
-    return TRUE;
+    return NULL;
 }
 
 _Function_class_(KSTART_ROUTINE)
@@ -101,30 +222,14 @@ void calc_thread(void* context) {
     ObReferenceObject(thread->DeviceObject);
 
     while (TRUE) {
-        KeWaitForSingleObject(&Vcb->calcthreads.event, Executive, KernelMode, FALSE, NULL);
-
-        while (TRUE) {
-            calc_job* cj;
-            BOOL b;
-
-            ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
-
-            if (IsListEmpty(&Vcb->calcthreads.job_list)) {
-                ExReleaseResourceLite(&Vcb->calcthreads.lock);
-                break;
-            }
-
-            cj = CONTAINING_RECORD(Vcb->calcthreads.job_list.Flink, calc_job, list_entry);
-            cj->refcount++;
-
-            ExReleaseResourceLite(&Vcb->calcthreads.lock);
+        calc_job* cj;
 
-            b = do_calc(Vcb, cj);
+        KeWaitForSingleObject(&thread->event, Executive, KernelMode, FALSE, NULL);
 
-            free_calc_job(cj);
+        while ((cj = get_calc_job(Vcb, thread))) {
+            while (do_calc(Vcb, cj)) { }
 
-            if (!b)
-                break;
+            free_calc_job(Vcb, cj);
         }
 
         if (thread->quit)
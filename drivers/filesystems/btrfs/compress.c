@@ -26,6 +26,10 @@
 // Modern versions of lzo are licensed under the GPL, but the very oldest
 // versions are under the LGPL and hence okay to use here.
 
+// The zstd code is written from the format description in RFC 8878. The
+// decompressor handles anything the format allows apart from dictionaries;
+// the compressor only uses the parts of it which are cheap to produce.
+
 #include "btrfs_drv.h"
 
 #define Z_SOLO
@@ -41,6 +45,8 @@
 
 #define LINUX_PAGE_SIZE 4096
 
+#define COMPRESS_BATCH_MAX 32 // most 128 KB parts of a write we compress at once
+
 typedef struct {
     UINT8* in;
     UINT32 inlen;
@@ -361,35 +367,41 @@ NTSTATUS zlib_decompress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outle
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS zlib_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback) {
-    NTSTATUS Status;
-    UINT8 compression;
-    UINT32 comp_length;
+// Keeps the compressed data if it saves at least a sector, otherwise the
+// part gets written as it is.
+static void set_part_compressed(device_extension* Vcb, comp_part* part, UINT8* comp_data, UINT32 cl, UINT8 compression) {
+    if (cl + Vcb->superblock.sector_size > part->length) { // compressed extent would be larger than or same size as uncompressed extent
+        ExFreePool(comp_data);
+
+        part->comp_data = part->data;
+        part->comp_length = part->length;
+        part->compression = BTRFS_COMPRESSION_NONE;
+    } else {
+        part->comp_data = comp_data;
+        part->comp_length = (UINT32)sector_align(cl, Vcb->superblock.sector_size);
+        part->compression = compression;
+
+        RtlZeroMemory(comp_data + cl, part->comp_length - cl);
+    }
+}
+
+static NTSTATUS zlib_compress_part(device_extension* Vcb, comp_part* part) {
     UINT8* comp_data;
     UINT32 out_left;
-    LIST_ENTRY* le;
-    chunk* c;
     z_stream c_stream;
     int ret;
 
-    comp_data = ExAllocatePoolWithTag(PagedPool, (UINT32)(end_data - start_data), ALLOC_TAG);
+    comp_data = ExAllocatePoolWithTag(PagedPool, part->length, ALLOC_TAG);
     if (!comp_data) {
         ERR("out of memory\n");
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    Status = excise_extents(fcb->Vcb, fcb, start_data, end_data, Irp, rollback);
-    if (!NT_SUCCESS(Status)) {
-        ERR("excise_extents returned %08x\n", Status);
-        ExFreePool(comp_data);
-        return Status;
-    }
-
     c_stream.zalloc = zlib_alloc;
     c_stream.zfree = zlib_free;
     c_stream.opaque = (voidpf)0;
 
-    ret = deflateInit(&c_stream, fcb->Vcb->options.zlib_level);
+    ret = deflateInit(&c_stream, Vcb->options.zlib_level);
 
     if (ret != Z_OK) {
         ERR("deflateInit returned %08x\n", ret);
@@ -397,9 +409,9 @@ static NTSTATUS zlib_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 en
         return STATUS_INTERNAL_ERROR;
     }
 
-    c_stream.avail_in = (UINT32)(end_data - start_data);
-    c_stream.next_in = data;
-    c_stream.avail_out = (UINT32)(end_data - start_data);
+    c_stream.avail_in = part->length;
+    c_stream.next_in = part->data;
+    c_stream.avail_out = part->length;
     c_stream.next_out = comp_data;
 
     do {
@@ -422,90 +434,9 @@ static NTSTATUS zlib_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 en
         return STATUS_INTERNAL_ERROR;
     }
 
-    if (out_left < fcb->Vcb->superblock.sector_size) { // compressed extent would be larger than or same size as uncompressed extent
-        ExFreePool(comp_data);
-
-        comp_length = (UINT32)(end_data - start_data);
-        comp_data = data;
-        compression = BTRFS_COMPRESSION_NONE;
-
-        *compressed = FALSE;
-    } else {
-        UINT32 cl;
-
-        compression = BTRFS_COMPRESSION_ZLIB;
-        cl = (UINT32)(end_data - start_data - out_left);
-        comp_length = (UINT32)sector_align(cl, fcb->Vcb->superblock.sector_size);
-
-        RtlZeroMemory(comp_data + cl, comp_length - cl);
-
-        *compressed = TRUE;
-    }
-
-    ExAcquireResourceSharedLite(&fcb->Vcb->chunk_lock, TRUE);
-
-    le = fcb->Vcb->chunks.Flink;
-    while (le != &fcb->Vcb->chunks) {
-        c = CONTAINING_RECORD(le, chunk, list_entry);
-
-        if (!c->readonly && !c->reloc) {
-            ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-
-            if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-                if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data, FALSE, 0)) {
-                    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-
-                    if (compression != BTRFS_COMPRESSION_NONE)
-                        ExFreePool(comp_data);
-
-                    return STATUS_SUCCESS;
-                }
-            }
-
-            ExReleaseResourceLite(&c->lock);
-        }
-
-        le = le->Flink;
-    }
-
-    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-
-    ExAcquireResourceExclusiveLite(&fcb->Vcb->chunk_lock, TRUE);
-
-    Status = alloc_chunk(fcb->Vcb, fcb->Vcb->data_flags, &c, FALSE);
-
-    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-
-    if (!NT_SUCCESS(Status)) {
-        ERR("alloc_chunk returned %08x\n", Status);
-
-        if (compression != BTRFS_COMPRESSION_NONE)
-            ExFreePool(comp_data);
-
-        return Status;
-    }
-
-    if (c) {
-        ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-
-        if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-            if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data, FALSE, 0)) {
-                if (compression != BTRFS_COMPRESSION_NONE)
-                    ExFreePool(comp_data);
-
-                return STATUS_SUCCESS;
-            }
-        }
-
-        ExReleaseResourceLite(&c->lock);
-    }
-
-    WARN("couldn't find any data chunks with %llx bytes free\n", comp_length);
+    set_part_compressed(Vcb, part, comp_data, part->length - out_left, BTRFS_COMPRESSION_ZLIB);
 
-    if (compression != BTRFS_COMPRESSION_NONE)
-        ExFreePool(comp_data);
-
-    return STATUS_DISK_FULL;
+    return STATUS_SUCCESS;
 }
 
 static NTSTATUS lzo_do_compress(const UINT8* in, UINT32 in_len, UINT8* out, UINT32* out_len, void* wrkmem) {
@@ -749,19 +680,15 @@ static __inline UINT32 lzo_max_outlen(UINT32 inlen) {
     return inlen + (inlen / 16) + 64 + 3; // formula comes from LZO.FAQ
 }
 
-static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback) {
+static NTSTATUS lzo_compress_part(device_extension* Vcb, comp_part* part) {
     NTSTATUS Status;
-    UINT8 compression;
-    UINT64 comp_length;
     ULONG comp_data_len, num_pages, i;
     UINT8* comp_data;
     BOOL skip_compression = FALSE;
     lzo_stream stream;
     UINT32* out_size;
-    LIST_ENTRY* le;
-    chunk* c;
 
-    num_pages = (ULONG)((sector_align(end_data - start_data, LINUX_PAGE_SIZE)) / LINUX_PAGE_SIZE);
+    num_pages = (ULONG)((sector_align(part->length, LINUX_PAGE_SIZE)) / LINUX_PAGE_SIZE);
 
     // Four-byte overall header
     // Another four-byte header page
@@ -782,24 +709,16 @@ static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    Status = excise_extents(fcb->Vcb, fcb, start_data, end_data, Irp, rollback);
-    if (!NT_SUCCESS(Status)) {
-        ERR("excise_extents returned %08x\n", Status);
-        ExFreePool(comp_data);
-        ExFreePool(stream.wrkmem);
-        return Status;
-    }
-
     out_size = (UINT32*)comp_data;
     *out_size = sizeof(UINT32);
 
-    stream.in = data;
+    stream.in = part->data;
     stream.out = comp_data + (2 * sizeof(UINT32));
 
     for (i = 0; i < num_pages; i++) {
         UINT32* pagelen = (UINT32*)(stream.out - sizeof(UINT32));
 
-        stream.inlen = (UINT32)min(LINUX_PAGE_SIZE, end_data - start_data - (i * LINUX_PAGE_SIZE));
+        stream.inlen = (UINT32)min(LINUX_PAGE_SIZE, part->length - (i * LINUX_PAGE_SIZE));
 
         Status = lzo1x_1_compress(&stream);
         if (!NT_SUCCESS(Status)) {
@@ -823,107 +742,1962 @@ static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end
 
     ExFreePool(stream.wrkmem);
 
-    if (skip_compression || *out_size >= end_data - start_data - fcb->Vcb->superblock.sector_size) { // compressed extent would be larger than or same size as uncompressed extent
-        ExFreePool(comp_data);
+    set_part_compressed(Vcb, part, comp_data, skip_compression ? part->length : *out_size, BTRFS_COMPRESSION_LZO);
 
-        comp_length = end_data - start_data;
-        comp_data = data;
-        compression = BTRFS_COMPRESSION_NONE;
+    return STATUS_SUCCESS;
+}
 
-        *compressed = FALSE;
-    } else {
-        compression = BTRFS_COMPRESSION_LZO;
-        comp_length = sector_align(*out_size, fcb->Vcb->superblock.sector_size);
+#define ZSTD_MAGIC              0xfd2fb528
+#define ZSTD_SKIPPABLE_MAGIC    0x184d2a50 // the bottom four bits can be anything
+
+#define ZSTD_BLOCK_SIZE_MAX     0x20000
+
+#define ZSTD_BLOCK_RAW          0
+#define ZSTD_BLOCK_RLE          1
+#define ZSTD_BLOCK_COMPRESSED   2
+
+#define ZSTD_LITERALS_RAW           0
+#define ZSTD_LITERALS_RLE           1
+#define ZSTD_LITERALS_COMPRESSED    2
+#define ZSTD_LITERALS_TREELESS      3
+
+#define ZSTD_MODE_PREDEFINED    0
+#define ZSTD_MODE_RLE           1
+#define ZSTD_MODE_FSE           2
+#define ZSTD_MODE_REPEAT        3
+
+#define ZSTD_HUF_MAX_BITS       11
+#define ZSTD_FSE_MAX_LOG        9
+
+#define ZSTD_LL_MAX_SYMBOL      35
+#define ZSTD_ML_MAX_SYMBOL      52
+#define ZSTD_OF_MAX_SYMBOL      31
+
+#define ZSTD_LL_MAX_LOG         9
+#define ZSTD_ML_MAX_LOG         9
+#define ZSTD_OF_MAX_LOG         8
+#define ZSTD_WEIGHTS_MAX_LOG    6
+
+#define ZSTD_LL_DEFAULT_LOG     6
+#define ZSTD_ML_DEFAULT_LOG     6
+#define ZSTD_OF_DEFAULT_LOG     5
+
+static const UINT32 zstd_ll_base[ZSTD_LL_MAX_SYMBOL + 1] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+};
+
+static const UINT8 zstd_ll_bits[ZSTD_LL_MAX_SYMBOL + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+};
+
+static const UINT32 zstd_ml_base[ZSTD_ML_MAX_SYMBOL + 1] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+};
+
+static const UINT8 zstd_ml_bits[ZSTD_ML_MAX_SYMBOL + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+};
+
+// Predefined distributions, from RFC 8878
+
+static const INT16 zstd_ll_default[ZSTD_LL_MAX_SYMBOL + 1] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+};
+
+static const INT16 zstd_ml_default[ZSTD_ML_MAX_SYMBOL + 1] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+};
+
+static const INT16 zstd_of_default[29] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+typedef struct {
+    UINT16 new_state;
+    UINT8 symbol;
+    UINT8 bits;
+} zstd_fse_entry;
+
+typedef struct {
+    zstd_fse_entry entries[1 << ZSTD_FSE_MAX_LOG];
+    UINT32 log;
+    BOOL valid;
+} zstd_fse_table;
 
-        RtlZeroMemory(comp_data + *out_size, (ULONG)(comp_length - *out_size));
+typedef struct {
+    UINT8 symbol;
+    UINT8 bits;
+} zstd_huf_entry;
+
+typedef struct {
+    zstd_huf_entry huf[1 << ZSTD_HUF_MAX_BITS];
+    UINT32 huf_bits; // 0 until a block has a Huffman tree
+    zstd_fse_table ll, of, ml;
+    UINT32 rep[3];
+    UINT8 literals[ZSTD_BLOCK_SIZE_MAX];
+} zstd_dctx;
+
+// Bitstreams are little-endian; the backward ones are read from the
+// end, starting just below the highest set bit of the last byte.
 
-        *compressed = TRUE;
+typedef struct {
+    const UINT8* data;
+    UINT32 size;
+    INT32 pos;
+} zstd_bitreader;
+
+static UINT32 zstd_highbit(UINT32 v) {
+    UINT32 n = 0;
+
+    while (v >>= 1) {
+        n++;
     }
 
-    ExAcquireResourceSharedLite(&fcb->Vcb->chunk_lock, TRUE);
+    return n;
+}
 
-    le = fcb->Vcb->chunks.Flink;
-    while (le != &fcb->Vcb->chunks) {
-        c = CONTAINING_RECORD(le, chunk, list_entry);
+// n may be up to 32; bits below the start of the stream read as zero
+static UINT32 zstd_get_bits(const UINT8* data, UINT32 size, INT32 pos, UINT32 n) {
+    UINT64 v = 0;
+    UINT32 byte, i;
 
-        if (!c->readonly && !c->reloc) {
-            ExAcquireResourceExclusiveLite(&c->lock, TRUE);
+    if (n == 0)
+        return 0;
 
-            if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-                if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data, FALSE, 0)) {
-                    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+    if (pos < 0) {
+        if ((INT32)n + pos <= 0)
+            return 0;
 
-                    if (compression != BTRFS_COMPRESSION_NONE)
-                        ExFreePool(comp_data);
+        return zstd_get_bits(data, size, 0, n + pos) << -pos;
+    }
 
-                    return STATUS_SUCCESS;
+    byte = (UINT32)pos >> 3;
+
+    for (i = 0; i < 5 && byte + i < size; i++) {
+        v |= (UINT64)data[byte + i] << (i * 8);
+    }
+
+    return (UINT32)((v >> (pos & 7)) & ((1ull << n) - 1));
+}
+
+static __inline UINT32 zstd_le32(const UINT8* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+static BOOL zstd_init_bitreader(zstd_bitreader* br, const UINT8* data, UINT32 size) {
+    if (size == 0 || data[size - 1] == 0)
+        return FALSE;
+
+    br->data = data;
+    br->size = size;
+    br->pos = (INT32)(((size - 1) * 8) + zstd_highbit(data[size - 1]));
+
+    return TRUE;
+}
+
+static __inline UINT32 zstd_read_bits(zstd_bitreader* br, UINT32 n) {
+    br->pos -= n;
+
+    return zstd_get_bits(br->data, br->size, br->pos, n);
+}
+
+static __inline UINT32 zstd_peek_bits(zstd_bitreader* br, UINT32 n) {
+    return zstd_get_bits(br->data, br->size, br->pos - n, n);
+}
+
+static NTSTATUS zstd_build_fse_table(zstd_fse_table* table, const INT16* norm, UINT32 num_symbols, UINT32 log) {
+    UINT16 next[ZSTD_ML_MAX_SYMBOL + 1];
+    UINT32 size = 1 << log, high = size - 1, step, pos = 0, s, u;
+    INT32 i;
+
+    for (s = 0; s < num_symbols; s++) {
+        if (norm[s] == -1) {
+            table->entries[high].symbol = (UINT8)s;
+            high--;
+            next[s] = 1;
+        } else
+            next[s] = (UINT16)norm[s];
+    }
+
+    step = (size >> 1) + (size >> 3) + 3;
+
+    for (s = 0; s < num_symbols; s++) {
+        for (i = 0; i < norm[s]; i++) {
+            table->entries[pos].symbol = (UINT8)s;
+
+            do {
+                pos = (pos + step) & (size - 1);
+            } while (pos > high);
+        }
+    }
+
+    if (pos != 0) {
+        ERR("invalid FSE distribution\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    for (u = 0; u < size; u++) {
+        UINT32 state = next[table->entries[u].symbol]++;
+        UINT32 bits = log - zstd_highbit(state);
+
+        table->entries[u].bits = (UINT8)bits;
+        table->entries[u].new_state = (UINT16)((state << bits) - size);
+    }
+
+    table->log = log;
+    table->valid = TRUE;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS zstd_read_fse_table(zstd_fse_table* table, const UINT8* data, UINT32 size, UINT32 max_symbol, UINT32 max_log, UINT32* used) {
+    INT16 norm[ZSTD_ML_MAX_SYMBOL + 1];
+    INT32 remaining, threshold;
+    UINT32 pos, log, bits, symbol = 0;
+    BOOL previous0 = FALSE;
+
+    if (size == 0) {
+        ERR("FSE table truncated\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    log = (data[0] & 0xf) + 5;
+    pos = 4;
+
+    if (log > max_log) {
+        ERR("FSE accuracy log %u too large\n", log);
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    remaining = (1 << log) + 1;
+    threshold = 1 << log;
+    bits = log + 1;
+
+    while (remaining > 1 && symbol <= max_symbol) {
+        INT32 maxval, count;
+        UINT32 v;
+
+        if (previous0) {
+            UINT32 repeat, i;
+
+            // 2-bit repeat flags give the number of further zero
+            // probabilities, 3 meaning that another flag follows
+
+            do {
+                repeat = zstd_get_bits(data, size, pos, 2);
+                pos += 2;
+
+                for (i = 0; i < repeat && symbol <= max_symbol; i++) {
+                    norm[symbol++] = 0;
                 }
-            }
+            } while (repeat == 3 && symbol <= max_symbol);
 
-            ExReleaseResourceLite(&c->lock);
+            if (symbol > max_symbol)
+                break;
         }
 
-        le = le->Flink;
+        maxval = (2 * threshold - 1) - remaining;
+        v = zstd_get_bits(data, size, pos, bits);
+
+        if ((INT32)(v & (threshold - 1)) < maxval) {
+            count = v & (threshold - 1);
+            pos += bits - 1;
+        } else {
+            count = v & (2 * threshold - 1);
+            if (count >= threshold)
+                count -= maxval;
+            pos += bits;
+        }
+
+        count--;
+        remaining -= count < 0 ? -count : count;
+
+        if (remaining < 1)
+            break;
+
+        norm[symbol++] = (INT16)count;
+        previous0 = count == 0;
+
+        while (remaining < threshold) {
+            bits--;
+            threshold >>= 1;
+        }
     }
 
-    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+    if (remaining != 1 || pos > size * 8) {
+        ERR("invalid FSE table\n");
+        return STATUS_INTERNAL_ERROR;
+    }
 
-    ExAcquireResourceExclusiveLite(&fcb->Vcb->chunk_lock, TRUE);
+    while (symbol <= max_symbol) {
+        norm[symbol++] = 0;
+    }
 
-    Status = alloc_chunk(fcb->Vcb, fcb->Vcb->data_flags, &c, FALSE);
+    *used = (pos + 7) / 8;
 
-    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+    return zstd_build_fse_table(table, norm, max_symbol + 1, log);
+}
 
-    if (!NT_SUCCESS(Status)) {
-        ERR("alloc_chunk returned %08x\n", Status);
+static NTSTATUS zstd_build_huf_table(zstd_dctx* ctx, UINT8* weights, UINT32 num_weights) {
+    UINT32 total = 0, rest, max_bits, pos = 0, w, s, i;
 
-        if (compression != BTRFS_COMPRESSION_NONE)
-            ExFreePool(comp_data);
+    for (i = 0; i < num_weights; i++) {
+        if (weights[i] > ZSTD_HUF_MAX_BITS) {
+            ERR("invalid Huffman weight %u\n", weights[i]);
+            return STATUS_INTERNAL_ERROR;
+        }
 
-        return Status;
+        if (weights[i] > 0)
+            total += 1 << (weights[i] - 1);
     }
 
-    if (c) {
-        ExAcquireResourceExclusiveLite(&c->lock, TRUE);
+    if (total == 0) {
+        ERR("empty Huffman tree\n");
+        return STATUS_INTERNAL_ERROR;
+    }
 
-        if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-            if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data, FALSE, 0)) {
-                if (compression != BTRFS_COMPRESSION_NONE)
-                    ExFreePool(comp_data);
+    // The weight of the last symbol isn't stored, it's whatever makes the
+    // total up to the next power of two
 
-                return STATUS_SUCCESS;
+    max_bits = zstd_highbit(total) + 1;
+    rest = (1 << max_bits) - total;
+
+    if (max_bits > ZSTD_HUF_MAX_BITS || rest & (rest - 1)) {
+        ERR("invalid Huffman tree\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    weights[num_weights++] = (UINT8)(zstd_highbit(rest) + 1);
+
+    // Codes are handed out by increasing weight, then by symbol
+
+    for (w = 1; w <= max_bits; w++) {
+        for (s = 0; s < num_weights; s++) {
+            if (weights[s] == w) {
+                for (i = 0; i < (1u << (w - 1)); i++) {
+                    ctx->huf[pos + i].symbol = (UINT8)s;
+                    ctx->huf[pos + i].bits = (UINT8)(max_bits + 1 - w);
+                }
+
+                pos += 1 << (w - 1);
             }
         }
+    }
 
-        ExReleaseResourceLite(&c->lock);
+    ctx->huf_bits = max_bits;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS zstd_read_huf_tree(zstd_dctx* ctx, const UINT8* data, UINT32 size, UINT32* used) {
+    UINT8 weights[256];
+    UINT32 num_weights, header, i;
+    NTSTATUS Status;
+
+    if (size == 0) {
+        ERR("Huffman tree truncated\n");
+        return STATUS_INTERNAL_ERROR;
     }
 
-    WARN("couldn't find any data chunks with %llx bytes free\n", comp_length);
+    header = data[0];
 
-    if (compression != BTRFS_COMPRESSION_NONE)
-        ExFreePool(comp_data);
+    if (header >= 128) {
+        // weights as 4-bit values
+        num_weights = header - 127;
 
-    return STATUS_DISK_FULL;
+        if (1 + ((num_weights + 1) / 2) > size) {
+            ERR("Huffman tree truncated\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        for (i = 0; i < num_weights; i++) {
+            weights[i] = (i & 1) ? (data[1 + (i / 2)] & 0xf) : (data[1 + (i / 2)] >> 4);
+        }
+
+        *used = 1 + ((num_weights + 1) / 2);
+    } else {
+        // weights compressed with FSE, with two interleaved states
+        zstd_fse_table table;
+        zstd_bitreader br;
+        UINT32 tablelen, state1, state2;
+
+        if (1 + header > size) {
+            ERR("Huffman tree truncated\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        Status = zstd_read_fse_table(&table, data + 1, header, ZSTD_HUF_MAX_BITS, ZSTD_WEIGHTS_MAX_LOG, &tablelen);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        if (!zstd_init_bitreader(&br, data + 1 + tablelen, header - tablelen)) {
+            ERR("invalid Huffman weights bitstream\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        state1 = zstd_read_bits(&br, table.log);
+        state2 = zstd_read_bits(&br, table.log);
+        num_weights = 0;
+
+        while (TRUE) {
+            if (num_weights >= 254) {
+                ERR("too many Huffman weights\n");
+                return STATUS_INTERNAL_ERROR;
+            }
+
+            weights[num_weights++] = table.entries[state1].symbol;
+            state1 = table.entries[state1].new_state + zstd_read_bits(&br, table.entries[state1].bits);
+
+            if (br.pos < 0) {
+                weights[num_weights++] = table.entries[state2].symbol;
+                break;
+            }
+
+            weights[num_weights++] = table.entries[state2].symbol;
+            state2 = table.entries[state2].new_state + zstd_read_bits(&br, table.entries[state2].bits);
+
+            if (br.pos < 0) {
+                weights[num_weights++] = table.entries[state1].symbol;
+                break;
+            }
+        }
+
+        *used = 1 + header;
+    }
+
+    return zstd_build_huf_table(ctx, weights, num_weights);
 }
 
-NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback) {
-    UINT8 type;
+static NTSTATUS zstd_decode_huf_stream(zstd_dctx* ctx, const UINT8* data, UINT32 size, UINT8* out, UINT32 outlen) {
+    zstd_bitreader br;
+    UINT32 i;
 
-    if (fcb->Vcb->options.compress_type != 0 && fcb->prop_compression == PropCompression_None)
-        type = fcb->Vcb->options.compress_type;
-    else {
-        if (!(fcb->Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO) && fcb->prop_compression == PropCompression_LZO) {
-            fcb->Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO;
-            type = BTRFS_COMPRESSION_LZO;
-        } else if (fcb->Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO && fcb->prop_compression != PropCompression_Zlib)
-            type = BTRFS_COMPRESSION_LZO;
-        else
-            type = BTRFS_COMPRESSION_ZLIB;
+    if (!zstd_init_bitreader(&br, data, size)) {
+        ERR("invalid Huffman bitstream\n");
+        return STATUS_INTERNAL_ERROR;
     }
 
-    if (type == BTRFS_COMPRESSION_LZO) {
-        fcb->Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO;
-        return lzo_write_compressed_bit(fcb, start_data, end_data, data, compressed, Irp, rollback);
-    } else
-        return zlib_write_compressed_bit(fcb, start_data, end_data, data, compressed, Irp, rollback);
+    for (i = 0; i < outlen; i++) {
+        zstd_huf_entry* e = &ctx->huf[zstd_peek_bits(&br, ctx->huf_bits)];
+
+        out[i] = e->symbol;
+        br.pos -= e->bits;
+    }
+
+    if (br.pos != 0) {
+        ERR("Huffman bitstream not consumed\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS zstd_decode_literals(zstd_dctx* ctx, const UINT8* data, UINT32 size, const UINT8** literals, UINT32* litlen, UINT32* used) {
+    UINT32 type, format, headerlen, regen, comp;
+    NTSTATUS Status;
+
+    if (size == 0) {
+        ERR("literals section truncated\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    type = data[0] & 3;
+    format = (data[0] >> 2) & 3;
+
+    if (type == ZSTD_LITERALS_RAW || type == ZSTD_LITERALS_RLE) {
+        if (format == 0 || format == 2) {
+            headerlen = 1;
+            regen = data[0] >> 3;
+        } else if (format == 1) {
+            headerlen = 2;
+            regen = size < 2 ? 0 : (data[0] >> 4) | (data[1] << 4);
+        } else {
+            headerlen = 3;
+            regen = size < 3 ? 0 : (data[0] >> 4) | (data[1] << 4) | (data[2] << 12);
+        }
+
+        if (regen > ZSTD_BLOCK_SIZE_MAX || headerlen + (type == ZSTD_LITERALS_RAW ? regen : 1) > size) {
+            ERR("literals section truncated\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        if (type == ZSTD_LITERALS_RAW) {
+            *literals = data + headerlen;
+            *used = headerlen + regen;
+        } else {
+            RtlFillMemory(ctx->literals, regen, data[headerlen]);
+            *literals = ctx->literals;
+            *used = headerlen + 1;
+        }
+
+        *litlen = regen;
+
+        return STATUS_SUCCESS;
+    }
+
+    headerlen = format < 2 ? 3 : (format == 2 ? 4 : 5);
+
+    if (headerlen > size) {
+        ERR("literals section truncated\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    if (headerlen == 3) {
+        UINT32 v = data[0] | (data[1] << 8) | (data[2] << 16);
+
+        regen = (v >> 4) & 0x3ff;
+        comp = (v >> 14) & 0x3ff;
+    } else if (headerlen == 4) {
+        UINT32 v = zstd_le32(data);
+
+        regen = (v >> 4) & 0x3fff;
+        comp = v >> 18;
+    } else {
+        UINT64 v = data[0] | (data[1] << 8) | (data[2] << 16) | ((UINT64)data[3] << 24) | ((UINT64)data[4] << 32);
+
+        regen = (UINT32)(v >> 4) & 0x3ffff;
+        comp = (UINT32)(v >> 22) & 0x3ffff;
+    }
+
+    if (regen > ZSTD_BLOCK_SIZE_MAX || headerlen + comp > size) {
+        ERR("literals section truncated\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    *used = headerlen + comp;
+    data += headerlen;
+
+    if (type == ZSTD_LITERALS_COMPRESSED) {
+        UINT32 treelen;
+
+        Status = zstd_read_huf_tree(ctx, data, comp, &treelen);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        data += treelen;
+        comp -= treelen;
+    } else if (ctx->huf_bits == 0) {
+        ERR("treeless literals without a previous Huffman tree\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    if (format == 0) {
+        Status = zstd_decode_huf_stream(ctx, data, comp, ctx->literals, regen);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    } else {
+        UINT32 streamlen[4], seg, i;
+        UINT8* out = ctx->literals;
+
+        // jump table with the sizes of the first three streams
+
+        if (comp < 6) {
+            ERR("literals jump table truncated\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        streamlen[0] = data[0] | (data[1] << 8);
+        streamlen[1] = data[2] | (data[3] << 8);
+        streamlen[2] = data[4] | (data[5] << 8);
+
+        if (6 + streamlen[0] + streamlen[1] + streamlen[2] > comp) {
+            ERR("literals streams truncated\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        streamlen[3] = comp - 6 - streamlen[0] - streamlen[1] - streamlen[2];
+        seg = (regen + 3) / 4;
+
+        if (seg * 3 > regen) {
+            ERR("too few literals for four streams\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        data += 6;
+
+        for (i = 0; i < 4; i++) {
+            UINT32 outlen = i < 3 ? seg : regen - (seg * 3);
+
+            Status = zstd_decode_huf_stream(ctx, data, streamlen[i], out, outlen);
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            data += streamlen[i];
+            out += outlen;
+        }
+    }
+
+    *literals = ctx->literals;
+    *litlen = regen;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS zstd_read_seq_table(zstd_fse_table* table, UINT32 mode, const UINT8* data, UINT32 size, UINT32* pos,
+                                    const INT16* def, UINT32 def_symbols, UINT32 def_log, UINT32 max_symbol, UINT32 max_log) {
+    NTSTATUS Status;
+    UINT32 used;
+
+    switch (mode) {
+        case ZSTD_MODE_PREDEFINED:
+            return zstd_build_fse_table(table, def, def_symbols, def_log);
+
+        case ZSTD_MODE_RLE:
+            if (*pos >= size || data[*pos] > max_symbol) {
+                ERR("invalid RLE sequence table\n");
+                return STATUS_INTERNAL_ERROR;
+            }
+
+            table->entries[0].symbol = data[*pos];
+            table->entries[0].bits = 0;
+            table->entries[0].new_state = 0;
+            table->log = 0;
+            table->valid = TRUE;
+            (*pos)++;
+
+            return STATUS_SUCCESS;
+
+        case ZSTD_MODE_FSE:
+            Status = zstd_read_fse_table(table, data + *pos, size - *pos, max_symbol, max_log, &used);
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            *pos += used;
+
+            return STATUS_SUCCESS;
+
+        default: // ZSTD_MODE_REPEAT
+            if (!table->valid) {
+                ERR("repeated sequence table without a previous one\n");
+                return STATUS_INTERNAL_ERROR;
+            }
+
+            return STATUS_SUCCESS;
+    }
+}
+
+// Copies length bytes from src to the output, stopping when it is full.
+// Returns FALSE once there is no more room.
+static __inline BOOL zstd_output(UINT8* outbuf, UINT32* outpos, UINT32 outlen, const UINT8* src, UINT32 length) {
+    if (length > outlen - *outpos) {
+        RtlCopyMemory(outbuf + *outpos, src, outlen - *outpos);
+        *outpos = outlen;
+        return FALSE;
+    }
+
+    RtlCopyMemory(outbuf + *outpos, src, length);
+    *outpos += length;
+
+    return *outpos < outlen;
+}
+
+static NTSTATUS zstd_decode_sequences(zstd_dctx* ctx, const UINT8* data, UINT32 size, const UINT8* literals, UINT32 litlen,
+                                      UINT8* outbuf, UINT32 framestart, UINT32* outpos, UINT32 outlen) {
+    NTSTATUS Status;
+    UINT32 num_seqs, pos, modes, llstate, ofstate, mlstate, i;
+    zstd_bitreader br;
+
+    if (size == 0) {
+        ERR("sequences section truncated\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    if (data[0] < 128) {
+        num_seqs = data[0];
+        pos = 1;
+    } else if (data[0] < 255) {
+        if (size < 2) {
+            ERR("sequences section truncated\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        num_seqs = ((data[0] - 128) << 8) + data[1];
+        pos = 2;
+    } else {
+        if (size < 3) {
+            ERR("sequences section truncated\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        num_seqs = data[1] + (data[2] << 8) + 0x7f00;
+        pos = 3;
+    }
+
+    if (num_seqs == 0) {
+        zstd_output(outbuf, outpos, outlen, literals, litlen);
+        return STATUS_SUCCESS;
+    }
+
+    if (pos >= size || data[pos] & 3) {
+        ERR("invalid sequence compression modes\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    modes = data[pos];
+    pos++;
+
+    Status = zstd_read_seq_table(&ctx->ll, modes >> 6, data, size, &pos, zstd_ll_default, sizeof(zstd_ll_default) / sizeof(INT16),
+                                 ZSTD_LL_DEFAULT_LOG, ZSTD_LL_MAX_SYMBOL, ZSTD_LL_MAX_LOG);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Status = zstd_read_seq_table(&ctx->of, (modes >> 4) & 3, data, size, &pos, zstd_of_default, sizeof(zstd_of_default) / sizeof(INT16),
+                                 ZSTD_OF_DEFAULT_LOG, ZSTD_OF_MAX_SYMBOL, ZSTD_OF_MAX_LOG);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Status = zstd_read_seq_table(&ctx->ml, (modes >> 2) & 3, data, size, &pos, zstd_ml_default, sizeof(zstd_ml_default) / sizeof(INT16),
+                                 ZSTD_ML_DEFAULT_LOG, ZSTD_ML_MAX_SYMBOL, ZSTD_ML_MAX_LOG);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (!zstd_init_bitreader(&br, data + pos, size - pos)) {
+        ERR("invalid sequences bitstream\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    llstate = zstd_read_bits(&br, ctx->ll.log);
+    ofstate = zstd_read_bits(&br, ctx->of.log);
+    mlstate = zstd_read_bits(&br, ctx->ml.log);
+
+    for (i = 0; i < num_seqs; i++) {
+        UINT32 llcode = ctx->ll.entries[llstate].symbol;
+        UINT32 ofcode = ctx->of.entries[ofstate].symbol;
+        UINT32 mlcode = ctx->ml.entries[mlstate].symbol;
+        UINT32 offset, ll, ml, j;
+
+        offset = (1u << ofcode) + zstd_read_bits(&br, ofcode);
+        ml = zstd_ml_base[mlcode] + zstd_read_bits(&br, zstd_ml_bits[mlcode]);
+        ll = zstd_ll_base[llcode] + zstd_read_bits(&br, zstd_ll_bits[llcode]);
+
+        // Offset values 1 to 3 refer to the last three offsets used, shifted
+        // by one if there are no literals
+
+        if (offset > 3) {
+            offset -= 3;
+            ctx->rep[2] = ctx->rep[1];
+            ctx->rep[1] = ctx->rep[0];
+            ctx->rep[0] = offset;
+        } else {
+            UINT32 idx = offset - 1 + (ll == 0 ? 1 : 0);
+
+            if (idx == 0)
+                offset = ctx->rep[0];
+            else {
+                offset = idx == 3 ? ctx->rep[0] - 1 : ctx->rep[idx];
+
+                if (idx > 1)
+                    ctx->rep[2] = ctx->rep[1];
+
+                ctx->rep[1] = ctx->rep[0];
+                ctx->rep[0] = offset;
+            }
+        }
+
+        if (i != num_seqs - 1) {
+            llstate = ctx->ll.entries[llstate].new_state + zstd_read_bits(&br, ctx->ll.entries[llstate].bits);
+            mlstate = ctx->ml.entries[mlstate].new_state + zstd_read_bits(&br, ctx->ml.entries[mlstate].bits);
+            ofstate = ctx->of.entries[ofstate].new_state + zstd_read_bits(&br, ctx->of.entries[ofstate].bits);
+        }
+
+        if (ll > litlen) {
+            ERR("sequence uses more literals than there are\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        if (!zstd_output(outbuf, outpos, outlen, literals, ll))
+            return STATUS_SUCCESS;
+
+        literals += ll;
+        litlen -= ll;
+
+        if (offset == 0 || offset > *outpos - framestart) {
+            ERR("match offset %x out of range\n", offset);
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        // byte by byte, as the match can overlap what it's producing
+
+        for (j = 0; j < ml; j++) {
+            outbuf[*outpos] = outbuf[*outpos - offset];
+            (*outpos)++;
+
+            if (*outpos == outlen)
+                return STATUS_SUCCESS;
+        }
+    }
+
+    if (br.pos != 0) {
+        ERR("sequences bitstream not consumed\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    zstd_output(outbuf, outpos, outlen, literals, litlen);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS zstd_decompress_frame(zstd_dctx* ctx, UINT8* inbuf, UINT32 inlen, UINT32* inpos, UINT8* outbuf, UINT32 outlen, UINT32* outpos) {
+    static const UINT8 dictid_len[] = { 0, 1, 2, 4 };
+    static const UINT8 fcs_len[] = { 0, 2, 4, 8 };
+    NTSTATUS Status;
+    UINT32 pos = *inpos + sizeof(UINT32), framestart = *outpos, fhd, i;
+    UINT32 dictid = 0;
+    BOOL last;
+
+    if (pos >= inlen) {
+        ERR("zstd frame header truncated\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    fhd = inbuf[pos];
+    pos++;
+
+    if (fhd & 0x08) {
+        ERR("reserved bit set in zstd frame header\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    // We decompress into a flat buffer, so the window size doesn't matter
+    if (!(fhd & 0x20))
+        pos++;
+
+    if (pos + dictid_len[fhd & 3] > inlen) {
+        ERR("zstd frame header truncated\n");
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    for (i = 0; i < dictid_len[fhd & 3]; i++) {
+        dictid |= inbuf[pos + i] << (i * 8);
+    }
+
+    if (dictid != 0) {
+        ERR("zstd dictionaries not supported\n");
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    pos += dictid_len[fhd & 3];
+    pos += (fhd >> 6) == 0 && fhd & 0x20 ? 1 : fcs_len[fhd >> 6];
+
+    ctx->huf_bits = 0;
+    ctx->ll.valid = ctx->of.valid = ctx->ml.valid = FALSE;
+    ctx->rep[0] = 1;
+    ctx->rep[1] = 4;
+    ctx->rep[2] = 8;
+
+    do {
+        UINT32 header, type, size;
+
+        if (pos + 3 > inlen) {
+            ERR("zstd block header truncated\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        header = inbuf[pos] | (inbuf[pos + 1] << 8) | (inbuf[pos + 2] << 16);
+        pos += 3;
+
+        last = header & 1;
+        type = (header >> 1) & 3;
+        size = header >> 3;
+
+        if (size > ZSTD_BLOCK_SIZE_MAX) {
+            ERR("zstd block too large (%x)\n", size);
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        if (type == ZSTD_BLOCK_RAW) {
+            if (pos + size > inlen) {
+                ERR("zstd block truncated\n");
+                return STATUS_INTERNAL_ERROR;
+            }
+
+            zstd_output(outbuf, outpos, outlen, inbuf + pos, size);
+            pos += size;
+        } else if (type == ZSTD_BLOCK_RLE) {
+            if (pos + 1 > inlen) {
+                ERR("zstd block truncated\n");
+                return STATUS_INTERNAL_ERROR;
+            }
+
+            size = min(size, outlen - *outpos);
+            RtlFillMemory(outbuf + *outpos, size, inbuf[pos]);
+            *outpos += size;
+            pos++;
+        } else if (type == ZSTD_BLOCK_COMPRESSED) {
+            const UINT8* literals;
+            UINT32 litlen, used;
+
+            if (pos + size > inlen) {
+                ERR("zstd block truncated\n");
+                return STATUS_INTERNAL_ERROR;
+            }
+
+            Status = zstd_decode_literals(ctx, inbuf + pos, size, &literals, &litlen, &used);
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            Status = zstd_decode_sequences(ctx, inbuf + pos + used, size - used, literals, litlen, outbuf, framestart, outpos, outlen);
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            pos += size;
+        } else {
+            ERR("reserved zstd block type\n");
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        if (*outpos == outlen)
+            break;
+    } while (!last);
+
+    // content checksum, which we don't verify
+    if (fhd & 0x04)
+        pos += sizeof(UINT32);
+
+    *inpos = pos;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS zstd_decompress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    zstd_dctx* ctx;
+    UINT32 inpos = 0, outpos = 0;
+
+    ctx = ExAllocatePoolWithTag(PagedPool, sizeof(zstd_dctx), ALLOC_TAG);
+    if (!ctx) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // The extent is normally one frame, followed by zeroes up to the end of
+    // the sector
+
+    while (outpos < outlen && inlen - inpos >= sizeof(UINT32)) {
+        UINT32 magic = zstd_le32(&inbuf[inpos]);
+
+        if ((magic & 0xfffffff0) == ZSTD_SKIPPABLE_MAGIC) {
+            UINT32 len;
+
+            if (inlen - inpos < 2 * sizeof(UINT32))
+                break;
+
+            len = zstd_le32(&inbuf[inpos + sizeof(UINT32)]);
+
+            if (len > inlen - inpos - (2 * sizeof(UINT32)))
+                break;
+
+            inpos += (2 * sizeof(UINT32)) + len;
+            continue;
+        }
+
+        if (magic != ZSTD_MAGIC) {
+            if (inpos == 0) {
+                ERR("zstd magic not found\n");
+                Status = STATUS_INTERNAL_ERROR;
+            }
+
+            break;
+        }
+
+        Status = zstd_decompress_frame(ctx, inbuf, inlen, &inpos, outbuf, outlen, &outpos);
+        if (!NT_SUCCESS(Status)) {
+            ERR("zstd_decompress_frame returned %08x\n", Status);
+            break;
+        }
+    }
+
+    ExFreePool(ctx);
+
+    return Status;
+}
+
+// The compressor produces one frame, with the content size and without a
+// checksum, like the Linux driver does. Matches are found with hash chains,
+// the level setting how far down the chains we look. Literals are Huffman
+// coded when all of them are below 0x80, so that the weights can be stored
+// directly, and the sequences use the predefined FSE tables.
+
+#define ZSTD_HASH_BITS          14
+#define ZSTD_WINDOW_SIZE        0x10000
+#define ZSTD_MIN_MATCH          4
+#define ZSTD_MAX_SEQS           8192
+#define ZSTD_MIN_HUF_LITERALS   64
+#define ZSTD_MAX_DIRECT_WEIGHTS 128
+
+typedef struct {
+    UINT32 litlen;
+    UINT32 matchlen;
+    UINT32 offset; // as written: 1 for the last offset used, otherwise the distance plus 3
+} zstd_seq;
+
+typedef struct {
+    UINT16 state_table[1 << ZSTD_LL_DEFAULT_LOG];
+    INT32 delta_find_state[ZSTD_ML_MAX_SYMBOL + 1];
+    UINT32 delta_nb_bits[ZSTD_ML_MAX_SYMBOL + 1];
+    UINT32 log;
+} zstd_fse_ctable;
+
+typedef struct {
+    UINT32 hash[1 << ZSTD_HASH_BITS]; // position + 1 of the last string with this hash
+    UINT16 chain[ZSTD_WINDOW_SIZE]; // distance back to the previous string with the same hash
+    zstd_seq seqs[ZSTD_MAX_SEQS];
+    UINT8 literals[ZSTD_BLOCK_SIZE_MAX];
+    zstd_fse_ctable ll, of, ml;
+    UINT32 rep;
+    UINT32 depth;
+    UINT32 nice;
+} zstd_cctx;
+
+typedef struct {
+    UINT8* out;
+    UINT32 size;
+    UINT32 pos;
+    UINT64 acc;
+    UINT32 bits;
+    BOOL overflow;
+} zstd_bitwriter;
+
+static void zstd_init_bitwriter(zstd_bitwriter* bw, UINT8* out, UINT32 size) {
+    bw->out = out;
+    bw->size = size;
+    bw->pos = 0;
+    bw->acc = 0;
+    bw->bits = 0;
+    bw->overflow = FALSE;
+}
+
+static __inline void zstd_add_bits(zstd_bitwriter* bw, UINT32 value, UINT32 n) {
+    bw->acc |= (UINT64)(value & (UINT32)((1ull << n) - 1)) << bw->bits;
+    bw->bits += n;
+
+    while (bw->bits >= 8) {
+        if (bw->pos < bw->size) {
+            bw->out[bw->pos] = (UINT8)bw->acc;
+            bw->pos++;
+        } else
+            bw->overflow = TRUE;
+
+        bw->acc >>= 8;
+        bw->bits -= 8;
+    }
+}
+
+// Adds the end marker, and returns the length of the stream, or 0 if it didn't fit
+static UINT32 zstd_close_bitwriter(zstd_bitwriter* bw) {
+    zstd_add_bits(bw, 1, 1);
+
+    if (bw->bits > 0)
+        zstd_add_bits(bw, 0, 8 - bw->bits);
+
+    return bw->overflow ? 0 : bw->pos;
+}
+
+static void zstd_build_fse_ctable(zstd_fse_ctable* ct, const INT16* norm, UINT32 num_symbols, UINT32 log) {
+    UINT8 symbols[1 << ZSTD_LL_DEFAULT_LOG];
+    UINT32 cumul[ZSTD_ML_MAX_SYMBOL + 2];
+    UINT32 size = 1 << log, high = size - 1, step, pos = 0, total = 0, s, u;
+    INT32 i;
+
+    cumul[0] = 0;
+
+    for (s = 0; s < num_symbols; s++) {
+        if (norm[s] == -1) {
+            cumul[s + 1] = cumul[s] + 1;
+            symbols[high] = (UINT8)s;
+            high--;
+        } else
+            cumul[s + 1] = cumul[s] + norm[s];
+    }
+
+    // same spread as zstd_build_fse_table
+
+    step = (size >> 1) + (size >> 3) + 3;
+
+    for (s = 0; s < num_symbols; s++) {
+        for (i = 0; i < norm[s]; i++) {
+            symbols[pos] = (UINT8)s;
+
+            do {
+                pos = (pos + step) & (size - 1);
+            } while (pos > high);
+        }
+    }
+
+    for (u = 0; u < size; u++) {
+        ct->state_table[cumul[symbols[u]]++] = (UINT16)(size + u);
+    }
+
+    for (s = 0; s < num_symbols; s++) {
+        if (norm[s] == -1 || norm[s] == 1) {
+            ct->delta_nb_bits[s] = (log << 16) - size;
+            ct->delta_find_state[s] = (INT32)total - 1;
+            total++;
+        } else if (norm[s] > 1) {
+            UINT32 max_bits_out = log - zstd_highbit(norm[s] - 1);
+            UINT32 min_state_plus = (UINT32)norm[s] << max_bits_out;
+
+            ct->delta_nb_bits[s] = (max_bits_out << 16) - min_state_plus;
+            ct->delta_find_state[s] = (INT32)total - norm[s];
+            total += norm[s];
+        } else {
+            ct->delta_nb_bits[s] = ((log + 1) << 16) - size;
+            ct->delta_find_state[s] = 0;
+        }
+    }
+
+    ct->log = log;
+}
+
+// Sets up the state so that it stands for symbol, without writing anything
+static __inline void zstd_fse_init_state(zstd_fse_ctable* ct, UINT32* state, UINT32 symbol) {
+    UINT32 bits = (ct->delta_nb_bits[symbol] + (1 << 15)) >> 16;
+    UINT32 value = (bits << 16) - ct->delta_nb_bits[symbol];
+
+    *state = ct->state_table[(INT32)(value >> bits) + ct->delta_find_state[symbol]];
+}
+
+static __inline void zstd_fse_encode(zstd_bitwriter* bw, zstd_fse_ctable* ct, UINT32* state, UINT32 symbol) {
+    UINT32 bits = (*state + ct->delta_nb_bits[symbol]) >> 16;
+
+    zstd_add_bits(bw, *state, bits);
+    *state = ct->state_table[(INT32)(*state >> bits) + ct->delta_find_state[symbol]];
+}
+
+static BOOL zstd_build_huf_code(const UINT32* counts, UINT32 max_symbol, UINT8* lengths, UINT16* codes, UINT8* weights) {
+    UINT16 sorted[ZSTD_MAX_DIRECT_WEIGHTS + 1];
+    UINT32 weight[2 * (ZSTD_MAX_DIRECT_WEIGHTS + 1)];
+    UINT16 parent[2 * (ZSTD_MAX_DIRECT_WEIGHTS + 1)];
+    UINT8 depth[2 * (ZSTD_MAX_DIRECT_WEIGHTS + 1)];
+    UINT32 num_codes[ZSTD_HUF_MAX_BITS + 1];
+    UINT32 n = 0, leaf, node, total, max_bits = 0, pos, len, w, s, i;
+    INT32 k;
+
+    // symbols with a count, least frequent first
+
+    for (s = 0; s <= max_symbol; s++) {
+        if (counts[s] == 0)
+            continue;
+
+        for (i = n; i > 0 && counts[sorted[i - 1]] > counts[s]; i--) {
+            sorted[i] = sorted[i - 1];
+        }
+
+        sorted[i] = (UINT16)s;
+        n++;
+    }
+
+    if (n < 2)
+        return FALSE;
+
+    // Huffman tree, taking the two lightest of the leaves and the nodes
+    // made so far, which come out in order
+
+    for (i = 0; i < n; i++) {
+        weight[i] = counts[sorted[i]];
+    }
+
+    leaf = 0;
+    node = n;
+
+    for (i = n; i < (2 * n) - 1; i++) {
+        UINT32 a, b;
+
+        a = (leaf < n && (node >= i || weight[leaf] <= weight[node])) ? leaf++ : node++;
+        b = (leaf < n && (node >= i || weight[leaf] <= weight[node])) ? leaf++ : node++;
+
+        weight[i] = weight[a] + weight[b];
+        parent[a] = parent[b] = (UINT16)i;
+    }
+
+    depth[(2 * n) - 2] = 0;
+
+    for (k = (INT32)(2 * n) - 3; k >= 0; k--) {
+        depth[k] = depth[parent[k]] + 1;
+    }
+
+    // Limit the lengths to ZSTD_HUF_MAX_BITS, then lengthen the shorter codes
+    // until the code is complete again
+
+    RtlZeroMemory(num_codes, sizeof(num_codes));
+
+    for (i = 0; i < n; i++) {
+        num_codes[min(depth[i], ZSTD_HUF_MAX_BITS)]++;
+    }
+
+    total = 0;
+    for (len = 1; len <= ZSTD_HUF_MAX_BITS; len++) {
+        total += num_codes[len] << (ZSTD_HUF_MAX_BITS - len);
+    }
+
+    while (total != 1 << ZSTD_HUF_MAX_BITS) {
+        num_codes[ZSTD_HUF_MAX_BITS]--;
+
+        for (len = ZSTD_HUF_MAX_BITS - 1; len > 0; len--) {
+            if (num_codes[len] != 0) {
+                num_codes[len]--;
+                num_codes[len + 1] += 2;
+                break;
+            }
+        }
+
+        total--;
+    }
+
+    RtlZeroMemory(lengths, max_symbol + 1);
+
+    pos = 0;
+    for (len = ZSTD_HUF_MAX_BITS; len > 0; len--) {
+        for (i = 0; i < num_codes[len]; i++) {
+            lengths[sorted[pos]] = (UINT8)len;
+            pos++;
+        }
+
+        if (num_codes[len] != 0 && max_bits == 0)
+            max_bits = len;
+    }
+
+    for (s = 0; s <= max_symbol; s++) {
+        weights[s] = lengths[s] == 0 ? 0 : (UINT8)(max_bits + 1 - lengths[s]);
+    }
+
+    // codes are handed out as zstd_build_huf_table expects
+
+    pos = 0;
+    for (w = 1; w <= max_bits; w++) {
+        for (s = 0; s <= max_symbol; s++) {
+            if (weights[s] == w) {
+                codes[s] = (UINT16)(pos >> (w - 1));
+                pos += 1 << (w - 1);
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+static UINT32 zstd_write_huf_stream(const UINT8* literals, UINT32 litlen, const UINT8* lengths, const UINT16* codes, UINT8* out, UINT32 outlen) {
+    zstd_bitwriter bw;
+    INT32 i;
+
+    zstd_init_bitwriter(&bw, out, outlen);
+
+    // backwards, as the decoder starts from the end
+    for (i = (INT32)litlen - 1; i >= 0; i--) {
+        zstd_add_bits(&bw, codes[literals[i]], lengths[literals[i]]);
+    }
+
+    return zstd_close_bitwriter(&bw);
+}
+
+static UINT32 zstd_write_huf_literals(const UINT8* literals, UINT32 litlen, const UINT32* counts, UINT32 max_symbol, UINT8* out, UINT32 outlen) {
+    UINT8 lengths[ZSTD_MAX_DIRECT_WEIGHTS + 1], weights[ZSTD_MAX_DIRECT_WEIGHTS + 1];
+    UINT16 codes[ZSTD_MAX_DIRECT_WEIGHTS + 1];
+    UINT32 headerlen, pos, comp, n, i;
+
+    if (!zstd_build_huf_code(counts, max_symbol, lengths, codes, weights))
+        return 0;
+
+    // one stream for short sections, otherwise four, with a jump table
+
+    headerlen = litlen <= 1023 ? 3 : (litlen <= 16383 ? 4 : 5);
+
+    if (headerlen + 1 + ((max_symbol + 1) / 2) + 6 > outlen)
+        return 0;
+
+    pos = headerlen;
+
+    // the weight of max_symbol is implied
+    out[pos] = (UINT8)(127 + max_symbol);
+    pos++;
+
+    for (i = 0; i < max_symbol; i += 2) {
+        out[pos] = (UINT8)((weights[i] << 4) | (i + 1 < max_symbol ? weights[i + 1] : 0));
+        pos++;
+    }
+
+    if (headerlen == 3) {
+        n = zstd_write_huf_stream(literals, litlen, lengths, codes, out + pos, outlen - pos);
+        if (n == 0)
+            return 0;
+
+        pos += n;
+    } else {
+        UINT32 seg = (litlen + 3) / 4, jump = pos;
+
+        pos += 6;
+
+        for (i = 0; i < 4; i++) {
+            UINT32 len = i < 3 ? seg : litlen - (3 * seg);
+
+            n = zstd_write_huf_stream(literals + (i * seg), len, lengths, codes, out + pos, outlen - pos);
+            if (n == 0 || n > 0xffff)
+                return 0;
+
+            if (i < 3) {
+                out[jump + (i * 2)] = (UINT8)n;
+                out[jump + (i * 2) + 1] = (UINT8)(n >> 8);
+            }
+
+            pos += n;
+        }
+    }
+
+    comp = pos - headerlen;
+
+    if (headerlen == 3) {
+        UINT32 v;
+
+        if (comp > 0x3ff)
+            return 0;
+
+        v = ZSTD_LITERALS_COMPRESSED | (litlen << 4) | (comp << 14);
+        out[0] = (UINT8)v;
+        out[1] = (UINT8)(v >> 8);
+        out[2] = (UINT8)(v >> 16);
+    } else if (headerlen == 4) {
+        UINT32 v;
+
+        if (comp > 0x3fff)
+            return 0;
+
+        v = ZSTD_LITERALS_COMPRESSED | (2 << 2) | (litlen << 4) | (comp << 18);
+        out[0] = (UINT8)v;
+        out[1] = (UINT8)(v >> 8);
+        out[2] = (UINT8)(v >> 16);
+        out[3] = (UINT8)(v >> 24);
+    } else {
+        UINT64 v;
+
+        if (comp > 0x3ffff)
+            return 0;
+
+        v = ZSTD_LITERALS_COMPRESSED | (3 << 2) | (litlen << 4) | ((UINT64)comp << 22);
+        out[0] = (UINT8)v;
+        out[1] = (UINT8)(v >> 8);
+        out[2] = (UINT8)(v >> 16);
+        out[3] = (UINT8)(v >> 24);
+        out[4] = (UINT8)(v >> 32);
+    }
+
+    return pos;
+}
+
+static UINT32 zstd_literals_header(UINT8* out, UINT32 type, UINT32 litlen) {
+    if (litlen < 32) {
+        out[0] = (UINT8)(type | (litlen << 3));
+        return 1;
+    } else if (litlen < 4096) {
+        out[0] = (UINT8)(type | (1 << 2) | (litlen << 4));
+        out[1] = (UINT8)(litlen >> 4);
+        return 2;
+    } else {
+        out[0] = (UINT8)(type | (3 << 2) | (litlen << 4));
+        out[1] = (UINT8)(litlen >> 4);
+        out[2] = (UINT8)(litlen >> 12);
+        return 3;
+    }
+}
+
+static UINT32 zstd_write_literals(zstd_cctx* ctx, UINT32 litlen, UINT8* out, UINT32 outlen) {
+    UINT32 counts[256], max_symbol = 0, distinct = 0, rawlen, n, i;
+
+    RtlZeroMemory(counts, sizeof(counts));
+
+    for (i = 0; i < litlen; i++) {
+        counts[ctx->literals[i]]++;
+    }
+
+    for (i = 0; i < 256; i++) {
+        if (counts[i] != 0) {
+            distinct++;
+            max_symbol = i;
+        }
+    }
+
+    if (outlen < 4)
+        return 0;
+
+    if (distinct == 1) {
+        n = zstd_literals_header(out, ZSTD_LITERALS_RLE, litlen);
+        out[n] = ctx->literals[0];
+        return n + 1;
+    }
+
+    rawlen = (litlen < 32 ? 1 : (litlen < 4096 ? 2 : 3)) + litlen;
+
+    if (litlen >= ZSTD_MIN_HUF_LITERALS && max_symbol <= ZSTD_MAX_DIRECT_WEIGHTS) {
+        n = zstd_write_huf_literals(ctx->literals, litlen, counts, max_symbol, out, outlen);
+
+        if (n != 0 && n < rawlen)
+            return n;
+    }
+
+    if (rawlen > outlen)
+        return 0;
+
+    n = zstd_literals_header(out, ZSTD_LITERALS_RAW, litlen);
+    RtlCopyMemory(out + n, ctx->literals, litlen);
+
+    return rawlen;
+}
+
+static __inline UINT32 zstd_ll_code(UINT32 ll) {
+    UINT32 code = ZSTD_LL_MAX_SYMBOL;
+
+    while (zstd_ll_base[code] > ll) {
+        code--;
+    }
+
+    return code;
+}
+
+static __inline UINT32 zstd_ml_code(UINT32 ml) {
+    UINT32 code = ZSTD_ML_MAX_SYMBOL;
+
+    while (zstd_ml_base[code] > ml) {
+        code--;
+    }
+
+    return code;
+}
+
+static __inline void zstd_seq_extra_bits(zstd_bitwriter* bw, zstd_seq* seq, UINT32 llcode, UINT32 mlcode, UINT32 ofcode) {
+    zstd_add_bits(bw, seq->litlen - zstd_ll_base[llcode], zstd_ll_bits[llcode]);
+    zstd_add_bits(bw, seq->matchlen - zstd_ml_base[mlcode], zstd_ml_bits[mlcode]);
+    zstd_add_bits(bw, seq->offset - (1 << ofcode), ofcode);
+}
+
+static UINT32 zstd_write_sequences(zstd_cctx* ctx, UINT32 num_seqs, UINT8* out, UINT32 outlen) {
+    zstd_bitwriter bw;
+    UINT32 pos = 0, llstate, ofstate, mlstate, llcode, mlcode, ofcode, n;
+    INT32 i;
+
+    if (outlen < 4)
+        return 0;
+
+    if (num_seqs < 128) {
+        out[pos] = (UINT8)num_seqs;
+        pos++;
+    } else if (num_seqs < 0x7f00) {
+        out[pos] = (UINT8)((num_seqs >> 8) + 128);
+        out[pos + 1] = (UINT8)num_seqs;
+        pos += 2;
+    } else {
+        out[pos] = 255;
+        out[pos + 1] = (UINT8)(num_seqs - 0x7f00);
+        out[pos + 2] = (UINT8)((num_seqs - 0x7f00) >> 8);
+        pos += 3;
+    }
+
+    if (num_seqs == 0)
+        return pos;
+
+    // predefined tables for all three
+    out[pos] = 0;
+    pos++;
+
+    zstd_init_bitwriter(&bw, out + pos, outlen - pos);
+
+    // The decoder reads the bitstream from the end, so we start with the
+    // last sequence, whose codes the initial states stand for.
+
+    i = num_seqs - 1;
+
+    llcode = zstd_ll_code(ctx->seqs[i].litlen);
+    mlcode = zstd_ml_code(ctx->seqs[i].matchlen);
+    ofcode = zstd_highbit(ctx->seqs[i].offset);
+
+    zstd_fse_init_state(&ctx->ml, &mlstate, mlcode);
+    zstd_fse_init_state(&ctx->of, &ofstate, ofcode);
+    zstd_fse_init_state(&ctx->ll, &llstate, llcode);
+    zstd_seq_extra_bits(&bw, &ctx->seqs[i], llcode, mlcode, ofcode);
+
+    for (i = num_seqs - 2; i >= 0; i--) {
+        llcode = zstd_ll_code(ctx->seqs[i].litlen);
+        mlcode = zstd_ml_code(ctx->seqs[i].matchlen);
+        ofcode = zstd_highbit(ctx->seqs[i].offset);
+
+        zstd_fse_encode(&bw, &ctx->of, &ofstate, ofcode);
+        zstd_fse_encode(&bw, &ctx->ml, &mlstate, mlcode);
+        zstd_fse_encode(&bw, &ctx->ll, &llstate, llcode);
+        zstd_seq_extra_bits(&bw, &ctx->seqs[i], llcode, mlcode, ofcode);
+    }
+
+    zstd_add_bits(&bw, mlstate, ctx->ml.log);
+    zstd_add_bits(&bw, ofstate, ctx->of.log);
+    zstd_add_bits(&bw, llstate, ctx->ll.log);
+
+    n = zstd_close_bitwriter(&bw);
+    if (n == 0)
+        return 0;
+
+    return pos + n;
+}
+
+static __inline UINT32 zstd_hash(const UINT8* p) {
+    return (zstd_le32(p) * 2654435761u) >> (32 - ZSTD_HASH_BITS);
+}
+
+static __inline void zstd_insert(zstd_cctx* ctx, const UINT8* src, UINT32 srclen, UINT32 pos) {
+    UINT32 h, prev, delta;
+
+    if (pos + ZSTD_MIN_MATCH > srclen)
+        return;
+
+    h = zstd_hash(src + pos);
+    prev = ctx->hash[h];
+    delta = prev == 0 ? 0 : pos - (prev - 1);
+
+    ctx->chain[pos & (ZSTD_WINDOW_SIZE - 1)] = delta < ZSTD_WINDOW_SIZE ? (UINT16)delta : 0;
+    ctx->hash[h] = pos + 1;
+}
+
+static __inline UINT32 zstd_match_len(const UINT8* a, const UINT8* b, UINT32 maxlen) {
+    UINT32 len = 0;
+
+    while (len < maxlen && a[len] == b[len]) {
+        len++;
+    }
+
+    return len;
+}
+
+// Finds the sequences for the block starting at start. Returns where the
+// block ends, which may be before end if we run out of room for sequences.
+static UINT32 zstd_find_sequences(zstd_cctx* ctx, const UINT8* src, UINT32 srclen, UINT32 start, UINT32 end, UINT32* num_seqs, UINT32* litlen) {
+    UINT32 ip = start, anchor = start, nseqs = 0, nlit = 0, block_end, i;
+
+    while (ip + ZSTD_MIN_MATCH <= end && nseqs < ZSTD_MAX_SEQS) {
+        UINT32 maxlen = end - ip, best_len = 0, best_off = 0, cand, attempts;
+
+        // Try the last offset first, it's cheaper to encode. We only use it
+        // after literals, as without them offset value 1 means something else.
+
+        if (ip > anchor && ip >= ctx->rep) {
+            best_len = zstd_match_len(src + ip, src + ip - ctx->rep, maxlen);
+
+            if (best_len >= ZSTD_MIN_MATCH)
+                best_off = ctx->rep;
+            else
+                best_len = 0;
+        }
+
+        cand = ctx->hash[zstd_hash(src + ip)];
+        attempts = ctx->depth;
+
+        while (cand != 0 && attempts > 0 && best_len < maxlen) {
+            UINT32 c = cand - 1, dist = ip - c, delta;
+
+            if (dist >= ZSTD_WINDOW_SIZE)
+                break;
+
+            if (src[c + best_len] == src[ip + best_len]) {
+                UINT32 len = zstd_match_len(src + ip, src + c, maxlen);
+
+                if (len > best_len) {
+                    best_len = len;
+                    best_off = dist;
+
+                    if (len >= ctx->nice)
+                        break;
+                }
+            }
+
+            delta = ctx->chain[c & (ZSTD_WINDOW_SIZE - 1)];
+            if (delta == 0)
+                break;
+
+            cand = c - delta + 1;
+            attempts--;
+        }
+
+        zstd_insert(ctx, src, srclen, ip);
+
+        if (best_len < ZSTD_MIN_MATCH) {
+            ip++;
+            continue;
+        }
+
+        ctx->seqs[nseqs].litlen = ip - anchor;
+        ctx->seqs[nseqs].matchlen = best_len;
+        ctx->seqs[nseqs].offset = best_off == ctx->rep && ip > anchor ? 1 : best_off + 3;
+        nseqs++;
+
+        RtlCopyMemory(ctx->literals + nlit, src + anchor, ip - anchor);
+        nlit += ip - anchor;
+
+        ctx->rep = best_off;
+
+        for (i = 1; i < best_len; i++) {
+            zstd_insert(ctx, src, srclen, ip + i);
+        }
+
+        ip += best_len;
+        anchor = ip;
+    }
+
+    block_end = nseqs == ZSTD_MAX_SEQS ? ip : end;
+
+    RtlCopyMemory(ctx->literals + nlit, src + anchor, block_end - anchor);
+    nlit += block_end - anchor;
+
+    *num_seqs = nseqs;
+    *litlen = nlit;
+
+    return block_end;
+}
+
+static NTSTATUS zstd_compress(zstd_cctx* ctx, const UINT8* src, UINT32 srclen, UINT8* out, UINT32 outlen, UINT32 level, UINT32* complen) {
+    UINT32 pos = 0, p;
+
+    if (outlen < 9)
+        return STATUS_BUFFER_OVERFLOW;
+
+    // Level 1 only looks at the latest match for each hash, each level
+    // above that searching further down the hash chains.
+
+    level = max(1, min(level, 15));
+    ctx->depth = 1 << (level / 2);
+    ctx->nice = 16 << ((level - 1) / 3);
+
+    zstd_build_fse_ctable(&ctx->ll, zstd_ll_default, sizeof(zstd_ll_default) / sizeof(INT16), ZSTD_LL_DEFAULT_LOG);
+    zstd_build_fse_ctable(&ctx->of, zstd_of_default, sizeof(zstd_of_default) / sizeof(INT16), ZSTD_OF_DEFAULT_LOG);
+    zstd_build_fse_ctable(&ctx->ml, zstd_ml_default, sizeof(zstd_ml_default) / sizeof(INT16), ZSTD_ML_DEFAULT_LOG);
+
+    RtlZeroMemory(ctx->hash, sizeof(ctx->hash));
+    ctx->rep = 1;
+
+    // frame header, single segment with the content size
+
+    out[0] = (UINT8)ZSTD_MAGIC;
+    out[1] = (UINT8)(ZSTD_MAGIC >> 8);
+    out[2] = (UINT8)(ZSTD_MAGIC >> 16);
+    out[3] = (UINT8)(ZSTD_MAGIC >> 24);
+
+    if (srclen < 256) {
+        out[4] = 0x20;
+        out[5] = (UINT8)srclen;
+        p = 6;
+    } else if (srclen < 0x10000 + 256) {
+        out[4] = 0x60;
+        out[5] = (UINT8)(srclen - 256);
+        out[6] = (UINT8)((srclen - 256) >> 8);
+        p = 7;
+    } else {
+        out[4] = 0xa0;
+        out[5] = (UINT8)srclen;
+        out[6] = (UINT8)(srclen >> 8);
+        out[7] = (UINT8)(srclen >> 16);
+        out[8] = (UINT8)(srclen >> 24);
+        p = 9;
+    }
+
+    do {
+        UINT32 end = min(srclen, pos + ZSTD_BLOCK_SIZE_MAX), rep = ctx->rep;
+        UINT32 block_end, num_seqs, litlen, size = 0, header;
+
+        if (outlen - p < 3)
+            return STATUS_BUFFER_OVERFLOW;
+
+        block_end = zstd_find_sequences(ctx, src, srclen, pos, end, &num_seqs, &litlen);
+
+        size = zstd_write_literals(ctx, litlen, out + p + 3, outlen - p - 3);
+
+        if (size != 0) {
+            UINT32 seqlen = zstd_write_sequences(ctx, num_seqs, out + p + 3 + size, outlen - p - 3 - size);
+
+            size = seqlen == 0 ? 0 : size + seqlen;
+        }
+
+        if (size == 0 || size >= block_end - pos) {
+            // Store the block as it is. The decoder won't see the offsets
+            // we've used, so forget them.
+
+            ctx->rep = rep;
+            size = block_end - pos;
+
+            if (outlen - p - 3 < size)
+                return STATUS_BUFFER_OVERFLOW;
+
+            RtlCopyMemory(out + p + 3, src + pos, size);
+            header = size << 3 | ZSTD_BLOCK_RAW << 1;
+        } else
+            header = size << 3 | ZSTD_BLOCK_COMPRESSED << 1;
+
+        if (block_end == srclen)
+            header |= 1;
+
+        out[p] = (UINT8)header;
+        out[p + 1] = (UINT8)(header >> 8);
+        out[p + 2] = (UINT8)(header >> 16);
+
+        p += 3 + size;
+        pos = block_end;
+    } while (pos < srclen);
+
+    *complen = p;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS zstd_compress_part(device_extension* Vcb, comp_part* part) {
+    NTSTATUS Status;
+    UINT8* comp_data;
+    UINT32 cl;
+    zstd_cctx* ctx;
+
+    comp_data = ExAllocatePoolWithTag(PagedPool, part->length, ALLOC_TAG);
+    if (!comp_data) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ctx = ExAllocatePoolWithTag(PagedPool, sizeof(zstd_cctx), ALLOC_TAG);
+    if (!ctx) {
+        ERR("out of memory\n");
+        ExFreePool(comp_data);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = zstd_compress(ctx, part->data, part->length, comp_data, part->length, Vcb->options.zstd_level, &cl);
+
+    ExFreePool(ctx);
+
+    if (Status == STATUS_BUFFER_OVERFLOW)
+        cl = part->length;
+    else if (!NT_SUCCESS(Status)) {
+        ERR("zstd_compress returned %08x\n", Status);
+        ExFreePool(comp_data);
+        return Status;
+    }
+
+    set_part_compressed(Vcb, part, comp_data, cl, BTRFS_COMPRESSION_ZSTD);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS compress_part(device_extension* Vcb, comp_part* part) {
+    part->comp_data = NULL;
+    part->compression = BTRFS_COMPRESSION_NONE;
+
+    if (part->type == BTRFS_COMPRESSION_ZSTD)
+        return zstd_compress_part(Vcb, part);
+    else if (part->type == BTRFS_COMPRESSION_LZO)
+        return lzo_compress_part(Vcb, part);
+    else
+        return zlib_compress_part(Vcb, part);
+}
+
+static NTSTATUS insert_compressed_part(fcb* fcb, UINT64 start_data, comp_part* part, PIRP Irp, LIST_ENTRY* rollback) {
+    NTSTATUS Status;
+    LIST_ENTRY* le;
+    chunk* c;
+
+    Status = excise_extents(fcb->Vcb, fcb, start_data, start_data + part->length, Irp, rollback);
+    if (!NT_SUCCESS(Status)) {
+        ERR("excise_extents returned %08x\n", Status);
+        return Status;
+    }
+
+    ExAcquireResourceSharedLite(&fcb->Vcb->chunk_lock, TRUE);
+
+    le = fcb->Vcb->chunks.Flink;
+    while (le != &fcb->Vcb->chunks) {
+        c = CONTAINING_RECORD(le, chunk, list_entry);
+
+        if (!c->readonly && !c->reloc) {
+            ExAcquireResourceExclusiveLite(&c->lock, TRUE);
+
+            if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= part->comp_length) {
+                if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, part->comp_length, FALSE, part->comp_data, Irp, rollback, part->compression, part->length, FALSE, 0)) {
+                    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+                    return STATUS_SUCCESS;
+                }
+            }
+
+            ExReleaseResourceLite(&c->lock);
+        }
+
+        le = le->Flink;
+    }
+
+    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+
+    ExAcquireResourceExclusiveLite(&fcb->Vcb->chunk_lock, TRUE);
+
+    Status = alloc_chunk(fcb->Vcb, fcb->Vcb->data_flags, &c, FALSE);
+
+    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+
+    if (!NT_SUCCESS(Status)) {
+        ERR("alloc_chunk returned %08x\n", Status);
+        return Status;
+    }
+
+    if (c) {
+        ExAcquireResourceExclusiveLite(&c->lock, TRUE);
+
+        if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= part->comp_length) {
+            if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, part->comp_length, FALSE, part->comp_data, Irp, rollback, part->compression, part->length, FALSE, 0))
+                return STATUS_SUCCESS;
+        }
+
+        ExReleaseResourceLite(&c->lock);
+    }
+
+    WARN("couldn't find any data chunks with %x bytes free\n", part->comp_length);
+
+    return STATUS_DISK_FULL;
+}
+
+static UINT8 get_compression_type(fcb* fcb) {
+    UINT8 type;
+
+    if (fcb->Vcb->options.compress_type != 0 && fcb->prop_compression == PropCompression_None)
+        type = fcb->Vcb->options.compress_type;
+    else {
+        if (!(fcb->Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_ZSTD) && fcb->prop_compression == PropCompression_ZSTD) {
+            fcb->Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_ZSTD;
+            type = BTRFS_COMPRESSION_ZSTD;
+        } else if (fcb->Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_ZSTD && fcb->prop_compression != PropCompression_Zlib && fcb->prop_compression != PropCompression_LZO)
+            type = BTRFS_COMPRESSION_ZSTD;
+        else if (!(fcb->Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO) && fcb->prop_compression == PropCompression_LZO) {
+            fcb->Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO;
+            type = BTRFS_COMPRESSION_LZO;
+        } else if (fcb->Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO && fcb->prop_compression != PropCompression_Zlib)
+            type = BTRFS_COMPRESSION_LZO;
+        else
+            type = BTRFS_COMPRESSION_ZLIB;
+    }
+
+    if (type == BTRFS_COMPRESSION_ZSTD)
+        fcb->Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_ZSTD;
+    else if (type == BTRFS_COMPRESSION_LZO)
+        fcb->Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO;
+
+    return type;
+}
+
+static void free_comp_parts(comp_part* parts, ULONG num_parts) {
+    ULONG i;
+
+    for (i = 0; i < num_parts; i++) {
+        if (parts[i].comp_data && parts[i].compression != BTRFS_COMPRESSION_NONE)
+            ExFreePool(parts[i].comp_data);
+
+        parts[i].comp_data = NULL;
+    }
+}
+
+// The 128 KB parts of a write are compressed in batches on the calc threads,
+// then added to the file in order. The batches are kept small so that we
+// don't hold on to much more pool than the uncompressed data itself.
+NTSTATUS write_compressed(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, PIRP Irp, LIST_ENTRY* rollback) {
+    NTSTATUS Status;
+    comp_part* parts;
+    ULONG num_parts, batch, n = 0, i, j;
+    UINT8 type;
+
+    num_parts = (ULONG)(sector_align(end_data - start_data, COMPRESSED_EXTENT_SIZE) / COMPRESSED_EXTENT_SIZE);
+    batch = min(num_parts, min(COMPRESS_BATCH_MAX, 2 * max(fcb->Vcb->calcthreads.num_threads, 1)));
+
+    parts = ExAllocatePoolWithTag(PagedPool, batch * sizeof(comp_part), ALLOC_TAG);
+    if (!parts) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    type = get_compression_type(fcb);
+
+    for (i = 0; i < num_parts; i += n) {
+        n = min(batch, num_parts - i);
+
+        for (j = 0; j < n; j++) {
+            UINT64 s2 = start_data + ((i + j) * COMPRESSED_EXTENT_SIZE);
+
+            parts[j].data = (UINT8*)data + ((i + j) * COMPRESSED_EXTENT_SIZE);
+            parts[j].length = (UINT32)(min(s2 + COMPRESSED_EXTENT_SIZE, end_data) - s2);
+            parts[j].type = type;
+            parts[j].comp_data = NULL;
+            parts[j].compression = BTRFS_COMPRESSION_NONE;
+        }
+
+        // If the first 128 KB of a file is incompressible, we set the nocompress flag so we don't
+        // bother with the rest of it. We try it on its own first, so as not to waste time on the rest.
+        if (i == 0 && start_data == 0 && parts[0].length == COMPRESSED_EXTENT_SIZE && !fcb->Vcb->options.compress_force) {
+            Status = compress_part(fcb->Vcb, &parts[0]);
+            if (!NT_SUCCESS(Status)) {
+                ERR("compress_part returned %08x\n", Status);
+                goto end;
+            }
+
+            if (parts[0].compression == BTRFS_COMPRESSION_NONE) {
+                Status = insert_compressed_part(fcb, start_data, &parts[0], Irp, rollback);
+                if (!NT_SUCCESS(Status)) {
+                    ERR("insert_compressed_part returned %08x\n", Status);
+                    goto end;
+                }
+
+                fcb->inode_item.flags |= BTRFS_INODE_NOCOMPRESS;
+                fcb->inode_item_changed = TRUE;
+                mark_fcb_dirty(fcb);
+
+                // write subsequent data non-compressed
+                if (COMPRESSED_EXTENT_SIZE < end_data) {
+                    Status = do_write_file(fcb, COMPRESSED_EXTENT_SIZE, end_data, (UINT8*)data + COMPRESSED_EXTENT_SIZE, Irp, FALSE, 0, rollback);
+
+                    if (!NT_SUCCESS(Status)) {
+                        ERR("do_write_file returned %08x\n", Status);
+                        goto end;
+                    }
+                }
+
+                Status = STATUS_SUCCESS;
+                goto end;
+            }
+
+            Status = do_compress_job(fcb->Vcb, &parts[1], n - 1);
+        } else
+            Status = do_compress_job(fcb->Vcb, parts, n);
+
+        if (!NT_SUCCESS(Status)) {
+            ERR("do_compress_job returned %08x\n", Status);
+            goto end;
+        }
+
+        for (j = 0; j < n; j++) {
+            Status = insert_compressed_part(fcb, start_data + ((i + j) * COMPRESSED_EXTENT_SIZE), &parts[j], Irp, rollback);
+            if (!NT_SUCCESS(Status)) {
+                ERR("insert_compressed_part returned %08x\n", Status);
+                goto end;
+            }
+        }
+
+        free_comp_parts(parts, n);
+    }
+
+    Status = STATUS_SUCCESS;
+
+end:
+    free_comp_parts(parts, n);
+    ExFreePool(parts);
+
+    return Status;
 }
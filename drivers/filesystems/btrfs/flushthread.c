@@ -5046,6 +5046,15 @@ NTSTATUS flush_fcb(fcb* fcb, BOOL cache, LIST_ENTRY* batchlist, PIRP Irp) {
                 ERR("set_xattr returned %08x\n", Status);
                 goto end;
             }
+        } else if (fcb->prop_compression == PropCompression_ZSTD) {
+            const char zstd[] = "zstd";
+
+            Status = set_xattr(fcb->Vcb, batchlist, fcb->subvol, fcb->inode, EA_PROP_COMPRESSION, (UINT16)strlen(EA_PROP_COMPRESSION),
+                               EA_PROP_COMPRESSION_HASH, (UINT8*)zstd, (UINT16)strlen(zstd));
+            if (!NT_SUCCESS(Status)) {
+                ERR("set_xattr returned %08x\n", Status);
+                goto end;
+            }
         }
 
         fcb->prop_compression_changed = FALSE;
@@ -5403,7 +5412,10 @@ static NTSTATUS drop_chunk(device_extension* Vcb, chunk* c, LIST_ENTRY* batchlis
         ExFreePool(s);
     }
 
+    free_stripe_cache(c);
+
     ExDeleteResourceLite(&c->partial_stripes_lock);
+    ExDeleteResourceLite(&c->stripe_cache_lock);
     ExDeleteResourceLite(&c->range_locks_lock);
     ExDeleteResourceLite(&c->lock);
     ExDeleteResourceLite(&c->changed_extents_lock);
@@ -5561,7 +5573,8 @@ NTSTATUS flush_partial_stripe(device_extension* Vcb, chunk* c, partial_stripe* p
     last1 = 0;
 
     while (runlength != 0) {
-        if (index > last1) {
+        if (index > last1 && !stripe_cache_read(Vcb, c, ps->address + (last1 * Vcb->superblock.sector_size), (index - last1) * Vcb->superblock.sector_size,
+                                                ps->data + (last1 * Vcb->superblock.sector_size))) {
             Status = partial_stripe_read(Vcb, c, ps, startoff, parity2, last1, index - last1);
             if (!NT_SUCCESS(Status)) {
                 ERR("partial_stripe_read returned %08x\n", Status);
@@ -5574,7 +5587,9 @@ NTSTATUS flush_partial_stripe(device_extension* Vcb, chunk* c, partial_stripe* p
         runlength = RtlFindNextForwardRunClear(&ps->bmp, index + runlength, &index);
     }
 
-    if (last1 < ps_length / Vcb->superblock.sector_size) {
+    if (last1 < ps_length / Vcb->superblock.sector_size &&
+        !stripe_cache_read(Vcb, c, ps->address + (last1 * Vcb->superblock.sector_size), (ULONG)(ps_length - (last1 * Vcb->superblock.sector_size)),
+                           ps->data + (last1 * Vcb->superblock.sector_size))) {
         Status = partial_stripe_read(Vcb, c, ps, startoff, parity2, last1, (ULONG)((ps_length / Vcb->superblock.sector_size) - last1));
         if (!NT_SUCCESS(Status)) {
             ERR("partial_stripe_read returned %08x\n", Status);
@@ -5629,6 +5644,10 @@ NTSTATUS flush_partial_stripe(device_extension* Vcb, chunk* c, partial_stripe* p
         stripe = (stripe + 1) % c->chunk_item->num_stripes;
     }
 
+    // Keep the whole stripe, so the next partial write to it doesn't need to read anything back.
+    // This has to come before the parity calculation, which for RAID5 overwrites the first data stripe.
+    stripe_cache_update(Vcb, c, ps->address, (UINT32)ps_length, ps->data, TRUE);
+
     // write parity
     if (c->chunk_item->type & BLOCK_FLAG_RAID5) {
         if (c->devices[parity2]->devobj) {
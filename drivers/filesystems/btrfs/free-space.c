@@ -1759,7 +1759,7 @@ end:
     return Status;
 }
 
-static NTSTATUS update_chunk_cache_tree(device_extension* Vcb, chunk* c, LIST_ENTRY* batchlist) {
+static NTSTATUS rewrite_chunk_cache_tree(device_extension* Vcb, chunk* c, UINT32 count, LIST_ENTRY* batchlist) {
     NTSTATUS Status;
     LIST_ENTRY* le;
     FREE_SPACE_INFO* fsi;
@@ -1770,17 +1770,13 @@ static NTSTATUS update_chunk_cache_tree(device_extension* Vcb, chunk* c, LIST_EN
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    space_list_merge(&c->space, &c->space_size, &c->deleting);
-
-    fsi->count = 0;
+    fsi->count = count;
     fsi->flags = 0;
 
     le = c->space.Flink;
     while (le != &c->space) {
         space* s = CONTAINING_RECORD(le, space, list_entry);
 
-        fsi->count++;
-
         Status = insert_tree_item_batch(batchlist, Vcb, Vcb->space_root, s->address, TYPE_FREE_SPACE_EXTENT, s->size,
                                         NULL, 0, Batch_Insert);
         if (!NT_SUCCESS(Status)) {
@@ -1811,6 +1807,112 @@ static NTSTATUS update_chunk_cache_tree(device_extension* Vcb, chunk* c, LIST_EN
     return STATUS_SUCCESS;
 }
 
+// Compares the chunk's space list with what's in the free-space tree, and
+// only deletes and inserts the extents that have changed, so that a flush
+// touches just the leaves that need to change rather than every leaf of a
+// big block group. Block groups stored as bitmaps get rewritten as extents.
+static NTSTATUS update_chunk_cache_tree(device_extension* Vcb, chunk* c, LIST_ENTRY* batchlist, PIRP Irp) {
+    NTSTATUS Status;
+    LIST_ENTRY* le;
+    KEY searchkey;
+    traverse_ptr tp, next_tp;
+    FREE_SPACE_INFO* fsi;
+    UINT32 count = 0;
+    BOOL b;
+
+    space_list_merge(&c->space, &c->space_size, &c->deleting);
+
+    le = c->space.Flink;
+    while (le != &c->space) {
+        count++;
+        le = le->Flink;
+    }
+
+    searchkey.obj_id = c->offset;
+    searchkey.obj_type = TYPE_FREE_SPACE_INFO;
+    searchkey.offset = c->chunk_item->size;
+
+    Status = find_item(Vcb, Vcb->space_root, &tp, &searchkey, FALSE, Irp);
+    if (!NT_SUCCESS(Status)) {
+        ERR("find_item returned %08x\n", Status);
+        return Status;
+    }
+
+    if (keycmp(tp.item->key, searchkey) || tp.item->size < sizeof(FREE_SPACE_INFO) ||
+        ((FREE_SPACE_INFO*)tp.item->data)->flags & BTRFS_FREE_SPACE_USING_BITMAPS)
+        return rewrite_chunk_cache_tree(Vcb, c, count, batchlist);
+
+    if (((FREE_SPACE_INFO*)tp.item->data)->count != count) {
+        fsi = ExAllocatePoolWithTag(PagedPool, sizeof(FREE_SPACE_INFO), ALLOC_TAG);
+        if (!fsi) {
+            ERR("out of memory\n");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        fsi->count = count;
+        fsi->flags = 0;
+
+        Status = insert_tree_item_batch(batchlist, Vcb, Vcb->space_root, c->offset, TYPE_FREE_SPACE_INFO, c->chunk_item->size,
+                                        NULL, 0, Batch_Delete);
+        if (!NT_SUCCESS(Status)) {
+            ERR("insert_tree_item_batch returned %08x\n", Status);
+            ExFreePool(fsi);
+            return Status;
+        }
+
+        Status = insert_tree_item_batch(batchlist, Vcb, Vcb->space_root, c->offset, TYPE_FREE_SPACE_INFO, c->chunk_item->size,
+                                        fsi, sizeof(FREE_SPACE_INFO), Batch_Insert);
+        if (!NT_SUCCESS(Status)) {
+            ERR("insert_tree_item_batch returned %08x\n", Status);
+            ExFreePool(fsi);
+            return Status;
+        }
+    }
+
+    // Both lists are sorted by address, so we can walk them together
+
+    le = c->space.Flink;
+
+    b = find_next_item(Vcb, &tp, &next_tp, FALSE, Irp);
+    if (b) {
+        tp = next_tp;
+        b = tp.item->key.obj_id < c->offset + c->chunk_item->size;
+    }
+
+    while (b || le != &c->space) {
+        space* s = le != &c->space ? CONTAINING_RECORD(le, space, list_entry) : NULL;
+
+        if (b && s && tp.item->key.obj_type == TYPE_FREE_SPACE_EXTENT && tp.item->key.obj_id == s->address && tp.item->key.offset == s->size) {
+            le = le->Flink;
+        } else if (b && (!s || tp.item->key.obj_type != TYPE_FREE_SPACE_EXTENT || tp.item->key.obj_id <= s->address)) {
+            Status = insert_tree_item_batch(batchlist, Vcb, Vcb->space_root, tp.item->key.obj_id, tp.item->key.obj_type, tp.item->key.offset,
+                                            NULL, 0, Batch_Delete);
+            if (!NT_SUCCESS(Status)) {
+                ERR("insert_tree_item_batch returned %08x\n", Status);
+                return Status;
+            }
+        } else {
+            Status = insert_tree_item_batch(batchlist, Vcb, Vcb->space_root, s->address, TYPE_FREE_SPACE_EXTENT, s->size,
+                                            NULL, 0, Batch_Insert);
+            if (!NT_SUCCESS(Status)) {
+                ERR("insert_tree_item_batch returned %08x\n", Status);
+                return Status;
+            }
+
+            le = le->Flink;
+            continue;
+        }
+
+        b = find_next_item(Vcb, &tp, &next_tp, FALSE, Irp);
+        if (b) {
+            tp = next_tp;
+            b = tp.item->key.obj_id < c->offset + c->chunk_item->size;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS update_chunk_caches(device_extension* Vcb, PIRP Irp, LIST_ENTRY* rollback) {
     LIST_ENTRY *le, batchlist;
     NTSTATUS Status;
@@ -1898,7 +2000,7 @@ NTSTATUS update_chunk_caches_tree(device_extension* Vcb, PIRP Irp) {
 
         if (c->space_changed) {
             ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-            Status = update_chunk_cache_tree(Vcb, c, &batchlist);
+            Status = update_chunk_cache_tree(Vcb, c, &batchlist, Irp);
             ExReleaseResourceLite(&c->lock);
 
             if (!NT_SUCCESS(Status)) {
@@ -107,7 +107,25 @@ __inline static UINT32 galois_double_mask32(UINT32 v) {
 #endif
 
 void galois_double(UINT8* data, UINT32 len) {
-    // FIXME - SIMD?
+#ifndef __REACTOS__
+    if (have_sse2 && ((uintptr_t)data & 0xf) == 0) {
+        __m128i poly = _mm_set1_epi8(0x1d), zero = _mm_setzero_si128();
+
+        while (len >= 16) {
+            __m128i v = _mm_load_si128((__m128i*)data), mask;
+
+            // bytes with the top bit set compare as negative, giving us the mask to XOR
+            // the polynomial in with; there's no byte shift, so add each byte to itself
+            mask = _mm_cmpgt_epi8(zero, v);
+            v = _mm_add_epi8(v, v);
+            v = _mm_xor_si128(v, _mm_and_si128(mask, poly));
+            _mm_store_si128((__m128i*)data, v);
+
+            data += 16;
+            len -= 16;
+        }
+    }
+#endif
 
 #ifdef _AMD64_
     while (len > sizeof(UINT64)) {
@@ -88,13 +88,9 @@ static NTSTATUS read_data_completion(PDEVICE_OBJECT DeviceObject, PIRP Irp, PVOI
 
 NTSTATUS check_csum(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum) {
     NTSTATUS Status;
-    calc_job* cj;
     UINT32* csum2;
 
-    // From experimenting, it seems that 40 sectors is roughly the crossover
-    // point where offloading the crc32 calculation becomes worth it.
-
-    if (sectors < 40 || KeQueryActiveProcessorCount(NULL) < 2) {
+    if (sectors < CALC_INLINE_SECTORS || Vcb->calcthreads.num_threads < 2) {
         ULONG j;
 
         for (j = 0; j < sectors; j++) {
@@ -114,22 +110,18 @@ NTSTATUS check_csum(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32*
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    Status = add_calc_job(Vcb, data, sectors, csum2, &cj);
+    Status = do_calc_job(Vcb, data, sectors, csum2);
     if (!NT_SUCCESS(Status)) {
-        ERR("add_calc_job returned %08x\n", Status);
+        ERR("do_calc_job returned %08x\n", Status);
         ExFreePool(csum2);
         return Status;
     }
 
-    KeWaitForSingleObject(&cj->event, Executive, KernelMode, FALSE, NULL);
-
     if (RtlCompareMemory(csum2, csum, sectors * sizeof(UINT32)) != sectors * sizeof(UINT32)) {
-        free_calc_job(cj);
         ExFreePool(csum2);
         return STATUS_CRC_ERROR;
     }
 
-    free_calc_job(cj);
     ExFreePool(csum2);
 
     return STATUS_SUCCESS;
@@ -1456,7 +1448,7 @@ NTSTATUS read_data(_In_ device_extension* Vcb, _In_ UINT64 addr, _In_ UINT32 len
     UINT16 i, startoffstripe, allowed_missing, missing_devices = 0;
     UINT8* dummypage = NULL;
     PMDL dummy_mdl = NULL;
-    BOOL need_to_wait;
+    BOOL need_to_wait, degraded = FALSE;
     UINT64 lockaddr, locklen;
 #ifdef DEBUG_STATS
     LARGE_INTEGER time1, time2;
@@ -1562,6 +1554,22 @@ NTSTATUS read_data(_In_ device_extension* Vcb, _In_ UINT64 addr, _In_ UINT32 len
 
     RtlZeroMemory(context.stripes, sizeof(read_data_stripe) * ci->num_stripes);
 
+    if (c && (type == BLOCK_FLAG_RAID5 || type == BLOCK_FLAG_RAID6)) {
+        for (i = 0; i < ci->num_stripes; i++) {
+            if (!devices[i] || !devices[i]->devobj) {
+                degraded = TRUE;
+                break;
+            }
+        }
+
+        // If a device is missing, every read means reading the whole of the stripe row and
+        // reconstructing - see if we've done this recently.
+        if (degraded && stripe_cache_read(Vcb, c, addr, length, buf)) {
+            Status = STATUS_SUCCESS;
+            goto exit;
+        }
+    }
+
     context.buflen = length;
     context.num_stripes = ci->num_stripes;
     context.stripes_left = context.num_stripes;
@@ -2631,6 +2639,9 @@ NTSTATUS read_data(_In_ device_extension* Vcb, _In_ UINT64 addr, _In_ UINT32 len
             RtlCopyMemory(buf, context.va, length);
             ExFreePool(context.va);
         }
+
+        if (degraded)
+            stripe_cache_update(Vcb, c, addr, length, buf, TRUE);
     } else if (type == BLOCK_FLAG_RAID6) {
         Status = read_data_raid6(Vcb, file_read ? context.va : buf, addr, length, &context, ci, devices, offset, generation, c, missing_devices > 0 ? TRUE : FALSE);
         if (!NT_SUCCESS(Status)) {
@@ -2646,6 +2657,9 @@ NTSTATUS read_data(_In_ device_extension* Vcb, _In_ UINT64 addr, _In_ UINT32 len
             RtlCopyMemory(buf, context.va, length);
             ExFreePool(context.va);
         }
+
+        if (degraded)
+            stripe_cache_update(Vcb, c, addr, length, buf, TRUE);
     }
 
 exit:
@@ -2787,7 +2801,7 @@ NTSTATUS read_file(fcb* fcb, UINT8* data, UINT64 start, UINT64 length, ULONG* pb
                         read = (UINT32)min(min(len, ext->datalen) - off, length);
 
                         RtlCopyMemory(data + bytes_read, &ed->data[off], read);
-                    } else if (ed->compression == BTRFS_COMPRESSION_ZLIB || ed->compression == BTRFS_COMPRESSION_LZO) {
+                    } else if (ed->compression == BTRFS_COMPRESSION_ZLIB || ed->compression == BTRFS_COMPRESSION_LZO || ed->compression == BTRFS_COMPRESSION_ZSTD) {
                         UINT8* decomp;
                         BOOL decomp_alloc;
                         UINT16 inlen = ext->datalen - (UINT16)offsetof(EXTENT_DATA, data[0]);
@@ -2836,6 +2850,13 @@ NTSTATUS read_file(fcb* fcb, UINT8* data, UINT64 start, UINT64 length, ULONG* pb
                                 if (decomp_alloc) ExFreePool(decomp);
                                 goto exit;
                             }
+                        } else if (ed->compression == BTRFS_COMPRESSION_ZSTD) {
+                            Status = zstd_decompress(ed->data, inlen, decomp, (UINT32)(read + off));
+                            if (!NT_SUCCESS(Status)) {
+                                ERR("zstd_decompress returned %08x\n", Status);
+                                if (decomp_alloc) ExFreePool(decomp);
+                                goto exit;
+                            }
                         }
 
                         if (decomp_alloc) {
@@ -3002,6 +3023,18 @@ NTSTATUS read_file(fcb* fcb, UINT8* data, UINT64 start, UINT64 length, ULONG* pb
                                 ERR("lzo_decompress returned %08x\n", Status);
                                 ExFreePool(buf);
 
+                                if (decomp)
+                                    ExFreePool(decomp);
+
+                                goto exit;
+                            }
+                        } else if (ed->compression == BTRFS_COMPRESSION_ZSTD) {
+                            Status = zstd_decompress(buf2, inlen, decomp ? decomp : (data + bytes_read), outlen);
+
+                            if (!NT_SUCCESS(Status)) {
+                                ERR("zstd_decompress returned %08x\n", Status);
+                                ExFreePool(buf);
+
                                 if (decomp)
                                     ExFreePool(decomp);
 
@@ -19,6 +19,12 @@
 
 #define SCRUB_UNIT 0x100000 // 1 MB
 
+#define THROTTLE_WINDOW     10000000 // 1 second, in 100ns units
+#define THROTTLE_MAX_DELAY  10000000
+#define THROTTLE_MIN_DELAY  100000 // not worth stopping for less than 10 ms
+
+extern tIoSetIoPriorityHint fIoSetIoPriorityHint;
+
 struct _scrub_context;
 
 typedef struct {
@@ -1392,6 +1398,8 @@ static NTSTATUS scrub_extent(device_extension* Vcb, chunk* c, ULONG type, UINT64
     CHUNK_ITEM_STRIPE* cis;
     NTSTATUS Status;
     UINT16 startoffstripe, num_missing, allowed_missing;
+    UINT64 read_len = 0, start_time;
+    ULONG num_reads;
 
     TRACE("(%p, %p, %llx, %llx, %p)\n", Vcb, c, offset, size, csum);
 
@@ -1515,6 +1523,9 @@ static NTSTATUS scrub_extent(device_extension* Vcb, chunk* c, ULONG type, UINT64
                 goto end;
             }
 
+            if (fIoSetIoPriorityHint)
+                fIoSetIoPriorityHint(context.stripes[i].Irp, IoPriorityLow);
+
             IrpSp = IoGetNextIrpStackLocation(context.stripes[i].Irp);
             IrpSp->MajorFunction = IRP_MJ_READ;
 
@@ -1564,6 +1575,7 @@ static NTSTATUS scrub_extent(device_extension* Vcb, chunk* c, ULONG type, UINT64
             context.stripes_left++;
 
             Vcb->scrub.data_scrubbed += context.stripes[i].length;
+            read_len += context.stripes[i].length;
         }
     }
 
@@ -1575,6 +1587,9 @@ static NTSTATUS scrub_extent(device_extension* Vcb, chunk* c, ULONG type, UINT64
 
     KeInitializeEvent(&context.Event, NotificationEvent, FALSE);
 
+    num_reads = context.stripes_left; // stripes_left goes down as the reads complete
+    start_time = KeQueryInterruptTime();
+
     for (i = 0; i < c->chunk_item->num_stripes; i++) {
         if (c->devices[i]->devobj && context.stripes[i].length > 0)
             IoCallDriver(c->devices[i]->devobj, context.stripes[i].Irp);
@@ -1582,6 +1597,8 @@ static NTSTATUS scrub_extent(device_extension* Vcb, chunk* c, ULONG type, UINT64
 
     KeWaitForSingleObject(&context.Event, Executive, KernelMode, FALSE, NULL);
 
+    io_throttle_done(&Vcb->scrub.throttle, read_len, num_reads, start_time);
+
     // return an error if any of the stripes returned an error
     for (i = 0; i < c->chunk_item->num_stripes; i++) {
         if (!NT_SUCCESS(context.stripes[i].iosb.Status)) {
@@ -2662,9 +2679,10 @@ static NTSTATUS scrub_chunk_raid56_stripe_run(device_extension* Vcb, chunk* c, U
     chunk_lock_range(Vcb, c, run_start, run_end - run_start);
 
     do {
-        ULONG read_stripes;
+        ULONG read_stripes, num_reads = 0;
         UINT16 missing_devices = 0;
         BOOL need_wait = FALSE;
+        UINT64 start_time;
 
         if (max_read < stripe_end + 1 - stripe)
             read_stripes = max_read;
@@ -2686,6 +2704,9 @@ static NTSTATUS scrub_chunk_raid56_stripe_run(device_extension* Vcb, chunk* c, U
                     goto end3;
                 }
 
+                if (fIoSetIoPriorityHint)
+                    fIoSetIoPriorityHint(context.stripes[i].Irp, IoPriorityLow);
+
                 context.stripes[i].Irp->MdlAddress = NULL;
 
                 IrpSp = IoGetNextIrpStackLocation(context.stripes[i].Irp);
@@ -2737,6 +2758,7 @@ static NTSTATUS scrub_chunk_raid56_stripe_run(device_extension* Vcb, chunk* c, U
                 IoSetCompletionRoutine(context.stripes[i].Irp, scrub_read_completion_raid56, &context.stripes[i], TRUE, TRUE, TRUE);
 
                 Vcb->scrub.data_scrubbed += read_stripes * c->chunk_item->stripe_length;
+                num_reads++;
                 need_wait = TRUE;
             } else {
                 context.stripes[i].Irp = NULL;
@@ -2759,12 +2781,16 @@ static NTSTATUS scrub_chunk_raid56_stripe_run(device_extension* Vcb, chunk* c, U
         if (need_wait) {
             KeInitializeEvent(&context.Event, NotificationEvent, FALSE);
 
+            start_time = KeQueryInterruptTime();
+
             for (i = 0; i < c->chunk_item->num_stripes; i++) {
                 if (c->devices[i]->devobj)
                     IoCallDriver(c->devices[i]->devobj, context.stripes[i].Irp);
             }
 
             KeWaitForSingleObject(&context.Event, Executive, KernelMode, FALSE, NULL);
+
+            io_throttle_done(&Vcb->scrub.throttle, num_reads * read_stripes * c->chunk_item->stripe_length, num_reads, start_time);
         }
 
         // return an error if any of the stripes returned an error
@@ -2902,8 +2928,8 @@ static NTSTATUS scrub_chunk_raid56(device_extension* Vcb, chunk* c, UINT64* offs
             total_data += size;
             num_extents++;
 
-            // only do so much at a time
-            if (num_extents >= 64 || total_data >= 0x8000000) // 128 MB
+            // only do so much at a time, and stop early if we need to wait for our I/O budget - we don't want to sleep holding tree_lock
+            if (num_extents >= 64 || total_data >= 0x8000000 || io_throttle_due(Vcb, &Vcb->scrub.throttle)) // 128 MB
                 break;
         }
 
@@ -3108,8 +3134,8 @@ static NTSTATUS scrub_chunk(device_extension* Vcb, chunk* c, UINT64* offset, BOO
             total_data += size;
             num_extents++;
 
-            // only do so much at a time
-            if (num_extents >= 64 || total_data >= 0x8000000) // 128 MB
+            // only do so much at a time, and stop early if we need to wait for our I/O budget - we don't want to sleep holding tree_lock
+            if (num_extents >= 64 || total_data >= 0x8000000 || io_throttle_due(Vcb, &Vcb->scrub.throttle)) // 128 MB
                 break;
         }
 
@@ -3135,6 +3161,92 @@ end:
     return Status;
 }
 
+// Scrub and balance go through an io_throttle, so that they stay within the bandwidth and IOPS
+// limits set in the registry, and so that they back off when the disks are busy with
+// foreground I/O. We can't see other people's I/O directly, but we can see how long our own
+// takes - if it takes much more time per MB than it did at its best, someone else is queued
+// in front of us.
+
+void init_io_throttle(io_throttle* t) {
+    RtlZeroMemory(t, sizeof(io_throttle));
+    t->window_start = KeQueryInterruptTime();
+}
+
+void io_throttle_done(io_throttle* t, UINT64 bytes, ULONG ios, UINT64 start_time) {
+    t->window_bytes += bytes;
+    t->window_ios += ios;
+    t->last_duration = KeQueryInterruptTime() - start_time;
+
+    if (bytes == 0)
+        return;
+
+    t->last_latency = (t->last_duration * 0x100000) / bytes;
+
+    // let the baseline creep upwards, so one unusually quick read doesn't throttle us forever
+    if (t->best_latency == 0 || t->last_latency < t->best_latency)
+        t->best_latency = t->last_latency;
+    else
+        t->best_latency += (t->last_latency - t->best_latency) / 64;
+}
+
+static UINT64 io_throttle_delay(device_extension* Vcb, io_throttle* t) {
+    UINT64 elapsed = KeQueryInterruptTime() - t->window_start, delay = 0, needed;
+
+    if (Vcb->options.maint_bandwidth != 0) {
+        needed = (t->window_bytes * 10000000) / ((UINT64)Vcb->options.maint_bandwidth * 0x100000);
+
+        if (needed > elapsed)
+            delay = needed - elapsed;
+    }
+
+    if (Vcb->options.maint_iops != 0) {
+        needed = (t->window_ios * 10000000) / Vcb->options.maint_iops;
+
+        if (needed > elapsed)
+            delay = max(delay, needed - elapsed);
+    }
+
+    // If our last I/O was more than twice as slow as normal, give the disks back
+    // the extra time it took, i.e. if it took three times as long, wait for twice its duration.
+    if (Vcb->options.maint_backoff && t->best_latency != 0 && t->last_latency > t->best_latency * 2)
+        delay = max(delay, (t->last_duration * (t->last_latency - t->best_latency)) / t->best_latency);
+
+    return min(delay, THROTTLE_MAX_DELAY);
+}
+
+BOOL io_throttle_due(device_extension* Vcb, io_throttle* t) {
+    return io_throttle_delay(Vcb, t) >= THROTTLE_MIN_DELAY;
+}
+
+void io_throttle_wait(device_extension* Vcb, io_throttle* t, BOOL* stopping) {
+    UINT64 delay = io_throttle_delay(Vcb, t), now;
+
+    t->last_latency = 0;
+
+    while (delay > 0 && !*stopping) {
+        LARGE_INTEGER interval;
+        UINT64 slice = min(delay, THROTTLE_WINDOW / 10); // so stopping doesn't have to wait for us
+
+        interval.QuadPart = -(LONGLONG)slice;
+        KeDelayExecutionThread(KernelMode, FALSE, &interval);
+
+        delay -= slice;
+    }
+
+    now = KeQueryInterruptTime();
+
+    // start a new window every second, and fold the old one into the reported rate
+    if (now - t->window_start >= THROTTLE_WINDOW) {
+        UINT64 window_rate = (t->window_bytes * 10000000) / (now - t->window_start);
+
+        t->rate = t->rate == 0 ? window_rate : ((t->rate * 3) + window_rate) / 4;
+
+        t->window_start = now;
+        t->window_bytes = 0;
+        t->window_ios = 0;
+    }
+}
+
 _Function_class_(KSTART_ROUTINE)
 #ifdef __REACTOS__
 static void NTAPI scrub_thread(void* context) {
@@ -3178,6 +3290,7 @@ static void scrub_thread(void* context) {
     Vcb->scrub.chunks_left = 0;
     Vcb->scrub.data_scrubbed = 0;
     Vcb->scrub.num_errors = 0;
+    init_io_throttle(&Vcb->scrub.throttle);
 
     while (!IsListEmpty(&Vcb->scrub.errors)) {
         scrub_error* err = CONTAINING_RECORD(RemoveHeadList(&Vcb->scrub.errors), scrub_error, list_entry);
@@ -3233,6 +3346,8 @@ static void scrub_thread(void* context) {
                 if (offset == c->offset + c->chunk_item->size || Vcb->scrub.stopping)
                     break;
 
+                io_throttle_wait(Vcb, &Vcb->scrub.throttle, &Vcb->scrub.stopping);
+
                 KeWaitForSingleObject(&Vcb->scrub.event, Executive, KernelMode, FALSE, NULL);
             } while (changed);
         }
@@ -3324,6 +3439,7 @@ NTSTATUS query_scrub(device_extension* Vcb, KPROCESSOR_MODE processor_mode, void
     bqs->chunks_left = Vcb->scrub.chunks_left;
     bqs->total_chunks = Vcb->scrub.total_chunks;
     bqs->data_scrubbed = Vcb->scrub.data_scrubbed;
+    bqs->rate = bqs->status == BTRFS_SCRUB_RUNNING ? Vcb->scrub.throttle.rate : 0;
 
     bqs->duration = Vcb->scrub.duration.QuadPart;
 
@@ -25,6 +25,8 @@ typedef struct {
     UINT64 irp_offset;
 } write_stripe;
 
+#define STRIPE_CACHE_SIZE 4 // full RAID5/6 stripes we keep per chunk
+
 _Function_class_(IO_COMPLETION_ROUTINE)
 #ifdef __REACTOS__
 static NTSTATUS NTAPI write_data_completion(PDEVICE_OBJECT DeviceObject, PIRP Irp, PVOID conptr);
@@ -613,6 +615,10 @@ NTSTATUS alloc_chunk(device_extension* Vcb, UINT64 flags, chunk** pc, BOOL full_
     InitializeListHead(&c->partial_stripes);
     ExInitializeResourceLite(&c->partial_stripes_lock);
 
+    InitializeListHead(&c->stripe_cache);
+    c->stripe_cache_count = 0;
+    ExInitializeResourceLite(&c->stripe_cache_lock);
+
     ExInitializeResourceLite(&c->lock);
     ExInitializeResourceLite(&c->changed_extents_lock);
 
@@ -955,6 +961,153 @@ static NTSTATUS prepare_raid10_write(_Pre_satisfies_(_Curr_->chunk_item->sub_str
     return STATUS_SUCCESS;
 }
 
+static stripe_cache_entry* find_stripe_cache_entry(chunk* c, UINT64 stripe_addr) {
+    LIST_ENTRY* le;
+
+    le = c->stripe_cache.Flink;
+    while (le != &c->stripe_cache) {
+        stripe_cache_entry* sce = CONTAINING_RECORD(le, stripe_cache_entry, list_entry);
+
+        if (sce->address == stripe_addr) {
+            // move to the front, so the least recently used entry is always at the back
+            RemoveEntryList(&sce->list_entry);
+            InsertHeadList(&c->stripe_cache, &sce->list_entry);
+
+            return sce;
+        }
+
+        le = le->Flink;
+    }
+
+    return NULL;
+}
+
+// Copies data into the stripe cache, which holds the logical contents of recently used RAID5/6
+// stripes so that flushing a partial stripe or reading degraded doesn't have to go back to the
+// disks. If add is FALSE, only stripes which are already in the cache get updated.
+void stripe_cache_update(device_extension* Vcb, chunk* c, UINT64 address, UINT32 length, UINT8* data, BOOL add) {
+    UINT16 num_data_stripes = c->chunk_item->num_stripes - (c->chunk_item->type & BLOCK_FLAG_RAID5 ? 1 : 2);
+    UINT64 ps_length = num_data_stripes * c->chunk_item->stripe_length;
+
+    ExAcquireResourceExclusiveLite(&c->stripe_cache_lock, TRUE);
+
+    while (length > 0) {
+        UINT64 stripe_addr = address - ((address - c->offset) % ps_length);
+        UINT32 len = (UINT32)min(length, stripe_addr + ps_length - address);
+        stripe_cache_entry* sce;
+
+        sce = find_stripe_cache_entry(c, stripe_addr);
+
+        if (!sce && add) {
+            if (c->stripe_cache_count >= STRIPE_CACHE_SIZE) { // reuse the oldest entry
+                sce = CONTAINING_RECORD(RemoveTailList(&c->stripe_cache), stripe_cache_entry, list_entry);
+                RtlSetAllBits(&sce->bmp);
+            } else {
+                ULONG bmplen = (ULONG)sector_align(((ps_length / (8 * Vcb->superblock.sector_size)) + 1), sizeof(ULONG));
+
+                sce = ExAllocatePoolWithTag(PagedPool, offsetof(stripe_cache_entry, data[0]) + (ULONG)ps_length, ALLOC_TAG);
+                if (sce) {
+                    sce->bmparr = ExAllocatePoolWithTag(PagedPool, bmplen, ALLOC_TAG);
+                    if (!sce->bmparr) {
+                        ExFreePool(sce);
+                        sce = NULL;
+                    } else {
+                        RtlInitializeBitMap(&sce->bmp, sce->bmparr, (ULONG)(ps_length / Vcb->superblock.sector_size));
+                        RtlSetAllBits(&sce->bmp);
+                        c->stripe_cache_count++;
+                    }
+                }
+
+                if (!sce)
+                    WARN("out of memory\n"); // not fatal, we just don't cache this stripe
+            }
+
+            if (sce) {
+                sce->address = stripe_addr;
+                InsertHeadList(&c->stripe_cache, &sce->list_entry);
+            }
+        }
+
+        if (sce) {
+            RtlCopyMemory(sce->data + address - stripe_addr, data, len);
+            RtlClearBits(&sce->bmp, (ULONG)((address - stripe_addr) / Vcb->superblock.sector_size), len / Vcb->superblock.sector_size);
+        }
+
+        address += len;
+        data += len;
+        length -= len;
+    }
+
+    ExReleaseResourceLite(&c->stripe_cache_lock);
+}
+
+// Returns TRUE if the whole of the range was in the stripe cache, and has been copied into buf.
+BOOL stripe_cache_read(device_extension* Vcb, chunk* c, UINT64 address, UINT32 length, UINT8* buf) {
+    UINT16 num_data_stripes = c->chunk_item->num_stripes - (c->chunk_item->type & BLOCK_FLAG_RAID5 ? 1 : 2);
+    UINT64 ps_length = num_data_stripes * c->chunk_item->stripe_length;
+
+    ExAcquireResourceExclusiveLite(&c->stripe_cache_lock, TRUE);
+
+    while (length > 0) {
+        UINT64 stripe_addr = address - ((address - c->offset) % ps_length);
+        UINT32 len = (UINT32)min(length, stripe_addr + ps_length - address);
+        stripe_cache_entry* sce;
+
+        sce = find_stripe_cache_entry(c, stripe_addr);
+
+        if (!sce || !RtlAreBitsClear(&sce->bmp, (ULONG)((address - stripe_addr) / Vcb->superblock.sector_size), len / Vcb->superblock.sector_size)) {
+            ExReleaseResourceLite(&c->stripe_cache_lock);
+            return FALSE;
+        }
+
+        RtlCopyMemory(buf, sce->data + address - stripe_addr, len);
+
+        address += len;
+        buf += len;
+        length -= len;
+    }
+
+    ExReleaseResourceLite(&c->stripe_cache_lock);
+
+    return TRUE;
+}
+
+void stripe_cache_invalidate(chunk* c, UINT64 address, UINT64 length) {
+    LIST_ENTRY* le;
+    UINT16 num_data_stripes = c->chunk_item->num_stripes - (c->chunk_item->type & BLOCK_FLAG_RAID5 ? 1 : 2);
+    UINT64 ps_length = num_data_stripes * c->chunk_item->stripe_length;
+
+    ExAcquireResourceExclusiveLite(&c->stripe_cache_lock, TRUE);
+
+    le = c->stripe_cache.Flink;
+    while (le != &c->stripe_cache) {
+        LIST_ENTRY* le2 = le->Flink;
+        stripe_cache_entry* sce = CONTAINING_RECORD(le, stripe_cache_entry, list_entry);
+
+        if (sce->address + ps_length > address && sce->address < address + length) {
+            RemoveEntryList(&sce->list_entry);
+            ExFreePool(sce->bmparr);
+            ExFreePool(sce);
+            c->stripe_cache_count--;
+        }
+
+        le = le2;
+    }
+
+    ExReleaseResourceLite(&c->stripe_cache_lock);
+}
+
+void free_stripe_cache(chunk* c) {
+    while (!IsListEmpty(&c->stripe_cache)) {
+        stripe_cache_entry* sce = CONTAINING_RECORD(RemoveHeadList(&c->stripe_cache), stripe_cache_entry, list_entry);
+
+        ExFreePool(sce->bmparr);
+        ExFreePool(sce);
+    }
+
+    c->stripe_cache_count = 0;
+}
+
 static NTSTATUS add_partial_stripe(device_extension* Vcb, chunk *c, UINT64 address, UINT32 length, void* data) {
     NTSTATUS Status;
     LIST_ENTRY* le;
@@ -968,6 +1121,8 @@ static NTSTATUS add_partial_stripe(device_extension* Vcb, chunk *c, UINT64 addre
 
     ExAcquireResourceExclusiveLite(&c->partial_stripes_lock, TRUE);
 
+    stripe_cache_update(Vcb, c, address, length, data, FALSE);
+
     le = c->partial_stripes.Flink;
     while (le != &c->partial_stripes) {
         ps = CONTAINING_RECORD(le, partial_stripe, list_entry);
@@ -1087,6 +1242,9 @@ static NTSTATUS prepare_raid5_write(device_extension* Vcb, chunk* c, UINT64 addr
         goto exit;
     }
 
+    // the rest is whole stripes, which go straight to disk
+    stripe_cache_invalidate(c, address, length);
+
     get_raid0_offset(address - c->offset, c->chunk_item->stripe_length, num_data_stripes, &startoff, &startoffstripe);
     get_raid0_offset(address + length - c->offset - 1, c->chunk_item->stripe_length, num_data_stripes, &endoff, &endoffstripe);
 
@@ -1483,6 +1641,9 @@ static NTSTATUS prepare_raid6_write(device_extension* Vcb, chunk* c, UINT64 addr
         goto exit;
     }
 
+    // the rest is whole stripes, which go straight to disk
+    stripe_cache_invalidate(c, address, length);
+
     get_raid0_offset(address - c->offset, c->chunk_item->stripe_length, num_data_stripes, &startoff, &startoffstripe);
     get_raid0_offset(address + length - c->offset - 1, c->chunk_item->stripe_length, num_data_stripes, &endoff, &endoffstripe);
 
@@ -2777,30 +2938,13 @@ static void remove_fcb_extent(fcb* fcb, extent* ext, LIST_ENTRY* rollback) {
 NTSTATUS calc_csum(_In_ device_extension* Vcb, _In_reads_bytes_(sectors*Vcb->superblock.sector_size) UINT8* data,
                    _In_ UINT32 sectors, _Out_writes_bytes_(sectors*sizeof(UINT32)) UINT32* csum) {
     NTSTATUS Status;
-    calc_job* cj;
-
-    // From experimenting, it seems that 40 sectors is roughly the crossover
-    // point where offloading the crc32 calculation becomes worth it.
-
-    if (sectors < 40 || KeQueryActiveProcessorCount(NULL) < 2) {
-        ULONG j;
 
-        for (j = 0; j < sectors; j++) {
-            csum[j] = ~calc_crc32c(0xffffffff, data + (j * Vcb->superblock.sector_size), Vcb->superblock.sector_size);
-        }
-
-        return STATUS_SUCCESS;
-    }
-
-    Status = add_calc_job(Vcb, data, sectors, csum, &cj);
+    Status = do_calc_job(Vcb, data, sectors, csum);
     if (!NT_SUCCESS(Status)) {
-        ERR("add_calc_job returned %08x\n", Status);
+        ERR("do_calc_job returned %08x\n", Status);
         return Status;
     }
 
-    KeWaitForSingleObject(&cj->event, Executive, KernelMode, FALSE, NULL);
-    free_calc_job(cj);
-
     return STATUS_SUCCESS;
 }
 
@@ -4081,48 +4225,6 @@ nextitem:
     return STATUS_SUCCESS;
 }
 
-NTSTATUS write_compressed(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, PIRP Irp, LIST_ENTRY* rollback) {
-    NTSTATUS Status;
-    UINT64 i;
-
-    for (i = 0; i < sector_align(end_data - start_data, COMPRESSED_EXTENT_SIZE) / COMPRESSED_EXTENT_SIZE; i++) {
-        UINT64 s2, e2;
-        BOOL compressed;
-
-        s2 = start_data + (i * COMPRESSED_EXTENT_SIZE);
-        e2 = min(s2 + COMPRESSED_EXTENT_SIZE, end_data);
-
-        Status = write_compressed_bit(fcb, s2, e2, (UINT8*)data + (i * COMPRESSED_EXTENT_SIZE), &compressed, Irp, rollback);
-
-        if (!NT_SUCCESS(Status)) {
-            ERR("write_compressed_bit returned %08x\n", Status);
-            return Status;
-        }
-
-        // If the first 128 KB of a file is incompressible, we set the nocompress flag so we don't
-        // bother with the rest of it.
-        if (s2 == 0 && e2 == COMPRESSED_EXTENT_SIZE && !compressed && !fcb->Vcb->options.compress_force) {
-            fcb->inode_item.flags |= BTRFS_INODE_NOCOMPRESS;
-            fcb->inode_item_changed = TRUE;
-            mark_fcb_dirty(fcb);
-
-            // write subsequent data non-compressed
-            if (e2 < end_data) {
-                Status = do_write_file(fcb, e2, end_data, (UINT8*)data + e2, Irp, FALSE, 0, rollback);
-
-                if (!NT_SUCCESS(Status)) {
-                    ERR("do_write_file returned %08x\n", Status);
-                    return Status;
-                }
-            }
-
-            return STATUS_SUCCESS;
-        }
-    }
-
-    return STATUS_SUCCESS;
-}
-
 NTSTATUS write_file2(device_extension* Vcb, PIRP Irp, LARGE_INTEGER offset, void* buf, ULONG* length, BOOLEAN paging_io, BOOLEAN no_cache,
                      BOOLEAN wait, BOOLEAN deferred_write, BOOLEAN write_irp, LIST_ENTRY* rollback) {
     PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation(Irp);
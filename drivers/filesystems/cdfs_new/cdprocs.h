@@ -89,6 +89,8 @@ Abstract:
 #define TAG_IRP_CONTEXT         'cidC'      //  Irp Context
 #define TAG_IRP_CONTEXT_LITE    'lidC'      //  Irp Context lite
 #define TAG_MCB_ARRAY           'amdC'      //  Mcb array
+#define TAG_NAME_CACHE          'cndC'      //  Directory name cache
+#define TAG_PATH_INDEX          'ipdC'      //  Path table index
 #define TAG_PATH_ENTRY_NAME     'nPdC'      //  CdName in path entry
 #define TAG_PREFIX_ENTRY        'epdC'      //  Prefix Entry
 #define TAG_PREFIX_NAME         'npdC'      //  Prefix Entry name
@@ -642,6 +644,12 @@ CdUpcaseName (
     _Inout_ PCD_NAME UpcaseName
     );
 
+ULONG
+CdHashName (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PUNICODE_STRING Name
+    );
+
 VOID
 CdDissectName (
     _In_ PIRP_CONTEXT IrpContext,
@@ -727,6 +735,12 @@ CdLookupPathEntry (
     _Inout_ PCOMPOUND_PATH_ENTRY CompoundPathEntry
     );
 
+VOID
+CdBuildPathTableIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PVCB Vcb
+    );
+
 BOOLEAN
 CdLookupNextPathEntry (
     _In_ PIRP_CONTEXT IrpContext,
@@ -466,6 +466,46 @@ typedef struct _CD_SECTOR_CACHE_CHUNK {
 #define CD_SEC_CACHE_CHUNKS  4
 #define CD_SEC_CHUNK_BLOCKS  0x18
 
+//
+//  The path table index is an in-memory summary of the path table which is
+//  built when the volume is mounted.  There is one entry for each directory,
+//  entry N describing the directory with ordinal N + 1.  Since the children
+//  of a directory are grouped together in the path table we can binary search
+//  the parent ordinals to find them, and the upcased name hash lets us skip
+//  the children whose name can't match without touching the path table.
+//
+
+typedef struct _PATH_INDEX_ENTRY {
+
+    ULONG PathTableOffset;
+    ULONG ParentOrdinal;
+    ULONG NameHash;
+
+} PATH_INDEX_ENTRY, *PPATH_INDEX_ENTRY;
+
+//
+//  We won't build an index for path tables with more directories than this.
+//
+
+#define CD_MAX_PATH_INDEX_ENTRIES   (0x40000)
+
+//
+//  The name cache remembers where in a directory previous file lookups found
+//  their match.  It is a small direct mapped table allocated on the first
+//  successful lookup in the directory.  A zero dirent offset marks an empty
+//  slot since a file can never be the first entry in a directory.
+//
+
+typedef struct _NAME_CACHE_ENTRY {
+
+    ULONG NameHash;
+    ULONG DirentOffset;
+    BOOLEAN IgnoreCase;
+
+} NAME_CACHE_ENTRY, *PNAME_CACHE_ENTRY;
+
+#define CD_NAME_CACHE_ENTRIES       (64)
+
 //
 //  The Vcb (Volume control block) record corresponds to every
 //  volume mounted by the file system.  They are ordered in a queue off
@@ -692,6 +732,15 @@ typedef struct _VCB {
     KEVENT SectorCacheEvent;
     ERESOURCE SectorCacheResource;
 
+    //
+    //  Path table index built at mount time.  This is NULL if the path table
+    //  is too large or couldn't be indexed, in which case we scan the path
+    //  table itself.
+    //
+
+    PPATH_INDEX_ENTRY PathIndex;
+    ULONG PathIndexCount;
+
 #ifdef CDFS_TELEMETRY_DATA
 
     //
@@ -856,6 +905,13 @@ typedef struct _FCB_INDEX {
     PRTL_SPLAY_LINKS ExactCaseRoot;
     PRTL_SPLAY_LINKS IgnoreCaseRoot;
 
+    //
+    //  Cache of the dirent offsets of the files found in this directory.
+    //  Synchronized with the Fcb mutex.
+    //
+
+    PNAME_CACHE_ENTRY NameCache;
+
 } FCB_INDEX;
 typedef FCB_INDEX *PFCB_INDEX;
 
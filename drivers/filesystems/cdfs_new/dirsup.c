@@ -865,6 +865,11 @@ Return Value:
     PDIRENT Dirent;
     ULONG ShortNameDirentOffset;
 
+    PNAME_CACHE_ENTRY CacheEntry;
+    ULONG CachedDirentOffset = 0;
+    ULONG NameHash = 0;
+    BOOLEAN UseNameCache;
+
     BOOLEAN Found = FALSE;
 
     PAGED_CODE();
@@ -881,6 +886,74 @@ Return Value:
 
     ShortNameDirentOffset = CdShortNameDirentOffset( IrpContext, &Name->FileName );
 
+    //
+    //  We only use the name cache for names which have no version string and
+    //  can't be short names.  Such a name can only match the dirents with
+    //  exactly that name, so if the dirent we found for a name with the same
+    //  hash still matches it is the first match in the directory.
+    //
+
+    UseNameCache = (BOOLEAN) ((ShortNameDirentOffset == MAXULONG) &&
+                              (Name->VersionString.Length == 0));
+
+    if (UseNameCache) {
+
+        NameHash = CdHashName( IrpContext, &Name->FileName );
+
+        CdLockFcb( IrpContext, Fcb );
+
+        if (Fcb->NameCache != NULL) {
+
+            CacheEntry = &Fcb->NameCache[ NameHash % CD_NAME_CACHE_ENTRIES ];
+
+            if ((CacheEntry->NameHash == NameHash) &&
+                (CacheEntry->IgnoreCase == IgnoreCase)) {
+
+                CachedDirentOffset = CacheEntry->DirentOffset;
+            }
+        }
+
+        CdUnlockFcb( IrpContext, Fcb );
+    }
+
+    //
+    //  If we have a cached offset then check the dirent there first.
+    //
+
+    if (CachedDirentOffset != 0) {
+
+        CdLookupInitialFileDirent( IrpContext, Fcb, FileContext, CachedDirentOffset );
+
+        Dirent = &FileContext->InitialDirent->Dirent;
+
+        if (!FlagOn( Dirent->DirentFlags, CD_ATTRIBUTE_ASSOC | CD_ATTRIBUTE_DIRECTORY )) {
+
+            CdUpdateDirentName( IrpContext, Dirent, IgnoreCase );
+
+            if (!FlagOn( Dirent->Flags, DIRENT_FLAG_CONSTANT_ENTRY ) &&
+                CdIsNameInExpression( IrpContext,
+                                      &Dirent->CdCaseFileName,
+                                      Name,
+                                      0,
+                                      TRUE )) {
+
+                *MatchingName = &Dirent->CdCaseFileName;
+
+                CdLookupLastFileDirent( IrpContext, Fcb, FileContext );
+
+                return TRUE;
+            }
+        }
+
+        //
+        //  This was a different name with the same hash.  Reset the file
+        //  context and scan the directory.
+        //
+
+        CdCleanupFileContext( IrpContext, FileContext );
+        CdInitializeFileContext( IrpContext, FileContext );
+    }
+
     //
     //  Position ourselves at the first entry.
     //
@@ -985,6 +1058,42 @@ Return Value:
 
     if (Found) {
 
+        //
+        //  Remember where we found a long name match.  We allocate the cache on
+        //  the first match in this directory and simply do without it if there
+        //  is no pool.
+        //
+
+        if (UseNameCache &&
+            (*MatchingName == &FileContext->InitialDirent->Dirent.CdCaseFileName)) {
+
+            CdLockFcb( IrpContext, Fcb );
+
+            if (Fcb->NameCache == NULL) {
+
+                Fcb->NameCache = ExAllocatePoolWithTag( CdPagedPool,
+                                                        CD_NAME_CACHE_ENTRIES * sizeof( NAME_CACHE_ENTRY ),
+                                                        TAG_NAME_CACHE );
+
+                if (Fcb->NameCache != NULL) {
+
+                    RtlZeroMemory( Fcb->NameCache,
+                                   CD_NAME_CACHE_ENTRIES * sizeof( NAME_CACHE_ENTRY ));
+                }
+            }
+
+            if (Fcb->NameCache != NULL) {
+
+                CacheEntry = &Fcb->NameCache[ NameHash % CD_NAME_CACHE_ENTRIES ];
+
+                CacheEntry->NameHash = NameHash;
+                CacheEntry->DirentOffset = FileContext->InitialDirent->Dirent.DirentOffset;
+                CacheEntry->IgnoreCase = IgnoreCase;
+            }
+
+            CdUnlockFcb( IrpContext, Fcb );
+        }
+
         CdLookupLastFileDirent( IrpContext, Fcb, FileContext );
 
     }
@@ -140,6 +140,7 @@ main (argc, argv)
         doit( FCB_INDEX, ChildOrdinal );
         doit( FCB_INDEX, ExactCaseRoot );
         doit( FCB_INDEX, IgnoreCaseRoot );
+        doit( FCB_INDEX, NameCache );
     }
     printf("\n");
     {
@@ -1153,6 +1153,16 @@ Return Value:
                                       Vcb,
                                       RawIsoVd );
 
+        //
+        //  Build the path table index for this volume.  An audio disk only has
+        //  the pseudo path table created when the Vcb was initialized.
+        //
+
+        if (!FlagOn( Vcb->VcbState, VCB_STATE_AUDIO_DISK )) {
+
+            CdBuildPathTableIndex( IrpContext, Vcb );
+        }
+
         //
         //  Drop an extra reference on the root dir file so we'll be able to send
         //  notification.
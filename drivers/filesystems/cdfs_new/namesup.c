@@ -27,6 +27,7 @@ Abstract:
 #pragma alloc_text(PAGE, CdDissectName)
 #pragma alloc_text(PAGE, CdGenerate8dot3Name)
 #pragma alloc_text(PAGE, CdFullCompareNames)
+#pragma alloc_text(PAGE, CdHashName)
 #pragma alloc_text(PAGE, CdIsLegalName)
 #pragma alloc_text(PAGE, CdIs8dot3Name)
 #pragma alloc_text(PAGE, CdIsNameInExpression)
@@ -296,6 +297,48 @@ Return Value:
     return;
 }
 
+
+ULONG
+CdHashName (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PUNICODE_STRING Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes a hash value for a filename.  The name is upcased
+    as it is hashed so that the exact case and ignore case forms of a name
+    have the same hash value.  This is used by the path table index and the
+    directory name cache to skip names which can't match a search.
+
+Arguments:
+
+    Name - This is the name to hash.  It may or may not be upcased.
+
+Return Value:
+
+    ULONG - The hash value for the name.
+
+--*/
+
+{
+    ULONG Hash = 0;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    for (Index = 0; Index < Name->Length / sizeof( WCHAR ); Index++) {
+
+        Hash = (Hash * 37) + RtlUpcaseUnicodeChar( Name->Buffer[Index] );
+    }
+
+    return Hash;
+}
+
 
 VOID
 CdDissectName (
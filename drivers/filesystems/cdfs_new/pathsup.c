@@ -70,6 +70,14 @@ Abstract:
             to convert to little endian.  We assume that directories
             don't have version numbers.
 
+    Path Table Index:
+
+        When a volume is mounted we walk the path table once and build an
+        in-memory index holding the offset, parent ordinal and name hash of
+        every directory.  Searches for the children of a directory use this
+        to go straight to the children and to only map the path table for
+        entries whose name hash matches.
+
 
 --*/
 
@@ -118,8 +126,20 @@ CdUpdatePathEntryFromRawPathEntry (
     _Out_ PPATH_ENTRY PathEntry
     );
 
+_Success_(return != FALSE)
+BOOLEAN
+CdFindPathEntryInIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB ParentFcb,
+    _In_ PCD_NAME DirName,
+    _In_ BOOLEAN IgnoreCase,
+    _Inout_ PCOMPOUND_PATH_ENTRY CompoundPathEntry
+    );
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, CdBuildPathTableIndex)
 #pragma alloc_text(PAGE, CdFindPathEntry)
+#pragma alloc_text(PAGE, CdFindPathEntryInIndex)
 #pragma alloc_text(PAGE, CdLookupPathEntry)
 #pragma alloc_text(PAGE, CdLookupNextPathEntry)
 #pragma alloc_text(PAGE, CdMapPathTableBlock)
@@ -297,6 +317,154 @@ Return Value:
                                               PathEntry );
 }
 
+
+VOID
+CdBuildPathTableIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called during mount to build the in-memory index of the
+    path table.  We walk the entire path table once and store the offset,
+    parent ordinal and upcased name hash of each directory.
+
+    The index is only an optimization.  If the path table is too large, the
+    allocation fails or the path table is not in the order required by the
+    ISO 9660 spec we simply don't build the index and later searches will
+    scan the path table.  A corrupt path table is reported when it is scanned
+    rather than failing the mount here.
+
+Arguments:
+
+    Vcb - Vcb for the volume being mounted.  The path table Fcb and its
+        stream file have been created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    COMPOUND_PATH_ENTRY CompoundPathEntry;
+    PPATH_ENTRY PathEntry = &CompoundPathEntry.PathEntry;
+
+    PPATH_INDEX_ENTRY PathIndex;
+    ULONG MaxEntries;
+    ULONG Count = 0;
+    ULONG LastParent = 1;
+    BOOLEAN Valid = TRUE;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    NT_ASSERT( Vcb->PathIndex == NULL );
+
+    //
+    //  Each path entry takes at least a word aligned minimal entry so this
+    //  bounds the number of directories.
+    //
+
+    MaxEntries = ((ULONG) Vcb->PathTableFcb->FileSize.QuadPart - Vcb->PathTableFcb->StreamOffset) /
+                 WordAlign( MIN_RAW_PATH_ENTRY_LEN ) + 1;
+
+    if (MaxEntries > CD_MAX_PATH_INDEX_ENTRIES) {
+
+        return;
+    }
+
+    PathIndex = ExAllocatePoolWithTag( CdPagedPool,
+                                       MaxEntries * sizeof( PATH_INDEX_ENTRY ),
+                                       TAG_PATH_INDEX );
+
+    if (PathIndex == NULL) {
+
+        return;
+    }
+
+    CdInitializeCompoundPathEntry( IrpContext, &CompoundPathEntry );
+
+    _SEH2_TRY {
+
+        _SEH2_TRY {
+
+            //
+            //  Start with the root entry and walk to the end of the table.
+            //
+
+            CdLookupPathEntry( IrpContext,
+                               Vcb->PathTableFcb->StreamOffset,
+                               1,
+                               TRUE,
+                               &CompoundPathEntry );
+
+            do {
+
+                //
+                //  The children of a directory must follow their parent and the
+                //  parent ordinals can never decrease.  Don't use the index if
+                //  that is not the case.
+                //
+
+                if ((Count == MaxEntries) ||
+                    (PathEntry->ParentOrdinal < LastParent) ||
+                    ((PathEntry->Ordinal != 1) && (PathEntry->ParentOrdinal >= PathEntry->Ordinal))) {
+
+                    Valid = FALSE;
+                    break;
+                }
+
+                LastParent = PathEntry->ParentOrdinal;
+
+                CdUpdatePathEntryName( IrpContext, PathEntry, TRUE );
+
+                PathIndex[Count].PathTableOffset = PathEntry->PathTableOffset;
+                PathIndex[Count].ParentOrdinal = PathEntry->ParentOrdinal;
+                PathIndex[Count].NameHash = CdHashName( IrpContext,
+                                                        &PathEntry->CdCaseDirName.FileName );
+                Count += 1;
+
+            } while (CdLookupNextPathEntry( IrpContext,
+                                            &CompoundPathEntry.PathContext,
+                                            PathEntry ));
+
+        } _SEH2_FINALLY {
+
+            CdCleanupCompoundPathEntry( IrpContext, &CompoundPathEntry );
+
+            if (_SEH2_AbnormalTermination()) {
+
+                CdFreePool( &PathIndex );
+            }
+        } _SEH2_END;
+
+    } _SEH2_EXCEPT( (((Status = _SEH2_GetExceptionCode()) == STATUS_DISK_CORRUPT_ERROR) ||
+                     (Status == STATUS_FILE_CORRUPT_ERROR)) ?
+                    EXCEPTION_EXECUTE_HANDLER :
+                    EXCEPTION_CONTINUE_SEARCH ) {
+
+        //
+        //  Leave the corruption to be reported by the path table scans.
+        //
+
+        IrpContext->ExceptionStatus = STATUS_SUCCESS;
+        Valid = FALSE;
+    } _SEH2_END;
+
+    if (!Valid) {
+
+        CdFreePool( &PathIndex );
+        return;
+    }
+
+    Vcb->PathIndex = PathIndex;
+    Vcb->PathIndexCount = Count;
+}
+
 _Success_(return != FALSE)
 BOOLEAN
 CdFindPathEntry (
@@ -367,6 +535,19 @@ Return Value:
 		CdRaiseStatus( IrpContext, STATUS_DISK_CORRUPT_ERROR );
 	}
 
+    //
+    //  Use the path table index if we built one for this volume.
+    //
+
+    if (ParentFcb->Vcb->PathIndex != NULL) {
+
+        return CdFindPathEntryInIndex( IrpContext,
+                                       ParentFcb,
+                                       DirName,
+                                       IgnoreCase,
+                                       CompoundPathEntry );
+    }
+
     CdLockFcb( IrpContext, ParentFcb );
 
     if (ParentFcb->ChildPathTableOffset != 0) {
@@ -480,6 +661,131 @@ Return Value:
 //  Local support routine
 //
 
+_Success_(return != FALSE)
+BOOLEAN
+CdFindPathEntryInIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB ParentFcb,
+    _In_ PCD_NAME DirName,
+    _In_ BOOLEAN IgnoreCase,
+    _Inout_ PCOMPOUND_PATH_ENTRY CompoundPathEntry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the version of CdFindPathEntry used when there is a path
+    table index for the volume.  We binary search the index for the first
+    child of ParentFcb and then only look at the path table entries of the
+    children whose name hash matches the name we are looking for.  The
+    children are examined in path table order so we find the same entry a
+    scan of the path table would.
+
+Arguments:
+
+    ParentFcb - This is the directory we are examining.
+
+    DirName - This is the name we are searching for.  This name will not contain wildcard
+        characters.  The name will also not have a version string.
+
+    IgnoreCase - Indicates if this search is exact or ignore case.
+
+    CompoundPathEntry - Complete path table enumeration structure.  We will have initialized
+        it for the search on entry.  This will be positioned at the matching name if found.
+
+Return Value:
+
+    BOOLEAN - TRUE if matching entry found, FALSE otherwise.
+
+--*/
+
+{
+    PVCB Vcb = ParentFcb->Vcb;
+    PPATH_INDEX_ENTRY PathIndex = Vcb->PathIndex;
+    BOOLEAN Positioned = FALSE;
+
+    ULONG NameHash;
+    ULONG Low;
+    ULONG High;
+    ULONG Middle;
+
+    PAGED_CODE();
+
+    NameHash = CdHashName( IrpContext, &DirName->FileName );
+
+    //
+    //  Find the first entry whose parent is at or beyond our directory.  The root
+    //  entry is its own parent so we skip it.
+    //
+
+    Low = 1;
+    High = Vcb->PathIndexCount;
+
+    while (Low < High) {
+
+        Middle = Low + (High - Low) / 2;
+
+        if (PathIndex[Middle].ParentOrdinal < ParentFcb->Ordinal) {
+
+            Low = Middle + 1;
+
+        } else {
+
+            High = Middle;
+        }
+    }
+
+    //
+    //  Now walk through the children of this directory.
+    //
+
+    for (; (Low < Vcb->PathIndexCount) && (PathIndex[Low].ParentOrdinal == ParentFcb->Ordinal); Low += 1) {
+
+        if (PathIndex[Low].NameHash != NameHash) {
+
+            continue;
+        }
+
+        //
+        //  Clean up the enumeration context if we already looked at another
+        //  entry with the same hash.
+        //
+
+        if (Positioned) {
+
+            CdCleanupCompoundPathEntry( IrpContext, CompoundPathEntry );
+            CdInitializeCompoundPathEntry( IrpContext, CompoundPathEntry );
+        }
+
+        CdLookupPathEntry( IrpContext,
+                           PathIndex[Low].PathTableOffset,
+                           Low + 1,
+                           FALSE,
+                           CompoundPathEntry );
+
+        Positioned = TRUE;
+
+        CdUpdatePathEntryName( IrpContext, &CompoundPathEntry->PathEntry, IgnoreCase );
+
+        if (CdIsNameInExpression( IrpContext,
+                                  &CompoundPathEntry->PathEntry.CdCaseDirName,
+                                  DirName,
+                                  0,
+                                  FALSE )) {
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+//
+//  Local support routine
+//
+
 VOID
 CdMapPathTableBlock (
     _In_ PIRP_CONTEXT IrpContext,
@@ -932,6 +932,12 @@ Return Value:
     CdFreePool( &Vcb->XASector );
     CdFreePool( &Vcb->SectorCacheBuffer);
 
+    //
+    //  Delete the path table index if we built one.
+    //
+
+    CdFreePool( &Vcb->PathIndex );
+
     if (Vcb->SectorCacheIrp != NULL) {
 
         IoFreeIrp( Vcb->SectorCacheIrp);
@@ -2511,6 +2517,11 @@ Return Value:
             Vcb->PathTableFcb = NULL;
         }
 
+        if (Fcb->NameCache != NULL) {
+
+            CdFreePool( &Fcb->NameCache );
+        }
+
         CdDeallocateFcbIndex( IrpContext, *(PVOID*)&Fcb );/* ReactOS Change: GCC "passing argument 1 from incompatible pointer type" */
         break;
 
@@ -86,6 +86,14 @@
 
 #define READ_AHEAD_GRANULARITY          (0x10000)
 
+/* files larger than LARGE_FILE_SIZE are read ahead in bigger chunks */
+#define LARGE_FILE_SIZE                 (0x1000000)
+#define LARGE_READ_AHEAD_GRANULARITY    (0x40000)
+
+#define Ext2ReadAheadGranularity(Fcb)                               \
+        (((Fcb)->Header.FileSize.QuadPart >= LARGE_FILE_SIZE) ?     \
+         LARGE_READ_AHEAD_GRANULARITY : READ_AHEAD_GRANULARITY)
+
 #define SUPER_BLOCK                     (Vcb->SuperBlock)
 
 #define INODE_SIZE                      (Vcb->InodeSize)
@@ -1665,6 +1673,14 @@ Ext2MapExtent(
     OUT PULONG              Number
     );
 
+NTSTATUS
+Ext2PrecacheExtents(
+    IN PEXT2_IRP_CONTEXT    IrpContext,
+    IN PEXT2_VCB            Vcb,
+    IN PEXT2_MCB            Mcb,
+    IN ULONG                End
+    );
+
 NTSTATUS
 Ext2ExpandExtent(
     PEXT2_IRP_CONTEXT IrpContext,
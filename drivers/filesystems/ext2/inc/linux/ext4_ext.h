@@ -101,6 +101,11 @@ struct ext4_ext_path
 #define EXT_INIT_MAX_LEN (1UL << 15)
 #define EXT_UNWRITTEN_MAX_LEN	(EXT_INIT_MAX_LEN - 1)
 
+/*
+ * Deepest extent tree we accept, as in Linux
+ */
+#define EXT4_MAX_EXTENT_DEPTH 5
+
 #define EXT_EXTENT_SIZE sizeof(struct ext4_extent)
 #define EXT_INDEX_SIZE sizeof(struct ext4_extent_idx)
 
@@ -254,4 +259,8 @@ int ext4_ext_get_blocks(void *icb, handle_t *handle, struct inode *inode, ext4_f
 int ext4_ext_tree_init(void *icb, handle_t *handle, struct inode *inode);
 int ext4_ext_truncate(void *icb, struct inode *inode, unsigned long start);
 
+typedef int (*ext4_ext_precache_fn)(void *ctx, struct ext4_extent *ex);
+int ext4_ext_precache(void *icb, struct inode *inode,
+		ext4_ext_precache_fn fn, void *ctx);
+
 #endif	/* _LINUX_EXT4_EXT */
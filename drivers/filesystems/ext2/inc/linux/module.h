@@ -861,6 +861,7 @@ int bh_uptodate_or_lock(struct buffer_head *bh);
 int bh_submit_read(struct buffer_head *bh);
 /* They are separately managed  */
 struct buffer_head *extents_bread(struct super_block *sb, sector_t block);
+void extents_breadahead(struct super_block *sb, sector_t block, unsigned long count);
 struct buffer_head *extents_bwrite(struct super_block *sb, sector_t block);
 void extents_mark_buffer_dirty(struct buffer_head *bh);
 void extents_brelse(struct buffer_head *bh);
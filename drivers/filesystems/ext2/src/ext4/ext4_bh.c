@@ -17,6 +17,45 @@ extents_bread(struct super_block *sb, sector_t block)
     return sb_getblk(sb, block);
 }
 
+/*
+ * extents_breadahead: Bring a run of adjacent blocks into the cache with a
+ *                     single CcPinRead, so that the extents_bread calls on
+ *                     them that follow are satisfied from memory.
+ *
+ * @sb:    the device we need to undergo buffered IO on.
+ * @block: the first block of the run.
+ * @count: the number of blocks in the run.
+ *
+ * The run is clipped to the end of the volume and to the cache view which
+ * contains its first block.
+ */
+void
+extents_breadahead(struct super_block *sb, sector_t block, unsigned long count)
+{
+    PEXT2_VCB       Vcb = sb->s_bdev->bd_priv;
+    LARGE_INTEGER   Offset;
+    ULONG           Length;
+    PVOID           Bcb = NULL;
+    PVOID           Ptr = NULL;
+
+    if (count <= 1 || block >= TOTAL_BLOCKS)
+        return;
+    if (count > TOTAL_BLOCKS - block)
+        count = (unsigned long)(TOTAL_BLOCKS - block);
+
+    Offset.QuadPart = (LONGLONG)block << BLOCK_BITS;
+    Length = VACB_MAPPING_GRANULARITY -
+             (ULONG)(Offset.QuadPart & (VACB_MAPPING_GRANULARITY - 1));
+    if (Length > ((ULONG)count << BLOCK_BITS))
+        Length = (ULONG)count << BLOCK_BITS;
+    if (Length <= BLOCK_SIZE)
+        return;
+
+    if (CcPinRead(Vcb->Volume, &Offset, Length, PIN_WAIT, &Bcb, &Ptr)) {
+        CcUnpinData(Bcb);
+    }
+}
+
 /*
  * extents_bwrite: This function is a wrapper of CcPreparePinWrite routine.
  * 
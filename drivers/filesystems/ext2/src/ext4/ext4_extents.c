@@ -2506,6 +2506,74 @@ out2:
 	return err ? err : allocated;
 }
 
+/*
+ * ext4_ext_precache_node:
+ * call fn for every extent below the node eh, which is at the given depth,
+ * in logical order. The child nodes of an index node are read ahead before
+ * we descend into them, adjacent blocks being merged into one request.
+ */
+static int ext4_ext_precache_node(void *icb, struct inode *inode,
+		struct ext4_extent_header *eh, int depth,
+		ext4_ext_precache_fn fn, void *ctx)
+{
+	struct ext4_extent_idx *ix;
+	struct ext4_extent *ex;
+	struct buffer_head *bh;
+	ext4_fsblk_t start;
+	int i, count, entries, err = 0;
+
+	entries = le16_to_cpu(eh->eh_entries);
+
+	if (depth == 0) {
+		ex = EXT_FIRST_EXTENT(eh);
+		for (i = 0; i < entries && !err; i++, ex++)
+			err = fn(ctx, ex);
+		return err;
+	}
+
+	ix = EXT_FIRST_INDEX(eh);
+	for (i = 0; i < entries; i += count) {
+		start = ext4_idx_pblock(ix + i);
+		for (count = 1; i + count < entries; count++) {
+			if (ext4_idx_pblock(ix + i + count) != start + count)
+				break;
+		}
+		extents_breadahead(inode->i_sb, start, count);
+	}
+
+	for (i = 0; i < entries && !err; i++, ix++) {
+		bh = read_extent_tree_block(inode, ext4_idx_pblock(ix), depth - 1, 0);
+		if (IS_ERR(bh))
+			return PTR_ERR(bh);
+		err = ext4_ext_precache_node(icb, inode, ext_block_hdr(bh),
+				depth - 1, fn, ctx);
+		extents_brelse(bh);
+	}
+
+	return err;
+}
+
+/*
+ * ext4_ext_precache:
+ * walk through the whole extent tree of the inode once, calling fn for
+ * every extent in logical order, so that the caller can cache the block
+ * mapping of the file instead of looking each extent up from the root.
+ */
+int ext4_ext_precache(void *icb, struct inode *inode,
+		ext4_ext_precache_fn fn, void *ctx)
+{
+	int err;
+
+	err = ext4_ext_check_inode(inode);
+	if (err)
+		return err;
+	if (ext_depth(inode) > EXT4_MAX_EXTENT_DEPTH)
+		return -EIO;
+
+	return ext4_ext_precache_node(icb, inode, ext_inode_hdr(inode),
+			ext_depth(inode), fn, ctx);
+}
+
 int ext4_ext_truncate(void *icb, struct inode *inode, unsigned long start)
 {
     int ret = ext4_ext_remove_space(icb, inode, start);
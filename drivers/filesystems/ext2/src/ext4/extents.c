@@ -101,6 +101,72 @@ Ext2MapExtent(
 }
 
 
+typedef struct _EXT2_PRECACHE_CONTEXT {
+    PEXT2_VCB   Vcb;
+    PEXT2_MCB   Mcb;
+    ULONG       End;
+} EXT2_PRECACHE_CONTEXT, *PEXT2_PRECACHE_CONTEXT;
+
+static int
+Ext2PrecacheExtent(void *ctx, struct ext4_extent *ex)
+{
+    PEXT2_PRECACHE_CONTEXT Context = (PEXT2_PRECACHE_CONTEXT)ctx;
+    PEXT2_VCB   Vcb = Context->Vcb;
+    ULONG       Start = le32_to_cpu(ex->ee_block);
+    ULONG       Length = ext4_ext_get_actual_len(ex);
+    ULONGLONG   Block = ext4_ext_pblock(ex);
+
+    /* unwritten extents read as zero, just like holes */
+    if (ext4_ext_is_unwritten(ex) || Start >= Context->End || Length == 0) {
+        return 0;
+    }
+    if (Length > Context->End - Start) {
+        Length = Context->End - Start;
+    }
+
+    /* skip wrong blocks, as Ext2InitializeZone does */
+    if (Block == 0 || Block + Length > TOTAL_BLOCKS) {
+        return 0;
+    }
+
+    if (!Ext2AddBlockExtent(Vcb, Context->Mcb, Start, (ULONG)Block, Length)) {
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/*
+ * Build the extents cache of the Mcb for the blocks below End, reading
+ * the extent tree of the inode in a single pass
+ */
+
+NTSTATUS
+Ext2PrecacheExtents(
+    IN PEXT2_IRP_CONTEXT    IrpContext,
+    IN PEXT2_VCB            Vcb,
+    IN PEXT2_MCB            Mcb,
+    IN ULONG                End
+)
+{
+    EXT2_PRECACHE_CONTEXT Context;
+    int rc;
+
+    Context.Vcb = Vcb;
+    Context.Mcb = Mcb;
+    Context.End = End;
+
+    rc = ext4_ext_precache(IrpContext, &Mcb->Inode, Ext2PrecacheExtent, &Context);
+    if (rc < 0) {
+        DEBUG(DL_ERR, ("Ext2PrecacheExtents: %wZ failed, err: %d\n",
+                       &Mcb->FullName, rc));
+        return Ext2WinntError(rc);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
 NTSTATUS
 Ext2DoExtentExpand(
     IN PEXT2_IRP_CONTEXT    IrpContext,
@@ -1137,6 +1137,17 @@ Ext2InitializeZone(
     ASSERT(Mcb != NULL);
     End = (ULONG)((Mcb->Inode.i_size + BLOCK_SIZE - 1) >> BLOCK_BITS);
 
+    /* walk the extent tree once instead of looking it up for every extent */
+    if (INODE_HAS_EXTENT(&Mcb->Inode) &&
+        get_ext4_header(&Mcb->Inode)->eh_magic == EXT4_EXT_MAGIC) {
+
+        Status = Ext2PrecacheExtents(IrpContext, Vcb, Mcb, End);
+        if (NT_SUCCESS(Status)) {
+            SetLongFlag(Mcb->Flags, MCB_ZONE_INITED);
+        }
+        goto errorout;
+    }
+
     while (Start < End) {
 
         Block = Mapped = 0;
@@ -673,7 +673,7 @@ Ext2ReadFile(IN PEXT2_IRP_CONTEXT IrpContext)
                         Fcb );
                 CcSetReadAheadGranularity(
                         FileObject,
-                        READ_AHEAD_GRANULARITY );
+                        Ext2ReadAheadGranularity(Fcb) );
             }
 
             if (FlagOn(IrpContext->MinorFunction, IRP_MN_MDL)) {
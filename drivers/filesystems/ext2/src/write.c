@@ -1093,7 +1093,7 @@ Ext2WriteFile(IN PEXT2_IRP_CONTEXT IrpContext)
 
                 CcSetReadAheadGranularity(
                     FileObject,
-                    READ_AHEAD_GRANULARITY );
+                    Ext2ReadAheadGranularity(Fcb) );
             }
 
             if (FlagOn(IrpContext->MinorFunction, IRP_MN_MDL)) {
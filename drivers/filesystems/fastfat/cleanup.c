@@ -86,6 +86,36 @@ VfatCleanupFile(
                                NULL);
         }
 
+        /* Fast I/O writes don't touch the dates, do it now */
+        if (BooleanFlagOn(FileObject->Flags, FO_FILE_MODIFIED) &&
+            !vfatFCBIsDirectory(pFcb))
+        {
+            LARGE_INTEGER SystemTime;
+
+            KeQuerySystemTime(&SystemTime);
+            if (vfatVolumeIsFatX(DeviceExt))
+            {
+                FsdSystemTimeToDosDateTime(DeviceExt,
+                                           &SystemTime, &pFcb->entry.FatX.UpdateDate,
+                                           &pFcb->entry.FatX.UpdateTime);
+                pFcb->entry.FatX.AccessDate = pFcb->entry.FatX.UpdateDate;
+                pFcb->entry.FatX.AccessTime = pFcb->entry.FatX.UpdateTime;
+            }
+            else
+            {
+                FsdSystemTimeToDosDateTime(DeviceExt,
+                                           &SystemTime, &pFcb->entry.Fat.UpdateDate,
+                                           &pFcb->entry.Fat.UpdateTime);
+                pFcb->entry.Fat.AccessDate = pFcb->entry.Fat.UpdateDate;
+            }
+            pFcb->Flags |= FCB_IS_DIRTY;
+            FileObject->Flags &= ~FO_FILE_MODIFIED;
+
+            vfatReportChange(DeviceExt, pFcb,
+                             FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_ATTRIBUTES,
+                             FILE_ACTION_MODIFIED);
+        }
+
         if (BooleanFlagOn(pFcb->Flags, FCB_IS_DIRTY))
         {
             VfatUpdateEntry (pFcb, vfatVolumeIsFatX(DeviceExt));
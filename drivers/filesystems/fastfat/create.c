@@ -178,6 +178,18 @@ FindFile(
         }
     }
 
+    /* A whole directory lookup can use the name index of large directories */
+    if (WildCard == FALSE && First && DirContext->DirIndex == 0)
+    {
+        Status = vfatNameIndexFind(DeviceExt, Parent, FileToFindU, DirContext);
+        if (Status == STATUS_SUCCESS || Status == STATUS_OBJECT_NAME_NOT_FOUND)
+        {
+            ExFreePool(PathNameBuffer);
+            return (Status == STATUS_SUCCESS) ? STATUS_SUCCESS : STATUS_NO_MORE_ENTRIES;
+        }
+        DirContext->DirIndex = 0;
+    }
+
     /* FsRtlIsNameInExpression need the searched string to be upcase,
     * even if IgnoreCase is specified */
     Status = RtlUpcaseUnicodeString(&FileToFindUpcase, FileToFindU, TRUE);
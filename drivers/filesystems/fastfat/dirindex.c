@@ -0,0 +1,490 @@
+/*
+ * COPYRIGHT:        See COPYING in the top level directory
+ * PROJECT:          ReactOS kernel
+ * FILE:             drivers/filesystems/fastfat/dirindex.c
+ * PURPOSE:          VFAT Filesystem : name index of large directories
+ *
+ * Looking a name up in a FAT directory means reading every entry until it
+ * is found. For large directories, the first lookup builds a hash of all the
+ * long and short names to the index of their entry. Lookups then only read
+ * the entries whose name hash matches. The index is kept up to date by
+ * FATAddEntry and FATDelEntry, and every operation on it is done with the
+ * volume DirResource held exclusively.
+ *
+ * A slot pointing to an entry with another name is harmless, the name is
+ * always checked on the entry itself. A name missing from the index is not,
+ * so the index is dropped whenever it can't be updated.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "vfat.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS ******************************************************************/
+
+/* Directories smaller than this many entries are simply scanned */
+#define VFAT_NAME_INDEX_MIN_ENTRIES     1024
+
+/* Memory the indexes of a volume can use, the least recently used ones
+ * are freed past it */
+#define VFAT_NAME_INDEX_MAX_BYTES       (4 * 1024 * 1024)
+
+#define VFAT_NAME_INDEX_EMPTY           0xFFFFFFFF
+#define VFAT_NAME_INDEX_DELETED         0xFFFFFFFE
+
+#define TAG_NAME_INDEX 'INFV'
+
+/* FUNCTIONS ****************************************************************/
+
+static
+ULONG
+vfatNameIndexHash(
+    PUNICODE_STRING NameU)
+{
+    ULONG Hash = 0;
+    USHORT i;
+
+    /* Case insensitive the same way RtlEqualUnicodeString is */
+    for (i = 0; i < NameU->Length / sizeof(WCHAR); i++)
+    {
+        Hash = Hash * 31 + RtlUpcaseUnicodeChar(NameU->Buffer[i]);
+    }
+
+    return Hash;
+}
+
+static
+VOID
+vfatNameIndexFree(
+    PVFAT_NAME_INDEX Index)
+{
+    PDEVICE_EXTENSION DeviceExt = Index->DeviceExt;
+
+    DPRINT("Freeing the name index of '%wZ'\n", &Index->DirFcb->PathNameU);
+
+    RemoveEntryList(&Index->IndexListEntry);
+    DeviceExt->NameIndexBytes -= Index->Size * sizeof(VFAT_NAME_INDEX_SLOT);
+    Index->DirFcb->NameIndex = NULL;
+    ExFreePoolWithTag(Index->Slots, TAG_NAME_INDEX);
+    ExFreePoolWithTag(Index, TAG_NAME_INDEX);
+}
+
+/*
+ * Allocate a slot table, freeing the least recently used indexes of the
+ * volume other than Keep if we're over budget or out of pool
+ */
+static
+PVFAT_NAME_INDEX_SLOT
+vfatNameIndexAllocateSlots(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG Size,
+    PVFAT_NAME_INDEX Keep)
+{
+    PVFAT_NAME_INDEX_SLOT Slots;
+    PVFAT_NAME_INDEX Index;
+    ULONG Bytes = Size * sizeof(VFAT_NAME_INDEX_SLOT);
+
+    if (Bytes > VFAT_NAME_INDEX_MAX_BYTES)
+    {
+        return NULL;
+    }
+
+    while (TRUE)
+    {
+        if (DeviceExt->NameIndexBytes + Bytes <= VFAT_NAME_INDEX_MAX_BYTES)
+        {
+            Slots = ExAllocatePoolWithTag(PagedPool, Bytes, TAG_NAME_INDEX);
+            if (Slots != NULL)
+            {
+                RtlFillMemory(Slots, Bytes, 0xFF);
+                return Slots;
+            }
+        }
+
+        if (IsListEmpty(&DeviceExt->NameIndexList))
+        {
+            return NULL;
+        }
+
+        Index = CONTAINING_RECORD(DeviceExt->NameIndexList.Blink, VFAT_NAME_INDEX, IndexListEntry);
+        if (Index == Keep)
+        {
+            return NULL;
+        }
+        vfatNameIndexFree(Index);
+    }
+}
+
+static
+VOID
+vfatNameIndexPut(
+    PVFAT_NAME_INDEX_SLOT Slots,
+    ULONG Size,
+    ULONG Hash,
+    ULONG DirIndex)
+{
+    ULONG i;
+
+    for (i = Hash & (Size - 1); Slots[i].DirIndex != VFAT_NAME_INDEX_EMPTY; i = (i + 1) & (Size - 1));
+    Slots[i].Hash = Hash;
+    Slots[i].DirIndex = DirIndex;
+}
+
+static
+BOOLEAN
+vfatNameIndexInsert(
+    PVFAT_NAME_INDEX Index,
+    ULONG Hash,
+    ULONG DirIndex)
+{
+    PVFAT_NAME_INDEX_SLOT Slots;
+    ULONG i, Size;
+
+    for (i = Hash & (Index->Size - 1); Index->Slots[i].DirIndex != VFAT_NAME_INDEX_EMPTY; i = (i + 1) & (Index->Size - 1))
+    {
+        if (Index->Slots[i].Hash == Hash && Index->Slots[i].DirIndex == DirIndex)
+        {
+            return TRUE;
+        }
+    }
+
+    /* Keep the table at most 3/4 full, deleted slots included */
+    if ((Index->Used + 1) * 4 > Index->Size * 3)
+    {
+        Size = Index->Size * 2;
+        Slots = vfatNameIndexAllocateSlots(Index->DeviceExt, Size, Index);
+        if (Slots == NULL)
+        {
+            return FALSE;
+        }
+
+        Index->Used = 0;
+        for (i = 0; i < Index->Size; i++)
+        {
+            if (Index->Slots[i].DirIndex < VFAT_NAME_INDEX_DELETED)
+            {
+                vfatNameIndexPut(Slots, Size, Index->Slots[i].Hash, Index->Slots[i].DirIndex);
+                Index->Used++;
+            }
+        }
+
+        ExFreePoolWithTag(Index->Slots, TAG_NAME_INDEX);
+        Index->DeviceExt->NameIndexBytes += (Size - Index->Size) * sizeof(VFAT_NAME_INDEX_SLOT);
+        Index->Slots = Slots;
+        Index->Size = Size;
+    }
+
+    vfatNameIndexPut(Index->Slots, Index->Size, Hash, DirIndex);
+    Index->Used++;
+    return TRUE;
+}
+
+static
+BOOLEAN
+vfatNameIndexAddNames(
+    PVFAT_NAME_INDEX Index,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    ULONG LongHash, ShortHash;
+
+    if (ENTRY_VOLUME(FALSE, &DirContext->DirEntry) ||
+        DirContext->LongNameU.Length == 0 ||
+        DirContext->ShortNameU.Length == 0)
+    {
+        /* vfatDirFindFile and FindFile never return these */
+        return TRUE;
+    }
+
+    LongHash = vfatNameIndexHash(&DirContext->LongNameU);
+    ShortHash = vfatNameIndexHash(&DirContext->ShortNameU);
+
+    if (!vfatNameIndexInsert(Index, LongHash, DirContext->DirIndex))
+    {
+        return FALSE;
+    }
+    if (ShortHash != LongHash && !vfatNameIndexInsert(Index, ShortHash, DirContext->DirIndex))
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Read the entry whose short name entry is at DirIndex.
+ */
+static
+NTSTATUS
+vfatNameIndexReadEntry(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    ULONG DirIndex,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    PVOID Context = NULL;
+    PVOID Page;
+    NTSTATUS Status;
+
+    DirContext->DirIndex = DirIndex;
+    Status = VfatGetNextDirEntry(DeviceExt, &Context, &Page, DirFcb, DirContext, TRUE);
+    if (Context)
+    {
+        CcUnpinData(Context);
+    }
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    /* The entry was deleted, we got the next one */
+    if (DirContext->DirIndex != DirIndex)
+    {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+PVFAT_NAME_INDEX
+vfatNameIndexBuild(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb)
+{
+    PVFAT_NAME_INDEX Index;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+    PVOID Context = NULL;
+    PVOID Page;
+    BOOLEAN First = TRUE;
+    NTSTATUS Status;
+    ULONG Entries;
+
+    Entries = DirFcb->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY);
+    if (vfatVolumeIsFatX(DeviceExt) || Entries < VFAT_NAME_INDEX_MIN_ENTRIES)
+    {
+        return NULL;
+    }
+
+    Index = ExAllocatePoolWithTag(PagedPool, sizeof(VFAT_NAME_INDEX), TAG_NAME_INDEX);
+    if (Index == NULL)
+    {
+        return NULL;
+    }
+
+    /* A file has at most one name per entry it uses (a short name only
+     * file has one), so this size is enough until the directory grows */
+    for (Index->Size = VFAT_NAME_INDEX_MIN_ENTRIES; Index->Size < Entries + Entries / 3; Index->Size *= 2);
+    Index->Used = 0;
+    Index->DeviceExt = DeviceExt;
+    Index->DirFcb = DirFcb;
+    Index->Slots = vfatNameIndexAllocateSlots(DeviceExt, Index->Size, NULL);
+    if (Index->Slots == NULL)
+    {
+        ExFreePoolWithTag(Index, TAG_NAME_INDEX);
+        return NULL;
+    }
+    InsertHeadList(&DeviceExt->NameIndexList, &Index->IndexListEntry);
+    DeviceExt->NameIndexBytes += Index->Size * sizeof(VFAT_NAME_INDEX_SLOT);
+    DirFcb->NameIndex = Index;
+
+    DirContext.DirIndex = 0;
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.Length = 0;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.Length = 0;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+
+    while (TRUE)
+    {
+        Status = VfatGetNextDirEntry(DeviceExt, &Context, &Page, DirFcb, &DirContext, First);
+        First = FALSE;
+        if (Status == STATUS_NO_MORE_ENTRIES)
+        {
+            break;
+        }
+        if (!NT_SUCCESS(Status) || !vfatNameIndexAddNames(Index, &DirContext))
+        {
+            if (Context)
+            {
+                CcUnpinData(Context);
+            }
+            vfatNameIndexFree(Index);
+            return NULL;
+        }
+        DirContext.DirIndex++;
+    }
+
+    DPRINT("Built the name index of '%wZ', %u names in %u slots\n",
+           &DirFcb->PathNameU, Index->Used, Index->Size);
+    return Index;
+}
+
+/*
+ * FUNCTION: Looks FileToFindU up in the name index of a directory, building
+ *           it if the directory is large enough.
+ * RETURNS:  STATUS_SUCCESS with DirContext filled if found,
+ *           STATUS_OBJECT_NAME_NOT_FOUND if the directory has no such name,
+ *           STATUS_UNSUCCESSFUL if there is no index, the caller must scan.
+ */
+NTSTATUS
+vfatNameIndexFind(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    PVFAT_NAME_INDEX Index;
+    ULONG Hash, i;
+    NTSTATUS Status;
+
+    ASSERT(ExIsResourceAcquiredExclusive(&DeviceExt->DirResource));
+
+    Index = DirFcb->NameIndex;
+    if (Index == NULL)
+    {
+        Index = vfatNameIndexBuild(DeviceExt, DirFcb);
+        if (Index == NULL)
+        {
+            return STATUS_UNSUCCESSFUL;
+        }
+    }
+    else
+    {
+        RemoveEntryList(&Index->IndexListEntry);
+        InsertHeadList(&DeviceExt->NameIndexList, &Index->IndexListEntry);
+    }
+
+    Hash = vfatNameIndexHash(FileToFindU);
+    for (i = Hash & (Index->Size - 1); Index->Slots[i].DirIndex != VFAT_NAME_INDEX_EMPTY; i = (i + 1) & (Index->Size - 1))
+    {
+        if (Index->Slots[i].Hash != Hash || Index->Slots[i].DirIndex == VFAT_NAME_INDEX_DELETED)
+        {
+            continue;
+        }
+
+        Status = vfatNameIndexReadEntry(DeviceExt, DirFcb, Index->Slots[i].DirIndex, DirContext);
+        if (Status == STATUS_OBJECT_NAME_NOT_FOUND || Status == STATUS_NO_MORE_ENTRIES)
+        {
+            /* Stale slot */
+            continue;
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            vfatNameIndexFree(Index);
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        if (!ENTRY_VOLUME(FALSE, &DirContext->DirEntry) &&
+            DirContext->LongNameU.Length != 0 &&
+            DirContext->ShortNameU.Length != 0 &&
+            (RtlEqualUnicodeString(FileToFindU, &DirContext->LongNameU, TRUE) ||
+             RtlEqualUnicodeString(FileToFindU, &DirContext->ShortNameU, TRUE)))
+        {
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+/*
+ * FUNCTION: Adds the names of the entry just written at DirIndex
+ */
+VOID
+vfatNameIndexAddEntry(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    ULONG DirIndex)
+{
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+
+    if (DirFcb->NameIndex == NULL)
+    {
+        return;
+    }
+
+    ASSERT(ExIsResourceAcquiredExclusive(&DeviceExt->DirResource));
+
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+
+    /* Index the names as they will be read back, not as we were given them */
+    if (!NT_SUCCESS(vfatNameIndexReadEntry(DeviceExt, DirFcb, DirIndex, &DirContext)) ||
+        !vfatNameIndexAddNames(DirFcb->NameIndex, &DirContext))
+    {
+        vfatNameIndexFree(DirFcb->NameIndex);
+    }
+}
+
+/*
+ * FUNCTION: Removes the names of the entry at DirIndex, before it is deleted
+ */
+VOID
+vfatNameIndexRemoveEntry(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    ULONG DirIndex)
+{
+    PVFAT_NAME_INDEX Index = DirFcb->NameIndex;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+    ULONG Hash[2], i, j;
+
+    if (Index == NULL)
+    {
+        return;
+    }
+
+    ASSERT(ExIsResourceAcquiredExclusive(&DeviceExt->DirResource));
+
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+
+    /* If we can't read it, the slots just stay stale */
+    if (!NT_SUCCESS(vfatNameIndexReadEntry(DeviceExt, DirFcb, DirIndex, &DirContext)))
+    {
+        return;
+    }
+
+    Hash[0] = vfatNameIndexHash(&DirContext.LongNameU);
+    Hash[1] = vfatNameIndexHash(&DirContext.ShortNameU);
+    for (j = 0; j < 2; j++)
+    {
+        for (i = Hash[j] & (Index->Size - 1); Index->Slots[i].DirIndex != VFAT_NAME_INDEX_EMPTY; i = (i + 1) & (Index->Size - 1))
+        {
+            if (Index->Slots[i].Hash == Hash[j] && Index->Slots[i].DirIndex == DirIndex)
+            {
+                Index->Slots[i].DirIndex = VFAT_NAME_INDEX_DELETED;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * FUNCTION: Frees the name index of a directory FCB being destroyed
+ */
+VOID
+vfatNameIndexDestroy(
+    PVFATFCB DirFcb)
+{
+    if (DirFcb->NameIndex != NULL)
+    {
+        vfatNameIndexFree(DirFcb->NameIndex);
+    }
+}
+
+/* EOF */
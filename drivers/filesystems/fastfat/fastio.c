@@ -31,19 +31,48 @@ VfatFastIoCheckIfPossible(
     OUT PIO_STATUS_BLOCK IoStatus,
     IN PDEVICE_OBJECT DeviceObject)
 {
-    /* Prevent all Fast I/O requests */
-    DPRINT("VfatFastIoCheckIfPossible(): returning FALSE.\n");
+    PVFATFCB Fcb;
+    LARGE_INTEGER LargeLength;
+
+    DPRINT("VfatFastIoCheckIfPossible()\n");
 
-    UNREFERENCED_PARAMETER(FileObject);
-    UNREFERENCED_PARAMETER(FileOffset);
-    UNREFERENCED_PARAMETER(Length);
     UNREFERENCED_PARAMETER(Wait);
-    UNREFERENCED_PARAMETER(LockKey);
-    UNREFERENCED_PARAMETER(CheckForReadOperation);
     UNREFERENCED_PARAMETER(IoStatus);
     UNREFERENCED_PARAMETER(DeviceObject);
 
-    return FALSE;
+    /* This is called by FsRtl with the FCB resource held */
+    Fcb = (PVFATFCB)FileObject->FsContext;
+    if (Fcb == NULL ||
+        vfatFCBIsFastIoPossible(Fcb) == FastIoIsNotPossible ||
+        BooleanFlagOn(Fcb->Flags, FCB_DELETE_PENDING))
+    {
+        return FALSE;
+    }
+
+    LargeLength.QuadPart = Length;
+
+    if (CheckForReadOperation)
+    {
+        return FsRtlFastCheckLockForRead(&Fcb->FileLock,
+                                         FileOffset,
+                                         &LargeLength,
+                                         LockKey,
+                                         FileObject,
+                                         PsGetCurrentProcess());
+    }
+
+    /* Writes growing the file need new clusters and a dirent update */
+    if (FileOffset->QuadPart + Length > Fcb->RFCB.FileSize.QuadPart)
+    {
+        return FALSE;
+    }
+
+    return FsRtlFastCheckLockForWrite(&Fcb->FileLock,
+                                      FileOffset,
+                                      &LargeLength,
+                                      LockKey,
+                                      FileObject,
+                                      PsGetCurrentProcess());
 }
 
 static FAST_IO_READ VfatFastIoRead;
@@ -63,16 +92,16 @@ VfatFastIoRead(
 {
     DPRINT("VfatFastIoRead()\n");
 
-    UNREFERENCED_PARAMETER(FileObject);
-    UNREFERENCED_PARAMETER(FileOffset);
-    UNREFERENCED_PARAMETER(Length);
-    UNREFERENCED_PARAMETER(Wait);
-    UNREFERENCED_PARAMETER(LockKey);
-    UNREFERENCED_PARAMETER(Buffer);
-    UNREFERENCED_PARAMETER(IoStatus);
-    UNREFERENCED_PARAMETER(DeviceObject);
-
-    return FALSE;
+    /* FsRtl does the locking, the cache map checks and calls
+     * VfatFastIoCheckIfPossible when needed */
+    return FsRtlCopyRead(FileObject,
+                         FileOffset,
+                         Length,
+                         Wait,
+                         LockKey,
+                         Buffer,
+                         IoStatus,
+                         DeviceObject);
 }
 
 static FAST_IO_WRITE VfatFastIoWrite;
@@ -90,18 +119,32 @@ VfatFastIoWrite(
     OUT PIO_STATUS_BLOCK IoStatus,
     IN PDEVICE_OBJECT DeviceObject)
 {
+    PVFATFCB Fcb;
+
     DPRINT("VfatFastIoWrite()\n");
 
-    UNREFERENCED_PARAMETER(FileObject);
-    UNREFERENCED_PARAMETER(FileOffset);
-    UNREFERENCED_PARAMETER(Length);
-    UNREFERENCED_PARAMETER(Wait);
-    UNREFERENCED_PARAMETER(LockKey);
-    UNREFERENCED_PARAMETER(Buffer);
-    UNREFERENCED_PARAMETER(IoStatus);
-    UNREFERENCED_PARAMETER(DeviceObject);
+    Fcb = (PVFATFCB)FileObject->FsContext;
+    if (Fcb == NULL)
+    {
+        return FALSE;
+    }
 
-    return FALSE;
+    /* Don't bother FsRtl for appends, they always extend the file */
+    if (FileOffset->HighPart == -1 &&
+        FileOffset->LowPart == FILE_WRITE_TO_END_OF_FILE)
+    {
+        return FALSE;
+    }
+
+    /* Dates are updated on cleanup, see FO_FILE_MODIFIED */
+    return FsRtlCopyWrite(FileObject,
+                          FileOffset,
+                          Length,
+                          Wait,
+                          LockKey,
+                          Buffer,
+                          IoStatus,
+                          DeviceObject);
 }
 
 static FAST_IO_QUERY_BASIC_INFO VfatFastIoQueryBasicInfo;
@@ -19,6 +19,9 @@
 #define  CACHEPAGESIZE(pDeviceExt) ((pDeviceExt)->FatInfo.BytesPerCluster > PAGE_SIZE ? \
 		   (pDeviceExt)->FatInfo.BytesPerCluster : PAGE_SIZE)
 
+/* Free clusters looked for when a file gets its first cluster */
+#define  VFAT_NEW_FILE_RUN 16
+
 /* FUNCTIONS ****************************************************************/
 
 /*
@@ -413,7 +416,11 @@ FAT12CountAvailableClusters(
         }
 
         if (Entry == 0)
+        {
             ulCount++;
+            if (DeviceExt->FreeClusterMap.Buffer)
+                RtlSetBit(&DeviceExt->FreeClusterMap, i);
+        }
     }
 
     CcUnpinData(Context);
@@ -464,7 +471,11 @@ FAT16CountAvailableClusters(
         while (Block < BlockEnd && i < FatLength)
         {
             if (*Block == 0)
+            {
                 ulCount++;
+                if (DeviceExt->FreeClusterMap.Buffer)
+                    RtlSetBit(&DeviceExt->FreeClusterMap, i);
+            }
             Block++;
             i++;
         }
@@ -520,7 +531,11 @@ FAT32CountAvailableClusters(
         while (Block < BlockEnd && i < FatLength)
         {
             if ((*Block & 0x0fffffff) == 0)
+            {
                 ulCount++;
+                if (DeviceExt->FreeClusterMap.Buffer)
+                    RtlSetBit(&DeviceExt->FreeClusterMap, i);
+            }
             Block++;
             i++;
         }
@@ -534,6 +549,42 @@ FAT32CountAvailableClusters(
     return STATUS_SUCCESS;
 }
 
+/*
+ * FUNCTION: Counts the free clusters of the volume, and builds the free
+ *           cluster bitmap on the way. The FAT resource must be held
+ *           exclusively
+ */
+static
+NTSTATUS
+ScanAvailableClusters(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    NTSTATUS Status;
+    ULONG MapSize;
+    PULONG MapBuffer;
+
+    if (DeviceExt->FreeClusterMap.Buffer == NULL)
+    {
+        /* Without the bitmap we're only slower, don't fail for it */
+        MapSize = DeviceExt->FatInfo.NumberOfClusters + 2;
+        MapBuffer = ExAllocatePoolWithTag(PagedPool, ROUND_UP(MapSize, 32) / 8, TAG_VFAT);
+        if (MapBuffer != NULL)
+            RtlInitializeBitMap(&DeviceExt->FreeClusterMap, MapBuffer, MapSize);
+    }
+    if (DeviceExt->FreeClusterMap.Buffer != NULL)
+        RtlClearAllBits(&DeviceExt->FreeClusterMap);
+
+    if (DeviceExt->FatInfo.FatType == FAT12)
+        Status = FAT12CountAvailableClusters(DeviceExt);
+    else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
+        Status = FAT16CountAvailableClusters(DeviceExt);
+    else
+        Status = FAT32CountAvailableClusters(DeviceExt);
+
+    DeviceExt->FreeClusterMapValid = NT_SUCCESS(Status) && DeviceExt->FreeClusterMap.Buffer != NULL;
+    return Status;
+}
+
 NTSTATUS
 CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
@@ -543,12 +594,7 @@ CountAvailableClusters(
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     if (!DeviceExt->AvailableClustersValid)
     {
-        if (DeviceExt->FatInfo.FatType == FAT12)
-            Status = FAT12CountAvailableClusters(DeviceExt);
-        else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
-            Status = FAT16CountAvailableClusters(DeviceExt);
-        else
-            Status = FAT32CountAvailableClusters(DeviceExt);
+        Status = ScanAvailableClusters(DeviceExt);
     }
     Clusters->QuadPart = DeviceExt->AvailableClusters;
     ExReleaseResourceLite (&DeviceExt->FatResource);
@@ -556,6 +602,68 @@ CountAvailableClusters(
     return Status;
 }
 
+/*
+ * FUNCTION: Releases the free cluster bitmap of a volume
+ */
+VOID
+FreeClusterMapCleanup(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    if (DeviceExt->FreeClusterMap.Buffer != NULL)
+    {
+        ExFreePoolWithTag(DeviceExt->FreeClusterMap.Buffer, TAG_VFAT);
+        DeviceExt->FreeClusterMap.Buffer = NULL;
+    }
+    DeviceExt->FreeClusterMapValid = FALSE;
+}
+
+/*
+ * FUNCTION: Finds a free cluster, preferably at Hint and followed by
+ *           RunLength - 1 more free clusters, and marks it as end of chain.
+ *           Falls back to scanning the FAT when there is no bitmap.
+ *           The FAT resource must be held exclusively
+ */
+static
+NTSTATUS
+FindAndMarkAvailableCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG Hint,
+    ULONG RunLength,
+    PULONG Cluster)
+{
+    ULONG Index = 0xFFFFFFFF;
+    ULONG OldValue;
+    NTSTATUS Status;
+
+    if (!DeviceExt->AvailableClustersValid)
+        ScanAvailableClusters(DeviceExt);
+
+    if (!DeviceExt->FreeClusterMapValid)
+        return DeviceExt->FindAndMarkAvailableCluster(DeviceExt, Cluster);
+
+    if (Hint < 2 || Hint >= DeviceExt->FreeClusterMap.SizeOfBitMap)
+        Hint = DeviceExt->LastAvailableCluster;
+
+    if (RunLength > 1)
+        Index = RtlFindSetBits(&DeviceExt->FreeClusterMap, RunLength, Hint);
+    if (Index == 0xFFFFFFFF)
+        Index = RtlFindSetBits(&DeviceExt->FreeClusterMap, 1, Hint);
+    if (Index == 0xFFFFFFFF)
+        return STATUS_DISK_FULL;
+
+    Status = DeviceExt->WriteCluster(DeviceExt, Index, 0xffffffff, &OldValue);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    ASSERT(OldValue == 0);
+    DPRINT("Found available cluster 0x%x\n", Index);
+    RtlClearBit(&DeviceExt->FreeClusterMap, Index);
+    InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
+    DeviceExt->LastAvailableCluster = *Cluster = Index;
+
+    return STATUS_SUCCESS;
+}
+
 
 /*
  * FUNCTION: Writes a cluster to the FAT12 physical and in-memory tables
@@ -713,6 +821,14 @@ WriteCluster(
         else if (OldValue == 0 && NewValue)
             InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
     }
+    if (DeviceExt->FreeClusterMapValid && NT_SUCCESS(Status) &&
+        ClusterToWrite >= 2 && ClusterToWrite < DeviceExt->FreeClusterMap.SizeOfBitMap)
+    {
+        if (NewValue == 0)
+            RtlSetBit(&DeviceExt->FreeClusterMap, ClusterToWrite);
+        else
+            RtlClearBit(&DeviceExt->FreeClusterMap, ClusterToWrite);
+    }
     ExReleaseResourceLite(&DeviceExt->FatResource);
     return Status;
 }
@@ -782,7 +898,8 @@ GetNextClusterExtend(
      */
     if (CurrentCluster == 0)
     {
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        /* Leave the new file some room to grow contiguously */
+        Status = FindAndMarkAvailableCluster(DeviceExt, 0, VFAT_NEW_FILE_RUN, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -800,8 +917,8 @@ GetNextClusterExtend(
     {
         /* We are after last existing cluster, we must add one to file */
         /* Firstly, find the next available open allocation unit and
-           mark it as end of file */
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+           mark it as end of file, right after the last one if possible */
+        Status = FindAndMarkAvailableCluster(DeviceExt, CurrentCluster + 1, 1, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
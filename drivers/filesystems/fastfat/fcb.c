@@ -53,6 +53,26 @@ vfatNameHash(
     return hash;
 }
 
+/*
+ * Hash of the path of a file in the given directory, without the file name.
+ * The path of the directory is already hashed in its FCB, so walking a path
+ * only hashes each component once.
+ */
+static
+ULONG
+vfatDirPathHash(
+    PVFATFCB DirFcb)
+{
+    UNICODE_STRING SeparatorU = RTL_CONSTANT_STRING(L"\\");
+
+    if (vfatFCBIsRoot(DirFcb))
+    {
+        return DirFcb->Hash.Hash;
+    }
+
+    return vfatNameHash(DirFcb->Hash.Hash, &SeparatorU);
+}
+
 VOID
 vfatSplitPathName(
     PUNICODE_STRING PathNameU,
@@ -154,6 +174,7 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
     ExInitializeFastMutex(&rcFCB->LastMutex);
+    FsRtlInitializeLargeMcb(&rcFCB->ClusterMcb, NonPagedPool);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -174,6 +195,7 @@ vfatDelFCBFromTable(
 
     Index = pFCB->Hash.Hash % pVCB->HashTableSize;
     ShortIndex = pFCB->ShortHash.Hash % pVCB->HashTableSize;
+    pVCB->HashTableCount--;
 
     if (pFCB->Hash.Hash != pFCB->ShortHash.Hash)
     {
@@ -287,6 +309,8 @@ vfatDestroyFCB(
     ExFreePool(pFCB->PathNameBuffer);
     ExDeleteResourceLite(&pFCB->PagingIoResource);
     ExDeleteResourceLite(&pFCB->MainResource);
+    FsRtlUninitializeLargeMcb(&pFCB->ClusterMcb);
+    vfatNameIndexDestroy(pFCB);
     ASSERT(IsListEmpty(&pFCB->ParentListHead));
     ExFreeToNPagedLookasideList(&VfatGlobalData->FcbLookasideList, pFCB);
 }
@@ -321,11 +345,13 @@ _vfatGrabFCB(
     }
 #endif
 
-    ASSERT(ExIsResourceAcquiredExclusive(&pVCB->DirResource));
+    /* Lookups only need DirResource shared, so references may be taken
+     * concurrently. They are only dropped with it held exclusively */
+    ASSERT(ExIsResourceAcquiredSharedLite(&pVCB->DirResource));
 
     ASSERT(pFCB != pVCB->VolumeFcb);
     ASSERT(pFCB->RefCount > 0);
-    ++pFCB->RefCount;
+    InterlockedIncrement(&pFCB->RefCount);
 }
 
 VOID
@@ -392,6 +418,52 @@ _vfatReleaseFCB(
     }
 }
 
+/*
+ * Double the FCB table once it holds more FCBs than buckets. If there's no
+ * memory for it, we just keep the longer chains.
+ */
+static
+VOID
+vfatGrowFCBTable(
+    PDEVICE_EXTENSION pVCB)
+{
+    HASHENTRY **Table;
+    ULONG Size, Index;
+    PLIST_ENTRY ListEntry;
+    PVFATFCB Fcb;
+
+    Size = pVCB->HashTableSize * 2 + 1;
+    Table = ExAllocatePoolWithTag(NonPagedPool, sizeof(HASHENTRY*) * Size, TAG_FCB);
+    if (Table == NULL)
+    {
+        return;
+    }
+    RtlZeroMemory(Table, sizeof(HASHENTRY*) * Size);
+
+    /* Every FCB in the table is on the volume FCB list */
+    for (ListEntry = pVCB->FcbListHead.Flink;
+         ListEntry != &pVCB->FcbListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Fcb = CONTAINING_RECORD(ListEntry, VFATFCB, FcbListEntry);
+
+        Index = Fcb->Hash.Hash % Size;
+        Fcb->Hash.next = Table[Index];
+        Table[Index] = &Fcb->Hash;
+        if (Fcb->Hash.Hash != Fcb->ShortHash.Hash)
+        {
+            Index = Fcb->ShortHash.Hash % Size;
+            Fcb->ShortHash.next = Table[Index];
+            Table[Index] = &Fcb->ShortHash;
+        }
+    }
+
+    DPRINT("FCB table grown to %u buckets for %u FCBs\n", Size, pVCB->HashTableCount);
+    ExFreePoolWithTag(pVCB->FcbHashTable, TAG_FCB);
+    pVCB->FcbHashTable = Table;
+    pVCB->HashTableSize = Size;
+}
+
 static
 VOID
 vfatAddFCBToTable(
@@ -402,6 +474,14 @@ vfatAddFCBToTable(
     ULONG ShortIndex;
 
     ASSERT(pFCB->Hash.Hash == vfatNameHash(0, &pFCB->PathNameU));
+    ASSERT(ExIsResourceAcquiredExclusive(&pVCB->DirResource));
+
+    if (pVCB->HashTableCount >= pVCB->HashTableSize)
+    {
+        vfatGrowFCBTable(pVCB);
+    }
+    pVCB->HashTableCount++;
+
     Index = pFCB->Hash.Hash % pVCB->HashTableSize;
     ShortIndex = pFCB->ShortHash.Hash % pVCB->HashTableSize;
 
@@ -586,13 +666,18 @@ vfatUpdateFCB(
     return STATUS_SUCCESS;
 }
 
+/*
+ * The table only changes with DirResource held exclusively, looking it up
+ * only needs it shared.
+ */
+static
 PVFATFCB
-vfatGrabFCBFromTable(
+vfatGrabFCBFromTableWithHash(
     PDEVICE_EXTENSION pVCB,
-    PUNICODE_STRING PathNameU)
+    PUNICODE_STRING PathNameU,
+    ULONG Hash)
 {
     PVFATFCB  rcFCB;
-    ULONG Hash;
     UNICODE_STRING DirNameU;
     UNICODE_STRING FileNameU;
     PUNICODE_STRING FcbNameU;
@@ -602,7 +687,8 @@ vfatGrabFCBFromTable(
     DPRINT("'%wZ'\n", PathNameU);
 
     ASSERT(PathNameU->Length >= sizeof(WCHAR) && PathNameU->Buffer[0] == L'\\');
-    Hash = vfatNameHash(0, PathNameU);
+    ASSERT(Hash == vfatNameHash(0, PathNameU));
+    ASSERT(ExIsResourceAcquiredSharedLite(&pVCB->DirResource));
 
     entry = pVCB->FcbHashTable[Hash % pVCB->HashTableSize];
     if (entry)
@@ -640,6 +726,14 @@ vfatGrabFCBFromTable(
     return NULL;
 }
 
+PVFATFCB
+vfatGrabFCBFromTable(
+    PDEVICE_EXTENSION pVCB,
+    PUNICODE_STRING PathNameU)
+{
+    return vfatGrabFCBFromTableWithHash(pVCB, PathNameU, vfatNameHash(0, PathNameU));
+}
+
 static
 NTSTATUS
 vfatFCBInitializeCacheFromVolume(
@@ -879,6 +973,18 @@ vfatDirFindFile(
     DirContext.ShortNameU.Length = 0;
     DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
 
+    /* Large directories are looked up in their name index */
+    status = vfatNameIndexFind(pDeviceExt, pDirectoryFCB, FileToFindU, &DirContext);
+    if (status == STATUS_SUCCESS)
+    {
+        return vfatMakeFCBFromDirEntry(pDeviceExt, pDirectoryFCB, &DirContext, pFoundFCB);
+    }
+    if (status == STATUS_OBJECT_NAME_NOT_FOUND)
+    {
+        return status;
+    }
+    DirContext.DirIndex = 0;
+
     while (TRUE)
     {
         status = VfatGetNextDirEntry(pDeviceExt,
@@ -951,6 +1057,7 @@ vfatGetFCBForFile(
     WCHAR NameBuffer[260];
     PWCHAR curr, prev, last;
     ULONG Length;
+    ULONG Hash;
 
     DPRINT("vfatGetFCBForFile (%p,%p,%p,%wZ)\n",
            pVCB, pParentFCB, pFCB, pFileNameU);
@@ -1095,11 +1202,15 @@ vfatGetFCBForFile(
         {
             curr++;
         }
+        /* The path up to prev is the one of parentFCB, hash only the new component */
+        NameU.Buffer = prev;
+        NameU.MaximumLength = NameU.Length = (curr - prev) * sizeof(WCHAR);
+        Hash = vfatNameHash(vfatDirPathHash(parentFCB), &NameU);
         NameU.Buffer = FileNameU.Buffer;
         NameU.Length = (curr - NameU.Buffer) * sizeof(WCHAR);
         NameU.MaximumLength = FileNameU.MaximumLength;
         DPRINT("%wZ\n", &NameU);
-        FCB = vfatGrabFCBFromTable(pVCB, &NameU);
+        FCB = vfatGrabFCBFromTableWithHash(pVCB, &NameU, Hash);
         if (FCB == NULL)
         {
             NameU.Buffer = prev;
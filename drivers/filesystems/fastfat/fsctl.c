@@ -38,6 +38,9 @@ extern VFAT_DISPATCH FatDispatch;
 #define  CACHEPAGESIZE(pDeviceExt) ((pDeviceExt)->FatInfo.BytesPerCluster > PAGE_SIZE ? \
                                     (pDeviceExt)->FatInfo.BytesPerCluster : PAGE_SIZE)
 
+/* When the storage device doesn't tell its limits */
+#define VFAT_DEFAULT_MAX_TRANSFER (64 * 1024)
+
 static
 NTSTATUS
 VfatHasFileSystem(
@@ -509,6 +512,55 @@ ReadVolumeLabel(
     return STATUS_SUCCESS;
 }
 
+/*
+ * Largest transfer a single IRP sent to the storage device should carry.
+ * Longer runs of clusters are split in pieces of this size, all sent at
+ * once, so that the device queue is kept busy.
+ */
+static
+ULONG
+VfatGetMaxTransferLength(
+    PDEVICE_OBJECT StorageDevice)
+{
+    STORAGE_PROPERTY_QUERY Query;
+    STORAGE_ADAPTER_DESCRIPTOR Adapter;
+    ULONG Size, MaxLength;
+    NTSTATUS Status;
+
+    Query.PropertyId = StorageAdapterProperty;
+    Query.QueryType = PropertyStandardQuery;
+    Size = sizeof(STORAGE_ADAPTER_DESCRIPTOR);
+    Status = VfatBlockDeviceIoControl(StorageDevice,
+                                      IOCTL_STORAGE_QUERY_PROPERTY,
+                                      &Query,
+                                      sizeof(Query),
+                                      &Adapter,
+                                      &Size,
+                                      TRUE);
+    if (!NT_SUCCESS(Status) ||
+        Size < FIELD_OFFSET(STORAGE_ADAPTER_DESCRIPTOR, AlignmentMask))
+    {
+        DPRINT("No adapter descriptor (%x), using %u\n", Status, VFAT_DEFAULT_MAX_TRANSFER);
+        return VFAT_DEFAULT_MAX_TRANSFER;
+    }
+
+    MaxLength = Adapter.MaximumTransferLength;
+    /* A buffer that isn't page aligned spans one more page */
+    if (Adapter.MaximumPhysicalPages > 1 &&
+        (Adapter.MaximumPhysicalPages - 1) < MaxLength / PAGE_SIZE)
+    {
+        MaxLength = (Adapter.MaximumPhysicalPages - 1) * PAGE_SIZE;
+    }
+
+    MaxLength = ROUND_DOWN(MaxLength, PAGE_SIZE);
+    if (MaxLength < PAGE_SIZE)
+    {
+        MaxLength = PAGE_SIZE;
+    }
+
+    DPRINT("Maximum transfer length %u\n", MaxLength);
+    return MaxLength;
+}
 
 /*
  * FUNCTION: Mount the filesystem
@@ -530,7 +582,6 @@ VfatMount(
     UNICODE_STRING NameU = RTL_CONSTANT_STRING(L"\\$$Fat$$");
     UNICODE_STRING VolumeNameU = RTL_CONSTANT_STRING(L"\\$$Volume$$");
     UNICODE_STRING VolumeLabelU;
-    ULONG HashTableSize;
     ULONG eocMark;
     ULONG i;
     FATINFO FatInfo;
@@ -561,23 +612,9 @@ VfatMount(
         goto ByeBye;
     }
 
-    /* Use prime numbers for the table size */
-    if (FatInfo.FatType == FAT12)
-    {
-        HashTableSize = 4099; // 4096 = 4 * 1024
-    }
-    else if (FatInfo.FatType == FAT16 ||
-             FatInfo.FatType == FATX16)
-    {
-        HashTableSize = 16411; // 16384 = 16 * 1024
-    }
-    else
-    {
-        HashTableSize = 65537; // 65536 = 64 * 1024;
-    }
     DPRINT("VFAT: Recognized volume\n");
     Status = IoCreateDevice(VfatGlobalData->DriverObject,
-                            ROUND_UP(sizeof (DEVICE_EXTENSION), sizeof(ULONG)) + sizeof(HASHENTRY*) * HashTableSize,
+                            sizeof(DEVICE_EXTENSION),
                             NULL,
                             FILE_DEVICE_DISK_FILE_SYSTEM,
                             DeviceToMount->Characteristics,
@@ -589,11 +626,21 @@ VfatMount(
     }
 
     DeviceExt = DeviceObject->DeviceExtension;
-    RtlZeroMemory(DeviceExt, ROUND_UP(sizeof(DEVICE_EXTENSION), sizeof(ULONG)) + sizeof(HASHENTRY*) * HashTableSize);
-    DeviceExt->FcbHashTable = (HASHENTRY**)((ULONG_PTR)DeviceExt + ROUND_UP(sizeof(DEVICE_EXTENSION), sizeof(ULONG)));
-    DeviceExt->HashTableSize = HashTableSize;
+    RtlZeroMemory(DeviceExt, sizeof(DEVICE_EXTENSION));
     DeviceExt->VolumeDevice = DeviceObject;
 
+    /* The FCB table starts small and grows with the number of FCBs */
+    DeviceExt->HashTableSize = VFAT_FCB_HASH_INITIAL_SIZE;
+    DeviceExt->FcbHashTable = ExAllocatePoolWithTag(NonPagedPool,
+                                                    sizeof(HASHENTRY*) * DeviceExt->HashTableSize,
+                                                    TAG_FCB);
+    if (DeviceExt->FcbHashTable == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ByeBye;
+    }
+    RtlZeroMemory(DeviceExt->FcbHashTable, sizeof(HASHENTRY*) * DeviceExt->HashTableSize);
+
     /* use same vpb as device disk */
     DeviceObject->Vpb = Vpb;
     DeviceToMount->Vpb = Vpb;
@@ -656,6 +703,7 @@ VfatMount(
     DeviceExt->StorageDevice->Vpb->Flags |= VPB_MOUNTED;
     DeviceObject->StackSize = DeviceExt->StorageDevice->StackSize + 1;
     DeviceObject->Flags &= ~DO_DEVICE_INITIALIZING;
+    DeviceExt->MaxTransferLength = VfatGetMaxTransferLength(DeviceExt->StorageDevice);
 
     DPRINT("FsDeviceObject %p\n", DeviceObject);
 
@@ -735,6 +783,7 @@ VfatMount(
     ExInitializeResourceLite(&DeviceExt->FatResource);
 
     InitializeListHead(&DeviceExt->FcbListHead);
+    InitializeListHead(&DeviceExt->NameIndexList);
 
     VolumeFcb = vfatNewFCB(DeviceExt, &VolumeNameU);
     if (VolumeFcb == NULL)
@@ -796,6 +845,8 @@ ByeBye:
             ExFreePoolWithTag(DeviceExt->SpareVPB, TAG_VFAT);
         if (DeviceExt && DeviceExt->Statistics)
             ExFreePoolWithTag(DeviceExt->Statistics, TAG_VFAT);
+        if (DeviceExt && DeviceExt->FcbHashTable)
+            ExFreePoolWithTag(DeviceExt->FcbHashTable, TAG_FCB);
         if (Fcb)
             vfatDestroyFCB(Fcb);
         if (Ccb)
@@ -1208,6 +1259,8 @@ VfatDismountVolume(
         vfatDestroyFCB(Fcb);
     }
 
+    FreeClusterMapCleanup(DeviceExt);
+
     /* Mark we're being dismounted */
     DeviceExt->Flags |= VCB_DISMOUNT_PENDING;
 #ifndef ENABLE_SWAPOUT
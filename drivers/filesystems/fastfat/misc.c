@@ -439,6 +439,9 @@ VfatCheckForDismount(
     {
         PVPB DelVpb;
 
+        FreeClusterMapCleanup(DeviceExt);
+        ExFreePoolWithTag(DeviceExt->FcbHashTable, TAG_FCB);
+
         /* If we have a local VPB, we'll have to delete it
          * but we won't dismount us - something went bad before
          */
@@ -106,6 +106,154 @@ OffsetToCluster(
    }
 }
 
+/*
+ * Forget the runs of the cluster chain past the first Clusters clusters.
+ * Must be called whenever the chain of the file is cut.
+ */
+VOID
+VfatTruncateClusterMcb(
+    PVFATFCB Fcb,
+    ULONG Clusters)
+{
+    ExAcquireFastMutex(&Fcb->LastMutex);
+    FsRtlTruncateLargeMcb(&Fcb->ClusterMcb, Clusters);
+    if (Fcb->MappedClusters > Clusters)
+        Fcb->MappedClusters = Clusters;
+    Fcb->McbGeneration++;
+    ExReleaseFastMutex(&Fcb->LastMutex);
+}
+
+/*
+ * Remember a run found while walking the chain. Fails if the chain was cut
+ * since the walk started, the run may be stale then.
+ */
+static
+BOOLEAN
+VfatCacheClusterRun(
+    PVFATFCB Fcb,
+    ULONG Generation,
+    ULONG RunIndex,
+    ULONG RunCluster,
+    ULONG RunLength)
+{
+    BOOLEAN Cached = FALSE;
+
+    ExAcquireFastMutex(&Fcb->LastMutex);
+    if (Fcb->McbGeneration == Generation &&
+        RunIndex <= Fcb->MappedClusters &&
+        FsRtlAddLargeMcbEntry(&Fcb->ClusterMcb, RunIndex, RunCluster, RunLength))
+    {
+        if (RunIndex + RunLength > Fcb->MappedClusters)
+            Fcb->MappedClusters = RunIndex + RunLength;
+        Cached = TRUE;
+    }
+    ExReleaseFastMutex(&Fcb->LastMutex);
+
+    return Cached;
+}
+
+/*
+ * Return the disk cluster holding the ClusterIndex'th cluster of the file,
+ * and how many clusters (up to MaxClusters) follow it contiguously on disk.
+ * Known runs come from the FCB cluster MCB, only the part of the chain past
+ * them is walked, one FAT lookup per cluster, and remembered for next time.
+ */
+static
+NTSTATUS
+VfatGetClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG ClusterIndex,
+    ULONG MaxClusters,
+    PULONG Cluster,
+    PULONG RunClusters)
+{
+    LONGLONG Lbn, Count;
+    ULONG Generation, CurrentIndex, CurrentCluster;
+    ULONG RunIndex, RunCluster, RunLength;
+    BOOLEAN Cache = TRUE, Cached = FALSE;
+    NTSTATUS Status;
+
+    ASSERT(FirstCluster > 1);
+    ASSERT(MaxClusters > 0);
+
+    if (FsRtlLookupLargeMcbEntry(&Fcb->ClusterMcb, ClusterIndex, &Lbn, &Count, NULL, NULL, NULL) &&
+        Lbn != -1)
+    {
+        *Cluster = (ULONG)Lbn;
+        *RunClusters = (ULONG)min(Count, MaxClusters);
+        return STATUS_SUCCESS;
+    }
+
+    /* Resume the walk after the known part of the chain */
+    ExAcquireFastMutex(&Fcb->LastMutex);
+    Generation = Fcb->McbGeneration;
+    CurrentIndex = Fcb->MappedClusters;
+    ExReleaseFastMutex(&Fcb->LastMutex);
+
+    CurrentCluster = FirstCluster;
+    if (CurrentIndex > ClusterIndex)
+        CurrentIndex = 0;
+    if (CurrentIndex > 0)
+    {
+        if (FsRtlLookupLargeMcbEntry(&Fcb->ClusterMcb, CurrentIndex - 1, &Lbn, NULL, NULL, NULL, NULL) &&
+            Lbn != -1)
+        {
+            Status = GetNextCluster(DeviceExt, (ULONG)Lbn, &CurrentCluster);
+            if (!NT_SUCCESS(Status))
+                return Status;
+        }
+        else
+        {
+            /* Truncated meanwhile, start over */
+            CurrentIndex = 0;
+        }
+    }
+
+    RunIndex = CurrentIndex;
+    RunCluster = CurrentCluster;
+    RunLength = 0;
+    while (CurrentCluster != 0xffffffff && CurrentCluster >= 2)
+    {
+        if (RunLength > 0 && CurrentCluster != RunCluster + RunLength)
+        {
+            /* The run ends here, we're done if it holds ClusterIndex */
+            if (Cache)
+                Cache = VfatCacheClusterRun(Fcb, Generation, RunIndex, RunCluster, RunLength);
+            if (RunIndex + RunLength > ClusterIndex)
+            {
+                Cached = TRUE;
+                break;
+            }
+
+            RunIndex = CurrentIndex;
+            RunCluster = CurrentCluster;
+            RunLength = 0;
+        }
+
+        RunLength++;
+        if (CurrentIndex + 1 >= ClusterIndex + MaxClusters)
+            break;
+
+        Status = GetNextCluster(DeviceExt, CurrentCluster, &CurrentCluster);
+        if (!NT_SUCCESS(Status))
+            return Status;
+        CurrentIndex++;
+    }
+
+    if (RunLength > 0 && !Cached && Cache)
+        VfatCacheClusterRun(Fcb, Generation, RunIndex, RunCluster, RunLength);
+
+    /* The chain is shorter than the file claims */
+    if (RunLength == 0 || ClusterIndex < RunIndex || ClusterIndex >= RunIndex + RunLength)
+        return STATUS_UNSUCCESSFUL;
+
+    *Cluster = RunCluster + (ClusterIndex - RunIndex);
+    *RunClusters = min(RunIndex + RunLength - ClusterIndex, MaxClusters);
+    return STATUS_SUCCESS;
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -117,20 +265,17 @@ VfatReadFileData(
     LARGE_INTEGER ReadOffset,
     PULONG LengthRead)
 {
-    ULONG CurrentCluster;
     ULONG FirstCluster;
     ULONG StartCluster;
     ULONG ClusterCount;
+    ULONG ClusterOffset;
     LARGE_INTEGER StartOffset;
     PDEVICE_EXTENSION DeviceExt;
-    BOOLEAN First = TRUE;
     PVFATFCB Fcb;
     NTSTATUS Status;
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -187,8 +332,7 @@ VfatReadFileData(
     }
 
     /* Find the first cluster */
-    FirstCluster =
-    CurrentCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
+    FirstCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
 
     if (FirstCluster == 1)
     {
@@ -208,18 +352,21 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
+    KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
+    IrpContext->RefCount = 1;
 
-    /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
+    /* One read per run of contiguous clusters */
+    while (Length > 0)
     {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+        ClusterOffset = ReadOffset.u.LowPart % BytesPerCluster;
+        Status = VfatGetClusterRun(DeviceExt, Fcb, FirstCluster,
+                                   ReadOffset.u.LowPart / BytesPerCluster,
+                                   (ULONG)(((ULONGLONG)ClusterOffset + Length + BytesPerCluster - 1) / BytesPerCluster),
+                                   &StartCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
         /* DEBUG VERIFICATION */
         {
@@ -227,68 +374,16 @@ VfatReadFileData(
             OffsetToCluster(DeviceExt, FirstCluster,
                             ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
                             &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
+            if (CorrectCluster != StartCluster)
                 KeBugCheck(FAT_FILE_SYSTEM);
         }
 #endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (ReadOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
-    IrpContext->RefCount = 1;
-
-    while (Length > 0 && CurrentCluster != 0xffffffff)
-    {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
-        {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (ReadOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += ReadOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
-        }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector + ClusterOffset;
+        BytesDone = (ULONG)min(Length, (ULONGLONG)ClusterCount * BytesPerCluster - ClusterOffset);
+        /* Split long runs, the rest is found in the MCB on the next pass */
+        BytesDone = min(BytesDone, DeviceExt->MaxTransferLength);
+        DPRINT("start %08x, count %u\n", StartCluster, ClusterCount);
 
         /* Fire up the read command */
         Status = VfatReadDiskPartial (IrpContext, &StartOffset, BytesDone, *LengthRead, FALSE);
@@ -332,18 +427,15 @@ VfatWriteFileData(
     PVFATFCB Fcb;
     ULONG Count;
     ULONG FirstCluster;
-    ULONG CurrentCluster;
     ULONG BytesDone;
     ULONG StartCluster;
     ULONG ClusterCount;
+    ULONG ClusterOffset;
     NTSTATUS Status = STATUS_SUCCESS;
-    BOOLEAN First = TRUE;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -408,8 +500,7 @@ VfatWriteFileData(
     /*
      * Find the first cluster
      */
-    FirstCluster =
-    CurrentCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
+    FirstCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
 
     if (FirstCluster == 1)
     {
@@ -421,20 +512,21 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
+    IrpContext->RefCount = 1;
+    BufferOffset = 0;
 
-    /*
-     * Find the cluster to start the write from
-     */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
+    /* One write per run of contiguous clusters */
+    while (Length > 0)
     {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+        ClusterOffset = WriteOffset.u.LowPart % BytesPerCluster;
+        Status = VfatGetClusterRun(DeviceExt, Fcb, FirstCluster,
+                                   WriteOffset.u.LowPart / BytesPerCluster,
+                                   (ULONG)(((ULONGLONG)ClusterOffset + Length + BytesPerCluster - 1) / BytesPerCluster),
+                                   &StartCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
         /* DEBUG VERIFICATION */
         {
@@ -442,68 +534,16 @@ VfatWriteFileData(
             OffsetToCluster(DeviceExt, FirstCluster,
                             ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
                             &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
+            if (CorrectCluster != StartCluster)
                 KeBugCheck(FAT_FILE_SYSTEM);
         }
 #endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (WriteOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    IrpContext->RefCount = 1;
-    BufferOffset = 0;
-
-    while (Length > 0 && CurrentCluster != 0xffffffff)
-    {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
-        {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (WriteOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += WriteOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
-        }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector + ClusterOffset;
+        BytesDone = (ULONG)min(Length, (ULONGLONG)ClusterCount * BytesPerCluster - ClusterOffset);
+        /* Split long runs, the rest is found in the MCB on the next pass */
+        BytesDone = min(BytesDone, DeviceExt->MaxTransferLength);
+        DPRINT("start %08x, count %u\n", StartCluster, ClusterCount);
 
         // Fire up the write command
         Status = VfatWriteDiskPartial (IrpContext, &StartOffset, BytesDone, BufferOffset, FALSE);
@@ -685,6 +725,7 @@ VfatRead(
                                      FALSE,
                                      &(VfatGlobalData->CacheMgrCallbacks),
                                      Fcb);
+                Fcb->RFCB.IsFastIoPossible = vfatFCBIsFastIoPossible(Fcb);
             }
 
             if (!CcCopyRead(IrpContext->FileObject,
@@ -725,6 +766,20 @@ VfatRead(
             Length = (ULONG)(ROUND_UP_64(Fcb->RFCB.FileSize.QuadPart, BytesPerSector) - ByteOffset.QuadPart);
         }
 
+        // the disk must have what's cached before we read it directly
+        if (!PagingIo && !IsVolume &&
+            IrpContext->FileObject->SectionObjectPointer->DataSectionObject != NULL)
+        {
+            IO_STATUS_BLOCK IoStatus;
+
+            CcFlushCache(IrpContext->FileObject->SectionObjectPointer, &ByteOffset, Length, &IoStatus);
+            if (!NT_SUCCESS(IoStatus.Status))
+            {
+                Status = IoStatus.Status;
+                goto ByeBye;
+            }
+        }
+
         if (!IsVolume)
         {
             vfatAddToStat(IrpContext->DeviceExt, Fat.NonCachedReads, 1);
@@ -977,6 +1032,7 @@ VfatWrite(
                                      FALSE,
                                      &VfatGlobalData->CacheMgrCallbacks,
                                      Fcb);
+                Fcb->RFCB.IsFastIoPossible = vfatFCBIsFastIoPossible(Fcb);
             }
 
             if (ByteOffset.QuadPart > OldFileSize.QuadPart)
@@ -1020,6 +1076,21 @@ VfatWrite(
             CcZeroData(IrpContext->FileObject, &OldFileSize, &ByteOffset, TRUE);
         }
 
+        // write back and drop what's cached, the disk is about to get newer data
+        if (!PagingIo && !IsVolume &&
+            IrpContext->FileObject->SectionObjectPointer->DataSectionObject != NULL)
+        {
+            IO_STATUS_BLOCK IoStatus;
+
+            CcFlushCache(IrpContext->FileObject->SectionObjectPointer, &ByteOffset, Length, &IoStatus);
+            if (!NT_SUCCESS(IoStatus.Status))
+            {
+                Status = IoStatus.Status;
+                goto ByeBye;
+            }
+            CcPurgeCacheSection(IrpContext->FileObject->SectionObjectPointer, &ByteOffset, Length, FALSE);
+        }
+
         if (!IsVolume)
         {
             vfatAddToStat(IrpContext->DeviceExt, Fat.NonCachedWrites, 1);
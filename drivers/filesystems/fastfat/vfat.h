@@ -274,6 +274,9 @@ typedef struct _HASHENTRY
 }
 HASHENTRY;
 
+/* Buckets of a new FCB table, it doubles when it has more FCBs than that */
+#define VFAT_FCB_HASH_INITIAL_SIZE 1031
+
 typedef struct DEVICE_EXTENSION *PDEVICE_EXTENSION;
 
 typedef NTSTATUS (*PGET_NEXT_CLUSTER)(PDEVICE_EXTENSION,ULONG,PULONG);
@@ -308,19 +311,30 @@ typedef struct DEVICE_EXTENSION
     KSPIN_LOCK FcbListLock;
     LIST_ENTRY FcbListHead;
     ULONG HashTableSize;
+    ULONG HashTableCount;
     struct _HASHENTRY **FcbHashTable;
 
     PDEVICE_OBJECT VolumeDevice;
     PDEVICE_OBJECT StorageDevice;
+    /* Longest piece of a cluster run sent to the storage device in one IRP */
+    ULONG MaxTransferLength;
     PFILE_OBJECT FATFileObject;
     FATINFO FatInfo;
     ULONG LastAvailableCluster;
     ULONG AvailableClusters;
     BOOLEAN AvailableClustersValid;
+    /* Set bits are free clusters. Built by the first free cluster count and
+     * kept in sync by WriteCluster, protected by FatResource */
+    RTL_BITMAP FreeClusterMap;
+    BOOLEAN FreeClusterMapValid;
     ULONG Flags;
     struct _VFATFCB *VolumeFcb;
     PSTATISTICS Statistics;
 
+    /* Name indexes of large directories, most recently used first */
+    LIST_ENTRY NameIndexList;
+    ULONG NameIndexBytes;
+
     /* Pointers to functions for manipulating FAT. */
     PGET_NEXT_CLUSTER GetNextCluster;
     PFIND_AND_MARK_AVAILABLE_CLUSTER FindAndMarkAvailableCluster;
@@ -420,6 +434,23 @@ extern PVFAT_GLOBAL_DATA VfatGlobalData;
 
 #define NODE_TYPE_FCB ((CSHORT)0x0502)
 
+typedef struct _VFAT_NAME_INDEX_SLOT
+{
+    ULONG Hash;
+    ULONG DirIndex;
+} VFAT_NAME_INDEX_SLOT, *PVFAT_NAME_INDEX_SLOT;
+
+/* Hash of the names of a large directory to their entry, see dirindex.c */
+typedef struct _VFAT_NAME_INDEX
+{
+    LIST_ENTRY IndexListEntry;
+    PDEVICE_EXTENSION DeviceExt;
+    struct _VFATFCB *DirFcb;
+    ULONG Size;
+    ULONG Used;
+    PVFAT_NAME_INDEX_SLOT Slots;
+} VFAT_NAME_INDEX, *PVFAT_NAME_INDEX;
+
 typedef struct _VFATFCB
 {
     /* FCB header required by ROS/NT */
@@ -503,6 +534,19 @@ typedef struct _VFATFCB
     FAST_MUTEX LastMutex;
     ULONG LastCluster;
     ULONG LastOffset;
+
+    /*
+     * Runs of the cluster chain seen so far, cluster index in the file to
+     * cluster on the disk. Built lazily from the start of the chain, so the
+     * first MappedClusters clusters are always known. McbGeneration changes
+     * whenever the chain is cut, both are protected by LastMutex.
+     */
+    LARGE_MCB ClusterMcb;
+    ULONG MappedClusters;
+    ULONG McbGeneration;
+
+    /* Name index of a large directory, NULL until its first lookup */
+    PVFAT_NAME_INDEX NameIndex;
 } VFATFCB, *PVFATFCB;
 
 #define CCB_DELETE_ON_CLOSE     0x0001
@@ -598,6 +642,22 @@ vfatFCBIsDirectory(PVFATFCB FCB)
     return BooleanFlagOn(*FCB->Attributes, FILE_ATTRIBUTE_DIRECTORY);
 }
 
+/* Regular cached files go through VfatFastIoCheckIfPossible on each fast I/O:
+ * it checks byte range locks and keeps writes that extend the file on the IRP
+ * path, which is the one maintaining the allocation and the dirent */
+FORCEINLINE
+FAST_IO_POSSIBLE
+vfatFCBIsFastIoPossible(PVFATFCB FCB)
+{
+    if (vfatFCBIsDirectory(FCB) ||
+        BooleanFlagOn(FCB->Flags, FCB_IS_PAGE_FILE | FCB_IS_VOLUME | FCB_IS_FAT))
+    {
+        return FastIoIsNotPossible;
+    }
+
+    return FastIoIsQuestionable;
+}
+
 FORCEINLINE
 BOOLEAN
 vfatFCBIsReadOnly(PVFATFCB FCB)
@@ -725,6 +785,31 @@ FsdSystemTimeToDosDateTime(
     USHORT *pDosDate,
     USHORT *pDosTime);
 
+/* dirindex.c */
+
+NTSTATUS
+vfatNameIndexFind(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext);
+
+VOID
+vfatNameIndexAddEntry(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    ULONG DirIndex);
+
+VOID
+vfatNameIndexRemoveEntry(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    ULONG DirIndex);
+
+VOID
+vfatNameIndexDestroy(
+    PVFATFCB DirFcb);
+
 /* direntry.c */
 
 ULONG
@@ -871,6 +956,10 @@ CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
     PLARGE_INTEGER Clusters);
 
+VOID
+FreeClusterMapCleanup(
+    PDEVICE_EXTENSION DeviceExt);
+
 NTSTATUS
 WriteCluster(
     PDEVICE_EXTENSION DeviceExt,
@@ -1108,6 +1197,11 @@ NextCluster(
     PULONG CurrentCluster,
     BOOLEAN Extend);
 
+VOID
+VfatTruncateClusterMcb(
+    PVFATFCB Fcb,
+    ULONG Clusters);
+
 /* shutdown.c */
 
 DRIVER_DISPATCH
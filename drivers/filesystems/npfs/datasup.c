@@ -15,6 +15,133 @@
 
 /* FUNCTIONS ******************************************************************/
 
+VOID
+NTAPI
+NpFreeDataQueueEntry(IN PNP_DATA_QUEUE_ENTRY DataEntry)
+{
+    PVOID *Chunks;
+    ULONG i;
+
+    Chunks = (PVOID *)(DataEntry + 1);
+    for (i = 0; i < DataEntry->ChunkCount; i++)
+    {
+        if (Chunks[i]) ExFreeToNPagedLookasideList(&NpDataChunkLookasideList, Chunks[i]);
+    }
+
+    if (DataEntry->QuotaProcess)
+    {
+        PsReturnPoolQuota(DataEntry->QuotaProcess,
+                          NonPagedPool,
+                          DataEntry->ChunkCount * NPFS_DATA_CHUNK_SIZE);
+        ObDereferenceObject(DataEntry->QuotaProcess);
+    }
+
+    ExFreePool(DataEntry);
+}
+
+NTSTATUS
+NTAPI
+NpCopyToDataQueueEntry(IN PNP_DATA_QUEUE_ENTRY DataEntry,
+                       IN PVOID Buffer)
+{
+    NTSTATUS Status;
+    PEPROCESS Process;
+    PVOID *Chunks;
+    ULONG i, Size;
+
+    if (!DataEntry->ChunkCount)
+    {
+        _SEH2_TRY
+        {
+            RtlCopyMemory(DataEntry + 1, Buffer, DataEntry->DataSize);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+
+        return STATUS_SUCCESS;
+    }
+
+    /* The chunks come from a lookaside list, so charge the writer for them */
+    Process = PsGetCurrentProcess();
+    Status = PsChargeProcessPoolQuota(Process,
+                                      NonPagedPool,
+                                      DataEntry->ChunkCount * NPFS_DATA_CHUNK_SIZE);
+    if (!NT_SUCCESS(Status)) return Status;
+    ObReferenceObject(Process);
+    DataEntry->QuotaProcess = Process;
+
+    Chunks = (PVOID *)(DataEntry + 1);
+    for (i = 0; i < DataEntry->ChunkCount; i++)
+    {
+        Chunks[i] = ExAllocateFromNPagedLookasideList(&NpDataChunkLookasideList);
+        if (!Chunks[i]) return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    _SEH2_TRY
+    {
+        for (i = 0; i < DataEntry->ChunkCount; i++)
+        {
+            Size = DataEntry->DataSize - i * NPFS_DATA_CHUNK_SIZE;
+            if (Size > NPFS_DATA_CHUNK_SIZE) Size = NPFS_DATA_CHUNK_SIZE;
+
+            RtlCopyMemory(Chunks[i],
+                          (PVOID)((ULONG_PTR)Buffer + i * NPFS_DATA_CHUNK_SIZE),
+                          Size);
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        _SEH2_YIELD(return _SEH2_GetExceptionCode());
+    }
+    _SEH2_END;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+NpCopyFromDataQueueEntry(IN PNP_DATA_QUEUE_ENTRY DataEntry,
+                         IN ULONG Offset,
+                         OUT PVOID Buffer,
+                         IN ULONG Length)
+{
+    PVOID *Chunks;
+    ULONG ChunkOffset, Size;
+
+    if (DataEntry->DataEntryType == Unbuffered)
+    {
+        RtlCopyMemory(Buffer,
+                      (PVOID)((ULONG_PTR)DataEntry->Irp->AssociatedIrp.SystemBuffer + Offset),
+                      Length);
+        return;
+    }
+
+    if (!DataEntry->ChunkCount)
+    {
+        RtlCopyMemory(Buffer, (PVOID)((ULONG_PTR)(DataEntry + 1) + Offset), Length);
+        return;
+    }
+
+    Chunks = (PVOID *)(DataEntry + 1);
+    while (Length)
+    {
+        ChunkOffset = Offset % NPFS_DATA_CHUNK_SIZE;
+        Size = NPFS_DATA_CHUNK_SIZE - ChunkOffset;
+        if (Size > Length) Size = Length;
+
+        RtlCopyMemory(Buffer,
+                      (PVOID)((ULONG_PTR)Chunks[Offset / NPFS_DATA_CHUNK_SIZE] + ChunkOffset),
+                      Size);
+
+        Buffer = (PVOID)((ULONG_PTR)Buffer + Size);
+        Offset += Size;
+        Length -= Size;
+    }
+}
+
 NTSTATUS
 NTAPI
 NpUninitializeDataQueue(IN PNP_DATA_QUEUE DataQueue)
@@ -152,7 +279,7 @@ NpRemoveDataQueueEntry(IN PNP_DATA_QUEUE DataQueue,
             Irp = NULL;
         }
 
-        ExFreePool(QueueEntry);
+        NpFreeDataQueueEntry(QueueEntry);
 
         if (Flag)
         {
@@ -281,7 +408,7 @@ NpCancelDataQueueIrp(IN PDEVICE_OBJECT DeviceObject,
         FsRtlExitFileSystem();
     }
 
-    if (DataEntry) ExFreePool(DataEntry);
+    if (DataEntry) NpFreeDataQueueEntry(DataEntry);
 
     NpFreeClientSecurityContext(ClientSecurityContext);
     Irp->IoStatus.Status = STATUS_CANCELLED;
@@ -305,7 +432,7 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
     NTSTATUS Status;
     PNP_DATA_QUEUE_ENTRY DataEntry;
     SIZE_T EntrySize;
-    ULONG QuotaInEntry;
+    ULONG QuotaInEntry, ChunkCount;
     PSECURITY_CLIENT_CONTEXT ClientContext;
     BOOLEAN HasSpace;
 
@@ -344,6 +471,8 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
             }
 
             DataEntry->DataEntryType = Type;
+            DataEntry->ChunkCount = 0;
+            DataEntry->QuotaProcess = NULL;
             DataEntry->QuotaInEntry = 0;
             DataEntry->Irp = Irp;
             DataEntry->DataSize = DataSize;
@@ -355,13 +484,23 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
         case Buffered:
 
             EntrySize = sizeof(*DataEntry);
+            ChunkCount = 0;
             if (Who != ReadEntries)
             {
-                EntrySize += DataSize;
-                if (EntrySize < DataSize)
+                if (DataSize > NPFS_DATA_CHUNK_SIZE)
                 {
-                    NpFreeClientSecurityContext(ClientContext);
-                    return STATUS_INVALID_PARAMETER;
+                    ChunkCount = DataSize / NPFS_DATA_CHUNK_SIZE +
+                                 ((DataSize % NPFS_DATA_CHUNK_SIZE) != 0);
+                    EntrySize += ChunkCount * sizeof(PVOID);
+                }
+                else
+                {
+                    EntrySize += DataSize;
+                    if (EntrySize < DataSize)
+                    {
+                        NpFreeClientSecurityContext(ClientContext);
+                        return STATUS_INVALID_PARAMETER;
+                    }
                 }
             }
 
@@ -388,6 +527,9 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
             DataEntry->QuotaInEntry = QuotaInEntry;
             DataEntry->Irp = Irp;
             DataEntry->DataEntryType = Buffered;
+            DataEntry->ChunkCount = ChunkCount;
+            DataEntry->QuotaProcess = NULL;
+            if (ChunkCount) RtlZeroMemory(DataEntry + 1, ChunkCount * sizeof(PVOID));
             DataEntry->ClientSecurityContext = ClientContext;
             DataEntry->DataSize = DataSize;
 
@@ -401,18 +543,14 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
             }
             else
             {
-                _SEH2_TRY
-                {
-                    RtlCopyMemory(DataEntry + 1,
-                                  Irp ? Irp->UserBuffer: Buffer,
-                                  DataSize);
-                }
-                _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+                Status = NpCopyToDataQueueEntry(DataEntry,
+                                                Irp ? Irp->UserBuffer : Buffer);
+                if (!NT_SUCCESS(Status))
                 {
+                    NpFreeDataQueueEntry(DataEntry);
                     NpFreeClientSecurityContext(ClientContext);
-                    _SEH2_YIELD(return _SEH2_GetExceptionCode());
+                    return Status;
                 }
-                _SEH2_END;
 
                 if (HasSpace && Irp)
                 {
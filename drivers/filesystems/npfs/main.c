@@ -19,6 +19,7 @@ PDEVICE_OBJECT NpfsDeviceObject;
 PVOID NpAliases;
 PNPFS_ALIAS NpAliasList;
 PNPFS_ALIAS NpAliasListByLength[MAX_INDEXED_LENGTH + 1 - MIN_INDEXED_LENGTH];
+NPAGED_LOOKASIDE_LIST NpDataChunkLookasideList;
 
 FAST_IO_DISPATCH NpFastIoDispatch =
 {
@@ -339,6 +340,14 @@ DriverEntry(IN PDRIVER_OBJECT DriverObject,
         return Status;
     }
 
+    ExInitializeNPagedLookasideList(&NpDataChunkLookasideList,
+                                    NULL,
+                                    NULL,
+                                    0,
+                                    NPFS_DATA_CHUNK_SIZE,
+                                    NPFS_DATA_CHUNK_TAG,
+                                    0);
+
     DriverObject->MajorFunction[IRP_MJ_CREATE] = NpFsdCreate;
     DriverObject->MajorFunction[IRP_MJ_CREATE_NAMED_PIPE] = NpFsdCreateNamedPipe;
     DriverObject->MajorFunction[IRP_MJ_CLOSE] = NpFsdClose;
@@ -369,6 +378,7 @@ DriverEntry(IN PDRIVER_OBJECT DriverObject,
     if (!NT_SUCCESS(Status))
     {
         DPRINT1("Failed to create named pipe device! (Status %lx)\n", Status);
+        ExDeleteNPagedLookasideList(&NpDataChunkLookasideList);
         return Status;
     }
 
@@ -44,6 +44,7 @@
 //  NpFD - npfs.sys - DCB, directory block
 //  NpFg - npfs.sys - Global storage
 //  NpFi - npfs.sys - NPFS client info buffer.
+//  NpFk - npfs.sys - Data chunks of large buffered writes
 //  NpFn - npfs.sys - Name block
 //  NpFq - npfs.sys - Query template buffer used for directory query
 //  NpFr - npfs.sys - DATA_ENTRY records(read / write buffers)
@@ -56,6 +57,7 @@
 #define NPFS_FCB_TAG            'fFpN'
 #define NPFS_GLOBAL_TAG         'gFpN'
 #define NPFS_CLIENT_INFO_TAG    'iFpN'
+#define NPFS_DATA_CHUNK_TAG     'kFpN'
 #define NPFS_NAME_BLOCK_TAG     'nFpN'
 #define NPFS_QUERY_TEMPLATE_TAG 'qFpN'
 #define NPFS_DATA_ENTRY_TAG     'rFpN'
@@ -153,8 +155,26 @@ typedef struct _NP_DATA_QUEUE_ENTRY
     ULONG QuotaInEntry;
     PSECURITY_CLIENT_CONTEXT ClientSecurityContext;
     ULONG DataSize;
+    ULONG ChunkCount;
+    PEPROCESS QuotaProcess;
 } NP_DATA_QUEUE_ENTRY, *PNP_DATA_QUEUE_ENTRY;
 
+//
+// Buffered writes larger than a chunk don't get one big nonpaged block: their
+// data lives in chunks from NpDataChunkLookasideList, pointed to by an array
+// following the entry (ChunkCount != 0). Smaller writes keep their data right
+// after the entry
+//
+#define NPFS_DATA_CHUNK_SIZE    PAGE_SIZE
+
+//
+// Reads at least this large lock the reader's buffer so that a writer can copy
+// straight into it instead of going through an intermediate pool buffer
+//
+#define NPFS_DIRECT_READ_SIZE   PAGE_SIZE
+
+extern NPAGED_LOOKASIDE_LIST NpDataChunkLookasideList;
+
 /* A Wait Queue. Only the VCB has one of these. */
 typedef struct _NP_WAIT_QUEUE
 {
@@ -404,6 +424,13 @@ NpRemoveDataQueueEntry(IN PNP_DATA_QUEUE DataQueue,
                        IN BOOLEAN Flag,
                        IN PLIST_ENTRY List);
 
+VOID
+NTAPI
+NpCopyFromDataQueueEntry(IN PNP_DATA_QUEUE_ENTRY DataEntry,
+                         IN ULONG Offset,
+                         OUT PVOID Buffer,
+                         IN ULONG Length);
+
 NTSTATUS
 NTAPI
 NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
@@ -129,6 +129,25 @@ NpCommonRead(IN PFILE_OBJECT FileObject,
         goto Quickie;
     }
 
+    /* Lock large read buffers, so the writer can fill them directly */
+    if (BufferSize >= NPFS_DIRECT_READ_SIZE && !Irp->MdlAddress)
+    {
+        if (IoAllocateMdl(Buffer, BufferSize, FALSE, FALSE, Irp))
+        {
+            _SEH2_TRY
+            {
+                MmProbeAndLockPages(Irp->MdlAddress, Irp->RequestorMode, IoWriteAccess);
+            }
+            _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+            {
+                /* No big deal, the data will go through pool instead */
+                IoFreeMdl(Irp->MdlAddress);
+                Irp->MdlAddress = NULL;
+            }
+            _SEH2_END;
+        }
+    }
+
     Status = NpAddDataQueueEntry(NamedPipeEnd,
                                  Ccb,
                                  ReadQueue,
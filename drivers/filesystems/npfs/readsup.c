@@ -27,7 +27,6 @@ NpReadDataQueue(IN PNP_DATA_QUEUE DataQueue,
                 IN PLIST_ENTRY List)
 {
     PNP_DATA_QUEUE_ENTRY DataEntry, TempDataEntry;
-    PVOID DataBuffer;
     ULONG DataSize, DataLength, TotalBytesCopied, RemainingSize, Offset;
     PIRP Irp;
     IO_STATUS_BLOCK IoStatus;
@@ -59,15 +58,6 @@ NpReadDataQueue(IN PNP_DATA_QUEUE DataQueue,
             DataEntry->DataEntryType == Buffered ||
             DataEntry->DataEntryType == Unbuffered)
         {
-            if (DataEntry->DataEntryType == Unbuffered)
-            {
-                DataBuffer = DataEntry->Irp->AssociatedIrp.SystemBuffer;
-            }
-            else
-            {
-                DataBuffer = &DataEntry[1];
-            }
-
             DataSize = DataEntry->DataSize;
             Offset = DataSize;
 
@@ -81,9 +71,10 @@ NpReadDataQueue(IN PNP_DATA_QUEUE DataQueue,
 
             _SEH2_TRY
             {
-                RtlCopyMemory((PVOID)((ULONG_PTR)Buffer + BufferSize - RemainingSize),
-                              (PVOID)((ULONG_PTR)DataBuffer + DataSize - Offset),
-                              DataLength);
+                NpCopyFromDataQueueEntry(DataEntry,
+                                         DataSize - Offset,
+                                         (PVOID)((ULONG_PTR)Buffer + BufferSize - RemainingSize),
+                                         DataLength);
             }
             _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
             {
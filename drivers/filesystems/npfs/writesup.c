@@ -82,9 +82,24 @@ NpWriteDataQueue(IN PNP_DATA_QUEUE WriteQueue,
 
         if (DataEntry->DataEntryType != Unbuffered && BufferSize)
         {
-            Buffer = ExAllocatePoolWithTag(NonPagedPool, BufferSize, NPFS_DATA_ENTRY_TAG);
-            if (!Buffer) return STATUS_INSUFFICIENT_RESOURCES;
-            AllocatedBuffer = TRUE;
+            /* If the reader locked its buffer, copy straight into it */
+            Buffer = NULL;
+            if (IoStack->MajorFunction == IRP_MJ_READ && DataEntry->Irp->MdlAddress)
+            {
+                Buffer = MmGetSystemAddressForMdlSafe(DataEntry->Irp->MdlAddress,
+                                                      NormalPagePriority);
+            }
+
+            if (Buffer)
+            {
+                AllocatedBuffer = FALSE;
+            }
+            else
+            {
+                Buffer = ExAllocatePoolWithTag(NonPagedPool, BufferSize, NPFS_DATA_ENTRY_TAG);
+                if (!Buffer) return STATUS_INSUFFICIENT_RESOURCES;
+                AllocatedBuffer = TRUE;
+            }
         }
         else
         {
@@ -389,6 +389,66 @@ CreateEmptyBTree(PB_TREE *NewTree)
     return STATUS_SUCCESS;
 }
 
+/**
+* @name CollateFileNames
+* @implemented
+*
+* Compare two file names to determine their order in a $I30 index.
+*
+* @param Name1
+* Pointer to a UNICODE_STRING holding the first name.
+*
+* @param Name2
+* Pointer to a UNICODE_STRING holding the other name.
+*
+* @param CaseSensitive
+* Boolean indicating if the function should operate in case-sensitive mode.
+*
+* @returns
+* 0 if the two names are equal.
+* < 0 if Name1 sorts before Name2
+* > 0 if Name1 sorts after Name2
+*/
+LONG
+CollateFileNames(PUNICODE_STRING Name1, PUNICODE_STRING Name2, BOOLEAN CaseSensitive)
+{
+    UNICODE_STRING Key1Name = *Name1, Key2Name = *Name2;
+    LONG Comparison;
+
+    // Are the two names the same length?
+    if (Key1Name.Length == Key2Name.Length)
+        return RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
+
+    // Is Name1 shorter?
+    if (Key1Name.Length < Key2Name.Length)
+    {
+        // Truncate Key2Name to be the same length as Key1Name
+        Key2Name.Length = Key1Name.Length;
+        
+        // Compare the names of the same length
+        Comparison = RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
+
+        // If the truncated names are the same length, the shorter one comes first
+        if (Comparison == 0)
+            return -1;
+    }
+    else
+    {
+        // Name2 is shorter
+        // Truncate Key1Name to be the same length as Key2Name
+        Key1Name.Length = Key2Name.Length;
+
+        // Compare the names of the same length
+        Comparison = RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
+
+        // If the truncated names are the same length, the shorter one comes first
+        if (Comparison == 0)
+            return 1;
+    }
+
+    return Comparison;
+}
+
 /**
 * @name CompareTreeKeys
 * @implemented
@@ -417,7 +477,6 @@ LONG
 CompareTreeKeys(PB_TREE_KEY Key1, PB_TREE_KEY Key2, BOOLEAN CaseSensitive)
 {
     UNICODE_STRING Key1Name, Key2Name;
-    LONG Comparison;
 
     // Key1 must not be the final key (AKA the dummy key)
     ASSERT(!(Key1->IndexEntry->Flags & NTFS_INDEX_ENTRY_END));
@@ -434,38 +493,7 @@ CompareTreeKeys(PB_TREE_KEY Key1, PB_TREE_KEY Key2, BOOLEAN CaseSensitive)
     Key2Name.Length = Key2Name.MaximumLength
         = Key2->IndexEntry->FileName.NameLength * sizeof(WCHAR);
 
-    // Are the two keys the same length?
-    if (Key1Name.Length == Key2Name.Length)
-        return RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
-
-    // Is Key1 shorter?
-    if (Key1Name.Length < Key2Name.Length)
-    {
-        // Truncate KeyName2 to be the same length as KeyName1
-        Key2Name.Length = Key1Name.Length;
-        
-        // Compare the names of the same length
-        Comparison = RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
-
-        // If the truncated names are the same length, the shorter one comes first
-        if (Comparison == 0)
-            return -1;
-    }
-    else
-    {
-        // Key2 is shorter
-        // Truncate KeyName1 to be the same length as KeyName2
-        Key1Name.Length = Key2Name.Length;
-
-        // Compare the names of the same length
-        Comparison = RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
-
-        // If the truncated names are the same length, the shorter one comes first
-        if (Comparison == 0)
-            return 1;
-    }
-
-    return Comparison;
+    return CollateFileNames(&Key1Name, &Key2Name, CaseSensitive);
 }
 
 /**
@@ -1438,6 +1466,11 @@ UpdateIndexNode(PDEVICE_EXTENSION DeviceExt,
 
         // Write the buffer to the index allocation
         Status = WriteAttribute(DeviceExt, IndexAllocationContext, NodeOffset, (const PUCHAR)IndexBuffer, IndexBufferSize, &LengthWritten, FileRecord);
+
+        // Forget the old copy of the node, see NtfsReadIndexBuffer()
+        NtfsInvalidateCache(&DeviceExt->IndexCache,
+                            IndexAllocationContext->FileMFTIndex + ((ULONGLONG)FileRecord->SequenceNumber << 48),
+                            NodeOffset);
         if (!NT_SUCCESS(Status) || LengthWritten != IndexBufferSize)
         {
             DPRINT1("ERROR: Failed to update index allocation!\n");
@@ -407,6 +407,9 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
 
     NtfsInfo->MftZoneReservation = NtfsQueryMftZoneReservation();
 
+    NtfsInitializeCache(&DeviceExt->RecordCache, NTFS_RECORD_CACHE_ENTRIES, NtfsInfo->BytesPerFileRecord);
+    NtfsInitializeCache(&DeviceExt->IndexCache, NTFS_INDEX_CACHE_ENTRIES, NtfsInfo->BytesPerIndexRecord);
+
     return Status;
 }
 
@@ -568,7 +571,11 @@ ByeBye:
             IoDeleteDevice(NewDeviceObject);
 
         if (Lookaside)
+        {
+            NtfsFreeCache(&Vcb->IndexCache);
+            NtfsFreeCache(&Vcb->RecordCache);
             ExDeleteNPagedLookasideList(&Vcb->FileRecLookasideList);
+        }
     }
 
     DPRINT("NtfsMountVolume() done (Status: %lx)\n", Status);
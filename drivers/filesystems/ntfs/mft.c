@@ -1005,6 +1005,49 @@ SetResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
     return STATUS_SUCCESS;
 }
 
+/**
+* @name LookupAttributeVcn
+* @implemented
+*
+* Translates a VCN of a non-resident attribute to an LCN with the MCB of the
+* attribute context, without decoding the mapping pairs again.
+*
+* @param Lcn
+* Pointer to a LONGLONG which receives the LCN, or -1 in a sparse run.
+*
+* @param RunClusters
+* Pointer to a ULONGLONG which receives the number of clusters left in the run,
+* starting with Vcn.
+*
+* @return
+* FALSE if Vcn is past the end of the attribute.
+*/
+static
+BOOLEAN
+LookupAttributeVcn(PNTFS_ATTR_CONTEXT Context,
+                   ULONGLONG Vcn,
+                   PLONGLONG Lcn,
+                   PULONGLONG RunClusters)
+{
+    LONGLONG Count;
+
+    ASSERT(Context->pRecord->IsNonResident);
+
+    if (FsRtlLookupLargeMcbEntry(&Context->DataRunsMCB, Vcn, Lcn, &Count, NULL, NULL, NULL))
+    {
+        *RunClusters = Count;
+        return TRUE;
+    }
+
+    // Sparse runs at the end of the attribute aren't in the MCB
+    if (Vcn > Context->pRecord->NonResident.HighestVCN)
+        return FALSE;
+
+    *Lcn = -1;
+    *RunClusters = Context->pRecord->NonResident.HighestVCN - Vcn + 1;
+    return TRUE;
+}
+
 ULONG
 ReadAttribute(PDEVICE_EXTENSION Vcb,
               PNTFS_ATTR_CONTEXT Context,
@@ -1012,18 +1055,13 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
               PCHAR Buffer,
               ULONG Length)
 {
-    ULONGLONG LastLCN;
-    PUCHAR DataRun;
-    LONGLONG DataRunOffset;
-    ULONGLONG DataRunLength;
-    LONGLONG DataRunStartLCN;
-    ULONGLONG CurrentOffset;
+    ULONGLONG Vcn;
+    LONGLONG Lcn;
+    ULONGLONG RunClusters;
+    ULONG RunOffset;
     ULONG ReadLength;
     ULONG AlreadyRead;
     NTSTATUS Status;
-    
-    //TEMPTEMP
-    PUCHAR TempBuffer;
 
     if (!Context->pRecord->IsNonResident)
     {
@@ -1042,173 +1080,44 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
     }
 
     /*
-     * Non-resident attribute
-     */
-
-    /*
-     * I. Find the corresponding start data run.
+     * Non-resident attribute. The run list was decoded once into the MCB of
+     * the context, translate each VCN with a lookup in it.
      */
 
     AlreadyRead = 0;
-
-    // FIXME: Cache seems to be non-working. Disable it for now
-    //if(Context->CacheRunOffset <= Offset && Offset < Context->CacheRunOffset + Context->CacheRunLength * Volume->ClusterSize)
-    if (0)
-    {
-        DataRun = Context->CacheRun;
-        LastLCN = Context->CacheRunLastLCN;
-        DataRunStartLCN = Context->CacheRunStartLCN;
-        DataRunLength = Context->CacheRunLength;
-        CurrentOffset = Context->CacheRunCurrentOffset;
-    }
-    else
+    while (Length > 0)
     {
-        //TEMPTEMP
-        ULONG UsedBufferSize;
-        TempBuffer = ExAllocatePoolWithTag(NonPagedPool, Vcb->NtfsInfo.BytesPerFileRecord, TAG_NTFS);
-        if (TempBuffer == NULL)
+        Vcn = Offset / Vcb->NtfsInfo.BytesPerCluster;
+        RunOffset = (ULONG)(Offset % Vcb->NtfsInfo.BytesPerCluster);
+        if (!LookupAttributeVcn(Context, Vcn, &Lcn, &RunClusters))
         {
-            return STATUS_INSUFFICIENT_RESOURCES;
+            /* Past the last run */
+            break;
         }
 
-        LastLCN = 0;
-        CurrentOffset = 0;
-
-        // This will be rewritten in the next iteration to just use the DataRuns MCB directly
-        ConvertLargeMCBToDataRuns(&Context->DataRunsMCB,
-                                  TempBuffer,
-                                  Vcb->NtfsInfo.BytesPerFileRecord,
-                                  &UsedBufferSize);
-
-        DataRun = TempBuffer;
-
-        while (1)
+        ReadLength = (ULONG)min(RunClusters * Vcb->NtfsInfo.BytesPerCluster - RunOffset, Length);
+        if (Lcn == -1)
         {
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-
-            if (Offset >= CurrentOffset &&
-                Offset < CurrentOffset + (DataRunLength * Vcb->NtfsInfo.BytesPerCluster))
-            {
+            /* Sparse data run. */
+            RtlZeroMemory(Buffer, ReadLength);
+        }
+        else
+        {
+            Status = NtfsReadDisk(Vcb->StorageDevice,
+                                  Lcn * Vcb->NtfsInfo.BytesPerCluster + RunOffset,
+                                  ReadLength,
+                                  Vcb->NtfsInfo.BytesPerSector,
+                                  (PVOID)Buffer,
+                                  FALSE);
+            if (!NT_SUCCESS(Status))
                 break;
-            }
-
-            if (*DataRun == 0)
-            {
-                ExFreePoolWithTag(TempBuffer, TAG_NTFS);
-                return AlreadyRead;
-            }
-
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
         }
-    }
 
-    /*
-     * II. Go through the run list and read the data
-     */
-
-    ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset), Length);
-    if (DataRunStartLCN == -1)
-    {
-        RtlZeroMemory(Buffer, ReadLength);
-        Status = STATUS_SUCCESS;
-    }
-    else
-    {
-        Status = NtfsReadDisk(Vcb->StorageDevice,
-                              DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster + Offset - CurrentOffset,
-                              ReadLength,
-                              Vcb->NtfsInfo.BytesPerSector,
-                              (PVOID)Buffer,
-                              FALSE);
-    }
-    if (NT_SUCCESS(Status))
-    {
         Length -= ReadLength;
         Buffer += ReadLength;
+        Offset += ReadLength;
         AlreadyRead += ReadLength;
-
-        if (ReadLength == DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset))
-        {
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != (ULONGLONG)-1)
-            {
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-                DataRunStartLCN = -1;
-        }
-
-        while (Length > 0)
-        {
-            ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster, Length);
-            if (DataRunStartLCN == -1)
-                RtlZeroMemory(Buffer, ReadLength);
-            else
-            {
-                Status = NtfsReadDisk(Vcb->StorageDevice,
-                                      DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster,
-                                      ReadLength,
-                                      Vcb->NtfsInfo.BytesPerSector,
-                                      (PVOID)Buffer,
-                                      FALSE);
-                if (!NT_SUCCESS(Status))
-                    break;
-            }
-
-            Length -= ReadLength;
-            Buffer += ReadLength;
-            AlreadyRead += ReadLength;
-
-            /* We finished this request, but there still data in this data run. */
-            if (Length == 0 && ReadLength != DataRunLength * Vcb->NtfsInfo.BytesPerCluster)
-                break;
-
-            /*
-             * Go to next run in the list.
-             */
-
-            if (*DataRun == 0)
-                break;
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-        } /* while */
-
-    } /* if Disk */
-
-    // TEMPTEMP
-    if (Context->pRecord->IsNonResident)
-        ExFreePoolWithTag(TempBuffer, TAG_NTFS);
-
-    Context->CacheRun = DataRun;
-    Context->CacheRunOffset = Offset + AlreadyRead;
-    Context->CacheRunStartLCN = DataRunStartLCN;
-    Context->CacheRunLength = DataRunLength;
-    Context->CacheRunLastLCN = LastLCN;
-    Context->CacheRunCurrentOffset = CurrentOffset;
+    }
 
     return AlreadyRead;
 }
@@ -1577,9 +1486,16 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
                PFILE_RECORD_HEADER file)
 {
     ULONGLONG BytesRead;
+    ULONG Generation;
+    NTSTATUS Status;
 
     DPRINT("ReadFileRecord(%p, %I64x, %p)\n", Vcb, index, file);
 
+    if (NtfsLookupCache(&Vcb->RecordCache, index, 0, file, &Generation))
+    {
+        return STATUS_SUCCESS;
+    }
+
     BytesRead = ReadAttribute(Vcb, Vcb->MFTContext, index * Vcb->NtfsInfo.BytesPerFileRecord, (PCHAR)file, Vcb->NtfsInfo.BytesPerFileRecord);
     if (BytesRead != Vcb->NtfsInfo.BytesPerFileRecord)
     {
@@ -1589,7 +1505,80 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
 
     /* Apply update sequence array fixups. */
     DPRINT("Sequence number: %u\n", file->SequenceNumber);
-    return FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    Status = FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+
+    if (NT_SUCCESS(Status))
+    {
+        NtfsInsertCache(&Vcb->RecordCache, index, 0, file, Generation);
+    }
+
+    return Status;
+}
+
+/**
+* @name ReadAheadFileRecords
+* @implemented
+*
+* Reads the NTFS_RECORD_READ_AHEAD file records around index with a single
+* read and caches them. Files of a directory are often created together
+* and sit next to each other in the MFT, so enumerating it then mostly
+* finds its records in the cache.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param index
+* MFT index of the record about to be read.
+*
+* @remarks
+* This is only a hint, failures are ignored and the caller reads the record
+* with ReadFileRecord() as usual.
+*/
+VOID
+ReadAheadFileRecords(PDEVICE_EXTENSION Vcb,
+                     ULONGLONG index)
+{
+    PCHAR Buffer;
+    PFILE_RECORD_HEADER Record;
+    ULONGLONG FirstIndex, BytesRead;
+    ULONG Generation, i;
+
+    if (Vcb->RecordCache.Buffer == NULL ||
+        NtfsLookupCache(&Vcb->RecordCache, index, 0, NULL, &Generation))
+    {
+        return;
+    }
+
+    Buffer = ExAllocatePoolWithTag(NonPagedPool,
+                                   NTFS_RECORD_READ_AHEAD * Vcb->NtfsInfo.BytesPerFileRecord,
+                                   TAG_FILE_REC);
+    if (Buffer == NULL)
+    {
+        return;
+    }
+
+    /* Stops short at the end of the MFT */
+    FirstIndex = ROUND_DOWN(index, NTFS_RECORD_READ_AHEAD);
+    BytesRead = ReadAttribute(Vcb,
+                              Vcb->MFTContext,
+                              FirstIndex * Vcb->NtfsInfo.BytesPerFileRecord,
+                              Buffer,
+                              NTFS_RECORD_READ_AHEAD * Vcb->NtfsInfo.BytesPerFileRecord);
+
+    for (i = 0; i < BytesRead / Vcb->NtfsInfo.BytesPerFileRecord; i++)
+    {
+        Record = (PFILE_RECORD_HEADER)(Buffer + i * Vcb->NtfsInfo.BytesPerFileRecord);
+        if (Record->Ntfs.Type != NRH_FILE_TYPE ||
+            !BooleanFlagOn(Record->Flags, FRH_IN_USE) ||
+            !NT_SUCCESS(FixupUpdateSequenceArray(Vcb, &Record->Ntfs)))
+        {
+            continue;
+        }
+
+        NtfsInsertCache(&Vcb->RecordCache, FirstIndex + i, 0, Record, Generation);
+    }
+
+    ExFreePoolWithTag(Buffer, TAG_FILE_REC);
 }
 
 
@@ -1833,6 +1822,9 @@ UpdateIndexEntryFileNameSize(PDEVICE_EXTENSION Vcb,
             }
 
             Status = WriteAttribute(Vcb, IndexAllocationCtx, RecordOffset, (const PUCHAR)IndexRecord, IndexBlockSize, &Written, MftRecord);
+            NtfsInvalidateCache(&Vcb->IndexCache,
+                                IndexAllocationCtx->FileMFTIndex + ((ULONGLONG)MftRecord->SequenceNumber << 48),
+                                RecordOffset);
             if (!NT_SUCCESS(Status))
             {
                 DPRINT1("ERROR Performing write!\n");
@@ -1901,6 +1893,9 @@ UpdateFileRecord(PDEVICE_EXTENSION Vcb,
     // remove the fixup array (so the file record pointer can still be used)
     FixupUpdateSequenceArray(Vcb, &FileRecord->Ntfs);
 
+    // the cached copy is stale now, and so is any read that started before the write
+    NtfsInvalidateCache(&Vcb->RecordCache, MftIndex, 0);
+
     return Status;
 }
 
@@ -3089,6 +3084,200 @@ BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
     return STATUS_OBJECT_PATH_NOT_FOUND;
 }
 
+/**
+* @name NtfsReadIndexBuffer
+* @implemented
+*
+* Reads and fixes up the index buffer at Offset in the $I30 index allocation
+* of a directory, from the index buffer cache when it's there.
+*
+* @param DirectoryReference
+* File reference (MFT index and sequence number) of the directory. Once the
+* directory is deleted and its file record reused, the key doesn't match anymore.
+*
+* @remarks
+* Writers of index buffers must call NtfsInvalidateCache() with the same key.
+*/
+static
+NTSTATUS
+NtfsReadIndexBuffer(PDEVICE_EXTENSION Vcb,
+                    ULONGLONG DirectoryReference,
+                    PNTFS_ATTR_CONTEXT IndexAllocationContext,
+                    ULONGLONG Offset,
+                    ULONG IndexBlockSize,
+                    PINDEX_BUFFER IndexBuffer)
+{
+    BOOLEAN Cacheable;
+    ULONG Generation = 0;
+    NTSTATUS Status;
+
+    Cacheable = (IndexBlockSize == Vcb->IndexCache.DataSize);
+    if (Cacheable &&
+        NtfsLookupCache(&Vcb->IndexCache, DirectoryReference, Offset, IndexBuffer, &Generation))
+    {
+        return STATUS_SUCCESS;
+    }
+
+    if (ReadAttribute(Vcb, IndexAllocationContext, Offset, (PCHAR)IndexBuffer, IndexBlockSize) != IndexBlockSize)
+    {
+        DPRINT1("Unable to read index record!\n");
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    if (IndexBuffer->Ntfs.Type != NRH_INDX_TYPE ||
+        IndexBuffer->Header.AllocatedSize + FIELD_OFFSET(INDEX_BUFFER, Header) != IndexBlockSize ||
+        IndexBuffer->Header.TotalSizeOfEntries > IndexBuffer->Header.AllocatedSize)
+    {
+        DPRINT1("Corrupted index record at offset %I64u\n", Offset);
+        return STATUS_DATA_ERROR;
+    }
+
+    Status = FixupUpdateSequenceArray(Vcb, &((PFILE_RECORD_HEADER)IndexBuffer)->Ntfs);
+    if (NT_SUCCESS(Status) && Cacheable)
+    {
+        NtfsInsertCache(&Vcb->IndexCache, DirectoryReference, Offset, IndexBuffer, Generation);
+    }
+
+    return Status;
+}
+
+/**
+* @name NtfsSearchIndex
+* @implemented
+*
+* Looks a name up in the $I30 index of a directory by descending its B+tree.
+* The entries of a node are sorted, and the sub-node of an entry holds the
+* names sorted before it, so a single node is read per level instead of
+* the whole index.
+*
+* @return
+* STATUS_SUCCESS if the name was found, STATUS_OBJECT_PATH_NOT_FOUND if not.
+* STATUS_MORE_PROCESSING_REQUIRED if the index holds names which differ only
+* by case from a case sensitive FileName: the caller must then walk the index.
+*/
+static
+NTSTATUS
+NtfsSearchIndex(PDEVICE_EXTENSION Vcb,
+                PFILE_RECORD_HEADER MftRecord,
+                PINDEX_ROOT_ATTRIBUTE IndexRoot,
+                PUNICODE_STRING FileName,
+                BOOLEAN CaseSensitive,
+                ULONGLONG *OutMFTIndex)
+{
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry, LastEntry;
+    PNTFS_ATTR_CONTEXT IndexAllocationContext = NULL;
+    PINDEX_BUFFER IndexBuffer = NULL;
+    UNICODE_STRING EntryName;
+    BOOLEAN HasSubNodes;
+    ULONG Depth = 0;
+    LONG Comparison;
+    NTSTATUS Status;
+
+    IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)&IndexRoot->Header + IndexRoot->Header.FirstEntryOffset);
+    LastEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)&IndexRoot->Header + IndexRoot->Header.TotalSizeOfEntries);
+    HasSubNodes = BooleanFlagOn(IndexRoot->Header.Flags, INDEX_ROOT_LARGE);
+
+    for (;;)
+    {
+        // Find the first entry of the node which doesn't sort before FileName
+        Comparison = -1;
+        while (IndexEntry < LastEntry && !(IndexEntry->Flags & NTFS_INDEX_ENTRY_END))
+        {
+            EntryName.Buffer = IndexEntry->FileName.Name;
+            EntryName.Length = EntryName.MaximumLength = IndexEntry->FileName.NameLength * sizeof(WCHAR);
+
+            // The index is sorted case-insensitively whatever the lookup
+            Comparison = CollateFileNames(FileName, &EntryName, FALSE);
+            if (Comparison <= 0)
+                break;
+
+            ASSERT(IndexEntry->Length >= sizeof(INDEX_ENTRY_ATTRIBUTE));
+            IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)IndexEntry + IndexEntry->Length);
+        }
+
+        if (IndexEntry >= LastEntry)
+        {
+            DPRINT1("Filesystem corruption detected, index node without an end entry!\n");
+            Status = STATUS_DATA_ERROR;
+            break;
+        }
+
+        if (Comparison == 0 && !(IndexEntry->Flags & NTFS_INDEX_ENTRY_END))
+        {
+            // Same filters as BrowseIndexEntries()
+            if ((IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) < NTFS_FILE_FIRST_USER_FILE ||
+                IndexEntry->FileName.NameType == NTFS_FILE_NAME_DOS)
+            {
+                Status = STATUS_OBJECT_PATH_NOT_FOUND;
+            }
+            else if (CaseSensitive && RtlCompareUnicodeString(FileName, &EntryName, FALSE) != 0)
+            {
+                Status = STATUS_MORE_PROCESSING_REQUIRED;
+            }
+            else
+            {
+                *OutMFTIndex = (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
+                Status = STATUS_SUCCESS;
+            }
+            break;
+        }
+
+        // FileName sorts before IndexEntry: it can only be in its sub-node
+        if (!(IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE))
+        {
+            Status = STATUS_OBJECT_PATH_NOT_FOUND;
+            break;
+        }
+
+        if (!HasSubNodes || ++Depth > NTFS_MAX_INDEX_DEPTH)
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            Status = STATUS_DATA_ERROR;
+            break;
+        }
+
+        if (IndexAllocationContext == NULL)
+        {
+            Status = FindAttribute(Vcb, MftRecord, AttributeIndexAllocation, L"$I30", 4, &IndexAllocationContext, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Filesystem corruption detected, no index allocation!\n");
+                IndexAllocationContext = NULL;
+                break;
+            }
+
+            IndexBuffer = ExAllocatePoolWithTag(NonPagedPool, IndexRoot->SizeOfEntry, TAG_NTFS);
+            if (IndexBuffer == NULL)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+
+        Status = NtfsReadIndexBuffer(Vcb,
+                                     IndexAllocationContext->FileMFTIndex + ((ULONGLONG)MftRecord->SequenceNumber << 48),
+                                     IndexAllocationContext,
+                                     GetAllocationOffsetFromVCN(Vcb, IndexRoot->SizeOfEntry, GetIndexEntryVCN(IndexEntry)),
+                                     IndexRoot->SizeOfEntry,
+                                     IndexBuffer);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)&IndexBuffer->Header + IndexBuffer->Header.FirstEntryOffset);
+        LastEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)&IndexBuffer->Header + IndexBuffer->Header.TotalSizeOfEntries);
+        HasSubNodes = BooleanFlagOn(IndexBuffer->Header.Flags, INDEX_NODE_LARGE);
+    }
+
+    if (IndexBuffer != NULL)
+        ExFreePoolWithTag(IndexBuffer, TAG_NTFS);
+    if (IndexAllocationContext != NULL)
+        ReleaseAttributeContext(IndexAllocationContext);
+
+    return Status;
+}
+
 NTSTATUS
 NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
                   ULONGLONG MFTIndex,
@@ -3153,6 +3342,23 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
 
     DPRINT("IndexRecordSize: %x IndexBlockSize: %x\n", Vcb->NtfsInfo.BytesPerIndexRecord, IndexRoot->SizeOfEntry);
 
+    /* Opening a file only needs the path through the tree to its name */
+    if (!DirSearch)
+    {
+        Status = NtfsSearchIndex(Vcb,
+                                 MftRecord,
+                                 IndexRoot,
+                                 FileName,
+                                 CaseSensitive,
+                                 OutMFTIndex);
+        if (Status != STATUS_MORE_PROCESSING_REQUIRED)
+        {
+            ExFreePoolWithTag(IndexRecord, TAG_NTFS);
+            ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+            return Status;
+        }
+    }
+
     Status = BrowseIndexEntries(Vcb,
                                 MftRecord,
                                 (PINDEX_ROOT_ATTRIBUTE)IndexRecord,
@@ -3332,6 +3538,9 @@ NtfsFindFileAt(PDEVICE_EXTENSION Vcb,
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
+    /* The next entries of the enumeration likely live next to this one */
+    ReadAheadFileRecords(Vcb, CurrentMFTIndex);
+
     Status = ReadFileRecord(Vcb, CurrentMFTIndex, *FileRecord);
     if (!NT_SUCCESS(Status))
     {
@@ -188,4 +188,222 @@ NtfsLockUserBuffer(IN PIRP Irp,
     return STATUS_SUCCESS;
 }
 
+/**
+* @name NtfsInitializeCache
+* @implemented
+*
+* Sets up a fixed size LRU cache of EntryCount blocks of DataSize bytes.
+*
+* @param Cache
+* Pointer to the NTFS_CACHE to initialize.
+*
+* @param EntryCount
+* Number of blocks kept in the cache.
+*
+* @param DataSize
+* Size in bytes of each block.
+*
+* @remarks
+* If memory is short the cache stays disabled: lookups then always miss and
+* insertions are ignored. The volume just works without it.
+*/
+VOID
+NtfsInitializeCache(PNTFS_CACHE Cache,
+                    ULONG EntryCount,
+                    ULONG DataSize)
+{
+    PNTFS_CACHE_ENTRY Entries;
+    PCHAR Data;
+    ULONG i;
+
+    RtlZeroMemory(Cache, sizeof(NTFS_CACHE));
+    ExInitializeFastMutex(&Cache->Lock);
+    InitializeListHead(&Cache->LruList);
+    Cache->DataSize = DataSize;
+
+    Cache->Buffer = ExAllocatePoolWithTag(PagedPool,
+                                          EntryCount * (sizeof(NTFS_CACHE_ENTRY) + DataSize),
+                                          TAG_NTFS);
+    if (Cache->Buffer == NULL)
+    {
+        DPRINT1("No memory for a cache of %lu blocks of %lu bytes\n", EntryCount, DataSize);
+        return;
+    }
+
+    Entries = Cache->Buffer;
+    Data = (PCHAR)&Entries[EntryCount];
+    for (i = 0; i < EntryCount; i++)
+    {
+        Entries[i].Valid = FALSE;
+        Entries[i].HashNext = NULL;
+        Entries[i].Data = Data + i * DataSize;
+        InsertTailList(&Cache->LruList, &Entries[i].LruLink);
+    }
+}
+
+VOID
+NtfsFreeCache(PNTFS_CACHE Cache)
+{
+    if (Cache->Buffer != NULL)
+    {
+        ExFreePoolWithTag(Cache->Buffer, TAG_NTFS);
+        Cache->Buffer = NULL;
+    }
+}
+
+/* Must be called with the cache lock held */
+static
+PNTFS_CACHE_ENTRY *
+NtfsFindCacheEntry(PNTFS_CACHE Cache,
+                   ULONGLONG Key,
+                   ULONGLONG SubKey)
+{
+    PNTFS_CACHE_ENTRY *Link;
+
+    Link = &Cache->Buckets[(Key + SubKey / Cache->DataSize) % NTFS_CACHE_BUCKETS];
+    while (*Link != NULL && ((*Link)->Key != Key || (*Link)->SubKey != SubKey))
+    {
+        Link = &(*Link)->HashNext;
+    }
+
+    return Link;
+}
+
+/**
+* @name NtfsLookupCache
+* @implemented
+*
+* Looks a block up in a cache.
+*
+* @param Data
+* Optional pointer to a buffer of Cache->DataSize bytes which receives a copy
+* of the cached block.
+*
+* @param Generation
+* Pointer to a ULONG which receives the generation of the cache. On a miss, it
+* must be given to NtfsInsertCache() with the block then read from disk.
+*
+* @return
+* TRUE if the block is cached, FALSE otherwise.
+*/
+BOOLEAN
+NtfsLookupCache(PNTFS_CACHE Cache,
+                ULONGLONG Key,
+                ULONGLONG SubKey,
+                PVOID Data,
+                PULONG Generation)
+{
+    PNTFS_CACHE_ENTRY Entry;
+
+    if (Cache->Buffer == NULL)
+    {
+        *Generation = 0;
+        return FALSE;
+    }
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    Entry = *NtfsFindCacheEntry(Cache, Key, SubKey);
+    if (Entry != NULL)
+    {
+        if (Data != NULL)
+        {
+            RtlCopyMemory(Data, Entry->Data, Cache->DataSize);
+        }
+        RemoveEntryList(&Entry->LruLink);
+        InsertHeadList(&Cache->LruList, &Entry->LruLink);
+    }
+    *Generation = Cache->Generation;
+
+    ExReleaseFastMutex(&Cache->Lock);
+
+    return (Entry != NULL);
+}
+
+/**
+* @name NtfsInsertCache
+* @implemented
+*
+* Remembers a block read from disk, in place of the least recently used one.
+*
+* @param Generation
+* Generation returned by the NtfsLookupCache() call which missed. If the cache
+* was invalidated since, the block may be older than what's on disk and it's
+* not cached.
+*/
+VOID
+NtfsInsertCache(PNTFS_CACHE Cache,
+                ULONGLONG Key,
+                ULONGLONG SubKey,
+                PVOID Data,
+                ULONG Generation)
+{
+    PNTFS_CACHE_ENTRY Entry, *Bucket;
+
+    if (Cache->Buffer == NULL)
+        return;
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    Bucket = NtfsFindCacheEntry(Cache, Key, SubKey);
+    if (Cache->Generation == Generation && *Bucket == NULL)
+    {
+        Entry = CONTAINING_RECORD(Cache->LruList.Blink, NTFS_CACHE_ENTRY, LruLink);
+        if (Entry->Valid)
+        {
+            *NtfsFindCacheEntry(Cache, Entry->Key, Entry->SubKey) = Entry->HashNext;
+            /* The unlinked entry may have been the one before ours */
+            Bucket = NtfsFindCacheEntry(Cache, Key, SubKey);
+        }
+
+        RtlCopyMemory(Entry->Data, Data, Cache->DataSize);
+        Entry->Valid = TRUE;
+        Entry->Key = Key;
+        Entry->SubKey = SubKey;
+        Entry->HashNext = NULL;
+        *Bucket = Entry;
+
+        RemoveEntryList(&Entry->LruLink);
+        InsertHeadList(&Cache->LruList, &Entry->LruLink);
+    }
+
+    ExReleaseFastMutex(&Cache->Lock);
+}
+
+/**
+* @name NtfsInvalidateCache
+* @implemented
+*
+* Drops a block from a cache after it was written to disk.
+*
+* @remarks
+* This must be called after the write completed. Any read racing with the
+* write then sees a new generation and its data is not cached.
+*/
+VOID
+NtfsInvalidateCache(PNTFS_CACHE Cache,
+                    ULONGLONG Key,
+                    ULONGLONG SubKey)
+{
+    PNTFS_CACHE_ENTRY *Link, Entry;
+
+    if (Cache->Buffer == NULL)
+        return;
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    Link = NtfsFindCacheEntry(Cache, Key, SubKey);
+    Entry = *Link;
+    if (Entry != NULL)
+    {
+        *Link = Entry->HashNext;
+        Entry->Valid = FALSE;
+        RemoveEntryList(&Entry->LruLink);
+        InsertTailList(&Cache->LruList, &Entry->LruLink);
+    }
+    Cache->Generation++;
+
+    ExReleaseFastMutex(&Cache->Lock);
+}
+
 /* EOF */
@@ -101,6 +101,40 @@ typedef struct
     ULONG Size;
 } NTFSIDENTIFIER, *PNTFSIDENTIFIER;
 
+/* Fixed size LRU caches of fixed up on-disk structures, see misc.c */
+#define NTFS_CACHE_BUCKETS          64
+
+/* Fixed up file records, keyed by MFT index */
+#define NTFS_RECORD_CACHE_ENTRIES   256
+#define NTFS_RECORD_READ_AHEAD      8
+/* Fixed up $I30 index buffers, keyed by directory file reference and offset */
+#define NTFS_INDEX_CACHE_ENTRIES    64
+/* Deeper $I30 B+trees are considered corrupted (looping) */
+#define NTFS_MAX_INDEX_DEPTH        32
+
+typedef struct _NTFS_CACHE_ENTRY
+{
+    LIST_ENTRY LruLink;
+    struct _NTFS_CACHE_ENTRY *HashNext;
+    BOOLEAN Valid;
+    ULONGLONG Key;
+    ULONGLONG SubKey;
+    PVOID Data;
+} NTFS_CACHE_ENTRY, *PNTFS_CACHE_ENTRY;
+
+typedef struct _NTFS_CACHE
+{
+    FAST_MUTEX Lock;
+    /* Most recently used first, unused entries at the tail */
+    LIST_ENTRY LruList;
+    PNTFS_CACHE_ENTRY Buckets[NTFS_CACHE_BUCKETS];
+    /* Bumped on each invalidation, so that data read from disk
+     * meanwhile isn't cached */
+    ULONG Generation;
+    ULONG DataSize;
+    PVOID Buffer;
+} NTFS_CACHE, *PNTFS_CACHE;
+
 typedef struct
 {
     NTFSIDENTIFIER Identifier;
@@ -122,6 +156,8 @@ typedef struct
     NTFS_INFO NtfsInfo;
 
     NPAGED_LOOKASIDE_LIST FileRecLookasideList;
+    NTFS_CACHE RecordCache;
+    NTFS_CACHE IndexCache;
 
     ULONG MftDataOffset;
     ULONG Flags;
@@ -722,6 +758,11 @@ NtfsDeviceIoControl(IN PDEVICE_OBJECT DeviceObject,
 
 /* btree.c */
 
+LONG
+CollateFileNames(PUNICODE_STRING Name1,
+                 PUNICODE_STRING Name2,
+                 BOOLEAN CaseSensitive);
+
 LONG
 CompareTreeKeys(PB_TREE_KEY Key1,
                 PB_TREE_KEY Key2,
@@ -1095,6 +1136,10 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file);
 
+VOID
+ReadAheadFileRecords(PDEVICE_EXTENSION Vcb,
+                     ULONGLONG index);
+
 NTSTATUS
 UpdateIndexEntryFileNameSize(PDEVICE_EXTENSION Vcb,
                              PFILE_RECORD_HEADER MftRecord,
@@ -1229,6 +1274,33 @@ VOID
 NtfsFileFlagsToAttributes(ULONG NtfsAttributes,
                           PULONG FileAttributes);
 
+VOID
+NtfsInitializeCache(PNTFS_CACHE Cache,
+                    ULONG EntryCount,
+                    ULONG DataSize);
+
+VOID
+NtfsFreeCache(PNTFS_CACHE Cache);
+
+BOOLEAN
+NtfsLookupCache(PNTFS_CACHE Cache,
+                ULONGLONG Key,
+                ULONGLONG SubKey,
+                PVOID Data,
+                PULONG Generation);
+
+VOID
+NtfsInsertCache(PNTFS_CACHE Cache,
+                ULONGLONG Key,
+                ULONGLONG SubKey,
+                PVOID Data,
+                ULONG Generation);
+
+VOID
+NtfsInvalidateCache(PNTFS_CACHE Cache,
+                    ULONGLONG Key,
+                    ULONGLONG SubKey);
+
 
 /* rw.c */
 
@@ -124,6 +124,14 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                 FCB->OobInline = InfoReq->Information.Boolean;
                 break;
             case AFD_INFO_RECEIVE_WINDOW_SIZE:
+                /* For streams this is SO_RCVBUF, the window holds data that
+                 * arrives ahead of recv() calls */
+                if (!(FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS))
+                {
+                    Status = AfdSetReceiveWindowSize(FCB, InfoReq->Information.Ulong);
+                    break;
+                }
+
                 NewBuffer = ExAllocatePoolWithTag(PagedPool,
                                                   InfoReq->Information.Ulong,
                                                   TAG_AFD_DATA_BUFFER);
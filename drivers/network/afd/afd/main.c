@@ -361,6 +361,7 @@ AfdCreateSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 
     InitializeListHead( &FCB->DatagramList );
     InitializeListHead( &FCB->PendingConnections );
+    InitializeListHead( &FCB->PollSetEntries );
 
     AFD_DbgPrint(MID_TRACE,("%p: Checking command channel\n", FCB));
 
@@ -445,7 +446,10 @@ AfdCleanupSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         }
     }
 
+    if( FCB->Transmit ) IoCancelIrp( FCB->Transmit->Irp );
+
     KillSelectsForFCB( FCB->DeviceExt, FileObject, FALSE );
+    DestroyPollSets( FCB );
 
     return UnlockAndMaybeComplete(FCB, STATUS_SUCCESS, Irp, 0);
 }
@@ -485,6 +489,7 @@ AfdCloseSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     }
 
     KillSelectsForFCB( FCB->DeviceExt, FileObject, FALSE );
+    DestroyPollSets( FCB );
 
     ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_CONNECT]));
     ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]));
@@ -959,6 +964,15 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_SELECT:
             return AfdSelect( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_POLL_SET_CONTROL:
+            return AfdPollSetControl( DeviceObject, Irp, IrpSp );
+
+        case IOCTL_AFD_POLL_SET_WAIT:
+            return AfdPollSetWait( DeviceObject, Irp, IrpSp );
+
+        case IOCTL_AFD_TRANSMIT_PACKETS:
+            return AfdTransmitPackets( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_EVENT_SELECT:
             return AfdEventSelect( DeviceObject, Irp, IrpSp );
 
@@ -975,6 +989,12 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_SEND_DATAGRAM:
             return AfdPacketSocketWriteData( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_RECV_DATAGRAM_BATCH:
+            return AfdPacketSocketRecvBatch( DeviceObject, Irp, IrpSp );
+
+        case IOCTL_AFD_SEND_DATAGRAM_BATCH:
+            return AfdPacketSocketSendBatch( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_GET_INFO:
             return AfdGetInfo( DeviceObject, Irp, IrpSp );
 
@@ -1261,6 +1281,16 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             DbgPrint("WARNING!!! IRP cancellation race could lead to a process hang! (IOCTL_AFD_SELECT)\n");
             return;
 
+        case IOCTL_AFD_POLL_SET_WAIT:
+            PollSetCancelWait(FCB, Irp);
+            SocketStateUnlock(FCB);
+            return;
+
+        case IOCTL_AFD_TRANSMIT_PACKETS:
+            TransmitCancel(FCB, Irp);
+            SocketStateUnlock(FCB);
+            return;
+
         case IOCTL_AFD_DISCONNECT:
             Function = FUNCTION_DISCONNECT;
             break;
@@ -1271,6 +1301,15 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             return;
     }
 
+    if (Function == FUNCTION_RECV && Irp == FCB->DirectRecvIrp)
+    {
+        /* The transport is filling this recv's buffer, so cancel that
+         * receive. Its completion then completes this IRP */
+        IoCancelIrp(FCB->ReceiveIrp.InFlightRequest);
+        SocketStateUnlock(FCB);
+        return;
+    }
+
     CurrentEntry = FCB->PendingIrpList[Function].Flink;
     while (CurrentEntry != &FCB->PendingIrpList[Function])
     {
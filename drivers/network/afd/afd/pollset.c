@@ -0,0 +1,473 @@
+/*
+ * COPYRIGHT:        See COPYING in the top level directory
+ * PROJECT:          ReactOS kernel
+ * FILE:             drivers/net/afd/afd/pollset.c
+ * PURPOSE:          Persistent poll sets
+ * PROGRAMMER:       ReactOS Team
+ *
+ * A poll set is a command channel handle that sockets are registered on
+ * once. When PollReeval sees a registered socket become ready it queues
+ * the registration on the set, so a wait only looks at the queue and costs
+ * O(ready) instead of O(registered) like AfdSelect.
+ *
+ * Registrations are level triggered: a reported socket stays queued until a
+ * wait finds none of its events pending any more. AFD_POLL_SET_ONESHOT
+ * disarms instead, until the next AFD_POLL_SET_MODIFY.
+ */
+
+#include "afd.h"
+
+/* * * All of the helpers below are called with DeviceExt->Lock held * * */
+
+static PAFD_POLL_SET_ENTRY FindPollSetEntry( PAFD_POLL_SET PollSet,
+                                             PAFD_FCB FCB ) {
+    PLIST_ENTRY ListEntry;
+    PAFD_POLL_SET_ENTRY Entry;
+
+    /* A socket is normally in one or two sets at most */
+    for( ListEntry = FCB->PollSetEntries.Flink;
+         ListEntry != &FCB->PollSetEntries;
+         ListEntry = ListEntry->Flink ) {
+        Entry = CONTAINING_RECORD(ListEntry, AFD_POLL_SET_ENTRY, SocketEntry);
+        if( Entry->PollSet == PollSet ) return Entry;
+    }
+
+    return NULL;
+}
+
+static VOID RemovePollSetEntry( PAFD_POLL_SET_ENTRY Entry ) {
+    RemoveEntryList( &Entry->SetEntry );
+    RemoveEntryList( &Entry->SocketEntry );
+    if( Entry->Queued ) RemoveEntryList( &Entry->ReadyEntry );
+
+    ExFreePoolWithTag( Entry, TAG_AFD_POLL_SET );
+}
+
+static ULONG HarvestPollSet( PAFD_POLL_SET PollSet,
+                             PAFD_POLL_SET_EVENT Events,
+                             ULONG MaxEvents ) {
+    LIST_ENTRY Reported;
+    PAFD_POLL_SET_ENTRY Entry;
+    ULONG Count = 0, Ready;
+
+    InitializeListHead( &Reported );
+
+    while( Count < MaxEvents && !IsListEmpty( &PollSet->ReadyList ) ) {
+        Entry = CONTAINING_RECORD(RemoveHeadList( &PollSet->ReadyList ),
+                                  AFD_POLL_SET_ENTRY, ReadyEntry);
+
+        Ready = Entry->Events & Entry->FCB->PollState;
+        if( !Ready ) {
+            /* It went quiet again before anybody asked */
+            Entry->Queued = FALSE;
+            continue;
+        }
+
+        AFD_DbgPrint(MID_TRACE,("Reporting %p with %x\n", Entry->FCB, Ready));
+
+        Events[Count].Context = Entry->Context;
+        Events[Count].Events = Ready;
+        Count++;
+
+        if( Entry->Flags & AFD_POLL_SET_ONESHOT ) {
+            Entry->Events = 0;
+            Entry->Queued = FALSE;
+        } else
+            InsertTailList( &Reported, &Entry->ReadyEntry );
+    }
+
+    /* Put the reported ones behind the rest so a busy socket can't starve
+     * the others when the caller's buffer is small */
+    while( !IsListEmpty( &Reported ) )
+        InsertTailList( &PollSet->ReadyList, RemoveHeadList( &Reported ) );
+
+    return Count;
+}
+
+static VOID CompletePollSetWaiter( PAFD_POLL_SET_WAITER Waiter,
+                                   NTSTATUS Status,
+                                   ULONG_PTR Information ) {
+    PIRP Irp = Waiter->Irp;
+
+    RemoveEntryList( &Waiter->ListEntry );
+    Waiter->Irp = NULL;
+
+    /* If the timer already went off the DPC is on its way, and it frees
+     * the waiter when it sees there is no IRP left */
+    if( KeCancelTimer( &Waiter->Timer ) )
+        ExFreePoolWithTag( Waiter, TAG_AFD_POLL_SET );
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = Information;
+    (void)IoSetCancelRoutine(Irp, NULL);
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+static VOID WakePollSetWaiter( PAFD_POLL_SET PollSet ) {
+    PAFD_POLL_SET_WAITER Waiter;
+    PIO_STACK_LOCATION IrpSp;
+    ULONG Count;
+
+    if( IsListEmpty( &PollSet->Waiters ) ||
+        IsListEmpty( &PollSet->ReadyList ) ) return;
+
+    /* Wake one waiter only, the others would just find the queue empty */
+    Waiter = CONTAINING_RECORD(PollSet->Waiters.Flink,
+                               AFD_POLL_SET_WAITER, ListEntry);
+    IrpSp = IoGetCurrentIrpStackLocation( Waiter->Irp );
+
+    Count = HarvestPollSet
+        ( PollSet,
+          Waiter->Irp->AssociatedIrp.SystemBuffer,
+          IrpSp->Parameters.DeviceIoControl.OutputBufferLength /
+          sizeof(AFD_POLL_SET_EVENT) );
+
+    if( Count )
+        CompletePollSetWaiter( Waiter, STATUS_SUCCESS,
+                               Count * sizeof(AFD_POLL_SET_EVENT) );
+}
+
+static VOID QueuePollSetEntry( PAFD_POLL_SET_ENTRY Entry ) {
+    if( !Entry->Queued ) {
+        InsertTailList( &Entry->PollSet->ReadyList, &Entry->ReadyEntry );
+        Entry->Queued = TRUE;
+    }
+
+    WakePollSetWaiter( Entry->PollSet );
+}
+
+/* * * NOTE ALWAYS CALLED WITH DeviceExt->Lock HELD * * */
+VOID PollSetReeval( PAFD_FCB FCB ) {
+    PLIST_ENTRY ListEntry;
+    PAFD_POLL_SET_ENTRY Entry;
+
+    for( ListEntry = FCB->PollSetEntries.Flink;
+         ListEntry != &FCB->PollSetEntries;
+         ListEntry = ListEntry->Flink ) {
+        Entry = CONTAINING_RECORD(ListEntry, AFD_POLL_SET_ENTRY, SocketEntry);
+
+        if( Entry->Events & FCB->PollState )
+            QueuePollSetEntry( Entry );
+    }
+}
+
+static KDEFERRED_ROUTINE PollSetWaitTimeout;
+static VOID NTAPI PollSetWaitTimeout( PKDPC Dpc,
+                                      PVOID DeferredContext,
+                                      PVOID SystemArgument1,
+                                      PVOID SystemArgument2 ) {
+    PAFD_POLL_SET_WAITER Waiter = DeferredContext;
+    PAFD_DEVICE_EXTENSION DeviceExt = Waiter->DeviceExt;
+    KIRQL OldIrql;
+    PIRP Irp;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+    Irp = Waiter->Irp;
+    if( Irp ) RemoveEntryList( &Waiter->ListEntry );
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    ExFreePoolWithTag( Waiter, TAG_AFD_POLL_SET );
+
+    if( !Irp ) return;
+
+    AFD_DbgPrint(MID_TRACE,("Timeout\n"));
+
+    Irp->IoStatus.Status = STATUS_TIMEOUT;
+    Irp->IoStatus.Information = 0;
+    (void)IoSetCancelRoutine(Irp, NULL);
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+/* Called with the state lock of FCB held */
+static PAFD_POLL_SET GetPollSet( PAFD_FCB FCB ) {
+    PAFD_POLL_SET PollSet;
+
+    if( FCB->PollSet ) return FCB->PollSet;
+
+    /* Only command channels can be poll sets. A socket's own readiness
+     * would never show up in the set */
+    if( FCB->TdiDeviceName.Buffer ) return NULL;
+
+    PollSet = ExAllocatePoolWithTag(NonPagedPool,
+                                    sizeof(AFD_POLL_SET),
+                                    TAG_AFD_POLL_SET);
+    if( !PollSet ) return NULL;
+
+    InitializeListHead( &PollSet->Members );
+    InitializeListHead( &PollSet->ReadyList );
+    InitializeListHead( &PollSet->Waiters );
+    PollSet->DeviceExt = FCB->DeviceExt;
+
+    FCB->PollSet = PollSet;
+
+    return PollSet;
+}
+
+NTSTATUS NTAPI
+AfdPollSetControl( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                   PIO_STACK_LOCATION IrpSp ) {
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext, SocketFCB;
+    PAFD_DEVICE_EXTENSION DeviceExt = DeviceObject->DeviceExtension;
+    PAFD_POLL_SET_CONTROL_INFO ControlReq = Irp->AssociatedIrp.SystemBuffer;
+    PAFD_POLL_SET PollSet;
+    PAFD_POLL_SET_ENTRY Entry, NewEntry = NULL;
+    PFILE_OBJECT SocketObject;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    if( IrpSp->Parameters.DeviceIoControl.InputBufferLength <
+        sizeof(AFD_POLL_SET_CONTROL_INFO) )
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+
+    AFD_DbgPrint(MID_TRACE,("Called (Operation %u Handle %p Events %x)\n",
+                            ControlReq->Operation,
+                            (PVOID)ControlReq->Handle,
+                            ControlReq->Events));
+
+    PollSet = GetPollSet( FCB );
+    if( !PollSet )
+        return UnlockAndMaybeComplete( FCB, FCB->TdiDeviceName.Buffer ?
+                                       STATUS_INVALID_DEVICE_REQUEST :
+                                       STATUS_NO_MEMORY, Irp, 0 );
+
+    Status = ObReferenceObjectByHandle( (PVOID)ControlReq->Handle,
+                                        FILE_ALL_ACCESS,
+                                        *IoFileObjectType,
+                                        KernelMode,
+                                        (PVOID*)&SocketObject,
+                                        NULL );
+    if( !NT_SUCCESS(Status) ) {
+        AFD_DbgPrint(MIN_TRACE,("Failed to reference handle (0x%x)\n", Status));
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    SocketFCB = SocketObject->FsContext;
+
+    if( SocketObject->DeviceObject != DeviceObject || !SocketFCB ||
+        SocketFCB == FCB ) {
+        ObDereferenceObject( SocketObject );
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_HANDLE, Irp, 0 );
+    }
+
+    if( ControlReq->Operation == AFD_POLL_SET_ADD ) {
+        NewEntry = ExAllocatePoolWithTag(NonPagedPool,
+                                         sizeof(AFD_POLL_SET_ENTRY),
+                                         TAG_AFD_POLL_SET);
+        if( !NewEntry ) {
+            ObDereferenceObject( SocketObject );
+            return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+        }
+    }
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    Entry = FindPollSetEntry( PollSet, SocketFCB );
+
+    switch( ControlReq->Operation ) {
+    case AFD_POLL_SET_ADD:
+        if( Entry ) {
+            Status = STATUS_OBJECT_NAME_COLLISION;
+            Entry = NULL;
+            break;
+        }
+
+        Entry = NewEntry;
+        NewEntry = NULL;
+
+        Entry->PollSet = PollSet;
+        Entry->FCB = SocketFCB;
+        Entry->Queued = FALSE;
+        InsertTailList( &PollSet->Members, &Entry->SetEntry );
+        InsertTailList( &SocketFCB->PollSetEntries, &Entry->SocketEntry );
+        Status = STATUS_SUCCESS;
+        break;
+
+    case AFD_POLL_SET_MODIFY:
+        Status = Entry ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+        break;
+
+    case AFD_POLL_SET_REMOVE:
+        if( Entry ) {
+            RemovePollSetEntry( Entry );
+            Entry = NULL;
+            Status = STATUS_SUCCESS;
+        } else
+            Status = STATUS_NOT_FOUND;
+        break;
+
+    default:
+        Entry = NULL;
+        Status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+    if( Entry ) {
+        Entry->Events = ControlReq->Events;
+        Entry->Flags = ControlReq->Flags;
+        Entry->Context = ControlReq->Context;
+
+        /* Report what is already pending, like a fresh select would */
+        if( Entry->Events & SocketFCB->PollState )
+            QueuePollSetEntry( Entry );
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    if( NewEntry ) ExFreePoolWithTag( NewEntry, TAG_AFD_POLL_SET );
+
+    ObDereferenceObject( SocketObject );
+
+    return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+}
+
+NTSTATUS NTAPI
+AfdPollSetWait( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                PIO_STACK_LOCATION IrpSp ) {
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DEVICE_EXTENSION DeviceExt = DeviceObject->DeviceExtension;
+    PAFD_POLL_SET_WAIT_INFO WaitReq = Irp->AssociatedIrp.SystemBuffer;
+    PAFD_POLL_SET PollSet;
+    PAFD_POLL_SET_WAITER Waiter;
+    LARGE_INTEGER Timeout;
+    ULONG MaxEvents, Count;
+    KIRQL OldIrql;
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    MaxEvents = IrpSp->Parameters.DeviceIoControl.OutputBufferLength /
+        sizeof(AFD_POLL_SET_EVENT);
+
+    if( IrpSp->Parameters.DeviceIoControl.InputBufferLength <
+        sizeof(AFD_POLL_SET_WAIT_INFO) )
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+
+    if( !MaxEvents )
+        return UnlockAndMaybeComplete( FCB, STATUS_BUFFER_TOO_SMALL, Irp, 0 );
+
+    PollSet = GetPollSet( FCB );
+    if( !PollSet )
+        return UnlockAndMaybeComplete( FCB, FCB->TdiDeviceName.Buffer ?
+                                       STATUS_INVALID_DEVICE_REQUEST :
+                                       STATUS_NO_MEMORY, Irp, 0 );
+
+    /* The events are written over the request */
+    Timeout = WaitReq->Timeout;
+
+    AFD_DbgPrint(MID_TRACE,("Called (MaxEvents %u Timeout %d)\n",
+                            MaxEvents, (INT)Timeout.QuadPart));
+
+    Waiter = ExAllocatePoolWithTag(NonPagedPool,
+                                   sizeof(AFD_POLL_SET_WAITER),
+                                   TAG_AFD_POLL_SET);
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    Count = HarvestPollSet( PollSet, Irp->AssociatedIrp.SystemBuffer,
+                            MaxEvents );
+
+    if( Count || !Timeout.QuadPart || !Waiter ) {
+        KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+        if( Waiter ) ExFreePoolWithTag( Waiter, TAG_AFD_POLL_SET );
+
+        return UnlockAndMaybeComplete( FCB,
+                                       Count ? STATUS_SUCCESS :
+                                       Timeout.QuadPart ? STATUS_NO_MEMORY :
+                                       STATUS_TIMEOUT,
+                                       Irp,
+                                       Count * sizeof(AFD_POLL_SET_EVENT) );
+    }
+
+    Waiter->Irp = Irp;
+    Waiter->DeviceExt = DeviceExt;
+    KeInitializeTimerEx( &Waiter->Timer, NotificationTimer );
+    KeInitializeDpc( &Waiter->TimeoutDpc, PollSetWaitTimeout, Waiter );
+
+    InsertTailList( &PollSet->Waiters, &Waiter->ListEntry );
+    KeSetTimer( &Waiter->Timer, Timeout, &Waiter->TimeoutDpc );
+
+    IoMarkIrpPending( Irp );
+    (void)IoSetCancelRoutine(Irp, AfdCancelHandler);
+
+    /* We were cancelled before the cancel routine was in place */
+    if( Irp->Cancel && IoSetCancelRoutine(Irp, NULL) )
+        CompletePollSetWaiter( Waiter, STATUS_CANCELLED, 0 );
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    SocketStateUnlock( FCB );
+
+    return STATUS_PENDING;
+}
+
+VOID PollSetCancelWait( PAFD_FCB FCB, PIRP Irp ) {
+    PAFD_DEVICE_EXTENSION DeviceExt = FCB->DeviceExt;
+    PLIST_ENTRY ListEntry;
+    PAFD_POLL_SET_WAITER Waiter;
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    if( FCB->PollSet ) {
+        for( ListEntry = FCB->PollSet->Waiters.Flink;
+             ListEntry != &FCB->PollSet->Waiters;
+             ListEntry = ListEntry->Flink ) {
+            Waiter = CONTAINING_RECORD(ListEntry, AFD_POLL_SET_WAITER, ListEntry);
+
+            if( Waiter->Irp == Irp ) {
+                CompletePollSetWaiter( Waiter, STATUS_CANCELLED, 0 );
+                KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+                return;
+            }
+        }
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    DbgPrint("WARNING!!! IRP cancellation race could lead to a process hang! (IOCTL_AFD_POLL_SET_WAIT)\n");
+}
+
+VOID DestroyPollSets( PAFD_FCB FCB ) {
+    PAFD_DEVICE_EXTENSION DeviceExt = FCB->DeviceExt;
+    PAFD_POLL_SET PollSet;
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    /* Leave every set this socket is registered in */
+    while( !IsListEmpty( &FCB->PollSetEntries ) )
+        RemovePollSetEntry( CONTAINING_RECORD(FCB->PollSetEntries.Flink,
+                                              AFD_POLL_SET_ENTRY,
+                                              SocketEntry) );
+
+    /* And tear down the set if this handle is one */
+    PollSet = FCB->PollSet;
+    FCB->PollSet = NULL;
+
+    if( PollSet ) {
+        while( !IsListEmpty( &PollSet->Members ) )
+            RemovePollSetEntry( CONTAINING_RECORD(PollSet->Members.Flink,
+                                                  AFD_POLL_SET_ENTRY,
+                                                  SetEntry) );
+
+        while( !IsListEmpty( &PollSet->Waiters ) )
+            CompletePollSetWaiter( CONTAINING_RECORD(PollSet->Waiters.Flink,
+                                                     AFD_POLL_SET_WAITER,
+                                                     ListEntry),
+                                   STATUS_CANCELLED, 0 );
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    if( PollSet ) ExFreePoolWithTag( PollSet, TAG_AFD_POLL_SET );
+}
+
+/* EOF */
@@ -10,14 +10,113 @@
 
 #include "afd.h"
 
+static VOID ResizeReceiveWindow( PAFD_FCB FCB )
+{
+    UINT Unread = FCB->Recv.Content - FCB->Recv.BytesUsed;
+    UINT Size = FCB->RecvSizeRequested;
+    PCHAR NewWindow;
+
+    FCB->RecvSizeRequested = 0;
+
+    /* Never drop data that is already buffered */
+    if (Size < Unread) Size = Unread;
+    if (Size == FCB->Recv.Size) return;
+
+    NewWindow = ExAllocatePoolWithTag(PagedPool, Size, TAG_AFD_DATA_BUFFER);
+    if (!NewWindow)
+    {
+        /* Keep the old one */
+        return;
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Receive window %u -> %u bytes\n", FCB->Recv.Size, Size));
+
+    RtlCopyMemory(NewWindow, FCB->Recv.Window + FCB->Recv.BytesUsed, Unread);
+    ExFreePoolWithTag(FCB->Recv.Window, TAG_AFD_DATA_BUFFER);
+
+    FCB->Recv.Window = NewWindow;
+    FCB->Recv.Size = Size;
+    FCB->Recv.Content = Unread;
+    FCB->Recv.BytesUsed = 0;
+}
+
+static BOOLEAN CanReceiveDirect( PAFD_FCB FCB, PIRP Irp )
+{
+    PAFD_RECV_INFO RecvReq = GetLockedData(Irp, IoGetCurrentIrpStackLocation(Irp));
+    PAFD_MAPBUF Map;
+
+    /* Anything buffered has to go out first */
+    if (FCB->Recv.Content != FCB->Recv.BytesUsed) return FALSE;
+
+    /* Peeked data has to stay around for the next recv */
+    if (RecvReq->TdiFlags & TDI_RECEIVE_PEEK) return FALSE;
+
+    if (!RecvReq->BufferArray || RecvReq->BufferCount != 1) return FALSE;
+    if (RecvReq->BufferArray[0].len < AFD_DIRECT_RECV_THRESHOLD) return FALSE;
+
+    Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+
+    return Map[0].Mdl != NULL;
+}
+
+static BOOLEAN ReceiveDirect( PAFD_FCB FCB, PIRP Irp )
+{
+    PAFD_RECV_INFO RecvReq = GetLockedData(Irp, IoGetCurrentIrpStackLocation(Irp));
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+    NTSTATUS Status;
+
+    Map[0].BufferAddress = MmMapLockedPages( Map[0].Mdl, KernelMode );
+
+    /* The recv leaves the queue while the transport owns its buffer. The
+     * completion may run before TdiReceive returns, so set this up first */
+    RemoveEntryList( &Irp->Tail.Overlay.ListEntry );
+    FCB->DirectRecvIrp = Irp;
+
+    AFD_DbgPrint(MID_TRACE,("Receiving straight into %p (%u)\n",
+                            Irp, RecvReq->BufferArray[0].len));
+
+    Status = TdiReceive( &FCB->ReceiveIrp.InFlightRequest,
+                         FCB->Connection.Object,
+                         TDI_RECEIVE_NORMAL,
+                         Map[0].BufferAddress,
+                         RecvReq->BufferArray[0].len,
+                         ReceiveComplete,
+                         FCB );
+    if (Status == STATUS_PENDING) return TRUE;
+
+    /* Fall back to our own buffer */
+    FCB->DirectRecvIrp = NULL;
+    MmUnmapLockedPages( Map[0].BufferAddress, Map[0].Mdl );
+    InsertHeadList( &FCB->PendingIrpList[FUNCTION_RECV],
+                    &Irp->Tail.Overlay.ListEntry );
+
+    return FALSE;
+}
+
 static VOID RefillSocketBuffer( PAFD_FCB FCB )
 {
+    PIRP NextIrp;
+
     /* Make sure nothing's in flight first */
     if (FCB->ReceiveIrp.InFlightRequest) return;
 
     /* Now ensure that receive is still allowed */
     if (FCB->TdiReceiveClosed) return;
 
+    /* Nothing is writing to the window, so it can be resized now */
+    if (FCB->RecvSizeRequested) ResizeReceiveWindow(FCB);
+
+    /* If a large enough recv is waiting on an empty buffer, the transport
+     * copies into it directly instead of going through the window */
+    if (!IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV]))
+    {
+        NextIrp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_RECV].Flink,
+                                    IRP, Tail.Overlay.ListEntry);
+
+        if (CanReceiveDirect(FCB, NextIrp) && ReceiveDirect(FCB, NextIrp))
+            return;
+    }
+
     /* Check if the buffer is full */
     if (FCB->Recv.Content == FCB->Recv.Size)
     {
@@ -50,6 +149,49 @@ static VOID RefillSocketBuffer( PAFD_FCB FCB )
                 FCB );
 }
 
+static VOID RedirectReceive( PAFD_FCB FCB )
+{
+    PIRP NextIrp;
+
+    /* Only a receive into our own window can be redirected */
+    if (!FCB->ReceiveIrp.InFlightRequest ||
+        FCB->DirectRecvIrp ||
+        FCB->RecvRedirected) return;
+
+    if (IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV])) return;
+
+    NextIrp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_RECV].Flink,
+                                IRP, Tail.Overlay.ListEntry);
+    if (!CanReceiveDirect(FCB, NextIrp)) return;
+
+    /* The transport holds on to data that arrives while nothing is posted,
+     * so this loses nothing. The completion posts the recv's buffer instead */
+    AFD_DbgPrint(MID_TRACE,("Redirecting receive to %p\n", NextIrp));
+    FCB->RecvRedirected = TRUE;
+    IoCancelIrp(FCB->ReceiveIrp.InFlightRequest);
+}
+
+NTSTATUS AfdSetReceiveWindowSize( PAFD_FCB FCB, UINT Size )
+{
+    if (Size < AFD_MIN_RECV_WINDOW) Size = AFD_MIN_RECV_WINDOW;
+    if (Size > AFD_MAX_RECV_WINDOW) Size = AFD_MAX_RECV_WINDOW;
+
+    /* Not connected yet, the window is allocated with this size later */
+    if (!FCB->Recv.Window)
+    {
+        FCB->Recv.Size = Size;
+        return STATUS_SUCCESS;
+    }
+
+    /* A receive into the window holds on to it until it completes, the
+     * refill after that picks up the new size */
+    FCB->RecvSizeRequested = Size;
+    if (!FCB->ReceiveIrp.InFlightRequest || FCB->DirectRecvIrp)
+        ResizeReceiveWindow(FCB);
+
+    return STATUS_SUCCESS;
+}
+
 static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Information )
 {
     FCB->LastReceiveStatus = Status;
@@ -71,11 +213,6 @@ static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Info
             /* Receive is closed */
             FCB->TdiReceiveClosed = TRUE;
         }
-        else
-        {
-            /* Issue another receive IRP to keep the buffer well stocked */
-            RefillSocketBuffer(FCB);
-        }
     }
     /* Receive failed with no data (unexpected closure) */
     else
@@ -275,6 +412,8 @@ NTSTATUS NTAPI ReceiveComplete
     PIRP NextIrp;
     PAFD_RECV_INFO RecvReq;
     PIO_STACK_LOCATION NextIrpSp;
+    PAFD_MAPBUF Map;
+    BOOLEAN Handled = FALSE;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -286,6 +425,50 @@ NTSTATUS NTAPI ReceiveComplete
     ASSERT(FCB->ReceiveIrp.InFlightRequest == Irp);
     FCB->ReceiveIrp.InFlightRequest = NULL;
 
+    if( FCB->DirectRecvIrp ) {
+        /* The transport filled a recv's buffer itself */
+        NextIrp = FCB->DirectRecvIrp;
+        FCB->DirectRecvIrp = NULL;
+        NextIrpSp = IoGetCurrentIrpStackLocation(NextIrp);
+        RecvReq = GetLockedData(NextIrp, NextIrpSp);
+        Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+        MmUnmapLockedPages( Map[0].BufferAddress, Map[0].Mdl );
+
+        if( FCB->State != SOCKET_STATE_CLOSED &&
+            Irp->IoStatus.Status == STATUS_SUCCESS &&
+            Irp->IoStatus.Information != 0 ) {
+            AFD_DbgPrint(MID_TRACE,("Completing direct recv %p (%u)\n",
+                                    NextIrp, Irp->IoStatus.Information));
+            FCB->LastReceiveStatus = STATUS_SUCCESS;
+            UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+            NextIrp->IoStatus.Status = STATUS_SUCCESS;
+            NextIrp->IoStatus.Information = Irp->IoStatus.Information;
+            if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+            (void)IoSetCancelRoutine(NextIrp, NULL);
+            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+            Handled = TRUE;
+        } else if( Irp->IoStatus.Status == STATUS_CANCELLED && NextIrp->Cancel ) {
+            /* The recv itself was cancelled */
+            UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+            NextIrp->IoStatus.Status = STATUS_CANCELLED;
+            NextIrp->IoStatus.Information = 0;
+            if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+            (void)IoSetCancelRoutine(NextIrp, NULL);
+            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+            Handled = TRUE;
+        } else {
+            /* End of stream or failure, which is dealt with below */
+            InsertHeadList( &FCB->PendingIrpList[FUNCTION_RECV],
+                            &NextIrp->Tail.Overlay.ListEntry );
+        }
+    } else if( FCB->RecvRedirected ) {
+        /* We cancelled this one to receive into a recv's buffer instead.
+         * The transport keeps the data when it is cancelled */
+        FCB->RecvRedirected = FALSE;
+        if( Irp->IoStatus.Status == STATUS_CANCELLED )
+            Handled = TRUE;
+    }
+
     if( FCB->State == SOCKET_STATE_CLOSED ) {
         /* Cleanup our IRP queue because the FCB is being destroyed */
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
@@ -308,24 +491,30 @@ NTSTATUS NTAPI ReceiveComplete
         return STATUS_INVALID_PARAMETER;
     }
 
-    HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    if( !Handled )
+        HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
 
     ReceiveActivity( FCB, NULL );
 
+    /* Issue another receive IRP to keep the buffer well stocked. This
+     * comes last so that recvs still waiting can be filled directly */
+    RefillSocketBuffer( FCB );
+
     SocketStateUnlock( FCB );
 
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS NTAPI
-SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
-                         PAFD_STORED_DATAGRAM DatagramRecv,
-                         PUINT TotalBytesCopied ) {
+static NTSTATUS
+CopyDatagramToRecvRequest( PAFD_FCB FCB, PIRP Irp,
+                           PCHAR Data, UINT Len,
+                           PTRANSPORT_ADDRESS Address,
+                           PUINT TotalBytesCopied ) {
     NTSTATUS Status = STATUS_SUCCESS;
     PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
     PAFD_RECV_INFO RecvReq =
     GetLockedData(Irp, IrpSp);
-    UINT BytesToCopy = 0, BytesAvailable = DatagramRecv->Len, AddrLen = 0;
+    UINT BytesToCopy = 0, BytesAvailable = Len, AddrLen = 0;
     PAFD_MAPBUF Map;
     BOOLEAN ExtraBuffers = CheckUnlockExtraBuffers(FCB, IrpSp);
 
@@ -343,16 +532,16 @@ SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
         if( ExtraBuffers && Map[1].Mdl && Map[2].Mdl ) {
             AFD_DbgPrint(MID_TRACE,("Checking TAAddressCount\n"));
 
-            if( DatagramRecv->Address->TAAddressCount != 1 ) {
+            if( Address->TAAddressCount != 1 ) {
                 AFD_DbgPrint
                 (MIN_TRACE,
                  ("Wierd address count %d\n",
-                  DatagramRecv->Address->TAAddressCount));
+                  Address->TAAddressCount));
             }
 
             AFD_DbgPrint(MID_TRACE,("Computing addr len\n"));
 
-            AddrLen = MIN(DatagramRecv->Address->Address->AddressLength +
+            AddrLen = MIN(Address->Address->AddressLength +
                           sizeof(USHORT),
                           RecvReq->BufferArray[1].len);
 
@@ -363,7 +552,7 @@ SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
             AFD_DbgPrint(MID_TRACE,("Done mapping, copying address\n"));
 
             RtlCopyMemory( Map[1].BufferAddress,
-                          &DatagramRecv->Address->Address->AddressType,
+                          &Address->Address->AddressType,
                           AddrLen );
 
             MmUnmapLockedPages( Map[1].BufferAddress, Map[1].Mdl );
@@ -385,7 +574,7 @@ SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
                                 BytesToCopy));
 
         RtlCopyMemory( Map[0].BufferAddress,
-                      DatagramRecv->Buffer,
+                      Data,
                       BytesToCopy );
 
         MmUnmapLockedPages( Map[0].BufferAddress, Map[0].Mdl );
@@ -393,7 +582,7 @@ SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
         *TotalBytesCopied = BytesToCopy;
     }
 
-    if (*TotalBytesCopied == DatagramRecv->Len)
+    if (*TotalBytesCopied == Len)
     {
         /* We copied the whole datagram */
         Status = Irp->IoStatus.Status = STATUS_SUCCESS;
@@ -406,6 +595,23 @@ SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
 
     Irp->IoStatus.Information = *TotalBytesCopied;
 
+    return Status;
+}
+
+static NTSTATUS NTAPI
+SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
+                         PAFD_STORED_DATAGRAM DatagramRecv,
+                         PUINT TotalBytesCopied ) {
+    NTSTATUS Status;
+    PAFD_RECV_INFO RecvReq =
+    GetLockedData(Irp, IoGetCurrentIrpStackLocation( Irp ));
+
+    Status = CopyDatagramToRecvRequest( FCB, Irp,
+                                        DatagramRecv->Buffer,
+                                        DatagramRecv->Len,
+                                        DatagramRecv->Address,
+                                        TotalBytesCopied );
+
     if (!(RecvReq->TdiFlags & TDI_RECEIVE_PEEK))
     {
         FCB->Recv.Content -= DatagramRecv->Len;
@@ -532,6 +738,7 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         AFD_DbgPrint(MID_TRACE,("Leaving read irp\n"));
         IoMarkIrpPending( Irp );
         (void)IoSetCancelRoutine(Irp, AfdCancelHandler);
+        RedirectReceive( FCB );
     } else {
         AFD_DbgPrint(MID_TRACE,("Completed with status %x\n", Status));
     }
@@ -604,6 +811,33 @@ PacketSocketRecvComplete(
         return STATUS_FILE_CLOSED;
     }
 
+    /* A recv already waiting with nothing queued ahead of this datagram
+     * gets it straight from the window, without storing it first */
+    if( IsListEmpty( &FCB->DatagramList ) &&
+        !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
+        NextIrp = CONTAINING_RECORD( FCB->PendingIrpList[FUNCTION_RECV].Flink,
+                                     IRP, Tail.Overlay.ListEntry );
+        NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+        RecvReq = GetLockedData(NextIrp, NextIrpSp);
+
+        if( !(RecvReq->TdiFlags & TDI_RECEIVE_PEEK) ) {
+            RemoveEntryList( &NextIrp->Tail.Overlay.ListEntry );
+
+            Status = CopyDatagramToRecvRequest
+            ( FCB, NextIrp, FCB->Recv.Window, Irp->IoStatus.Information,
+              FCB->AddressFrom->RemoteAddress,
+              (PUINT)&NextIrp->IoStatus.Information );
+
+            UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, CheckUnlockExtraBuffers(FCB, NextIrpSp) );
+            if ( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+            (void)IoSetCancelRoutine(NextIrp, NULL);
+            NextIrp->IoStatus.Status = Status;
+            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+
+            goto relaunch;
+        }
+    }
+
     DatagramRecv = ExAllocatePoolWithTag(NonPagedPool,
                                          DGSize,
                                          TAG_AFD_STORED_DATAGRAM);
@@ -681,6 +915,7 @@ PacketSocketRecvComplete(
     } else
         FCB->PollState &= ~AFD_EVENT_RECEIVE;
 
+relaunch:
     if( NT_SUCCESS(Irp->IoStatus.Status) ) {
         /* Now relaunch the datagram request */
         Status = TdiReceiveDatagram
@@ -787,3 +1022,114 @@ AfdPacketSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         return LeaveIrpUntilLater( FCB, Irp, FUNCTION_RECV );
     }
 }
+
+NTSTATUS NTAPI
+AfdPacketSocketRecvBatch(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                         PIO_STACK_LOCATION IrpSp ) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DATAGRAM_BATCH_INFO BatchReq;
+    PAFD_DATAGRAM DatagramArray;
+    AFD_DATAGRAM Datagram;
+    PAFD_STORED_DATAGRAM DatagramRecv;
+    PTA_ADDRESS Address;
+    ULONG Count, Received = 0;
+    UINT BytesToCopy, AddrLen;
+    KPROCESSOR_MODE LockMode;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_RECEIVE;
+
+    /* Check that the socket is bound */
+    if( FCB->State != SOCKET_STATE_BOUND )
+    {
+        AFD_DbgPrint(MIN_TRACE,("Invalid socket state\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+    }
+
+    if (FCB->TdiReceiveClosed)
+    {
+        AFD_DbgPrint(MIN_TRACE,("Receive closed\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_FILE_CLOSED, Irp, 0);
+    }
+
+    if( !(BatchReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete(FCB, STATUS_NO_MEMORY, Irp, 0);
+
+    DatagramArray = BatchReq->DatagramArray;
+    Count = BatchReq->DatagramCount;
+
+    UnlockRequest( Irp, IrpSp );
+
+    if( !Count || Count > AFD_DATAGRAM_BATCH_MAX )
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+
+    /* A batch only takes what is already stored, it never waits. Datagrams
+     * are copied straight into the caller's buffers and stay queued if one
+     * of them turns out to be bad */
+    while( Received < Count && !IsListEmpty( &FCB->DatagramList ) ) {
+        DatagramRecv = CONTAINING_RECORD( FCB->DatagramList.Flink,
+                                          AFD_STORED_DATAGRAM, ListEntry );
+        Address = &DatagramRecv->Address->Address[0];
+
+        _SEH2_TRY {
+            if( LockMode == UserMode )
+                ProbeForWrite( &DatagramArray[Received], sizeof(AFD_DATAGRAM), sizeof(ULONG) );
+            Datagram = DatagramArray[Received];
+
+            BytesToCopy = MIN( Datagram.Buffer.len, DatagramRecv->Len );
+            if( LockMode == UserMode )
+                ProbeForWrite( Datagram.Buffer.buf, BytesToCopy, 1 );
+            RtlCopyMemory( Datagram.Buffer.buf, DatagramRecv->Buffer, BytesToCopy );
+
+            AddrLen = 0;
+            if( Datagram.Address && Datagram.AddressLength > 0 ) {
+                AddrLen = MIN( Address->AddressLength + sizeof(USHORT),
+                               (UINT)Datagram.AddressLength );
+                if( LockMode == UserMode )
+                    ProbeForWrite( Datagram.Address, AddrLen, 1 );
+                RtlCopyMemory( Datagram.Address, &Address->AddressType, AddrLen );
+            }
+
+            DatagramArray[Received].AddressLength = AddrLen;
+            DatagramArray[Received].BytesTransferred = BytesToCopy;
+            DatagramArray[Received].Flags =
+                BytesToCopy < DatagramRecv->Len ? AFD_DATAGRAM_TRUNCATED : 0;
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            Status = STATUS_ACCESS_VIOLATION;
+        } _SEH2_END;
+
+        if( !NT_SUCCESS(Status) ) break;
+
+        RemoveEntryList( &DatagramRecv->ListEntry );
+        FCB->Recv.Content -= DatagramRecv->Len;
+        ExFreePoolWithTag( DatagramRecv->Address, TAG_AFD_TRANSPORT_ADDRESS );
+        ExFreePoolWithTag( DatagramRecv, TAG_AFD_STORED_DATAGRAM );
+
+        Received++;
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Received %u of %u datagrams (0x%x)\n", Received, Count, Status));
+
+    if (!IsListEmpty(&FCB->DatagramList))
+    {
+        FCB->PollState |= AFD_EVENT_RECEIVE;
+        FCB->PollStatus[FD_READ_BIT] = STATUS_SUCCESS;
+        PollReeval( FCB->DeviceExt, FCB->FileObject );
+    }
+    else
+        FCB->PollState &= ~AFD_EVENT_RECEIVE;
+
+    if( Received )
+        Status = STATUS_SUCCESS;
+    else if( NT_SUCCESS(Status) )
+        Status = STATUS_CANT_WAIT;
+
+    return UnlockAndMaybeComplete( FCB, Status, Irp, Received );
+}
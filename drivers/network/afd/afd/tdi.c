@@ -973,6 +973,44 @@ NTSTATUS TdiSend(
     return STATUS_PENDING;
 }
 
+PIRP TdiBuildSendMdl(
+    PFILE_OBJECT TransportObject,
+    USHORT Flags,
+    PMDL Mdl,
+    UINT Length,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID CompletionContext)
+/*
+ * FUNCTION: Builds a send of data that is already described by an MDL
+ * NOTES:
+ *     The IRP isn't associated with the thread, the caller sends it with
+ *     IoCallDriver and frees it when its completion routine returns
+ *     STATUS_MORE_PROCESSING_REQUIRED. The MDL stays the caller's
+ */
+{
+    PDEVICE_OBJECT DeviceObject;
+    PIRP Irp;
+
+    DeviceObject = IoGetRelatedDeviceObject(TransportObject);
+
+    Irp = IoAllocateIrp(DeviceObject->StackSize, FALSE);
+    if (!Irp) {
+        AFD_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return NULL;
+    }
+
+    TdiBuildSend(Irp,                    /* I/O Request Packet */
+                 DeviceObject,           /* Device object */
+                 TransportObject,        /* File object */
+                 CompletionRoutine,      /* Completion routine */
+                 CompletionContext,      /* Completion context */
+                 Mdl,                    /* Data buffer */
+                 Flags,                  /* Flags */
+                 Length);                /* Length of data */
+
+    return Irp;
+}
+
 NTSTATUS TdiReceive(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
@@ -0,0 +1,488 @@
+/*
+ * COPYRIGHT:        See COPYING in the top level directory
+ * PROJECT:          ReactOS kernel
+ * FILE:             drivers/net/afd/afd/transmit.c
+ * PURPOSE:          TransmitFile and TransmitPackets
+ * PROGRAMMER:       ReactOS Team
+ *
+ * A transmit request is a list of memory and file elements that a work
+ * item sends in order. Files are read as cache MDLs, so the TDI sends
+ * describe the cache pages themselves and the data is never copied; files
+ * that aren't cached go through a buffer of the request. Buffers the
+ * caller gives are locked and sent where they are too.
+ *
+ * The transport only looks at the first MDL of a send, so every MDL of a
+ * cache chain gets its own send.
+ */
+
+#include "afd.h"
+
+static IO_COMPLETION_ROUTINE TransmitSendComplete;
+static NTSTATUS NTAPI TransmitSendComplete
+( PDEVICE_OBJECT DeviceObject,
+  PIRP Irp,
+  PVOID Context ) {
+    PAFD_TRANSMIT Transmit = Context;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+    UNREFERENCED_PARAMETER(Irp);
+
+    KeSetEvent( &Transmit->SendDone, IO_NETWORK_INCREMENT, FALSE );
+
+    /* TransmitSendMdl frees the IRP and still owns the MDL */
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+static NTSTATUS TransmitSendIrp( PAFD_FCB FCB, PAFD_TRANSMIT Transmit,
+                                 PMDL Mdl, UINT Length, PUINT BytesSent ) {
+    NTSTATUS Status;
+    PIRP Irp;
+
+    *BytesSent = 0;
+
+    /* The IRP outlives its completion, so it can be cancelled until we
+     * free it */
+    Irp = TdiBuildSendMdl( FCB->Connection.Object,
+                           0,
+                           Mdl,
+                           Length,
+                           TransmitSendComplete,
+                           Transmit );
+    if( !Irp ) return STATUS_INSUFFICIENT_RESOURCES;
+
+    if( !SocketAcquireStateLock( FCB ) ) {
+        IoFreeIrp( Irp );
+        return STATUS_FILE_CLOSED;
+    }
+
+    if( Transmit->Cancelled ) {
+        SocketStateUnlock( FCB );
+        IoFreeIrp( Irp );
+        return STATUS_CANCELLED;
+    }
+
+    KeClearEvent( &Transmit->SendDone );
+    Transmit->SendIrp = Irp;
+    SocketStateUnlock( FCB );
+
+    IoCallDriver( IoGetRelatedDeviceObject( FCB->Connection.Object ), Irp );
+    KeWaitForSingleObject( &Transmit->SendDone, Executive, KernelMode, FALSE, NULL );
+
+    SocketAcquireStateLock( FCB );
+    Transmit->SendIrp = NULL;
+    SocketStateUnlock( FCB );
+
+    Status = Irp->IoStatus.Status;
+    *BytesSent = (UINT)Irp->IoStatus.Information;
+    IoFreeIrp( Irp );
+
+    return Status;
+}
+
+static NTSTATUS TransmitSendMdl( PAFD_FCB FCB, PAFD_TRANSMIT Transmit,
+                                 PMDL Mdl, UINT Length ) {
+/*
+ * FUNCTION: Sends the first Length bytes of Mdl in pieces of at most
+ *           SendSize bytes
+ */
+    NTSTATUS Status = STATUS_SUCCESS;
+    PCHAR Address = MmGetMdlVirtualAddress( Mdl );
+    UINT Offset = 0, Piece, Sent;
+    PMDL PartialMdl;
+
+    while( Offset < Length && NT_SUCCESS(Status) ) {
+        Piece = MIN(Length - Offset, Transmit->SendSize);
+
+        if( Offset == 0 && Piece == MmGetMdlByteCount( Mdl ) ) {
+            Status = TransmitSendIrp( FCB, Transmit, Mdl, Piece, &Sent );
+        } else {
+            PartialMdl = IoAllocateMdl( Address + Offset, Piece, FALSE, FALSE, NULL );
+            if( !PartialMdl ) return STATUS_INSUFFICIENT_RESOURCES;
+
+            IoBuildPartialMdl( Mdl, PartialMdl, Address + Offset, Piece );
+            Status = TransmitSendIrp( FCB, Transmit, PartialMdl, Piece, &Sent );
+            IoFreeMdl( PartialMdl );
+        }
+
+        /* A partial send is continued with the rest */
+        if( NT_SUCCESS(Status) && !Sent ) Status = STATUS_CONNECTION_ABORTED;
+
+        Offset += Sent;
+        Transmit->BytesSent += Sent;
+    }
+
+    return Status;
+}
+
+static NTSTATUS TransmitReadFile( PAFD_TRANSMIT Transmit, PFILE_OBJECT FileObject,
+                                  PLARGE_INTEGER Offset, UINT Length, PUINT Read ) {
+    PDEVICE_OBJECT DeviceObject = IoGetRelatedDeviceObject( FileObject );
+    IO_STATUS_BLOCK IoStatus;
+    NTSTATUS Status;
+    KEVENT Event;
+    PIRP Irp;
+
+    *Read = 0;
+
+    if( !Transmit->Buffer ) {
+        Transmit->Buffer = ExAllocatePoolWithTag( NonPagedPool,
+                                                  Transmit->SendSize,
+                                                  TAG_AFD_DATA_BUFFER );
+        if( !Transmit->Buffer ) return STATUS_INSUFFICIENT_RESOURCES;
+
+        Transmit->BufferMdl = IoAllocateMdl( Transmit->Buffer, Transmit->SendSize,
+                                             FALSE, FALSE, NULL );
+        if( !Transmit->BufferMdl ) return STATUS_INSUFFICIENT_RESOURCES;
+
+        MmBuildMdlForNonPagedPool( Transmit->BufferMdl );
+    }
+
+    KeInitializeEvent( &Event, NotificationEvent, FALSE );
+
+    Irp = IoBuildSynchronousFsdRequest( IRP_MJ_READ,
+                                        DeviceObject,
+                                        Transmit->Buffer,
+                                        Length,
+                                        Offset,
+                                        &Event,
+                                        &IoStatus );
+    if( !Irp ) return STATUS_INSUFFICIENT_RESOURCES;
+
+    IoGetNextIrpStackLocation( Irp )->FileObject = FileObject;
+
+    Status = IoCallDriver( DeviceObject, Irp );
+    if( Status == STATUS_PENDING ) {
+        KeWaitForSingleObject( &Event, Executive, KernelMode, FALSE, NULL );
+        Status = IoStatus.Status;
+    }
+
+    if( NT_SUCCESS(Status) ) *Read = (UINT)IoStatus.Information;
+
+    return Status;
+}
+
+static BOOLEAN TransmitMdlRead( PFILE_OBJECT FileObject, PLARGE_INTEGER Offset,
+                                UINT Length, PMDL *MdlChain, PIO_STATUS_BLOCK IoStatus ) {
+    PDEVICE_OBJECT DeviceObject = IoGetRelatedDeviceObject( FileObject );
+    PFAST_IO_DISPATCH FastIoDispatch = DeviceObject->DriverObject->FastIoDispatch;
+
+    if( FastIoDispatch && FastIoDispatch->MdlRead )
+        return FastIoDispatch->MdlRead( FileObject, Offset, Length, 0,
+                                        MdlChain, IoStatus, DeviceObject );
+
+    return FsRtlMdlReadDev( FileObject, Offset, Length, 0, MdlChain, IoStatus, DeviceObject );
+}
+
+static VOID TransmitMdlReadComplete( PFILE_OBJECT FileObject, PMDL MdlChain ) {
+    PDEVICE_OBJECT DeviceObject = IoGetRelatedDeviceObject( FileObject );
+    PFAST_IO_DISPATCH FastIoDispatch = DeviceObject->DriverObject->FastIoDispatch;
+
+    if( FastIoDispatch && FastIoDispatch->MdlReadComplete &&
+        FastIoDispatch->MdlReadComplete( FileObject, MdlChain, DeviceObject ) )
+        return;
+
+    FsRtlMdlReadCompleteDev( FileObject, MdlChain, DeviceObject );
+}
+
+static NTSTATUS TransmitFileEntry( PAFD_FCB FCB, PAFD_TRANSMIT Transmit,
+                                   PAFD_TRANSMIT_ENTRY Entry ) {
+    PFILE_OBJECT FileObject = Entry->FileObject;
+    ULONGLONG Remaining;
+    LARGE_INTEGER Offset;
+    IO_STATUS_BLOCK IoStatus;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PMDL MdlChain, Mdl;
+    UINT Length, Read;
+
+    Offset = Entry->FileOffset;
+    if( Offset.QuadPart == -1 ) Offset = FileObject->CurrentByteOffset;
+
+    /* A length of 0 reads up to the end of the file */
+    Remaining = Entry->Length ? Entry->Length : (ULONGLONG)-1;
+
+    while( Remaining && NT_SUCCESS(Status) ) {
+        Length = (UINT)MIN(Remaining, Transmit->SendSize);
+        MdlChain = NULL;
+
+        if( TransmitMdlRead( FileObject, &Offset, Length, &MdlChain, &IoStatus ) ) {
+            Status = IoStatus.Status;
+            Read = NT_SUCCESS(Status) ? (UINT)IoStatus.Information : 0;
+
+            for( Mdl = MdlChain; Mdl && NT_SUCCESS(Status); Mdl = Mdl->Next )
+                Status = TransmitSendMdl( FCB, Transmit, Mdl, MmGetMdlByteCount( Mdl ) );
+
+            if( MdlChain ) TransmitMdlReadComplete( FileObject, MdlChain );
+        } else {
+            /* Not cached (yet), the read sets up the cache for the next piece */
+            Status = TransmitReadFile( Transmit, FileObject, &Offset, Length, &Read );
+
+            if( NT_SUCCESS(Status) && Read )
+                Status = TransmitSendMdl( FCB, Transmit, Transmit->BufferMdl, Read );
+        }
+
+        if( Status == STATUS_END_OF_FILE || (NT_SUCCESS(Status) && !Read) ) {
+            /* A file shorter than the length asked for ends the element */
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        Offset.QuadPart += Read;
+        Remaining -= Read;
+    }
+
+    return Status;
+}
+
+static VOID TransmitFreeEntries( PAFD_TRANSMIT Transmit ) {
+    PAFD_TRANSMIT_ENTRY Entry;
+    ULONG i;
+
+    for( i = 0; i < Transmit->EntryCount; i++ ) {
+        Entry = &Transmit->Entries[i];
+
+        if( Entry->FileObject ) ObDereferenceObject( Entry->FileObject );
+        if( Entry->Mdl ) {
+            MmUnlockPages( Entry->Mdl );
+            IoFreeMdl( Entry->Mdl );
+        }
+    }
+
+    if( Transmit->BufferMdl ) IoFreeMdl( Transmit->BufferMdl );
+    if( Transmit->Buffer ) ExFreePoolWithTag( Transmit->Buffer, TAG_AFD_DATA_BUFFER );
+    if( Transmit->WorkItem ) IoFreeWorkItem( Transmit->WorkItem );
+
+    ExFreePoolWithTag( Transmit, TAG_AFD_TRANSMIT );
+}
+
+static IO_WORKITEM_ROUTINE TransmitWorker;
+static VOID NTAPI TransmitWorker( PDEVICE_OBJECT DeviceObject, PVOID Context ) {
+    PAFD_TRANSMIT Transmit = Context;
+    PIRP Irp = Transmit->Irp;
+    PAFD_FCB FCB = IoGetCurrentIrpStackLocation( Irp )->FileObject->FsContext;
+    PAFD_TRANSMIT_ENTRY Entry;
+    LARGE_INTEGER Interval;
+    NTSTATUS Status = STATUS_SUCCESS;
+    BOOLEAN Idle;
+    ULONG i;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    /* Let the sends queued before us go first */
+    Interval.QuadPart = -10 * 1000 * 10;
+    for( ;; ) {
+        SocketAcquireStateLock( FCB );
+        Idle = !FCB->SendIrp.InFlightRequest &&
+               IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] );
+        if( Transmit->Cancelled ) Status = STATUS_CANCELLED;
+        SocketStateUnlock( FCB );
+
+        if( Idle || !NT_SUCCESS(Status) ) break;
+        KeDelayExecutionThread( KernelMode, FALSE, &Interval );
+    }
+
+    for( i = 0; i < Transmit->EntryCount && NT_SUCCESS(Status); i++ ) {
+        Entry = &Transmit->Entries[i];
+
+        if( Entry->Mdl )
+            Status = TransmitSendMdl( FCB, Transmit, Entry->Mdl, Entry->Length );
+        else if( Entry->FileObject )
+            Status = TransmitFileEntry( FCB, Transmit, Entry );
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Transmit of %u elements done (%x, %Iu bytes)\n",
+                            Transmit->EntryCount, Status, Transmit->BytesSent));
+
+    SocketAcquireStateLock( FCB );
+
+    FCB->Transmit = NULL;
+
+    /* TransmitFile sockets can only be reused through AcceptEx and
+     * ConnectEx, so TF_REUSE_SOCKET ends the connection like TF_DISCONNECT */
+    if( NT_SUCCESS(Status) && (Transmit->Flags & (AFD_TP_DISCONNECT | AFD_TP_REUSE_SOCKET)) &&
+        !FCB->DisconnectPending && FCB->ConnectCallInfo ) {
+        FCB->DisconnectFlags = TDI_DISCONNECT_RELEASE;
+        FCB->DisconnectTimeout.QuadPart = -1000000;
+        FCB->DisconnectPending = TRUE;
+        FCB->SendClosed = TRUE;
+        FCB->PollState &= ~AFD_EVENT_SEND;
+        RetryDisconnectCompletion( FCB );
+    }
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = NT_SUCCESS(Status) ? Transmit->BytesSent : 0;
+    (void)IoSetCancelRoutine( Irp, NULL );
+
+    SocketStateUnlock( FCB );
+
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+
+    TransmitFreeEntries( Transmit );
+}
+
+static NTSTATUS TransmitCaptureEntries( PAFD_TRANSMIT Transmit,
+                                        PAFD_TRANSMIT_ELEMENT Elements,
+                                        KPROCESSOR_MODE LockMode ) {
+    PAFD_TRANSMIT_ENTRY Entry;
+    AFD_TRANSMIT_ELEMENT Element;
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG i;
+
+    for( i = 0; i < Transmit->EntryCount; i++ ) {
+        Entry = &Transmit->Entries[i];
+
+        _SEH2_TRY {
+            Element = Elements[i];
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            _SEH2_YIELD(return STATUS_ACCESS_VIOLATION);
+        } _SEH2_END;
+
+        Entry->Flags = Element.Flags;
+        Entry->Length = Element.Length;
+        Entry->FileOffset = Element.FileOffset;
+
+        if( Element.Flags & AFD_TP_ELEMENT_FILE ) {
+            Status = ObReferenceObjectByHandle( Element.FileHandle,
+                                                FILE_READ_DATA,
+                                                *IoFileObjectType,
+                                                LockMode,
+                                                (PVOID*)&Entry->FileObject,
+                                                NULL );
+            if( !NT_SUCCESS(Status) ) {
+                Entry->FileObject = NULL;
+                return Status;
+            }
+        } else if( Element.Flags & AFD_TP_ELEMENT_MEMORY ) {
+            if( !Element.Length ) continue;
+
+            Entry->Mdl = IoAllocateMdl( Element.Buffer, Element.Length,
+                                        FALSE, FALSE, NULL );
+            if( !Entry->Mdl ) return STATUS_INSUFFICIENT_RESOURCES;
+
+            _SEH2_TRY {
+                MmProbeAndLockPages( Entry->Mdl, LockMode, IoReadAccess );
+            } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+                Status = STATUS_ACCESS_VIOLATION;
+            } _SEH2_END;
+
+            if( !NT_SUCCESS(Status) ) {
+                IoFreeMdl( Entry->Mdl );
+                Entry->Mdl = NULL;
+                return Status;
+            }
+        } else {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS NTAPI
+AfdTransmitPackets( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                    PIO_STACK_LOCATION IrpSp ) {
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_TRANSMIT_INFO TransmitReq;
+    AFD_TRANSMIT_INFO Request;
+    PAFD_TRANSMIT Transmit;
+    KPROCESSOR_MODE LockMode;
+    NTSTATUS Status;
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    if( (FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+        FCB->State != SOCKET_STATE_CONNECTED ) {
+        AFD_DbgPrint(MIN_TRACE,("Socket not connected\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_CONNECTION, Irp, 0 );
+    }
+
+    if( FCB->SendClosed || (FCB->PollState & (AFD_EVENT_CLOSE | AFD_EVENT_ABORT)) ) {
+        AFD_DbgPrint(MIN_TRACE,("No more sends\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_FILE_CLOSED, Irp, 0 );
+    }
+
+    if( FCB->Transmit ) {
+        AFD_DbgPrint(MIN_TRACE,("Transmit already in progress\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_DEVICE_REQUEST, Irp, 0 );
+    }
+
+    if( IrpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(*TransmitReq) ||
+        !(TransmitReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+
+    Request = *TransmitReq;
+    UnlockRequest( Irp, IrpSp );
+
+    if( Request.ElementCount > AFD_TRANSMIT_MAX_ELEMENTS )
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+
+    if( LockMode == UserMode && Request.ElementCount ) {
+        _SEH2_TRY {
+            ProbeForRead( Request.ElementArray,
+                          Request.ElementCount * sizeof(AFD_TRANSMIT_ELEMENT),
+                          sizeof(ULONG) );
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            _SEH2_YIELD(return UnlockAndMaybeComplete( FCB, STATUS_ACCESS_VIOLATION, Irp, 0 ));
+        } _SEH2_END;
+    }
+
+    Transmit = ExAllocatePoolWithTag( NonPagedPool,
+                                      FIELD_OFFSET(AFD_TRANSMIT, Entries[Request.ElementCount]),
+                                      TAG_AFD_TRANSMIT );
+    if( !Transmit )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    RtlZeroMemory( Transmit, FIELD_OFFSET(AFD_TRANSMIT, Entries[Request.ElementCount]) );
+    Transmit->Irp = Irp;
+    Transmit->Flags = Request.Flags;
+    Transmit->SendSize = Request.SendSize ? MIN(Request.SendSize, AFD_TRANSMIT_MAX_SEND_SIZE) : AFD_TRANSMIT_SEND_SIZE;
+    Transmit->EntryCount = Request.ElementCount;
+    KeInitializeEvent( &Transmit->SendDone, NotificationEvent, FALSE );
+
+    Status = TransmitCaptureEntries( Transmit, Request.ElementArray, LockMode );
+    if( NT_SUCCESS(Status) ) {
+        Transmit->WorkItem = IoAllocateWorkItem( DeviceObject );
+        if( !Transmit->WorkItem ) Status = STATUS_NO_MEMORY;
+    }
+
+    if( !NT_SUCCESS(Status) ) {
+        TransmitFreeEntries( Transmit );
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    IoAcquireCancelSpinLock( &Irp->CancelIrql );
+    if( Irp->Cancel ) {
+        IoReleaseCancelSpinLock( Irp->CancelIrql );
+        TransmitFreeEntries( Transmit );
+        return UnlockAndMaybeComplete( FCB, STATUS_CANCELLED, Irp, 0 );
+    }
+    (void)IoSetCancelRoutine( Irp, AfdCancelHandler );
+    IoReleaseCancelSpinLock( Irp->CancelIrql );
+
+    IoMarkIrpPending( Irp );
+    FCB->Transmit = Transmit;
+
+    /* The sends wait for each other, so they don't belong on this thread */
+    IoQueueWorkItem( Transmit->WorkItem, TransmitWorker, DelayedWorkQueue, Transmit );
+
+    SocketStateUnlock( FCB );
+
+    return STATUS_PENDING;
+}
+
+VOID TransmitCancel( PAFD_FCB FCB, PIRP Irp ) {
+/*
+ * FUNCTION: Stops a transmit after the send in flight, called with the
+ *           socket lock held
+ */
+    PAFD_TRANSMIT Transmit = FCB->Transmit;
+
+    if( !Transmit || Transmit->Irp != Irp ) return;
+
+    Transmit->Cancelled = TRUE;
+    if( Transmit->SendIrp ) IoCancelIrp( Transmit->SendIrp );
+}
+
+/* EOF */
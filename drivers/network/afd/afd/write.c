@@ -676,3 +676,164 @@ AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
     }
 }
+
+typedef struct _AFD_BATCH_SEND_CONTEXT {
+    KEVENT Event;
+    IO_STATUS_BLOCK Iosb;
+} AFD_BATCH_SEND_CONTEXT, *PAFD_BATCH_SEND_CONTEXT;
+
+static IO_COMPLETION_ROUTINE BatchSendComplete;
+static NTSTATUS NTAPI BatchSendComplete
+( PDEVICE_OBJECT DeviceObject,
+  PIRP Irp,
+  PVOID Context ) {
+    PAFD_BATCH_SEND_CONTEXT SendContext = Context;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    SendContext->Iosb = Irp->IoStatus;
+    KeSetEvent(&SendContext->Event, IO_NETWORK_INCREMENT, FALSE);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS NTAPI
+AfdPacketSocketSendBatch(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                         PIO_STACK_LOCATION IrpSp) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DATAGRAM_BATCH_INFO BatchReq;
+    PAFD_DATAGRAM DatagramArray;
+    AFD_DATAGRAM Datagram;
+    PTDI_CONNECTION_INFORMATION TargetAddress = NULL;
+    UCHAR AddressBuffer[FIELD_OFFSET(TRANSPORT_ADDRESS, Address[0].AddressType) +
+                        AFD_DATAGRAM_MAX_ADDRESS];
+    PTRANSPORT_ADDRESS Address = (PTRANSPORT_ADDRESS)AddressBuffer;
+    AFD_BATCH_SEND_CONTEXT SendContext;
+    PIRP SendIrp;
+    ULONG Count, Sent = 0;
+    KPROCESSOR_MODE LockMode;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_SEND;
+
+    /* msafd binds the socket before the first batch */
+    if( FCB->State != SOCKET_STATE_BOUND )
+    {
+        AFD_DbgPrint(MIN_TRACE,("Invalid socket state\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+    }
+
+    if (FCB->SendClosed)
+    {
+        AFD_DbgPrint(MIN_TRACE,("No more sends\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_FILE_CLOSED, Irp, 0);
+    }
+
+    if( !(BatchReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete(FCB, STATUS_NO_MEMORY, Irp, 0);
+
+    DatagramArray = BatchReq->DatagramArray;
+    Count = BatchReq->DatagramCount;
+
+    UnlockRequest( Irp, IrpSp );
+
+    if( !Count || Count > AFD_DATAGRAM_BATCH_MAX )
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+
+    KeInitializeEvent(&SendContext.Event, NotificationEvent, FALSE);
+
+    /* The datagrams go out one after the other from this thread. UDP sends
+     * complete at once, the batch saves the trip through the I/O manager */
+    while( Sent < Count ) {
+        _SEH2_TRY {
+            if( LockMode == UserMode )
+                ProbeForRead( &DatagramArray[Sent], sizeof(AFD_DATAGRAM), sizeof(ULONG) );
+            Datagram = DatagramArray[Sent];
+
+            if( Datagram.AddressLength < (INT)sizeof(USHORT) ||
+                Datagram.AddressLength > AFD_DATAGRAM_MAX_ADDRESS ) {
+                Status = STATUS_INVALID_PARAMETER;
+            } else {
+                RtlZeroMemory( AddressBuffer, sizeof(AddressBuffer) );
+                Address->TAAddressCount = 1;
+                Address->Address[0].AddressLength =
+                    (USHORT)(Datagram.AddressLength - sizeof(USHORT));
+                if( LockMode == UserMode )
+                    ProbeForRead( Datagram.Address, Datagram.AddressLength, 1 );
+                RtlCopyMemory( &Address->Address[0].AddressType,
+                               Datagram.Address,
+                               Datagram.AddressLength );
+
+                /* The transport locks the data with the kernel's mode */
+                if( LockMode == UserMode )
+                    ProbeForRead( Datagram.Buffer.buf, Datagram.Buffer.len, 1 );
+            }
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            Status = STATUS_ACCESS_VIOLATION;
+        } _SEH2_END;
+
+        if( !NT_SUCCESS(Status) ) break;
+
+        /* Batches rarely mix address families, the connection
+         * information is only rebuilt when the type changes */
+        if( !TargetAddress ||
+            ((PTRANSPORT_ADDRESS)TargetAddress->RemoteAddress)->Address[0].AddressType !=
+            Address->Address[0].AddressType ) {
+            if( TargetAddress )
+                ExFreePoolWithTag( TargetAddress, TAG_AFD_TDI_CONNECTION_INFORMATION );
+            Status = TdiBuildConnectionInfo( &TargetAddress, Address );
+        } else {
+            Status = TdiBuildConnectionInfoInPlace( TargetAddress, Address );
+        }
+
+        if( !NT_SUCCESS(Status) ) break;
+
+        KeClearEvent( &SendContext.Event );
+        SendIrp = NULL;
+
+        Status = TdiSendDatagram( &SendIrp,
+                                  FCB->AddressFile.Object,
+                                  Datagram.Buffer.buf,
+                                  Datagram.Buffer.len,
+                                  TargetAddress,
+                                  BatchSendComplete,
+                                  &SendContext );
+
+        if( Status == STATUS_PENDING ) {
+            KeWaitForSingleObject( &SendContext.Event, Executive, KernelMode, FALSE, NULL );
+            Status = SendContext.Iosb.Status;
+        }
+
+        if( !NT_SUCCESS(Status) ) break;
+
+        _SEH2_TRY {
+            DatagramArray[Sent].BytesTransferred = Datagram.Buffer.len;
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        } _SEH2_END;
+
+        Sent++;
+    }
+
+    if( TargetAddress )
+        ExFreePoolWithTag( TargetAddress, TAG_AFD_TDI_CONNECTION_INFORMATION );
+
+    AFD_DbgPrint(MID_TRACE,("Sent %u of %u datagrams (0x%x)\n", Sent, Count, Status));
+
+    /* A batch that got some datagrams out reports how many, the next one
+     * runs into the error again */
+    if( Sent )
+        Status = STATUS_SUCCESS;
+
+    FCB->PollState |= AFD_EVENT_SEND;
+    FCB->PollStatus[FD_WRITE_BIT] = STATUS_SUCCESS;
+    PollReeval( FCB->DeviceExt, FCB->FileObject );
+
+    return UnlockAndMaybeComplete( FCB, Status, Irp, Sent );
+}
@@ -47,11 +47,13 @@
 #define TAG_AFD_POLL_HANDLE                'hpfA'
 #define TAG_AFD_FCB                        'cffA'
 #define TAG_AFD_ACTIVE_POLL                'pafA'
+#define TAG_AFD_POLL_SET                   'spfA'
 #define TAG_AFD_EA_INFO                    'aefA'
 #define TAG_AFD_STORED_DATAGRAM            'gsfA'
 #define TAG_AFD_SNMP_ADDRESS_INFO          'asfA'
 #define TAG_AFD_TDI_CONNECTION_INFORMATION 'cTfA'
 #define TAG_AFD_WSA_BUFFER                 'bWfA'
+#define TAG_AFD_TRANSMIT                   'rtfA'
 
 typedef struct IPADDR_ENTRY {
 	ULONG  Addr;
@@ -96,6 +98,21 @@ typedef struct IPADDR_ENTRY {
 					   * for ancillary data on packet
 					   * requests. */
 
+#define AFD_DIRECT_RECV_THRESHOLD       0x4000 /* Stream recvs at least this
+					   * large are filled by the transport
+					   * directly when nothing is buffered. */
+
+#define AFD_TRANSMIT_SEND_SIZE          0x10000 /* Default size of the sends
+					   * TransmitFile splits files into */
+#define AFD_TRANSMIT_MAX_SEND_SIZE      0x100000
+#define AFD_TRANSMIT_MAX_ELEMENTS       0x10000
+
+#define AFD_DATAGRAM_BATCH_MAX          1024
+#define AFD_DATAGRAM_MAX_ADDRESS        128 /* Largest sockaddr in a batch */
+
+#define AFD_MIN_RECV_WINDOW             0x1000
+#define AFD_MAX_RECV_WINDOW             0x100000
+
 /* XXX This is a hack we should clean up later
  * We do this in order to get some storage for the locked handle table
  * Maybe I'll use some tail item in the irp instead */
@@ -123,6 +140,35 @@ typedef struct _AFD_ACTIVE_POLL {
     BOOLEAN Exclusive;
 } AFD_ACTIVE_POLL, *PAFD_ACTIVE_POLL;
 
+typedef struct _AFD_POLL_SET {
+    LIST_ENTRY Members;          /* AFD_POLL_SET_ENTRY.SetEntry */
+    LIST_ENTRY ReadyList;        /* Members with events not yet reported */
+    LIST_ENTRY Waiters;          /* AFD_POLL_SET_WAITER.ListEntry */
+    PAFD_DEVICE_EXTENSION DeviceExt;
+} AFD_POLL_SET, *PAFD_POLL_SET;
+
+/* One socket in one poll set. Everything in this and in AFD_POLL_SET is
+ * protected by the device extension lock, like the active polls */
+typedef struct _AFD_POLL_SET_ENTRY {
+    LIST_ENTRY SetEntry;
+    LIST_ENTRY SocketEntry;      /* AFD_FCB.PollSetEntries */
+    LIST_ENTRY ReadyEntry;
+    PAFD_POLL_SET PollSet;
+    struct _AFD_FCB *FCB;
+    ULONG Events;
+    ULONG Flags;
+    ULONG_PTR Context;
+    BOOLEAN Queued;
+} AFD_POLL_SET_ENTRY, *PAFD_POLL_SET_ENTRY;
+
+typedef struct _AFD_POLL_SET_WAITER {
+    LIST_ENTRY ListEntry;
+    PIRP Irp;                    /* NULL once completed */
+    PAFD_DEVICE_EXTENSION DeviceExt;
+    KDPC TimeoutDpc;
+    KTIMER Timer;
+} AFD_POLL_SET_WAITER, *PAFD_POLL_SET_WAITER;
+
 typedef struct _IRP_LIST {
     LIST_ENTRY ListEntry;
     PIRP Irp;
@@ -158,6 +204,30 @@ typedef struct _AFD_STORED_DATAGRAM {
     CHAR Buffer[1];
 } AFD_STORED_DATAGRAM, *PAFD_STORED_DATAGRAM;
 
+typedef struct _AFD_TRANSMIT_ENTRY {
+    ULONG Flags;
+    ULONG Length;
+    LARGE_INTEGER FileOffset;
+    PFILE_OBJECT FileObject;     /* File elements */
+    PMDL Mdl;                    /* Locked buffer of memory elements */
+} AFD_TRANSMIT_ENTRY, *PAFD_TRANSMIT_ENTRY;
+
+/* A TransmitFile/TransmitPackets request, sent by a work item */
+typedef struct _AFD_TRANSMIT {
+    PIRP Irp;
+    PIO_WORKITEM WorkItem;
+    PIRP SendIrp;                /* TDI send in flight, under the socket lock */
+    KEVENT SendDone;
+    BOOLEAN Cancelled;
+    ULONG SendSize;
+    ULONG Flags;
+    PCHAR Buffer;                /* For files that can't be read from the cache */
+    PMDL BufferMdl;
+    ULONG_PTR BytesSent;
+    ULONG EntryCount;
+    AFD_TRANSMIT_ENTRY Entries[1];
+} AFD_TRANSMIT, *PAFD_TRANSMIT;
+
 typedef struct _AFD_FCB {
     BOOLEAN Locked, Critical, Overread, NonBlocking, OobInline, TdiReceiveClosed, SendClosed;
     UINT State, Flags, GroupID, GroupType;
@@ -176,6 +246,9 @@ typedef struct _AFD_FCB {
     AFD_TDI_OBJECT AddressFile, Connection;
     AFD_IN_FLIGHT_REQUEST ConnectIrp, ListenIrp, ReceiveIrp, SendIrp, DisconnectIrp;
     AFD_DATA_WINDOW Send, Recv;
+    PIRP DirectRecvIrp;          /* Recv whose buffer the in-flight receive fills */
+    BOOLEAN RecvRedirected;      /* Receive into Recv.Window cancelled for a direct one */
+    UINT RecvSizeRequested;      /* Size to switch Recv.Window to, 0 if none */
     KMUTEX Mutex;
     PKEVENT EventSelect;
     DWORD EventSelectTriggers;
@@ -184,6 +257,9 @@ typedef struct _AFD_FCB {
     PVOID Context;
     DWORD PollState;
     NTSTATUS PollStatus[FD_MAX_EVENTS];
+    PAFD_POLL_SET PollSet;       /* Set when this handle is a poll set */
+    LIST_ENTRY PollSetEntries;   /* Poll sets this socket is registered in */
+    PAFD_TRANSMIT Transmit;      /* TransmitFile/TransmitPackets in progress */
     NTSTATUS LastReceiveStatus;
     UINT ContextSize;
     PVOID ConnectData;
@@ -316,6 +392,29 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCA
 NTSTATUS NTAPI
 AfdPacketSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 			PIO_STACK_LOCATION IrpSp );
+NTSTATUS NTAPI
+AfdPacketSocketRecvBatch(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+			 PIO_STACK_LOCATION IrpSp );
+NTSTATUS AfdSetReceiveWindowSize( PAFD_FCB FCB, UINT Size );
+
+/* pollset.c */
+
+NTSTATUS NTAPI
+AfdPollSetControl( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+		   PIO_STACK_LOCATION IrpSp );
+NTSTATUS NTAPI
+AfdPollSetWait( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+		PIO_STACK_LOCATION IrpSp );
+VOID PollSetReeval( PAFD_FCB FCB );
+VOID PollSetCancelWait( PAFD_FCB FCB, PIRP Irp );
+VOID DestroyPollSets( PAFD_FCB FCB );
+
+/* transmit.c */
+
+NTSTATUS NTAPI
+AfdTransmitPackets( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+		    PIO_STACK_LOCATION IrpSp );
+VOID TransmitCancel( PAFD_FCB FCB, PIRP Irp );
 
 /* select.c */
 
@@ -379,6 +478,14 @@ NTSTATUS TdiSend
   PIO_COMPLETION_ROUTINE  CompletionRoutine,
   PVOID CompletionContext);
 
+PIRP TdiBuildSendMdl(
+    PFILE_OBJECT TransportObject,
+    USHORT Flags,
+    PMDL Mdl,
+    UINT Length,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID CompletionContext);
+
 NTSTATUS TdiReceiveDatagram(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
@@ -410,5 +517,8 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 NTSTATUS NTAPI
 AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 			 PIO_STACK_LOCATION IrpSp);
+NTSTATUS NTAPI
+AfdPacketSocketSendBatch(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+			 PIO_STACK_LOCATION IrpSp);
 
 #endif /* _AFD_H */
@@ -49,6 +49,123 @@ DriverEntry(
     IN PDRIVER_OBJECT DriverObject,
     IN PUNICODE_STRING RegistryPath);
 
+static UINT
+MiReceive(
+    IN PADAPTER Adapter,
+    IN UINT Budget)
+/*
+ * FUNCTION: Indicate the frames waiting in the receive ring
+ * ARGUMENTS:
+ *     Adapter: pointer to the miniport's adapter struct
+ *     Budget: maximum number of frames to indicate
+ * RETURNS:
+ *     Number of frames indicated
+ * NOTES:
+ *     - Called with the adapter lock held
+ */
+{
+  BOOLEAN IndicatedData = FALSE;
+  UINT Received = 0;
+
+  while(Received < Budget)
+    {
+      PRECEIVE_DESCRIPTOR Descriptor = Adapter->ReceiveDescriptorRingVirt + Adapter->CurrentReceiveDescriptorIndex;
+      PCHAR Buffer;
+      ULONG ByteCount;
+
+      if(Descriptor->FLAGS & RD_OWN)
+        {
+          DPRINT("no more receive descriptors to process\n");
+          break;
+        }
+
+      if(Descriptor->FLAGS & RD_ERR)
+        {
+          DPRINT("receive descriptor error: 0x%x\n", Descriptor->FLAGS);
+          if (Descriptor->FLAGS & RD_BUFF)
+            Adapter->Statistics.RcvBufferErrors++;
+          if (Descriptor->FLAGS & RD_CRC)
+            Adapter->Statistics.RcvCrcErrors++;
+          if (Descriptor->FLAGS & RD_OFLO)
+            Adapter->Statistics.RcvOverflowErrors++;
+          if (Descriptor->FLAGS & RD_FRAM)
+            Adapter->Statistics.RcvFramingErrors++;
+          break;
+        }
+
+      if(!((Descriptor->FLAGS & RD_STP) && (Descriptor->FLAGS & RD_ENP)))
+        {
+          DPRINT("receive descriptor not start&end: 0x%x\n", Descriptor->FLAGS);
+          break;
+        }
+
+      Buffer = Adapter->ReceiveBufferPtrVirt + Adapter->CurrentReceiveDescriptorIndex * BUFFER_SIZE;
+      ByteCount = Descriptor->MCNT & 0xfff;
+
+      DPRINT("Indicating a %d-byte packet (index %d)\n", ByteCount, Adapter->CurrentReceiveDescriptorIndex);
+
+      NdisMEthIndicateReceive(Adapter->MiniportAdapterHandle, 0, Buffer, 14, Buffer+14, ByteCount-14, ByteCount-14);
+
+      IndicatedData = TRUE;
+
+      RtlZeroMemory(Descriptor, sizeof(RECEIVE_DESCRIPTOR));
+      Descriptor->RBADR = Adapter->ReceiveBufferPtrPhys.QuadPart +
+                          (Adapter->CurrentReceiveDescriptorIndex * BUFFER_SIZE);
+      Descriptor->BCNT = (-BUFFER_SIZE) | 0xf000;
+      Descriptor->FLAGS |= RD_OWN;
+
+      Adapter->CurrentReceiveDescriptorIndex++;
+      Adapter->CurrentReceiveDescriptorIndex %= Adapter->BufferCount;
+
+      Adapter->Statistics.RcvGoodFrames++;
+      Received++;
+    }
+
+  if (IndicatedData)
+    NdisMEthIndicateReceiveComplete(Adapter->MiniportAdapterHandle);
+
+  return Received;
+}
+
+static BOOLEAN
+NTAPI
+MiSyncRxModeration(
+    IN PVOID SynchronizeContext)
+/*
+ * FUNCTION: Switch the receive interrupt between per frame and timer polling
+ * ARGUMENTS:
+ *     SynchronizeContext: Adapter context
+ */
+{
+  PADAPTER Adapter = (PADAPTER)SynchronizeContext;
+  USHORT Data;
+
+  if (Adapter->RxModeration)
+    {
+      NdisRawWritePortUshort(Adapter->PortOffset + RAP, BCR31);
+      NdisRawWritePortUshort(Adapter->PortOffset + BDP, (USHORT)Adapter->RxModeration);
+    }
+
+  NdisRawWritePortUshort(Adapter->PortOffset + RAP, CSR7);
+  NdisRawReadPortUshort(Adapter->PortOffset + RDP, &Data);
+  Data &= ~(CSR7_INTERRUPTS | CSR7_STINTE);
+  if (Adapter->RxModeration)
+    Data |= CSR7_STINTE;
+  NdisRawWritePortUshort(Adapter->PortOffset + RDP, Data);
+
+  NdisRawWritePortUshort(Adapter->PortOffset + RAP, CSR3);
+  NdisRawReadPortUshort(Adapter->PortOffset + RDP, &Data);
+  if (Adapter->RxModeration)
+    Data |= CSR3_RINTM;
+  else
+    Data &= ~CSR3_RINTM;
+  NdisRawWritePortUshort(Adapter->PortOffset + RDP, Data);
+
+  NdisRawWritePortUshort(Adapter->PortOffset + RAP, CSR0);
+
+  return TRUE;
+}
+
 static VOID
 NTAPI
 MiniportHandleInterrupt(
@@ -63,7 +180,11 @@ MiniportHandleInterrupt(
 {
   PADAPTER Adapter = (PADAPTER)MiniportAdapterContext;
   USHORT Data;
+  USHORT Data7;
   UINT i = 0;
+  UINT Received = 0;
+  UINT Budget = Adapter->HasSoftwareTimer ? RECEIVE_BUDGET : (UINT)-1;
+  ULONG Moderation;
 
   DPRINT("Called\n");
 
@@ -81,6 +202,18 @@ MiniportHandleInterrupt(
       /* Clear interrupt flags early to avoid race conditions. */
       NdisRawWritePortUshort(Adapter->PortOffset + RDP, Data);
 
+      if (Adapter->RxModeration)
+        {
+          /* A timer tick stands for the masked receive interrupt */
+          NdisRawWritePortUshort(Adapter->PortOffset + RAP, CSR7);
+          NdisRawReadPortUshort(Adapter->PortOffset + RDP, &Data7);
+          if (Data7 & CSR7_STINT)
+            NdisRawWritePortUshort(Adapter->PortOffset + RDP, (Data7 & ~CSR7_INTERRUPTS) | CSR7_STINT);
+          NdisRawWritePortUshort(Adapter->PortOffset + RAP, CSR0);
+
+          Data |= CSR0_RINT;
+        }
+
       if(Data & CSR0_ERR)
         {
           DPRINT("error: %x\n", Data & (CSR0_MERR|CSR0_BABL|CSR0_CERR|CSR0_MISS));
@@ -93,65 +226,8 @@ MiniportHandleInterrupt(
         }
       if(Data & CSR0_RINT)
         {
-          BOOLEAN IndicatedData = FALSE;
-
           DPRINT("receive interrupt\n");
-
-          while(1)
-            {
-              PRECEIVE_DESCRIPTOR Descriptor = Adapter->ReceiveDescriptorRingVirt + Adapter->CurrentReceiveDescriptorIndex;
-              PCHAR Buffer;
-              ULONG ByteCount;
-
-              if(Descriptor->FLAGS & RD_OWN)
-                {
-                  DPRINT("no more receive descriptors to process\n");
-                  break;
-                }
-
-              if(Descriptor->FLAGS & RD_ERR)
-                {
-                  DPRINT("receive descriptor error: 0x%x\n", Descriptor->FLAGS);
-                  if (Descriptor->FLAGS & RD_BUFF)
-                    Adapter->Statistics.RcvBufferErrors++;
-                  if (Descriptor->FLAGS & RD_CRC)
-                    Adapter->Statistics.RcvCrcErrors++;
-                  if (Descriptor->FLAGS & RD_OFLO)
-                    Adapter->Statistics.RcvOverflowErrors++;
-                  if (Descriptor->FLAGS & RD_FRAM)
-                    Adapter->Statistics.RcvFramingErrors++;
-                  break;
-                }
-
-              if(!((Descriptor->FLAGS & RD_STP) && (Descriptor->FLAGS & RD_ENP)))
-                {
-                  DPRINT("receive descriptor not start&end: 0x%x\n", Descriptor->FLAGS);
-                  break;
-                }
-
-              Buffer = Adapter->ReceiveBufferPtrVirt + Adapter->CurrentReceiveDescriptorIndex * BUFFER_SIZE;
-              ByteCount = Descriptor->MCNT & 0xfff;
-
-              DPRINT("Indicating a %d-byte packet (index %d)\n", ByteCount, Adapter->CurrentReceiveDescriptorIndex);
-
-              NdisMEthIndicateReceive(Adapter->MiniportAdapterHandle, 0, Buffer, 14, Buffer+14, ByteCount-14, ByteCount-14);
-
-              IndicatedData = TRUE;
-
-              RtlZeroMemory(Descriptor, sizeof(RECEIVE_DESCRIPTOR));
-              Descriptor->RBADR = Adapter->ReceiveBufferPtrPhys.QuadPart +
-                                  (Adapter->CurrentReceiveDescriptorIndex * BUFFER_SIZE);
-              Descriptor->BCNT = (-BUFFER_SIZE) | 0xf000;
-              Descriptor->FLAGS |= RD_OWN;
-
-              Adapter->CurrentReceiveDescriptorIndex++;
-              Adapter->CurrentReceiveDescriptorIndex %= Adapter->BufferCount;
-
-              Adapter->Statistics.RcvGoodFrames++;
-            }
-
-            if (IndicatedData)
-                NdisMEthIndicateReceiveComplete(Adapter->MiniportAdapterHandle);
+          Received += MiReceive(Adapter, Budget - Received);
         }
       if(Data & CSR0_TINT)
         {
@@ -215,6 +291,32 @@ MiniportHandleInterrupt(
       NdisRawReadPortUshort(Adapter->PortOffset + RDP, &Data);
     }
 
+  /* adapt the receive moderation to what came in */
+  if (Adapter->HasSoftwareTimer)
+    {
+      Moderation = Adapter->RxModeration;
+      if (Received >= Budget)
+        Moderation = Moderation ? max(Moderation / 2, RX_MODERATION_MIN) : RX_MODERATION_START;
+      else if (Received >= RX_MODERATION_BURST)
+        {
+          if (!Moderation)
+            Moderation = RX_MODERATION_START;
+        }
+      else if (Moderation)
+        {
+          Moderation *= 2;
+          if (Moderation > RX_MODERATION_MAX)
+            Moderation = 0;
+        }
+
+      if (Moderation != Adapter->RxModeration)
+        {
+          DPRINT("%d frames, receive moderation %d\n", Received, Moderation);
+          Adapter->RxModeration = Moderation;
+          NdisMSynchronizeWithInterrupt(&Adapter->InterruptObject, MiSyncRxModeration, Adapter);
+        }
+    }
+
   /* re-enable interrupts */
   NdisRawWritePortUshort(Adapter->PortOffset + RDP, CSR0_IENA);
 
@@ -684,6 +786,7 @@ MiInitChip(
  */
 {
   USHORT Data = 0;
+  ULONG ChipId;
 
   DPRINT("Called\n");
 
@@ -704,6 +807,21 @@ MiInitChip(
 
   DPRINT("chip stopped\n");
 
+  /* the software timer used for receive moderation came with the Am79C972 */
+  NdisRawWritePortUshort(Adapter->PortOffset + RAP, CSR88);
+  NdisRawReadPortUshort(Adapter->PortOffset + RDP, &Data);
+  ChipId = Data;
+  NdisRawWritePortUshort(Adapter->PortOffset + RAP, CSR89);
+  NdisRawReadPortUshort(Adapter->PortOffset + RDP, &Data);
+  ChipId |= (ULONG)Data << 16;
+
+  DPRINT("chip id 0x%x\n", ChipId);
+
+  Adapter->HasSoftwareTimer = CHIP_PART_ID(ChipId) == PART_ID_AM79C972 ||
+                              CHIP_PART_ID(ChipId) == PART_ID_AM79C973 ||
+                              CHIP_PART_ID(ChipId) == PART_ID_AM79C975;
+  Adapter->RxModeration = 0;
+
   /* set the software style to 2 (32 bits) */
   NdisRawWritePortUshort(Adapter->PortOffset + RAP, CSR58);
   NdisRawReadPortUshort(Adapter->PortOffset + RDP, &Data);
@@ -105,6 +105,10 @@ typedef struct _ADAPTER
   ULONG BufferCount;
   ULONG LogBufferCount;
 
+  /* receive interrupt moderation */
+  BOOLEAN HasSoftwareTimer;
+  ULONG RxModeration;
+
   ADAPTER_STATS Statistics;
 } ADAPTER, *PADAPTER;
 
@@ -161,6 +165,22 @@ MiGetMediaDuplex(PADAPTER Adapter);
 /* Maximum number of interrupts handled per call to MiniportHandleInterrupt */
 #define INTERRUPT_LIMIT 10
 
+/* Frames received per call to MiniportHandleInterrupt when the software
+ * timer is there to pick up the rest */
+#define RECEIVE_BUDGET 64
+
+/*
+ * Receive interrupt moderation, for chips with the software timer (Am79C972
+ * and later). After a burst of frames the receive interrupt is masked and
+ * the ring is polled from the timer interrupt. The interval, in 10.24us
+ * units, shrinks while the budget runs out and grows while little comes in,
+ * until moderation is turned off again
+ */
+#define RX_MODERATION_BURST 8
+#define RX_MODERATION_MIN   5
+#define RX_MODERATION_START 12
+#define RX_MODERATION_MAX   100
+
 /* memory pool tag */
 #define PCNET_TAG 'tNcP'
 
@@ -67,6 +67,7 @@
 #define CSR4   0x4      /* test and features control */
 #define CSR5   0x5      /* extended control and interrupt */
 #define CSR6   0x6      /* rx/tx descriptor table length */
+#define CSR7   0x7      /* extended control and interrupt 2 */
 #define CSR8   0x8      /* logical address filter 0 */
 #define CSR9   0x9      /* logical address filter 1 */
 #define CSR10  0xa      /* logical address filter 2 */
@@ -148,6 +149,7 @@
 #define BCR20  0x14     /* software style */
 #define BCR21  0x15     /* interrupt control */
 #define BCR22  0x16     /* pci latency register */
+#define BCR31  0x1f     /* software timer value */
 
 /* CSR0 bits */
 #define CSR0_INIT  0x1          /* read initialization block */
@@ -214,6 +216,17 @@
 #define CSR5_LTINTEN   0x4000   /* last transmit interrupt enable */
 #define CSR5_TOKINTD   0x8000   /* transmit ok interrupt disable */
 
+/* CSR7 bits */
+#define CSR7_STINTE    0x400    /* software timer interrupt enable */
+#define CSR7_STINT     0x800    /* software timer interrupt */
+#define CSR7_INTERRUPTS 0xaaa   /* interrupt flags, written as 1 to clear */
+
+/* chip id (CSR89:CSR88) */
+#define CHIP_PART_ID(x)     (((x) >> 12) & 0xffff)
+#define PART_ID_AM79C972    0x2624  /* PCnet-FAST+ */
+#define PART_ID_AM79C973    0x2625  /* PCnet-FAST III */
+#define PART_ID_AM79C975    0x2627  /* PCnet-FAST III */
+
 /* CSR15 bits */
 #define CSR15_DRX      0x1      /* disable receiver */
 #define CSR15_DTX      0x2      /* disable transmitter */
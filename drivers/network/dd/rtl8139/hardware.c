@@ -171,6 +171,38 @@ NICAcknowledgeInterrupts (
     NdisRawWritePortUshort(Adapter->IoBase + R_IS, Adapter->InterruptPending);
 }
 
+BOOLEAN
+NTAPI
+NICApplyRxModeration (
+    IN PVOID SynchronizeContext
+    )
+{
+    PRTL_ADAPTER Adapter = (PRTL_ADAPTER)SynchronizeContext;
+
+    //
+    // Runs synchronized with the ISR, which reads the mask
+    //
+    if (Adapter->RxModeration)
+    {
+        Adapter->InterruptMask &= ~R_I_RXOK;
+    }
+    else
+    {
+        Adapter->InterruptMask |= R_I_RXOK;
+    }
+
+    NdisRawWritePortUlong(Adapter->IoBase + R_TINTR, Adapter->RxModeration);
+
+    //
+    // Any write restarts the timer from zero
+    //
+    NdisRawWritePortUlong(Adapter->IoBase + R_TCTR, 0);
+
+    NdisRawWritePortUshort(Adapter->IoBase + R_IM, Adapter->InterruptMask);
+
+    return TRUE;
+}
+
 VOID
 NTAPI
 NICUpdateLinkStatus (
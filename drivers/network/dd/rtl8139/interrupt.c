@@ -82,6 +82,8 @@ MiniportHandleInterrupt (
     UCHAR command;
     PPACKET_HEADER nicHeader;
     PETH_HEADER ethHeader;
+    ULONG received = 0;
+    ULONG moderation;
         
     NdisDprAcquireSpinLock(&adapter->Lock);
     
@@ -141,11 +143,12 @@ MiniportHandleInterrupt (
     }
     
     //
-    // Handle a good RX interrupt
+    // Handle a good RX interrupt, or a timer tick while RX is polled
     //
-    if (adapter->InterruptPending & (R_I_RXOK | R_I_RXERR))
+    if ((adapter->InterruptPending & (R_I_RXOK | R_I_RXERR | R_I_TIMEOUT)) ||
+        adapter->RxModeration)
     {
-        for (;;)
+        while (received < RX_DPC_BUDGET)
         {
             NdisRawReadPortUchar(adapter->IoBase + R_CMD, &command);
             if (command & R_CMD_RXEMPTY)
@@ -194,6 +197,7 @@ MiniportHandleInterrupt (
                                     nicHeader->PacketLength - sizeof(ETH_HEADER) - RECV_CRC_LENGTH,
                                     nicHeader->PacketLength - sizeof(ETH_HEADER) - RECV_CRC_LENGTH);
             adapter->ReceiveOk++;
+            received++;
             
         NextPacket:
             adapter->ReceiveOffset += nicHeader->PacketLength + sizeof(PACKET_HEADER);
@@ -211,6 +215,52 @@ MiniportHandleInterrupt (
         }
         
         NdisMEthIndicateReceiveComplete(adapter->MiniportAdapterHandle);
+
+        //
+        // Adapt the moderation to what this DPC found
+        //
+        moderation = adapter->RxModeration;
+        if (received >= RX_DPC_BUDGET)
+        {
+            //
+            // Frames are still waiting, poll sooner
+            //
+            moderation = moderation ? max(moderation / 2, RX_MODERATION_MIN) :
+                                      RX_MODERATION_START;
+        }
+        else if (received >= RX_MODERATION_BURST)
+        {
+            if (!moderation)
+            {
+                moderation = RX_MODERATION_START;
+            }
+        }
+        else if (moderation)
+        {
+            //
+            // The load dropped, back to an interrupt per frame once the
+            // interval gets long
+            //
+            moderation *= 2;
+            if (moderation > RX_MODERATION_MAX)
+            {
+                moderation = 0;
+            }
+        }
+
+        //
+        // The timer is restarted on every tick
+        //
+        if (moderation || adapter->RxModeration)
+        {
+            NDIS_DbgPrint(MAX_TRACE, ("%d frames, moderation %d\n", received, moderation));
+            adapter->RxModeration = moderation;
+            NdisMSynchronizeWithInterrupt(&adapter->Interrupt,
+                                          NICApplyRxModeration,
+                                          adapter);
+        }
+
+        adapter->InterruptPending &= ~R_I_TIMEOUT;
     }
     
     NdisDprReleaseSpinLock(&adapter->Lock);
@@ -33,6 +33,18 @@
 // 2048 byte DMA bursts
 #define TC_VAL (0x700)
 
+// Frames handled per DPC before the rest is left for the next one
+#define RX_DPC_BUDGET 64
+
+// Receive interrupt moderation: once a DPC finds a burst of frames, receive
+// interrupts are masked and the ring is polled from the timer interrupt.
+// The interval (in 33 MHz PCI clocks) shrinks while DPCs run out of budget
+// and grows while they find little, until moderation is turned off again
+#define RX_MODERATION_BURST 8
+#define RX_MODERATION_MIN   (33 * 50)
+#define RX_MODERATION_START (33 * 125)
+#define RX_MODERATION_MAX   (33 * 1000)
+
 typedef struct _RTL_ADAPTER {
     NDIS_HANDLE MiniportAdapterHandle;
     NDIS_SPIN_LOCK Lock;
@@ -68,6 +80,7 @@ typedef struct _RTL_ADAPTER {
     
     USHORT InterruptMask;
     USHORT InterruptPending;
+    ULONG RxModeration;
     
     UCHAR DirtyTxDesc;
     UCHAR CurrentTxDesc;
@@ -161,6 +174,12 @@ NICUpdateLinkStatus (
     IN PRTL_ADAPTER Adapter
     );
 
+BOOLEAN
+NTAPI
+NICApplyRxModeration (
+    IN PVOID SynchronizeContext
+    );
+
 NDIS_STATUS
 NTAPI
 NICTransmitPacket (
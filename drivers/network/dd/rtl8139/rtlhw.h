@@ -62,6 +62,7 @@
 #define R_I_RXUNDRUN    0x0020  //Receive underrun
 #define R_I_FIFOOVR     0x0040  //FIFO overflow
 #define R_I_PCSTMOUT    0x4000  //PCS timeout
+#define R_I_TIMEOUT     0x4000  //TCTR reached TINTR (same bit as above)
 #define R_I_PCIERR      0x8000  //PCI error
 
 #define R_RC            0x44    //Receive configuration register
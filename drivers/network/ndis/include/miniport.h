@@ -83,6 +83,9 @@ typedef struct _NDIS_WRAPPER_CONTEXT {
 
 #define GET_MINIPORT_DRIVER(Handle)((PNDIS_M_DRIVER_BLOCK)Handle)
 
+/* Most queued sends handed to a miniport's SendPackets handler at once */
+#define MINIPORT_SEND_BATCH 32
+
 /* Information about a logical adapter */
 typedef struct _LOGICAL_ADAPTER
 {
@@ -1226,6 +1226,8 @@ MiniportWorker(IN PDEVICE_OBJECT DeviceObject, IN PVOID Context)
   PVOID WorkItemContext;
   NDIS_WORK_ITEM_TYPE WorkItemType;
   BOOLEAN AddressingReset;
+  PNDIS_PACKET SendArray[MINIPORT_SEND_BATCH];
+  UINT SendCount = 0, SendLimit;
 
   IoFreeWorkItem((PIO_WORKITEM)Context);
 
@@ -1235,6 +1237,26 @@ MiniportWorker(IN PDEVICE_OBJECT DeviceObject, IN PVOID Context)
       MiniDequeueWorkItem
       (Adapter, &WorkItemType, &WorkItemContext);
 
+  if (NdisStatus == NDIS_STATUS_SUCCESS &&
+      WorkItemType == NdisWorkItemSend &&
+      Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendPacketsHandler &&
+      (Adapter->NdisMiniportBlock.Flags & NDIS_ATTRIBUTE_DESERIALIZE))
+  {
+      /* A deserialized miniport queues and completes sends itself, so it
+       * gets every send that piled up behind this one in a single call */
+      SendLimit = min(MINIPORT_SEND_BATCH,
+                      max(Adapter->NdisMiniportBlock.MaxSendPackets, 1));
+
+      SendArray[SendCount++] = WorkItemContext;
+      while (SendCount < SendLimit &&
+             Adapter->WorkQueueHead &&
+             Adapter->WorkQueueHead->WorkItemType == NdisWorkItemSend)
+      {
+          MiniDequeueWorkItem(Adapter, &WorkItemType, (PVOID*)&SendArray[SendCount]);
+          SendCount++;
+      }
+  }
+
   KeReleaseSpinLock(&Adapter->NdisMiniportBlock.Lock, OldIrql);
 
   if (NdisStatus == NDIS_STATUS_SUCCESS)
@@ -1250,9 +1272,9 @@ MiniportWorker(IN PDEVICE_OBJECT DeviceObject, IN PVOID Context)
               {
                 if(Adapter->NdisMiniportBlock.Flags & NDIS_ATTRIBUTE_DESERIALIZE)
                 {
-                    NDIS_DbgPrint(MAX_TRACE, ("Calling miniport's SendPackets handler\n"));
+                    NDIS_DbgPrint(MAX_TRACE, ("Calling miniport's SendPackets handler with %u packets\n", SendCount));
                     (*Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendPacketsHandler)(
-                     Adapter->NdisMiniportBlock.MiniportAdapterContext, (PPNDIS_PACKET)&WorkItemContext, 1);
+                     Adapter->NdisMiniportBlock.MiniportAdapterContext, SendArray, SendCount);
                     NdisStatus = NDIS_STATUS_PENDING;
                 }
                 else
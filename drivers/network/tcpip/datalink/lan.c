@@ -20,14 +20,6 @@ UINT TransferDataCompleteCalled = 0;
 #define CCS_ROOT L"\\Registry\\Machine\\SYSTEM\\CurrentControlSet"
 #define TCPIP_GUID L"{4D36E972-E325-11CE-BFC1-08002BE10318}"
 
-typedef struct _LAN_WQ_ITEM {
-    LIST_ENTRY ListEntry;
-    PNDIS_PACKET Packet;
-    PLAN_ADAPTER Adapter;
-    UINT BytesTransferred;
-    BOOLEAN LegacyReceive;
-} LAN_WQ_ITEM, *PLAN_WQ_ITEM;
-
 typedef struct _RECONFIGURE_CONTEXT {
     ULONG State;
     PLAN_ADAPTER Adapter;
@@ -38,6 +30,9 @@ BOOLEAN ProtocolRegistered     = FALSE;
 LIST_ENTRY AdapterListHead;
 KSPIN_LOCK AdapterListLock;
 
+/* Receive work items, one per indicated packet */
+static NPAGED_LOOKASIDE_LIST LanWorkItemList;
+
 NDIS_STATUS NDISCall(
     PLAN_ADAPTER Adapter,
     NDIS_REQUEST_TYPE Type,
@@ -304,25 +299,15 @@ VOID NTAPI ProtocolSendComplete(
     FreeNdisPacket(Packet);
 }
 
-VOID LanReceiveWorker( PVOID Context ) {
+static VOID LanReceive(
+    PLAN_ADAPTER Adapter,
+    PNDIS_PACKET Packet,
+    UINT BytesTransferred,
+    BOOLEAN LegacyReceive) {
     ULONG PacketType;
-    PLAN_WQ_ITEM WorkItem = (PLAN_WQ_ITEM)Context;
-    PNDIS_PACKET Packet;
-    PLAN_ADAPTER Adapter;
-    UINT BytesTransferred;
     IP_PACKET IPPacket;
-    BOOLEAN LegacyReceive;
     PIP_INTERFACE Interface;
 
-    TI_DbgPrint(DEBUG_DATALINK, ("Called.\n"));
-
-    Packet = WorkItem->Packet;
-    Adapter = WorkItem->Adapter;
-    BytesTransferred = WorkItem->BytesTransferred;
-    LegacyReceive = WorkItem->LegacyReceive;
-
-    ExFreePoolWithTag(WorkItem, WQ_CONTEXT_TAG);
-
     Interface = Adapter->Context;
 
     IPInitializePacket(&IPPacket, 0);
@@ -365,8 +350,36 @@ VOID LanReceiveWorker( PVOID Context ) {
 	 ("Ether Type = %x Total = %d\n",
 	  PacketType, IPPacket.TotalSize));
 
-    /* Update interface stats */
-    Interface->Stats.InBytes += IPPacket.TotalSize + Adapter->HeaderSize;
+    /* Update interface stats, other processors may be receiving too */
+    InterlockedExchangeAdd((PLONG)&Interface->Stats.InBytes,
+                           IPPacket.TotalSize + Adapter->HeaderSize);
+
+    /* Pick up the checksums the adapter verified for us */
+    if (PacketType == ETYPE_IPv4 && !LegacyReceive &&
+        (Interface->ChecksumOffload & IP_CHECKSUM_OFFLOAD_RX))
+    {
+        NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
+
+        ChecksumInfo.Value = PtrToUlong(NDIS_PER_PACKET_INFO_FROM_PACKET(Packet,
+                                                                         TcpIpChecksumPacketInfo));
+
+        if (ChecksumInfo.Receive.NdisPacketIpChecksumFailed ||
+            ChecksumInfo.Receive.NdisPacketTcpChecksumFailed ||
+            ChecksumInfo.Receive.NdisPacketUdpChecksumFailed)
+        {
+            TI_DbgPrint(DEBUG_DATALINK, ("Adapter reported a bad checksum\n"));
+            InterlockedIncrement((PLONG)&Interface->Stats.InErrors);
+            IPPacket.Free(&IPPacket);
+            return;
+        }
+
+        if (ChecksumInfo.Receive.NdisPacketIpChecksumSucceeded)
+            IPPacket.Flags |= IP_PACKET_FLAG_IP_CHECKSUM_OK;
+        if (ChecksumInfo.Receive.NdisPacketTcpChecksumSucceeded)
+            IPPacket.Flags |= IP_PACKET_FLAG_TCP_CHECKSUM_OK;
+        if (ChecksumInfo.Receive.NdisPacketUdpChecksumSucceeded)
+            IPPacket.Flags |= IP_PACKET_FLAG_UDP_CHECKSUM_OK;
+    }
 
     /* NDIS packet is freed in all of these cases */
     switch (PacketType) {
@@ -385,13 +398,73 @@ VOID LanReceiveWorker( PVOID Context ) {
     }
 }
 
+VOID LANProcessReceive(
+    PLAN_WQ_ITEM WorkItem)
+/*
+ * FUNCTION: Processes a received packet, called by the receive threads
+ * ARGUMENTS:
+ *     WorkItem = Received packet, freed on return
+ */
+{
+    PLAN_ADAPTER Adapter = WorkItem->Adapter;
+
+    TI_DbgPrint(DEBUG_DATALINK, ("Called.\n"));
+
+    LanReceive(Adapter,
+               WorkItem->Packet,
+               WorkItem->BytesTransferred,
+               WorkItem->LegacyReceive);
+
+    ExFreeToNPagedLookasideList(&LanWorkItemList, WorkItem);
+
+    InterlockedDecrement(&Adapter->ReceivesPending);
+}
+
+static ULONG LanFlowHash(
+    PLAN_ADAPTER Adapter,
+    PNDIS_PACKET Packet,
+    BOOLEAN LegacyReceive)
+/*
+ * FUNCTION: Computes the receive hash of a received packet
+ * NOTES:
+ *     Only the first buffer is looked at, the headers are in it for
+ *     pretty much every packet and anything else hashes to 0
+ */
+{
+    PNDIS_BUFFER NdisBuffer;
+    PUCHAR Data;
+    UINT FirstLength, TotalLength;
+
+    NdisGetFirstBufferFromPacket(Packet,
+                                 &NdisBuffer,
+                                 (PVOID*)&Data,
+                                 &FirstLength,
+                                 &TotalLength);
+    if (!Data)
+        return 0;
+
+    if (LegacyReceive)
+    {
+        /* Transferred packets start at the network header */
+        if (PC(Packet)->PacketType != ETYPE_IPv4)
+            return 0;
+
+        return LANRssHash(Data, FirstLength);
+    }
+
+    if (FirstLength < Adapter->HeaderSize ||
+        ((PETH_HEADER)Data)->EType != ETYPE_IPv4)
+        return 0;
+
+    return LANRssHash(Data + Adapter->HeaderSize, FirstLength - Adapter->HeaderSize);
+}
+
 VOID LanSubmitReceiveWork(
     NDIS_HANDLE BindingContext,
     PNDIS_PACKET Packet,
     UINT BytesTransferred,
     BOOLEAN LegacyReceive) {
-    PLAN_WQ_ITEM WQItem = ExAllocatePoolWithTag(NonPagedPool, sizeof(LAN_WQ_ITEM),
-                                                WQ_CONTEXT_TAG);
+    PLAN_WQ_ITEM WQItem = ExAllocateFromNPagedLookasideList(&LanWorkItemList);
     PLAN_ADAPTER Adapter = (PLAN_ADAPTER)BindingContext;
 
     TI_DbgPrint(DEBUG_DATALINK,("called\n"));
@@ -403,8 +476,9 @@ VOID LanSubmitReceiveWork(
     WQItem->BytesTransferred = BytesTransferred;
     WQItem->LegacyReceive = LegacyReceive;
 
-    if (!ChewCreate( LanReceiveWorker, WQItem ))
-        ExFreePoolWithTag(WQItem, WQ_CONTEXT_TAG);
+    InterlockedIncrement(&Adapter->ReceivesPending);
+
+    LANQueueReceive(WQItem, LanFlowHash(Adapter, Packet, LegacyReceive));
 }
 
 VOID NTAPI ProtocolTransferDataComplete(
@@ -1006,6 +1080,12 @@ VOID LANTransmit(
 
     RtlCopyMemory(Data + Adapter->HeaderSize, OldData, OldSize);
 
+    /* Carry over any checksum and large send offload request */
+    NDIS_PER_PACKET_INFO_FROM_PACKET(XmitPacket, TcpIpChecksumPacketInfo) =
+        NDIS_PER_PACKET_INFO_FROM_PACKET(NdisPacket, TcpIpChecksumPacketInfo);
+    NDIS_PER_PACKET_INFO_FROM_PACKET(XmitPacket, TcpLargeSendPacketInfo) =
+        NDIS_PER_PACKET_INFO_FROM_PACKET(NdisPacket, TcpLargeSendPacketInfo);
+
     (*PC(NdisPacket)->DLComplete)(PC(NdisPacket)->Context, NdisPacket, NDIS_STATUS_SUCCESS);
 
     switch (Adapter->Media) {
@@ -1056,12 +1136,6 @@ VOID LANTransmit(
 		   ((PCHAR)LinkAddress)[5] & 0xff));
 	}
 
-    if (Adapter->MTU < Size) {
-        /* This is NOT a pointer. MSDN explicitly says so. */
-        NDIS_PER_PACKET_INFO_FROM_PACKET(NdisPacket,
-                                         TcpLargeSendPacketInfo) = (PVOID)((ULONG_PTR)Adapter->MTU);
-    }
-
     /* Update interface stats */
     Interface->Stats.OutBytes += Size;
 
@@ -1309,6 +1383,183 @@ VOID GetName( PUNICODE_STRING RegistryKey,
     AppendUnicodeString( OutName, &PartialRegistryKey, FALSE );
 }
 
+/* Room for the offload header and every task a miniport might report */
+#define TASK_OFFLOAD_BUFFER_SIZE 512
+
+VOID LANEnableTaskOffload(
+    PLAN_ADAPTER Adapter,
+    PIP_INTERFACE IF)
+/*
+ * FUNCTION: Turns on the checksum and large send offloads the adapter supports
+ * ARGUMENTS:
+ *     Adapter = Pointer to LAN_ADAPTER structure
+ *     IF      = Interface that records which offloads are in use
+ * NOTES:
+ *     Only IPv4 TCP transmit checksums and receive checksum results are
+ *     used. lwIP always sends TCP options (timestamps), so transmit
+ *     offload needs an adapter that copes with them. Large send relies on
+ *     the adapter checksumming the segments it cuts, so it is only turned
+ *     on together with TCP transmit checksums
+ */
+{
+    NDIS_STATUS NdisStatus;
+    PNDIS_TASK_OFFLOAD_HEADER Header;
+    PNDIS_TASK_OFFLOAD Task;
+    PNDIS_TASK_TCP_IP_CHECKSUM Checksum, EnableChecksum;
+    PNDIS_TASK_TCP_LARGE_SEND LargeSend, EnableLargeSend;
+    NDIS_TASK_TCP_IP_CHECKSUM Supported;
+    NDIS_TASK_TCP_LARGE_SEND SupportedLargeSend;
+    ULONG Offset, Length;
+
+    IF->ChecksumOffload = 0;
+    IF->LargeSendSize = 0;
+    IF->LargeSendMinSegments = 0;
+
+    if (Adapter->Media != NdisMedium802_3)
+        return;
+
+    Header = ExAllocatePoolWithTag(NonPagedPool, TASK_OFFLOAD_BUFFER_SIZE, TASK_OFFLOAD_TAG);
+    if (!Header)
+        return;
+
+    RtlZeroMemory(Header, TASK_OFFLOAD_BUFFER_SIZE);
+    Header->Version = NDIS_TASK_OFFLOAD_VERSION;
+    Header->Size = sizeof(NDIS_TASK_OFFLOAD_HEADER);
+    Header->EncapsulationFormat.Encapsulation = IEEE_802_3_Encapsulation;
+    Header->EncapsulationFormat.Flags.FixedHeaderSize = 1;
+    Header->EncapsulationFormat.EncapsulationHeaderSize = Adapter->HeaderSize;
+
+    NdisStatus = NDISCall(Adapter,
+                          NdisRequestQueryInformation,
+                          OID_TCP_TASK_OFFLOAD,
+                          Header,
+                          TASK_OFFLOAD_BUFFER_SIZE);
+    if (NdisStatus != NDIS_STATUS_SUCCESS) {
+        TI_DbgPrint(DEBUG_DATALINK, ("No task offload support (0x%X).\n", NdisStatus));
+        ExFreePoolWithTag(Header, TASK_OFFLOAD_TAG);
+        return;
+    }
+
+    /* Find the checksum and large send tasks */
+    Checksum = NULL;
+    LargeSend = NULL;
+    Offset = Header->OffsetFirstTask;
+    while (Offset != 0 &&
+           Offset + FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) <= TASK_OFFLOAD_BUFFER_SIZE)
+    {
+        Task = (PNDIS_TASK_OFFLOAD)((PUCHAR)Header + Offset);
+        Length = Offset + FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) + Task->TaskBufferLength;
+
+        if (Length <= TASK_OFFLOAD_BUFFER_SIZE)
+        {
+            if (Task->Task == TcpIpChecksumNdisTask &&
+                Task->TaskBufferLength >= sizeof(NDIS_TASK_TCP_IP_CHECKSUM))
+            {
+                Checksum = (PNDIS_TASK_TCP_IP_CHECKSUM)Task->TaskBuffer;
+            }
+            else if (Task->Task == TcpLargeSendNdisTask &&
+                     Task->TaskBufferLength >= sizeof(NDIS_TASK_TCP_LARGE_SEND))
+            {
+                LargeSend = (PNDIS_TASK_TCP_LARGE_SEND)Task->TaskBuffer;
+            }
+        }
+
+        /* The next task is relative to this one */
+        if (Task->OffsetNextTask == 0)
+            break;
+        Offset += Task->OffsetNextTask;
+    }
+
+    if (!Checksum) {
+        ExFreePoolWithTag(Header, TASK_OFFLOAD_TAG);
+        return;
+    }
+
+    /* The request is built in the same buffer and may overwrite it */
+    Supported = *Checksum;
+    if (LargeSend)
+        SupportedLargeSend = *LargeSend;
+
+    if (Supported.V4Transmit.TcpChecksum && Supported.V4Transmit.TcpOptionsSupported)
+        IF->ChecksumOffload |= IP_CHECKSUM_OFFLOAD_TX_TCP;
+    if (Supported.V4Receive.IpChecksum || Supported.V4Receive.TcpChecksum ||
+        Supported.V4Receive.UdpChecksum)
+        IF->ChecksumOffload |= IP_CHECKSUM_OFFLOAD_RX;
+
+    /* Anything smaller than two full segments is not worth the trouble */
+    if (LargeSend &&
+        (IF->ChecksumOffload & IP_CHECKSUM_OFFLOAD_TX_TCP) &&
+        SupportedLargeSend.Version == NDIS_TASK_TCP_LARGE_SEND_V0 &&
+        SupportedLargeSend.TcpOptions &&
+        SupportedLargeSend.MaxOffLoadSize >= 2 * IF->MTU)
+    {
+        IF->LargeSendSize = min(SupportedLargeSend.MaxOffLoadSize, IP_MAXIMUM_LARGE_SEND);
+        IF->LargeSendMinSegments = max(SupportedLargeSend.MinSegmentCount, 2);
+    }
+
+    Task = (PNDIS_TASK_OFFLOAD)(Header + 1);
+    EnableChecksum = (PNDIS_TASK_TCP_IP_CHECKSUM)Task->TaskBuffer;
+
+    RtlZeroMemory(Task, FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) + sizeof(NDIS_TASK_TCP_IP_CHECKSUM));
+    EnableChecksum->V4Receive = Supported.V4Receive;
+    if (IF->ChecksumOffload & IP_CHECKSUM_OFFLOAD_TX_TCP) {
+        EnableChecksum->V4Transmit.TcpOptionsSupported = 1;
+        EnableChecksum->V4Transmit.TcpChecksum = 1;
+    }
+
+    Header->OffsetFirstTask = sizeof(NDIS_TASK_OFFLOAD_HEADER);
+    Task->Version = NDIS_TASK_OFFLOAD_VERSION;
+    Task->Size = sizeof(NDIS_TASK_OFFLOAD);
+    Task->Task = TcpIpChecksumNdisTask;
+    Task->OffsetNextTask = 0;
+    Task->TaskBufferLength = sizeof(NDIS_TASK_TCP_IP_CHECKSUM);
+    Length = sizeof(NDIS_TASK_OFFLOAD_HEADER) +
+             FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) +
+             sizeof(NDIS_TASK_TCP_IP_CHECKSUM);
+
+    if (IF->LargeSendSize) {
+        /* Keep the tasks aligned like the query results are */
+        Task->OffsetNextTask = ALIGN_UP_BY(FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) +
+                                           sizeof(NDIS_TASK_TCP_IP_CHECKSUM), sizeof(ULONG));
+        Task = (PNDIS_TASK_OFFLOAD)((PUCHAR)Task + Task->OffsetNextTask);
+        EnableLargeSend = (PNDIS_TASK_TCP_LARGE_SEND)Task->TaskBuffer;
+
+        RtlZeroMemory(Task, FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) + sizeof(NDIS_TASK_TCP_LARGE_SEND));
+        Task->Version = NDIS_TASK_OFFLOAD_VERSION;
+        Task->Size = sizeof(NDIS_TASK_OFFLOAD);
+        Task->Task = TcpLargeSendNdisTask;
+        Task->OffsetNextTask = 0;
+        Task->TaskBufferLength = sizeof(NDIS_TASK_TCP_LARGE_SEND);
+        EnableLargeSend->Version = NDIS_TASK_TCP_LARGE_SEND_V0;
+        EnableLargeSend->MaxOffLoadSize = IF->LargeSendSize;
+        EnableLargeSend->MinSegmentCount = IF->LargeSendMinSegments;
+        EnableLargeSend->TcpOptions = TRUE;
+        EnableLargeSend->IpOptions = FALSE;
+        Length = (ULONG)((PUCHAR)Task - (PUCHAR)Header) +
+                 FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) +
+                 sizeof(NDIS_TASK_TCP_LARGE_SEND);
+    }
+
+    if (IF->ChecksumOffload) {
+        NdisStatus = NDISCall(Adapter,
+                              NdisRequestSetInformation,
+                              OID_TCP_TASK_OFFLOAD,
+                              Header,
+                              Length);
+        if (NdisStatus != NDIS_STATUS_SUCCESS) {
+            TI_DbgPrint(MIN_TRACE, ("Could not enable task offload (0x%X).\n", NdisStatus));
+            IF->ChecksumOffload = 0;
+            IF->LargeSendSize = 0;
+            IF->LargeSendMinSegments = 0;
+        }
+    }
+
+    TI_DbgPrint(DEBUG_DATALINK, ("Checksum offload flags 0x%x, large send %u bytes\n",
+                                 IF->ChecksumOffload, IF->LargeSendSize));
+
+    ExFreePoolWithTag(Header, TASK_OFFLOAD_TAG);
+}
+
 BOOLEAN BindAdapter(
     PLAN_ADAPTER Adapter,
     PNDIS_STRING RegistryPath)
@@ -1410,6 +1661,9 @@ BOOLEAN BindAdapter(
     if (NdisStatus != NDIS_STATUS_SUCCESS)
         return FALSE;
 
+    /* Let the adapter do checksums if it can */
+    LANEnableTaskOffload(Adapter, IF);
+
     /* Register interface with IP layer */
     IPRegisterInterface(IF);
 
@@ -1507,6 +1761,7 @@ NDIS_STATUS LANRegisterAdapter(
     /* Initialize protecting spin lock */
     KeInitializeSpinLock(&IF->Lock);
 
+
     KeInitializeEvent(&IF->Event, SynchronizationEvent, FALSE);
 
     /* Initialize array with media IDs we support */
@@ -1641,6 +1896,15 @@ NDIS_STATUS LANUnregisterAdapter(
     } else
         TcpipReleaseSpinLock(&Adapter->Lock, OldIrql);
 
+    /* Nothing is indicated anymore, let the receive threads finish. The
+     * unload path calls this under the adapter list lock and can't wait */
+    while (Adapter->ReceivesPending && KeGetCurrentIrql() == PASSIVE_LEVEL) {
+        LARGE_INTEGER Interval;
+
+        Interval.QuadPart = -10 * 1000 * 10; /* 10 ms */
+        KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+    }
+
     FreeAdapter(Adapter);
 
     return NdisStatus;
@@ -1679,6 +1943,9 @@ LANUnregisterProtocol(VOID)
 
         NdisDeregisterProtocol(&NdisStatus, NdisProtocolHandle);
         ProtocolRegistered = FALSE;
+
+        LANStopReceiveQueues();
+        ExDeleteNPagedLookasideList(&LanWorkItemList);
     }
 }
 
@@ -1704,6 +1971,7 @@ NTSTATUS LANRegisterProtocol(
  */
 {
     NDIS_STATUS NdisStatus;
+    NTSTATUS Status;
     NDIS_PROTOCOL_CHARACTERISTICS ProtChars;
 
     TI_DbgPrint(DEBUG_DATALINK, ("Called.\n"));
@@ -1711,6 +1979,22 @@ NTSTATUS LANRegisterProtocol(
     InitializeListHead(&AdapterListHead);
     KeInitializeSpinLock(&AdapterListLock);
 
+    /* Bindings can come in as soon as the protocol is registered */
+    ExInitializeNPagedLookasideList(&LanWorkItemList,
+                                    NULL,
+                                    NULL,
+                                    0,
+                                    sizeof(LAN_WQ_ITEM),
+                                    WQ_CONTEXT_TAG,
+                                    0);
+
+    Status = LANStartReceiveQueues();
+    if (!NT_SUCCESS(Status))
+    {
+        ExDeleteNPagedLookasideList(&LanWorkItemList);
+        return Status;
+    }
+
     /* Set up protocol characteristics */
     RtlZeroMemory(&ProtChars, sizeof(NDIS_PROTOCOL_CHARACTERISTICS));
     ProtChars.MajorNdisVersion               = NDIS_VERSION_MAJOR;
@@ -1742,6 +2026,8 @@ NTSTATUS LANRegisterProtocol(
     if (NdisStatus != NDIS_STATUS_SUCCESS)
     {
         TI_DbgPrint(DEBUG_DATALINK, ("NdisRegisterProtocol failed, status 0x%x\n", NdisStatus));
+        LANStopReceiveQueues();
+        ExDeleteNPagedLookasideList(&LanWorkItemList);
         return (NTSTATUS)NdisStatus;
     }
 
@@ -0,0 +1,278 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * FILE:        datalink/rss.c
+ * PURPOSE:     Receive side scaling
+ */
+
+#include "precomp.h"
+
+/* NDIS 5 has no way to ask a miniport for receive side scaling, so it's
+ * done here. Received frames are hashed the way RSS hardware hashes them
+ * and the indirection table picks the processor whose receive thread
+ * processes them. A flow always hashes to the same processor, so its
+ * frames stay in order and its state stays in that processor's cache */
+
+/* Hash key from the RSS specification */
+static const UCHAR LanRssKey[LAN_RSS_KEY_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+static ULONG LanRssHashTypes = LAN_RSS_HASH_IPV4 | LAN_RSS_HASH_TCP_IPV4;
+
+/* Maps the low hash bits to a receive queue */
+static UCHAR LanRssTable[LAN_RSS_TABLE_SIZE];
+
+static LAN_RECEIVE_QUEUE LanReceiveQueues[MAXIMUM_PROCESSORS];
+static ULONG LanReceiveQueueCount;
+
+
+static ULONG LanToeplitzHash(
+    PUCHAR Input,
+    UINT Length)
+/*
+ * FUNCTION: Computes the Toeplitz hash of a byte string
+ * NOTES:
+ *     Length can't be more than LAN_RSS_KEY_SIZE - 4
+ */
+{
+    ULONG Result = 0;
+    ULONG Window;
+    UINT i, Bit;
+
+    /* The 32 key bits starting at the current input bit */
+    Window = (LanRssKey[0] << 24) | (LanRssKey[1] << 16) |
+             (LanRssKey[2] << 8) | LanRssKey[3];
+
+    for (i = 0; i < Length; i++) {
+        for (Bit = 0; Bit < 8; Bit++) {
+            if (Input[i] & (0x80 >> Bit))
+                Result ^= Window;
+
+            Window = (Window << 1) | ((LanRssKey[i + 4] >> (7 - Bit)) & 1);
+        }
+    }
+
+    return Result;
+}
+
+
+ULONG LANRssHash(
+    PUCHAR IPHeader,
+    UINT Length)
+/*
+ * FUNCTION: Computes the receive hash of an IP datagram
+ * ARGUMENTS:
+ *     IPHeader = Pointer to the IP header
+ *     Length   = Number of contiguous bytes at IPHeader
+ * RETURNS:
+ *     Hash value, 0 if the datagram isn't hashed
+ */
+{
+    PIPv4_HEADER Header = (PIPv4_HEADER)IPHeader;
+    UCHAR Input[12];
+    UINT HeaderLength;
+
+    if (Length < sizeof(IPv4_HEADER) || (Header->VerIHL >> 4) != 4)
+        return 0;
+
+    HeaderLength = (Header->VerIHL & 0x0F) << 2;
+
+    RtlCopyMemory(&Input[0], &Header->SrcAddr, sizeof(IPv4_RAW_ADDRESS));
+    RtlCopyMemory(&Input[4], &Header->DstAddr, sizeof(IPv4_RAW_ADDRESS));
+
+    /* Fragments only have the addresses hashed, so they all meet on the
+     * same processor for reassembly */
+    if ((LanRssHashTypes & LAN_RSS_HASH_TCP_IPV4) &&
+        Header->Protocol == IPPROTO_TCP &&
+        !(WN2H(Header->FlagsFragOfs) & (IPv4_MF_MASK | IPv4_FRAGOFS_MASK)) &&
+        Length >= HeaderLength + 4)
+    {
+        /* Source and destination port */
+        RtlCopyMemory(&Input[8], IPHeader + HeaderLength, 4);
+        return LanToeplitzHash(Input, 12);
+    }
+
+    if (!(LanRssHashTypes & LAN_RSS_HASH_IPV4))
+        return 0;
+
+    return LanToeplitzHash(Input, 8);
+}
+
+
+VOID LANQueueReceive(
+    PLAN_WQ_ITEM WorkItem,
+    ULONG Hash)
+/*
+ * FUNCTION: Hands a received packet to the receive thread picked by its hash
+ * ARGUMENTS:
+ *     WorkItem = Received packet
+ *     Hash     = Receive hash of the packet
+ */
+{
+    PLAN_RECEIVE_QUEUE Queue;
+    BOOLEAN Wake;
+    KIRQL OldIrql;
+
+    Queue = &LanReceiveQueues[LanRssTable[Hash & (LAN_RSS_TABLE_SIZE - 1)]];
+
+    TcpipAcquireSpinLock(&Queue->Lock, &OldIrql);
+    Wake = IsListEmpty(&Queue->Queue);
+    InsertTailList(&Queue->Queue, &WorkItem->ListEntry);
+    TcpipReleaseSpinLock(&Queue->Lock, OldIrql);
+
+    /* The thread empties the queue every time it wakes up */
+    if (Wake)
+        KeSetEvent(&Queue->Event, IO_NETWORK_INCREMENT, FALSE);
+}
+
+
+static VOID NTAPI LanReceiveThread(
+    PVOID Context)
+/*
+ * FUNCTION: Processes the received packets queued for one processor
+ * ARGUMENTS:
+ *     Context = Pointer to the LAN_RECEIVE_QUEUE
+ */
+{
+    PLAN_RECEIVE_QUEUE Queue = Context;
+    PLIST_ENTRY Entry;
+    LIST_ENTRY Batch;
+    KIRQL OldIrql;
+
+    KeSetSystemAffinityThread((KAFFINITY)1 << Queue->Processor);
+    KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
+
+    for (;;) {
+        KeWaitForSingleObject(&Queue->Event, Executive, KernelMode, FALSE, NULL);
+
+        for (;;) {
+            TcpipAcquireSpinLock(&Queue->Lock, &OldIrql);
+            if (IsListEmpty(&Queue->Queue)) {
+                TcpipReleaseSpinLock(&Queue->Lock, OldIrql);
+                break;
+            }
+            Batch = Queue->Queue;
+            Batch.Flink->Blink = &Batch;
+            Batch.Blink->Flink = &Batch;
+            InitializeListHead(&Queue->Queue);
+            TcpipReleaseSpinLock(&Queue->Lock, OldIrql);
+
+            Queue->Batches++;
+
+            while (!IsListEmpty(&Batch)) {
+                Entry = RemoveHeadList(&Batch);
+                Queue->Packets++;
+                LANProcessReceive(CONTAINING_RECORD(Entry, LAN_WQ_ITEM, ListEntry));
+            }
+        }
+
+        if (Queue->Stop)
+            break;
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+
+NTSTATUS LANStartReceiveQueues(VOID)
+/*
+ * FUNCTION: Starts a receive thread on every processor and spreads the
+ *           indirection table over them
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    PLAN_RECEIVE_QUEUE Queue;
+    HANDLE ThreadHandle;
+    KAFFINITY Active;
+    NTSTATUS Status;
+    ULONG i;
+
+    Active = KeQueryActiveProcessors();
+    LanReceiveQueueCount = 0;
+
+    for (i = 0; i < MAXIMUM_PROCESSORS && i < sizeof(KAFFINITY) * 8; i++) {
+        if (!(Active & ((KAFFINITY)1 << i)))
+            continue;
+
+        Queue = &LanReceiveQueues[LanReceiveQueueCount];
+
+        KeInitializeSpinLock(&Queue->Lock);
+        InitializeListHead(&Queue->Queue);
+        KeInitializeEvent(&Queue->Event, SynchronizationEvent, FALSE);
+        Queue->Thread = NULL;
+        Queue->Processor = (CCHAR)i;
+        Queue->Stop = FALSE;
+        Queue->Packets = 0;
+        Queue->Batches = 0;
+
+        Status = PsCreateSystemThread(&ThreadHandle,
+                                      THREAD_ALL_ACCESS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      LanReceiveThread,
+                                      Queue);
+        if (!NT_SUCCESS(Status)) {
+            /* Its share of the table goes to the other processors */
+            TI_DbgPrint(MIN_TRACE, ("No receive thread for processor %lu (0x%x)\n", i, Status));
+            continue;
+        }
+
+        Status = ObReferenceObjectByHandle(ThreadHandle,
+                                           THREAD_ALL_ACCESS,
+                                           *PsThreadType,
+                                           KernelMode,
+                                           (PVOID*)&Queue->Thread,
+                                           NULL);
+        ZwClose(ThreadHandle);
+
+        if (!NT_SUCCESS(Status))
+            Queue->Thread = NULL;
+
+        LanReceiveQueueCount++;
+    }
+
+    if (!LanReceiveQueueCount)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    for (i = 0; i < LAN_RSS_TABLE_SIZE; i++)
+        LanRssTable[i] = (UCHAR)(i % LanReceiveQueueCount);
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID LANStopReceiveQueues(VOID)
+/*
+ * FUNCTION: Stops the receive threads once their queues are empty
+ */
+{
+    PLAN_RECEIVE_QUEUE Queue;
+    ULONG i;
+
+    for (i = 0; i < LanReceiveQueueCount; i++) {
+        Queue = &LanReceiveQueues[i];
+
+        Queue->Stop = TRUE;
+        KeSetEvent(&Queue->Event, IO_NETWORK_INCREMENT, FALSE);
+
+        if (Queue->Thread) {
+            KeWaitForSingleObject(Queue->Thread, Executive, KernelMode, FALSE, NULL);
+            ObDereferenceObject(Queue->Thread);
+            Queue->Thread = NULL;
+        }
+
+        TI_DbgPrint(DEBUG_DATALINK, ("Processor %d: %lu packets in %lu batches\n",
+                                     Queue->Processor, Queue->Packets, Queue->Batches));
+    }
+
+    LanReceiveQueueCount = 0;
+}
+
+/* EOF */
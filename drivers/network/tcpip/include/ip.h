@@ -91,6 +91,12 @@ typedef struct _IP_PACKET {
 } IP_PACKET, *PIP_PACKET;
 
 #define IP_PACKET_FLAG_RAW      0x01    /* Raw IP packet */
+#define IP_PACKET_FLAG_IP_CHECKSUM_OK  0x02 /* Adapter verified the IP header checksum */
+#define IP_PACKET_FLAG_TCP_CHECKSUM_OK 0x04 /* Adapter verified the TCP checksum */
+#define IP_PACKET_FLAG_UDP_CHECKSUM_OK 0x08 /* Adapter verified the UDP checksum */
+#define IP_PACKET_FLAG_CHECKSUM_OK     (IP_PACKET_FLAG_IP_CHECKSUM_OK | \
+                                        IP_PACKET_FLAG_TCP_CHECKSUM_OK | \
+                                        IP_PACKET_FLAG_UDP_CHECKSUM_OK)
 
 
 /* Packet context */
@@ -168,8 +174,16 @@ typedef struct _IP_INTERFACE {
     LL_TRANSMIT_ROUTINE Transmit; /* Pointer to transmit function */
     PVOID TCPContext;             /* TCP Content for this interface */
     SEND_RECV_STATS Stats;        /* Send/Receive statistics */
+    ULONG ChecksumOffload;        /* Checksums done by the adapter (see IP_CHECKSUM_OFFLOAD_xx below) */
+    ULONG LargeSendSize;          /* Largest TCP packet the adapter segments itself, 0 if none */
+    ULONG LargeSendMinSegments;   /* Fewest segments the adapter accepts a large send for */
 } IP_INTERFACE, *PIP_INTERFACE;
 
+#define IP_CHECKSUM_OFFLOAD_TX_TCP  0x01 /* Adapter fills in TCP checksums */
+#define IP_CHECKSUM_OFFLOAD_RX      0x02 /* Adapter reports received checksum results */
+
+#define IP_MAXIMUM_LARGE_SEND       0xFFFF /* Largest IPv4 packet an adapter can cut up */
+
 typedef struct _IP_SET_ADDRESS {
     ULONG NteIndex;
     IPv4_RAW_ADDRESS Address;
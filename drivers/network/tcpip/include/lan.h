@@ -59,8 +59,38 @@ typedef struct LAN_ADAPTER {
     UINT MacOptions;                        /* MAC options for NIC driver/adapter */
     UINT Speed;                             /* Link speed */
     UINT PacketFilter;                      /* Packet filter for this adapter */
+    volatile LONG ReceivesPending;          /* Packets queued to receive threads */
 } LAN_ADAPTER, *PLAN_ADAPTER;
 
+/* A received packet waiting for a receive thread */
+typedef struct _LAN_WQ_ITEM {
+    LIST_ENTRY ListEntry;
+    PNDIS_PACKET Packet;
+    PLAN_ADAPTER Adapter;
+    UINT BytesTransferred;
+    BOOLEAN LegacyReceive;
+} LAN_WQ_ITEM, *PLAN_WQ_ITEM;
+
+/* Receive side scaling */
+#define LAN_RSS_KEY_SIZE      40
+#define LAN_RSS_TABLE_SIZE    128   /* Indirection table entries, a power of two */
+
+/* Hash types */
+#define LAN_RSS_HASH_IPV4     0x01  /* Source and destination address */
+#define LAN_RSS_HASH_TCP_IPV4 0x02  /* Addresses and TCP ports */
+
+/* Received packets for one processor */
+typedef struct _LAN_RECEIVE_QUEUE {
+    KSPIN_LOCK Lock;                        /* Protects Queue */
+    LIST_ENTRY Queue;                       /* Packets to process */
+    KEVENT Event;                           /* Set when Queue gets packets */
+    PKTHREAD Thread;                        /* Receive thread */
+    CCHAR Processor;                        /* Processor the thread runs on */
+    BOOLEAN Stop;                           /* Thread exits once Queue is empty */
+    ULONG Packets;                          /* Packets processed there */
+    ULONG Batches;                          /* Times the thread woke up */
+} LAN_RECEIVE_QUEUE, *PLAN_RECEIVE_QUEUE;
+
 /* LAN adapter state constants */
 #define LAN_STATE_OPENING   0
 #define LAN_STATE_RESETTING 1
@@ -108,4 +138,19 @@ NDIS_STATUS NDISCall(
     PVOID Buffer,
     UINT Length);
 
+VOID LANProcessReceive(
+    PLAN_WQ_ITEM WorkItem);
+
+/* rss.c */
+NTSTATUS LANStartReceiveQueues(VOID);
+VOID LANStopReceiveQueues(VOID);
+
+ULONG LANRssHash(
+    PUCHAR IPHeader,
+    UINT Length);
+
+VOID LANQueueReceive(
+    PLAN_WQ_ITEM WorkItem,
+    ULONG Hash);
+
 /* EOF */
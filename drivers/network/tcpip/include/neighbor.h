@@ -7,7 +7,10 @@
 
 #pragma once
 
-#define NB_HASHMASK 0xF /* Hash mask for neighbor cache */
+#define NB_LOCK_COUNT  16     /* Number of neighbor cache locks */
+#define NB_MIN_BUCKETS 16     /* Initial number of hash buckets */
+#define NB_MAX_BUCKETS 16384  /* The table stops growing here */
+#define NB_WHEEL_SIZE  64     /* Number of timer wheel slots */
 
 typedef VOID (*PNEIGHBOR_PACKET_COMPLETE)
     ( PVOID Context, PNDIS_PACKET Packet, NDIS_STATUS Status );
@@ -19,17 +22,39 @@ typedef struct _NEIGHBOR_PACKET {
     PVOID Context;
 } NEIGHBOR_PACKET, *PNEIGHBOR_PACKET;
 
+/* Hash chains, replaced by a bigger array when they get too long */
+typedef struct NEIGHBOR_CACHE_BUCKETS {
+    SINGLE_LIST_ENTRY RetireEntry;      /* Must be first */
+    ULONG Mask;                         /* Number of buckets minus one */
+    struct NEIGHBOR_CACHE_ENTRY *Cache[NB_MIN_BUCKETS]; /* Grown arrays are longer */
+} NEIGHBOR_CACHE_BUCKETS, *PNEIGHBOR_CACHE_BUCKETS;
+
+/* Lookups walk the chains without a lock and retry a miss if Sequence
+ * changed meanwhile. Writers take the lock chosen by the address hash,
+ * a resize takes all of them */
 typedef struct NEIGHBOR_CACHE_TABLE {
-    struct NEIGHBOR_CACHE_ENTRY *Cache; /* Pointer to cache */
-    KSPIN_LOCK Lock;                    /* Protecting lock */
+    PNEIGHBOR_CACHE_BUCKETS Buckets;    /* Current hash chains */
+    volatile LONG Sequence;             /* Odd while the table is resized */
+    volatile LONG Count;                /* Number of NCEs in the table */
+    KSPIN_LOCK Lock[NB_LOCK_COUNT];     /* Protecting locks */
+    KSPIN_LOCK TimerLock;               /* Protects the wheel and retire list */
+    ULONG Ticks;                        /* Timeout handler invocations */
+    LIST_ENTRY Wheel[NB_WHEEL_SIZE];    /* NCEs by the tick they are due */
+    SINGLE_LIST_ENTRY Retired;          /* Memory waiting for lookups to finish */
+    BOOLEAN ReclaimPending;             /* A reclaim work item is queued */
 } NEIGHBOR_CACHE_TABLE, *PNEIGHBOR_CACHE_TABLE;
 
 /* Information about a neighbor */
 typedef struct NEIGHBOR_CACHE_ENTRY {
+    SINGLE_LIST_ENTRY RetireEntry;      /* Must be first */
     struct NEIGHBOR_CACHE_ENTRY *Next;  /* Pointer to next entry */
     UCHAR State;                        /* State of NCE */
-    UINT EventTimer;                    /* Ticks since last event */
-    UINT EventCount;                    /* Number of events */
+    BOOLEAN Removed;                    /* Unlinked, waiting to be freed */
+    ULONG Hash;                         /* Hash of the IP address */
+    UINT EventTimer;                    /* Ticks before the NCE times out */
+    ULONG EventTime;                    /* Tick of the last event */
+    ULONG TimerDue;                     /* Tick the NCE is looked at next */
+    LIST_ENTRY TimerEntry;              /* Wheel link, empty if not due */
     PIP_INTERFACE Interface;            /* Pointer to interface */
     UINT LinkAddressLength;             /* Length of link address */
     PVOID LinkAddress;                  /* Pointer to link address */
@@ -54,7 +79,7 @@ typedef struct NEIGHBOR_CACHE_ENTRY {
 /* Number of seconds before retransmission */
 #define ARP_TIMEOUT_RETRANSMISSION 3
 
-extern NEIGHBOR_CACHE_TABLE NeighborCache[NB_HASHMASK + 1];
+extern NEIGHBOR_CACHE_TABLE NeighborCache;
 
 
 VOID NBTimeout(
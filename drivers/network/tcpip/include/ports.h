@@ -10,11 +10,30 @@
 
 #pragma once
 
+#define PORT_SHARE_BUCKETS  256
+#define PORT_SHARE_ATTEMPTS 16
+#define PORT_HINT_STEP      8   /* Largest random step between two searches */
+
+/* One connection using a local port that other connections may use too */
+typedef struct _PORT_SHARE {
+    LIST_ENTRY ListEntry;
+    PVOID Owner;
+    ULONG Port;                 /* Bit index in the bitmap */
+    ULONG RemoteAddress;
+    USHORT RemotePort;          /* Network byte order */
+} PORT_SHARE, *PPORT_SHARE;
+
 typedef struct _PORT_SET {
     RTL_BITMAP ProtoBitmap;
     PVOID ProtoBitBuffer;
+    RTL_BITMAP SharedBitmap;    /* Ports only held by AllocateConnectPort */
+    PVOID SharedBitBuffer;
     UINT StartingPort;
     UINT PortsToOversee;
+    UINT PortsInUse;
+    ULONG Seed;
+    ULONG Hint[MAXIMUM_PROCESSORS];
+    LIST_ENTRY Shares[PORT_SHARE_BUCKETS];
     KSPIN_LOCK Lock;
 } PORT_SET, *PPORT_SET;
 
@@ -26,3 +45,6 @@ VOID DeallocatePort( PPORT_SET PortSet, ULONG Port );
 BOOLEAN AllocatePort( PPORT_SET PortSet, ULONG Port );
 ULONG AllocateAnyPort( PPORT_SET PortSet );
 ULONG AllocatePortFromRange( PPORT_SET PortSet, ULONG Lowest, ULONG Highest );
+ULONG AllocateConnectPort( PPORT_SET PortSet, ULONG Lowest, ULONG Highest,
+                           PVOID Owner, ULONG RemoteAddress, USHORT RemotePort );
+VOID DeallocateConnectPort( PPORT_SET PortSet, ULONG Port, PVOID Owner );
@@ -14,6 +14,12 @@
 #include <info.h>
 #include <arp.h>
 
+/* Routes cached outside the routing subsystem are valid while this is
+ * unchanged */
+extern volatile LONG RouteGeneration;
+
 PNEIGHBOR_CACHE_ENTRY RouteGetRouteToDestination(PIP_ADDRESS Destination);
 
+VOID RouteInvalidateCache(VOID);
+
 /* EOF */
@@ -9,6 +9,8 @@
 
 UINT Random(VOID);
 
+VOID SynchronizeProcessors(VOID);
+
 UINT CopyBufferToBufferChain(
     PNDIS_BUFFER DstBuffer,
     UINT DstOffset,
@@ -56,6 +56,10 @@ typedef struct _CLIENT_DATA {
     KIRQL OldIrql;
 } CLIENT_DATA, *PCLIENT_DATA;
 
+/* Local ports handed to connections that didn't bind to one */
+#define TCP_CONNECT_PORT_LOW    49152
+#define TCP_CONNECT_PORT_HIGH   65534
+
 /* Retransmission timeout constants */
 
 /* Lower bound for retransmission timeout in TCP timer ticks */
@@ -173,6 +177,10 @@ UINT TCPAllocatePort( const UINT HintPort );
 
 VOID TCPFreePort( const UINT Port );
 
+UINT TCPAllocateConnectPort( PVOID Owner, ULONG RemoteAddress, USHORT RemotePort );
+
+VOID TCPFreeConnectPort( const UINT Port, PVOID Owner );
+
 NTSTATUS TCPGetSockAddress
 ( PCONNECTION_ENDPOINT Connection,
   PTRANSPORT_ADDRESS TransportAddress,
@@ -188,6 +196,8 @@ BOOLEAN TCPRemoveIRP( PCONNECTION_ENDPOINT Connection, PIRP Irp );
 
 NTSTATUS TCPSetNoDelay(PCONNECTION_ENDPOINT Connection, BOOLEAN Set);
 
+NTSTATUS TCPSetBufferSize(PCONNECTION_ENDPOINT Connection, BOOLEAN Receive, ULONG Size);
+
 VOID
 TCPUpdateInterfaceLinkStatus(PIP_INTERFACE IF);
 
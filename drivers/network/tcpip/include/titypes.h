@@ -137,6 +137,7 @@ typedef struct _ADDRESS_FILE {
     USHORT Family;                        /* Address family */
     USHORT Protocol;                      /* Protocol number */
     USHORT Port;                          /* Network port (network byte order) */
+    BOOLEAN SharedPort;                   /* Port came from TCPAllocateConnectPort */
     LONG Sharers;                         /* Number of file objects with this addr file */
     UCHAR TTL;                            /* Time to live stored in packets sent from this address file */
     UINT DF;                              /* Don't fragment */
@@ -272,6 +273,8 @@ typedef struct _CONNECTION_ENDPOINT {
     LIST_ENTRY ShutdownRequest;/* Queued shutdown requests */
 
     LIST_ENTRY PacketQueue;    /* Queued received packets waiting to be processed */
+    LONG PacketQueueBytes;     /* Bytes in PacketQueue that weren't read yet */
+    struct _CONNECTION_ENDPOINT *LoopbackPeer; /* Other end if it's on this host */
     
     /* Disconnect Timer */
     KTIMER DisconnectTimer;
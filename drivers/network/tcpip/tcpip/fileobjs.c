@@ -344,7 +344,11 @@ VOID AddrFileFree(
   /* Protocol specific handling */
   switch (AddrFile->Protocol) {
   case IPPROTO_TCP:
-    if (AddrFile->Port)
+    if (AddrFile->SharedPort)
+    {
+        TCPFreeConnectPort(AddrFile->Port, AddrFile);
+    }
+    else if (AddrFile->Port)
     {
         TCPFreePort(AddrFile->Port);
     }
@@ -1892,6 +1892,122 @@ Retry:
         break;
     }
 
+    case IOCTL_DISK_PERFORMANCE: {
+
+        PDISK_PERFORMANCE diskPerformance = Irp->AssociatedIrp.SystemBuffer;
+        PDISK_IO_STATISTICS ioStatistics;
+        ULONG i;
+
+        DebugPrint((3, "IOCTL_DISK_PERFORMANCE to device %p through irp %p\n",
+                    DeviceObject, Irp));
+
+        if (irpStack->Parameters.DeviceIoControl.OutputBufferLength <
+            sizeof(DISK_PERFORMANCE)) {
+
+            status = STATUS_BUFFER_TOO_SMALL;
+            Irp->IoStatus.Information = sizeof(DISK_PERFORMANCE);
+            break;
+        }
+
+        if(!commonExtension->IsFdo) {
+
+            //
+            // Pdo should issue this request to the lower device object
+            //
+
+            ClassReleaseRemoveLock(DeviceObject, Irp);
+            ExFreePool(srb);
+            SendToFdo(DeviceObject, Irp, status);
+            return status;
+        }
+
+        //
+        // The counters are kept by the class driver for every read and
+        // write, summarize them the way diskperf would.
+        //
+
+        ioStatistics = ExAllocatePoolWithTag(NonPagedPool,
+                                             sizeof(DISK_IO_STATISTICS),
+                                             DISK_TAG_IO_STATS);
+        if (ioStatistics == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        status = ClassQueryIoStatistics(DeviceObject, ioStatistics);
+
+        if (NT_SUCCESS(status)) {
+
+            RtlZeroMemory(diskPerformance, sizeof(DISK_PERFORMANCE));
+
+            for (i = 0; i < DISK_IO_SIZE_CLASSES; i++) {
+                diskPerformance->BytesRead.QuadPart += ioStatistics->SizeClass[i].BytesRead.QuadPart;
+                diskPerformance->BytesWritten.QuadPart += ioStatistics->SizeClass[i].BytesWritten.QuadPart;
+                diskPerformance->ReadCount += ioStatistics->SizeClass[i].ReadCount;
+                diskPerformance->WriteCount += ioStatistics->SizeClass[i].WriteCount;
+            }
+
+            diskPerformance->ReadTime = ioStatistics->ReadTime;
+            diskPerformance->WriteTime = ioStatistics->WriteTime;
+            diskPerformance->IdleTime = ioStatistics->IdleTime;
+            diskPerformance->QueueDepth = ioStatistics->QueueDepth;
+            diskPerformance->SplitCount = ioStatistics->SplitCount;
+            diskPerformance->QueryTime = ioStatistics->QueryTime;
+            diskPerformance->StorageDeviceNumber = fdoExtension->DeviceNumber;
+            RtlCopyMemory(diskPerformance->StorageManagerName,
+                          L"PhysDisk",
+                          sizeof(diskPerformance->StorageManagerName));
+
+            Irp->IoStatus.Information = sizeof(DISK_PERFORMANCE);
+        }
+
+        ExFreePool(ioStatistics);
+        break;
+    }
+
+    case IOCTL_DISK_PERFORMANCE_OFF: {
+
+        //
+        // The counters are cheap enough to be always on.
+        //
+
+        status = STATUS_SUCCESS;
+        break;
+    }
+
+    case IOCTL_DISK_QUERY_IO_STATISTICS: {
+
+        DebugPrint((3, "IOCTL_DISK_QUERY_IO_STATISTICS to device %p through irp %p\n",
+                    DeviceObject, Irp));
+
+        if (irpStack->Parameters.DeviceIoControl.OutputBufferLength <
+            sizeof(DISK_IO_STATISTICS)) {
+
+            status = STATUS_BUFFER_TOO_SMALL;
+            Irp->IoStatus.Information = sizeof(DISK_IO_STATISTICS);
+            break;
+        }
+
+        if(!commonExtension->IsFdo) {
+
+            //
+            // Pdo should issue this request to the lower device object
+            //
+
+            ClassReleaseRemoveLock(DeviceObject, Irp);
+            ExFreePool(srb);
+            SendToFdo(DeviceObject, Irp, status);
+            return status;
+        }
+
+        status = ClassQueryIoStatistics(DeviceObject,
+                                        Irp->AssociatedIrp.SystemBuffer);
+        if (NT_SUCCESS(status)) {
+            Irp->IoStatus.Information = sizeof(DISK_IO_STATISTICS);
+        }
+        break;
+    }
+
     case IOCTL_DISK_GET_DRIVE_GEOMETRY: {
 
         DebugPrint((2, "IOCTL_DISK_GET_DRIVE_GEOMETRY to device %p through irp %p\n",
@@ -37,6 +37,7 @@ Revision History:
 
 #if defined(_X86_)
 #include <mountdev.h>
+#include <reactos/rosioctl.h>
 #endif
 
 #ifdef ExAllocatePool
@@ -60,6 +61,7 @@ Revision History:
 #define DISK_TAG_PART_LIST      'pDcS'  // "ScDp" - disk partition lists
 #define DISK_TAG_SRB            'SDcS'  // "ScDS" - srb allocation
 #define DISK_TAG_START          'sDcS'  // "ScDs" - start device paths
+#define DISK_TAG_IO_STATS       'TDcS'  // "ScDT" - i/o statistics snapshot
 #define DISK_TAG_UPDATE_CAP     'UDcS'  // "ScDU" - update capacity path
 #define DISK_TAG_WI_CONTEXT     'WDcS'  // "ScDW" - work-item context
 
@@ -40,6 +40,13 @@
 
 #define TOC_DATA_TRACK              (0x04)
 
+//
+// Scratch disks are backed by chunks of the size (and when contiguous, the
+// alignment) of a large page, which stay mapped for the life of the disk
+//
+#define RAMDISK_CHUNK_SHIFT         22
+#define RAMDISK_CHUNK_SIZE          (1 << RAMDISK_CHUNK_SHIFT)
+
 typedef enum _RAMDISK_DEVICE_TYPE
 {
     RamdiskBus,
@@ -57,6 +64,12 @@ typedef enum _RAMDISK_DEVICE_STATE
     RamdiskStateEnumerated,
 } RAMDISK_DEVICE_STATE;
 
+typedef struct _RAMDISK_CHUNK
+{
+    PVOID BaseAddress;
+    PMDL Mdl;
+} RAMDISK_CHUNK, *PRAMDISK_CHUNK;
+
 DEFINE_GUID(RamdiskBusInterface,
             0x5DC52DF0,
             0x2F8A,
@@ -104,6 +117,11 @@ typedef struct _RAMDISK_DRIVE_EXTENSION
     WCHAR DriveLetter;
     ULONG BasePage;
 
+    /* Memory of a scratch disk */
+    PRAMDISK_CHUNK Chunks;
+    ULONG ChunkCount;
+    FAST_MUTEX ChunkLock;
+
     /* Data we get from the disk */
     ULONG BytesPerSector;
     ULONG SectorsPerTrack;
@@ -264,6 +282,173 @@ QueryParameters(IN PUNICODE_STRING RegistryPath)
     }
 }
 
+NTSTATUS
+NTAPI
+RamdiskAllocateChunk(IN BOOLEAN LargePages,
+                     OUT PRAMDISK_CHUNK Chunk)
+{
+    PHYSICAL_ADDRESS LowAddress, HighAddress, SkipBytes, Boundary;
+    PVOID BaseAddress;
+    PMDL Mdl;
+
+    LowAddress.QuadPart = 0;
+    HighAddress.QuadPart = -1;
+    SkipBytes.QuadPart = 0;
+    Boundary.QuadPart = RAMDISK_CHUNK_SIZE;
+
+    if (LargePages)
+    {
+        /*
+         * A chunk that can't cross a chunk boundary is aligned on one, so
+         * it can be mapped with a single large page
+         */
+        BaseAddress = MmAllocateContiguousMemorySpecifyCache(RAMDISK_CHUNK_SIZE,
+                                                             LowAddress,
+                                                             HighAddress,
+                                                             Boundary,
+                                                             MmCached);
+        if (!BaseAddress) return STATUS_INSUFFICIENT_RESOURCES;
+
+        /* Contiguous memory doesn't come zeroed */
+        RtlZeroMemory(BaseAddress, RAMDISK_CHUNK_SIZE);
+        Chunk->BaseAddress = BaseAddress;
+        Chunk->Mdl = NULL;
+        return STATUS_SUCCESS;
+    }
+
+    /* Otherwise take any pages, the zeroed ones first */
+    Mdl = MmAllocatePagesForMdlEx(LowAddress,
+                                  HighAddress,
+                                  SkipBytes,
+                                  RAMDISK_CHUNK_SIZE,
+                                  MmCached,
+                                  0);
+    if (!Mdl) return STATUS_INSUFFICIENT_RESOURCES;
+    if (MmGetMdlByteCount(Mdl) != RAMDISK_CHUNK_SIZE)
+    {
+        /* We only got part of it */
+        MmFreePagesFromMdl(Mdl);
+        ExFreePool(Mdl);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    /* And map them once and for all */
+    BaseAddress = MmMapLockedPagesSpecifyCache(Mdl,
+                                               KernelMode,
+                                               MmCached,
+                                               NULL,
+                                               FALSE,
+                                               NormalPagePriority);
+    if (!BaseAddress)
+    {
+        MmFreePagesFromMdl(Mdl);
+        ExFreePool(Mdl);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Chunk->BaseAddress = BaseAddress;
+    Chunk->Mdl = Mdl;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+RamdiskFreeScratchMemory(IN PRAMDISK_CHUNK Chunks,
+                         IN ULONG ChunkCount)
+{
+    ULONG i;
+
+    /* Free every chunk we got */
+    for (i = 0; i < ChunkCount; i++)
+    {
+        if (!Chunks[i].BaseAddress) continue;
+
+        if (Chunks[i].Mdl)
+        {
+            MmUnmapLockedPages(Chunks[i].BaseAddress, Chunks[i].Mdl);
+            MmFreePagesFromMdl(Chunks[i].Mdl);
+            ExFreePool(Chunks[i].Mdl);
+        }
+        else
+        {
+            MmFreeContiguousMemory(Chunks[i].BaseAddress);
+        }
+    }
+
+    /* And the chunk table */
+    ExFreePoolWithTag(Chunks, 'dmaR');
+}
+
+NTSTATUS
+NTAPI
+RamdiskAllocateScratchMemory(IN PRAMDISK_CREATE_INPUT Input,
+                             OUT PRAMDISK_CHUNK *OutChunks,
+                             OUT PULONG OutChunkCount)
+{
+    PRAMDISK_CHUNK Chunks;
+    ULONG ChunkCount, i;
+    NTSTATUS Status;
+
+    /* Allocate the chunk table */
+    ChunkCount = (ULONG)((Input->DiskLength.QuadPart + RAMDISK_CHUNK_SIZE - 1) >> RAMDISK_CHUNK_SHIFT);
+    Chunks = ExAllocatePoolWithTag(NonPagedPool,
+                                   ChunkCount * sizeof(RAMDISK_CHUNK),
+                                   'dmaR');
+    if (!Chunks) return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(Chunks, ChunkCount * sizeof(RAMDISK_CHUNK));
+
+    /* Unless the disk grows on demand, get all its memory now */
+    if (!Input->Options.GrowOnDemand)
+    {
+        for (i = 0; i < ChunkCount; i++)
+        {
+            Status = RamdiskAllocateChunk(Input->Options.LargePages, &Chunks[i]);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Out of memory for a %I64u bytes scratch disk\n",
+                        Input->DiskLength.QuadPart);
+                RamdiskFreeScratchMemory(Chunks, ChunkCount);
+                return Status;
+            }
+        }
+    }
+
+    *OutChunks = Chunks;
+    *OutChunkCount = ChunkCount;
+    return STATUS_SUCCESS;
+}
+
+PVOID
+NTAPI
+RamdiskGetChunk(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
+                IN ULONG Index,
+                IN BOOLEAN Allocate)
+{
+    PRAMDISK_CHUNK Chunk;
+    RAMDISK_CHUNK NewChunk;
+
+    ASSERT(Index < DeviceExtension->ChunkCount);
+    Chunk = &DeviceExtension->Chunks[Index];
+
+    /* Check if the chunk is there, or if the caller can do without */
+    if ((Chunk->BaseAddress) || !(Allocate)) return Chunk->BaseAddress;
+
+    /* Grow the disk, unless someone else just did */
+    ExAcquireFastMutex(&DeviceExtension->ChunkLock);
+    if (!Chunk->BaseAddress)
+    {
+        if (NT_SUCCESS(RamdiskAllocateChunk(DeviceExtension->DiskOptions.LargePages,
+                                            &NewChunk)))
+        {
+            Chunk->Mdl = NewChunk.Mdl;
+            InterlockedExchangePointer(&Chunk->BaseAddress, NewChunk.BaseAddress);
+        }
+    }
+    ExReleaseFastMutex(&DeviceExtension->ChunkLock);
+
+    return Chunk->BaseAddress;
+}
+
 PVOID
 NTAPI
 RamdiskMapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
@@ -278,6 +463,18 @@ RamdiskMapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
     LARGE_INTEGER ActualOffset;
     LARGE_INTEGER ActualPages;
 
+    /* Scratch disks are always mapped, just look up the chunk */
+    if (DeviceExtension->DiskType == RAMDISK_SCRATCH_DISK)
+    {
+        PageOffset = (ULONG)(Offset.QuadPart & (RAMDISK_CHUNK_SIZE - 1));
+        MappedBase = RamdiskGetChunk(DeviceExtension,
+                                     (ULONG)(Offset.QuadPart >> RAMDISK_CHUNK_SHIFT),
+                                     TRUE);
+        if (MappedBase) MappedBase = (PVOID)((ULONG_PTR)MappedBase + PageOffset);
+        *OutputLength = min(Length, RAMDISK_CHUNK_SIZE - PageOffset);
+        return MappedBase;
+    }
+
     /* We only support boot disks for now */
     ASSERT(DeviceExtension->DiskType == RAMDISK_BOOT_DISK);
 
@@ -322,6 +519,9 @@ RamdiskUnmapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
     SIZE_T ActualLength;
     ULONG PageOffset;
 
+    /* Scratch disks stay mapped */
+    if (DeviceExtension->DiskType == RAMDISK_SCRATCH_DISK) return;
+
     /* We only support boot disks for now */
     ASSERT(DeviceExtension->DiskType == RAMDISK_BOOT_DISK);
 
@@ -365,6 +565,8 @@ RamdiskCreateDiskDevice(IN PRAMDISK_BUS_EXTENSION DeviceExtension,
     PVOID BaseAddress;
     LARGE_INTEGER CurrentOffset, CylinderSize, DiskLength;
     ULONG CylinderCount, SizeByCylinders;
+    PRAMDISK_CHUNK Chunks = NULL;
+    ULONG ChunkCount = 0;
 
     /* Check if we're a boot RAM disk */
     DiskType = Input->DiskType;
@@ -385,6 +587,22 @@ RamdiskCreateDiskDevice(IN PRAMDISK_BUS_EXTENSION DeviceExtension,
             Input->Options.NoDosDevice = FALSE;
             Input->Options.NoDriveLetter = IsWinPEBoot ? TRUE : FALSE;
         }
+        else if (DiskType == RAMDISK_SCRATCH_DISK)
+        {
+            /* We need a size, in whole sectors */
+            if ((Input->DiskLength.QuadPart <= 0) ||
+                (Input->DiskLength.QuadPart & (512 - 1)) ||
+                ((Input->DiskLength.QuadPart >> RAMDISK_CHUNK_SHIFT) >= MAXULONG / sizeof(RAMDISK_CHUNK)))
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            /* Sanitize disk options */
+            Input->DiskOffset = 0;
+            Input->Options.Fixed = TRUE;
+            Input->Options.Readonly = FALSE;
+            Input->Options.ExportAsCd = FALSE;
+        }
         else
         {
             /* The only other possibility is a WIM disk */
@@ -408,6 +626,13 @@ RamdiskCreateDiskDevice(IN PRAMDISK_BUS_EXTENSION DeviceExtension,
         /* Are we just validating and returning to the user? */
         if (ValidateOnly) return STATUS_SUCCESS;
 
+        /* Get the memory of a scratch disk before anything else */
+        if (DiskType == RAMDISK_SCRATCH_DISK)
+        {
+            Status = RamdiskAllocateScratchMemory(Input, &Chunks, &ChunkCount);
+            if (!NT_SUCCESS(Status)) return Status;
+        }
+
         /* Build the GUID string */
         Status = RtlStringFromGUID(&Input->DiskGuid, &GuidString);
         if (!(NT_SUCCESS(Status)) || !(GuidString.Buffer))
@@ -526,11 +751,15 @@ RamdiskCreateDiskDevice(IN PRAMDISK_BUS_EXTENSION DeviceExtension,
         DriveExtension->DiskLength = DiskLength;
         DriveExtension->DiskOffset = Input->DiskOffset;
         DriveExtension->BasePage = Input->BasePage;
+        DriveExtension->Chunks = Chunks;
+        DriveExtension->ChunkCount = ChunkCount;
+        ExInitializeFastMutex(&DriveExtension->ChunkLock);
         DriveExtension->BytesPerSector = 0;
         DriveExtension->SectorsPerTrack = 0;
         DriveExtension->NumberOfHeads = 0;
 
         /* Make sure we don't free it later */
+        Chunks = NULL;
         DeviceName.Buffer = NULL;
         SymbolicLinkName.Buffer = NULL;
         GuidString.Buffer = NULL;
@@ -627,6 +856,7 @@ RamdiskCreateDiskDevice(IN PRAMDISK_BUS_EXTENSION DeviceExtension,
     }
 
 FailCreate:
+    if (Chunks) RamdiskFreeScratchMemory(Chunks, ChunkCount);
     UNIMPLEMENTED_DBGBREAK();
     return STATUS_SUCCESS;
 }
@@ -934,6 +1164,66 @@ SendIrpToThread(IN PDEVICE_OBJECT DeviceObject,
     }
 }
 
+NTSTATUS
+NTAPI
+RamdiskReadWriteScratch(IN PIRP Irp,
+                        IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
+                        IN PVOID SystemVa)
+{
+    PIO_STACK_LOCATION IoStackLocation;
+    LARGE_INTEGER CurrentOffset;
+    ULONG BytesLeft, CopyLength, ChunkOffset;
+    PVOID ChunkBase;
+    BOOLEAN IsWrite;
+
+    /* Get the request and check it fits on the disk */
+    IoStackLocation = IoGetCurrentIrpStackLocation(Irp);
+    CurrentOffset = IoStackLocation->Parameters.Read.ByteOffset;
+    BytesLeft = IoStackLocation->Parameters.Read.Length;
+    IsWrite = (IoStackLocation->MajorFunction == IRP_MJ_WRITE);
+    if ((CurrentOffset.QuadPart < 0) ||
+        (CurrentOffset.QuadPart + BytesLeft > DeviceExtension->DiskLength.QuadPart))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // The disk is always mapped, so this is a straight copy between the
+    // caller's buffer and the chunk, only split if the request crosses a chunk
+    //
+    while (BytesLeft)
+    {
+        ChunkOffset = (ULONG)(CurrentOffset.QuadPart & (RAMDISK_CHUNK_SIZE - 1));
+        CopyLength = min(BytesLeft, RAMDISK_CHUNK_SIZE - ChunkOffset);
+
+        /* Only writes grow the disk, what was never written reads as zeroes */
+        ChunkBase = RamdiskGetChunk(DeviceExtension,
+                                    (ULONG)(CurrentOffset.QuadPart >> RAMDISK_CHUNK_SHIFT),
+                                    IsWrite);
+        if (!ChunkBase)
+        {
+            if (IsWrite) return STATUS_INSUFFICIENT_RESOURCES;
+            RtlZeroMemory(SystemVa, CopyLength);
+        }
+        else if (IsWrite)
+        {
+            RtlCopyMemory((PVOID)((ULONG_PTR)ChunkBase + ChunkOffset), SystemVa, CopyLength);
+        }
+        else
+        {
+            RtlCopyMemory(SystemVa, (PVOID)((ULONG_PTR)ChunkBase + ChunkOffset), CopyLength);
+        }
+
+        /* Update offset and bytes left */
+        Irp->IoStatus.Information += CopyLength;
+        BytesLeft -= CopyLength;
+        CurrentOffset.QuadPart += CopyLength;
+        SystemVa = (PVOID)((ULONG_PTR)SystemVa + CopyLength);
+    }
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 NTAPI
 RamdiskReadWriteReal(IN PIRP Irp,
@@ -978,6 +1268,12 @@ RamdiskReadWriteReal(IN PIRP Irp,
     BytesLeft = IoStackLocation->Parameters.Read.Length;
     if (!BytesLeft) return STATUS_INVALID_PARAMETER;
 
+    /* Scratch disks don't need any mapping */
+    if (DeviceExtension->DiskType == RAMDISK_SCRATCH_DISK)
+    {
+        return RamdiskReadWriteScratch(Irp, DeviceExtension, SystemVa);
+    }
+
     /* Do the copy loop */
     while (TRUE)
     {
@@ -1678,10 +1678,11 @@ NTSTATUS NTAPI ClassReadWrite(IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp)
                              commonExtension->PartitionZeroExtension->DMByteSkew;
 
                         /*
-                         *  Perform the actual transfer(s) on the hardware
-                         *  to service this request.
+                         *  Queue the request by priority; the scheduler
+                         *  performs the actual transfer(s) on the hardware
+                         *  once it gets a slot.
                          */
-                        ServiceTransferRequest(DeviceObject, Irp);
+                        ScheduleClientIrp(DeviceObject, Irp);
                         status = STATUS_PENDING;
                     }
                     else {
@@ -2300,6 +2301,9 @@ VOID NTAPI ServiceTransferRequest(PDEVICE_OBJECT Fdo, PIRP Irp)
          *  It will be used to count down the pieces as they complete.
          */
         Irp->Tail.Overlay.DriverContext[0] = LongToPtr(numPackets);
+        if (numPackets > 1){
+            InterlockedIncrement((PLONG)&fdoData->IoStatistics.SplitCount);
+        }
 
         /*
          *  We are proceeding with the transfer.
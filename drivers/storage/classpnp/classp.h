@@ -30,6 +30,7 @@ Revision History:
 
 #include <ntddk.h>
 #include <classpnp.h>
+#include <reactos/rosioctl.h>
 #include <ioevent.h>
 #include <pseh/pseh2.h>
 
@@ -75,6 +76,37 @@ extern GUID ClassGuidQueryRegInfoEx;
 #define NUM_MODESENSE_RETRIES           1
 #define NUM_DRIVECAPACITY_RETRIES       1
 
+/*
+ *  Client irp scheduling (see clntirp.c).
+ *  At most IO_SCHED_MAX_OUTSTANDING client read/write irps are serviced
+ *  at once per FDO, the others wait in per-priority queues.
+ *  Low priority irps are released in batches of IO_SCHED_LOW_BATCH.
+ *  Deadlines are in microseconds.
+ */
+typedef enum _CLASS_IO_PRIORITY {
+    ClassIoPriorityLow = 0,
+    ClassIoPriorityNormal,
+    ClassIoPriorityHigh,
+    NumClassIoPriorities
+} CLASS_IO_PRIORITY;
+
+#define IO_SCHED_MAX_OUTSTANDING        16
+#define IO_SCHED_LOW_BATCH              8
+
+#define IO_SCHED_HIGH_DEADLINE          25000
+#define IO_SCHED_READ_DEADLINE          50000
+#define IO_SCHED_WRITE_DEADLINE         250000
+#define IO_SCHED_LOW_DEADLINE           1000000
+
+typedef struct _CLASS_IO_SCHED_STATISTICS {
+    ULONG NumRequests;
+    ULONG NumDeadlineDispatches;    // dispatched ahead of higher classes because they were late
+    ULONG MaxQueueDepth;
+    ULONG MaxLatency;
+    ULONGLONG TotalLatency;         // arrival to completion
+    ULONGLONG TotalQueueTime;       // arrival to dispatch
+} CLASS_IO_SCHED_STATISTICS, *PCLASS_IO_SCHED_STATISTICS;
+
 
 #define CLASS_FILE_OBJECT_EXTENSION_KEY     'eteP'
 #define CLASSP_VOLUME_VERIFY_CHECKED        0x34
@@ -379,6 +411,25 @@ typedef struct _TRANSFER_PACKET {
 #define MIN_WORKINGSET_TRANSFER_PACKETS_Enterprise    256
 #define MAX_WORKINGSET_TRANSFER_PACKETS_Enterprise   2048
 
+/*
+ *  The free packets are kept in up to MAX_TRANSFER_PACKET_POOLS per-processor
+ *  lists so that processors completing and issuing transfers don't all
+ *  hammer the same slist header.
+ *
+ *  Whenever we have to allocate packets in stress, the device's own working
+ *  set minimum is raised to the number of packets it needed, so that the
+ *  next burst finds them in the pool.  It decays back towards
+ *  MinWorkingSetTransferPackets once no stress has been seen for
+ *  TRANSFER_PACKET_WORKINGSET_DECAY_TIME (100ns units).
+ */
+#define MAX_TRANSFER_PACKET_POOLS                     8
+#define TRANSFER_PACKET_WORKINGSET_DECAY_TIME         (5 * 1000 * 1000 * 10)
+
+typedef struct _TRANSFER_PACKET_POOL {
+    SLIST_HEADER FreeList;
+    UCHAR Reserved[64 - sizeof(SLIST_HEADER)];  // one cache line per list
+} TRANSFER_PACKET_POOL, *PTRANSFER_PACKET_POOL;
+
 
 //
 // add to the front of this structure to help prevent illegal
@@ -432,16 +483,42 @@ struct _CLASS_PRIVATE_FDO_DATA {
      *   a doubly-linked list since we have to dequeue from the middle).
      */
     LIST_ENTRY AllTransferPacketsList;
-    SLIST_HEADER FreeTransferPacketsList;
+    TRANSFER_PACKET_POOL FreeTransferPacketPools[MAX_TRANSFER_PACKET_POOLS];
+    ULONG NumTransferPacketPools;
     ULONG NumFreeTransferPackets;
     ULONG NumTotalTransferPackets;
     ULONG DbgPeakNumTransferPackets;
 
+    /*
+     *  Adaptive working set minimum (see TRANSFER_PACKET_WORKINGSET_DECAY_TIME).
+     */
+    ULONG MinWorkingSetTransferPackets;
+    LARGE_INTEGER LastTransferPacketStressTime;
+
     /*
      *  Queue for deferred client irps
      */
     LIST_ENTRY DeferredClientIrpList;
 
+    /*
+     *  Client irp scheduler, protected by SpinLock.
+     *  Scheduled irps wait in SchedQueue[priority] until they get a slot.
+     */
+    LIST_ENTRY SchedQueue[NumClassIoPriorities];
+    ULONG SchedQueueDepth[NumClassIoPriorities];
+    ULONG SchedOutstanding[NumClassIoPriorities];
+    ULONG SchedNumOutstanding;
+    ULONG SchedLowBatchRemaining;
+    CLASS_IO_SCHED_STATISTICS SchedStats[NumClassIoPriorities];
+
+    /*
+     *  Read/write statistics returned by ClassQueryIoStatistics, kept by the
+     *  scheduler under SpinLock (SplitCount is updated interlocked).
+     *  IoIdleStartTime is the interrupt time at which the device last went idle.
+     */
+    DISK_IO_STATISTICS IoStatistics;
+    ULONGLONG IoIdleStartTime;
+
     /*
      *  Precomputed maximum transfer length for the hardware.
      */
@@ -857,6 +934,10 @@ BOOLEAN NTAPI InterpretTransferPacketError(PTRANSFER_PACKET Pkt);
 BOOLEAN NTAPI RetryTransferPacket(PTRANSFER_PACKET Pkt);
 VOID NTAPI EnqueueDeferredClientIrp(PCLASS_PRIVATE_FDO_DATA FdoData, PIRP Irp);
 PIRP NTAPI DequeueDeferredClientIrp(PCLASS_PRIVATE_FDO_DATA FdoData);
+VOID NTAPI InitializeClientIrpScheduler(PCLASS_PRIVATE_FDO_DATA FdoData);
+VOID NTAPI ScheduleClientIrp(PDEVICE_OBJECT Fdo, PIRP Irp);
+BOOLEAN NTAPI CompleteScheduledClientIrp(PCLASS_PRIVATE_FDO_DATA FdoData, PIRP Irp);
+VOID NTAPI DispatchScheduledClientIrps(PDEVICE_OBJECT Fdo);
 VOID NTAPI InitLowMemRetry(PTRANSFER_PACKET Pkt, PVOID BufPtr, ULONG Len, LARGE_INTEGER TargetLocation);
 BOOLEAN NTAPI StepLowMemRetry(PTRANSFER_PACKET Pkt);
 VOID NTAPI SetupEjectionTransferPacket(TRANSFER_PACKET *Pkt, BOOLEAN PreventMediaRemoval, PKEVENT SyncEventPtr, PIRP OriginalIrp);
@@ -56,4 +56,5 @@
  @ stdcall ClassScanForSpecial(ptr ptr ptr)
  @ stdcall ClassSetDeviceParameter(ptr ptr ptr long)
  @ stdcall ClassGetDeviceParameter(ptr ptr ptr ptr)
+ @ stdcall ClassQueryIoStatistics(ptr ptr)
 
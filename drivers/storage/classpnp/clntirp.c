@@ -67,3 +67,420 @@ PIRP NTAPI DequeueDeferredClientIrp(PCLASS_PRIVATE_FDO_DATA FdoData)
 
     return irp;
 }
+
+
+/*
+ *  Client irp scheduler
+ *
+ *      Client read/write irps reaching the FDO are given a priority class
+ *      and are serviced at most IO_SCHED_MAX_OUTSTANDING at a time.  The
+ *      others wait in per-priority FIFOs and are dispatched highest class
+ *      first, unless the head of some queue is past its deadline, in which
+ *      case the latest one goes first.
+ *
+ *      Low priority irps (paging writes) are only released once the
+ *      previous low priority batch has completed and either nothing else
+ *      is in flight or IO_SCHED_LOW_BATCH of them have piled up.  They
+ *      then go down back to back, so the port driver can sort them.
+ *
+ *      The scheduler owns these fields of a scheduled irp:
+ *          DriverContext[1]  - priority class + 1 (NULL = not scheduled)
+ *          DriverContext[2]  - arrival time in us
+ *          DriverContext[3]  - deadline while queued, dispatch time afterwards
+ *      DriverContext[0] is left to ServiceTransferRequest.
+ */
+
+#define SCHED_TAG(Irp)          ((Irp)->Tail.Overlay.DriverContext[1])
+#define SCHED_ARRIVAL(Irp)      ((Irp)->Tail.Overlay.DriverContext[2])
+#define SCHED_TIME(Irp)         ((Irp)->Tail.Overlay.DriverContext[3])
+
+static inline ULONG SchedCurrentTime(VOID)
+{
+    /*
+     *  Microseconds, wrapping every ~71 minutes.
+     *  All comparisons are done on differences so the wrap is harmless.
+     */
+    return (ULONG)(KeQueryInterruptTime() / 10);
+}
+
+
+/*
+ *  ClasspGetLatencyBucket
+ *
+ *      Log2 bucket of a latency in us, see DISK_IO_LATENCY_BUCKETS.
+ */
+static ULONG ClasspGetLatencyBucket(ULONG Latency)
+{
+    ULONG bucket = 0;
+
+    Latency >>= 5;
+    while (Latency && (bucket < DISK_IO_LATENCY_BUCKETS - 1)){
+        Latency >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+
+/*
+ *  ClasspGetSizeClass
+ *
+ *      Request size class of a transfer length, see DISK_IO_SIZE_CLASSES.
+ */
+static ULONG ClasspGetSizeClass(ULONG Length)
+{
+    if (Length <= 0x1000){
+        return 0;
+    }
+    else if (Length <= 0x10000){
+        return 1;
+    }
+    else if (Length <= 0x100000){
+        return 2;
+    }
+    else {
+        return 3;
+    }
+}
+
+
+/*
+ *  ClasspGetIoPriority
+ *
+ *      There is no per-irp priority hint in this tree, so derive one from
+ *      the paging flags: a paging read has a thread blocked in a page fault
+ *      behind it, while paging writes come from the modified/mapped page
+ *      writers and the lazy writer, unless Mm asked for them urgently.
+ */
+static CLASS_IO_PRIORITY ClasspGetIoPriority(PIRP Irp)
+{
+    PIO_STACK_LOCATION currentSp = IoGetCurrentIrpStackLocation(Irp);
+    CLASS_IO_PRIORITY priority;
+
+    if (!TEST_FLAG(Irp->Flags, IRP_PAGING_IO)){
+        priority = ClassIoPriorityNormal;
+    }
+    else if (currentSp->MajorFunction == IRP_MJ_READ){
+        priority = ClassIoPriorityHigh;
+    }
+    else if (IoGetPagingIoPriority(Irp) == IoPagingPriorityHigh){
+        priority = ClassIoPriorityNormal;
+    }
+    else {
+        priority = ClassIoPriorityLow;
+    }
+
+    return priority;
+}
+
+
+/*
+ *  ClasspSelectScheduledClientIrp
+ *
+ *      Pick the next irp to dispatch, if any.  Must be called with the SpinLock held.
+ */
+static PIRP ClasspSelectScheduledClientIrp(PCLASS_PRIVATE_FDO_DATA FdoData, ULONG Now)
+{
+    PIRP irp, bestIrp = NULL;
+    LONG late, bestLate = 0;
+    ULONG i, bestPriority = 0;
+    ULONG foregroundBusy;
+
+    if (FdoData->SchedNumOutstanding >= IO_SCHED_MAX_OUTSTANDING){
+        return NULL;
+    }
+
+    /*
+     *  1.  Anything past its deadline goes first, the latest one first.
+     *      The queues are FIFO so only their heads need to be looked at.
+     */
+    for (i = 0; i < NumClassIoPriorities; i++){
+        if (!IsListEmpty(&FdoData->SchedQueue[i])){
+            irp = CONTAINING_RECORD(FdoData->SchedQueue[i].Flink, IRP, Tail.Overlay.ListEntry);
+            late = (LONG)(Now - PtrToUlong(SCHED_TIME(irp)));
+            if ((late >= 0) && (!bestIrp || (late > bestLate))){
+                bestIrp = irp;
+                bestLate = late;
+                bestPriority = i;
+            }
+        }
+    }
+
+    if (bestIrp){
+        /*
+         *  Only count it as a deadline dispatch if it overtook another class.
+         */
+        for (i = bestPriority + 1; i < NumClassIoPriorities; i++){
+            if (!IsListEmpty(&FdoData->SchedQueue[i])){
+                FdoData->SchedStats[bestPriority].NumDeadlineDispatches++;
+                break;
+            }
+        }
+    }
+    else {
+        /*
+         *  2.  Otherwise by priority, highest class first.
+         */
+        for (i = NumClassIoPriorities - 1; i > ClassIoPriorityLow; i--){
+            if (!IsListEmpty(&FdoData->SchedQueue[i])){
+                bestIrp = CONTAINING_RECORD(FdoData->SchedQueue[i].Flink, IRP, Tail.Overlay.ListEntry);
+                bestPriority = i;
+                break;
+            }
+        }
+
+        /*
+         *  3.  Low priority irps go in batches.
+         */
+        if (!bestIrp && !IsListEmpty(&FdoData->SchedQueue[ClassIoPriorityLow])){
+            if ((FdoData->SchedLowBatchRemaining == 0) &&
+                (FdoData->SchedOutstanding[ClassIoPriorityLow] == 0)){
+
+                foregroundBusy = FdoData->SchedNumOutstanding - FdoData->SchedOutstanding[ClassIoPriorityLow];
+                if (!foregroundBusy ||
+                    (FdoData->SchedQueueDepth[ClassIoPriorityLow] >= IO_SCHED_LOW_BATCH)){
+                    FdoData->SchedLowBatchRemaining = IO_SCHED_LOW_BATCH;
+                }
+            }
+
+            if (FdoData->SchedLowBatchRemaining > 0){
+                bestIrp = CONTAINING_RECORD(FdoData->SchedQueue[ClassIoPriorityLow].Flink, IRP, Tail.Overlay.ListEntry);
+                bestPriority = ClassIoPriorityLow;
+            }
+        }
+    }
+
+    if (bestIrp){
+        RemoveEntryList(&bestIrp->Tail.Overlay.ListEntry);
+        InitializeListHead(&bestIrp->Tail.Overlay.ListEntry);
+        FdoData->SchedQueueDepth[bestPriority]--;
+        FdoData->SchedOutstanding[bestPriority]++;
+        FdoData->SchedNumOutstanding++;
+        if ((bestPriority == ClassIoPriorityLow) && (FdoData->SchedLowBatchRemaining > 0)){
+            FdoData->SchedLowBatchRemaining--;
+        }
+
+        if (FdoData->SchedNumOutstanding == 1){
+            FdoData->IoStatistics.IdleTime.QuadPart += KeQueryInterruptTime() - FdoData->IoIdleStartTime;
+        }
+
+        SCHED_TIME(bestIrp) = ULongToPtr(Now);
+        FdoData->SchedStats[bestPriority].TotalQueueTime += Now - PtrToUlong(SCHED_ARRIVAL(bestIrp));
+    }
+
+    return bestIrp;
+}
+
+
+/*
+ *  InitializeClientIrpScheduler
+ *
+ */
+VOID NTAPI InitializeClientIrpScheduler(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    ULONG i;
+
+    for (i = 0; i < NumClassIoPriorities; i++){
+        InitializeListHead(&FdoData->SchedQueue[i]);
+        FdoData->SchedQueueDepth[i] = 0;
+        FdoData->SchedOutstanding[i] = 0;
+        RtlZeroMemory(&FdoData->SchedStats[i], sizeof(CLASS_IO_SCHED_STATISTICS));
+    }
+    FdoData->SchedNumOutstanding = 0;
+    FdoData->SchedLowBatchRemaining = 0;
+
+    RtlZeroMemory(&FdoData->IoStatistics, sizeof(DISK_IO_STATISTICS));
+    FdoData->IoIdleStartTime = KeQueryInterruptTime();
+}
+
+
+/*
+ *  ScheduleClientIrp
+ *
+ *      Queue a client read/write irp by priority and dispatch whatever can go now.
+ *      The irp is marked pending; it is serviced by ServiceTransferRequest.
+ */
+VOID NTAPI ScheduleClientIrp(PDEVICE_OBJECT Fdo, PIRP Irp)
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    PIO_STACK_LOCATION currentSp = IoGetCurrentIrpStackLocation(Irp);
+    CLASS_IO_PRIORITY priority;
+    ULONG now, deadline, depth;
+    KIRQL oldIrql;
+
+    priority = ClasspGetIoPriority(Irp);
+    now = SchedCurrentTime();
+
+    if (priority == ClassIoPriorityHigh){
+        deadline = IO_SCHED_HIGH_DEADLINE;
+    }
+    else if (priority == ClassIoPriorityLow){
+        deadline = IO_SCHED_LOW_DEADLINE;
+    }
+    else if (currentSp->MajorFunction == IRP_MJ_READ){
+        deadline = IO_SCHED_READ_DEADLINE;
+    }
+    else {
+        deadline = IO_SCHED_WRITE_DEADLINE;
+    }
+
+    SCHED_TAG(Irp) = ULongToPtr(priority + 1);
+    SCHED_ARRIVAL(Irp) = ULongToPtr(now);
+    SCHED_TIME(Irp) = ULongToPtr(now + deadline);
+
+    IoMarkIrpPending(Irp);
+
+    KeAcquireSpinLock(&fdoData->SpinLock, &oldIrql);
+    InsertTailList(&fdoData->SchedQueue[priority], &Irp->Tail.Overlay.ListEntry);
+    fdoData->SchedQueueDepth[priority]++;
+    fdoData->SchedStats[priority].MaxQueueDepth = MAX(fdoData->SchedStats[priority].MaxQueueDepth,
+                                                      fdoData->SchedQueueDepth[priority]);
+    depth = fdoData->SchedNumOutstanding +
+            fdoData->SchedQueueDepth[ClassIoPriorityLow] +
+            fdoData->SchedQueueDepth[ClassIoPriorityNormal] +
+            fdoData->SchedQueueDepth[ClassIoPriorityHigh];
+    fdoData->IoStatistics.MaxQueueDepth = MAX(fdoData->IoStatistics.MaxQueueDepth, depth);
+    KeReleaseSpinLock(&fdoData->SpinLock, oldIrql);
+
+    DispatchScheduledClientIrps(Fdo);
+}
+
+
+/*
+ *  CompleteScheduledClientIrp
+ *
+ *      Called when the last transfer piece of a client irp has completed,
+ *      before the irp itself is completed.  Accounts the latency and frees
+ *      the irp's slot; the caller then calls DispatchScheduledClientIrps.
+ *
+ *      Returns FALSE if the irp did not go through the scheduler.
+ */
+BOOLEAN NTAPI CompleteScheduledClientIrp(PCLASS_PRIVATE_FDO_DATA FdoData, PIRP Irp)
+{
+    PIO_STACK_LOCATION currentSp = IoGetCurrentIrpStackLocation(Irp);
+    PCLASS_IO_SCHED_STATISTICS stats;
+    PDISK_IO_SIZE_CLASS_STATISTICS sizeStats;
+    ULONG priority, latency, bucket;
+    KIRQL oldIrql;
+
+    if (!SCHED_TAG(Irp)){
+        return FALSE;
+    }
+
+    priority = PtrToUlong(SCHED_TAG(Irp)) - 1;
+    ASSERT(priority < NumClassIoPriorities);
+    SCHED_TAG(Irp) = NULL;
+
+    latency = SchedCurrentTime() - PtrToUlong(SCHED_ARRIVAL(Irp));
+    bucket = ClasspGetLatencyBucket(latency);
+
+    KeAcquireSpinLock(&FdoData->SpinLock, &oldIrql);
+
+    ASSERT(FdoData->SchedOutstanding[priority] > 0);
+    ASSERT(FdoData->SchedNumOutstanding > 0);
+    FdoData->SchedOutstanding[priority]--;
+    FdoData->SchedNumOutstanding--;
+
+    stats = &FdoData->SchedStats[priority];
+    stats->NumRequests++;
+    stats->TotalLatency += latency;
+    stats->MaxLatency = MAX(stats->MaxLatency, latency);
+
+    sizeStats = &FdoData->IoStatistics.SizeClass[ClasspGetSizeClass(currentSp->Parameters.Read.Length)];
+    if (currentSp->MajorFunction == IRP_MJ_READ){
+        sizeStats->ReadCount++;
+        sizeStats->BytesRead.QuadPart += Irp->IoStatus.Information;
+        sizeStats->ReadLatency[bucket]++;
+        FdoData->IoStatistics.ReadTime.QuadPart += (ULONGLONG)latency * 10;
+    }
+    else {
+        sizeStats->WriteCount++;
+        sizeStats->BytesWritten.QuadPart += Irp->IoStatus.Information;
+        sizeStats->WriteLatency[bucket]++;
+        FdoData->IoStatistics.WriteTime.QuadPart += (ULONGLONG)latency * 10;
+    }
+
+    if (FdoData->SchedNumOutstanding == 0){
+        FdoData->IoIdleStartTime = KeQueryInterruptTime();
+    }
+
+    KeReleaseSpinLock(&FdoData->SpinLock, oldIrql);
+
+    return TRUE;
+}
+
+
+/*
+ *  DispatchScheduledClientIrps
+ *
+ *      Send down as many queued client irps as the scheduler allows.
+ */
+VOID NTAPI DispatchScheduledClientIrps(PDEVICE_OBJECT Fdo)
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    LIST_ENTRY dispatchList;
+    PLIST_ENTRY listEntry;
+    PIRP irp;
+    ULONG now;
+    KIRQL oldIrql;
+
+    /*
+     *  Pick the irps under the lock, but send them without it.
+     */
+    InitializeListHead(&dispatchList);
+    now = SchedCurrentTime();
+
+    KeAcquireSpinLock(&fdoData->SpinLock, &oldIrql);
+    while ((irp = ClasspSelectScheduledClientIrp(fdoData, now))){
+        InsertTailList(&dispatchList, &irp->Tail.Overlay.ListEntry);
+    }
+    KeReleaseSpinLock(&fdoData->SpinLock, oldIrql);
+
+    while (!IsListEmpty(&dispatchList)){
+        listEntry = RemoveHeadList(&dispatchList);
+        irp = CONTAINING_RECORD(listEntry, IRP, Tail.Overlay.ListEntry);
+        InitializeListHead(&irp->Tail.Overlay.ListEntry);
+        ServiceTransferRequest(Fdo, irp);
+    }
+}
+
+
+/*
+ *  ClassQueryIoStatistics
+ *
+ *      Return a snapshot of the read/write statistics of an FDO.
+ *      They are always kept, so there is nothing to turn on or off.
+ */
+NTSTATUS NTAPI ClassQueryIoStatistics(PDEVICE_OBJECT Fdo, PDISK_IO_STATISTICS Statistics)
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    KIRQL oldIrql;
+    ULONG i;
+
+    ASSERT(fdoExt->CommonExtension.IsFdo);
+
+    if (!fdoData){
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    KeAcquireSpinLock(&fdoData->SpinLock, &oldIrql);
+
+    *Statistics = fdoData->IoStatistics;
+    Statistics->QueueDepth = fdoData->SchedNumOutstanding;
+    for (i = 0; i < NumClassIoPriorities; i++){
+        Statistics->QueueDepth += fdoData->SchedQueueDepth[i];
+    }
+    if (fdoData->SchedNumOutstanding == 0){
+        Statistics->IdleTime.QuadPart += KeQueryInterruptTime() - fdoData->IoIdleStartTime;
+    }
+
+    KeReleaseSpinLock(&fdoData->SpinLock, oldIrql);
+
+    KeQuerySystemTime(&Statistics->QueryTime);
+
+    return STATUS_SUCCESS;
+}
@@ -62,6 +62,13 @@ VOID NTAPI ClassSplitRequest(IN PDEVICE_OBJECT Fdo, IN PIRP Irp, IN ULONG Maximu
         fdoData->HwMaxXferLen = MAX(MaximumBytes, PAGE_SIZE);
     }
 
+    /*
+     *  The irp comes from the driver's StartIo queue and bypasses the
+     *  client irp scheduler; clear the scheduler tag, which overlaps
+     *  the device queue entry.
+     */
+    Irp->Tail.Overlay.DriverContext[1] = NULL;
+
     ServiceTransferRequest(Fdo, Irp);
 } 
 
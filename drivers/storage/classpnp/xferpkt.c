@@ -47,6 +47,7 @@ NTSTATUS NTAPI InitializeTransferPackets(PDEVICE_OBJECT Fdo)
     PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
     PSTORAGE_ADAPTER_DESCRIPTOR adapterDesc = commonExt->PartitionZeroExtension->AdapterDescriptor;
     ULONG hwMaxPages;
+    ULONG i;
     NTSTATUS status = STATUS_SUCCESS;
 
     PAGED_CODE();
@@ -75,9 +76,13 @@ NTSTATUS NTAPI InitializeTransferPackets(PDEVICE_OBJECT Fdo)
 
     fdoData->NumTotalTransferPackets = 0;
     fdoData->NumFreeTransferPackets = 0;
-    InitializeSListHead(&fdoData->FreeTransferPacketsList);
+    fdoData->NumTransferPacketPools = MIN((ULONG)KeNumberProcessors, MAX_TRANSFER_PACKET_POOLS);
+    for (i = 0; i < MAX_TRANSFER_PACKET_POOLS; i++){
+        InitializeSListHead(&fdoData->FreeTransferPacketPools[i].FreeList);
+    }
     InitializeListHead(&fdoData->AllTransferPacketsList);
     InitializeListHead(&fdoData->DeferredClientIrpList);
+    InitializeClientIrpScheduler(fdoData);
         
     /*
      *  Set the packet threshold numbers based on the Windows SKU.
@@ -103,6 +108,9 @@ NTSTATUS NTAPI InitializeTransferPackets(PDEVICE_OBJECT Fdo)
         MaxWorkingSetTransferPackets = MAX_WORKINGSET_TRANSFER_PACKETS_Consumer;
     }
 
+    fdoData->MinWorkingSetTransferPackets = MinWorkingSetTransferPackets;
+    fdoData->LastTransferPacketStressTime.QuadPart = 0;
+
     while (fdoData->NumFreeTransferPackets < MIN_INITIAL_TRANSFER_PACKETS){
         PTRANSFER_PACKET pkt = NewTransferPacket(Fdo);
         if (pkt){
@@ -140,6 +148,7 @@ VOID NTAPI DestroyAllTransferPackets(PDEVICE_OBJECT Fdo)
     PAGED_CODE();
     
     ASSERT(IsListEmpty(&fdoData->DeferredClientIrpList));
+    ASSERT(fdoData->SchedNumOutstanding == 0);
 
     while ((pkt = DequeueFreeTransferPacket(Fdo, FALSE))){
         DestroyTransferPacket(pkt);
@@ -223,7 +232,11 @@ VOID NTAPI EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, PTRANSFER_PACKET Pkt)
     
     ASSERT(!Pkt->SlistEntry.Next);
 
-    InterlockedPushEntrySList(&fdoData->FreeTransferPacketsList, &Pkt->SlistEntry);
+    /*
+     *  Return the packet to the current processor's list.
+     */
+    InterlockedPushEntrySList(&fdoData->FreeTransferPacketPools[KeGetCurrentProcessorNumber() % fdoData->NumTransferPacketPools].FreeList,
+                              &Pkt->SlistEntry);
     newNumPkts = InterlockedIncrement((PLONG)&fdoData->NumFreeTransferPackets);
     ASSERT(newNumPkts <= fdoData->NumTotalTransferPackets);
 
@@ -281,8 +294,17 @@ VOID NTAPI EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, PTRANSFER_PACKET Pkt)
 
         /*
          *  2.  Lazily work down to our LOWER threshold (by only freeing one packet at a time).
+         *      That threshold was raised by the last burst; let it decay once
+         *      we have been out of stress for a while.
          */
-        if (fdoData->NumTotalTransferPackets > MinWorkingSetTransferPackets){
+        if ((fdoData->MinWorkingSetTransferPackets > MinWorkingSetTransferPackets) &&
+            (KeQueryInterruptTime() - fdoData->LastTransferPacketStressTime.QuadPart >
+             TRANSFER_PACKET_WORKINGSET_DECAY_TIME)){
+
+            InterlockedDecrement((PLONG)&fdoData->MinWorkingSetTransferPackets);
+        }
+
+        if (fdoData->NumTotalTransferPackets > fdoData->MinWorkingSetTransferPackets){
             /*
              *  Check the counter again with lock held.  This eliminates a race condition
              *  while still allowing us to not grab the spinlock in the common codepath.
@@ -294,11 +316,11 @@ VOID NTAPI EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, PTRANSFER_PACKET Pkt)
              */
             PTRANSFER_PACKET pktToDelete = NULL; 
 
-            DBGTRACE(ClassDebugTrace, ("Exiting stress, lazily freeing one of %d/%d packets.", fdoData->NumTotalTransferPackets, MinWorkingSetTransferPackets));
+            DBGTRACE(ClassDebugTrace, ("Exiting stress, lazily freeing one of %d/%d packets.", fdoData->NumTotalTransferPackets, fdoData->MinWorkingSetTransferPackets));
             
             KeAcquireSpinLock(&fdoData->SpinLock, &oldIrql);
             if ((fdoData->NumFreeTransferPackets >= fdoData->NumTotalTransferPackets) &&
-                (fdoData->NumTotalTransferPackets > MinWorkingSetTransferPackets)){
+                (fdoData->NumTotalTransferPackets > fdoData->MinWorkingSetTransferPackets)){
                 
                 pktToDelete = DequeueFreeTransferPacket(Fdo, FALSE);
                 if (pktToDelete){
@@ -324,10 +346,25 @@ PTRANSFER_PACKET NTAPI DequeueFreeTransferPacket(PDEVICE_OBJECT Fdo, BOOLEAN All
     PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
     PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
     PTRANSFER_PACKET pkt;
-    PSINGLE_LIST_ENTRY slistEntry;
+    PSINGLE_LIST_ENTRY slistEntry = NULL;
+    ULONG pool, i;
     //KIRQL oldIrql;
 
-    slistEntry = InterlockedPopEntrySList(&fdoData->FreeTransferPacketsList);
+    /*
+     *  Try the current processor's list first, then steal from the others.
+     *  Don't bother walking the lists if they are all empty.
+     */
+    if (fdoData->NumFreeTransferPackets){
+        pool = KeGetCurrentProcessorNumber() % fdoData->NumTransferPacketPools;
+        for (i = 0; i < fdoData->NumTransferPacketPools; i++){
+            slistEntry = InterlockedPopEntrySList(&fdoData->FreeTransferPacketPools[pool].FreeList);
+            if (slistEntry){
+                break;
+            }
+            pool = (pool + 1) % fdoData->NumTransferPacketPools;
+        }
+    }
+
     if (slistEntry){
         slistEntry->Next = NULL;
         pkt = CONTAINING_RECORD(slistEntry, TRANSFER_PACKET, SlistEntry);
@@ -344,8 +381,16 @@ PTRANSFER_PACKET NTAPI DequeueFreeTransferPacket(PDEVICE_OBJECT Fdo, BOOLEAN All
              */
             pkt = NewTransferPacket(Fdo);
             if (pkt){
-                InterlockedIncrement((PLONG)&fdoData->NumTotalTransferPackets);
+                ULONG newNumPkts = InterlockedIncrement((PLONG)&fdoData->NumTotalTransferPackets);
                 fdoData->DbgPeakNumTransferPackets = max(fdoData->DbgPeakNumTransferPackets, fdoData->NumTotalTransferPackets);
+
+                /*
+                 *  Keep what this burst needed around for the next one.
+                 */
+                fdoData->LastTransferPacketStressTime.QuadPart = KeQueryInterruptTime();
+                if (newNumPkts > fdoData->MinWorkingSetTransferPackets){
+                    fdoData->MinWorkingSetTransferPackets = MIN(newNumPkts, MaxWorkingSetTransferPackets);
+                }
             }
             else {
                 DBGWARN(("DequeueFreeTransferPacket: packet allocation failed"));
@@ -594,6 +639,7 @@ NTSTATUS NTAPI TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PV
         LONG numPacketsRemaining;
         PIRP deferredIrp;
         PDEVICE_OBJECT Fdo = pkt->Fdo;
+        BOOLEAN wasScheduled = FALSE;
         UCHAR uniqueAddr;
         
         /*
@@ -650,6 +696,7 @@ NTSTATUS NTAPI TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PV
                     ASSERT((ULONG)pkt->OriginalIrp->IoStatus.Information == origCurrentSp->Parameters.Read.Length);
                     ClasspPerfIncrementSuccessfulIo(fdoExt);
                 }
+                wasScheduled = CompleteScheduledClientIrp(fdoData, pkt->OriginalIrp);
                 ClassReleaseRemoveLock(pkt->Fdo, pkt->OriginalIrp);
 
                 ClassCompleteRequest(pkt->Fdo, pkt->OriginalIrp, IO_DISK_INCREMENT);
@@ -702,6 +749,13 @@ NTSTATUS NTAPI TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PV
             ServiceTransferRequest(pkt->Fdo, deferredIrp);
         }
 
+        /*
+         *  A scheduler slot was freed, let the next client irps go.
+         */
+        if (wasScheduled){
+            DispatchScheduledClientIrps(Fdo);
+        }
+
         ClassReleaseRemoveLock(Fdo, (PIRP)&uniqueAddr);        
     }
 
@@ -51,6 +51,14 @@
 
 //#define UNI_CPU_OPTIMIZATION
 
+/***************************************/
+// Service long interrupts (ATAPI PIO, waiting for BUSY release) in the
+// port driver's DPC via CallEnableInterrupts/CallDisableInterrupts
+// instead of spinning in the ISR or polling from timer callbacks
+/***************************************/
+
+#define UNIATA_USE_XXableInterrupts
+
 /***************************************/
 // Enable/disable performance statistics
 /***************************************/
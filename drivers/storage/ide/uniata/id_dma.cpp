@@ -242,6 +242,29 @@ err_1:
     return;
 } // end AtapiDmaAlloc()
 
+/*
+    Trim physically contiguous block to what fits into a single PRD entry:
+    the rest of transfer, max segment length and segment alignment (e.g. BM
+    DMA can't cross 64k boundary)
+*/
+static
+ULONG
+AtapiDmaLimitSegment(
+    IN ULONG dma_base,
+    IN ULONG dma_count,
+    IN ULONG count,
+    IN ULONG max_frag,
+    IN ULONG seg_align
+    )
+{
+    dma_count = min(dma_count, count);
+    dma_count = min(dma_count, max_frag);
+    if(seg_align != (ULONG)-1) {
+        dma_count = min(dma_count, (seg_align+1) - (dma_base & seg_align));
+    }
+    return dma_count;
+} // end AtapiDmaLimitSegment()
+
 BOOLEAN
 NTAPI
 AtapiDmaSetup(
@@ -341,7 +364,8 @@ retry_DB_IO:
         return FALSE;
     }
 
-    dma_count = min(count, (PAGE_SIZE - ((ULONG)data & PAGE_MASK)));
+    // take whole physically contiguous block, not just a page
+    dma_count = AtapiDmaLimitSegment(dma_base, dma_count, count, max_frag, seg_align);
     data += dma_count;
     count -= dma_count;
     i = 0;
@@ -407,9 +431,9 @@ retry_DB_IO:
             return FALSE;
         }
 
-        dma_count = min(count, PAGE_SIZE);
-        data += min(count, PAGE_SIZE);
-        count -= min(count, PAGE_SIZE);
+        dma_count = AtapiDmaLimitSegment(dma_base, dma_count, count, max_frag, seg_align);
+        data += dma_count;
+        count -= dma_count;
     }
     KdPrint2((PRINT_PREFIX "  set TERM\n" ));
 /*    KdPrint2((PRINT_PREFIX " segments %#x+%#x == %#x && #x+%#x <= %#x\n",
@@ -1024,6 +1048,11 @@ AtapiDmaInit(
         udmamode = -1;
         wdmamode = min( wdmamode, (CHAR)(chan->MaxTransferMode - ATA_WDMA));
     } else
+    if((LONG)chan->MaxTransferMode >= ATA_DMA) {
+        // Generic BM controller, we don't know how to program its timings.
+        // Keep device modes, try_generic_dma will use DMA if BIOS has set it up
+        KdPrint2((PRINT_PREFIX "AtapiDmaInit: chan->MaxTransferMode >= ATA_DMA\n"));
+    } else
     if((LONG)chan->MaxTransferMode >= ATA_PIO0) {
         KdPrint2((PRINT_PREFIX "AtapiDmaInit: NO DMA\n"));
         wdmamode = udmamode = -1;
@@ -2305,6 +2334,15 @@ try_generic_dma:
 //        LunExt->TransferMode = ATA_DMA;
 //        return;
         KdPrint2((PRINT_PREFIX "try DMA on unknown controller\n"));
+        // Controller timings are set up by BIOS for the mode it has selected,
+        // keep that one. Plain ATA_DMA would switch the device to SDMA0
+        i = ata_cur_mode_from_ident(&(LunExt->IdentifyData), IDENT_MODE_ACTIVE);
+        if(i >= ATA_DMA) {
+            KdPrint2((PRINT_PREFIX "  active mode %#x\n", i));
+            if(AtaSetTransferMode(deviceExtension, DeviceNumber, lChannel, LunExt, i)) {
+                return;
+            }
+        }
         if(AtaSetTransferMode(deviceExtension, DeviceNumber, lChannel, LunExt, ATA_DMA)) {
             return;
         }
@@ -103,6 +103,7 @@ typedef struct _FDO_DEVICE_EXTENSION
     PHW_PASSIVE_INITIALIZE_ROUTINE HwPassiveInitRoutine;
     PKINTERRUPT Interrupt;
     ULONG InterruptIrql;
+    KSPIN_LOCK StartIoLock;
 } FDO_DEVICE_EXTENSION, *PFDO_DEVICE_EXTENSION;
 
 
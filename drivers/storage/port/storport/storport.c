@@ -160,6 +160,8 @@ PortAddDevice(
 
     DeviceExtension->PnpState = dsStopped;
 
+    KeInitializeSpinLock(&DeviceExtension->StartIoLock);
+
     /* Attach the FDO to the device stack */
     Status = IoAttachDeviceToDeviceStackSafe(Fdo,
                                              PhysicalDeviceObject,
@@ -1013,8 +1015,13 @@ StorPortNotification(
     PFDO_DEVICE_EXTENSION DeviceExtension = NULL;
     PHW_PASSIVE_INITIALIZE_ROUTINE HwPassiveInitRoutine;
     PBOOLEAN Result;
+    PLONG Succeeded;
     PSTOR_DPC Dpc;
     PHW_DPC_ROUTINE HwDpcRoutine;
+    PVOID SystemArgument1, SystemArgument2;
+    STOR_SPINLOCK SpinLock;
+    PVOID LockContext;
+    PSTOR_LOCK_HANDLE LockHandle;
     va_list ap;
 
     DPRINT1("StorPortNotification(%x %p)\n",
@@ -1059,12 +1066,89 @@ StorPortNotification(
             HwDpcRoutine = (PHW_DPC_ROUTINE)va_arg(ap, PHW_DPC_ROUTINE);
             DPRINT1("HwDpcRoutine %p\n", HwDpcRoutine);
 
+            /* The miniport DPC routine takes the STOR_DPC (it starts
+             * with the KDPC) and the miniport device extension */
             KeInitializeDpc((PRKDPC)&Dpc->Dpc,
                             (PKDEFERRED_ROUTINE)HwDpcRoutine,
-                            (PVOID)DeviceExtension);
+                            HwDeviceExtension);
             KeInitializeSpinLock(&Dpc->Lock);
             break;
 
+        case IssueDpc:
+            DPRINT("IssueDpc\n");
+            Dpc = (PSTOR_DPC)va_arg(ap, PSTOR_DPC);
+            SystemArgument1 = (PVOID)va_arg(ap, PVOID);
+            SystemArgument2 = (PVOID)va_arg(ap, PVOID);
+            Succeeded = (PLONG)va_arg(ap, PLONG);
+
+            /* It runs on the processor issuing it, that is the one which
+             * took the interrupt or submitted the request */
+            *Succeeded = KeInsertQueueDpc((PRKDPC)&Dpc->Dpc,
+                                          SystemArgument1,
+                                          SystemArgument2);
+            break;
+
+        case AcquireSpinLock:
+            DPRINT("AcquireSpinLock\n");
+            SpinLock = (STOR_SPINLOCK)va_arg(ap, STOR_SPINLOCK);
+            LockContext = (PVOID)va_arg(ap, PVOID);
+            LockHandle = (PSTOR_LOCK_HANDLE)va_arg(ap, PSTOR_LOCK_HANDLE);
+
+            LockHandle->Lock = SpinLock;
+            switch (SpinLock)
+            {
+                case DpcLock:
+                    /* The lock context is the STOR_DPC to synchronize with */
+                    KeAcquireInStackQueuedSpinLock(&((PSTOR_DPC)LockContext)->Lock,
+                                                   (PKLOCK_QUEUE_HANDLE)&LockHandle->Context);
+                    break;
+
+                case StartIoLock:
+                    ASSERT(DeviceExtension != NULL);
+                    KeAcquireInStackQueuedSpinLock(&DeviceExtension->StartIoLock,
+                                                   (PKLOCK_QUEUE_HANDLE)&LockHandle->Context);
+                    break;
+
+                case InterruptLock:
+                    ASSERT(DeviceExtension != NULL);
+                    if (DeviceExtension->Interrupt != NULL)
+                        LockHandle->Context.OldIrql = KeAcquireInterruptSpinLock(DeviceExtension->Interrupt);
+                    else
+                        KeRaiseIrql(HIGH_LEVEL, &LockHandle->Context.OldIrql);
+                    break;
+
+                default:
+                    DPRINT1("Unsupported spin lock %lu\n", SpinLock);
+                    break;
+            }
+            break;
+
+        case ReleaseSpinLock:
+            DPRINT("ReleaseSpinLock\n");
+            LockHandle = (PSTOR_LOCK_HANDLE)va_arg(ap, PSTOR_LOCK_HANDLE);
+
+            switch (LockHandle->Lock)
+            {
+                case DpcLock:
+                case StartIoLock:
+                    KeReleaseInStackQueuedSpinLock((PKLOCK_QUEUE_HANDLE)&LockHandle->Context);
+                    break;
+
+                case InterruptLock:
+                    ASSERT(DeviceExtension != NULL);
+                    if (DeviceExtension->Interrupt != NULL)
+                        KeReleaseInterruptSpinLock(DeviceExtension->Interrupt,
+                                                   LockHandle->Context.OldIrql);
+                    else
+                        KeLowerIrql(LockHandle->Context.OldIrql);
+                    break;
+
+                default:
+                    DPRINT1("Unsupported spin lock %lu\n", LockHandle->Lock);
+                    break;
+            }
+            break;
+
         default:
             DPRINT1("Unsupported Notification %lx\n", NotificationType);
             break;
@@ -1270,8 +1354,28 @@ StorPortStallExecution(
 }
 
 
+typedef struct _SYNCHRONIZE_ACCESS_CONTEXT
+{
+    PVOID HwDeviceExtension;
+    PSTOR_SYNCHRONIZED_ACCESS SynchronizedAccessRoutine;
+    PVOID Context;
+} SYNCHRONIZE_ACCESS_CONTEXT, *PSYNCHRONIZE_ACCESS_CONTEXT;
+
+static
+BOOLEAN
+NTAPI
+PortSynchronizeAccessRoutine(
+    _In_ PVOID SynchronizeContext)
+{
+    PSYNCHRONIZE_ACCESS_CONTEXT AccessContext = SynchronizeContext;
+
+    return AccessContext->SynchronizedAccessRoutine(AccessContext->HwDeviceExtension,
+                                                    AccessContext->Context);
+}
+
+
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 VOID
@@ -1281,8 +1385,36 @@ StorPortSynchronizeAccess(
     _In_ PSTOR_SYNCHRONIZED_ACCESS SynchronizedAccessRoutine,
     _In_opt_ PVOID Context)
 {
-    DPRINT1("StorPortSynchronizeAccess()\n");
-    UNIMPLEMENTED;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    SYNCHRONIZE_ACCESS_CONTEXT AccessContext;
+    KIRQL OldIrql;
+
+    DPRINT("StorPortSynchronizeAccess(%p %p %p)\n",
+           HwDeviceExtension, SynchronizedAccessRoutine, Context);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    AccessContext.HwDeviceExtension = HwDeviceExtension;
+    AccessContext.SynchronizedAccessRoutine = SynchronizedAccessRoutine;
+    AccessContext.Context = Context;
+
+    /* Run the routine with the interrupt held off */
+    if (DeviceExtension->Interrupt != NULL)
+    {
+        KeSynchronizeExecution(DeviceExtension->Interrupt,
+                               PortSynchronizeAccessRoutine,
+                               &AccessContext);
+    }
+    else
+    {
+        KeRaiseIrql(HIGH_LEVEL, &OldIrql);
+        PortSynchronizeAccessRoutine(&AccessContext);
+        KeLowerIrql(OldIrql);
+    }
 }
 
 
@@ -128,6 +128,9 @@ static VOID NTAPI
 ScsiPortIoTimer(PDEVICE_OBJECT DeviceObject,
 		PVOID Context);
 
+static BOOLEAN NTAPI
+SpiEnableInterrupts(IN PVOID Context);
+
 IO_ALLOCATION_ACTION
 NTAPI
 ScsiPortAllocateAdapterChannel(IN PDEVICE_OBJECT DeviceObject,
@@ -1991,11 +1994,21 @@ ScsiPortNotification(IN SCSI_NOTIFICATION_TYPE NotificationType,
           break;
 
       case CallDisableInterrupts:
-          DPRINT1("UNIMPLEMENTED SCSI Notification called: CallDisableInterrupts!\n");
+          DPRINT("Notify: CallDisableInterrupts\n");
+          /* Only valid from the routine called by the DPC for CallEnableInterrupts */
+          ASSERT(DeviceExtension->InterruptData.Flags & SCSI_PORT_DISABLE_INTERRUPTS);
+          /* The routine will be called synchronized with the ISR, re-enabling interrupts */
+          DeviceExtension->Flags |= SCSI_PORT_DISABLE_INT_REQUESET;
+          DeviceExtension->HwRequestInterrupt = (PHW_INTERRUPT)va_arg(ap, PHW_INTERRUPT);
           break;
 
       case CallEnableInterrupts:
-          DPRINT1("UNIMPLEMENTED SCSI Notification called: CallEnableInterrupts!\n");
+          DPRINT("Notify: CallEnableInterrupts\n");
+          ASSERT(!(DeviceExtension->InterruptData.Flags & SCSI_PORT_DISABLE_INTERRUPTS));
+          /* Stop calling the ISR and run the routine from the DPC instead */
+          DeviceExtension->InterruptData.Flags |=
+                SCSI_PORT_DISABLE_INTERRUPTS | SCSI_PORT_ENABLE_INT_REQUEST;
+          DeviceExtension->HwRequestInterrupt = (PHW_INTERRUPT)va_arg(ap, PHW_INTERRUPT);
           break;
 
       case RequestTimerCall:
@@ -5046,25 +5059,15 @@ TryAgain:
         /* Synchronize using spinlock */
         KeAcquireSpinLockAtDpcLevel(&DeviceExtension->SpinLock);
 
-        /* Request an interrupt */
-        DeviceExtension->HwInterrupt(DeviceExtension->MiniPortDeviceExtension);
+        /* Call the miniport's routine, with its ISR disabled */
+        DeviceExtension->HwRequestInterrupt(&DeviceExtension->MiniPortDeviceExtension);
 
         ASSERT(DeviceExtension->Flags & SCSI_PORT_DISABLE_INT_REQUESET);
 
-        /* Should interrupts be enabled again? */
-        if (DeviceExtension->Flags & SCSI_PORT_DISABLE_INT_REQUESET)
-        {
-            /* Clear this flag */
-            DeviceExtension->Flags &= ~SCSI_PORT_DISABLE_INT_REQUESET;
-
-            /* Call a special routine to do this */
-            ASSERT(FALSE);
-#if 0
-            KeSynchronizeExecution(DeviceExtension->Interrupt,
-                                   SpiEnableInterrupts,
-                                   DeviceExtension);
-#endif
-        }
+        /* Enable interrupts again, calling the miniport back if it asked for it */
+        KeSynchronizeExecution(DeviceExtension->Interrupt[0],
+                               SpiEnableInterrupts,
+                               DeviceExtension);
 
         /* If we need a notification again - loop */
         if (DeviceExtension->InterruptData.Flags & SCSI_PORT_NOTIFICATION_NEEDED)
@@ -5077,6 +5080,24 @@ TryAgain:
     DPRINT("ScsiPortDpcForIsr() done\n");
 }
 
+static BOOLEAN NTAPI
+SpiEnableInterrupts(IN PVOID Context)
+{
+    PSCSI_PORT_DEVICE_EXTENSION DeviceExtension = Context;
+
+    /* The ISR may call the miniport again */
+    DeviceExtension->InterruptData.Flags &= ~SCSI_PORT_DISABLE_INTERRUPTS;
+
+    /* Call the routine passed with CallDisableInterrupts, if any */
+    if (DeviceExtension->Flags & SCSI_PORT_DISABLE_INT_REQUESET)
+    {
+        DeviceExtension->Flags &= ~SCSI_PORT_DISABLE_INT_REQUESET;
+        DeviceExtension->HwRequestInterrupt(&DeviceExtension->MiniPortDeviceExtension);
+    }
+
+    return TRUE;
+}
+
 BOOLEAN
 NTAPI
 SpiProcessTimeout(PVOID ServiceContext)
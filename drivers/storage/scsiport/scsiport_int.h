@@ -259,6 +259,7 @@ typedef struct _SCSI_PORT_DEVICE_EXTENSION
     PHW_INITIALIZE HwInitialize;
     PHW_STARTIO HwStartIo;
     PHW_INTERRUPT HwInterrupt;
+    PHW_INTERRUPT HwRequestInterrupt; /* CallEnableInterrupts/CallDisableInterrupts routine */
     PHW_RESET_BUS HwResetBus;
     PHW_DMA_STARTED HwDmaStarted;
     PHW_TIMER HwScsiTimer;
@@ -548,6 +548,58 @@ AhciHwInitialize (
     return TRUE;
 }// -- AhciHwInitialize();
 
+/**
+ * @name AhciEnableCompletionCoalescing
+ * @implemented
+ *
+ * Add the port to command completion coalescing, if the HBA supports it
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciEnableCompletionCoalescing (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    ULONG ccc;
+    STOR_LOCK_HANDLE lockhandle = {0};
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+
+    AdapterExtension = PortExtension->AdapterExtension;
+
+    if ((AHCI_CCC_COMPLETIONS == 0) || ((AdapterExtension->CAP & AHCI_Global_HBA_CAP_CCCS) == 0))
+    {
+        return;
+    }
+
+    StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+
+    // 3.1.6
+    // CCC_CTL.CC and CCC_CTL.TV may only be changed while CCC_CTL.EN is cleared
+    ccc = StorPortReadRegisterUlong(AdapterExtension, &AdapterExtension->ABAR_Address->CCC_CTL);
+    if ((ccc & AHCI_Global_CCC_CTL_EN) != 0)
+    {
+        StorPortWriteRegisterUlong(AdapterExtension,
+                                   &AdapterExtension->ABAR_Address->CCC_CTL,
+                                   ccc & ~AHCI_Global_CCC_CTL_EN);
+    }
+
+    AdapterExtension->CccInterrupt = 1 << AHCI_Global_CCC_CTL_INT(ccc);
+    AdapterExtension->CccPorts |= 1 << PortExtension->PortNumber;
+    StorPortWriteRegisterUlong(AdapterExtension, &AdapterExtension->ABAR_Address->CCC_PTS, AdapterExtension->CccPorts);
+
+    ccc = AHCI_Global_CCC_CTL_TV(AHCI_CCC_TIMEOUT_MS) |
+          AHCI_Global_CCC_CTL_CC(AHCI_CCC_COMPLETIONS) |
+          AHCI_Global_CCC_CTL_EN;
+    StorPortWriteRegisterUlong(AdapterExtension, &AdapterExtension->ABAR_Address->CCC_CTL, ccc);
+
+    StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+
+    AhciDebugPrint("\tCompletion coalescing enabled, ports: %x\n", AdapterExtension->CccPorts);
+    return;
+}// -- AhciEnableCompletionCoalescing();
+
 /**
  * @name AhciCompleteIssuedSrb
  * @implemented
@@ -579,7 +631,7 @@ AhciCompleteIssuedSrb (
 
     for (i = 0; i < NCS; i++)
     {
-        if (((1 << i) & CommandsToComplete) != 0)
+        if (((1UL << i) & CommandsToComplete) != 0)
         {
             Srb = PortExtension->Slot[i];
 
@@ -588,6 +640,12 @@ AhciCompleteIssuedSrb (
                 continue;
             }
 
+            // the slot can be reused from now on
+            PortExtension->Slot[i] = NULL;
+            PortExtension->NcqIssuedSlots &= ~(1UL << i);
+            NT_ASSERT(PortExtension->Statistics.OutstandingCommands > 0);
+            PortExtension->Statistics.OutstandingCommands--;
+
             SrbExtension = GetSrbExtension(Srb);
             NT_ASSERT(SrbExtension != NULL);
 
@@ -697,6 +755,10 @@ AhciInterruptHandler (
     {
         AhciCompleteIssuedSrb(PortExtension, (PortExtension->CommandIssuedSlots & (~outstanding)));
         PortExtension->CommandIssuedSlots &= outstanding;
+
+        // slots were freed, issue whatever is still waiting in SrbQueue
+        AhciFillCommandSlots(PortExtension);
+        AhciActivatePort(PortExtension);
     }
 
     return;
@@ -721,6 +783,7 @@ AhciHwInterrupt (
     )
 {
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
+    PAHCI_PORT_EXTENSION PortExtension;
     ULONG portPending, nextPort, i, portCount;
 
     AdapterExtension = (PAHCI_ADAPTER_EXTENSION)DeviceExtension;
@@ -732,6 +795,29 @@ AhciHwInterrupt (
 
     portPending = StorPortReadRegisterUlong(AdapterExtension, AdapterExtension->IS);
 
+    // 3.1.6
+    // Command completions of the ports in CCC_PTS don't set their own IS.IPS bit,
+    // the HBA raises the CCC_CTL.INT bit instead once the threshold or the timeout is hit
+    if ((AdapterExtension->CccInterrupt & portPending) != 0)
+    {
+        StorPortWriteRegisterUlong(AdapterExtension, AdapterExtension->IS, AdapterExtension->CccInterrupt);
+
+        for (i = 0; i < AdapterExtension->PortCount; i++)
+        {
+            PortExtension = &AdapterExtension->PortExtension[i];
+            if (((AdapterExtension->CccPorts & (1 << i)) == 0) ||
+                (PortExtension->DeviceParams.IsActive == FALSE))
+            {
+                continue;
+            }
+
+            PortExtension->Statistics.CoalescedInterrupts++;
+            AhciInterruptHandler(PortExtension);
+        }
+
+        return TRUE;
+    }
+
     // we process interrupt for implemented ports only
     portCount = AdapterExtension->PortCount;
     portPending = portPending & AdapterExtension->PortImplemented;
@@ -1403,6 +1489,14 @@ AhciProcessSrb (
     NT_ASSERT(SlotIndex < AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
     SrbExtension->SlotIndex = SlotIndex;
 
+    if (IsNcqCommand(SrbExtension))
+    {
+        // FPDMA QUEUED commands carry the tag in Count[7:3], we use the slot index
+        NT_ASSERT(SlotIndex < PortExtension->MaxPortQueueDepth);
+        SrbExtension->SectorCountLow = (UCHAR)(SlotIndex << 3);
+        PortExtension->NcqIssuedSlots |= 1UL << SlotIndex;
+    }
+
     // program the CFIS in the CommandTable
     CommandHeader = &PortExtension->CommandList[SlotIndex];
 
@@ -1467,7 +1561,7 @@ AhciProcessSrb (
 
     // mark this slot
     PortExtension->Slot[SlotIndex] = Srb;
-    PortExtension->QueueSlots |= 1 << SlotIndex;
+    PortExtension->QueueSlots |= 1UL << SlotIndex;
     return;
 }// -- AhciProcessSrb();
 
@@ -1486,7 +1580,7 @@ AhciActivatePort (
     )
 {
     AHCI_PORT_CMD cmd;
-    ULONG QueueSlots, slotToActivate, tmp;
+    ULONG QueueSlots, ncqSlots, count, tmp;
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
 
     AhciDebugPrint("AhciActivatePort()\n");
@@ -1508,27 +1602,112 @@ AhciActivatePort (
         return;
     }
 
-    // get the lowest set bit
-    tmp = QueueSlots & (QueueSlots - 1);
+    // all the queued slots are issued together, AhciFillCommandSlots
+    // made sure they are either all NCQ or all non-queued commands
+    ncqSlots = QueueSlots & PortExtension->NcqIssuedSlots;
+    NT_ASSERT((ncqSlots == 0) || (ncqSlots == QueueSlots));
 
-    if (tmp == 0)
-        slotToActivate = QueueSlots;
-    else
-        slotToActivate = (QueueSlots & (~tmp));
-
-    // mark that bit off in QueueSlots
-    // so we can know we it is really needed to activate port or not
-    PortExtension->QueueSlots &= ~slotToActivate;
+    PortExtension->QueueSlots = 0;
     // mark this CommandIssuedSlots
     // to validate in completeIssuedCommand
-    PortExtension->CommandIssuedSlots |= slotToActivate;
+    PortExtension->CommandIssuedSlots |= QueueSlots;
+
+    // section 5.3.1
+    // For native queued commands PxSACT must be set before the slots are issued in PxCI
+    if (ncqSlots != 0)
+    {
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SACT, ncqSlots);
+    }
+
+    // tell the HBA to issue these Command Slots to the given port
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, QueueSlots);
+
+    // update queue depth statistics
+    for (count = 0, tmp = QueueSlots; tmp != 0; tmp &= (tmp - 1))
+        count++;
+
+    PortExtension->Statistics.CommandsIssued += count;
+    if (ncqSlots != 0)
+    {
+        PortExtension->Statistics.NcqCommandsIssued += count;
+    }
 
-    // tell the HBA to issue this Command Slot to the given port
-    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, slotToActivate);
+    PortExtension->Statistics.OutstandingCommands += count;
+    if (PortExtension->Statistics.OutstandingCommands > PortExtension->Statistics.MaxOutstandingCommands)
+    {
+        PortExtension->Statistics.MaxOutstandingCommands = PortExtension->Statistics.OutstandingCommands;
+        AhciDebugPrint("\tPort %d: queue depth reached %d\n",
+                       PortExtension->PortNumber,
+                       PortExtension->Statistics.MaxOutstandingCommands);
+    }
 
     return;
 }// -- AhciActivatePort();
 
+/**
+ * @name AhciFillCommandSlots
+ * @implemented
+ *
+ * Move pending Srbs from SrbQueue to free command slots, caller holds InterruptLock
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciFillCommandSlots (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    PSCSI_REQUEST_BLOCK tmpSrb;
+    PAHCI_SRB_EXTENSION SrbExtension;
+    ULONG freeSlots, busySlots, slotIndex;
+
+    if (PortExtension->DeviceParams.IsActive == FALSE)
+    {
+        return; // we should wait for device to get active
+    }
+
+    busySlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
+    freeSlots = AHCI_SLOT_MASK(PortExtension->MaxPortQueueDepth) & ~busySlots;
+
+    // iterate over HBA port slots
+    for (slotIndex = 0; (slotIndex < PortExtension->MaxPortQueueDepth) && (freeSlots != 0); slotIndex++)
+    {
+        if ((freeSlots & (1UL << slotIndex)) == 0)
+        {
+            continue;
+        }
+
+        tmpSrb = PeekQueue(&PortExtension->SrbQueue);
+        if (tmpSrb == NULL)
+        {
+            break;
+        }
+
+        // Native queued and non-queued commands can't be outstanding at the same time,
+        // leave the Srb in the queue until the other kind has drained
+        SrbExtension = GetSrbExtension(tmpSrb);
+        if (IsNcqCommand(SrbExtension))
+        {
+            if ((busySlots & ~PortExtension->NcqIssuedSlots) != 0)
+                break;
+        }
+        else if ((busySlots & PortExtension->NcqIssuedSlots) != 0)
+        {
+            break;
+        }
+
+        tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
+        NT_ASSERT(tmpSrb->PathId == PortExtension->PortNumber);
+        AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
+
+        busySlots |= 1UL << slotIndex;
+        freeSlots &= ~(1UL << slotIndex);
+    }
+
+    return;
+}// -- AhciFillCommandSlots();
+
 /**
  * @name AhciProcessIO
  * @implemented
@@ -1548,10 +1727,8 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     )
 {
-    PSCSI_REQUEST_BLOCK tmpSrb;
     STOR_LOCK_HANDLE lockhandle = {0};
     PAHCI_PORT_EXTENSION PortExtension;
-    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
 
     AhciDebugPrint("AhciProcessIO()\n");
     AhciDebugPrint("\tPathId: %d\n", PathId);
@@ -1573,36 +1750,8 @@ AhciProcessIO (
         return; // we should wait for device to get active
     }
 
-    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
-    NCS = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
-    commandSlotMask = (1 << NCS) - 1; // available slots mask
-
-    commandSlotMask = (commandSlotMask & ~occupiedSlots);
-    if(commandSlotMask != 0)
-    {
-        // iterate over HBA port slots
-        for (slotIndex = 0; slotIndex < NCS; slotIndex++)
-        {
-            // find first free slot
-            if ((commandSlotMask & (1 << slotIndex)) != 0)
-            {
-                tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
-                if (tmpSrb != NULL)
-                {
-                    NT_ASSERT(tmpSrb->PathId == PathId);
-                    AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
-                }
-                else
-                {
-                    break;
-                }
-            }
-            else
-            {
-                break;
-            }
-        }
-    }
+    // populate free command slots
+    AhciFillCommandSlots(PortExtension);
 
     // program HBA port
     AhciActivatePort(PortExtension);
@@ -1765,6 +1914,21 @@ InquiryCompletion (
         PortExtension->DeviceParams.RevisionID[sizeof(PortExtension->DeviceParams.RevisionID) - 1] = '\0';
         PortExtension->DeviceParams.SerialNumber[sizeof(PortExtension->DeviceParams.SerialNumber) - 1] = '\0';
 
+        /* Native Command Queuing, needs HBA CAP.SNCQ and 48bit LBA for the FPDMA commands */
+        if (IsAdapterCAPSNCQ(AdapterExtension->CAP) &&
+            PortExtension->DeviceParams.Lba48BitMode &&
+            (IdentifyDeviceData->ReservedWords76[0] & IDENTIFY_SATA_CAPABILITIES_NCQ))
+        {
+            PortExtension->DeviceParams.NcqSupported = 1;
+
+            // word 75 holds the maximum queue depth - 1, tags must stay below it
+            PortExtension->MaxPortQueueDepth = min(AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP),
+                                                   (ULONG)IdentifyDeviceData->QueueDepth + 1);
+
+            AhciDebugPrint("\tNCQ supported, Queue Depth: %d\n", PortExtension->MaxPortQueueDepth);
+            AhciEnableCompletionCoalescing(PortExtension);
+        }
+
         // TODO: Add other device params
         AhciDebugPrint("\tATA Device\n");
     }
@@ -1788,7 +1952,7 @@ InquiryCompletion (
     // prepare data to send
     InquiryData->Versions = 2;
     InquiryData->Wide32Bit = 1;
-    InquiryData->CommandQueue = 0; // NCQ not supported
+    InquiryData->CommandQueue = PortExtension->DeviceParams.NcqSupported;
     InquiryData->ResponseDataFormat = 0x2;
     InquiryData->DeviceTypeModifier = 0;
     InquiryData->DeviceTypeQualifier = DEVICE_CONNECTED;
@@ -1810,7 +1974,7 @@ InquiryCompletion (
                                          Srb->PathId,
                                          Srb->TargetId,
                                          Srb->Lun,
-                                         AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
+                                         PortExtension->MaxPortQueueDepth);
 
     NT_ASSERT(status == TRUE);
     return;
@@ -2066,6 +2230,19 @@ DeviceRequestReadWrite (
 
     NT_ASSERT(SectorCount < 0x100);
 
+    if (PortExtension->DeviceParams.NcqSupported)
+    {
+        // READ/WRITE FPDMA QUEUED: sector count moves to the Features register,
+        // the tag goes to Count[7:3] once AhciProcessSrb picked a slot
+        SrbExtension->Flags |= ATA_FLAGS_NCQ_COMMAND;
+        SrbExtension->CommandReg = IsReading ? IDE_COMMAND_READ_FPDMA_QUEUED : IDE_COMMAND_WRITE_FPDMA_QUEUED;
+        SrbExtension->FeaturesLow = (SectorCount >> 0) & 0xFF;
+        SrbExtension->FeaturesHigh = (SectorCount >> 8) & 0xFF;
+        SrbExtension->SectorCountLow = 0;
+        SrbExtension->SectorCountHigh = 0;
+        SrbExtension->Device = IDE_LBA_MODE;
+    }
+
     SrbExtension->pSgl = (PLOCAL_SCATTER_GATHER_LIST)StorPortGetScatterGatherList(AdapterExtension, Srb);
 
     return SRB_STATUS_PENDING;
@@ -2537,6 +2714,33 @@ RemoveQueue (
     return Srb;
 }// -- RemoveQueue();
 
+/**
+ * @name PeekQueue
+ * @implemented
+ *
+ * Return Srb at the head of Queue without removing it
+ *
+ * @param Queue
+ *
+ * @return
+ * return Srb
+ *
+ */
+__inline
+PVOID
+PeekQueue (
+    __in PAHCI_QUEUE Queue
+    )
+{
+    NT_ASSERT(Queue->Head < MAXIMUM_QUEUE_BUFFER_SIZE);
+    NT_ASSERT(Queue->Tail < MAXIMUM_QUEUE_BUFFER_SIZE);
+
+    if (Queue->Head == Queue->Tail)
+        return NULL;
+
+    return Queue->Buffer[Queue->Tail];
+}// -- PeekQueue();
+
 /**
  * @name GetSrbExtension
  * @implemented
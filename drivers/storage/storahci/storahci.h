@@ -20,7 +20,7 @@
 
 #define MAXIMUM_AHCI_PORT_COUNT             32
 #define MAXIMUM_AHCI_PRDT_ENTRIES           32
-#define MAXIMUM_AHCI_PORT_NCS               30
+#define MAXIMUM_AHCI_PORT_NCS               32
 #define MAXIMUM_QUEUE_BUFFER_SIZE           255
 #define MAXIMUM_TRANSFER_LENGTH             (128*1024) // 128 KB
 
@@ -33,6 +33,26 @@
 
 // section 3.1.2
 #define AHCI_Global_HBA_CAP_S64A            (1 << 31)
+#define AHCI_Global_HBA_CAP_SNCQ            (1 << 30)
+#define AHCI_Global_HBA_CAP_CCCS            (1 << 7)
+
+// section 3.1.6 -- command completion coalescing
+#define AHCI_Global_CCC_CTL_EN              (1 << 0)
+#define AHCI_Global_CCC_CTL_INT(x)          (((x) >> 3) & 0x1F)
+#define AHCI_Global_CCC_CTL_CC(x)           (((x) & 0xFF) << 8)
+#define AHCI_Global_CCC_CTL_TV(x)           (((x) & 0xFFFF) << 16)
+
+// coalescing applied to NCQ ports, an interrupt is raised after that many
+// completions or once the timeout (in ms) expires. 0 completions disables it
+#define AHCI_CCC_COMPLETIONS                8
+#define AHCI_CCC_TIMEOUT_MS                 1
+
+// READ/WRITE FPDMA QUEUED, not in ata.h
+#define IDE_COMMAND_READ_FPDMA_QUEUED       0x60
+#define IDE_COMMAND_WRITE_FPDMA_QUEUED      0x61
+
+// IDENTIFY DEVICE word 76 -- Serial ATA capabilities
+#define IDENTIFY_SATA_CAPABILITIES_NCQ      (1 << 8)
 
 // FIS Types : http://wiki.osdev.org/AHCI
 #define FIS_TYPE_REG_H2D        0x27 // Register FIS - host to device
@@ -71,14 +91,20 @@
 #define ATA_FLAGS_DATA_OUT                  (1 << 2)
 #define ATA_FLAGS_48BIT_COMMAND             (1 << 3)
 #define ATA_FLAGS_USE_DMA                   (1 << 4)
+#define ATA_FLAGS_NCQ_COMMAND               (1 << 5)
 
 #define IsAtaCommand(AtaFunction)           (AtaFunction & ATA_FUNCTION_ATA_COMMAND)
 #define IsAtapiCommand(AtaFunction)         (AtaFunction & ATA_FUNCTION_ATAPI_COMMAND)
 #define IsDataTransferNeeded(SrbExtension)  (SrbExtension->Flags & (ATA_FLAGS_DATA_IN | ATA_FLAGS_DATA_OUT))
 #define IsAdapterCAPS64(CAP)                (CAP & AHCI_Global_HBA_CAP_S64A)
+#define IsAdapterCAPSNCQ(CAP)               (CAP & AHCI_Global_HBA_CAP_SNCQ)
+#define IsNcqCommand(SrbExtension)          (SrbExtension->Flags & ATA_FLAGS_NCQ_COMMAND)
+
+// 3.1.1 NCS = CAP[12:08] -> 0's based value, 1 to 32 slots
+#define AHCI_Global_Port_CAP_NCS(x)         ((((x) & 0x1F00) >> 8) + 1)
 
-// 3.1.1 NCS = CAP[12:08] -> Align
-#define AHCI_Global_Port_CAP_NCS(x)         (((x) & 0xF00) >> 8)
+// bit mask of the first `n` command slots, n may be 32
+#define AHCI_SLOT_MASK(n)                   ((n) >= 32 ? MAXULONG : ((1UL << (n)) - 1))
 
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 //#define AhciDebugPrint(format, ...) StorPortDebugPrint(0, format, __VA_ARGS__)
@@ -464,6 +490,7 @@ typedef struct _AHCI_PORT_EXTENSION
     ULONG PortNumber;
     ULONG QueueSlots;                                   // slots which we have already assigned task (Slot)
     ULONG CommandIssuedSlots;                           // slots which has been programmed
+    ULONG NcqIssuedSlots;                               // slots holding NCQ commands, queued or issued through PxSACT
     ULONG MaxPortQueueDepth;
 
     struct
@@ -473,6 +500,7 @@ typedef struct _AHCI_PORT_EXTENSION
         UCHAR AccessType;
         UCHAR DeviceType;
         UCHAR IsActive;
+        UCHAR NcqSupported;
         LARGE_INTEGER MaxLba;
         ULONG BytesPerLogicalSector;
         ULONG BytesPerPhysicalSector;
@@ -481,6 +509,15 @@ typedef struct _AHCI_PORT_EXTENSION
         UCHAR SerialNumber[21];
     } DeviceParams;
 
+    struct
+    {
+        ULONG CommandsIssued;
+        ULONG NcqCommandsIssued;
+        ULONG OutstandingCommands;                      // current queue depth
+        ULONG MaxOutstandingCommands;                   // highest queue depth seen
+        ULONG CoalescedInterrupts;
+    } Statistics;
+
     STOR_DPC CommandCompletion;
     PAHCI_PORT Port;                                    // AHCI Port Infomation
     AHCI_QUEUE SrbQueue;                                // pending Srbs
@@ -513,6 +550,8 @@ typedef struct _AHCI_ADAPTER_EXTENSION
     ULONG   CAP2;
     ULONG   LastInterruptPort;
     ULONG   CurrentCommandSlot;
+    ULONG   CccPorts;// ports in command completion coalescing
+    ULONG   CccInterrupt;// IS bit raised for coalesced completions
 
     PVOID NonCachedExtension; // holds virtual address to noncached buffer allocated for Port Extension
 
@@ -576,6 +615,21 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     );
 
+VOID
+AhciFillCommandSlots (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    );
+
+VOID
+AhciActivatePort (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    );
+
+VOID
+AhciEnableCompletionCoalescing (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    );
+
 BOOLEAN
 AhciAdapterReset (
     __in PAHCI_ADAPTER_EXTENSION AdapterExtension
@@ -645,6 +699,12 @@ RemoveQueue (
     __inout PAHCI_QUEUE Queue
     );
 
+__inline
+PVOID
+PeekQueue (
+    __in PAHCI_QUEUE Queue
+    );
+
 __inline
 PAHCI_SRB_EXTENSION
 GetSrbExtension(
@@ -24,6 +24,7 @@
 
 /* Transfer Descriptor Control */
 #define OHCI_TD_INTERRUPT_IMMEDIATE 0
+#define OHCI_TD_INTERRUPT_DELAYED   6
 #define OHCI_TD_INTERRUPT_NONE      7
 
 #define OHCI_TD_DIRECTION_PID_SETUP    0
@@ -1539,11 +1539,25 @@ OHCI_BulkOrInterruptTransfer(IN POHCI_EXTENSION OhciExtension,
 
     if (TransferParameters->TransferFlags & USBD_SHORT_TRANSFER_OK)
     {
-        PrevTD->HwTD.gTD.Control.BufferRounding = TRUE;
         OhciTransfer->Flags |= OHCI_TRANSFER_FLAGS_SHORT_TRANSFER_OK;
     }
 
-    PrevTD->HwTD.gTD.Control.DelayInterrupt = OHCI_TD_INTERRUPT_IMMEDIATE;
+    if (TransferParameters->IsSplitContinued)
+    {
+        /*
+         * More splits of this transfer are queued behind this one. A short
+         * packet halts the endpoint here and is handled as an error, so
+         * the interrupt can wait for the end of the chain.
+         */
+        PrevTD->HwTD.gTD.Control.DelayInterrupt = OHCI_TD_INTERRUPT_DELAYED;
+    }
+    else
+    {
+        if (TransferParameters->TransferFlags & USBD_SHORT_TRANSFER_OK)
+            PrevTD->HwTD.gTD.Control.BufferRounding = TRUE;
+
+        PrevTD->HwTD.gTD.Control.DelayInterrupt = OHCI_TD_INTERRUPT_IMMEDIATE;
+    }
     PrevTD->HwTD.gTD.NextTD = TD->PhysicalAddress;
     PrevTD->NextHcdTD = (ULONG)TD;
 
@@ -21,94 +21,63 @@ USBPORT_MakeSplitTransfer(IN PDEVICE_OBJECT FdoDevice,
                           IN ULONG TransferRemainLen,
                           IN ULONG TransferOffset)
 {
+    PUSBPORT_SCATTER_GATHER_LIST SgList;
     PUSBPORT_SCATTER_GATHER_LIST SplitSgList;
-    PUSBPORT_SCATTER_GATHER_ELEMENT Element0;
-    PUSBPORT_SCATTER_GATHER_ELEMENT Element1;
+    PUSBPORT_SCATTER_GATHER_ELEMENT SgElement;
+    PUSBPORT_SCATTER_GATHER_ELEMENT SplitElement;
+    SIZE_T SplitLength = 0;
     SIZE_T SgLength;
-    SIZE_T SgRemainLen;
+    ULONG ElementCount = 0;
 
     DPRINT("USBPORT_MakeSplitTransfer: ... \n");
 
+    SgList = &Transfer->SgList;
     SplitSgList = &SplitTransfer->SgList;
-    Element0 = &SplitSgList->SgElement[0];
 
-    SgLength = Transfer->SgList.SgElement[*SgIdx].SgTransferLength - *SgOffset;
-
-    if (SgLength > MaxTransferSize)
+    /*
+     * Fill the split with whole or partial elements of the parent, so that
+     * every split but the last one is MaxTransferSize long. The split was
+     * copied from the parent, its list has room for all parent elements.
+     */
+    while (SplitLength < MaxTransferSize && TransferRemainLen)
     {
-        /* SgLength > MaxTransferSize */
-        SplitTransfer->SgList.SgElementCount = 1;
+        SgElement = &SgList->SgElement[*SgIdx];
 
-        Element0->SgOffset = 0;
-        Element0->SgTransferLength = MaxTransferSize;
-        Element0->SgPhysicalAddress.LowPart = Transfer->SgList.SgElement[*SgIdx].SgPhysicalAddress.LowPart + *SgOffset;
+        SgLength = SgElement->SgTransferLength - *SgOffset;
 
-        SplitTransfer->TransferParameters.IsTransferSplited = TRUE;
-        SplitTransfer->TransferParameters.TransferBufferLength = MaxTransferSize;
+        if (SgLength > MaxTransferSize - SplitLength)
+            SgLength = MaxTransferSize - SplitLength;
 
-        SplitTransfer->SgList.CurrentVa = Transfer->SgList.CurrentVa + TransferOffset;
-        SplitTransfer->SgList.MappedSystemVa = (PVOID)((ULONG_PTR)Transfer->SgList.MappedSystemVa + TransferOffset);
+        SplitElement = &SplitSgList->SgElement[ElementCount];
+        ElementCount++;
 
-        SplitTransfer->Flags |= TRANSFER_FLAG_SPLITED;
+        SplitElement->SgPhysicalAddress.QuadPart = SgElement->SgPhysicalAddress.QuadPart +
+                                                   *SgOffset;
+        SplitElement->SgTransferLength = SgLength;
+        SplitElement->SgOffset = SplitLength;
 
-        *SgOffset += MaxTransferSize;
-        TransferRemainLen -= MaxTransferSize;
-        return TransferRemainLen;
-    }
+        SplitLength += SgLength;
+        TransferRemainLen -= SgLength;
+        *SgOffset += SgLength;
 
-    /* SgLength <= MaxTransferSize */
-    SplitTransfer->SgList.SgElementCount = 1;
-    TransferRemainLen -= SgLength;
+        if (*SgOffset == SgElement->SgTransferLength)
+        {
+            ++*SgIdx;
+            *SgOffset = 0;
+        }
+    }
 
-    Element0->SgOffset = 0;
-    Element0->SgTransferLength = SgLength;
-    Element0->SgPhysicalAddress.LowPart = Transfer->SgList.SgElement[*SgIdx].SgPhysicalAddress.LowPart + *SgOffset;
+    SplitSgList->SgElementCount = ElementCount;
 
-    SplitTransfer->TransferParameters.TransferBufferLength = SgLength;
     SplitTransfer->TransferParameters.IsTransferSplited = TRUE;
+    SplitTransfer->TransferParameters.IsSplitContinued = (TransferRemainLen != 0);
+    SplitTransfer->TransferParameters.TransferBufferLength = SplitLength;
 
     SplitTransfer->SgList.CurrentVa = Transfer->SgList.CurrentVa + TransferOffset;
     SplitTransfer->SgList.MappedSystemVa = (PVOID)((ULONG_PTR)Transfer->SgList.MappedSystemVa + TransferOffset);
 
     SplitTransfer->Flags |= TRANSFER_FLAG_SPLITED;
 
-    *SgOffset += SgLength;
-
-    SgRemainLen = MaxTransferSize - SgLength;
-
-    if (SgRemainLen > TransferRemainLen)
-    {
-        SgRemainLen = TransferRemainLen;
-    }
-
-    if (!SgRemainLen)
-    {
-        /* SgLength == MaxTransferSize */
-        ++*SgIdx;
-        *SgOffset = 0;
-        return TransferRemainLen;
-    }
-
-    /* SgLength < MaxTransferSize */
-
-    DPRINT1("MakeSplitTransfer: SgRemainLen - %x\n", SgRemainLen);
-    DPRINT1("MakeSplitTransfer: SgIdx - %x\n", *SgIdx);
-    ++*SgIdx;
-
-    *SgOffset = 0;
-    SplitTransfer->SgList.SgElementCount++;
-
-    Element1 = &SplitSgList->SgElement[1];
-
-    Element1->SgOffset = SgRemainLen;
-    Element1->SgTransferLength = Element0->SgTransferLength;
-    Element1->SgPhysicalAddress.LowPart = Transfer->SgList.SgElement[*SgIdx].SgPhysicalAddress.LowPart + *SgOffset;
-
-    SplitTransfer->TransferParameters.TransferBufferLength += SgRemainLen;
-
-    *SgOffset += SgRemainLen;
-    TransferRemainLen -= SgRemainLen;
-
     return TransferRemainLen;
 }
 
@@ -132,11 +101,15 @@ USBPORT_SplitBulkInterruptTransfer(IN PDEVICE_OBJECT FdoDevice,
 
     DPRINT("USBPORT_SplitBulkInterruptTransfer: ... \n");
 
+    /*
+     * The splits are as big as the miniport allows, each one is a single
+     * chain of TDs and only the last one needs to end in a short packet.
+     */
     MaxTransferSize = Endpoint->EndpointProperties.TotalMaxPacketSize *
                       (Endpoint->EndpointProperties.MaxTransferSize /
                        Endpoint->EndpointProperties.TotalMaxPacketSize);
 
-    if (Endpoint->EndpointProperties.MaxTransferSize > PAGE_SIZE)
+    if (MaxTransferSize == 0)
     {
         KeBugCheckEx(BUGCODE_USB_DRIVER, 1, 0, 0, 0);
     }
@@ -144,7 +117,10 @@ USBPORT_SplitBulkInterruptTransfer(IN PDEVICE_OBJECT FdoDevice,
     TransferBufferLength = Transfer->TransferParameters.TransferBufferLength;
     Transfer->Flags |= TRANSFER_FLAG_PARENT;
 
-    NeedSplits = TransferBufferLength / MaxTransferSize + 1;
+    /* The miniport tells the splits of different transfers apart by this */
+    Transfer->TransferParameters.TransferCounter = ++Endpoint->SplitTransferCounter;
+
+    NeedSplits = (TransferBufferLength + MaxTransferSize - 1) / MaxTransferSize;
 
     InitializeListHead(&tmplist);
 
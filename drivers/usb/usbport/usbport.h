@@ -217,6 +217,7 @@ typedef struct _USBPORT_ENDPOINT {
   UCHAR Padded[2];
   LONG LockCounter;
   LONG FlushPendingLock;
+  ULONG SplitTransferCounter;
   /* State */
   ULONG StateLast;
   ULONG StateNext;
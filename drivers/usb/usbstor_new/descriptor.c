@@ -207,6 +207,8 @@ USBSTOR_ScanConfigurationDescriptor(
 {
     PUSB_CONFIGURATION_DESCRIPTOR CurrentDescriptor;
     PUSB_ENDPOINT_DESCRIPTOR EndpointDescriptor;
+    PUSB_INTERFACE_DESCRIPTOR InterfaceDescriptor;
+    BOOLEAN SkipEndpoints = FALSE;
 
     //
     // sanity checks
@@ -238,20 +240,42 @@ USBSTOR_ScanConfigurationDescriptor(
             //
             // found interface descriptor
             //
+            InterfaceDescriptor = (PUSB_INTERFACE_DESCRIPTOR)CurrentDescriptor;
+
             if (*OutInterfaceDescriptor)
             {
+                if (InterfaceDescriptor->bInterfaceNumber != (*OutInterfaceDescriptor)->bInterfaceNumber)
+                {
+                    //
+                    // we only process the first interface descriptor as ms does -> see documentation
+                    //
+                    break;
+                }
+
+                if (InterfaceDescriptor->bInterfaceProtocol != USB_PROTOCOL_UAS ||
+                    (*OutInterfaceDescriptor)->bInterfaceProtocol == USB_PROTOCOL_UAS)
+                {
+                    //
+                    // ignore the other alternate settings
+                    //
+                    SkipEndpoints = TRUE;
+                    goto NextDescriptor;
+                }
+
                 //
-                // we only process the first interface descriptor as ms does -> see documentation
+                // prefer the USB attached SCSI alternate setting over bulk only transport
                 //
-                break;
+                *InEndpointDescriptor = NULL;
+                *OutEndpointDescriptor = NULL;
             }
 
             //
             // store interface descriptor
             //
-            *OutInterfaceDescriptor = (PUSB_INTERFACE_DESCRIPTOR)CurrentDescriptor;
+            *OutInterfaceDescriptor = InterfaceDescriptor;
+            SkipEndpoints = FALSE;
         }
-        else if (CurrentDescriptor->bDescriptorType == USB_ENDPOINT_DESCRIPTOR_TYPE)
+        else if (CurrentDescriptor->bDescriptorType == USB_ENDPOINT_DESCRIPTOR_TYPE && !SkipEndpoints)
         {
             //
             // convert to endpoint descriptor
@@ -295,6 +319,7 @@ USBSTOR_ScanConfigurationDescriptor(
             }
         }
 
+NextDescriptor:
         //
         // move to next descriptor
         //
@@ -368,6 +393,13 @@ USBSTOR_SelectConfigurationAndInterface(
         return Status;
     }
 
+    //
+    // devices with an USB attached SCSI alternate setting take tagged commands
+    //
+    DeviceExtension->IsUAS = (InterfaceDescriptor->bInterfaceProtocol == USB_PROTOCOL_UAS);
+    DPRINT1("USBSTOR_SelectConfigurationAndInterface: interface %x alternate setting %x protocol %x\n",
+            InterfaceDescriptor->bInterfaceNumber, InterfaceDescriptor->bAlternateSetting, InterfaceDescriptor->bInterfaceProtocol);
+
     //
     // now allocate one interface entry and terminating null entry
     //
@@ -481,6 +513,121 @@ USBSTOR_SelectConfigurationAndInterface(
     return Status;
 }
 
+UCHAR
+USBSTOR_GetUasPipeId(
+    IN PFDO_DEVICE_EXTENSION DeviceExtension,
+    IN UCHAR EndpointAddress)
+{
+    PUSB_COMMON_DESCRIPTOR CurrentDescriptor;
+    PUSB_INTERFACE_DESCRIPTOR InterfaceDescriptor;
+    PUSB_PIPE_USAGE_DESCRIPTOR PipeUsageDescriptor;
+    BOOLEAN InInterface = FALSE, EndpointFound = FALSE;
+    ULONG_PTR End;
+
+    //
+    // the pipe usage descriptor follows the endpoint descriptor of the selected alternate setting
+    //
+    CurrentDescriptor = (PUSB_COMMON_DESCRIPTOR)DeviceExtension->ConfigurationDescriptor;
+    End = (ULONG_PTR)DeviceExtension->ConfigurationDescriptor + DeviceExtension->ConfigurationDescriptor->wTotalLength;
+
+    while ((ULONG_PTR)CurrentDescriptor + sizeof(USB_COMMON_DESCRIPTOR) <= End && CurrentDescriptor->bLength)
+    {
+        if (CurrentDescriptor->bDescriptorType == USB_INTERFACE_DESCRIPTOR_TYPE)
+        {
+            //
+            // check if this is the selected interface
+            //
+            InterfaceDescriptor = (PUSB_INTERFACE_DESCRIPTOR)CurrentDescriptor;
+            InInterface = (InterfaceDescriptor->bInterfaceNumber == DeviceExtension->InterfaceInformation->InterfaceNumber &&
+                           InterfaceDescriptor->bAlternateSetting == DeviceExtension->InterfaceInformation->AlternateSetting);
+            EndpointFound = FALSE;
+        }
+        else if (InInterface && CurrentDescriptor->bDescriptorType == USB_ENDPOINT_DESCRIPTOR_TYPE)
+        {
+            //
+            // is it the endpoint
+            //
+            EndpointFound = (((PUSB_ENDPOINT_DESCRIPTOR)CurrentDescriptor)->bEndpointAddress == EndpointAddress);
+        }
+        else if (EndpointFound && CurrentDescriptor->bDescriptorType == USB_PIPE_USAGE_DESCRIPTOR_TYPE &&
+                 CurrentDescriptor->bLength >= sizeof(USB_PIPE_USAGE_DESCRIPTOR))
+        {
+            //
+            // found pipe usage
+            //
+            PipeUsageDescriptor = (PUSB_PIPE_USAGE_DESCRIPTOR)CurrentDescriptor;
+            return PipeUsageDescriptor->bPipeID;
+        }
+
+        //
+        // move to next descriptor
+        //
+        CurrentDescriptor = (PUSB_COMMON_DESCRIPTOR)((ULONG_PTR)CurrentDescriptor + CurrentDescriptor->bLength);
+    }
+
+    //
+    // no pipe usage descriptor
+    //
+    return 0;
+}
+
+NTSTATUS
+USBSTOR_GetUasPipeHandles(
+    IN PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    ULONG Index;
+    UCHAR PipeId;
+    ULONG PipesFound = 0;
+
+    //
+    // the pipes are identified by their pipe usage descriptor
+    //
+    for(Index = 0; Index < DeviceExtension->InterfaceInformation->NumberOfPipes; Index++)
+    {
+        if (DeviceExtension->InterfaceInformation->Pipes[Index].PipeType != UsbdPipeTypeBulk)
+            continue;
+
+        PipeId = USBSTOR_GetUasPipeId(DeviceExtension, DeviceExtension->InterfaceInformation->Pipes[Index].EndpointAddress);
+        switch (PipeId)
+        {
+            case UAS_PIPE_ID_COMMAND:
+                DeviceExtension->UasCommandPipeIndex = Index;
+                break;
+            case UAS_PIPE_ID_STATUS:
+                DeviceExtension->UasStatusPipeIndex = Index;
+                break;
+            case UAS_PIPE_ID_DATA_IN:
+                //
+                // data pipes are used as the bulk only pipes are
+                //
+                DeviceExtension->BulkInPipeIndex = Index;
+                break;
+            case UAS_PIPE_ID_DATA_OUT:
+                DeviceExtension->BulkOutPipeIndex = Index;
+                break;
+            default:
+                DPRINT1("USBSTOR_GetUasPipeHandles> endpoint %x has unknown pipe id %x\n", DeviceExtension->InterfaceInformation->Pipes[Index].EndpointAddress, PipeId);
+                continue;
+        }
+
+        PipesFound |= (1 << PipeId);
+    }
+
+    //
+    // check if all four pipes have been found
+    //
+    if (PipesFound != ((1 << UAS_PIPE_ID_COMMAND) | (1 << UAS_PIPE_ID_STATUS) | (1 << UAS_PIPE_ID_DATA_IN) | (1 << UAS_PIPE_ID_DATA_OUT)))
+    {
+        DPRINT1("USBSTOR_GetUasPipeHandles> pipes missing %lx\n", PipesFound);
+        return STATUS_DEVICE_CONFIGURATION_ERROR;
+    }
+
+    //
+    // device is configured
+    //
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 USBSTOR_GetPipeHandles(
     IN PFDO_DEVICE_EXTENSION DeviceExtension)
@@ -488,6 +635,14 @@ USBSTOR_GetPipeHandles(
     ULONG Index;
     BOOLEAN BulkInFound = FALSE, BulkOutFound = FALSE;
 
+    if (DeviceExtension->IsUAS)
+    {
+        //
+        // USB attached SCSI uses a command, status, data in and data out pipe
+        //
+        return USBSTOR_GetUasPipeHandles(DeviceExtension);
+    }
+
     //
     // no enumerate all pipes and extract bulk-in / bulk-out pipe handle
     //
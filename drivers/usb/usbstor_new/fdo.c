@@ -142,6 +142,10 @@ USBSTOR_FdoHandleRemoveDevice(
         }
     }
 
+    /* Stop reading the status pipe */
+    if (DeviceExtension->IsUAS)
+        USBSTOR_UasTerminate(DeviceExtension);
+
     /* Send the IRP down the stack */
     IoSkipCurrentIrpStackLocation(Irp);
     Status = IoCallDriver(DeviceExtension->LowerDeviceObject, Irp);
@@ -213,7 +217,8 @@ USBSTOR_FdoHandleStartDevice(
     ASSERT(InterfaceDesc->bLength == sizeof(USB_INTERFACE_DESCRIPTOR));
 
     DPRINT("bInterfaceSubClass %x\n", InterfaceDesc->bInterfaceSubClass);
-    if (InterfaceDesc->bInterfaceProtocol != 0x50)
+    if (InterfaceDesc->bInterfaceProtocol != USB_PROTOCOL_BULK_ONLY &&
+        InterfaceDesc->bInterfaceProtocol != USB_PROTOCOL_UAS)
     {
         DPRINT1("USB Device is not a bulk only device and is not currently supported\n");
         return STATUS_NOT_SUPPORTED;
@@ -255,17 +260,37 @@ USBSTOR_FdoHandleStartDevice(
         return Status;
     }
 
-    //
-    // get num of lun which are supported
-    //
-    Status = USBSTOR_GetMaxLUN(DeviceExtension->LowerDeviceObject, DeviceExtension);
-    if (!NT_SUCCESS(Status))
+    if (DeviceExtension->IsUAS)
     {
         //
-        // failed to get max LUN
+        // there is no get max lun request with USB attached SCSI, only lun 0 is used
         //
-        DPRINT1("USBSTOR_FdoHandleStartDevice failed to get max lun %x\n", Status);
-        return Status;
+        DeviceExtension->MaxLUN = 0;
+
+        //
+        // prepare reading the status pipe
+        //
+        Status = USBSTOR_UasInitialize(DeviceExtension);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("USBSTOR_FdoHandleStartDevice failed to initialize uas %x\n", Status);
+            return Status;
+        }
+    }
+    else
+    {
+        //
+        // get num of lun which are supported
+        //
+        Status = USBSTOR_GetMaxLUN(DeviceExtension->LowerDeviceObject, DeviceExtension);
+        if (!NT_SUCCESS(Status))
+        {
+            //
+            // failed to get max LUN
+            //
+            DPRINT1("USBSTOR_FdoHandleStartDevice failed to get max lun %x\n", Status);
+            return Status;
+        }
     }
 
     //
@@ -173,10 +173,22 @@ USBSTOR_QueueAddIrp(
     //
     KeAcquireSpinLock(&FDODeviceExtension->IrpListLock, &OldLevel);
 
-    //
-    // check if there are irp pending
-    //
-    SrbProcessing = FDODeviceExtension->IrpPendingCount != 0;
+    if (FDODeviceExtension->IsUAS)
+    {
+        //
+        // USB attached SCSI devices take a new command while tagged commands are outstanding
+        //
+        SrbProcessing = (FDODeviceExtension->ActiveSrb != NULL ||
+                         FDODeviceExtension->UasCommandCount >= USBSTOR_UAS_MAX_COMMANDS ||
+                         !IsListEmpty(&FDODeviceExtension->IrpListHead));
+    }
+    else
+    {
+        //
+        // check if there are irp pending
+        //
+        SrbProcessing = FDODeviceExtension->IrpPendingCount != 0;
+    }
 
     if (SrbProcessing)
     {
@@ -185,6 +197,14 @@ USBSTOR_QueueAddIrp(
         //
         InsertTailList(&FDODeviceExtension->IrpListHead, &Irp->Tail.Overlay.ListEntry);
     }
+    else
+    {
+        //
+        // this one is started now
+        //
+        ASSERT(FDODeviceExtension->ActiveSrb == NULL);
+        FDODeviceExtension->ActiveSrb = Request;
+    }
 
     //
     // increment pending count
@@ -217,15 +237,10 @@ USBSTOR_QueueAddIrp(
     //
     if (SrbProcessing)
     {
-        ASSERT(FDODeviceExtension->ActiveSrb != NULL);
-
         OldDriverCancel = IoSetCancelRoutine(Irp, USBSTOR_Cancel);
     }
     else
     {
-        ASSERT(FDODeviceExtension->ActiveSrb == NULL);
-
-        FDODeviceExtension->ActiveSrb = Request;
         OldDriverCancel = IoSetCancelRoutine(Irp, USBSTOR_CancelIo);
     }
 
@@ -407,10 +422,11 @@ USBSTOR_QueueNextRequest(
     ASSERT(FDODeviceExtension->Common.IsFDO);
 
     //
-    // check first if there's already a request pending or the queue is frozen
+    // check first if there's already a request pending, all tags are used or the queue is frozen
     //
     if (FDODeviceExtension->ActiveSrb != NULL ||
-        FDODeviceExtension->IrpListFreeze)
+        FDODeviceExtension->IrpListFreeze ||
+        (FDODeviceExtension->IsUAS && FDODeviceExtension->UasCommandCount >= USBSTOR_UAS_MAX_COMMANDS))
     {
         //
         // no work to do yet
@@ -165,32 +165,10 @@ USBSTOR_QueueWorkItem(
 }
 
 
-//
-// driver verifier
-//
-IO_COMPLETION_ROUTINE USBSTOR_CSWCompletionRoutine;
-
-NTSTATUS
-NTAPI
-USBSTOR_CSWCompletionRoutine(
-    PDEVICE_OBJECT DeviceObject,
-    PIRP Irp,
-    PVOID Ctx)
+VOID
+USBSTOR_FreeTransferMdl(
+    IN PIRP_CONTEXT Context)
 {
-    PIRP_CONTEXT Context;
-    PIO_STACK_LOCATION IoStack;
-    PSCSI_REQUEST_BLOCK Request;
-    PCDB pCDB;
-    PREAD_CAPACITY_DATA_EX CapacityDataEx;
-    PREAD_CAPACITY_DATA CapacityData;
-    PUFI_CAPACITY_RESPONSE Response;
-    NTSTATUS Status;
-
-    //
-    // access context
-    //
-    Context = (PIRP_CONTEXT)Ctx;
-
     //
     // is there a mdl
     //
@@ -220,48 +198,19 @@ USBSTOR_CSWCompletionRoutine(
             IoFreeMdl(Context->TransferBufferMDL);
         }
     }
+}
 
-    DPRINT("USBSTOR_CSWCompletionRoutine Status %x\n", Irp->IoStatus.Status);
-
-    if (!NT_SUCCESS(Irp->IoStatus.Information))
-    {
-        if (Context->ErrorIndex == 0)
-        {
-            //
-            // increment error index
-            //
-            Context->ErrorIndex = 1;
-
-            //
-            // clear stall and resend cbw
-            //
-            Status = USBSTOR_QueueWorkItem(Context, Irp);
-            ASSERT(Status == STATUS_MORE_PROCESSING_REQUIRED);
-            return STATUS_MORE_PROCESSING_REQUIRED;
-        }
-
-        //
-        // perform reset recovery
-        //
-        Context->ErrorIndex = 2;
-        IoFreeIrp(Irp);
-        Status = USBSTOR_QueueWorkItem(Context, NULL);
-        ASSERT(Status == STATUS_MORE_PROCESSING_REQUIRED);
-        return STATUS_MORE_PROCESSING_REQUIRED;
-    }
-
-    if (!USBSTOR_IsCSWValid(Context))
-    {
-        //
-        // perform reset recovery
-        //
-        Context->ErrorIndex = 2;
-        IoFreeIrp(Irp);
-        Status = USBSTOR_QueueWorkItem(Context, NULL);
-        ASSERT(Status == STATUS_MORE_PROCESSING_REQUIRED);
-        return STATUS_MORE_PROCESSING_REQUIRED;
-    }
-
+VOID
+USBSTOR_FinishRequest(
+    IN PIRP_CONTEXT Context,
+    IN NTSTATUS Status)
+{
+    PIO_STACK_LOCATION IoStack;
+    PSCSI_REQUEST_BLOCK Request;
+    PCDB pCDB;
+    PREAD_CAPACITY_DATA_EX CapacityDataEx;
+    PREAD_CAPACITY_DATA CapacityData;
+    PUFI_CAPACITY_RESPONSE Response;
 
     //
     // get current stack location
@@ -274,13 +223,18 @@ USBSTOR_CSWCompletionRoutine(
     Request = (PSCSI_REQUEST_BLOCK)IoStack->Parameters.Others.Argument1;
     ASSERT(Request);
 
-    Status = Irp->IoStatus.Status;
-
     //
     // get SCSI command data block
     //
     pCDB = (PCDB)Request->Cdb;
-    Request->SrbStatus = SRB_STATUS_SUCCESS;
+
+    //
+    // the transport sets the srb status of failed requests
+    //
+    if (NT_SUCCESS(Status))
+    {
+        Request->SrbStatus = SRB_STATUS_SUCCESS;
+    }
 
     //
     // read capacity needs special work
@@ -292,45 +246,46 @@ USBSTOR_CSWCompletionRoutine(
         //
         Response = (PUFI_CAPACITY_RESPONSE)Context->TransferData;
 
-        //
-        // store in pdo
-        //
-        Context->PDODeviceExtension->BlockLength = NTOHL(Response->BlockLength);
-        Context->PDODeviceExtension->LastLogicBlockAddress = NTOHL(Response->LastLogicalBlockAddress);
-
-        if (Request->DataTransferLength == sizeof(READ_CAPACITY_DATA_EX))
+        if (NT_SUCCESS(Status))
         {
             //
-            // get input buffer
+            // store in pdo
             //
-            CapacityDataEx = (PREAD_CAPACITY_DATA_EX)Request->DataBuffer;
+            Context->PDODeviceExtension->BlockLength = NTOHL(Response->BlockLength);
+            Context->PDODeviceExtension->LastLogicBlockAddress = NTOHL(Response->LastLogicalBlockAddress);
 
-            //
-            // set result
-            //
-            CapacityDataEx->BytesPerBlock = Response->BlockLength;
-            CapacityDataEx->LogicalBlockAddress.QuadPart = Response->LastLogicalBlockAddress;
-            Irp->IoStatus.Information = sizeof(READ_CAPACITY_DATA_EX);
-       }
-       else
-       {
-            //
-            // get input buffer
-            //
-            CapacityData = (PREAD_CAPACITY_DATA)Request->DataBuffer;
+            if (Request->DataTransferLength == sizeof(READ_CAPACITY_DATA_EX))
+            {
+                //
+                // get input buffer
+                //
+                CapacityDataEx = (PREAD_CAPACITY_DATA_EX)Request->DataBuffer;
 
-            //
-            // set result
-            //
-            CapacityData->BytesPerBlock = Response->BlockLength;
-            CapacityData->LogicalBlockAddress = Response->LastLogicalBlockAddress;
-            Irp->IoStatus.Information = sizeof(READ_CAPACITY_DATA);
-       }
-
-       //
-       // free response
-       //
-       FreeItem(Context->TransferData);
+                //
+                // set result
+                //
+                CapacityDataEx->BytesPerBlock = Response->BlockLength;
+                CapacityDataEx->LogicalBlockAddress.QuadPart = Response->LastLogicalBlockAddress;
+            }
+            else
+            {
+                //
+                // get input buffer
+                //
+                CapacityData = (PREAD_CAPACITY_DATA)Request->DataBuffer;
+
+                //
+                // set result
+                //
+                CapacityData->BytesPerBlock = Response->BlockLength;
+                CapacityData->LogicalBlockAddress = Response->LastLogicalBlockAddress;
+            }
+        }
+
+        //
+        // free response
+        //
+        FreeItem(Context->TransferData);
     }
 
     //
@@ -341,7 +296,7 @@ USBSTOR_CSWCompletionRoutine(
     //
     // FIXME: check status
     //
-    Context->Irp->IoStatus.Status = Irp->IoStatus.Status;
+    Context->Irp->IoStatus.Status = Status;
     Context->Irp->IoStatus.Information = Context->TransferDataLength;
 
     //
@@ -359,15 +314,89 @@ USBSTOR_CSWCompletionRoutine(
     //
     USBSTOR_QueueNextRequest(Context->PDODeviceExtension->LowerDeviceObject);
 
+    //
+    // free context
+    //
+    FreeItem(Context);
+}
+
+//
+// driver verifier
+//
+IO_COMPLETION_ROUTINE USBSTOR_CSWCompletionRoutine;
+
+NTSTATUS
+NTAPI
+USBSTOR_CSWCompletionRoutine(
+    PDEVICE_OBJECT DeviceObject,
+    PIRP Irp,
+    PVOID Ctx)
+{
+    PIRP_CONTEXT Context;
+    NTSTATUS Status;
+
+    //
+    // access context
+    //
+    Context = (PIRP_CONTEXT)Ctx;
+
+    //
+    // free the transfer mdl
+    //
+    USBSTOR_FreeTransferMdl(Context);
+
+    DPRINT("USBSTOR_CSWCompletionRoutine Status %x\n", Irp->IoStatus.Status);
+
+    if (!NT_SUCCESS(Irp->IoStatus.Information))
+    {
+        if (Context->ErrorIndex == 0)
+        {
+            //
+            // increment error index
+            //
+            Context->ErrorIndex = 1;
+
+            //
+            // clear stall and resend cbw
+            //
+            Status = USBSTOR_QueueWorkItem(Context, Irp);
+            ASSERT(Status == STATUS_MORE_PROCESSING_REQUIRED);
+            return STATUS_MORE_PROCESSING_REQUIRED;
+        }
+
+        //
+        // perform reset recovery
+        //
+        Context->ErrorIndex = 2;
+        IoFreeIrp(Irp);
+        Status = USBSTOR_QueueWorkItem(Context, NULL);
+        ASSERT(Status == STATUS_MORE_PROCESSING_REQUIRED);
+        return STATUS_MORE_PROCESSING_REQUIRED;
+    }
+
+    if (!USBSTOR_IsCSWValid(Context))
+    {
+        //
+        // perform reset recovery
+        //
+        Context->ErrorIndex = 2;
+        IoFreeIrp(Irp);
+        Status = USBSTOR_QueueWorkItem(Context, NULL);
+        ASSERT(Status == STATUS_MORE_PROCESSING_REQUIRED);
+        return STATUS_MORE_PROCESSING_REQUIRED;
+    }
+
+    Status = Irp->IoStatus.Status;
+
     //
     // free our allocated irp
     //
     IoFreeIrp(Irp);
 
     //
-    // free context
+    // complete the request and start the next one
     //
-    FreeItem(Context);
+    USBSTOR_FinishRequest(Context, Status);
 
     //
     // done
@@ -657,30 +686,33 @@ USBSTOR_SendRequest(
     //
     FDODeviceExtension = (PFDO_DEVICE_EXTENSION)PDODeviceExtension->LowerDeviceObject->DeviceExtension;
 
-    //
-    // now build the cbw
-    //
-    USBSTOR_BuildCBW((ULONG)Context->cbw,
-                     TransferDataLength,
-                     PDODeviceExtension->LUN,
-                     CommandLength,
-                     Command,
-                     Context->cbw);
+    if (!FDODeviceExtension->IsUAS)
+    {
+        //
+        // now build the cbw
+        //
+        USBSTOR_BuildCBW((ULONG)Context->cbw,
+                         TransferDataLength,
+                         PDODeviceExtension->LUN,
+                         CommandLength,
+                         Command,
+                         Context->cbw);
 
-    DPRINT("CBW %p\n", Context->cbw);
-    DumpCBW((PUCHAR)Context->cbw);
+        DPRINT("CBW %p\n", Context->cbw);
+        DumpCBW((PUCHAR)Context->cbw);
 
-    //
-    // now initialize the urb
-    //
-    UsbBuildInterruptOrBulkTransferRequest(&Context->Urb,
-                                           sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
-                                           FDODeviceExtension->InterfaceInformation->Pipes[FDODeviceExtension->BulkOutPipeIndex].PipeHandle,
-                                           Context->cbw,
-                                           NULL,
-                                           sizeof(CBW),
-                                           USBD_TRANSFER_DIRECTION_OUT,
-                                           NULL);
+        //
+        // now initialize the urb
+        //
+        UsbBuildInterruptOrBulkTransferRequest(&Context->Urb,
+                                               sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+                                               FDODeviceExtension->InterfaceInformation->Pipes[FDODeviceExtension->BulkOutPipeIndex].PipeHandle,
+                                               Context->cbw,
+                                               NULL,
+                                               sizeof(CBW),
+                                               USBD_TRANSFER_DIRECTION_OUT,
+                                               NULL);
+    }
 
     //
     // initialize rest of context
@@ -810,6 +842,14 @@ USBSTOR_SendRequest(
         IoMarkIrpPending(OriginalRequest);
     }
 
+    if (FDODeviceExtension->IsUAS)
+    {
+        //
+        // send tagged command, the device may queue it with others
+        //
+        return USBSTOR_UasSendCommand(Context, Irp, CommandLength, Command);
+    }
+
     //
     // send request
     //
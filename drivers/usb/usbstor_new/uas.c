@@ -0,0 +1,710 @@
+/*
+ * PROJECT:     ReactOS Universal Serial Bus Bulk Storage Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/usb/usbstor/uas.c
+ * PURPOSE:     USB attached SCSI transport.
+ * PROGRAMMERS:
+ */
+
+/*
+ * USB attached SCSI sends a command IU tagged with its own tag on the command
+ * pipe, so several commands can be outstanding on the device. Without streams
+ * the device tells which command it wants to transfer data for with a READ READY
+ * or WRITE READY IU on the status pipe, and finishes the command with a SENSE or
+ * RESPONSE IU on the status pipe. The status pipe is read by a single irp for all
+ * commands, the IU is matched to the command by its tag.
+ *
+ * A command finishes after three stages: the command IU was sent, the data was
+ * transferred (if there is data) and the status was received. The host controller
+ * may complete them in any order.
+ */
+
+#include "usbstor.h"
+
+#define NDEBUG
+#include <debug.h>
+
+IO_COMPLETION_ROUTINE USBSTOR_UasStatusCompletionRoutine;
+
+VOID
+USBSTOR_UasSubmitTransfer(
+    IN PFDO_DEVICE_EXTENSION FDODeviceExtension,
+    IN PIRP Irp,
+    IN PURB Urb,
+    IN UCHAR PipeIndex,
+    IN PVOID TransferBuffer,
+    IN PMDL TransferBufferMDL,
+    IN ULONG TransferBufferLength,
+    IN ULONG TransferFlags,
+    IN PIO_COMPLETION_ROUTINE CompletionRoutine,
+    IN PVOID CompletionContext)
+{
+    PIO_STACK_LOCATION IoStack;
+
+    //
+    // initialize the urb
+    //
+    UsbBuildInterruptOrBulkTransferRequest(Urb,
+                                           sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+                                           FDODeviceExtension->InterfaceInformation->Pipes[PipeIndex].PipeHandle,
+                                           TransferBuffer,
+                                           TransferBufferMDL,
+                                           TransferBufferLength,
+                                           TransferFlags,
+                                           NULL);
+
+    //
+    // initialize stack location
+    //
+    IoStack = IoGetNextIrpStackLocation(Irp);
+    IoStack->MajorFunction = IRP_MJ_INTERNAL_DEVICE_CONTROL;
+    IoStack->Parameters.DeviceIoControl.IoControlCode = IOCTL_INTERNAL_USB_SUBMIT_URB;
+    IoStack->Parameters.Others.Argument1 = (PVOID)Urb;
+    IoStack->Parameters.DeviceIoControl.InputBufferLength = Urb->UrbHeader.Length;
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+
+    //
+    // setup completion routine
+    //
+    IoSetCompletionRoutine(Irp, CompletionRoutine, CompletionContext, TRUE, TRUE, TRUE);
+
+    //
+    // call driver
+    //
+    IoCallDriver(FDODeviceExtension->LowerDeviceObject, Irp);
+}
+
+VOID
+USBSTOR_UasCompleteCommand(
+    IN PIRP_CONTEXT Context)
+{
+    PFDO_DEVICE_EXTENSION FDODeviceExtension = Context->FDODeviceExtension;
+    PIO_STACK_LOCATION IoStack;
+    PSCSI_REQUEST_BLOCK Request;
+    NTSTATUS Status;
+    KIRQL OldLevel;
+
+    DPRINT("USBSTOR_UasCompleteCommand Tag %x Status %x ScsiStatus %x\n", Context->Tag, Context->UasTransferStatus, Context->ScsiStatus);
+
+    //
+    // free the tag
+    //
+    if (Context->Tag)
+    {
+        KeAcquireSpinLock(&FDODeviceExtension->IrpListLock, &OldLevel);
+        ASSERT(FDODeviceExtension->UasTagContext[Context->Tag - 1] == Context);
+        FDODeviceExtension->UasTagContext[Context->Tag - 1] = NULL;
+        FDODeviceExtension->UasCommandCount--;
+        KeReleaseSpinLock(&FDODeviceExtension->IrpListLock, OldLevel);
+    }
+
+    //
+    // free the transfer mdl and our irp
+    //
+    USBSTOR_FreeTransferMdl(Context);
+    IoFreeIrp(Context->UasIrp);
+
+    //
+    // get request block
+    //
+    IoStack = IoGetCurrentIrpStackLocation(Context->Irp);
+    Request = (PSCSI_REQUEST_BLOCK)IoStack->Parameters.Others.Argument1;
+    ASSERT(Request);
+
+    Status = Context->UasTransferStatus;
+    if (!NT_SUCCESS(Status))
+    {
+        //
+        // the command did not make it through the transport
+        //
+        Request->SrbStatus = SRB_STATUS_ERROR;
+    }
+    else if (Context->ScsiStatus != SCSISTAT_GOOD)
+    {
+        //
+        // the device reported an error
+        //
+        Request->ScsiStatus = Context->ScsiStatus;
+        Request->SrbStatus = SRB_STATUS_ERROR;
+        Status = STATUS_IO_DEVICE_ERROR;
+
+        if (Context->SenseLength && Request->SenseInfoBuffer && Request->SenseInfoBufferLength &&
+            !(Request->SrbFlags & SRB_FLAGS_DISABLE_AUTOSENSE))
+        {
+            //
+            // return the sense data along with the error
+            //
+            Request->SenseInfoBufferLength = min(Request->SenseInfoBufferLength, Context->SenseLength);
+            RtlCopyMemory(Request->SenseInfoBuffer, Context->SenseData, Request->SenseInfoBufferLength);
+            Request->SrbStatus |= SRB_STATUS_AUTOSENSE_VALID;
+        }
+    }
+
+    //
+    // complete the request and start the next one
+    //
+    USBSTOR_FinishRequest(Context, Status);
+}
+
+VOID
+USBSTOR_UasReleaseStage(
+    IN PIRP_CONTEXT Context)
+{
+    //
+    // the last stage completes the command
+    //
+    if (InterlockedDecrement(&Context->UasStages) == 0)
+    {
+        USBSTOR_UasCompleteCommand(Context);
+    }
+}
+
+IO_COMPLETION_ROUTINE USBSTOR_UasDataCompletionRoutine;
+
+NTSTATUS
+NTAPI
+USBSTOR_UasDataCompletionRoutine(
+    PDEVICE_OBJECT DeviceObject,
+    PIRP Irp,
+    PVOID Ctx)
+{
+    PIRP_CONTEXT Context = (PIRP_CONTEXT)Ctx;
+
+    DPRINT("USBSTOR_UasDataCompletionRoutine Tag %x Status %x\n", Context->Tag, Irp->IoStatus.Status);
+
+    if (!NT_SUCCESS(Irp->IoStatus.Status))
+    {
+        //
+        // the device still reports the status of the command
+        //
+        DPRINT1("[USBSTOR] Tag %x data transfer failed with %x\n", Context->Tag, Irp->IoStatus.Status);
+        Context->UasTransferStatus = Irp->IoStatus.Status;
+    }
+
+    USBSTOR_UasReleaseStage(Context);
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+VOID
+USBSTOR_UasOpenDataGate(
+    IN PIRP_CONTEXT Context)
+{
+    BOOLEAN Write;
+
+    //
+    // the data is transferred once the command IU was sent and the device is ready,
+    // the irp of the command is free by then
+    //
+    if (InterlockedIncrement(&Context->UasDataGate) != 2)
+        return;
+
+    if (!NT_SUCCESS(Context->UasTransferStatus) || Context->UasStatusReceived)
+    {
+        //
+        // the command failed or finished without asking for the data
+        //
+        USBSTOR_UasReleaseStage(Context);
+        return;
+    }
+
+    Write = (Context->CommandIU->CommandBlock[0] == SCSIOP_WRITE);
+    USBSTOR_UasSubmitTransfer(Context->FDODeviceExtension,
+                              Context->UasIrp,
+                              &Context->Urb,
+                              Write ? Context->FDODeviceExtension->BulkOutPipeIndex : Context->FDODeviceExtension->BulkInPipeIndex,
+                              NULL,
+                              Context->TransferBufferMDL,
+                              Context->TransferDataLength,
+                              Write ? USBD_TRANSFER_DIRECTION_OUT : (USBD_TRANSFER_DIRECTION_IN | USBD_SHORT_TRANSFER_OK),
+                              USBSTOR_UasDataCompletionRoutine,
+                              Context);
+}
+
+BOOLEAN
+USBSTOR_UasAbortCommandLocked(
+    IN PIRP_CONTEXT Context,
+    IN NTSTATUS Status,
+    OUT PBOOLEAN OpenDataGate)
+{
+    BOOLEAN ReleaseStatus;
+
+    //
+    // caller holds the irp list lock; no status nor ready IU is expected any more
+    //
+    Context->UasTransferStatus = Status;
+
+    ReleaseStatus = !Context->UasStatusReceived;
+    Context->UasStatusReceived = TRUE;
+
+    *OpenDataGate = (Context->TransferDataLength && !Context->UasReady);
+    Context->UasReady = TRUE;
+
+    return ReleaseStatus;
+}
+
+VOID
+USBSTOR_UasSubmitStatus(
+    IN PFDO_DEVICE_EXTENSION FDODeviceExtension)
+{
+    //
+    // read the next IU from the status pipe
+    //
+    USBSTOR_UasSubmitTransfer(FDODeviceExtension,
+                              FDODeviceExtension->UasStatusIrp,
+                              FDODeviceExtension->UasStatusUrb,
+                              FDODeviceExtension->UasStatusPipeIndex,
+                              FDODeviceExtension->UasStatusBuffer,
+                              NULL,
+                              sizeof(UAS_SENSE_IU),
+                              USBD_TRANSFER_DIRECTION_IN | USBD_SHORT_TRANSFER_OK,
+                              USBSTOR_UasStatusCompletionRoutine,
+                              FDODeviceExtension);
+}
+
+BOOLEAN
+USBSTOR_UasContinueStatusLocked(
+    IN PFDO_DEVICE_EXTENSION FDODeviceExtension)
+{
+    ULONG Index;
+
+    //
+    // caller holds the irp list lock; keep reading while a command waits for an IU,
+    // otherwise the status pipe goes idle
+    //
+    for (Index = 0; Index < USBSTOR_UAS_MAX_COMMANDS; Index++)
+    {
+        if (FDODeviceExtension->UasTagContext[Index] &&
+            !FDODeviceExtension->UasTagContext[Index]->UasStatusReceived)
+        {
+            return TRUE;
+        }
+    }
+
+    FDODeviceExtension->UasStatusPending = FALSE;
+    KeSetEvent(&FDODeviceExtension->UasStatusIdle, IO_NO_INCREMENT, FALSE);
+    return FALSE;
+}
+
+VOID
+USBSTOR_UasAbortOutstanding(
+    IN PFDO_DEVICE_EXTENSION FDODeviceExtension,
+    IN NTSTATUS Status)
+{
+    PIRP_CONTEXT Abort[USBSTOR_UAS_MAX_COMMANDS];
+    BOOLEAN ReleaseStatus[USBSTOR_UAS_MAX_COMMANDS];
+    BOOLEAN OpenDataGate[USBSTOR_UAS_MAX_COMMANDS];
+    ULONG Index, Count = 0;
+    KIRQL OldLevel;
+
+    //
+    // the status of the outstanding commands is lost, fail them
+    //
+    KeAcquireSpinLock(&FDODeviceExtension->IrpListLock, &OldLevel);
+    for (Index = 0; Index < USBSTOR_UAS_MAX_COMMANDS; Index++)
+    {
+        if (FDODeviceExtension->UasTagContext[Index] &&
+            !FDODeviceExtension->UasTagContext[Index]->UasStatusReceived)
+        {
+            Abort[Count] = FDODeviceExtension->UasTagContext[Index];
+            ReleaseStatus[Count] = USBSTOR_UasAbortCommandLocked(Abort[Count], Status, &OpenDataGate[Count]);
+            Count++;
+        }
+    }
+    KeReleaseSpinLock(&FDODeviceExtension->IrpListLock, OldLevel);
+
+    for (Index = 0; Index < Count; Index++)
+    {
+        DPRINT1("[USBSTOR] Aborting tag %x\n", Abort[Index]->Tag);
+
+        if (OpenDataGate[Index])
+            USBSTOR_UasOpenDataGate(Abort[Index]);
+
+        if (ReleaseStatus[Index])
+            USBSTOR_UasReleaseStage(Abort[Index]);
+    }
+}
+
+VOID
+NTAPI
+USBSTOR_UasResetWorkItemRoutine(
+    PVOID Ctx)
+{
+    PFDO_DEVICE_EXTENSION FDODeviceExtension = (PFDO_DEVICE_EXTENSION)Ctx;
+    NTSTATUS Status;
+    BOOLEAN Restart;
+    KIRQL OldLevel;
+
+    //
+    // clear stall on the status pipe
+    //
+    Status = USBSTOR_ResetPipeWithHandle(FDODeviceExtension->LowerDeviceObject,
+                                         FDODeviceExtension->InterfaceInformation->Pipes[FDODeviceExtension->UasStatusPipeIndex].PipeHandle);
+    DPRINT1("USBSTOR_ResetPipeWithHandle Status %x\n", Status);
+
+    //
+    // restart reading if commands were sent meanwhile
+    //
+    KeAcquireSpinLock(&FDODeviceExtension->IrpListLock, &OldLevel);
+    Restart = USBSTOR_UasContinueStatusLocked(FDODeviceExtension);
+    KeReleaseSpinLock(&FDODeviceExtension->IrpListLock, OldLevel);
+
+    if (Restart)
+        USBSTOR_UasSubmitStatus(FDODeviceExtension);
+}
+
+NTSTATUS
+NTAPI
+USBSTOR_UasStatusCompletionRoutine(
+    PDEVICE_OBJECT DeviceObject,
+    PIRP Irp,
+    PVOID Ctx)
+{
+    PFDO_DEVICE_EXTENSION FDODeviceExtension = (PFDO_DEVICE_EXTENSION)Ctx;
+    PUAS_SENSE_IU SenseIU = (PUAS_SENSE_IU)FDODeviceExtension->UasStatusBuffer;
+    PIRP_CONTEXT Context = NULL;
+    BOOLEAN OpenDataGate = FALSE, ReleaseStatus = FALSE, Restart;
+    ULONG Length;
+    USHORT Tag;
+    KIRQL OldLevel;
+
+    if (!NT_SUCCESS(Irp->IoStatus.Status))
+    {
+        DPRINT1("[USBSTOR] Status pipe failed with %x\n", Irp->IoStatus.Status);
+
+        //
+        // fail all commands waiting for an IU
+        //
+        USBSTOR_UasAbortOutstanding(FDODeviceExtension, Irp->IoStatus.Status);
+
+        if (Irp->IoStatus.Status == STATUS_CANCELLED)
+        {
+            //
+            // device is removed
+            //
+            KeAcquireSpinLock(&FDODeviceExtension->IrpListLock, &OldLevel);
+            FDODeviceExtension->UasStatusPending = FALSE;
+            KeSetEvent(&FDODeviceExtension->UasStatusIdle, IO_NO_INCREMENT, FALSE);
+            KeReleaseSpinLock(&FDODeviceExtension->IrpListLock, OldLevel);
+        }
+        else
+        {
+            //
+            // clear the stall at passive level, reading stays pending meanwhile
+            //
+            ExInitializeWorkItem(&FDODeviceExtension->UasResetWorkItem,
+                                 USBSTOR_UasResetWorkItemRoutine,
+                                 FDODeviceExtension);
+            ExQueueWorkItem(&FDODeviceExtension->UasResetWorkItem, DelayedWorkQueue);
+        }
+
+        return STATUS_MORE_PROCESSING_REQUIRED;
+    }
+
+    Length = FDODeviceExtension->UasStatusUrb->UrbBulkOrInterruptTransfer.TransferBufferLength;
+    Tag = NTOHS(SenseIU->Header.Tag);
+
+    DPRINT("USBSTOR_UasStatusCompletionRoutine IU %x Tag %x Length %lu\n", SenseIU->Header.IUID, Tag, Length);
+
+    KeAcquireSpinLock(&FDODeviceExtension->IrpListLock, &OldLevel);
+
+    //
+    // find the command of the IU
+    //
+    if (Length >= sizeof(UAS_IU_HEADER) && Tag >= 1 && Tag <= USBSTOR_UAS_MAX_COMMANDS)
+    {
+        Context = FDODeviceExtension->UasTagContext[Tag - 1];
+    }
+
+    if (!Context)
+    {
+        DPRINT1("[USBSTOR] IU %x for unknown tag %x\n", SenseIU->Header.IUID, Tag);
+    }
+    else if (SenseIU->Header.IUID == UAS_IU_ID_READ_READY || SenseIU->Header.IUID == UAS_IU_ID_WRITE_READY)
+    {
+        //
+        // device is ready to transfer the data of the command
+        //
+        if (Context->TransferDataLength && !Context->UasReady)
+        {
+            Context->UasReady = TRUE;
+            OpenDataGate = TRUE;
+        }
+    }
+    else if (SenseIU->Header.IUID == UAS_IU_ID_SENSE && !Context->UasStatusReceived)
+    {
+        //
+        // command is done, keep the sense data
+        //
+        Context->UasStatusReceived = TRUE;
+        Context->ScsiStatus = SenseIU->Status;
+        if (Length > FIELD_OFFSET(UAS_SENSE_IU, SenseData))
+        {
+            Context->SenseLength = (UCHAR)min(min(NTOHS(SenseIU->SenseLength), Length - FIELD_OFFSET(UAS_SENSE_IU, SenseData)),
+                                              sizeof(Context->SenseData));
+            RtlCopyMemory(Context->SenseData, SenseIU->SenseData, Context->SenseLength);
+        }
+        ReleaseStatus = TRUE;
+
+        //
+        // a device which fails the command does not ask for its data
+        //
+        if (Context->TransferDataLength && !Context->UasReady)
+        {
+            Context->UasReady = TRUE;
+            OpenDataGate = TRUE;
+        }
+    }
+    else if (SenseIU->Header.IUID == UAS_IU_ID_RESPONSE && !Context->UasStatusReceived)
+    {
+        //
+        // the device rejected the command IU
+        //
+        DPRINT1("[USBSTOR] Tag %x response code %x\n", Tag, ((PUAS_RESPONSE_IU)SenseIU)->ResponseCode);
+        ReleaseStatus = USBSTOR_UasAbortCommandLocked(Context, STATUS_IO_DEVICE_ERROR, &OpenDataGate);
+    }
+    else
+    {
+        DPRINT1("[USBSTOR] Unexpected IU %x for tag %x\n", SenseIU->Header.IUID, Tag);
+    }
+
+    //
+    // check if the status pipe needs to be read again
+    //
+    Restart = USBSTOR_UasContinueStatusLocked(FDODeviceExtension);
+
+    KeReleaseSpinLock(&FDODeviceExtension->IrpListLock, OldLevel);
+
+    if (OpenDataGate)
+        USBSTOR_UasOpenDataGate(Context);
+
+    if (ReleaseStatus)
+        USBSTOR_UasReleaseStage(Context);
+
+    if (Restart)
+        USBSTOR_UasSubmitStatus(FDODeviceExtension);
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+IO_COMPLETION_ROUTINE USBSTOR_UasCommandCompletionRoutine;
+
+NTSTATUS
+NTAPI
+USBSTOR_UasCommandCompletionRoutine(
+    PDEVICE_OBJECT DeviceObject,
+    PIRP Irp,
+    PVOID Ctx)
+{
+    PIRP_CONTEXT Context = (PIRP_CONTEXT)Ctx;
+    PFDO_DEVICE_EXTENSION FDODeviceExtension = Context->FDODeviceExtension;
+    PIO_STACK_LOCATION IoStack;
+    BOOLEAN OpenDataGate = FALSE, ReleaseStatus = FALSE;
+    KIRQL OldLevel;
+
+    DPRINT("USBSTOR_UasCommandCompletionRoutine Tag %x Status %x\n", Context->Tag, Irp->IoStatus.Status);
+
+    IoStack = IoGetCurrentIrpStackLocation(Context->Irp);
+
+    KeAcquireSpinLock(&FDODeviceExtension->IrpListLock, &OldLevel);
+
+    if (!NT_SUCCESS(Irp->IoStatus.Status))
+    {
+        //
+        // the device never saw the command
+        //
+        DPRINT1("[USBSTOR] Tag %x command failed with %x\n", Context->Tag, Irp->IoStatus.Status);
+        ReleaseStatus = USBSTOR_UasAbortCommandLocked(Context, Irp->IoStatus.Status, &OpenDataGate);
+    }
+
+    //
+    // the command is queued on the device, let the next request be sent
+    //
+    if (FDODeviceExtension->ActiveSrb == (PSCSI_REQUEST_BLOCK)IoStack->Parameters.Others.Argument1)
+    {
+        FDODeviceExtension->ActiveSrb = NULL;
+    }
+
+    KeReleaseSpinLock(&FDODeviceExtension->IrpListLock, OldLevel);
+
+    if (OpenDataGate)
+        USBSTOR_UasOpenDataGate(Context);
+
+    if (ReleaseStatus)
+        USBSTOR_UasReleaseStage(Context);
+
+    //
+    // start next request
+    //
+    USBSTOR_QueueNextRequest(FDODeviceExtension->FunctionalDeviceObject);
+
+    //
+    // the command stage is done, the data stage may take over the irp now
+    //
+    if (Context->TransferDataLength)
+        USBSTOR_UasOpenDataGate(Context);
+
+    USBSTOR_UasReleaseStage(Context);
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+NTSTATUS
+USBSTOR_UasSendCommand(
+    IN PIRP_CONTEXT Context,
+    IN PIRP Irp,
+    IN UCHAR CommandLength,
+    IN PUCHAR Command)
+{
+    PFDO_DEVICE_EXTENSION FDODeviceExtension = Context->FDODeviceExtension;
+    BOOLEAN StartStatus = FALSE;
+    ULONG Index;
+    KIRQL OldLevel;
+
+    //
+    // sanity check
+    //
+    ASSERT(CommandLength <= sizeof(Context->CommandIU->CommandBlock));
+
+    //
+    // command IU sent, data transferred and status received
+    //
+    Context->UasIrp = Irp;
+    Context->UasStages = (Context->TransferDataLength ? 3 : 2);
+    Context->UasTransferStatus = STATUS_SUCCESS;
+    Context->ScsiStatus = SCSISTAT_GOOD;
+
+    //
+    // allocate a tag
+    //
+    KeAcquireSpinLock(&FDODeviceExtension->IrpListLock, &OldLevel);
+    for (Index = 0; Index < USBSTOR_UAS_MAX_COMMANDS; Index++)
+    {
+        if (!FDODeviceExtension->UasTagContext[Index])
+        {
+            FDODeviceExtension->UasTagContext[Index] = Context;
+            FDODeviceExtension->UasCommandCount++;
+            Context->Tag = (USHORT)(Index + 1);
+
+            //
+            // start reading the status pipe
+            //
+            if (!FDODeviceExtension->UasStatusPending)
+            {
+                FDODeviceExtension->UasStatusPending = TRUE;
+                KeClearEvent(&FDODeviceExtension->UasStatusIdle);
+                StartStatus = TRUE;
+            }
+            break;
+        }
+    }
+    KeReleaseSpinLock(&FDODeviceExtension->IrpListLock, OldLevel);
+
+    if (!Context->Tag)
+    {
+        //
+        // the queue does not start more commands than there are tags
+        //
+        DPRINT1("[USBSTOR] No free tag\n");
+        ASSERT(FALSE);
+        Context->UasTransferStatus = STATUS_INSUFFICIENT_RESOURCES;
+        USBSTOR_UasCompleteCommand(Context);
+        return STATUS_PENDING;
+    }
+
+    //
+    // build the command IU
+    //
+    RtlZeroMemory(Context->CommandIU, sizeof(UAS_COMMAND_IU));
+    Context->CommandIU->IUID = UAS_IU_ID_COMMAND;
+    Context->CommandIU->Tag = HTONS(Context->Tag);
+    Context->CommandIU->Attribute = UAS_TASK_ATTRIBUTE_SIMPLE;
+    Context->CommandIU->LUN[1] = Context->PDODeviceExtension->LUN;
+    RtlCopyMemory(Context->CommandIU->CommandBlock, Command, CommandLength);
+
+    DPRINT("USBSTOR_UasSendCommand Tag %x Command %x Length %lu\n", Context->Tag, Command[0], Context->TransferDataLength);
+
+    if (StartStatus)
+    {
+        //
+        // the status pipe must be read for the device to report back
+        //
+        USBSTOR_UasSubmitStatus(FDODeviceExtension);
+    }
+
+    //
+    // send the command IU
+    //
+    USBSTOR_UasSubmitTransfer(FDODeviceExtension,
+                              Irp,
+                              &Context->Urb,
+                              FDODeviceExtension->UasCommandPipeIndex,
+                              Context->CommandIU,
+                              NULL,
+                              sizeof(UAS_COMMAND_IU),
+                              USBD_TRANSFER_DIRECTION_OUT,
+                              USBSTOR_UasCommandCompletionRoutine,
+                              Context);
+
+    return STATUS_PENDING;
+}
+
+NTSTATUS
+USBSTOR_UasInitialize(
+    IN PFDO_DEVICE_EXTENSION FDODeviceExtension)
+{
+    //
+    // allocate the irp, urb and buffer reading the status pipe
+    //
+    FDODeviceExtension->UasStatusIrp = IoAllocateIrp(FDODeviceExtension->LowerDeviceObject->StackSize, FALSE);
+    FDODeviceExtension->UasStatusUrb = (PURB)AllocateItem(NonPagedPool, sizeof(URB));
+    FDODeviceExtension->UasStatusBuffer = (PUCHAR)AllocateItem(NonPagedPool, sizeof(UAS_SENSE_IU));
+
+    if (!FDODeviceExtension->UasStatusIrp || !FDODeviceExtension->UasStatusUrb || !FDODeviceExtension->UasStatusBuffer)
+    {
+        //
+        // no memory
+        //
+        USBSTOR_UasTerminate(FDODeviceExtension);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeInitializeEvent(&FDODeviceExtension->UasStatusIdle, NotificationEvent, TRUE);
+    FDODeviceExtension->UasStatusPending = FALSE;
+    FDODeviceExtension->UasCommandCount = 0;
+    RtlZeroMemory(FDODeviceExtension->UasTagContext, sizeof(FDODeviceExtension->UasTagContext));
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+USBSTOR_UasTerminate(
+    IN PFDO_DEVICE_EXTENSION FDODeviceExtension)
+{
+    if (FDODeviceExtension->UasStatusIrp && FDODeviceExtension->UasStatusUrb && FDODeviceExtension->UasStatusBuffer)
+    {
+        //
+        // stop reading the status pipe
+        //
+        if (FDODeviceExtension->UasStatusPending)
+            IoCancelIrp(FDODeviceExtension->UasStatusIrp);
+
+        KeWaitForSingleObject(&FDODeviceExtension->UasStatusIdle, Executive, KernelMode, FALSE, NULL);
+    }
+
+    if (FDODeviceExtension->UasStatusIrp)
+    {
+        IoFreeIrp(FDODeviceExtension->UasStatusIrp);
+        FDODeviceExtension->UasStatusIrp = NULL;
+    }
+
+    if (FDODeviceExtension->UasStatusUrb)
+    {
+        FreeItem(FDODeviceExtension->UasStatusUrb);
+        FDODeviceExtension->UasStatusUrb = NULL;
+    }
+
+    if (FDODeviceExtension->UasStatusBuffer)
+    {
+        FreeItem(FDODeviceExtension->UasStatusBuffer);
+        FDODeviceExtension->UasStatusBuffer = NULL;
+    }
+}
@@ -27,6 +27,17 @@
 #define USB_RECOVERABLE_ERRORS (USBD_STATUS_STALL_PID | USBD_STATUS_DEV_NOT_RESPONDING \
 	| USBD_STATUS_ENDPOINT_HALTED | USBD_STATUS_NO_BANDWIDTH)
 
+//
+// interface protocols
+//
+#define USB_PROTOCOL_BULK_ONLY           0x50
+#define USB_PROTOCOL_UAS                 0x62
+
+//
+// max tagged commands outstanding on an USB attached SCSI device
+//
+#define USBSTOR_UAS_MAX_COMMANDS         (16)
+
 typedef struct __COMMON_DEVICE_EXTENSION__
 {
     BOOLEAN IsFDO;
@@ -61,6 +72,17 @@ typedef struct
     ULONG SrbErrorHandlingActive;                                                        // error handling of srb is activated
     ULONG TimerWorkQueueEnabled;                                                         // timer work queue enabled
     ULONG InstanceCount;                                                                 // pdo instance count
+    BOOLEAN IsUAS;                                                                       // device uses USB attached SCSI
+    UCHAR UasCommandPipeIndex;                                                           // uas command pipe index
+    UCHAR UasStatusPipeIndex;                                                            // uas status pipe index
+    BOOLEAN UasStatusPending;                                                            // if true the status pipe is read
+    ULONG UasCommandCount;                                                               // count of tagged commands outstanding
+    struct _IRP_CONTEXT *UasTagContext[USBSTOR_UAS_MAX_COMMANDS];                        // irp context of each tag
+    PIRP UasStatusIrp;                                                                   // irp reading the status pipe
+    PURB UasStatusUrb;                                                                   // urb reading the status pipe
+    PUCHAR UasStatusBuffer;                                                              // received status IU
+    KEVENT UasStatusIdle;                                                                // set if the status pipe is not read
+    WORK_QUEUE_ITEM UasResetWorkItem;                                                    // clears a stall of the status pipe
 }FDO_DEVICE_EXTENSION, *PFDO_DEVICE_EXTENSION;
 
 typedef struct
@@ -113,6 +135,78 @@ typedef struct
     UCHAR Status;                                                    // CSW status
 }CSW, *PCSW;
 
+//--------------------------------------------------------------------------------------------------------------------------------------------
+//
+// USB attached SCSI information units
+//
+#define USB_PIPE_USAGE_DESCRIPTOR_TYPE   0x24
+
+#define UAS_PIPE_ID_COMMAND              0x01
+#define UAS_PIPE_ID_STATUS               0x02
+#define UAS_PIPE_ID_DATA_IN              0x03
+#define UAS_PIPE_ID_DATA_OUT             0x04
+
+#define UAS_IU_ID_COMMAND                0x01
+#define UAS_IU_ID_SENSE                  0x03
+#define UAS_IU_ID_RESPONSE               0x04
+#define UAS_IU_ID_READ_READY             0x06
+#define UAS_IU_ID_WRITE_READY            0x07
+
+#define UAS_TASK_ATTRIBUTE_SIMPLE        0x00
+
+typedef struct
+{
+    UCHAR bLength;                                                   // 4
+    UCHAR bDescriptorType;                                           // USB_PIPE_USAGE_DESCRIPTOR_TYPE
+    UCHAR bPipeID;                                                   // UAS_PIPE_ID_*
+    UCHAR Reserved;
+}USB_PIPE_USAGE_DESCRIPTOR, *PUSB_PIPE_USAGE_DESCRIPTOR;
+
+C_ASSERT(sizeof(USB_PIPE_USAGE_DESCRIPTOR) == 4);
+
+typedef struct
+{
+    UCHAR IUID;                                                      // UAS_IU_ID_COMMAND
+    UCHAR Reserved;
+    USHORT Tag;                                                      // big endian tag
+    UCHAR Attribute;                                                 // task attribute and priority
+    UCHAR Reserved1;
+    UCHAR AdditionalCdbLength;                                       // additional cdb length in dwords, shifted by 2
+    UCHAR Reserved2;
+    UCHAR LUN[8];                                                    // SAM lun
+    UCHAR CommandBlock[16];
+}UAS_COMMAND_IU, *PUAS_COMMAND_IU;
+
+C_ASSERT(sizeof(UAS_COMMAND_IU) == 32);
+
+typedef struct
+{
+    UCHAR IUID;                                                      // UAS_IU_ID_*
+    UCHAR Reserved;
+    USHORT Tag;                                                      // big endian tag
+}UAS_IU_HEADER, *PUAS_IU_HEADER;
+
+typedef struct
+{
+    UAS_IU_HEADER Header;                                            // UAS_IU_ID_SENSE
+    USHORT StatusQualifier;
+    UCHAR Status;                                                    // scsi status
+    UCHAR Reserved[7];
+    USHORT SenseLength;                                              // big endian sense data length
+    UCHAR SenseData[96];
+}UAS_SENSE_IU, *PUAS_SENSE_IU;
+
+C_ASSERT(sizeof(UAS_SENSE_IU) == 112);
+
+typedef struct
+{
+    UAS_IU_HEADER Header;                                            // UAS_IU_ID_RESPONSE
+    UCHAR AdditionalResponseInfo[3];
+    UCHAR ResponseCode;
+}UAS_RESPONSE_IU, *PUAS_RESPONSE_IU;
+
+C_ASSERT(sizeof(UAS_RESPONSE_IU) == 8);
+
 //--------------------------------------------------------------------------------------------------------------------------------------------
 //
 // UFI INQUIRY command
@@ -312,12 +406,13 @@ typedef struct
     UCHAR Bytes[16];
 }UFI_UNKNOWN_CMD, *PUFI_UNKNOWN_CMD;
 
-typedef struct
+typedef struct _IRP_CONTEXT
 {
     union
     {
         PCBW cbw;
         PCSW csw;
+        PUAS_COMMAND_IU CommandIU;
     };
     URB Urb;
     PIRP Irp;
@@ -328,6 +423,16 @@ typedef struct
     PMDL TransferBufferMDL;
     ULONG ErrorIndex;
     ULONG RetryCount;
+    PIRP UasIrp;
+    USHORT Tag;
+    BOOLEAN UasReady;
+    BOOLEAN UasStatusReceived;
+    LONG UasDataGate;
+    LONG UasStages;
+    NTSTATUS UasTransferStatus;
+    UCHAR ScsiStatus;
+    UCHAR SenseLength;
+    UCHAR SenseData[18];
 }IRP_CONTEXT, *PIRP_CONTEXT;
 
 typedef struct _ERRORHANDLER_WORKITEM_DATA
@@ -460,6 +565,34 @@ USBSTOR_SendCSW(
     PIRP_CONTEXT Context,
     PIRP Irp);
 
+VOID
+USBSTOR_FreeTransferMdl(
+    IN PIRP_CONTEXT Context);
+
+VOID
+USBSTOR_FinishRequest(
+    IN PIRP_CONTEXT Context,
+    IN NTSTATUS Status);
+
+//---------------------------------------------------------------------
+//
+// uas.c routines
+//
+NTSTATUS
+USBSTOR_UasInitialize(
+    IN PFDO_DEVICE_EXTENSION FDODeviceExtension);
+
+VOID
+USBSTOR_UasTerminate(
+    IN PFDO_DEVICE_EXTENSION FDODeviceExtension);
+
+NTSTATUS
+USBSTOR_UasSendCommand(
+    IN PIRP_CONTEXT Context,
+    IN PIRP Irp,
+    IN UCHAR CommandLength,
+    IN PUCHAR Command);
+
 
 //---------------------------------------------------------------------
 //
@@ -14,6 +14,13 @@
 
 #include <debug.h>
 
+// notification events a client may register on a pin
+#define MAX_NOTIFICATION_EVENTS 2
+
+// user mappings of the position and the clock register
+#define POSITION_REGISTER 0
+#define CLOCK_REGISTER 1
+
 class CPortPinWaveRT : public IPortPinWaveRT
 {
 public:
@@ -67,10 +74,28 @@ protected:
 
     MEMORY_CACHING_TYPE m_CacheType;
     PMDL m_Mdl;
+    BOOL m_MappedCommonBuffer;
+
+    PMINIPORTWAVERTSTREAMNOTIFICATION m_NotificationStream;
+    BOOL m_BufferWithNotification;
+    PKEVENT m_NotificationEvents[MAX_NOTIFICATION_EVENTS];
+
+    PEPROCESS m_UserProcess;
+    PVOID m_UserBuffer;
+    PMDL m_RegisterMdl[2];
+    PVOID m_UserRegister[2];
 
     LONG m_Ref;
 
     NTSTATUS NTAPI HandleKsProperty(IN PIRP Irp);
+    NTSTATUS NTAPI HandleRtAudioProperty(IN PIRP Irp, IN PKSPROPERTY Property, OUT PULONG Information);
+    NTSTATUS NTAPI AllocateBuffer(IN ULONG RequestedSize, IN ULONG NotificationCount);
+    VOID NTAPI FreeBuffer();
+    NTSTATUS NTAPI MapToUser(IN PMDL Mdl, IN MEMORY_CACHING_TYPE CacheType, OUT PVOID *UserAddress);
+    VOID NTAPI UnmapFromUser(IN PVOID UserAddress, IN PMDL Mdl);
+    NTSTATUS NTAPI MapRegister(IN ULONG Index, IN PKSRTAUDIO_HWREGISTER Register);
+    VOID NTAPI UnmapUserMappings();
+    VOID NTAPI UnregisterNotificationEvents();
     NTSTATUS NTAPI HandleKsStream(IN PIRP Irp);
     VOID NTAPI SetStreamState(IN KSSTATE State);
     friend VOID NTAPI SetStreamWorkerRoutine(IN PDEVICE_OBJECT  DeviceObject, IN PVOID  Context);
@@ -123,6 +148,438 @@ CPortPinWaveRT::NewIrpTarget(
     return STATUS_UNSUCCESSFUL;
 }
 
+NTSTATUS
+NTAPI
+CPortPinWaveRT::MapToUser(
+    IN PMDL Mdl,
+    IN MEMORY_CACHING_TYPE CacheType,
+    OUT PVOID *UserAddress)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PVOID Address = NULL;
+
+    // all user mappings of a pin live in the address space of one process
+    if (m_UserProcess && m_UserProcess != PsGetCurrentProcess())
+    {
+        DPRINT1("Pin %p is already mapped into process %p\n", this, m_UserProcess);
+        return STATUS_ACCESS_DENIED;
+    }
+
+    _SEH2_TRY
+    {
+        Address = MmMapLockedPagesSpecifyCache(Mdl, UserMode, CacheType, NULL, FALSE, NormalPagePriority);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    if (!NT_SUCCESS(Status) || !Address)
+    {
+        DPRINT1("Failed to map Mdl %p into user space Status %x\n", Mdl, Status);
+        return NT_SUCCESS(Status) ? STATUS_INSUFFICIENT_RESOURCES : Status;
+    }
+
+    if (!m_UserProcess)
+    {
+        // keep the process around, the mappings are torn down on close
+        m_UserProcess = PsGetCurrentProcess();
+        ObReferenceObject(m_UserProcess);
+    }
+
+    *UserAddress = Address;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+CPortPinWaveRT::UnmapFromUser(
+    IN PVOID UserAddress,
+    IN PMDL Mdl)
+{
+    KAPC_STATE ApcState;
+    BOOL Attached = FALSE;
+
+    PC_ASSERT(m_UserProcess);
+
+    if (m_UserProcess != PsGetCurrentProcess())
+    {
+        KeStackAttachProcess((PKPROCESS)m_UserProcess, &ApcState);
+        Attached = TRUE;
+    }
+
+    MmUnmapLockedPages(UserAddress, Mdl);
+
+    if (Attached)
+        KeUnstackDetachProcess(&ApcState);
+}
+
+VOID
+NTAPI
+CPortPinWaveRT::UnmapUserMappings()
+{
+    ULONG Index;
+
+    if (m_UserBuffer)
+    {
+        UnmapFromUser(m_UserBuffer, m_Mdl);
+        m_UserBuffer = NULL;
+    }
+
+    for (Index = 0; Index < 2; Index++)
+    {
+        if (!m_RegisterMdl[Index])
+            continue;
+
+        if (m_UserRegister[Index])
+        {
+            UnmapFromUser(m_UserRegister[Index], m_RegisterMdl[Index]);
+            m_UserRegister[Index] = NULL;
+        }
+
+        IoFreeMdl(m_RegisterMdl[Index]);
+        m_RegisterMdl[Index] = NULL;
+    }
+
+    if (m_UserProcess)
+    {
+        ObDereferenceObject(m_UserProcess);
+        m_UserProcess = NULL;
+    }
+}
+
+NTSTATUS
+NTAPI
+CPortPinWaveRT::MapRegister(
+    IN ULONG Index,
+    IN PKSRTAUDIO_HWREGISTER Register)
+{
+    PMDL Mdl;
+    NTSTATUS Status;
+
+    if (!Register->Register)
+        return STATUS_NOT_SUPPORTED;
+
+    if (!m_UserRegister[Index])
+    {
+        // map the page holding the register, clients only read from it
+        Mdl = IoAllocateMdl(PAGE_ALIGN(Register->Register), PAGE_SIZE, FALSE, FALSE, NULL);
+        if (!Mdl)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        MmBuildMdlForNonPagedPool(Mdl);
+
+        Status = MapToUser(Mdl, MmNonCached, &m_UserRegister[Index]);
+        if (!NT_SUCCESS(Status))
+        {
+            IoFreeMdl(Mdl);
+            return Status;
+        }
+        m_RegisterMdl[Index] = Mdl;
+    }
+
+    Register->Register = (PUCHAR)m_UserRegister[Index] + BYTE_OFFSET(Register->Register);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+CPortPinWaveRT::AllocateBuffer(
+    IN ULONG RequestedSize,
+    IN ULONG NotificationCount)
+{
+    NTSTATUS Status;
+
+    // a client asking for a new buffer gives up the old one
+    FreeBuffer();
+
+    if (NotificationCount)
+    {
+        Status = m_NotificationStream->AllocateBufferWithNotification(NotificationCount, RequestedSize, &m_Mdl, &m_CommonBufferSize, &m_CommonBufferOffset, &m_CacheType);
+    }
+    else
+    {
+        Status = m_Stream->AllocateAudioBuffer(RequestedSize, &m_Mdl, &m_CommonBufferSize, &m_CommonBufferOffset, &m_CacheType);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT("AllocateAudioBuffer failed with %x\n", Status);
+        m_Mdl = NULL;
+        return Status;
+    }
+
+    m_BufferWithNotification = (NotificationCount != 0);
+
+    // only unmap the system address later on if it is ours
+    m_MappedCommonBuffer = !(m_Mdl->MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
+
+    m_CommonBuffer = MmGetSystemAddressForMdlSafe(m_Mdl, NormalPagePriority);
+    if (!m_CommonBuffer)
+    {
+        DPRINT("Failed to get system address\n");
+        m_MappedCommonBuffer = FALSE;
+        FreeBuffer();
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+CPortPinWaveRT::FreeBuffer()
+{
+    if (!m_Mdl)
+        return;
+
+    if (m_UserBuffer)
+    {
+        UnmapFromUser(m_UserBuffer, m_Mdl);
+        m_UserBuffer = NULL;
+    }
+
+    if (m_CommonBuffer && m_MappedCommonBuffer)
+        MmUnmapLockedPages(m_CommonBuffer, m_Mdl);
+
+    if (m_BufferWithNotification)
+        m_NotificationStream->FreeBufferWithNotification(m_Mdl, m_CommonBufferSize);
+    else
+        m_Stream->FreeAudioBuffer(m_Mdl, m_CommonBufferSize);
+
+    m_Mdl = NULL;
+    m_CommonBuffer = NULL;
+    m_CommonBufferSize = 0;
+    m_CommonBufferOffset = 0;
+    m_MappedCommonBuffer = FALSE;
+    m_BufferWithNotification = FALSE;
+}
+
+VOID
+NTAPI
+CPortPinWaveRT::UnregisterNotificationEvents()
+{
+    ULONG Index;
+
+    for (Index = 0; Index < MAX_NOTIFICATION_EVENTS; Index++)
+    {
+        if (!m_NotificationEvents[Index])
+            continue;
+
+        m_NotificationStream->UnregisterNotificationEvent(m_NotificationEvents[Index]);
+        ObDereferenceObject(m_NotificationEvents[Index]);
+        m_NotificationEvents[Index] = NULL;
+    }
+}
+
+NTSTATUS
+NTAPI
+CPortPinWaveRT::HandleRtAudioProperty(
+    IN PIRP Irp,
+    IN PKSPROPERTY Property,
+    OUT PULONG Information)
+{
+    PIO_STACK_LOCATION IoStack;
+    ULONG InputLength, OutputLength, Index;
+    NTSTATUS Status;
+
+    IoStack = IoGetCurrentIrpStackLocation(Irp);
+    InputLength = IoStack->Parameters.DeviceIoControl.InputBufferLength;
+    OutputLength = IoStack->Parameters.DeviceIoControl.OutputBufferLength;
+    *Information = 0;
+
+    if (!m_Stream)
+        return STATUS_UNSUCCESSFUL;
+
+    if (!(Property->Flags & KSPROPERTY_TYPE_GET))
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    switch (Property->Id)
+    {
+        case KSPROPERTY_RTAUDIO_BUFFER:
+        case KSPROPERTY_RTAUDIO_BUFFER_WITH_NOTIFICATION:
+        {
+            PKSRTAUDIO_BUFFER_PROPERTY BufferProperty = (PKSRTAUDIO_BUFFER_PROPERTY)Property;
+            PKSRTAUDIO_BUFFER Buffer = (PKSRTAUDIO_BUFFER)Irp->UserBuffer;
+            ULONG NotificationCount = 0;
+
+            if (Property->Id == KSPROPERTY_RTAUDIO_BUFFER_WITH_NOTIFICATION)
+            {
+                if (InputLength < sizeof(KSRTAUDIO_BUFFER_PROPERTY_WITH_NOTIFICATION))
+                    return STATUS_INVALID_PARAMETER;
+                if (!m_NotificationStream)
+                    return STATUS_NOT_SUPPORTED;
+
+                NotificationCount = ((PKSRTAUDIO_BUFFER_PROPERTY_WITH_NOTIFICATION)Property)->NotificationCount;
+                if (NotificationCount < 1 || NotificationCount > 2)
+                    return STATUS_INVALID_PARAMETER;
+            }
+            else if (InputLength < sizeof(KSRTAUDIO_BUFFER_PROPERTY))
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            if (OutputLength < sizeof(KSRTAUDIO_BUFFER))
+            {
+                *Information = sizeof(KSRTAUDIO_BUFFER);
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            // the hardware keeps reading the buffer while running
+            if (m_State == KSSTATE_RUN)
+                return STATUS_INVALID_DEVICE_STATE;
+
+            Status = AllocateBuffer(BufferProperty->RequestedBufferSize, NotificationCount);
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            // the client reads and writes the cyclic buffer directly
+            Status = MapToUser(m_Mdl, m_CacheType, &m_UserBuffer);
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            Buffer->BufferAddress = (PUCHAR)m_UserBuffer + m_CommonBufferOffset;
+            Buffer->ActualBufferSize = m_CommonBufferSize;
+            Buffer->CallMemoryBarrier = (m_CacheType == MmWriteCombined);
+
+            DPRINT("Mapped buffer %p Size %u CacheType %u\n", Buffer->BufferAddress, m_CommonBufferSize, m_CacheType);
+            *Information = sizeof(KSRTAUDIO_BUFFER);
+            return STATUS_SUCCESS;
+        }
+        case KSPROPERTY_RTAUDIO_HWLATENCY:
+        {
+            if (OutputLength < sizeof(KSRTAUDIO_HWLATENCY))
+            {
+                *Information = sizeof(KSRTAUDIO_HWLATENCY);
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            m_Stream->GetHWLatency((PKSRTAUDIO_HWLATENCY)Irp->UserBuffer);
+            *Information = sizeof(KSRTAUDIO_HWLATENCY);
+            return STATUS_SUCCESS;
+        }
+        case KSPROPERTY_RTAUDIO_POSITIONREGISTER:
+        case KSPROPERTY_RTAUDIO_CLOCKREGISTER:
+        {
+            KSRTAUDIO_HWREGISTER Register;
+
+            if (InputLength < sizeof(KSRTAUDIO_HWREGISTER_PROPERTY))
+                return STATUS_INVALID_PARAMETER;
+
+            if (OutputLength < sizeof(KSRTAUDIO_HWREGISTER))
+            {
+                *Information = sizeof(KSRTAUDIO_HWREGISTER);
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            RtlZeroMemory(&Register, sizeof(KSRTAUDIO_HWREGISTER));
+            if (Property->Id == KSPROPERTY_RTAUDIO_POSITIONREGISTER)
+            {
+                Index = POSITION_REGISTER;
+                Status = m_Stream->GetPositionRegister(&Register);
+            }
+            else
+            {
+                Index = CLOCK_REGISTER;
+                Status = m_Stream->GetClockRegister(&Register);
+            }
+
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            // reading the register from user mode saves a round trip per position query
+            Status = MapRegister(Index, &Register);
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            RtlMoveMemory(Irp->UserBuffer, &Register, sizeof(KSRTAUDIO_HWREGISTER));
+            *Information = sizeof(KSRTAUDIO_HWREGISTER);
+            return STATUS_SUCCESS;
+        }
+        case KSPROPERTY_RTAUDIO_REGISTER_NOTIFICATION_EVENT:
+        case KSPROPERTY_RTAUDIO_UNREGISTER_NOTIFICATION_EVENT:
+        {
+            PKSRTAUDIO_NOTIFICATION_EVENT_PROPERTY EventProperty = (PKSRTAUDIO_NOTIFICATION_EVENT_PROPERTY)Property;
+            PKEVENT Event;
+
+            if (InputLength < sizeof(KSRTAUDIO_NOTIFICATION_EVENT_PROPERTY))
+                return STATUS_INVALID_PARAMETER;
+            if (!m_NotificationStream)
+                return STATUS_NOT_SUPPORTED;
+
+            Status = ObReferenceObjectByHandle(EventProperty->NotificationEvent,
+                                               EVENT_MODIFY_STATE,
+                                               *ExEventObjectType,
+                                               Irp->RequestorMode,
+                                               (PVOID*)&Event,
+                                               NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Invalid notification event handle %p Status %x\n", EventProperty->NotificationEvent, Status);
+                return Status;
+            }
+
+            if (Property->Id == KSPROPERTY_RTAUDIO_REGISTER_NOTIFICATION_EVENT)
+            {
+                for (Index = 0; Index < MAX_NOTIFICATION_EVENTS; Index++)
+                {
+                    if (!m_NotificationEvents[Index])
+                        break;
+                }
+
+                if (Index == MAX_NOTIFICATION_EVENTS)
+                {
+                    ObDereferenceObject(Event);
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                // the miniport signals the event on every buffer position it was asked for
+                Status = m_NotificationStream->RegisterNotificationEvent(Event);
+                if (!NT_SUCCESS(Status))
+                {
+                    ObDereferenceObject(Event);
+                    return Status;
+                }
+
+                // keep the reference until the event is unregistered
+                m_NotificationEvents[Index] = Event;
+                return STATUS_SUCCESS;
+            }
+
+            Status = STATUS_NOT_FOUND;
+            for (Index = 0; Index < MAX_NOTIFICATION_EVENTS; Index++)
+            {
+                if (m_NotificationEvents[Index] != Event)
+                    continue;
+
+                m_NotificationStream->UnregisterNotificationEvent(Event);
+                ObDereferenceObject(m_NotificationEvents[Index]);
+                m_NotificationEvents[Index] = NULL;
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            ObDereferenceObject(Event);
+            return Status;
+        }
+        case KSPROPERTY_RTAUDIO_QUERY_NOTIFICATION_SUPPORT:
+        {
+            if (OutputLength < sizeof(BOOL))
+            {
+                *Information = sizeof(BOOL);
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            *(PBOOL)Irp->UserBuffer = (m_NotificationStream != NULL);
+            *Information = sizeof(BOOL);
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return STATUS_NOT_IMPLEMENTED;
+}
+
 NTSTATUS
 NTAPI
 CPortPinWaveRT::HandleKsProperty(
@@ -147,7 +604,48 @@ CPortPinWaveRT::HandleKsProperty(
 
     Property = (PKSPROPERTY)IoStack->Parameters.DeviceIoControl.Type3InputBuffer;
 
-    if (IsEqualGUIDAligned(Property->Set, KSPROPSETID_Connection))
+    if (IsEqualGUIDAligned(Property->Set, KSPROPSETID_RtAudio))
+    {
+        ULONG Information;
+
+        Status = HandleRtAudioProperty(Irp, Property, &Information);
+        if (Status != STATUS_NOT_IMPLEMENTED)
+        {
+            Irp->IoStatus.Information = Information;
+            Irp->IoStatus.Status = Status;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            return Status;
+        }
+    }
+    else if (IsEqualGUIDAligned(Property->Set, KSPROPSETID_Audio))
+    {
+        if (Property->Id == KSPROPERTY_AUDIO_POSITION && (Property->Flags & KSPROPERTY_TYPE_GET))
+        {
+            PKSAUDIO_POSITION Position = (PKSAUDIO_POSITION)Irp->UserBuffer;
+
+            if (IoStack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(KSAUDIO_POSITION))
+            {
+                Irp->IoStatus.Information = sizeof(KSAUDIO_POSITION);
+                Irp->IoStatus.Status = STATUS_BUFFER_TOO_SMALL;
+                IoCompleteRequest(Irp, IO_NO_INCREMENT);
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            Status = STATUS_UNSUCCESSFUL;
+            Irp->IoStatus.Information = 0;
+            if (m_Stream)
+            {
+                Status = m_Stream->GetPosition(Position);
+                if (NT_SUCCESS(Status))
+                    Irp->IoStatus.Information = sizeof(KSAUDIO_POSITION);
+            }
+
+            Irp->IoStatus.Status = Status;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            return Status;
+        }
+    }
+    else if (IsEqualGUIDAligned(Property->Set, KSPROPSETID_Connection))
     {
         if (Property->Id == KSPROPERTY_CONNECTION_STATE)
         {
@@ -391,6 +889,9 @@ CloseStreamRoutine(
             This->m_Stream->SetState(KSSTATE_STOP);
             KeStallExecutionProcessor(10);
         }
+
+        // the hardware is stopped, give the buffer back to the miniport
+        This->FreeBuffer();
     }
 
     Status = This->m_Port->QueryInterface(IID_ISubdevice, (PVOID*)&ISubDevice);
@@ -431,6 +932,11 @@ CloseStreamRoutine(
         Stream = This->m_Stream;
         This->m_Stream = NULL;
         DPRINT("Closing stream at Irql %u\n", KeGetCurrentIrql());
+        if (This->m_NotificationStream)
+        {
+            This->m_NotificationStream->Release();
+            This->m_NotificationStream = NULL;
+        }
         Stream->Release();
     }
 }
@@ -445,6 +951,11 @@ CPortPinWaveRT::Close(
 
     if (m_Stream)
     {
+        // close is sent while the address space of the client still exists,
+        // the work item runs in the system process
+        UnregisterNotificationEvents();
+        UnmapUserMappings();
+
         Ctx = (PCLOSESTREAM_CONTEXT)AllocateItem(NonPagedPool, sizeof(CLOSESTREAM_CONTEXT), TAG_PORTCLASS);
         if (!Ctx)
         {
@@ -626,25 +1137,18 @@ CPortPinWaveRT::Init(
     if (!NT_SUCCESS(Status))
         goto cleanup;
 
+    // miniports supporting event driven streaming expose the notification stream
+    if (!NT_SUCCESS(m_Stream->QueryInterface(IID_IMiniportWaveRTStreamNotification, (PVOID*)&m_NotificationStream)))
+        m_NotificationStream = NULL;
+
     m_Stream->GetHWLatency(&Latency);
     // delay of 10 millisec
     m_Delay = Int32x32To64(10, -10000);
 
-    Status = m_Stream->AllocateAudioBuffer(16384 * 11, &m_Mdl, &m_CommonBufferSize, &m_CommonBufferOffset, &m_CacheType);
+    // default buffer, a client normally replaces it with KSPROPERTY_RTAUDIO_BUFFER
+    Status = AllocateBuffer(16384 * 11, 0);
     if (!NT_SUCCESS(Status))
-    {
-        DPRINT("AllocateAudioBuffer failed with %x\n", Status);
         goto cleanup;
-    }
-
-    m_CommonBuffer = MmGetSystemAddressForMdlSafe(m_Mdl, NormalPagePriority);
-    if (!m_CommonBuffer)
-    {
-        DPRINT("Failed to get system address %x\n", Status);
-        IoFreeMdl(m_Mdl);
-        m_Mdl = NULL;
-        goto cleanup;
-    }
 
     DPRINT("Setting state to acquire %x\n", m_Stream->SetState(KSSTATE_ACQUIRE));
     DPRINT("Setting state to pause %x\n", m_Stream->SetState(KSSTATE_PAUSE));
@@ -664,6 +1168,12 @@ cleanup:
         m_Format = NULL;
     }
 
+    if (m_NotificationStream)
+    {
+        m_NotificationStream->Release();
+        m_NotificationStream = NULL;
+    }
+
     if (m_Stream)
     {
         m_Stream->Release();
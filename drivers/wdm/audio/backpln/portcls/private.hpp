@@ -14,10 +14,11 @@
 #define COM_STDMETHOD_CAN_THROW
 #define PC_NO_IMPORTS
 
-#include <ntddk.h>
+#include <ntifs.h>
 #include <portcls.h>
 #include <dmusicks.h>
 #include <kcom.h>
+#include <pseh/pseh2.h>
 
 #include "interfaces.hpp"
 
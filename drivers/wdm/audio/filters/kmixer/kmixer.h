@@ -18,6 +18,40 @@ typedef struct
 
 }SUM_NODE_CONTEXT, *PSUM_NODE_CONTEXT;
 
+/* filter taps per phase of the polyphase resampler */
+#define RESAMPLER_TAPS 16
+/* largest interpolation factor with a table, 8000 -> 44100 needs 441 */
+#define RESAMPLER_MAX_PHASES 512
+
+typedef struct
+{
+    ULONG InRate;
+    ULONG OutRate;
+    ULONG Channels;
+    ULONG Up;
+    ULONG Down;
+    ULONG Phase;
+    ULONG Skip;
+    PFLOAT Coefficients;
+    PFLOAT History;
+}POLYPHASE_RESAMPLER, *PPOLYPHASE_RESAMPLER;
+
+typedef struct
+{
+    KSDATAFORMAT_WAVEFORMATEX Formats[2];
+
+    /* sample rate conversion state, kept for the lifetime of the pin */
+    POLYPHASE_RESAMPLER Resampler;
+    PVOID SrcState;
+    ULONG SrcChannels;
+
+    /* scratch buffers, grown on demand */
+    PFLOAT FloatIn;
+    ULONG FloatInSize;
+    PFLOAT FloatOut;
+    ULONG FloatOutSize;
+}PIN_CONTEXT, *PPIN_CONTEXT;
+
 
 NTSTATUS
 NTAPI
@@ -28,6 +62,44 @@ NTSTATUS
 CreatePin(
     IN PIRP Irp);
 
+VOID
+ConvertToFloat(
+    IN PVOID Buffer,
+    OUT PFLOAT Out,
+    IN ULONG Count,
+    IN ULONG BytesPerSample);
+
+VOID
+ConvertFromFloat(
+    IN PFLOAT In,
+    OUT PVOID Buffer,
+    IN ULONG Count,
+    IN ULONG BytesPerSample);
+
+NTSTATUS
+InitializeResampler(
+    IN PPOLYPHASE_RESAMPLER Resampler,
+    IN ULONG InRate,
+    IN ULONG OutRate,
+    IN ULONG Channels);
+
+VOID
+FreeResampler(
+    IN PPOLYPHASE_RESAMPLER Resampler);
+
+ULONG
+GetResamplerOutputFrames(
+    IN PPOLYPHASE_RESAMPLER Resampler,
+    IN ULONG InputFrames);
+
+ULONG
+Resample(
+    IN PPOLYPHASE_RESAMPLER Resampler,
+    IN PFLOAT Work,
+    IN ULONG InputFrames,
+    OUT PFLOAT Out,
+    IN ULONG OutputFrames);
+
 #ifndef _M_IX86
 #define KeSaveFloatingPointState(x) ((void)(x), STATUS_SUCCESS)
 #define KeRestoreFloatingPointState(x) ((void)0)
@@ -15,8 +15,27 @@
 
 const GUID KSPROPSETID_Connection              = {0x1D58C920L, 0xAC9B, 0x11CF, {0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00}};
 
+static
+PFLOAT
+GetScratchBuffer(
+    IN OUT PFLOAT * Buffer,
+    IN OUT PULONG BufferSize,
+    IN ULONG Size)
+{
+    if (*BufferSize < Size)
+    {
+        if (*Buffer)
+            ExFreePool(*Buffer);
+
+        *Buffer = ExAllocatePool(NonPagedPool, Size);
+        *BufferSize = (*Buffer ? Size : 0);
+    }
+    return *Buffer;
+}
+
 NTSTATUS
 PerformSampleRateConversion(
+    PPIN_CONTEXT Context,
     PUCHAR Buffer,
     ULONG BufferLength,
     ULONG OldRate,
@@ -28,7 +47,7 @@ PerformSampleRateConversion(
 {
     KFLOATING_SAVE FloatSave;
     NTSTATUS Status;
-    ULONG Index;
+    PPOLYPHASE_RESAMPLER Resampler;
     SRC_STATE * State;
     SRC_DATA Data;
     PUCHAR ResultOut;
@@ -36,6 +55,8 @@ PerformSampleRateConversion(
     PFLOAT FloatIn, FloatOut;
     ULONG NumSamples;
     ULONG NewSamples;
+    ULONG HistoryFrames;
+    ULONG Generated;
 
     DPRINT("PerformSampleRateConversion OldRate %u NewRate %u BytesPerSample %u NumChannels %u Irql %u\n", OldRate, NewRate, BytesPerSample, NumChannels, KeGetCurrentIrql());
 
@@ -52,19 +73,34 @@ PerformSampleRateConversion(
 
     NumSamples = BufferLength / (BytesPerSample * NumChannels);
 
-    FloatIn = ExAllocatePool(NonPagedPool, NumSamples * NumChannels * sizeof(FLOAT));
-    if (!FloatIn)
+    /* the filter tables only depend on the formats, build them once */
+    Resampler = &Context->Resampler;
+    if (Resampler->InRate != OldRate || Resampler->OutRate != NewRate || Resampler->Channels != NumChannels)
     {
-        KeRestoreFloatingPointState(&FloatSave);
-        return STATUS_INSUFFICIENT_RESOURCES;
+        Status = InitializeResampler(Resampler, OldRate, NewRate, NumChannels);
+        if (!NT_SUCCESS(Status) && Status != STATUS_NOT_SUPPORTED)
+        {
+            KeRestoreFloatingPointState(&FloatSave);
+            return Status;
+        }
     }
 
-    NewSamples = ((((ULONG64)NumSamples * NewRate) + (OldRate / 2)) / OldRate) + 2;
+    if (Resampler->Coefficients)
+    {
+        /* the resampler wants its history in front of the samples */
+        HistoryFrames = RESAMPLER_TAPS - 1;
+        NewSamples = GetResamplerOutputFrames(Resampler, NumSamples);
+    }
+    else
+    {
+        HistoryFrames = 0;
+        NewSamples = ((((ULONG64)NumSamples * NewRate) + (OldRate / 2)) / OldRate) + 2;
+    }
 
-    FloatOut = ExAllocatePool(NonPagedPool, NewSamples * NumChannels * sizeof(FLOAT));
-    if (!FloatOut)
+    FloatIn = GetScratchBuffer(&Context->FloatIn, &Context->FloatInSize, (HistoryFrames + NumSamples) * NumChannels * sizeof(FLOAT));
+    FloatOut = GetScratchBuffer(&Context->FloatOut, &Context->FloatOutSize, NewSamples * NumChannels * sizeof(FLOAT));
+    if (!FloatIn || !FloatOut)
     {
-        ExFreePool(FloatIn);
         KeRestoreFloatingPointState(&FloatSave);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -72,81 +108,59 @@ PerformSampleRateConversion(
     ResultOut = ExAllocatePool(NonPagedPool, NewSamples * NumChannels * BytesPerSample);
     if (!ResultOut)
     {
-        ExFreePool(FloatIn);
-        ExFreePool(FloatOut);
         KeRestoreFloatingPointState(&FloatSave);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    State = src_new(SRC_SINC_FASTEST, NumChannels, &error);
-    if (!State)
-    {
-        DPRINT1("src_new failed with %x\n", error);
-        KeRestoreFloatingPointState(&FloatSave);
-        ExFreePool(FloatIn);
-        ExFreePool(FloatOut);
-        ExFreePool(ResultOut);
-        return STATUS_UNSUCCESSFUL;
-    }
-
-    /* fixme use asm */
-    if (BytesPerSample == 1)
-    {
-        for(Index = 0; Index < NumSamples * NumChannels; Index++)
-            FloatIn[Index] = (float)(Buffer[Index] / (1.0 * 0x80));
-    }
-    else if (BytesPerSample == 2)
-    {
-        src_short_to_float_array((short*)Buffer, FloatIn, NumSamples * NumChannels);
-    }
-    else if (BytesPerSample == 4)
-    {
-        src_int_to_float_array((int*)Buffer, FloatIn, NumSamples * NumChannels);
-    }
-
-    Data.data_in = FloatIn;
-    Data.data_out = FloatOut;
-    Data.input_frames = NumSamples;
-    Data.output_frames = NewSamples;
-    Data.src_ratio = (double)NewRate / (double)OldRate;
+    ConvertToFloat(Buffer, FloatIn + HistoryFrames * NumChannels, NumSamples * NumChannels, BytesPerSample);
 
-    error = src_process(State, &Data);
-    if (error)
+    if (Resampler->Coefficients)
     {
-        DPRINT1("src_process failed with %x\n", error);
-        KeRestoreFloatingPointState(&FloatSave);
-        ExFreePool(FloatIn);
-        ExFreePool(FloatOut);
-        ExFreePool(ResultOut);
-        return STATUS_UNSUCCESSFUL;
+        Generated = Resample(Resampler, FloatIn, NumSamples, FloatOut, NewSamples);
     }
-
-    if (BytesPerSample == 1)
+    else
     {
-        /* FIXME perform over/under clipping */
+        /* ratios without a table go through libsamplerate */
+        State = (SRC_STATE*)Context->SrcState;
+        if (!State || Context->SrcChannels != NumChannels)
+        {
+            if (State)
+                src_delete(State);
 
-        for(Index = 0; Index < Data.output_frames_gen * NumChannels; Index++)
-            ResultOut[Index] = (lrintf(FloatOut[Index]) >> 24);
-    }
-    else if (BytesPerSample == 2)
-    {
-        PUSHORT Res = (PUSHORT)ResultOut;
+            State = src_new(SRC_SINC_FASTEST, NumChannels, &error);
+            Context->SrcState = State;
+            Context->SrcChannels = NumChannels;
+            if (!State)
+            {
+                DPRINT1("src_new failed with %x\n", error);
+                KeRestoreFloatingPointState(&FloatSave);
+                ExFreePool(ResultOut);
+                return STATUS_UNSUCCESSFUL;
+            }
+        }
 
-        src_float_to_short_array(FloatOut, (short*)Res, Data.output_frames_gen * NumChannels);
-    }
-    else if (BytesPerSample == 4)
-    {
-        PULONG Res = (PULONG)ResultOut;
+        Data.data_in = FloatIn;
+        Data.data_out = FloatOut;
+        Data.input_frames = NumSamples;
+        Data.output_frames = NewSamples;
+        Data.src_ratio = (double)NewRate / (double)OldRate;
+        Data.end_of_input = 0;
 
-        src_float_to_int_array(FloatOut, (int*)Res, Data.output_frames_gen * NumChannels);
+        error = src_process(State, &Data);
+        if (error)
+        {
+            DPRINT1("src_process failed with %x\n", error);
+            KeRestoreFloatingPointState(&FloatSave);
+            ExFreePool(ResultOut);
+            return STATUS_UNSUCCESSFUL;
+        }
+        Generated = Data.output_frames_gen;
     }
 
+    ConvertFromFloat(FloatOut, ResultOut, Generated * NumChannels, BytesPerSample);
 
     *Result = ResultOut;
-    *ResultLength = Data.output_frames_gen * BytesPerSample * NumChannels;
-    ExFreePool(FloatIn);
-    ExFreePool(FloatOut);
-    src_delete(State);
+    *ResultLength = Generated * BytesPerSample * NumChannels;
     KeRestoreFloatingPointState(&FloatSave);
     return STATUS_SUCCESS;
 }
@@ -441,7 +455,7 @@ Pin_fnDeviceIoControl(
                 PKSDATAFORMAT_WAVEFORMATEX Formats;
                 PKSDATAFORMAT_WAVEFORMATEX WaveFormat;
 
-                Formats = (PKSDATAFORMAT_WAVEFORMATEX)IoStack->FileObject->FsContext2;
+                Formats = ((PPIN_CONTEXT)IoStack->FileObject->FsContext2)->Formats;
                 WaveFormat = (PKSDATAFORMAT_WAVEFORMATEX)Irp->UserBuffer;
 
                 ASSERT(Property->PinId == 0 || Property->PinId == 1);
@@ -514,8 +528,28 @@ Pin_fnClose(
     PDEVICE_OBJECT DeviceObject,
     PIRP Irp)
 {
+    PIO_STACK_LOCATION IoStack;
+    PPIN_CONTEXT Context;
+
     UNIMPLEMENTED;
 
+    IoStack = IoGetCurrentIrpStackLocation(Irp);
+    Context = (PPIN_CONTEXT)IoStack->FileObject->FsContext2;
+    if (Context)
+    {
+        /* free the conversion state of the pin */
+        FreeResampler(&Context->Resampler);
+        if (Context->SrcState)
+            src_delete((SRC_STATE*)Context->SrcState);
+        if (Context->FloatIn)
+            ExFreePool(Context->FloatIn);
+        if (Context->FloatOut)
+            ExFreePool(Context->FloatOut);
+
+        ExFreePool(Context);
+        IoStack->FileObject->FsContext2 = NULL;
+    }
+
     Irp->IoStatus.Status = STATUS_SUCCESS;
     Irp->IoStatus.Information = 0;
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
@@ -604,15 +638,15 @@ Pin_fnFastWrite(
     PVOID BufferOut;
     ULONG BufferLength;
     NTSTATUS Status = STATUS_SUCCESS;
-    PKSDATAFORMAT_WAVEFORMATEX Formats;
+    PPIN_CONTEXT Context;
     PKSDATAFORMAT_WAVEFORMATEX InputFormat, OutputFormat;
 
     DPRINT("Pin_fnFastWrite called DeviceObject %p Irp %p\n", DeviceObject);
 
-    Formats = (PKSDATAFORMAT_WAVEFORMATEX)FileObject->FsContext2;
+    Context = (PPIN_CONTEXT)FileObject->FsContext2;
 
-    InputFormat = Formats;
-    OutputFormat = (Formats + 1);
+    InputFormat = &Context->Formats[0];
+    OutputFormat = &Context->Formats[1];
     StreamHeader = (PKSSTREAM_HEADER)Buffer;
 
 
@@ -657,7 +691,8 @@ Pin_fnFastWrite(
 
     if (InputFormat->WaveFormatEx.nSamplesPerSec != OutputFormat->WaveFormatEx.nSamplesPerSec)
     {
-        Status = PerformSampleRateConversion(StreamHeader->Data,
+        Status = PerformSampleRateConversion(Context,
+                                             StreamHeader->Data,
                                              StreamHeader->DataUsed,
                                              InputFormat->WaveFormatEx.nSamplesPerSec,
                                              OutputFormat->WaveFormatEx.nSamplesPerSec,
@@ -701,18 +736,18 @@ CreatePin(
 {
     NTSTATUS Status;
     KSOBJECT_HEADER ObjectHeader;
-    PKSDATAFORMAT DataFormat;
+    PPIN_CONTEXT Context;
     PIO_STACK_LOCATION IoStack;
 
 
-    DataFormat = ExAllocatePool(NonPagedPool, sizeof(KSDATAFORMAT_WAVEFORMATEX) * 2);
-    if (!DataFormat)
+    Context = ExAllocatePool(NonPagedPool, sizeof(PIN_CONTEXT));
+    if (!Context)
         return STATUS_INSUFFICIENT_RESOURCES;
 
-    RtlZeroMemory(DataFormat, sizeof(KSDATAFORMAT_WAVEFORMATEX) * 2);
+    RtlZeroMemory(Context, sizeof(PIN_CONTEXT));
 
     IoStack = IoGetCurrentIrpStackLocation(Irp);
-    IoStack->FileObject->FsContext2 = (PVOID)DataFormat;
+    IoStack->FileObject->FsContext2 = (PVOID)Context;
 
     /* allocate object header */
     Status = KsAllocateObjectHeader(&ObjectHeader, 0, NULL, Irp, &PinTable);
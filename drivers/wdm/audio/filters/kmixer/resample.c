@@ -0,0 +1,317 @@
+/*
+ * PROJECT:         ReactOS Kernel Streaming Mixer
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            drivers/wdm/audio/filters/kmixer/resample.c
+ * PURPOSE:         Sample format conversion and polyphase resampling
+ * PROGRAMMERS:     Johannes Anderwald (johannes.anderwald@reactos.org)
+ */
+
+#include "kmixer.h"
+
+#define NDEBUG
+#include <debug.h>
+
+#define KMIX_PI 3.14159265358979323846
+
+/*
+ * The conversion loops below have no dependencies between iterations and
+ * clamp without branches, so that the compiler turns them into SSE2 code.
+ */
+
+VOID
+ConvertToFloat(
+    IN PVOID Buffer,
+    OUT PFLOAT Out,
+    IN ULONG Count,
+    IN ULONG BytesPerSample)
+{
+    ULONG Index;
+
+    if (BytesPerSample == 1)
+    {
+        PUCHAR In = (PUCHAR)Buffer;
+
+        /* 8 bit samples are unsigned */
+        for (Index = 0; Index < Count; Index++)
+            Out[Index] = ((LONG)In[Index] - 0x80) * (1.0f / 0x80);
+    }
+    else if (BytesPerSample == 2)
+    {
+        PSHORT In = (PSHORT)Buffer;
+
+        for (Index = 0; Index < Count; Index++)
+            Out[Index] = In[Index] * (1.0f / 0x8000);
+    }
+    else
+    {
+        PLONG In = (PLONG)Buffer;
+
+        ASSERT(BytesPerSample == 4);
+        for (Index = 0; Index < Count; Index++)
+            Out[Index] = In[Index] * (1.0f / 2147483648.0f);
+    }
+}
+
+VOID
+ConvertFromFloat(
+    IN PFLOAT In,
+    OUT PVOID Buffer,
+    IN ULONG Count,
+    IN ULONG BytesPerSample)
+{
+    ULONG Index;
+    FLOAT Value;
+
+    if (BytesPerSample == 1)
+    {
+        PUCHAR Out = (PUCHAR)Buffer;
+
+        for (Index = 0; Index < Count; Index++)
+        {
+            Value = In[Index] * 0x80;
+            Value = (Value > 127.0f) ? 127.0f : Value;
+            Value = (Value < -128.0f) ? -128.0f : Value;
+            Out[Index] = (UCHAR)(lrintf(Value) + 0x80);
+        }
+    }
+    else if (BytesPerSample == 2)
+    {
+        PSHORT Out = (PSHORT)Buffer;
+
+        for (Index = 0; Index < Count; Index++)
+        {
+            Value = In[Index] * 0x8000;
+            Value = (Value > 32767.0f) ? 32767.0f : Value;
+            Value = (Value < -32768.0f) ? -32768.0f : Value;
+            Out[Index] = (SHORT)lrintf(Value);
+        }
+    }
+    else
+    {
+        PLONG Out = (PLONG)Buffer;
+
+        ASSERT(BytesPerSample == 4);
+        for (Index = 0; Index < Count; Index++)
+        {
+            /* the largest float below 2^31, larger values do not convert */
+            Value = In[Index] * 2147483648.0f;
+            Value = (Value > 2147483520.0f) ? 2147483520.0f : Value;
+            Value = (Value < -2147483648.0f) ? -2147483648.0f : Value;
+            Out[Index] = lrintf(Value);
+        }
+    }
+}
+
+static
+ULONG
+GreatestCommonDivisor(
+    IN ULONG A,
+    IN ULONG B)
+{
+    ULONG Rest;
+
+    while (B)
+    {
+        Rest = A % B;
+        A = B;
+        B = Rest;
+    }
+    return A;
+}
+
+/* Only used for building the filter tables, there is no libm in the kernel */
+static
+double
+Sine(
+    IN double X)
+{
+    double Term, Sum, Square;
+    ULONG Index;
+
+    /* reduce to -pi..pi */
+    X -= (2 * KMIX_PI) * (LONG)(X / (2 * KMIX_PI));
+    if (X > KMIX_PI)
+        X -= 2 * KMIX_PI;
+    else if (X < -KMIX_PI)
+        X += 2 * KMIX_PI;
+
+    Term = X;
+    Sum = X;
+    Square = X * X;
+    for (Index = 1; Index < 12; Index++)
+    {
+        Term *= -Square / ((2 * Index) * (2 * Index + 1));
+        Sum += Term;
+    }
+    return Sum;
+}
+
+static
+double
+Cosine(
+    IN double X)
+{
+    return Sine(X + KMIX_PI / 2);
+}
+
+NTSTATUS
+InitializeResampler(
+    IN PPOLYPHASE_RESAMPLER Resampler,
+    IN ULONG InRate,
+    IN ULONG OutRate,
+    IN ULONG Channels)
+{
+    ULONG Divisor, Up, Down, Length, Phase, Tap, Index;
+    double Cutoff, Position, Value, Sum;
+    PFLOAT Coefficients;
+
+    FreeResampler(Resampler);
+
+    if (!InRate || !OutRate || !Channels)
+        return STATUS_INVALID_PARAMETER;
+
+    Divisor = GreatestCommonDivisor(InRate, OutRate);
+    Up = OutRate / Divisor;
+    Down = InRate / Divisor;
+
+    /* 44100 <-> 48000 is 160 / 147, odd ratios go to libsamplerate */
+    if (Up > RESAMPLER_MAX_PHASES)
+        return STATUS_NOT_SUPPORTED;
+
+    Coefficients = ExAllocatePool(NonPagedPool, Up * RESAMPLER_TAPS * sizeof(FLOAT));
+    if (!Coefficients)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Resampler->History = ExAllocatePool(NonPagedPool, (RESAMPLER_TAPS - 1) * Channels * sizeof(FLOAT));
+    if (!Resampler->History)
+    {
+        ExFreePool(Coefficients);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    /*
+     * Blackman windowed sinc prototype at the upsampled rate, cut off a bit
+     * below the lower of both Nyquist frequencies. Phase P uses every Up'th
+     * coefficient starting at P.
+     */
+    Length = Up * RESAMPLER_TAPS;
+    Cutoff = 0.5 * 0.92 / ((Up > Down) ? Up : Down);
+
+    for (Phase = 0; Phase < Up; Phase++)
+    {
+        Sum = 0;
+        for (Tap = 0; Tap < RESAMPLER_TAPS; Tap++)
+        {
+            Index = Phase + Tap * Up;
+            Position = Index - (Length - 1) / 2.0;
+
+            if (Position == 0)
+                Value = 2 * Cutoff;
+            else
+                Value = Sine(2 * KMIX_PI * Cutoff * Position) / (KMIX_PI * Position);
+
+            Value *= 0.42 - 0.5 * Cosine(2 * KMIX_PI * Index / (Length - 1)) +
+                     0.08 * Cosine(4 * KMIX_PI * Index / (Length - 1));
+
+            Coefficients[Phase * RESAMPLER_TAPS + Tap] = (FLOAT)Value;
+            Sum += Value;
+        }
+
+        /* unity gain for every phase, this also makes up for the zero stuffing */
+        for (Tap = 0; Tap < RESAMPLER_TAPS; Tap++)
+            Coefficients[Phase * RESAMPLER_TAPS + Tap] = (FLOAT)(Coefficients[Phase * RESAMPLER_TAPS + Tap] / Sum);
+    }
+
+    RtlZeroMemory(Resampler->History, (RESAMPLER_TAPS - 1) * Channels * sizeof(FLOAT));
+
+    Resampler->InRate = InRate;
+    Resampler->OutRate = OutRate;
+    Resampler->Channels = Channels;
+    Resampler->Up = Up;
+    Resampler->Down = Down;
+    Resampler->Phase = 0;
+    Resampler->Skip = 0;
+    Resampler->Coefficients = Coefficients;
+
+    DPRINT("InitializeResampler InRate %u OutRate %u Channels %u Up %u Down %u\n", InRate, OutRate, Channels, Up, Down);
+    return STATUS_SUCCESS;
+}
+
+VOID
+FreeResampler(
+    IN PPOLYPHASE_RESAMPLER Resampler)
+{
+    if (Resampler->Coefficients)
+        ExFreePool(Resampler->Coefficients);
+
+    if (Resampler->History)
+        ExFreePool(Resampler->History);
+
+    RtlZeroMemory(Resampler, sizeof(POLYPHASE_RESAMPLER));
+}
+
+ULONG
+GetResamplerOutputFrames(
+    IN PPOLYPHASE_RESAMPLER Resampler,
+    IN ULONG InputFrames)
+{
+    return (ULONG)(((ULONG64)InputFrames * Resampler->Up) / Resampler->Down) + 2;
+}
+
+/*
+ * Resamples InputFrames frames of interleaved float samples. Work must hold
+ * RESAMPLER_TAPS - 1 + InputFrames frames. The filter state is kept in the
+ * resampler, so consecutive buffers of a stream join without clicks.
+ */
+ULONG
+Resample(
+    IN PPOLYPHASE_RESAMPLER Resampler,
+    IN PFLOAT Work,
+    IN ULONG InputFrames,
+    OUT PFLOAT Out,
+    IN ULONG OutputFrames)
+{
+    ULONG Channels = Resampler->Channels;
+    ULONG TotalFrames = RESAMPLER_TAPS - 1 + InputFrames;
+    ULONG Position, Phase, Generated, Channel, Tap;
+    PFLOAT Coefficients, Sample;
+    FLOAT Sum;
+
+    /* the history goes in front of the new samples */
+    RtlCopyMemory(Work, Resampler->History, (RESAMPLER_TAPS - 1) * Channels * sizeof(FLOAT));
+
+    Position = RESAMPLER_TAPS - 1 + Resampler->Skip;
+    Phase = Resampler->Phase;
+    Generated = 0;
+
+    while (Position < TotalFrames && Generated < OutputFrames)
+    {
+        Coefficients = &Resampler->Coefficients[Phase * RESAMPLER_TAPS];
+
+        for (Channel = 0; Channel < Channels; Channel++)
+        {
+            /* walk back from the newest frame */
+            Sample = &Work[Position * Channels + Channel];
+            Sum = 0;
+            for (Tap = 0; Tap < RESAMPLER_TAPS; Tap++, Sample -= Channels)
+                Sum += Coefficients[Tap] * *Sample;
+
+            Out[Generated * Channels + Channel] = Sum;
+        }
+        Generated++;
+
+        Phase += Resampler->Down;
+        Position += Phase / Resampler->Up;
+        Phase %= Resampler->Up;
+    }
+
+    /* keep the newest frames for the next buffer */
+    RtlCopyMemory(Resampler->History,
+                  &Work[(TotalFrames - (RESAMPLER_TAPS - 1)) * Channels],
+                  (RESAMPLER_TAPS - 1) * Channels * sizeof(FLOAT));
+
+    Resampler->Phase = Phase;
+    Resampler->Skip = (Position > TotalFrames) ? Position - TotalFrames : 0;
+
+    return Generated;
+}
@@ -22,6 +22,7 @@ BOOLEAN HalpPhysicalMemoryMayAppearAbove4GB;
 
 FADT HalpFixedAcpiDescTable;
 PDEBUG_PORT_TABLE HalpDebugPortTable;
+PHPET_TABLE HalpHpetTable;
 PACPI_SRAT HalpAcpiSrat;
 PBOOT_TABLE HalpSimpleBootFlagTable;
 
@@ -824,6 +825,9 @@ HalpSetupAcpiPhase0(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     /* Get the debug table for KD */
     HalpDebugPortTable = HalAcpiGetTable(LoaderBlock, DBGP_SIGNATURE);
 
+    /* Get the HPET table, for the performance counter */
+    HalpHpetTable = HalAcpiGetTable(LoaderBlock, HPET_SIGNATURE);
+
     /* Initialize NUMA through the SRAT */
     HalpNumaInitializeStaticConfiguration(LoaderBlock);
 
@@ -950,6 +954,22 @@ HalpGetDebugPortTable(VOID)
             (HalpDebugPortTable->BaseAddress.AddressSpaceID == 1));
 }
 
+BOOLEAN
+NTAPI
+HalpGetHpetAddress(OUT PPHYSICAL_ADDRESS HpetAddress)
+{
+    /* The HPET registers must be memory mapped */
+    if (!(HalpHpetTable) ||
+        (HalpHpetTable->AddressSpaceID != 0) ||
+        !(HalpHpetTable->BaseAddress.QuadPart))
+    {
+        return FALSE;
+    }
+
+    *HpetAddress = HalpHpetTable->BaseAddress;
+    return TRUE;
+}
+
 ULONG
 NTAPI
 HalpIs16BitPortDecodeSupported(VOID)
@@ -12,6 +12,8 @@
 #define NDEBUG
 #include <debug.h>
 
+#include "../apic/apic.h"
+
 KAFFINITY HalpActiveProcessors;
 KAFFINITY HalpDefaultInterruptAffinity;
 
@@ -70,8 +72,7 @@ VOID
 NTAPI
 HalRequestIpi(KAFFINITY TargetProcessors)
 {
-    UNIMPLEMENTED;
-    __debugbreak();
+    ApicRequestIpi(TargetProcessors);
 }
 
 /* EOF */
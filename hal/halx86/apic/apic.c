@@ -22,11 +22,26 @@ void __cdecl HackEoi(void);
 #define APIC_LAZY_IRQL
 #endif
 
+/* Paravirtual EOI, see the KVM and Hyper-V specifications */
+#define MSR_KVM_PV_EOI_EN       0x4B564D04
+#define KVM_FEATURE_PV_EOI      0x40
+#define HV_X64_MSR_EOI          0x40000070
+#define HV_ACCESS_APIC_MSRS     0x10
+
 /* GLOBALS ********************************************************************/
 
 ULONG ApicVersion;
 UCHAR HalpVectorToIndex[256];
 
+/* x2APIC mode, the registers are accessed through MSRs */
+BOOLEAN HalpApicX2Mode = FALSE;
+ULONG HalpApicLogicalId[MAXIMUM_PROCESSORS];
+
+/* Set by KVM when the pending interrupt does not need an EOI write */
+volatile LONG HalpPvEoiFlag;
+BOOLEAN HalpPvEoiEnabled = FALSE;
+BOOLEAN HalpHvEoiMsr = FALSE;
+
 #ifndef _M_AMD64
 const UCHAR
 HalpIRQLtoTPR[32] =
@@ -130,6 +145,25 @@ ApicReadIORedirectionEntry(
     return ReDirReg;
 }
 
+FORCEINLINE
+VOID
+ApicWriteCommand(APIC_COMMAND_REGISTER CommandRegister, ULONG Destination)
+{
+    if (HalpApicX2Mode)
+    {
+        /* One write, the destination is the full 32 bit high dword */
+        CommandRegister.Long1 = Destination;
+        __writemsr(MSR_X2APIC_ICR, CommandRegister.LongLong);
+        return;
+    }
+
+    /* The write of the low dword sends the interrupt */
+    CommandRegister.Long1 = 0;
+    CommandRegister.Destination = (UCHAR)Destination;
+    ApicWrite(APIC_ICR1, CommandRegister.Long1);
+    ApicWrite(APIC_ICR0, CommandRegister.Long0);
+}
+
 FORCEINLINE
 VOID
 ApicRequestInterrupt(IN UCHAR Vector, UCHAR TriggerMode)
@@ -143,16 +177,32 @@ ApicRequestInterrupt(IN UCHAR Vector, UCHAR TriggerMode)
     CommandRegister.TriggerMode = TriggerMode;
     CommandRegister.DestinationShortHand = APIC_DSH_Self;
 
-    /* Write the low dword to send the interrupt */
-    ApicWrite(APIC_ICR0, CommandRegister.Long0);
+    /* Send the interrupt */
+    ApicWriteCommand(CommandRegister, 0);
 }
 
 FORCEINLINE
 VOID
 ApicSendEOI(void)
 {
-    //ApicWrite(APIC_EOI, 0);
-    HackEoi();
+    /* The hypervisor clears the flag when it needs to see the EOI */
+    if (HalpPvEoiEnabled && InterlockedBitTestAndReset(&HalpPvEoiFlag, 0))
+        return;
+
+    if (HalpApicX2Mode)
+    {
+        ApicWrite(APIC_EOI, 0);
+    }
+    else if (HalpHvEoiMsr)
+    {
+        /* Cheaper for Hyper-V than emulating the MMIO write */
+        __writemsr(HV_X64_MSR_EOI, 0);
+    }
+    else
+    {
+        //ApicWrite(APIC_EOI, 0);
+        HackEoi();
+    }
 }
 
 FORCEINLINE
@@ -254,6 +304,76 @@ HalpSendEOI(VOID)
     ApicSendEOI();
 }
 
+static
+BOOLEAN
+ApicIsX2ApicUsable(APIC_BASE_ADRESS_REGISTER BaseRegister)
+{
+#ifndef _M_AMD64
+    INT CpuInfo[4];
+#endif
+
+    /* If the firmware switched to x2APIC mode, the MMIO page is gone */
+    if (BaseRegister.ExtendedMode) return TRUE;
+
+#ifdef _M_AMD64
+    /* The kernel trap exit code writes the xAPIC EOI register itself */
+    return FALSE;
+#else
+    __cpuid(CpuInfo, 1);
+    return (CpuInfo[2] & 0x200000) != 0;
+#endif
+}
+
+static
+BOOLEAN
+ApicGetHypervisor(OUT PCHAR Vendor)
+{
+    INT CpuInfo[4];
+
+    /* Check the hypervisor present bit */
+    __cpuid(CpuInfo, 1);
+    if (!(CpuInfo[2] & 0x80000000)) return FALSE;
+
+    /* Get the vendor signature */
+    __cpuid(CpuInfo, 0x40000000);
+    RtlCopyMemory(Vendor, &CpuInfo[1], 12);
+    Vendor[12] = ANSI_NULL;
+    return TRUE;
+}
+
+VOID
+NTAPI
+ApicInitializeParavirtualEoi(VOID)
+{
+    CHAR Vendor[13];
+    PHYSICAL_ADDRESS PhysicalAddress;
+    INT CpuInfo[4];
+
+    if (!ApicGetHypervisor(Vendor)) return;
+
+    if (!strcmp(Vendor, "KVMKVMKVM"))
+    {
+        __cpuid(CpuInfo, 0x40000001);
+        if (!(CpuInfo[0] & KVM_FEATURE_PV_EOI)) return;
+
+        /* Give KVM the flag, it lets us skip the EOI exit */
+        PhysicalAddress = MmGetPhysicalAddress((PVOID)&HalpPvEoiFlag);
+        HalpPvEoiFlag = 0;
+        __writemsr(MSR_KVM_PV_EOI_EN, PhysicalAddress.QuadPart | 1);
+        HalpPvEoiEnabled = TRUE;
+        DPRINT1("Using KVM PV-EOI\n");
+    }
+    else if (!strcmp(Vendor, "Microsoft Hv") && !HalpApicX2Mode)
+    {
+        __cpuid(CpuInfo, 0x40000003);
+        if (!(CpuInfo[0] & HV_ACCESS_APIC_MSRS)) return;
+
+        /* The x2APIC EOI is an MSR already, this only helps the xAPIC */
+        HalpHvEoiMsr = TRUE;
+        DPRINT1("Using the Hyper-V EOI MSR\n");
+    }
+}
+
 VOID
 NTAPI
 ApicInitializeLocalApic(ULONG Cpu)
@@ -268,6 +388,14 @@ ApicInitializeLocalApic(ULONG Cpu)
     BaseRegister.BootStrapCPUCore = (Cpu == 0);
     __writemsr(MSR_APIC_BASE, BaseRegister.Long);
 
+    /* Switch to x2APIC mode, this is only possible from the enabled xAPIC mode */
+    if (Cpu == 0) HalpApicX2Mode = ApicIsX2ApicUsable(BaseRegister);
+    if (HalpApicX2Mode && !BaseRegister.ExtendedMode)
+    {
+        BaseRegister.ExtendedMode = 1;
+        __writemsr(MSR_APIC_BASE, BaseRegister.Long);
+    }
+
     /* Set spurious vector and SoftwareEnable to 1 */
     SpIntRegister.Long = ApicRead(APIC_SIVR);
     SpIntRegister.Vector = APIC_SPURIOUS_VECTOR;
@@ -278,11 +406,20 @@ ApicInitializeLocalApic(ULONG Cpu)
     /* Read the version and save it globally */
     if (Cpu == 0) ApicVersion = ApicRead(APIC_VER);
 
-    /* Set the mode to flat (max 8 CPUs supported!) */
-    ApicWrite(APIC_DFR, APIC_DF_Flat);
+    if (HalpApicX2Mode)
+    {
+        /* The logical ID is fixed, clusters of 16 processors */
+        HalpApicLogicalId[Cpu] = ApicRead(APIC_LDR);
+    }
+    else
+    {
+        /* Set the mode to flat (max 8 CPUs supported!) */
+        ApicWrite(APIC_DFR, APIC_DF_Flat);
 
-    /* Set logical apic ID */
-    ApicWrite(APIC_LDR, ApicLogicalId(Cpu) << 24);
+        /* Set logical apic ID */
+        ApicWrite(APIC_LDR, ApicLogicalId(Cpu) << 24);
+        HalpApicLogicalId[Cpu] = ApicLogicalId(Cpu);
+    }
 
     /* Set the spurious ISR */
     KeRegisterInterruptHandler(APIC_SPURIOUS_VECTOR, ApicSpuriousService);
@@ -301,10 +438,14 @@ ApicInitializeLocalApic(ULONG Cpu)
     ApicWrite(APIC_TMRLVTR, LvtEntry.Long);
     ApicWrite(APIC_THRMLVTR, LvtEntry.Long);
     ApicWrite(APIC_PCLVTR, LvtEntry.Long);
-    ApicWrite(APIC_EXT0LVTR, LvtEntry.Long);
-    ApicWrite(APIC_EXT1LVTR, LvtEntry.Long);
-    ApicWrite(APIC_EXT2LVTR, LvtEntry.Long);
-    ApicWrite(APIC_EXT3LVTR, LvtEntry.Long);
+    if (!HalpApicX2Mode)
+    {
+        /* The AMD extended LVTs have no x2APIC MSRs */
+        ApicWrite(APIC_EXT0LVTR, LvtEntry.Long);
+        ApicWrite(APIC_EXT1LVTR, LvtEntry.Long);
+        ApicWrite(APIC_EXT2LVTR, LvtEntry.Long);
+        ApicWrite(APIC_EXT3LVTR, LvtEntry.Long);
+    }
 
     /* LINT0 */
     LvtEntry.Vector = APIC_SPURIOUS_VECTOR;
@@ -331,6 +472,61 @@ ApicInitializeLocalApic(ULONG Cpu)
 #endif
 }
 
+/*
+ * Sends the IPI to all target processors with as few ICR writes as
+ * possible: a shorthand for all others, else one write per logical
+ * destination, i.e. one in flat mode and one per cluster in x2APIC mode.
+ */
+VOID
+NTAPI
+ApicRequestIpi(KAFFINITY TargetProcessors)
+{
+    APIC_COMMAND_REGISTER CommandRegister;
+    KAFFINITY Remaining;
+    ULONG Cpu, Destination, Cluster;
+
+    CommandRegister.LongLong = 0;
+    CommandRegister.Vector = APIC_IPI_VECTOR;
+    CommandRegister.MessageType = APIC_MT_Fixed;
+    CommandRegister.TriggerMode = APIC_TGM_Edge;
+
+    /* Check if this goes to all processors but the current one */
+    if (TargetProcessors == (HalpActiveProcessors & ~KeGetCurrentPrcb()->SetMember))
+    {
+        CommandRegister.DestinationShortHand = APIC_DSH_AllExclusingSelf;
+        ApicWriteCommand(CommandRegister, 0);
+        return;
+    }
+
+    CommandRegister.DestinationMode = APIC_DM_Logical;
+    if (!HalpApicX2Mode)
+    {
+        /* Flat mode, the destination has one bit per processor */
+        ApicWriteCommand(CommandRegister, (ULONG)TargetProcessors);
+        return;
+    }
+
+    while (TargetProcessors)
+    {
+        /* Collect the processors in the cluster of the first one */
+        Cluster = 0;
+        Destination = 0;
+        for (Cpu = 0, Remaining = TargetProcessors; Remaining; Cpu++, Remaining >>= 1)
+        {
+            if (!(Remaining & 1)) continue;
+
+            /* The logical ID always has a bit set, 0 means first processor */
+            if (!Destination) Cluster = HalpApicLogicalId[Cpu] & 0xFFFF0000;
+            if ((HalpApicLogicalId[Cpu] & 0xFFFF0000) != Cluster) continue;
+
+            Destination |= HalpApicLogicalId[Cpu];
+            TargetProcessors &= ~((KAFFINITY)1 << Cpu);
+        }
+
+        ApicWriteCommand(CommandRegister, Destination);
+    }
+}
+
 UCHAR
 NTAPI
 HalpAllocateSystemInterrupt(
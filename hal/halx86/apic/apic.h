@@ -39,11 +39,17 @@
 #endif
 
 #define MSR_APIC_BASE 0x0000001B
+#define MSR_TSC_DEADLINE 0x000006E0
+#define MSR_X2APIC_BASE 0x00000800
+#define MSR_X2APIC_ICR 0x00000830
 #define IOAPIC_PHYS_BASE 0xFEC00000
 #define APIC_CLOCK_INDEX 8
 
 #define ApicLogicalId(Cpu) ((UCHAR)(1<< Cpu))
 
+/* x2APIC registers are MSRs, one per 16 byte xAPIC register */
+#define ApicX2Msr(Offset) (MSR_X2APIC_BASE + ((Offset) >> 4))
+
 /* APIC Register Address Map */
 #define APIC_ID       0x0020 /* Local APIC ID Register (R/W) */
 #define APIC_VER      0x0030 /* Local APIC Version Register (R) */
@@ -128,6 +134,13 @@ enum
     TIMER_DV_DivideBy1 = 11,
 };
 
+enum
+{
+    TIMER_MODE_OneShot = 0,
+    TIMER_MODE_Periodic = 1,
+    TIMER_MODE_TscDeadline = 2
+};
+
 
 typedef union _APIC_BASE_ADRESS_REGISTER
 {
@@ -136,7 +149,8 @@ typedef union _APIC_BASE_ADRESS_REGISTER
     {
         ULONG64 Reserved1:8;
         ULONG64 BootStrapCPUCore:1;
-        ULONG64 Reserved2:2;
+        ULONG64 Reserved2:1;
+        ULONG64 ExtendedMode:1;
         ULONG64 Enable:1;
         ULONG64 BaseAddress:40;
         ULONG64 ReservedMBZ:12;
@@ -217,8 +231,8 @@ typedef union
         ULONG RemoteIRR:1;
         ULONG TriggerMode:1;
         ULONG Mask:1;
-        ULONG TimerMode:1;
-        ULONG Reserved2MBZ:13;
+        ULONG TimerMode:2;
+        ULONG Reserved2MBZ:12;
     };
 } LVT_REGISTER;
 
@@ -260,10 +274,13 @@ typedef union _IOAPIC_REDIRECTION_REGISTER
     };
 } IOAPIC_REDIRECTION_REGISTER;
 
+extern BOOLEAN HalpApicX2Mode;
+
 FORCEINLINE
 ULONG
 ApicRead(ULONG Offset)
 {
+    if (HalpApicX2Mode) return (ULONG)__readmsr(ApicX2Msr(Offset));
     return *(volatile ULONG *)(APIC_BASE + Offset);
 }
 
@@ -271,6 +288,11 @@ FORCEINLINE
 VOID
 ApicWrite(ULONG Offset, ULONG Value)
 {
+    if (HalpApicX2Mode)
+    {
+        __writemsr(ApicX2Msr(Offset), Value);
+        return;
+    }
     *(volatile ULONG *)(APIC_BASE + Offset) = Value;
 }
 
@@ -278,6 +300,18 @@ VOID
 NTAPI
 ApicInitializeTimer(ULONG Cpu);
 
+VOID
+NTAPI
+ApicSetTimerDeadline(ULONG64 TscTicks);
+
+VOID
+NTAPI
+ApicRequestIpi(KAFFINITY TargetProcessors);
+
+VOID
+NTAPI
+ApicInitializeParavirtualEoi(VOID);
+
 VOID
 NTAPI
 HalInitializeProfiling(VOID);
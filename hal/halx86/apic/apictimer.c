@@ -22,28 +22,72 @@ ULONGLONG HalCurProfileInterval = 10000000;
 ULONGLONG HalMinProfileInterval = 1000;
 ULONGLONG HalMaxProfileInterval = 10000000;
 
+/* TSC-deadline timer, the interval is in TSC ticks */
+BOOLEAN HalpTscDeadlineSupported = FALSE;
+ULONG64 HalpTimerDeadlineInterval;
+
 /* TIMER FUNCTIONS ************************************************************/
 
+static
+BOOLEAN
+ApicIsTscDeadlineSupported(VOID)
+{
+    INT CpuInfo[4];
+
+    __cpuid(CpuInfo, 1);
+    return (CpuInfo[2] & 0x1000000) != 0;
+}
+
+static
+VOID
+ApicSetTimerMode(ULONG TimerMode, BOOLEAN Mask)
+{
+    LVT_REGISTER LvtEntry;
+
+    LvtEntry.Long = 0;
+    LvtEntry.TimerMode = TimerMode;
+    LvtEntry.Vector = APIC_PROFILE_VECTOR;
+    LvtEntry.Mask = Mask;
+    ApicWrite(APIC_TMRLVTR, LvtEntry.Long);
+
+    /* The switch to TSC-deadline mode must complete before the MSR is written */
+    if (TimerMode == TIMER_MODE_TscDeadline) _mm_mfence();
+}
+
+/*
+ * Arms a one shot timer interrupt, TscTicks from now. A deadline of 0
+ * disarms the timer.
+ */
+VOID
+NTAPI
+ApicSetTimerDeadline(ULONG64 TscTicks)
+{
+    __writemsr(MSR_TSC_DEADLINE, TscTicks ? __rdtsc() + TscTicks : 0);
+}
+
 VOID
 NTAPI
 ApicSetTimerInterval(ULONG MicroSeconds)
 {
-    LVT_REGISTER LvtEntry;
     ULONGLONG TimerInterval;
 
     /* Calculate the Timer interval */
     TimerInterval = HalpCpuClockFrequency.QuadPart * MicroSeconds / 1000000;
 
+    if (HalpTscDeadlineSupported)
+    {
+        /* One shot, the interrupt handler arms the next deadline */
+        HalpTimerDeadlineInterval = TimerInterval;
+        ApicSetTimerMode(TIMER_MODE_TscDeadline, FALSE);
+        ApicSetTimerDeadline(TimerInterval);
+        return;
+    }
+
     /* Set the count interval */
     ApicWrite(APIC_TICR, (ULONG)TimerInterval);
 
     /* Set to periodic */
-    LvtEntry.Long = 0;
-    LvtEntry.TimerMode = 1;
-    LvtEntry.Vector = APIC_PROFILE_VECTOR;
-    LvtEntry.Mask = 0;
-    ApicWrite(APIC_TMRLVTR, LvtEntry.Long);
-
+    ApicSetTimerMode(TIMER_MODE_Periodic, FALSE);
 }
 
 VOID
@@ -69,6 +113,9 @@ VOID
 NTAPI
 HalInitializeProfiling(VOID)
 {
+    /* Use the TSC-deadline mode when the CPU has it */
+    HalpTscDeadlineSupported = ApicIsTscDeadlineSupported();
+
     KeGetPcr()->HalReserved[HAL_PROFILING_INTERVAL] = HalCurProfileInterval;
     KeGetPcr()->HalReserved[HAL_PROFILING_MULTIPLIER] = 1; /* TODO: HACK */
 }
@@ -77,23 +124,29 @@ VOID
 NTAPI
 HalStartProfileInterrupt(IN KPROFILE_SOURCE ProfileSource)
 {
-    LVT_REGISTER LvtEntry;
-
     /* Only handle ProfileTime */
     if (ProfileSource == ProfileTime)
     {
         /* OK, we are profiling now */
         HalIsProfiling = TRUE;
 
+        if (HalpTscDeadlineSupported)
+        {
+            /* Convert the interval from 100ns units to TSC ticks */
+            HalpTimerDeadlineInterval = HalpCpuClockFrequency.QuadPart *
+                                        HalCurProfileInterval / 10000000;
+
+            /* Unmask it and arm the first deadline */
+            ApicSetTimerMode(TIMER_MODE_TscDeadline, FALSE);
+            ApicSetTimerDeadline(HalpTimerDeadlineInterval);
+            return;
+        }
+
         /* Set interrupt interval */
         ApicWrite(APIC_TICR, KeGetPcr()->HalReserved[HAL_PROFILING_INTERVAL]);
 
         /* Unmask it */
-        LvtEntry.Long = 0;
-        LvtEntry.TimerMode = 1;
-        LvtEntry.Vector = APIC_PROFILE_VECTOR;
-        LvtEntry.Mask = 0;
-        ApicWrite(APIC_TMRLVTR, LvtEntry.Long);
+        ApicSetTimerMode(TIMER_MODE_Periodic, FALSE);
     }
 }
 
@@ -101,20 +154,22 @@ VOID
 NTAPI
 HalStopProfileInterrupt(IN KPROFILE_SOURCE ProfileSource)
 {
-    LVT_REGISTER LvtEntry;
-
     /* Only handle ProfileTime */
     if (ProfileSource == ProfileTime)
     {
         /* We are not profiling */
         HalIsProfiling = FALSE;
 
+        if (HalpTscDeadlineSupported)
+        {
+            /* Mask interrupt and disarm the deadline */
+            ApicSetTimerMode(TIMER_MODE_TscDeadline, TRUE);
+            ApicSetTimerDeadline(0);
+            return;
+        }
+
         /* Mask interrupt */
-        LvtEntry.Long = 0;
-        LvtEntry.TimerMode = 1;
-        LvtEntry.Vector = APIC_PROFILE_VECTOR;
-        LvtEntry.Mask = 1;
-        ApicWrite(APIC_TMRLVTR, LvtEntry.Long);
+        ApicSetTimerMode(TIMER_MODE_Periodic, TRUE);
     }
 }
 
@@ -140,6 +195,14 @@ HalSetProfileInterval(IN ULONG_PTR Interval)
     /* Remember interval */
     HalCurProfileInterval = FixedInterval;
 
+    /* In TSC-deadline mode the next deadline picks it up */
+    if (HalpTscDeadlineSupported)
+    {
+        HalpTimerDeadlineInterval = HalpCpuClockFrequency.QuadPart *
+                                    FixedInterval / 10000000;
+        return Interval;
+    }
+
     /* Recalculate interval for APIC */
     TimerInterval = FixedInterval * KeGetPcr()->HalReserved[HAL_PROFILING_MULTIPLIER] / HalMaxProfileInterval;
 
@@ -151,3 +214,36 @@ HalSetProfileInterval(IN ULONG_PTR Interval)
 
     return Interval;
 }
+
+VOID
+FASTCALL
+HalpProfileInterruptHandler(IN PKTRAP_FRAME TrapFrame)
+{
+    KIRQL Irql;
+
+    /* Enter trap */
+    KiEnterInterruptTrap(TrapFrame);
+
+    /* Start the interrupt */
+    if (HalBeginSystemInterrupt(PROFILE_LEVEL, APIC_PROFILE_VECTOR, &Irql))
+    {
+        /* A TSC-deadline timer fires once, arm the next interrupt */
+        if (HalIsProfiling && HalpTscDeadlineSupported)
+        {
+            ApicSetTimerDeadline(HalpTimerDeadlineInterval);
+        }
+
+        /* If profiling is enabled, call the kernel function */
+        if (HalIsProfiling)
+        {
+            KeProfileInterrupt(TrapFrame);
+        }
+
+        /* Finish the interrupt */
+        _disable();
+        HalEndSystemInterrupt(Irql, TrapFrame);
+    }
+
+    /* Spurious, just end the interrupt */
+    KiEoiHelper(TrapFrame);
+}
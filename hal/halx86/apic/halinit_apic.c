@@ -51,6 +51,9 @@ HalpInitPhase0(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
                                CLOCK2_LEVEL,
                                HalpClockInterrupt,
                                Latched);
+
+    /* Avoid the EOI exits when running on a hypervisor that allows it */
+    ApicInitializeParavirtualEoi();
 }
 
 VOID
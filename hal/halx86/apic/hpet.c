@@ -0,0 +1,101 @@
+/*
+ * PROJECT:         ReactOS HAL
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            hal/halx86/apic/hpet.c
+ * PURPOSE:         High Precision Event Timer main counter
+ */
+
+/* INCLUDES ******************************************************************/
+
+#include <hal.h>
+#define NDEBUG
+#include <debug.h>
+
+#include "tsc.h"
+
+/* HPET register offsets */
+#define HPET_GENERAL_CAPABILITIES   0x000
+#define HPET_GENERAL_CONFIGURATION  0x010
+#define HPET_MAIN_COUNTER           0x0F0
+
+/* HPET_GENERAL_CAPABILITIES bits, the period is in femtoseconds */
+#define HPET_CAP_COUNT_SIZE_64      0x2000
+#define HPET_CAP_MAX_PERIOD         100000000 /* 100 ns */
+#define HPET_FEMTOSECONDS           1000000000000000ULL
+
+/* HPET_GENERAL_CONFIGURATION bits */
+#define HPET_CONF_ENABLE            0x1
+
+PUCHAR HalpHpetBase;
+LARGE_INTEGER HalpHpetFrequency;
+
+/* PRIVATE FUNCTIONS *********************************************************/
+
+FORCEINLINE
+ULONG
+HpetRead(ULONG Offset)
+{
+    return READ_REGISTER_ULONG((PULONG)(HalpHpetBase + Offset));
+}
+
+FORCEINLINE
+VOID
+HpetWrite(ULONG Offset, ULONG Value)
+{
+    WRITE_REGISTER_ULONG((PULONG)(HalpHpetBase + Offset), Value);
+}
+
+BOOLEAN
+NTAPI
+HalpInitializeHpet(VOID)
+{
+    PHYSICAL_ADDRESS HpetAddress;
+    ULONG Capabilities, Period;
+
+    /* Check if the firmware describes a HPET */
+    if (!HalpGetHpetAddress(&HpetAddress)) return FALSE;
+
+    /* Map the register block */
+    HalpHpetBase = HalpMapPhysicalMemory64(HpetAddress, 1);
+    if (!HalpHpetBase) return FALSE;
+
+    /* Only use 64 bit counters, a 32 bit counter wraps within minutes */
+    Capabilities = HpetRead(HPET_GENERAL_CAPABILITIES);
+    Period = HpetRead(HPET_GENERAL_CAPABILITIES + 4);
+    if (!(Capabilities & HPET_CAP_COUNT_SIZE_64) ||
+        (Period == 0) || (Period > HPET_CAP_MAX_PERIOD))
+    {
+        DPRINT1("HPET not usable (capabilities 0x%lx, period %lu fs)\n",
+                Capabilities, Period);
+        HalpUnmapVirtualAddress(HalpHpetBase, 1);
+        HalpHpetBase = NULL;
+        return FALSE;
+    }
+
+    /* Start the main counter, if the firmware did not */
+    HpetWrite(HPET_GENERAL_CONFIGURATION,
+              HpetRead(HPET_GENERAL_CONFIGURATION) | HPET_CONF_ENABLE);
+
+    HalpHpetFrequency.QuadPart = HPET_FEMTOSECONDS / Period;
+    DPRINT1("HPET at 0x%I64x, %I64u Hz\n",
+            HpetAddress.QuadPart, HalpHpetFrequency.QuadPart);
+    return TRUE;
+}
+
+ULONG64
+NTAPI
+HalpReadHpetCounter(VOID)
+{
+    ULONG Low, High, Check;
+
+    /* The counter is read in two halves, retry if the low one wrapped */
+    High = HpetRead(HPET_MAIN_COUNTER + 4);
+    do
+    {
+        Check = High;
+        Low = HpetRead(HPET_MAIN_COUNTER);
+        High = HpetRead(HPET_MAIN_COUNTER + 4);
+    } while (High != Check);
+
+    return ((ULONG64)High << 32) | Low;
+}
@@ -26,6 +26,7 @@ UCHAR HalpCurrentRate = 9;  /* Initial rate  9: 128 Hz / 7.8 ms */
 ULONG HalpCurrentTimeIncrement;
 static UCHAR RtcMinimumClockRate = 6;  /* Minimum rate  6:  16 Hz / 62.5 ms */
 static UCHAR RtcMaximumClockRate = 10; /* Maximum rate 10: 256 Hz / 3.9 ms */
+static UCHAR RtcIdleClockRate = 13;    /* Idle rate    13:   8 Hz / 125 ms */
 
 
 FORCEINLINE
@@ -143,21 +144,22 @@ HalpClockInterruptHandler(IN PKTRAP_FRAME TrapFrame)
     KeUpdateSystemTime(TrapFrame, LastIncrement, Irql);
 }
 
-VOID
-FASTCALL
-HalpProfileInterruptHandler(IN PKTRAP_FRAME TrapFrame)
-{
-    __debugbreak();
-}
-
 ULONG
 NTAPI
 HalSetTimeIncrement(IN ULONG Increment)
 {
-    UCHAR Rate;
+    UCHAR Rate, MaximumRate;
+
+    /*
+     * Increments above the maximum only come from the kernel stretching the
+     * clock period while the system is idle, allow slower rates for those.
+     */
+    MaximumRate = RtcMaximumClockRate;
+    if (Increment > RtcClockRateToIncrement(RtcMaximumClockRate))
+        MaximumRate = RtcIdleClockRate;
 
     /* Lookup largest value below given Increment */
-    for (Rate = RtcMinimumClockRate; Rate <= RtcMaximumClockRate; Rate++)
+    for (Rate = RtcMinimumClockRate; Rate < MaximumRate; Rate++)
     {
         /* Check if this is the largest rate possible */
         if (RtcClockRateToIncrement(Rate + 1) > Increment) break;
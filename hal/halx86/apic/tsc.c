@@ -15,6 +15,8 @@
 #include "tsc.h"
 
 LARGE_INTEGER HalpCpuClockFrequency = {{INITIAL_STALL_COUNT * 1000000}};
+BOOLEAN HalpTscInvariant;
+BOOLEAN HalpUseHpetCounter;
 
 UCHAR TscCalibrationPhase;
 ULONG64 TscCalibrationArray[NUM_SAMPLES];
@@ -25,6 +27,21 @@ UCHAR HalpRtcClockVector = 0xD1;
 
 /* PRIVATE FUNCTIONS *********************************************************/
 
+static
+BOOLEAN
+HalpIsTscInvariant(VOID)
+{
+    INT CpuInfo[4];
+
+    /* Check for the advanced power management leaf */
+    __cpuid(CpuInfo, 0x80000000);
+    if ((ULONG)CpuInfo[0] < 0x80000007) return FALSE;
+
+    /* The invariant TSC runs at a constant rate in all P-, C- and T-states */
+    __cpuid(CpuInfo, 0x80000007);
+    return (CpuInfo[3] & 0x100) != 0;
+}
+
 static
 ULONG64
 DoLinearRegression(
@@ -127,6 +144,19 @@ HalpCalibrateStallExecution(VOID)
     HalpInitializeTsc();
 
     KeGetPcr()->StallScaleFactor = (ULONG)(HalpCpuClockFrequency.QuadPart / 1000000);
+
+    /*
+     * An invariant TSC is the cheapest performance counter there is. Without
+     * it the TSC rate follows the processor frequency, use the HPET instead.
+     */
+    HalpTscInvariant = HalpIsTscInvariant();
+    if (!HalpTscInvariant && HalpInitializeHpet())
+    {
+        HalpUseHpetCounter = TRUE;
+    }
+
+    DPRINT1("Performance counter: %s\n",
+            HalpUseHpetCounter ? "HPET" : (HalpTscInvariant ? "invariant TSC" : "TSC"));
 }
 
 /* PUBLIC FUNCTIONS ***********************************************************/
@@ -138,6 +168,14 @@ KeQueryPerformanceCounter(
 {
     LARGE_INTEGER Result;
 
+    /* Use the HPET when the TSC is not reliable */
+    if (HalpUseHpetCounter)
+    {
+        if (PerformanceFrequency) *PerformanceFrequency = HalpHpetFrequency;
+        Result.QuadPart = HalpReadHpetCounter();
+        return Result;
+    }
+
     /* Make sure it's calibrated */
     ASSERT(HalpCpuClockFrequency.QuadPart != 0);
 
@@ -9,8 +9,14 @@
 
 void __cdecl TscCalibrationISR(void);
 extern LARGE_INTEGER HalpCpuClockFrequency;
+extern BOOLEAN HalpTscInvariant;
 VOID NTAPI HalpInitializeTsc(void);
 
+/* HPET, used as the performance counter when the TSC is not invariant */
+extern LARGE_INTEGER HalpHpetFrequency;
+BOOLEAN NTAPI HalpInitializeHpet(VOID);
+ULONG64 NTAPI HalpReadHpetCounter(VOID);
+
 #ifdef _M_AMD64
 #define KiGetIdtEntry(Pcr, Vector) &((Pcr)->IdtBase[Vector])
 #else
@@ -773,6 +773,12 @@ HalpGetDebugPortTable(
     VOID
 );
 
+BOOLEAN
+NTAPI
+HalpGetHpetAddress(
+    OUT PPHYSICAL_ADDRESS HpetAddress
+);
+
 VOID
 NTAPI
 HalpReportSerialNumber(
@@ -16,6 +16,7 @@
 //#pragma alloc_text(INIT, HaliInitPnpDriver)
 #pragma alloc_text(INIT, HalpBuildAddressMap)
 #pragma alloc_text(INIT, HalpGetDebugPortTable)
+#pragma alloc_text(INIT, HalpGetHpetAddress)
 #pragma alloc_text(INIT, HalpIs16BitPortDecodeSupported)
 #pragma alloc_text(INIT, HalpSetupAcpiPhase0)
 #pragma alloc_text(INIT, HalReportResourceUsage)
@@ -60,6 +61,15 @@ HalpGetDebugPortTable(VOID)
     return FALSE;
 }
 
+INIT_SECTION
+BOOLEAN
+NTAPI
+HalpGetHpetAddress(OUT PPHYSICAL_ADDRESS HpetAddress)
+{
+    /* The HPET is only described by ACPI */
+    return FALSE;
+}
+
 INIT_SECTION
 ULONG
 NTAPI
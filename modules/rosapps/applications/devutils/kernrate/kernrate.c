@@ -0,0 +1,429 @@
+/*
+ * PROJECT:     ReactOS kernel profiler
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Samples the call stacks of all processors through the kernel
+ *              stack profiler and reports the hottest functions
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <dbghelp.h>
+#define NTOS_MODE_USER
+#include <ndk/ntndk.h>
+
+#define DRAIN_INTERVAL                  100     /* ms */
+#define DRAIN_ENTRIES                   4096
+
+#define ADDRESS_HASH_SIZE               65536   /* power of two */
+#define ADDRESS_HASH_PROBES             64
+#define MAX_PROCESSES                   256
+#define MAX_SYMBOL_NAME                 256
+
+/* A function, or a module without symbols, that showed up in the samples */
+typedef struct _FUNCTION
+{
+    CHAR Name[MAX_SYMBOL_NAME + 64];
+    ULONG Exclusive;                /* Samples it was interrupted in */
+    ULONG Inclusive;                /* Samples it was on the stack of */
+    ULONG LastSample;               /* To count recursive functions once */
+} FUNCTION, *PFUNCTION;
+
+/* Cache of the addresses resolved so far, user addresses per process */
+typedef struct _ADDRESS_ENTRY
+{
+    ULONG ProcessId;                /* 0 for kernel addresses */
+    ULONG_PTR Address;
+    ULONG Function;                 /* Index + 1 in Functions, 0 if unused */
+} ADDRESS_ENTRY, *PADDRESS_ENTRY;
+
+typedef struct _PROCESS
+{
+    ULONG ProcessId;
+    HANDLE Handle;                  /* dbghelp session, NULL if it is gone */
+} PROCESS, *PPROCESS;
+
+static PFUNCTION Functions;
+static ULONG FunctionCount, FunctionMax;
+static ADDRESS_ENTRY Addresses[ADDRESS_HASH_SIZE];
+static PROCESS Processes[MAX_PROCESSES];
+static ULONG ProcessCount;
+static HANDLE KernelSession;
+
+static ULONG Samples, KernelSamples, LostSamples, SampleNumber;
+
+static
+VOID
+Usage(VOID)
+{
+    printf("Usage: kernrate [-s seconds] [-i interval] [-n count] [-k]\n"
+           "  -s  Seconds to sample, 10 by default\n"
+           "  -i  Profile interrupt interval in 100ns units\n"
+           "  -n  Number of functions to report, 30 by default\n"
+           "  -k  Kernel only, don't resolve user mode addresses\n");
+}
+
+static
+ULONG
+AddFunction(PCSTR Name)
+{
+    ULONG i;
+    PFUNCTION NewFunctions;
+
+    for (i = 0; i < FunctionCount; i++)
+    {
+        if (!strcmp(Functions[i].Name, Name))
+            return i + 1;
+    }
+
+    if (FunctionCount == FunctionMax)
+    {
+        FunctionMax = FunctionMax ? FunctionMax * 2 : 1024;
+        NewFunctions = realloc(Functions, FunctionMax * sizeof(FUNCTION));
+        if (!NewFunctions)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        Functions = NewFunctions;
+    }
+
+    memset(&Functions[FunctionCount], 0, sizeof(FUNCTION));
+    strncpy(Functions[FunctionCount].Name, Name, sizeof(Functions[FunctionCount].Name) - 1);
+    return ++FunctionCount;
+}
+
+/* Load the symbols of the drivers, the kernel is a process of its own to dbghelp */
+static
+BOOL
+LoadKernelModules(VOID)
+{
+    PRTL_PROCESS_MODULES Modules;
+    PRTL_PROCESS_MODULE_INFORMATION Module;
+    CHAR SystemRoot[MAX_PATH], Path[MAX_PATH];
+    PCSTR FileName;
+    ULONG Size = 0x10000, i;
+    NTSTATUS Status;
+
+    KernelSession = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, GetCurrentProcessId());
+    if (!KernelSession || !SymInitialize(KernelSession, NULL, FALSE))
+        return FALSE;
+
+    for (;;)
+    {
+        Modules = malloc(Size);
+        if (!Modules)
+            return FALSE;
+
+        Status = NtQuerySystemInformation(SystemModuleInformation, Modules, Size, &Size);
+        if (Status != STATUS_INFO_LENGTH_MISMATCH)
+            break;
+        free(Modules);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        free(Modules);
+        return FALSE;
+    }
+
+    GetWindowsDirectoryA(SystemRoot, sizeof(SystemRoot));
+    for (i = 0; i < Modules->NumberOfModules; i++)
+    {
+        Module = &Modules->Modules[i];
+        FileName = (PCSTR)Module->FullPathName;
+
+        /* Turn the NT path into one dbghelp can open */
+        if (!_strnicmp(FileName, "\\SystemRoot\\", 12))
+            _snprintf(Path, sizeof(Path), "%s\\%s", SystemRoot, FileName + 12);
+        else if (!strncmp(FileName, "\\??\\", 4))
+            _snprintf(Path, sizeof(Path), "%s", FileName + 4);
+        else
+            _snprintf(Path, sizeof(Path), "%s", FileName);
+        Path[sizeof(Path) - 1] = ANSI_NULL;
+
+        SymLoadModuleEx(KernelSession,
+                        NULL,
+                        Path,
+                        (PCSTR)Module->FullPathName + Module->OffsetToFileName,
+                        (DWORD64)(ULONG_PTR)Module->ImageBase,
+                        Module->ImageSize,
+                        NULL,
+                        0);
+    }
+
+    free(Modules);
+    return TRUE;
+}
+
+static
+HANDLE
+GetProcessSession(ULONG ProcessId)
+{
+    HANDLE Handle;
+    ULONG i;
+
+    for (i = 0; i < ProcessCount; i++)
+    {
+        if (Processes[i].ProcessId == ProcessId)
+            return Processes[i].Handle;
+    }
+
+    /* The process may be gone by now, then its addresses stay unresolved */
+    Handle = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, ProcessId);
+    if (Handle && !SymInitialize(Handle, NULL, TRUE))
+    {
+        CloseHandle(Handle);
+        Handle = NULL;
+    }
+
+    if (ProcessCount < MAX_PROCESSES)
+    {
+        Processes[ProcessCount].ProcessId = ProcessId;
+        Processes[ProcessCount].Handle = Handle;
+        ProcessCount++;
+    }
+
+    return Handle;
+}
+
+static
+ULONG
+ResolveAddress(ULONG ProcessId, ULONG_PTR Address)
+{
+    CHAR Buffer[sizeof(SYMBOL_INFO) + MAX_SYMBOL_NAME];
+    CHAR Name[MAX_SYMBOL_NAME + 64];
+    PSYMBOL_INFO Symbol = (PSYMBOL_INFO)Buffer;
+    IMAGEHLP_MODULE64 ModuleInfo;
+    PADDRESS_ENTRY Entry = NULL;
+    HANDLE Session;
+    ULONG Hash, Probe;
+
+    /* Look in the cache first */
+    Hash = (ULONG)((Address >> 2) ^ (Address >> 16) ^ (ProcessId * 2654435761u));
+    for (Probe = 0; Probe < ADDRESS_HASH_PROBES; Probe++)
+    {
+        Entry = &Addresses[(Hash + Probe) & (ADDRESS_HASH_SIZE - 1)];
+        if (!Entry->Function)
+            break;
+        if (Entry->ProcessId == ProcessId && Entry->Address == Address)
+            return Entry->Function;
+    }
+
+    Session = ProcessId ? GetProcessSession(ProcessId) : KernelSession;
+
+    ModuleInfo.SizeOfStruct = sizeof(ModuleInfo);
+    Symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    Symbol->MaxNameLen = MAX_SYMBOL_NAME - 1;
+
+    if (!Session || !SymGetModuleInfo64(Session, Address, &ModuleInfo))
+        _snprintf(Name, sizeof(Name), ProcessId ? "<user>" : "<kernel>");
+    else if (SymFromAddr(Session, Address, NULL, Symbol))
+        _snprintf(Name, sizeof(Name), "%s!%s", ModuleInfo.ModuleName, Symbol->Name);
+    else
+        _snprintf(Name, sizeof(Name), "%s!<no symbol>", ModuleInfo.ModuleName);
+    Name[sizeof(Name) - 1] = ANSI_NULL;
+
+    /* The cache is only for speed, when it is full just don't add to it */
+    if (Probe < ADDRESS_HASH_PROBES)
+    {
+        Entry->ProcessId = ProcessId;
+        Entry->Address = Address;
+        Entry->Function = AddFunction(Name);
+        return Entry->Function;
+    }
+
+    return AddFunction(Name);
+}
+
+static
+VOID
+AddSample(PSYSDBG_STACK_PROFILE_ENTRY Entry, BOOL KernelOnly)
+{
+    PFUNCTION Function;
+    ULONG i, Frames, Index;
+    ULONG_PTR Address;
+    BOOL User;
+
+    if (Entry->Type == SYSDBG_STACK_PROFILE_LOST)
+    {
+        LostSamples += Entry->ThreadId;
+        return;
+    }
+
+    Samples++;
+    SampleNumber++;
+    if (Entry->KernelFrames)
+        KernelSamples++;
+
+    Frames = Entry->KernelFrames + Entry->UserFrames;
+    for (i = 0; i < Frames; i++)
+    {
+        User = (i >= Entry->KernelFrames);
+        if (User && KernelOnly)
+        {
+            if (i == 0)
+                Functions[AddFunction("<user>") - 1].Exclusive++;
+            break;
+        }
+
+        /* Return addresses point after the call, look the call up */
+        Address = (ULONG_PTR)Entry->Frames[i];
+        if (i != 0 && i != Entry->KernelFrames)
+            Address--;
+
+        Index = ResolveAddress(User ? Entry->ProcessId : 0, Address);
+        Function = &Functions[Index - 1];
+
+        if (i == 0)
+            Function->Exclusive++;
+        if (Function->LastSample != SampleNumber)
+        {
+            Function->LastSample = SampleNumber;
+            Function->Inclusive++;
+        }
+    }
+}
+
+static
+NTSTATUS
+SetStackProfile(BOOLEAN Enable, ULONG Interval)
+{
+    SYSDBG_STACK_PROFILE_CONTROL Control;
+
+    Control.Enable = Enable;
+    Control.Interval = Interval;
+    return NtSystemDebugControl(SysDbgSetStackProfile, &Control, sizeof(Control), NULL, 0, NULL);
+}
+
+static
+NTSTATUS
+DrainSamples(PSYSDBG_STACK_PROFILE_ENTRY Buffer, BOOL KernelOnly)
+{
+    NTSTATUS Status;
+    ULONG Length, i;
+
+    do
+    {
+        Status = NtSystemDebugControl(SysDbgQueryStackProfile,
+                                      NULL,
+                                      0,
+                                      Buffer,
+                                      DRAIN_ENTRIES * sizeof(SYSDBG_STACK_PROFILE_ENTRY),
+                                      &Length);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        for (i = 0; i < Length / sizeof(SYSDBG_STACK_PROFILE_ENTRY); i++)
+            AddSample(&Buffer[i], KernelOnly);
+    } while (Status == STATUS_MORE_ENTRIES);
+
+    return STATUS_SUCCESS;
+}
+
+static
+int
+__cdecl
+CompareFunctions(const void *A, const void *B)
+{
+    const FUNCTION *First = A, *Second = B;
+
+    if (First->Exclusive != Second->Exclusive)
+        return (First->Exclusive < Second->Exclusive) ? 1 : -1;
+    if (First->Inclusive != Second->Inclusive)
+        return (First->Inclusive < Second->Inclusive) ? 1 : -1;
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    PSYSDBG_STACK_PROFILE_ENTRY Buffer;
+    ULONG Seconds = 10, Interval = 0, Count = 30, i;
+    BOOL KernelOnly = FALSE;
+    BOOLEAN OldValue;
+    DWORD End;
+    NTSTATUS Status;
+
+    for (i = 1; i < (ULONG)argc; i++)
+    {
+        if (!strcmp(argv[i], "-s") && i + 1 < (ULONG)argc)
+            Seconds = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-i") && i + 1 < (ULONG)argc)
+            Interval = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-n") && i + 1 < (ULONG)argc)
+            Count = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-k"))
+            KernelOnly = TRUE;
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    Status = RtlAdjustPrivilege(SE_SYSTEM_PROFILE_PRIVILEGE, TRUE, FALSE, &OldValue);
+    if (!NT_SUCCESS(Status))
+    {
+        fprintf(stderr, "Can't enable the profiling privilege: 0x%08lx\n", Status);
+        return 1;
+    }
+
+    Buffer = malloc(DRAIN_ENTRIES * sizeof(SYSDBG_STACK_PROFILE_ENTRY));
+    if (!Buffer)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    SymSetOptions(SymGetOptions() | SYMOPT_UNDNAME);
+    if (!LoadKernelModules())
+        fprintf(stderr, "Can't load the kernel module symbols\n");
+
+    Status = SetStackProfile(TRUE, Interval);
+    if (!NT_SUCCESS(Status))
+    {
+        fprintf(stderr, "Can't start the stack profiler: 0x%08lx\n", Status);
+        return 1;
+    }
+
+    printf("Sampling for %lu seconds...\n", Seconds);
+    End = GetTickCount() + Seconds * 1000;
+    while ((LONG)(End - GetTickCount()) > 0)
+    {
+        Sleep(DRAIN_INTERVAL);
+
+        /* Resolving user addresses while sampling, processes may exit later */
+        Status = DrainSamples(Buffer, KernelOnly);
+        if (!NT_SUCCESS(Status))
+            break;
+    }
+
+    SetStackProfile(FALSE, 0);
+    if (NT_SUCCESS(Status))
+        Status = DrainSamples(Buffer, KernelOnly);
+    if (!NT_SUCCESS(Status))
+        fprintf(stderr, "Can't read the samples: 0x%08lx\n", Status);
+
+    printf("%lu samples, %lu in kernel mode, %lu lost\n\n", Samples, KernelSamples, LostSamples);
+    if (!Samples)
+        return 0;
+
+    qsort(Functions, FunctionCount, sizeof(FUNCTION), CompareFunctions);
+
+    printf("Exclusive      %%  Inclusive      %%  Function\n");
+    for (i = 0; i < FunctionCount && i < Count; i++)
+    {
+        printf("%9lu  %5.1f  %9lu  %5.1f  %s\n",
+               Functions[i].Exclusive,
+               Functions[i].Exclusive * 100.0 / Samples,
+               Functions[i].Inclusive,
+               Functions[i].Inclusive * 100.0 / Samples,
+               Functions[i].Name);
+    }
+
+    return 0;
+}
@@ -429,7 +429,7 @@ list(APPEND SOURCE_CRTDLL
 #    memchr.c
 #    memcmp.c
 #    memcpy.c
-#    memmove.c
+    memmove.c
 #    memset.c
 #    mktime.c
 #    modf.c
@@ -0,0 +1,153 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for memmove
+ */
+
+#include <apitest.h>
+
+#include <string.h>
+
+#define BUFFER_SIZE 192
+
+static unsigned char Pattern[BUFFER_SIZE];
+static unsigned char Buffer[BUFFER_SIZE];
+static unsigned char Expected[BUFFER_SIZE];
+
+typedef void *(__cdecl *PFN_MEMMOVE)(void *, const void *, size_t);
+
+static void
+ReferenceMove(unsigned char *Dest, const unsigned char *Source, size_t Count)
+{
+    unsigned char Temp[BUFFER_SIZE];
+    size_t i;
+
+    for (i = 0; i < Count; i++) Temp[i] = Source[i];
+    for (i = 0; i < Count; i++) Dest[i] = Temp[i];
+}
+
+/* Cover every relative alignment in both directions, with heads and tails */
+static void
+Test_memmove_alignments(PFN_MEMMOVE pmemmove, const char *Name)
+{
+    size_t DestOffset, SourceOffset, Count, i;
+    void *Result;
+
+    for (DestOffset = 0; DestOffset < 16; DestOffset++)
+    {
+        for (SourceOffset = 0; SourceOffset < 16; SourceOffset++)
+        {
+            for (Count = 0; Count <= 80; Count++)
+            {
+                memcpy(Buffer, Pattern, BUFFER_SIZE);
+                memcpy(Expected, Pattern, BUFFER_SIZE);
+
+                /* Overlapping move, either way depending on the offsets */
+                ReferenceMove(Expected + DestOffset + 32, Expected + SourceOffset + 32, Count);
+                Result = pmemmove(Buffer + DestOffset + 32, Buffer + SourceOffset + 32, Count);
+                ok(Result == Buffer + DestOffset + 32, "%s returned %p\n", Name, Result);
+
+                for (i = 0; i < BUFFER_SIZE && Buffer[i] == Expected[i]; i++);
+                ok(i == BUFFER_SIZE, "%s(+%u, +%u, %u) differs at %u\n", Name,
+                   (unsigned)DestOffset, (unsigned)SourceOffset, (unsigned)Count, (unsigned)i);
+                if (i != BUFFER_SIZE) return;
+            }
+        }
+    }
+}
+
+static void
+Test_memset_alignments(void)
+{
+    size_t Offset, Count, i;
+
+    for (Offset = 0; Offset < 16; Offset++)
+    {
+        for (Count = 0; Count <= 80; Count++)
+        {
+            memcpy(Buffer, Pattern, BUFFER_SIZE);
+            memcpy(Expected, Pattern, BUFFER_SIZE);
+            for (i = 0; i < Count; i++) Expected[Offset + i] = 0xA5;
+
+            ok(memset(Buffer + Offset, 0xFFFFFFA5, Count) == Buffer + Offset, "memset returned wrong pointer\n");
+            ok(memcmp(Buffer, Expected, BUFFER_SIZE) == 0, "memset(+%u, %u) is wrong\n",
+               (unsigned)Offset, (unsigned)Count);
+        }
+    }
+}
+
+static void
+Test_memcmp_alignments(void)
+{
+    size_t Offset, Count, Diff;
+
+    for (Offset = 0; Offset < 16; Offset++)
+    {
+        for (Count = 1; Count <= 64; Count++)
+        {
+            memcpy(Buffer, Pattern, BUFFER_SIZE);
+            memcpy(Expected, Pattern, BUFFER_SIZE);
+            ok(memcmp(Buffer + Offset, Expected + Offset, Count) == 0, "memcmp(+%u, %u) should be 0\n",
+               (unsigned)Offset, (unsigned)Count);
+
+            /* The first difference decides, compared as unsigned bytes */
+            Diff = Count / 2;
+            Buffer[Offset + Diff] = 0x80;
+            Expected[Offset + Diff] = 0x7F;
+            Buffer[Offset + Count - 1] = 0x00;
+            Expected[Offset + Count - 1] = 0xFF;
+            if (Diff == Count - 1)
+                ok(memcmp(Buffer + Offset, Expected + Offset, Count) < 0, "memcmp(+%u, %u) should be < 0\n",
+                   (unsigned)Offset, (unsigned)Count);
+            else
+                ok(memcmp(Buffer + Offset, Expected + Offset, Count) > 0, "memcmp(+%u, %u) should be > 0\n",
+                   (unsigned)Offset, (unsigned)Count);
+        }
+    }
+}
+
+static void
+Test_string_alignments(void)
+{
+    char String[96];
+    wchar_t WideString[48];
+    size_t Offset, Length, i;
+
+    for (Offset = 0; Offset < 16; Offset++)
+    {
+        for (Length = 0; Length < 64; Length++)
+        {
+            for (i = 0; i < sizeof(String); i++) String[i] = (char)(0x80 + (i % 0x7F) + 1);
+            String[Offset + Length] = 0;
+            ok(strlen(String + Offset) == Length, "strlen(+%u) should be %u\n", (unsigned)Offset, (unsigned)Length);
+            ok(strchr(String + Offset, 0) == String + Offset + Length, "strchr(+%u, 0) is wrong\n", (unsigned)Offset);
+            if (Length)
+            {
+                ok(strchr(String + Offset, String[Offset + Length - 1]) == String + Offset + Length - 1,
+                   "strchr(+%u) missed the last character\n", (unsigned)Offset);
+            }
+            ok(strchr(String + Offset, 'a') == NULL, "strchr(+%u) found a missing character\n", (unsigned)Offset);
+
+            if (Offset + Length < 48)
+            {
+                for (i = 0; i < 48; i++) WideString[i] = (wchar_t)(0x8000 + i + 1);
+                WideString[Offset + Length] = 0;
+                ok(wcslen(WideString + Offset) == Length, "wcslen(+%u) should be %u\n", (unsigned)Offset, (unsigned)Length);
+            }
+        }
+    }
+}
+
+START_TEST(memmove)
+{
+    size_t i;
+
+    for (i = 0; i < BUFFER_SIZE; i++)
+        Pattern[i] = (unsigned char)(i * 7 + 1);
+
+    Test_memmove_alignments(memmove, "memmove");
+    Test_memmove_alignments(memcpy, "memcpy");
+    Test_memset_alignments();
+    Test_memcmp_alignments();
+    Test_string_alignments();
+}
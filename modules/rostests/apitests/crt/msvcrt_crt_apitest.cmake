@@ -1124,7 +1124,7 @@ list(APPEND SOURCE_MSVCRT
 #    memcmp.c
 #    memcpy.c
 #    memcpy_s.c memmove_s
-#    memmove.c
+    memmove.c
 #    memmove_s.c
 #    memset.c
 #    mktime.c
@@ -75,7 +75,7 @@ list(APPEND SOURCE_NTDLL
 #    memchr.c
 #    memcmp.c
     # memcpy == memmove
-#    memmove.c
+    memmove.c
 #    memset.c
 #    pow.c
 #    qsort.c
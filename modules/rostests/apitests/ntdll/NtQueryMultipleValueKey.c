@@ -0,0 +1,131 @@
+/*
+ * PROJECT:         ReactOS API tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test for NtQueryMultipleValueKey
+ */
+
+#include "precomp.h"
+
+#include <winreg.h>
+
+#define MANY_VALUES 40
+
+START_TEST(NtQueryMultipleValueKey)
+{
+    NTSTATUS Status;
+    HANDLE ParentKeyHandle;
+    HANDLE KeyHandle;
+    UNICODE_STRING KeyName = RTL_CONSTANT_STRING(L"SOFTWARE\\ntdll-apitest-NtQueryMultipleValueKey");
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Names[MANY_VALUES];
+    WCHAR NameBuffers[MANY_VALUES][16];
+    KEY_VALUE_ENTRY Entries[MANY_VALUES];
+    UNICODE_STRING Missing = RTL_CONSTANT_STRING(L"Missing");
+    WCHAR Hello[] = L"Hello";
+    UCHAR Binary[] = { 1, 2, 3 };
+    UCHAR Buffer[1024];
+    ULONG Length, ReturnLength;
+    ULONG i;
+
+    Status = RtlOpenCurrentUser(READ_CONTROL, &ParentKeyHandle);
+    ok(Status == STATUS_SUCCESS, "RtlOpenCurrentUser returned %lx\n", Status);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("No user key handle\n");
+        return;
+    }
+
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &KeyName,
+                               OBJ_CASE_INSENSITIVE,
+                               ParentKeyHandle,
+                               NULL);
+    Status = NtCreateKey(&KeyHandle,
+                         KEY_QUERY_VALUE | KEY_SET_VALUE | DELETE,
+                         &ObjectAttributes,
+                         0,
+                         NULL,
+                         REG_OPTION_VOLATILE,
+                         NULL);
+    ok(Status == STATUS_SUCCESS, "NtCreateKey returned %lx\n", Status);
+    if (!NT_SUCCESS(Status))
+    {
+        NtClose(ParentKeyHandle);
+        skip("No key handle\n");
+        return;
+    }
+
+    /* Value i holds i as a DWORD, except for two with other types */
+    for (i = 0; i < MANY_VALUES; i++)
+    {
+        StringCbPrintfW(NameBuffers[i], sizeof(NameBuffers[i]), L"Value%lu", i);
+        RtlInitUnicodeString(&Names[i], NameBuffers[i]);
+        if (i == 1)
+            Status = NtSetValueKey(KeyHandle, &Names[i], 0, REG_SZ, Hello, sizeof(Hello));
+        else if (i == 2)
+            Status = NtSetValueKey(KeyHandle, &Names[i], 0, REG_BINARY, Binary, sizeof(Binary));
+        else
+            Status = NtSetValueKey(KeyHandle, &Names[i], 0, REG_DWORD, &i, sizeof(i));
+        ok(Status == STATUS_SUCCESS, "[%lu] NtSetValueKey returned %lx\n", i, Status);
+    }
+
+    /* Query all of them, in reverse order and with different case */
+    for (i = 0; i < MANY_VALUES; i++)
+    {
+        Entries[i].ValueName = &Names[MANY_VALUES - 1 - i];
+    }
+    RtlUpcaseUnicodeString(&Names[0], &Names[0], FALSE);
+    RtlZeroMemory(Buffer, sizeof(Buffer));
+    Length = sizeof(Buffer);
+    ReturnLength = 0x55555555;
+    Status = NtQueryMultipleValueKey(KeyHandle, Entries, MANY_VALUES, Buffer, &Length, &ReturnLength);
+    ok(Status == STATUS_SUCCESS, "NtQueryMultipleValueKey returned %lx\n", Status);
+    ok(Length == ReturnLength, "Length = %lu, ReturnLength = %lu\n", Length, ReturnLength);
+    for (i = 0; NT_SUCCESS(Status) && i < MANY_VALUES; i++)
+    {
+        ULONG Value = MANY_VALUES - 1 - i;
+
+        ok(Entries[i].DataOffset % sizeof(ULONG) == 0, "[%lu] DataOffset = %lu\n", i, Entries[i].DataOffset);
+        ok(Entries[i].DataOffset + Entries[i].DataLength <= Length, "[%lu] DataOffset = %lu\n", i, Entries[i].DataOffset);
+        if (Value == 1)
+        {
+            ok(Entries[i].Type == REG_SZ, "[%lu] Type = %lu\n", i, Entries[i].Type);
+            ok(Entries[i].DataLength == sizeof(Hello), "[%lu] DataLength = %lu\n", i, Entries[i].DataLength);
+            ok(!memcmp(Buffer + Entries[i].DataOffset, Hello, sizeof(Hello)), "[%lu] Data does not match\n", i);
+        }
+        else if (Value == 2)
+        {
+            ok(Entries[i].Type == REG_BINARY, "[%lu] Type = %lu\n", i, Entries[i].Type);
+            ok(Entries[i].DataLength == sizeof(Binary), "[%lu] DataLength = %lu\n", i, Entries[i].DataLength);
+            ok(!memcmp(Buffer + Entries[i].DataOffset, Binary, sizeof(Binary)), "[%lu] Data does not match\n", i);
+        }
+        else
+        {
+            ok(Entries[i].Type == REG_DWORD, "[%lu] Type = %lu\n", i, Entries[i].Type);
+            ok(Entries[i].DataLength == sizeof(ULONG), "[%lu] DataLength = %lu\n", i, Entries[i].DataLength);
+            ok(*(PULONG)(Buffer + Entries[i].DataOffset) == Value, "[%lu] Data = %lu\n", i, *(PULONG)(Buffer + Entries[i].DataOffset));
+        }
+    }
+
+    /* A buffer that is too small gets the needed length back */
+    Length = sizeof(ULONG);
+    ReturnLength = 0;
+    Status = NtQueryMultipleValueKey(KeyHandle, Entries, MANY_VALUES, Buffer, &Length, &ReturnLength);
+    ok(Status == STATUS_BUFFER_OVERFLOW, "NtQueryMultipleValueKey returned %lx\n", Status);
+    ok(ReturnLength > sizeof(ULONG), "ReturnLength = %lu\n", ReturnLength);
+
+    /* A single missing value fails the whole query */
+    Entries[3].ValueName = &Missing;
+    Length = sizeof(Buffer);
+    Status = NtQueryMultipleValueKey(KeyHandle, Entries, MANY_VALUES, Buffer, &Length, &ReturnLength);
+    ok(Status == STATUS_OBJECT_NAME_NOT_FOUND, "NtQueryMultipleValueKey returned %lx\n", Status);
+    Status = NtQueryMultipleValueKey(KeyHandle, &Entries[3], 1, Buffer, &Length, &ReturnLength);
+    ok(Status == STATUS_OBJECT_NAME_NOT_FOUND, "NtQueryMultipleValueKey returned %lx\n", Status);
+
+    Status = NtDeleteKey(KeyHandle);
+    ok(Status == STATUS_SUCCESS, "NtDeleteKey returned %lx\n", Status);
+    Status = NtClose(KeyHandle);
+    ok(Status == STATUS_SUCCESS, "NtClose returned %lx\n", Status);
+    Status = NtClose(ParentKeyHandle);
+    ok(Status == STATUS_SUCCESS, "NtClose returned %lx\n", Status);
+}
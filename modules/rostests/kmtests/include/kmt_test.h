@@ -166,6 +166,11 @@ USHORT KmtGetPoolType(PVOID Memory);
 PVOID KmtGetSystemRoutineAddress(IN PCWSTR RoutineName);
 PKTHREAD KmtStartThread(IN PKSTART_ROUTINE StartRoutine, IN PVOID StartContext OPTIONAL);
 VOID KmtFinishThread(IN PKTHREAD Thread OPTIONAL, IN PKEVENT Event OPTIONAL);
+
+#define KMT_BENCH_MAX_THREADS 32
+typedef VOID KMT_BENCH_OPERATION(IN PVOID Context, IN ULONG ThreadIndex);
+typedef KMT_BENCH_OPERATION *PKMT_BENCH_OPERATION;
+VOID KmtRunBenchmark(IN PCSTR Name, IN PKMT_BENCH_OPERATION Operation, IN PVOID Context OPTIONAL);
 #elif defined KMT_USER_MODE
 DWORD KmtRunKernelTest(IN PCSTR TestName);
 
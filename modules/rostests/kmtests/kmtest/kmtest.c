@@ -27,6 +27,7 @@ typedef enum
     KMT_LIST_TESTS,
     KMT_LIST_ALL_TESTS,
     KMT_RUN_TEST,
+    KMT_RUN_BENCHMARKS,
 } KMT_OPERATION;
 
 HANDLE KmtestHandle;
@@ -38,6 +39,7 @@ static DWORD ListTests(IN BOOLEAN IncludeHidden);
 static PKMT_TESTFUNC FindTest(IN PCSTR TestName);
 static DWORD OutputResult(IN PCSTR TestName);
 static DWORD RunTest(IN PCSTR TestName);
+static DWORD RunBenchmarks(VOID);
 int __cdecl main(int ArgCount, char **Arguments);
 
 /**
@@ -287,6 +289,51 @@ cleanup:
     return Error;
 }
 
+/**
+ * @name RunBenchmarks
+ *
+ * Run all hidden kernel-mode tests whose name ends in "Benchmark",
+ * outputting the results of each.
+ *
+ * @return Win32 error code
+ */
+static
+DWORD
+RunBenchmarks(VOID)
+{
+    DWORD Error = ERROR_SUCCESS;
+    CHAR Buffer[4096];
+    DWORD BytesRead;
+    PCSTR TestName;
+    SIZE_T Length;
+    const SIZE_T SuffixLength = sizeof("Benchmark") - 1;
+
+    if (!DeviceIoControl(KmtestHandle, IOCTL_KMTEST_GET_TESTS, NULL, 0, Buffer, sizeof Buffer, &BytesRead, NULL))
+        error_goto(Error, cleanup);
+    Buffer[sizeof Buffer - 2] = Buffer[sizeof Buffer - 1] = '\0';
+
+    for (TestName = Buffer; *TestName; TestName += Length + 1)
+    {
+        Length = strlen(TestName);
+        if (TestName[0] != '-' || Length <= SuffixLength ||
+            lstrcmpA(TestName + Length - SuffixLength, "Benchmark"))
+            continue;
+
+        Error = RunTest(TestName + 1);
+        if (Error)
+            break;
+
+        // every test gets a log of its own
+        ResultBuffer->Successes = 0;
+        ResultBuffer->Failures = 0;
+        ResultBuffer->Skipped = 0;
+        ResultBuffer->LogBufferLength = 0;
+    }
+
+cleanup:
+    return Error;
+}
+
 /**
  * @name main
  *
@@ -321,6 +368,7 @@ main(
         printf("Usage: %s <test_name>                 - run the specified test (creates/starts the driver(s) as appropriate)\n", AppName);
         printf("       %s --list                      - list available tests\n", AppName);
         printf("       %s --list-all                  - list available tests, including hidden\n", AppName);
+        printf("       %s --benchmark                 - run the kernel-mode benchmarks\n", AppName);
         printf("       %s <create|delete|start|stop>  - manage the kmtest driver\n\n", AppName);
         Operation = KMT_LIST_TESTS;
     }
@@ -340,6 +388,8 @@ main(
             Operation = KMT_LIST_TESTS;
         else if (!lstrcmpA(TestName, "--list-all"))
             Operation = KMT_LIST_ALL_TESTS;
+        else if (!lstrcmpA(TestName, "--benchmark"))
+            Operation = KMT_RUN_BENCHMARKS;
         else
             Operation = KMT_RUN_TEST;
     }
@@ -365,6 +415,9 @@ main(
             case KMT_RUN_TEST:
                 Error = RunTest(TestName);
                 break;
+            case KMT_RUN_BENCHMARKS:
+                Error = RunBenchmarks();
+                break;
             default:
                 assert(FALSE);
         }
@@ -0,0 +1,325 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     LGPL-2.1+ (https://spdx.org/licenses/LGPL-2.1+)
+ * PURPOSE:     Kernel-Mode Test Suite benchmark framework
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/*
+ * A benchmark runs its operation in a loop on 1, 2, 4, ... threads, up to one
+ * thread per processor, each thread bound to its own processor. Every
+ * KMT_BENCH_SAMPLE_INTERVAL'th operation is timed on its own, the timer
+ * overhead is subtracted. For every thread count one line is logged:
+ *
+ *   bench: name=<name> threads=<n> ops=<n> ops_per_sec=<n> p50_ns=<n> p90_ns=<n> p99_ns=<n> p999_ns=<n> max_ns=<n>
+ *
+ * The latencies are the lower bound of a histogram bucket, the buckets are
+ * at most 12.5% wide.
+ */
+
+#define TAG_BENCH                   'BtmK'
+
+#define KMT_BENCH_DURATION          (500 * MILLISECOND)
+#define KMT_BENCH_SAMPLE_INTERVAL   16
+#define KMT_BENCH_BUCKETS           512
+
+typedef struct _KMT_BENCH_RUN *PKMT_BENCH_RUN;
+
+typedef struct _KMT_BENCH_THREAD
+{
+    PKMT_BENCH_RUN Run;
+    ULONG Index;
+    PKTHREAD Thread;
+    ULONG64 Operations;
+    LONGLONG ElapsedTicks;
+    ULONG Histogram[KMT_BENCH_BUCKETS];
+} KMT_BENCH_THREAD, *PKMT_BENCH_THREAD;
+
+typedef struct _KMT_BENCH_RUN
+{
+    PKMT_BENCH_OPERATION Operation;
+    PVOID Context;
+    KEVENT StartEvent;
+    volatile LONG Ready;
+    volatile LONG Stop;
+    LONGLONG Frequency;
+    LONGLONG TimerOverhead;
+    ULONG64 Histogram[KMT_BENCH_BUCKETS];
+    KMT_BENCH_THREAD Threads[KMT_BENCH_MAX_THREADS];
+} KMT_BENCH_RUN;
+
+/* 8 buckets per power of two */
+static
+ULONG
+BenchGetBucket(
+    IN ULONG64 Nanoseconds)
+{
+    ULONG Shift = 0;
+
+    if (Nanoseconds < 8)
+        return (ULONG)Nanoseconds;
+
+    while ((Nanoseconds >> Shift) >= 16)
+        Shift++;
+
+    return (Shift + 1) * 8 + (ULONG)(Nanoseconds >> Shift) - 8;
+}
+
+static
+ULONG64
+BenchGetBucketValue(
+    IN ULONG Bucket)
+{
+    if (Bucket < 8)
+        return Bucket;
+
+    return (ULONG64)(Bucket % 8 + 8) << (Bucket / 8 - 1);
+}
+
+static
+ULONG64
+BenchTicksToNanoseconds(
+    IN PKMT_BENCH_RUN Run,
+    IN LONGLONG Ticks)
+{
+    if (Ticks <= 0)
+        return 0;
+
+    return (ULONG64)Ticks * 1000000000 / Run->Frequency;
+}
+
+static KSTART_ROUTINE BenchThread;
+static
+VOID
+NTAPI
+BenchThread(
+    IN PVOID Context)
+{
+    PKMT_BENCH_THREAD Thread = Context;
+    PKMT_BENCH_RUN Run = Thread->Run;
+    LARGE_INTEGER Start, End, Before, After;
+    ULONG64 Operations = 0;
+    ULONG64 Latency;
+    ULONG Bucket;
+    ULONG i;
+
+    KeSetSystemAffinityThread((KAFFINITY)1 << Thread->Index);
+
+    InterlockedIncrement(&Run->Ready);
+    KeWaitForSingleObject(&Run->StartEvent, Executive, KernelMode, FALSE, NULL);
+
+    Start = KeQueryPerformanceCounter(NULL);
+    while (!Run->Stop)
+    {
+        for (i = 0; i < KMT_BENCH_SAMPLE_INTERVAL - 1; i++)
+            Run->Operation(Run->Context, Thread->Index);
+
+        Before = KeQueryPerformanceCounter(NULL);
+        Run->Operation(Run->Context, Thread->Index);
+        After = KeQueryPerformanceCounter(NULL);
+
+        Latency = BenchTicksToNanoseconds(Run, After.QuadPart - Before.QuadPart - Run->TimerOverhead);
+        Bucket = BenchGetBucket(Latency);
+        Thread->Histogram[min(Bucket, KMT_BENCH_BUCKETS - 1)]++;
+
+        Operations += KMT_BENCH_SAMPLE_INTERVAL;
+    }
+    End = KeQueryPerformanceCounter(NULL);
+
+    KeRevertToUserAffinityThread();
+
+    Thread->Operations = Operations;
+    Thread->ElapsedTicks = End.QuadPart - Start.QuadPart;
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+LONGLONG
+BenchGetTimerOverhead(VOID)
+{
+    LARGE_INTEGER Before, After;
+    LONGLONG Overhead = MAXLONGLONG;
+    ULONG i;
+
+    for (i = 0; i < 1000; i++)
+    {
+        Before = KeQueryPerformanceCounter(NULL);
+        After = KeQueryPerformanceCounter(NULL);
+        Overhead = min(Overhead, After.QuadPart - Before.QuadPart);
+    }
+
+    return Overhead;
+}
+
+static
+ULONG64
+BenchGetPercentile(
+    IN PKMT_BENCH_RUN Run,
+    IN ULONG64 Samples,
+    IN ULONG PerMille)
+{
+    ULONG64 Wanted, Count = 0;
+    ULONG Bucket;
+
+    /* the first sample at or above the percentile */
+    Wanted = (Samples * PerMille + 999) / 1000;
+    if (Wanted == 0)
+        Wanted = 1;
+
+    for (Bucket = 0; Bucket < KMT_BENCH_BUCKETS; Bucket++)
+    {
+        Count += Run->Histogram[Bucket];
+        if (Count >= Wanted)
+            return BenchGetBucketValue(Bucket);
+    }
+
+    return 0;
+}
+
+static
+VOID
+BenchReport(
+    IN PCSTR Name,
+    IN PKMT_BENCH_RUN Run,
+    IN ULONG ThreadCount)
+{
+    ULONG64 Operations = 0, OperationsPerSecond = 0, Samples = 0, Maximum = 0;
+    PKMT_BENCH_THREAD Thread;
+    ULONG i, Bucket;
+
+    RtlZeroMemory(Run->Histogram, sizeof(Run->Histogram));
+
+    for (i = 0; i < ThreadCount; i++)
+    {
+        Thread = &Run->Threads[i];
+        Operations += Thread->Operations;
+        if (Thread->ElapsedTicks > 0)
+            OperationsPerSecond += Thread->Operations * Run->Frequency / Thread->ElapsedTicks;
+
+        for (Bucket = 0; Bucket < KMT_BENCH_BUCKETS; Bucket++)
+        {
+            Run->Histogram[Bucket] += Thread->Histogram[Bucket];
+            Samples += Thread->Histogram[Bucket];
+            if (Thread->Histogram[Bucket])
+                Maximum = max(Maximum, BenchGetBucketValue(Bucket));
+        }
+    }
+
+    if (skip(Samples != 0, "No samples for %s with %lu threads\n", Name, ThreadCount))
+        return;
+
+    trace("bench: name=%s threads=%lu ops=%I64u ops_per_sec=%I64u p50_ns=%I64u p90_ns=%I64u p99_ns=%I64u p999_ns=%I64u max_ns=%I64u\n",
+          Name,
+          ThreadCount,
+          Operations,
+          OperationsPerSecond,
+          BenchGetPercentile(Run, Samples, 500),
+          BenchGetPercentile(Run, Samples, 900),
+          BenchGetPercentile(Run, Samples, 990),
+          BenchGetPercentile(Run, Samples, 999),
+          Maximum);
+}
+
+static
+VOID
+BenchRunThreads(
+    IN PCSTR Name,
+    IN PKMT_BENCH_RUN Run,
+    IN ULONG ThreadCount)
+{
+    LARGE_INTEGER Timeout;
+    ULONG Started, i;
+
+    KeInitializeEvent(&Run->StartEvent, NotificationEvent, FALSE);
+    Run->Ready = 0;
+    Run->Stop = FALSE;
+    RtlZeroMemory(Run->Threads, sizeof(Run->Threads));
+
+    for (Started = 0; Started < ThreadCount; Started++)
+    {
+        Run->Threads[Started].Run = Run;
+        Run->Threads[Started].Index = Started;
+        Run->Threads[Started].Thread = KmtStartThread(BenchThread, &Run->Threads[Started]);
+        if (!Run->Threads[Started].Thread)
+            break;
+    }
+
+    /* start them all at once, once they run on their processors */
+    Timeout.QuadPart = -1 * MILLISECOND;
+    while (Run->Ready < (LONG)Started)
+        KeDelayExecutionThread(KernelMode, FALSE, &Timeout);
+    KeSetEvent(&Run->StartEvent, IO_NO_INCREMENT, FALSE);
+
+    Timeout.QuadPart = -KMT_BENCH_DURATION;
+    KeDelayExecutionThread(KernelMode, FALSE, &Timeout);
+    InterlockedExchange(&Run->Stop, TRUE);
+
+    for (i = 0; i < Started; i++)
+        KmtFinishThread(Run->Threads[i].Thread, NULL);
+
+    if (Started == ThreadCount)
+        BenchReport(Name, Run, ThreadCount);
+}
+
+/**
+ * @name KmtRunBenchmark
+ *
+ * Measure the throughput and latency of an operation, with one to
+ * KeNumberProcessors threads running it at the same time.
+ *
+ * @param Name
+ *        Name of the benchmark, as it appears in the log
+ * @param Operation
+ *        Routine performing a single operation. Called at PASSIVE_LEVEL
+ *        with the context and the index of the calling thread, which is
+ *        below KMT_BENCH_MAX_THREADS
+ * @param Context
+ *        Passed to Operation
+ */
+VOID
+KmtRunBenchmark(
+    IN PCSTR Name,
+    IN PKMT_BENCH_OPERATION Operation,
+    IN PVOID Context OPTIONAL)
+{
+    PKMT_BENCH_RUN Run;
+    LARGE_INTEGER Frequency;
+    KPRIORITY OldPriority;
+    ULONG Processors, ThreadCount;
+
+    PAGED_CODE();
+
+    Run = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Run), TAG_BENCH);
+    if (skip(Run != NULL, "Out of memory\n"))
+        return;
+
+    RtlZeroMemory(Run, sizeof(*Run));
+    Run->Operation = Operation;
+    Run->Context = Context;
+    KeQueryPerformanceCounter(&Frequency);
+    Run->Frequency = Frequency.QuadPart;
+    Run->TimerOverhead = BenchGetTimerOverhead();
+
+    Processors = min((ULONG)KeNumberProcessors, KMT_BENCH_MAX_THREADS);
+
+    /* the workers never yield, make sure we get to stop them */
+    OldPriority = KeSetPriorityThread(KeGetCurrentThread(), HIGH_PRIORITY);
+
+    ThreadCount = 1;
+    for (;;)
+    {
+        BenchRunThreads(Name, Run, ThreadCount);
+        if (ThreadCount == Processors)
+            break;
+        ThreadCount = min(ThreadCount * 2, Processors);
+    }
+
+    KeSetPriorityThread(KeGetCurrentThread(), OldPriority);
+
+    ExFreePoolWithTag(Run, TAG_BENCH);
+}
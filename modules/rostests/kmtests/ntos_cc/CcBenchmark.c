@@ -0,0 +1,121 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     LGPL-2.1+ (https://spdx.org/licenses/LGPL-2.1+)
+ * PURPOSE:     Kernel-Mode Test Suite cached read benchmarks
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define TAG_BENCH 'BcCK'
+
+/* the reads stay within this much of the start of the file */
+#define CACHED_WINDOW       (64 * 1024)
+
+typedef struct _COPY_READ_BENCH
+{
+    PFILE_OBJECT FileObject;
+    ULONG Length;
+    PUCHAR Buffers;
+} COPY_READ_BENCH, *PCOPY_READ_BENCH;
+
+static KMT_BENCH_OPERATION CopyRead;
+static
+VOID
+CopyRead(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    PCOPY_READ_BENCH Bench = Context;
+    PFSRTL_COMMON_FCB_HEADER Header = Bench->FileObject->FsContext;
+    LARGE_INTEGER Offset;
+    IO_STATUS_BLOCK IoStatus;
+
+    /* what the fast I/O read path does around CcCopyRead */
+    Offset.QuadPart = (ThreadIndex * PAGE_SIZE) % CACHED_WINDOW;
+    KeEnterCriticalRegion();
+    if (Header->Resource)
+        ExAcquireResourceSharedLite(Header->Resource, TRUE);
+    IoSetTopLevelIrp((PIRP)FSRTL_FAST_IO_TOP_LEVEL_IRP);
+
+    CcCopyRead(Bench->FileObject,
+               &Offset,
+               Bench->Length,
+               TRUE,
+               Bench->Buffers + ThreadIndex * PAGE_SIZE,
+               &IoStatus);
+
+    IoSetTopLevelIrp(NULL);
+    if (Header->Resource)
+        ExReleaseResourceLite(Header->Resource);
+    KeLeaveCriticalRegion();
+}
+
+START_TEST(CcBenchmark)
+{
+    UNICODE_STRING FileName = RTL_CONSTANT_STRING(L"\\SystemRoot\\system32\\ntoskrnl.exe");
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    COPY_READ_BENCH Bench;
+    HANDLE FileHandle;
+    NTSTATUS Status;
+
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &FileName,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwOpenFile(&FileHandle,
+                        GENERIC_READ | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &IoStatus,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (skip(NT_SUCCESS(Status), "No file to read\n"))
+        return;
+
+    Bench.Buffers = ExAllocatePoolWithTag(NonPagedPool, KMT_BENCH_MAX_THREADS * PAGE_SIZE, TAG_BENCH);
+    if (skip(Bench.Buffers != NULL, "Out of memory\n"))
+    {
+        ZwClose(FileHandle);
+        return;
+    }
+
+    /* a cached read has the file system set up caching and fills the cache */
+    Status = ZwReadFile(FileHandle,
+                        NULL,
+                        NULL,
+                        NULL,
+                        &IoStatus,
+                        Bench.Buffers,
+                        KMT_BENCH_MAX_THREADS * PAGE_SIZE,
+                        NULL,
+                        NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    Status = ObReferenceObjectByHandle(FileHandle,
+                                       FILE_READ_DATA,
+                                       *IoFileObjectType,
+                                       KernelMode,
+                                       (PVOID *)&Bench.FileObject,
+                                       NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!skip(NT_SUCCESS(Status), "No file object\n"))
+    {
+        if (!skip(Bench.FileObject->PrivateCacheMap != NULL &&
+                  Bench.FileObject->FsContext != NULL, "File is not cached\n"))
+        {
+            Bench.Length = 512;
+            KmtRunBenchmark("CcCopyRead/512", CopyRead, &Bench);
+            Bench.Length = PAGE_SIZE;
+            KmtRunBenchmark("CcCopyRead/4096", CopyRead, &Bench);
+        }
+        ObDereferenceObject(Bench.FileObject);
+    }
+
+    ExFreePoolWithTag(Bench.Buffers, TAG_BENCH);
+    ZwClose(FileHandle);
+}
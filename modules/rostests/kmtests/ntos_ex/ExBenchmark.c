@@ -0,0 +1,96 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     LGPL-2.1+ (https://spdx.org/licenses/LGPL-2.1+)
+ * PURPOSE:     Kernel-Mode Test Suite pool and push lock benchmarks
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define TAG_BENCH 'BxEK'
+
+typedef struct _POOL_BENCH
+{
+    POOL_TYPE PoolType;
+    SIZE_T Size;
+} POOL_BENCH, *PPOOL_BENCH;
+
+static KMT_BENCH_OPERATION AllocateFreePool;
+static
+VOID
+AllocateFreePool(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    PPOOL_BENCH Bench = Context;
+    PVOID Memory;
+
+    UNREFERENCED_PARAMETER(ThreadIndex);
+
+    Memory = ExAllocatePoolWithTag(Bench->PoolType, Bench->Size, TAG_BENCH);
+    if (Memory)
+        ExFreePoolWithTag(Memory, TAG_BENCH);
+}
+
+static KMT_BENCH_OPERATION AcquireReleasePushLockExclusive;
+static
+VOID
+AcquireReleasePushLockExclusive(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    PEX_PUSH_LOCK PushLock = Context;
+
+    UNREFERENCED_PARAMETER(ThreadIndex);
+
+    KeEnterCriticalRegion();
+    ExfAcquirePushLockExclusive(PushLock);
+    ExfReleasePushLockExclusive(PushLock);
+    KeLeaveCriticalRegion();
+}
+
+static KMT_BENCH_OPERATION AcquireReleasePushLockShared;
+static
+VOID
+AcquireReleasePushLockShared(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    PEX_PUSH_LOCK PushLock = Context;
+
+    UNREFERENCED_PARAMETER(ThreadIndex);
+
+    KeEnterCriticalRegion();
+    ExfAcquirePushLockShared(PushLock);
+    ExfReleasePushLockShared(PushLock);
+    KeLeaveCriticalRegion();
+}
+
+START_TEST(ExBenchmark)
+{
+    POOL_BENCH PoolBench;
+    PEX_PUSH_LOCK PushLock;
+
+    PoolBench.PoolType = NonPagedPool;
+    PoolBench.Size = 64;
+    KmtRunBenchmark("ExAllocatePoolWithTag/NonPaged/64", AllocateFreePool, &PoolBench);
+    PoolBench.Size = 1024;
+    KmtRunBenchmark("ExAllocatePoolWithTag/NonPaged/1024", AllocateFreePool, &PoolBench);
+    PoolBench.Size = 2 * PAGE_SIZE;
+    KmtRunBenchmark("ExAllocatePoolWithTag/NonPaged/8192", AllocateFreePool, &PoolBench);
+    PoolBench.PoolType = PagedPool;
+    PoolBench.Size = 64;
+    KmtRunBenchmark("ExAllocatePoolWithTag/Paged/64", AllocateFreePool, &PoolBench);
+
+    PushLock = ExAllocatePoolWithTag(NonPagedPool, sizeof(*PushLock), TAG_BENCH);
+    if (skip(PushLock != NULL, "Out of memory\n"))
+        return;
+
+    PushLock->Value = 0;
+    KmtRunBenchmark("ExAcquirePushLockExclusive", AcquireReleasePushLockExclusive, PushLock);
+    KmtRunBenchmark("ExAcquirePushLockShared", AcquireReleasePushLockShared, PushLock);
+
+    ExFreePoolWithTag(PushLock, TAG_BENCH);
+}
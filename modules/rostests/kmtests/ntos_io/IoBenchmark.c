@@ -0,0 +1,52 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     LGPL-2.1+ (https://spdx.org/licenses/LGPL-2.1+)
+ * PURPOSE:     Kernel-Mode Test Suite IRP allocation benchmarks
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+static KMT_BENCH_OPERATION AllocateFreeIrp;
+static
+VOID
+AllocateFreeIrp(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    CCHAR StackSize = (CCHAR)(ULONG_PTR)Context;
+    PIRP Irp;
+
+    UNREFERENCED_PARAMETER(ThreadIndex);
+
+    Irp = IoAllocateIrp(StackSize, FALSE);
+    if (Irp)
+        IoFreeIrp(Irp);
+}
+
+static KMT_BENCH_OPERATION AllocateFreeMdl;
+static
+VOID
+AllocateFreeMdl(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    PMDL Mdl;
+
+    UNREFERENCED_PARAMETER(ThreadIndex);
+
+    Mdl = IoAllocateMdl(Context, PAGE_SIZE, FALSE, FALSE, NULL);
+    if (Mdl)
+        IoFreeMdl(Mdl);
+}
+
+START_TEST(IoBenchmark)
+{
+    /* small IRPs come from the lookaside lists, large ones from pool */
+    KmtRunBenchmark("IoAllocateIrp/1", AllocateFreeIrp, (PVOID)1);
+    KmtRunBenchmark("IoAllocateIrp/8", AllocateFreeIrp, (PVOID)8);
+    KmtRunBenchmark("IoAllocateIrp/16", AllocateFreeIrp, (PVOID)16);
+    KmtRunBenchmark("IoAllocateMdl/4096", AllocateFreeMdl, (PVOID)PAGE_SIZE);
+}
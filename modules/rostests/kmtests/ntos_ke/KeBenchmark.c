@@ -0,0 +1,81 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     LGPL-2.1+ (https://spdx.org/licenses/LGPL-2.1+)
+ * PURPOSE:     Kernel-Mode Test Suite dispatcher object wait benchmarks
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define TAG_BENCH 'BeKK'
+
+typedef struct _WAIT_BENCH
+{
+    KEVENT SharedEvent;
+    KEVENT Events[KMT_BENCH_MAX_THREADS];
+} WAIT_BENCH, *PWAIT_BENCH;
+
+static KMT_BENCH_OPERATION WaitSignaled;
+static
+VOID
+WaitSignaled(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    PWAIT_BENCH Bench = Context;
+
+    KeWaitForSingleObject(&Bench->Events[ThreadIndex], Executive, KernelMode, FALSE, NULL);
+}
+
+static KMT_BENCH_OPERATION WaitSharedSignaled;
+static
+VOID
+WaitSharedSignaled(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    PWAIT_BENCH Bench = Context;
+
+    UNREFERENCED_PARAMETER(ThreadIndex);
+
+    KeWaitForSingleObject(&Bench->SharedEvent, Executive, KernelMode, FALSE, NULL);
+}
+
+static KMT_BENCH_OPERATION SetAndWait;
+static
+VOID
+SetAndWait(
+    IN PVOID Context,
+    IN ULONG ThreadIndex)
+{
+    PWAIT_BENCH Bench = Context;
+
+    KeSetEvent(&Bench->Events[ThreadIndex], IO_NO_INCREMENT, FALSE);
+    KeWaitForSingleObject(&Bench->Events[ThreadIndex], Executive, KernelMode, FALSE, NULL);
+}
+
+START_TEST(KeBenchmark)
+{
+    PWAIT_BENCH Bench;
+    ULONG i;
+
+    Bench = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Bench), TAG_BENCH);
+    if (skip(Bench != NULL, "Out of memory\n"))
+        return;
+
+    /* the wait is satisfied right away, this is the fast path */
+    KeInitializeEvent(&Bench->SharedEvent, NotificationEvent, TRUE);
+    for (i = 0; i < KMT_BENCH_MAX_THREADS; i++)
+        KeInitializeEvent(&Bench->Events[i], NotificationEvent, TRUE);
+    KmtRunBenchmark("KeWaitForSingleObject/Signaled", WaitSignaled, Bench);
+    KmtRunBenchmark("KeWaitForSingleObject/SharedSignaled", WaitSharedSignaled, Bench);
+
+    /* the wait resets the event */
+    for (i = 0; i < KMT_BENCH_MAX_THREADS; i++)
+        KeInitializeEvent(&Bench->Events[i], SynchronizationEvent, FALSE);
+    KmtRunBenchmark("KeSetEvent+KeWaitForSingleObject/Synchronization", SetAndWait, Bench);
+
+    ExFreePoolWithTag(Bench, TAG_BENCH);
+}
@@ -20,7 +20,8 @@ CConfiguration::CConfiguration()
       m_IsInteractive(false),
       m_PrintToConsole(true),
       m_Shutdown(false),
-      m_Submit(false)
+      m_Submit(false),
+      m_Workers(1)
 {
     WCHAR WindowsDirectory[MAX_PATH];
     WCHAR Interactive[32];
@@ -63,6 +64,16 @@ CConfiguration::ParseParameters(int argc, wchar_t* argv[])
                     m_PrintToConsole = false;
                     break;
 
+                case 'p':
+                    ++i;
+                    if(i == argc)
+                        throw CInvalidParameterException();
+
+                    m_Workers = _wtoi(argv[i]);
+                    if(m_Workers < 1 || m_Workers > MAXIMUM_WAIT_OBJECTS)
+                        throw CInvalidParameterException();
+                    break;
+
                 case 'r':
                     m_CrashRecovery = true;
                     break;
@@ -178,14 +189,15 @@ CConfiguration::GetConfigurationFromFile()
     string Value;
     WCHAR ConfigFile[MAX_PATH];
 
+    /* Build the path to the configuration file from the application's path */
+    GetModuleFileNameW(NULL, ConfigFile, MAX_PATH);
+    Length = wcsrchr(ConfigFile, '\\') - ConfigFile + 1;
+    wcscpy(&ConfigFile[Length], CONFIGURATION_FILENAMEW);
+    m_ConfigFile = ConfigFile;
+
     /* Most values are only needed if we're going to submit anything */
     if(m_Submit)
     {
-        /* Build the path to the configuration file from the application's path */
-        GetModuleFileNameW(NULL, ConfigFile, MAX_PATH);
-        Length = wcsrchr(ConfigFile, '\\') - ConfigFile + 1;
-        wcscpy(&ConfigFile[Length], CONFIGURATION_FILENAMEW);
-
         /* Check if it exists */
         if(GetFileAttributesW(ConfigFile) == INVALID_FILE_ATTRIBUTES)
             EXCEPTION("Missing \"" CONFIGURATION_FILENAMEA "\" configuration file!\n");
@@ -213,3 +225,39 @@ CConfiguration::GetConfigurationFromFile()
             m_Comment = GetINIValue(L"Submission", L"Comment", ConfigFile);
     }
 }
+
+/**
+ * Gets the isolation group of a test. Tests of the same group are never run at the same time,
+ * a test of the "exclusive" group is never run together with any other test.
+ *
+ * The group is taken from the "Isolation" section of the configuration file, which may list
+ * "module:test" or "module" keys. By default, all tests of a module form a group, as they
+ * often share files and registry keys.
+ *
+ * @param Module
+ * The module of the test (i.e. "advapi32")
+ *
+ * @param Test
+ * The name of the test
+ *
+ * @return
+ * The name of the isolation group as std::string.
+ */
+string
+CConfiguration::GetIsolationGroup(const string& Module, const string& Test) const
+{
+    string Group;
+
+    if(GetFileAttributesW(m_ConfigFile.c_str()) != INVALID_FILE_ATTRIBUTES)
+    {
+        Group = GetINIValue(L"Isolation", AsciiToUnicode(Module + ":" + Test).c_str(), m_ConfigFile.c_str());
+
+        if(Group.empty())
+            Group = GetINIValue(L"Isolation", AsciiToUnicode(Module).c_str(), m_ConfigFile.c_str());
+    }
+
+    if(Group.empty())
+        Group = Module;
+
+    return Group;
+}
@@ -14,7 +14,9 @@ private:
     bool m_PrintToConsole;
     bool m_Shutdown;
     bool m_Submit;
+    unsigned int m_Workers;
     string m_Comment;
+    wstring m_ConfigFile;
     wstring m_Module;
     string m_Test;
 
@@ -36,6 +38,8 @@ public:
     const string& GetComment() const { return m_Comment; }
     const wstring& GetModule() const { return m_Module; }
     const string& GetTest() const { return m_Test; }
+    unsigned int GetWorkerCount() const { return m_Workers; }
+    string GetIsolationGroup(const string& Module, const string& Test) const;
 
     const string& GetAuthenticationRequestString() const { return m_AuthenticationRequestString; }
     const string& GetSystemInfoRequestString() const { return m_SystemInfoRequestString; }
@@ -6,8 +6,9 @@
  */
 
 #include "precomp.h"
+#include <algorithm>
 
-static const char szJournalHeader[] = "RAT_J-V1";
+static const char szJournalHeader[] = "RAT_J-V2";
 static const WCHAR szJournalFileName[] = L"rosautotest.journal";
 
 /**
@@ -22,6 +23,7 @@ CJournaledTestList::CJournaledTestList(CTest* Test)
     WCHAR JournalFile[MAX_PATH];
 
     m_hJournal = INVALID_HANDLE_VALUE;
+    m_RunningTests = 0;
 
     /* Build the path to the journal file */
     if(SHGetFolderPathW(NULL, CSIDL_APPDATA, NULL, SHGFP_TYPE_CURRENT, JournalFile) != S_OK)
@@ -153,6 +155,7 @@ CJournaledTestList::WriteInitialJournalFile()
     char TerminatingNull = 0;
     CTestInfo* TestInfo;
     DWORD BytesWritten;
+    DWORD Offset;
 
     StringOut("Writing initial journal file...\n\n");
 
@@ -170,12 +173,23 @@ CJournaledTestList::WriteInitialJournalFile()
 
     WriteFile(m_hJournal, szJournalHeader, sizeof(szJournalHeader), &BytesWritten, NULL);
     WriteFile(m_hJournal, &m_ListIterator, sizeof(m_ListIterator), &BytesWritten, NULL);
+    Offset = sizeof(szJournalHeader) + sizeof(m_ListIterator);
 
     for(size_t i = 0; i < m_List.size(); i++)
     {
         SerializeIntoJournal(m_List[i].CommandLine);
         SerializeIntoJournal(m_List[i].Module);
         SerializeIntoJournal(m_List[i].Test);
+        Offset += (m_List[i].CommandLine.size() + 1) * sizeof(WCHAR);
+        Offset += m_List[i].Module.size() + 1;
+        Offset += m_List[i].Test.size() + 1;
+
+        /* The run times follow, they are filled in when the test has finished */
+        m_List[i].JournalIndex = i;
+        m_TimeOffsets.push_back(Offset);
+        WriteFile(m_hJournal, &m_List[i].WallTime, sizeof(m_List[i].WallTime), &BytesWritten, NULL);
+        WriteFile(m_hJournal, &m_List[i].CpuTime, sizeof(m_List[i].CpuTime), &BytesWritten, NULL);
+        Offset += sizeof(m_List[i].WallTime) + sizeof(m_List[i].CpuTime);
     }
 
     WriteFile(m_hJournal, &TerminatingNull, sizeof(TerminatingNull), &BytesWritten, NULL);
@@ -239,6 +253,13 @@ CJournaledTestList::LoadJournalFile()
         UnserializeFromBuffer(&pBuffer, TestInfo.Module);
         UnserializeFromBuffer(&pBuffer, TestInfo.Test);
 
+        m_TimeOffsets.push_back(sizeof(szJournalHeader) + sizeof(m_ListIterator) + (pBuffer - Buffer));
+        memcpy(&TestInfo.WallTime, pBuffer, sizeof(TestInfo.WallTime));
+        pBuffer += sizeof(TestInfo.WallTime);
+        memcpy(&TestInfo.CpuTime, pBuffer, sizeof(TestInfo.CpuTime));
+        pBuffer += sizeof(TestInfo.CpuTime);
+
+        TestInfo.JournalIndex = m_List.size();
         m_List.push_back(TestInfo);
     }
 
@@ -265,6 +286,102 @@ CJournaledTestList::UpdateJournal()
     m_hJournal = NULL;
 }
 
+/**
+ * Writes the run times of a test into the journal.
+ *
+ * @param Index
+ * The index of the test in m_List
+ */
+void
+CJournaledTestList::UpdateJournalTimes(size_t Index)
+{
+    DWORD BytesWritten;
+
+    OpenJournal(GENERIC_WRITE);
+
+    SetFilePointer(m_hJournal, m_TimeOffsets[Index], NULL, FILE_BEGIN);
+    WriteFile(m_hJournal, &m_List[Index].WallTime, sizeof(m_List[Index].WallTime), &BytesWritten, NULL);
+    WriteFile(m_hJournal, &m_List[Index].CpuTime, sizeof(m_List[Index].CpuTime), &BytesWritten, NULL);
+    FlushFileBuffers(m_hJournal);
+
+    CloseHandle(m_hJournal);
+    m_hJournal = INVALID_HANDLE_VALUE;
+}
+
+static bool
+IsSlowerTest(const CTestInfo* A, const CTestInfo* B)
+{
+    return A->WallTime > B->WallTime;
+}
+
+/**
+ * Prints the slowest tests of the whole run, including the ones run before a crash.
+ */
+void
+CJournaledTestList::PrintSlowestTests()
+{
+    vector<const CTestInfo*> Finished;
+    stringstream ss;
+
+    for(size_t i = 0; i < m_List.size(); i++)
+    {
+        if(m_List[i].WallTime != (DWORD)-1)
+            Finished.push_back(&m_List[i]);
+    }
+
+    if(Finished.empty())
+        return;
+
+    sort(Finished.begin(), Finished.end(), IsSlowerTest);
+    if(Finished.size() > 10)
+        Finished.resize(10);
+
+    ss << "Slowest tests:" << endl;
+    for(size_t i = 0; i < Finished.size(); i++)
+    {
+        ss << "    " << Finished[i]->Module << ':' << Finished[i]->Test << ' ';
+        ss << setprecision(2) << fixed << (float)Finished[i]->WallTime / 1000 << " seconds, ";
+        ss << setprecision(2) << fixed << (float)Finished[i]->CpuTime / 1000 << " seconds CPU" << endl;
+    }
+    ss << endl;
+
+    StringOut(ss.str());
+}
+
+/**
+ * Interface to other classes for storing the run times of a finished test in the journal.
+ *
+ * @param TestInfo
+ * Pointer to a CTestInfo object returned by GetNextTestInfo, containing the run times.
+ */
+void
+CJournaledTestList::TestFinished(CTestInfo* TestInfo)
+{
+    size_t Index = TestInfo->JournalIndex;
+
+    if(Index >= m_List.size())
+        FATAL("Finished test is not in the journal\n");
+
+    m_List[Index].WallTime = TestInfo->WallTime;
+    m_List[Index].CpuTime = TestInfo->CpuTime;
+    UpdateJournalTimes(Index);
+
+    /* With parallel workers, the last tests finish after the end of the list was reached */
+    --m_RunningTests;
+    if(m_ListIterator >= m_List.size() && !m_RunningTests)
+        DeleteJournal();
+}
+
+/**
+ * Reports the run times and deletes the journal, once all tests have finished.
+ */
+void
+CJournaledTestList::DeleteJournal()
+{
+    PrintSlowestTests();
+    DeleteFileW(m_JournalFile.c_str());
+}
+
 /**
  * Interface to other classes for receiving information about the next test to be run.
  *
@@ -284,10 +401,12 @@ CJournaledTestList::GetNextTestInfo()
     ++m_ListIterator;
 
     /* Check whether the iterator would already exceed the number of stored elements */
-    if(m_ListIterator == m_List.size())
+    if(m_ListIterator >= m_List.size())
     {
-        /* Delete the journal and return no pointer */
-        DeleteFileW(m_JournalFile.c_str());
+        /* Delete the journal, unless tests are still running, and return no pointer */
+        m_ListIterator = m_List.size();
+        if(!m_RunningTests)
+            DeleteJournal();
 
         TestInfo = NULL;
     }
@@ -297,6 +416,7 @@ CJournaledTestList::GetNextTestInfo()
         UpdateJournal();
 
         TestInfo = new CTestInfo(m_List[m_ListIterator]);
+        ++m_RunningTests;
     }
 
     return TestInfo;
@@ -10,7 +10,9 @@ class CJournaledTestList : public CTestList
 private:
     HANDLE m_hJournal;
     size_t m_ListIterator;
+    size_t m_RunningTests;
     vector<CTestInfo> m_List;
+    vector<DWORD> m_TimeOffsets;
     wstring m_JournalFile;
 
     void LoadJournalFile();
@@ -20,6 +22,9 @@ private:
     void UnserializeFromBuffer(char** Buffer, string& Output);
     void UnserializeFromBuffer(char** Buffer, wstring& Output);
     void UpdateJournal();
+    void UpdateJournalTimes(size_t Index);
+    void PrintSlowestTests();
+    void DeleteJournal();
     void WriteInitialJournalFile();
 
 public:
@@ -27,4 +32,5 @@ public:
     ~CJournaledTestList();
 
     CTestInfo* GetNextTestInfo();
+    void TestFinished(CTestInfo* TestInfo);
 };
@@ -34,3 +34,27 @@ CProcess::~CProcess()
     CloseHandle(m_ProcessInfo.hThread);
     CloseHandle(m_ProcessInfo.hProcess);
 }
+
+/**
+ * Gets the processor time used by the process so far.
+ *
+ * @return
+ * The time spent in user and kernel mode in milliseconds.
+ */
+DWORD
+CProcess::GetCpuTime() const
+{
+    FILETIME CreationTime, ExitTime, KernelTime, UserTime;
+    ULARGE_INTEGER Kernel, User;
+
+    if(!GetProcessTimes(m_ProcessInfo.hProcess, &CreationTime, &ExitTime, &KernelTime, &UserTime))
+        return 0;
+
+    Kernel.LowPart = KernelTime.dwLowDateTime;
+    Kernel.HighPart = KernelTime.dwHighDateTime;
+    User.LowPart = UserTime.dwLowDateTime;
+    User.HighPart = UserTime.dwHighDateTime;
+
+    /* The times are in 100 ns units */
+    return (DWORD)((Kernel.QuadPart + User.QuadPart) / 10000);
+}
@@ -15,4 +15,5 @@ public:
     ~CProcess();
 
     HANDLE GetProcessHandle() const { return m_ProcessInfo.hProcess; }
+    DWORD GetCpuTime() const;
 };
@@ -12,4 +12,13 @@ public:
     string Module;
     string Test;
     string Log;
+
+    /* In milliseconds, (DWORD)-1 if the test has not been run */
+    DWORD WallTime;
+    DWORD CpuTime;
+
+    /* Position in the journal, if the test comes from a CJournaledTestList */
+    size_t JournalIndex;
+
+    CTestInfo() : WallTime((DWORD)-1), CpuTime((DWORD)-1), JournalIndex((size_t)-1) {}
 };
@@ -17,3 +17,14 @@ CTestList::CTestList(CTest* Test) :
     m_Test(Test)
 {
 }
+
+/**
+ * Called after a test from this list was run. Does nothing by default.
+ *
+ * @param TestInfo
+ * Pointer to a CTestInfo object containing information about the test, including its run time.
+ */
+void
+CTestList::TestFinished(CTestInfo* TestInfo)
+{
+}
@@ -13,5 +13,8 @@ protected:
     CTestList(CTest* Test);
 
 public:
+    virtual ~CTestList() {}
+
     virtual CTestInfo* GetNextTestInfo() = 0;
+    virtual void TestFinished(CTestInfo* TestInfo);
 };
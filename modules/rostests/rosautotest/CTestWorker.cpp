@@ -0,0 +1,85 @@
+/*
+ * PROJECT:     ReactOS Automatic Testing Utility
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Class running a test in the background and collecting its output
+ */
+
+#include "precomp.h"
+
+/**
+ * Constructs a CTestWorker object and starts the test process.
+ * A thread collects the output of the test, so that several tests can run at the same time.
+ *
+ * @param TestInfo
+ * Pointer to a CTestInfo object containing information about the test.
+ * Needs to stay valid until the CTestWorker object is destructed.
+ */
+CTestWorker::CTestWorker(CTestInfo* TestInfo)
+    : m_TestInfo(TestInfo), m_hThread(NULL), m_ReadFailed(false)
+{
+    m_StartTime = GetTickCount();
+    m_Process.reset(new CPipedProcess(TestInfo->CommandLine, m_Pipe));
+
+    m_hThread = CreateThread(NULL, 0, ReadThread, this, 0, NULL);
+    if(!m_hThread)
+        FATAL("CreateThread failed\n");
+}
+
+/**
+ * Destructs a CTestWorker object. The test process must have ended.
+ */
+CTestWorker::~CTestWorker()
+{
+    if(m_hThread)
+    {
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+    }
+}
+
+/**
+ * Receives all the output of the test and waits for the test process to end.
+ *
+ * @param Parameter
+ * Pointer to the CTestWorker object
+ */
+DWORD WINAPI
+CTestWorker::ReadThread(LPVOID Parameter)
+{
+    CTestWorker* Worker = (CTestWorker*)Parameter;
+    DWORD BytesAvailable;
+    char Buffer[1024];
+
+    while(Worker->m_Pipe.Read(Buffer, sizeof(Buffer), &BytesAvailable) && BytesAvailable)
+        Worker->m_Output.append(Buffer, BytesAvailable);
+
+    if(GetLastError() != ERROR_BROKEN_PIPE)
+        Worker->m_ReadFailed = true;
+
+    WaitForSingleObject(Worker->m_Process->GetProcessHandle(), INFINITE);
+    return 0;
+}
+
+/**
+ * Collects the results once the wait handle is signaled.
+ * Stores the run times and, if the user wants to submit data, the test log in the CTestInfo object.
+ *
+ * @return
+ * The output of the test as std::string.
+ */
+string
+CTestWorker::Finish()
+{
+    WaitForSingleObject(m_hThread, INFINITE);
+
+    m_TestInfo->WallTime = GetTickCount() - m_StartTime;
+    m_TestInfo->CpuTime = m_Process->GetCpuTime();
+
+    if(m_ReadFailed)
+        m_Output += "CPipe::Read failed for the test run\n";
+
+    if(Configuration.DoSubmit())
+        m_TestInfo->Log += m_Output;
+
+    return m_Output;
+}
@@ -0,0 +1,27 @@
+/*
+ * PROJECT:     ReactOS Automatic Testing Utility
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Class running a test in the background and collecting its output
+ */
+
+class CTestWorker
+{
+private:
+    CTestInfo* m_TestInfo;
+    CPipe m_Pipe;
+    auto_ptr<CPipedProcess> m_Process;
+    HANDLE m_hThread;
+    DWORD m_StartTime;
+    string m_Output;
+    bool m_ReadFailed;
+
+    static DWORD WINAPI ReadThread(LPVOID Parameter);
+
+public:
+    CTestWorker(CTestInfo* TestInfo);
+    ~CTestWorker();
+
+    HANDLE GetWaitHandle() const { return m_hThread; }
+    CTestInfo* GetTestInfo() const { return m_TestInfo; }
+    string Finish();
+};
@@ -218,7 +218,7 @@ CWebService::Submit(const char* TestType, CTestInfo* TestInfo)
     auto_array_ptr<char> Response;
     auto_array_ptr<char> SuiteID;
     string Data;
-    stringstream ss;
+    stringstream ss, Times;
 
     if(!m_TestID)
         GetTestID(TestType);
@@ -236,6 +236,10 @@ CWebService::Submit(const char* TestType, CTestInfo* TestInfo)
     Data += "&log=";
     Data += EscapeString(TestInfo->Log);
 
+    /* Run times in milliseconds, to spot slow tests and performance regressions */
+    Times << "&walltime=" << TestInfo->WallTime << "&cputime=" << TestInfo->CpuTime;
+    Data += Times.str();
+
     Response.reset(DoRequest(Data));
 
     if (strcmp(Response, "OK"))
@@ -8,6 +8,7 @@
 #include "precomp.h"
 
 static const DWORD ListTimeout = 10000;
+static const char szExclusiveGroup[] = "exclusive";
 
 /**
  * Constructs a CWineTest object.
@@ -289,6 +290,7 @@ CWineTest::RunTest(CTestInfo* TestInfo)
     {
         /* Execute the test */
         CPipedProcess Process(TestInfo->CommandLine, Pipe);
+        bool ReadFailed;
 
         /* Receive all the data from the pipe */
         while(Pipe.Read(Buffer, sizeof(Buffer) - 1, &BytesAvailable) && BytesAvailable)
@@ -300,11 +302,20 @@ CWineTest::RunTest(CTestInfo* TestInfo)
             if(Configuration.DoSubmit())
                 TestInfo->Log += Buffer;
         }
-        if(GetLastError() != ERROR_BROKEN_PIPE)
+        ReadFailed = (GetLastError() != ERROR_BROKEN_PIPE);
+
+        /* The output ends before the process does */
+        WaitForSingleObject(Process.GetProcessHandle(), INFINITE);
+        TestInfo->CpuTime = Process.GetCpuTime();
+
+        if(ReadFailed)
             TESTEXCEPTION("CPipe::Read failed for the test run\n");
     }
     catch(CTestException& e)
     {
+        if(TestInfo->CpuTime == (DWORD)-1)
+            TestInfo->CpuTime = 0;
+
         if(!tailString.empty())
             StringOut(tailString);
         tailString.clear();
@@ -316,13 +327,152 @@ CWineTest::RunTest(CTestInfo* TestInfo)
     if(!tailString.empty())
         StringOut(tailString);
 
-    TotalTime = ((float)GetTickCount() - StartTime)/1000;
+    TestInfo->WallTime = GetTickCount() - StartTime;
+    TotalTime = (float)TestInfo->WallTime / 1000;
     ssFinish << "Test " << TestInfo->Test << " completed in ";
     ssFinish << setprecision(2) << fixed << TotalTime << " seconds." << endl;
     StringOut(ssFinish.str());
     TestInfo->Log += ssFinish.str();
 }
 
+/**
+ * Checks whether a test may be started while other tests are running.
+ *
+ * @param TestInfo
+ * Pointer to a CTestInfo object containing information about the test to be started.
+ *
+ * @param Workers
+ * The workers running the other tests.
+ *
+ * @return
+ * true if the test does not share an isolation group with any running test, otherwise false.
+ */
+bool
+CWineTest::CanStartTest(CTestInfo* TestInfo, const vector<CTestWorker*>& Workers)
+{
+    string Group = Configuration.GetIsolationGroup(TestInfo->Module, TestInfo->Test);
+
+    if(Workers.empty())
+        return true;
+
+    if(Group == szExclusiveGroup)
+        return false;
+
+    for(size_t i = 0; i < Workers.size(); i++)
+    {
+        CTestInfo* Running = Workers[i]->GetTestInfo();
+        string RunningGroup = Configuration.GetIsolationGroup(Running->Module, Running->Test);
+
+        if(RunningGroup == Group || RunningGroup == szExclusiveGroup)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Passes a finished test to the test list and submits its results if required.
+ *
+ * @param TestInfo
+ * Pointer to a CTestInfo object containing information about the test, including its run times.
+ */
+void
+CWineTest::FinishTest(CTestInfo* TestInfo, CTestList* TestList, CWebService* WebService)
+{
+    TestList->TestFinished(TestInfo);
+
+    if(Configuration.DoSubmit() && !TestInfo->Log.empty())
+        WebService->Submit("wine", TestInfo);
+
+    StringOut("\n\n");
+}
+
+/**
+ * Runs the tests in several worker processes at the same time.
+ * The output of a test is printed as a whole once the test has finished, so that the output
+ * of different tests does not mix. Tests are started in the order of the test list, a test
+ * waits for the running tests of its isolation group to finish.
+ */
+void
+CWineTest::RunParallel(CTestList* TestList, CWebService* WebService)
+{
+    HANDLE WaitHandles[MAXIMUM_WAIT_OBJECTS];
+    vector<CTestWorker*> Workers;
+    auto_ptr<CTestInfo> PendingTest;
+    bool ListFinished = false;
+
+    for(;;)
+    {
+        /* Start tests as long as there are free workers */
+        while(!ListFinished && Workers.size() < Configuration.GetWorkerCount())
+        {
+            if(!PendingTest.get())
+            {
+                PendingTest.reset(TestList->GetNextTestInfo());
+                if(!PendingTest.get())
+                {
+                    ListFinished = true;
+                    break;
+                }
+            }
+
+            if(!CanStartTest(PendingTest.get(), Workers))
+                break;
+
+            try
+            {
+                Workers.push_back(new CTestWorker(PendingTest.get()));
+                PendingTest.release();
+            }
+            catch(CTestException& e)
+            {
+                stringstream ss;
+
+                ss << "Running Wine Test, Module: " << PendingTest->Module << ", Test: " << PendingTest->Test << endl;
+                ss << e.GetMessage();
+                StringOut(ss.str());
+
+                PendingTest->WallTime = 0;
+                PendingTest->CpuTime = 0;
+                PendingTest->Log += e.GetMessage();
+                FinishTest(PendingTest.get(), TestList, WebService);
+                PendingTest.reset();
+            }
+        }
+
+        if(Workers.empty())
+            break;
+
+        /* Wait for any of the tests to finish */
+        for(size_t i = 0; i < Workers.size(); i++)
+            WaitHandles[i] = Workers[i]->GetWaitHandle();
+
+        DWORD WaitResult = WaitForMultipleObjects((DWORD)Workers.size(), WaitHandles, FALSE, INFINITE);
+        if(WaitResult >= WAIT_OBJECT_0 + Workers.size())
+            FATAL("WaitForMultipleObjects failed\n");
+
+        CTestWorker* Worker = Workers[WaitResult - WAIT_OBJECT_0];
+        Workers.erase(Workers.begin() + (WaitResult - WAIT_OBJECT_0));
+
+        {
+            auto_ptr<CTestWorker> WorkerPtr(Worker);
+            auto_ptr<CTestInfo> TestInfoPtr(Worker->GetTestInfo());
+            stringstream ss, ssFinish;
+
+            ss << "Running Wine Test, Module: " << TestInfoPtr->Module << ", Test: " << TestInfoPtr->Test << endl;
+            ss << Worker->Finish();
+            StringOut(ss.str());
+
+            ssFinish << "Test " << TestInfoPtr->Test << " completed in ";
+            ssFinish << setprecision(2) << fixed << (float)TestInfoPtr->WallTime / 1000 << " seconds." << endl;
+            StringOut(ssFinish.str());
+            TestInfoPtr->Log += ssFinish.str();
+
+            FinishTest(TestInfoPtr.get(), TestList, WebService);
+        }
+    }
+}
+
 /**
  * Interface to other classes for running all desired Wine tests.
  */
@@ -359,17 +509,20 @@ CWineTest::Run()
     if(!Configuration.IsInteractive())
         ErrorMode = SetErrorMode(SEM_FAILCRITICALERRORS | SEM_NOGPFAULTERRORBOX);
 
-    /* Get information for each test to run */
-    while((TestInfo = TestList->GetNextTestInfo()) != 0)
+    if(Configuration.GetWorkerCount() > 1)
     {
-        auto_ptr<CTestInfo> TestInfoPtr(TestInfo);
-
-        RunTest(TestInfo);
-
-        if(Configuration.DoSubmit() && !TestInfo->Log.empty())
-            WebService->Submit("wine", TestInfo);
+        RunParallel(TestList.get(), WebService.get());
+    }
+    else
+    {
+        /* Get information for each test to run */
+        while((TestInfo = TestList->GetNextTestInfo()) != 0)
+        {
+            auto_ptr<CTestInfo> TestInfoPtr(TestInfo);
 
-        StringOut("\n\n");
+            RunTest(TestInfo);
+            FinishTest(TestInfo, TestList.get(), WebService.get());
+        }
     }
 
     /* We're done with all tests. Finish this run */
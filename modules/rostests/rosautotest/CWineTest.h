@@ -20,6 +20,9 @@ private:
     CTestInfo* GetNextTestInfo();
     DWORD DoListCommand();
     void RunTest(CTestInfo* TestInfo);
+    void RunParallel(CTestList* TestList, CWebService* WebService);
+    bool CanStartTest(CTestInfo* TestInfo, const vector<CTestWorker*>& Workers);
+    void FinishTest(CTestInfo* TestInfo, CTestList* TestList, CWebService* WebService);
 
 public:
     CWineTest();
@@ -24,6 +24,11 @@ IntPrintUsage()
          << "                   Skips the comment set in the configuration file (if any)." << endl
          << "                   Only has an effect when /w is also used." << endl
          << "    /n           - Do not print test output to console" << endl
+         << "    /p <count>   - Run the tests in <count> parallel worker processes." << endl
+         << "                   Tests of the same module, or of the same group in the" << endl
+         << "                   \"Isolation\" section of \"rosautotest.ini\", never run" << endl
+         << "                   at the same time. Tests in the \"exclusive\" group" << endl
+         << "                   always run alone." << endl
          << "    /r           - Maintain information to resume from ReactOS crashes" << endl
          << "                   Can only be run under ReactOS and relies on sysreg2," << endl
          << "                   so incompatible with /w" << endl
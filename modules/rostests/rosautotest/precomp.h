@@ -45,6 +45,7 @@ using namespace std;
 #include "CTestInfo.h"
 #include "CTest.h"
 #include "CTestList.h"
+#include "CTestWorker.h"
 #include "CJournaledTestList.h"
 #include "CVirtualTestList.h"
 #include "CWebService.h"
@@ -14,14 +14,45 @@
 #define NDEBUG
 #include <debug.h>
 
-BOOLEAN CcPfEnablePrefetcher;
+ULONG CcPfEnablePrefetcher;
 PFSN_PREFETCHER_GLOBALS CcPfGlobals;
 MM_SYSTEMSIZE CcCapturedSystemSize;
 
 static ULONG BugCheckFileId = 0x4 << 16;
 
+CC_PERFORMANCE_COUNTERS CcPerformanceCounters[MAXIMUM_PROCESSORS];
+
+/* Read ahead window bounds for sequential streams */
+#define CC_READ_AHEAD_MIN_WINDOW        (64 * 1024)
+#define CC_READ_AHEAD_MAX_WINDOW        (4 * VACB_MAPPING_GRANULARITY)
+
+/* How many read ahead work items may be queued for a file at once */
+#define CC_MAX_READ_AHEADS_IN_FLIGHT    4
+
 /* FUNCTIONS *****************************************************************/
 
+VOID
+NTAPI
+CcQueryPerformanceCounters(
+    OUT PCC_PERFORMANCE_COUNTERS Counters)
+{
+    PULONG Total, Cpu;
+    ULONG i, j;
+
+    RtlZeroMemory(Counters, sizeof(*Counters));
+    Total = (PULONG)Counters;
+
+    /* All the counters are ULONGs, just sum them up, leaving the padding */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Cpu = (PULONG)&CcPerformanceCounters[i];
+        for (j = 0; j < RTL_SIZEOF_THROUGH_FIELD(CC_PERFORMANCE_COUNTERS, ThrottledWrites) / sizeof(ULONG); j++)
+        {
+            Total[j] += Cpu[j];
+        }
+    }
+}
+
 VOID
 NTAPI
 INIT_FUNCTION
@@ -34,10 +65,9 @@ CcPfInitializePrefetcher(VOID)
 
     /* Setup the Prefetcher Data */
     InitializeListHead(&CcPfGlobals.ActiveTraces);
+    KeInitializeSpinLock(&CcPfGlobals.ActiveTracesLock);
     InitializeListHead(&CcPfGlobals.CompletedTraces);
     ExInitializeFastMutex(&CcPfGlobals.CompletedTracesLock);
-
-    /* FIXME: Setup the rest of the prefetecher */
 }
 
 BOOLEAN
@@ -150,8 +180,69 @@ CcRemapBcb (
     return 0;
 }
 
+/* The caller accounted for it in ReadAheadsInFlight */
+static
+BOOLEAN
+CcQueueReadAhead (
+    IN PFILE_OBJECT FileObject,
+    IN LONGLONG FileOffset,
+    IN ULONG Length)
+{
+    PWORK_QUEUE_ENTRY WorkItem;
+
+    /* Get a work item */
+    WorkItem = ExAllocateFromNPagedLookasideList(&CcTwilightLookasideList);
+    if (WorkItem == NULL)
+    {
+        return FALSE;
+    }
+
+    /* Reference our FO so that it doesn't go in between */
+    ObReferenceObject(FileObject);
+
+    /* We want to do read ahead! */
+    WorkItem->Function = ReadAhead;
+    WorkItem->Parameters.Read.FileObject = FileObject;
+    WorkItem->Parameters.Read.FileOffset.QuadPart = FileOffset;
+    WorkItem->Parameters.Read.Length = Length;
+
+    /* Queue in the read ahead dedicated queue */
+    CcPostWorkQueue(WorkItem, &CcExpressWorkQueue);
+
+    return TRUE;
+}
+
 /*
- * @unimplemented
+ * Called when a read that can't wait found its data missing: bring that data
+ * in behind the caller, so that it is there when the request is retried.
+ * This isn't part of the read history, the retry will be.
+ */
+VOID
+CcScheduleReadAheadForMiss (
+    IN PFILE_OBJECT FileObject,
+    IN LONGLONG FileOffset,
+    IN ULONG Length)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    if (SharedCacheMap == NULL || FileObject->PrivateCacheMap == NULL ||
+        BooleanFlagOn(SharedCacheMap->Flags, READAHEAD_DISABLED) ||
+        FileOffset >= SharedCacheMap->FileSize.QuadPart)
+    {
+        return;
+    }
+
+    if (InterlockedIncrement(&SharedCacheMap->ReadAheadsInFlight) > CC_MAX_READ_AHEADS_IN_FLIGHT ||
+        !CcQueueReadAhead(FileObject, FileOffset, Length))
+    {
+        InterlockedDecrement(&SharedCacheMap->ReadAheadsInFlight);
+    }
+}
+
+/*
+ * @implemented
  */
 VOID
 NTAPI
@@ -162,7 +253,8 @@ CcScheduleReadAhead (
 	)
 {
     KIRQL OldIrql;
-    LARGE_INTEGER NewOffset;
+    ULONG ReadLength, Window;
+    LONGLONG ReadEnd, Stride, Start, End;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
     PPRIVATE_CACHE_MAP PrivateCacheMap;
 
@@ -177,82 +269,103 @@ CcScheduleReadAhead (
     }
 
     /* Round read length with read ahead mask */
+    ReadLength = Length;
     Length = ROUND_UP(Length, PrivateCacheMap->ReadAheadMask + 1);
     /* Compute the offset we'll reach */
-    NewOffset.QuadPart = FileOffset->QuadPart + Length;
+    ReadEnd = FileOffset->QuadPart + Length;
 
     /* Lock read ahead spin lock */
     KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
-    /* Easy case: the file is sequentially read */
-    if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+
+    /*
+     * The read history of the handle is in FileOffset1/BeyondLastByte1 (the
+     * one before last) and FileOffset2/BeyondLastByte2 (the last read).
+     * ReadAheadOffset[0] is where what we already scheduled for this handle
+     * ends, and ReadAheadLength[0] is the current sequential window.
+     * ReadAheadOffset[1] and ReadAheadLength[1] are the last region queued.
+     */
+    Stride = PrivateCacheMap->FileOffset2.QuadPart - PrivateCacheMap->FileOffset1.QuadPart;
+
+    /* Sequential access: the read starts where the previous one ended */
+    if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY) ||
+        (FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart &&
+         FileOffset->QuadPart <= PrivateCacheMap->BeyondLastByte2.QuadPart + PrivateCacheMap->ReadAheadMask))
     {
-        /* If we went backward, this is no go! */
-        if (NewOffset.QuadPart < PrivateCacheMap->ReadAheadOffset[1].QuadPart)
+        /* The caller told us it'll read the whole file: go for the max */
+        if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+        {
+            Window = CC_READ_AHEAD_MAX_WINDOW;
+        }
+        else
+        {
+            Window = max(PrivateCacheMap->ReadAheadLength[0], max(Length, CC_READ_AHEAD_MIN_WINDOW));
+        }
+
+        /* We still have enough ahead of the reader, wait until it gets closer */
+        if (ReadEnd + Window / 2 <= PrivateCacheMap->ReadAheadOffset[0].QuadPart)
         {
             KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
             return;
         }
 
-        /* FIXME: hackish, but will do the job for now */
-        PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-        PrivateCacheMap->ReadAheadLength[1] = Length;
+        /* Queue a window after what we already have, and double it for the next time */
+        Start = max(ReadEnd, PrivateCacheMap->ReadAheadOffset[0].QuadPart);
+        End = Start + Window;
+        Window = min(Window * 2, CC_READ_AHEAD_MAX_WINDOW);
     }
-    /* Other cases: try to find some logic in that mess... */
-    else
+    /* Strided access: same length, same distance as between the two previous reads */
+    else if (Stride > 0 &&
+             FileOffset->QuadPart - PrivateCacheMap->FileOffset2.QuadPart == Stride &&
+             PrivateCacheMap->BeyondLastByte2.QuadPart - PrivateCacheMap->FileOffset2.QuadPart == ReadLength)
     {
-        /* Let's check if we always read the same way (like going down in the file)
-         * and pretend it's enough for now
-         */
-        if (PrivateCacheMap->FileOffset2.QuadPart >= PrivateCacheMap->FileOffset1.QuadPart &&
-            FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart)
+        /* Fetch the next record, if we didn't already */
+        Start = FileOffset->QuadPart + Stride;
+        End = Start + Length;
+        if (End <= PrivateCacheMap->ReadAheadOffset[0].QuadPart)
         {
-            /* FIXME: hackish, but will do the job for now */
-            PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-            PrivateCacheMap->ReadAheadLength[1] = Length;
-        }
-        else
-        {
-            /* FIXME: handle the other cases */
             KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
-            UNIMPLEMENTED_ONCE;
             return;
         }
-    }
 
-    /* If read ahead isn't active yet */
-    if (!PrivateCacheMap->Flags.ReadAheadActive)
+        Window = 0;
+    }
+    /* Random access: forget about the current run */
+    else
     {
-        PWORK_QUEUE_ENTRY WorkItem;
-
-        /* It's active now!
-         * Be careful with the mask, you don't want to mess with node code
-         */
-        InterlockedOr((volatile long *)&PrivateCacheMap->UlongFlags, PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
+        PrivateCacheMap->ReadAheadOffset[0].QuadPart = 0;
+        PrivateCacheMap->ReadAheadLength[0] = 0;
         KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
 
-        /* Get a work item */
-        WorkItem = ExAllocateFromNPagedLookasideList(&CcTwilightLookasideList);
-        if (WorkItem != NULL)
-        {
-            /* Reference our FO so that it doesn't go in between */
-            ObReferenceObject(FileObject);
-
-            /* We want to do read ahead! */
-            WorkItem->Function = ReadAhead;
-            WorkItem->Parameters.Read.FileObject = FileObject;
-
-            /* Queue in the read ahead dedicated queue */
-            CcPostWorkQueue(WorkItem, &CcExpressWorkQueue);
+    /* Nothing to read past the end of the file, and don't queue too many reads at once */
+    if (Start >= SharedCacheMap->FileSize.QuadPart ||
+        SharedCacheMap->ReadAheadsInFlight >= CC_MAX_READ_AHEADS_IN_FLIGHT)
+    {
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
 
-            return;
-        }
+    /* Account for the region before releasing the lock, so that it's queued only once */
+    PrivateCacheMap->ReadAheadOffset[0].QuadPart = End;
+    PrivateCacheMap->ReadAheadLength[0] = Window;
+    PrivateCacheMap->ReadAheadOffset[1].QuadPart = Start;
+    PrivateCacheMap->ReadAheadLength[1] = (ULONG)(End - Start);
+    InterlockedIncrement(&SharedCacheMap->ReadAheadsInFlight);
+    KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
 
-        /* Fail path: lock again, and revert read ahead active */
-        KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
-        InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
+    if (CcQueueReadAhead(FileObject, Start, (ULONG)(End - Start)))
+    {
+        return;
     }
 
-    /* Done (fail) */
+    /* Fail path: give the region back so that the next read retries it */
+    KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
+    if (PrivateCacheMap->ReadAheadOffset[0].QuadPart == End)
+    {
+        PrivateCacheMap->ReadAheadOffset[0].QuadPart = Start;
+    }
+    InterlockedDecrement(&SharedCacheMap->ReadAheadsInFlight);
     KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
 }
 
@@ -43,13 +43,6 @@ ULONG CcFastReadWait;
 ULONG CcFastReadNoWait;
 ULONG CcFastReadResourceMiss;
 
-/* Counters:
- * - Amount of pages flushed to the disk
- * - Number of flush operations
- */
-ULONG CcDataPages = 0;
-ULONG CcDataFlushes = 0;
-
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -147,63 +140,111 @@ CcReadVirtualAddress (
 
 NTSTATUS
 NTAPI
-CcWriteVirtualAddress (
-    PROS_VACB Vacb)
+CcWriteVirtualAddresses (
+    PROS_VACB *Vacbs,
+    ULONG Count)
 {
-    ULONG Size;
-    PMDL Mdl;
+    ULONG Size, ViewSize, Pages, i;
+    PMDL Mdl, ViewMdls[VACB_MAX_FLUSH_RUN];
     NTSTATUS Status;
     IO_STATUS_BLOCK IoStatus;
     KEVENT Event;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
 
-    Size = (ULONG)(Vacb->SharedCacheMap->SectionSize.QuadPart - Vacb->FileOffset.QuadPart);
-    if (Size > VACB_MAPPING_GRANULARITY)
-    {
-        Size = VACB_MAPPING_GRANULARITY;
-    }
-    //
-    // Nonpaged pool PDEs in ReactOS must actually be synchronized between the
-    // MmGlobalPageDirectory and the real system PDE directory. What a mess...
-    //
+    ASSERT(Count != 0 && Count <= VACB_MAX_FLUSH_RUN);
+    SharedCacheMap = Vacbs[0]->SharedCacheMap;
+
+    /* Lock the pages of each view. The VACBs are contiguous in the file,
+     * so only the last one can be partial */
+    Size = 0;
+    for (i = 0; i < Count; i++)
     {
-        ULONG i = 0;
-        do
+        ASSERT(Vacbs[i]->FileOffset.QuadPart == Vacbs[0]->FileOffset.QuadPart + (LONGLONG)i * VACB_MAPPING_GRANULARITY);
+
+        ViewSize = (ULONG)min(SharedCacheMap->SectionSize.QuadPart - Vacbs[i]->FileOffset.QuadPart,
+                              VACB_MAPPING_GRANULARITY);
+        //
+        // Nonpaged pool PDEs in ReactOS must actually be synchronized between the
+        // MmGlobalPageDirectory and the real system PDE directory. What a mess...
+        //
         {
-            MmGetPfnForProcess(NULL, (PVOID)((ULONG_PTR)Vacb->BaseAddress + (i << PAGE_SHIFT)));
-        } while (++i < (Size >> PAGE_SHIFT));
+            ULONG j = 0;
+            do
+            {
+                MmGetPfnForProcess(NULL, (PVOID)((ULONG_PTR)Vacbs[i]->BaseAddress + (j << PAGE_SHIFT)));
+            } while (++j < (ViewSize >> PAGE_SHIFT));
+        }
+
+        ViewMdls[i] = IoAllocateMdl(Vacbs[i]->BaseAddress, ViewSize, FALSE, FALSE, NULL);
+        if (!ViewMdls[i])
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Cleanup;
+        }
+
+        _SEH2_TRY
+        {
+            MmProbeAndLockPages(ViewMdls[i], KernelMode, IoReadAccess);
+        }
+        _SEH2_EXCEPT (EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+            DPRINT1("MmProbeAndLockPages failed with: %lx for %p (%p, %p)\n", Status, ViewMdls[i], Vacbs[i], Vacbs[i]->BaseAddress);
+            KeBugCheck(CACHE_MANAGER);
+        } _SEH2_END;
+
+        Size += ViewSize;
     }
 
-    Mdl = IoAllocateMdl(Vacb->BaseAddress, Size, FALSE, FALSE, NULL);
-    if (!Mdl)
+    /* For a run, describe all the pages with one MDL so that it's a single write */
+    Mdl = ViewMdls[0];
+    if (Count > 1)
     {
-        return STATUS_INSUFFICIENT_RESOURCES;
+        Mdl = IoAllocateMdl(Vacbs[0]->BaseAddress, Size, FALSE, FALSE, NULL);
+        if (!Mdl)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Cleanup;
+        }
+
+        Pages = 0;
+        for (i = 0; i < Count; i++)
+        {
+            ViewSize = MmGetMdlByteCount(ViewMdls[i]);
+            RtlCopyMemory(MmGetMdlPfnArray(Mdl) + Pages,
+                          MmGetMdlPfnArray(ViewMdls[i]),
+                          BYTES_TO_PAGES(ViewSize) * sizeof(PFN_NUMBER));
+            Pages += BYTES_TO_PAGES(ViewSize);
+        }
+        Mdl->MdlFlags |= MDL_PAGES_LOCKED;
     }
 
-    Status = STATUS_SUCCESS;
-    _SEH2_TRY
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+    Status = IoSynchronousPageWrite(SharedCacheMap->FileObject, Mdl, &Vacbs[0]->FileOffset, &Event, &IoStatus);
+    if (Status == STATUS_PENDING)
     {
-        MmProbeAndLockPages(Mdl, KernelMode, IoReadAccess);
+        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+        Status = IoStatus.Status;
     }
-    _SEH2_EXCEPT (EXCEPTION_EXECUTE_HANDLER)
-    {
-        Status = _SEH2_GetExceptionCode();
-        DPRINT1("MmProbeAndLockPages failed with: %lx for %p (%p, %p)\n", Status, Mdl, Vacb, Vacb->BaseAddress);
-        KeBugCheck(CACHE_MANAGER);
-    } _SEH2_END;
 
-    if (NT_SUCCESS(Status))
+    /* The pages of the run MDL belong to the view MDLs, just drop the mapping the driver may have made */
+    if (Mdl != ViewMdls[0])
     {
-        KeInitializeEvent(&Event, NotificationEvent, FALSE);
-        Status = IoSynchronousPageWrite(Vacb->SharedCacheMap->FileObject, Mdl, &Vacb->FileOffset, &Event, &IoStatus);
-        if (Status == STATUS_PENDING)
+        if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
         {
-            KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-            Status = IoStatus.Status;
+            MmUnmapLockedPages(Mdl->MappedSystemVa, Mdl);
         }
+        Mdl->MdlFlags &= ~MDL_PAGES_LOCKED;
+        IoFreeMdl(Mdl);
+    }
 
-        MmUnlockPages(Mdl);
+Cleanup:
+    while (i-- > 0)
+    {
+        MmUnlockPages(ViewMdls[i]);
+        IoFreeMdl(ViewMdls[i]);
     }
-    IoFreeMdl(Mdl);
+
     if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE))
     {
         DPRINT1("IoPageWrite failed, Status %x\n", Status);
@@ -213,6 +254,14 @@ CcWriteVirtualAddress (
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+NTAPI
+CcWriteVirtualAddress (
+    PROS_VACB Vacb)
+{
+    return CcWriteVirtualAddresses(&Vacb, 1);
+}
+
 NTSTATUS
 ReadWriteOrZero(
     _Inout_ PVOID BaseAddress,
@@ -245,6 +294,30 @@ ReadWriteOrZero(
     return Status;
 }
 
+static
+VOID
+CcUpdateReadAheadCounters(
+    _In_ PPRIVATE_CACHE_MAP PrivateCacheMap,
+    _In_ PROS_VACB Vacb,
+    _In_ BOOLEAN Valid)
+{
+    if (Valid)
+    {
+        /* First read of a view brought in by read ahead */
+        if (Vacb->ReadAhead)
+        {
+            Vacb->ReadAhead = FALSE;
+            CcIncrementPerformanceCounter(ReadAheadHits);
+        }
+    }
+    /* Read ahead was scheduled for this view, but it isn't there (yet) */
+    else if (Vacb->FileOffset.QuadPart + VACB_MAPPING_GRANULARITY > PrivateCacheMap->FileOffset2.QuadPart &&
+             Vacb->FileOffset.QuadPart < PrivateCacheMap->ReadAheadOffset[0].QuadPart)
+    {
+        CcIncrementPerformanceCounter(ReadAheadMisses);
+    }
+}
+
 BOOLEAN
 CcCopyData (
     _In_ PFILE_OBJECT FileObject,
@@ -260,42 +333,50 @@ CcCopyData (
     ULONG BytesCopied;
     KIRQL OldIrql;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
-    PLIST_ENTRY ListEntry;
+    LONGLONG ViewOffset;
     PROS_VACB Vacb;
     ULONG PartialLength;
     PVOID BaseAddress;
-    BOOLEAN Valid;
+    BOOLEAN Valid, Missed;
     PPRIVATE_CACHE_MAP PrivateCacheMap;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
     PrivateCacheMap = FileObject->PrivateCacheMap;
     CurrentOffset = FileOffset;
     BytesCopied = 0;
+    Missed = FALSE;
+
+    if (Operation == CcOperationRead)
+    {
+        if (Wait)
+            CcIncrementPerformanceCounter(CopyReadWait);
+        else
+            CcIncrementPerformanceCounter(CopyReadNoWait);
+    }
 
     if (!Wait)
     {
-        /* test if the requested data is available */
+        /* Test if the requested data is available. Views that don't exist
+         * yet would have to be read too, so they're misses as well */
         KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
-        /* FIXME: this loop doesn't take into account areas that don't have
-         * a VACB in the list yet */
-        ListEntry = SharedCacheMap->CacheMapVacbListHead.Flink;
-        while (ListEntry != &SharedCacheMap->CacheMapVacbListHead)
+        for (ViewOffset = ROUND_DOWN(CurrentOffset, VACB_MAPPING_GRANULARITY);
+             ViewOffset < CurrentOffset + Length;
+             ViewOffset += VACB_MAPPING_GRANULARITY)
         {
-            Vacb = CONTAINING_RECORD(ListEntry,
-                                     ROS_VACB,
-                                     CacheMapVacbListEntry);
-            ListEntry = ListEntry->Flink;
-            if (!Vacb->Valid &&
-                DoRangesIntersect(Vacb->FileOffset.QuadPart,
-                                  VACB_MAPPING_GRANULARITY,
-                                  CurrentOffset, Length))
+            Vacb = CcRosLookupVacbIndex(SharedCacheMap, ViewOffset);
+            if (Vacb == NULL || !Vacb->Valid)
             {
                 KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
-                /* data not available */
+                /* Data not available: start reading it and let the caller
+                 * post the request */
+                if (Operation == CcOperationRead)
+                {
+                    CcIncrementPerformanceCounter(CopyReadNoWaitMiss);
+                    CcScheduleReadAheadForMiss(FileObject, ViewOffset,
+                                               (ULONG)(CurrentOffset + Length - ViewOffset));
+                }
                 return FALSE;
             }
-            if (Vacb->FileOffset.QuadPart >= CurrentOffset + Length)
-                break;
         }
         KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
     }
@@ -312,8 +393,11 @@ CcCopyData (
                                   &Vacb);
         if (!NT_SUCCESS(Status))
             ExRaiseStatus(Status);
+        if (Operation == CcOperationRead)
+            CcUpdateReadAheadCounters(PrivateCacheMap, Vacb, Valid);
         if (!Valid)
         {
+            Missed = TRUE;
             Status = CcReadVirtualAddress(Vacb);
             if (!NT_SUCCESS(Status))
             {
@@ -350,10 +434,13 @@ CcCopyData (
                                   &Vacb);
         if (!NT_SUCCESS(Status))
             ExRaiseStatus(Status);
+        if (Operation == CcOperationRead)
+            CcUpdateReadAheadCounters(PrivateCacheMap, Vacb, Valid);
         if (!Valid &&
             (Operation == CcOperationRead ||
              PartialLength < VACB_MAPPING_GRANULARITY))
         {
+            Missed = TRUE;
             Status = CcReadVirtualAddress(Vacb);
             if (!NT_SUCCESS(Status))
             {
@@ -376,14 +463,22 @@ CcCopyData (
             Buffer = (PVOID)((ULONG_PTR)Buffer + PartialLength);
     }
 
+    /* Count reads which had to go to the disk */
+    if (Operation == CcOperationRead && Missed)
+    {
+        if (Wait)
+            CcIncrementPerformanceCounter(CopyReadWaitMiss);
+        else
+            CcIncrementPerformanceCounter(CopyReadNoWaitMiss);
+    }
+
     /* If that was a successful sync read operation, let's handle read ahead */
     if (Operation == CcOperationRead && Length == 0 && Wait)
     {
-        /* If file isn't random access and next read may get us cross VACB boundary,
-         * schedule next read
+        /* If file isn't random access, let read ahead see this read: it
+         * decides whether it's part of a run and whether more is needed
          */
-        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS) &&
-            (CurrentOffset - 1) / VACB_MAPPING_GRANULARITY != (CurrentOffset + BytesCopied - 1) / VACB_MAPPING_GRANULARITY)
+        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
         {
             CcScheduleReadAhead(FileObject, (PLARGE_INTEGER)&FileOffset, BytesCopied);
         }
@@ -476,7 +571,9 @@ CcPostDeferredWrites(VOID)
 
 VOID
 CcPerformReadAhead(
-    IN PFILE_OBJECT FileObject)
+    IN PFILE_OBJECT FileObject,
+    IN LONGLONG FileOffset,
+    IN ULONG Length)
 {
     NTSTATUS Status;
     LONGLONG CurrentOffset;
@@ -486,11 +583,11 @@ CcPerformReadAhead(
     ULONG PartialLength;
     PVOID BaseAddress;
     BOOLEAN Valid;
-    ULONG Length;
     PPRIVATE_CACHE_MAP PrivateCacheMap;
     BOOLEAN Locked;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    CurrentOffset = FileOffset;
 
     /* Critical:
      * PrivateCacheMap might disappear in-between if the handle
@@ -504,17 +601,10 @@ CcPerformReadAhead(
     if (PrivateCacheMap == NULL)
     {
         KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+        InterlockedDecrement(&SharedCacheMap->ReadAheadsInFlight);
         ObDereferenceObject(FileObject);
         return;
     }
-    /* Otherwise, extract read offset and length and release private map */
-    else
-    {
-        KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-        CurrentOffset = PrivateCacheMap->ReadAheadOffset[1].QuadPart;
-        Length = PrivateCacheMap->ReadAheadLength[1];
-        KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-    }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
     /* Time to go! */
@@ -568,6 +658,10 @@ CcPerformReadAhead(
                 DPRINT1("Failed to read data: %lx!\n", Status);
                 goto Clear;
             }
+
+            /* Remember who brought it in, for the hit counter */
+            Vacb->ReadAhead = TRUE;
+            CcIncrementPerformanceCounter(ReadAheadIos);
         }
 
         CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
@@ -600,6 +694,10 @@ CcPerformReadAhead(
                 DPRINT1("Failed to read data: %lx!\n", Status);
                 goto Clear;
             }
+
+            /* Remember who brought it in, for the hit counter */
+            Vacb->ReadAhead = TRUE;
+            CcIncrementPerformanceCounter(ReadAheadIos);
         }
 
         CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
@@ -609,24 +707,15 @@ CcPerformReadAhead(
     }
 
 Clear:
-    /* See previous comment about private cache map */
-    OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-    PrivateCacheMap = FileObject->PrivateCacheMap;
-    if (PrivateCacheMap != NULL)
-    {
-        /* Mark read ahead as unactive */
-        KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-        InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
-        KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-    }
-    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
-
     /* If file was locked, release it */
     if (Locked)
     {
         SharedCacheMap->Callbacks->ReleaseFromReadAhead(SharedCacheMap->LazyWriteContext);
     }
 
+    /* Let CcScheduleReadAhead queue another one */
+    InterlockedDecrement(&SharedCacheMap->ReadAheadsInFlight);
+
     /* And drop our extra reference (See: CcScheduleReadAhead) */
     ObDereferenceObject(FileObject);
 
@@ -734,6 +823,12 @@ CcCanIWrite (
         return TRUE;
     }
 
+    /* Retries of a deferred write were already counted */
+    if (TryContext == FirstTry)
+    {
+        CcIncrementPerformanceCounter(ThrottledWrites);
+    }
+
     /* If we can wait, we'll start the wait loop for waiting till we can
      * write for real
      */
@@ -237,13 +237,13 @@ CcPurgeCacheSection (
 
         /* This VACB is in range, so unlink it and mark for free */
         ASSERT(Refs == 1 || Vacb->Dirty);
-        RemoveEntryList(&Vacb->VacbLruListEntry);
-        InitializeListHead(&Vacb->VacbLruListEntry);
+        CcRosRemoveVacbFromLru(Vacb);
         if (Vacb->Dirty)
         {
             CcRosUnmarkDirtyVacb(Vacb, FALSE);
         }
         RemoveEntryList(&Vacb->CacheMapVacbListEntry);
+        CcRosRemoveVacbFromIndex(Vacb);
         InsertHeadList(&FreeList, &Vacb->CacheMapVacbListEntry);
     }
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
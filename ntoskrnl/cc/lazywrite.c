@@ -13,13 +13,6 @@
 #define NDEBUG
 #include <debug.h>
 
-/* Counters:
- * - Amount of pages flushed by lazy writer
- * - Number of times lazy writer ran
- */
-ULONG CcLazyWritePages = 0;
-ULONG CcLazyWriteIos = 0;
-
 /* Internal vars (MS):
  * - Lazy writer status structure
  * - Lookaside list where to allocate work items
@@ -113,11 +106,23 @@ CcScanDpc(
     CcPostWorkQueue(WorkItem, &CcRegularWorkQueue);
 }
 
+VOID
+CcWriteBehind(
+    IN ULONG Target)
+{
+    ULONG Count;
+
+    DPRINT("Write behind starting (%d)\n", Target);
+    CcRosFlushDirtyPages(Target, &Count, FALSE, TRUE);
+    DPRINT("Write behind done (%d)\n", Count);
+}
+
 VOID
 CcLazyWriteScan(VOID)
 {
     ULONG Target;
     ULONG Count;
+    ULONG Workers, Share, i;
     KIRQL OldIrql;
     PLIST_ENTRY ListEntry;
     LIST_ENTRY ToPost;
@@ -140,15 +145,53 @@ CcLazyWriteScan(VOID)
 
     /* Our target is one-eighth of the dirty pages */
     Target = CcTotalDirtyPages / 8;
+
+    /* But if writers are waiting on us or are about to, get back under
+     * half of the threshold as fast as possible
+     */
+    if (!IsListEmpty(&CcDeferredWrites) || CcIsDirtyPageBacklogHigh())
+    {
+        if (CcTotalDirtyPages > CcDirtyPageThreshold / 2 &&
+            Target < CcTotalDirtyPages - CcDirtyPageThreshold / 2)
+        {
+            Target = CcTotalDirtyPages - CcDirtyPageThreshold / 2;
+        }
+    }
+
     if (Target != 0)
     {
+        /* Share the work with the other workers, keeping a share for us.
+         * Keep shares big enough so that flushes can still be coalesced
+         */
+        Workers = Target / (VACB_MAX_FLUSH_RUN * (VACB_MAPPING_GRANULARITY / PAGE_SIZE));
+        if (Workers > CcNumberWorkerThreads)
+        {
+            Workers = CcNumberWorkerThreads;
+        }
+        if (Workers == 0)
+        {
+            Workers = 1;
+        }
+        Share = Target / Workers;
+
+        for (i = 1; i < Workers; i++)
+        {
+            WorkItem = ExAllocateFromNPagedLookasideList(&CcTwilightLookasideList);
+            if (WorkItem == NULL)
+            {
+                break;
+            }
+
+            WorkItem->Function = WriteBehind;
+            WorkItem->Parameters.Write.SharedCacheMap = NULL;
+            WorkItem->Parameters.Write.Target = Share;
+            CcPostWorkQueue(WorkItem, &CcRegularWorkQueue);
+            Target -= Share;
+        }
+
         /* Flush! */
         DPRINT("Lazy writer starting (%d)\n", Target);
         CcRosFlushDirtyPages(Target, &Count, FALSE, TRUE);
-
-        /* And update stats */
-        CcLazyWritePages += Count;
-        ++CcLazyWriteIos;
         DPRINT("Lazy writer done (%d)\n", Count);
     }
 
@@ -166,9 +209,16 @@ CcLazyWriteScan(VOID)
         CcPostWorkQueue(WorkItem, &CcRegularWorkQueue);
     }
 
-    /* We're no longer active */
+    /* We're no longer active, unless there are dirty pages left */
     OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-    LazyWriter.ScanActive = FALSE;
+    if (CcTotalDirtyPages != 0)
+    {
+        CcScheduleLazyWriteScan(FALSE);
+    }
+    else
+    {
+        LazyWriter.ScanActive = FALSE;
+    }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 }
 
@@ -276,7 +326,13 @@ CcWorkerThread(
         switch (WorkItem->Function)
         {
             case ReadAhead:
-                CcPerformReadAhead(WorkItem->Parameters.Read.FileObject);
+                CcPerformReadAhead(WorkItem->Parameters.Read.FileObject,
+                                   WorkItem->Parameters.Read.FileOffset.QuadPart,
+                                   WorkItem->Parameters.Read.Length);
+                break;
+
+            case WriteBehind:
+                CcWriteBehind(WorkItem->Parameters.Write.Target);
                 break;
 
             case LazyWrite:
@@ -5,6 +5,7 @@
  * PURPOSE:         Implements MDL Cache Manager Functions
  *
  * PROGRAMMERS:     Alex Ionescu
+ *                  Pierre Schweitzer (pierre@reactos.org)
  */
 
 /* INCLUDES ******************************************************************/
@@ -15,6 +16,197 @@
 
 /* FUNCTIONS *****************************************************************/
 
+/*
+ * Describes Length bytes at FileOffset, all in the same view, with an MDL
+ * locking the cached pages themselves. The view is brought in first when
+ * needed. On success, the VACB stays referenced till the MDL is given back.
+ */
+static
+NTSTATUS
+CcMdlLockView (
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ LONGLONG FileOffset,
+    _In_ ULONG Length,
+    _In_ LOCK_OPERATION Operation,
+    _Out_ PMDL *Mdl)
+{
+    NTSTATUS Status;
+    ULONG ViewOffset, i;
+    PVOID BaseAddress;
+    BOOLEAN Valid;
+    PROS_VACB Vacb;
+
+    ViewOffset = FileOffset % VACB_MAPPING_GRANULARITY;
+    ASSERT(ViewOffset + Length <= VACB_MAPPING_GRANULARITY);
+
+    Status = CcRosRequestVacb(SharedCacheMap,
+                              FileOffset - ViewOffset,
+                              &BaseAddress,
+                              &Valid,
+                              &Vacb);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    if (Operation == IoReadAccess)
+    {
+        CcIncrementPerformanceCounter(MdlReadWait);
+        if (!Valid)
+        {
+            CcIncrementPerformanceCounter(MdlReadWaitMiss);
+        }
+    }
+
+    /* A write covering the whole view doesn't need what's on the disk */
+    if (!Valid &&
+        (Operation == IoReadAccess ||
+         ViewOffset != 0 || Length < VACB_MAPPING_GRANULARITY))
+    {
+        Status = CcReadVirtualAddress(Vacb);
+        if (!NT_SUCCESS(Status))
+        {
+            CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE, FALSE);
+            return Status;
+        }
+    }
+
+    /* From now on, the view holds the data the MDL describes */
+    Vacb->Valid = TRUE;
+    BaseAddress = (PUCHAR)BaseAddress + ViewOffset;
+
+    //
+    // Nonpaged pool PDEs in ReactOS must actually be synchronized between the
+    // MmGlobalPageDirectory and the real system PDE directory. What a mess...
+    //
+    for (i = 0; i < ADDRESS_AND_SIZE_TO_SPAN_PAGES(BaseAddress, Length); i++)
+    {
+        MmGetPfnForProcess(NULL, (PVOID)((ULONG_PTR)PAGE_ALIGN(BaseAddress) + (i << PAGE_SHIFT)));
+    }
+
+    *Mdl = IoAllocateMdl(BaseAddress, Length, FALSE, FALSE, NULL);
+    if (*Mdl == NULL)
+    {
+        CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    _SEH2_TRY
+    {
+        MmProbeAndLockPages(*Mdl, KernelMode, Operation);
+    }
+    _SEH2_EXCEPT (EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+        DPRINT1("MmProbeAndLockPages failed with: %lx for %p (%p, %p)\n", Status, *Mdl, Vacb, BaseAddress);
+    } _SEH2_END;
+
+    if (!NT_SUCCESS(Status))
+    {
+        IoFreeMdl(*Mdl);
+        *Mdl = NULL;
+        CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+    }
+
+    return Status;
+}
+
+/*
+ * Gives back a chain built by CcMdlBuildChain: pages get unlocked and the
+ * VACBs released, dirty if the chain was used to write to the file.
+ */
+static
+VOID
+CcMdlFreeChain (
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PMDL MdlChain,
+    _In_ BOOLEAN Dirty)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_VACB Vacb;
+    PMDL Mdl;
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    while ((Mdl = MdlChain))
+    {
+        MdlChain = Mdl->Next;
+
+        Vacb = CcRosLookupVacbByAddress(SharedCacheMap, MmGetMdlVirtualAddress(Mdl));
+        ASSERT(Vacb != NULL);
+
+        MmUnlockPages(Mdl);
+        IoFreeMdl(Mdl);
+
+        if (Vacb != NULL)
+        {
+            CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, Dirty, FALSE);
+        }
+    }
+}
+
+/*
+ * Builds a chain of MDLs, one per view, describing the cached data for the
+ * given range. On failure, nothing is left locked.
+ */
+static
+NTSTATUS
+CcMdlBuildChain (
+    _In_ PFILE_OBJECT FileObject,
+    _In_ LONGLONG FileOffset,
+    _In_ ULONG Length,
+    _In_ LOCK_OPERATION Operation,
+    _Out_ PMDL *MdlChain)
+{
+    NTSTATUS Status;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    ULONG PartialLength;
+    PMDL Mdl, *Link;
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    *MdlChain = NULL;
+    Link = MdlChain;
+    while (Length > 0)
+    {
+        PartialLength = VACB_MAPPING_GRANULARITY - (ULONG)(FileOffset % VACB_MAPPING_GRANULARITY);
+        PartialLength = min(PartialLength, Length);
+
+        Status = CcMdlLockView(SharedCacheMap, FileOffset, PartialLength, Operation, &Mdl);
+        if (!NT_SUCCESS(Status))
+        {
+            CcMdlFreeChain(FileObject, *MdlChain, FALSE);
+            *MdlChain = NULL;
+            return Status;
+        }
+
+        *Link = Mdl;
+        Link = &Mdl->Next;
+
+        FileOffset += PartialLength;
+        Length -= PartialLength;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Appends Chain to the chain the caller gave us, if any
+ */
+static
+VOID
+CcMdlAppendChain (
+    _Inout_ PMDL *MdlChain,
+    _In_ PMDL Chain)
+{
+    while (*MdlChain != NULL)
+    {
+        MdlChain = &(*MdlChain)->Next;
+    }
+
+    *MdlChain = Chain;
+}
+
 /*
  * @implemented
  */
@@ -28,10 +220,38 @@ CcMdlRead (
     OUT PIO_STATUS_BLOCK IoStatus
     )
 {
+    NTSTATUS Status;
+    PMDL Chain;
+    PPRIVATE_CACHE_MAP PrivateCacheMap;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    Status = CcMdlBuildChain(FileObject, FileOffset->QuadPart, Length, IoReadAccess, &Chain);
+    if (!NT_SUCCESS(Status))
+    {
+        ExRaiseStatus(Status);
+    }
+
+    CcMdlAppendChain(MdlChain, Chain);
+
+    /* Let read ahead know about this read, as CcCopyRead does */
+    PrivateCacheMap = FileObject->PrivateCacheMap;
+    if (PrivateCacheMap != NULL)
+    {
+        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
+        {
+            CcScheduleReadAhead(FileObject, FileOffset, Length);
+        }
+
+        PrivateCacheMap->FileOffset1.QuadPart = PrivateCacheMap->FileOffset2.QuadPart;
+        PrivateCacheMap->BeyondLastByte1.QuadPart = PrivateCacheMap->BeyondLastByte2.QuadPart;
+        PrivateCacheMap->FileOffset2.QuadPart = FileOffset->QuadPart;
+        PrivateCacheMap->BeyondLastByte2.QuadPart = FileOffset->QuadPart + Length;
+    }
+
+    IoStatus->Status = STATUS_SUCCESS;
+    IoStatus->Information = Length;
 }
 
 /*
@@ -58,15 +278,8 @@ CcMdlReadComplete2 (
     IN PMDL MemoryDescriptorList
 )
 {
-    PMDL Mdl;
-
-    /* Free MDLs */
-    while ((Mdl = MemoryDescriptorList))
-    {
-        MemoryDescriptorList = Mdl->Next;
-        MmUnlockPages(Mdl);
-        IoFreeMdl(Mdl);
-    }
+    /* Free MDLs and release the views */
+    CcMdlFreeChain(FileObject, MemoryDescriptorList, FALSE);
 }
 
 /*
@@ -106,9 +319,11 @@ CcMdlReadComplete (
                                       MdlChain,
                                       DeviceObject);
     }
-
-    /* Use slow path */
-    CcMdlReadComplete2(FileObject, MdlChain);
+    else
+    {
+        /* Use slow path */
+        CcMdlReadComplete2(FileObject, MdlChain);
+    }
 }
 
 /*
@@ -137,9 +352,11 @@ CcMdlWriteComplete (
                                        MdlChain,
                                        DeviceObject);
     }
-
-    /* Use slow path */
-    CcMdlWriteComplete2(FileObject,FileOffset, MdlChain);
+    else
+    {
+        /* Use slow path */
+        CcMdlWriteComplete2(FileObject,FileOffset, MdlChain);
+    }
 }
 
 VOID
@@ -149,11 +366,12 @@ CcMdlWriteComplete2 (
     IN PLARGE_INTEGER FileOffset,
     IN PMDL MdlChain)
 {
-    UNIMPLEMENTED;
+    /* Data was written to the views, so they're now dirty */
+    CcMdlFreeChain(FileObject, MdlChain, TRUE);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -161,11 +379,14 @@ CcMdlWriteAbort (
     IN PFILE_OBJECT FileObject,
     IN PMDL MdlChain)
 {
-    UNIMPLEMENTED;
+    CCTRACE(CC_API_DEBUG, "FileObject=%p MdlChain=%p\n", FileObject, MdlChain);
+
+    /* Nothing was written, just give the views back */
+    CcMdlFreeChain(FileObject, MdlChain, FALSE);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -176,8 +397,21 @@ CcPrepareMdlWrite (
     OUT PMDL * MdlChain,
     OUT PIO_STATUS_BLOCK IoStatus)
 {
+    NTSTATUS Status;
+    PMDL Chain;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    /* Views get dirty only once the caller is done writing, in CcMdlWriteComplete */
+    Status = CcMdlBuildChain(FileObject, FileOffset->QuadPart, Length, IoWriteAccess, &Chain);
+    if (!NT_SUCCESS(Status))
+    {
+        ExRaiseStatus(Status);
+    }
+
+    CcMdlAppendChain(MdlChain, Chain);
+
+    IoStatus->Status = STATUS_SUCCESS;
+    IoStatus->Information = Length;
 }
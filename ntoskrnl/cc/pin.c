@@ -18,31 +18,22 @@
 
 extern NPAGED_LOOKASIDE_LIST iBcbLookasideList;
 
-/* Counters:
- * - Number of calls to CcMapData that could wait
- * - Number of calls to CcMapData that couldn't wait
- * - Number of calls to CcPinRead that could wait
- * - Number of calls to CcPinRead that couldn't wait
- */
-ULONG CcMapDataWait = 0;
-ULONG CcMapDataNoWait = 0;
-ULONG CcPinReadWait = 0;
-ULONG CcPinReadNoWait = 0;
-
 /* FUNCTIONS *****************************************************************/
 
 /*
- * @implemented
+ * Does the work for CcMapData and CcPinRead, Miss tells whether the view
+ * wasn't in memory for the counters
  */
+static
 BOOLEAN
-NTAPI
-CcMapData (
+CcMapDataCommon (
     IN PFILE_OBJECT FileObject,
     IN PLARGE_INTEGER FileOffset,
     IN ULONG Length,
     IN ULONG Flags,
     OUT PVOID *pBcb,
-    OUT PVOID *pBuffer)
+    OUT PVOID *pBuffer,
+    OUT PBOOLEAN Miss)
 {
     LONGLONG ReadOffset;
     BOOLEAN Valid;
@@ -56,15 +47,7 @@ CcMapData (
            " pBcb 0x%p, pBuffer 0x%p)\n", FileObject, FileOffset->QuadPart,
            Length, Flags, pBcb, pBuffer);
 
-    if (Flags & MAP_WAIT)
-    {
-        ++CcMapDataWait;
-    }
-    else
-    {
-        ++CcMapDataNoWait;
-    }
-
+    *Miss = FALSE;
     ReadOffset = FileOffset->QuadPart;
 
     ASSERT(FileObject);
@@ -102,6 +85,8 @@ CcMapData (
 
     if (!Valid)
     {
+        *Miss = TRUE;
+
         if (!(Flags & MAP_WAIT))
         {
             CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE, FALSE);
@@ -149,6 +134,47 @@ CcMapData (
     return TRUE;
 }
 
+/*
+ * @implemented
+ */
+BOOLEAN
+NTAPI
+CcMapData (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length,
+    IN ULONG Flags,
+    OUT PVOID *pBcb,
+    OUT PVOID *pBuffer)
+{
+    BOOLEAN Ret, Miss;
+
+    if (Flags & MAP_WAIT)
+    {
+        CcIncrementPerformanceCounter(MapDataWait);
+    }
+    else
+    {
+        CcIncrementPerformanceCounter(MapDataNoWait);
+    }
+
+    Ret = CcMapDataCommon(FileObject, FileOffset, Length, Flags, pBcb, pBuffer, &Miss);
+
+    if (Miss)
+    {
+        if (Flags & MAP_WAIT)
+        {
+            CcIncrementPerformanceCounter(MapDataWaitMiss);
+        }
+        else
+        {
+            CcIncrementPerformanceCounter(MapDataNoWaitMiss);
+        }
+    }
+
+    return Ret;
+}
+
 /*
  * @unimplemented
  */
@@ -192,21 +218,27 @@ CcPinRead (
     OUT	PVOID * Buffer)
 {
     PINTERNAL_BCB iBcb;
+    BOOLEAN Miss;
 
     CCTRACE(CC_API_DEBUG, "FileOffset=%p FileOffset=%p Length=%lu Flags=0x%lx\n",
         FileObject, FileOffset, Length, Flags);
 
     if (Flags & PIN_WAIT)
     {
-        ++CcPinReadWait;
+        CcIncrementPerformanceCounter(PinReadWait);
     }
     else
     {
-        ++CcPinReadNoWait;
+        CcIncrementPerformanceCounter(PinReadNoWait);
     }
 
-    if (CcMapData(FileObject, FileOffset, Length, Flags, Bcb, Buffer))
+    if (CcMapDataCommon(FileObject, FileOffset, Length, Flags, Bcb, Buffer, &Miss))
     {
+        if (Miss)
+        {
+            CcIncrementPerformanceCounter(PinReadWaitMiss);
+        }
+
         if (CcPinMappedData(FileObject, FileOffset, Length, Flags, Bcb))
         {
             iBcb = *Bcb;
@@ -230,6 +262,10 @@ CcPinRead (
         else
             CcUnpinData(*Bcb);
     }
+    else if (Miss)
+    {
+        CcIncrementPerformanceCounter(PinReadNoWaitMiss);
+    }
     return FALSE;
 }
 
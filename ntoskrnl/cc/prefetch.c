@@ -0,0 +1,779 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS kernel
+ * FILE:            ntoskrnl/cc/prefetch.c
+ * PURPOSE:         Boot and application launch prefetcher
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/*
+ * The prefetcher records the file pages that section faults have to read
+ * during boot and during the first seconds of each application, and saves
+ * them in \SystemRoot\Prefetch once the scenario is over. The next time the
+ * scenario starts, the trace is read back and the pages are brought into the
+ * cache with large reads sorted by file offset, from a worker thread, while
+ * the faults that need them are still to come. Data and image sections both
+ * read their pages through the cache (see MiReadPage), so warming the cache
+ * serves them both.
+ *
+ * The files read this way are kept open until the scenario ends, so that the
+ * cache maps don't go away before the pages are used.
+ *
+ * Winlogon also gets a logon scenario per user, traced for the first seconds
+ * after the user logs on. The scenario of the last user is prefetched while
+ * the credentials are being entered, without tracing, so the files stay open
+ * for as long as the user is expected to take.
+ */
+
+/* GLOBALS ******************************************************************/
+
+#define CCPF_MAX_SECTIONS           256
+#define CCPF_MAX_BOOT_ENTRIES       32768
+#define CCPF_MAX_APP_ENTRIES        8192
+#define CCPF_MAX_LOGON_ENTRIES      16384
+#define CCPF_MAX_ACTIVE_TRACES      8
+
+/* How long a scenario is traced for, in seconds */
+#define CCPF_BOOT_TRACE_TIME        120
+#define CCPF_APP_TRACE_TIME         10
+#define CCPF_LOGON_TRACE_TIME       30
+#define CCPF_LOGON_PREFETCH_TIME    180
+
+/* Prefetch read size, and the largest hole in a run we still read through */
+#define CCPF_READ_SIZE              (64 * 1024)
+#define CCPF_READ_GAP_PAGES         8
+
+#define CCPF_TRACE_MAGIC_NUMBER     'ACCS'
+#define CCPF_TRACE_VERSION          1
+#define CCPF_MAXIMUM_TRACE_SIZE     (1024 * 1024)
+#define CCPF_BOOT_SCENARIO_HASH     0xB00DFAAD
+
+#define CCPF_LOG_ENTRY_DATA         0
+#define CCPF_LOG_ENTRY_IMAGE        1
+
+#define CCPF_SCENARIO_APP_LAUNCH    0
+#define CCPF_SCENARIO_BOOT          1
+#define CCPF_SCENARIO_LOGON         2
+
+/* Boot phase the boot scenario starts in */
+#define CCPF_BOOT_PHASE_SMSS_INIT   150
+
+typedef struct _CCPF_SECTION
+{
+    PFILE_OBJECT FileObject;
+    PSECTION_OBJECT_POINTERS SectionObjectPointer;
+} CCPF_SECTION, *PCCPF_SECTION;
+
+typedef struct _CCPF_TRACE
+{
+    LIST_ENTRY ActiveTracesLink;
+    PF_SCENARIO_ID ScenarioId;
+    ULONG ScenarioType;
+    PEPROCESS Process;
+    KTIMER TraceTimer;
+    KDPC TraceTimerDpc;
+    WORK_QUEUE_ITEM PrefetchWorkItem;
+    WORK_QUEUE_ITEM EndTraceWorkItem;
+    KEVENT PrefetchDoneEvent;
+    ULONG NumPrefetchHandles;
+    HANDLE PrefetchHandles[CCPF_MAX_SECTIONS];
+    ULONG NumSections;
+    CCPF_SECTION Sections[CCPF_MAX_SECTIONS];
+    ULONG NumEntries;
+    ULONG MaxEntries;
+    PF_LOG_ENTRY Entries[ANYSIZE_ARRAY];
+} CCPF_TRACE, *PCCPF_TRACE;
+
+static LONG CcPfNumActiveTraces;
+static const UNICODE_STRING CcPfDirectory = RTL_CONSTANT_STRING(L"\\SystemRoot\\Prefetch");
+
+/* FUNCTIONS *****************************************************************/
+
+static
+VOID
+CcPfBuildTracePath(
+    IN PPF_SCENARIO_ID ScenarioId,
+    OUT PUNICODE_STRING Path,
+    IN PWCHAR Buffer,
+    IN USHORT BufferSize)
+{
+    /* \SystemRoot\Prefetch\NAME-HASH.pf */
+    _snwprintf(Buffer,
+               BufferSize / sizeof(WCHAR),
+               L"\\SystemRoot\\Prefetch\\%.30s-%08lX.pf",
+               ScenarioId->ScenName,
+               ScenarioId->HashId);
+    Buffer[BufferSize / sizeof(WCHAR) - 1] = UNICODE_NULL;
+    RtlInitUnicodeString(Path, Buffer);
+}
+
+static
+VOID
+CcPfReadFileRun(
+    IN HANDLE FileHandle,
+    IN PVOID Buffer,
+    IN ULONG FirstPage,
+    IN ULONG LastPage)
+{
+    LARGE_INTEGER Offset;
+    IO_STATUS_BLOCK IoStatusBlock;
+    ULONGLONG End;
+    ULONG Length;
+    NTSTATUS Status;
+
+    /*
+     * We only want the data to end up in the cache, the buffer is just a
+     * sink for it
+     */
+    Offset.QuadPart = (ULONGLONG)FirstPage << PAGE_SHIFT;
+    End = ((ULONGLONG)LastPage + 1) << PAGE_SHIFT;
+    while ((ULONGLONG)Offset.QuadPart < End)
+    {
+        Length = (ULONG)min(End - Offset.QuadPart, CCPF_READ_SIZE);
+        Status = ZwReadFile(FileHandle,
+                            NULL,
+                            NULL,
+                            NULL,
+                            &IoStatusBlock,
+                            Buffer,
+                            Length,
+                            &Offset,
+                            NULL);
+        if (!NT_SUCCESS(Status) || (IoStatusBlock.Information < Length)) break;
+        Offset.QuadPart += Length;
+    }
+}
+
+static
+BOOLEAN
+CcPfValidateTrace(
+    IN PPF_TRACE_HEADER Header,
+    IN ULONG Size,
+    IN PPF_SCENARIO_ID ScenarioId)
+{
+    PUCHAR Names, NamesEnd;
+    ULONG i, NameLength;
+
+    if ((Size < sizeof(PF_TRACE_HEADER)) ||
+        (Header->MagicNumber != CCPF_TRACE_MAGIC_NUMBER) ||
+        (Header->Version != CCPF_TRACE_VERSION) ||
+        (Header->Size != Size) ||
+        (Header->ScenarioId.HashId != ScenarioId->HashId) ||
+        (Header->NumSections > CCPF_MAX_SECTIONS))
+    {
+        return FALSE;
+    }
+
+    /* The log entries come last */
+    if ((Header->TraceBufferOffset < Header->SectionInfoOffset) ||
+        (Header->TraceBufferOffset > Size) ||
+        (Header->NumEntries > (Size - Header->TraceBufferOffset) / sizeof(PF_LOG_ENTRY)))
+    {
+        return FALSE;
+    }
+
+    /* And the section names must fit before them */
+    if (Header->SectionInfoOffset < sizeof(PF_TRACE_HEADER)) return FALSE;
+    Names = (PUCHAR)Header + Header->SectionInfoOffset;
+    NamesEnd = (PUCHAR)Header + Header->TraceBufferOffset;
+    for (i = 0; i < Header->NumSections; i++)
+    {
+        if ((ULONG)(NamesEnd - Names) < sizeof(ULONG)) return FALSE;
+        NameLength = *(PULONG)Names;
+        if ((NameLength > MAXUSHORT) || (NameLength & 1) ||
+            (ALIGN_UP_BY(NameLength, sizeof(ULONG)) > (ULONG)(NamesEnd - Names) - sizeof(ULONG)))
+        {
+            return FALSE;
+        }
+        Names += sizeof(ULONG) + ALIGN_UP_BY(NameLength, sizeof(ULONG));
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+NTAPI
+CcPfPrefetchWorker(
+    IN PVOID Context)
+{
+    PCCPF_TRACE Trace = Context;
+    WCHAR PathBuffer[80];
+    UNICODE_STRING Path, Name;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_STANDARD_INFORMATION StandardInfo;
+    PPF_TRACE_HEADER Header = NULL;
+    PPF_LOG_ENTRY Entries;
+    PVOID ReadBuffer = NULL;
+    HANDLE Handle, FileHandle = NULL;
+    PUCHAR Names;
+    ULONG Size, i, FileKey, NameKey, FirstPage, LastPage;
+    NTSTATUS Status;
+
+    InterlockedIncrement(&CcPfGlobals.ActivePrefetches);
+
+    /* Read what was recorded the last time */
+    CcPfBuildTracePath(&Trace->ScenarioId, &Path, PathBuffer, sizeof(PathBuffer));
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &Path,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwOpenFile(&Handle,
+                        FILE_READ_DATA | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        FILE_SHARE_READ,
+                        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE);
+    if (!NT_SUCCESS(Status)) goto Done;
+
+    Status = ZwQueryInformationFile(Handle,
+                                    &IoStatusBlock,
+                                    &StandardInfo,
+                                    sizeof(StandardInfo),
+                                    FileStandardInformation);
+    if (!NT_SUCCESS(Status) ||
+        (StandardInfo.EndOfFile.QuadPart > CCPF_MAXIMUM_TRACE_SIZE))
+    {
+        ZwClose(Handle);
+        goto Done;
+    }
+
+    Size = StandardInfo.EndOfFile.LowPart;
+    Header = ExAllocatePoolWithTag(PagedPool, max(Size, 1), TAG_CC);
+    if (!Header)
+    {
+        ZwClose(Handle);
+        goto Done;
+    }
+
+    Status = ZwReadFile(Handle,
+                        NULL,
+                        NULL,
+                        NULL,
+                        &IoStatusBlock,
+                        Header,
+                        Size,
+                        NULL,
+                        NULL);
+    ZwClose(Handle);
+    if (!NT_SUCCESS(Status) ||
+        (IoStatusBlock.Information != Size) ||
+        !CcPfValidateTrace(Header, Size, &Trace->ScenarioId))
+    {
+        DPRINT1("Ignoring bad prefetch trace %wZ\n", &Path);
+        goto Done;
+    }
+
+    ReadBuffer = ExAllocatePoolWithTag(PagedPool, CCPF_READ_SIZE, TAG_CC);
+    if (!ReadBuffer) goto Done;
+
+    /*
+     * The entries are sorted by file, in the order the files were first
+     * faulted on, then by offset. Coalesce them into runs and read the runs.
+     */
+    Names = (PUCHAR)Header + Header->SectionInfoOffset;
+    Entries = (PPF_LOG_ENTRY)((PUCHAR)Header + Header->TraceBufferOffset);
+    FileKey = MAXULONG;
+    NameKey = 0;
+    FirstPage = LastPage = 0;
+    for (i = 0; i <= Header->NumEntries; i++)
+    {
+        /* Check if the current run goes on */
+        if ((i < Header->NumEntries) &&
+            (Entries[i].FileKey == FileKey) &&
+            (Entries[i].FileOffset >= FirstPage) &&
+            (Entries[i].FileOffset <= LastPage + CCPF_READ_GAP_PAGES))
+        {
+            LastPage = max(LastPage, Entries[i].FileOffset);
+            continue;
+        }
+
+        /* It doesn't, read it */
+        if (FileHandle) CcPfReadFileRun(FileHandle, ReadBuffer, FirstPage, LastPage);
+        if (i == Header->NumEntries) break;
+
+        /* Check if we also moved to another file */
+        if (Entries[i].FileKey != FileKey)
+        {
+            /* Find its name, skipping the files that had no entries */
+            FileHandle = NULL;
+            FileKey = Entries[i].FileKey;
+            if (FileKey >= Header->NumSections) break;
+            while (NameKey < FileKey)
+            {
+                Names += sizeof(ULONG) + ALIGN_UP_BY(*(PULONG)Names, sizeof(ULONG));
+                NameKey++;
+            }
+
+            /* Open the file and keep it open until the scenario is over */
+            Name.Length = Name.MaximumLength = (USHORT)*(PULONG)Names;
+            Name.Buffer = (PWCHAR)(Names + sizeof(ULONG));
+            if ((Name.Length) && (Trace->NumPrefetchHandles < CCPF_MAX_SECTIONS))
+            {
+                InitializeObjectAttributes(&ObjectAttributes,
+                                           &Name,
+                                           OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                           NULL,
+                                           NULL);
+                Status = ZwOpenFile(&FileHandle,
+                                    FILE_READ_DATA | SYNCHRONIZE,
+                                    &ObjectAttributes,
+                                    &IoStatusBlock,
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                    FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE);
+                if (NT_SUCCESS(Status))
+                {
+                    Trace->PrefetchHandles[Trace->NumPrefetchHandles++] = FileHandle;
+                }
+                else
+                {
+                    FileHandle = NULL;
+                }
+            }
+        }
+
+        FirstPage = LastPage = Entries[i].FileOffset;
+    }
+
+Done:
+    if (ReadBuffer) ExFreePoolWithTag(ReadBuffer, TAG_CC);
+    if (Header) ExFreePoolWithTag(Header, TAG_CC);
+    InterlockedDecrement(&CcPfGlobals.ActivePrefetches);
+    KeSetEvent(&Trace->PrefetchDoneEvent, IO_NO_INCREMENT, FALSE);
+}
+
+static
+int
+__cdecl
+CcPfCompareLogEntries(
+    const void *First,
+    const void *Second)
+{
+    const PF_LOG_ENTRY *Entry1 = First, *Entry2 = Second;
+
+    if (Entry1->FileKey != Entry2->FileKey)
+        return (Entry1->FileKey < Entry2->FileKey) ? -1 : 1;
+    if (Entry1->FileOffset != Entry2->FileOffset)
+        return (Entry1->FileOffset < Entry2->FileOffset) ? -1 : 1;
+    return 0;
+}
+
+static
+NTSTATUS
+CcPfWriteTrace(
+    IN PCCPF_TRACE Trace)
+{
+    POBJECT_NAME_INFORMATION NameInfo[CCPF_MAX_SECTIONS];
+    WCHAR PathBuffer[80];
+    UNICODE_STRING Path;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    PPF_TRACE_HEADER Header;
+    PUCHAR Names;
+    HANDLE Handle;
+    ULONG i, j, Size, NamesSize, Length;
+    NTSTATUS Status;
+
+    /* Sort the entries, and drop the pages that were faulted more than once */
+    qsort(Trace->Entries, Trace->NumEntries, sizeof(PF_LOG_ENTRY), CcPfCompareLogEntries);
+    for (i = 0, j = 0; i < Trace->NumEntries; i++)
+    {
+        if ((j) && !CcPfCompareLogEntries(&Trace->Entries[j - 1], &Trace->Entries[i])) continue;
+        Trace->Entries[j++] = Trace->Entries[i];
+    }
+    Trace->NumEntries = j;
+
+    /* Get the full name of the files, so we can open them again later */
+    NamesSize = 0;
+    for (i = 0; i < Trace->NumSections; i++)
+    {
+        NameInfo[i] = NULL;
+        Length = sizeof(OBJECT_NAME_INFORMATION) + 260 * sizeof(WCHAR);
+        NameInfo[i] = ExAllocatePoolWithTag(PagedPool, Length, TAG_CC);
+        if (NameInfo[i])
+        {
+            Status = ObQueryNameString(Trace->Sections[i].FileObject,
+                                       NameInfo[i],
+                                       Length,
+                                       &Length);
+            if (!NT_SUCCESS(Status))
+            {
+                ExFreePoolWithTag(NameInfo[i], TAG_CC);
+                NameInfo[i] = NULL;
+            }
+        }
+
+        NamesSize += sizeof(ULONG);
+        if (NameInfo[i]) NamesSize += ALIGN_UP_BY(NameInfo[i]->Name.Length, sizeof(ULONG));
+    }
+
+    /* Build the trace */
+    Size = sizeof(PF_TRACE_HEADER) + NamesSize + Trace->NumEntries * sizeof(PF_LOG_ENTRY);
+    Header = ExAllocatePoolWithTag(PagedPool, Size, TAG_CC);
+    if (!Header)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    RtlZeroMemory(Header, Size);
+    Header->Version = CCPF_TRACE_VERSION;
+    Header->MagicNumber = CCPF_TRACE_MAGIC_NUMBER;
+    Header->Size = Size;
+    Header->ScenarioId = Trace->ScenarioId;
+    Header->ScenarioType = Trace->ScenarioType;
+    Header->SectionInfoOffset = sizeof(PF_TRACE_HEADER);
+    Header->NumSections = Trace->NumSections;
+    Header->TraceBufferOffset = sizeof(PF_TRACE_HEADER) + NamesSize;
+    Header->NumEntries = Trace->NumEntries;
+    KeQuerySystemTime(&Header->LaunchTime);
+
+    Names = (PUCHAR)Header + Header->SectionInfoOffset;
+    for (i = 0; i < Trace->NumSections; i++)
+    {
+        /* Files we couldn't get the name of just won't be prefetched */
+        Length = NameInfo[i] ? NameInfo[i]->Name.Length : 0;
+        *(PULONG)Names = Length;
+        if (Length) RtlCopyMemory(Names + sizeof(ULONG), NameInfo[i]->Name.Buffer, Length);
+        Names += sizeof(ULONG) + ALIGN_UP_BY(Length, sizeof(ULONG));
+    }
+    RtlCopyMemory(Names, Trace->Entries, Trace->NumEntries * sizeof(PF_LOG_ENTRY));
+
+    /* Make sure the directory is there */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               (PUNICODE_STRING)&CcPfDirectory,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwCreateFile(&Handle,
+                          FILE_LIST_DIRECTORY | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatusBlock,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          FILE_OPEN_IF,
+                          FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                          NULL,
+                          0);
+    if (!NT_SUCCESS(Status)) goto Cleanup;
+    ZwClose(Handle);
+
+    /* And write the trace */
+    CcPfBuildTracePath(&Trace->ScenarioId, &Path, PathBuffer, sizeof(PathBuffer));
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &Path,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwCreateFile(&Handle,
+                          FILE_WRITE_DATA | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatusBlock,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          0,
+                          FILE_OVERWRITE_IF,
+                          FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                          NULL,
+                          0);
+    if (!NT_SUCCESS(Status)) goto Cleanup;
+
+    Status = ZwWriteFile(Handle,
+                         NULL,
+                         NULL,
+                         NULL,
+                         &IoStatusBlock,
+                         Header,
+                         Size,
+                         NULL,
+                         NULL);
+    ZwClose(Handle);
+
+Cleanup:
+    if (!NT_SUCCESS(Status)) DPRINT1("Failed to save prefetch trace: 0x%lx\n", Status);
+    if (Header) ExFreePoolWithTag(Header, TAG_CC);
+    for (i = 0; i < Trace->NumSections; i++)
+    {
+        if (NameInfo[i]) ExFreePoolWithTag(NameInfo[i], TAG_CC);
+    }
+    return Status;
+}
+
+static
+VOID
+NTAPI
+CcPfEndTraceWorker(
+    IN PVOID Context)
+{
+    PCCPF_TRACE Trace = Context;
+    KIRQL OldIrql;
+    ULONG i;
+
+    /* Stop logging */
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+    RemoveEntryList(&Trace->ActiveTracesLink);
+    if (CcPfGlobals.SystemWideTrace == (PPFSN_TRACE_HEADER)Trace) CcPfGlobals.SystemWideTrace = NULL;
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+
+    /* Wait for the prefetch to be done, and let go of the files it opened */
+    KeWaitForSingleObject(&Trace->PrefetchDoneEvent, Executive, KernelMode, FALSE, NULL);
+    for (i = 0; i < Trace->NumPrefetchHandles; i++) ZwClose(Trace->PrefetchHandles[i]);
+
+    /* Save what we recorded for the next time */
+    if (Trace->NumEntries) CcPfWriteTrace(Trace);
+
+    /* And clean up */
+    for (i = 0; i < Trace->NumSections; i++) ObDereferenceObject(Trace->Sections[i].FileObject);
+    if (Trace->Process) ObDereferenceObject(Trace->Process);
+    ExFreePoolWithTag(Trace, TAG_CC);
+    InterlockedDecrement(&CcPfNumActiveTraces);
+}
+
+static
+VOID
+NTAPI
+CcPfTraceTimerDpc(
+    IN PKDPC Dpc,
+    IN PVOID DeferredContext,
+    IN PVOID SystemArgument1,
+    IN PVOID SystemArgument2)
+{
+    PCCPF_TRACE Trace = DeferredContext;
+
+    /* Writing the trace needs a thread */
+    ExQueueWorkItem(&Trace->EndTraceWorkItem, DelayedWorkQueue);
+}
+
+static
+VOID
+CcPfBeginTrace(
+    IN PPF_SCENARIO_ID ScenarioId,
+    IN ULONG ScenarioType,
+    IN PEPROCESS Process,
+    IN ULONG MaxEntries,
+    IN ULONG TraceTime)
+{
+    PCCPF_TRACE Trace;
+    LARGE_INTEGER DueTime;
+    KIRQL OldIrql;
+
+    /* Don't let too many scenarios run at the same time */
+    if (InterlockedIncrement(&CcPfNumActiveTraces) > CCPF_MAX_ACTIVE_TRACES)
+    {
+        InterlockedDecrement(&CcPfNumActiveTraces);
+        return;
+    }
+
+    /* Faults are logged at raised IRQL, so this has to be nonpaged */
+    Trace = ExAllocatePoolWithTag(NonPagedPool,
+                                  FIELD_OFFSET(CCPF_TRACE, Entries[MaxEntries]),
+                                  TAG_CC);
+    if (!Trace)
+    {
+        InterlockedDecrement(&CcPfNumActiveTraces);
+        return;
+    }
+
+    RtlZeroMemory(Trace, FIELD_OFFSET(CCPF_TRACE, Entries));
+    Trace->ScenarioId = *ScenarioId;
+    Trace->ScenarioType = ScenarioType;
+    Trace->Process = Process;
+    if (Process) ObReferenceObject(Process);
+    Trace->MaxEntries = MaxEntries;
+    KeInitializeEvent(&Trace->PrefetchDoneEvent, NotificationEvent, FALSE);
+    ExInitializeWorkItem(&Trace->PrefetchWorkItem, CcPfPrefetchWorker, Trace);
+    ExInitializeWorkItem(&Trace->EndTraceWorkItem, CcPfEndTraceWorker, Trace);
+    KeInitializeDpc(&Trace->TraceTimerDpc, CcPfTraceTimerDpc, Trace);
+    KeInitializeTimer(&Trace->TraceTimer);
+
+    /* Start logging */
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+    InsertTailList(&CcPfGlobals.ActiveTraces, &Trace->ActiveTracesLink);
+    if (!Process && MaxEntries) CcPfGlobals.SystemWideTrace = (PPFSN_TRACE_HEADER)Trace;
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+
+    /* Prefetch what the previous run needed, and stop tracing in a while */
+    ExQueueWorkItem(&Trace->PrefetchWorkItem, DelayedWorkQueue);
+    DueTime.QuadPart = Int32x32To64(TraceTime, -10000000);
+    KeSetTimer(&Trace->TraceTimer, DueTime, &Trace->TraceTimerDpc);
+}
+
+static
+VOID
+CcPfLogToTrace(
+    IN PCCPF_TRACE Trace,
+    IN PFILE_OBJECT FileObject,
+    IN ULONG PageIndex,
+    IN ULONG Type)
+{
+    PPF_LOG_ENTRY Entry;
+    ULONG i;
+
+    if (Trace->NumEntries >= Trace->MaxEntries) return;
+
+    /* Look for the file, the most recent ones first */
+    for (i = Trace->NumSections; i > 0; i--)
+    {
+        if (Trace->Sections[i - 1].SectionObjectPointer == FileObject->SectionObjectPointer) break;
+    }
+
+    if (i == 0)
+    {
+        /* This is a new one */
+        if (Trace->NumSections >= CCPF_MAX_SECTIONS) return;
+        ObReferenceObject(FileObject);
+        Trace->Sections[Trace->NumSections].FileObject = FileObject;
+        Trace->Sections[Trace->NumSections].SectionObjectPointer = FileObject->SectionObjectPointer;
+        i = ++Trace->NumSections;
+    }
+
+    Entry = &Trace->Entries[Trace->NumEntries++];
+    Entry->FileOffset = PageIndex;
+    Entry->Type = Type;
+    Entry->FileKey = i - 1;
+}
+
+VOID
+NTAPI
+CcPfLogPageFault(
+    IN PFILE_OBJECT FileObject,
+    IN LONGLONG FileOffset,
+    IN BOOLEAN ImageSection)
+{
+    PLIST_ENTRY ListEntry;
+    PCCPF_TRACE Trace;
+    PEPROCESS Process;
+    KIRQL OldIrql;
+
+    /* Nothing to do when nobody is tracing */
+    if (IsListEmpty(&CcPfGlobals.ActiveTraces)) return;
+
+    /* Offsets are logged in pages */
+    if ((FileOffset >> PAGE_SHIFT) >= (1 << 30)) return;
+
+    Process = PsGetCurrentProcess();
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+    for (ListEntry = CcPfGlobals.ActiveTraces.Flink;
+         ListEntry != &CcPfGlobals.ActiveTraces;
+         ListEntry = ListEntry->Flink)
+    {
+        /* The boot trace gets faults from everybody */
+        Trace = CONTAINING_RECORD(ListEntry, CCPF_TRACE, ActiveTracesLink);
+        if ((Trace->Process) && (Trace->Process != Process)) continue;
+
+        CcPfLogToTrace(Trace,
+                       FileObject,
+                       (ULONG)(FileOffset >> PAGE_SHIFT),
+                       ImageSection ? CCPF_LOG_ENTRY_IMAGE : CCPF_LOG_ENTRY_DATA);
+    }
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+}
+
+NTSTATUS
+NTAPI
+CcPfBeginBootPhase(
+    IN ULONG Phase)
+{
+    PF_SCENARIO_ID ScenarioId;
+
+    /* We only have a single boot scenario, started before the session manager */
+    if (Phase != CCPF_BOOT_PHASE_SMSS_INIT) return STATUS_SUCCESS;
+    if (!(CcPfEnablePrefetcher & CCPF_ENABLE_BOOT)) return STATUS_SUCCESS;
+
+    RtlZeroMemory(&ScenarioId, sizeof(ScenarioId));
+    wcscpy(ScenarioId.ScenName, L"NTOSBOOT");
+    ScenarioId.HashId = CCPF_BOOT_SCENARIO_HASH;
+    CcPfBeginTrace(&ScenarioId,
+                   CCPF_SCENARIO_BOOT,
+                   NULL,
+                   CCPF_MAX_BOOT_ENTRIES,
+                   CCPF_BOOT_TRACE_TIME);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+CcPfBeginAppLaunch(
+    IN PEPROCESS Process)
+{
+    PF_SCENARIO_ID ScenarioId;
+    PUNICODE_STRING ImagePath;
+    ULONG i, Hash;
+
+    if (!(CcPfEnablePrefetcher & CCPF_ENABLE_APP_LAUNCH)) return;
+
+    /* Only trace the launch once per process */
+    if (PspSetProcessFlag(Process, PSF_LAUNCH_PREFETCHED_BIT) & PSF_LAUNCH_PREFETCHED_BIT) return;
+
+    /* The scenario is named after the image */
+    RtlZeroMemory(&ScenarioId, sizeof(ScenarioId));
+    for (i = 0; (i < sizeof(Process->ImageFileName)) && (Process->ImageFileName[i]); i++)
+    {
+        ScenarioId.ScenName[i] = RtlUpcaseUnicodeChar((WCHAR)(UCHAR)Process->ImageFileName[i]);
+    }
+    if (!i) return;
+
+    /* And told apart by the full path of the image */
+    Hash = 0;
+    if (Process->SeAuditProcessCreationInfo.ImageFileName)
+    {
+        ImagePath = &Process->SeAuditProcessCreationInfo.ImageFileName->Name;
+        for (i = 0; i < ImagePath->Length / sizeof(WCHAR); i++)
+        {
+            Hash = Hash * 65599 + RtlUpcaseUnicodeChar(ImagePath->Buffer[i]);
+        }
+    }
+    ScenarioId.HashId = Hash;
+
+    CcPfBeginTrace(&ScenarioId,
+                   CCPF_SCENARIO_APP_LAUNCH,
+                   Process,
+                   CCPF_MAX_APP_ENTRIES,
+                   CCPF_APP_TRACE_TIME);
+}
+
+VOID
+NTAPI
+CcPfBeginLogon(
+    IN ULONG UserHash,
+    IN BOOLEAN Trace)
+{
+    PF_SCENARIO_ID ScenarioId;
+
+    /* Logon is the end of the boot, it goes with it */
+    if (!(CcPfEnablePrefetcher & CCPF_ENABLE_BOOT)) return;
+
+    /* Winlogon tells the users apart */
+    RtlZeroMemory(&ScenarioId, sizeof(ScenarioId));
+    wcscpy(ScenarioId.ScenName, L"LOGON");
+    ScenarioId.HashId = UserHash;
+
+    /* Without tracing, this only warms the cache until the user logs on */
+    if (Trace)
+    {
+        CcPfBeginTrace(&ScenarioId,
+                       CCPF_SCENARIO_LOGON,
+                       NULL,
+                       CCPF_MAX_LOGON_ENTRIES,
+                       CCPF_LOGON_TRACE_TIME);
+    }
+    else
+    {
+        CcPfBeginTrace(&ScenarioId,
+                       CCPF_SCENARIO_LOGON,
+                       NULL,
+                       0,
+                       CCPF_LOGON_PREFETCH_TIME);
+    }
+}
+
+/* EOF */
@@ -43,7 +43,25 @@
 /* GLOBALS *******************************************************************/
 
 LIST_ENTRY DirtyVacbListHead;
+
+/*
+ * The LRU list is split in two, as in 2Q: views start in the probation list
+ * and only move to the protected one when they're used again. Trimming takes
+ * from the probation list first, so that a big scan through a file can't
+ * push out the views which are actually reused. Both are protected by the
+ * ViewLock.
+ */
 static LIST_ENTRY VacbLruListHead;
+static LIST_ENTRY VacbProtectedListHead;
+static ULONG VacbLruCount;
+static ULONG VacbProtectedCount;
+
+/* The protected list never gets more than three quarters of the views */
+#define VACB_PROTECTED_SHARE(Count) ((Count) - (Count) / 4)
+
+/* Uses closer than one second to the first one are part of the same access
+ * (such as a sequential read going through the view) and don't count */
+#define VACB_CORRELATED_USE_PERIOD (1000 * 1000 * 10)
 
 KGUARDED_MUTEX ViewLock;
 
@@ -60,6 +78,7 @@ static NPAGED_LOOKASIDE_LIST VacbLookasideList;
  */
 ULONG CcDirtyPageThreshold = 0;
 ULONG CcTotalDirtyPages = 0;
+ULONG CcMaxFlushRun = VACB_MAX_FLUSH_RUN;
 LIST_ENTRY CcDeferredWrites;
 KSPIN_LOCK CcDeferredWriteSpinLock;
 LIST_ENTRY CcCleanSharedCacheMapList;
@@ -177,6 +196,206 @@ CcRosFlushVacb (
     return Status;
 }
 
+/* Called with the ViewLock held */
+static
+VOID
+CcRosInsertVacbInLru (
+    PROS_VACB Vacb)
+{
+    Vacb->Protected = FALSE;
+    Vacb->FirstUseTime = KeQueryInterruptTime();
+    InsertTailList(&VacbLruListHead, &Vacb->VacbLruListEntry);
+    VacbLruCount++;
+}
+
+/* Called with the ViewLock held */
+VOID
+CcRosRemoveVacbFromLru (
+    PROS_VACB Vacb)
+{
+    if (IsListEmpty(&Vacb->VacbLruListEntry))
+        return;
+
+    RemoveEntryList(&Vacb->VacbLruListEntry);
+    InitializeListHead(&Vacb->VacbLruListEntry);
+
+    ASSERT(VacbLruCount > 0);
+    VacbLruCount--;
+    if (Vacb->Protected)
+    {
+        ASSERT(VacbProtectedCount > 0);
+        VacbProtectedCount--;
+        Vacb->Protected = FALSE;
+    }
+}
+
+/*
+ * Called with the ViewLock held when a view is used again. It gets protected
+ * if that's a new use of it, unless its file is only read sequentially: such
+ * views are used once and are left where they are to age out first.
+ */
+static
+VOID
+CcRosTouchVacb (
+    PROS_VACB Vacb)
+{
+    PLIST_ENTRY current_entry;
+    PROS_VACB current;
+
+    if (IsListEmpty(&Vacb->VacbLruListEntry))
+        return;
+
+    if (Vacb->Protected)
+    {
+        RemoveEntryList(&Vacb->VacbLruListEntry);
+        InsertTailList(&VacbProtectedListHead, &Vacb->VacbLruListEntry);
+        return;
+    }
+
+    if (BooleanFlagOn(Vacb->SharedCacheMap->Flags, CACHE_USE_ONCE))
+        return;
+
+    /* Read ahead isn't a use, and neither is going on with the first one */
+    if (Vacb->ReadAhead ||
+        KeQueryInterruptTime() - Vacb->FirstUseTime < VACB_CORRELATED_USE_PERIOD)
+        return;
+
+    RemoveEntryList(&Vacb->VacbLruListEntry);
+    InsertTailList(&VacbProtectedListHead, &Vacb->VacbLruListEntry);
+    Vacb->Protected = TRUE;
+    VacbProtectedCount++;
+
+    /* Keep room for probation, the oldest protected view goes back there */
+    if (VacbProtectedCount > VACB_PROTECTED_SHARE(VacbLruCount))
+    {
+        current_entry = RemoveHeadList(&VacbProtectedListHead);
+        current = CONTAINING_RECORD(current_entry,
+                                    ROS_VACB,
+                                    VacbLruListEntry);
+        InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
+        current->Protected = FALSE;
+        VacbProtectedCount--;
+    }
+}
+
+/* Called with the ViewLock held */
+static
+VOID
+CcRosRefreshVacb (
+    PROS_VACB Vacb)
+{
+    if (IsListEmpty(&Vacb->VacbLruListEntry))
+        return;
+
+    RemoveEntryList(&Vacb->VacbLruListEntry);
+    InsertTailList(Vacb->Protected ? &VacbProtectedListHead : &VacbLruListHead,
+                   &Vacb->VacbLruListEntry);
+}
+
+static
+NTSTATUS
+CcRosFlushVacbs (
+    PROS_VACB *Vacbs,
+    ULONG Count)
+{
+    NTSTATUS Status;
+    ULONG i;
+
+    Status = CcWriteVirtualAddresses(Vacbs, Count);
+    if (NT_SUCCESS(Status))
+    {
+        for (i = 0; i < Count; i++)
+        {
+            CcRosUnmarkDirtyVacb(Vacbs[i], TRUE);
+        }
+    }
+
+    return Status;
+}
+
+/* References Vacb if it's dirty and no one else is using it */
+static
+BOOLEAN
+CcRosReferenceFlushableVacb (
+    PROS_VACB Vacb)
+{
+    if (Vacb == NULL || !Vacb->Dirty)
+        return FALSE;
+
+    CcRosVacbIncRefCount(Vacb);
+
+    /* Same rule as in CcRosFlushDirtyPages */
+    if (CcRosVacbGetRefCount(Vacb) > 2)
+    {
+        CcRosVacbDecRefCount(Vacb);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Gathers the dirty views around Vacb (which must already be referenced)
+ * that can be written along with it, in file order: up to MaxBefore views
+ * before it and none past EndOffset. Each of them gets a reference.
+ * Called with the ViewLock held, returns the number of views.
+ */
+static
+ULONG
+CcRosGetFlushRun (
+    PROS_VACB Vacb,
+    ULONG MaxBefore,
+    LONGLONG EndOffset,
+    PROS_VACB *Run)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_VACB Before[VACB_MAX_FLUSH_RUN / 2];
+    PROS_VACB Next;
+    LONGLONG Offset;
+    ULONG Count, BeforeCount;
+    KIRQL oldIrql;
+
+    SharedCacheMap = Vacb->SharedCacheMap;
+    MaxBefore = min(MaxBefore, CcMaxFlushRun / 2);
+    EndOffset = min(EndOffset, SharedCacheMap->SectionSize.QuadPart);
+
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
+
+    /* Walk back to the start of the run... */
+    BeforeCount = 0;
+    Offset = Vacb->FileOffset.QuadPart;
+    while (BeforeCount < MaxBefore && Offset >= VACB_MAPPING_GRANULARITY)
+    {
+        Offset -= VACB_MAPPING_GRANULARITY;
+        Next = CcRosLookupVacbIndex(SharedCacheMap, Offset);
+        if (!CcRosReferenceFlushableVacb(Next))
+            break;
+        Before[BeforeCount++] = Next;
+    }
+
+    /* ...then go forward from there */
+    Count = 0;
+    while (BeforeCount > 0)
+        Run[Count++] = Before[--BeforeCount];
+    Run[Count++] = Vacb;
+
+    Offset = Vacb->FileOffset.QuadPart;
+    while (Count < CcMaxFlushRun)
+    {
+        Offset += VACB_MAPPING_GRANULARITY;
+        if (Offset >= EndOffset)
+            break;
+        Next = CcRosLookupVacbIndex(SharedCacheMap, Offset);
+        if (!CcRosReferenceFlushableVacb(Next))
+            break;
+        Run[Count++] = Next;
+    }
+
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+
+    return Count;
+}
+
 NTSTATUS
 NTAPI
 CcRosFlushDirtyPages (
@@ -187,6 +406,8 @@ CcRosFlushDirtyPages (
 {
     PLIST_ENTRY current_entry;
     PROS_VACB current;
+    PROS_VACB Run[VACB_MAX_FLUSH_RUN];
+    ULONG RunCount, i;
     BOOLEAN Locked;
     NTSTATUS Status;
 
@@ -239,15 +460,21 @@ CcRosFlushDirtyPages (
             continue;
         }
 
+        /* Write it along with the dirty views around it, in a single write */
+        RunCount = CcRosGetFlushRun(current, MAXULONG, MAXLONGLONG, Run);
+
         KeReleaseGuardedMutex(&ViewLock);
 
-        Status = CcRosFlushVacb(current);
+        Status = CcRosFlushVacbs(Run, RunCount);
 
         current->SharedCacheMap->Callbacks->ReleaseFromLazyWrite(
             current->SharedCacheMap->LazyWriteContext);
 
         KeAcquireGuardedMutex(&ViewLock);
-        CcRosVacbDecRefCount(current);
+        for (i = 0; i < RunCount; i++)
+        {
+            CcRosVacbDecRefCount(Run[i]);
+        }
 
         if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE) &&
             (Status != STATUS_MEDIA_WRITE_PROTECTED))
@@ -259,9 +486,16 @@ CcRosFlushDirtyPages (
             ULONG PagesFreed;
 
             /* How many pages did we free? */
-            PagesFreed = VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+            PagesFreed = RunCount * (VACB_MAPPING_GRANULARITY / PAGE_SIZE);
             (*Count) += PagesFreed;
 
+            /* Lazy writer runs can be concurrent, update its stats here */
+            if (CalledFromLazy)
+            {
+                CcAddPerformanceCounter(LazyWritePages, PagesFreed);
+                CcIncrementPerformanceCounter(LazyWriteIos);
+            }
+
             /* Make sure we don't overflow target! */
             if (Target < PagesFreed)
             {
@@ -306,6 +540,7 @@ CcRosTrimCache (
     PFN_NUMBER Page;
     ULONG i;
     BOOLEAN FlushedPages = FALSE;
+    PLIST_ENTRY ListHead;
 
     DPRINT("CcRosTrimCache(Target %lu)\n", Target);
 
@@ -316,8 +551,11 @@ CcRosTrimCache (
 retry:
     KeAcquireGuardedMutex(&ViewLock);
 
-    current_entry = VacbLruListHead.Flink;
-    while (current_entry != &VacbLruListHead)
+    /* Views on probation go first, protected ones only if that's not enough */
+    ListHead = &VacbLruListHead;
+next_list:
+    current_entry = ListHead->Flink;
+    while (current_entry != ListHead && Target > 0)
     {
         ULONG Refs;
 
@@ -362,8 +600,8 @@ retry:
             ASSERT(Refs == 1);
 
             RemoveEntryList(&current->CacheMapVacbListEntry);
-            RemoveEntryList(&current->VacbLruListEntry);
-            InitializeListHead(&current->VacbLruListEntry);
+            CcRosRemoveVacbFromIndex(current);
+            CcRosRemoveVacbFromLru(current);
             InsertHeadList(&FreeList, &current->CacheMapVacbListEntry);
 
             /* Calculate how many pages we freed for Mm */
@@ -375,6 +613,12 @@ retry:
         KeReleaseSpinLock(&current->SharedCacheMap->CacheMapLock, oldIrql);
     }
 
+    if (Target > 0 && ListHead == &VacbLruListHead)
+    {
+        ListHead = &VacbProtectedListHead;
+        goto next_list;
+    }
+
     KeReleaseGuardedMutex(&ViewLock);
 
     /* Try flushing pages if we haven't met our target */
@@ -450,6 +694,148 @@ CcRosReleaseVacb (
     return STATUS_SUCCESS;
 }
 
+/*
+ * The VACB index is a two level sparse array: VacbIndex points to blocks of
+ * VACB_INDEX_BLOCK_SIZE slots, each slot being the VACB for one view of the
+ * file, if any. Blocks are only allocated for the parts of the file that have
+ * been mapped. All of this is protected by the CacheMapLock.
+ */
+static
+PROS_VACB *
+CcRosGetVacbIndexSlot (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset,
+    BOOLEAN Create)
+{
+    ULONGLONG View;
+    ULONG Block, NewSize;
+    PROS_VACB **NewIndex;
+
+    View = FileOffset / VACB_MAPPING_GRANULARITY;
+    if ((View >> VACB_INDEX_BLOCK_SHIFT) >= MAXULONG / sizeof(PROS_VACB *) / 2)
+        return NULL;
+    Block = (ULONG)(View >> VACB_INDEX_BLOCK_SHIFT);
+
+    /* Grow the top level, if needed */
+    if (Block >= SharedCacheMap->VacbIndexSize)
+    {
+        if (!Create)
+            return NULL;
+
+        NewSize = max(Block + 1, SharedCacheMap->VacbIndexSize * 2);
+        NewIndex = ExAllocatePoolWithTag(NonPagedPool, NewSize * sizeof(PROS_VACB *), TAG_VACB_INDEX);
+        if (NewIndex == NULL)
+            return NULL;
+
+        RtlZeroMemory(NewIndex, NewSize * sizeof(PROS_VACB *));
+        if (SharedCacheMap->VacbIndex != NULL)
+        {
+            RtlCopyMemory(NewIndex,
+                          SharedCacheMap->VacbIndex,
+                          SharedCacheMap->VacbIndexSize * sizeof(PROS_VACB *));
+            ExFreePoolWithTag(SharedCacheMap->VacbIndex, TAG_VACB_INDEX);
+        }
+        SharedCacheMap->VacbIndex = NewIndex;
+        SharedCacheMap->VacbIndexSize = NewSize;
+    }
+
+    /* And allocate the block */
+    if (SharedCacheMap->VacbIndex[Block] == NULL)
+    {
+        if (!Create)
+            return NULL;
+
+        SharedCacheMap->VacbIndex[Block] = ExAllocatePoolWithTag(NonPagedPool,
+                                                                 VACB_INDEX_BLOCK_SIZE * sizeof(PROS_VACB),
+                                                                 TAG_VACB_INDEX);
+        if (SharedCacheMap->VacbIndex[Block] == NULL)
+            return NULL;
+
+        RtlZeroMemory(SharedCacheMap->VacbIndex[Block], VACB_INDEX_BLOCK_SIZE * sizeof(PROS_VACB));
+    }
+
+    return &SharedCacheMap->VacbIndex[Block][View & (VACB_INDEX_BLOCK_SIZE - 1)];
+}
+
+/* Returns the closest VACB before FileOffset, to keep the VACB list sorted */
+static
+PROS_VACB
+CcRosGetPreviousIndexedVacb (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset)
+{
+    ULONGLONG View;
+    ULONG Block;
+
+    View = FileOffset / VACB_MAPPING_GRANULARITY;
+    while (View-- > 0)
+    {
+        Block = (ULONG)(View >> VACB_INDEX_BLOCK_SHIFT);
+        if (Block >= SharedCacheMap->VacbIndexSize)
+        {
+            View = (ULONGLONG)SharedCacheMap->VacbIndexSize << VACB_INDEX_BLOCK_SHIFT;
+            continue;
+        }
+
+        /* Skip whole blocks that were never allocated */
+        if (SharedCacheMap->VacbIndex[Block] == NULL)
+        {
+            View &= ~(ULONGLONG)(VACB_INDEX_BLOCK_SIZE - 1);
+            continue;
+        }
+
+        if (SharedCacheMap->VacbIndex[Block][View & (VACB_INDEX_BLOCK_SIZE - 1)] != NULL)
+            return SharedCacheMap->VacbIndex[Block][View & (VACB_INDEX_BLOCK_SIZE - 1)];
+    }
+
+    return NULL;
+}
+
+/* Must be called with the CacheMapLock held */
+PROS_VACB
+CcRosLookupVacbIndex (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset)
+{
+    PROS_VACB *Slot;
+
+    Slot = CcRosGetVacbIndexSlot(SharedCacheMap, FileOffset, FALSE);
+    return (Slot != NULL) ? *Slot : NULL;
+}
+
+/* Must be called with the CacheMapLock held */
+VOID
+CcRosRemoveVacbFromIndex (
+    PROS_VACB Vacb)
+{
+    PROS_VACB *Slot;
+
+    Slot = CcRosGetVacbIndexSlot(Vacb->SharedCacheMap, Vacb->FileOffset.QuadPart, FALSE);
+    ASSERT(Slot != NULL && *Slot == Vacb);
+    if (Slot != NULL)
+        *Slot = NULL;
+}
+
+static
+VOID
+CcRosFreeVacbIndex (
+    PROS_SHARED_CACHE_MAP SharedCacheMap)
+{
+    ULONG i;
+
+    for (i = 0; i < SharedCacheMap->VacbIndexSize; i++)
+    {
+        if (SharedCacheMap->VacbIndex[i] != NULL)
+            ExFreePoolWithTag(SharedCacheMap->VacbIndex[i], TAG_VACB_INDEX);
+    }
+
+    if (SharedCacheMap->VacbIndex != NULL)
+        ExFreePoolWithTag(SharedCacheMap->VacbIndex, TAG_VACB_INDEX);
+
+    SharedCacheMap->VacbIndex = NULL;
+    SharedCacheMap->VacbIndexSize = 0;
+}
+
 /* Returns with VACB Lock Held! */
 PROS_VACB
 NTAPI
@@ -457,7 +843,6 @@ CcRosLookupVacb (
     PROS_SHARED_CACHE_MAP SharedCacheMap,
     LONGLONG FileOffset)
 {
-    PLIST_ENTRY current_entry;
     PROS_VACB current;
     KIRQL oldIrql;
 
@@ -469,32 +854,126 @@ CcRosLookupVacb (
     KeAcquireGuardedMutex(&ViewLock);
     KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
 
+    current = CcRosLookupVacbIndex(SharedCacheMap, FileOffset);
+    if (current != NULL)
+    {
+        ASSERT(IsPointInRange(current->FileOffset.QuadPart,
+                              VACB_MAPPING_GRANULARITY,
+                              FileOffset));
+        CcRosVacbIncRefCount(current);
+    }
+
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+    KeReleaseGuardedMutex(&ViewLock);
+
+    return current;
+}
+
+/*
+ * Finds the VACB mapping Address. It doesn't get referenced: the caller
+ * must already hold a reference to it, as MDL users do.
+ */
+PROS_VACB
+NTAPI
+CcRosLookupVacbByAddress (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PVOID Address)
+{
+    PLIST_ENTRY current_entry;
+    PROS_VACB current;
+    KIRQL oldIrql;
+
+    ASSERT(SharedCacheMap);
+
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
+
     current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
     while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
     {
         current = CONTAINING_RECORD(current_entry,
                                     ROS_VACB,
                                     CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
+        if (IsPointInRange((ULONG_PTR)current->BaseAddress,
                            VACB_MAPPING_GRANULARITY,
-                           FileOffset))
+                           (ULONG_PTR)Address))
         {
-            CcRosVacbIncRefCount(current);
             KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-            KeReleaseGuardedMutex(&ViewLock);
             return current;
         }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
         current_entry = current_entry->Flink;
     }
 
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-    KeReleaseGuardedMutex(&ViewLock);
 
     return NULL;
 }
 
+/*
+ * Reports how much of a file is in the cache: the bytes of its valid views
+ * and, among them, the bytes of the dirty ones. Everything is zero if the
+ * file isn't cached.
+ */
+VOID
+NTAPI
+CcRosQueryCacheResidency (
+    PSECTION_OBJECT_POINTERS SectionObjectPointers,
+    PLONGLONG FileSize,
+    PLONGLONG ResidentBytes,
+    PLONGLONG DirtyBytes,
+    PULONG ViewCount)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PLIST_ENTRY current_entry;
+    PROS_VACB current;
+    LONGLONG ViewSize;
+    KIRQL oldIrql;
+
+    *FileSize = 0;
+    *ResidentBytes = 0;
+    *DirtyBytes = 0;
+    *ViewCount = 0;
+
+    if (SectionObjectPointers == NULL)
+        return;
+
+    /* The ViewLock keeps the shared cache map around */
+    KeAcquireGuardedMutex(&ViewLock);
+
+    SharedCacheMap = SectionObjectPointers->SharedCacheMap;
+    if (SharedCacheMap != NULL)
+    {
+        KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
+
+        *FileSize = SharedCacheMap->FileSize.QuadPart;
+
+        current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
+        while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+        {
+            current = CONTAINING_RECORD(current_entry,
+                                        ROS_VACB,
+                                        CacheMapVacbListEntry);
+            current_entry = current_entry->Flink;
+
+            (*ViewCount)++;
+
+            if (!current->Valid ||
+                current->FileOffset.QuadPart >= SharedCacheMap->FileSize.QuadPart)
+                continue;
+
+            /* Don't count what lies past the end of file */
+            ViewSize = min(SharedCacheMap->FileSize.QuadPart - current->FileOffset.QuadPart,
+                           VACB_MAPPING_GRANULARITY);
+            *ResidentBytes += ViewSize;
+            if (current->Dirty)
+                *DirtyBytes += ViewSize;
+        }
+
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+    }
+
+    KeReleaseGuardedMutex(&ViewLock);
+}
+
 VOID
 NTAPI
 CcRosMarkDirtyVacb (
@@ -515,20 +994,20 @@ CcRosMarkDirtyVacb (
     Vacb->SharedCacheMap->DirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
     CcRosVacbIncRefCount(Vacb);
 
-    /* Move to the tail of the LRU list */
-    RemoveEntryList(&Vacb->VacbLruListEntry);
-    InsertTailList(&VacbLruListHead, &Vacb->VacbLruListEntry);
+    /* Move to the tail of its LRU list */
+    CcRosRefreshVacb(Vacb);
 
     Vacb->Dirty = TRUE;
 
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
     KeReleaseGuardedMutex(&ViewLock);
 
-    /* Schedule a lazy writer run to now that we have dirty VACB */
+    /* Schedule a lazy writer run to now that we have dirty VACB,
+     * right away if writers are getting ahead of it */
     oldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
     if (!LazyWriter.ScanActive)
     {
-        CcScheduleLazyWriteScan(FALSE);
+        CcScheduleLazyWriteScan(CcIsDirtyPageBacklogHigh());
     }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
 }
@@ -702,7 +1181,7 @@ CcRosCreateVacb (
 {
     PROS_VACB current;
     PROS_VACB previous;
-    PLIST_ENTRY current_entry;
+    PROS_VACB *Slot;
     NTSTATUS Status;
     KIRQL oldIrql;
     ULONG Refs;
@@ -722,6 +1201,7 @@ CcRosCreateVacb (
     current->Valid = FALSE;
     current->Dirty = FALSE;
     current->PageOut = FALSE;
+    current->ReadAhead = FALSE;
     current->FileOffset.QuadPart = ROUND_DOWN(FileOffset, VACB_MAPPING_GRANULARITY);
     current->SharedCacheMap = SharedCacheMap;
 #if DBG
@@ -756,48 +1236,45 @@ CcRosCreateVacb (
      * our newly created VACB and return the existing one.
      */
     KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    previous = NULL;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    Slot = CcRosGetVacbIndexSlot(SharedCacheMap, FileOffset, TRUE);
+    if (Slot == NULL)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-#if DBG
-            if (SharedCacheMap->Trace)
-            {
-                DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
-                        SharedCacheMap,
-                        (*Vacb),
-                        current);
-            }
-#endif
-            KeReleaseGuardedMutex(&ViewLock);
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+        KeReleaseGuardedMutex(&ViewLock);
 
-            Refs = CcRosVacbDecRefCount(*Vacb);
-            ASSERT(Refs == 0);
+        Refs = CcRosVacbDecRefCount(*Vacb);
+        ASSERT(Refs == 0);
 
-            *Vacb = current;
-            return STATUS_SUCCESS;
-        }
-        if (current->FileOffset.QuadPart < FileOffset)
+        *Vacb = NULL;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    current = *Slot;
+    if (current != NULL)
+    {
+        CcRosVacbIncRefCount(current);
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+#if DBG
+        if (SharedCacheMap->Trace)
         {
-            ASSERT(previous == NULL ||
-                   previous->FileOffset.QuadPart < current->FileOffset.QuadPart);
-            previous = current;
+            DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
+                    SharedCacheMap,
+                    (*Vacb),
+                    current);
         }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+#endif
+        KeReleaseGuardedMutex(&ViewLock);
+
+        Refs = CcRosVacbDecRefCount(*Vacb);
+        ASSERT(Refs == 0);
+
+        *Vacb = current;
+        return STATUS_SUCCESS;
     }
     /* There was no existing VACB. */
     current = *Vacb;
+    *Slot = current;
+    previous = CcRosGetPreviousIndexedVacb(SharedCacheMap, FileOffset);
     if (previous)
     {
         InsertHeadList(&previous->CacheMapVacbListEntry, &current->CacheMapVacbListEntry);
@@ -807,7 +1284,7 @@ CcRosCreateVacb (
         InsertHeadList(&SharedCacheMap->CacheMapVacbListHead, &current->CacheMapVacbListEntry);
     }
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-    InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
+    CcRosInsertVacbInLru(current);
     KeReleaseGuardedMutex(&ViewLock);
 
     MI_SET_USAGE(MI_USAGE_CACHE);
@@ -868,17 +1345,16 @@ CcRosGetVacb (
             return Status;
         }
     }
+    else
+    {
+        /* It's used again, see whether it should be protected */
+        KeAcquireGuardedMutex(&ViewLock);
+        CcRosTouchVacb(current);
+        KeReleaseGuardedMutex(&ViewLock);
+    }
 
     Refs = CcRosVacbGetRefCount(current);
 
-    KeAcquireGuardedMutex(&ViewLock);
-
-    /* Move to the tail of the LRU list */
-    RemoveEntryList(&current->VacbLruListEntry);
-    InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
-
-    KeReleaseGuardedMutex(&ViewLock);
-
     /*
      * Return information about the VACB to the caller.
      */
@@ -998,6 +1474,8 @@ CcFlushCache (
     LARGE_INTEGER Offset;
     LONGLONG RemainingLength;
     PROS_VACB current;
+    PROS_VACB Run[VACB_MAX_FLUSH_RUN];
+    ULONG RunCount, i;
     NTSTATUS Status;
 
     CCTRACE(CC_API_DEBUG, "SectionObjectPointers=%p FileOffset=%p Length=%lu\n",
@@ -1029,23 +1507,43 @@ CcFlushCache (
 
         while (RemainingLength > 0)
         {
+            RunCount = 1;
             current = CcRosLookupVacb(SharedCacheMap, Offset.QuadPart);
             if (current != NULL)
             {
                 if (current->Dirty)
                 {
-                    Status = CcRosFlushVacb(current);
+                    /* Take the unused dirty views that follow in the range
+                     * along, so that they make a single write */
+                    KeAcquireGuardedMutex(&ViewLock);
+                    RunCount = CcRosGetFlushRun(current,
+                                                0,
+                                                Offset.QuadPart + RemainingLength,
+                                                Run);
+                    KeReleaseGuardedMutex(&ViewLock);
+
+                    Status = CcRosFlushVacbs(Run, RunCount);
                     if (!NT_SUCCESS(Status) && IoStatus != NULL)
                     {
                         IoStatus->Status = Status;
                     }
+
+                    if (RunCount > 1)
+                    {
+                        KeAcquireGuardedMutex(&ViewLock);
+                        for (i = 1; i < RunCount; i++)
+                        {
+                            CcRosVacbDecRefCount(Run[i]);
+                        }
+                        KeReleaseGuardedMutex(&ViewLock);
+                    }
                 }
 
                 CcRosReleaseVacb(SharedCacheMap, current, current->Valid, current->Dirty, FALSE);
             }
 
-            Offset.QuadPart += VACB_MAPPING_GRANULARITY;
-            RemainingLength -= min(RemainingLength, VACB_MAPPING_GRANULARITY);
+            Offset.QuadPart += (LONGLONG)RunCount * VACB_MAPPING_GRANULARITY;
+            RemainingLength -= min(RemainingLength, (LONGLONG)RunCount * VACB_MAPPING_GRANULARITY);
         }
     }
     else
@@ -1094,11 +1592,11 @@ CcRosDeleteFileCache (
         while (!IsListEmpty(&SharedCacheMap->CacheMapVacbListHead))
         {
             current_entry = RemoveTailList(&SharedCacheMap->CacheMapVacbListHead);
+            current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
+            CcRosRemoveVacbFromIndex(current);
             KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
 
-            current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
-            RemoveEntryList(&current->VacbLruListEntry);
-            InitializeListHead(&current->VacbLruListEntry);
+            CcRosRemoveVacbFromLru(current);
             if (current->Dirty)
             {
                 KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
@@ -1164,6 +1662,7 @@ CcRosDeleteFileCache (
         RemoveEntryList(&SharedCacheMap->SharedCacheMapLinks);
         KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
+        CcRosFreeVacbIndex(SharedCacheMap);
         ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
         KeAcquireGuardedMutex(&ViewLock);
     }
@@ -1384,6 +1883,16 @@ CcRosInitializeFileCache (
 
         FileObject->PrivateCacheMap = PrivateMap;
         SharedCacheMap->OpenCount++;
+
+        /* Views of a file only ever read sequentially are used once */
+        if (!BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+        {
+            ClearFlag(SharedCacheMap->Flags, CACHE_USE_ONCE);
+        }
+        else if (Allocated)
+        {
+            SetFlag(SharedCacheMap->Flags, CACHE_USE_ONCE);
+        }
     }
     KeReleaseGuardedMutex(&ViewLock);
 
@@ -1419,8 +1928,15 @@ CcInitView (
 {
     DPRINT("CcInitView()\n");
 
+    /* The registry may only lower the flush run length */
+    if (CcMaxFlushRun == 0 || CcMaxFlushRun > VACB_MAX_FLUSH_RUN)
+    {
+        CcMaxFlushRun = VACB_MAX_FLUSH_RUN;
+    }
+
     InitializeListHead(&DirtyVacbListHead);
     InitializeListHead(&VacbLruListHead);
+    InitializeListHead(&VacbProtectedListHead);
     InitializeListHead(&CcDeferredWrites);
     InitializeListHead(&CcCleanSharedCacheMapList);
     KeInitializeSpinLock(&CcDeferredWriteSpinLock);
@@ -1521,6 +2037,8 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
 BOOLEAN
 ExpKdbgExtDefWrites(ULONG Argc, PCHAR Argv[])
 {
+    CC_PERFORMANCE_COUNTERS Counters;
+
     KdbpPrint("CcTotalDirtyPages:\t%lu (%lu Kb)\n", CcTotalDirtyPages,
               (CcTotalDirtyPages * PAGE_SIZE) / 1024);
     KdbpPrint("CcDirtyPageThreshold:\t%lu (%lu Kb)\n", CcDirtyPageThreshold,
@@ -1547,6 +2065,10 @@ ExpKdbgExtDefWrites(ULONG Argc, PCHAR Argv[])
         KdbpPrint("CcTotalDirtyPages below the threshold, writes should not be throttled\n");
     }
 
+    CcQueryPerformanceCounters(&Counters);
+    KdbpPrint("Throttled writes:\t%lu\n", Counters.ThrottledWrites);
+    KdbpPrint("Lazy writes:\t\t%lu (%lu pages)\n", Counters.LazyWriteIos, Counters.LazyWritePages);
+
     return TRUE;
 }
 #endif
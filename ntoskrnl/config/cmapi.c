@@ -116,8 +116,11 @@ CmpDoFlushAll(IN BOOLEAN ForceFlush)
             /* Only sync if we are forced to or if it won't cause a hive shrink */
             if ((ForceFlush) || (!HvHiveWillShrink(&Hive->Hive)))
             {
-                /* Do the sync */
-                Status = HvSyncHive(&Hive->Hive);
+                /* Do the sync, a forced one also gets the primary up to date */
+                if (ForceFlush)
+                    Status = HvReconcileHive(&Hive->Hive);
+                else
+                    Status = HvSyncHive(&Hive->Hive);
 
                 /* If something failed - set the flag and continue looping */
                 if (!NT_SUCCESS(Status)) Result = FALSE;
@@ -170,12 +173,13 @@ CmpSetValueKeyNew(IN PHHIVE Hive,
         }
     }
 
-    /* Allocate a value cell */
+    /* Allocate a value cell, close to the other values of the key */
     ValueCell = HvAllocateCell(Hive,
                                FIELD_OFFSET(CM_KEY_VALUE, Name) +
                                CmpNameSize(Hive, ValueName),
                                StorageType,
-                               HCELL_NIL);
+                               Parent->ValueList.Count ?
+                               Parent->ValueList.List : HCELL_NIL);
     if (ValueCell == HCELL_NIL) return STATUS_INSUFFICIENT_RESOURCES;
 
     /* Get the actual data for it */
@@ -349,7 +353,7 @@ CmpSetValueKeyExisting(IN PHHIVE Hive,
     else
     {
         /* This was a small key, or a key with no data, allocate a cell */
-        NewCell = HvAllocateCell(Hive, DataSize, StorageType, HCELL_NIL);
+        NewCell = HvAllocateCell(Hive, DataSize, StorageType, OldChild);
         if (NewCell == HCELL_NIL) return STATUS_INSUFFICIENT_RESOURCES;
     }
 
@@ -1187,6 +1191,163 @@ DoAgain:
     return Status;
 }
 
+NTSTATUS
+NTAPI
+CmQueryMultipleValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
+                        IN PCUNICODE_STRING ValueNames,
+                        IN OUT PKEY_VALUE_ENTRY ValueList,
+                        IN ULONG NumberOfValues,
+                        OUT PVOID Buffer,
+                        IN ULONG Length,
+                        OUT PULONG ResultLength)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PHCELL_INDEX ValueCells;
+    PCM_KEY_VALUE ValueData;
+    PVOID Data;
+    ULONG i, DataLength, DataOffset, RequiredLength = 0;
+    BOOLEAN IsSmall, DataAllocated, Overflow = FALSE;
+    HCELL_INDEX DataCellToRelease;
+    VALUE_SEARCH_RETURN_TYPE Result;
+    PHHIVE Hive;
+    PAGED_CODE();
+
+    /* Allocate room for the value cell of every name */
+    *ResultLength = 0;
+    if (!NumberOfValues) return STATUS_SUCCESS;
+    ValueCells = ExAllocatePoolWithTag(PagedPool,
+                                       NumberOfValues * sizeof(HCELL_INDEX),
+                                       TAG_CM);
+    if (!ValueCells) return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* Acquire hive lock */
+    CmpLockRegistry();
+
+    /* Lock the KCB shared */
+    CmpAcquireKcbLockShared(Kcb);
+
+    /* Don't touch deleted keys */
+DoAgain:
+    if (Kcb->Delete)
+    {
+        /* Undo everything */
+        CmpReleaseKcbLock(Kcb);
+        CmpUnlockRegistry();
+        ExFreePoolWithTag(ValueCells, TAG_CM);
+        return STATUS_KEY_DELETED;
+    }
+
+    /* We don't deal with this yet */
+    if (Kcb->ExtFlags & CM_KCB_SYM_LINK_FOUND)
+    {
+        /* Shouldn't happen */
+        ASSERT(FALSE);
+    }
+
+    /* Get the hive */
+    Hive = Kcb->KeyHive;
+
+    /* Look all the values up in a single pass over the value list */
+    Result = CmpFindValuesByNameFromCache(Kcb,
+                                          ValueNames,
+                                          NumberOfValues,
+                                          ValueCells);
+    if (Result == SearchNeedExclusiveLock)
+    {
+        /* Try with exclusive KCB lock */
+        CmpConvertKcbSharedToExclusive(Kcb);
+        goto DoAgain;
+    }
+
+    if (Result != SearchSuccess) Status = STATUS_INSUFFICIENT_RESOURCES;
+
+    /* Now copy the data of every value, aligned, one after the other */
+    for (i = 0; (i < NumberOfValues) && NT_SUCCESS(Status); i++)
+    {
+        /* All the values must exist */
+        if (ValueCells[i] == HCELL_NIL)
+        {
+            Status = STATUS_OBJECT_NAME_NOT_FOUND;
+            break;
+        }
+
+        ValueData = (PCM_KEY_VALUE)HvGetCell(Hive, ValueCells[i]);
+        if (!ValueData)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        /* Keep counting the size needed once the buffer is full */
+        IsSmall = CmpIsKeyValueSmall(&DataLength, ValueData->DataLength);
+        DataOffset = ALIGN_UP_BY(RequiredLength, sizeof(ULONG));
+        RequiredLength = DataOffset + DataLength;
+        if ((Overflow) || (RequiredLength > Length) || (RequiredLength < DataOffset))
+        {
+            Overflow = TRUE;
+            HvReleaseCell(Hive, ValueCells[i]);
+            continue;
+        }
+
+        /* Get the data, from the cell itself if it is small */
+        Data = NULL;
+        DataAllocated = FALSE;
+        DataCellToRelease = HCELL_NIL;
+        if ((IsSmall) || !(DataLength))
+        {
+            Data = &ValueData->Data;
+        }
+        else if (CmpGetValueDataFromCache(Kcb,
+                                          NULL,
+                                          (PCELL_DATA)ValueData,
+                                          FALSE,
+                                          &Data,
+                                          &DataAllocated,
+                                          &DataCellToRelease) != SearchSuccess)
+        {
+            /* We failed, nothing should be allocated */
+            ASSERT(Data == NULL);
+            ASSERT(DataAllocated == FALSE);
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (Data)
+        {
+            /* User data, protect against exceptions */
+            _SEH2_TRY
+            {
+                RtlCopyMemory((PUCHAR)Buffer + DataOffset, Data, DataLength);
+                ValueList[i].DataLength = DataLength;
+                ValueList[i].DataOffset = DataOffset;
+                ValueList[i].Type = ValueData->Type;
+            }
+            _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+            {
+                Status = _SEH2_GetExceptionCode();
+            }
+            _SEH2_END;
+        }
+
+        /* Release what we got */
+        if (DataAllocated) CmpFree(Data, 0);
+        if (DataCellToRelease != HCELL_NIL) HvReleaseCell(Hive, DataCellToRelease);
+        HvReleaseCell(Hive, ValueCells[i]);
+    }
+
+    /* Tell the caller how much is needed, even if it didn't fit */
+    if (NT_SUCCESS(Status))
+    {
+        *ResultLength = RequiredLength;
+        if (Overflow) Status = STATUS_BUFFER_OVERFLOW;
+    }
+
+    /* Release locks */
+    CmpReleaseKcbLock(Kcb);
+    CmpUnlockRegistry();
+    ExFreePoolWithTag(ValueCells, TAG_CM);
+    return Status;
+}
+
 NTSTATUS
 NTAPI
 CmEnumerateValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
@@ -2237,6 +2398,14 @@ CmUnloadKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     /* Flush the hive */
     CmFlushKey(Kcb, TRUE);
 
+    /* Empty its log into the primary, so the file stands on its own */
+    CmpLockHiveFlusherExclusive(CmHive);
+    if (!HvReconcileHive(Hive))
+    {
+        DPRINT1("Failed to reconcile hive %wZ\n", &CmHive->FileFullPath);
+    }
+    CmpUnlockHiveFlusher(CmHive);
+
     /* Unlink the hive from the master hive */
     if (!CmpUnlinkHiveFromMaster(CmHive, Cell))
     {
@@ -2375,32 +2544,18 @@ CmCountOpenSubKeys(IN PCM_KEY_CONTROL_BLOCK RootKcb,
 }
 
 static
-NTSTATUS
-CmpDeepCopyKeyInternal(IN PHHIVE SourceHive,
-                       IN HCELL_INDEX SrcKeyCell,
-                       IN PHHIVE DestinationHive,
-                       IN HCELL_INDEX Parent,
-                       IN HSTORAGE_TYPE StorageType,
-                       OUT PHCELL_INDEX DestKeyCell OPTIONAL)
+HCELL_INDEX
+CmpDeepCopyKeyNode(IN PHHIVE SourceHive,
+                   IN HCELL_INDEX SrcKeyCell,
+                   IN PHHIVE DestinationHive,
+                   IN HCELL_INDEX Parent,
+                   IN HSTORAGE_TYPE StorageType)
 {
-    NTSTATUS Status;
-    PCM_KEY_NODE SrcNode;
-    PCM_KEY_NODE DestNode = NULL;
-    HCELL_INDEX NewKeyCell = HCELL_NIL;
-    HCELL_INDEX NewClassCell = HCELL_NIL, NewSecCell = HCELL_NIL;
-    HCELL_INDEX SubKey, NewSubKey;
-    ULONG Index, SubKeyCount;
+    PCM_KEY_NODE SrcNode, DestNode;
+    HCELL_INDEX NewKeyCell;
 
     PAGED_CODE();
 
-    DPRINT("CmpDeepCopyKeyInternal(0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X)\n",
-           SourceHive,
-           SrcKeyCell,
-           DestinationHive,
-           Parent,
-           StorageType,
-           DestKeyCell);
-
     /* Get the source cell node */
     SrcNode = HvGetCell(SourceHive, SrcKeyCell);
     ASSERT(SrcNode);
@@ -2416,8 +2571,8 @@ CmpDeepCopyKeyInternal(IN PHHIVE SourceHive,
     if (NewKeyCell == HCELL_NIL)
     {
         /* Not enough storage space */
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-        goto Cleanup;
+        HvReleaseCell(SourceHive, SrcKeyCell);
+        return HCELL_NIL;
     }
 
     /* Get the destination cell node */
@@ -2433,6 +2588,59 @@ CmpDeepCopyKeyInternal(IN PHHIVE SourceHive,
         DestNode->Flags |= KEY_HIVE_ENTRY | KEY_NO_DELETE;
     }
 
+    /* Nothing else is copied yet, clear the cells of the source hive */
+    DestNode->Class = HCELL_NIL;
+    DestNode->ClassLength = 0;
+    DestNode->Security = HCELL_NIL;
+    DestNode->ValueList.Count = 0;
+    DestNode->ValueList.List = HCELL_NIL;
+    DestNode->SubKeyCounts[Stable] = DestNode->SubKeyCounts[Volatile] = 0;
+    DestNode->SubKeyLists[Stable] = DestNode->SubKeyLists[Volatile] = HCELL_NIL;
+
+    /* Release the cells */
+    HvReleaseCell(DestinationHive, NewKeyCell);
+    HvReleaseCell(SourceHive, SrcKeyCell);
+    return NewKeyCell;
+}
+
+//
+// Copies everything below an already copied key node. This is also what
+// compacts a hive when it gets saved: the nodes of all the subkeys of a key
+// are copied first, so that they end up next to each other and next to the
+// index pointing to them, since those are the cells touched when looking up
+// a path. Each subkey then gets its own class, values and subkeys copied.
+//
+static
+NTSTATUS
+CmpDeepCopyKeyInternal(IN PHHIVE SourceHive,
+                       IN HCELL_INDEX SrcKeyCell,
+                       IN PHHIVE DestinationHive,
+                       IN HCELL_INDEX NewKeyCell,
+                       IN HSTORAGE_TYPE StorageType)
+{
+    NTSTATUS Status;
+    PCM_KEY_NODE SrcNode;
+    PCM_KEY_NODE DestNode = NULL;
+    HCELL_INDEX NewClassCell = HCELL_NIL, NewSecCell = HCELL_NIL;
+    HCELL_INDEX SubKey;
+    PHCELL_INDEX NewSubKeys = NULL;
+    ULONG Index, SubKeyCount;
+
+    PAGED_CODE();
+
+    DPRINT("CmpDeepCopyKeyInternal(0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X)\n",
+           SourceHive,
+           SrcKeyCell,
+           DestinationHive,
+           NewKeyCell,
+           StorageType);
+
+    /* Get the source and destination cell nodes */
+    SrcNode = HvGetCell(SourceHive, SrcKeyCell);
+    ASSERT(SrcNode);
+    DestNode = HvGetCell(DestinationHive, NewKeyCell);
+    ASSERT(DestNode);
+
     /* Copy the class cell */
     if (SrcNode->ClassLength > 0)
     {
@@ -2450,11 +2658,6 @@ CmpDeepCopyKeyInternal(IN PHHIVE SourceHive,
         DestNode->Class = NewClassCell;
         DestNode->ClassLength = SrcNode->ClassLength;
     }
-    else
-    {
-        DestNode->Class = HCELL_NIL;
-        DestNode->ClassLength = 0;
-    }
 
     /* Copy the security cell (FIXME: HACKish poor-man version) */
     if (SrcNode->Security != HCELL_NIL)
@@ -2481,52 +2684,78 @@ CmpDeepCopyKeyInternal(IN PHHIVE SourceHive,
     if (!NT_SUCCESS(Status))
         goto Cleanup;
 
-    /* Clear the invalid subkey index */
-    DestNode->SubKeyCounts[Stable] = DestNode->SubKeyCounts[Volatile] = 0;
-    DestNode->SubKeyLists[Stable] = DestNode->SubKeyLists[Volatile] = HCELL_NIL;
-
     /* Calculate the total number of subkeys */
     SubKeyCount = SrcNode->SubKeyCounts[Stable] + SrcNode->SubKeyCounts[Volatile];
+    if (SubKeyCount)
+    {
+        /* Allocate room for the copies of the subkey nodes */
+        NewSubKeys = ExAllocatePoolWithTag(PagedPool,
+                                           SubKeyCount * sizeof(HCELL_INDEX),
+                                           TAG_CM);
+        if (!NewSubKeys)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Cleanup;
+        }
+    }
 
-    /* Loop through all the subkeys */
+    /* Copy the nodes of all the subkeys first, and index them */
     for (Index = 0; Index < SubKeyCount; Index++)
     {
         /* Get the subkey */
         SubKey = CmpFindSubKeyByNumber(SourceHive, SrcNode, Index);
         ASSERT(SubKey != HCELL_NIL);
 
-        /* Call the function recursively for the subkey */
-        //
-        // FIXME: Danger!! Kernel stack exhaustion!!
-        //
-        Status = CmpDeepCopyKeyInternal(SourceHive,
-                                        SubKey,
-                                        DestinationHive,
-                                        NewKeyCell,
-                                        StorageType,
-                                        &NewSubKey);
-        if (!NT_SUCCESS(Status))
+        NewSubKeys[Index] = CmpDeepCopyKeyNode(SourceHive,
+                                               SubKey,
+                                               DestinationHive,
+                                               NewKeyCell,
+                                               StorageType);
+        if (NewSubKeys[Index] == HCELL_NIL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
             goto Cleanup;
+        }
 
         /* Add the copy of the subkey to the new key */
         if (!CmpAddSubKey(DestinationHive,
                           NewKeyCell,
-                          NewSubKey))
+                          NewSubKeys[Index]))
         {
             /* Cleanup allocated cell */
-            HvFreeCell(DestinationHive, NewSubKey);
+            HvFreeCell(DestinationHive, NewSubKeys[Index]);
 
             Status = STATUS_INSUFFICIENT_RESOURCES;
             goto Cleanup;
         }
     }
 
+    /* Now copy what is below each of them */
+    for (Index = 0; Index < SubKeyCount; Index++)
+    {
+        SubKey = CmpFindSubKeyByNumber(SourceHive, SrcNode, Index);
+        ASSERT(SubKey != HCELL_NIL);
+
+        /* Call the function recursively for the subkey */
+        //
+        // FIXME: Danger!! Kernel stack exhaustion!!
+        //
+        Status = CmpDeepCopyKeyInternal(SourceHive,
+                                        SubKey,
+                                        DestinationHive,
+                                        NewSubKeys[Index],
+                                        StorageType);
+        if (!NT_SUCCESS(Status))
+            goto Cleanup;
+    }
+
     /* Set success */
     Status = STATUS_SUCCESS;
 
 Cleanup:
 
     /* Release the cells */
+    if (NewSubKeys) ExFreePoolWithTag(NewSubKeys, TAG_CM);
     if (DestNode) HvReleaseCell(DestinationHive, NewKeyCell);
     if (SrcNode) HvReleaseCell(SourceHive, SrcKeyCell);
 
@@ -2538,15 +2767,8 @@ Cleanup:
 
         if (NewClassCell != HCELL_NIL)
             HvFreeCell(DestinationHive, NewClassCell);
-
-        if (NewKeyCell != HCELL_NIL)
-            HvFreeCell(DestinationHive, NewKeyCell);
-
-        NewKeyCell = HCELL_NIL;
     }
 
-    /* Set the cell index if requested and return status */
-    if (DestKeyCell) *DestKeyCell = NewKeyCell;
     return Status;
 }
 
@@ -2558,13 +2780,36 @@ CmpDeepCopyKey(IN PHHIVE SourceHive,
                IN HSTORAGE_TYPE StorageType,
                OUT PHCELL_INDEX DestKeyCell OPTIONAL)
 {
-    /* Call the internal function */
-    return CmpDeepCopyKeyInternal(SourceHive,
-                                  SrcKeyCell,
-                                  DestinationHive,
-                                  HCELL_NIL,
-                                  StorageType,
-                                  DestKeyCell);
+    NTSTATUS Status;
+    HCELL_INDEX NewKeyCell;
+
+    /* Copy the root node, then everything below it */
+    NewKeyCell = CmpDeepCopyKeyNode(SourceHive,
+                                    SrcKeyCell,
+                                    DestinationHive,
+                                    HCELL_NIL,
+                                    StorageType);
+    if (NewKeyCell == HCELL_NIL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else
+    {
+        Status = CmpDeepCopyKeyInternal(SourceHive,
+                                        SrcKeyCell,
+                                        DestinationHive,
+                                        NewKeyCell,
+                                        StorageType);
+        if (!NT_SUCCESS(Status))
+        {
+            HvFreeCell(DestinationHive, NewKeyCell);
+            NewKeyCell = HCELL_NIL;
+        }
+    }
+
+    /* Set the cell index if requested and return status */
+    if (DestKeyCell) *DestKeyCell = NewKeyCell;
+    return Status;
 }
 
 NTSTATUS
@@ -282,6 +282,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Memory Management",
+        L"CacheMaxFlushViews",
+        &CcMaxFlushRun,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Memory Management",
         L"SessionPoolSize",
@@ -330,6 +338,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Memory Management",
+        L"LargePageNonPagedPool",
+        &MmLargePageNonPagedPool,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Memory Management",
         L"LargeSystemCache",
@@ -530,6 +546,40 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Memory Management",
+        L"CompressedStoreMaximumPercent",
+        &MmCompressedStoreMaximumPercent,
+        NULL,
+        NULL
+    },
+
+#ifndef NEWCC
+    {
+        L"Session Manager\\Memory Management\\PrefetchParameters",
+        L"EnablePrefetcher",
+        &CcPfEnablePrefetcher,
+        NULL,
+        NULL
+    },
+#endif
+
+    {
+        L"Session Manager\\Executive",
+        L"PushLockSpinCount",
+        &ExPushLockSpinCount,
+        NULL,
+        NULL
+    },
+
+    {
+        L"Session Manager\\Executive",
+        L"ResourceSpinCount",
+        &ExResourceSpinCount,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Executive",
         L"AdditionalCriticalWorkerThreads",
@@ -546,6 +596,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Executive",
+        L"WorkerLatencyThreshold",
+        &ExpWorkerLatencyThreshold,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Executive",
         L"PriorityQuantumMatrix",
@@ -554,6 +612,46 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Kernel",
+        L"SpinLockProfile",
+        &KiSpinLockProfileAtBoot,
+        NULL,
+        NULL
+    },
+
+    {
+        L"Session Manager\\Kernel",
+        L"SchedTrace",
+        &KiSchedTraceAtBoot,
+        NULL,
+        NULL
+    },
+
+    {
+        L"Session Manager\\Kernel",
+        L"DynamicTick",
+        &KiDynamicTickEnabled,
+        NULL,
+        NULL
+    },
+
+    {
+        L"Session Manager\\Kernel",
+        L"ThreadDpcEnable",
+        &KeThreadDpcEnable,
+        NULL,
+        NULL
+    },
+
+    {
+        L"Session Manager\\Kernel",
+        L"DpcTiming",
+        &KiDpcTimingEnabled,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Kernel",
         L"DpcQueueDepth",
@@ -730,6 +828,22 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         &DummyData
     },
 
+    {
+        L"Session Manager\\Configuration Manager",
+        L"MappedHiveViews",
+        &CmpHiveViewLimit,
+        NULL,
+        NULL
+    },
+
+    {
+        L"Session Manager\\Configuration Manager",
+        L"LogReconcileThreshold",
+        &CmpLogReconcileThreshold,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager",
         L"ForceNpxEmulation",
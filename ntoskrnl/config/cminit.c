@@ -175,7 +175,8 @@ CmpInitializeHive(OUT PCMHIVE *CmHive,
                           OperationType,
                           HiveFlags,
                           FileType,
-                          HiveData,
+                          (OperationType == HINIT_MAPFILE) ?
+                              (PVOID)CmpGetMappedCell : HiveData,
                           CmpAllocate,
                           CmpFree,
                           CmpFileSetSize,
@@ -187,6 +188,7 @@ CmpInitializeHive(OUT PCMHIVE *CmHive,
     if (!NT_SUCCESS(Status))
     {
         /* Cleanup allocations and fail */
+        if (OperationType == HINIT_MAPFILE) CmpDestroyHiveViewList(Hive);
         ExDeleteResourceLite(Hive->FlusherLock);
         ExFreePoolWithTag(Hive->FlusherLock, TAG_CMHIVE);
         ExFreePoolWithTag(Hive->ViewLock, TAG_CMHIVE);
@@ -205,6 +207,7 @@ CmpInitializeHive(OUT PCMHIVE *CmHive,
         if (CheckStatus != 0)
         {
             /* Cleanup allocations and fail */
+            if (OperationType == HINIT_MAPFILE) CmpDestroyHiveViewList(Hive);
             ExDeleteResourceLite(Hive->FlusherLock);
             ExFreePoolWithTag(Hive->FlusherLock, TAG_CMHIVE);
             ExFreePoolWithTag(Hive->ViewLock, TAG_CMHIVE);
@@ -213,6 +216,10 @@ CmpInitializeHive(OUT PCMHIVE *CmHive,
         }
     }
 
+    /* Loading mapped every bin once, drop what is over the limit */
+    if (OperationType == HINIT_MAPFILE) CmpTrimHiveViews(Hive, CmpHiveViewLimit);
+    Hive->HiveIsLoading = FALSE;
+
     /* Lock the hive list */
     ExAcquirePushLockExclusive(&CmpHiveListHeadLock);
 
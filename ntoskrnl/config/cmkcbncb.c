@@ -14,10 +14,18 @@
 
 /* GLOBALS *******************************************************************/
 
-ULONG CmpHashTableSize = 2048;
+ULONG CmpHashTableSize = CMP_HASH_TABLE_INITIAL_SIZE;
+ULONG CmpNameHashTableSize = CMP_HASH_TABLE_INITIAL_SIZE;
 PCM_KEY_HASH_TABLE_ENTRY CmpCacheTable;
 PCM_NAME_HASH_TABLE_ENTRY CmpNameCacheTable;
 
+CM_HASH_LOCK CmpKcbHashLocks[CMP_HASH_LOCK_COUNT];
+CM_HASH_LOCK CmpNcbHashLocks[CMP_HASH_LOCK_COUNT];
+CM_HASH_TABLE_STATISTICS CmpKcbHashStatistics, CmpNcbHashStatistics;
+
+WORK_QUEUE_ITEM CmpHashGrowWorkItem;
+LONG CmpHashGrowPending;
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -41,15 +49,8 @@ CmpInitializeCache(VOID)
     /* Zero out the table */
     RtlZeroMemory(CmpCacheTable, Length);
 
-    /* Initialize the locks */
-    for (i = 0;i < CmpHashTableSize; i++)
-    {
-        /* Setup the pushlock */
-        ExInitializePushLock(&CmpCacheTable[i].Lock);
-    }
-
     /* Calculate length for the name cache */
-    Length = CmpHashTableSize * sizeof(CM_NAME_HASH_TABLE_ENTRY);
+    Length = CmpNameHashTableSize * sizeof(CM_NAME_HASH_TABLE_ENTRY);
 
     /* Now allocate the name cache table */
     CmpNameCacheTable = CmpAllocate(Length, TRUE, TAG_CM);
@@ -63,16 +64,162 @@ CmpInitializeCache(VOID)
     RtlZeroMemory(CmpNameCacheTable, Length);
 
     /* Initialize the locks */
-    for (i = 0;i < CmpHashTableSize; i++)
+    for (i = 0; i < CMP_HASH_LOCK_COUNT; i++)
     {
-        /* Setup the pushlock */
-        ExInitializePushLock(&CmpNameCacheTable[i].Lock);
+        /* Setup the pushlocks */
+        ExInitializePushLock(&CmpKcbHashLocks[i].Lock);
+        ExInitializePushLock(&CmpNcbHashLocks[i].Lock);
     }
 
     /* Setup the delayed close table */
     CmpInitializeDelayedCloseTable();
 }
 
+static
+VOID
+CmpUpdateLongestChain(IN PCM_HASH_TABLE_STATISTICS Statistics,
+                      IN ULONG Length)
+{
+    /* This is only statistics, a lost update doesn't matter */
+    if (Length > Statistics->LongestChain) Statistics->LongestChain = Length;
+}
+
+static
+VOID
+CmpGrowKeyHashTable(VOID)
+{
+    PCM_KEY_HASH_TABLE_ENTRY NewTable, OldTable;
+    PCM_KEY_HASH Entry, NextEntry;
+    ULONG NewSize, OldSize, i, Index;
+
+    /* Only this routine changes the size, and it never runs twice at once */
+    OldSize = CmpHashTableSize;
+    NewSize = OldSize * 2;
+    NewTable = CmpAllocate(NewSize * sizeof(CM_KEY_HASH_TABLE_ENTRY), TRUE, TAG_CM);
+    if (!NewTable) return;
+    RtlZeroMemory(NewTable, NewSize * sizeof(CM_KEY_HASH_TABLE_ENTRY));
+
+    /* Lock the whole table, in the same order as CmpAcquireTwoKcbLocksExclusiveByKey */
+    for (i = 0; i < CMP_HASH_LOCK_COUNT; i++) CmpAcquireKcbLockExclusiveByIndex(i);
+
+    /* Move all the keys over */
+    OldTable = CmpCacheTable;
+    for (i = 0; i < OldSize; i++)
+    {
+        for (Entry = OldTable[i].Entry; Entry; Entry = NextEntry)
+        {
+            NextEntry = Entry->NextHash;
+            Index = GET_HASH_KEY(Entry->ConvKey) & (NewSize - 1);
+            Entry->NextHash = NewTable[Index].Entry;
+            NewTable[Index].Entry = Entry;
+        }
+    }
+
+    CmpCacheTable = NewTable;
+    CmpHashTableSize = NewSize;
+    CmpKcbHashStatistics.Resizes++;
+
+    for (i = CMP_HASH_LOCK_COUNT; i > 0; i--) CmpReleaseKcbLockByIndex(i - 1);
+
+    CmpFree(OldTable, 0);
+}
+
+static
+VOID
+CmpGrowNameHashTable(VOID)
+{
+    PCM_NAME_HASH_TABLE_ENTRY NewTable, OldTable;
+    PCM_NAME_HASH Entry, NextEntry;
+    ULONG NewSize, OldSize, i, Index;
+
+    /* Only this routine changes the size, and it never runs twice at once */
+    OldSize = CmpNameHashTableSize;
+    NewSize = OldSize * 2;
+    NewTable = CmpAllocate(NewSize * sizeof(CM_NAME_HASH_TABLE_ENTRY), TRUE, TAG_CM);
+    if (!NewTable) return;
+    RtlZeroMemory(NewTable, NewSize * sizeof(CM_NAME_HASH_TABLE_ENTRY));
+
+    /* Lock the whole table */
+    for (i = 0; i < CMP_HASH_LOCK_COUNT; i++)
+    {
+        CmpAcquireHashLockExclusive(&CmpNcbHashLocks[i]);
+    }
+
+    /* Move all the names over */
+    OldTable = CmpNameCacheTable;
+    for (i = 0; i < OldSize; i++)
+    {
+        for (Entry = OldTable[i].Entry; Entry; Entry = NextEntry)
+        {
+            NextEntry = Entry->NextHash;
+            Index = GET_HASH_KEY(Entry->ConvKey) & (NewSize - 1);
+            Entry->NextHash = NewTable[Index].Entry;
+            NewTable[Index].Entry = Entry;
+        }
+    }
+
+    CmpNameCacheTable = NewTable;
+    CmpNameHashTableSize = NewSize;
+    CmpNcbHashStatistics.Resizes++;
+
+    for (i = CMP_HASH_LOCK_COUNT; i > 0; i--)
+    {
+        ExReleasePushLock(&CmpNcbHashLocks[i - 1].Lock);
+    }
+
+    CmpFree(OldTable, 0);
+}
+
+static
+VOID
+NTAPI
+CmpHashGrowWorker(IN PVOID Context)
+{
+    ULONG OldSize;
+    UNREFERENCED_PARAMETER(Context);
+
+    //
+    // Keep out the code walking the whole KCB table under the exclusive
+    // registry lock; everything else goes through the lock stripes
+    //
+    CmpLockRegistry();
+
+    while ((CmpHashTableSize < CMP_HASH_TABLE_MAXIMUM_SIZE) &&
+           ((ULONG)CmpKcbHashStatistics.Entries >
+            CmpHashTableSize * CMP_HASH_TABLE_LOAD_FACTOR))
+    {
+        OldSize = CmpHashTableSize;
+        CmpGrowKeyHashTable();
+        if (CmpHashTableSize == OldSize) break;
+    }
+
+    while ((CmpNameHashTableSize < CMP_HASH_TABLE_MAXIMUM_SIZE) &&
+           ((ULONG)CmpNcbHashStatistics.Entries >
+            CmpNameHashTableSize * CMP_HASH_TABLE_LOAD_FACTOR))
+    {
+        OldSize = CmpNameHashTableSize;
+        CmpGrowNameHashTable();
+        if (CmpNameHashTableSize == OldSize) break;
+    }
+
+    CmpUnlockRegistry();
+
+    /* Allow the next growth to be queued */
+    InterlockedExchange(&CmpHashGrowPending, 0);
+}
+
+static
+VOID
+CmpQueueHashTableGrowth(VOID)
+{
+    /* The tables are grown in the background, nobody can hold a stripe then */
+    if (!InterlockedCompareExchange(&CmpHashGrowPending, 1, 0))
+    {
+        ExInitializeWorkItem(&CmpHashGrowWorkItem, CmpHashGrowWorker, NULL);
+        ExQueueWorkItem(&CmpHashGrowWorkItem, DelayedWorkQueue);
+    }
+}
+
 VOID
 NTAPI
 CmpRemoveKeyHash(IN PCM_KEY_HASH KeyHash)
@@ -102,6 +249,8 @@ CmpRemoveKeyHash(IN PCM_KEY_HASH KeyHash)
         /* Otherwise, keep going */
         Prev = &Current->NextHash;
     }
+
+    InterlockedDecrement(&CmpKcbHashStatistics.Entries);
 }
 
 PCM_KEY_CONTROL_BLOCK
@@ -109,12 +258,15 @@ NTAPI
 CmpInsertKeyHash(IN PCM_KEY_HASH KeyHash,
                  IN BOOLEAN IsFake)
 {
-    ULONG i;
+    PCM_HASH_LOCK HashLock;
+    ULONG i, Length = 0;
     PCM_KEY_HASH Entry;
     ASSERT_VALID_HASH(KeyHash);
 
     /* Get the hash index */
     i = GET_HASH_INDEX(KeyHash->ConvKey);
+    HashLock = GET_KCB_HASH_LOCK(KeyHash->ConvKey);
+    InterlockedIncrement(&HashLock->Lookups);
 
     /* If this is a fake key, increase the key cell to use the parent data */
     if (IsFake) KeyHash->KeyCell++;
@@ -125,11 +277,13 @@ CmpInsertKeyHash(IN PCM_KEY_HASH KeyHash,
     {
         /* Check if this matches */
         ASSERT_VALID_HASH(Entry);
+        Length++;
         if ((KeyHash->ConvKey == Entry->ConvKey) &&
             (KeyHash->KeyCell == Entry->KeyCell) &&
             (KeyHash->KeyHive == Entry->KeyHive))
         {
             /* Return it */
+            InterlockedExchangeAdd(&HashLock->Probes, Length);
             return CONTAINING_RECORD(Entry, CM_KEY_CONTROL_BLOCK, KeyHash);
         }
 
@@ -137,63 +291,46 @@ CmpInsertKeyHash(IN PCM_KEY_HASH KeyHash,
         Entry = Entry->NextHash;
     }
 
+    InterlockedExchangeAdd(&HashLock->Probes, Length);
+    CmpUpdateLongestChain(&CmpKcbHashStatistics, Length + 1);
+
     /* No entry found, add this one and return NULL since none existed */
     KeyHash->NextHash = CmpCacheTable[i].Entry;
     CmpCacheTable[i].Entry = KeyHash;
+
+    /* Grow the table once the chains get too long on average */
+    if (((ULONG)InterlockedIncrement(&CmpKcbHashStatistics.Entries) >
+         CmpHashTableSize * CMP_HASH_TABLE_LOAD_FACTOR) &&
+        (CmpHashTableSize < CMP_HASH_TABLE_MAXIMUM_SIZE))
+    {
+        CmpQueueHashTableGrowth();
+    }
     return NULL;
 }
 
+static
 PCM_NAME_CONTROL_BLOCK
-NTAPI
-CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
+CmpFindNameControlBlock(IN PUNICODE_STRING NodeName,
+                        IN ULONG ConvKey,
+                        IN USHORT Length)
 {
-    PCM_NAME_CONTROL_BLOCK Ncb = NULL;
-    ULONG ConvKey = 0;
-    PWCHAR p, pp;
-    ULONG i;
-    BOOLEAN IsCompressed = TRUE, Found = FALSE;
+    PCM_NAME_CONTROL_BLOCK Ncb;
     PCM_NAME_HASH HashEntry;
-    ULONG NcbSize;
-    USHORT Length;
-
-    /* Loop the name */
-    p = NodeName->Buffer;
-    for (i = 0; i < NodeName->Length; i += sizeof(WCHAR))
-    {
-        /* Make sure it's not a slash */
-        if (*p != OBJ_NAME_PATH_SEPARATOR)
-        {
-            /* Add it to the hash */
-            ConvKey = 37 * ConvKey + RtlUpcaseUnicodeChar(*p);
-        }
-
-        /* Next character */
-        p++;
-    }
-
-    /* Set assumed lengh and loop to check */
-    Length = NodeName->Length / sizeof(WCHAR);
-    for (i = 0; i < (NodeName->Length / sizeof(WCHAR)); i++)
-    {
-        /* Check if this is a 16-bit character */
-        if (NodeName->Buffer[i] > (UCHAR)-1)
-        {
-            /* This is the actual size, and we know we're not compressed */
-            Length = NodeName->Length;
-            IsCompressed = FALSE;
-            break;
-        }
-    }
+    PCM_HASH_LOCK HashLock = GET_NCB_HASH_LOCK(ConvKey);
+    PWCHAR p, pp;
+    ULONG i, Probes = 0;
+    BOOLEAN Found;
 
-    /* Lock the NCB entry */
-    CmpAcquireNcbLockExclusiveByKey(ConvKey);
+    /* The caller holds the NCB lock, either shared or exclusive */
+    InterlockedIncrement(&HashLock->Lookups);
 
     /* Get the hash entry */
-    HashEntry = GET_HASH_ENTRY(CmpNameCacheTable, ConvKey)->Entry;
+    HashEntry = GET_NAME_HASH_ENTRY(ConvKey)->Entry;
     while (HashEntry)
     {
         /* Get the current NCB */
         Ncb = CONTAINING_RECORD(HashEntry, CM_NAME_CONTROL_BLOCK, NameHash);
+        Probes++;
 
         /* Check if the hash matches */
         if ((ConvKey == HashEntry->ConvKey) && (Length == Ncb->NameLength))
@@ -235,10 +372,8 @@ CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
             /* Check if we found a name */
             if (Found)
             {
-                /* Reference it */
-                ASSERT(Ncb->RefCount != 0xFFFF);
-                Ncb->RefCount++;
-                break;
+                InterlockedExchangeAdd(&HashLock->Probes, Probes);
+                return Ncb;
             }
         }
 
@@ -246,59 +381,138 @@ CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
         HashEntry = HashEntry->NextHash;
     }
 
-    /* Check if we didn't find it */
-    if (!Found)
+    /* Not there */
+    InterlockedExchangeAdd(&HashLock->Probes, Probes);
+    CmpUpdateLongestChain(&CmpNcbHashStatistics, Probes);
+    return NULL;
+}
+
+PCM_NAME_CONTROL_BLOCK
+NTAPI
+CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
+{
+    PCM_NAME_CONTROL_BLOCK Ncb, NewNcb;
+    ULONG ConvKey = 0;
+    PWCHAR p;
+    ULONG i;
+    BOOLEAN IsCompressed = TRUE;
+    PCM_NAME_HASH HashEntry;
+    ULONG NcbSize;
+    USHORT Length;
+
+    /* Loop the name */
+    p = NodeName->Buffer;
+    for (i = 0; i < NodeName->Length; i += sizeof(WCHAR))
     {
-        /* Allocate one */
-        NcbSize = FIELD_OFFSET(CM_NAME_CONTROL_BLOCK, Name) + Length;
-        Ncb = CmpAllocate(NcbSize, TRUE, TAG_CM);
-        if (!Ncb)
+        /* Make sure it's not a slash */
+        if (*p != OBJ_NAME_PATH_SEPARATOR)
         {
-            /* Release the lock and fail */
-            CmpReleaseNcbLockByKey(ConvKey);
-            return NULL;
+            /* Add it to the hash */
+            ConvKey = 37 * ConvKey + RtlUpcaseUnicodeChar(*p);
         }
 
-        /* Clear it out */
-        RtlZeroMemory(Ncb, NcbSize);
+        /* Next character */
+        p++;
+    }
 
-        /* Check if the name was compressed */
-        if (IsCompressed)
+    /* Set assumed lengh and loop to check */
+    Length = NodeName->Length / sizeof(WCHAR);
+    for (i = 0; i < (NodeName->Length / sizeof(WCHAR)); i++)
+    {
+        /* Check if this is a 16-bit character */
+        if (NodeName->Buffer[i] > (UCHAR)-1)
         {
-            /* Copy the compressed name */
-            for (i = 0; i < NodeName->Length / sizeof(WCHAR); i++)
-            {
-                /* Copy Unicode to ANSI */
-                ((PCHAR)Ncb->Name)[i] = (CHAR)RtlUpcaseUnicodeChar(NodeName->Buffer[i]);
-            }
+            /* This is the actual size, and we know we're not compressed */
+            Length = NodeName->Length;
+            IsCompressed = FALSE;
+            break;
         }
-        else
+    }
+
+    //
+    // Most names are already cached, so look for it with the NCB lock shared
+    // first. References are only dropped with the lock held exclusively, so
+    // the ones taken here just need to be atomic with each other.
+    //
+    CmpAcquireNcbLockSharedByKey(ConvKey);
+    Ncb = CmpFindNameControlBlock(NodeName, ConvKey, Length);
+    if (Ncb)
+    {
+        /* Reference it */
+        ASSERT(Ncb->RefCount != 0xFFFF);
+        InterlockedIncrement16((PSHORT)&Ncb->RefCount);
+        CmpReleaseNcbLockByKey(ConvKey);
+        return Ncb;
+    }
+    CmpReleaseNcbLockByKey(ConvKey);
+
+    /* Build a new one before taking the lock exclusively */
+    NcbSize = FIELD_OFFSET(CM_NAME_CONTROL_BLOCK, Name) + Length;
+    NewNcb = CmpAllocate(NcbSize, TRUE, TAG_CM);
+    if (!NewNcb) return NULL;
+
+    /* Clear it out */
+    RtlZeroMemory(NewNcb, NcbSize);
+
+    /* Check if the name was compressed */
+    if (IsCompressed)
+    {
+        /* Copy the compressed name */
+        for (i = 0; i < NodeName->Length / sizeof(WCHAR); i++)
         {
-            /* Copy the name directly */
-            for (i = 0; i < NodeName->Length / sizeof(WCHAR); i++)
-            {
-                /* Copy each unicode character */
-                Ncb->Name[i] = RtlUpcaseUnicodeChar(NodeName->Buffer[i]);
-            }
+            /* Copy Unicode to ANSI */
+            ((PCHAR)NewNcb->Name)[i] = (CHAR)RtlUpcaseUnicodeChar(NodeName->Buffer[i]);
+        }
+    }
+    else
+    {
+        /* Copy the name directly */
+        for (i = 0; i < NodeName->Length / sizeof(WCHAR); i++)
+        {
+            /* Copy each unicode character */
+            NewNcb->Name[i] = RtlUpcaseUnicodeChar(NodeName->Buffer[i]);
         }
+    }
+
+    /* Setup the rest of the NCB */
+    NewNcb->Compressed = IsCompressed;
+    NewNcb->ConvKey = ConvKey;
+    NewNcb->RefCount++;
+    NewNcb->NameLength = Length;
+
+    /* Lock the NCB entry */
+    CmpAcquireNcbLockExclusiveByKey(ConvKey);
 
-        /* Setup the rest of the NCB */
-        Ncb->Compressed = IsCompressed;
-        Ncb->ConvKey = ConvKey;
+    /* Someone might have added it in the meantime */
+    Ncb = CmpFindNameControlBlock(NodeName, ConvKey, Length);
+    if (Ncb)
+    {
+        /* Reference that one and drop ours */
+        ASSERT(Ncb->RefCount != 0xFFFF);
         Ncb->RefCount++;
-        Ncb->NameLength = Length;
+        CmpReleaseNcbLockByKey(ConvKey);
+        CmpFree(NewNcb, 0);
+        return Ncb;
+    }
+
+    /* Insert the name in the hash table */
+    HashEntry = &NewNcb->NameHash;
+    HashEntry->NextHash = GET_NAME_HASH_ENTRY(ConvKey)->Entry;
+    GET_NAME_HASH_ENTRY(ConvKey)->Entry = HashEntry;
 
-        /* Insert the name in the hash table */
-        HashEntry = &Ncb->NameHash;
-        HashEntry->NextHash = GET_HASH_ENTRY(CmpNameCacheTable, ConvKey)->Entry;
-        GET_HASH_ENTRY(CmpNameCacheTable, ConvKey)->Entry = HashEntry;
+    /* Grow the table once the chains get too long on average */
+    if (((ULONG)InterlockedIncrement(&CmpNcbHashStatistics.Entries) >
+         CmpNameHashTableSize * CMP_HASH_TABLE_LOAD_FACTOR) &&
+        (CmpNameHashTableSize < CMP_HASH_TABLE_MAXIMUM_SIZE))
+    {
+        CmpQueueHashTableGrowth();
     }
 
     /* Release NCB lock */
     CmpReleaseNcbLockByKey(ConvKey);
 
     /* Return the NCB found */
-    return Ncb;
+    return NewNcb;
 }
 
 VOID
@@ -327,7 +541,7 @@ CmpDereferenceNameControlBlockWithLock(IN PCM_NAME_CONTROL_BLOCK Ncb)
     if (!(--Ncb->RefCount))
     {
         /* Find the NCB in the table */
-        Next = &GET_HASH_ENTRY(CmpNameCacheTable, Ncb->ConvKey)->Entry;
+        Next = &GET_NAME_HASH_ENTRY(Ncb->ConvKey)->Entry;
         while (TRUE)
         {
             /* Check the current entry */
@@ -345,6 +559,7 @@ CmpDereferenceNameControlBlockWithLock(IN PCM_NAME_CONTROL_BLOCK Ncb)
         }
 
         /* Found it, now free it */
+        InterlockedDecrement(&CmpNcbHashStatistics.Entries);
         CmpFree(Ncb, 0);
     }
 
@@ -1193,3 +1408,40 @@ CmpFlushNotifiesOnKeyBodyList(IN PCM_KEY_CONTROL_BLOCK Kcb,
         break;
     }
 }
+
+#if DBG && defined(KDBG)
+static
+VOID
+CmpKdbgPrintHashTable(IN PCSTR Name,
+                      IN ULONG Size,
+                      IN PCM_HASH_TABLE_STATISTICS Statistics,
+                      IN PCM_HASH_LOCK Locks)
+{
+    ULONG64 Lookups = 0, Probes = 0, Waits = 0;
+    ULONG i, Busiest = 0;
+
+    /* Add up the stripes without locking, this is only a rough picture */
+    for (i = 0; i < CMP_HASH_LOCK_COUNT; i++)
+    {
+        Lookups += (ULONG)Locks[i].Lookups;
+        Probes += (ULONG)Locks[i].Probes;
+        Waits += (ULONG)Locks[i].Waits;
+        if (Locks[i].Waits > Locks[Busiest].Waits) Busiest = i;
+    }
+
+    KdbpPrint("%s: %ld entries in %lu buckets, longest chain %lu, %lu resizes\n",
+              Name, Statistics->Entries, Size, Statistics->LongestChain, Statistics->Resizes);
+    KdbpPrint("     %I64u lookups, %I64u probes, %I64u lock waits (stripe %lu: %ld)\n",
+              Lookups, Probes, Waits, Busiest, Locks[Busiest].Waits);
+}
+
+BOOLEAN
+ExpKdbgExtCmHash(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    CmpKdbgPrintHashTable("KCB", CmpHashTableSize, &CmpKcbHashStatistics, CmpKcbHashLocks);
+    CmpKdbgPrintHashTable("NCB", CmpNameHashTableSize, &CmpNcbHashStatistics, CmpNcbHashLocks);
+    return TRUE;
+}
+#endif
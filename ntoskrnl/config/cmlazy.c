@@ -27,8 +27,42 @@ static ULONG CmpLazyFlushHiveCount = 7;
 ULONG CmpLazyFlushCount = 1;
 LONG CmpFlushStarveWriters;
 
+//
+// Flushes of hives with a log only append to it. The primary files get
+// reconciled once the lazy flusher went quiet for a while, or as soon as a
+// log grows past the threshold.
+//
+KTIMER CmpReconcileTimer;
+KDPC CmpReconcileDpc;
+WORK_QUEUE_ITEM CmpReconcileWorkItem;
+LONG CmpReconcilePending;
+ULONG CmpReconcileIntervalInSeconds = 30;
+ULONG CmpLogReconcileThreshold = 1024 * 1024;
+
 /* FUNCTIONS ******************************************************************/
 
+static
+VOID
+CmpQueueReconcile(IN BOOLEAN Now)
+{
+    LARGE_INTEGER DueTime;
+
+    if (!Now)
+    {
+        /* Wait for things to settle down, the timer gets pushed back meanwhile */
+        DueTime.QuadPart = Int32x32To64(CmpReconcileIntervalInSeconds,
+                                        -10 * 1000 * 1000);
+        KeSetTimer(&CmpReconcileTimer, DueTime, &CmpReconcileDpc);
+        return;
+    }
+
+    /* Only one reconciliation at a time */
+    if (InterlockedCompareExchange(&CmpReconcilePending, 1, 0) == 0)
+    {
+        ExQueueWorkItem(&CmpReconcileWorkItem, DelayedWorkQueue);
+    }
+}
+
 BOOLEAN
 NTAPI
 CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
@@ -38,7 +72,7 @@ CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
     NTSTATUS Status;
     PLIST_ENTRY NextEntry;
     PCMHIVE CmHive;
-    BOOLEAN Result;
+    BOOLEAN Result, Reconcile = FALSE;
     ULONG HiveCount = CmpLazyFlushHiveCount;
 
     /* Set Defaults */
@@ -80,7 +114,10 @@ CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
                 /* Do the sync */
                 DPRINT("Flushing: %wZ\n", &CmHive->FileFullPath);
                 DPRINT("Handle: %p\n", CmHive->FileHandles[HFILE_TYPE_PRIMARY]);
+                CmpLockHiveFlusherExclusive(CmHive);
                 Status = HvSyncHive(&CmHive->Hive);
+                if (CmHive->Hive.LogOffset >= CmpLogReconcileThreshold) Reconcile = TRUE;
+                CmpUnlockHiveFlusher(CmHive);
                 if(!NT_SUCCESS(Status))
                 {
                     /* Let them know we failed */
@@ -119,8 +156,13 @@ CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
         Result = TRUE;
     }
 
-    /* Unlock the list and return the result */
+    /* Unlock the list */
     ExReleasePushLock(&CmpHiveListHeadLock);
+
+    /* Don't let a log grow too large before reconciling its hive */
+    if (Reconcile) CmpQueueReconcile(TRUE);
+
+    /* Return the result */
     return Result;
 }
 
@@ -227,6 +269,64 @@ CmpLazyFlushWorker(IN PVOID Parameter)
         /* Relaunch the flush timer, so the remaining hives get flushed */
         CmpLazyFlush();
     }
+    else
+    {
+        /* Reconcile the hives the flushes got logged for once it is quiet */
+        CmpQueueReconcile(FALSE);
+    }
+}
+
+_Function_class_(KDEFERRED_ROUTINE)
+VOID
+NTAPI
+CmpReconcileDpcRoutine(IN PKDPC Dpc,
+                       IN PVOID DeferredContext,
+                       IN PVOID SystemArgument1,
+                       IN PVOID SystemArgument2)
+{
+    /* Queue the reconcile worker unless it is already on its way */
+    CmpQueueReconcile(TRUE);
+}
+
+_Function_class_(WORKER_THREAD_ROUTINE)
+VOID
+NTAPI
+CmpReconcileWorker(IN PVOID Parameter)
+{
+    PLIST_ENTRY NextEntry;
+    PCMHIVE CmHive;
+    PAGED_CODE();
+
+    /* Lock the registry and loop all the hives */
+    CmpLockRegistry();
+    ExAcquirePushLockShared(&CmpHiveListHeadLock);
+    NextEntry = CmpHiveListHead.Flink;
+    while ((NextEntry != &CmpHiveListHead) && !(CmpNoWrite))
+    {
+        /* Only hives whose log holds entries need to be reconciled */
+        CmHive = CONTAINING_RECORD(NextEntry, CMHIVE, HiveList);
+        if ((CmHive->Hive.LogAppend) &&
+            (CmHive->Hive.LogOffset > HBLOCK_SIZE) &&
+            !(CmHive->Hive.HiveFlags & HIVE_VOLATILE))
+        {
+            /* Keep the hive from being flushed meanwhile */
+            CmpLockHiveFlusherExclusive(CmHive);
+            DPRINT("Reconciling: %wZ\n", &CmHive->FileFullPath);
+            if (!HvReconcileHive(&CmHive->Hive))
+            {
+                DPRINT1("Failed to reconcile %wZ\n", &CmHive->FileFullPath);
+            }
+            CmpUnlockHiveFlusher(CmHive);
+        }
+
+        /* Try the next one */
+        NextEntry = NextEntry->Flink;
+    }
+
+    /* Not pending anymore, release the locks */
+    ExReleasePushLock(&CmpHiveListHeadLock);
+    InterlockedExchange(&CmpReconcilePending, 0);
+    CmpUnlockRegistry();
 }
 
 VOID
@@ -245,6 +345,11 @@ CmpCmdInit(IN BOOLEAN SetupBoot)
     /* Setup the lazy worker */
     ExInitializeWorkItem(&CmpLazyWorkItem, CmpLazyFlushWorker, NULL);
 
+    /* Setup the reconcile DPC, timer and worker */
+    KeInitializeDpc(&CmpReconcileDpc, CmpReconcileDpcRoutine, NULL);
+    KeInitializeTimer(&CmpReconcileTimer);
+    ExInitializeWorkItem(&CmpReconcileWorkItem, CmpReconcileWorker, NULL);
+
     /* Setup the forced-lazy DPC and timer */
     KeInitializeDpc(&CmpEnableLazyFlushDpc,
                     CmpEnableLazyFlushDpcRoutine,
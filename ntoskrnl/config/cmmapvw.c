@@ -14,8 +14,421 @@
 
 /* GLOBALS *******************************************************************/
 
+//
+// Bins of a mapped hive are read in from the primary file in views of up to
+// this size, which start on a multiple of it. A bin that doesn't fit is read
+// in together with the others starting in the same window.
+//
+#define CM_VIEW_SIZE        (16 * HBLOCK_SIZE)
+#define CM_VIEW_BLOCKS      (CM_VIEW_SIZE / HBLOCK_SIZE)
+
+//
+// Number of unpinned views a mapped hive is trimmed down to. Zero disables
+// mapping altogether and hives are then read in whole, as before.
+//
+ULONG CmpHiveViewLimit = 256;
+
+WORK_QUEUE_ITEM CmpViewTrimWorkItem;
+LONG CmpViewTrimPending;
+
+/* PRIVATE FUNCTIONS *********************************************************/
+
+static
+BOOLEAN
+CmpIsViewClean(IN PCMHIVE CmHive,
+               IN PCM_VIEW_OF_FILE CmView)
+{
+    /* A view can only be dropped once all of its blocks made it to the primary */
+    return !HvIsRangeDirty(&CmHive->Hive,
+                           CmView->FileOffset / HBLOCK_SIZE,
+                           CmView->Size / HBLOCK_SIZE);
+}
+
+static
+VOID
+CmpUnmapHiveView(IN PCMHIVE CmHive,
+                 IN PCM_VIEW_OF_FILE CmView)
+{
+    PHMAP_ENTRY BlockList = CmHive->Hive.Storage[Stable].BlockList;
+    ULONG Block, EndBlock;
+
+    /* Forget about the blocks that were mapped through this view */
+    Block = CmView->FileOffset / HBLOCK_SIZE;
+    EndBlock = Block + CmView->Size / HBLOCK_SIZE;
+    for (; Block < EndBlock; Block++)
+    {
+        if (BlockList[Block].CmView != CmView) continue;
+        BlockList[Block].BlockAddress = 0;
+        BlockList[Block].BinAddress = 0;
+        BlockList[Block].CmView = NULL;
+    }
+
+    /* And free it */
+    ExFreePoolWithTag(CmView->ViewAddress, TAG_CM);
+    ExFreePoolWithTag(CmView, TAG_CM);
+}
+
+static
+VOID
+NTAPI
+CmpViewTrimWorker(IN PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    /* Trim all the mapped hives with no cell pointers outstanding */
+    CmpLockRegistryExclusive();
+    CmpTrimMappedHives();
+    CmpUnlockRegistry();
+
+    /* Allow the next trim to be queued */
+    InterlockedExchange(&CmpViewTrimPending, 0);
+}
+
+static
+BOOLEAN
+CmpMapHiveView(IN PCMHIVE CmHive,
+               IN ULONG Block)
+{
+    PHMAP_ENTRY BlockList;
+    PCM_VIEW_OF_FILE CmView;
+    PUCHAR ViewAddress;
+    PHBIN Bin;
+    ULONG BinBlock, StartBlock, EndBlock, Window, Previous, i;
+    ULONG FileOffset;
+    BOOLEAN Raced;
+
+    while (TRUE)
+    {
+        KeAcquireGuardedMutex(CmHive->ViewLock);
+        CmHive->ViewLockOwner = KeGetCurrentThread();
+
+        /* Someone else might have mapped it already */
+        BlockList = CmHive->Hive.Storage[Stable].BlockList;
+        if (BlockList[Block].BlockAddress) break;
+
+        /* Find the start of the bin */
+        BinBlock = Block;
+        while ((BinBlock) && !(BlockList[BinBlock].MemAlloc)) BinBlock--;
+        if (!BlockList[BinBlock].MemAlloc) goto Fail;
+
+        //
+        // Take in the unmapped bins around it starting in the same window,
+        // so that neighbouring cells usually come in with a single read
+        //
+        Window = BinBlock & ~(CM_VIEW_BLOCKS - 1);
+        StartBlock = BinBlock;
+        while (StartBlock > Window)
+        {
+            Previous = StartBlock - 1;
+            while ((Previous) && !(BlockList[Previous].MemAlloc)) Previous--;
+            if ((Previous < Window) || (BlockList[Previous].BlockAddress)) break;
+            StartBlock = Previous;
+        }
+
+        EndBlock = BinBlock + BlockList[BinBlock].MemAlloc / HBLOCK_SIZE;
+        while ((EndBlock < Window + CM_VIEW_BLOCKS) &&
+               (EndBlock < CmHive->Hive.Storage[Stable].Length) &&
+               (BlockList[EndBlock].MemAlloc) &&
+               !(BlockList[EndBlock].BlockAddress))
+        {
+            EndBlock += BlockList[EndBlock].MemAlloc / HBLOCK_SIZE;
+        }
+
+        /* Don't do I/O while holding a guarded mutex */
+        CmHive->ViewLockOwner = NULL;
+        KeReleaseGuardedMutex(CmHive->ViewLock);
+
+        CmView = ExAllocatePoolWithTag(PagedPool, sizeof(CM_VIEW_OF_FILE), TAG_CM);
+        if (!CmView) return FALSE;
+
+        /* This is page aligned, which unbuffered reads of the primary need */
+        ViewAddress = ExAllocatePoolWithTag(PagedPool,
+                                            (EndBlock - StartBlock) * HBLOCK_SIZE,
+                                            TAG_CM);
+        if (!ViewAddress)
+        {
+            ExFreePoolWithTag(CmView, TAG_CM);
+            return FALSE;
+        }
+
+        /* Read the bins in; the first block of the file is the base block */
+        FileOffset = HBLOCK_SIZE + StartBlock * HBLOCK_SIZE;
+        if (!CmpFileRead(&CmHive->Hive,
+                         HFILE_TYPE_PRIMARY,
+                         &FileOffset,
+                         ViewAddress,
+                         (EndBlock - StartBlock) * HBLOCK_SIZE))
+        {
+            DPRINT1("Failed to read blocks %lu-%lu of hive %p\n",
+                    StartBlock, EndBlock, CmHive);
+            ExFreePoolWithTag(ViewAddress, TAG_CM);
+            ExFreePoolWithTag(CmView, TAG_CM);
+            return FALSE;
+        }
+
+        CmView->FileOffset = StartBlock * HBLOCK_SIZE;
+        CmView->Size = (EndBlock - StartBlock) * HBLOCK_SIZE;
+        CmView->ViewAddress = (PULONG_PTR)ViewAddress;
+        CmView->Bcb = NULL;
+        CmView->UseCount = 1;
+
+        KeAcquireGuardedMutex(CmHive->ViewLock);
+        CmHive->ViewLockOwner = KeGetCurrentThread();
+
+        /* Check whether another thread mapped any of these bins meanwhile */
+        BlockList = CmHive->Hive.Storage[Stable].BlockList;
+        Raced = FALSE;
+        for (i = StartBlock; i < EndBlock; i++)
+        {
+            if (BlockList[i].BlockAddress)
+            {
+                Raced = TRUE;
+                break;
+            }
+        }
+
+        if (Raced)
+        {
+            /* Drop our copy and start over */
+            CmHive->ViewLockOwner = NULL;
+            KeReleaseGuardedMutex(CmHive->ViewLock);
+            ExFreePoolWithTag(ViewAddress, TAG_CM);
+            ExFreePoolWithTag(CmView, TAG_CM);
+            continue;
+        }
+
+        /* The file must still describe the bins we know about */
+        for (i = StartBlock; i < EndBlock; i += BlockList[i].MemAlloc / HBLOCK_SIZE)
+        {
+            Bin = (PHBIN)(ViewAddress + (i - StartBlock) * HBLOCK_SIZE);
+            if ((Bin->Signature != HV_BIN_SIGNATURE) ||
+                (Bin->FileOffset != i * HBLOCK_SIZE) ||
+                (Bin->Size != BlockList[i].MemAlloc))
+            {
+                DPRINT1("Invalid bin at block %lu of hive %p\n", i, CmHive);
+                ExFreePoolWithTag(ViewAddress, TAG_CM);
+                ExFreePoolWithTag(CmView, TAG_CM);
+                goto Fail;
+            }
+        }
+
+        //
+        // Install the view. The block address goes in last, as it is what the
+        // lock-free lookup in CmpGetMappedCell checks.
+        //
+        Bin = NULL;
+        for (i = StartBlock; i < EndBlock; i++)
+        {
+            if (BlockList[i].MemAlloc)
+            {
+                Bin = (PHBIN)(ViewAddress + (i - StartBlock) * HBLOCK_SIZE);
+            }
+            BlockList[i].BinAddress = (ULONG_PTR)Bin;
+            BlockList[i].CmView = CmView;
+        }
+        KeMemoryBarrier();
+        for (i = StartBlock; i < EndBlock; i++)
+        {
+            BlockList[i].BlockAddress = (ULONG_PTR)(ViewAddress + (i - StartBlock) * HBLOCK_SIZE);
+        }
+
+        InsertHeadList(&CmHive->LRUViewListHead, &CmView->LRUViewList);
+        CmHive->MappedViews++;
+
+        //
+        // Have the views trimmed again once there are too many, but never while
+        // the hive is being loaded, it is trimmed once it is done
+        //
+        if ((CmpHiveViewLimit) &&
+            !(CmHive->HiveIsLoading) &&
+            (CmHive->MappedViews > CmpHiveViewLimit + CmpHiveViewLimit / 4) &&
+            !(InterlockedCompareExchange(&CmpViewTrimPending, 1, 0)))
+        {
+            ExInitializeWorkItem(&CmpViewTrimWorkItem, CmpViewTrimWorker, NULL);
+            ExQueueWorkItem(&CmpViewTrimWorkItem, DelayedWorkQueue);
+        }
+        break;
+    }
+
+    CmHive->ViewLockOwner = NULL;
+    KeReleaseGuardedMutex(CmHive->ViewLock);
+    return TRUE;
+
+Fail:
+    CmHive->ViewLockOwner = NULL;
+    KeReleaseGuardedMutex(CmHive->ViewLock);
+    return FALSE;
+}
+
 /* FUNCTIONS *****************************************************************/
 
+/*++
+ * @name CmpGetMappedCell
+ *
+ *     Cell lookup routine of mapped hives. Returns the cell if its bin is
+ *     present, and reads the bin in from the primary file otherwise.
+ *
+ * @param Hive
+ *        Hive the cell belongs to.
+ *
+ * @param Cell
+ *        Index of the cell to look up.
+ *
+ * @return Pointer to the cell data, or NULL if its bin couldn't be read in.
+ *
+ * @remarks The returned pointer stays valid until the registry lock is next
+ *          acquired exclusively, as views are only dropped under it.
+ *
+ *--*/
+PCELL_DATA
+CMAPI
+CmpGetMappedCell(IN PHHIVE Hive,
+                 IN HCELL_INDEX Cell)
+{
+    PCMHIVE CmHive = (PCMHIVE)Hive;
+    HSTORAGE_TYPE Type = HvGetCellType(Cell);
+    ULONG Block = HvGetCellBlock(Cell);
+    ULONG Offset = (Cell & HCELL_OFFSET_MASK) >> HCELL_OFFSET_SHIFT;
+    PHMAP_ENTRY Entry;
+    PCM_VIEW_OF_FILE CmView;
+    ULONG_PTR BlockAddress;
+
+    ASSERT(Block < Hive->Storage[Type].Length);
+
+    while (TRUE)
+    {
+        /* Fast path: the bin is present, either mapped in or in pool */
+        Entry = &Hive->Storage[Type].BlockList[Block];
+        BlockAddress = Entry->BlockAddress;
+        if (BlockAddress)
+        {
+            /* Mark the view as recently used so the next trim spares it */
+            CmView = Entry->CmView;
+            if ((CmView) && !(CmView->UseCount)) CmView->UseCount = 1;
+
+            return (PCELL_DATA)((PHCELL)(BlockAddress + Offset) + 1);
+        }
+
+        /* Only stable bins ever get unmapped */
+        if (Type != Stable) return NULL;
+
+        /* Map it in and try again */
+        if (!CmpMapHiveView(CmHive, Block)) return NULL;
+    }
+}
+
+/*++
+ * @name CmpTrimHiveViews
+ *
+ *     Drops the least recently used clean views of a mapped hive, until no
+ *     more than the given number of them is left. Views holding dirty blocks
+ *     are pinned until the hive gets flushed.
+ *
+ * @param CmHive
+ *        Hive to trim.
+ *
+ * @param Limit
+ *        Number of unpinned views to keep.
+ *
+ * @remarks The registry lock must be held exclusively, or the hive must not
+ *          have been published yet, so that nobody holds cell pointers.
+ *
+ *--*/
+VOID
+NTAPI
+CmpTrimHiveViews(IN PCMHIVE CmHive,
+                 IN ULONG Limit)
+{
+    PCM_VIEW_OF_FILE CmView;
+    PLIST_ENTRY NextEntry;
+    ULONG Count;
+
+    KeAcquireGuardedMutex(CmHive->ViewLock);
+    CmHive->ViewLockOwner = KeGetCurrentThread();
+
+    /* Unpin the views that got flushed since the last trim */
+    NextEntry = CmHive->PinViewListHead.Flink;
+    while (NextEntry != &CmHive->PinViewListHead)
+    {
+        CmView = CONTAINING_RECORD(NextEntry, CM_VIEW_OF_FILE, PinViewList);
+        NextEntry = NextEntry->Flink;
+
+        if (!CmpIsViewClean(CmHive, CmView)) continue;
+
+        RemoveEntryList(&CmView->PinViewList);
+        InsertHeadList(&CmHive->LRUViewListHead, &CmView->LRUViewList);
+        CmHive->PinnedViews--;
+        CmHive->MappedViews++;
+    }
+
+    //
+    // Walk the views from the least recently used one. Recently used views
+    // get another chance, and none is looked at more than twice.
+    //
+    Count = CmHive->MappedViews * 2;
+    while ((CmHive->MappedViews > Limit) && (Count--))
+    {
+        CmView = CONTAINING_RECORD(CmHive->LRUViewListHead.Blink,
+                                   CM_VIEW_OF_FILE,
+                                   LRUViewList);
+        RemoveEntryList(&CmView->LRUViewList);
+
+        if (!CmpIsViewClean(CmHive, CmView))
+        {
+            /* The file doesn't have this data yet, keep the view around */
+            InsertTailList(&CmHive->PinViewListHead, &CmView->PinViewList);
+            CmHive->MappedViews--;
+            CmHive->PinnedViews++;
+            continue;
+        }
+
+        if (CmView->UseCount)
+        {
+            CmView->UseCount = 0;
+            InsertHeadList(&CmHive->LRUViewListHead, &CmView->LRUViewList);
+            continue;
+        }
+
+        CmpUnmapHiveView(CmHive, CmView);
+        CmHive->MappedViews--;
+    }
+
+    CmHive->ViewLockOwner = NULL;
+    KeReleaseGuardedMutex(CmHive->ViewLock);
+}
+
+/*++
+ * @name CmpTrimMappedHives
+ *
+ *     Trims the views of all the loaded mapped hives.
+ *
+ * @remarks The registry lock must be held exclusively.
+ *
+ *--*/
+VOID
+NTAPI
+CmpTrimMappedHives(VOID)
+{
+    PLIST_ENTRY NextEntry;
+    PCMHIVE CmHive;
+
+    ASSERT(CmpTestRegistryLockExclusive() == TRUE);
+
+    ExAcquirePushLockShared(&CmpHiveListHeadLock);
+    for (NextEntry = CmpHiveListHead.Flink;
+         NextEntry != &CmpHiveListHead;
+         NextEntry = NextEntry->Flink)
+    {
+        CmHive = CONTAINING_RECORD(NextEntry, CMHIVE, HiveList);
+        if ((CmHive->Hive.GetCellRoutine) &&
+            (CmHive->MappedViews + CmHive->PinnedViews))
+        {
+            CmpTrimHiveViews(CmHive, CmpHiveViewLimit);
+        }
+    }
+    ExReleasePushLock(&CmpHiveListHeadLock);
+}
+
 VOID
 NTAPI
 CmpInitHiveViewList(IN PCMHIVE Hive)
@@ -47,9 +460,9 @@ CmpDestroyHiveViewList(IN PCMHIVE Hive)
 
         CmView = CONTAINING_RECORD(EntryList, CM_VIEW_OF_FILE, PinViewList);
 
-        /* FIXME: Unmap the view if it is mapped */
-
-        ExFreePool(CmView);
+        /* The block list goes away with the hive, just drop the view */
+        if (CmView->ViewAddress) ExFreePoolWithTag(CmView->ViewAddress, TAG_CM);
+        ExFreePoolWithTag(CmView, TAG_CM);
 
         Hive->PinnedViews--;
     }
@@ -65,9 +478,9 @@ CmpDestroyHiveViewList(IN PCMHIVE Hive)
 
         CmView = CONTAINING_RECORD(EntryList, CM_VIEW_OF_FILE, LRUViewList);
 
-        /* FIXME: Unmap the view if it is mapped */
-
-        ExFreePool(CmView);
+        /* The block list goes away with the hive, just drop the view */
+        if (CmView->ViewAddress) ExFreePoolWithTag(CmView->ViewAddress, TAG_CM);
+        ExFreePoolWithTag(CmView, TAG_CM);
 
         Hive->MappedViews--;
     }
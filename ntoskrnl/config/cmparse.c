@@ -226,12 +226,12 @@ CmpDoCreateChild(IN PHHIVE Hive,
     StorageType = Stable;
     if (ParseContext->CreateOptions & REG_OPTION_VOLATILE) StorageType = Volatile;
 
-    /* Allocate the child */
+    /* Allocate the child, close to its siblings */
     *KeyCell = HvAllocateCell(Hive,
                               FIELD_OFFSET(CM_KEY_NODE, Name) +
                               CmpNameSize(Hive, Name),
                               StorageType,
-                              HCELL_NIL);
+                              ParentCell);
     if (*KeyCell == HCELL_NIL)
     {
         /* Fail */
@@ -259,7 +259,7 @@ CmpDoCreateChild(IN PHHIVE Hive,
         ClassCell = HvAllocateCell(Hive,
                                    ParseContext->Class.Length,
                                    StorageType,
-                                   HCELL_NIL);
+                                   *KeyCell);
         if (ClassCell == HCELL_NIL)
         {
             /* Fail */
@@ -324,8 +324,8 @@ CmpInitHiveFromFile(IN PCUNICODE_STRING HiveName,
     }
     else
     {
-        /* Open it as a file */
-        Operation = HINIT_FILE;
+        /* Open it as a file, leaving the bins in it if we can */
+        Operation = CmpHiveViewLimit ? HINIT_MAPFILE : HINIT_FILE;
         *New = FALSE;
     }
 
@@ -362,6 +362,20 @@ CmpInitHiveFromFile(IN PCUNICODE_STRING HiveName,
                                NULL,
                                HiveName,
                                CheckFlags);
+    if (!NT_SUCCESS(Status) && (Operation == HINIT_MAPFILE))
+    {
+        /* The hive may need recovering from its log, load it whole then */
+        Status = CmpInitializeHive(&NewHive,
+                                   HINIT_FILE,
+                                   HiveFlags,
+                                   FileType,
+                                   NULL,
+                                   FileHandle,
+                                   LogHandle,
+                                   NULL,
+                                   HiveName,
+                                   CheckFlags);
+    }
     if (!NT_SUCCESS(Status))
     {
         /* Fail */
@@ -2075,9 +2089,9 @@ CmpAcquireTwoKcbLocksExclusiveByKey(IN ULONG ConvKey1,
     /* Sanity check */
     CMP_ASSERT_REGISTRY_LOCK();
 
-    /* Get hash indexes */
-    Index1 = GET_HASH_INDEX(ConvKey1);
-    Index2 = GET_HASH_INDEX(ConvKey2);
+    /* Get lock indexes */
+    Index1 = GET_HASH_LOCK_INDEX(ConvKey1);
+    Index2 = GET_HASH_LOCK_INDEX(ConvKey2);
 
     /* See which one is highest */
     if (Index1 < Index2)
@@ -2104,17 +2118,17 @@ CmpReleaseTwoKcbLockByKey(IN ULONG ConvKey1,
     /* Sanity check */
     CMP_ASSERT_REGISTRY_LOCK();
 
-    /* Get hash indexes */
-    Index1 = GET_HASH_INDEX(ConvKey1);
-    Index2 = GET_HASH_INDEX(ConvKey2);
-    ASSERT((GET_HASH_ENTRY(CmpCacheTable, ConvKey2)->Owner == KeGetCurrentThread()) ||
+    /* Get lock indexes */
+    Index1 = GET_HASH_LOCK_INDEX(ConvKey1);
+    Index2 = GET_HASH_LOCK_INDEX(ConvKey2);
+    ASSERT((GET_KCB_HASH_LOCK(ConvKey2)->Owner == KeGetCurrentThread()) ||
            (CmpTestRegistryLockExclusive()));
 
     /* See which one is highest */
     if (Index1 < Index2)
     {
         /* Grab them in the proper order */
-        ASSERT((GET_HASH_ENTRY(CmpCacheTable, ConvKey1)->Owner == KeGetCurrentThread()) ||
+        ASSERT((GET_KCB_HASH_LOCK(ConvKey1)->Owner == KeGetCurrentThread()) ||
                (CmpTestRegistryLockExclusive()));
         CmpReleaseKcbLockByKey(ConvKey2);
         CmpReleaseKcbLockByKey(ConvKey1);
@@ -2124,7 +2138,7 @@ CmpReleaseTwoKcbLockByKey(IN ULONG ConvKey1,
         /* Release the first one first, then the second */
         if (Index1 != Index2)
         {
-            ASSERT((GET_HASH_ENTRY(CmpCacheTable, ConvKey1)->Owner == KeGetCurrentThread()) ||
+            ASSERT((GET_KCB_HASH_LOCK(ConvKey1)->Owner == KeGetCurrentThread()) ||
                    (CmpTestRegistryLockExclusive()));
             CmpReleaseKcbLockByKey(ConvKey1);
         }
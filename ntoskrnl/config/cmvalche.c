@@ -37,6 +37,98 @@ CmpSetValueCached(IN PHCELL_INDEX CellIndex)
 #define ASSERT_VALUE_CACHE() \
     ASSERTMSG("Cached Values Not Yet Supported!", FALSE);
 
+/* Value lists at least this long get sorted for multiple value lookups */
+#define CMP_SORTED_VALUE_LOOKUP_MINIMUM     16
+
+typedef struct _CM_VALUE_HASH
+{
+    ULONG Hash;
+    HCELL_INDEX Cell;
+} CM_VALUE_HASH, *PCM_VALUE_HASH;
+
+static
+LONG
+CmpCompareValueName(IN PCUNICODE_STRING Name,
+                    IN PCM_KEY_VALUE KeyValue)
+{
+    UNICODE_STRING SearchName;
+
+    /* Is it compressed? */
+    if (KeyValue->Flags & VALUE_COMP_NAME)
+    {
+        /* It is, do a compressed name comparison */
+        return CmpCompareCompressedName(Name,
+                                        KeyValue->Name,
+                                        KeyValue->NameLength);
+    }
+
+    /* It's not compressed, so do a standard comparison */
+    SearchName.Length = KeyValue->NameLength;
+    SearchName.MaximumLength = SearchName.Length;
+    SearchName.Buffer = KeyValue->Name;
+    return RtlCompareUnicodeString(Name, &SearchName, TRUE);
+}
+
+static
+ULONG
+CmpHashValueName(IN PCUNICODE_STRING Name OPTIONAL,
+                 IN PCM_KEY_VALUE KeyValue OPTIONAL)
+{
+    ULONG Hash = 0, Length, i;
+    WCHAR Char;
+
+    /* Hash the characters upcased, so that equal names hash the same */
+    if (Name)
+    {
+        Length = Name->Length / sizeof(WCHAR);
+    }
+    else if (KeyValue->Flags & VALUE_COMP_NAME)
+    {
+        Length = KeyValue->NameLength;
+    }
+    else
+    {
+        Length = KeyValue->NameLength / sizeof(WCHAR);
+    }
+
+    for (i = 0; i < Length; i++)
+    {
+        if (Name)
+            Char = Name->Buffer[i];
+        else if (KeyValue->Flags & VALUE_COMP_NAME)
+            Char = ((PUCHAR)KeyValue->Name)[i];
+        else
+            Char = KeyValue->Name[i];
+
+        Hash = 37 * Hash + RtlUpcaseUnicodeChar(Char);
+    }
+
+    return Hash;
+}
+
+static
+VOID
+CmpSortValueHashes(IN OUT PCM_VALUE_HASH Hashes,
+                   IN ULONG Count)
+{
+    CM_VALUE_HASH Entry;
+    ULONG Gap, i, j;
+
+    /* Shell sort, value lists aren't that long and it needs no extra memory */
+    for (Gap = Count / 2; Gap; Gap /= 2)
+    {
+        for (i = Gap; i < Count; i++)
+        {
+            Entry = Hashes[i];
+            for (j = i; (j >= Gap) && (Hashes[j - Gap].Hash > Entry.Hash); j -= Gap)
+            {
+                Hashes[j] = Hashes[j - Gap];
+            }
+            Hashes[j] = Entry;
+        }
+    }
+}
+
 /* FUNCTIONS *****************************************************************/
 
 VALUE_SEARCH_RETURN_TYPE
@@ -202,10 +294,8 @@ CmpFindValueByNameFromCache(IN PCM_KEY_CONTROL_BLOCK Kcb,
     PHHIVE Hive;
     VALUE_SEARCH_RETURN_TYPE SearchResult = SearchFail;
     LONG Result;
-    UNICODE_STRING SearchName;
     PCELL_DATA CellData;
     PCACHED_CHILD_LIST ChildList;
-    PCM_KEY_VALUE KeyValue;
     BOOLEAN IndexIsCached;
     ULONG i = 0;
     HCELL_INDEX Cell = HCELL_NIL;
@@ -274,23 +364,8 @@ CmpFindValueByNameFromCache(IN PCM_KEY_CONTROL_BLOCK Kcb,
             }
             else
             {
-                /* No cache, so try to compare the name. Is it compressed? */
-                KeyValue = *Value;
-                if (KeyValue->Flags & VALUE_COMP_NAME)
-                {
-                    /* It is, do a compressed name comparison */
-                    Result = CmpCompareCompressedName(Name,
-                                                      KeyValue->Name,
-                                                      KeyValue->NameLength);
-                }
-                else
-                {
-                    /* It's not compressed, so do a standard comparison */
-                    SearchName.Length = KeyValue->NameLength;
-                    SearchName.MaximumLength = SearchName.Length;
-                    SearchName.Buffer = KeyValue->Name;
-                    Result = RtlCompareUnicodeString(Name, &SearchName, TRUE);
-                }
+                /* No cache, so try to compare the name */
+                Result = CmpCompareValueName(Name, *Value);
             }
 
             /* Check if we found the value data */
@@ -322,6 +397,137 @@ Quickie:
     return SearchResult;
 }
 
+VALUE_SEARCH_RETURN_TYPE
+NTAPI
+CmpFindValuesByNameFromCache(IN PCM_KEY_CONTROL_BLOCK Kcb,
+                             IN PCUNICODE_STRING Names,
+                             IN ULONG NameCount,
+                             OUT PHCELL_INDEX ValueCells)
+{
+    PHHIVE Hive;
+    VALUE_SEARCH_RETURN_TYPE SearchResult;
+    PCELL_DATA CellData;
+    PCACHED_CHILD_LIST ChildList;
+    PCM_KEY_VALUE KeyValue;
+    PCM_VALUE_HASH Hashes = NULL;
+    BOOLEAN IndexIsCached;
+    HCELL_INDEX Cell = HCELL_NIL;
+    ULONG Hash, Left, Right, Middle, Found = 0, i, j;
+
+    /* Nothing found yet */
+    for (i = 0; i < NameCount; i++) ValueCells[i] = HCELL_NIL;
+
+    /* Get the hive and child list */
+    Hive = Kcb->KeyHive;
+    ChildList = &Kcb->ValueCache;
+    if (ChildList->Count == 0) return SearchSuccess;
+
+    /* Get the value list associated to this child list, only once for all names */
+    SearchResult = CmpGetValueListFromCache(Kcb, &CellData, &IndexIsCached, &Cell);
+    if (SearchResult != SearchSuccess)
+    {
+        /* We either failed or need the exclusive lock */
+        ASSERT((SearchResult == SearchFail) || !(CmpIsKcbLockedExclusive(Kcb)));
+        ASSERT(Cell == HCELL_NIL);
+        return SearchResult;
+    }
+
+    /* The index shouldn't be cached right now */
+    if (IndexIsCached) ASSERT_VALUE_CACHE();
+
+    //
+    // With many names and a long value list, hash every value name once and
+    // sort them, so that each name is found with a binary search. If there
+    // is no memory for that, fall back to the linear walk below.
+    //
+    if ((NameCount > 1) && (ChildList->Count >= CMP_SORTED_VALUE_LOOKUP_MINIMUM))
+    {
+        Hashes = ExAllocatePoolWithTag(PagedPool,
+                                       ChildList->Count * sizeof(CM_VALUE_HASH),
+                                       TAG_CM);
+    }
+
+    if (Hashes)
+    {
+        for (i = 0; i < ChildList->Count; i++)
+        {
+            KeyValue = (PCM_KEY_VALUE)HvGetCell(Hive, CellData->u.KeyList[i]);
+            if (!KeyValue)
+            {
+                SearchResult = SearchFail;
+                goto Quickie;
+            }
+
+            Hashes[i].Hash = CmpHashValueName(NULL, KeyValue);
+            Hashes[i].Cell = CellData->u.KeyList[i];
+            HvReleaseCell(Hive, CellData->u.KeyList[i]);
+        }
+        CmpSortValueHashes(Hashes, ChildList->Count);
+
+        for (i = 0; i < NameCount; i++)
+        {
+            /* Find the first value with the same hash */
+            Hash = CmpHashValueName(&Names[i], NULL);
+            Left = 0;
+            Right = ChildList->Count;
+            while (Left < Right)
+            {
+                Middle = Left + (Right - Left) / 2;
+                if (Hashes[Middle].Hash < Hash)
+                    Left = Middle + 1;
+                else
+                    Right = Middle;
+            }
+
+            /* And compare the names of all of those */
+            for (j = Left; (j < ChildList->Count) && (Hashes[j].Hash == Hash); j++)
+            {
+                KeyValue = (PCM_KEY_VALUE)HvGetCell(Hive, Hashes[j].Cell);
+                if (!KeyValue)
+                {
+                    SearchResult = SearchFail;
+                    goto Quickie;
+                }
+
+                if (!CmpCompareValueName(&Names[i], KeyValue)) ValueCells[i] = Hashes[j].Cell;
+                HvReleaseCell(Hive, Hashes[j].Cell);
+                if (ValueCells[i] != HCELL_NIL) break;
+            }
+        }
+    }
+    else
+    {
+        /* Walk the value list once, matching every name not found so far */
+        for (i = 0; (i < ChildList->Count) && (Found < NameCount); i++)
+        {
+            KeyValue = (PCM_KEY_VALUE)HvGetCell(Hive, CellData->u.KeyList[i]);
+            if (!KeyValue)
+            {
+                SearchResult = SearchFail;
+                goto Quickie;
+            }
+
+            for (j = 0; j < NameCount; j++)
+            {
+                if ((ValueCells[j] == HCELL_NIL) &&
+                    !(CmpCompareValueName(&Names[j], KeyValue)))
+                {
+                    ValueCells[j] = CellData->u.KeyList[i];
+                    Found++;
+                }
+            }
+
+            HvReleaseCell(Hive, CellData->u.KeyList[i]);
+        }
+    }
+
+Quickie:
+    /* Release the value list cell and the sorted hashes */
+    if (Hashes) ExFreePoolWithTag(Hashes, TAG_CM);
+    if (Cell != HCELL_NIL) HvReleaseCell(Hive, Cell);
+    return SearchResult;
+}
+
 VALUE_SEARCH_RETURN_TYPE
 NTAPI
 CmpQueryKeyValueData(IN PCM_KEY_CONTROL_BLOCK Kcb,
@@ -1107,8 +1107,145 @@ NtQueryMultipleValueKey(IN HANDLE KeyHandle,
                         IN OUT PULONG Length,
                         OUT PULONG ReturnLength)
 {
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    NTSTATUS Status;
+    PCM_KEY_BODY KeyObject;
+    REG_QUERY_MULTIPLE_VALUE_KEY_INFORMATION QueryMultipleValueKeyInfo;
+    REG_POST_OPERATION_INFORMATION PostOperationInfo;
+    PUNICODE_STRING ValueNames;
+    ULONG BufferLength = 0, ResultLength = 0, Captured = 0, i;
+    PAGED_CODE();
+    DPRINT("NtQueryMultipleValueKey() KH 0x%p, Count %lu\n", KeyHandle, NumberOfValues);
+
+    /* Make sure the value entries can't overflow */
+    if (NumberOfValues > MAXULONG / sizeof(KEY_VALUE_ENTRY))
+        return STATUS_INVALID_PARAMETER;
+
+    /* Verify that the handle is valid and is a registry key */
+    Status = ObReferenceObjectByHandle(KeyHandle,
+                                       KEY_QUERY_VALUE,
+                                       CmpKeyObjectType,
+                                       PreviousMode,
+                                       (PVOID*)&KeyObject,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Allocate the captured names */
+    ValueNames = ExAllocatePoolWithTag(PagedPool,
+                                       max(NumberOfValues, 1) * sizeof(UNICODE_STRING),
+                                       TAG_CM);
+    if (!ValueNames)
+    {
+        ObDereferenceObject(KeyObject);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    _SEH2_TRY
+    {
+        if (PreviousMode != KernelMode)
+        {
+            ProbeForWrite(ValueList,
+                          NumberOfValues * sizeof(KEY_VALUE_ENTRY),
+                          sizeof(ULONG));
+            ProbeForWriteUlong(Length);
+            if (ReturnLength) ProbeForWriteUlong(ReturnLength);
+        }
+
+        BufferLength = *Length;
+        if (PreviousMode != KernelMode)
+        {
+            ProbeForWrite(Buffer, BufferLength, sizeof(ULONG));
+        }
+
+        /* Capture the value names */
+        for (Captured = 0; Captured < NumberOfValues; Captured++)
+        {
+            Status = ProbeAndCaptureUnicodeString(&ValueNames[Captured],
+                                                  PreviousMode,
+                                                  ValueList[Captured].ValueName);
+            if (!NT_SUCCESS(Status)) _SEH2_LEAVE;
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    for (i = 0; NT_SUCCESS(Status) && (i < NumberOfValues); i++)
+    {
+        /* Make sure the name is aligned properly */
+        if ((ValueNames[i].Length & (sizeof(WCHAR) - 1)))
+        {
+            /* It isn't, so we'll fail */
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        /* Ignore any null characters at the end */
+        while ((ValueNames[i].Length) &&
+               !(ValueNames[i].Buffer[ValueNames[i].Length / sizeof(WCHAR) - 1]))
+        {
+            /* Skip it */
+            ValueNames[i].Length -= sizeof(WCHAR);
+        }
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        /* Setup the callback */
+        PostOperationInfo.Object = (PVOID)KeyObject;
+        QueryMultipleValueKeyInfo.Object = (PVOID)KeyObject;
+        QueryMultipleValueKeyInfo.ValueEntries = ValueList;
+        QueryMultipleValueKeyInfo.EntryCount = NumberOfValues;
+        QueryMultipleValueKeyInfo.ValueBuffer = Buffer;
+        QueryMultipleValueKeyInfo.BufferLength = Length;
+        QueryMultipleValueKeyInfo.RequiredBufferLength = ReturnLength;
+
+        /* Do the callback */
+        Status = CmiCallRegisteredCallbacks(RegNtPreQueryMultipleValueKey,
+                                            &QueryMultipleValueKeyInfo);
+        if (NT_SUCCESS(Status))
+        {
+            /* Call the internal API */
+            Status = CmQueryMultipleValueKey(KeyObject->KeyControlBlock,
+                                             ValueNames,
+                                             ValueList,
+                                             NumberOfValues,
+                                             Buffer,
+                                             BufferLength,
+                                             &ResultLength);
+            if (NT_SUCCESS(Status) || (Status == STATUS_BUFFER_OVERFLOW))
+            {
+                /* Return the length used, or the one needed */
+                _SEH2_TRY
+                {
+                    *Length = ResultLength;
+                    if (ReturnLength) *ReturnLength = ResultLength;
+                }
+                _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+                {
+                    Status = _SEH2_GetExceptionCode();
+                }
+                _SEH2_END;
+            }
+
+            /* Do the post callback */
+            PostOperationInfo.Status = Status;
+            CmiCallRegisteredCallbacks(RegNtPostQueryMultipleValueKey, &PostOperationInfo);
+        }
+    }
+
+    /* Release the captured names */
+    for (i = 0; i < Captured; i++)
+    {
+        ReleaseCapturedUnicodeString(&ValueNames[i], PreviousMode);
+    }
+    ExFreePoolWithTag(ValueNames, TAG_CM);
+
+    /* Dereference and return status */
+    ObDereferenceObject(KeyObject);
+    return Status;
 }
 
 NTSTATUS
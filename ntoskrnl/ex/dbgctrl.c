@@ -144,6 +144,205 @@ ExpDebuggerWorker(IN PVOID Context)
 }
 // #endif /* _WINKD_ */
 
+static
+NTSTATUS
+ExpSpinLockProfileControl(IN SYSDBG_COMMAND ControlCode,
+                          IN PVOID InputBuffer,
+                          IN ULONG InputBufferLength,
+                          OUT PVOID OutputBuffer,
+                          IN ULONG OutputBufferLength,
+                          OUT PULONG ReturnLength OPTIONAL)
+{
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    BOOLEAN Enable;
+    ULONG Length = 0;
+    NTSTATUS Status;
+    PAGED_CODE();
+
+    /* The profile shows kernel addresses, so this is for debuggers only */
+    if (!SeSinglePrivilegeCheck(SeDebugPrivilege, PreviousMode))
+    {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    _SEH2_TRY
+    {
+        if (PreviousMode != KernelMode)
+        {
+            if (InputBufferLength) ProbeForRead(InputBuffer, InputBufferLength, sizeof(UCHAR));
+            if (OutputBufferLength) ProbeForWrite(OutputBuffer, OutputBufferLength, sizeof(ULONG));
+            if (ReturnLength) ProbeForWriteUlong(ReturnLength);
+        }
+
+        if (ControlCode == SysDbgSetSpinLockProfile)
+        {
+            /* The input is a BOOLEAN telling whether to start or stop it */
+            if (InputBufferLength != sizeof(BOOLEAN)) _SEH2_YIELD(return STATUS_INFO_LENGTH_MISMATCH);
+            Enable = *(PBOOLEAN)InputBuffer;
+            Status = KeSetSpinLockProfile(Enable);
+        }
+        else
+        {
+            /* Return an array of SYSDBG_SPINLOCK_PROFILE_ENTRY */
+            Status = KeQuerySpinLockProfile(OutputBuffer, OutputBufferLength, &Length);
+        }
+
+        if (ReturnLength) *ReturnLength = Length;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
+}
+
+static
+NTSTATUS
+ExpWorkQueueStatisticsControl(OUT PVOID OutputBuffer,
+                              IN ULONG OutputBufferLength,
+                              OUT PULONG ReturnLength OPTIONAL)
+{
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    ULONG Length = 0;
+    NTSTATUS Status;
+    PAGED_CODE();
+
+    /* These are only counters, so monitoring tools just need profiling rights */
+    if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+    {
+        return STATUS_PRIVILEGE_NOT_HELD;
+    }
+
+    _SEH2_TRY
+    {
+        if (PreviousMode != KernelMode)
+        {
+            if (OutputBufferLength) ProbeForWrite(OutputBuffer, OutputBufferLength, sizeof(ULONG));
+            if (ReturnLength) ProbeForWriteUlong(ReturnLength);
+        }
+
+        /* Return an array of SYSDBG_WORK_QUEUE_STATISTICS */
+        Status = ExpQueryWorkQueueStatistics(OutputBuffer, OutputBufferLength, &Length);
+        if (ReturnLength) *ReturnLength = Length;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
+}
+
+static
+NTSTATUS
+ExpSchedTraceControl(IN SYSDBG_COMMAND ControlCode,
+                     IN PVOID InputBuffer,
+                     IN ULONG InputBufferLength,
+                     OUT PVOID OutputBuffer,
+                     IN ULONG OutputBufferLength,
+                     OUT PULONG ReturnLength OPTIONAL)
+{
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    BOOLEAN Enable;
+    ULONG Length = 0;
+    NTSTATUS Status;
+    PAGED_CODE();
+
+    /* The trace only shows thread IDs, so profiling rights are enough */
+    if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+    {
+        return STATUS_PRIVILEGE_NOT_HELD;
+    }
+
+    _SEH2_TRY
+    {
+        if (PreviousMode != KernelMode)
+        {
+            if (InputBufferLength) ProbeForRead(InputBuffer, InputBufferLength, sizeof(UCHAR));
+            if (OutputBufferLength) ProbeForWrite(OutputBuffer, OutputBufferLength, sizeof(ULONG));
+            if (ReturnLength) ProbeForWriteUlong(ReturnLength);
+        }
+
+        if (ControlCode == SysDbgSetSchedTrace)
+        {
+            /* The input is a BOOLEAN telling whether to start or stop it */
+            if (InputBufferLength != sizeof(BOOLEAN)) _SEH2_YIELD(return STATUS_INFO_LENGTH_MISMATCH);
+            Enable = *(PBOOLEAN)InputBuffer;
+            Status = KeSetSchedTrace(Enable);
+        }
+        else
+        {
+            /* Drain the trace into an array of SYSDBG_SCHED_TRACE_ENTRY */
+            Status = KeQuerySchedTrace(OutputBuffer, OutputBufferLength, &Length);
+        }
+
+        if (ReturnLength) *ReturnLength = Length;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
+}
+
+static
+NTSTATUS
+ExpStackProfileControl(IN SYSDBG_COMMAND ControlCode,
+                       IN PVOID InputBuffer,
+                       IN ULONG InputBufferLength,
+                       OUT PVOID OutputBuffer,
+                       IN ULONG OutputBufferLength,
+                       OUT PULONG ReturnLength OPTIONAL)
+{
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    SYSDBG_STACK_PROFILE_CONTROL Control;
+    ULONG Length = 0;
+    NTSTATUS Status;
+    PAGED_CODE();
+
+    /* Same rights as NtCreateProfile on the whole system */
+    if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+    {
+        return STATUS_PRIVILEGE_NOT_HELD;
+    }
+
+    _SEH2_TRY
+    {
+        if (PreviousMode != KernelMode)
+        {
+            if (InputBufferLength) ProbeForRead(InputBuffer, InputBufferLength, sizeof(ULONG));
+            if (OutputBufferLength) ProbeForWrite(OutputBuffer, OutputBufferLength, sizeof(ULONG_PTR));
+            if (ReturnLength) ProbeForWriteUlong(ReturnLength);
+        }
+
+        if (ControlCode == SysDbgSetStackProfile)
+        {
+            if (InputBufferLength != sizeof(SYSDBG_STACK_PROFILE_CONTROL)) _SEH2_YIELD(return STATUS_INFO_LENGTH_MISMATCH);
+            Control = *(PSYSDBG_STACK_PROFILE_CONTROL)InputBuffer;
+            Status = KeSetStackProfile(Control.Enable, Control.Interval);
+        }
+        else
+        {
+            /* Drain the samples into an array of SYSDBG_STACK_PROFILE_ENTRY */
+            Status = KeQueryStackProfile(OutputBuffer, OutputBufferLength, &Length);
+        }
+
+        if (ReturnLength) *ReturnLength = Length;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
+}
+
 /*++
  * @name NtSystemDebugControl
  * @implemented
@@ -230,6 +429,31 @@ NtSystemDebugControl(SYSDBG_COMMAND ControlCode,
                 InputBuffer, InputBufferLength,
                 OutputBuffer, OutputBufferLength,
                 ReturnLength, KeGetPreviousMode());
+        case SysDbgQuerySpinLockProfile:
+        case SysDbgSetSpinLockProfile:
+            return ExpSpinLockProfileControl(
+                ControlCode,
+                InputBuffer, InputBufferLength,
+                OutputBuffer, OutputBufferLength,
+                ReturnLength);
+        case SysDbgQueryWorkQueueStatistics:
+            return ExpWorkQueueStatisticsControl(
+                OutputBuffer, OutputBufferLength,
+                ReturnLength);
+        case SysDbgQuerySchedTrace:
+        case SysDbgSetSchedTrace:
+            return ExpSchedTraceControl(
+                ControlCode,
+                InputBuffer, InputBufferLength,
+                OutputBuffer, OutputBufferLength,
+                ReturnLength);
+        case SysDbgQueryStackProfile:
+        case SysDbgSetStackProfile:
+            return ExpStackProfileControl(
+                ControlCode,
+                InputBuffer, InputBufferLength,
+                OutputBuffer, OutputBufferLength,
+                ReturnLength);
         default:
             return STATUS_INVALID_INFO_CLASS;
     }
@@ -20,6 +20,40 @@ EX_PUSH_LOCK HandleTableListLock;
 #define SizeOfHandle(x) (sizeof(HANDLE) * (x))
 #define INDEX_TO_HANDLE_VALUE(x) ((x) << HANDLE_TAG_BITS)
 
+/* Number of free handles a processor keeps before giving them back */
+#define EXP_HANDLE_FREE_LIST_DEPTH  64
+
+//
+// Once a handle table grows past its first page, each processor gets its own
+// list of free handles, so that creating and closing handles on different
+// processors doesn't contend on the FirstFree chain. Handles go back to the
+// global chain as a batch once a list is full, or when the table would
+// otherwise have to grow.
+//
+typedef struct DECLSPEC_CACHEALIGN _EXP_HANDLE_FREE_LIST
+{
+    EX_PUSH_LOCK Lock;
+    ULONG FirstFree;
+    ULONG LastFree;
+    ULONG Count;
+} EXP_HANDLE_FREE_LIST, *PEXP_HANDLE_FREE_LIST;
+
+C_ASSERT(sizeof(EXP_HANDLE_FREE_LIST) * MAXIMUM_PROCESSORS <= PAGE_SIZE);
+
+//
+// The per-processor lists are kernel private, so they live right behind the
+// public part of the handle table
+//
+typedef struct _EXP_HANDLE_TABLE
+{
+    HANDLE_TABLE Table;
+    PEXP_HANDLE_FREE_LIST FreeLists;
+    ULONG FreeListCount;
+} EXP_HANDLE_TABLE, *PEXP_HANDLE_TABLE;
+
+#define ExpGetHandleTableExtension(HandleTable) \
+    CONTAINING_RECORD((HandleTable), EXP_HANDLE_TABLE, Table)
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 VOID
@@ -46,13 +80,19 @@ ExpLookupHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     Handle.TagBits = 0;
 
     /* Check if the handle is in the allocated range */
-    if (Handle.Value >= HandleTable->NextHandleNeedingPool)
+    if (Handle.Value >= *(volatile ULONG *)&HandleTable->NextHandleNeedingPool)
     {
         return NULL;
     }
 
-    /* Get the table code */
-    TableBase = HandleTable->TableCode;
+    //
+    // Get the table code. This takes no lock: a growing table publishes its new
+    // pages and levels before raising NextHandleNeedingPool, and the old levels
+    // stay linked into the new ones until the table is freed, so whichever
+    // table code we see still leads to the entry.
+    //
+    KeMemoryBarrier();
+    TableBase = *(volatile ULONG_PTR *)&HandleTable->TableCode;
 
     /* Extract the table level and actual table base */
     TableLevel = (ULONG)(TableBase & 3);
@@ -176,6 +216,104 @@ ExpFreeLowLevelTable(IN PEPROCESS Process,
     ExpFreeTablePagedPool(Process, TableEntry, PAGE_SIZE);
 }
 
+VOID
+NTAPI
+ExpEnableHandleFreeLists(IN PHANDLE_TABLE HandleTable)
+{
+    PEXP_HANDLE_TABLE Extension = ExpGetHandleTableExtension(HandleTable);
+    PEXP_HANDLE_FREE_LIST FreeLists;
+    ULONG i;
+    PAGED_CODE();
+
+    /* Nothing to do if we have them already, or if they wouldn't help */
+    if ((Extension->FreeLists) ||
+        (HandleTable->StrictFIFO) ||
+        (KeNumberProcessors == 1))
+    {
+        return;
+    }
+
+    /* Allocate a whole page, so that each list gets its own cache line */
+    FreeLists = ExpAllocateTablePagedPool(HandleTable->QuotaProcess, PAGE_SIZE);
+    if (!FreeLists) return;
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        ExInitializePushLock(&FreeLists[i].Lock);
+    }
+
+    /* Publish the lists, the count first */
+    Extension->FreeListCount = KeNumberProcessors;
+    InterlockedExchangePointer((PVOID*)&Extension->FreeLists, FreeLists);
+}
+
+VOID
+NTAPI
+ExpReturnFreeListHandles(IN PHANDLE_TABLE HandleTable,
+                         IN PEXP_HANDLE_FREE_LIST FreeList)
+{
+    PHANDLE_TABLE_ENTRY LastEntry;
+    EXHANDLE Handle;
+    ULONG OldValue;
+
+    /* Nothing to do if the list is empty */
+    if (!FreeList->FirstFree) return;
+
+    /* Get the entry at the end of the list */
+    Handle.Value = FreeList->LastFree;
+    LastEntry = ExpLookupHandleTableEntry(HandleTable, Handle);
+    ASSERT(LastEntry != NULL);
+
+    //
+    // Push the whole list on the global LastFree chain at once. Nobody else can
+    // see these entries, so unlike a pop this is safe without any table lock.
+    //
+    for (;;)
+    {
+        OldValue = HandleTable->LastFree;
+        LastEntry->NextFreeTableEntry = OldValue;
+        if (InterlockedCompareExchange((PLONG)&HandleTable->LastFree,
+                                       FreeList->FirstFree,
+                                       OldValue) == OldValue)
+        {
+            break;
+        }
+    }
+
+    /* The list is empty now */
+    FreeList->FirstFree = 0;
+    FreeList->LastFree = 0;
+    FreeList->Count = 0;
+}
+
+BOOLEAN
+NTAPI
+ExpFlushHandleFreeLists(IN PHANDLE_TABLE HandleTable)
+{
+    PEXP_HANDLE_TABLE Extension = ExpGetHandleTableExtension(HandleTable);
+    PEXP_HANDLE_FREE_LIST FreeList;
+    BOOLEAN Flushed = FALSE;
+    ULONG i;
+
+    /* Give the handles of every processor back to the global chain */
+    if (!Extension->FreeLists) return FALSE;
+    for (i = 0; i < Extension->FreeListCount; i++)
+    {
+        FreeList = &Extension->FreeLists[i];
+        if (!FreeList->FirstFree) continue;
+
+        ExAcquirePushLockExclusive(&FreeList->Lock);
+        if (FreeList->FirstFree)
+        {
+            ExpReturnFreeListHandles(HandleTable, FreeList);
+            Flushed = TRUE;
+        }
+        ExReleasePushLockExclusive(&FreeList->Lock);
+    }
+
+    return Flushed;
+}
+
 VOID
 NTAPI
 ExpFreeHandleTable(IN PHANDLE_TABLE HandleTable)
@@ -244,6 +382,14 @@ ExpFreeHandleTable(IN PHANDLE_TABLE HandleTable)
                               SizeOfHandle(HIGH_LEVEL_ENTRIES));
     }
 
+    /* Free the per-processor free lists */
+    if (ExpGetHandleTableExtension(HandleTable)->FreeLists)
+    {
+        ExpFreeTablePagedPool(Process,
+                              ExpGetHandleTableExtension(HandleTable)->FreeLists,
+                              PAGE_SIZE);
+    }
+
     /* Free the actual table and check if we need to release quota */
     ExFreePoolWithTag(HandleTable, TAG_OBJECT_TABLE);
     if (Process)
@@ -258,6 +404,8 @@ ExpFreeHandleTableEntry(IN PHANDLE_TABLE HandleTable,
                         IN EXHANDLE Handle,
                         IN PHANDLE_TABLE_ENTRY HandleTableEntry)
 {
+    PEXP_HANDLE_TABLE Extension = ExpGetHandleTableExtension(HandleTable);
+    PEXP_HANDLE_FREE_LIST FreeList;
     ULONG OldValue, *Free;
     ULONG LockIndex;
     PAGED_CODE();
@@ -272,6 +420,26 @@ ExpFreeHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     /* Mark the handle as free */
     Handle.TagBits = 0;
 
+    /* Check if we can keep it on the free list of this processor */
+    if (Extension->FreeLists)
+    {
+        FreeList = &Extension->FreeLists[KeGetCurrentProcessorNumber() %
+                                         Extension->FreeListCount];
+        ExAcquirePushLockExclusive(&FreeList->Lock);
+
+        /* Push it, and give the whole batch back once we have enough */
+        HandleTableEntry->NextFreeTableEntry = FreeList->FirstFree;
+        FreeList->FirstFree = Handle.AsULONG;
+        if (!FreeList->LastFree) FreeList->LastFree = Handle.AsULONG;
+        if (++FreeList->Count >= EXP_HANDLE_FREE_LIST_DEPTH)
+        {
+            ExpReturnFreeListHandles(HandleTable, FreeList);
+        }
+
+        ExReleasePushLockExclusive(&FreeList->Lock);
+        return;
+    }
+
     /* Check if we're FIFO */
     if (!HandleTable->StrictFIFO)
     {
@@ -314,9 +482,9 @@ ExpAllocateHandleTable(IN PEPROCESS Process OPTIONAL,
     ULONG i;
     PAGED_CODE();
 
-    /* Allocate the table */
+    /* Allocate the table, along with our private part */
     HandleTable = ExAllocatePoolWithTag(PagedPool,
-                                        sizeof(HANDLE_TABLE),
+                                        sizeof(EXP_HANDLE_TABLE),
                                         TAG_OBJECT_TABLE);
     if (!HandleTable) return NULL;
 
@@ -327,7 +495,7 @@ ExpAllocateHandleTable(IN PEPROCESS Process OPTIONAL,
     }
 
     /* Clear the table */
-    RtlZeroMemory(HandleTable, sizeof(HANDLE_TABLE));
+    RtlZeroMemory(HandleTable, sizeof(EXP_HANDLE_TABLE));
 
     /* Now allocate the first level structures */
     HandleTableTable = ExpAllocateTablePagedPoolNoZero(Process, PAGE_SIZE);
@@ -601,6 +769,9 @@ ExpAllocateHandleTableEntrySlow(IN PHANDLE_TABLE HandleTable,
                                                  FirstFree);
             if (NewFree == FirstFree) break;
         }
+
+        /* The table is getting bigger, give each processor its free list */
+        ExpEnableHandleFreeLists(HandleTable);
     }
 
     /* All done */
@@ -642,6 +813,47 @@ ExpMoveFreeHandles(IN PHANDLE_TABLE HandleTable)
     return LastFree;
 }
 
+PHANDLE_TABLE_ENTRY
+NTAPI
+ExpAllocateHandleFromFreeList(IN PHANDLE_TABLE HandleTable,
+                              OUT PEXHANDLE NewHandle)
+{
+    PEXP_HANDLE_TABLE Extension = ExpGetHandleTableExtension(HandleTable);
+    PEXP_HANDLE_FREE_LIST FreeList;
+    PHANDLE_TABLE_ENTRY Entry = NULL;
+    EXHANDLE Handle;
+
+    /* Get the list of this processor, and don't bother locking it if empty */
+    FreeList = &Extension->FreeLists[KeGetCurrentProcessorNumber() %
+                                     Extension->FreeListCount];
+    if (!FreeList->FirstFree) return NULL;
+
+    //
+    // Pop the first handle. Pops and pushes both hold the list lock, so the
+    // next link can't change under us.
+    //
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&FreeList->Lock);
+    if (FreeList->FirstFree)
+    {
+        Handle.Value = FreeList->FirstFree;
+        Entry = ExpLookupHandleTableEntry(HandleTable, Handle);
+        ASSERT(Entry != NULL);
+
+        FreeList->FirstFree = Entry->NextFreeTableEntry;
+        if (!--FreeList->Count) FreeList->LastFree = 0;
+        ASSERT((FreeList->Count != 0) == (FreeList->FirstFree != 0));
+    }
+    ExReleasePushLockExclusive(&FreeList->Lock);
+    KeLeaveCriticalRegion();
+    if (!Entry) return NULL;
+
+    /* Increase the number of handles and return the handle and the entry */
+    InterlockedIncrement(&HandleTable->HandleCount);
+    *NewHandle = Handle;
+    return Entry;
+}
+
 PHANDLE_TABLE_ENTRY
 NTAPI
 ExpAllocateHandleTableEntry(IN PHANDLE_TABLE HandleTable,
@@ -653,6 +865,13 @@ ExpAllocateHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     BOOLEAN Result;
     ULONG i;
 
+    /* Try the free list of this processor first */
+    if (ExpGetHandleTableExtension(HandleTable)->FreeLists)
+    {
+        Entry = ExpAllocateHandleFromFreeList(HandleTable, NewHandle);
+        if (Entry) return Entry;
+    }
+
     /* Start allocation loop */
     for (;;)
     {
@@ -674,8 +893,12 @@ ExpAllocateHandleTableEntry(IN PHANDLE_TABLE HandleTable,
                 break;
             }
 
-            /* Now move any free handles */
+            /* Now move any free handles, including those of the other processors */
             OldValue = ExpMoveFreeHandles(HandleTable);
+            if (!(OldValue) && (ExpFlushHandleFreeLists(HandleTable)))
+            {
+                OldValue = ExpMoveFreeHandles(HandleTable);
+            }
             if (OldValue)
             {
                 /* Another thread has already moved them, bail out */
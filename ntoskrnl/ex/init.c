@@ -546,8 +546,11 @@ ExpLoadInitialProcess(IN PINIT_BUFFER InitBuffer,
     RtlAppendUnicodeStringToString(&Environment, &NtSystemRoot);
     RtlAppendUnicodeStringToString(&Environment, &NullString);
 
-    /* Prepare the prefetcher */
-    //CcPfBeginBootPhase(150);
+    /* The session manager phase starts, prepare the prefetcher */
+    IopBootTracePhase(PfSessionManagerInitPhase);
+#ifndef NEWCC
+    CcPfBeginBootPhase(PfSessionManagerInitPhase);
+#endif
 
     /* Create SMSS process */
     SmssName = ProcessParams->ImagePathName;
@@ -955,6 +958,9 @@ ExpInitializeExecutive(IN ULONG Cpu,
         return;
     }
 
+    /* Remember when the kernel started, for the boot timeline */
+    IopInitBootTraceTimes(LoaderBlock);
+
     /* Assume no text-mode or remote boot */
     ExpInTextModeSetup = FALSE;
     IoRemoteBootClient = FALSE;
@@ -1650,6 +1656,12 @@ Phase1InitializationDiscard(IN PVOID Context)
     /* Initialize Prefetcher */
     CcPfInitializePrefetcher();
 
+    /* Start profiling spinlocks if we were asked to */
+    if (KiSpinLockProfileAtBoot) KeSetSpinLockProfile(TRUE);
+
+    /* Same for the scheduler trace */
+    if (KiSchedTraceAtBoot) KeSetSchedTrace(TRUE);
+
     /* Update progress bar */
     InbvUpdateProgressBar(15);
 
@@ -1777,6 +1789,7 @@ Phase1InitializationDiscard(IN PVOID Context)
 
             /* Setup boot logging */
             //IopInitializeBootLogging(LoaderBlock, InitBuffer->BootlogHeader);
+            IopInitBootLog(TRUE);
         }
     }
 
@@ -1800,6 +1813,9 @@ Phase1InitializationDiscard(IN PVOID Context)
     /* Initialize the I/O Subsystem */
     if (!IoInitSystem(LoaderBlock)) KeBugCheck(IO1_INITIALIZATION_FAILED);
 
+    /* Boot devices are up and the system volume is mounted, save the boot log */
+    IopSaveBootLogToFile();
+
     /* Set maximum update to 100% */
     InbvSetProgressBarSubset(0, 100);
 
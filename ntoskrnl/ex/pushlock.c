@@ -15,6 +15,7 @@
 /* DATA **********************************************************************/
 
 ULONG ExPushLockSpinCount = 0;
+EX_SPIN_WAIT_STATISTICS ExpPushLockSpinStatistics;
 
 #undef EX_PUSH_LOCK
 #undef PEX_PUSH_LOCK
@@ -37,6 +38,7 @@ ULONG ExPushLockSpinCount = 0;
  * @return None.
  *
  * @remarks The ExpInitializePushLocks routine sets up the spin on SMP machines.
+ *          A spin count set in the registry is kept.
  *
  *--*/
 VOID
@@ -46,11 +48,63 @@ ExpInitializePushLocks(VOID)
 {
 #ifdef CONFIG_SMP
     /* Initialize an internal 1024-iteration spin for MP CPUs */
-    if (KeNumberProcessors > 1)
+    if (KeNumberProcessors == 1)
+        ExPushLockSpinCount = 0;
+    else if (!ExPushLockSpinCount)
         ExPushLockSpinCount = 1024;
+#else
+    ExPushLockSpinCount = 0;
 #endif
 }
 
+#ifdef CONFIG_SMP
+/*++
+ * @name ExpSpinOnPushLock
+ *
+ *     The ExpSpinOnPushLock routine spins on a contended Pushlock before the
+ *     caller queues a wait block for it.
+ *
+ * @param PushLock
+ *        Pointer to the pushlock.
+ *
+ * @param Shared
+ *        Whether the caller wants to acquire the pushlock shared.
+ *
+ * @return The last value of the pushlock that was read.
+ *
+ * @remarks The spin stops as soon as someone else queues up, so that the
+ *          caller doesn't barge ahead of existing waiters.
+ *
+ *--*/
+static
+EX_PUSH_LOCK
+ExpSpinOnPushLock(IN PEX_PUSH_LOCK PushLock,
+                  IN BOOLEAN Shared)
+{
+    EX_PUSH_LOCK Value;
+    ULONG i = ExPushLockSpinCount;
+
+    InterlockedIncrement(&ExpPushLockSpinStatistics.Spins);
+    do
+    {
+        YieldProcessor();
+        Value.Ptr = *(volatile PVOID *)&PushLock->Ptr;
+
+        /* Give up if there are waiters now */
+        if (Value.Waiting) break;
+
+        /* Check if we can get it now */
+        if (!(Value.Locked) || ((Shared) && (Value.Shared > 0)))
+        {
+            InterlockedIncrement(&ExpPushLockSpinStatistics.SpinAcquires);
+            break;
+        }
+    } while (--i);
+
+    return Value;
+}
+#endif
+
 /*++
  * @name ExfWakePushLock
  *
@@ -474,10 +528,23 @@ ExfAcquirePushLockExclusive(PEX_PUSH_LOCK PushLock)
     BOOLEAN NeedWake;
     EX_PUSH_LOCK_WAIT_BLOCK Block;
     PEX_PUSH_LOCK_WAIT_BLOCK WaitBlock = &Block;
+#ifdef CONFIG_SMP
+    BOOLEAN Spun = FALSE;
+#endif
 
     /* Start main loop */
     for (;;)
     {
+#ifdef CONFIG_SMP
+        /* If it's locked but nobody waits yet, spin a while before queuing */
+        if ((OldValue.Locked) && !(OldValue.Waiting) &&
+            (ExPushLockSpinCount) && !(Spun))
+        {
+            Spun = TRUE;
+            OldValue = ExpSpinOnPushLock(PushLock, FALSE);
+        }
+#endif
+
         /* Check if it's unlocked */
         if (!OldValue.Locked)
         {
@@ -612,6 +679,7 @@ ExfAcquirePushLockExclusive(PEX_PUSH_LOCK PushLock)
             if (InterlockedBitTestAndReset(&WaitBlock->Flags, 1))
             {
                 /* Nobody removed it already, let's do a full wait */
+                InterlockedIncrement(&ExpPushLockSpinStatistics.Blocks);
                 KeWaitForGate(&WaitBlock->WakeGate, WrPushLock, KernelMode);
                 ASSERT(WaitBlock->Signaled);
             }
@@ -648,10 +716,23 @@ ExfAcquirePushLockShared(PEX_PUSH_LOCK PushLock)
     BOOLEAN NeedWake;
     EX_PUSH_LOCK_WAIT_BLOCK Block;
     PEX_PUSH_LOCK_WAIT_BLOCK WaitBlock = &Block;
+#ifdef CONFIG_SMP
+    BOOLEAN Spun = FALSE;
+#endif
 
     /* Start main loop */
     for (;;)
     {
+#ifdef CONFIG_SMP
+        /* If it's owned exclusively but nobody waits yet, spin a while first */
+        if ((OldValue.Locked) && !(OldValue.Waiting) && !(OldValue.Shared) &&
+            (ExPushLockSpinCount) && !(Spun))
+        {
+            Spun = TRUE;
+            OldValue = ExpSpinOnPushLock(PushLock, TRUE);
+        }
+#endif
+
         /* Check if it's unlocked or if it's waiting without any sharers */
         if (!(OldValue.Locked) || (!(OldValue.Waiting) && (OldValue.Shared > 0)))
         {
@@ -779,6 +860,7 @@ ExfAcquirePushLockShared(PEX_PUSH_LOCK PushLock)
             if (InterlockedBitTestAndReset(&WaitBlock->Flags, 1))
             {
                 /* Fast-path did not work, we need to do a full wait */
+                InterlockedIncrement(&ExpPushLockSpinStatistics.Blocks);
                 KeWaitForGate(&WaitBlock->WakeGate, WrPushLock, KernelMode);
                 ASSERT(WaitBlock->Signaled);
             }
@@ -75,6 +75,8 @@ ULONG ExpResourceTimeoutCount = 90 * 3600 / 2;
 KSPIN_LOCK ExpResourceSpinLock;
 LIST_ENTRY ExpSystemResourcesList;
 BOOLEAN ExResourceStrict = TRUE;
+ULONG ExResourceSpinCount = 1024;
+EX_SPIN_WAIT_STATISTICS ExpResourceSpinStatistics;
 
 /* PRIVATE FUNCTIONS *********************************************************/
 
@@ -597,6 +599,74 @@ ExpBoostOwnerThread(IN PKTHREAD Thread,
     }
 }
 
+#ifdef CONFIG_SMP
+/*++
+ * @name ExpSpinOnResource
+ *
+ *     The ExpSpinOnResource routine spins on a contended resource for a
+ *     bounded time, as long as its exclusive owner runs on another processor.
+ *
+ * @param Resource
+ *        Pointer to the resource.
+ *
+ * @param LockHandle
+ *        Pointer to in-stack queued spinlock.
+ *
+ * @return TRUE if the caller should try acquiring the resource again,
+ *         FALSE if there was no point in spinning.
+ *
+ * @remarks The resource lock is dropped while spinning, so the caller has
+ *          to look at the resource state again after a spin.
+ *
+ *--*/
+static
+BOOLEAN
+ExpSpinOnResource(IN PERESOURCE Resource,
+                  IN PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    volatile ERESOURCE *VolatileResource = Resource;
+    ERESOURCE_THREAD OwnerThread;
+    ULONG i;
+
+    /* Owner pointers set by ExSetResourceOwnerPointer aren't threads */
+    OwnerThread = Resource->OwnerEntry.OwnerThread;
+    if (!(ExResourceSpinCount) ||
+        !(IsOwnedExclusive(Resource)) ||
+        (OwnerThread & 3) ||
+        (((PKTHREAD)OwnerThread)->State != Running))
+    {
+        /* The owner won't be done any time soon */
+        return FALSE;
+    }
+
+    /* Drop the lock and spin */
+    ExReleaseResourceLock(Resource, LockHandle);
+    InterlockedIncrement(&ExpResourceSpinStatistics.Spins);
+    for (i = ExResourceSpinCount; i; i--)
+    {
+        YieldProcessor();
+
+        /* Check if it got released */
+        if (!VolatileResource->ActiveEntries)
+        {
+            InterlockedIncrement(&ExpResourceSpinStatistics.SpinAcquires);
+            break;
+        }
+
+        /* Stop once the owner changed, or it isn't running anymore */
+        if ((VolatileResource->OwnerEntry.OwnerThread != OwnerThread) ||
+            (((volatile KTHREAD *)OwnerThread)->State != Running))
+        {
+            break;
+        }
+    }
+
+    /* Take the lock back */
+    ExAcquireResourceLock(Resource, LockHandle);
+    return TRUE;
+}
+#endif
+
 /*++
  * @name ExpWaitForResource
  *
@@ -631,6 +701,7 @@ ExpWaitForResource(IN PERESOURCE Resource,
 
     /* Increase contention count and use a 5 second timeout */
     Resource->ContentionCount++;
+    InterlockedIncrement(&ExpResourceSpinStatistics.Blocks);
     Timeout.QuadPart = 500 * -10000;
     for (;;)
     {
@@ -773,6 +844,9 @@ ExAcquireResourceExclusiveLite(IN PERESOURCE Resource,
     KLOCK_QUEUE_HANDLE LockHandle;
     ERESOURCE_THREAD Thread;
     BOOLEAN Success;
+#ifdef CONFIG_SMP
+    BOOLEAN Spun = FALSE;
+#endif
 
     /* Sanity check */
     ASSERT((Resource->Flag & ResourceNeverExclusive) == 0);
@@ -813,6 +887,15 @@ TryAcquire:
             }
             else
             {
+#ifdef CONFIG_SMP
+                /* Unless others wait already, spin while the owner runs */
+                if (!(Spun) && !(IsExclusiveWaiting(Resource)))
+                {
+                    Spun = ExpSpinOnResource(Resource, &LockHandle);
+                    if (Spun) goto TryAcquire;
+                }
+#endif
+
                 /* Check if it has exclusive waiters */
                 if (!Resource->ExclusiveWaiters)
                 {
@@ -889,6 +972,9 @@ ExAcquireResourceSharedLite(IN PERESOURCE Resource,
     ERESOURCE_THREAD Thread;
     POWNER_ENTRY Owner = NULL;
     BOOLEAN FirstEntryBusy;
+#ifdef CONFIG_SMP
+    BOOLEAN Spun = FALSE;
+#endif
 
     /* Get the thread */
     Thread = ExGetCurrentResourceThread();
@@ -979,6 +1065,15 @@ ExAcquireResourceSharedLite(IN PERESOURCE Resource,
             ExReleaseResourceLock(Resource, &LockHandle);
             return FALSE;
         }
+
+#ifdef CONFIG_SMP
+        /* Unless exclusive waiters are queued, spin while the owner runs */
+        if (!(Spun) && !(IsExclusiveWaiting(Resource)))
+        {
+            Spun = ExpSpinOnResource(Resource, &LockHandle);
+            if (Spun) continue;
+        }
+#endif
         
         /* Check if we have a shared waiters semaphore */
         if (!Resource->SharedWaiters)
@@ -2283,3 +2378,25 @@ ExReleaseResourceAndLeaveCriticalRegion(IN PERESOURCE Resource)
     /* Leave critical region */
     KeLeaveCriticalRegion();
 }
+
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtLockSpin(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    KdbpPrint("Type        SpinCount       Spins  SpinAcquires      Blocks\n");
+    KdbpPrint("Push lock  %10lu  %10lu    %10lu  %10lu\n",
+              ExPushLockSpinCount,
+              ExpPushLockSpinStatistics.Spins,
+              ExpPushLockSpinStatistics.SpinAcquires,
+              ExpPushLockSpinStatistics.Blocks);
+    KdbpPrint("Resource   %10lu  %10lu    %10lu  %10lu\n",
+              ExResourceSpinCount,
+              ExpResourceSpinStatistics.Spins,
+              ExpResourceSpinStatistics.SpinAcquires,
+              ExpResourceSpinStatistics.Blocks);
+
+    return TRUE;
+}
+#endif
@@ -595,6 +595,7 @@ QSI_DEF(SystemProcessorInformation)
 QSI_DEF(SystemPerformanceInformation)
 {
     ULONG IdleUser, IdleKernel;
+    CC_PERFORMANCE_COUNTERS CcCounters;
     PSYSTEM_PERFORMANCE_INFORMATION Spi
         = (PSYSTEM_PERFORMANCE_INFORMATION) Buffer;
 
@@ -677,40 +678,41 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->ResidentPagedPoolPage = 0; /* FIXME */
 
     Spi->ResidentSystemDriverPage = 0; /* FIXME */
-    Spi->CcFastReadNoWait = 0; /* FIXME */
-    Spi->CcFastReadWait = 0; /* FIXME */
-    Spi->CcFastReadResourceMiss = 0; /* FIXME */
-    Spi->CcFastReadNotPossible = 0; /* FIXME */
+    Spi->CcFastReadNoWait = CcFastReadNoWait;
+    Spi->CcFastReadWait = CcFastReadWait;
+    Spi->CcFastReadResourceMiss = CcFastReadResourceMiss;
+    Spi->CcFastReadNotPossible = CcFastReadNotPossible;
 
     Spi->CcFastMdlReadNoWait = 0; /* FIXME */
-    Spi->CcFastMdlReadWait = 0; /* FIXME */
+    Spi->CcFastMdlReadWait = CcFastMdlReadWait;
     Spi->CcFastMdlReadResourceMiss = 0; /* FIXME */
-    Spi->CcFastMdlReadNotPossible = 0; /* FIXME */
+    Spi->CcFastMdlReadNotPossible = CcFastMdlReadNotPossible;
 
-    Spi->CcMapDataNoWait = CcMapDataNoWait;
-    Spi->CcMapDataWait = CcMapDataWait;
-    Spi->CcMapDataNoWaitMiss = 0; /* FIXME */
-    Spi->CcMapDataWaitMiss = 0; /* FIXME */
+    CcQueryPerformanceCounters(&CcCounters);
+    Spi->CcMapDataNoWait = CcCounters.MapDataNoWait;
+    Spi->CcMapDataWait = CcCounters.MapDataWait;
+    Spi->CcMapDataNoWaitMiss = CcCounters.MapDataNoWaitMiss;
+    Spi->CcMapDataWaitMiss = CcCounters.MapDataWaitMiss;
 
     Spi->CcPinMappedDataCount = 0; /* FIXME */
-    Spi->CcPinReadNoWait = CcPinReadNoWait;
-    Spi->CcPinReadWait = CcPinReadWait;
-    Spi->CcPinReadNoWaitMiss = 0; /* FIXME */
-    Spi->CcPinReadWaitMiss = 0; /* FIXME */
-    Spi->CcCopyReadNoWait = 0; /* FIXME */
-    Spi->CcCopyReadWait = 0; /* FIXME */
-    Spi->CcCopyReadNoWaitMiss = 0; /* FIXME */
-    Spi->CcCopyReadWaitMiss = 0; /* FIXME */
+    Spi->CcPinReadNoWait = CcCounters.PinReadNoWait;
+    Spi->CcPinReadWait = CcCounters.PinReadWait;
+    Spi->CcPinReadNoWaitMiss = CcCounters.PinReadNoWaitMiss;
+    Spi->CcPinReadWaitMiss = CcCounters.PinReadWaitMiss;
+    Spi->CcCopyReadNoWait = CcCounters.CopyReadNoWait;
+    Spi->CcCopyReadWait = CcCounters.CopyReadWait;
+    Spi->CcCopyReadNoWaitMiss = CcCounters.CopyReadNoWaitMiss;
+    Spi->CcCopyReadWaitMiss = CcCounters.CopyReadWaitMiss;
 
     Spi->CcMdlReadNoWait = 0; /* FIXME */
-    Spi->CcMdlReadWait = 0; /* FIXME */
+    Spi->CcMdlReadWait = CcCounters.MdlReadWait;
     Spi->CcMdlReadNoWaitMiss = 0; /* FIXME */
-    Spi->CcMdlReadWaitMiss = 0; /* FIXME */
-    Spi->CcReadAheadIos = 0; /* FIXME */
-    Spi->CcLazyWriteIos = CcLazyWriteIos;
-    Spi->CcLazyWritePages = CcLazyWritePages;
-    Spi->CcDataFlushes = CcDataFlushes;
-    Spi->CcDataPages = CcDataPages;
+    Spi->CcMdlReadWaitMiss = CcCounters.MdlReadWaitMiss;
+    Spi->CcReadAheadIos = CcCounters.ReadAheadIos;
+    Spi->CcLazyWriteIos = CcCounters.LazyWriteIos;
+    Spi->CcLazyWritePages = CcCounters.LazyWritePages;
+    Spi->CcDataFlushes = CcCounters.DataFlushes;
+    Spi->CcDataPages = CcCounters.DataPages;
     Spi->ContextSwitches = 0; /* FIXME */
     Spi->FirstLevelTbFills = 0; /* FIXME */
     Spi->SecondLevelTbFills = 0; /* FIXME */
@@ -2299,6 +2301,78 @@ QSI_DEF(SystemPrefetcherInformation)
     return STATUS_NOT_IMPLEMENTED;
 }
 
+SSI_DEF(SystemPrefetcherInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PREFETCHER_INFORMATION PrefetcherInfo;
+    PF_LOGON_SCENARIO_INFORMATION LogonInfo;
+    ULONG Phase;
+
+    /* Check size of a buffer, it must match our expectations */
+    if (sizeof(PREFETCHER_INFORMATION) != Size)
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* The caller's buffer was probed and we run within its SEH */
+    PrefetcherInfo = *(PPREFETCHER_INFORMATION)Buffer;
+    if ((PrefetcherInfo.Version != PF_CURRENT_VERSION) ||
+        (PrefetcherInfo.Magic != PF_SYSINFO_MAGIC_NUMBER))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeProfileSingleProcessPrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    switch (PrefetcherInfo.PrefetcherInformationClass)
+    {
+        case PrefetcherBootPhase:
+            if (PrefetcherInfo.PrefetcherInformationLength != sizeof(ULONG))
+                return STATUS_INFO_LENGTH_MISMATCH;
+
+            if (PreviousMode != KernelMode)
+                Phase = ProbeForReadUlong((PULONG)PrefetcherInfo.PrefetcherInformation);
+            else
+                Phase = *(PULONG)PrefetcherInfo.PrefetcherInformation;
+
+            /* Put it on the boot timeline and let the prefetcher know */
+            IopBootTracePhase(Phase);
+#ifndef NEWCC
+            return CcPfBeginBootPhase(Phase);
+#else
+            return STATUS_SUCCESS;
+#endif
+
+        case PrefetcherLogonScenario:
+            if (PrefetcherInfo.PrefetcherInformationLength != sizeof(LogonInfo))
+                return STATUS_INFO_LENGTH_MISMATCH;
+
+            if (PreviousMode != KernelMode)
+            {
+                ProbeForRead(PrefetcherInfo.PrefetcherInformation,
+                             sizeof(LogonInfo),
+                             sizeof(ULONG));
+            }
+            LogonInfo = *(PPF_LOGON_SCENARIO_INFORMATION)PrefetcherInfo.PrefetcherInformation;
+
+#ifndef NEWCC
+            CcPfBeginLogon(LogonInfo.UserHash, LogonInfo.Trace);
+#endif
+            return STATUS_SUCCESS;
+
+        default:
+            DPRINT1("SystemPrefetcherInformation class %d not implemented\n",
+                    PrefetcherInfo.PrefetcherInformationClass);
+            return STATUS_NOT_IMPLEMENTED;
+    }
+}
+
 
 /* Class 57 - Extended process information  */
 QSI_DEF(SystemExtendedProcessInformation)
@@ -2581,7 +2655,7 @@ CallQS [] =
     SI_QX(SystemSessionProcessesInformation),
     SI_XS(SystemLoadGdiDriverInSystemSpaceInformation),
     SI_QX(SystemNumaProcessorMap),
-    SI_QX(SystemPrefetcherInformation),
+    SI_QS(SystemPrefetcherInformation),
     SI_QX(SystemExtendedProcessInformation),
     SI_QX(SystemRecommendedSharedDataAlignment),
     SI_XX(SystemComPlusPackage),
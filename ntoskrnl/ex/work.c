@@ -26,6 +26,16 @@
 /* Magic flag for dynamic worker threads */
 #define EX_DYNAMIC_WORK_THREAD                      0x80000000
 
+/* The node of a worker thread is also passed in its context */
+#define EX_WORK_THREAD_NODE_SHIFT                   8
+#define EX_WORK_THREAD_TYPE_MASK                    0xFF
+
+/* Maximum number of dynamic threads per queue */
+#define EX_MAXIMUM_DYNAMIC_THREADS                  16
+
+/* Number of work items whose queueing time is remembered per queue */
+#define EX_WORK_LATENCY_SLOTS                       64
+
 /* Worker thread priority increments (added to base priority) */
 #define EX_HYPERCRITICAL_QUEUE_PRIORITY_INCREMENT   7
 #define EX_CRITICAL_QUEUE_PRIORITY_INCREMENT        5
@@ -53,8 +63,272 @@ KEVENT ExpThreadSetManagerShutdownEvent;
 PETHREAD ExpWorkerThreadBalanceManagerPtr;
 PETHREAD ExpLastWorkerThread;
 
+/*
+ * Items that wait longer than this many milliseconds before a worker picks
+ * them up get the balance set manager to add a thread right away, instead of
+ * waiting for the next deadlock detection pass. Zero disables this.
+ */
+ULONG ExpWorkerLatencyThreshold = 20;
+
+/*
+ * WORK_QUEUE_ITEM is a public structure with no room for a timestamp, so each
+ * queue remembers when its last few items were inserted in a ring indexed by
+ * insertion order. Queues are FIFO, so the n-th item removed is the n-th one
+ * inserted; a zero slot means the time of that item is unknown.
+ */
+typedef struct _EX_WORK_QUEUE_LATENCY
+{
+    LONG InsertSequence;
+    LONG RemoveSequence;
+    ULONG InsertTime[EX_WORK_LATENCY_SLOTS];
+    ULONG Histogram[SYSDBG_WORK_QUEUE_LATENCY_BUCKETS];
+    ULONG MaximumLatency;
+    ULONG WorkItemsStolen;
+    BOOLEAN GrowthRequested;
+} EX_WORK_QUEUE_LATENCY, *PEX_WORK_QUEUE_LATENCY;
+
+/*
+ * Each node has its own set of queues and workers. Items are queued to the
+ * node of the current processor, and workers whose queue runs dry steal from
+ * the other nodes. The first node uses ExWorkerQueue.
+ */
+typedef struct _EX_WORKER_NODE
+{
+    PEX_WORK_QUEUE Queues;
+    EX_WORK_QUEUE_LATENCY Latency[MaximumWorkQueue];
+} EX_WORKER_NODE, *PEX_WORKER_NODE;
+
+static EX_WORKER_NODE ExpWorkerNode0 = { ExWorkerQueue };
+PEX_WORKER_NODE ExpWorkerNodes[MAXIMUM_PROCESSORS] = { &ExpWorkerNode0 };
+ULONG ExpWorkerNodeCount = 1;
+
+/* Frequency of the TSC used for the latency timestamps, zero if unknown */
+ULONG ExpWorkTscMHz;
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
+FORCEINLINE
+ULONG
+ExpWorkTimestamp(VOID)
+{
+    ULONG Stamp;
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+    /* Use the TSC, in units of 64 cycles, when we know how fast it runs */
+    if (ExpWorkTscMHz)
+    {
+        Stamp = (ULONG)(__rdtsc() >> 6);
+        return Stamp ? Stamp : 1;
+    }
+#endif
+
+    /* Otherwise fall back to the interrupt time */
+    Stamp = (ULONG)KeQueryInterruptTime();
+    return Stamp ? Stamp : 1;
+}
+
+FORCEINLINE
+ULONG
+ExpWorkTimeToMicroseconds(IN ULONG Delta)
+{
+#if defined(_M_IX86) || defined(_M_AMD64)
+    if (ExpWorkTscMHz) return (ULONG)(((ULONGLONG)Delta << 6) / ExpWorkTscMHz);
+#endif
+    return Delta / 10;
+}
+
+FORCEINLINE
+PEX_WORKER_NODE
+ExpGetWorkerNode(IN ULONG Node)
+{
+    /* Nodes that could not get their own queues share the first one's */
+    return ExpWorkerNodes[(Node < ExpWorkerNodeCount) ? Node : 0];
+}
+
+static
+ULONG
+ExpSelectWorkerNode(IN WORK_QUEUE_TYPE QueueType)
+{
+    ULONG Node, Other, i;
+
+    /* Nothing to choose from on most machines */
+    if (ExpWorkerNodeCount == 1) return 0;
+
+    /* Use our node, unless none of its workers is waiting and another one has */
+    Node = KeGetCurrentPrcb()->ParentNode->NodeNumber;
+    if (Node >= ExpWorkerNodeCount) return 0;
+    if (!IsListEmpty(&ExpWorkerNodes[Node]->Queues[QueueType].WorkerQueue.Header.WaitListHead))
+    {
+        return Node;
+    }
+
+    for (i = 1; i < ExpWorkerNodeCount; i++)
+    {
+        Other = (Node + i) % ExpWorkerNodeCount;
+        if (!IsListEmpty(&ExpWorkerNodes[Other]->Queues[QueueType].WorkerQueue.Header.WaitListHead))
+        {
+            return Other;
+        }
+    }
+
+    return Node;
+}
+
+static
+ULONG
+ExpRecordWorkItemLatency(IN PEX_WORK_QUEUE_LATENCY Latency)
+{
+    LONG Sequence;
+    ULONG InsertTime, Microseconds, Bucket;
+
+    //
+    // Claim the next removal slot. Items inserted behind our back, such as
+    // the reaper's, were never stamped; don't let them get us ahead of the
+    // inserters.
+    //
+    do
+    {
+        Sequence = Latency->RemoveSequence;
+        if ((Sequence - Latency->InsertSequence) >= 0) return 0;
+    } while (InterlockedCompareExchange(&Latency->RemoveSequence,
+                                        Sequence + 1,
+                                        Sequence) != Sequence);
+
+    /* Get the stamp and free the slot */
+    InsertTime = Latency->InsertTime[Sequence & (EX_WORK_LATENCY_SLOTS - 1)];
+    Latency->InsertTime[Sequence & (EX_WORK_LATENCY_SLOTS - 1)] = 0;
+    if (!InsertTime) return 0;
+
+    /* The TSCs of different processors can be a bit apart */
+    InsertTime = ExpWorkTimestamp() - InsertTime;
+    if ((LONG)InsertTime < 0) InsertTime = 0;
+    Microseconds = ExpWorkTimeToMicroseconds(InsertTime);
+
+    /* Bucket n holds the items that waited less than 2^n microseconds */
+    for (Bucket = 0; Bucket < SYSDBG_WORK_QUEUE_LATENCY_BUCKETS - 1; Bucket++)
+    {
+        if (!(Microseconds >> Bucket)) break;
+    }
+    InterlockedIncrement((PLONG)&Latency->Histogram[Bucket]);
+    if (Microseconds > Latency->MaximumLatency) Latency->MaximumLatency = Microseconds;
+
+    return Microseconds;
+}
+
+static
+VOID
+ExpRunWorkItem(IN PETHREAD Thread,
+               IN PEX_WORK_QUEUE WorkQueue,
+               IN PEX_WORK_QUEUE_LATENCY Latency,
+               IN PLIST_ENTRY QueueEntry)
+{
+    PWORK_QUEUE_ITEM WorkItem;
+    ULONG Microseconds;
+
+    /* Increment Processed Work Items */
+    InterlockedIncrement((PLONG)&WorkQueue->WorkItemsProcessed);
+
+    //
+    // If the item waited too long and there is more behind it, get the
+    // balance set manager to add a thread now
+    //
+    Microseconds = ExpRecordWorkItemLatency(Latency);
+    if ((ExpWorkerLatencyThreshold) &&
+        (Microseconds >= ExpWorkerLatencyThreshold * 1000) &&
+        (!IsListEmpty(&WorkQueue->WorkerQueue.EntryListHead)) &&
+        (WorkQueue->DynamicThreadCount < EX_MAXIMUM_DYNAMIC_THREADS) &&
+        !(Latency->GrowthRequested))
+    {
+        Latency->GrowthRequested = TRUE;
+        KeSetEvent(&ExpThreadSetManagerEvent, 0, FALSE);
+    }
+
+    /* Get the Work Item */
+    WorkItem = CONTAINING_RECORD(QueueEntry, WORK_QUEUE_ITEM, List);
+
+    /* Make sure nobody is trying to play smart with us */
+    ASSERT((ULONG_PTR)WorkItem->WorkerRoutine > MmUserProbeAddress);
+
+    /* Call the Worker Routine */
+    WorkItem->WorkerRoutine(WorkItem->Parameter);
+
+    /* Make sure APCs are not disabled */
+    if (Thread->Tcb.CombinedApcDisable != 0)
+    {
+        /* We're nice and do it behind your back */
+        DPRINT1("Warning: Broken Worker Thread: %p %p %p came back "
+                "with APCs disabled!\n",
+                WorkItem->WorkerRoutine,
+                WorkItem->Parameter,
+                WorkItem);
+        ASSERT(Thread->Tcb.CombinedApcDisable == 0);
+        Thread->Tcb.CombinedApcDisable = 0;
+    }
+
+    /* Make sure it returned at right IRQL */
+    if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+    {
+        /* It didn't, bugcheck! */
+        KeBugCheckEx(WORKER_THREAD_RETURNED_AT_BAD_IRQL,
+                     (ULONG_PTR)WorkItem->WorkerRoutine,
+                     KeGetCurrentIrql(),
+                     (ULONG_PTR)WorkItem->Parameter,
+                     (ULONG_PTR)WorkItem);
+    }
+
+    /* Make sure it returned with Impersionation Disabled */
+    if (Thread->ActiveImpersonationInfo)
+    {
+        /* It didn't, bugcheck! */
+        KeBugCheckEx(IMPERSONATING_WORKER_THREAD,
+                     (ULONG_PTR)WorkItem->WorkerRoutine,
+                     (ULONG_PTR)WorkItem->Parameter,
+                     (ULONG_PTR)WorkItem,
+                     0);
+    }
+}
+
+static
+BOOLEAN
+ExpStealWorkItem(IN PETHREAD Thread,
+                 IN ULONG Node,
+                 IN WORK_QUEUE_TYPE WorkQueueType,
+                 IN KPROCESSOR_MODE WaitMode)
+{
+    LARGE_INTEGER NoWait;
+    PEX_WORKER_NODE Victim;
+    PLIST_ENTRY QueueEntry;
+    ULONG i;
+
+    /* Look for a node with pending items of our type */
+    NoWait.QuadPart = 0;
+    for (i = 1; i < ExpWorkerNodeCount; i++)
+    {
+        Victim = ExpWorkerNodes[(Node + i) % ExpWorkerNodeCount];
+        if (IsListEmpty(&Victim->Queues[WorkQueueType].WorkerQueue.EntryListHead)) continue;
+
+        /* Try to take one without waiting, someone may have beaten us to it */
+        QueueEntry = KeRemoveQueue(&Victim->Queues[WorkQueueType].WorkerQueue,
+                                   WaitMode,
+                                   &NoWait);
+        if (((NTSTATUS)(ULONG_PTR)QueueEntry == STATUS_TIMEOUT) ||
+            ((NTSTATUS)(ULONG_PTR)QueueEntry == STATUS_USER_APC))
+        {
+            continue;
+        }
+
+        /* Run it on behalf of its node */
+        InterlockedIncrement((PLONG)&Victim->Latency[WorkQueueType].WorkItemsStolen);
+        ExpRunWorkItem(Thread,
+                       &Victim->Queues[WorkQueueType],
+                       &Victim->Latency[WorkQueueType],
+                       QueueEntry);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 /*++
  * @name ExpWorkerThreadEntryPoint
  *
@@ -62,14 +336,17 @@ PETHREAD ExpLastWorkerThread;
  *     worker thread created by teh system.
  *
  * @param Context
- *        Contains the work queue type masked with a flag specifing whether the
- *        thread is dynamic or not.
+ *        Contains the work queue type and node masked with a flag specifing
+ *        whether the thread is dynamic or not.
  *
  * @return None.
  *
  * @remarks A dynamic thread can timeout after 10 minutes of waiting on a queue
  *          while a static thread will never timeout.
  *
+ *          When its own queue is empty, a worker takes pending items of the
+ *          same type from the queues of the other nodes before waiting.
+ *
  *          Worker threads must return at IRQL == PASSIVE_LEVEL, must not have
  *          active impersonation info, and must not have disabled APCs.
  *
@@ -81,10 +358,11 @@ VOID
 NTAPI
 ExpWorkerThreadEntryPoint(IN PVOID Context)
 {
-    PWORK_QUEUE_ITEM WorkItem;
     PLIST_ENTRY QueueEntry;
     WORK_QUEUE_TYPE WorkQueueType;
     PEX_WORK_QUEUE WorkQueue;
+    PEX_WORKER_NODE WorkerNode;
+    ULONG Node;
     LARGE_INTEGER Timeout;
     PLARGE_INTEGER TimeoutPointer = NULL;
     PETHREAD Thread = PsGetCurrentThread();
@@ -99,10 +377,19 @@ ExpWorkerThreadEntryPoint(IN PVOID Context)
         TimeoutPointer = &Timeout;
     }
 
-    /* Get Queue Type and Worker Queue */
+    /* Get Queue Type, Node and Worker Queue */
     WorkQueueType = (WORK_QUEUE_TYPE)((ULONG_PTR)Context &
-                                      ~EX_DYNAMIC_WORK_THREAD);
-    WorkQueue = &ExWorkerQueue[WorkQueueType];
+                                      EX_WORK_THREAD_TYPE_MASK);
+    Node = ((ULONG_PTR)Context & ~EX_DYNAMIC_WORK_THREAD) >>
+           EX_WORK_THREAD_NODE_SHIFT;
+    WorkerNode = ExpGetWorkerNode(Node);
+    WorkQueue = &WorkerNode->Queues[WorkQueueType];
+
+    /* Stay on the processors of our node */
+    if (ExpWorkerNodeCount > 1)
+    {
+        KeSetAffinityThread(&Thread->Tcb, KeNodeBlock[Node]->ProcessorMask);
+    }
 
     /* Select the wait mode */
     WaitMode = (UCHAR)WorkQueue->Info.WaitMode;
@@ -149,51 +436,17 @@ ProcessLoop:
         /* Check if we timed out and quit this loop in that case */
         if ((NTSTATUS)(ULONG_PTR)QueueEntry == STATUS_TIMEOUT) break;
 
-        /* Increment Processed Work Items */
-        InterlockedIncrement((PLONG)&WorkQueue->WorkItemsProcessed);
-
-        /* Get the Work Item */
-        WorkItem = CONTAINING_RECORD(QueueEntry, WORK_QUEUE_ITEM, List);
-
-        /* Make sure nobody is trying to play smart with us */
-        ASSERT((ULONG_PTR)WorkItem->WorkerRoutine > MmUserProbeAddress);
-
-        /* Call the Worker Routine */
-        WorkItem->WorkerRoutine(WorkItem->Parameter);
-
-        /* Make sure APCs are not disabled */
-        if (Thread->Tcb.CombinedApcDisable != 0)
-        {
-            /* We're nice and do it behind your back */
-            DPRINT1("Warning: Broken Worker Thread: %p %p %p came back "
-                    "with APCs disabled!\n",
-                    WorkItem->WorkerRoutine,
-                    WorkItem->Parameter,
-                    WorkItem);
-            ASSERT(Thread->Tcb.CombinedApcDisable == 0);
-            Thread->Tcb.CombinedApcDisable = 0;
-        }
-
-        /* Make sure it returned at right IRQL */
-        if (KeGetCurrentIrql() != PASSIVE_LEVEL)
-        {
-            /* It didn't, bugcheck! */
-            KeBugCheckEx(WORKER_THREAD_RETURNED_AT_BAD_IRQL,
-                         (ULONG_PTR)WorkItem->WorkerRoutine,
-                         KeGetCurrentIrql(),
-                         (ULONG_PTR)WorkItem->Parameter,
-                         (ULONG_PTR)WorkItem);
-        }
+        /* Run the work item */
+        ExpRunWorkItem(Thread,
+                       WorkQueue,
+                       &WorkerNode->Latency[WorkQueueType],
+                       QueueEntry);
 
-        /* Make sure it returned with Impersionation Disabled */
-        if (Thread->ActiveImpersonationInfo)
+        /* Help the other nodes out for as long as we have nothing to do */
+        while ((ExpWorkerNodeCount > 1) &&
+               (IsListEmpty(&WorkQueue->WorkerQueue.EntryListHead)))
         {
-            /* It didn't, bugcheck! */
-            KeBugCheckEx(IMPERSONATING_WORKER_THREAD,
-                         (ULONG_PTR)WorkItem->WorkerRoutine,
-                         (ULONG_PTR)WorkItem->Parameter,
-                         (ULONG_PTR)WorkItem,
-                         0);
+            if (!ExpStealWorkItem(Thread, Node, WorkQueueType, WaitMode)) break;
         }
     }
 
@@ -232,6 +485,9 @@ ProcessLoop:
  *     The ExpCreateWorkerThread routine creates a new worker thread for the
  *     specified queue.
  *
+ * @param Node
+ *        Node whose queue the thread should serve.
+ *
  * @param QueueType
  *        Type of the queue to use for this thread. Valid values are:
  *          - DelayedWorkQueue
@@ -251,7 +507,8 @@ ProcessLoop:
  *--*/
 VOID
 NTAPI
-ExpCreateWorkerThread(WORK_QUEUE_TYPE WorkQueueType,
+ExpCreateWorkerThread(IN ULONG Node,
+                      IN WORK_QUEUE_TYPE WorkQueueType,
                       IN BOOLEAN Dynamic)
 {
     PETHREAD Thread;
@@ -260,7 +517,7 @@ ExpCreateWorkerThread(WORK_QUEUE_TYPE WorkQueueType,
     KPRIORITY Priority;
 
     /* Check if this is going to be a dynamic thread */
-    Context = WorkQueueType;
+    Context = WorkQueueType | (Node << EX_WORK_THREAD_NODE_SHIFT);
 
     /* Add the dynamic mask */
     if (Dynamic) Context |= EX_DYNAMIC_WORK_THREAD;
@@ -278,7 +535,7 @@ ExpCreateWorkerThread(WORK_QUEUE_TYPE WorkQueueType,
     if (Dynamic)
     {
         /* Increase the count */
-        InterlockedIncrement(&ExWorkerQueue[WorkQueueType].DynamicThreadCount);
+        InterlockedIncrement(&ExpWorkerNodes[Node]->Queues[WorkQueueType].DynamicThreadCount);
     }
 
     /* Set the priority */
@@ -333,30 +590,33 @@ VOID
 NTAPI
 ExpDetectWorkerThreadDeadlock(VOID)
 {
-    ULONG i;
+    ULONG i, Node;
     PEX_WORK_QUEUE Queue;
 
-    /* Loop the 3 queues */
-    for (i = 0; i < MaximumWorkQueue; i++)
+    /* Loop the 3 queues of every node */
+    for (Node = 0; Node < ExpWorkerNodeCount; Node++)
     {
-        /* Get the queue */
-        Queue = &ExWorkerQueue[i];
-        ASSERT(Queue->DynamicThreadCount <= 16);
-
-        /* Check if stuff is on the queue that still is unprocessed */
-        if ((Queue->QueueDepthLastPass) &&
-            (Queue->WorkItemsProcessed == Queue->WorkItemsProcessedLastPass) &&
-            (Queue->DynamicThreadCount < 16))
+        for (i = 0; i < MaximumWorkQueue; i++)
         {
-            /* Stuff is still on the queue and nobody did anything about it */
-            DPRINT1("EX: Work Queue Deadlock detected: %lu\n", i);
-            ExpCreateWorkerThread(i, TRUE);
-            DPRINT1("Dynamic threads queued %d\n", Queue->DynamicThreadCount);
-        }
+            /* Get the queue */
+            Queue = &ExpWorkerNodes[Node]->Queues[i];
+            ASSERT(Queue->DynamicThreadCount <= EX_MAXIMUM_DYNAMIC_THREADS);
+
+            /* Check if stuff is on the queue that still is unprocessed */
+            if ((Queue->QueueDepthLastPass) &&
+                (Queue->WorkItemsProcessed == Queue->WorkItemsProcessedLastPass) &&
+                (Queue->DynamicThreadCount < EX_MAXIMUM_DYNAMIC_THREADS))
+            {
+                /* Stuff is still on the queue and nobody did anything about it */
+                DPRINT1("EX: Work Queue Deadlock detected: %lu on node %lu\n", i, Node);
+                ExpCreateWorkerThread(Node, i, TRUE);
+                DPRINT1("Dynamic threads queued %d\n", Queue->DynamicThreadCount);
+            }
 
-        /* Update our data */
-        Queue->WorkItemsProcessedLastPass = Queue->WorkItemsProcessed;
-        Queue->QueueDepthLastPass = KeReadStateQueue(&Queue->WorkerQueue);
+            /* Update our data */
+            Queue->WorkItemsProcessedLastPass = Queue->WorkItemsProcessed;
+            Queue->QueueDepthLastPass = KeReadStateQueue(&Queue->WorkerQueue);
+        }
     }
 }
 
@@ -371,32 +631,43 @@ ExpDetectWorkerThreadDeadlock(VOID)
  * @return None.
  *
  * @remarks The algorithm for deciding if a new thread must be created is
- *          documented in the ExQueueWorkItem routine.
+ *          documented in the ExQueueWorkItem routine. Queues whose items
+ *          have been waiting longer than ExpWorkerLatencyThreshold get one
+ *          as well, whether or not they normally make threads as necessary.
  *
  *--*/
 VOID
 NTAPI
 ExpCheckDynamicThreadCount(VOID)
 {
-    ULONG i;
+    ULONG i, Node;
     PEX_WORK_QUEUE Queue;
+    PEX_WORK_QUEUE_LATENCY Latency;
 
-    /* Loop the 3 queues */
-    for (i = 0; i < MaximumWorkQueue; i++)
+    /* Loop the 3 queues of every node */
+    for (Node = 0; Node < ExpWorkerNodeCount; Node++)
     {
-        /* Get the queue */
-        Queue = &ExWorkerQueue[i];
-
-        /* Check if still need a new thread. See ExQueueWorkItem */
-        if ((Queue->Info.MakeThreadsAsNecessary) &&
-            (!IsListEmpty(&Queue->WorkerQueue.EntryListHead)) &&
-            (Queue->WorkerQueue.CurrentCount <
-             Queue->WorkerQueue.MaximumCount) &&
-            (Queue->DynamicThreadCount < 16))
+        for (i = 0; i < MaximumWorkQueue; i++)
         {
-            /* Create a new thread */
-            DPRINT1("EX: Creating new dynamic thread as requested\n");
-            ExpCreateWorkerThread(i, TRUE);
+            /* Get the queue */
+            Queue = &ExpWorkerNodes[Node]->Queues[i];
+            Latency = &ExpWorkerNodes[Node]->Latency[i];
+
+            /* Check if still need a new thread. See ExQueueWorkItem */
+            if (((Queue->Info.MakeThreadsAsNecessary) ||
+                 (Latency->GrowthRequested)) &&
+                (!IsListEmpty(&Queue->WorkerQueue.EntryListHead)) &&
+                (Queue->WorkerQueue.CurrentCount <
+                 Queue->WorkerQueue.MaximumCount) &&
+                (Queue->DynamicThreadCount < EX_MAXIMUM_DYNAMIC_THREADS))
+            {
+                /* Create a new thread */
+                DPRINT1("EX: Creating new dynamic thread as requested\n");
+                ExpCreateWorkerThread(Node, i, TRUE);
+            }
+
+            /* The next late item can ask again */
+            Latency->GrowthRequested = FALSE;
         }
     }
 }
@@ -524,7 +795,8 @@ ExpInitializeWorkerThreads(VOID)
     ULONG CriticalThreads, DelayedThreads;
     HANDLE ThreadHandle;
     PETHREAD Thread;
-    ULONG i;
+    PEX_WORKER_NODE WorkerNode;
+    ULONG i, Node;
 
     /* Setup the stack swap support */
     ExInitializeFastMutex(&ExpWorkerSwapinMutex);
@@ -545,16 +817,40 @@ ExpInitializeWorkerThreads(VOID)
     DelayedThreads += ExpAdditionalDelayedWorkerThreads;
     CriticalThreads += ExpAdditionalCriticalWorkerThreads;
 
-    /* Initialize the Array */
-    for (WorkQueueType = 0; WorkQueueType < MaximumWorkQueue; WorkQueueType++)
+#if defined(_M_IX86) || defined(_M_AMD64)
+    /* Time the work items with the TSC if we know its frequency */
+    ExpWorkTscMHz = KeGetCurrentPrcb()->MHz;
+#endif
+
+    /* Give every other node its own queues, as long as we can */
+    for (Node = 1; Node < KeNumberNodes; Node++)
     {
-        /* Clear the structure and initialize the queue */
-        RtlZeroMemory(&ExWorkerQueue[WorkQueueType], sizeof(EX_WORK_QUEUE));
-        KeInitializeQueue(&ExWorkerQueue[WorkQueueType].WorkerQueue, 0);
+        WorkerNode = ExAllocatePoolWithTag(NonPagedPool,
+                                           sizeof(EX_WORKER_NODE) +
+                                           MaximumWorkQueue * sizeof(EX_WORK_QUEUE),
+                                           TAG_WORKER_NODE);
+        if (!WorkerNode) break;
+
+        RtlZeroMemory(WorkerNode, sizeof(EX_WORKER_NODE));
+        WorkerNode->Queues = (PEX_WORK_QUEUE)(WorkerNode + 1);
+        ExpWorkerNodes[Node] = WorkerNode;
     }
+    ExpWorkerNodeCount = Node;
+
+    /* Initialize the Arrays */
+    for (Node = 0; Node < ExpWorkerNodeCount; Node++)
+    {
+        WorkerNode = ExpWorkerNodes[Node];
+        for (WorkQueueType = 0; WorkQueueType < MaximumWorkQueue; WorkQueueType++)
+        {
+            /* Clear the structure and initialize the queue */
+            RtlZeroMemory(&WorkerNode->Queues[WorkQueueType], sizeof(EX_WORK_QUEUE));
+            KeInitializeQueue(&WorkerNode->Queues[WorkQueueType].WorkerQueue, 0);
+        }
 
-    /* Dynamic threads are only used for the critical queue */
-    ExWorkerQueue[CriticalWorkQueue].Info.MakeThreadsAsNecessary = TRUE;
+        /* Dynamic threads are only used for the critical queue */
+        WorkerNode->Queues[CriticalWorkQueue].Info.MakeThreadsAsNecessary = TRUE;
+    }
 
     /* Initialize the balance set manager events */
     KeInitializeEvent(&ExpThreadSetManagerEvent, SynchronizationEvent, FALSE);
@@ -562,24 +858,28 @@ ExpInitializeWorkerThreads(VOID)
                       NotificationEvent,
                       FALSE);
 
-    /* Create the built-in worker threads for the critical queue */
-    for (i = 0; i < CriticalThreads; i++)
+    /* Every node gets the same set of built-in worker threads */
+    for (Node = 0; Node < ExpWorkerNodeCount; Node++)
     {
-        /* Create the thread */
-        ExpCreateWorkerThread(CriticalWorkQueue, FALSE);
-        ExCriticalWorkerThreads++;
-    }
+        /* Create the built-in worker threads for the critical queue */
+        for (i = 0; i < CriticalThreads; i++)
+        {
+            /* Create the thread */
+            ExpCreateWorkerThread(Node, CriticalWorkQueue, FALSE);
+            ExCriticalWorkerThreads++;
+        }
 
-    /* Create the built-in worker threads for the delayed queue */
-    for (i = 0; i < DelayedThreads; i++)
-    {
-        /* Create the thread */
-        ExpCreateWorkerThread(DelayedWorkQueue, FALSE);
-        ExDelayedWorkerThreads++;
-    }
+        /* Create the built-in worker threads for the delayed queue */
+        for (i = 0; i < DelayedThreads; i++)
+        {
+            /* Create the thread */
+            ExpCreateWorkerThread(Node, DelayedWorkQueue, FALSE);
+            ExDelayedWorkerThreads++;
+        }
 
-    /* Create the built-in worker thread for the hypercritical queue */
-    ExpCreateWorkerThread(HyperCriticalWorkQueue, FALSE);
+        /* Create the built-in worker thread for the hypercritical queue */
+        ExpCreateWorkerThread(Node, HyperCriticalWorkQueue, FALSE);
+    }
 
     /* Create the balance set manager thread */
     PsCreateSystemThread(&ThreadHandle,
@@ -711,16 +1011,27 @@ Next:
  *
  *          Callers of this routine must be running at IRQL <= DISPATCH_LEVEL.
  *
+ *          The item goes to the queue of the current node, unless all of its
+ *          workers are busy and another node has one waiting.
+ *
  *--*/
 VOID
 NTAPI
 ExQueueWorkItem(IN PWORK_QUEUE_ITEM WorkItem,
                 IN WORK_QUEUE_TYPE QueueType)
 {
-    PEX_WORK_QUEUE WorkQueue = &ExWorkerQueue[QueueType];
+    PEX_WORKER_NODE WorkerNode;
+    PEX_WORK_QUEUE WorkQueue;
+    PEX_WORK_QUEUE_LATENCY Latency;
+    LONG Sequence;
     ASSERT(QueueType < MaximumWorkQueue);
     ASSERT(WorkItem->List.Flink == NULL);
 
+    /* Pick the node and queue */
+    WorkerNode = ExpWorkerNodes[ExpSelectWorkerNode(QueueType)];
+    WorkQueue = &WorkerNode->Queues[QueueType];
+    Latency = &WorkerNode->Latency[QueueType];
+
     /* Don't try to trick us */
     if ((ULONG_PTR)WorkItem->WorkerRoutine < MmUserProbeAddress)
     {
@@ -732,7 +1043,9 @@ ExQueueWorkItem(IN PWORK_QUEUE_ITEM WorkItem,
                      0);
     }
 
-    /* Insert the Queue */
+    /* Remember when the item was queued, then insert it */
+    Sequence = InterlockedIncrement(&Latency->InsertSequence) - 1;
+    Latency->InsertTime[Sequence & (EX_WORK_LATENCY_SLOTS - 1)] = ExpWorkTimestamp();
     KeInsertQueue(&WorkQueue->WorkerQueue, &WorkItem->List);
     ASSERT(!WorkQueue->Info.QueueDisabled);
 
@@ -747,7 +1060,7 @@ ExQueueWorkItem(IN PWORK_QUEUE_ITEM WorkItem,
         (!IsListEmpty(&WorkQueue->WorkerQueue.EntryListHead)) &&
         (WorkQueue->WorkerQueue.CurrentCount <
          WorkQueue->WorkerQueue.MaximumCount) &&
-        (WorkQueue->DynamicThreadCount < 16))
+        (WorkQueue->DynamicThreadCount < EX_MAXIMUM_DYNAMIC_THREADS))
     {
         /* Let the balance manager know about it */
         DPRINT1("Requesting a new thread. CurrentCount: %lu. MaxCount: %lu\n",
@@ -757,4 +1070,112 @@ ExQueueWorkItem(IN PWORK_QUEUE_ITEM WorkItem,
     }
 }
 
+/*++
+ * @name ExpQueryWorkQueueStatistics
+ *
+ *     The ExpQueryWorkQueueStatistics routine returns the state and the
+ *     latency histogram of every work queue of every node.
+ *
+ * @param Buffer
+ *        Array of SYSDBG_WORK_QUEUE_STATISTICS receiving the data.
+ *
+ * @param BufferLength
+ *        Size of the array, in bytes.
+ *
+ * @param ReturnLength
+ *        Receives the size needed for all the queues, in bytes.
+ *
+ * @return STATUS_SUCCESS, or STATUS_INFO_LENGTH_MISMATCH if the buffer is too
+ *         small for all of them.
+ *
+ * @remarks The counters keep changing, so this is only a snapshot. The caller
+ *          must handle exceptions.
+ *
+ *--*/
+NTSTATUS
+NTAPI
+ExpQueryWorkQueueStatistics(OUT PSYSDBG_WORK_QUEUE_STATISTICS Buffer,
+                            IN ULONG BufferLength,
+                            OUT PULONG ReturnLength)
+{
+    PEX_WORK_QUEUE Queue;
+    PEX_WORK_QUEUE_LATENCY Latency;
+    ULONG Node, i, Length;
+
+    /* Check if everything fits */
+    Length = ExpWorkerNodeCount * MaximumWorkQueue * sizeof(SYSDBG_WORK_QUEUE_STATISTICS);
+    *ReturnLength = Length;
+    if (BufferLength < Length) return STATUS_INFO_LENGTH_MISMATCH;
+
+    for (Node = 0; Node < ExpWorkerNodeCount; Node++)
+    {
+        for (i = 0; i < MaximumWorkQueue; i++, Buffer++)
+        {
+            Queue = &ExpWorkerNodes[Node]->Queues[i];
+            Latency = &ExpWorkerNodes[Node]->Latency[i];
+
+            Buffer->Node = Node;
+            Buffer->QueueType = i;
+            Buffer->WorkerCount = Queue->Info.WorkerCount;
+            Buffer->DynamicThreadCount = Queue->DynamicThreadCount;
+            Buffer->QueueDepth = KeReadStateQueue(&Queue->WorkerQueue);
+            Buffer->WorkItemsProcessed = Queue->WorkItemsProcessed;
+            Buffer->WorkItemsStolen = Latency->WorkItemsStolen;
+            Buffer->MaximumLatency = Latency->MaximumLatency;
+            RtlCopyMemory(Buffer->LatencyHistogram,
+                          Latency->Histogram,
+                          sizeof(Buffer->LatencyHistogram));
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtWorkQueues(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    static const PCSTR QueueNames[MaximumWorkQueue] = { "Critical", "Delayed", "HyperCrit" };
+    PEX_WORK_QUEUE Queue;
+    PEX_WORK_QUEUE_LATENCY Latency;
+    ULONG Node, i, Bucket;
+
+    KdbpPrint("Latency threshold %lu ms, timed with %s\n",
+              ExpWorkerLatencyThreshold,
+              ExpWorkTscMHz ? "the TSC" : "the interrupt time");
+    KdbpPrint("Node  Queue      Workers  Dynamic  Depth   Processed     Stolen  Max latency\n");
+    for (Node = 0; Node < ExpWorkerNodeCount; Node++)
+    {
+        for (i = 0; i < MaximumWorkQueue; i++)
+        {
+            Queue = &ExpWorkerNodes[Node]->Queues[i];
+            Latency = &ExpWorkerNodes[Node]->Latency[i];
+
+            KdbpPrint("%4lu  %-9s  %7lu  %7ld  %5ld  %10lu  %9lu  %8lu us\n",
+                      Node,
+                      QueueNames[i],
+                      (ULONG)Queue->Info.WorkerCount,
+                      Queue->DynamicThreadCount,
+                      KeReadStateQueue(&Queue->WorkerQueue),
+                      Queue->WorkItemsProcessed,
+                      Latency->WorkItemsStolen,
+                      Latency->MaximumLatency);
+
+            /* Show the latency histogram, skipping empty buckets */
+            for (Bucket = 0; Bucket < SYSDBG_WORK_QUEUE_LATENCY_BUCKETS; Bucket++)
+            {
+                if (!Latency->Histogram[Bucket]) continue;
+                KdbpPrint("          < %6lu us: %lu\n",
+                          (Bucket < SYSDBG_WORK_QUEUE_LATENCY_BUCKETS - 1) ? (1UL << Bucket) : MAXULONG,
+                          Latency->Histogram[Bucket]);
+            }
+        }
+    }
+
+    return TRUE;
+}
+#endif
+
 /* EOF */
@@ -32,13 +32,14 @@ typedef union _COMBINED_LOCK_ELEMENT
 
 typedef struct _LOCK_INFORMATION
 {
-    RTL_GENERIC_TABLE RangeTable;
+    RTL_AVL_TABLE RangeTable;
     IO_CSQ Csq;
     KSPIN_LOCK CsqLock;
     LIST_ENTRY CsqList;
     PFILE_LOCK BelongsTo;
     LIST_ENTRY SharedLocks;
     ULONG Generation;
+    ULONG ExclusiveLocks;
 }
     LOCK_INFORMATION, *PLOCK_INFORMATION;
 
@@ -68,7 +69,7 @@ FsRtlCompleteLockIrpReal(IN PCOMPLETE_LOCK_IRP_ROUTINE CompleteRoutine,
 
 /* Generic table methods */
 
-static PVOID NTAPI LockAllocate(PRTL_GENERIC_TABLE Table, CLONG Bytes)
+static PVOID NTAPI LockAllocate(PRTL_AVL_TABLE Table, CLONG Bytes)
 {
     PVOID Result;
     Result = ExAllocatePoolWithTag(NonPagedPool, Bytes, TAG_TABLE);
@@ -76,14 +77,14 @@ static PVOID NTAPI LockAllocate(PRTL_GENERIC_TABLE Table, CLONG Bytes)
     return Result;
 }
 
-static VOID NTAPI LockFree(PRTL_GENERIC_TABLE Table, PVOID Buffer)
+static VOID NTAPI LockFree(PRTL_AVL_TABLE Table, PVOID Buffer)
 {
     DPRINT("LockFree(%p)\n", Buffer);
     ExFreePoolWithTag(Buffer, TAG_TABLE);
 }
 
 static RTL_GENERIC_COMPARE_RESULTS NTAPI LockCompare
-(PRTL_GENERIC_TABLE Table, PVOID PtrA, PVOID PtrB)
+(PRTL_AVL_TABLE Table, PVOID PtrA, PVOID PtrB)
 {
     PCOMBINED_LOCK_ELEMENT A = PtrA, B = PtrB;
     RTL_GENERIC_COMPARE_RESULTS Result;
@@ -119,6 +120,38 @@ static RTL_GENERIC_COMPARE_RESULTS NTAPI LockCompare
     return Result;
 }
 
+/* Ranges in the table never overlap each other: an exclusive lock conflicts
+ * with anything in its range, and overlapping shared locks are merged into a
+ * single element (the individual shared locks are kept on SharedLocks).  The
+ * table is therefore ordered by ending byte as well as by starting byte, so the
+ * maximum ending byte of any subtree is that of its rightmost node and no
+ * separate interval bookkeeping is needed.  Everything overlapping a range is
+ * the first matching element found by the lookup and the in-order successors
+ * that still compare equal to it. */
+
+static PCOMBINED_LOCK_ELEMENT
+FsRtlpFirstOverlappingLock(PLOCK_INFORMATION LockInfo,
+                           PCOMBINED_LOCK_ELEMENT Range,
+                           PVOID *RestartKey)
+{
+    return RtlLookupFirstMatchingElementGenericTableAvl(&LockInfo->RangeTable,
+                                                         Range,
+                                                         RestartKey);
+}
+
+static PCOMBINED_LOCK_ELEMENT
+FsRtlpNextOverlappingLock(PLOCK_INFORMATION LockInfo,
+                          PCOMBINED_LOCK_ELEMENT Range,
+                          PVOID *RestartKey)
+{
+    PCOMBINED_LOCK_ELEMENT Entry;
+    Entry = RtlEnumerateGenericTableWithoutSplayingAvl(&LockInfo->RangeTable,
+                                                       RestartKey);
+    if (Entry && LockCompare(&LockInfo->RangeTable, Entry, Range) == GenericEqual)
+        return Entry;
+    return NULL;
+}
+
 /* CSQ methods */
 
 static NTSTATUS NTAPI LockInsertIrpEx
@@ -260,8 +293,9 @@ FsRtlGetNextFileLock(IN PFILE_LOCK FileLock,
                      IN BOOLEAN Restart)
 {
     PCOMBINED_LOCK_ELEMENT Entry;
-    if (!FileLock->LockInformation) return NULL;
-    Entry = RtlEnumerateGenericTable(FileLock->LockInformation, Restart);
+    PLOCK_INFORMATION LockInfo = FileLock->LockInformation;
+    if (!LockInfo) return NULL;
+    Entry = RtlEnumerateGenericTableAvl(&LockInfo->RangeTable, Restart);
     if (!Entry) return NULL;
     else return &Entry->Exclusive.FileLock;
 }
@@ -302,16 +336,16 @@ FsRtlpRebuildSharedLockRange
     BOOLEAN InsertedNew = FALSE, RemovedOld;
     COMBINED_LOCK_ELEMENT NewElement = *Conflict;
     PCOMBINED_LOCK_ELEMENT Entry;
-    while ((Entry = RtlLookupElementGenericTable
-            (FileLock->LockInformation, &NewElement)))
+    while ((Entry = RtlLookupElementGenericTableAvl
+            (&LockInfo->RangeTable, &NewElement)))
     {
         FsRtlpExpandLockElement(&NewElement, Entry);
-        RemovedOld = RtlDeleteElementGenericTable
+        RemovedOld = RtlDeleteElementGenericTableAvl
             (&LockInfo->RangeTable,
              Entry);
         ASSERT(RemovedOld);
     }
-    Conflict = RtlInsertElementGenericTable
+    Conflict = RtlInsertElementGenericTableAvl
         (&LockInfo->RangeTable,
          &NewElement,
          sizeof(NewElement),
@@ -393,8 +427,9 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
 
         LockInfo->BelongsTo = FileLock;
         InitializeListHead(&LockInfo->SharedLocks);
+        LockInfo->ExclusiveLocks = 0;
         
-        RtlInitializeGenericTable
+        RtlInitializeGenericTableAvl
             (&LockInfo->RangeTable,
              LockCompare,
              LockAllocate,
@@ -422,8 +457,8 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
     ToInsert.Exclusive.FileLock.Key = Key;
     ToInsert.Exclusive.FileLock.ExclusiveLock = ExclusiveLock;
 
-    Conflict = RtlInsertElementGenericTable
-        (FileLock->LockInformation,
+    Conflict = RtlInsertElementGenericTableAvl
+        (&LockInfo->RangeTable,
          &ToInsert,
          sizeof(ToInsert),
          &InsertedNew);
@@ -474,59 +509,55 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
         }
         else
         {
-            ULONG i;
+            PVOID RestartKey;
             /* We know of at least one lock in range that's shared.  We need to
              * find out if any more exist and any are exclusive. */
-            for (i = 0; i < RtlNumberGenericTableElements(&LockInfo->RangeTable); i++)
+            for (Conflict = FsRtlpFirstOverlappingLock(LockInfo, &ToInsert, &RestartKey);
+                 Conflict;
+                 Conflict = FsRtlpNextOverlappingLock(LockInfo, &ToInsert, &RestartKey))
             {
-                Conflict = RtlGetElementGenericTable(&LockInfo->RangeTable, i);
-
-                /* The first argument will be inserted as a shared range */
-                if (Conflict && (LockCompare(&LockInfo->RangeTable, Conflict, &ToInsert) == GenericEqual))
+                if (Conflict->Exclusive.FileLock.ExclusiveLock)
                 {
-                    if (Conflict->Exclusive.FileLock.ExclusiveLock)
+                    /* Found an exclusive match */
+                    if (FailImmediately)
                     {
-                        /* Found an exclusive match */
-                        if (FailImmediately)
+                        IoStatus->Status = STATUS_FILE_LOCK_CONFLICT;
+                        DPRINT("STATUS_FILE_LOCK_CONFLICT\n");
+                        if (Irp)
                         {
-                            IoStatus->Status = STATUS_FILE_LOCK_CONFLICT;
-                            DPRINT("STATUS_FILE_LOCK_CONFLICT\n");
-                            if (Irp)
-                            {
-                                DPRINT("STATUS_FILE_LOCK_CONFLICT: Complete\n");
-                                FsRtlCompleteLockIrpReal
-                                    (FileLock->CompleteLockIrpRoutine,
-                                     Context,
-                                     Irp,
-                                     IoStatus->Status,
-                                     &Status,
-                                     FileObject);
-                            }
+                            DPRINT("STATUS_FILE_LOCK_CONFLICT: Complete\n");
+                            FsRtlCompleteLockIrpReal
+                                (FileLock->CompleteLockIrpRoutine,
+                                 Context,
+                                 Irp,
+                                 IoStatus->Status,
+                                 &Status,
+                                 FileObject);
                         }
-                        else
+                    }
+                    else
+                    {
+                        IoStatus->Status = STATUS_PENDING;
+                        if (Irp)
                         {
-                            IoStatus->Status = STATUS_PENDING;
-                            if (Irp)
-                            {
-                                IoMarkIrpPending(Irp);
-                                IoCsqInsertIrpEx
-                                    (&LockInfo->Csq,
-                                     Irp,
-                                     NULL,
-                                     NULL);
-                            }
+                            IoMarkIrpPending(Irp);
+                            IoCsqInsertIrpEx
+                                (&LockInfo->Csq,
+                                 Irp,
+                                 NULL,
+                                 NULL);
                         }
-                        return FALSE;
                     }
+                    return FALSE;
                 }
             }
             
             DPRINT("Overlapping shared lock %wZ %08x%08x %08x%08x\n",
                    &FileObject->FileName,
-                   Conflict->Exclusive.FileLock.StartingByte.HighPart,
-                   Conflict->Exclusive.FileLock.StartingByte.LowPart,
-                   Conflict->Exclusive.FileLock.EndingByte.HighPart,
-                   Conflict->Exclusive.FileLock.EndingByte.LowPart);
+                   ToInsert.Exclusive.FileLock.StartingByte.HighPart,
+                   ToInsert.Exclusive.FileLock.StartingByte.LowPart,
+                   ToInsert.Exclusive.FileLock.EndingByte.HighPart,
+                   ToInsert.Exclusive.FileLock.EndingByte.LowPart);
             Conflict = FsRtlpRebuildSharedLockRange(FileLock,
                                                     LockInfo,
                                                     &ToInsert);
@@ -620,7 +651,11 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
                Conflict->Exclusive.FileLock.EndingByte.HighPart,
                Conflict->Exclusive.FileLock.EndingByte.LowPart,
                Conflict->Exclusive.FileLock.ExclusiveLock);
-        if (!ExclusiveLock)
+        if (ExclusiveLock)
+        {
+            LockInfo->ExclusiveLocks++;
+        }
+        else
         {
             NewSharedRange = 
                 ExAllocatePoolWithTag(NonPagedPool, sizeof(*NewSharedRange), TAG_RANGE);
@@ -676,16 +711,20 @@ NTAPI
 FsRtlCheckLockForReadAccess(IN PFILE_LOCK FileLock,
                             IN PIRP Irp)
 {
-    BOOLEAN Result;
+    BOOLEAN Result = TRUE;
     PIO_STACK_LOCATION IoStack = IoGetCurrentIrpStackLocation(Irp);
     COMBINED_LOCK_ELEMENT ToFind;
     PCOMBINED_LOCK_ELEMENT Found;
+    PLOCK_INFORMATION LockInfo = FileLock->LockInformation;
+    PVOID RestartKey;
     DPRINT("CheckLockForReadAccess(%wZ, Offset %08x%08x, Length %x)\n", 
            &IoStack->FileObject->FileName,
            IoStack->Parameters.Read.ByteOffset.HighPart,
            IoStack->Parameters.Read.ByteOffset.LowPart,
            IoStack->Parameters.Read.Length);
-    if (!FileLock->LockInformation) {
+    /* Only exclusive locks keep anyone from reading, so skip the lookup
+     * when there aren't any */
+    if (!LockInfo || !LockInfo->ExclusiveLocks) {
         DPRINT("CheckLockForReadAccess(%wZ) => TRUE\n", &IoStack->FileObject->FileName);
         return TRUE;
     }
@@ -693,15 +732,13 @@ FsRtlCheckLockForReadAccess(IN PFILE_LOCK FileLock,
     ToFind.Exclusive.FileLock.EndingByte.QuadPart = 
         ToFind.Exclusive.FileLock.StartingByte.QuadPart + 
         IoStack->Parameters.Read.Length;
-    Found = RtlLookupElementGenericTable
-        (FileLock->LockInformation,
-         &ToFind);
-    if (!Found) {
-        DPRINT("CheckLockForReadAccess(%wZ) => TRUE\n", &IoStack->FileObject->FileName);
-        return TRUE;
+    for (Found = FsRtlpFirstOverlappingLock(LockInfo, &ToFind, &RestartKey);
+         Found && Result;
+         Found = FsRtlpNextOverlappingLock(LockInfo, &ToFind, &RestartKey))
+    {
+        Result = !Found->Exclusive.FileLock.ExclusiveLock || 
+            IoStack->Parameters.Read.Key == Found->Exclusive.FileLock.Key;
     }
-    Result = !Found->Exclusive.FileLock.ExclusiveLock || 
-        IoStack->Parameters.Read.Key == Found->Exclusive.FileLock.Key;
     DPRINT("CheckLockForReadAccess(%wZ) => %s\n", &IoStack->FileObject->FileName, Result ? "TRUE" : "FALSE");
     return Result;
 }
@@ -714,17 +751,19 @@ NTAPI
 FsRtlCheckLockForWriteAccess(IN PFILE_LOCK FileLock,
                              IN PIRP Irp)
 {
-    BOOLEAN Result;
+    BOOLEAN Result = TRUE;
     PIO_STACK_LOCATION IoStack = IoGetCurrentIrpStackLocation(Irp);
     COMBINED_LOCK_ELEMENT ToFind;
     PCOMBINED_LOCK_ELEMENT Found;
     PEPROCESS Process = Irp->Tail.Overlay.Thread->ThreadsProcess;
+    PLOCK_INFORMATION LockInfo = FileLock->LockInformation;
+    PVOID RestartKey;
     DPRINT("CheckLockForWriteAccess(%wZ, Offset %08x%08x, Length %x)\n", 
            &IoStack->FileObject->FileName,
            IoStack->Parameters.Write.ByteOffset.HighPart,
            IoStack->Parameters.Write.ByteOffset.LowPart,
            IoStack->Parameters.Write.Length);
-    if (!FileLock->LockInformation) {
+    if (!LockInfo || RtlIsGenericTableEmptyAvl(&LockInfo->RangeTable)) {
         DPRINT("CheckLockForWriteAccess(%wZ) => TRUE\n", &IoStack->FileObject->FileName);
         return TRUE;
     }
@@ -732,14 +771,12 @@ FsRtlCheckLockForWriteAccess(IN PFILE_LOCK FileLock,
     ToFind.Exclusive.FileLock.EndingByte.QuadPart = 
         ToFind.Exclusive.FileLock.StartingByte.QuadPart + 
         IoStack->Parameters.Write.Length;
-    Found = RtlLookupElementGenericTable
-        (FileLock->LockInformation,
-         &ToFind);
-    if (!Found) {
-        DPRINT("CheckLockForWriteAccess(%wZ) => TRUE\n", &IoStack->FileObject->FileName);
-        return TRUE;
+    for (Found = FsRtlpFirstOverlappingLock(LockInfo, &ToFind, &RestartKey);
+         Found && Result;
+         Found = FsRtlpNextOverlappingLock(LockInfo, &ToFind, &RestartKey))
+    {
+        Result = Process == Found->Exclusive.FileLock.ProcessId;
     }
-    Result = Process == Found->Exclusive.FileLock.ProcessId;
     DPRINT("CheckLockForWriteAccess(%wZ) => %s\n", &IoStack->FileObject->FileName, Result ? "TRUE" : "FALSE");
     return Result;
 }
@@ -759,6 +796,8 @@ FsRtlFastCheckLockForRead(IN PFILE_LOCK FileLock,
     PEPROCESS EProcess = Process;
     COMBINED_LOCK_ELEMENT ToFind;
     PCOMBINED_LOCK_ELEMENT Found;
+    PLOCK_INFORMATION LockInfo = FileLock->LockInformation;
+    PVOID RestartKey;
     DPRINT("FsRtlFastCheckLockForRead(%wZ, Offset %08x%08x, Length %08x%08x, Key %x)\n", 
            &FileObject->FileName, 
            FileOffset->HighPart,
@@ -769,13 +808,17 @@ FsRtlFastCheckLockForRead(IN PFILE_LOCK FileLock,
     ToFind.Exclusive.FileLock.StartingByte = *FileOffset;
     ToFind.Exclusive.FileLock.EndingByte.QuadPart = 
         FileOffset->QuadPart + Length->QuadPart;
-    if (!FileLock->LockInformation) return TRUE;
-    Found = RtlLookupElementGenericTable
-        (FileLock->LockInformation,
-         &ToFind);
-    if (!Found || !Found->Exclusive.FileLock.ExclusiveLock) return TRUE;
-    return Found->Exclusive.FileLock.Key == Key && 
-        Found->Exclusive.FileLock.ProcessId == EProcess;
+    if (!LockInfo || !LockInfo->ExclusiveLocks) return TRUE;
+    for (Found = FsRtlpFirstOverlappingLock(LockInfo, &ToFind, &RestartKey);
+         Found;
+         Found = FsRtlpNextOverlappingLock(LockInfo, &ToFind, &RestartKey))
+    {
+        if (Found->Exclusive.FileLock.ExclusiveLock &&
+            (Found->Exclusive.FileLock.Key != Key ||
+             Found->Exclusive.FileLock.ProcessId != EProcess))
+            return FALSE;
+    }
+    return TRUE;
 }
 
 /*
@@ -790,10 +833,12 @@ FsRtlFastCheckLockForWrite(IN PFILE_LOCK FileLock,
                            IN PFILE_OBJECT FileObject,
                            IN PVOID Process)
 {
-    BOOLEAN Result;
+    BOOLEAN Result = TRUE;
     PEPROCESS EProcess = Process;
     COMBINED_LOCK_ELEMENT ToFind;
     PCOMBINED_LOCK_ELEMENT Found;
+    PLOCK_INFORMATION LockInfo = FileLock->LockInformation;
+    PVOID RestartKey;
     DPRINT("FsRtlFastCheckLockForWrite(%wZ, Offset %08x%08x, Length %08x%08x, Key %x)\n", 
            &FileObject->FileName, 
            FileOffset->HighPart,
@@ -804,19 +849,17 @@ FsRtlFastCheckLockForWrite(IN PFILE_LOCK FileLock,
     ToFind.Exclusive.FileLock.StartingByte = *FileOffset;
     ToFind.Exclusive.FileLock.EndingByte.QuadPart = 
         FileOffset->QuadPart + Length->QuadPart;
-    if (!FileLock->LockInformation) {
+    if (!LockInfo || RtlIsGenericTableEmptyAvl(&LockInfo->RangeTable)) {
         DPRINT("CheckForWrite(%wZ) => TRUE\n", &FileObject->FileName);
         return TRUE;
     }
-    Found = RtlLookupElementGenericTable
-        (FileLock->LockInformation,
-         &ToFind);
-    if (!Found) {
-        DPRINT("CheckForWrite(%wZ) => TRUE\n", &FileObject->FileName);
-        return TRUE;
+    for (Found = FsRtlpFirstOverlappingLock(LockInfo, &ToFind, &RestartKey);
+         Found && Result;
+         Found = FsRtlpNextOverlappingLock(LockInfo, &ToFind, &RestartKey))
+    {
+        Result = Found->Exclusive.FileLock.Key == Key && 
+            Found->Exclusive.FileLock.ProcessId == EProcess;
     }
-    Result = Found->Exclusive.FileLock.Key == Key && 
-        Found->Exclusive.FileLock.ProcessId == EProcess;
     DPRINT("CheckForWrite(%wZ) => %s\n", &FileObject->FileName, Result ? "TRUE" : "FALSE");
     return Result;
 }
@@ -862,7 +905,7 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
         DPRINT("File not previously locked (ever)\n");
         return STATUS_RANGE_NOT_LOCKED;
     }
-    Entry = RtlLookupElementGenericTable(&InternalInfo->RangeTable, &Find);
+    Entry = RtlLookupElementGenericTableAvl(&InternalInfo->RangeTable, &Find);
     if (!Entry) {
         DPRINT("Range not locked %wZ\n", &FileObject->FileName);
         return STATUS_RANGE_NOT_LOCKED;
@@ -889,7 +932,8 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
         }
         RtlCopyMemory(&Find, Entry, sizeof(Find));
         // Remove the old exclusive lock region
-        RtlDeleteElementGenericTable(&InternalInfo->RangeTable, Entry);
+        RtlDeleteElementGenericTableAvl(&InternalInfo->RangeTable, Entry);
+        InternalInfo->ExclusiveLocks--;
     }
     else
     {
@@ -935,7 +979,7 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
                
             /* Remember what was in there and remove it from the table */
             Find = *Entry;
-            RtlDeleteElementGenericTable(&InternalInfo->RangeTable, &Find);
+            RtlDeleteElementGenericTableAvl(&InternalInfo->RangeTable, &Find);
             /* Put shared locks back in place */
             for (SharedEntry = InternalInfo->SharedLocks.Flink;
                  SharedEntry != &InternalInfo->SharedLocks;
@@ -1056,9 +1100,9 @@ FsRtlFastUnlockAll(IN PFILE_LOCK FileLock,
              Context,
              TRUE);
     }
-    for (Entry = RtlEnumerateGenericTable(&InternalInfo->RangeTable, TRUE);
+    for (Entry = RtlEnumerateGenericTableAvl(&InternalInfo->RangeTable, TRUE);
          Entry;
-         Entry = RtlEnumerateGenericTable(&InternalInfo->RangeTable, FALSE))
+         Entry = RtlEnumerateGenericTableAvl(&InternalInfo->RangeTable, FALSE))
     {
         LARGE_INTEGER Length;
         // We'll take the first one to be the list head, and free the others first...
@@ -1118,9 +1162,9 @@ FsRtlFastUnlockAllByKey(IN PFILE_LOCK FileLock,
              Context,
              TRUE);
     }
-    for (Entry = RtlEnumerateGenericTable(&InternalInfo->RangeTable, TRUE);
+    for (Entry = RtlEnumerateGenericTableAvl(&InternalInfo->RangeTable, TRUE);
          Entry;
-         Entry = RtlEnumerateGenericTable(&InternalInfo->RangeTable, FALSE))
+         Entry = RtlEnumerateGenericTableAvl(&InternalInfo->RangeTable, FALSE))
     {
         LARGE_INTEGER Length;
         // We'll take the first one to be the list head, and free the others first...
@@ -1293,9 +1337,9 @@ FsRtlUninitializeFileLock(IN PFILE_LOCK FileLock)
             RemoveEntryList(&SharedRange->Entry);
             ExFreePoolWithTag(SharedRange, TAG_RANGE);
         }
-        while ((Entry = RtlGetElementGenericTable(&InternalInfo->RangeTable, 0)) != NULL)
+        while ((Entry = RtlEnumerateGenericTableAvl(&InternalInfo->RangeTable, TRUE)) != NULL)
         {
-            RtlDeleteElementGenericTable(&InternalInfo->RangeTable, Entry);
+            RtlDeleteElementGenericTableAvl(&InternalInfo->RangeTable, Entry);
         }
         while ((Irp = IoCsqRemoveNextIrp(&InternalInfo->Csq, NULL)) != NULL)
         {
@@ -552,6 +552,160 @@ FsRtlNotifyUpdateBuffer(OUT PFILE_NOTIFY_INFORMATION OutputBuffer,
     return Succeed;
 }
 
+/*
+ * @implemented
+ */
+BOOLEAN
+FsRtlNotifyIsDuplicateModify(IN PVOID Buffer,
+                             IN PFILE_NOTIFY_INFORMATION NewEntry)
+{
+    BOOLEAN Duplicate = FALSE;
+    PFILE_NOTIFY_INFORMATION Entry = Buffer;
+
+    PAGED_CODE();
+
+    /* Find the latest entry already in the buffer for the same name.
+     * The new entry only adds something if that one isn't a modify
+     */
+    while (Entry != NewEntry)
+    {
+        if (Entry->FileNameLength == NewEntry->FileNameLength &&
+            RtlEqualMemory(Entry->FileName, NewEntry->FileName, NewEntry->FileNameLength))
+        {
+            Duplicate = (Entry->Action == FILE_ACTION_MODIFIED);
+        }
+
+        if (!Entry->NextEntryOffset)
+        {
+            break;
+        }
+        Entry = (PVOID)((ULONG_PTR)Entry + Entry->NextEntryOffset);
+    }
+
+    return Duplicate;
+}
+
+/*
+ * @implemented
+ */
+VOID
+NTAPI
+FsRtlNotifyCoalesceWorker(IN PVOID Context)
+{
+    PNOTIFY_CHANGE NotifyChange;
+    PREAL_NOTIFY_SYNC RealNotifySync;
+    PNOTIFY_COALESCE Coalesce = Context;
+    PSECURITY_SUBJECT_CONTEXT _SEH2_VOLATILE SubjectContext = NULL;
+
+    PAGED_CODE();
+
+    NotifyChange = Coalesce->NotifyChange;
+    RealNotifySync = NotifyChange->NotifySync;
+
+    FsRtlNotifyAcquireFastMutex(RealNotifySync);
+
+    _SEH2_TRY
+    {
+        /* Only free it with the lock held, cleanup may be looking at it */
+        ASSERT(NotifyChange->Coalesce == Coalesce);
+        NotifyChange->Coalesce = NULL;
+        ExFreePoolWithTag(Coalesce, TAG_FS_NOTIFICATIONS);
+
+        /* Window is over, return whatever was gathered meanwhile */
+        if (!(NotifyChange->Flags & (NOTIFY_LATER | CLEANUP_IN_PROCESS)) &&
+            (NotifyChange->DataLength != 0 || (NotifyChange->Flags & NOTIFY_IMMEDIATELY)) &&
+            !IsListEmpty(&NotifyChange->NotifyIrps))
+        {
+            FsRtlNotifyCompleteIrpList(NotifyChange, STATUS_SUCCESS);
+        }
+
+        /* Drop the reference that was kept for us, cleanup may already be done */
+        if (!InterlockedDecrement((PLONG)&(NotifyChange->ReferenceCount)))
+        {
+            RemoveEntryList(&NotifyChange->NotifyList);
+
+            if (NotifyChange->AllocatedBuffer)
+            {
+                PsReturnProcessPagedPoolQuota(NotifyChange->OwningProcess, NotifyChange->ThisBufferLength);
+                ExFreePool(NotifyChange->AllocatedBuffer);
+            }
+
+            if (NotifyChange->FullDirectoryName)
+            {
+                SubjectContext = NotifyChange->SubjectContext;
+            }
+
+            ExFreePoolWithTag(NotifyChange, 'FSrN');
+        }
+    }
+    _SEH2_FINALLY
+    {
+        FsRtlNotifyReleaseFastMutex(RealNotifySync);
+
+        if (SubjectContext)
+        {
+            SeReleaseSubjectContext(SubjectContext);
+            ExFreePool(SubjectContext);
+        }
+    }
+    _SEH2_END;
+}
+
+/*
+ * @implemented
+ */
+VOID
+NTAPI
+FsRtlNotifyCoalesceDpc(IN PKDPC Dpc,
+                       IN PVOID DeferredContext,
+                       IN PVOID SystemArgument1,
+                       IN PVOID SystemArgument2)
+{
+    PNOTIFY_COALESCE Coalesce = DeferredContext;
+
+    /* Completion needs the notify sync, so get back to passive level */
+    ExQueueWorkItem(&Coalesce->WorkItem, DelayedWorkQueue);
+}
+
+/*
+ * @implemented
+ */
+VOID
+FsRtlNotifyDeferCompletion(IN PNOTIFY_CHANGE NotifyChange)
+{
+    LARGE_INTEGER DueTime;
+    PNOTIFY_COALESCE Coalesce;
+
+    PAGED_CODE();
+
+    /* Already waiting, the change just joins the pending batch */
+    if (NotifyChange->Coalesce != NULL)
+    {
+        return;
+    }
+
+    /* Timer and DPC can't live in the (paged) notification */
+    Coalesce = ExAllocatePoolWithTag(NonPagedPool, sizeof(NOTIFY_COALESCE), TAG_FS_NOTIFICATIONS);
+    if (Coalesce == NULL)
+    {
+        /* No way to wait, complete right now */
+        FsRtlNotifyCompleteIrpList(NotifyChange, STATUS_SUCCESS);
+        return;
+    }
+
+    Coalesce->NotifyChange = NotifyChange;
+    KeInitializeTimer(&Coalesce->Timer);
+    KeInitializeDpc(&Coalesce->Dpc, FsRtlNotifyCoalesceDpc, Coalesce);
+    ExInitializeWorkItem(&Coalesce->WorkItem, FsRtlNotifyCoalesceWorker, Coalesce);
+
+    /* The worker will release that reference */
+    InterlockedIncrement((PLONG)&(NotifyChange->ReferenceCount));
+    NotifyChange->Coalesce = Coalesce;
+
+    DueTime.QuadPart = -NOTIFY_COALESCE_WINDOW;
+    KeSetTimer(&Coalesce->Timer, DueTime, &Coalesce->Dpc);
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*++
@@ -655,6 +809,15 @@ FsRtlNotifyCleanup(IN PNOTIFY_SYNC NotifySync,
             /* Mark it as to know that cleanup is in process */
             NotifyChange->Flags |= CLEANUP_IN_PROCESS;
 
+            /* Stop a pending delayed completion, if it didn't fire yet */
+            if (NotifyChange->Coalesce != NULL &&
+                KeCancelTimer(&NotifyChange->Coalesce->Timer))
+            {
+                ExFreePoolWithTag(NotifyChange->Coalesce, TAG_FS_NOTIFICATIONS);
+                NotifyChange->Coalesce = NULL;
+                InterlockedDecrement((PLONG)&(NotifyChange->ReferenceCount));
+            }
+
             /* If there are pending IRPs, complete them using the STATUS_NOTIFY_CLEANUP status */
             if (!IsListEmpty(&NotifyChange->NotifyIrps))
             {
@@ -992,7 +1155,7 @@ FsRtlNotifyFilterReportChange(IN PNOTIFY_SYNC NotifySync,
     BOOLEAN IsStream, IsParent, PoolQuotaCharged;
     STRING TargetDirectory, TargetName, ParentName, IntNormalizedParentName;
     ULONG NumberOfBytes, TargetNumberOfParts, FullNumberOfParts, LastPartOffset, ParentNameOffset, ParentNameLength;
-    ULONG DataLength, AlignedDataLength;
+    ULONG DataLength, AlignedDataLength, PreviousLastEntry;
 
     TargetDirectory.Length = 0;
     TargetDirectory.MaximumLength = 0;
@@ -1145,6 +1308,7 @@ FsRtlNotifyFilterReportChange(IN PNOTIFY_SYNC NotifySync,
                 /* If we have something to output... */
                 if (NotifyChange->BufferLength)
                 {
+RetryOutput:
                     /* Get size of the output */
                     NumberOfBytes = 0;
                     Irp = NULL;
@@ -1288,12 +1452,21 @@ FsRtlNotifyFilterReportChange(IN PNOTIFY_SYNC NotifySync,
                     /* If it's higher than buffer length, then, bail out without outputing */
                     if (DataLength > NumberOfBytes || AlignedDataLength + DataLength > NumberOfBytes)
                     {
+                        /* Unless we're just holding a full batch: return it and start a new one */
+                        if (NotifyChange->Coalesce != NULL && NotifyChange->DataLength != 0 &&
+                            DataLength <= NumberOfBytes && !IsListEmpty(&NotifyChange->NotifyIrps))
+                        {
+                            FsRtlNotifyCompleteIrpList(NotifyChange, STATUS_SUCCESS);
+                            goto RetryOutput;
+                        }
+
                         NotifyChange->Flags |= NOTIFY_IMMEDIATELY;
                     }
                     else
                     {
                         OutputBuffer = NULL;
                         FileNotifyInfo = NULL;
+                        PreviousLastEntry = NotifyChange->LastEntry;
                         /* If we already had a buffer, update last entry position */
                         if (NotifyChange->Buffer != NULL)
                         {
@@ -1352,7 +1525,18 @@ FsRtlNotifyFilterReportChange(IN PNOTIFY_SYNC NotifySync,
                                                          StreamName, NotifyChange->CharacterSize == sizeof(WCHAR),
                                                          DataLength))
                             {
-                                NotifyChange->DataLength = DataLength + AlignedDataLength;
+                                /* Same file got modified again, the entry already there is enough */
+                                if (Action == FILE_ACTION_MODIFIED && FileNotifyInfo != NULL &&
+                                    NotifyChange->DataLength != 0 &&
+                                    FsRtlNotifyIsDuplicateModify(NotifyChange->Buffer, OutputBuffer))
+                                {
+                                    FileNotifyInfo->NextEntryOffset = 0;
+                                    NotifyChange->LastEntry = PreviousLastEntry;
+                                }
+                                else
+                                {
+                                    NotifyChange->DataLength = DataLength + AlignedDataLength;
+                                }
                             }
                             /* If it failed, notify immediately */
                             else
@@ -1397,7 +1581,17 @@ FsRtlNotifyFilterReportChange(IN PNOTIFY_SYNC NotifySync,
                 NotifyChange->Flags &= ~NOTIFY_LATER;
                 if (!IsListEmpty(&NotifyChange->NotifyIrps))
                 {
-                    FsRtlNotifyCompleteIrpList(NotifyChange, STATUS_SUCCESS);
+                    /* If the change went into the buffer, give the next ones
+                     * a chance to join it before completing
+                     */
+                    if (!(NotifyChange->Flags & NOTIFY_IMMEDIATELY) && NotifyChange->DataLength != 0)
+                    {
+                        FsRtlNotifyDeferCompletion(NotifyChange);
+                    }
+                    else
+                    {
+                        FsRtlNotifyCompleteIrpList(NotifyChange, STATUS_SUCCESS);
+                    }
                 }
             }
         }
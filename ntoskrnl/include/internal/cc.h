@@ -54,16 +54,52 @@ extern NPAGED_LOOKASIDE_LIST CcTwilightLookasideList;
 extern LARGE_INTEGER CcIdleDelay;
 
 //
-// Counters
+// Counters, kept per processor so that hot paths don't share cache lines.
+// They are only summed up when queried, a few counts may be lost when a
+// thread moves to another processor while updating one.
 //
-extern ULONG CcLazyWritePages;
-extern ULONG CcLazyWriteIos;
-extern ULONG CcMapDataWait;
-extern ULONG CcMapDataNoWait;
-extern ULONG CcPinReadWait;
-extern ULONG CcPinReadNoWait;
-extern ULONG CcDataPages;
-extern ULONG CcDataFlushes;
+typedef struct DECLSPEC_CACHEALIGN _CC_PERFORMANCE_COUNTERS
+{
+    ULONG CopyReadNoWait;
+    ULONG CopyReadWait;
+    ULONG CopyReadNoWaitMiss;
+    ULONG CopyReadWaitMiss;
+    ULONG MapDataNoWait;
+    ULONG MapDataWait;
+    ULONG MapDataNoWaitMiss;
+    ULONG MapDataWaitMiss;
+    ULONG PinReadNoWait;
+    ULONG PinReadWait;
+    ULONG PinReadNoWaitMiss;
+    ULONG PinReadWaitMiss;
+    ULONG MdlReadWait;
+    ULONG MdlReadWaitMiss;
+    /* Views read by read ahead, then read, or read too late */
+    ULONG ReadAheadIos;
+    ULONG ReadAheadHits;
+    ULONG ReadAheadMisses;
+    /* Writes and pages issued by the lazy writer */
+    ULONG LazyWriteIos;
+    ULONG LazyWritePages;
+    /* Writes and pages issued by Cc, whoever asked for them */
+    ULONG DataFlushes;
+    ULONG DataPages;
+    /* Writes CcCanIWrite didn't allow right away */
+    ULONG ThrottledWrites;
+} CC_PERFORMANCE_COUNTERS, *PCC_PERFORMANCE_COUNTERS;
+
+extern CC_PERFORMANCE_COUNTERS CcPerformanceCounters[MAXIMUM_PROCESSORS];
+
+#define CcAddPerformanceCounter(Counter, Value) \
+    (CcPerformanceCounters[KeGetCurrentProcessorNumber()].Counter += (Value))
+
+#define CcIncrementPerformanceCounter(Counter) \
+    CcAddPerformanceCounter(Counter, 1)
+
+VOID
+NTAPI
+CcQueryPerformanceCounters(
+    OUT PCC_PERFORMANCE_COUNTERS Counters);
 
 typedef struct _PF_SCENARIO_ID
 {
@@ -188,6 +224,11 @@ typedef struct _ROS_SHARED_CACHE_MAP
     ULONG TimeStamp;
     BOOLEAN PinAccess;
     KSPIN_LOCK CacheMapLock;
+    /* Number of read ahead work items queued for this file */
+    volatile LONG ReadAheadsInFlight;
+    /* Sparse index of the VACBs by view number, protected by CacheMapLock */
+    struct _ROS_VACB ***VacbIndex;
+    ULONG VacbIndexSize;
 #if DBG
     BOOLEAN Trace; /* enable extra trace output for this cache map and it's VACBs */
 #endif
@@ -195,6 +236,15 @@ typedef struct _ROS_SHARED_CACHE_MAP
 
 #define READAHEAD_DISABLED 0x1
 #define WRITEBEHIND_DISABLED 0x2
+#define CACHE_USE_ONCE 0x4
+
+/* Contiguous dirty views are flushed in a single write of up to 4MB. The
+ * actual limit is CcMaxFlushRun, which can be lowered from the registry */
+#define VACB_MAX_FLUSH_RUN 16
+
+/* Each block of the VACB index covers 128 views (32MB of file) */
+#define VACB_INDEX_BLOCK_SHIFT 7
+#define VACB_INDEX_BLOCK_SIZE (1 << VACB_INDEX_BLOCK_SHIFT)
 
 typedef struct _ROS_VACB
 {
@@ -208,6 +258,12 @@ typedef struct _ROS_VACB
     BOOLEAN Dirty;
     /* Page out in progress */
     BOOLEAN PageOut;
+    /* Brought in by read ahead, and not read by anyone since. */
+    BOOLEAN ReadAhead;
+    /* In the protected part of the LRU list, which trimming goes to last. */
+    BOOLEAN Protected;
+    /* Interrupt time of the first use, while on probation. */
+    ULONGLONG FirstUseTime;
     ULONG MappedCount;
     /* Entry in the list of VACBs for this shared cache map. */
     LIST_ENTRY CacheMapVacbListEntry;
@@ -255,10 +311,13 @@ typedef struct _WORK_QUEUE_ENTRY
         struct
         {
             FILE_OBJECT *FileObject;
+            LARGE_INTEGER FileOffset;
+            ULONG Length;
         } Read;
         struct
         {
             SHARED_CACHE_MAP *SharedCacheMap;
+            ULONG Target;
         } Write;
         struct
         {
@@ -286,12 +345,47 @@ extern LAZY_WRITER LazyWriter;
 #define NODE_TYPE_PRIVATE_MAP    0x02FE
 #define NODE_TYPE_SHARED_MAP     0x02FF
 
+/* CcPfEnablePrefetcher flags */
+#define CCPF_ENABLE_APP_LAUNCH  0x1
+#define CCPF_ENABLE_BOOT        0x2
+
+extern ULONG CcPfEnablePrefetcher;
+extern ULONG CcMaxFlushRun;
+extern PFSN_PREFETCHER_GLOBALS CcPfGlobals;
+
 VOID
 NTAPI
 CcPfInitializePrefetcher(
     VOID
 );
 
+NTSTATUS
+NTAPI
+CcPfBeginBootPhase(
+    IN ULONG Phase
+);
+
+VOID
+NTAPI
+CcPfBeginAppLaunch(
+    IN PEPROCESS Process
+);
+
+VOID
+NTAPI
+CcPfBeginLogon(
+    IN ULONG UserHash,
+    IN BOOLEAN Trace
+);
+
+VOID
+NTAPI
+CcPfLogPageFault(
+    IN PFILE_OBJECT FileObject,
+    IN LONGLONG FileOffset,
+    IN BOOLEAN ImageSection
+);
+
 VOID
 NTAPI
 CcMdlReadComplete2(
@@ -338,6 +432,10 @@ NTSTATUS
 NTAPI
 CcWriteVirtualAddress(PROS_VACB Vacb);
 
+NTSTATUS
+NTAPI
+CcWriteVirtualAddresses(PROS_VACB *Vacbs, ULONG Count);
+
 BOOLEAN
 NTAPI
 CcInitializeCacheManager(VOID);
@@ -357,6 +455,39 @@ CcRosLookupVacb(
     LONGLONG FileOffset
 );
 
+PROS_VACB
+CcRosLookupVacbIndex(
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset
+);
+
+VOID
+CcRosRemoveVacbFromIndex(
+    PROS_VACB Vacb
+);
+
+VOID
+CcRosRemoveVacbFromLru(
+    PROS_VACB Vacb
+);
+
+PROS_VACB
+NTAPI
+CcRosLookupVacbByAddress(
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PVOID Address
+);
+
+VOID
+NTAPI
+CcRosQueryCacheResidency(
+    PSECTION_OBJECT_POINTERS SectionObjectPointers,
+    PLONGLONG FileSize,
+    PLONGLONG ResidentBytes,
+    PLONGLONG DirtyBytes,
+    PULONG ViewCount
+);
+
 VOID
 NTAPI
 CcInitCacheZeroPage(VOID);
@@ -465,7 +596,15 @@ CcPostWorkQueue(
 
 VOID
 CcPerformReadAhead(
-    IN PFILE_OBJECT FileObject);
+    IN PFILE_OBJECT FileObject,
+    IN LONGLONG FileOffset,
+    IN ULONG Length);
+
+VOID
+CcScheduleReadAheadForMiss(
+    IN PFILE_OBJECT FileObject,
+    IN LONGLONG FileOffset,
+    IN ULONG Length);
 
 NTSTATUS
 CcRosInternalFreeVacb(
@@ -496,6 +635,14 @@ IsPointInRange(
     return DoRangesIntersect(Offset1, Length1, Point, 1);
 }
 
+/* Past three quarters of the dirty page threshold, the lazy writer hurries up */
+FORCEINLINE
+BOOLEAN
+CcIsDirtyPageBacklogHigh(VOID)
+{
+    return CcTotalDirtyPages > CcDirtyPageThreshold - CcDirtyPageThreshold / 4;
+}
+
 #define CcBugCheck(A, B, C) KeBugCheckEx(CACHE_MANAGER, BugCheckFileId | ((ULONG)(__LINE__)), A, B, C)
 
 #if DBG
@@ -84,6 +84,17 @@
 #define CMP_HASH_IRRATIONAL                             314159269
 #define CMP_HASH_PRIME                                  1000000007
 
+//
+// KCB and NCB hash table sizing. Both tables start out with the initial size
+// and get doubled whenever the average chain gets longer than the load
+// factor. The lock stripe count must be a power of two no larger than the
+// initial size.
+//
+#define CMP_HASH_TABLE_INITIAL_SIZE                     2048
+#define CMP_HASH_TABLE_MAXIMUM_SIZE                     0x40000
+#define CMP_HASH_TABLE_LOAD_FACTOR                      2
+#define CMP_HASH_LOCK_COUNT                             512
+
 //
 // CmpCreateKeyControlBlock Flags
 //
@@ -152,8 +163,6 @@ typedef struct _CM_KEY_HASH
 //
 typedef struct _CM_KEY_HASH_TABLE_ENTRY
 {
-    EX_PUSH_LOCK Lock;
-    PKTHREAD Owner;
     PCM_KEY_HASH Entry;
 } CM_KEY_HASH_TABLE_ENTRY, *PCM_KEY_HASH_TABLE_ENTRY;
 
@@ -173,10 +182,33 @@ typedef struct _CM_NAME_HASH
 //
 typedef struct _CM_NAME_HASH_TABLE_ENTRY
 {
-    EX_PUSH_LOCK Lock;
     PCM_NAME_HASH Entry;
 } CM_NAME_HASH_TABLE_ENTRY, *PCM_NAME_HASH_TABLE_ENTRY;
 
+//
+// Hash Table Lock Stripe. Buckets whose index is the same modulo the number
+// of stripes share one, so that growing a table never moves a key to another
+// lock. The KCB stripes also serve as the KCB locks.
+//
+typedef struct DECLSPEC_CACHEALIGN _CM_HASH_LOCK
+{
+    EX_PUSH_LOCK Lock;
+    PKTHREAD Owner;
+    LONG Waits;
+    LONG Lookups;
+    LONG Probes;
+} CM_HASH_LOCK, *PCM_HASH_LOCK;
+
+//
+// Hash Table Statistics
+//
+typedef struct _CM_HASH_TABLE_STATISTICS
+{
+    LONG Entries;
+    ULONG LongestChain;
+    ULONG Resizes;
+} CM_HASH_TABLE_STATISTICS, *PCM_HASH_TABLE_STATISTICS;
+
 //
 // Key Security Cache
 //
@@ -558,6 +590,26 @@ CmpDestroyHiveViewList(
     IN PCMHIVE Hive
 );
 
+PCELL_DATA
+CMAPI
+CmpGetMappedCell(
+    IN PHHIVE Hive,
+    IN HCELL_INDEX Cell
+);
+
+VOID
+NTAPI
+CmpTrimHiveViews(
+    IN PCMHIVE CmHive,
+    IN ULONG Limit
+);
+
+VOID
+NTAPI
+CmpTrimMappedHives(
+    VOID
+);
+
 //
 // Security Cache Functions
 //
@@ -588,6 +640,15 @@ CmpFindValueByNameFromCache(
     OUT PHCELL_INDEX CellToRelease
 );
 
+VALUE_SEARCH_RETURN_TYPE
+NTAPI
+CmpFindValuesByNameFromCache(
+    IN PCM_KEY_CONTROL_BLOCK Kcb,
+    IN PCUNICODE_STRING Names,
+    IN ULONG NameCount,
+    OUT PHCELL_INDEX ValueCells
+);
+
 VALUE_SEARCH_RETURN_TYPE
 NTAPI
 CmpQueryKeyValueData(
@@ -624,6 +685,18 @@ CmpGetValueKeyFromCache(
     OUT PHCELL_INDEX CellToRelease
 );
 
+VALUE_SEARCH_RETURN_TYPE
+NTAPI
+CmpGetValueDataFromCache(
+    IN PCM_KEY_CONTROL_BLOCK Kcb,
+    IN PCM_CACHED_VALUE *CachedValue,
+    IN PCELL_DATA ValueKey,
+    IN BOOLEAN ValueIsCached,
+    OUT PVOID *DataPointer,
+    OUT PBOOLEAN Allocated,
+    OUT PHCELL_INDEX CellToRelease
+);
+
 VALUE_SEARCH_RETURN_TYPE
 NTAPI
 CmpCompareNewValueDataAgainstKCBCache(
@@ -1339,6 +1412,18 @@ CmQueryValueKey(
     IN PULONG ResultLength
 );
 
+NTSTATUS
+NTAPI
+CmQueryMultipleValueKey(
+    IN PCM_KEY_CONTROL_BLOCK Kcb,
+    IN PCUNICODE_STRING ValueNames,
+    IN OUT PKEY_VALUE_ENTRY ValueList,
+    IN ULONG NumberOfValues,
+    OUT PVOID Buffer,
+    IN ULONG Length,
+    OUT PULONG ResultLength
+);
+
 NTSTATUS
 NTAPI
 CmLoadKey(
@@ -1480,6 +1565,9 @@ extern POBJECT_TYPE CmpKeyObjectType;
 extern ERESOURCE CmpRegistryLock;
 extern PCM_KEY_HASH_TABLE_ENTRY CmpCacheTable;
 extern PCM_NAME_HASH_TABLE_ENTRY CmpNameCacheTable;
+extern CM_HASH_LOCK CmpKcbHashLocks[CMP_HASH_LOCK_COUNT];
+extern CM_HASH_LOCK CmpNcbHashLocks[CMP_HASH_LOCK_COUNT];
+extern CM_HASH_TABLE_STATISTICS CmpKcbHashStatistics, CmpNcbHashStatistics;
 extern KGUARDED_MUTEX CmpDelayedCloseTableLock;
 extern CMHIVE CmControlHive;
 extern WCHAR CmDefaultLanguageId[];
@@ -1509,7 +1597,9 @@ extern ULONG CmpBootType;
 extern HANDLE CmpRegistryRootHandle;
 extern BOOLEAN ExpInTextModeSetup;
 extern BOOLEAN InitIsWinPEMode;
-extern ULONG CmpHashTableSize;
+extern ULONG CmpHashTableSize, CmpNameHashTableSize;
+extern ULONG CmpHiveViewLimit;
+extern ULONG CmpLogReconcileThreshold;
 extern ULONG CmpDelayedCloseSize, CmpDelayedCloseIndex;
 extern BOOLEAN CmpNoWrite;
 extern BOOLEAN CmpForceForceFlush;
@@ -13,12 +13,27 @@
     ((CMP_HASH_IRRATIONAL * (ConvKey)) % CMP_HASH_PRIME)
 
 //
-// Returns the index into the hash table, or the entry itself
+// Returns the index into the hash table, or the entry itself. The table sizes
+// are always powers of two.
 //
 #define GET_HASH_INDEX(ConvKey)                                     \
-    GET_HASH_KEY(ConvKey) % CmpHashTableSize
+    (GET_HASH_KEY(ConvKey) & (CmpHashTableSize - 1))
 #define GET_HASH_ENTRY(Table, ConvKey)                              \
     (&Table[GET_HASH_INDEX(ConvKey)])
+#define GET_NAME_HASH_INDEX(ConvKey)                                \
+    (GET_HASH_KEY(ConvKey) & (CmpNameHashTableSize - 1))
+#define GET_NAME_HASH_ENTRY(ConvKey)                                \
+    (&CmpNameCacheTable[GET_NAME_HASH_INDEX(ConvKey)])
+
+//
+// Returns the index of the lock stripe covering a key, or the stripe itself
+//
+#define GET_HASH_LOCK_INDEX(ConvKey)                                \
+    (GET_HASH_KEY(ConvKey) & (CMP_HASH_LOCK_COUNT - 1))
+#define GET_KCB_HASH_LOCK(ConvKey)                                  \
+    (&CmpKcbHashLocks[GET_HASH_LOCK_INDEX(ConvKey)])
+#define GET_NCB_HASH_LOCK(ConvKey)                                  \
+    (&CmpNcbHashLocks[GET_HASH_LOCK_INDEX(ConvKey)])
 #define ASSERT_VALID_HASH(h)                                        \
     ASSERT_KCB_VALID(CONTAINING_RECORD((h), CM_KEY_CONTROL_BLOCK, KeyHash))
 
@@ -76,22 +91,50 @@
 #define ASSERT_KCB_VALID(k)                                         \
     ASSERT((k)->Signature == CM_KCB_SIGNATURE)
 
+//
+// Exclusively acquires a hash lock stripe, counting the times it was busy
+//
+FORCEINLINE
+VOID
+CmpAcquireHashLockExclusive(IN PCM_HASH_LOCK HashLock)
+{
+    if (!ExTryToAcquirePushLockExclusive(&HashLock->Lock))
+    {
+        InterlockedIncrement(&HashLock->Waits);
+        ExAcquirePushLockExclusive(&HashLock->Lock);
+    }
+}
+
+//
+// Shared acquires a hash lock stripe, counting the times it was held
+// exclusively
+//
+FORCEINLINE
+VOID
+CmpAcquireHashLockShared(IN PCM_HASH_LOCK HashLock)
+{
+    if ((HashLock->Lock.Locked) && !(HashLock->Lock.Shared))
+    {
+        InterlockedIncrement(&HashLock->Waits);
+    }
+    ExAcquirePushLockShared(&HashLock->Lock);
+}
+
 //
 // Checks if a KCB is exclusively locked
 //
 #define CmpIsKcbLockedExclusive(k)                                  \
-    (GET_HASH_ENTRY(CmpCacheTable,                                  \
-                    (k)->ConvKey)->Owner == KeGetCurrentThread())
+    (GET_KCB_HASH_LOCK((k)->ConvKey)->Owner == KeGetCurrentThread())
 
 //
-// Exclusively acquires a KCB by index
+// Exclusively acquires a KCB by lock index
 //
 FORCEINLINE
 VOID
 CmpAcquireKcbLockExclusiveByIndex(ULONG Index)
 {
-    ExAcquirePushLockExclusive(&CmpCacheTable[Index].Lock);
-    CmpCacheTable[Index].Owner = KeGetCurrentThread();
+    CmpAcquireHashLockExclusive(&CmpKcbHashLocks[Index]);
+    CmpKcbHashLocks[Index].Owner = KeGetCurrentThread();
 }
 
 //
@@ -101,7 +144,7 @@ FORCEINLINE
 VOID
 CmpAcquireKcbLockExclusive(PCM_KEY_CONTROL_BLOCK Kcb)
 {
-    CmpAcquireKcbLockExclusiveByIndex(GET_HASH_INDEX(Kcb->ConvKey));
+    CmpAcquireKcbLockExclusiveByIndex(GET_HASH_LOCK_INDEX(Kcb->ConvKey));
 }
 
 //
@@ -111,7 +154,7 @@ FORCEINLINE
 VOID
 CmpAcquireKcbLockExclusiveByKey(IN ULONG ConvKey)
 {
-    CmpAcquireKcbLockExclusiveByIndex(GET_HASH_INDEX(ConvKey));
+    CmpAcquireKcbLockExclusiveByIndex(GET_HASH_LOCK_INDEX(ConvKey));
 }
 
 
@@ -120,16 +163,15 @@ CmpAcquireKcbLockExclusiveByKey(IN ULONG ConvKey)
 //
 #define CmpAcquireKcbLockShared(k)                                  \
 {                                                                   \
-    ExAcquirePushLockShared(&GET_HASH_ENTRY(CmpCacheTable,          \
-                                            (k)->ConvKey)->Lock);    \
+    CmpAcquireHashLockShared(GET_KCB_HASH_LOCK((k)->ConvKey));      \
 }
 
 //
-// Shared acquires a KCB by index
+// Shared acquires a KCB by lock index
 //
 #define CmpAcquireKcbLockSharedByIndex(i)                           \
 {                                                                   \
-    ExAcquirePushLockShared(&CmpCacheTable[(i)].Lock);              \
+    CmpAcquireHashLockShared(&CmpKcbHashLocks[(i)]);                \
 }
 
 //
@@ -141,24 +183,23 @@ CmpTryToConvertKcbSharedToExclusive(IN PCM_KEY_CONTROL_BLOCK k)
 {
     ASSERT(CmpIsKcbLockedExclusive(k) == FALSE);
     if (ExConvertPushLockSharedToExclusive(
-            &GET_HASH_ENTRY(CmpCacheTable, k->ConvKey)->Lock))
+            &GET_KCB_HASH_LOCK(k->ConvKey)->Lock))
     {
-        GET_HASH_ENTRY(CmpCacheTable,
-                       k->ConvKey)->Owner = KeGetCurrentThread();
+        GET_KCB_HASH_LOCK(k->ConvKey)->Owner = KeGetCurrentThread();
         return TRUE;
     }
     return FALSE;
 }
 
 //
-// Releases an exlusively or shared acquired KCB by index
+// Releases an exlusively or shared acquired KCB by lock index
 //
 FORCEINLINE
 VOID
 CmpReleaseKcbLockByIndex(ULONG Index)
 {
-    CmpCacheTable[Index].Owner = NULL;
-    ExReleasePushLock(&CmpCacheTable[Index].Lock);
+    CmpKcbHashLocks[Index].Owner = NULL;
+    ExReleasePushLock(&CmpKcbHashLocks[Index].Lock);
 }
 
 //
@@ -168,7 +209,7 @@ FORCEINLINE
 VOID
 CmpReleaseKcbLock(PCM_KEY_CONTROL_BLOCK Kcb)
 {
-    CmpReleaseKcbLockByIndex(GET_HASH_INDEX(Kcb->ConvKey));
+    CmpReleaseKcbLockByIndex(GET_HASH_LOCK_INDEX(Kcb->ConvKey));
 }
 
 //
@@ -178,7 +219,7 @@ FORCEINLINE
 VOID
 CmpReleaseKcbLockByKey(ULONG ConvKey)
 {
-    CmpReleaseKcbLockByIndex(GET_HASH_INDEX(ConvKey));
+    CmpReleaseKcbLockByIndex(GET_HASH_LOCK_INDEX(ConvKey));
 }
 
 //
@@ -198,8 +239,7 @@ CmpConvertKcbSharedToExclusive(IN PCM_KEY_CONTROL_BLOCK k)
 //
 #define CmpAcquireNcbLockExclusive(n)                               \
 {                                                                   \
-    ExAcquirePushLockExclusive(&GET_HASH_ENTRY(CmpNameCacheTable,   \
-                                              (n)->ConvKey)->Lock);  \
+    CmpAcquireHashLockExclusive(GET_NCB_HASH_LOCK((n)->ConvKey));   \
 }
 
 //
@@ -207,8 +247,15 @@ CmpConvertKcbSharedToExclusive(IN PCM_KEY_CONTROL_BLOCK k)
 //
 #define CmpAcquireNcbLockExclusiveByKey(k)                          \
 {                                                                   \
-    ExAcquirePushLockExclusive(&GET_HASH_ENTRY(CmpNameCacheTable,   \
-                                               (k))->Lock);          \
+    CmpAcquireHashLockExclusive(GET_NCB_HASH_LOCK(k));              \
+}
+
+//
+// Shared acquires an NCB by key
+//
+#define CmpAcquireNcbLockSharedByKey(k)                             \
+{                                                                   \
+    CmpAcquireHashLockShared(GET_NCB_HASH_LOCK(k));                 \
 }
 
 //
@@ -216,8 +263,7 @@ CmpConvertKcbSharedToExclusive(IN PCM_KEY_CONTROL_BLOCK k)
 //
 #define CmpReleaseNcbLock(k)                                        \
 {                                                                   \
-    ExReleasePushLock(&GET_HASH_ENTRY(CmpNameCacheTable,            \
-                                     (k)->ConvKey)->Lock);           \
+    ExReleasePushLock(&GET_NCB_HASH_LOCK((k)->ConvKey)->Lock);      \
 }
 
 //
@@ -225,8 +271,7 @@ CmpConvertKcbSharedToExclusive(IN PCM_KEY_CONTROL_BLOCK k)
 //
 #define CmpReleaseNcbLockByKey(k)                                   \
 {                                                                   \
-    ExReleasePushLock(&GET_HASH_ENTRY(CmpNameCacheTable,            \
-                                      (k))->Lock);                   \
+    ExReleasePushLock(&GET_NCB_HASH_LOCK(k)->Lock);                 \
 }
 
 //
@@ -234,7 +279,7 @@ CmpConvertKcbSharedToExclusive(IN PCM_KEY_CONTROL_BLOCK k)
 //
 #define CMP_ASSERT_HASH_ENTRY_LOCK(k)                               \
 {                                                                   \
-    ASSERT(((GET_HASH_ENTRY(CmpCacheTable, k)->Owner ==              \
+    ASSERT(((GET_KCB_HASH_LOCK(k)->Owner ==                         \
             KeGetCurrentThread())) ||                               \
            (CmpTestRegistryLockExclusive() == TRUE));               \
 }
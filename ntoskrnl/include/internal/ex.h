@@ -30,6 +30,7 @@ extern KSPIN_LOCK ExpNonPagedLookasideListLock;
 extern KSPIN_LOCK ExpPagedLookasideListLock;
 extern ULONG ExCriticalWorkerThreads;
 extern ULONG ExDelayedWorkerThreads;
+extern ULONG ExpWorkerLatencyThreshold;
 
 extern PVOID ExpDefaultErrorPort;
 extern PEPROCESS ExpDefaultErrorPortProcess;
@@ -112,6 +113,22 @@ typedef struct _ETIMER
     LIST_ENTRY WakeTimerListEntry;
 } ETIMER, *PETIMER;
 
+//
+// Counters of the spin before blocking done by contended push lock and
+// resource acquisitions
+//
+typedef struct _EX_SPIN_WAIT_STATISTICS
+{
+    LONG Spins;
+    LONG SpinAcquires;
+    LONG Blocks;
+} EX_SPIN_WAIT_STATISTICS, *PEX_SPIN_WAIT_STATISTICS;
+
+extern ULONG ExPushLockSpinCount;
+extern ULONG ExResourceSpinCount;
+extern EX_SPIN_WAIT_STATISTICS ExpPushLockSpinStatistics;
+extern EX_SPIN_WAIT_STATISTICS ExpResourceSpinStatistics;
+
 typedef struct
 {
     PCALLBACK_OBJECT *CallbackObject;
@@ -201,6 +218,14 @@ VOID
 NTAPI
 ExSwapinWorkerThreads(IN BOOLEAN AllowSwap);
 
+NTSTATUS
+NTAPI
+ExpQueryWorkQueueStatistics(
+    OUT PSYSDBG_WORK_QUEUE_STATISTICS Buffer,
+    IN ULONG BufferLength,
+    OUT PULONG ReturnLength
+);
+
 VOID
 NTAPI
 ExpInitLookasideLists(VOID);
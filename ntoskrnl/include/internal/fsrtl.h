@@ -59,6 +59,12 @@
 #define WATCH_ROOT         0x10
 #define DELETE_IN_PROCESS  0x20
 
+//
+// How long a notification IRP is held after a change, so that further
+// changes can be returned with it (100ns units)
+//
+#define NOTIFY_COALESCE_WINDOW (20 * 1000 * 10)
+
 //
 // Internal structure for NOTIFY_SYNC
 //
@@ -69,6 +75,17 @@ typedef struct _REAL_NOTIFY_SYNC
     ULONG OwnerCount;
 } REAL_NOTIFY_SYNC, * PREAL_NOTIFY_SYNC;
 
+//
+// Internal structure for a delayed notification completion
+//
+typedef struct _NOTIFY_COALESCE
+{
+    KTIMER Timer;
+    KDPC Dpc;
+    WORK_QUEUE_ITEM WorkItem;
+    struct _NOTIFY_CHANGE *NotifyChange;
+} NOTIFY_COALESCE, *PNOTIFY_COALESCE;
+
 //
 // Internal structure for notifications
 //
@@ -94,6 +111,7 @@ typedef struct _NOTIFY_CHANGE
     ULONG LastEntry;
     ULONG ReferenceCount;
     PEPROCESS OwningProcess;
+    PNOTIFY_COALESCE Coalesce;
 } NOTIFY_CHANGE, *PNOTIFY_CHANGE;
 
 //
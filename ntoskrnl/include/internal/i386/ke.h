@@ -438,6 +438,8 @@ KiInitializePAT(
     VOID
 );
 
+extern BOOLEAN KiPatInitialized;
+
 VOID
 NTAPI
 KiInitializeMTRR(
@@ -96,7 +96,16 @@
 #define MI_MAKE_ACCESSED_PAGE(x)   ((x)->u.Hard.Accessed = 1)
 #define MI_PAGE_DISABLE_CACHE(x)   ((x)->u.Hard.CacheDisable = 1)
 #define MI_PAGE_WRITE_THROUGH(x)   ((x)->u.Hard.WriteThrough = 1)
-#define MI_PAGE_WRITE_COMBINED(x)  ((x)->u.Hard.WriteThrough = 0)
+/* With the PAT programmed, PWT alone selects write combining (PAT entry 1) */
+#define MI_PAGE_WRITE_COMBINED(x)  \
+    do { \
+        if (KiPatInitialized) \
+        { \
+            (x)->u.Hard.CacheDisable = 0; \
+            (x)->u.Hard.WriteThrough = 1; \
+        } \
+        else (x)->u.Hard.WriteThrough = 0; \
+    } while (0)
 #define MI_IS_PAGE_LARGE(x)        ((x)->u.Hard.LargePage == 1)
 #if !defined(CONFIG_SMP)
 #define MI_IS_PAGE_WRITEABLE(x)    ((x)->u.Hard.Write == 1)
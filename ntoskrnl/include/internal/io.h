@@ -92,6 +92,11 @@
 #define IOP_USE_TOP_LEVEL_DEVICE_HINT       0x01
 #define IOP_CREATE_FILE_OBJECT_EXTENSION    0x02
 
+//
+// Private device object extension flag, the boot timeline saw I/O to the device
+//
+#define DOE_BOOT_TRACE_SEEN                 0x80000000
+
 
 typedef struct _FILE_OBJECT_EXTENSION
 {
@@ -988,6 +993,30 @@ IopBootLog(
     IN BOOLEAN Success
 );
 
+VOID
+IopBootTrace(
+    IN UCHAR Type,
+    IN ULONGLONG StartTime,
+    IN ULONG Data,
+    IN PCUNICODE_STRING Name
+);
+
+VOID
+IopBootTraceFirstIo(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN UCHAR MajorFunction
+);
+
+VOID
+IopBootTracePhase(
+    IN ULONG Phase
+);
+
+VOID
+IopInitBootTraceTimes(
+    IN PLOADER_PARAMETER_BLOCK LoaderBlock
+);
+
 VOID
 IopSaveBootLogToFile(
     VOID
@@ -1341,6 +1370,10 @@ extern PIO_BUS_TYPE_GUID_LIST PnpBusTypeGuidList;
 extern PDRIVER_OBJECT IopRootDriverObject;
 extern KSPIN_LOCK IopDeviceActionLock;
 extern LIST_ENTRY IopDeviceActionRequestList;
+extern ERESOURCE PpResourceAssignmentLock;
+extern BOOLEAN IopBootTraceEnabled;
+extern ULONG PnpBootStartThreads;
+extern BOOLEAN PnpBootTrace;
 extern RESERVE_IRP_ALLOCATOR IopReserveIrpAllocator;
 
 //
@@ -52,8 +52,8 @@ UCHAR IopQueryOperationLength[] =
     0,
     0,
     0,
+    0,
 #if 0 // VISTA
-    sizeof(FILE_IO_COMPLETION_NOTIFICATION_INFORMATION),
     sizeof(FILE_IOSTATUSBLOCK_RANGE_INFORMATION),
     sizeof(FILE_IO_PRIORITY_HINT_INFORMATION),
     sizeof(FILE_SFIO_RESERVE_INFORMATION),
@@ -109,6 +109,7 @@ UCHAR IopSetOperationLength[] =
     0,
     sizeof(FILE_VALID_DATA_LENGTH_INFORMATION),
     sizeof(UNICODE_STRING),
+    sizeof(FILE_IO_COMPLETION_NOTIFICATION_INFORMATION),
     0xFF
 };
 
@@ -155,6 +156,7 @@ ACCESS_MASK IopQueryOperationAccess[] =
     0,
     0,
     0,
+    0,
     0xFFFFFFFF
 };
 
@@ -201,6 +203,7 @@ ACCESS_MASK IopSetOperationAccess[] =
     0,
     FILE_WRITE_DATA,
     DELETE,
+    0,
     0xFFFFFFFF
 };
 
@@ -55,6 +55,10 @@ VOID
 KdbSymProcessSymbols(
     IN PLDR_DATA_TABLE_ENTRY LdrEntry);
 
+VOID
+KdbSymUnloadSymbols(
+    IN PVOID BaseOfDll);
+
 
 BOOLEAN
 KdbSymPrintAddress(
@@ -108,7 +108,8 @@ extern ULONG KiMaximumDpcQueueDepth;
 extern ULONG KiMinimumDpcRate;
 extern ULONG KiAdjustDpcThreshold;
 extern ULONG KiIdealDpcRate;
-extern BOOLEAN KeThreadDpcEnable;
+extern ULONG KeThreadDpcEnable;
+extern ULONG KiDpcTimingEnabled;
 extern LARGE_INTEGER KiTimeIncrementReciprocal;
 extern UCHAR KiTimeIncrementShiftCount;
 extern ULONG KiTimeLimitIsrMicroseconds;
@@ -117,6 +118,7 @@ extern LIST_ENTRY KeBugcheckCallbackListHead, KeBugcheckReasonCallbackListHead;
 extern KSPIN_LOCK BugCheckCallbackLock;
 extern KDPC KiTimerExpireDpc;
 extern KTIMER_TABLE_ENTRY KiTimerTableListHead[TIMER_TABLE_SIZE];
+extern KTIMER_TABLE_ENTRY KiTimerFarTableListHead[TIMER_TABLE_SIZE];
 extern FAST_MUTEX KiGenericCallDpcMutex;
 extern LIST_ENTRY KiProfileListHead, KiProfileSourceListHead;
 extern KSPIN_LOCK KiProfileLock;
@@ -127,6 +129,11 @@ extern KEVENT KiSwapEvent;
 extern PKPRCB KiProcessorBlock[];
 extern ULONG KiMask32Array[MAXIMUM_PRIORITY];
 extern ULONG_PTR KiIdleSummary;
+extern BOOLEAN KiSpinLockProfileEnabled;
+extern ULONG KiSpinLockProfileAtBoot;
+extern ULONG KiSchedTraceEnabled;
+extern ULONG KiSchedTraceAtBoot;
+extern ULONG KiStackProfileEnabled;
 extern PVOID KeUserApcDispatcher;
 extern PVOID KeUserCallbackDispatcher;
 extern PVOID KeUserExceptionDispatcher;
@@ -135,6 +142,8 @@ extern ULONG KeTimeIncrement;
 extern ULONG KeTimeAdjustment;
 extern BOOLEAN KiTimeAdjustmentEnabled;
 extern LONG KiTickOffset;
+extern ULONG KiDynamicTickEnabled;
+extern LONG KiDynamicTickActive;
 extern ULONG_PTR KiBugCheckData[5];
 extern ULONG KiFreezeFlag;
 extern ULONG KiDPCTimeout;
@@ -272,6 +281,13 @@ KiInsertTimerTable(
     IN ULONG Hand
 );
 
+VOID
+FASTCALL
+KiCascadeTimerTable(
+    IN ULONG Hand,
+    IN ULONGLONG InterruptTime
+);
+
 VOID
 FASTCALL
 KiTimerListExpire(
@@ -357,6 +373,12 @@ KiIpiSignalPacketDoneAndStall(
     IN volatile PULONG ReverseStall
 );
 
+VOID
+FASTCALL
+KiIpiStallOnPacketTargets(
+    VOID
+);
+
 /* next file ***************************************************************/
 
 UCHAR
@@ -411,6 +433,16 @@ KeUpdateRunTime(
     KIRQL Irql
 );
 
+VOID
+FASTCALL
+KiEnterDynamicTick(
+    IN PKPRCB Prcb
+);
+
+VOID
+FASTCALL
+KiExitDynamicTick(VOID);
+
 VOID
 NTAPI
 KiExpireTimers(
@@ -701,6 +733,17 @@ BOOLEAN
 NTAPI
 KeRemoveQueueApc(PKAPC Apc);
 
+ULONG
+NTAPI
+KeRemoveQueueEx(
+    IN PKQUEUE Queue,
+    IN KPROCESSOR_MODE WaitMode,
+    IN BOOLEAN Alertable,
+    IN PLARGE_INTEGER Timeout OPTIONAL,
+    OUT PLIST_ENTRY *EntryArray,
+    IN ULONG Count
+);
+
 VOID
 FASTCALL
 KiActivateWaiterQueue(IN PKQUEUE Queue);
@@ -716,6 +759,14 @@ BOOLEAN
 NTAPI
 KeInitSystem(VOID);
 
+VOID
+NTAPI
+KiInitializeDpcTiming(VOID);
+
+VOID
+NTAPI
+KiStartDpcThreads(VOID);
+
 VOID
 NTAPI
 KeInitExceptions(VOID);
@@ -790,6 +841,14 @@ VOID
 NTAPI
 KeFlushCurrentTb(VOID);
 
+VOID
+NTAPI
+KeFlushMultipleTb(
+    IN ULONG Number,
+    IN PVOID *VirtualAddresses,
+    IN BOOLEAN AllProcessors
+);
+
 BOOLEAN
 NTAPI
 KeInvalidateAllCaches(VOID);
@@ -972,6 +1031,79 @@ KeReleaseQueuedSpinLockFromDpcLevel(
     IN OUT PKSPIN_LOCK_QUEUE LockQueue
 );
 
+VOID
+FASTCALL
+KiSpinLockProfileAcquire(
+    IN PKSPIN_LOCK SpinLock,
+    IN PVOID Caller
+);
+
+VOID
+FASTCALL
+KiSpinLockProfileRelease(
+    IN PKSPIN_LOCK SpinLock
+);
+
+VOID
+FASTCALL
+KiSpinLockProfileAcquired(
+    IN PKSPIN_LOCK SpinLock,
+    IN PVOID Caller,
+    IN ULONG Spins
+);
+
+NTSTATUS
+NTAPI
+KeSetSpinLockProfile(
+    IN BOOLEAN Enable
+);
+
+NTSTATUS
+NTAPI
+KeQuerySpinLockProfile(
+    OUT PSYSDBG_SPINLOCK_PROFILE_ENTRY Buffer,
+    IN ULONG BufferLength,
+    OUT PULONG ReturnLength
+);
+
+VOID
+FASTCALL
+KiSchedTraceRecord(
+    IN UCHAR Type,
+    IN PKTHREAD OldThread,
+    IN PKTHREAD NewThread,
+    IN ULONG TargetProcessor
+);
+
+NTSTATUS
+NTAPI
+KeSetSchedTrace(
+    IN BOOLEAN Enable
+);
+
+NTSTATUS
+NTAPI
+KeQuerySchedTrace(
+    OUT PSYSDBG_SCHED_TRACE_ENTRY Buffer,
+    IN ULONG BufferLength,
+    OUT PULONG ReturnLength
+);
+
+NTSTATUS
+NTAPI
+KeSetStackProfile(
+    IN BOOLEAN Enable,
+    IN ULONG Interval
+);
+
+NTSTATUS
+NTAPI
+KeQueryStackProfile(
+    OUT PSYSDBG_STACK_PROFILE_ENTRY Buffer,
+    IN ULONG BufferLength,
+    OUT PULONG ReturnLength
+);
+
 VOID
 NTAPI
 KiRestoreProcessorControlState(
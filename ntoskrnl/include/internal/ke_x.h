@@ -875,6 +875,25 @@ KiComputeTimerTableIndex(IN ULONGLONG DueTime)
     return (DueTime / KeMaximumIncrement) & (TIMER_TABLE_SIZE - 1);
 }
 
+//
+// Called when one of the timer lists of a hand went empty. The time of the
+// table entry is the earliest due time of either list, so that the clock
+// interrupt also notices when far timers need to be moved to the near list.
+//
+FORCEINLINE
+VOID
+KiUpdateTimerTableEntry(IN ULONG Hand)
+{
+    PKTIMER_TABLE_ENTRY TableEntry = &KiTimerTableListHead[Hand];
+    PKTIMER_TABLE_ENTRY FarEntry = &KiTimerFarTableListHead[Hand];
+
+    /* Set the far entry to an infinite absolute time if it's empty */
+    if (IsListEmpty(&FarEntry->Entry)) FarEntry->Time.HighPart = 0xFFFFFFFF;
+
+    /* Without near timers, the next one to look at is the earliest far one */
+    if (IsListEmpty(&TableEntry->Entry)) TableEntry->Time = FarEntry->Time;
+}
+
 //
 // Called from KiCompleteTimer, KiInsertTreeTimer, KeSetSystemTime
 // to remove timer entries
@@ -883,20 +902,11 @@ FORCEINLINE
 VOID
 KiRemoveEntryTimer(IN PKTIMER Timer)
 {
-    ULONG Hand;
-    PKTIMER_TABLE_ENTRY TableEntry;
-
     /* Remove the timer from the timer list and check if it's empty */
-    Hand = Timer->Header.Hand;
     if (RemoveEntryList(&Timer->TimerListEntry))
     {
-        /* Get the respective timer table entry */
-        TableEntry = &KiTimerTableListHead[Hand];
-        if (&TableEntry->Entry == TableEntry->Entry.Flink)
-        {
-            /* Set the entry to an infinite absolute time */
-            TableEntry->Time.HighPart = 0xFFFFFFFF;
-        }
+        /* Update the respective timer table entry */
+        KiUpdateTimerTableEntry(Timer->Header.Hand);
     }
 
     /* Clear the list entries on dbg builds so we can tell the timer is gone */
@@ -996,7 +1006,6 @@ KxRemoveTreeTimer(IN PKTIMER Timer)
 {
     ULONG Hand = Timer->Header.Hand;
     PKSPIN_LOCK_QUEUE LockQueue;
-    PKTIMER_TABLE_ENTRY TimerEntry;
 
     /* Acquire timer lock */
     LockQueue = KiAcquireTimerLock(Hand);
@@ -1004,17 +1013,8 @@ KxRemoveTreeTimer(IN PKTIMER Timer)
     /* Set the timer as non-inserted */
     Timer->Header.Inserted = FALSE;
 
-    /* Remove it from the timer list */
-    if (RemoveEntryList(&Timer->TimerListEntry))
-    {
-        /* Get the entry and check if it's empty */
-        TimerEntry = &KiTimerTableListHead[Hand];
-        if (IsListEmpty(&TimerEntry->Entry))
-        {
-            /* Clear the time then */
-            TimerEntry->Time.HighPart = 0xFFFFFFFF;
-        }
-    }
+    /* Remove it from the timer list, and update the entry if it's empty */
+    if (RemoveEntryList(&Timer->TimerListEntry)) KiUpdateTimerTableEntry(Hand);
 
     /* Release the timer lock */
     KiReleaseTimerLock(LockQueue);
@@ -1677,6 +1677,33 @@ KiReleaseNmiListLock(IN KIRQL OldIrql)
     KeReleaseSpinLock(&KiNmiCallbackListLock, OldIrql);
 }
 
+//
+// Scheduler trace hooks. When tracing is off, all they cost is the test
+//
+FORCEINLINE
+VOID
+KiSchedTraceContextSwitch(IN PKTHREAD OldThread,
+                          IN PKTHREAD NewThread)
+{
+    if (KiSchedTraceEnabled)
+        KiSchedTraceRecord(SYSDBG_SCHED_TRACE_SWITCH,
+                           OldThread,
+                           NewThread,
+                           KeGetCurrentProcessorNumber());
+}
+
+FORCEINLINE
+VOID
+KiSchedTraceReadyThread(IN PKTHREAD Thread,
+                        IN ULONG Processor)
+{
+    if (KiSchedTraceEnabled)
+        KiSchedTraceRecord(SYSDBG_SCHED_TRACE_READY,
+                           KeGetCurrentThread(),
+                           Thread,
+                           Processor);
+}
+
 #if defined(_M_IX86) || defined(_M_AMD64)
 FORCEINLINE
 VOID
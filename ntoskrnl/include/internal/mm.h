@@ -149,6 +149,11 @@ typedef ULONG_PTR SWAPENTRY;
 //
 #define MM_WAIT_ENTRY            0x7ffffc00
 
+//
+// Largest number of extra pages a single paging read may bring in
+//
+#define MM_MAXIMUM_READ_CLUSTER_SIZE    15
+
 #define InterlockedCompareExchangePte(PointerPte, Exchange, Comperand) \
     InterlockedCompareExchange((PLONG)(PointerPte), Exchange, Comperand)
 
@@ -596,6 +601,40 @@ MmInitSystem(IN ULONG Phase,
              IN PLOADER_PARAMETER_BLOCK LoaderBlock);
 
 
+/* compstore.c ***************************************************************/
+
+extern ULONG MmCompressedStoreMaximumPercent;
+
+VOID
+NTAPI
+MiInitializeCompressedStore(VOID);
+
+BOOLEAN
+NTAPI
+MiCompressedStoreWrite(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset,
+    _In_ PFN_NUMBER Page);
+
+BOOLEAN
+NTAPI
+MiCompressedStoreRead(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset,
+    _In_ PFN_NUMBER Page);
+
+BOOLEAN
+NTAPI
+MiCompressedStoreContains(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset);
+
+VOID
+NTAPI
+MiCompressedStoreFree(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset);
+
 /* pagefile.c ****************************************************************/
 
 SWAPENTRY
@@ -639,6 +678,14 @@ MiReadPageFile(
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset);
 
+NTSTATUS
+NTAPI
+MiReadPageFileCluster(
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ PFN_COUNT PageCount,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset);
+
 /* process.c ****************************************************************/
 
 NTSTATUS
@@ -811,6 +858,10 @@ VOID
 NTAPI
 MmRebalanceMemoryConsumers(VOID);
 
+VOID
+NTAPI
+MiNoteUserPageRefault(struct _EPROCESS *Process);
+
 /* rmap.c **************************************************************/
 
 VOID
@@ -864,6 +915,10 @@ BOOLEAN
 NTAPI
 MmIsDirtyPageRmap(PFN_NUMBER Page);
 
+BOOLEAN
+NTAPI
+MmTestAndClearAccessedPageRmap(PFN_NUMBER Page);
+
 NTSTATUS
 NTAPI
 MmPageOutPhysicalAddress(PFN_NUMBER Page);
@@ -947,6 +1002,10 @@ PFN_NUMBER
 NTAPI
 MmGetLRUFirstUserPage(VOID);
 
+UCHAR
+NTAPI
+MmAgeUserPage(PFN_NUMBER Page, BOOLEAN Accessed);
+
 VOID
 NTAPI
 MmInsertLRULastUserPage(PFN_NUMBER Page);
@@ -1197,6 +1256,13 @@ MmIsDirtyPage(
     PVOID Address
 );
 
+BOOLEAN
+NTAPI
+MmTestAndClearAccessedPage(
+    struct _EPROCESS *Process,
+    PVOID Address
+);
+
 /* wset.c ********************************************************************/
 
 NTSTATUS
@@ -88,6 +88,7 @@
 #include "vdm.h"
 #include "hal.h"
 #include "hdl.h"
+#include "wmi.h"
 #include "arch/intrin_i.h"
 
 /*
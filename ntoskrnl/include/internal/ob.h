@@ -115,6 +115,25 @@ typedef struct _OBP_FIND_HANDLE_DATA
     POBJECT_HANDLE_INFORMATION HandleInformation;
 } OBP_FIND_HANDLE_DATA, *POBP_FIND_HANDLE_DATA;
 
+//
+// Kernel private part of an object directory, allocated right behind the
+// public OBJECT_DIRECTORY. Small directories use the built-in hash buckets.
+// Once a directory holds enough entries it gets a larger power-of-two hash
+// table, which is only replaced while the directory is locked exclusively.
+// LastLookup remembers the entry found by the last successful lookup, so that
+// repeated opens of the same name skip the bucket walk.
+//
+typedef struct _OBP_DIRECTORY
+{
+    OBJECT_DIRECTORY Directory;
+    ULONG EntryCount;
+    ULONG HashShift;
+    POBJECT_DIRECTORY_ENTRY *HashTable;
+    POBJECT_DIRECTORY_ENTRY LastLookup;
+} OBP_DIRECTORY, *POBP_DIRECTORY;
+
+#define OBP_GET_DIRECTORY(d)    CONTAINING_RECORD((d), OBP_DIRECTORY, Directory)
+
 //
 // Cached Security Descriptor Header
 //
@@ -127,9 +146,10 @@ typedef struct _SECURITY_DESCRIPTOR_HEADER
 } SECURITY_DESCRIPTOR_HEADER, *PSECURITY_DESCRIPTOR_HEADER;
 
 //
-// Cached Security Descriptor List
+// Cached Security Descriptor List. Each list has a cache line of its own, so
+// that busy lists don't slow down their neighbours.
 //
-typedef struct _OB_SD_CACHE_LIST
+typedef struct DECLSPEC_CACHEALIGN _OB_SD_CACHE_LIST
 {
     EX_PUSH_LOCK PushLock;
     LIST_ENTRY Head;
@@ -174,6 +194,12 @@ ObShutdownSystem(
 //
 // Directory Namespace Functions
 //
+VOID
+NTAPI
+ObpDeleteDirectory(
+    IN PVOID ObjectBody
+);
+
 BOOLEAN
 NTAPI
 ObpDeleteEntryDirectory(
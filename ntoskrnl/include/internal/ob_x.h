@@ -17,6 +17,31 @@
 
 #define OBP_NAME_LOOKASIDE_MAX_SIZE 248
 
+//
+// Handle and object statistics are charged to the process of the current
+// thread, even while it is attached to another one, since that is the one
+// doing the work. They are plain increments: a few counts may get lost when
+// threads of a process race, but the handle paths don't pay for interlocks.
+//
+#define ObpUpdateHandleStatistics(Field)                                    \
+{                                                                           \
+    PEPROCESS _Process = PsGetCurrentThread()->ThreadsProcess;              \
+    if (_Process) _Process->HandleStatistics.Field++;                       \
+}
+
+FORCEINLINE
+VOID
+ObpUpdateObjectStatistics(IN POBJECT_TYPE ObjectType)
+{
+    PEPROCESS Process = PsGetCurrentThread()->ThreadsProcess;
+
+    if ((Process) &&
+        ((ULONG)ObjectType->Index - 1 < PROCESS_HANDLE_STATISTICS_TYPES))
+    {
+        Process->HandleStatistics.ObjectCreates[ObjectType->Index - 1]++;
+    }
+}
+
 FORCEINLINE
 ULONG
 ObpValidateAttributes(IN ULONG Attributes,
@@ -3,6 +3,7 @@
 /* Cache Manager Tags */
 #define TAG_CC                  '  cC'
 #define TAG_VACB                'aVcC'
+#define TAG_VACB_INDEX          'iVcC'
 #define TAG_SHARED_CACHE_MAP    'cScC'
 #define TAG_PRIVATE_CACHE_MAP   'cPcC'
 #define TAG_BCB                 'cBcC'
@@ -26,6 +27,9 @@
 #define TAG_INIT 'tinI'
 #define TAG_RTLI 'iltR'
 
+/* Executive worker queues */
+#define TAG_WORKER_NODE 'NkrW'
+
 /* formerly located in fs/notify.c */
 #define FSRTL_NOTIFY_TAG 'ITON'
 
@@ -116,6 +120,9 @@
 /* formerly located in mm/aspace.c */
 #define TAG_PTRC      'CRTP'
 
+/* formerly located in mm/compstore.c */
+#define TAG_MM_CSTORE   'SCmM'
+
 /* formerly located in mm/marea.c */
 #define TAG_MAREA   'ERAM'
 #define TAG_MVAD    'VADM'
@@ -156,6 +163,15 @@
 #define TAG_CIDOBJECT 'ODIC'
 #define TAG_PS_IMPERSONATION    'mIsP'
 
+/* Kernel spinlock profiler */
+#define TAG_SPINLOCK_PROFILE    'PSeK'
+#define TAG_DPC_TIMING          'TDeK'
+#define TAG_SCHED_TRACE         'TSeK'
+#define TAG_STACK_PROFILE       'PSkK'
+
+/* WMI kernel logger */
+#define TAG_WMI_TRACE           'TimW'
+
 /* formerly located in ps/job.c */
 #define TAG_EJOB 'BOJE' /* EJOB */
 
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <evntrace.h>
+
+//
+// Kernel logger hooks. When the kernel logger is off or does not trace the
+// group, all they cost is the test of WmipKernelLoggerFlags.
+//
+extern volatile ULONG WmipKernelLoggerFlags;
+
+VOID
+NTAPI
+WmipTraceProcess(
+    IN PEPROCESS Process,
+    IN UCHAR Type
+);
+
+VOID
+NTAPI
+WmipTraceThread(
+    IN PETHREAD Thread,
+    IN PINITIAL_TEB InitialTeb OPTIONAL,
+    IN UCHAR Type
+);
+
+VOID
+FASTCALL
+WmipTraceContextSwitch(
+    IN PKTHREAD OldThread,
+    IN PKTHREAD NewThread
+);
+
+VOID
+NTAPI
+WmipTracePageFault(
+    IN ULONG FaultCode,
+    IN PVOID Address,
+    IN PVOID TrapInformation OPTIONAL
+);
+
+VOID
+FASTCALL
+WmipTraceDiskIo(
+    IN PIRP Irp,
+    IN BOOLEAN Completion
+);
+
+VOID
+NTAPI
+WmipTraceFileIo(
+    IN UCHAR Type,
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER ByteOffset,
+    IN ULONG Length
+);
+
+VOID
+NTAPI
+WmipTraceFileCreate(
+    IN PFILE_OBJECT FileObject
+);
+
+FORCEINLINE
+VOID
+WmiTraceProcess(IN PEPROCESS Process,
+                IN BOOLEAN Create)
+{
+    if (WmipKernelLoggerFlags & EVENT_TRACE_FLAG_PROCESS)
+        WmipTraceProcess(Process, Create ? EVENT_TRACE_TYPE_START : EVENT_TRACE_TYPE_END);
+}
+
+FORCEINLINE
+VOID
+WmiTraceThread(IN PETHREAD Thread,
+               IN PINITIAL_TEB InitialTeb OPTIONAL,
+               IN BOOLEAN Create)
+{
+    if (WmipKernelLoggerFlags & EVENT_TRACE_FLAG_THREAD)
+        WmipTraceThread(Thread, InitialTeb, Create ? EVENT_TRACE_TYPE_START : EVENT_TRACE_TYPE_END);
+}
+
+FORCEINLINE
+VOID
+WmiTraceContextSwitch(IN PKTHREAD OldThread,
+                      IN PKTHREAD NewThread)
+{
+    if (WmipKernelLoggerFlags & EVENT_TRACE_FLAG_CSWITCH)
+        WmipTraceContextSwitch(OldThread, NewThread);
+}
+
+FORCEINLINE
+VOID
+WmiTracePageFault(IN ULONG FaultCode,
+                  IN PVOID Address,
+                  IN PVOID TrapInformation OPTIONAL)
+{
+    if (WmipKernelLoggerFlags & EVENT_TRACE_FLAG_MEMORY_PAGE_FAULTS)
+        WmipTracePageFault(FaultCode, Address, TrapInformation);
+}
+
+FORCEINLINE
+VOID
+WmiTraceDiskIoStart(IN PIRP Irp)
+{
+    if (WmipKernelLoggerFlags & EVENT_TRACE_FLAG_DISK_IO_INIT)
+        WmipTraceDiskIo(Irp, FALSE);
+}
+
+FORCEINLINE
+VOID
+WmiTraceDiskIoComplete(IN PIRP Irp)
+{
+    if (WmipKernelLoggerFlags & EVENT_TRACE_FLAG_DISK_IO)
+        WmipTraceDiskIo(Irp, TRUE);
+}
+
+FORCEINLINE
+VOID
+WmiTraceFileIo(IN BOOLEAN Write,
+               IN PFILE_OBJECT FileObject,
+               IN PLARGE_INTEGER ByteOffset,
+               IN ULONG Length)
+{
+    if (WmipKernelLoggerFlags & EVENT_TRACE_FLAG_FILE_IO)
+        WmipTraceFileIo(Write ? EVENT_TRACE_TYPE_IO_WRITE : EVENT_TRACE_TYPE_IO_READ,
+                        FileObject,
+                        ByteOffset,
+                        Length);
+}
+
+FORCEINLINE
+VOID
+WmiTraceFileCreate(IN PFILE_OBJECT FileObject)
+{
+    if (WmipKernelLoggerFlags & EVENT_TRACE_FLAG_FILE_IO)
+        WmipTraceFileCreate(FileObject);
+}
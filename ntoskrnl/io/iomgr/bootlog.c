@@ -10,12 +10,14 @@
 /* INCLUDES *****************************************************************/
 
 #include <ntoskrnl.h>
+#include <boottrace.h>
 #define NDEBUG
 #include <debug.h>
 
 #if defined (ALLOC_PRAGMA)
 #pragma alloc_text(INIT, IopInitBootLog)
 #pragma alloc_text(INIT, IopStartBootLog)
+#pragma alloc_text(INIT, IopInitBootTraceTimes)
 #endif
 
 /* GLOBALS ******************************************************************/
@@ -26,6 +28,62 @@ static BOOLEAN IopLogFileEnabled = FALSE;
 static ULONG IopLogEntryCount = 0;
 static ERESOURCE IopBootLogResource;
 
+/*
+ * Boot timeline. Records are appended to a non paged buffer while booting.
+ * A first copy is written to \SystemRoot\rosboot.trc together with the
+ * text log, and the final one once the user shell is ready. See boottrace.h
+ * for the format.
+ */
+#define IOP_BOOT_TRACE_BUFFER_SIZE  (256 * 1024)
+
+BOOLEAN IopBootTraceEnabled = FALSE;
+static PUCHAR IopBootTraceBuffer;
+static ULONG IopBootTraceOffset;
+static ULONG IopBootTraceCount;
+static ULONG IopBootTraceDropped;
+static KSPIN_LOCK IopBootTraceLock;
+
+/*
+ * Timeline clock. Records are stamped with the interrupt time plus a bias
+ * which makes the time count from the start of the loader, when the loader
+ * passed its TSC readings. The TSC is converted once the CPU speed is known.
+ */
+static LOADER_PERFORMANCE_DATA IopLoaderPerformanceData;
+static ULONGLONG IopBootTraceKernelTsc;
+static ULONGLONG IopBootTraceKernelTime;
+static LONGLONG IopBootTraceTimeBias;
+
+/* Current boot phase, phases are reported in PF_BOOT_PHASE_ID order */
+static ULONG IopBootTracePhaseId = PfKernelInitPhase;
+static ULONGLONG IopBootTracePhaseStart;
+
+typedef struct _IOP_BOOT_PHASE_NAME
+{
+    ULONG Phase;
+    PCWSTR Name;
+} IOP_BOOT_PHASE_NAME;
+
+/* Each name describes the work from the start of its phase to the next one */
+static const IOP_BOOT_PHASE_NAME IopBootPhaseNames[] =
+{
+    { PfKernelInitPhase, L"Kernel" },
+    { PfBootDriverInitPhase, L"BootDrivers" },
+    { PfSystemDriverInitPhase, L"SystemDrivers" },
+    { PfSessionManagerInitPhase, L"SessionManager" },
+    { PfSMRegistryInitPhase, L"Subsystems" },
+    { PfVideoInitPhase, L"Winlogon" },
+    { PfPostVideoInitPhase, L"Services" },
+    { PfBootAcceptedRegistryInitPhase, L"Logon" },
+};
+
+static
+VOID
+IopBootTraceAppend(IN UCHAR Type,
+                   IN ULONGLONG StartTime,
+                   IN ULONGLONG Duration,
+                   IN ULONG Data,
+                   IN PCUNICODE_STRING Name);
+
 
 /* FUNCTIONS ****************************************************************/
 
@@ -34,6 +92,7 @@ INIT_FUNCTION
 IopInitBootLog(BOOLEAN StartBootLog)
 {
     ExInitializeResourceLite(&IopBootLogResource);
+    KeInitializeSpinLock(&IopBootTraceLock);
     if (StartBootLog) IopStartBootLog();
 }
 
@@ -44,6 +103,68 @@ IopStartBootLog(VOID)
 {
     IopBootLogCreate = TRUE;
     IopBootLogEnabled = TRUE;
+
+    /* The timeline is best effort, boot logging works without it */
+    IopBootTraceBuffer = ExAllocatePoolWithTag(NonPagedPool,
+                                               IOP_BOOT_TRACE_BUFFER_SIZE,
+                                               TAG_IO);
+    if (IopBootTraceBuffer == NULL)
+        return;
+
+    /* The TSC is calibrated by now, put the loader on the timeline */
+#if defined(_M_IX86) || defined(_M_AMD64)
+    if (IopLoaderPerformanceData.StartTime != 0 &&
+        IopLoaderPerformanceData.EndTime > IopLoaderPerformanceData.StartTime &&
+        IopBootTraceKernelTsc > IopLoaderPerformanceData.EndTime &&
+        KeGetCurrentPrcb()->MHz != 0)
+    {
+        UNICODE_STRING LoaderName = RTL_CONSTANT_STRING(L"Loader");
+        ULONG MHz = KeGetCurrentPrcb()->MHz;
+        ULONGLONG LoaderTime, KernelStart;
+
+        /* TSC ticks divided by MHz are microseconds, timeline units are 100ns */
+        LoaderTime = (IopLoaderPerformanceData.EndTime -
+                      IopLoaderPerformanceData.StartTime) * 10 / MHz;
+        KernelStart = (IopBootTraceKernelTsc -
+                       IopLoaderPerformanceData.StartTime) * 10 / MHz;
+        IopBootTraceTimeBias = (LONGLONG)KernelStart - (LONGLONG)IopBootTraceKernelTime;
+
+        IopBootTraceEnabled = TRUE;
+        IopBootTraceAppend(BOOT_TRACE_PHASE,
+                           0,
+                           LoaderTime,
+                           BOOT_TRACE_LOADER_PHASE,
+                           &LoaderName);
+    }
+#endif
+
+    IopBootTracePhaseStart = IopBootTraceKernelTime;
+    IopBootTraceEnabled = TRUE;
+}
+
+
+/*
+ * Remember when the kernel started and the loader's TSC readings, the loader
+ * block is gone by the time the boot log is started.
+ */
+VOID
+INIT_FUNCTION
+IopInitBootTraceTimes(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
+{
+    PLOADER_PARAMETER_EXTENSION Extension = LoaderBlock->Extension;
+
+    IopBootTraceKernelTime = KeQueryInterruptTime();
+#if defined(_M_IX86) || defined(_M_AMD64)
+    IopBootTraceKernelTsc = __rdtsc();
+#endif
+
+    if ((Extension != NULL) &&
+        (Extension->Size >= RTL_SIZEOF_THROUGH_FIELD(LOADER_PARAMETER_EXTENSION,
+                                                     LoaderPerformanceData)) &&
+        (Extension->LoaderPerformanceData != NULL))
+    {
+        IopLoaderPerformanceData = *Extension->LoaderPerformanceData;
+    }
 }
 
 
@@ -51,6 +172,276 @@ VOID
 IopStopBootLog(VOID)
 {
     IopBootLogEnabled = FALSE;
+    IopBootTraceEnabled = FALSE;
+}
+
+
+/*
+ * Append a record to the boot timeline. StartTime is already in timeline time.
+ */
+static
+VOID
+IopBootTraceAppend(IN UCHAR Type,
+                   IN ULONGLONG StartTime,
+                   IN ULONGLONG Duration,
+                   IN ULONG Data,
+                   IN PCUNICODE_STRING Name)
+{
+    PBOOT_TRACE_RECORD Record;
+    USHORT NameLength;
+    ULONG Size;
+    KIRQL OldIrql;
+
+    /* Keep the tail of long names, it's the part telling devices apart */
+    NameLength = (Name != NULL) ? Name->Length : 0;
+    if (NameLength > BOOT_TRACE_MAX_NAME) NameLength = BOOT_TRACE_MAX_NAME;
+    Size = ALIGN_UP_BY(FIELD_OFFSET(BOOT_TRACE_RECORD, Name) + NameLength, sizeof(ULONG));
+
+    /* Reserve room for the record */
+    KeAcquireSpinLock(&IopBootTraceLock, &OldIrql);
+    if (IopBootTraceOffset + Size > IOP_BOOT_TRACE_BUFFER_SIZE)
+    {
+        IopBootTraceDropped++;
+        KeReleaseSpinLock(&IopBootTraceLock, OldIrql);
+        return;
+    }
+    Record = (PBOOT_TRACE_RECORD)(IopBootTraceBuffer + IopBootTraceOffset);
+    IopBootTraceOffset += Size;
+    IopBootTraceCount++;
+    KeReleaseSpinLock(&IopBootTraceLock, OldIrql);
+
+    /* And fill it outside of the lock */
+    RtlZeroMemory(Record, Size);
+    Record->Size = (USHORT)Size;
+    Record->Type = Type;
+    Record->Data = Data;
+    Record->StartTime = StartTime;
+    Record->Duration = (Duration > MAXULONG) ? MAXULONG : (ULONG)Duration;
+    Record->ThreadId = HandleToUlong(PsGetCurrentThreadId());
+    Record->NameLength = NameLength;
+    if (NameLength)
+    {
+        RtlCopyMemory(Record->Name,
+                      (PUCHAR)Name->Buffer + Name->Length - NameLength,
+                      NameLength);
+    }
+}
+
+
+/*
+ * Append a record to the boot timeline. The operation started at StartTime
+ * (interrupt time) and ends now. Must be called below DISPATCH_LEVEL since
+ * the name may be paged.
+ */
+VOID
+IopBootTrace(IN UCHAR Type,
+             IN ULONGLONG StartTime,
+             IN ULONG Data,
+             IN PCUNICODE_STRING Name)
+{
+    if (IopBootTraceEnabled == FALSE)
+        return;
+
+    ASSERT(KeGetCurrentIrql() < DISPATCH_LEVEL);
+
+    IopBootTraceAppend(Type,
+                       StartTime + IopBootTraceTimeBias,
+                       KeQueryInterruptTime() - StartTime,
+                       Data,
+                       Name);
+}
+
+
+/*
+ * Record the first request sent to a device that doesn't come from the PnP
+ * manager. The request is accounted to the bottom of the device stack, so
+ * it shows up under the instance path of the device.
+ */
+VOID
+IopBootTraceFirstIo(IN PDEVICE_OBJECT DeviceObject,
+                    IN UCHAR MajorFunction)
+{
+    PDEVICE_OBJECT BaseDevice;
+    PDEVICE_NODE DeviceNode;
+    PCUNICODE_STRING Name;
+    KIRQL OldIrql;
+
+    if ((MajorFunction == IRP_MJ_PNP) ||
+        (MajorFunction == IRP_MJ_POWER) ||
+        (KeGetCurrentIrql() >= DISPATCH_LEVEL))
+    {
+        return;
+    }
+
+    /* Only look at each device once */
+    if (InterlockedOr((PLONG)&IoGetDevObjExtension(DeviceObject)->ExtensionFlags,
+                      DOE_BOOT_TRACE_SEEN) & DOE_BOOT_TRACE_SEEN)
+    {
+        return;
+    }
+
+    OldIrql = KeAcquireQueuedSpinLock(LockQueueIoDatabaseLock);
+    BaseDevice = DeviceObject;
+    while (IoGetDevObjExtension(BaseDevice)->AttachedTo)
+    {
+        BaseDevice = IoGetDevObjExtension(BaseDevice)->AttachedTo;
+    }
+    ObReferenceObject(BaseDevice);
+    KeReleaseQueuedSpinLock(LockQueueIoDatabaseLock, OldIrql);
+
+    if ((BaseDevice == DeviceObject) ||
+        !(InterlockedOr((PLONG)&IoGetDevObjExtension(BaseDevice)->ExtensionFlags,
+                        DOE_BOOT_TRACE_SEEN) & DOE_BOOT_TRACE_SEEN))
+    {
+        DeviceNode = IoGetDevObjExtension(BaseDevice)->DeviceNode;
+        if ((DeviceNode != NULL) && (DeviceNode->InstancePath.Length != 0))
+            Name = &DeviceNode->InstancePath;
+        else
+            Name = &BaseDevice->DriverObject->DriverName;
+
+        IopBootTrace(BOOT_TRACE_FIRST_IO, KeQueryInterruptTime(), MajorFunction, Name);
+    }
+
+    ObDereferenceObject(BaseDevice);
+}
+
+
+static
+VOID
+IopSaveBootTraceToFile(IN BOOLEAN Final)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING FileName = RTL_CONSTANT_STRING(L"\\SystemRoot\\rosboot.trc");
+    IO_STATUS_BLOCK IoStatusBlock;
+    BOOT_TRACE_HEADER Header;
+    HANDLE FileHandle;
+    KIRQL OldIrql;
+    NTSTATUS Status;
+
+    if (IopBootTraceBuffer == NULL)
+        return;
+
+    /* Freeze the timeline for the final copy, late records are dropped */
+    if (Final)
+        IopBootTraceEnabled = FALSE;
+    KeAcquireSpinLock(&IopBootTraceLock, &OldIrql);
+    Header.Signature = BOOT_TRACE_SIGNATURE;
+    Header.Version = BOOT_TRACE_VERSION;
+    Header.HeaderSize = sizeof(Header);
+    Header.RecordCount = IopBootTraceCount;
+    Header.DataSize = IopBootTraceOffset;
+    Header.DroppedCount = IopBootTraceDropped;
+    Header.Reserved = 0;
+    KeReleaseSpinLock(&IopBootTraceLock, OldIrql);
+
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &FileName,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwCreateFile(&FileHandle,
+                          FILE_GENERIC_WRITE,
+                          &ObjectAttributes,
+                          &IoStatusBlock,
+                          NULL,
+                          0,
+                          0,
+                          FILE_SUPERSEDE,
+                          FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                          NULL,
+                          0);
+    if (NT_SUCCESS(Status))
+    {
+        Status = ZwWriteFile(FileHandle,
+                             NULL,
+                             NULL,
+                             NULL,
+                             &IoStatusBlock,
+                             &Header,
+                             sizeof(Header),
+                             NULL,
+                             NULL);
+        if (NT_SUCCESS(Status) && Header.DataSize)
+        {
+            Status = ZwWriteFile(FileHandle,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 &IoStatusBlock,
+                                 IopBootTraceBuffer,
+                                 Header.DataSize,
+                                 NULL,
+                                 NULL);
+        }
+        ZwClose(FileHandle);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed to write the boot timeline (Status %lx)\n", Status);
+    }
+    else
+    {
+        DPRINT1("Boot timeline: %lu records, %lu dropped\n",
+                Header.RecordCount, Header.DroppedCount);
+    }
+
+    if (Final)
+    {
+        ExFreePoolWithTag(IopBootTraceBuffer, TAG_IO);
+        IopBootTraceBuffer = NULL;
+    }
+}
+
+
+/*
+ * Called when the system enters a new boot phase. The phase that just ended
+ * is recorded with its duration. Once the user shell is ready the boot is
+ * over and the timeline is saved for good.
+ */
+VOID
+IopBootTracePhase(IN ULONG Phase)
+{
+    UNICODE_STRING PhaseName;
+    ULONGLONG Now, PhaseStart;
+    ULONG PreviousPhase, i;
+    KIRQL OldIrql;
+
+    if (IopBootTraceEnabled == FALSE)
+        return;
+
+    Now = KeQueryInterruptTime();
+
+    KeAcquireSpinLock(&IopBootTraceLock, &OldIrql);
+    if (Phase <= IopBootTracePhaseId)
+    {
+        KeReleaseSpinLock(&IopBootTraceLock, OldIrql);
+        return;
+    }
+    PreviousPhase = IopBootTracePhaseId;
+    PhaseStart = IopBootTracePhaseStart;
+    IopBootTracePhaseId = Phase;
+    IopBootTracePhaseStart = Now;
+    KeReleaseSpinLock(&IopBootTraceLock, OldIrql);
+
+    RtlInitEmptyUnicodeString(&PhaseName, NULL, 0);
+    for (i = 0; i < RTL_NUMBER_OF(IopBootPhaseNames); i++)
+    {
+        if (IopBootPhaseNames[i].Phase == PreviousPhase)
+        {
+            RtlInitUnicodeString(&PhaseName, IopBootPhaseNames[i].Name);
+            break;
+        }
+    }
+
+    IopBootTraceAppend(BOOT_TRACE_PHASE,
+                       PhaseStart + IopBootTraceTimeBias,
+                       Now - PhaseStart,
+                       PreviousPhase,
+                       &PhaseName);
+
+    if (Phase >= PfUserShellReadyPhase && KeGetCurrentIrql() == PASSIVE_LEVEL)
+        IopSaveBootTraceToFile(TRUE);
 }
 
 
@@ -239,8 +630,6 @@ IopCreateLogFile(VOID)
 
     DPRINT("IopSaveBootLogToFile() called\n");
 
-    ExAcquireResourceExclusiveLite(&IopBootLogResource, TRUE);
-
     RtlInitUnicodeString(&FileName,
                          L"\\SystemRoot\\rosboot.log");
     InitializeObjectAttributes(&ObjectAttributes,
@@ -308,6 +697,9 @@ IopSaveBootLogToFile(VOID)
 
     DPRINT("IopSaveBootLogToFile() called\n");
 
+    /* The timeline doesn't depend on the text log, the final copy is saved after logon */
+    IopSaveBootTraceToFile(FALSE);
+
     ExAcquireResourceExclusiveLite(&IopBootLogResource, TRUE);
 
     Status = IopCreateLogFile();
@@ -11,6 +11,7 @@
 /* INCLUDES *******************************************************************/
 
 #include <ntoskrnl.h>
+#include <boottrace.h>
 #define NDEBUG
 #include <debug.h>
 
@@ -314,6 +315,7 @@ IopLoadServiceModule(
     NTSTATUS Status;
     HANDLE CCSKey, ServiceKey;
     PVOID BaseAddress;
+    ULONGLONG StartTime;
 
     ASSERT(ExIsResourceAcquiredExclusiveLite(&IopDriverLoadResource));
     ASSERT(ServiceName->Length);
@@ -405,7 +407,9 @@ IopLoadServiceModule(
     else
     {
         DPRINT("Loading module from %wZ\n", &ServiceImagePath);
+        StartTime = KeQueryInterruptTime();
         Status = MmLoadSystemImage(&ServiceImagePath, NULL, NULL, 0, (PVOID)ModuleObject, &BaseAddress);
+        IopBootTrace(BOOT_TRACE_DRIVER_LOAD, StartTime, Status, ServiceName);
         if (NT_SUCCESS(Status))
         {
             IopDisplayLoadingMessage(ServiceName);
@@ -527,6 +531,9 @@ IopInitializeDriverModule(
     RtlFreeUnicodeString(&RegistryKey);
     RtlFreeUnicodeString(&DriverName);
 
+    if (ServiceName != NULL && ServiceName->Length != 0)
+        IopBootLog(ServiceName, NT_SUCCESS(Status));
+
     if (!NT_SUCCESS(Status))
     {
         DPRINT("IopCreateDriver() failed (Status 0x%08lx)\n", Status);
@@ -941,6 +948,8 @@ IopInitializeBootDrivers(VOID)
     PBOOT_DRIVER_LIST_ENTRY BootEntry;
     DPRINT("IopInitializeBootDrivers()\n");
 
+    IopBootTracePhase(PfBootDriverInitPhase);
+
     /* Use IopRootDeviceNode for now */
     Status = IopCreateDeviceNode(IopRootDeviceNode, NULL, NULL, &DeviceNode);
     if (!NT_SUCCESS(Status)) return;
@@ -1121,6 +1130,8 @@ IopInitializeSystemDrivers(VOID)
 {
     PUNICODE_STRING *DriverList, *SavedList;
 
+    IopBootTracePhase(PfSystemDriverInitPhase);
+
     /* No system drivers on the boot cd */
     if (KeLoaderBlock->SetupLdrBlock) return;
 
@@ -1433,6 +1444,7 @@ IopCreateDriver(IN PUNICODE_STRING DriverName OPTIONAL,
     PDRIVER_OBJECT DriverObject;
     UNICODE_STRING ServiceKeyName;
     HANDLE hDriver;
+    ULONGLONG StartTime;
     ULONG i, RetryCount = 0;
 
 try_again:
@@ -1578,7 +1590,9 @@ try_again:
     /* Finally, call its init function */
     DPRINT("RegistryKey: %wZ\n", RegistryPath);
     DPRINT("Calling driver entrypoint at %p\n", InitializationFunction);
+    StartTime = KeQueryInterruptTime();
     Status = (*InitializationFunction)(DriverObject, RegistryPath);
+    IopBootTrace(BOOT_TRACE_DRIVER_ENTRY, StartTime, Status, ServiceName);
     if (!NT_SUCCESS(Status))
     {
         /* If it didn't work, then kill the object */
@@ -1849,6 +1863,7 @@ IopLoadUnloadDriver(
     PDEVICE_NODE DeviceNode;
     PLDR_DATA_TABLE_ENTRY ModuleObject;
     PVOID BaseAddress;
+    ULONGLONG StartTime;
     WCHAR *cur;
 
     /* Load/Unload must be called from system process */
@@ -1960,7 +1975,9 @@ IopLoadUnloadDriver(
          * Load the driver module
          */
         DPRINT("Loading module from %wZ\n", &ImagePath);
+        StartTime = KeQueryInterruptTime();
         Status = MmLoadSystemImage(&ImagePath, NULL, NULL, 0, (PVOID)&ModuleObject, &BaseAddress);
+        IopBootTrace(BOOT_TRACE_DRIVER_LOAD, StartTime, Status, &ServiceName);
         if (!NT_SUCCESS(Status))
         {
             DPRINT("MmLoadSystemImage() failed (Status %lx)\n", Status);
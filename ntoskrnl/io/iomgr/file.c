@@ -2547,6 +2547,9 @@ IopCreateFile(OUT PHANDLE FileHandle,
         OpenPacket->FileObject->Flags |= FO_HANDLE_CREATED;
         ASSERT(OpenPacket->FileObject->Type == IO_TYPE_FILE);
 
+        /* Notify WMI */
+        WmiTraceFileCreate(OpenPacket->FileObject);
+
         /* Enter SEH for write back */
         _SEH2_TRY
         {
@@ -13,6 +13,7 @@
 
 #include <ntoskrnl.h>
 #include <ioevent.h>
+#include <reactos/rosioctl.h>
 #define NDEBUG
 #include <debug.h>
 #include "internal/io_i.h"
@@ -190,6 +191,43 @@ IopPerformSynchronousRequest(IN PDEVICE_OBJECT DeviceObject,
     return Status;
 }
 
+static
+NTSTATUS
+IopQueryCacheResidency(IN PFILE_OBJECT FileObject,
+                       OUT PVOID OutputBuffer,
+                       IN ULONG OutputBufferLength,
+                       OUT PULONG_PTR Information)
+{
+    FILE_CACHE_RESIDENCY_INFORMATION Residency;
+
+    *Information = 0;
+
+    /* Check the buffer */
+    if (OutputBufferLength < sizeof(Residency)) return STATUS_BUFFER_TOO_SMALL;
+
+    /* Ask the cache manager */
+    CcRosQueryCacheResidency(FileObject->SectionObjectPointer,
+                             &Residency.FileSize.QuadPart,
+                             &Residency.ResidentBytes.QuadPart,
+                             &Residency.DirtyBytes.QuadPart,
+                             &Residency.ViewCount);
+    Residency.ViewSize = VACB_MAPPING_GRANULARITY;
+
+    /* Copy it back, the buffer was probed if needed */
+    _SEH2_TRY
+    {
+        RtlCopyMemory(OutputBuffer, &Residency, sizeof(Residency));
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        _SEH2_YIELD(return _SEH2_GetExceptionCode());
+    }
+    _SEH2_END;
+
+    *Information = sizeof(Residency);
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 NTAPI
 IopDeviceFsIoControl(IN HANDLE DeviceHandle,
@@ -425,10 +463,13 @@ IopDeviceFsIoControl(IN HANDLE DeviceHandle,
                     CompletionInfo = *(FileObject->CompletionContext);
                 }
 
-                /* If we had an event, signal it */
+                /* If we had an event, signal it unless asked not to */
                 if (Event)
                 {
-                    KeSetEvent(EventObject, IO_NO_INCREMENT, FALSE);
+                    if (!(FileObject->Flags & FO_SKIP_SET_FAST_IO))
+                    {
+                        KeSetEvent(EventObject, IO_NO_INCREMENT, FALSE);
+                    }
                     ObDereferenceObject(EventObject);
                 }
 
@@ -438,8 +479,10 @@ IopDeviceFsIoControl(IN HANDLE DeviceHandle,
                     IopUnlockFileObject(FileObject);
                 }
 
-                /* Set completion if required */
-                if (CompletionInfo.Port != NULL && UserApcContext != NULL)
+                /* Set completion if required, unless the caller skips it on success */
+                if (CompletionInfo.Port != NULL && UserApcContext != NULL &&
+                    !((FileObject->Flags & FO_SKIP_COMPLETION_PORT) &&
+                      NT_SUCCESS(KernelIosb.Status)))
                 {
                     if (!NT_SUCCESS(IoSetIoCompletion(CompletionInfo.Port,
                                                       CompletionInfo.Key,
@@ -459,6 +502,68 @@ IopDeviceFsIoControl(IN HANDLE DeviceHandle,
         }
     }
 
+    /*
+     * The cache residency query doesn't depend on the file system, the cache
+     * manager answers it directly and it is always completed synchronously
+     */
+    if (!IsDevIoCtl && IoControlCode == FSCTL_QUERY_CACHE_RESIDENCY)
+    {
+        IO_STATUS_BLOCK KernelIosb;
+        IO_COMPLETION_CONTEXT CompletionInfo = { NULL, NULL };
+
+        KernelIosb.Status = IopQueryCacheResidency(FileObject,
+                                                   OutputBuffer,
+                                                   OutputBufferLength,
+                                                   &KernelIosb.Information);
+
+        /* Write the IOSB back */
+        _SEH2_TRY
+        {
+            *IoStatusBlock = KernelIosb;
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            KernelIosb.Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        /* Backup our complete context in case it exists */
+        if (FileObject->CompletionContext)
+        {
+            CompletionInfo = *(FileObject->CompletionContext);
+        }
+
+        /* If we had an event, signal it */
+        if (Event)
+        {
+            KeSetEvent(EventObject, IO_NO_INCREMENT, FALSE);
+            ObDereferenceObject(EventObject);
+        }
+
+        /* If FO was locked, unlock it */
+        if (LockedForSynch)
+        {
+            IopUnlockFileObject(FileObject);
+        }
+
+        /* Set completion if required */
+        if (CompletionInfo.Port != NULL && UserApcContext != NULL)
+        {
+            if (!NT_SUCCESS(IoSetIoCompletion(CompletionInfo.Port,
+                                              CompletionInfo.Key,
+                                              UserApcContext,
+                                              KernelIosb.Status,
+                                              KernelIosb.Information,
+                                              TRUE)))
+            {
+                KernelIosb.Status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+
+        ObDereferenceObject(FileObject);
+        return KernelIosb.Status;
+    }
+
     /* Clear the event */
     KeClearEvent(&FileObject->Event);
 
@@ -1046,8 +1151,8 @@ IoSynchronousPageWrite(IN PFILE_OBJECT FileObject,
     if (FileObject->SectionObjectPointer != NULL &&
         FileObject->SectionObjectPointer->SharedCacheMap != NULL)
     {
-        ++CcDataFlushes;
-        CcDataPages += BYTES_TO_PAGES(MmGetMdlByteCount(Mdl));
+        CcIncrementPerformanceCounter(DataFlushes);
+        CcAddPerformanceCounter(DataPages, BYTES_TO_PAGES(MmGetMdlByteCount(Mdl)));
     }
 
     /* Get the Device Object */
@@ -1746,15 +1851,20 @@ NtLockFile(IN HANDLE FileHandle,
             }
             _SEH2_END;
 
-            /* If we had an event, signal it */
+            /* If we had an event, signal it unless asked not to */
             if (EventHandle)
             {
-                KeSetEvent(Event, IO_NO_INCREMENT, FALSE);
+                if (!(FileObject->Flags & FO_SKIP_SET_FAST_IO))
+                {
+                    KeSetEvent(Event, IO_NO_INCREMENT, FALSE);
+                }
                 ObDereferenceObject(Event);
             }
 
-            /* Set completion if required */
-            if (FileObject->CompletionContext != NULL && ApcContext != NULL)
+            /* Set completion if required, unless the caller skips it on success */
+            if (FileObject->CompletionContext != NULL && ApcContext != NULL &&
+                !((FileObject->Flags & FO_SKIP_COMPLETION_PORT) &&
+                  NT_SUCCESS(KernelIosb.Status)))
             {
                 if (!NT_SUCCESS(IoSetIoCompletion(FileObject->CompletionContext->Port,
                                                   FileObject->CompletionContext->Key,
@@ -2615,6 +2725,9 @@ NtReadFile(IN HANDLE FileHandle,
     /* Get the device object */
     DeviceObject = IoGetRelatedDeviceObject(FileObject);
 
+    /* Notify WMI */
+    WmiTraceFileIo(FALSE, FileObject, &CapturedByteOffset, Length);
+
     /* Check if we should use Sync IO or not */
     if (FileObject->Flags & FO_SYNCHRONOUS_IO)
     {
@@ -2813,8 +2926,255 @@ NtReadFile(IN HANDLE FileHandle,
                                         IopReadTransfer);
 }
 
+static
+NTSTATUS
+IopReadWriteScatterGather(IN HANDLE FileHandle,
+                          IN HANDLE Event OPTIONAL,
+                          IN PIO_APC_ROUTINE ApcRoutine OPTIONAL,
+                          IN PVOID ApcContext OPTIONAL,
+                          OUT PIO_STATUS_BLOCK IoStatusBlock,
+                          IN FILE_SEGMENT_ELEMENT SegmentArray[],
+                          IN ULONG Length,
+                          IN PLARGE_INTEGER ByteOffset OPTIONAL,
+                          IN PULONG Key OPTIONAL,
+                          IN BOOLEAN Write)
+{
+    NTSTATUS Status;
+    PFILE_OBJECT FileObject;
+    PIRP Irp;
+    PDEVICE_OBJECT DeviceObject;
+    PIO_STACK_LOCATION StackPtr;
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PKEVENT EventObject = NULL;
+    LARGE_INTEGER CapturedByteOffset;
+    ULONG CapturedKey = 0;
+    BOOLEAN Synchronous = FALSE;
+    PMDL Mdl;
+    OBJECT_HANDLE_INFORMATION ObjectHandleInfo;
+    PVOID Buffer;
+
+    PAGED_CODE();
+    CapturedByteOffset.QuadPart = 0;
+    IOTRACE(IO_API_DEBUG, "FileHandle: %p\n", FileHandle);
+
+    /* Get File Object */
+    if (Write)
+    {
+        Status = ObReferenceFileObjectForWrite(FileHandle,
+                                               PreviousMode,
+                                               &FileObject,
+                                               &ObjectHandleInfo);
+    }
+    else
+    {
+        Status = ObReferenceObjectByHandle(FileHandle,
+                                           FILE_READ_DATA,
+                                           IoFileObjectType,
+                                           PreviousMode,
+                                           (PVOID*)&FileObject,
+                                           &ObjectHandleInfo);
+    }
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Validate User-Mode Buffers */
+    if (PreviousMode != KernelMode)
+    {
+        _SEH2_TRY
+        {
+            /* Probe the status block */
+            ProbeForWriteIoStatusBlock(IoStatusBlock);
+
+            /*
+             * Probe the segment array, one element per page. The pages
+             * themselves are probed when they get locked.
+             */
+            ProbeForRead(SegmentArray,
+                         BYTES_TO_PAGES(Length) * sizeof(FILE_SEGMENT_ELEMENT),
+                         sizeof(ULONG));
+
+            /* Check if we got a byte offset */
+            if (ByteOffset)
+            {
+                /* Capture and probe it */
+                CapturedByteOffset = ProbeForReadLargeInteger(ByteOffset);
+            }
+
+            /* Capture and probe the key */
+            if (Key) CapturedKey = ProbeForReadUlong(Key);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            /* Release the file object and return the exception code */
+            ObDereferenceObject(FileObject);
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+    }
+    else
+    {
+        /* Kernel mode: capture directly */
+        if (ByteOffset) CapturedByteOffset = *ByteOffset;
+        if (Key) CapturedKey = *Key;
+    }
+
+    /* Get the device object */
+    DeviceObject = IoGetRelatedDeviceObject(FileObject);
+
+    /*
+     * The pages are handed to the driver as they are, so this only works
+     * for non cached I/O on drivers taking MDLs
+     */
+    if (!(FileObject->Flags & FO_NO_INTERMEDIATE_BUFFERING) ||
+        !(DeviceObject->Flags & DO_DIRECT_IO))
+    {
+        ObDereferenceObject(FileObject);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Check if this is an append operation */
+    if (Write &&
+        (ObjectHandleInfo.GrantedAccess &
+        (FILE_APPEND_DATA | FILE_WRITE_DATA)) == FILE_APPEND_DATA)
+    {
+        /* Give the drivers something to understand */
+        CapturedByteOffset.u.LowPart = FILE_WRITE_TO_END_OF_FILE;
+        CapturedByteOffset.u.HighPart = -1;
+    }
+
+    /* Check for event */
+    if (Event)
+    {
+        /* Reference it */
+        Status = ObReferenceObjectByHandle(Event,
+                                           EVENT_MODIFY_STATE,
+                                           ExEventObjectType,
+                                           PreviousMode,
+                                           (PVOID*)&EventObject,
+                                           NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            /* Fail */
+            ObDereferenceObject(FileObject);
+            return Status;
+        }
+
+        /* Otherwise reset the event */
+        KeClearEvent(EventObject);
+    }
+
+    /* Check if we should use Sync IO or not */
+    if (FileObject->Flags & FO_SYNCHRONOUS_IO)
+    {
+        /* Lock the file object */
+        IopLockFileObject(FileObject);
+
+        /* Check if we don't have a byte offset available */
+        if (!(ByteOffset) ||
+            ((CapturedByteOffset.u.LowPart == FILE_USE_FILE_POINTER_POSITION) &&
+             (CapturedByteOffset.u.HighPart == -1)))
+        {
+            /* Use the Current Byte Offset instead */
+            CapturedByteOffset = FileObject->CurrentByteOffset;
+        }
+
+        /* Non cached I/O, so there is no fast I/O to try. Remember we are sync */
+        Synchronous = TRUE;
+    }
+    else if (!(ByteOffset))
+    {
+        /* Otherwise, this was async I/O without a byte offset, so fail */
+        if (EventObject) ObDereferenceObject(EventObject);
+        ObDereferenceObject(FileObject);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Clear the File Object's event */
+    KeClearEvent(&FileObject->Event);
+
+    /* Allocate the IRP */
+    Irp = IoAllocateIrp(DeviceObject->StackSize, FALSE);
+    if (!Irp) return IopCleanupFailedIrp(FileObject, EventObject, NULL);
+
+    /* Set the IRP */
+    Irp->Tail.Overlay.OriginalFileObject = FileObject;
+    Irp->Tail.Overlay.Thread = PsGetCurrentThread();
+    Irp->RequestorMode = PreviousMode;
+    Irp->Overlay.AsynchronousParameters.UserApcRoutine = ApcRoutine;
+    Irp->Overlay.AsynchronousParameters.UserApcContext = ApcContext;
+    Irp->UserIosb = IoStatusBlock;
+    Irp->UserEvent = EventObject;
+    Irp->PendingReturned = FALSE;
+    Irp->Cancel = FALSE;
+    Irp->CancelRoutine = NULL;
+    Irp->AssociatedIrp.SystemBuffer = NULL;
+    Irp->MdlAddress = NULL;
+
+    /* Set the Stack Data */
+    StackPtr = IoGetNextIrpStackLocation(Irp);
+    StackPtr->FileObject = FileObject;
+    if (Write)
+    {
+        StackPtr->MajorFunction = IRP_MJ_WRITE;
+        StackPtr->Flags = FileObject->Flags & FO_WRITE_THROUGH ?
+                          SL_WRITE_THROUGH : 0;
+        StackPtr->Parameters.Write.Key = CapturedKey;
+        StackPtr->Parameters.Write.Length = Length;
+        StackPtr->Parameters.Write.ByteOffset = CapturedByteOffset;
+    }
+    else
+    {
+        StackPtr->MajorFunction = IRP_MJ_READ;
+        StackPtr->Parameters.Read.Key = CapturedKey;
+        StackPtr->Parameters.Read.Length = Length;
+        StackPtr->Parameters.Read.ByteOffset = CapturedByteOffset;
+    }
+
+    /* Check if we have a buffer length */
+    if (Length)
+    {
+        _SEH2_TRY
+        {
+            /*
+             * Build a single MDL out of all the pages, starting at the
+             * first one. Only this MDL describes the buffer, so the driver
+             * must not use the user buffer directly.
+             */
+            Buffer = (PVOID)(ULONG_PTR)SegmentArray[0].Alignment;
+            Mdl = IoAllocateMdl(Buffer, Length, FALSE, TRUE, Irp);
+            if (!Mdl)
+                ExRaiseStatus(STATUS_INSUFFICIENT_RESOURCES);
+            if (BYTE_OFFSET(Buffer))
+                ExRaiseStatus(STATUS_DATATYPE_MISALIGNMENT);
+            MmProbeAndLockSelectedPages(Mdl,
+                                        SegmentArray,
+                                        PreviousMode,
+                                        Write ? IoReadAccess : IoWriteAccess);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            /* Allocating failed, clean up and return the exception code */
+            IopCleanupAfterException(FileObject, Irp, EventObject, NULL);
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+    }
+
+    /* This is non cached I/O straight into the caller's pages */
+    Irp->Flags = IRP_NOCACHE | IRP_DEFER_IO_COMPLETION;
+    Irp->Flags |= Write ? IRP_WRITE_OPERATION : IRP_READ_OPERATION;
+
+    /* Perform the call */
+    return IopPerformSynchronousRequest(DeviceObject,
+                                        Irp,
+                                        FileObject,
+                                        TRUE,
+                                        PreviousMode,
+                                        Synchronous,
+                                        Write ? IopWriteTransfer : IopReadTransfer);
+}
+
 /*
- * @unimplemented
+ * @implemented
  */
 NTSTATUS
 NTAPI
@@ -2828,8 +3188,16 @@ NtReadFileScatter(IN HANDLE FileHandle,
                   IN PLARGE_INTEGER  ByteOffset,
                   IN PULONG Key OPTIONAL)
 {
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+    return IopReadWriteScatterGather(FileHandle,
+                                     Event,
+                                     UserApcRoutine,
+                                     UserApcContext,
+                                     UserIoStatusBlock,
+                                     BufferDescription,
+                                     BufferLength,
+                                     ByteOffset,
+                                     Key,
+                                     FALSE);
 }
 
 /*
@@ -2871,6 +3239,7 @@ NtSetInformationFile(IN HANDLE FileHandle,
     IO_STATUS_BLOCK KernelIosb;
     PVOID Queue;
     PFILE_COMPLETION_INFORMATION CompletionInfo = FileInformation;
+    ULONG NotificationFlags, FileObjectFlags;
     PIO_COMPLETION_CONTEXT Context;
     PFILE_RENAME_INFORMATION RenameInfo;
     HANDLE TargetHandle = NULL;
@@ -3128,6 +3497,38 @@ NtSetInformationFile(IN HANDLE FileHandle,
         Irp->IoStatus.Status = Status;
         Irp->IoStatus.Information = 0;
     }
+    else if (FileInformationClass == FileIoCompletionNotificationInformation)
+    {
+        /* Get the requested modes */
+        NotificationFlags = ((PFILE_IO_COMPLETION_NOTIFICATION_INFORMATION)
+                             Irp->AssociatedIrp.SystemBuffer)->Flags;
+
+        /* Make sure they are all known */
+        if (NotificationFlags & ~(FILE_SKIP_COMPLETION_PORT_ON_SUCCESS |
+                                  FILE_SKIP_SET_EVENT_ON_HANDLE |
+                                  FILE_SKIP_SET_USER_EVENT_ON_FAST_IO))
+        {
+            /* Fail */
+            Status = STATUS_INVALID_PARAMETER;
+        }
+        else
+        {
+            /* The modes can only be turned on, so just OR them in */
+            FileObjectFlags = 0;
+            if (NotificationFlags & FILE_SKIP_COMPLETION_PORT_ON_SUCCESS)
+                FileObjectFlags |= FO_SKIP_COMPLETION_PORT;
+            if (NotificationFlags & FILE_SKIP_SET_EVENT_ON_HANDLE)
+                FileObjectFlags |= FO_SKIP_SET_EVENT;
+            if (NotificationFlags & FILE_SKIP_SET_USER_EVENT_ON_FAST_IO)
+                FileObjectFlags |= FO_SKIP_SET_FAST_IO;
+            InterlockedOr((PLONG)&FileObject->Flags, FileObjectFlags);
+            Status = STATUS_SUCCESS;
+        }
+
+        /* Set the IRP Status */
+        Irp->IoStatus.Status = Status;
+        Irp->IoStatus.Information = 0;
+    }
     else if (FileInformationClass == FileRenameInformation ||
              FileInformationClass == FileLinkInformation ||
              FileInformationClass == FileMoveClusterInformation)
@@ -3612,6 +4013,9 @@ NtWriteFile(IN HANDLE FileHandle,
     /* Get the device object */
     DeviceObject = IoGetRelatedDeviceObject(FileObject);
 
+    /* Notify WMI */
+    WmiTraceFileIo(TRUE, FileObject, &CapturedByteOffset, Length);
+
     /* Check if we should use Sync IO or not */
     if (FileObject->Flags & FO_SYNCHRONOUS_IO)
     {
@@ -3809,6 +4213,9 @@ NtWriteFile(IN HANDLE FileHandle,
                                         IopWriteTransfer);
 }
 
+/*
+ * @implemented
+ */
 NTSTATUS
 NTAPI
 NtWriteFileGather(IN HANDLE FileHandle,
@@ -3821,8 +4228,16 @@ NtWriteFileGather(IN HANDLE FileHandle,
                   IN PLARGE_INTEGER ByteOffset,
                   IN PULONG Key OPTIONAL)
 {
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+    return IopReadWriteScatterGather(FileHandle,
+                                     Event,
+                                     UserApcRoutine,
+                                     UserApcContext,
+                                     UserIoStatusBlock,
+                                     BufferDescription,
+                                     BufferLength,
+                                     ByteOffset,
+                                     Key,
+                                     TRUE);
 }
 
 /*
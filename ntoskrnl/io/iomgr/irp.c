@@ -399,8 +399,16 @@ IopCompleteRequest(IN PKAPC Apc,
         }
         else if (FileObject)
         {
-            /* Signal the file object and set the status */
-            KeSetEvent(&FileObject->Event, 0, FALSE);
+            /*
+             * Signal the file object and set the status, unless this is an
+             * asynchronous handle whose owner asked us not to touch its event
+             */
+            if (!(FileObject->Flags & FO_SKIP_SET_EVENT) ||
+                (FileObject->Flags & FO_SYNCHRONOUS_IO) ||
+                (Irp->Flags & IRP_SYNCHRONOUS_API))
+            {
+                KeSetEvent(&FileObject->Event, 0, FALSE);
+            }
             FileObject->FinalStatus = Irp->IoStatus.Status;
 
             /*
@@ -460,9 +468,16 @@ IopCompleteRequest(IN PKAPC Apc,
             KeInsertQueueApc(&Irp->Tail.Apc, Irp->UserIosb, NULL, 2);
         }
         else if ((Port) &&
-                 (Irp->Overlay.AsynchronousParameters.UserApcContext))
+                 (Irp->Overlay.AsynchronousParameters.UserApcContext) &&
+                 !((FileObject->Flags & FO_SKIP_COMPLETION_PORT) &&
+                   !(Irp->PendingReturned) &&
+                   NT_SUCCESS(Irp->IoStatus.Status)))
         {
-            /* We have an I/O Completion setup... create the special Overlay */
+            /*
+             * We have an I/O Completion setup, and the request either went
+             * pending or failed, or the caller wants a packet even when it
+             * completes inline... create the special Overlay
+             */
             Irp->Tail.CompletionKey = Key;
             Irp->Tail.Overlay.PacketType = IopCompletionPacketIrp;
             KeInsertQueue(Port, &Irp->Tail.Overlay.ListEntry);
@@ -1282,6 +1297,12 @@ IofCallDriver(IN PDEVICE_OBJECT DeviceObject,
     /* Get the Device Object */
     StackPtr->DeviceObject = DeviceObject;
 
+    /* Boot timeline wants to know when each device is first used */
+    if (IopBootTraceEnabled) IopBootTraceFirstIo(DeviceObject, StackPtr->MajorFunction);
+
+    /* Notify WMI of disk requests */
+    WmiTraceDiskIoStart(Irp);
+
     /* Call it */
     return DriverObject->MajorFunction[StackPtr->MajorFunction](DeviceObject,
                                                                 Irp);
@@ -1337,6 +1358,9 @@ IofCompleteRequest(IN PIRP Irp,
     ASSERT(Irp->IoStatus.Status != STATUS_PENDING);
     ASSERT(Irp->IoStatus.Status != (NTSTATUS)0xFFFFFFFF);
 
+    /* Notify WMI of disk requests, before the stack locations get cleared */
+    WmiTraceDiskIoComplete(Irp);
+
     /* Get the last stack */
     LastStackPtr = (PIO_STACK_LOCATION)(Irp + 1);
     if (LastStackPtr->Control & SL_ERROR_RETURNED)
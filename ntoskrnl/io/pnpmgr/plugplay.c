@@ -26,6 +26,7 @@ typedef struct _PNP_EVENT_ENTRY
 /* GLOBALS *******************************************************************/
 
 static LIST_ENTRY IopPnpEventQueueHead;
+static KGUARDED_MUTEX IopPnpEventQueueLock;
 static KEVENT IopPnpNotifyEvent;
 
 /* FUNCTIONS *****************************************************************/
@@ -34,6 +35,7 @@ NTSTATUS INIT_FUNCTION
 IopInitPlugPlayEvents(VOID)
 {
     InitializeListHead(&IopPnpEventQueueHead);
+    KeInitializeGuardedMutex(&IopPnpEventQueueLock);
 
     KeInitializeEvent(&IopPnpNotifyEvent,
                       SynchronizationEvent,
@@ -81,8 +83,11 @@ IopQueueTargetDeviceEvent(const GUID *Guid,
         return Status;
     }
 
+    /* Devices may be started from several threads at once */
+    KeAcquireGuardedMutex(&IopPnpEventQueueLock);
     InsertHeadList(&IopPnpEventQueueHead,
                    &EventEntry->ListEntry);
+    KeReleaseGuardedMutex(&IopPnpEventQueueLock);
     KeSetEvent(&IopPnpNotifyEvent,
                0,
                FALSE);
@@ -98,14 +103,25 @@ IopQueueTargetDeviceEvent(const GUID *Guid,
 static NTSTATUS
 IopRemovePlugPlayEvent(VOID)
 {
+    PLIST_ENTRY ListEntry = NULL;
+    BOOLEAN MoreEvents;
+
     /* Remove a pnp event entry from the tail of the queue */
+    KeAcquireGuardedMutex(&IopPnpEventQueueLock);
     if (!IsListEmpty(&IopPnpEventQueueHead))
     {
-        ExFreePool(CONTAINING_RECORD(RemoveTailList(&IopPnpEventQueueHead), PNP_EVENT_ENTRY, ListEntry));
+        ListEntry = RemoveTailList(&IopPnpEventQueueHead);
+    }
+    MoreEvents = !IsListEmpty(&IopPnpEventQueueHead);
+    KeReleaseGuardedMutex(&IopPnpEventQueueLock);
+
+    if (ListEntry)
+    {
+        ExFreePool(CONTAINING_RECORD(ListEntry, PNP_EVENT_ENTRY, ListEntry));
     }
 
     /* Signal the next pnp event in the queue */
-    if (!IsListEmpty(&IopPnpEventQueueHead))
+    if (MoreEvents)
     {
         KeSetEvent(&IopPnpNotifyEvent,
                    0,
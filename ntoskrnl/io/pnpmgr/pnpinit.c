@@ -385,6 +385,52 @@ Exit:
     return Status;
 }
 
+VOID
+NTAPI
+INIT_FUNCTION
+PiInitBootStartConfiguration(IN HANDLE ControlHandle)
+{
+    HANDLE KeyHandle;
+    NTSTATUS Status;
+    PKEY_VALUE_FULL_INFORMATION KeyValueInformation;
+    UNICODE_STRING KeyName = RTL_CONSTANT_STRING(L"PnP");
+
+    /* The key is optional, keep the defaults if it isn't there */
+    Status = IopOpenRegistryKeyEx(&KeyHandle,
+                                  ControlHandle,
+                                  &KeyName,
+                                  KEY_READ);
+    if (!NT_SUCCESS(Status)) return;
+
+    /* Number of helper threads used to start device subtrees, 0 disables it */
+    Status = IopGetRegistryValue(KeyHandle, L"BootStartThreads", &KeyValueInformation);
+    if (NT_SUCCESS(Status))
+    {
+        if ((KeyValueInformation->Type == REG_DWORD) &&
+            (KeyValueInformation->DataLength == sizeof(ULONG)))
+        {
+            PnpBootStartThreads = *(PULONG)((ULONG_PTR)KeyValueInformation +
+                                            KeyValueInformation->DataOffset);
+        }
+        ExFreePool(KeyValueInformation);
+    }
+
+    /* Log the start time of every device to the debugger */
+    Status = IopGetRegistryValue(KeyHandle, L"BootTrace", &KeyValueInformation);
+    if (NT_SUCCESS(Status))
+    {
+        if ((KeyValueInformation->Type == REG_DWORD) &&
+            (KeyValueInformation->DataLength == sizeof(ULONG)))
+        {
+            PnpBootTrace = *(PULONG)((ULONG_PTR)KeyValueInformation +
+                                     KeyValueInformation->DataOffset) != 0;
+        }
+        ExFreePool(KeyValueInformation);
+    }
+
+    ZwClose(KeyHandle);
+}
+
 NTSTATUS
 NTAPI
 INIT_FUNCTION
@@ -401,6 +447,7 @@ IopInitializePlugPlayServices(VOID)
     KeInitializeSpinLock(&IopDeviceTreeLock);
     KeInitializeSpinLock(&IopDeviceActionLock);
     InitializeListHead(&IopDeviceActionRequestList);
+    ExInitializeResourceLite(&PpResourceAssignmentLock);
 
     /* Get the default interface */
     PnpDefaultInterfaceType = IopDetermineDefaultInterfaceType();
@@ -448,6 +495,9 @@ IopInitializePlugPlayServices(VOID)
         ZwClose(DeviceClassesHandle);
     }
 
+    /* Read the boot time device start settings */
+    PiInitBootStartConfiguration(ControlHandle);
+
     ZwClose(ControlHandle);
 
     /* Create the enum key */
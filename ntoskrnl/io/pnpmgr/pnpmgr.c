@@ -10,6 +10,7 @@
 /* INCLUDES ******************************************************************/
 
 #include <ntoskrnl.h>
+#include <boottrace.h>
 #define NDEBUG
 #include <debug.h>
 
@@ -46,6 +47,26 @@ typedef struct _DEVICE_ACTION_DATA
     DEVICE_RELATION_TYPE Type;
 } DEVICE_ACTION_DATA, *PDEVICE_ACTION_DATA;
 
+/*
+ * During boot the children of a device node are started from several
+ * threads, each thread taking a whole child subtree. A parent is always
+ * started before its children since the subtree walk is still done in
+ * order, only siblings run concurrently.
+ */
+#define PNP_BOOT_START_MAX_THREADS  8
+
+ULONG PnpBootStartThreads = 4;
+BOOLEAN PnpBootTrace;
+static volatile LONG PnpBootStartThreadsActive;
+
+typedef struct _PNP_START_CONTEXT
+{
+    PDEVICE_NODE ParentDeviceNode;
+    PDEVICE_NODE *Children;
+    ULONG ChildCount;
+    volatile LONG NextChild;
+} PNP_START_CONTEXT, *PPNP_START_CONTEXT;
+
 /* FUNCTIONS *****************************************************************/
 NTSTATUS
 NTAPI
@@ -437,6 +458,7 @@ IopInitializeDevice(PDEVICE_NODE DeviceNode,
 {
    PDEVICE_OBJECT Fdo;
    NTSTATUS Status;
+   ULONGLONG StartTime;
 
    if (!DriverObject)
    {
@@ -463,8 +485,10 @@ IopInitializeDevice(PDEVICE_NODE DeviceNode,
    DPRINT("Calling %wZ->AddDevice(%wZ)\n",
       &DriverObject->DriverName,
       &DeviceNode->InstancePath);
+   StartTime = KeQueryInterruptTime();
    Status = DriverObject->DriverExtension->AddDevice(
       DriverObject, DeviceNode->PhysicalDeviceObject);
+   IopBootTrace(BOOT_TRACE_ADD_DEVICE, StartTime, Status, &DeviceNode->InstancePath);
    if (!NT_SUCCESS(Status))
    {
       DPRINT1("%wZ->AddDevice(%wZ) failed with status 0x%x\n",
@@ -656,6 +680,7 @@ IopStartDevice2(IN PDEVICE_OBJECT DeviceObject)
     NTSTATUS Status;
     PVOID Dummy;
     DEVICE_CAPABILITIES DeviceCapabilities;
+    ULONGLONG StartTime;
 
     /* Get the device node */
     DeviceNode = IopGetDeviceNode(DeviceObject);
@@ -673,7 +698,19 @@ IopStartDevice2(IN PDEVICE_OBJECT DeviceObject)
          DeviceNode->ResourceListTranslated;
 
     /* Do the call */
+    StartTime = KeQueryInterruptTime();
     Status = IopSynchronousCall(DeviceObject, &Stack, &Dummy);
+    IopBootTrace(BOOT_TRACE_START_DEVICE, StartTime, Status, &DeviceNode->InstancePath);
+    if (PnpBootTrace)
+    {
+        /* Interrupt time counts 100ns units since boot */
+        DPRINT1("PnP start: %wZ at %I64u ms took %I64u ms on thread %p [Status: 0x%x]\n",
+                &DeviceNode->InstancePath,
+                StartTime / 10000,
+                (KeQueryInterruptTime() - StartTime) / 10000,
+                KeGetCurrentThread(),
+                Status);
+    }
     if (!NT_SUCCESS(Status))
     {
         /* Send an IRP_MN_REMOVE_DEVICE request */
@@ -2895,6 +2932,148 @@ IopActionInitChildServices(PDEVICE_NODE DeviceNode,
  * Return Value
  *    Status
  */
+static
+VOID
+PipStartChildSubtrees(IN PPNP_START_CONTEXT StartContext)
+{
+   DEVICETREE_TRAVERSE_CONTEXT Context;
+   LONG Index;
+
+   /* Keep taking the next unclaimed child until all of them are done */
+   while (TRUE)
+   {
+      Index = InterlockedIncrement(&StartContext->NextChild) - 1;
+      if (Index >= (LONG)StartContext->ChildCount)
+         break;
+
+      IopInitDeviceTreeTraverseContext(
+         &Context,
+         StartContext->Children[Index],
+         IopActionInitChildServices,
+         StartContext->ParentDeviceNode);
+
+      IopTraverseDeviceTree(&Context);
+   }
+}
+
+static
+VOID
+NTAPI
+PipStartChildSubtreesThread(IN PVOID StartContext)
+{
+   PipStartChildSubtrees(StartContext);
+   PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+NTSTATUS
+PipInitializePnpServicesParallel(IN PDEVICE_NODE DeviceNode)
+{
+   PNP_START_CONTEXT StartContext;
+   PDEVICE_NODE ChildDeviceNode;
+   PKTHREAD Threads[PNP_BOOT_START_MAX_THREADS];
+   HANDLE ThreadHandle;
+   ULONG ThreadCount, MaxThreads, i;
+   KIRQL OldIrql;
+   NTSTATUS Status;
+
+   /* The parent itself doesn't need anything, see IopActionInitChildServices */
+   StartContext.ParentDeviceNode = DeviceNode;
+   StartContext.ChildCount = 0;
+   StartContext.NextChild = 0;
+
+   /* Count the children */
+   KeAcquireSpinLock(&IopDeviceTreeLock, &OldIrql);
+   for (ChildDeviceNode = DeviceNode->Child;
+        ChildDeviceNode != NULL;
+        ChildDeviceNode = ChildDeviceNode->Sibling)
+   {
+      StartContext.ChildCount++;
+   }
+   KeReleaseSpinLock(&IopDeviceTreeLock, OldIrql);
+
+   if (StartContext.ChildCount < 2)
+      return STATUS_NOT_SUPPORTED;
+
+   StartContext.Children = ExAllocatePoolWithTag(PagedPool,
+                                                 StartContext.ChildCount * sizeof(PDEVICE_NODE),
+                                                 TAG_IO);
+   if (!StartContext.Children)
+      return STATUS_INSUFFICIENT_RESOURCES;
+
+   /* Take a snapshot of the children, they may be enumerated meanwhile */
+   i = 0;
+   KeAcquireSpinLock(&IopDeviceTreeLock, &OldIrql);
+   for (ChildDeviceNode = DeviceNode->Child;
+        ChildDeviceNode != NULL && i < StartContext.ChildCount;
+        ChildDeviceNode = ChildDeviceNode->Sibling)
+   {
+      ObReferenceObject(ChildDeviceNode->PhysicalDeviceObject);
+      StartContext.Children[i++] = ChildDeviceNode;
+   }
+   KeReleaseSpinLock(&IopDeviceTreeLock, OldIrql);
+   StartContext.ChildCount = i;
+
+   /* Spawn helpers as long as the global budget allows it */
+   MaxThreads = min(PnpBootStartThreads, PNP_BOOT_START_MAX_THREADS);
+   MaxThreads = min(MaxThreads, StartContext.ChildCount - 1);
+   for (ThreadCount = 0; ThreadCount < MaxThreads; ThreadCount++)
+   {
+      if (InterlockedIncrement(&PnpBootStartThreadsActive) > (LONG)PnpBootStartThreads)
+      {
+         InterlockedDecrement(&PnpBootStartThreadsActive);
+         break;
+      }
+
+      Status = PsCreateSystemThread(&ThreadHandle,
+                                    THREAD_ALL_ACCESS,
+                                    NULL,
+                                    NULL,
+                                    NULL,
+                                    PipStartChildSubtreesThread,
+                                    &StartContext);
+      if (NT_SUCCESS(Status))
+      {
+         Status = ObReferenceObjectByHandle(ThreadHandle,
+                                            SYNCHRONIZE,
+                                            PsThreadType,
+                                            KernelMode,
+                                            (PVOID*)&Threads[ThreadCount],
+                                            NULL);
+         /* Our own handle can't go bad */
+         ASSERT(NT_SUCCESS(Status));
+         ZwClose(ThreadHandle);
+      }
+
+      if (!NT_SUCCESS(Status))
+      {
+         DPRINT1("Failed to create a device start thread: 0x%lx\n", Status);
+         InterlockedDecrement(&PnpBootStartThreadsActive);
+         break;
+      }
+   }
+
+   DPRINT("Starting %lu children of %wZ with %lu helper threads\n",
+          StartContext.ChildCount, &DeviceNode->InstancePath, ThreadCount);
+
+   /* Do our share of the work, then wait for the helpers */
+   PipStartChildSubtrees(&StartContext);
+   for (i = 0; i < ThreadCount; i++)
+   {
+      KeWaitForSingleObject(Threads[i], Executive, KernelMode, FALSE, NULL);
+      ObDereferenceObject(Threads[i]);
+      InterlockedDecrement(&PnpBootStartThreadsActive);
+   }
+
+   for (i = 0; i < StartContext.ChildCount; i++)
+   {
+      ObDereferenceObject(StartContext.Children[i]->PhysicalDeviceObject);
+   }
+   ExFreePoolWithTag(StartContext.Children, TAG_IO);
+
+   return STATUS_SUCCESS;
+}
+
 NTSTATUS
 IopInitializePnpServices(IN PDEVICE_NODE DeviceNode)
 {
@@ -2902,6 +3081,13 @@ IopInitializePnpServices(IN PDEVICE_NODE DeviceNode)
 
    DPRINT("IopInitializePnpServices(%p)\n", DeviceNode);
 
+   /* Siblings are independent of each other while booting, start them in parallel */
+   if (!PnpSystemInit && PnpBootStartThreads)
+   {
+      if (NT_SUCCESS(PipInitializePnpServicesParallel(DeviceNode)))
+         return STATUS_SUCCESS;
+   }
+
    IopInitDeviceTreeTraverseContext(
       &Context,
       DeviceNode,
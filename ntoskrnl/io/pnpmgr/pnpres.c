@@ -12,6 +12,9 @@
 #define NDEBUG
 #include <debug.h>
 
+/* Serializes resource assignment when devices are started in parallel */
+ERESOURCE PpResourceAssignmentLock;
+
 static
 BOOLEAN
 IopCheckDescriptorForConflict(PCM_PARTIAL_RESOURCE_DESCRIPTOR CmDesc, OPTIONAL PCM_PARTIAL_RESOURCE_DESCRIPTOR ConflictingDescriptor)
@@ -1055,9 +1058,9 @@ cleanup:
    return Status;
 }
 
+static
 NTSTATUS
-NTAPI
-IopAssignDeviceResources(
+IopAssignDeviceResourcesLocked(
    IN PDEVICE_NODE DeviceNode)
 {
    NTSTATUS Status;
@@ -1165,6 +1168,23 @@ ByeBye:
    return Status;
 }
 
+NTSTATUS
+NTAPI
+IopAssignDeviceResources(
+   IN PDEVICE_NODE DeviceNode)
+{
+   NTSTATUS Status;
+
+   /* Conflict detection and the resource map update must see a stable view */
+   KeEnterCriticalRegion();
+   ExAcquireResourceExclusiveLite(&PpResourceAssignmentLock, TRUE);
+   Status = IopAssignDeviceResourcesLocked(DeviceNode);
+   ExReleaseResourceLite(&PpResourceAssignmentLock);
+   KeLeaveCriticalRegion();
+
+   return Status;
+}
+
 static
 BOOLEAN
 IopCheckForResourceConflict(
@@ -188,6 +188,15 @@ KdpEnterDebuggerException(IN PKTRAP_FRAME TrapFrame,
                 }
             }
         }
+        else if ((ExceptionCommand == BREAKPOINT_UNLOAD_SYMBOLS) &&
+                 (PreviousMode == KernelMode))
+        {
+            PKD_SYMBOLS_INFO SymbolsInfo;
+
+            /* Drop a driver from the module index before its entry is freed */
+            SymbolsInfo = (PKD_SYMBOLS_INFO)ExceptionRecord->ExceptionInformation[2];
+            KdbSymUnloadSymbols(SymbolsInfo->BaseOfDll);
+        }
         else if (ExceptionCommand == BREAKPOINT_PROMPT)
         {
             ULONG ReturnValue;
@@ -95,6 +95,17 @@ BOOLEAN ExpKdbgExtPool(ULONG Argc, PCHAR Argv[]);
 BOOLEAN ExpKdbgExtPoolUsed(ULONG Argc, PCHAR Argv[]);
 BOOLEAN ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[]);
 BOOLEAN ExpKdbgExtDefWrites(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtCompressedStore(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtWorkingSetTrim(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtScheduler(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtSpinLocks(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtLockSpin(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtDpcs(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtWorkQueues(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtSchedTrace(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtProfile(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtSdCache(ULONG Argc, PCHAR Argv[]);
+BOOLEAN ExpKdbgExtCmHash(ULONG Argc, PCHAR Argv[]);
 
 #ifdef __ROS_DWARF__
 static BOOLEAN KdbpCmdPrintStruct(ULONG Argc, PCHAR Argv[]);
@@ -190,6 +201,17 @@ static const struct
     { "!poolused", "!poolused [Flags [Tag]]", "Display pool usage.", ExpKdbgExtPoolUsed },
     { "!filecache", "!filecache", "Display cache usage.", ExpKdbgExtFileCache },
     { "!defwrites", "!defwrites", "Display cache write values.", ExpKdbgExtDefWrites },
+    { "!cstore", "!cstore", "Display compressed store statistics.", ExpKdbgExtCompressedStore },
+    { "!wstrim", "!wstrim", "Display working set trimming statistics.", ExpKdbgExtWorkingSetTrim },
+    { "!sched", "!sched", "Display per-processor scheduling statistics.", ExpKdbgExtScheduler },
+    { "!spinlocks", "!spinlocks [all]", "Display spinlock contention statistics.", ExpKdbgExtSpinLocks },
+    { "!lockspin", "!lockspin", "Display push lock and resource spin statistics.", ExpKdbgExtLockSpin },
+    { "!dpcs", "!dpcs", "Display threaded DPC state and per-routine DPC timings.", ExpKdbgExtDpcs },
+    { "!workqueues", "!workqueues", "Display executive work queue statistics and latencies.", ExpKdbgExtWorkQueues },
+    { "!schedtrace", "!schedtrace [count]", "Display the last scheduler trace records of each processor.", ExpKdbgExtSchedTrace },
+    { "!profile", "!profile [count] | stacks [count]", "Display the hottest stack profiler samples, or the last sampled stacks of each processor.", ExpKdbgExtProfile },
+    { "!sdcache", "!sdcache", "Display security descriptor cache statistics.", ExpKdbgExtSdCache },
+    { "!cmhash", "!cmhash", "Display registry KCB and NCB hash table statistics.", ExpKdbgExtCmHash },
 };
 
 /* FUNCTIONS *****************************************************************/
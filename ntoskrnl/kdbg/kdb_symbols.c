@@ -26,11 +26,35 @@ typedef struct _IMAGE_SYMBOL_INFO_CACHE
 }
 IMAGE_SYMBOL_INFO_CACHE, *PIMAGE_SYMBOL_INFO_CACHE;
 
+/* Address range of a kernel module, in the module index */
+typedef struct _KDB_SYM_MODULE_RANGE
+{
+    ULONG_PTR Base;
+    ULONG_PTR End;
+    PLDR_DATA_TABLE_ENTRY LdrEntry;
+} KDB_SYM_MODULE_RANGE, *PKDB_SYM_MODULE_RANGE;
+
+#define KDB_SYM_MODULE_INDEX_SIZE   512
+
 static BOOLEAN LoadSymbols;
 static LIST_ENTRY SymbolFileListHead;
 static KSPIN_LOCK SymbolFileListLock;
 BOOLEAN KdbpSymbolsInitialized = FALSE;
 
+/*
+ * Kernel modules sorted by base address, so that symbolizing an address
+ * doesn't walk PsLoadedModuleList. Readers can be the debugger with the other
+ * processors frozen or DbgPrint callers at any IRQL, so they don't lock:
+ * the sequence is odd while an update is in progress and readers retry when
+ * it changed under them. Updates come from loading and unloading symbols,
+ * which the system load lock serializes. The index is static so that it
+ * can't fail to grow; modules that don't fit are still found through the
+ * list.
+ */
+static KDB_SYM_MODULE_RANGE KdbpSymModuleIndex[KDB_SYM_MODULE_INDEX_SIZE];
+static ULONG KdbpSymModuleIndexCount;
+static volatile LONG KdbpSymModuleIndexSequence;
+
 /* FUNCTIONS ****************************************************************/
 
 static BOOLEAN
@@ -60,6 +84,136 @@ KdbpSymSearchModuleList(
     return FALSE;
 }
 
+/*! \brief Look up the kernel module containing an address in the index.
+ *
+ * \param Address    Address to look up.
+ * \param pLdrEntry  Receives the module, or NULL if no indexed module
+ *                   contains \a Address.
+ *
+ * \retval TRUE   The index was read, \a pLdrEntry was filled.
+ * \retval FALSE  The index kept changing or is being changed by a frozen
+ *                processor, the caller has to walk the list.
+ */
+static BOOLEAN
+KdbpSymLookupModuleIndex(
+    IN PVOID Address,
+    OUT PLDR_DATA_TABLE_ENTRY* pLdrEntry)
+{
+    ULONG_PTR Target = (ULONG_PTR)Address;
+    ULONG Low, High, Middle, Tries;
+    LONG Sequence;
+
+    for (Tries = 0; Tries < 4; Tries++)
+    {
+        Sequence = KdbpSymModuleIndexSequence;
+        if (Sequence & 1)
+            continue;
+        KeMemoryBarrier();
+
+        *pLdrEntry = NULL;
+        Low = 0;
+        High = min(KdbpSymModuleIndexCount, KDB_SYM_MODULE_INDEX_SIZE);
+        while (Low < High)
+        {
+            Middle = (Low + High) / 2;
+            if (Target < KdbpSymModuleIndex[Middle].Base)
+            {
+                High = Middle;
+            }
+            else if (Target >= KdbpSymModuleIndex[Middle].End)
+            {
+                Low = Middle + 1;
+            }
+            else
+            {
+                *pLdrEntry = KdbpSymModuleIndex[Middle].LdrEntry;
+                break;
+            }
+        }
+
+        KeMemoryBarrier();
+        if (Sequence == KdbpSymModuleIndexSequence)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*! \brief Add a kernel module to the index, or update it.
+ *
+ * \param LdrEntry  Module that got its symbols loaded. User mode modules
+ *                  are ignored.
+ */
+static VOID
+KdbpSymInsertModuleIndex(
+    IN PLDR_DATA_TABLE_ENTRY LdrEntry)
+{
+    ULONG_PTR Base = (ULONG_PTR)LdrEntry->DllBase;
+    ULONG i;
+
+    if (Base < (ULONG_PTR)MmSystemRangeStart)
+        return;
+
+    for (i = 0; i < KdbpSymModuleIndexCount; i++)
+    {
+        if (KdbpSymModuleIndex[i].Base >= Base)
+            break;
+    }
+
+    if ((i == KdbpSymModuleIndexCount || KdbpSymModuleIndex[i].Base != Base) &&
+        KdbpSymModuleIndexCount == KDB_SYM_MODULE_INDEX_SIZE)
+    {
+        DPRINT1("Module index full, %wZ is not indexed\n", &LdrEntry->BaseDllName);
+        return;
+    }
+
+    InterlockedIncrement(&KdbpSymModuleIndexSequence);
+
+    /* A module loaded again at the same place replaces the old one */
+    if (i == KdbpSymModuleIndexCount || KdbpSymModuleIndex[i].Base != Base)
+    {
+        RtlMoveMemory(&KdbpSymModuleIndex[i + 1],
+                      &KdbpSymModuleIndex[i],
+                      (KdbpSymModuleIndexCount - i) * sizeof(KDB_SYM_MODULE_RANGE));
+        KdbpSymModuleIndexCount++;
+    }
+
+    KdbpSymModuleIndex[i].Base = Base;
+    KdbpSymModuleIndex[i].End = Base + LdrEntry->SizeOfImage;
+    KdbpSymModuleIndex[i].LdrEntry = LdrEntry;
+
+    InterlockedIncrement(&KdbpSymModuleIndexSequence);
+}
+
+/*! \brief Remove a kernel module from the index.
+ *
+ * \param BaseOfDll  Base address of the module being unloaded.
+ */
+VOID
+KdbSymUnloadSymbols(
+    IN PVOID BaseOfDll)
+{
+    ULONG i;
+
+    for (i = 0; i < KdbpSymModuleIndexCount; i++)
+    {
+        if (KdbpSymModuleIndex[i].Base == (ULONG_PTR)BaseOfDll)
+            break;
+    }
+
+    if (i == KdbpSymModuleIndexCount)
+        return;
+
+    InterlockedIncrement(&KdbpSymModuleIndexSequence);
+
+    RtlMoveMemory(&KdbpSymModuleIndex[i],
+                  &KdbpSymModuleIndex[i + 1],
+                  (KdbpSymModuleIndexCount - i - 1) * sizeof(KDB_SYM_MODULE_RANGE));
+    KdbpSymModuleIndexCount--;
+
+    InterlockedIncrement(&KdbpSymModuleIndexSequence);
+}
+
 /*! \brief Find a module...
  *
  * \param Address      If \a Address is not NULL the module containing \a Address
@@ -82,6 +236,17 @@ KdbpSymFindModule(
     LONG Count = 0;
     PEPROCESS CurrentProcess;
 
+    /* Looking up an address, which is what symbolizing does, can use the index */
+    if (Address && !Name && Index < 0)
+    {
+        /* Kernel modules are never in user space */
+        if ((ULONG_PTR)Address < (ULONG_PTR)MmSystemRangeStart)
+            goto SearchProcess;
+
+        if (KdbpSymLookupModuleIndex(Address, pLdrEntry) && *pLdrEntry)
+            return TRUE;
+    }
+
     /* First try to look up the module in the kernel module list. */
     if(KdbpSymSearchModuleList(PsLoadedModuleList.Flink,
                                &PsLoadedModuleList,
@@ -94,6 +259,7 @@ KdbpSymFindModule(
         return TRUE;
     }
 
+SearchProcess:
     /* That didn't succeed. Try the module list of the current process now. */
     CurrentProcess = PsGetCurrentProcess();
 
@@ -424,6 +590,9 @@ VOID
 KdbSymProcessSymbols(
     IN PLDR_DATA_TABLE_ENTRY LdrEntry)
 {
+    /* Finding the module of an address doesn't have to walk the list then */
+    KdbpSymInsertModuleIndex(LdrEntry);
+
     if (!LoadSymbols)
     {
         LdrEntry->PatchInformation = NULL;
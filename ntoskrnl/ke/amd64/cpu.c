@@ -428,6 +428,33 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
 
 }
 
+VOID
+NTAPI
+KeFlushMultipleTb(IN ULONG Number,
+                  IN PVOID *VirtualAddresses,
+                  IN BOOLEAN AllProcessors)
+{
+    KIRQL OldIrql;
+    ULONG i;
+
+    // FIXME: only flushes the current CPU, like KeFlushEntireTb
+    /* Raise the IRQL for the TB Flush */
+    OldIrql = KeRaiseIrqlToSynchLevel();
+
+    /* Flush the TB for the Current CPU */
+    if (VirtualAddresses)
+    {
+        for (i = 0; i < Number; i++) KeInvalidateTlbEntry(VirtualAddresses[i]);
+    }
+    else
+    {
+        KeFlushCurrentTb();
+    }
+
+    /* Return to original IRQL */
+    KeLowerIrql(OldIrql);
+}
+
 KAFFINITY
 NTAPI
 KeQueryActiveProcessors(VOID)
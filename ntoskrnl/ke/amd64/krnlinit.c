@@ -182,6 +182,9 @@ KiInitializeKernel(IN PKPROCESS InitProcess,
         InitializeListHead(&KiTimerTableListHead[i].Entry);
         KiTimerTableListHead[i].Time.HighPart = 0xFFFFFFFF;
         KiTimerTableListHead[i].Time.LowPart = 0;
+        InitializeListHead(&KiTimerFarTableListHead[i].Entry);
+        KiTimerFarTableListHead[i].Time.HighPart = 0xFFFFFFFF;
+        KiTimerFarTableListHead[i].Time.LowPart = 0;
     }
 
     /* Initialize the Swap event and all swap lists */
@@ -77,13 +77,19 @@ KiDpcInterruptHandler(VOID)
 }
 
 
+VOID
+FASTCALL
+KiZeroPagesNonTemporal(IN PVOID Address,
+                       IN ULONG Size);
+
 VOID
 FASTCALL
 KeZeroPages(IN PVOID Address,
             IN ULONG Size)
 {
-    /* Not using XMMI in this routine */
-    RtlZeroMemory(Address, Size);
+    /* Use non-temporal stores, so we don't thrash the caches */
+    ASSERT((Size & 63) == 0);
+    KiZeroPagesNonTemporal(Address, Size);
 }
 
 PVOID
@@ -126,6 +132,7 @@ KiIdleLoop(VOID)
 
         /* Check for pending timers, pending DPCs, or pending ready threads */
         if ((Prcb->DpcData[0].DpcQueueDepth) ||
+            (Prcb->DpcSetEventRequest) ||
             (Prcb->TimerRequest) ||
             (Prcb->DeferredReadyListHead.Next))
         {
@@ -136,9 +143,20 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+        /* Check if we should look for work on the other processors */
+        if (Prcb->IdleSchedule)
+        {
+            _enable();
+            KiIdleSchedule(Prcb);
+            _disable();
+        }
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
+            /* Restore the normal clock period if it was stretched */
+            if (KiDynamicTickActive) KiExitDynamicTick();
+
             /* Enable interrupts */
             _enable();
 
@@ -164,6 +182,9 @@ KiIdleLoop(VOID)
         }
         else
         {
+            /* Stretch the clock period if the whole system is idle */
+            KiEnterDynamicTick(Prcb);
+
             /* Continue staying idle. Note the HAL returns with interrupts on */
             Prcb->PowerState.IdleFunction(&Prcb->PowerState);
         }
@@ -168,9 +168,11 @@ KiSwapContextResume(
        __writemsr(MSR_GS_SWAP, (ULONG64)NewThread->Teb);
     }
 
-    /* Increase context switch count */
+    /* Increase context switch count and trace the switch */
     Pcr->ContextSwitches++;
     NewThread->ContextSwitches++;
+    KiSchedTraceContextSwitch(OldThread, NewThread);
+    WmiTraceContextSwitch(OldThread, NewThread);
 
     /* DPCs shouldn't be active */
     if (Pcr->Prcb.DpcRoutineActive)
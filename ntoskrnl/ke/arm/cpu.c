@@ -140,6 +140,38 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
     KeLowerIrql(OldIrql);
 }
 
+VOID
+NTAPI
+KeFlushMultipleTb(IN ULONG Number,
+                  IN PVOID *VirtualAddresses,
+                  IN BOOLEAN AllProcessors)
+{
+    KIRQL OldIrql;
+    ULONG i;
+
+    //
+    // Raise the IRQL for the TB Flush
+    //
+    OldIrql = KeRaiseIrqlToSynchLevel();
+
+    //
+    // Flush the entries, or the whole TB, for the Current CPU
+    //
+    if (VirtualAddresses)
+    {
+        for (i = 0; i < Number; i++) KeInvalidateTlbEntry(VirtualAddresses[i]);
+    }
+    else
+    {
+        KeFlushCurrentTb();
+    }
+
+    //
+    // Return to Original IRQL
+    //
+    KeLowerIrql(OldIrql);
+}
+
 /*
  * @implemented
  */
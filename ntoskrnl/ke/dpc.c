@@ -20,14 +20,247 @@ ULONG KiMaximumDpcQueueDepth = 4;
 ULONG KiMinimumDpcRate = 3;
 ULONG KiAdjustDpcThreshold = 20;
 ULONG KiIdealDpcRate = 20;
-BOOLEAN KeThreadDpcEnable;
+ULONG KeThreadDpcEnable = TRUE;
 FAST_MUTEX KiGenericCallDpcMutex;
 KDPC KiTimerExpireDpc;
 ULONG KiTimeLimitIsrMicroseconds;
 ULONG KiDPCTimeout = 110;
 
+//
+// Optional per-processor DPC timing: how often each deferred routine ran and
+// for how long. Normal and threaded DPCs are kept apart so that each table
+// only has a single writer.
+//
+#define KI_DPC_TIMING_ENTRIES   64
+#define KI_DPC_TIMING_PROBES    8
+
+typedef struct _KI_DPC_TIMING_ENTRY
+{
+    PKDEFERRED_ROUTINE Routine;
+    ULONG Count;
+    ULONGLONG TotalTime;
+    ULONGLONG MaxTime;
+} KI_DPC_TIMING_ENTRY, *PKI_DPC_TIMING_ENTRY;
+
+typedef struct _KI_DPC_TIMING
+{
+    KI_DPC_TIMING_ENTRY Entries[2][KI_DPC_TIMING_ENTRIES];
+    ULONG Dropped[2];
+} KI_DPC_TIMING, *PKI_DPC_TIMING;
+
+ULONG KiDpcTimingEnabled;
+static PKI_DPC_TIMING KiDpcTiming[MAXIMUM_PROCESSORS];
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
+FORCEINLINE
+ULONGLONG
+KiDpcTimestamp(VOID)
+{
+#if defined(_M_IX86) || defined(_M_AMD64)
+    return __rdtsc();
+#else
+    /* DPC times aren't tracked here */
+    return 0;
+#endif
+}
+
+static
+VOID
+KiRecordDpcTime(IN PKI_DPC_TIMING Timing,
+                IN ULONG Type,
+                IN PKDEFERRED_ROUTINE Routine,
+                IN ULONGLONG Time)
+{
+    PKI_DPC_TIMING_ENTRY Entry;
+    ULONG Hash, i;
+
+    /* Look up the routine, or a free entry for it */
+    Hash = (ULONG)((ULONG_PTR)Routine >> 4);
+    for (i = 0; i < KI_DPC_TIMING_PROBES; i++)
+    {
+        Entry = &Timing->Entries[Type][(Hash + i) & (KI_DPC_TIMING_ENTRIES - 1)];
+        if (Entry->Routine == Routine) break;
+        if (!Entry->Routine)
+        {
+            Entry->Routine = Routine;
+            break;
+        }
+    }
+
+    /* The table is too crowded around this routine */
+    if (i == KI_DPC_TIMING_PROBES)
+    {
+        Timing->Dropped[Type]++;
+        return;
+    }
+
+    /* Account for this run */
+    Entry->Count++;
+    Entry->TotalTime += Time;
+    if (Time > Entry->MaxTime) Entry->MaxTime = Time;
+}
+
+static
+VOID
+NTAPI
+KiExecuteDpc(IN PVOID Context)
+{
+    PKPRCB Prcb;
+    PKDPC_DATA DpcData;
+    PLIST_ENTRY DpcEntry;
+    PKDPC Dpc;
+    PKDEFERRED_ROUTINE DeferredRoutine;
+    PVOID DeferredContext, SystemArgument1, SystemArgument2;
+    PKI_DPC_TIMING Timing;
+    ULONGLONG StartTime = 0;
+    KIRQL OldIrql;
+
+    /* Stick to our processor and preempt anything else running there */
+    KeSetSystemAffinityThread(AFFINITY_MASK((ULONG_PTR)Context));
+    KeSetPriorityThread(KeGetCurrentThread(), HIGH_PRIORITY);
+    Prcb = KeGetCurrentPrcb();
+    ASSERT(Prcb->Number == (ULONG_PTR)Context);
+    DpcData = &Prcb->DpcData[DPC_THREADED];
+
+    /* We're ready, threaded DPCs can be queued to us from now on */
+    Prcb->DpcThread = KeGetCurrentThread();
+    KeMemoryBarrier();
+    Prcb->ThreadDpcEnable = TRUE;
+
+    for (;;)
+    {
+        /* Wait until a threaded DPC gets queued */
+        KeWaitForSingleObject(&Prcb->DpcEvent,
+                              Suspended,
+                              KernelMode,
+                              FALSE,
+                              NULL);
+
+        do
+        {
+            /* Set us as active */
+            Prcb->DpcThreadActive = TRUE;
+
+            /* Loop while we have entries in the queue */
+            while (DpcData->DpcQueueDepth != 0)
+            {
+                /* Lock the DPC data the same way KeInsertQueueDpc does */
+                KeRaiseIrql(HIGH_LEVEL, &OldIrql);
+                KiAcquireSpinLock(&DpcData->DpcLock);
+
+                /* Make sure we have an entry */
+                DpcEntry = DpcData->DpcListHead.Flink;
+                if (DpcEntry == &DpcData->DpcListHead)
+                {
+                    /* It got removed behind our back */
+                    KiReleaseSpinLock(&DpcData->DpcLock);
+                    KeLowerIrql(OldIrql);
+                    break;
+                }
+
+                /* Remove the DPC from the list */
+                RemoveEntryList(DpcEntry);
+                Dpc = CONTAINING_RECORD(DpcEntry, KDPC, DpcListEntry);
+
+                /* Clear its DPC data and save its parameters */
+                Dpc->DpcData = NULL;
+                DeferredRoutine = Dpc->DeferredRoutine;
+                DeferredContext = Dpc->DeferredContext;
+                SystemArgument1 = Dpc->SystemArgument1;
+                SystemArgument2 = Dpc->SystemArgument2;
+
+                /* Decrease the queue depth and release the lock */
+                DpcData->DpcQueueDepth--;
+                KiReleaseSpinLock(&DpcData->DpcLock);
+                KeLowerIrql(OldIrql);
+
+                /* Call the DPC at passive level, timing it if asked to */
+                Timing = KiDpcTiming[Prcb->Number];
+                if (Timing) StartTime = KiDpcTimestamp();
+                DeferredRoutine(Dpc,
+                                DeferredContext,
+                                SystemArgument1,
+                                SystemArgument2);
+                ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+                if (Timing)
+                {
+                    KiRecordDpcTime(Timing,
+                                    DPC_THREADED,
+                                    DeferredRoutine,
+                                    KiDpcTimestamp() - StartTime);
+                }
+            }
+
+            //
+            // Go inactive before checking the queue one last time, so that a
+            // DPC queued in between either sees us active or gets noticed
+            //
+            Prcb->DpcThreadActive = FALSE;
+            Prcb->DpcThreadRequested = FALSE;
+            KeMemoryBarrier();
+        } while (DpcData->DpcQueueDepth != 0);
+    }
+}
+
+VOID
+NTAPI
+INIT_FUNCTION
+KiInitializeDpcTiming(VOID)
+{
+    PKI_DPC_TIMING Timing;
+    ULONG i;
+
+    /* Allocate the timing tables of every processor */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Timing = ExAllocatePoolWithTag(NonPagedPool,
+                                       sizeof(KI_DPC_TIMING),
+                                       TAG_DPC_TIMING);
+        if (!Timing)
+        {
+            DPRINT1("No memory for the DPC timing of CPU %lu\n", i);
+            continue;
+        }
+
+        RtlZeroMemory(Timing, sizeof(KI_DPC_TIMING));
+        KiDpcTiming[i] = Timing;
+    }
+}
+
+VOID
+NTAPI
+INIT_FUNCTION
+KiStartDpcThreads(VOID)
+{
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+    ULONG i;
+
+    //
+    // Create the DPC thread of every processor. Until its thread is up, or
+    // if it couldn't be created, a processor runs threaded DPCs like normal
+    // ones.
+    //
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Status = PsCreateSystemThread(&ThreadHandle,
+                                      THREAD_ALL_ACCESS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      KiExecuteDpc,
+                                      (PVOID)(ULONG_PTR)i);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to create the DPC thread of CPU %lu: 0x%lx\n", i, Status);
+            continue;
+        }
+
+        ZwClose(ThreadHandle);
+    }
+}
+
 VOID
 NTAPI
 KiCheckTimerTable(IN ULARGE_INTEGER CurrentTime)
@@ -131,6 +364,15 @@ KiTimerExpiration(IN PKDPC Dpc,
         /* Get the current index */
         Index = (Index + 1) & (TIMER_TABLE_SIZE - 1);
 
+        /* Check if far timers of this hand are coming due */
+        if (KiTimerFarTableListHead[Index].Time.QuadPart <= InterruptTime.QuadPart)
+        {
+            /* Move them to the near list, so the loop below expires them */
+            LockQueue = KiAcquireTimerLock(Index);
+            KiCascadeTimerTable(Index, InterruptTime.QuadPart);
+            KiReleaseTimerLock(LockQueue);
+        }
+
         /* Get list pointers and loop the list */
         ListHead = &KiTimerTableListHead[Index].Entry;
         while (ListHead != ListHead->Flink)
@@ -254,10 +496,11 @@ KiTimerExpiration(IN PKDPC Dpc,
                     ASSERT(KiTimerTableListHead[Index].Time.QuadPart <=
                            Timer->DueTime.QuadPart);
 
-                    /* Update the time */
+                    /* Update the time, unless a far timer comes due first */
                     _disable();
                     KiTimerTableListHead[Index].Time.QuadPart =
-                        Timer->DueTime.QuadPart;
+                        min(Timer->DueTime.QuadPart,
+                            KiTimerFarTableListHead[Index].Time.QuadPart);
                     _enable();
                 }
 
@@ -566,6 +809,8 @@ KiRetireDpcList(IN PKPRCB Prcb)
     PKDEFERRED_ROUTINE DeferredRoutine;
     PVOID DeferredContext, SystemArgument1, SystemArgument2;
     ULONG_PTR TimerHand;
+    PKI_DPC_TIMING Timing;
+    ULONGLONG StartTime = 0;
 #ifdef CONFIG_SMP
     KIRQL OldIrql;
 #endif
@@ -573,6 +818,7 @@ KiRetireDpcList(IN PKPRCB Prcb)
     /* Get data and list variables before starting anything else */
     DpcData = &Prcb->DpcData[DPC_NORMAL];
     ListHead = &DpcData->DpcListHead;
+    Timing = KiDpcTiming[Prcb->Number];
 
     /* Main outer loop */
     do
@@ -580,6 +826,17 @@ KiRetireDpcList(IN PKPRCB Prcb)
         /* Set us as active */
         Prcb->DpcRoutineActive = TRUE;
 
+        /* Wake up the DPC thread if a threaded DPC was queued */
+        if (Prcb->DpcSetEventRequest)
+        {
+            _enable();
+            if (InterlockedExchange(&Prcb->DpcSetEventRequest, 0))
+            {
+                KeSetEvent(&Prcb->DpcEvent, 0, FALSE);
+            }
+            _disable();
+        }
+
         /* Check if this is a timer expiration request */
         if (Prcb->TimerRequest)
         {
@@ -628,12 +885,20 @@ KiRetireDpcList(IN PKPRCB Prcb)
                 /* Re-enable interrupts */
                 _enable();
 
-                /* Call the DPC */
+                /* Call the DPC, timing it if asked to */
+                if (Timing) StartTime = KiDpcTimestamp();
                 DeferredRoutine(Dpc,
                                 DeferredContext,
                                 SystemArgument1,
                                 SystemArgument2);
                 ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+                if (Timing)
+                {
+                    KiRecordDpcTime(Timing,
+                                    DPC_NORMAL,
+                                    DeferredRoutine,
+                                    KiDpcTimestamp() - StartTime);
+                }
 
                 /* Disable interrupts and keep looping */
                 _disable();
@@ -796,8 +1061,17 @@ KeInsertQueueDpc(IN PKDPC Dpc,
             /* Make sure a threaded DPC isn't already active */
             if (!(Prcb->DpcThreadActive) && !(Prcb->DpcThreadRequested))
             {
-                /* FIXME: Setup Threaded DPC */
-                UNIMPLEMENTED_FATAL("Threaded DPC not supported\n");
+                //
+                // Have the DPC thread signaled from the dispatch interrupt,
+                // which also gets it to preempt the current thread
+                //
+                InterlockedExchange(&Prcb->DpcSetEventRequest, TRUE);
+                Prcb->DpcThreadRequested = TRUE;
+                Prcb->QuantumEnd = TRUE;
+                KeMemoryBarrier();
+
+                /* Set DPC inserted */
+                DpcInserted = TRUE;
             }
         }
         else
@@ -1031,4 +1305,54 @@ KeSignalCallDpcSynchronize(IN PVOID SystemArgument2)
     return TRUE;
 }
 
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtDpcs(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    PKI_DPC_TIMING Timing;
+    PKI_DPC_TIMING_ENTRY Entry;
+    ULONG i, j, Type;
+
+    KdbpPrint("Threaded DPCs are %s, DPC timing is %s\n",
+              KeThreadDpcEnable ? "enabled" : "disabled",
+              KiDpcTimingEnabled ? "on" : "off");
+    KdbpPrint("CPU  Routine   Type        Count          Total        Average            Max\n");
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Timing = KiDpcTiming[i];
+        if (!Timing) continue;
+
+        for (Type = DPC_NORMAL; Type <= DPC_THREADED; Type++)
+        {
+            for (j = 0; j < KI_DPC_TIMING_ENTRIES; j++)
+            {
+                Entry = &Timing->Entries[Type][j];
+                if (!Entry->Count) continue;
+
+                KdbpPrint("%3lu  %p  %-8s  %8lu  %13I64u  %13I64u  %13I64u\n",
+                          i,
+                          Entry->Routine,
+                          (Type == DPC_THREADED) ? "threaded" : "normal",
+                          Entry->Count,
+                          Entry->TotalTime,
+                          Entry->TotalTime / Entry->Count,
+                          Entry->MaxTime);
+            }
+
+            if (Timing->Dropped[Type])
+            {
+                KdbpPrint("%3lu  %lu %s samples dropped\n",
+                          i,
+                          Timing->Dropped[Type],
+                          (Type == DPC_THREADED) ? "threaded" : "normal");
+            }
+        }
+    }
+
+    return TRUE;
+}
+#endif
+
 /* EOF */
@@ -1129,12 +1129,24 @@ KeInvalidateAllCaches(VOID)
     return TRUE;
 }
 
+VOID
+FASTCALL
+KiZeroPagesNonTemporal(IN PVOID Address,
+                       IN ULONG Size);
+
 VOID
 FASTCALL
 KeZeroPages(IN PVOID Address,
             IN ULONG Size)
 {
-    /* Not using XMMI in this routine */
+    /* Use non-temporal stores if we have SSE2, so we don't thrash the caches */
+    if ((KeFeatureBits & KF_XMMI64) && !(Size & 63))
+    {
+        KiZeroPagesNonTemporal(Address, Size);
+        return;
+    }
+
+    /* Otherwise use a normal memset */
     RtlZeroMemory(Address, Size);
 }
 
@@ -1436,11 +1448,35 @@ KiFlushTargetEntireTb(IN PKIPI_CONTEXT PacketContext,
                       IN PVOID Ignored2,
                       IN PVOID Ignored3)
 {
+    /* Flush the TB for the Current CPU before the sender gets to go on */
+    KeFlushCurrentTb();
+
     /* Signal this packet as done */
     KiIpiSignalPacketDone(PacketContext);
+}
 
-    /* Flush the TB for the Current CPU */
-    KeFlushCurrentTb();
+VOID
+NTAPI
+KiFlushTargetMultipleTb(IN PKIPI_CONTEXT PacketContext,
+                        IN PVOID Ignored,
+                        IN PVOID VirtualAddresses,
+                        IN PVOID Number)
+{
+    PVOID *Va = VirtualAddresses;
+    ULONG i;
+
+    /* Flush the entries first, the sender's list is only valid until we're done */
+    if (Va)
+    {
+        for (i = 0; i < *(PULONG)Number; i++) KeInvalidateTlbEntry(Va[i]);
+    }
+    else
+    {
+        KeFlushCurrentTb();
+    }
+
+    /* Signal this packet as done */
+    KiIpiSignalPacketDone(PacketContext);
 }
 
 /*
@@ -1454,7 +1490,7 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
     KIRQL OldIrql;
 #ifdef CONFIG_SMP
     KAFFINITY TargetAffinity;
-    PKPRCB Prcb = KeGetCurrentPrcb();
+    PKPRCB Prcb;
 #endif
 
     /* Raise the IRQL for the TB Flush */
@@ -1463,6 +1499,9 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
 #ifdef CONFIG_SMP
     /* FIXME: Use KiTbFlushTimeStamp to synchronize TB flush */
 
+    /* We can't move to another processor anymore */
+    Prcb = KeGetCurrentPrcb();
+
     /* Get the current processor affinity, and exclude ourselves */
     TargetAffinity = KeActiveProcessors;
     TargetAffinity &= ~Prcb->SetMember;
@@ -1489,8 +1528,8 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
         /* Sanity check */
         ASSERT(Prcb == KeGetCurrentPrcb());
 
-        /* FIXME: TODO */
-        ASSERTMSG("Not yet implemented\n", FALSE);
+        /* Wait for the other processors to flush */
+        KiIpiStallOnPacketTargets();
     }
 #endif
 
@@ -1499,6 +1538,87 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
     KeLowerIrql(OldIrql);
 }
 
+/*++
+ * @name KeFlushMultipleTb
+ *
+ *     Flushes a batch of TB entries with a single IPI to each processor that
+ *     may have them cached.
+ *
+ * @param Number
+ *        Number of addresses in VirtualAddresses.
+ *
+ * @param VirtualAddresses
+ *        Addresses to flush. If NULL, the whole TB of the targets is flushed.
+ *
+ * @param AllProcessors
+ *        TRUE for system addresses. Otherwise only the processors currently
+ *        running the current address space are flushed.
+ *
+ *--*/
+VOID
+NTAPI
+KeFlushMultipleTb(IN ULONG Number,
+                  IN PVOID *VirtualAddresses,
+                  IN BOOLEAN AllProcessors)
+{
+    KIRQL OldIrql;
+    ULONG i;
+#ifdef CONFIG_SMP
+    KAFFINITY TargetAffinity;
+    PKPRCB Prcb;
+#endif
+
+    /* Raise the IRQL for the TB Flush */
+    OldIrql = KeRaiseIrqlToSynchLevel();
+
+#ifdef CONFIG_SMP
+    //
+    // Other processors running this address space are the only ones, besides
+    // us, that can have its entries cached: the others flushed them when they
+    // switched away from it
+    //
+    Prcb = KeGetCurrentPrcb();
+    if (AllProcessors)
+    {
+        TargetAffinity = KeActiveProcessors;
+    }
+    else
+    {
+        TargetAffinity = KeGetCurrentThread()->ApcState.Process->ActiveProcessors;
+    }
+    TargetAffinity &= ~Prcb->SetMember;
+
+    /* Make sure this is MP */
+    if (TargetAffinity)
+    {
+        /* Send one IPI for the whole batch */
+        KiIpiSendPacket(TargetAffinity,
+                        KiFlushTargetMultipleTb,
+                        NULL,
+                        (ULONG_PTR)VirtualAddresses,
+                        &Number);
+    }
+#endif
+
+    /* Flush the TB for the Current CPU */
+    if (VirtualAddresses)
+    {
+        for (i = 0; i < Number; i++) KeInvalidateTlbEntry(VirtualAddresses[i]);
+    }
+    else
+    {
+        KeFlushCurrentTb();
+    }
+
+#ifdef CONFIG_SMP
+    /* If this is MP, wait for the other processors to finish */
+    if (TargetAffinity) KiIpiStallOnPacketTargets();
+#endif
+
+    /* Return to original IRQL */
+    KeLowerIrql(OldIrql);
+}
+
 /*
  * @implemented
  */
@@ -55,13 +55,52 @@ Ki386EnableGlobalPage(IN ULONG_PTR Context)
     return 0;
 }
 
+/* Set once every processor uses the PAT layout below */
+BOOLEAN KiPatInitialized;
+
+INIT_SECTION
+ULONG_PTR
+NTAPI
+Ki386EnablePAT(IN ULONG_PTR Context)
+{
+    BOOLEAN Enable;
+
+    /* Disable interrupts */
+    Enable = KeDisableInterrupts();
+
+    /* Don't let cached lines of the old memory types survive the switch */
+    __wbinvd();
+    __writemsr(MSR_PAT, *(PULONGLONG)Context);
+
+    /* Flush the TLB and the caches again */
+    __writecr3(__readcr3());
+    __wbinvd();
+
+    /* Restore interrupts and return */
+    KeRestoreInterrupts(Enable);
+    return 0;
+}
+
 VOID
 NTAPI
 INIT_FUNCTION
 KiInitializePAT(VOID)
 {
-    /* FIXME: Support this */
-    DPRINT("PAT support detected but not yet taken advantage of\n");
+    ULONGLONG Pat;
+
+    /*
+     * Same layout as on AMD64: entries 0, 2 and 3 keep their power-on
+     * meaning (WB, UC-, UC) for PWT/PCD, entry 1 is write combining instead
+     * of write through, and the upper half mirrors the lower one.
+     */
+    Pat = (PAT_WB << 0)  | (PAT_WC << 8) | (PAT_UCM << 16) | (PAT_UC << 24) |
+          (PAT_WB << 32) | (PAT_WC << 40) | (PAT_UCM << 48) | (PAT_UC << 56);
+
+    /* Do an IPI to program it on all CPUs */
+    KeIpiGenericCall(Ki386EnablePAT, (ULONG_PTR)&Pat);
+    KiPatInitialized = TRUE;
+
+    DPRINT("PAT initialized, write combining is available\n");
 }
 
 ULONG_PTR
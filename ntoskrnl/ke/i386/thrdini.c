@@ -284,6 +284,7 @@ KiIdleLoop(VOID)
 
         /* Check for pending timers, pending DPCs, or pending ready threads */
         if ((Prcb->DpcData[0].DpcQueueDepth) ||
+            (Prcb->DpcSetEventRequest) ||
             (Prcb->TimerRequest) ||
             (Prcb->DeferredReadyListHead.Next))
         {
@@ -294,9 +295,20 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+        /* Check if we should look for work on the other processors */
+        if (Prcb->IdleSchedule)
+        {
+            _enable();
+            KiIdleSchedule(Prcb);
+            _disable();
+        }
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
+            /* Restore the normal clock period if it was stretched */
+            if (KiDynamicTickActive) KiExitDynamicTick();
+
             /* Enable interrupts */
             _enable();
 
@@ -316,6 +328,9 @@ KiIdleLoop(VOID)
         }
         else
         {
+            /* Stretch the clock period if the whole system is idle */
+            KiEnterDynamicTick(Prcb);
+
             /* Continue staying idle. Note the HAL returns with interrupts on */
             Prcb->PowerState.IdleFunction(&Prcb->PowerState);
         }
@@ -434,6 +449,8 @@ KiSwapContextEntry(IN PKSWITCHFRAME SwitchFrame,
     /* Get thread pointers */
     OldThread = (PKTHREAD)(OldThreadAndApcFlag & ~3);
     NewThread = Pcr->PrcbData.CurrentThread;
+    KiSchedTraceContextSwitch(OldThread, NewThread);
+    WmiTraceContextSwitch(OldThread, NewThread);
 
     /* Get the old thread and set its kernel stack */
     OldThread->KernelStack = SwitchFrame;
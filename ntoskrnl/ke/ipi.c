@@ -34,8 +34,21 @@ FASTCALL
 KiIpiSend(IN KAFFINITY TargetProcessors,
           IN ULONG IpiRequest)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    KAFFINITY Processors;
+    ULONG i;
+
+    /* Post the request to every target, then interrupt them all at once */
+    for (i = 0, Processors = TargetProcessors; Processors; i++, Processors >>= 1)
+    {
+        if (Processors & 1)
+        {
+            InterlockedBitTestAndSet((PLONG)&KiProcessorBlock[i]->IpiFrozen, IpiRequest);
+        }
+    }
+
+    HalRequestIpi(TargetProcessors);
+#endif
 }
 
 VOID
@@ -46,16 +59,78 @@ KiIpiSendPacket(IN KAFFINITY TargetProcessors,
                 IN ULONG_PTR Context,
                 IN PULONG Count)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    PKPRCB Prcb, TargetPrcb;
+    KAFFINITY Processors;
+    ULONG i;
+
+    /* We must not get rescheduled while the packet is in flight */
+    ASSERT(KeGetCurrentIrql() >= SYNCH_LEVEL);
+    Prcb = KeGetCurrentPrcb();
+    ASSERT((TargetProcessors & Prcb->SetMember) == 0);
+
+    /* Fill out the packet, and mark all the targets as pending */
+    Prcb->WorkerRoutine = WorkerFunction;
+    Prcb->CurrentPacket[0] = BroadcastFunction;
+    Prcb->CurrentPacket[1] = (PVOID)Context;
+    Prcb->CurrentPacket[2] = Count;
+    Prcb->TargetSet = TargetProcessors;
+    KeMemoryBarrier();
+
+    for (i = 0, Processors = TargetProcessors; Processors; i++, Processors >>= 1)
+    {
+        if (!(Processors & 1)) continue;
+
+        //
+        // Wait for the target to pick up any packet another processor sent it
+        // earlier. We are below IPI_LEVEL, so we keep servicing the packets
+        // sent to us while we wait.
+        //
+        TargetPrcb = KiProcessorBlock[i];
+        while (InterlockedCompareExchangePointer((PVOID*)&TargetPrcb->SignalDone,
+                                                 Prcb,
+                                                 NULL))
+        {
+            YieldProcessor();
+        }
+
+        //
+        // Interrupt it right away: holding on to its packet slot while we
+        // claim the slots of the other targets could deadlock with another
+        // sender doing the same
+        //
+        InterlockedBitTestAndSet((PLONG)&TargetPrcb->IpiFrozen, IPI_PACKET_READY);
+        HalRequestIpi(AFFINITY_MASK(i));
+    }
+#endif
 }
 
 VOID
 FASTCALL
 KiIpiSignalPacketDone(IN PKIPI_CONTEXT PacketContext)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    PKPRCB Prcb = (PKPRCB)PacketContext;
+
+    /* Take ourselves out of the targets of the sender */
+    InterlockedBitTestAndReset((PLONG)&Prcb->TargetSet, KeGetCurrentProcessorNumber());
+#endif
+}
+
+VOID
+FASTCALL
+KiIpiStallOnPacketTargets(VOID)
+{
+#ifdef CONFIG_SMP
+    PKPRCB Prcb = KeGetCurrentPrcb();
+
+    /* Wait for all the targets of our packet to signal it done */
+    while (Prcb->TargetSet)
+    {
+        YieldProcessor();
+        KeMemoryBarrierWithoutFence();
+    }
+#endif
 }
 
 VOID
@@ -165,6 +240,21 @@ KiIpiServiceRoutine(IN PKTRAP_FRAME TrapFrame,
         HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
     }
 
+#ifndef _M_ARM
+    if (InterlockedBitTestAndReset((PLONG)&Prcb->IpiFrozen, IPI_PACKET_READY))
+    {
+        PKPRCB SourcePrcb = (PKPRCB)Prcb->SignalDone;
+        PKIPI_WORKER WorkerRoutine = SourcePrcb->WorkerRoutine;
+        PVOID Parameter1 = SourcePrcb->CurrentPacket[0];
+        PVOID Parameter2 = SourcePrcb->CurrentPacket[1];
+        PVOID Parameter3 = SourcePrcb->CurrentPacket[2];
+
+        /* We have the packet, let the next sender in and run it */
+        InterlockedExchangePointer((PVOID*)&Prcb->SignalDone, NULL);
+        WorkerRoutine(SourcePrcb, Parameter1, Parameter2, Parameter3);
+    }
+#endif
+
     if (InterlockedBitTestAndReset((PLONG)&Prcb->IpiFrozen, IPI_SYNCH_REQUEST))
     {
 #ifdef _M_ARM
@@ -93,6 +93,9 @@ KiInitSystem(VOID)
         InitializeListHead(&KiTimerTableListHead[i].Entry);
         KiTimerTableListHead[i].Time.HighPart = 0xFFFFFFFF;
         KiTimerTableListHead[i].Time.LowPart = 0;
+        InitializeListHead(&KiTimerFarTableListHead[i].Entry);
+        KiTimerFarTableListHead[i].Time.HighPart = 0xFFFFFFFF;
+        KiTimerFarTableListHead[i].Time.LowPart = 0;
     }
 
     /* Initialize the Swap event and all swap lists */
@@ -204,6 +207,11 @@ KiInitSpinLocks(IN PKPRCB Prcb,
     KeInitializeSpinLock(&Prcb->DpcData[DPC_NORMAL].DpcLock);
     Prcb->DpcData[DPC_NORMAL].DpcQueueDepth = 0;
     Prcb->DpcData[DPC_NORMAL].DpcCount = 0;
+    InitializeListHead(&Prcb->DpcData[DPC_THREADED].DpcListHead);
+    KeInitializeSpinLock(&Prcb->DpcData[DPC_THREADED].DpcLock);
+    Prcb->DpcData[DPC_THREADED].DpcQueueDepth = 0;
+    Prcb->DpcData[DPC_THREADED].DpcCount = 0;
+    KeInitializeEvent(&Prcb->DpcEvent, SynchronizationEvent, FALSE);
     Prcb->DpcRoutineActive = FALSE;
     Prcb->MaximumDpcQueueDepth = KiMaximumDpcQueueDepth;
     Prcb->MinimumDpcRate = KiMinimumDpcRate;
@@ -292,11 +300,14 @@ NTAPI
 INIT_FUNCTION
 KeInitSystem(VOID)
 {
+    /* Allocate the DPC timing tables if asked to */
+    if (KiDpcTimingEnabled) KiInitializeDpcTiming();
+
     /* Check if Threaded DPCs are enabled */
     if (KeThreadDpcEnable)
     {
-        /* FIXME: TODO */
-        DPRINT1("Threaded DPCs not yet supported\n");
+        /* Start the DPC threads */
+        KiStartDpcThreads();
     }
 
     /* Initialize non-portable parts of the kernel */
@@ -12,6 +12,22 @@
 #define NDEBUG
 #include <debug.h>
 
+/* Number of samples in the per-processor stack profiler rings */
+#define KI_STACK_PROFILE_SHIFT      10
+#define KI_STACK_PROFILE_ENTRIES    (1 << KI_STACK_PROFILE_SHIFT)
+
+//
+// Per-processor stack profiler ring. Only the profile interrupt of the owning
+// processor writes to it and it doesn't nest, so like the scheduler trace the
+// write index needs no interlocked operations.
+//
+typedef struct _KI_STACK_PROFILE_RING
+{
+    volatile ULONG WriteIndex;
+    ULONG ReadIndex;
+    SYSDBG_STACK_PROFILE_ENTRY Entries[KI_STACK_PROFILE_ENTRIES];
+} KI_STACK_PROFILE_RING, *PKI_STACK_PROFILE_RING;
+
 /* GLOBALS *******************************************************************/
 
 KIRQL KiProfileIrql = PROFILE_LEVEL;
@@ -21,6 +37,16 @@ KSPIN_LOCK KiProfileLock;
 ULONG KiProfileTimeInterval = 78125; /* Default resolution 7.8ms (sysinternals) */
 ULONG KiProfileAlignmentFixupInterval;
 
+//
+// The stack profiler records the kernel and user call stack of whatever each
+// processor is running on every profile interrupt, independently of the
+// profile objects. It is drained through NtSystemDebugControl. The rings are
+// allocated the first time it is enabled and never freed.
+//
+ULONG KiStackProfileEnabled;
+static PKI_STACK_PROFILE_RING KiStackProfileRings[MAXIMUM_PROCESSORS];
+static LONG KiStackProfileReaderActive;
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -201,8 +227,9 @@ KeStopProfile(IN PKPROFILE Profile)
     /* Release the profile lock */
     KeReleaseSpinLockFromDpcLevel(&KiProfileLock);
 
-    /* Stop the profile interrupt */
-    HalStopProfileInterrupt(Profile->Source);
+    /* Stop the profile interrupt, unless the stack profiler still needs it */
+    if (!KiStackProfileEnabled || (Profile->Source != ProfileTime))
+        HalStopProfileInterrupt(Profile->Source);
 
     /* Lower back to original IRQL */
     KeLowerIrql(OldIrql);
@@ -339,6 +366,175 @@ KiParseProfileList(IN PKTRAP_FRAME TrapFrame,
     }
 }
 
+static
+ULONG
+KiStackProfileKernelFrames(IN PKTRAP_FRAME TrapFrame,
+                           OUT PVOID *Frames,
+                           IN ULONG Count)
+{
+#ifdef _M_IX86
+    PKTHREAD Thread = KeGetCurrentThread();
+    PKPRCB Prcb = KeGetCurrentPrcb();
+    ULONG_PTR Frame, Next, Low, High;
+#endif
+    ULONG i = 0;
+
+    /* The interrupted instruction comes first */
+    Frames[i++] = (PVOID)KeGetTrapFramePc(TrapFrame);
+
+#ifdef _M_IX86
+    //
+    // Follow the EBP chain, but only within the stack the chain starts on:
+    // the thread's kernel stack or the DPC stack. Both are resident, so this
+    // can't fault, and the chain has to go up the stack or it is garbage.
+    //
+    Frame = TrapFrame->Ebp;
+    if ((Frame >= Thread->StackLimit) && (Frame < (ULONG_PTR)Thread->InitialStack))
+    {
+        Low = Thread->StackLimit;
+        High = (ULONG_PTR)Thread->InitialStack;
+    }
+    else if ((Prcb->DpcStack) &&
+             (Frame < (ULONG_PTR)Prcb->DpcStack) &&
+             (Frame >= (ULONG_PTR)Prcb->DpcStack - KERNEL_STACK_SIZE))
+    {
+        Low = (ULONG_PTR)Prcb->DpcStack - KERNEL_STACK_SIZE;
+        High = (ULONG_PTR)Prcb->DpcStack;
+    }
+    else
+    {
+        return i;
+    }
+
+    while (i < Count)
+    {
+        if ((Frame & (sizeof(ULONG_PTR) - 1)) ||
+            (Frame < Low) ||
+            (Frame + 2 * sizeof(ULONG_PTR) > High))
+        {
+            break;
+        }
+
+        Next = ((PULONG_PTR)Frame)[0];
+        Frames[i++] = (PVOID)((PULONG_PTR)Frame)[1];
+        if (Next <= Frame) break;
+        Frame = Next;
+    }
+#endif
+
+    return i;
+}
+
+static
+ULONG
+KiStackProfileUserFrames(IN PKTRAP_FRAME TrapFrame,
+                         OUT PVOID *Frames,
+                         IN ULONG Count)
+{
+#ifdef _M_IX86
+    ULONG_PTR Frame, Next;
+#endif
+    ULONG i = 0;
+
+    if (!Count) return 0;
+#ifdef _M_IX86
+    if (TrapFrame->EFlags & EFLAGS_V86_MASK) return 0;
+#endif
+
+    /* The instruction the thread was at in user mode comes first */
+    Frames[i++] = (PVOID)KeGetTrapFramePc(TrapFrame);
+
+#ifdef _M_IX86
+    //
+    // We can't take a page fault at profile IRQL, so the user EBP chain is
+    // only followed as long as the frames are resident. The caller made sure
+    // the user part of the address space is the thread's own.
+    //
+    Frame = TrapFrame->Ebp;
+    while (i < Count)
+    {
+        if (!(Frame) ||
+            (Frame & (sizeof(ULONG_PTR) - 1)) ||
+            (Frame >= (ULONG_PTR)MmHighestUserAddress - 2 * sizeof(ULONG_PTR)) ||
+            !(MmIsAddressValid((PVOID)Frame)) ||
+            !(MmIsAddressValid((PVOID)(Frame + sizeof(ULONG_PTR)))))
+        {
+            break;
+        }
+
+        Next = ((PULONG_PTR)Frame)[0];
+        Frames[i++] = (PVOID)((PULONG_PTR)Frame)[1];
+        if (Next <= Frame) break;
+        Frame = Next;
+    }
+#endif
+
+    return i;
+}
+
+static
+VOID
+KiStackProfileRecord(IN PKTRAP_FRAME TrapFrame)
+{
+    PKI_STACK_PROFILE_RING Ring;
+    PSYSDBG_STACK_PROFILE_ENTRY Entry;
+    PKTHREAD Thread = KeGetCurrentThread();
+    PKTRAP_FRAME UserTrapFrame;
+    ULONG Processor, Index, KernelFrames;
+
+    /* A processor started after the profiler was enabled has no ring */
+    Processor = KeGetCurrentProcessorNumber();
+    Ring = KiStackProfileRings[Processor];
+    if (!Ring) return;
+
+    Index = Ring->WriteIndex;
+    Entry = &Ring->Entries[Index & (KI_STACK_PROFILE_ENTRIES - 1)];
+    Entry->TimeStamp = KeQueryInterruptTime();
+    Entry->Type = SYSDBG_STACK_PROFILE_SAMPLE;
+    Entry->Processor = (UCHAR)Processor;
+    Entry->ProcessId = HandleToUlong(CONTAINING_RECORD(Thread, ETHREAD, Tcb)->Cid.UniqueProcess);
+    Entry->ThreadId = HandleToUlong(CONTAINING_RECORD(Thread, ETHREAD, Tcb)->Cid.UniqueThread);
+    Entry->Reserved = 0;
+
+    if (KiUserTrap(TrapFrame))
+    {
+        /* Interrupted in user mode, there is no kernel stack to look at */
+        KernelFrames = 0;
+        UserTrapFrame = TrapFrame;
+    }
+    else
+    {
+        KernelFrames = KiStackProfileKernelFrames(TrapFrame,
+                                                  Entry->Frames,
+                                                  SYSDBG_STACK_PROFILE_FRAMES);
+
+        //
+        // The user stack is found through the trap frame the thread entered
+        // the kernel with. System threads don't have one, and an attached
+        // thread doesn't have its own user address space mapped.
+        //
+        UserTrapFrame = NULL;
+        if ((Thread->Teb) && (Thread->ApcStateIndex == OriginalApcEnvironment))
+        {
+            UserTrapFrame = KeGetTrapFrame(Thread);
+            if (!KiUserTrap(UserTrapFrame)) UserTrapFrame = NULL;
+        }
+    }
+
+    Entry->KernelFrames = (UCHAR)KernelFrames;
+    Entry->UserFrames = 0;
+    if (UserTrapFrame)
+    {
+        Entry->UserFrames = (UCHAR)KiStackProfileUserFrames(UserTrapFrame,
+                                                            &Entry->Frames[KernelFrames],
+                                                            SYSDBG_STACK_PROFILE_FRAMES - KernelFrames);
+    }
+
+    /* Publish it once it is complete */
+    KeMemoryBarrierWithoutFence();
+    Ring->WriteIndex = Index + 1;
+}
+
 /*
  * @implemented
  *
@@ -359,6 +555,10 @@ KeProfileInterruptWithSource(IN PKTRAP_FRAME TrapFrame,
     /* We have to parse 2 lists. Per-Process and System-Wide */
     KiParseProfileList(TrapFrame, Source, &Process->ProfileListHead);
     KiParseProfileList(TrapFrame, Source, &KiProfileListHead);
+
+    /* Take a stack sample if the stack profiler runs */
+    if ((KiStackProfileEnabled) && (Source == ProfileTime))
+        KiStackProfileRecord(TrapFrame);
 }
 
 /*
@@ -371,3 +571,336 @@ KeSetProfileIrql(IN KIRQL ProfileIrql)
     /* Set the IRQL at which Profiling will run */
     KiProfileIrql = ProfileIrql;
 }
+
+static
+ULONG_PTR
+NTAPI
+KiStackProfileStartWorker(IN ULONG_PTR Interval)
+{
+    /* The profile interrupt is per processor, program it on each of them */
+    if (Interval) KeSetIntervalProfile((ULONG)Interval, ProfileTime);
+    HalStartProfileInterrupt(ProfileTime);
+    return 0;
+}
+
+static
+ULONG_PTR
+NTAPI
+KiStackProfileStopWorker(IN ULONG_PTR Context)
+{
+    HalStopProfileInterrupt(ProfileTime);
+    return 0;
+}
+
+/*++
+ * @name KeSetStackProfile
+ *
+ *     Starts or stops the stack profiler on all processors. Starting it
+ *     throws away whatever was recorded before.
+ *
+ * @param Enable
+ *        TRUE to start sampling, FALSE to stop it.
+ *
+ * @param Interval
+ *        Profile interrupt interval in 100ns units when starting, zero to
+ *        keep the current one.
+ *
+ * @return STATUS_SUCCESS, STATUS_INSUFFICIENT_RESOURCES if the rings could
+ *         not be allocated, or STATUS_DEVICE_BUSY if the samples are being
+ *         read.
+ *
+ * @remarks The interval is shared with the profile objects using
+ *          ProfileTime. Stopping leaves the profile interrupt running if
+ *          such a profile object is started.
+ *
+ *--*/
+NTSTATUS
+NTAPI
+KeSetStackProfile(IN BOOLEAN Enable,
+                  IN ULONG Interval)
+{
+    PKI_STACK_PROFILE_RING Ring;
+    PLIST_ENTRY NextEntry;
+    BOOLEAN TimeSourceActive = FALSE;
+    KIRQL OldIrql;
+    ULONG i;
+    PAGED_CODE();
+
+    /* Don't move the read indexes under a reader */
+    if (InterlockedCompareExchange(&KiStackProfileReaderActive, 1, 0))
+    {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    if (!Enable)
+    {
+        if (KiStackProfileEnabled)
+        {
+            KiStackProfileEnabled = FALSE;
+
+            /* Check if a profile object still uses the interrupt */
+            KeRaiseIrql(KiProfileIrql, &OldIrql);
+            KeAcquireSpinLockAtDpcLevel(&KiProfileLock);
+            for (NextEntry = KiProfileSourceListHead.Flink;
+                 NextEntry != &KiProfileSourceListHead;
+                 NextEntry = NextEntry->Flink)
+            {
+                if (CONTAINING_RECORD(NextEntry,
+                                      KPROFILE_SOURCE_OBJECT,
+                                      ListEntry)->Source == ProfileTime)
+                {
+                    TimeSourceActive = TRUE;
+                    break;
+                }
+            }
+            KeReleaseSpinLockFromDpcLevel(&KiProfileLock);
+            KeLowerIrql(OldIrql);
+
+            if (!TimeSourceActive) KeIpiGenericCall(KiStackProfileStopWorker, 0);
+        }
+
+        InterlockedExchange(&KiStackProfileReaderActive, 0);
+        return STATUS_SUCCESS;
+    }
+
+    /* Stop sampling while we start over */
+    KiStackProfileEnabled = FALSE;
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        /* Allocate the rings we don't have yet */
+        Ring = KiStackProfileRings[i];
+        if (!Ring)
+        {
+            Ring = ExAllocatePoolWithTag(NonPagedPool,
+                                         sizeof(KI_STACK_PROFILE_RING),
+                                         TAG_STACK_PROFILE);
+            if (!Ring)
+            {
+                InterlockedExchange(&KiStackProfileReaderActive, 0);
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+            RtlZeroMemory(Ring, sizeof(KI_STACK_PROFILE_RING));
+            KiStackProfileRings[i] = Ring;
+        }
+
+        /* Skip what is already in there */
+        Ring->ReadIndex = Ring->WriteIndex;
+    }
+
+    KiStackProfileEnabled = TRUE;
+    KeIpiGenericCall(KiStackProfileStartWorker, Interval);
+
+    InterlockedExchange(&KiStackProfileReaderActive, 0);
+    return STATUS_SUCCESS;
+}
+
+/*++
+ * @name KeQueryStackProfile
+ *
+ *     Drains the stack profiler samples into the caller's buffer, one
+ *     processor after another. Samples that were overwritten before they
+ *     could be read are reported through a SYSDBG_STACK_PROFILE_LOST entry.
+ *
+ * @param Buffer
+ *        Array of SYSDBG_STACK_PROFILE_ENTRY receiving the samples. This can
+ *        be a user-mode buffer that was probed by the caller.
+ *
+ * @param BufferLength
+ *        Size of the buffer, in bytes.
+ *
+ * @param ReturnLength
+ *        Receives the number of bytes returned.
+ *
+ * @return STATUS_SUCCESS if everything was drained, STATUS_MORE_ENTRIES if
+ *         the buffer filled up first, STATUS_INFO_LENGTH_MISMATCH if it can't
+ *         hold a single sample, or STATUS_DEVICE_BUSY if another reader is
+ *         draining the samples.
+ *
+ *--*/
+NTSTATUS
+NTAPI
+KeQueryStackProfile(OUT PSYSDBG_STACK_PROFILE_ENTRY Buffer,
+                    IN ULONG BufferLength,
+                    OUT PULONG ReturnLength)
+{
+    PKI_STACK_PROFILE_RING Ring;
+    ULONG i, Read, Write, Count, Length = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PAGED_CODE();
+
+    *ReturnLength = 0;
+    if (BufferLength < sizeof(SYSDBG_STACK_PROFILE_ENTRY)) return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* There is only one read index per ring, so one reader at a time */
+    if (InterlockedCompareExchange(&KiStackProfileReaderActive, 1, 0))
+    {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    Count = BufferLength / sizeof(SYSDBG_STACK_PROFILE_ENTRY);
+    _SEH2_TRY
+    {
+        for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        {
+            Ring = KiStackProfileRings[i];
+            if (!Ring) continue;
+
+            /* Get the unread part, and check if the writer lapped us */
+            Write = Ring->WriteIndex;
+            Read = Ring->ReadIndex;
+            if ((Write - Read) > KI_STACK_PROFILE_ENTRIES)
+            {
+                if (!Count)
+                {
+                    Status = STATUS_MORE_ENTRIES;
+                    break;
+                }
+
+                /* Tell the reader how much it missed */
+                RtlZeroMemory(Buffer, sizeof(SYSDBG_STACK_PROFILE_ENTRY));
+                Buffer->Type = SYSDBG_STACK_PROFILE_LOST;
+                Buffer->Processor = (UCHAR)i;
+                Buffer->ThreadId = Write - Read - KI_STACK_PROFILE_ENTRIES;
+                Buffer++;
+                Count--;
+                Length += sizeof(SYSDBG_STACK_PROFILE_ENTRY);
+
+                Read = Write - KI_STACK_PROFILE_ENTRIES;
+            }
+
+            /* Copy as much as fits */
+            while ((Read != Write) && (Count))
+            {
+                *Buffer++ = Ring->Entries[Read & (KI_STACK_PROFILE_ENTRIES - 1)];
+                Read++;
+                Count--;
+                Length += sizeof(SYSDBG_STACK_PROFILE_ENTRY);
+            }
+
+            Ring->ReadIndex = Read;
+            if (Read != Write)
+            {
+                Status = STATUS_MORE_ENTRIES;
+                break;
+            }
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    InterlockedExchange(&KiStackProfileReaderActive, 0);
+    *ReturnLength = Length;
+    return Status;
+}
+
+#if DBG && defined(KDBG)
+#define KI_STACK_PROFILE_HOT_SPOTS  128
+
+static
+VOID
+KiStackProfilePrintFrame(IN PVOID Address)
+{
+    if (!KdbSymPrintAddress(Address, NULL))
+        KdbpPrint("<%p>", Address);
+    KdbpPrint("\n");
+}
+
+BOOLEAN
+ExpKdbgExtProfile(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    static struct
+    {
+        PVOID Address;
+        ULONG Count;
+    } HotSpots[KI_STACK_PROFILE_HOT_SPOTS];
+    PKI_STACK_PROFILE_RING Ring;
+    PSYSDBG_STACK_PROFILE_ENTRY Entry;
+    ULONG i, j, Index, Best, Used = 0, Total = 0, Other = 0, Count = 16;
+    BOOLEAN Stacks = FALSE;
+
+    if ((Argc > 1) && !(strcmp(Argv[1], "stacks")))
+    {
+        Stacks = TRUE;
+        Argc--;
+        Argv++;
+        Count = 4;
+    }
+    if (Argc > 1) Count = strtoul(Argv[1], NULL, 0);
+    if (Count > KI_STACK_PROFILE_ENTRIES) Count = KI_STACK_PROFILE_ENTRIES;
+
+    KdbpPrint("Stack profiler is %s, interval %lu x 100ns\n",
+              KiStackProfileEnabled ? "on" : "off",
+              KiProfileTimeInterval);
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Ring = KiStackProfileRings[i];
+        if (!Ring) continue;
+
+        /* Look at what the ring still holds, without consuming it */
+        Index = Ring->WriteIndex;
+        Index -= min(Index, Stacks ? Count : KI_STACK_PROFILE_ENTRIES);
+        for (; Index != Ring->WriteIndex; Index++)
+        {
+            Entry = &Ring->Entries[Index & (KI_STACK_PROFILE_ENTRIES - 1)];
+            if (Stacks)
+            {
+                KdbpPrint("CPU %lu  process %lx  thread %lx  time %I64u\n",
+                          i, Entry->ProcessId, Entry->ThreadId, Entry->TimeStamp);
+                for (j = 0; j < (ULONG)Entry->KernelFrames + Entry->UserFrames; j++)
+                {
+                    KdbpPrint("  %c ", (j < Entry->KernelFrames) ? 'k' : 'u');
+                    KiStackProfilePrintFrame(Entry->Frames[j]);
+                }
+                continue;
+            }
+
+            /* Count the samples by the instruction they interrupted */
+            Total++;
+            for (j = 0; j < Used; j++)
+            {
+                if (HotSpots[j].Address == Entry->Frames[0]) break;
+            }
+            if (j == Used)
+            {
+                if (Used == KI_STACK_PROFILE_HOT_SPOTS)
+                {
+                    Other++;
+                    continue;
+                }
+                HotSpots[Used].Address = Entry->Frames[0];
+                HotSpots[Used].Count = 0;
+                Used++;
+            }
+            HotSpots[j].Count++;
+        }
+    }
+
+    if (Stacks) return TRUE;
+
+    KdbpPrint("%lu samples, %lu at other addresses\n", Total, Other);
+    KdbpPrint("   Count    %%  Address\n");
+    while ((Count--) && (Used))
+    {
+        /* Print them from the hottest down */
+        Best = 0;
+        for (j = 1; j < Used; j++)
+        {
+            if (HotSpots[j].Count > HotSpots[Best].Count) Best = j;
+        }
+
+        KdbpPrint("%8lu  %3lu  ", HotSpots[Best].Count, HotSpots[Best].Count * 100 / Total);
+        KiStackProfilePrintFrame(HotSpots[Best].Address);
+
+        HotSpots[Best] = HotSpots[--Used];
+    }
+
+    return TRUE;
+}
+#endif
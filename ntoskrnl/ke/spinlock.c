@@ -15,8 +15,312 @@
 #define LQ_WAIT     1
 #define LQ_OWN      2
 
+/* Size of the per-processor profile tables, and how far we probe them */
+#define KI_SPINLOCK_PROFILE_SHIFT   9
+#define KI_SPINLOCK_PROFILE_ENTRIES (1 << KI_SPINLOCK_PROFILE_SHIFT)
+#define KI_SPINLOCK_PROFILE_PROBES  8
+
+/* Number of nested locks we track the hold time of */
+#define KI_SPINLOCK_PROFILE_DEPTH   8
+
+typedef struct _KI_SPINLOCK_HELD
+{
+    PKSPIN_LOCK SpinLock;
+    PSYSDBG_SPINLOCK_PROFILE_ENTRY Entry;
+    ULONGLONG AcquireTime;
+} KI_SPINLOCK_HELD, *PKI_SPINLOCK_HELD;
+
+typedef struct _KI_SPINLOCK_PROFILE
+{
+    ULONG Depth;
+    ULONG Dropped;
+    KI_SPINLOCK_HELD Held[KI_SPINLOCK_PROFILE_DEPTH];
+    SYSDBG_SPINLOCK_PROFILE_ENTRY Entries[KI_SPINLOCK_PROFILE_ENTRIES];
+} KI_SPINLOCK_PROFILE, *PKI_SPINLOCK_PROFILE;
+
+/* GLOBALS *******************************************************************/
+
+//
+// The spinlock profiler records, per processor and for each lock address and
+// caller, how often the lock was taken, how often and how long we had to spin
+// for it and how long it was held. It is off unless enabled from the registry
+// or through NtSystemDebugControl, and the tables are allocated the first time
+// it is enabled and never freed, so that a processor still updating its table
+// while the profiler is being turned off never touches freed memory.
+//
+BOOLEAN KiSpinLockProfileEnabled;
+ULONG KiSpinLockProfileAtBoot;
+static PKI_SPINLOCK_PROFILE KiSpinLockProfiles[MAXIMUM_PROCESSORS];
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
+FORCEINLINE
+ULONGLONG
+KiSpinLockProfileTimestamp(VOID)
+{
+#if defined(_M_IX86) || defined(_M_AMD64)
+    return __rdtsc();
+#else
+    /* Hold times aren't tracked here */
+    return 0;
+#endif
+}
+
+//
+// Spinlock acquire and release that go through the profiler when it is enabled
+//
+FORCEINLINE
+VOID
+KxAcquireSpinLockProfiled(IN PKSPIN_LOCK SpinLock,
+                          IN PVOID Caller)
+{
+    if (KiSpinLockProfileEnabled)
+        KiSpinLockProfileAcquire(SpinLock, Caller);
+    else
+        KxAcquireSpinLock(SpinLock);
+}
+
+FORCEINLINE
+VOID
+KxReleaseSpinLockProfiled(IN PKSPIN_LOCK SpinLock)
+{
+    if (KiSpinLockProfileEnabled)
+        KiSpinLockProfileRelease(SpinLock);
+    else
+        KxReleaseSpinLock(SpinLock);
+}
+
+static
+PSYSDBG_SPINLOCK_PROFILE_ENTRY
+KiSpinLockProfileFindEntry(IN PKI_SPINLOCK_PROFILE Profile,
+                           IN PKSPIN_LOCK SpinLock,
+                           IN PVOID Caller)
+{
+    PSYSDBG_SPINLOCK_PROFILE_ENTRY Entry;
+    ULONG Hash, i;
+
+    /* Hash the lock and the caller together */
+    Hash = (ULONG)((ULONG_PTR)SpinLock >> 2) ^ (ULONG)((ULONG_PTR)Caller >> 1);
+    Hash = (Hash * 0x9E3779B1) >> (32 - KI_SPINLOCK_PROFILE_SHIFT);
+
+    for (i = 0; i < KI_SPINLOCK_PROFILE_PROBES; i++)
+    {
+        Entry = &Profile->Entries[(Hash + i) & (KI_SPINLOCK_PROFILE_ENTRIES - 1)];
+        if ((Entry->SpinLock == SpinLock) && (Entry->Caller == Caller)) return Entry;
+
+        /* Take the first free entry */
+        if (!Entry->SpinLock)
+        {
+            Entry->SpinLock = SpinLock;
+            Entry->Caller = Caller;
+            Entry->Processor = KeGetCurrentProcessorNumber();
+            return Entry;
+        }
+    }
+
+    /* The table is too full around here */
+    Profile->Dropped++;
+    return NULL;
+}
+
+VOID
+FASTCALL
+KiSpinLockProfileAcquired(IN PKSPIN_LOCK SpinLock,
+                          IN PVOID Caller,
+                          IN ULONG Spins)
+{
+    PKI_SPINLOCK_PROFILE Profile;
+    PSYSDBG_SPINLOCK_PROFILE_ENTRY Entry;
+    BOOLEAN Enable;
+
+    Profile = KiSpinLockProfiles[KeGetCurrentProcessorNumber()];
+    if (!Profile) return;
+
+    /* Locks are also taken from interrupts, keep them out of the table */
+    Enable = KeDisableInterrupts();
+
+    Entry = KiSpinLockProfileFindEntry(Profile, SpinLock, Caller);
+    if (Entry)
+    {
+        Entry->AcquireCount++;
+        if (Spins)
+        {
+            Entry->ContentionCount++;
+            Entry->SpinCount += Spins;
+        }
+    }
+
+    /* Remember when we got it, forgetting the oldest lock if we're too deep */
+    if (Profile->Depth == KI_SPINLOCK_PROFILE_DEPTH)
+    {
+        RtlMoveMemory(&Profile->Held[0],
+                      &Profile->Held[1],
+                      (KI_SPINLOCK_PROFILE_DEPTH - 1) * sizeof(KI_SPINLOCK_HELD));
+        Profile->Depth--;
+    }
+    Profile->Held[Profile->Depth].SpinLock = SpinLock;
+    Profile->Held[Profile->Depth].Entry = Entry;
+    Profile->Held[Profile->Depth].AcquireTime = KiSpinLockProfileTimestamp();
+    Profile->Depth++;
+
+    KeRestoreInterrupts(Enable);
+}
+
+VOID
+FASTCALL
+KiSpinLockProfileAcquire(IN PKSPIN_LOCK SpinLock,
+                         IN PVOID Caller)
+{
+    ULONG Spins = 0;
+
+#ifdef CONFIG_SMP
+    //
+    // Count how long we wait for the lock to look free. Don't wait for a lock
+    // we already own, so that the acquire below can bugcheck.
+    //
+    while ((*(volatile KSPIN_LOCK *)SpinLock & 1) &&
+           (*(volatile KSPIN_LOCK *)SpinLock != ((KSPIN_LOCK)KeGetCurrentThread() | 1)))
+    {
+        YieldProcessor();
+        Spins++;
+    }
+#endif
+
+    /* Now really acquire it */
+    KxAcquireSpinLock(SpinLock);
+    KiSpinLockProfileAcquired(SpinLock, Caller, Spins);
+}
+
+VOID
+FASTCALL
+KiSpinLockProfileRelease(IN PKSPIN_LOCK SpinLock)
+{
+    PKI_SPINLOCK_PROFILE Profile;
+    PSYSDBG_SPINLOCK_PROFILE_ENTRY Entry;
+    ULONGLONG HoldTime;
+    BOOLEAN Enable;
+    ULONG i;
+
+    Profile = KiSpinLockProfiles[KeGetCurrentProcessorNumber()];
+    if (Profile)
+    {
+        Enable = KeDisableInterrupts();
+
+        /* Find the lock, locks are usually released in reverse order */
+        for (i = Profile->Depth; i > 0; i--)
+        {
+            if (Profile->Held[i - 1].SpinLock == SpinLock) break;
+        }
+
+        if (i)
+        {
+            /* Account for the hold time */
+            Entry = Profile->Held[i - 1].Entry;
+            if (Entry)
+            {
+                HoldTime = KiSpinLockProfileTimestamp() - Profile->Held[i - 1].AcquireTime;
+                Entry->HoldTime += HoldTime;
+                if (HoldTime > Entry->MaxHoldTime) Entry->MaxHoldTime = HoldTime;
+            }
+
+            /* And forget about it */
+            RtlMoveMemory(&Profile->Held[i - 1],
+                          &Profile->Held[i],
+                          (Profile->Depth - i) * sizeof(KI_SPINLOCK_HELD));
+            Profile->Depth--;
+        }
+
+        KeRestoreInterrupts(Enable);
+    }
+
+    KxReleaseSpinLock(SpinLock);
+}
+
+static
+ULONG_PTR
+NTAPI
+KiResetSpinLockProfile(IN ULONG_PTR Context)
+{
+    PKI_SPINLOCK_PROFILE Profile;
+
+    /* Every processor resets its own table, with interrupts off */
+    Profile = KiSpinLockProfiles[KeGetCurrentProcessorNumber()];
+    if (Profile) RtlZeroMemory(Profile, sizeof(KI_SPINLOCK_PROFILE));
+
+    /* Start the profiler on the way out */
+    if (Context) KiSpinLockProfileEnabled = TRUE;
+    return 0;
+}
+
+NTSTATUS
+NTAPI
+KeSetSpinLockProfile(IN BOOLEAN Enable)
+{
+    PKI_SPINLOCK_PROFILE Profile;
+    ULONG i;
+    PAGED_CODE();
+
+    /* Stop the profiler, the tables stay around */
+    KiSpinLockProfileEnabled = FALSE;
+    if (!Enable) return STATUS_SUCCESS;
+
+    /* Allocate the tables we don't have yet */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        if (KiSpinLockProfiles[i]) continue;
+
+        Profile = ExAllocatePoolWithTag(NonPagedPool,
+                                        sizeof(KI_SPINLOCK_PROFILE),
+                                        TAG_SPINLOCK_PROFILE);
+        if (!Profile) return STATUS_INSUFFICIENT_RESOURCES;
+        RtlZeroMemory(Profile, sizeof(KI_SPINLOCK_PROFILE));
+        KiSpinLockProfiles[i] = Profile;
+    }
+
+    /* Start over with empty tables */
+    KeIpiGenericCall(KiResetSpinLockProfile, TRUE);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+KeQuerySpinLockProfile(OUT PSYSDBG_SPINLOCK_PROFILE_ENTRY Buffer,
+                       IN ULONG BufferLength,
+                       OUT PULONG ReturnLength)
+{
+    PKI_SPINLOCK_PROFILE Profile;
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG i, j, Length = 0;
+
+    //
+    // Copy all of the used entries. The counters keep changing under us, so
+    // this is only a snapshot. The caller handles exceptions.
+    //
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Profile = KiSpinLockProfiles[i];
+        if (!Profile) continue;
+
+        for (j = 0; j < KI_SPINLOCK_PROFILE_ENTRIES; j++)
+        {
+            if (!Profile->Entries[j].SpinLock) continue;
+
+            if (Length + sizeof(SYSDBG_SPINLOCK_PROFILE_ENTRY) <= BufferLength)
+            {
+                *Buffer++ = Profile->Entries[j];
+            }
+            else
+            {
+                Status = STATUS_INFO_LENGTH_MISMATCH;
+            }
+            Length += sizeof(SYSDBG_SPINLOCK_PROFILE_ENTRY);
+        }
+    }
+
+    *ReturnLength = Length;
+    return Status;
+}
+
 #if 0
 //
 // FIXME: The queued spinlock routines are broken.
@@ -111,7 +415,7 @@ KeAcquireQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
     }
 
     /* Do the inlined function */
-    KxAcquireSpinLock(LockHandle->Lock);
+    KxAcquireSpinLockProfiled(LockHandle->Lock, _ReturnAddress());
 #endif
 }
 
@@ -132,7 +436,7 @@ KeReleaseQueuedSpinLockFromDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
     }
 
     /* Do the inlined function */
-    KxReleaseSpinLock(LockHandle->Lock);
+    KxReleaseSpinLockProfiled(LockHandle->Lock);
 #endif
 }
 
@@ -203,7 +507,7 @@ KeAcquireSpinLockAtDpcLevel(IN PKSPIN_LOCK SpinLock)
     }
 
     /* Do the inlined function */
-    KxAcquireSpinLock(SpinLock);
+    KxAcquireSpinLockProfiled(SpinLock, _ReturnAddress());
 }
 
 /*
@@ -226,7 +530,7 @@ KeReleaseSpinLockFromDpcLevel(IN PKSPIN_LOCK SpinLock)
     }
 
     /* Do the inlined function */
-    KxReleaseSpinLock(SpinLock);
+    KxReleaseSpinLockProfiled(SpinLock);
 }
 
 /*
@@ -248,7 +552,7 @@ KefAcquireSpinLockAtDpcLevel(IN PKSPIN_LOCK SpinLock)
     }
 
     /* Do the inlined function */
-    KxAcquireSpinLock(SpinLock);
+    KxAcquireSpinLockProfiled(SpinLock, _ReturnAddress());
 }
 
 /*
@@ -270,7 +574,7 @@ KefReleaseSpinLockFromDpcLevel(IN PKSPIN_LOCK SpinLock)
     }
 
     /* Do the inlined function */
-    KxReleaseSpinLock(SpinLock);
+    KxReleaseSpinLockProfiled(SpinLock);
 }
 
 /*
@@ -281,7 +585,7 @@ FASTCALL
 KiAcquireSpinLock(IN PKSPIN_LOCK SpinLock)
 {
     /* Do the inlined function */
-    KxAcquireSpinLock(SpinLock);
+    KxAcquireSpinLockProfiled(SpinLock, _ReturnAddress());
 }
 
 /*
@@ -292,7 +596,7 @@ FASTCALL
 KiReleaseSpinLock(IN PKSPIN_LOCK SpinLock)
 {
     /* Do the inlined function */
-    KxReleaseSpinLock(SpinLock);
+    KxReleaseSpinLockProfiled(SpinLock);
 }
 
 /*
@@ -325,6 +629,9 @@ KeTryToAcquireSpinLockAtDpcLevel(IN OUT PKSPIN_LOCK SpinLock)
 #endif
 #endif
 
+    /* Let the profiler know we got it */
+    if (KiSpinLockProfileEnabled) KiSpinLockProfileAcquired(SpinLock, _ReturnAddress(), 0);
+
     /* All is well, return TRUE */
     return TRUE;
 }
@@ -356,7 +663,7 @@ KeAcquireInStackQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK SpinLock,
     }
 
     /* Acquire the lock */
-    KxAcquireSpinLock(LockHandle->LockQueue.Lock); // HACK
+    KxAcquireSpinLockProfiled(LockHandle->LockQueue.Lock, _ReturnAddress()); // HACK
 #endif
 #endif
 }
@@ -385,7 +692,7 @@ KeReleaseInStackQueuedSpinLockFromDpcLevel(IN PKLOCK_QUEUE_HANDLE LockHandle)
     }
 
     /* Release the lock */
-    KxReleaseSpinLock(LockHandle->LockQueue.Lock); // HACK
+    KxReleaseSpinLockProfiled(LockHandle->LockQueue.Lock); // HACK
 #endif
 #endif
 }
@@ -460,6 +767,11 @@ VOID
 NTAPI
 Kii386SpinOnSpinLock(PKSPIN_LOCK SpinLock, ULONG Flags)
 {
+    PKI_SPINLOCK_PROFILE Profile;
+    PSYSDBG_SPINLOCK_PROFILE_ENTRY Entry;
+    BOOLEAN Enable;
+    ULONG Spins = 0;
+
     // FIXME: Handle flags
     UNREFERENCED_PARAMETER(Flags);
 
@@ -470,6 +782,70 @@ Kii386SpinOnSpinLock(PKSPIN_LOCK SpinLock, ULONG Flags)
 
         /* Yield and keep looping */
         YieldProcessor();
+        Spins++;
+    }
+
+    //
+    // This is where the inlined acquires end up when the lock is busy, so
+    // account for the contention here. The acquire itself is not counted.
+    //
+    if (KiSpinLockProfileEnabled)
+    {
+        Profile = KiSpinLockProfiles[KeGetCurrentProcessorNumber()];
+        if (!Profile) return;
+
+        Enable = KeDisableInterrupts();
+        Entry = KiSpinLockProfileFindEntry(Profile, SpinLock, _ReturnAddress());
+        if (Entry)
+        {
+            Entry->ContentionCount++;
+            Entry->SpinCount += Spins;
+        }
+        KeRestoreInterrupts(Enable);
     }
 }
 #endif
+
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtSpinLocks(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    PKI_SPINLOCK_PROFILE Profile;
+    PSYSDBG_SPINLOCK_PROFILE_ENTRY Entry;
+    BOOLEAN All;
+    ULONG i, j;
+
+    /* By default only show the locks we had to spin for */
+    All = (Argc > 1) && !strcmp(Argv[1], "all");
+
+    KdbpPrint("Spinlock profiling is %s\n", KiSpinLockProfileEnabled ? "on" : "off");
+    KdbpPrint("CPU  Lock      Caller    Acquires  Contended       Spins         Hold      MaxHold\n");
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Profile = KiSpinLockProfiles[i];
+        if (!Profile) continue;
+
+        for (j = 0; j < KI_SPINLOCK_PROFILE_ENTRIES; j++)
+        {
+            Entry = &Profile->Entries[j];
+            if (!(Entry->SpinLock) || (!(All) && !(Entry->ContentionCount))) continue;
+
+            KdbpPrint("%3lu  %p  %p  %8lu  %9lu  %10I64u  %11I64u  %11I64u\n",
+                      i,
+                      Entry->SpinLock,
+                      Entry->Caller,
+                      Entry->AcquireCount,
+                      Entry->ContentionCount,
+                      Entry->SpinCount,
+                      Entry->HoldTime,
+                      Entry->MaxHoldTime);
+        }
+
+        if (Profile->Dropped) KdbpPrint("%3lu  %lu samples dropped\n", i, Profile->Dropped);
+    }
+
+    return TRUE;
+}
+#endif
@@ -15,24 +15,222 @@
 #ifdef _WIN64
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr64((PLONG64)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd64((PLONG64)Destination, SetMember);
 #else
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr((PLONG)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd((PLONG)Destination, SetMember);
 #endif
 
+//
+// Per-processor scheduling statistics. A processor only updates its own entry,
+// or the entry of the processor whose PRCB lock it holds.
+//
+typedef struct _KI_SCHEDULER_STATISTICS
+{
+    ULONG Migrations;           // Threads queued here that last ran elsewhere
+    ULONG IdleDispatches;       // Threads handed directly to this idle processor
+    ULONG StealAttempts;        // Idle passes looking for work elsewhere
+    ULONG Steals;               // Threads taken from another processor
+} KI_SCHEDULER_STATISTICS, *PKI_SCHEDULER_STATISTICS;
+
+/* Number of records in the per-processor scheduler trace rings */
+#define KI_SCHED_TRACE_SHIFT    12
+#define KI_SCHED_TRACE_ENTRIES  (1 << KI_SCHED_TRACE_SHIFT)
+
+//
+// Per-processor scheduler trace ring. Only the owning processor writes to it,
+// from the context switch and ready paths at DISPATCH_LEVEL or above, so the
+// write index needs no interlocked operations. The read index only belongs to
+// the reader.
+//
+typedef struct _KI_SCHED_TRACE_RING
+{
+    volatile ULONG WriteIndex;
+    ULONG ReadIndex;
+    SYSDBG_SCHED_TRACE_ENTRY Entries[KI_SCHED_TRACE_ENTRIES];
+} KI_SCHED_TRACE_RING, *PKI_SCHED_TRACE_RING;
+
 /* GLOBALS *******************************************************************/
 
 ULONG_PTR KiIdleSummary;
 ULONG_PTR KiIdleSMTSummary;
+DECLSPEC_CACHEALIGN KI_SCHEDULER_STATISTICS KiSchedulerStatistics[MAXIMUM_PROCESSORS];
+
+//
+// The scheduler trace records context switches and readied threads in a ring
+// per processor, to be drained through NtSystemDebugControl. It is off unless
+// enabled from the registry or at runtime. Like the spinlock profiler, the
+// rings are allocated the first time it is enabled and never freed.
+//
+ULONG KiSchedTraceEnabled;
+ULONG KiSchedTraceAtBoot;
+static PKI_SCHED_TRACE_RING KiSchedTraceRings[MAXIMUM_PROCESSORS];
+static LONG KiSchedTraceReaderActive;
 
 /* FUNCTIONS *****************************************************************/
 
+#ifdef CONFIG_SMP
+static
+ULONG
+KiSelectReadyProcessor(IN PKTHREAD Thread)
+{
+    KAFFINITY Affinity, IdleSet;
+    ULONG Processor, i;
+
+    /* Only look at the processors the thread may run on */
+    Affinity = Thread->Affinity & KeActiveProcessors;
+    ASSERT(Affinity != 0);
+
+    /* An idle processor is the best choice, the ideal one above all */
+    IdleSet = KiIdleSummary & Affinity;
+    if (IdleSet)
+    {
+        if (IdleSet & AFFINITY_MASK(Thread->IdealProcessor)) return Thread->IdealProcessor;
+        if (IdleSet & AFFINITY_MASK(Thread->NextProcessor)) return Thread->NextProcessor;
+        Affinity = IdleSet;
+    }
+    else
+    {
+        /* Otherwise stick to the ideal processor, or the last one we ran on */
+        if (Affinity & AFFINITY_MASK(Thread->IdealProcessor)) return Thread->IdealProcessor;
+        if (Affinity & AFFINITY_MASK(Thread->NextProcessor)) return Thread->NextProcessor;
+    }
+
+    /* Take the next one after the last processor, so threads get spread out */
+    Processor = Thread->NextProcessor;
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        if (++Processor >= (ULONG)KeNumberProcessors) Processor = 0;
+        if (Affinity & AFFINITY_MASK(Processor)) break;
+    }
+
+    ASSERT(Affinity & AFFINITY_MASK(Processor));
+    return Processor;
+}
+
+static
+PKTHREAD
+KiStealReadyThread(IN PKPRCB Prcb,
+                   IN PKPRCB TargetPrcb)
+{
+    PLIST_ENTRY ListEntry;
+    PKTHREAD Thread, BestThread = NULL;
+    ULONG Summary, Priority;
+
+    KiAcquirePrcbLock(TargetPrcb);
+
+    /* Look for the highest priority thread that is allowed to run here */
+    Summary = TargetPrcb->ReadySummary;
+    while (Summary)
+    {
+        BitScanReverse(&Priority, Summary);
+        Summary ^= PRIORITY_MASK(Priority);
+
+        for (ListEntry = TargetPrcb->DispatcherReadyListHead[Priority].Flink;
+             ListEntry != &TargetPrcb->DispatcherReadyListHead[Priority];
+             ListEntry = ListEntry->Flink)
+        {
+            Thread = CONTAINING_RECORD(ListEntry, KTHREAD, WaitListEntry);
+            if (!(Thread->Affinity & Prcb->SetMember)) continue;
+
+            /* Prefer the threads that would rather run here anyway */
+            if (!BestThread) BestThread = Thread;
+            if (Thread->IdealProcessor == Prcb->Number)
+            {
+                BestThread = Thread;
+                break;
+            }
+        }
+
+        if (BestThread)
+        {
+            /* Take it off the other processor's queue */
+            ASSERT(BestThread->State == Ready);
+            if (RemoveEntryList(&BestThread->WaitListEntry))
+            {
+                TargetPrcb->ReadySummary ^= PRIORITY_MASK(Priority);
+            }
+
+            //
+            // Until we make it our next thread, anybody looking at it will see
+            // a standby thread that isn't the next one of its processor yet,
+            // and will retry
+            //
+            BestThread->NextProcessor = Prcb->Number;
+            BestThread->State = Standby;
+            break;
+        }
+    }
+
+    KiReleasePrcbLock(TargetPrcb);
+    return BestThread;
+}
+#endif
+
 PKTHREAD
 FASTCALL
 KiIdleSchedule(IN PKPRCB Prcb)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("SMP: Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    PKPRCB TargetPrcb;
+    PKTHREAD Thread = NULL;
+    ULONG Processor, i;
+
+    /* Nothing to do if somebody gave us a thread meanwhile */
+    if (Prcb->NextThread)
+    {
+        Prcb->IdleSchedule = FALSE;
+        return NULL;
+    }
+
+    //
+    // Go over the other processors, starting with the one after us so that
+    // all of them don't pick on the same one, and take the best thread from
+    // the first busy one that has something we can run. The ready summaries
+    // are only peeked at without the lock, to keep idle processors off the
+    // locks of the busy ones.
+    //
+    KiSchedulerStatistics[Prcb->Number].StealAttempts++;
+    Processor = Prcb->Number;
+    for (i = 1; i < (ULONG)KeNumberProcessors; i++)
+    {
+        if (++Processor >= (ULONG)KeNumberProcessors) Processor = 0;
+        TargetPrcb = KiProcessorBlock[Processor];
+        if (!(TargetPrcb) || !(TargetPrcb->ReadySummary)) continue;
+        if (KiIdleSummary & AFFINITY_MASK(Processor)) continue;
+
+        Thread = KiStealReadyThread(Prcb, TargetPrcb);
+        if (Thread) break;
+    }
+
+    /* Keep looking on the next pass if there was nothing to take */
+    if (!Thread) return NULL;
+
+    KiAcquirePrcbLock(Prcb);
+    if (!Prcb->NextThread)
+    {
+        /* We're not idle anymore, run the thread we took */
+        InterlockedAndSetMember(&KiIdleSummary, ~Prcb->SetMember);
+        Prcb->NextThread = Thread;
+        Prcb->IdleSchedule = FALSE;
+        KiSchedulerStatistics[Prcb->Number].Steals++;
+        KiReleasePrcbLock(Prcb);
+        return Thread;
+    }
+
+    /* Somebody was faster, queue the thread again */
+    Prcb->IdleSchedule = FALSE;
+    Thread->State = DeferredReady;
+    Thread->DeferredProcessor = Prcb->Number;
+    KiReleasePrcbLock(Prcb);
+    KiDeferredReadyThread(Thread);
+#else
+    /* There is nobody to take work from */
+    Prcb->IdleSchedule = FALSE;
+#endif
     return NULL;
 }
 
@@ -228,27 +426,42 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     OldPriority = Thread->Priority;
     Thread->Preempted = FALSE;
 
-    /* Queue the thread on CPU 0 and get the PRCB and lock it */
-    Thread->NextProcessor = 0;
-    Prcb = KiProcessorBlock[0];
+#ifdef CONFIG_SMP
+    /* Pick a processor for the thread */
+    Processor = KiSelectReadyProcessor(Thread);
+#endif
+
+    /* Trace the ready event, this is where the ready latency starts */
+    KiSchedTraceReadyThread(Thread, Processor);
+
+    /* Get the PRCB of that CPU and lock it */
+    Prcb = KiProcessorBlock[Processor];
     KiAcquirePrcbLock(Prcb);
 
-    /* Check if we have an idle summary */
-    if (KiIdleSummary)
+    /* Queue the thread on it */
+    if (Processor != Thread->NextProcessor) KiSchedulerStatistics[Processor].Migrations++;
+    Thread->NextProcessor = (UCHAR)Processor;
+
+    /* Check if the processor is idle */
+    if ((KiIdleSummary & AFFINITY_MASK(Processor)) && !(Prcb->NextThread))
     {
-        /* Clear it and set this thread as the next one */
-        KiIdleSummary = 0;
+        /* Clear its idle bit and set this thread as the next one */
+        InterlockedAndSetMember(&KiIdleSummary, ~AFFINITY_MASK(Processor));
         Thread->State = Standby;
         Prcb->NextThread = Thread;
+        KiSchedulerStatistics[Processor].IdleDispatches++;
 
-        /* Unlock the PRCB and return */
+        /* Unlock the PRCB */
         KiReleasePrcbLock(Prcb);
+
+        /* Wake it up if it isn't us */
+        if (KeGetCurrentProcessorNumber() != Processor)
+        {
+            KiIpiSend(AFFINITY_MASK(Processor), IPI_DPC);
+        }
         return;
     }
 
-    /* Set the CPU number */
-    Thread->NextProcessor = (UCHAR)Processor;
-
     /* Get the next scheduled thread */
     NextThread = Prcb->NextThread;
     if (NextThread)
@@ -341,7 +554,6 @@ KiSelectNextThread(IN PKPRCB Prcb)
         Prcb->IdleSchedule = TRUE;
 
         /* FIXME: SMT support */
-        ASSERTMSG("SMP: Not yet implemented\n", FALSE);
     }
 
     /* Sanity checks and return the thread */
@@ -385,8 +597,9 @@ KiSwapThread(IN PKTHREAD CurrentThread,
         }
         else
         {
-            /* Set the idle summary */
+            /* Set the idle summary, and look for work elsewhere once idle */
             InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+            Prcb->IdleSchedule = TRUE;
 
             /* Schedule the idle thread */
             NextThread = Prcb->IdleThread;
@@ -664,9 +877,8 @@ KiSetPriorityThread(IN PKTHREAD Thread,
             }
             else if (Thread->State == DeferredReady)
             {
-                /* FIXME: TODO */
-                DPRINT1("Deferred state not yet supported\n");
-                ASSERT(FALSE);
+                /* It will be queued at its new priority */
+                Thread->Priority = (SCHAR)Priority;
             }
             else
             {
@@ -816,3 +1028,302 @@ NtYieldExecution(VOID)
     KeLowerIrql(OldIrql);
     return Status;
 }
+
+FORCEINLINE
+ULONGLONG
+KiSchedTraceTimestamp(VOID)
+{
+#if defined(_M_IX86) || defined(_M_AMD64)
+    return __rdtsc();
+#else
+    return KeQueryInterruptTime();
+#endif
+}
+
+VOID
+FASTCALL
+KiSchedTraceRecord(IN UCHAR Type,
+                   IN PKTHREAD OldThread,
+                   IN PKTHREAD NewThread,
+                   IN ULONG TargetProcessor)
+{
+    PKI_SCHED_TRACE_RING Ring;
+    PSYSDBG_SCHED_TRACE_ENTRY Entry;
+    ULONG Processor, Index;
+
+    /* A processor started after the trace was enabled has no ring */
+    Processor = KeGetCurrentProcessorNumber();
+    Ring = KiSchedTraceRings[Processor];
+    if (!Ring) return;
+
+    //
+    // Fill the next record. A switch tells why the old thread stopped running,
+    // a ready event what the readied thread was waiting for.
+    //
+    Index = Ring->WriteIndex;
+    Entry = &Ring->Entries[Index & (KI_SCHED_TRACE_ENTRIES - 1)];
+    Entry->TimeStamp = KiSchedTraceTimestamp();
+    Entry->Type = Type;
+    Entry->Processor = (UCHAR)Processor;
+    Entry->TargetProcessor = (UCHAR)TargetProcessor;
+    Entry->OldState = OldThread->State;
+    if (Type == SYSDBG_SCHED_TRACE_SWITCH)
+        Entry->WaitReason = (OldThread->State == Waiting) ? OldThread->WaitReason : 0;
+    else
+        Entry->WaitReason = NewThread->WaitReason;
+    Entry->OldPriority = OldThread->Priority;
+    Entry->NewPriority = NewThread->Priority;
+    Entry->Reserved = 0;
+    Entry->OldThreadId = HandleToUlong(CONTAINING_RECORD(OldThread, ETHREAD, Tcb)->Cid.UniqueThread);
+    Entry->NewThreadId = HandleToUlong(CONTAINING_RECORD(NewThread, ETHREAD, Tcb)->Cid.UniqueThread);
+
+    /* Publish it once it is complete */
+    KeMemoryBarrierWithoutFence();
+    Ring->WriteIndex = Index + 1;
+}
+
+/*++
+ * @name KeSetSchedTrace
+ *
+ *     Starts or stops the scheduler trace. Starting it throws away whatever
+ *     was recorded before.
+ *
+ * @param Enable
+ *        TRUE to start tracing, FALSE to stop it.
+ *
+ * @return STATUS_SUCCESS, STATUS_INSUFFICIENT_RESOURCES if the rings could
+ *         not be allocated, or STATUS_DEVICE_BUSY if the trace is being read.
+ *
+ * @remarks The rings are never freed once allocated.
+ *
+ *--*/
+NTSTATUS
+NTAPI
+KeSetSchedTrace(IN BOOLEAN Enable)
+{
+    PKI_SCHED_TRACE_RING Ring;
+    ULONG i;
+    PAGED_CODE();
+
+    /* Stopping is all we have to do to turn it off, the rings stay around */
+    if (!Enable)
+    {
+        KiSchedTraceEnabled = FALSE;
+        return STATUS_SUCCESS;
+    }
+
+    /* Don't move the read indexes under a reader */
+    if (InterlockedCompareExchange(&KiSchedTraceReaderActive, 1, 0))
+    {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    /* Stop tracing while we start over */
+    KiSchedTraceEnabled = FALSE;
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        /* Allocate the rings we don't have yet */
+        Ring = KiSchedTraceRings[i];
+        if (!Ring)
+        {
+            Ring = ExAllocatePoolWithTag(NonPagedPool,
+                                         sizeof(KI_SCHED_TRACE_RING),
+                                         TAG_SCHED_TRACE);
+            if (!Ring)
+            {
+                InterlockedExchange(&KiSchedTraceReaderActive, 0);
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+            RtlZeroMemory(Ring, sizeof(KI_SCHED_TRACE_RING));
+            KiSchedTraceRings[i] = Ring;
+        }
+
+        //
+        // Skip what is already in there. Only the owning processor touches the
+        // write index, so it isn't reset.
+        //
+        Ring->ReadIndex = Ring->WriteIndex;
+    }
+
+    InterlockedExchange(&KiSchedTraceReaderActive, 0);
+    KiSchedTraceEnabled = TRUE;
+    return STATUS_SUCCESS;
+}
+
+/*++
+ * @name KeQuerySchedTrace
+ *
+ *     Drains the scheduler trace records into the caller's buffer, one
+ *     processor after another. Records that were overwritten before they
+ *     could be read are reported through a SYSDBG_SCHED_TRACE_LOST record.
+ *
+ * @param Buffer
+ *        Array of SYSDBG_SCHED_TRACE_ENTRY receiving the records. This can
+ *        be a user-mode buffer that was probed by the caller.
+ *
+ * @param BufferLength
+ *        Size of the buffer, in bytes.
+ *
+ * @param ReturnLength
+ *        Receives the number of bytes returned.
+ *
+ * @return STATUS_SUCCESS if everything was drained, STATUS_MORE_ENTRIES if
+ *         the buffer filled up first, STATUS_INFO_LENGTH_MISMATCH if it can't
+ *         hold a single record, or STATUS_DEVICE_BUSY if another reader is
+ *         draining the trace.
+ *
+ * @remarks Records are read while the processors keep writing, so the oldest
+ *          ones may get overwritten while they are copied. The timestamps
+ *          are only comparable across processors if their TSCs are in sync.
+ *
+ *--*/
+NTSTATUS
+NTAPI
+KeQuerySchedTrace(OUT PSYSDBG_SCHED_TRACE_ENTRY Buffer,
+                  IN ULONG BufferLength,
+                  OUT PULONG ReturnLength)
+{
+    PKI_SCHED_TRACE_RING Ring;
+    ULONG i, Read, Write, Count, Length = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PAGED_CODE();
+
+    *ReturnLength = 0;
+    if (BufferLength < sizeof(SYSDBG_SCHED_TRACE_ENTRY)) return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* There is only one read index per ring, so one reader at a time */
+    if (InterlockedCompareExchange(&KiSchedTraceReaderActive, 1, 0))
+    {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    Count = BufferLength / sizeof(SYSDBG_SCHED_TRACE_ENTRY);
+    _SEH2_TRY
+    {
+        for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        {
+            Ring = KiSchedTraceRings[i];
+            if (!Ring) continue;
+
+            /* Get the unread part, and check if the writer lapped us */
+            Write = Ring->WriteIndex;
+            Read = Ring->ReadIndex;
+            if ((Write - Read) > KI_SCHED_TRACE_ENTRIES)
+            {
+                if (!Count)
+                {
+                    Status = STATUS_MORE_ENTRIES;
+                    break;
+                }
+
+                /* Tell the reader how much it missed */
+                RtlZeroMemory(Buffer, sizeof(SYSDBG_SCHED_TRACE_ENTRY));
+                Buffer->Type = SYSDBG_SCHED_TRACE_LOST;
+                Buffer->Processor = (UCHAR)i;
+                Buffer->OldThreadId = Write - Read - KI_SCHED_TRACE_ENTRIES;
+                Buffer++;
+                Count--;
+                Length += sizeof(SYSDBG_SCHED_TRACE_ENTRY);
+
+                Read = Write - KI_SCHED_TRACE_ENTRIES;
+            }
+
+            /* Copy as much as fits */
+            while ((Read != Write) && (Count))
+            {
+                *Buffer++ = Ring->Entries[Read & (KI_SCHED_TRACE_ENTRIES - 1)];
+                Read++;
+                Count--;
+                Length += sizeof(SYSDBG_SCHED_TRACE_ENTRY);
+            }
+
+            Ring->ReadIndex = Read;
+            if (Read != Write)
+            {
+                Status = STATUS_MORE_ENTRIES;
+                break;
+            }
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    InterlockedExchange(&KiSchedTraceReaderActive, 0);
+    *ReturnLength = Length;
+    return Status;
+}
+
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtScheduler(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    PKPRCB Prcb;
+    ULONG i;
+
+    KdbpPrint("CPU  Ready    Idle  Migrations  IdleDispatch  StealTries    Steals\n");
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Prcb = KiProcessorBlock[i];
+        if (!Prcb) continue;
+
+        KdbpPrint("%3lu  %08lx  %3s  %10lu  %12lu  %10lu  %8lu\n",
+                  i,
+                  Prcb->ReadySummary,
+                  (KiIdleSummary & AFFINITY_MASK(i)) ? "yes" : "no",
+                  KiSchedulerStatistics[i].Migrations,
+                  KiSchedulerStatistics[i].IdleDispatches,
+                  KiSchedulerStatistics[i].StealAttempts,
+                  KiSchedulerStatistics[i].Steals);
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+ExpKdbgExtSchedTrace(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    PKI_SCHED_TRACE_RING Ring;
+    PSYSDBG_SCHED_TRACE_ENTRY Entry;
+    ULONG i, Index, Count = 16;
+
+    /* Show the last records of each processor, without consuming them */
+    if (Argc > 1) Count = strtoul(Argv[1], NULL, 0);
+    if (Count > KI_SCHED_TRACE_ENTRIES) Count = KI_SCHED_TRACE_ENTRIES;
+
+    KdbpPrint("Scheduler trace is %s\n", KiSchedTraceEnabled ? "on" : "off");
+    KdbpPrint("CPU  Timestamp         Event   Old    Pri  State  Wait  New    Pri  Target\n");
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Ring = KiSchedTraceRings[i];
+        if (!Ring) continue;
+
+        Index = Ring->WriteIndex;
+        Index -= min(Index, Count);
+        for (; Index != Ring->WriteIndex; Index++)
+        {
+            Entry = &Ring->Entries[Index & (KI_SCHED_TRACE_ENTRIES - 1)];
+            KdbpPrint("%3lu  %016I64x  %-6s  %5lx  %3d  %5u  %4u  %5lx  %3d  %6u\n",
+                      i,
+                      Entry->TimeStamp,
+                      (Entry->Type == SYSDBG_SCHED_TRACE_SWITCH) ? "switch" : "ready",
+                      Entry->OldThreadId,
+                      Entry->OldPriority,
+                      Entry->OldState,
+                      Entry->WaitReason,
+                      Entry->NewThreadId,
+                      Entry->NewPriority,
+                      Entry->TargetProcessor);
+        }
+    }
+
+    return TRUE;
+}
+#endif
@@ -18,6 +18,18 @@ LONG KiTickOffset;
 ULONG KeTimeAdjustment;
 BOOLEAN KiTimeAdjustmentEnabled = FALSE;
 
+//
+// Dynamic tick: while every processor is idle, the clock processor asks the
+// HAL for a longer clock period, bounded by the next timer deadline, and the
+// skipped ticks are accounted for when the stretched interrupt comes in.
+//
+ULONG KiDynamicTickEnabled;
+LONG KiDynamicTickActive;
+ULONG KiDynamicTickStretches;
+
+/* Longest clock period used while idle, in clock ticks */
+#define KI_DYNAMIC_TICK_MAXIMUM     8
+
 /* FUNCTIONS ******************************************************************/
 
 FORCEINLINE
@@ -104,26 +116,41 @@ KeUpdateSystemTime(IN PKTRAP_FRAME TrapFrame,
     /* Check for full tick */
     if (OldTickOffset <= (LONG)Increment)
     {
-        /* Update the system time */
-        CurrentTime.QuadPart = *(ULONGLONG*)&SharedUserData->SystemTime;
-        CurrentTime.QuadPart += KeTimeAdjustment;
-        KiWriteSystemTime(&SharedUserData->SystemTime, CurrentTime);
+        //
+        // A stretched clock period covers several ticks. Account for each
+        // of them, so that the tick count, the timer hands that were passed
+        // over and the thread quantum all catch up with the interrupt time.
+        //
+        do
+        {
+            /* Update the system time */
+            CurrentTime.QuadPart = *(ULONGLONG*)&SharedUserData->SystemTime;
+            CurrentTime.QuadPart += KeTimeAdjustment;
+            KiWriteSystemTime(&SharedUserData->SystemTime, CurrentTime);
 
-        /* Update the tick count */
-        CurrentTime.QuadPart = (*(ULONGLONG*)&KeTickCount) + 1;
-        KiWriteSystemTime(&KeTickCount, CurrentTime);
+            /* Update the tick count */
+            CurrentTime.QuadPart = (*(ULONGLONG*)&KeTickCount) + 1;
+            KiWriteSystemTime(&KeTickCount, CurrentTime);
 
-        /* Update it in the shared user data */
-        KiWriteSystemTime(&SharedUserData->TickCount, CurrentTime);
+            /* Update it in the shared user data */
+            KiWriteSystemTime(&SharedUserData->TickCount, CurrentTime);
 
-        /* Check for expiration with the new tick count as well */
-        KiCheckForTimerExpiration(Prcb, TrapFrame, InterruptTime);
+            /* Check for expiration with the new tick count as well */
+            KiCheckForTimerExpiration(Prcb, TrapFrame, InterruptTime);
 
-        /* Reset the tick offset */
-        KiTickOffset += KeMaximumIncrement;
+            /* Reset the tick offset */
+            KiTickOffset += KeMaximumIncrement;
 
-        /* Update processor/thread runtime */
-        KeUpdateRunTime(TrapFrame, Irql);
+            /* Update processor/thread runtime */
+            KeUpdateRunTime(TrapFrame, Irql);
+        } while (KiTickOffset <= 0);
+
+        /* Go back to the normal period as soon as some processor is busy */
+        if ((KiDynamicTickActive) &&
+            ((KiIdleSummary & KeActiveProcessors) != KeActiveProcessors))
+        {
+            KiExitDynamicTick();
+        }
     }
     else
     {
@@ -135,6 +162,63 @@ KeUpdateSystemTime(IN PKTRAP_FRAME TrapFrame,
     KiEndInterrupt(Irql, TrapFrame);
 }
 
+VOID
+FASTCALL
+KiEnterDynamicTick(IN PKPRCB Prcb)
+{
+    ULONGLONG InterruptTime, DueTime, NextDueTime;
+    ULONG Hand;
+
+    /* Only the clock processor does this, and only once every processor idles */
+    if (!(KiDynamicTickEnabled) ||
+        (KiDynamicTickActive) ||
+        (Prcb != KiProcessorBlock[0]) ||
+        ((KiIdleSummary & KeActiveProcessors) != KeActiveProcessors))
+    {
+        return;
+    }
+
+    //
+    // Find the earliest timer deadline. The table entries are read without
+    // the timer locks: a timer queued behind our back can fire late by at
+    // most the longest stretched period.
+    //
+    NextDueTime = MAXLONGLONG;
+    for (Hand = 0; Hand < TIMER_TABLE_SIZE; Hand++)
+    {
+        DueTime = KiTimerTableListHead[Hand].Time.QuadPart;
+        if (DueTime < NextDueTime) NextDueTime = DueTime;
+    }
+
+    //
+    // The new period only starts at the next clock interrupt, so leave the
+    // current one out, and don't bother unless we skip at least one tick
+    //
+    InterruptTime = KeQueryInterruptTime() + KeTimeIncrement;
+    if (NextDueTime <= InterruptTime + 2 * KeMaximumIncrement) return;
+    DueTime = NextDueTime - InterruptTime;
+    if (DueTime > KI_DYNAMIC_TICK_MAXIMUM * KeMaximumIncrement)
+    {
+        DueTime = KI_DYNAMIC_TICK_MAXIMUM * KeMaximumIncrement;
+    }
+
+    /* Ask the HAL for the longest period that fits */
+    HalSetTimeIncrement((ULONG)DueTime);
+    KiDynamicTickActive = TRUE;
+    KiDynamicTickStretches++;
+}
+
+VOID
+FASTCALL
+KiExitDynamicTick(VOID)
+{
+    /* Go back to the period in use before we went idle */
+    if (InterlockedExchange(&KiDynamicTickActive, FALSE))
+    {
+        HalSetTimeIncrement(KeTimeIncrement);
+    }
+}
+
 VOID
 NTAPI
 KeUpdateRunTime(IN PKTRAP_FRAME TrapFrame,
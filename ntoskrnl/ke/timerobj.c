@@ -15,10 +15,14 @@
 /* GLOBALS *******************************************************************/
 
 KTIMER_TABLE_ENTRY KiTimerTableListHead[TIMER_TABLE_SIZE];
+KTIMER_TABLE_ENTRY KiTimerFarTableListHead[TIMER_TABLE_SIZE];
 LARGE_INTEGER KiTimeIncrementReciprocal;
 UCHAR KiTimeIncrementShiftCount;
 BOOLEAN KiEnableTimerWatchdog = FALSE;
 
+/* Interrupt time covered by one full turn of the timer table */
+#define KI_TIMER_TABLE_SPAN ((ULONGLONG)TIMER_TABLE_SIZE * KeMaximumIncrement)
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 BOOLEAN
@@ -58,23 +62,15 @@ KiInsertTreeTimer(IN PKTIMER Timer,
     return Inserted;
 }
 
+static
 BOOLEAN
-FASTCALL
-KiInsertTimerTable(IN PKTIMER Timer,
-                   IN ULONG Hand)
+KiInsertNearTimer(IN PKTIMER Timer,
+                  IN ULONG Hand,
+                  IN ULONGLONG InterruptTime)
 {
-    LARGE_INTEGER InterruptTime;
-    LONGLONG DueTime = Timer->DueTime.QuadPart;
-    BOOLEAN Expired = FALSE;
+    ULONGLONG DueTime = Timer->DueTime.QuadPart;
     PLIST_ENTRY ListHead, NextEntry;
     PKTIMER CurrentTimer;
-    DPRINT("KiInsertTimerTable(): Timer %p, Hand: %lu\n", Timer, Hand);
-
-    /* Check if the period is zero */
-    if (!Timer->Period) Timer->Header.SignalState = FALSE;
-
-    /* Sanity check */
-    ASSERT(Hand == KiComputeTimerTableIndex(DueTime));
 
     /* Loop the timer list backwards */
     ListHead = &KiTimerTableListHead[Hand].Entry;
@@ -85,28 +81,106 @@ KiInsertTimerTable(IN PKTIMER Timer,
         CurrentTimer = CONTAINING_RECORD(NextEntry, KTIMER, TimerListEntry);
 
         /* Now check if we can fit it before */
-        if ((ULONGLONG)DueTime >= CurrentTimer->DueTime.QuadPart) break;
+        if (DueTime >= CurrentTimer->DueTime.QuadPart) break;
 
         /* Keep looping */
         NextEntry = NextEntry->Blink;
     }
 
-    /* Looped all the list, insert it here and get the interrupt time again */
+    /* Looped all the list, insert it here */
     InsertHeadList(NextEntry, &Timer->TimerListEntry);
 
     /* Check if we didn't find it in the list */
-    if (NextEntry == ListHead)
+    if (NextEntry != ListHead) return FALSE;
+
+    /* Update the time, far timers may still be due before this one */
+    if (DueTime < KiTimerTableListHead[Hand].Time.QuadPart)
     {
-        /* Set the time */
         KiTimerTableListHead[Hand].Time.QuadPart = DueTime;
+    }
+
+    /* Tell the caller if it has expired already */
+    return (DueTime <= InterruptTime);
+}
+
+BOOLEAN
+FASTCALL
+KiInsertTimerTable(IN PKTIMER Timer,
+                   IN ULONG Hand)
+{
+    ULONGLONG DueTime = Timer->DueTime.QuadPart;
+    ULONGLONG InterruptTime;
+    PKTIMER_TABLE_ENTRY FarEntry;
+    DPRINT("KiInsertTimerTable(): Timer %p, Hand: %lu\n", Timer, Hand);
+
+    /* Check if the period is zero */
+    if (!Timer->Period) Timer->Header.SignalState = FALSE;
+
+    /* Sanity check */
+    ASSERT(Hand == KiComputeTimerTableIndex(DueTime));
+
+    //
+    // Timers due more than a full turn of the table from now go on the far
+    // list of their hand, unsorted, so that long timeouts don't make every
+    // insertion walk past them. They get moved to the sorted near list by
+    // KiCascadeTimerTable once they come due within a turn.
+    //
+    InterruptTime = KeQueryInterruptTime();
+    if (DueTime > InterruptTime + KI_TIMER_TABLE_SPAN)
+    {
+        /* Insert it and remember the earliest far due time */
+        FarEntry = &KiTimerFarTableListHead[Hand];
+        InsertTailList(&FarEntry->Entry, &Timer->TimerListEntry);
+        if (DueTime < FarEntry->Time.QuadPart) FarEntry->Time.QuadPart = DueTime;
+
+        /* Make sure the clock interrupt looks at this hand in time */
+        if (DueTime < KiTimerTableListHead[Hand].Time.QuadPart)
+        {
+            KiTimerTableListHead[Hand].Time.QuadPart = DueTime;
+        }
+
+        /* It can't have expired */
+        return FALSE;
+    }
 
-        /* Make sure it hasn't expired already */
-        InterruptTime.QuadPart = KeQueryInterruptTime();
-        if (DueTime <= InterruptTime.QuadPart) Expired = TRUE;
+    /* Insert it in the sorted near list */
+    return KiInsertNearTimer(Timer, Hand, InterruptTime);
+}
+
+VOID
+FASTCALL
+KiCascadeTimerTable(IN ULONG Hand,
+                    IN ULONGLONG InterruptTime)
+{
+    PKTIMER_TABLE_ENTRY FarEntry = &KiTimerFarTableListHead[Hand];
+    ULONGLONG Limit = InterruptTime + KI_TIMER_TABLE_SPAN;
+    PLIST_ENTRY NextEntry;
+    PKTIMER Timer;
+
+    /* Move the timers due within a turn and find the earliest one left */
+    FarEntry->Time.HighPart = 0xFFFFFFFF;
+    NextEntry = FarEntry->Entry.Flink;
+    while (NextEntry != &FarEntry->Entry)
+    {
+        /* Get the timer and move to the next one */
+        Timer = CONTAINING_RECORD(NextEntry, KTIMER, TimerListEntry);
+        NextEntry = NextEntry->Flink;
+
+        if (Timer->DueTime.QuadPart <= Limit)
+        {
+            /* Move it to the near list, the caller expires it if needed */
+            RemoveEntryList(&Timer->TimerListEntry);
+            KiInsertNearTimer(Timer, Hand, InterruptTime);
+        }
+        else if (Timer->DueTime.QuadPart < FarEntry->Time.QuadPart)
+        {
+            /* This is the earliest so far */
+            FarEntry->Time.QuadPart = Timer->DueTime.QuadPart;
+        }
     }
 
-    /* Return expired state */
-    return Expired;
+    /* Update the table entry in case nothing was moved */
+    KiUpdateTimerTableEntry(Hand);
 }
 
 BOOLEAN
@@ -22,14 +22,6 @@
 
 #define POOL_BIG_TABLE_ENTRY_FREE 0x1
 
-typedef struct _POOL_DPC_CONTEXT
-{
-    PPOOL_TRACKER_TABLE PoolTrackTable;
-    SIZE_T PoolTrackTableSize;
-    PPOOL_TRACKER_TABLE PoolTrackTableExpansion;
-    SIZE_T PoolTrackTableSizeExpansion;
-} POOL_DPC_CONTEXT, *PPOOL_DPC_CONTEXT;
-
 ULONG ExpNumberOfPagedPools;
 POOL_DESCRIPTOR NonPagedPoolDescriptor;
 PPOOL_DESCRIPTOR ExpPagedPoolDescriptor[16 + 1];
@@ -38,6 +30,7 @@ PKGUARDED_MUTEX ExpPagedPoolMutex;
 SIZE_T PoolTrackTableSize, PoolTrackTableMask;
 SIZE_T PoolBigPageTableSize, PoolBigPageTableHash;
 PPOOL_TRACKER_TABLE PoolTrackTable;
+PPOOL_TRACKER_TABLE ExpPoolTrackShards[MAXIMUM_PROCESSORS];
 PPOOL_TRACKER_BIG_PAGES PoolBigPageTable;
 KSPIN_LOCK ExpTaggedPoolLock;
 ULONG PoolHitTag;
@@ -47,6 +40,37 @@ ULONG ExpPoolBigEntriesInUse;
 ULONG ExpPoolFlags;
 ULONG ExPoolFailures;
 
+//
+// Per-processor magazine caches. Every CPU owns a loaded and a previous
+// magazine for each pool block size, and full/empty magazines are exchanged
+// with the other CPUs through a global, lock-free depot. Only magazine
+// refills and drains need to touch the pool descriptor lock.
+//
+#define POOL_MAGAZINE_ROUNDS        14
+#define POOL_MAGAZINE_MIN_ROUNDS    2
+#define POOL_MAGAZINE_MAX_BYTES     (4 * PAGE_SIZE)
+#define POOL_MAGAZINE_DEPOT_DEPTH   4
+#define TAG_POOL_MAGAZINE           'gaMP'
+
+typedef struct _POOL_MAGAZINE
+{
+    SLIST_ENTRY DepotLink;
+    ULONG Rounds;
+    PPOOL_HEADER Round[POOL_MAGAZINE_ROUNDS];
+} POOL_MAGAZINE, *PPOOL_MAGAZINE;
+
+typedef struct _POOL_MAGAZINE_CACHE
+{
+    PPOOL_MAGAZINE Loaded;
+    PPOOL_MAGAZINE Previous;
+} POOL_MAGAZINE_CACHE, *PPOOL_MAGAZINE_CACHE;
+
+C_ASSERT(sizeof(POOL_MAGAZINE_CACHE) * POOL_LISTS_PER_PAGE == PAGE_SIZE);
+
+PPOOL_MAGAZINE_CACHE ExpPoolMagazineCaches[MAXIMUM_PROCESSORS][2];
+SLIST_HEADER ExpPoolFullMagazines[2][POOL_LISTS_PER_PAGE];
+SLIST_HEADER ExpPoolEmptyMagazines;
+
 /* Pool block/header/list access macros */
 #define POOL_ENTRY(x)       (PPOOL_HEADER)((ULONG_PTR)(x) - sizeof(POOL_HEADER))
 #define POOL_FREE_BLOCK(x)  (PLIST_ENTRY)((ULONG_PTR)(x)  + sizeof(POOL_HEADER))
@@ -460,6 +484,35 @@ ExpComputePartialHashForAddress(IN PVOID BaseAddress)
     return (Result >> 24) ^ (Result >> 16) ^ (Result >> 8) ^ Result;
 }
 
+VOID
+NTAPI
+ExpFoldPoolTracker(IN SIZE_T Index,
+                   OUT PPOOL_TRACKER_TABLE Entry)
+{
+    PPOOL_TRACKER_TABLE Shard;
+    ULONG i;
+
+    //
+    // Start with the global entry, which has the key and the counters of the
+    // boot processor, then add in the shard of every other processor. Nothing
+    // is locked, so the result is only a snapshot: the counters of a tag that
+    // is being allocated and freed at the same time might not perfectly agree
+    //
+    *Entry = PoolTrackTable[Index];
+    for (i = 1; i < MAXIMUM_PROCESSORS; i++)
+    {
+        Shard = ExpPoolTrackShards[i];
+        if (!Shard) continue;
+
+        Entry->NonPagedAllocs += Shard[Index].NonPagedAllocs;
+        Entry->NonPagedFrees += Shard[Index].NonPagedFrees;
+        Entry->NonPagedBytes += Shard[Index].NonPagedBytes;
+        Entry->PagedAllocs += Shard[Index].PagedAllocs;
+        Entry->PagedFrees += Shard[Index].PagedFrees;
+        Entry->PagedBytes += Shard[Index].PagedBytes;
+    }
+}
+
 #if DBG
 FORCEINLINE
 BOOLEAN
@@ -532,9 +585,10 @@ MiDumpPoolConsumers(BOOLEAN CalledFromDbg, ULONG Tag, ULONG Mask, ULONG Flags)
     //
     for (i = 0; i < PoolTrackTableSize; ++i)
     {
-        PPOOL_TRACKER_TABLE TableEntry;
+        POOL_TRACKER_TABLE FoldedEntry;
+        PPOOL_TRACKER_TABLE TableEntry = &FoldedEntry;
 
-        TableEntry = &PoolTrackTable[i];
+        ExpFoldPoolTracker(i, TableEntry);
 
         //
         // We only care about tags which have allocated memory
@@ -749,6 +803,56 @@ ExpSeedHotTags(VOID)
     }
 }
 
+VOID
+NTAPI
+ExpInsertPoolTracker(IN ULONG Key,
+                     IN SIZE_T NumberOfBytes,
+                     IN POOL_TYPE PoolType);
+
+PPOOL_TRACKER_TABLE
+NTAPI
+ExpGetPoolTrackerShard(IN BOOLEAN CanAllocate)
+{
+    ULONG Processor = KeGetCurrentProcessorNumber();
+    PPOOL_TRACKER_TABLE Shard;
+    SIZE_T ShardSize;
+
+    //
+    // The keys only ever live in the global table, which the boot processor
+    // also uses for its own counters. Every other processor counts into a
+    // private copy of the table, indexed by the same hash, so that the hot
+    // tags don't have their cache lines bouncing between processors. If we
+    // got moved to another processor since reading the number, we simply
+    // count into the wrong shard, which is harmless since the counters are
+    // updated with interlocked operations and only ever summed up.
+    //
+    if (Processor == 0) return PoolTrackTable;
+    Shard = ExpPoolTrackShards[Processor];
+    if ((Shard) || !(CanAllocate)) return Shard ? Shard : PoolTrackTable;
+
+    //
+    // This is the first time this processor tracks an allocation, so build
+    // its shard. Failing here is not fatal, we'll use the global table
+    //
+    ShardSize = PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE);
+    Shard = MiAllocatePoolPages(NonPagedPool, ShardSize);
+    if (!Shard) return PoolTrackTable;
+    RtlZeroMemory(Shard, ShardSize);
+    if (InterlockedCompareExchangePointer((PVOID*)&ExpPoolTrackShards[Processor],
+                                          Shard,
+                                          NULL))
+    {
+        //
+        // Someone else on this processor beat us to it
+        //
+        MiFreePoolPages(Shard);
+        return ExpPoolTrackShards[Processor];
+    }
+
+    ExpInsertPoolTracker('looP', ROUND_TO_PAGES(ShardSize), NonPagedPool);
+    return Shard;
+}
+
 VOID
 NTAPI
 ExpRemovePoolTracker(IN ULONG Key,
@@ -798,8 +902,9 @@ ExpRemovePoolTracker(IN ULONG Key,
         {
             //
             // Decrement the counters depending on if this was paged or nonpaged
-            // pool
+            // pool, in this processor's shard
             //
+            TableEntry = &ExpGetPoolTrackerShard(FALSE)[Hash];
             if ((PoolType & BASE_POOL_TYPE_MASK) == NonPagedPool)
             {
                 InterlockedIncrement(&TableEntry->NonPagedFrees);
@@ -871,7 +976,6 @@ ExpInsertPoolTracker(IN ULONG Key,
     // ASSERT on ReactOS features not yet supported
     //
     ASSERT(!(PoolType & SESSION_POOL_MASK));
-    ASSERT(KeGetCurrentProcessorNumber() == 0);
 
     //
     // Why the double indirection? Because normally this function is also used
@@ -901,8 +1005,9 @@ ExpInsertPoolTracker(IN ULONG Key,
         {
             //
             // Increment the counters depending on if this was paged or nonpaged
-            // pool
+            // pool, in this processor's shard
             //
+            TableEntry = &ExpGetPoolTrackerShard(TRUE)[Hash];
             if ((PoolType & BASE_POOL_TYPE_MASK) == NonPagedPool)
             {
                 InterlockedIncrement(&TableEntry->NonPagedAllocs);
@@ -1202,6 +1307,17 @@ InitializePool(IN POOL_TYPE PoolType,
         //
         KeInitializeSpinLock(&ExpTaggedPoolLock);
 
+        //
+        // Initialize the magazine depot. The per-CPU caches themselves are
+        // built the first time each processor touches the pool
+        //
+        InitializeSListHead(&ExpPoolEmptyMagazines);
+        for (i = 0; i < POOL_LISTS_PER_PAGE; i++)
+        {
+            InitializeSListHead(&ExpPoolFullMagazines[NonPagedPool][i]);
+            InitializeSListHead(&ExpPoolFullMagazines[PagedPool][i]);
+        }
+
         //
         // Initialize the nonpaged pool descriptor
         //
@@ -1308,237 +1424,885 @@ ExUnlockPool(IN PPOOL_DESCRIPTOR Descriptor,
     }
 }
 
-VOID
+PPOOL_HEADER
 NTAPI
-ExpGetPoolTagInfoTarget(IN PKDPC Dpc,
-                        IN PVOID DeferredContext,
-                        IN PVOID SystemArgument1,
-                        IN PVOID SystemArgument2)
+ExpSplitPoolBlock(IN PPOOL_DESCRIPTOR PoolDesc,
+                  IN PPOOL_HEADER Entry,
+                  IN USHORT BlockSize)
 {
-    PPOOL_DPC_CONTEXT Context = DeferredContext;
-    UNREFERENCED_PARAMETER(Dpc);
-    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+    PPOOL_HEADER NextEntry, FragmentEntry;
+    USHORT FragmentSize;
+
+    //
+    // The caller owns the pool lock and has already removed this free block,
+    // which is bigger than needed, from its list
+    //
+    ASSERT(Entry->BlockSize > BlockSize);
 
     //
-    // Make sure we win the race, and if we did, copy the data atomically
+    // Is there an entry before this one?
     //
-    if (KeSignalCallDpcSynchronize(SystemArgument2))
+    if (Entry->PreviousSize == 0)
     {
-        RtlCopyMemory(Context->PoolTrackTable,
-                      PoolTrackTable,
-                      Context->PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE));
+        //
+        // There isn't anyone before us, so take the next block and
+        // turn it into a fragment that contains the leftover data
+        // that we don't need to satisfy the caller's request
+        //
+        FragmentEntry = POOL_BLOCK(Entry, BlockSize);
+        FragmentEntry->BlockSize = Entry->BlockSize - BlockSize;
 
         //
-        // This is here because ReactOS does not yet support expansion
+        // And make it point back to us
         //
-        ASSERT(Context->PoolTrackTableSizeExpansion == 0);
+        FragmentEntry->PreviousSize = BlockSize;
+
+        //
+        // Now get the block that follows the new fragment and check
+        // if it's still on the same page as us (and not at the end)
+        //
+        NextEntry = POOL_NEXT_BLOCK(FragmentEntry);
+        if (PAGE_ALIGN(NextEntry) != NextEntry)
+        {
+            //
+            // Adjust this next block to point to our newly created
+            // fragment block
+            //
+            NextEntry->PreviousSize = FragmentEntry->BlockSize;
+        }
     }
+    else
+    {
+        //
+        // There is a free entry before us, which we know is smaller
+        // so we'll make this entry the fragment instead
+        //
+        FragmentEntry = Entry;
 
-    //
-    // Regardless of whether we won or not, we must now synchronize and then
-    // decrement the barrier since this is one more processor that has completed
-    // the callback.
-    //
-    KeSignalCallDpcSynchronize(SystemArgument2);
-    KeSignalCallDpcDone(SystemArgument1);
-}
+        //
+        // And then we'll remove from it the actual size required.
+        // Now the entry is a leftover free fragment
+        //
+        Entry->BlockSize -= BlockSize;
 
-NTSTATUS
-NTAPI
-ExGetPoolTagInfo(IN PSYSTEM_POOLTAG_INFORMATION SystemInformation,
-                 IN ULONG SystemInformationLength,
-                 IN OUT PULONG ReturnLength OPTIONAL)
-{
-    ULONG TableSize, CurrentLength;
-    ULONG EntryCount;
-    NTSTATUS Status = STATUS_SUCCESS;
-    PSYSTEM_POOLTAG TagEntry;
-    PPOOL_TRACKER_TABLE Buffer, TrackerEntry;
-    POOL_DPC_CONTEXT Context;
-    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+        //
+        // Now let's go to the next entry after the fragment (which
+        // used to point to our original free entry) and make it
+        // reference the new fragment entry instead.
+        //
+        // This is the entry that will actually end up holding the
+        // allocation!
+        //
+        Entry = POOL_NEXT_BLOCK(Entry);
+        Entry->PreviousSize = FragmentEntry->BlockSize;
 
-    //
-    // Keep track of how much data the caller's buffer must hold
-    //
-    CurrentLength = FIELD_OFFSET(SYSTEM_POOLTAG_INFORMATION, TagInfo);
+        //
+        // And now let's go to the entry after that one and check if
+        // it's still on the same page, and not at the end
+        //
+        NextEntry = POOL_BLOCK(Entry, BlockSize);
+        if (PAGE_ALIGN(NextEntry) != NextEntry)
+        {
+            //
+            // Make it reference the allocation entry
+            //
+            NextEntry->PreviousSize = BlockSize;
+        }
+    }
 
     //
-    // Initialize the caller's buffer
+    // Now our (allocation) entry is the right size
     //
-    TagEntry = &SystemInformation->TagInfo[0];
-    SystemInformation->Count = 0;
+    Entry->BlockSize = BlockSize;
 
     //
-    // Capture the number of entries, and the total size needed to make a copy
-    // of the table
+    // And the next entry is now the free fragment which contains
+    // the remaining difference between how big the original entry
+    // was, and the actual size the caller needs/requested.
     //
-    EntryCount = (ULONG)PoolTrackTableSize;
-    TableSize = EntryCount * sizeof(POOL_TRACKER_TABLE);
+    FragmentEntry->PoolType = 0;
+    FragmentSize = FragmentEntry->BlockSize;
 
     //
-    // Allocate the "Generic DPC" temporary buffer
+    // Now check if enough free bytes remained for us to have a
+    // "full" entry, which contains enough bytes for a linked list
+    // and thus can be used for allocations (up to 8 bytes...)
     //
-    Buffer = ExAllocatePoolWithTag(NonPagedPool, TableSize, 'ofnI');
-    if (!Buffer) return STATUS_INSUFFICIENT_RESOURCES;
+    ExpCheckPoolLinks(&PoolDesc->ListHeads[FragmentSize - 1]);
+    if (FragmentSize != 1)
+    {
+        //
+        // Insert the free entry into the free list for this size
+        //
+        ExpInsertPoolTailList(&PoolDesc->ListHeads[FragmentSize - 1],
+                              POOL_FREE_BLOCK(FragmentEntry));
+        ExpCheckPoolLinks(POOL_FREE_BLOCK(FragmentEntry));
+    }
 
     //
-    // Do a "Generic DPC" to atomically retrieve the tag and allocation data
+    // Return the entry that will hold the allocation
     //
-    Context.PoolTrackTable = Buffer;
-    Context.PoolTrackTableSize = PoolTrackTableSize;
-    Context.PoolTrackTableExpansion = NULL;
-    Context.PoolTrackTableSizeExpansion = 0;
-    KeGenericCallDpc(ExpGetPoolTagInfoTarget, &Context);
+    return Entry;
+}
+
+PPOOL_HEADER
+NTAPI
+ExpFindFreePoolBlock(IN PPOOL_DESCRIPTOR PoolDesc,
+                     IN USHORT BlockSize)
+{
+    PLIST_ENTRY ListHead;
+    PPOOL_HEADER Entry;
 
     //
-    // Now parse the results
+    // The caller owns the pool lock. Walk the free lists, starting with the
+    // one optimized for this size, and take the first block we find
     //
-    for (TrackerEntry = Buffer; TrackerEntry < (Buffer + EntryCount); TrackerEntry++)
+    ListHead = &PoolDesc->ListHeads[BlockSize];
+    while (ListHead != &PoolDesc->ListHeads[POOL_LISTS_PER_PAGE])
     {
-        //
-        // If the entry is empty, skip it
-        //
-        if (!TrackerEntry->Key) continue;
-
-        //
-        // Otherwise, add one more entry to the caller's buffer, and ensure that
-        // enough space has been allocated in it
-        //
-        SystemInformation->Count++;
-        CurrentLength += sizeof(*TagEntry);
-        if (SystemInformationLength < CurrentLength)
+        if (!ExpIsPoolListEmpty(ListHead))
         {
             //
-            // The caller's buffer is too small, so set a failure code. The
-            // caller will know the count, as well as how much space is needed.
-            //
-            // We do NOT break out of the loop, because we want to keep incrementing
-            // the Count as well as CurrentLength so that the caller can know the
-            // final numbers
+            // Remove the free entry and shrink it down to the size needed
             //
-            Status = STATUS_INFO_LENGTH_MISMATCH;
+            ExpCheckPoolLinks(ListHead);
+            Entry = POOL_ENTRY(ExpRemovePoolHeadList(ListHead));
+            ExpCheckPoolLinks(ListHead);
+            ExpCheckPoolBlocks(Entry);
+            ASSERT(Entry->BlockSize >= BlockSize);
+            ASSERT(Entry->PoolType == 0);
+            if (Entry->BlockSize != BlockSize)
+            {
+                Entry = ExpSplitPoolBlock(PoolDesc, Entry, BlockSize);
+            }
+            return Entry;
         }
-        else
-        {
-            //
-            // Small sanity check that our accounting is working correctly
-            //
-            ASSERT(TrackerEntry->PagedAllocs >= TrackerEntry->PagedFrees);
-            ASSERT(TrackerEntry->NonPagedAllocs >= TrackerEntry->NonPagedFrees);
 
-            //
-            // Return the data into the caller's buffer
-            //
-            TagEntry->TagUlong = TrackerEntry->Key;
-            TagEntry->PagedAllocs = TrackerEntry->PagedAllocs;
-            TagEntry->PagedFrees = TrackerEntry->PagedFrees;
-            TagEntry->PagedUsed = TrackerEntry->PagedBytes;
-            TagEntry->NonPagedAllocs = TrackerEntry->NonPagedAllocs;
-            TagEntry->NonPagedFrees = TrackerEntry->NonPagedFrees;
-            TagEntry->NonPagedUsed = TrackerEntry->NonPagedBytes;
-            TagEntry++;
-        }
+        ListHead++;
     }
 
     //
-    // Free the "Generic DPC" temporary buffer, return the buffer length and status
+    // Nothing is left on the free lists
     //
-    ExFreePoolWithTag(Buffer, 'ofnI');
-    if (ReturnLength) *ReturnLength = CurrentLength;
-    return Status;
+    return NULL;
 }
 
-BOOLEAN
+PVOID
 NTAPI
-ExpAddTagForBigPages(IN PVOID Va,
-                     IN ULONG Key,
-                     IN ULONG NumberOfPages,
-                     IN POOL_TYPE PoolType)
+ExpCoalescePoolBlock(IN PPOOL_DESCRIPTOR PoolDesc,
+                     IN PPOOL_HEADER Entry)
 {
-    ULONG Hash, i = 0;
-    PVOID OldVa;
-    KIRQL OldIrql;
-    SIZE_T TableSize;
-    PPOOL_TRACKER_BIG_PAGES Entry, EntryEnd, EntryStart;
-    ASSERT(((ULONG_PTR)Va & POOL_BIG_TABLE_ENTRY_FREE) == 0);
-    ASSERT(!(PoolType & SESSION_POOL_MASK));
+    PPOOL_HEADER NextEntry;
+    USHORT BlockSize;
+    BOOLEAN Combined = FALSE;
 
     //
-    // As the table is expandable, these values must only be read after acquiring
-    // the lock to avoid a teared access during an expansion
+    // Get the pointer to the next entry, the caller owns the pool lock
     //
-    Hash = ExpComputePartialHashForAddress(Va);
-    KeAcquireSpinLock(&ExpLargePoolTableLock, &OldIrql);
-    Hash &= PoolBigPageTableHash;
-    TableSize = PoolBigPageTableSize;
+    NextEntry = POOL_NEXT_BLOCK(Entry);
 
     //
-    // We loop from the current hash bucket to the end of the table, and then
-    // rollover to hash bucket 0 and keep going from there. If we return back
-    // to the beginning, then we attempt expansion at the bottom of the loop
+    // Check if the next allocation is at the end of the page
     //
-    EntryStart = Entry = &PoolBigPageTable[Hash];
-    EntryEnd = &PoolBigPageTable[TableSize];
-    do
+    ExpCheckPoolBlocks(Entry);
+    if (PAGE_ALIGN(NextEntry) != NextEntry)
     {
         //
-        // Make sure that this is a free entry and attempt to atomically make the
-        // entry busy now
+        // We may be able to combine the block if it's free
         //
-        OldVa = Entry->Va;
-        if (((ULONG_PTR)OldVa & POOL_BIG_TABLE_ENTRY_FREE) &&
-            (InterlockedCompareExchangePointer(&Entry->Va, Va, OldVa) == OldVa))
+        if (NextEntry->PoolType == 0)
         {
             //
-            // We now own this entry, write down the size and the pool tag
+            // The next block is free, so we'll do a combine
             //
-            Entry->Key = Key;
-            Entry->NumberOfPages = NumberOfPages;
+            Combined = TRUE;
 
             //
-            // Add one more entry to the count, and see if we're getting within
-            // 25% of the table size, at which point we'll do an expansion now
-            // to avoid blocking too hard later on.
-            //
-            // Note that we only do this if it's also been the 16th time that we
-            // keep losing the race or that we are not finding a free entry anymore,
-            // which implies a massive number of concurrent big pool allocations.
+            // Make sure there's actual data in the block -- anything smaller
+            // than this means we only have the header, so there's no linked list
+            // for us to remove
             //
-            InterlockedIncrementUL(&ExpPoolBigEntriesInUse);
-            if ((i >= 16) && (ExpPoolBigEntriesInUse > (TableSize / 4)))
+            if ((NextEntry->BlockSize != 1))
             {
-                DPRINT("Should attempt expansion since we now have %lu entries\n",
-                        ExpPoolBigEntriesInUse);
+                //
+                // The block is at least big enough to have a linked list, so go
+                // ahead and remove it
+                //
+                ExpCheckPoolLinks(POOL_FREE_BLOCK(NextEntry));
+                ExpRemovePoolEntryList(POOL_FREE_BLOCK(NextEntry));
+                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Flink));
+                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Blink));
             }
 
             //
-            // We have our entry, return
+            // Our entry is now combined with the next entry
             //
-            KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
-            return TRUE;
+            Entry->BlockSize = Entry->BlockSize + NextEntry->BlockSize;
         }
-
-        //
-        // We don't have our entry yet, so keep trying, making the entry list
-        // circular if we reach the last entry. We'll eventually break out of
-        // the loop once we've rolled over and returned back to our original
-        // hash bucket
-        //
-        i++;
-        if (++Entry >= EntryEnd) Entry = &PoolBigPageTable[0];
-    } while (Entry != EntryStart);
+    }
 
     //
-    // This means there's no free hash buckets whatsoever, so we would now have
-    // to attempt expanding the table
+    // Now check if there was a previous entry on the same page as us
     //
-    DPRINT1("Big pool expansion needed, not implemented!\n");
-    KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
-    return FALSE;
-}
+    if (Entry->PreviousSize)
+    {
+        //
+        // Great, grab that entry and check if it's free
+        //
+        NextEntry = POOL_PREV_BLOCK(Entry);
+        if (NextEntry->PoolType == 0)
+        {
+            //
+            // It is, so we can do a combine
+            //
+            Combined = TRUE;
 
-ULONG
-NTAPI
+            //
+            // Make sure there's actual data in the block -- anything smaller
+            // than this means we only have the header so there's no linked list
+            // for us to remove
+            //
+            if ((NextEntry->BlockSize != 1))
+            {
+                //
+                // The block is at least big enough to have a linked list, so go
+                // ahead and remove it
+                //
+                ExpCheckPoolLinks(POOL_FREE_BLOCK(NextEntry));
+                ExpRemovePoolEntryList(POOL_FREE_BLOCK(NextEntry));
+                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Flink));
+                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Blink));
+            }
+
+            //
+            // Combine our original block (which might've already been combined
+            // with the next block), into the previous block
+            //
+            NextEntry->BlockSize = NextEntry->BlockSize + Entry->BlockSize;
+
+            //
+            // And now we'll work with the previous block instead
+            //
+            Entry = NextEntry;
+        }
+    }
+
+    //
+    // By now, it may have been possible for our combined blocks to actually
+    // have made up a full page (if there were only 2-3 allocations on the
+    // page, they could've all been combined).
+    //
+    if ((PAGE_ALIGN(Entry) == Entry) &&
+        (PAGE_ALIGN(POOL_NEXT_BLOCK(Entry)) == POOL_NEXT_BLOCK(Entry)))
+    {
+        //
+        // In this case, the caller must free the page once the pool lock has
+        // been released
+        //
+        return Entry;
+    }
+
+    //
+    // Otherwise, we now have a free block (or a combination of 2 or 3)
+    //
+    Entry->PoolType = 0;
+    BlockSize = Entry->BlockSize;
+    ASSERT(BlockSize != 1);
+
+    //
+    // Check if we actually did combine it with anyone
+    //
+    if (Combined)
+    {
+        //
+        // Get the first combined block (either our original to begin with, or
+        // the one after the original, depending if we combined with the previous)
+        //
+        NextEntry = POOL_NEXT_BLOCK(Entry);
+
+        //
+        // As long as the next block isn't on a page boundary, have it point
+        // back to us
+        //
+        if (PAGE_ALIGN(NextEntry) != NextEntry) NextEntry->PreviousSize = BlockSize;
+    }
+
+    //
+    // Insert this new free block
+    //
+    ExpInsertPoolHeadList(&PoolDesc->ListHeads[BlockSize - 1], POOL_FREE_BLOCK(Entry));
+    ExpCheckPoolLinks(POOL_FREE_BLOCK(Entry));
+    return NULL;
+}
+
+FORCEINLINE
+ULONG
+ExpPoolMagazineCapacity(IN USHORT BlockSize)
+{
+    ULONG Capacity;
+
+    //
+    // Bound the amount of memory a single magazine can pin down, so that the
+    // caches for the bigger block sizes don't end up hoarding whole pages
+    //
+    Capacity = POOL_MAGAZINE_MAX_BYTES / (BlockSize * POOL_BLOCK_SIZE);
+    if (Capacity > POOL_MAGAZINE_ROUNDS) Capacity = POOL_MAGAZINE_ROUNDS;
+    if (Capacity < POOL_MAGAZINE_MIN_ROUNDS) Capacity = POOL_MAGAZINE_MIN_ROUNDS;
+    return Capacity;
+}
+
+PPOOL_MAGAZINE_CACHE
+NTAPI
+ExpGetPoolMagazineCache(IN POOL_TYPE PoolType,
+                        IN USHORT BlockSize)
+{
+    PPOOL_MAGAZINE_CACHE *CacheArray, Caches;
+
+    //
+    // The caches are per-CPU, so the caller must not be able to get preempted
+    //
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+    ASSERT(BlockSize < POOL_LISTS_PER_PAGE);
+    CacheArray = &ExpPoolMagazineCaches[KeGetCurrentProcessorNumber()][PoolType];
+    if (!*CacheArray)
+    {
+        //
+        // This is the first time this CPU uses this pool type, so build it a
+        // page worth of caches, one for each block size. Failing here is not
+        // fatal, the caller will simply go to the pool descriptor instead
+        //
+        Caches = MiAllocatePoolPages(NonPagedPool, PAGE_SIZE);
+        if (!Caches) return NULL;
+        RtlZeroMemory(Caches, PAGE_SIZE);
+        ExpInsertPoolTracker(TAG_POOL_MAGAZINE, PAGE_SIZE, NonPagedPool);
+        *CacheArray = Caches;
+    }
+
+    return &(*CacheArray)[BlockSize];
+}
+
+BOOLEAN
+NTAPI
+ExpPushFullPoolMagazine(IN POOL_TYPE PoolType,
+                        IN USHORT BlockSize,
+                        IN PPOOL_MAGAZINE Magazine)
+{
+    PSLIST_HEADER Depot = &ExpPoolFullMagazines[PoolType][BlockSize];
+
+    //
+    // Don't let the depot grow without bounds; the caller drains the magazine
+    // back into the pool descriptor instead. The depth check is racy, but this
+    // is only a heuristic
+    //
+    if (ExQueryDepthSList(Depot) >= POOL_MAGAZINE_DEPOT_DEPTH) return FALSE;
+    InterlockedPushEntrySList(Depot, &Magazine->DepotLink);
+    return TRUE;
+}
+
+PPOOL_HEADER
+NTAPI
+ExpRefillPoolMagazine(IN PPOOL_DESCRIPTOR PoolDesc,
+                      IN PPOOL_MAGAZINE Magazine,
+                      IN USHORT BlockSize)
+{
+    PPOOL_HEADER Entry;
+    ULONG Capacity, Count;
+    KIRQL OldIrql;
+
+    //
+    // Grab as many blocks as the magazine can hold with a single acquisition
+    // of the pool lock. They stay marked as allocated while cached.
+    //
+    ASSERT(Magazine->Rounds == 0);
+    Capacity = ExpPoolMagazineCapacity(BlockSize);
+    OldIrql = ExLockPool(PoolDesc);
+    while (Magazine->Rounds < Capacity)
+    {
+        Entry = ExpFindFreePoolBlock(PoolDesc, BlockSize);
+        if (!Entry) break;
+
+        Entry->PoolType = PoolDesc->PoolType + 1;
+        ExpCheckPoolBlocks(Entry);
+        Magazine->Round[Magazine->Rounds++] = Entry;
+    }
+    ExUnlockPool(PoolDesc, OldIrql);
+
+    //
+    // If the free lists were empty the caller will have to get a fresh page
+    //
+    Count = Magazine->Rounds;
+    if (!Count) return NULL;
+
+    //
+    // Increment required counters, and hand out the first round
+    //
+    InterlockedExchangeAddSizeT(&PoolDesc->TotalBytes, Count * BlockSize * POOL_BLOCK_SIZE);
+    InterlockedExchangeAdd((PLONG)&PoolDesc->RunningAllocs, (LONG)Count);
+    return Magazine->Round[--Magazine->Rounds];
+}
+
+VOID
+NTAPI
+ExpDrainPoolMagazine(IN PPOOL_DESCRIPTOR PoolDesc,
+                     IN PPOOL_MAGAZINE Magazine)
+{
+    PPOOL_HEADER Entry;
+    PVOID FreePage, FreePageList = NULL;
+    ULONG Count;
+    SIZE_T Bytes = 0;
+    KIRQL OldIrql;
+
+    //
+    // Return every cached block to the free lists with a single acquisition
+    // of the pool lock
+    //
+    Count = Magazine->Rounds;
+    if (!Count) return;
+    OldIrql = ExLockPool(PoolDesc);
+    while (Magazine->Rounds)
+    {
+        Entry = Magazine->Round[--Magazine->Rounds];
+        Bytes += Entry->BlockSize * POOL_BLOCK_SIZE;
+
+        //
+        // Pages that became entirely free are chained through their own free
+        // space, and released once the lock is dropped
+        //
+        FreePage = ExpCoalescePoolBlock(PoolDesc, Entry);
+        if (FreePage)
+        {
+            *(PVOID*)POOL_FREE_BLOCK(FreePage) = FreePageList;
+            FreePageList = FreePage;
+        }
+    }
+    ExUnlockPool(PoolDesc, OldIrql);
+
+    //
+    // Update performance counters
+    //
+    InterlockedExchangeAdd((PLONG)&PoolDesc->RunningDeAllocs, (LONG)Count);
+    InterlockedExchangeAddSizeT(&PoolDesc->TotalBytes, -(LONG_PTR)Bytes);
+
+    //
+    // And free all the pages we collected
+    //
+    while (FreePageList)
+    {
+        FreePage = FreePageList;
+        FreePageList = *(PVOID*)POOL_FREE_BLOCK(FreePage);
+        InterlockedExchangeAdd((PLONG)&PoolDesc->TotalPages, -1);
+        MiFreePoolPages(FreePage);
+    }
+}
+
+VOID
+NTAPI
+ExpReturnPoolMagazine(IN PPOOL_MAGAZINE_CACHE Cache,
+                      IN POOL_TYPE PoolType,
+                      IN USHORT BlockSize,
+                      IN PPOOL_MAGAZINE Magazine)
+{
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    //
+    // If this CPU has no loaded magazine (we may have been running on another
+    // CPU while refilling) then install this one
+    //
+    if ((Cache) && !(Cache->Loaded))
+    {
+        Cache->Loaded = Magazine;
+        return;
+    }
+
+    //
+    // Empty magazines always go back to the depot
+    //
+    if (!Magazine->Rounds)
+    {
+        InterlockedPushEntrySList(&ExpPoolEmptyMagazines, &Magazine->DepotLink);
+        return;
+    }
+
+    //
+    // Prefer replacing an empty loaded magazine, otherwise share the rounds
+    // with the other CPUs through the depot
+    //
+    if ((Cache) && !(Cache->Loaded->Rounds))
+    {
+        InterlockedPushEntrySList(&ExpPoolEmptyMagazines, &Cache->Loaded->DepotLink);
+        Cache->Loaded = Magazine;
+        return;
+    }
+    InterlockedPushEntrySList(&ExpPoolFullMagazines[PoolType][BlockSize],
+                              &Magazine->DepotLink);
+}
+
+PPOOL_HEADER
+NTAPI
+ExpAllocateFromPoolMagazine(IN PPOOL_DESCRIPTOR PoolDesc,
+                            IN USHORT BlockSize)
+{
+    PPOOL_MAGAZINE_CACHE Cache;
+    PPOOL_MAGAZINE Magazine;
+    PSLIST_ENTRY ListEntry;
+    PPOOL_HEADER Entry;
+    POOL_TYPE PoolType = PoolDesc->PoolType;
+    KIRQL OldIrql;
+
+    //
+    // Get this CPU's cache for this block size
+    //
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    Cache = ExpGetPoolMagazineCache(PoolType, BlockSize);
+    if (!Cache)
+    {
+        KeLowerIrql(OldIrql);
+        return NULL;
+    }
+
+    //
+    // Check if the loaded magazine has any rounds left
+    //
+    Magazine = Cache->Loaded;
+    if (!(Magazine) || !(Magazine->Rounds))
+    {
+        if ((Cache->Previous) && (Cache->Previous->Rounds))
+        {
+            //
+            // The previous one does, so just swap them
+            //
+            Cache->Loaded = Cache->Previous;
+            Cache->Previous = Magazine;
+            Magazine = Cache->Loaded;
+        }
+        else
+        {
+            //
+            // Try to get a full magazine that another CPU left in the depot,
+            // and give it our empty one in exchange
+            //
+            ListEntry = InterlockedPopEntrySList(&ExpPoolFullMagazines[PoolType][BlockSize]);
+            if (!ListEntry)
+            {
+                //
+                // The depot is dry too, so refill our magazine from the pool
+                // descriptor. This has to be done at the caller's IRQL since
+                // paged pool is protected by a guarded mutex, so detach the
+                // magazine from the CPU while we do it.
+                //
+                // Note that we never allocate magazines here: allocating one
+                // would recurse into this very path.
+                //
+                Cache->Loaded = NULL;
+                KeLowerIrql(OldIrql);
+                if (!Magazine) return NULL;
+                Entry = ExpRefillPoolMagazine(PoolDesc, Magazine, BlockSize);
+
+                //
+                // We may now be running on a different CPU, so look up the
+                // cache again before handing the magazine back
+                //
+                KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+                Cache = ExpGetPoolMagazineCache(PoolType, BlockSize);
+                ExpReturnPoolMagazine(Cache, PoolType, BlockSize, Magazine);
+                KeLowerIrql(OldIrql);
+                return Entry;
+            }
+
+            if (Magazine)
+            {
+                InterlockedPushEntrySList(&ExpPoolEmptyMagazines, &Magazine->DepotLink);
+            }
+            Magazine = CONTAINING_RECORD(ListEntry, POOL_MAGAZINE, DepotLink);
+            Cache->Loaded = Magazine;
+        }
+    }
+
+    //
+    // Pop a round from the loaded magazine
+    //
+    ASSERT(Magazine->Rounds != 0);
+    Entry = Magazine->Round[--Magazine->Rounds];
+    KeLowerIrql(OldIrql);
+    return Entry;
+}
+
+BOOLEAN
+NTAPI
+ExpFreeToPoolMagazine(IN PPOOL_DESCRIPTOR PoolDesc,
+                      IN PPOOL_HEADER Entry)
+{
+    PPOOL_MAGAZINE_CACHE Cache;
+    PPOOL_MAGAZINE Magazine, FullMagazine;
+    PSLIST_ENTRY ListEntry;
+    POOL_TYPE PoolType = PoolDesc->PoolType;
+    USHORT BlockSize = Entry->BlockSize;
+    ULONG Capacity, Attempt;
+    KIRQL OldIrql;
+
+    Capacity = ExpPoolMagazineCapacity(BlockSize);
+    for (Attempt = 0; Attempt < 2; Attempt++)
+    {
+        //
+        // Get this CPU's cache for this block size
+        //
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        Cache = ExpGetPoolMagazineCache(PoolType, BlockSize);
+        if (!Cache)
+        {
+            KeLowerIrql(OldIrql);
+            return FALSE;
+        }
+
+        //
+        // If the loaded magazine is full but the previous one isn't, swap them
+        //
+        Magazine = Cache->Loaded;
+        if (!(Magazine) || (Magazine->Rounds >= Capacity))
+        {
+            if ((Cache->Previous) && (Cache->Previous->Rounds < Capacity))
+            {
+                Cache->Loaded = Cache->Previous;
+                Cache->Previous = Magazine;
+                Magazine = Cache->Loaded;
+            }
+            else
+            {
+                //
+                // Both are full, so get an empty magazine from the depot
+                //
+                ListEntry = InterlockedPopEntrySList(&ExpPoolEmptyMagazines);
+                if (!ListEntry)
+                {
+                    //
+                    // There are no empty magazines either, so build a new one
+                    // and try again. This allocation cannot recurse back in here.
+                    //
+                    KeLowerIrql(OldIrql);
+                    Magazine = ExAllocatePoolWithTag(NonPagedPool,
+                                                     sizeof(POOL_MAGAZINE),
+                                                     TAG_POOL_MAGAZINE);
+                    if (!Magazine) return FALSE;
+                    Magazine->Rounds = 0;
+                    InterlockedPushEntrySList(&ExpPoolEmptyMagazines, &Magazine->DepotLink);
+                    continue;
+                }
+
+                //
+                // Our previous magazine goes to the depot, the loaded one
+                // becomes the previous one, and the empty one gets loaded
+                //
+                FullMagazine = Cache->Previous;
+                Cache->Previous = Magazine;
+                Magazine = CONTAINING_RECORD(ListEntry, POOL_MAGAZINE, DepotLink);
+                ASSERT(Magazine->Rounds == 0);
+                Cache->Loaded = Magazine;
+                Magazine->Round[Magazine->Rounds++] = Entry;
+
+                if ((FullMagazine) &&
+                    !(ExpPushFullPoolMagazine(PoolType, BlockSize, FullMagazine)))
+                {
+                    //
+                    // The depot has enough full magazines already, so give
+                    // these blocks back to the pool descriptor
+                    //
+                    KeLowerIrql(OldIrql);
+                    ExpDrainPoolMagazine(PoolDesc, FullMagazine);
+                    InterlockedPushEntrySList(&ExpPoolEmptyMagazines, &FullMagazine->DepotLink);
+                    return TRUE;
+                }
+
+                KeLowerIrql(OldIrql);
+                return TRUE;
+            }
+        }
+
+        //
+        // Cache the block in the loaded magazine
+        //
+        Magazine->Round[Magazine->Rounds++] = Entry;
+        KeLowerIrql(OldIrql);
+        return TRUE;
+    }
+
+    //
+    // Let the caller free it to the pool descriptor
+    //
+    return FALSE;
+}
+
+NTSTATUS
+NTAPI
+ExGetPoolTagInfo(IN PSYSTEM_POOLTAG_INFORMATION SystemInformation,
+                 IN ULONG SystemInformationLength,
+                 IN OUT PULONG ReturnLength OPTIONAL)
+{
+    ULONG CurrentLength;
+    ULONG EntryCount, i;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PSYSTEM_POOLTAG TagEntry;
+    POOL_TRACKER_TABLE FoldedEntry;
+    PPOOL_TRACKER_TABLE TrackerEntry = &FoldedEntry;
+    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    //
+    // Keep track of how much data the caller's buffer must hold
+    //
+    CurrentLength = FIELD_OFFSET(SYSTEM_POOLTAG_INFORMATION, TagInfo);
+
+    //
+    // Initialize the caller's buffer
+    //
+    TagEntry = &SystemInformation->TagInfo[0];
+    SystemInformation->Count = 0;
+
+    //
+    // Walk the table and fold the per-processor counters of each tag as we
+    // go. This used to stop every processor with a generic DPC to copy the
+    // table at once; the snapshot is now taken without holding up anybody
+    // who is allocating, so tags can be monitored all the time.
+    //
+    EntryCount = (ULONG)PoolTrackTableSize;
+    for (i = 0; i < EntryCount; i++)
+    {
+        //
+        // If the entry is empty, skip it
+        //
+        if (!PoolTrackTable[i].Key) continue;
+        ExpFoldPoolTracker(i, TrackerEntry);
+
+        //
+        // Otherwise, add one more entry to the caller's buffer, and ensure that
+        // enough space has been allocated in it
+        //
+        SystemInformation->Count++;
+        CurrentLength += sizeof(*TagEntry);
+        if (SystemInformationLength < CurrentLength)
+        {
+            //
+            // The caller's buffer is too small, so set a failure code. The
+            // caller will know the count, as well as how much space is needed.
+            //
+            // We do NOT break out of the loop, because we want to keep incrementing
+            // the Count as well as CurrentLength so that the caller can know the
+            // final numbers
+            //
+            Status = STATUS_INFO_LENGTH_MISMATCH;
+        }
+        else
+        {
+            //
+            // Return the data into the caller's buffer
+            //
+            TagEntry->TagUlong = TrackerEntry->Key;
+            TagEntry->PagedAllocs = TrackerEntry->PagedAllocs;
+            TagEntry->PagedFrees = TrackerEntry->PagedFrees;
+            TagEntry->PagedUsed = TrackerEntry->PagedBytes;
+            TagEntry->NonPagedAllocs = TrackerEntry->NonPagedAllocs;
+            TagEntry->NonPagedFrees = TrackerEntry->NonPagedFrees;
+            TagEntry->NonPagedUsed = TrackerEntry->NonPagedBytes;
+            TagEntry++;
+        }
+    }
+
+    //
+    // Return the buffer length and status
+    //
+    if (ReturnLength) *ReturnLength = CurrentLength;
+    return Status;
+}
+
+BOOLEAN
+NTAPI
+ExpAddTagForBigPages(IN PVOID Va,
+                     IN ULONG Key,
+                     IN ULONG NumberOfPages,
+                     IN POOL_TYPE PoolType)
+{
+    ULONG Hash, i = 0;
+    PVOID OldVa;
+    KIRQL OldIrql;
+    SIZE_T TableSize;
+    PPOOL_TRACKER_BIG_PAGES Entry, EntryEnd, EntryStart;
+    ASSERT(((ULONG_PTR)Va & POOL_BIG_TABLE_ENTRY_FREE) == 0);
+    ASSERT(!(PoolType & SESSION_POOL_MASK));
+
+    //
+    // As the table is expandable, these values must only be read after acquiring
+    // the lock to avoid a teared access during an expansion
+    //
+    Hash = ExpComputePartialHashForAddress(Va);
+    KeAcquireSpinLock(&ExpLargePoolTableLock, &OldIrql);
+    Hash &= PoolBigPageTableHash;
+    TableSize = PoolBigPageTableSize;
+
+    //
+    // We loop from the current hash bucket to the end of the table, and then
+    // rollover to hash bucket 0 and keep going from there. If we return back
+    // to the beginning, then we attempt expansion at the bottom of the loop
+    //
+    EntryStart = Entry = &PoolBigPageTable[Hash];
+    EntryEnd = &PoolBigPageTable[TableSize];
+    do
+    {
+        //
+        // Make sure that this is a free entry and attempt to atomically make the
+        // entry busy now
+        //
+        OldVa = Entry->Va;
+        if (((ULONG_PTR)OldVa & POOL_BIG_TABLE_ENTRY_FREE) &&
+            (InterlockedCompareExchangePointer(&Entry->Va, Va, OldVa) == OldVa))
+        {
+            //
+            // We now own this entry, write down the size and the pool tag
+            //
+            Entry->Key = Key;
+            Entry->NumberOfPages = NumberOfPages;
+
+            //
+            // Add one more entry to the count, and see if we're getting within
+            // 25% of the table size, at which point we'll do an expansion now
+            // to avoid blocking too hard later on.
+            //
+            // Note that we only do this if it's also been the 16th time that we
+            // keep losing the race or that we are not finding a free entry anymore,
+            // which implies a massive number of concurrent big pool allocations.
+            //
+            InterlockedIncrementUL(&ExpPoolBigEntriesInUse);
+            if ((i >= 16) && (ExpPoolBigEntriesInUse > (TableSize / 4)))
+            {
+                DPRINT("Should attempt expansion since we now have %lu entries\n",
+                        ExpPoolBigEntriesInUse);
+            }
+
+            //
+            // We have our entry, return
+            //
+            KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
+            return TRUE;
+        }
+
+        //
+        // We don't have our entry yet, so keep trying, making the entry list
+        // circular if we reach the last entry. We'll eventually break out of
+        // the loop once we've rolled over and returned back to our original
+        // hash bucket
+        //
+        i++;
+        if (++Entry >= EntryEnd) Entry = &PoolBigPageTable[0];
+    } while (Entry != EntryStart);
+
+    //
+    // This means there's no free hash buckets whatsoever, so we would now have
+    // to attempt expanding the table
+    //
+    DPRINT1("Big pool expansion needed, not implemented!\n");
+    KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
+    return FALSE;
+}
+
+ULONG
+NTAPI
 ExpFindAndRemoveTagBigPages(IN PVOID Va,
                             OUT PULONG_PTR BigPages,
                             IN POOL_TYPE PoolType)
@@ -1735,7 +2499,7 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
 {
     PPOOL_DESCRIPTOR PoolDesc;
     PLIST_ENTRY ListHead;
-    PPOOL_HEADER Entry, NextEntry, FragmentEntry;
+    PPOOL_HEADER Entry, FragmentEntry;
     KIRQL OldIrql;
     USHORT BlockSize, i;
     ULONG OriginalType;
@@ -1956,6 +2720,30 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
         }
     }
 
+    //
+    // Next, try popping it from this CPU's magazine cache, which will refill
+    // itself from the depot or from the free lists below in a single batch
+    //
+    Entry = ExpAllocateFromPoolMagazine(PoolDesc, i);
+    if (Entry)
+    {
+        //
+        // Write down its pool type, and track it
+        //
+        Entry->PoolType = OriginalType + 1;
+        ExpInsertPoolTracker(Tag,
+                             Entry->BlockSize * POOL_BLOCK_SIZE,
+                             OriginalType);
+
+        //
+        // Return the pool allocation
+        //
+        Entry->PoolTag = Tag;
+        (POOL_FREE_BLOCK(Entry))->Flink = NULL;
+        (POOL_FREE_BLOCK(Entry))->Blink = NULL;
+        return POOL_FREE_BLOCK(Entry);
+    }
+
     //
     // Loop in the free lists looking for a block if this size. Start with the
     // list optimized for this kind of size lookup
@@ -2008,105 +2796,7 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
             //
             if (Entry->BlockSize != i)
             {
-                //
-                // Is there an entry before this one?
-                //
-                if (Entry->PreviousSize == 0)
-                {
-                    //
-                    // There isn't anyone before us, so take the next block and
-                    // turn it into a fragment that contains the leftover data
-                    // that we don't need to satisfy the caller's request
-                    //
-                    FragmentEntry = POOL_BLOCK(Entry, i);
-                    FragmentEntry->BlockSize = Entry->BlockSize - i;
-
-                    //
-                    // And make it point back to us
-                    //
-                    FragmentEntry->PreviousSize = i;
-
-                    //
-                    // Now get the block that follows the new fragment and check
-                    // if it's still on the same page as us (and not at the end)
-                    //
-                    NextEntry = POOL_NEXT_BLOCK(FragmentEntry);
-                    if (PAGE_ALIGN(NextEntry) != NextEntry)
-                    {
-                        //
-                        // Adjust this next block to point to our newly created
-                        // fragment block
-                        //
-                        NextEntry->PreviousSize = FragmentEntry->BlockSize;
-                    }
-                }
-                else
-                {
-                    //
-                    // There is a free entry before us, which we know is smaller
-                    // so we'll make this entry the fragment instead
-                    //
-                    FragmentEntry = Entry;
-
-                    //
-                    // And then we'll remove from it the actual size required.
-                    // Now the entry is a leftover free fragment
-                    //
-                    Entry->BlockSize -= i;
-
-                    //
-                    // Now let's go to the next entry after the fragment (which
-                    // used to point to our original free entry) and make it
-                    // reference the new fragment entry instead.
-                    //
-                    // This is the entry that will actually end up holding the
-                    // allocation!
-                    //
-                    Entry = POOL_NEXT_BLOCK(Entry);
-                    Entry->PreviousSize = FragmentEntry->BlockSize;
-
-                    //
-                    // And now let's go to the entry after that one and check if
-                    // it's still on the same page, and not at the end
-                    //
-                    NextEntry = POOL_BLOCK(Entry, i);
-                    if (PAGE_ALIGN(NextEntry) != NextEntry)
-                    {
-                        //
-                        // Make it reference the allocation entry
-                        //
-                        NextEntry->PreviousSize = i;
-                    }
-                }
-
-                //
-                // Now our (allocation) entry is the right size
-                //
-                Entry->BlockSize = i;
-
-                //
-                // And the next entry is now the free fragment which contains
-                // the remaining difference between how big the original entry
-                // was, and the actual size the caller needs/requested.
-                //
-                FragmentEntry->PoolType = 0;
-                BlockSize = FragmentEntry->BlockSize;
-
-                //
-                // Now check if enough free bytes remained for us to have a
-                // "full" entry, which contains enough bytes for a linked list
-                // and thus can be used for allocations (up to 8 bytes...)
-                //
-                ExpCheckPoolLinks(&PoolDesc->ListHeads[BlockSize - 1]);
-                if (BlockSize != 1)
-                {
-                    //
-                    // Insert the free entry into the free list for this size
-                    //
-                    ExpInsertPoolTailList(&PoolDesc->ListHeads[BlockSize - 1],
-                                          POOL_FREE_BLOCK(FragmentEntry));
-                    ExpCheckPoolLinks(POOL_FREE_BLOCK(FragmentEntry));
-                }
+                Entry = ExpSplitPoolBlock(PoolDesc, Entry, i);
             }
 
             //
@@ -2316,13 +3006,12 @@ NTAPI
 ExFreePoolWithTag(IN PVOID P,
                   IN ULONG TagToFree)
 {
-    PPOOL_HEADER Entry, NextEntry;
+    PPOOL_HEADER Entry;
     USHORT BlockSize;
     KIRQL OldIrql;
     POOL_TYPE PoolType;
     PPOOL_DESCRIPTOR PoolDesc;
     ULONG Tag;
-    BOOLEAN Combined = FALSE;
     PFN_NUMBER PageCount, RealPageCount;
     PKPRCB Prcb = KeGetCurrentPrcb();
     PGENERAL_LOOKASIDE LookasideList;
@@ -2576,9 +3265,9 @@ ExFreePoolWithTag(IN PVOID P,
     }
 
     //
-    // Get the pointer to the next entry
+    // Otherwise, try caching it in this CPU's magazines
     //
-    NextEntry = POOL_BLOCK(Entry, BlockSize);
+    if (ExpFreeToPoolMagazine(PoolDesc, Entry)) return;
 
     //
     // Update performance counters
@@ -2587,145 +3276,21 @@ ExFreePoolWithTag(IN PVOID P,
     InterlockedExchangeAddSizeT(&PoolDesc->TotalBytes, -BlockSize * POOL_BLOCK_SIZE);
 
     //
-    // Acquire the pool lock
+    // Acquire the pool lock, and combine the block with its free neighbours
     //
     OldIrql = ExLockPool(PoolDesc);
+    Entry = ExpCoalescePoolBlock(PoolDesc, Entry);
+    ExUnlockPool(PoolDesc, OldIrql);
 
     //
-    // Check if the next allocation is at the end of the page
-    //
-    ExpCheckPoolBlocks(Entry);
-    if (PAGE_ALIGN(NextEntry) != NextEntry)
-    {
-        //
-        // We may be able to combine the block if it's free
-        //
-        if (NextEntry->PoolType == 0)
-        {
-            //
-            // The next block is free, so we'll do a combine
-            //
-            Combined = TRUE;
-
-            //
-            // Make sure there's actual data in the block -- anything smaller
-            // than this means we only have the header, so there's no linked list
-            // for us to remove
-            //
-            if ((NextEntry->BlockSize != 1))
-            {
-                //
-                // The block is at least big enough to have a linked list, so go
-                // ahead and remove it
-                //
-                ExpCheckPoolLinks(POOL_FREE_BLOCK(NextEntry));
-                ExpRemovePoolEntryList(POOL_FREE_BLOCK(NextEntry));
-                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Flink));
-                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Blink));
-            }
-
-            //
-            // Our entry is now combined with the next entry
-            //
-            Entry->BlockSize = Entry->BlockSize + NextEntry->BlockSize;
-        }
-    }
-
-    //
-    // Now check if there was a previous entry on the same page as us
-    //
-    if (Entry->PreviousSize)
-    {
-        //
-        // Great, grab that entry and check if it's free
-        //
-        NextEntry = POOL_PREV_BLOCK(Entry);
-        if (NextEntry->PoolType == 0)
-        {
-            //
-            // It is, so we can do a combine
-            //
-            Combined = TRUE;
-
-            //
-            // Make sure there's actual data in the block -- anything smaller
-            // than this means we only have the header so there's no linked list
-            // for us to remove
-            //
-            if ((NextEntry->BlockSize != 1))
-            {
-                //
-                // The block is at least big enough to have a linked list, so go
-                // ahead and remove it
-                //
-                ExpCheckPoolLinks(POOL_FREE_BLOCK(NextEntry));
-                ExpRemovePoolEntryList(POOL_FREE_BLOCK(NextEntry));
-                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Flink));
-                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Blink));
-            }
-
-            //
-            // Combine our original block (which might've already been combined
-            // with the next block), into the previous block
-            //
-            NextEntry->BlockSize = NextEntry->BlockSize + Entry->BlockSize;
-
-            //
-            // And now we'll work with the previous block instead
-            //
-            Entry = NextEntry;
-        }
-    }
-
-    //
-    // By now, it may have been possible for our combined blocks to actually
-    // have made up a full page (if there were only 2-3 allocations on the
-    // page, they could've all been combined).
+    // If the whole page is now free, update the performance counter and free
+    // the page
     //
-    if ((PAGE_ALIGN(Entry) == Entry) &&
-        (PAGE_ALIGN(POOL_NEXT_BLOCK(Entry)) == POOL_NEXT_BLOCK(Entry)))
+    if (Entry)
     {
-        //
-        // In this case, release the pool lock, update the performance counter,
-        // and free the page
-        //
-        ExUnlockPool(PoolDesc, OldIrql);
         InterlockedExchangeAdd((PLONG)&PoolDesc->TotalPages, -1);
         MiFreePoolPages(Entry);
-        return;
-    }
-
-    //
-    // Otherwise, we now have a free block (or a combination of 2 or 3)
-    //
-    Entry->PoolType = 0;
-    BlockSize = Entry->BlockSize;
-    ASSERT(BlockSize != 1);
-
-    //
-    // Check if we actually did combine it with anyone
-    //
-    if (Combined)
-    {
-        //
-        // Get the first combined block (either our original to begin with, or
-        // the one after the original, depending if we combined with the previous)
-        //
-        NextEntry = POOL_NEXT_BLOCK(Entry);
-
-        //
-        // As long as the next block isn't on a page boundary, have it point
-        // back to us
-        //
-        if (PAGE_ALIGN(NextEntry) != NextEntry) NextEntry->PreviousSize = BlockSize;
     }
-
-    //
-    // Insert this new free block, and release the pool lock
-    //
-    ExpInsertPoolHeadList(&PoolDesc->ListHeads[BlockSize - 1], POOL_FREE_BLOCK(Entry));
-    ExpCheckPoolLinks(POOL_FREE_BLOCK(Entry));
-    ExUnlockPool(PoolDesc, OldIrql);
 }
 
 /*
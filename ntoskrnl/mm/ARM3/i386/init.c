@@ -241,10 +241,11 @@ NTAPI
 INIT_FUNCTION
 MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
 {
-    PFN_NUMBER PageFrameIndex;
+    PFN_NUMBER PageFrameIndex, PadPageFrame, PadPages = 0;
     PMMPTE StartPde, EndPde, PointerPte, LastPte;
+    PMMPDE LargeStartPde, LargeEndPde;
     MMPTE TempPde, TempPte;
-    PVOID NonPagedPoolExpansionVa;
+    PVOID NonPagedPoolExpansionVa, LargeStartVa, LargeEndVa;
     SIZE_T NonPagedSystemSize;
     KIRQL OldIrql;
     PMMPFN Pfn1;
@@ -353,6 +354,54 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     MmNonPagedPoolStart = (PVOID)((ULONG_PTR)MmPfnDatabase +
                                   (MxPfnAllocation << PAGE_SHIFT));
 
+    //
+    // Check if the part of initial nonpaged pool covering whole PDEs should be
+    // mapped with large pages. Since nonpaged pool is physically contiguous,
+    // this only requires the physical pages to have the same offset inside a
+    // PDE as the virtual ones, which we get by skipping a few pages first.
+    // Protected freed pool needs to invalidate individual PTEs, so it can't be
+    // used together with this.
+    //
+    LargeStartPde = LargeEndPde = NULL;
+    LargeStartVa = ALIGN_UP_POINTER_BY(MmNonPagedPoolStart, PDE_MAPPED_VA);
+    LargeEndVa = ALIGN_DOWN_POINTER_BY((ULONG_PTR)MmNonPagedPoolStart +
+                                       MmSizeOfNonPagedPoolInBytes,
+                                       PDE_MAPPED_VA);
+    if ((MmLargePageNonPagedPool) &&
+        (KeFeatureBits & KF_LARGE_PAGE) &&
+        !(MmProtectFreedNonPagedPool) &&
+        (LargeStartVa < LargeEndVa))
+    {
+        PadPages = (MiAddressToPteOffset(MmNonPagedPoolStart) -
+                    MxFreeDescriptor->BasePage) & (PTE_PER_PAGE - 1);
+        if ((PadPages + MxPfnAllocation +
+             (MmSizeOfNonPagedPoolInBytes >> PAGE_SHIFT)) <
+            MxFreeDescriptor->PageCount)
+        {
+            //
+            // Skip the padding pages, they will be given back to the free list
+            // once the PFN database has been built
+            //
+            PadPageFrame = MxFreeDescriptor->BasePage;
+            if (PadPages) MxGetNextPage(PadPages);
+
+            /* Enable large pages on the boot CPU (the others get it in phase 1) */
+            __writecr4(__readcr4() | CR4_PSE);
+
+            LargeStartPde = MiAddressToPde(LargeStartVa);
+            LargeEndPde = MiAddressToPde(LargeEndVa);
+            MiLargePageNonPagedPoolPages = (PFN_COUNT)
+                (((ULONG_PTR)LargeEndVa - (ULONG_PTR)LargeStartVa) >> PAGE_SHIFT);
+            DPRINT1("Mapping %lu pages of nonpaged pool with large pages (%lu padding pages)\n",
+                    MiLargePageNonPagedPoolPages, PadPages);
+        }
+        else
+        {
+            /* Not enough memory to align the pool, use small pages */
+            PadPages = 0;
+        }
+    }
+
     //
     // Now we actually need to get these many physical pages. Nonpaged pool
     // is actually also physically contiguous (but not the expansion)
@@ -400,6 +449,15 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
                                     MmSizeOfNonPagedPoolInBytes - 1));
     while (StartPde <= EndPde)
     {
+        //
+        // PDEs which will be mapped with large pages don't need page tables
+        //
+        if ((StartPde >= LargeStartPde) && (StartPde < LargeEndPde))
+        {
+            StartPde++;
+            continue;
+        }
+
         //
         // Get a page
         //
@@ -431,6 +489,26 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
                                      MmSizeOfNonPagedPoolInBytes - 1));
     while (PointerPte <= LastPte)
     {
+        //
+        // Check if this is the beginning of a large page
+        //
+        StartPde = MiAddressToPde(MiPteToAddress(PointerPte));
+        if ((StartPde >= LargeStartPde) && (StartPde < LargeEndPde))
+        {
+            //
+            // Map the whole PDE with our contiguous pages
+            //
+            ASSERT(MiAddressToPteOffset(MiPteToAddress(PointerPte)) == 0);
+            ASSERT((PageFrameIndex & (PTE_PER_PAGE - 1)) == 0);
+            TempPde.u.Hard.PageFrameNumber = PageFrameIndex;
+            TempPde.u.Hard.LargePage = 1;
+            MI_WRITE_VALID_PTE(StartPde, TempPde);
+            TempPde.u.Hard.LargePage = 0;
+            PageFrameIndex += PTE_PER_PAGE;
+            PointerPte += PTE_PER_PAGE;
+            continue;
+        }
+
         //
         // Use one of our contigous pages
         //
@@ -456,6 +534,22 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
 
     /* Build the PFN Database */
     MiInitializePfnDatabase(LoaderBlock);
+
+    //
+    // Give back the pages we skipped to align nonpaged pool for large pages
+    //
+    if (PadPages)
+    {
+        OldIrql = MiAcquirePfnLock();
+        while (PadPages--)
+        {
+            Pfn1 = MiGetPfnEntry(PadPageFrame);
+            ASSERT(Pfn1->u3.e2.ReferenceCount == 0);
+            Pfn1->u3.e1.CacheAttribute = MiNonCached;
+            MiInsertPageInFreeList(PadPageFrame++);
+        }
+        MiReleasePfnLock(OldIrql);
+    }
     MmInitializeBalancer(MmAvailablePages, 0);
 
     //
@@ -577,7 +671,7 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     ASSERT(StartPde->u.Hard.Valid == 1);
     PointerPte = MiAddressToPte(MmFreePagesByColor[0]);
     ASSERT(PointerPte->u.Hard.Valid == 1);
-    LastPte = MiAddressToPte((ULONG_PTR)&MmFreePagesByColor[1][MmSecondaryColors] - 1);
+    LastPte = MiAddressToPte((ULONG_PTR)&MmFreePagesByColor[1][MI_NUMBER_OF_COLORS] - 1);
     ASSERT(LastPte->u.Hard.Valid == 1);
 
     /* Loop the color list PTEs */
@@ -222,15 +222,10 @@ MmUnmapIoSpace(IN PVOID BaseAddress,
         // Destroy the PTE
         //
         RtlZeroMemory(PointerPte, PageCount * sizeof(MMPTE));
-
-        //
-        // Blow the TLB
-        //
-        KeFlushEntireTb(TRUE, TRUE);
     }
 
     //
-    // Release the PTEs
+    // Release the PTEs, which also takes care of flushing them from the TB
     //
     MiReleaseSystemPtes(PointerPte, PageCount, 0);
 }
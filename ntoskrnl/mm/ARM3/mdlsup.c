@@ -432,16 +432,25 @@ MmBuildMdlForNonPagedPool(IN PMDL Mdl)
     EndPage = MdlPages + PageCount;
 
     //
-    // Loop the PTEs
+    // Loop the pages. Initial nonpaged pool might be mapped with large pages,
+    // in which case there is no PTE to read the PFN from.
     //
-    PointerPte = MiAddressToPte(Base);
     do
     {
         //
         // Write the PFN
         //
-        Pfn = PFN_FROM_PTE(PointerPte++);
+        if (MI_IS_PHYSICAL_ADDRESS(Base))
+        {
+            Pfn = MI_CONVERT_PHYSICAL_TO_PFN(Base);
+        }
+        else
+        {
+            PointerPte = MiAddressToPte(Base);
+            Pfn = PFN_FROM_PTE(PointerPte);
+        }
         *MdlPages++ = Pfn;
+        Base = (PVOID)((ULONG_PTR)Base + PAGE_SIZE);
     } while (MdlPages < EndPage);
 
     //
@@ -985,9 +994,6 @@ MmProbeAndLockPages(IN PMDL Mdl,
     TotalPages = LockPages;
     StartAddress = Address;
 
-    /* Large pages not supported */
-    ASSERT(!MI_IS_PHYSICAL_ADDRESS(Address));
-
     //
     // Now probe them
     //
@@ -1170,7 +1176,8 @@ MmProbeAndLockPages(IN PMDL Mdl,
                (PointerPpe->u.Hard.Valid == 0) ||
 #endif
                (PointerPde->u.Hard.Valid == 0) ||
-               (PointerPte->u.Hard.Valid == 0))
+               ((PointerPde->u.Hard.LargePage == 0) &&
+                (PointerPte->u.Hard.Valid == 0)))
         {
             //
             // What kind of lock were we using?
@@ -1305,9 +1312,17 @@ MmProbeAndLockPages(IN PMDL Mdl,
         }
 
         //
-        // Grab the PFN
+        // Grab the PFN, large pages (initial nonpaged pool) don't have a PTE
         //
-        PageFrameIndex = PFN_FROM_PTE(PointerPte);
+        if (PointerPde->u.Hard.LargePage)
+        {
+            PageFrameIndex = PFN_FROM_PTE(PointerPde) +
+                             MiAddressToPteOffset(MiPteToAddress(PointerPte));
+        }
+        else
+        {
+            PageFrameIndex = PFN_FROM_PTE(PointerPte);
+        }
         Pfn1 = MiGetPfnEntry(PageFrameIndex);
         if (Pfn1)
         {
@@ -1660,16 +1675,97 @@ MmProbeAndLockProcessPages(IN OUT PMDL MemoryDescriptorList,
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
 MmProbeAndLockSelectedPages(IN OUT PMDL MemoryDescriptorList,
-                            IN LARGE_INTEGER PageList[],
+                            IN PFILE_SEGMENT_ELEMENT SegmentArray,
                             IN KPROCESSOR_MODE AccessMode,
                             IN LOCK_OPERATION Operation)
 {
-    UNIMPLEMENTED;
+    PMDL Mdl = MemoryDescriptorList;
+    PFN_NUMBER MdlBuffer[(sizeof(MDL) / sizeof(PFN_NUMBER)) + 1];
+    PMDL PageMdl = (PMDL)MdlBuffer;
+    PPFN_NUMBER MdlPages;
+    PVOID Address;
+    ULONG PageCount, ByteCount, i;
+    ULONG Flags = 0;
+    PEPROCESS Process = NULL;
+    NTSTATUS Status = STATUS_SUCCESS;
+    DPRINT("Probing selected pages for MDL: %p\n", Mdl);
+
+    //
+    // Sanity checks. The MDL only gives the size, each segment element
+    // supplies the address of one page
+    //
+    ASSERT(Mdl->ByteCount != 0);
+    ASSERT(Mdl->ByteOffset == 0);
+    ASSERT((Mdl->MdlFlags & (MDL_PAGES_LOCKED |
+                             MDL_MAPPED_TO_SYSTEM_VA |
+                             MDL_SOURCE_IS_NONPAGED_POOL |
+                             MDL_PARTIAL |
+                             MDL_IO_SPACE)) == 0);
+
+    MdlPages = (PPFN_NUMBER)(Mdl + 1);
+    PageCount = ADDRESS_AND_SIZE_TO_SPAN_PAGES(Mdl->StartVa, Mdl->ByteCount);
+
+    //
+    // Lock the pages one at a time and collect their PFNs
+    //
+    for (i = 0; i < PageCount; i++)
+    {
+        _SEH2_TRY
+        {
+            Address = (PVOID)(ULONG_PTR)SegmentArray[i].Alignment;
+            if (BYTE_OFFSET(Address)) ExRaiseStatus(STATUS_DATATYPE_MISALIGNMENT);
+
+            MmInitializeMdl(PageMdl, Address, PAGE_SIZE);
+            MmProbeAndLockPages(PageMdl, AccessMode, Operation);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+        if (!NT_SUCCESS(Status)) break;
+
+        //
+        // All pages must belong to the same address space, so that the
+        // locked pages accounting done by MmUnlockPages stays right
+        //
+        ASSERT((i == 0) || (PageMdl->Process == Process));
+        Process = PageMdl->Process;
+        Flags |= PageMdl->MdlFlags & (MDL_WRITE_OPERATION | MDL_IO_SPACE);
+        MdlPages[i] = *(PPFN_NUMBER)(PageMdl + 1);
+    }
+
+    //
+    // The MDL now describes the locked pages, even a partial list must be
+    // unlocked on failure
+    //
+    Mdl->Process = Process;
+    Mdl->MdlFlags |= Flags | MDL_PAGES_LOCKED;
+    if (NT_SUCCESS(Status)) return;
+
+    if (i)
+    {
+        //
+        // Unlock what we got so far
+        //
+        ByteCount = Mdl->ByteCount;
+        Mdl->ByteCount = i << PAGE_SHIFT;
+        MmUnlockPages(Mdl);
+        Mdl->ByteCount = ByteCount;
+    }
+    else
+    {
+        Mdl->MdlFlags &= ~(Flags | MDL_PAGES_LOCKED);
+    }
+
+    Mdl->Process = NULL;
+    MdlPages[0] = LIST_HEAD;
+    ExRaiseStatus(Status);
 }
 
 /*
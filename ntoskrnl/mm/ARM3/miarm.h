@@ -205,11 +205,27 @@ extern const ULONG MmProtectToValue[32];
 #define MM_NOIRQL (KIRQL)0xFFFFFFFF
 
 //
-// Returns the color of a page
+// Returns the node of a page. There is no memory affinity information (SRAT)
+// yet, so all memory belongs to the first node for now.
 //
-#define MI_GET_PAGE_COLOR(x)                ((x) & MmSecondaryColorMask)
-#define MI_GET_NEXT_COLOR()                 (MI_GET_PAGE_COLOR(++MmSystemPageColor))
-#define MI_GET_NEXT_PROCESS_COLOR(x)        (MI_GET_PAGE_COLOR(++(x)->NextPageColor))
+#define MI_GET_PAGE_NODE(x)                 (0)
+
+//
+// Returns the color of a page. The lower bits are the cache color, the node
+// number sits above them, so that each node has its own set of color lists.
+//
+#define MI_GET_PAGE_COLOR(x)                (((x) & MmSecondaryColorMask) | \
+                                             (MI_GET_PAGE_NODE(x) << MmSecondaryColorNodeShift))
+#define MI_GET_COLOR_NODE(c)                ((c) >> MmSecondaryColorNodeShift)
+#define MI_NUMBER_OF_COLORS                 (MmSecondaryColors * KeNumberNodes)
+
+//
+// Returns the next color to allocate from, on the current processor's node
+//
+#define MI_GET_NEXT_COLOR()                 (((++MmSystemPageColor) & MmSecondaryColorMask) | \
+                                             MiGetCurrentNodeColor())
+#define MI_GET_NEXT_PROCESS_COLOR(x)        (((++(x)->NextPageColor) & MmSecondaryColorMask) | \
+                                             MiGetCurrentNodeColor())
 
 //
 // Prototype PTEs that don't yet have a pagefile association
@@ -418,6 +434,18 @@ typedef struct _MI_LARGE_PAGE_RANGES
     PFN_NUMBER LastFrame;
 } MI_LARGE_PAGE_RANGES, *PMI_LARGE_PAGE_RANGES;
 
+//
+// TB entries to flush in one go once a batch of PTEs has been invalidated.
+// Past MI_MAXIMUM_FLUSH_COUNT entries the whole TB gets flushed instead.
+//
+#define MI_MAXIMUM_FLUSH_COUNT  32
+
+typedef struct _MMPTE_FLUSH_LIST
+{
+    ULONG Count;
+    PVOID FlushVa[MI_MAXIMUM_FLUSH_COUNT];
+} MMPTE_FLUSH_LIST, *PMMPTE_FLUSH_LIST;
+
 typedef struct _MMVIEW
 {
     ULONG_PTR Entry;
@@ -508,6 +536,8 @@ extern MMPTE MmDecommittedPte;
 extern BOOLEAN MmLargeSystemCache;
 extern BOOLEAN MmZeroPageFile;
 extern BOOLEAN MmProtectFreedNonPagedPool;
+extern ULONG MmLargePageNonPagedPool;
+extern PFN_COUNT MiLargePageNonPagedPoolPages;
 extern BOOLEAN MmTrackLockedPages;
 extern BOOLEAN MmTrackPtes;
 extern BOOLEAN MmDynamicPfn;
@@ -577,6 +607,7 @@ extern SIZE_T MmDefaultMaximumNonPagedPool;
 extern ULONG MmMaxAdditionNonPagedPoolPerMb;
 extern ULONG MmSecondaryColors;
 extern ULONG MmSecondaryColorMask;
+extern ULONG MmSecondaryColorNodeShift;
 extern ULONG MmNumberOfSystemPtes;
 extern ULONG MmMaximumNonPagedPoolPercent;
 extern ULONG MmLargeStackSize;
@@ -598,6 +629,7 @@ extern PFN_NUMBER MiLowNonPagedPoolThreshold;
 extern PFN_NUMBER MiHighNonPagedPoolThreshold;
 extern PFN_NUMBER MmMinimumFreePages;
 extern PFN_NUMBER MmPlentyFreePages;
+extern ULONG MmReadClusterSize;
 extern SIZE_T MmMinimumStackCommitInBytes;
 extern PFN_COUNT MiExpansionPoolPagesInitialCharge;
 extern PFN_NUMBER MmResidentAvailablePages;
@@ -614,6 +646,8 @@ extern PMMPTE MmSharedUserDataPte;
 extern LIST_ENTRY MmProcessList;
 extern BOOLEAN MmZeroingPageThreadActive;
 extern KEVENT MmZeroingPageEvent;
+extern PFN_NUMBER MmZeroedPageLowWatermark;
+extern PFN_NUMBER MmZeroedPageHighWatermark;
 extern ULONG MmSystemPageColor;
 extern ULONG MmProcessColorSeed;
 extern PMMWSL MmWorkingSetList;
@@ -908,6 +942,72 @@ MI_IS_PHYSICAL_ADDRESS(IN PVOID Address)
     return ((PointerPde->u.Hard.LargePage) && (PointerPde->u.Hard.Valid));
 }
 
+//
+// Returns the first color of the current processor's node
+//
+FORCEINLINE
+ULONG
+MiGetCurrentNodeColor(VOID)
+{
+    PKNODE Node = KeGetCurrentPrcb()->ParentNode;
+
+    /* Processors which haven't been assigned to a node use the first one */
+    return Node ? Node->MmShiftedColor : 0;
+}
+
+//
+// Returns the page frame backing an address mapped by a large page
+//
+FORCEINLINE
+PFN_NUMBER
+MI_CONVERT_PHYSICAL_TO_PFN(IN PVOID Address)
+{
+    ASSERT(MI_IS_PHYSICAL_ADDRESS(Address));
+    return PFN_FROM_PTE(MiAddressToPde(Address)) + MiAddressToPteOffset(Address);
+}
+
+//
+// Returns the page frame backing a nonpaged system address, which can either
+// be mapped by a PTE or by a large page (initial nonpaged pool). Fails if the
+// address is a guard page or otherwise invalid.
+//
+FORCEINLINE
+BOOLEAN
+MiGetNonPagedPageFrame(IN PVOID Address,
+                       OUT PPFN_NUMBER PageFrameIndex)
+{
+    PMMPTE PointerPte;
+
+    /* Large pages are always resident */
+    if (MI_IS_PHYSICAL_ADDRESS(Address))
+    {
+        *PageFrameIndex = MI_CONVERT_PHYSICAL_TO_PFN(Address);
+        return TRUE;
+    }
+
+    /* Otherwise the PTE must be valid */
+    PointerPte = MiAddressToPte(Address);
+    if (PointerPte->u.Hard.Valid == 0) return FALSE;
+    *PageFrameIndex = PFN_FROM_PTE(PointerPte);
+    return TRUE;
+}
+
+//
+// Same as above, for an address which is known to be resident
+//
+FORCEINLINE
+PFN_NUMBER
+MiNonPagedAddressToPageFrame(IN PVOID Address)
+{
+    PFN_NUMBER PageFrameIndex = 0;
+
+    if (!MiGetNonPagedPageFrame(Address, &PageFrameIndex))
+    {
+        ASSERT(FALSE);
+    }
+    return PageFrameIndex;
+}
+
 //
 // Writes a valid PTE
 //
@@ -963,6 +1063,22 @@ MI_ERASE_PTE(IN PMMPTE PointerPte)
     PointerPte->u.Long = 0;
 }
 
+//
+// Queues the TB flush of an address whose PTE was invalidated
+//
+FORCEINLINE
+VOID
+MI_QUEUE_TB_FLUSH(IN PMMPTE_FLUSH_LIST FlushList,
+                  IN PVOID VirtualAddress)
+{
+    /* Keep counting once the list is full, so that it gets flushed entirely */
+    if (FlushList->Count < MI_MAXIMUM_FLUSH_COUNT)
+    {
+        FlushList->FlushVa[FlushList->Count] = VirtualAddress;
+    }
+    FlushList->Count++;
+}
+
 //
 // Writes a valid PDE
 //
@@ -2181,6 +2297,13 @@ MiDeletePte(
     IN PMMPTE PrototypePte
 );
 
+VOID
+NTAPI
+MiFlushPteList(
+    IN PMMPTE_FLUSH_LIST FlushList,
+    IN BOOLEAN AllProcessors
+);
+
 ULONG
 NTAPI
 MiMakeSystemAddressValid(
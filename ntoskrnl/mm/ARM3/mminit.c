@@ -255,6 +255,7 @@ PVOID MmHyperSpaceEnd;
 //
 ULONG MmSecondaryColors;
 ULONG MmSecondaryColorMask;
+ULONG MmSecondaryColorNodeShift;
 
 //
 // Actual (registry-configurable) size of a GUI thread's stack
@@ -277,7 +278,8 @@ MEMORY_ALLOCATION_DESCRIPTOR MxOldFreeDescriptor;
  * free lists are organized in what is called a "color".
  *
  * This array points to the two lists, so it can be thought of as a multi-dimensional
- * array of MmFreePagesByColor[2][MmSecondaryColors]. Since the number is dynamic,
+ * array of MmFreePagesByColor[2][MmSecondaryColors * KeNumberNodes]. Each node gets
+ * its own range of colors (see MI_GET_PAGE_COLOR). Since the number is dynamic,
  * we describe the array in pointer form instead.
  *
  * On a final note, the color tables themselves are right after the PFN database.
@@ -507,7 +509,7 @@ NTAPI
 INIT_FUNCTION
 MiComputeColorInformation(VOID)
 {
-    ULONG L2Associativity;
+    ULONG L2Associativity, i;
 
     /* Check if no setting was provided already */
     if (!MmSecondaryColors)
@@ -554,6 +556,20 @@ MiComputeColorInformation(VOID)
     /* Compute the mask and store it */
     MmSecondaryColorMask = MmSecondaryColors - 1;
     KeGetCurrentPrcb()->SecondaryColorMask = MmSecondaryColorMask;
+
+    /* The node number goes above the color bits */
+    MmSecondaryColorNodeShift = 0;
+    while ((1UL << MmSecondaryColorNodeShift) < MmSecondaryColors)
+    {
+        MmSecondaryColorNodeShift++;
+    }
+
+    /* Give each node its range of colors */
+    for (i = 0; i < KeNumberNodes; i++)
+    {
+        KeNodeBlock[i]->Color = (UCHAR)i;
+        KeNodeBlock[i]->MmShiftedColor = i << MmSecondaryColorNodeShift;
+    }
 }
 
 VOID
@@ -571,7 +587,7 @@ MiInitializeColorTables(VOID)
     /* Loop the PTEs. We have two color tables for each secondary color */
     PointerPte = MiAddressToPte(&MmFreePagesByColor[0][0]);
     LastPte = MiAddressToPte((ULONG_PTR)MmFreePagesByColor[0] +
-                             (2 * MmSecondaryColors * sizeof(MMCOLOR_TABLES))
+                             (2 * MI_NUMBER_OF_COLORS * sizeof(MMCOLOR_TABLES))
                              - 1);
     while (PointerPte <= LastPte)
     {
@@ -591,10 +607,10 @@ MiInitializeColorTables(VOID)
     }
 
     /* Now set the address of the next list, right after this one */
-    MmFreePagesByColor[1] = &MmFreePagesByColor[0][MmSecondaryColors];
+    MmFreePagesByColor[1] = &MmFreePagesByColor[0][MI_NUMBER_OF_COLORS];
 
     /* Now loop the lists to set them up */
-    for (i = 0; i < MmSecondaryColors; i++)
+    for (i = 0; i < MI_NUMBER_OF_COLORS; i++)
     {
         /* Set both free and zero lists for each color */
         MmFreePagesByColor[ZeroedPageList][i].Flink = LIST_HEAD;
@@ -782,8 +798,37 @@ MiBuildPfnDatabaseFromPages(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     Count = PD_COUNT * PDE_COUNT;
     for (i = 0; i < Count; i++)
     {
-        /* Check for valid PDE */
-        if (PointerPde->u.Hard.Valid == 1)
+        /* Check for a large page (initial nonpaged pool) */
+        if ((PointerPde->u.Hard.Valid == 1) &&
+            (PointerPde->u.Hard.LargePage == 1))
+        {
+            /* There's no page table, so set up PFN entries for the whole range */
+            PageFrameIndex = PFN_FROM_PTE(PointerPde);
+            for (j = 0; j < PTE_COUNT; j++, PageFrameIndex++)
+            {
+                if (!MiIsRegularMemory(LoaderBlock, PageFrameIndex)) continue;
+
+                Pfn2 = MiGetPfnEntry(PageFrameIndex);
+                if ((MmIsAddressValid(Pfn2)) && (MmIsAddressValid(Pfn2 + 1)))
+                {
+                    /* The PDE takes the role of the PTE here */
+                    Pfn2->u4.PteFrame = StartupPdIndex;
+                    Pfn2->PteAddress = (PMMPTE)PointerPde;
+                    Pfn2->u2.ShareCount++;
+                    Pfn2->u3.e2.ReferenceCount = 1;
+                    Pfn2->u3.e1.PageLocation = ActiveAndValid;
+                    Pfn2->u3.e1.CacheAttribute = MiNonCached;
+#if MI_TRACE_PFNS
+                    Pfn2->PfnUsage = MI_USAGE_INIT_MEMORY;
+                    memcpy(Pfn2->ProcessName, "Initial PDE", 16);
+#endif
+                }
+            }
+
+            /* Next PDE mapped address */
+            BaseAddress += PDE_MAPPED_VA;
+        }
+        else if (PointerPde->u.Hard.Valid == 1)
         {
             /* Get the PFN from it */
             PageFrameIndex = PFN_FROM_PTE(PointerPde);
@@ -2318,7 +2363,7 @@ MmArmInitSystem(IN ULONG Phase,
         // Calculate the number of bytes for the PFN database
         // then add the color tables and convert to pages
         MxPfnAllocation = (MmHighestPhysicalPage + 1) * sizeof(MMPFN);
-        MxPfnAllocation += (MmSecondaryColors * sizeof(MMCOLOR_TABLES) * 2);
+        MxPfnAllocation += (MI_NUMBER_OF_COLORS * sizeof(MMCOLOR_TABLES) * 2);
         MxPfnAllocation >>= PAGE_SHIFT;
 
         // We have to add one to the count here, because in the process of
@@ -2466,6 +2511,11 @@ MmArmInitSystem(IN ULONG Phase,
             MmSystemCacheWsMinimum += 500;
         }
 
+        /* Small systems read fewer extra pages around a paging fault */
+        MmReadClusterSize = (MmSystemSize == MmSmallSystem) ?
+                            (MM_MAXIMUM_READ_CLUSTER_SIZE / 2) :
+                            MM_MAXIMUM_READ_CLUSTER_SIZE;
+
         /* Now setup the shared user data fields */
         ASSERT(SharedUserData->NumberOfPhysicalPages == 0);
         SharedUserData->NumberOfPhysicalPages = MmNumberOfPhysicalPages;
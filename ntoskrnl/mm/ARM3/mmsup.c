@@ -186,6 +186,9 @@ MmIsAddressValid(IN PVOID VirtualAddress)
 #if _MI_PAGING_LEVELS >= 2
     /* Check if the PDE is valid */
     if (MiAddressToPde(VirtualAddress)->u.Hard.Valid == 0) return FALSE;
+
+    /* Large pages don't have a PTE */
+    if (MI_IS_PHYSICAL_ADDRESS(VirtualAddress)) return TRUE;
 #endif
 
     /* Check if the PTE is valid */
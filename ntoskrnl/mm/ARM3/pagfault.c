@@ -856,6 +856,123 @@ MiCompleteProtoPteFault(IN BOOLEAN StoreInstruction,
     return STATUS_SUCCESS;
 }
 
+static
+PFN_COUNT
+MiBuildPageFileCluster(
+    _In_ PMMPTE PointerPte,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset,
+    _In_ PFN_NUMBER PteFrame,
+    _In_ PEPROCESS CurrentProcess,
+    _Out_writes_to_(MM_MAXIMUM_READ_CLUSTER_SIZE, return) PPFN_NUMBER Pages)
+{
+    PETHREAD CurrentThread = PsGetCurrentThread();
+    PFN_COUNT ClusterSize, PageCount;
+    PMMPTE NextPte;
+    MMPTE TempPte;
+    PMMPFN Pfn1;
+    PFN_NUMBER Page;
+
+    /* Make sure the PFN lock is held */
+    MI_ASSERT_PFN_LOCK_HELD();
+
+    /* Check if the thread asked for clustering to be turned off */
+    if (CurrentThread->DisablePageFaultClustering) return 0;
+    ClusterSize = min(CurrentThread->ReadClusterSize, MM_MAXIMUM_READ_CLUSTER_SIZE);
+
+    //
+    // Take the following PTEs of the same page table as long as they are
+    // still paged out to the next slots of the same paging file. The extra
+    // pages are only worth it while there is plenty of free memory, as the
+    // standby list is not reclaimed by the allocator yet.
+    //
+    for (PageCount = 0; PageCount < ClusterSize; PageCount++)
+    {
+        NextPte = PointerPte + PageCount + 1;
+        if (MiIsPteOnPdeBoundary(NextPte)) break;
+
+        TempPte = *NextPte;
+        if ((TempPte.u.Hard.Valid == 1) ||
+            (TempPte.u.Soft.Prototype == 1) ||
+            (TempPte.u.Soft.Transition == 1) ||
+            (TempPte.u.Soft.PageFileLow != PageFileIndex) ||
+            (TempPte.u.Soft.PageFileHigh != PageFileOffset + PageCount + 1))
+        {
+            break;
+        }
+
+        if ((MmFreePageListHead.Total + MmZeroedPageListHead.Total) < MmPlentyFreePages) break;
+
+        /* Get a page for it */
+        Page = MiRemoveAnyPage(MI_GET_NEXT_PROCESS_COLOR(CurrentProcess));
+        Pfn1 = MI_PFN_ELEMENT(Page);
+
+        //
+        // Set it up as a transition page that nobody maps, held only by the
+        // reference of the read in progress
+        //
+        Pfn1->PteAddress = NextPte;
+        Pfn1->OriginalPte = TempPte;
+        ASSERT(Pfn1->u3.e2.ReferenceCount == 0);
+        Pfn1->u3.e2.ReferenceCount = 1;
+        Pfn1->u2.ShareCount = 0;
+        Pfn1->u3.e1.PageLocation = TransitionPage;
+        Pfn1->u3.e1.Modified = 0;
+        Pfn1->u3.e1.PrototypePte = 0;
+        Pfn1->u4.InPageError = 0;
+        Pfn1->u1.Event = NULL;
+        Pfn1->u3.e1.ReadInProgress = 1;
+
+        /* The page table stays around as long as the page is in transition */
+        Pfn1->u4.PteFrame = PteFrame;
+        MI_PFN_ELEMENT(PteFrame)->u2.ShareCount++;
+
+        /* Point the PTE at the page being read */
+        MI_MAKE_TRANSITION_PTE(&TempPte, Page, TempPte.u.Soft.Protection);
+        MI_WRITE_INVALID_PTE(NextPte, TempPte);
+
+        Pages[PageCount] = Page;
+    }
+
+    return PageCount;
+}
+
+static
+VOID
+MiCompletePageFileClusterPage(
+    _In_ PFN_NUMBER Page,
+    _In_ NTSTATUS Status)
+{
+    PMMPFN Pfn1 = MI_PFN_ELEMENT(Page);
+
+    /* Make sure the PFN lock is held */
+    MI_ASSERT_PFN_LOCK_HELD();
+
+    /* Nobody should have changed that while we were not looking */
+    ASSERT(Pfn1->u3.e1.ReadInProgress == 1);
+    ASSERT(Pfn1->u3.e1.PageLocation == TransitionPage);
+    ASSERT(Pfn1->u2.ShareCount == 0);
+    Pfn1->u3.e1.ReadInProgress = 0;
+
+    /* Wake up anyone who faulted on it in the meantime, they will fault again */
+    if (Pfn1->u1.Event) KeSetEvent(Pfn1->u1.Event, IO_NO_INCREMENT, FALSE);
+    Pfn1->u1.Event = NULL;
+
+    if (!NT_SUCCESS(Status))
+    {
+        //
+        // Nobody asked for this page, so simply put the paged out PTE back and
+        // get rid of it. The data will be read again if it is ever needed.
+        //
+        MI_WRITE_INVALID_PTE(Pfn1->PteAddress, Pfn1->OriginalPte);
+        MiDecrementShareCount(MI_PFN_ELEMENT(Pfn1->u4.PteFrame), Pfn1->u4.PteFrame);
+        MI_SET_PFN_DELETED(Pfn1);
+    }
+
+    /* Drop the read reference, this puts the page on the standby list */
+    MiDecrementReferenceCount(Pfn1, Page);
+}
+
 static
 NTSTATUS
 NTAPI
@@ -873,6 +990,8 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
     ULONG PageFileIndex = TempPte.u.Soft.PageFileLow;
     ULONG_PTR PageFileOffset = TempPte.u.Soft.PageFileHigh;
     ULONG Protection = TempPte.u.Soft.Protection;
+    PFN_NUMBER Pages[MM_MAXIMUM_READ_CLUSTER_SIZE + 1];
+    PFN_COUNT PageCount, i;
 
     /* Things we don't support yet */
     ASSERT(CurrentProcess > HYDRA_PROCESS);
@@ -905,11 +1024,20 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
 
     MI_WRITE_INVALID_PTE(PointerPte, TempPte);
 
+    /* Bring the following pages of the paging file in with the same read */
+    Pages[0] = Page;
+    PageCount = 1 + MiBuildPageFileCluster(PointerPte,
+                                           PageFileIndex,
+                                           PageFileOffset,
+                                           Pfn1->u4.PteFrame,
+                                           CurrentProcess,
+                                           &Pages[1]);
+
     /* Release the PFN lock while we proceed */
     MiReleasePfnLock(*OldIrql);
 
     /* Do the paging IO */
-    Status = MiReadPageFile(Page, PageFileIndex, PageFileOffset);
+    Status = MiReadPageFileCluster(Pages, PageCount, PageFileIndex, PageFileOffset);
 
     /* Lock the PFN database again */
     *OldIrql = MiAcquirePfnLock();
@@ -938,6 +1066,12 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
         KeSetEvent(Pfn1->u1.Event, IO_NO_INCREMENT, FALSE);
     }
 
+    /* The rest of the cluster goes to the standby list */
+    for (i = 1; i < PageCount; i++)
+    {
+        MiCompletePageFileClusterPage(Pages[i], Status);
+    }
+
     return Status;
 }
 
@@ -117,6 +117,21 @@ MiDecrementAvailablePages(
     }
 }
 
+static
+VOID
+MiCheckZeroedPageWatermark(
+    VOID)
+{
+    /* Wake up the zeroing workers early if we're running out of zeroed pages */
+    if ((MmZeroedPageListHead.Total < MmZeroedPageLowWatermark) &&
+        (MmFreePageListHead.Total) &&
+        !(MmZeroingPageThreadActive))
+    {
+        /* Set the event */
+        KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
+    }
+}
+
 VOID
 NTAPI
 MiZeroPhysicalPage(IN PFN_NUMBER PageFrameIndex)
@@ -191,7 +206,10 @@ MiUnlinkFreeOrZeroedPage(IN PMMPFN Entry)
 
     /* Get the page color */
     OldBlink = MiGetPfnEntryIndex(Entry);
-    Color = OldBlink & MmSecondaryColorMask;
+    Color = MI_GET_PAGE_COLOR(OldBlink);
+
+    /* One less page on this list for the page's node */
+    KeNodeBlock[MI_GET_COLOR_NODE(Color)]->FreeCount[ListName]--;
 
     /* Get the first page on the color list */
     ColorTable = &MmFreePagesByColor[ListName][Color];
@@ -289,7 +307,6 @@ MiUnlinkPageFromList(IN PMMPFN Pfn)
         MiDecrementAvailablePages();
 
         /* Decrease transition page counter */
-        ASSERT(Pfn->u3.e1.PrototypePte == 1); /* Only supported ARM3 case */
         MmTransitionSharedPages--;
     }
     else if (ListHead == &MmModifiedPageListHead)
@@ -372,7 +389,8 @@ MiRemovePageByColor(IN PFN_NUMBER PageIndex,
 
     /* Make sure PFN lock is held */
     MI_ASSERT_PFN_LOCK_HELD();
-    ASSERT(Color < MmSecondaryColors);
+    ASSERT(Color < MI_NUMBER_OF_COLORS);
+    ASSERT(Color == MI_GET_PAGE_COLOR(PageIndex));
 
     /* Get the PFN entry */
     Pfn1 = MI_PFN_ELEMENT(PageIndex);
@@ -430,10 +448,12 @@ MiRemovePageByColor(IN PFN_NUMBER PageIndex,
     Pfn1->u3.e1.CacheAttribute = OldCache;
 
     /* Get the first page on the color list */
-    ASSERT(Color < MmSecondaryColors);
     ColorTable = &MmFreePagesByColor[ListName][Color];
     ASSERT(ColorTable->Count >= 1);
 
+    /* One less page on this list for the page's node */
+    KeNodeBlock[MI_GET_COLOR_NODE(Color)]->FreeCount[ListName]--;
+
     /* Set the forward link to whoever we were pointing to */
     ColorTable->Flink = Pfn1->OriginalPte.u.Long;
 
@@ -470,6 +490,35 @@ MiRemovePageByColor(IN PFN_NUMBER PageIndex,
     return PageIndex;
 }
 
+static
+PFN_NUMBER
+MiFindPageOnNode(IN MMLISTS ListName,
+                 IN OUT PULONG Color)
+{
+    ULONG NodeColor, i, NewColor;
+    PFN_NUMBER PageIndex;
+
+    /* Don't bother scanning if the node has no pages on this list at all */
+    NodeColor = *Color & ~MmSecondaryColorMask;
+    if (!KeNodeBlock[MI_GET_COLOR_NODE(*Color)]->FreeCount[ListName]) return LIST_HEAD;
+
+    /* Try the other colors of the same node, in order */
+    for (i = 1; i < MmSecondaryColors; i++)
+    {
+        NewColor = ((*Color + i) & MmSecondaryColorMask) | NodeColor;
+        PageIndex = MmFreePagesByColor[ListName][NewColor].Flink;
+        if (PageIndex != LIST_HEAD)
+        {
+            *Color = NewColor;
+            return PageIndex;
+        }
+    }
+
+    /* The counts say there are pages, but not on the expected lists */
+    ASSERT(FALSE);
+    return LIST_HEAD;
+}
+
 PFN_NUMBER
 NTAPI
 MiRemoveAnyPage(IN ULONG Color)
@@ -480,7 +529,7 @@ MiRemoveAnyPage(IN ULONG Color)
     /* Make sure PFN lock is held and we have pages */
     MI_ASSERT_PFN_LOCK_HELD();
     ASSERT(MmAvailablePages != 0);
-    ASSERT(Color < MmSecondaryColors);
+    ASSERT(Color < MI_NUMBER_OF_COLORS);
 
     /* Check the colored free list */
     PageIndex = MmFreePagesByColor[FreePageList][Color].Flink;
@@ -489,17 +538,23 @@ MiRemoveAnyPage(IN ULONG Color)
         /* Check the colored zero list */
         PageIndex = MmFreePagesByColor[ZeroedPageList][Color].Flink;
         if (PageIndex == LIST_HEAD)
+        {
+            /* Prefer any page of another color on the same node */
+            PageIndex = MiFindPageOnNode(FreePageList, &Color);
+            if (PageIndex == LIST_HEAD) PageIndex = MiFindPageOnNode(ZeroedPageList, &Color);
+        }
+        if (PageIndex == LIST_HEAD)
         {
             /* Check the free list */
             ASSERT_LIST_INVARIANT(&MmFreePageListHead);
             PageIndex = MmFreePageListHead.Flink;
-            Color = PageIndex & MmSecondaryColorMask;
+            Color = MI_GET_PAGE_COLOR(PageIndex);
             if (PageIndex == LIST_HEAD)
             {
                 /* Check the zero list */
                 ASSERT_LIST_INVARIANT(&MmZeroedPageListHead);
                 PageIndex = MmZeroedPageListHead.Flink;
-                Color = PageIndex & MmSecondaryColorMask;
+                Color = MI_GET_PAGE_COLOR(PageIndex);
                 ASSERT(PageIndex != LIST_HEAD);
                 if (PageIndex == LIST_HEAD)
                 {
@@ -512,6 +567,7 @@ MiRemoveAnyPage(IN ULONG Color)
 
     /* Remove the page from its list */
     PageIndex = MiRemovePageByColor(PageIndex, Color);
+    MiCheckZeroedPageWatermark();
 
     /* Sanity checks */
     Pfn1 = MI_PFN_ELEMENT(PageIndex);
@@ -537,10 +593,11 @@ MiRemoveZeroPage(IN ULONG Color)
     /* Make sure PFN lock is held and we have pages */
     MI_ASSERT_PFN_LOCK_HELD();
     ASSERT(MmAvailablePages != 0);
-    ASSERT(Color < MmSecondaryColors);
+    ASSERT(Color < MI_NUMBER_OF_COLORS);
 
-    /* Check the colored zero list */
+    /* Check the colored zero list, then the other colors of the same node */
     PageIndex = MmFreePagesByColor[ZeroedPageList][Color].Flink;
+    if (PageIndex == LIST_HEAD) PageIndex = MiFindPageOnNode(ZeroedPageList, &Color);
     if (PageIndex == LIST_HEAD)
     {
         /* Check the zero list */
@@ -552,14 +609,15 @@ MiRemoveZeroPage(IN ULONG Color)
             ASSERT(MmZeroedPageListHead.Total == 0);
             Zero = TRUE;
 
-            /* Check the colored free list */
+            /* Check the colored free list, then the rest of the node */
             PageIndex = MmFreePagesByColor[FreePageList][Color].Flink;
+            if (PageIndex == LIST_HEAD) PageIndex = MiFindPageOnNode(FreePageList, &Color);
             if (PageIndex == LIST_HEAD)
             {
                 /* Check the free list */
                 ASSERT_LIST_INVARIANT(&MmFreePageListHead);
                 PageIndex = MmFreePageListHead.Flink;
-                Color = PageIndex & MmSecondaryColorMask;
+                Color = MI_GET_PAGE_COLOR(PageIndex);
                 ASSERT(PageIndex != LIST_HEAD);
                 if (PageIndex == LIST_HEAD)
                 {
@@ -570,7 +628,7 @@ MiRemoveZeroPage(IN ULONG Color)
         }
         else
         {
-            Color = PageIndex & MmSecondaryColorMask;
+            Color = MI_GET_PAGE_COLOR(PageIndex);
         }
     }
 
@@ -582,6 +640,7 @@ MiRemoveZeroPage(IN ULONG Color)
     /* Remove the page from its list */
     PageIndex = MiRemovePageByColor(PageIndex, Color);
     ASSERT(Pfn1 == MI_PFN_ELEMENT(PageIndex));
+    MiCheckZeroedPageWatermark();
 
     /* Zero it, if needed */
     if (Zero) MiZeroPhysicalPage(PageIndex);
@@ -670,8 +729,9 @@ MiInsertPageInFreeList(IN PFN_NUMBER PageFrameIndex)
     /* Increment number of available pages */
     MiIncrementAvailablePages();
 
-    /* Get the page color */
-    Color = PageFrameIndex & MmSecondaryColorMask;
+    /* Get the page color, and account the page to its node */
+    Color = MI_GET_PAGE_COLOR(PageFrameIndex);
+    KeNodeBlock[MI_GET_COLOR_NODE(Color)]->FreeCount[FreePageList]++;
 
     /* Get the first page on the color list */
     ColorTable = &MmFreePagesByColor[FreePageList][Color];
@@ -734,7 +794,6 @@ MiInsertStandbyListAtFront(IN PFN_NUMBER PageFrameIndex)
     Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
     ASSERT(Pfn1->u4.MustBeCached == 0);
     ASSERT(Pfn1->u3.e2.ReferenceCount == 0);
-    ASSERT(Pfn1->u3.e1.PrototypePte == 1);
     ASSERT(Pfn1->u3.e1.Rom != 1);
 
     /* One more transition page on a list */
@@ -904,8 +963,9 @@ MiInsertPageInList(IN PMMPFNLIST ListHead,
         ASSERT(ListName == ZeroedPageList);
         ASSERT(Pfn1->u4.InPageError == 0);
 
-        /* Get the page color */
-        Color = PageFrameIndex & MmSecondaryColorMask;
+        /* Get the page color, and account the page to its node */
+        Color = MI_GET_PAGE_COLOR(PageFrameIndex);
+        KeNodeBlock[MI_GET_COLOR_NODE(Color)]->FreeCount[ZeroedPageList]++;
 
         /* Get the list for this color */
         ColorHead = &MmFreePagesByColor[ZeroedPageList][Color];
@@ -27,6 +27,8 @@ SIZE_T MmAllocatedNonPagedPool;
 ULONG MmSpecialPoolTag;
 ULONG MmConsumedPoolPercentage;
 BOOLEAN MmProtectFreedNonPagedPool;
+ULONG MmLargePageNonPagedPool;
+PFN_COUNT MiLargePageNonPagedPoolPages;
 SLIST_HEADER MiNonPagedPoolSListHead;
 ULONG MiNonPagedPoolSListMaximum = 4;
 SLIST_HEADER MiPagedPoolSListHead;
@@ -357,9 +359,7 @@ MiInitializeNonPagedPool(VOID)
     //
     // Validate and remember first allocated pool page
     //
-    PointerPte = MiAddressToPte(MmNonPagedPoolStart);
-    ASSERT(PointerPte->u.Hard.Valid == 1);
-    MiStartOfInitialPoolFrame = PFN_FROM_PTE(PointerPte);
+    MiStartOfInitialPoolFrame = MiNonPagedAddressToPageFrame(MmNonPagedPoolStart);
 
     //
     // Keep track of where initial nonpaged pool ends
@@ -370,9 +370,8 @@ MiInitializeNonPagedPool(VOID)
     //
     // Validate and remember last allocated pool page
     //
-    PointerPte = MiAddressToPte((PVOID)((ULONG_PTR)MmNonPagedPoolEnd0 - 1));
-    ASSERT(PointerPte->u.Hard.Valid == 1);
-    MiEndOfInitialPoolFrame = PFN_FROM_PTE(PointerPte);
+    MiEndOfInitialPoolFrame =
+        MiNonPagedAddressToPageFrame((PVOID)((ULONG_PTR)MmNonPagedPoolEnd0 - 1));
 
     //
     // Validate the first nonpaged pool expansion page (which is a guard page)
@@ -752,15 +751,10 @@ MiAllocatePoolPages(IN POOL_TYPE PoolType,
                 }
 
                 //
-                // Grab the PTE for this allocation
+                // Grab the PFN entry for this allocation. The initial pool may
+                // be mapped with large pages, so go through the VA.
                 //
-                PointerPte = MiAddressToPte(BaseVa);
-                ASSERT(PointerPte->u.Hard.Valid == 1);
-
-                //
-                // Grab the PFN NextEntry and index
-                //
-                Pfn1 = MiGetPfnEntry(PFN_FROM_PTE(PointerPte));
+                Pfn1 = MiGetPfnEntry(MiNonPagedAddressToPageFrame(BaseVa));
 
                 //
                 // Now mark it as the beginning of an allocation
@@ -781,11 +775,11 @@ MiAllocatePoolPages(IN POOL_TYPE PoolType,
                 if (SizeInPages != 1)
                 {
                     //
-                    // Navigate to the last PFN entry and PTE
+                    // Navigate to the last PFN entry
                     //
-                    PointerPte += SizeInPages - 1;
-                    ASSERT(PointerPte->u.Hard.Valid == 1);
-                    Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
+                    BaseVaStart = (PVOID)((ULONG_PTR)BaseVa +
+                                          ((SizeInPages - 1) << PAGE_SHIFT));
+                    Pfn1 = MiGetPfnEntry(MiNonPagedAddressToPageFrame(BaseVaStart));
                 }
 
                 //
@@ -900,13 +894,15 @@ ULONG
 NTAPI
 MiFreePoolPages(IN PVOID StartingVa)
 {
-    PMMPTE PointerPte, StartPte;
+    PMMPTE PointerPte;
     PMMPFN Pfn1, StartPfn;
+    PFN_NUMBER PageFrameIndex;
     PFN_COUNT FreePages, NumberOfPages;
     KIRQL OldIrql;
     PMMFREE_POOL_ENTRY FreeEntry, NextEntry, LastEntry;
     ULONG i, End;
     ULONG_PTR Offset;
+    PVOID PeekVa;
 
     //
     // Handle paged pool
@@ -976,8 +972,7 @@ MiFreePoolPages(IN PVOID StartingVa)
     // last PTE, meaning that this allocation was only for one page, push it into
     // the S-LIST instead of freeing it
     //
-    StartPte = PointerPte = MiAddressToPte(StartingVa);
-    StartPfn = Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
+    StartPfn = Pfn1 = MiGetPfnEntry(MiNonPagedAddressToPageFrame(StartingVa));
     if ((Pfn1->u3.e1.EndOfAllocation == 1) &&
         (ExQueryDepthSList(&MiNonPagedPoolSListHead) < MiNonPagedPoolSListMaximum))
     {
@@ -986,22 +981,20 @@ MiFreePoolPages(IN PVOID StartingVa)
     }
 
     //
-    // Loop until we find the last PTE
+    // Loop until we find the last page. This goes through the VA rather than
+    // the PTEs, since the initial pool might be mapped with large pages.
     //
+    NumberOfPages = 1;
     while (Pfn1->u3.e1.EndOfAllocation == 0)
     {
         //
         // Keep going
         //
-        PointerPte++;
-        Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
+        PeekVa = (PVOID)((ULONG_PTR)StartingVa + (NumberOfPages << PAGE_SHIFT));
+        Pfn1 = MiGetPfnEntry(MiNonPagedAddressToPageFrame(PeekVa));
+        NumberOfPages++;
     }
 
-    //
-    // Now we know how many pages we have
-    //
-    NumberOfPages = (PFN_COUNT)(PointerPte - StartPte + 1);
-
     //
     // Acquire the nonpaged pool lock
     //
@@ -1021,7 +1014,7 @@ MiFreePoolPages(IN PVOID StartingVa)
     //
     // Peek one page past the end of the allocation
     //
-    PointerPte++;
+    PeekVa = (PVOID)((ULONG_PTR)StartingVa + (NumberOfPages << PAGE_SHIFT));
 
     //
     // Guard against going past initial nonpaged pool
@@ -1042,7 +1035,7 @@ MiFreePoolPages(IN PVOID StartingVa)
         if (MmProtectFreedNonPagedPool)
         {
             /* The freed block will be merged, it must be made accessible */
-            MiUnProtectFreeNonPagedPool(MiPteToAddress(PointerPte), 0);
+            MiUnProtectFreeNonPagedPool(PeekVa, 0);
         }
 
         //
@@ -1050,12 +1043,12 @@ MiFreePoolPages(IN PVOID StartingVa)
         // paged pool, or the expansion nonpaged pool, so get the PFN entry of
         // the next allocation
         //
-        if (PointerPte->u.Hard.Valid == 1)
+        if (MiGetNonPagedPageFrame(PeekVa, &PageFrameIndex))
         {
             //
             // It's either expansion or initial: get the PFN entry
             //
-            Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
+            Pfn1 = MiGetPfnEntry(PageFrameIndex);
         }
         else
         {
@@ -1109,24 +1102,24 @@ MiFreePoolPages(IN PVOID StartingVa)
     else
     {
         //
-        // Otherwise, get the PTE for the page right before our allocation
+        // Otherwise, get the page right before our allocation
         //
-        PointerPte -= NumberOfPages + 1;
+        PeekVa = (PVOID)((ULONG_PTR)StartingVa - PAGE_SIZE);
 
         /* Check if protected pool is enabled */
         if (MmProtectFreedNonPagedPool)
         {
             /* The freed block will be merged, it must be made accessible */
-            MiUnProtectFreeNonPagedPool(MiPteToAddress(PointerPte), 0);
+            MiUnProtectFreeNonPagedPool(PeekVa, 0);
         }
 
         /* Check if this is valid pool, or a guard page */
-        if (PointerPte->u.Hard.Valid == 1)
+        if (MiGetNonPagedPageFrame(PeekVa, &PageFrameIndex))
         {
             //
             // It's either expansion or initial nonpaged pool, get the PFN entry
             //
-            Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
+            Pfn1 = MiGetPfnEntry(PageFrameIndex);
         }
         else
         {
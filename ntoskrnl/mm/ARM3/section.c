@@ -996,7 +996,7 @@ _WARN("MiSessionCommitPageTables halfplemented for amd64")
             OldIrql = MiAcquirePfnLock();
             MI_SET_USAGE(MI_USAGE_PAGE_TABLE);
             MI_SET_PROCESS2(PsGetCurrentProcess()->ImageFileName);
-            Color = (++MmSessionSpace->Color) & MmSecondaryColorMask;
+            Color = ((++MmSessionSpace->Color) & MmSecondaryColorMask) | MiGetCurrentNodeColor();
             PageFrameNumber = MiRemoveZeroPage(Color);
             TempPde.u.Hard.PageFrameNumber = PageFrameNumber;
             MI_WRITE_VALID_PDE(StartPde, TempPde);
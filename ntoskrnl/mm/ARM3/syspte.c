@@ -35,6 +35,36 @@ const UCHAR MmSysPteTables[] = { 0, // 1
                                };
 LONG MmSysPteListBySizeCount[5];
 
+//
+// Small PTE runs are cached per processor, sorted by size, so that the common
+// mappings (MDLs, hyperspace-like single pages, kernel stacks) don't need to
+// take the System PTE lock. Released runs are not flushed from the TB right
+// away: each one remembers the flush stamp at the time it was released, and
+// the first reuse of a run that hasn't been flushed since does a single TB
+// flush on all processors, which covers every run released before it.
+//
+#define MM_SYS_PTE_TABLES_MAX       5
+#define MI_SYSTEM_PTE_CACHE_DEPTH   8
+#define MI_SYSTEM_PTE_CACHE_REFILL  4
+
+typedef struct _MI_SYSTEM_PTE_CACHE_ENTRY
+{
+    PMMPTE PointerPte;
+    LONG FlushStamp;
+} MI_SYSTEM_PTE_CACHE_ENTRY, *PMI_SYSTEM_PTE_CACHE_ENTRY;
+
+typedef struct _MI_SYSTEM_PTE_CACHE_LIST
+{
+    ULONG Head;
+    ULONG Count;
+    MI_SYSTEM_PTE_CACHE_ENTRY Entries[MI_SYSTEM_PTE_CACHE_DEPTH];
+} MI_SYSTEM_PTE_CACHE_LIST, *PMI_SYSTEM_PTE_CACHE_LIST;
+
+static MI_SYSTEM_PTE_CACHE_LIST MiSystemPteCaches[MAXIMUM_PROCESSORS][MM_SYS_PTE_TABLES_MAX];
+static KSPIN_LOCK MiSystemPteFlushLock;
+static volatile LONG MiSystemPteFlushStarted;
+static volatile LONG MiSystemPteFlushCompleted;
+
 /* PRIVATE FUNCTIONS **********************************************************/
 
 //
@@ -83,21 +113,15 @@ MI_GET_CLUSTER_SIZE(IN PMMPTE Pte)
     return (ULONG)Pte->u.List.NextEntry;
 }
 
+static
 PMMPTE
-NTAPI
-MiReserveAlignedSystemPtes(IN ULONG NumberOfPtes,
-                           IN MMSYSTEM_PTE_POOL_TYPE SystemPtePoolType,
-                           IN ULONG Alignment)
+MiReserveSystemPtesFromList(IN ULONG NumberOfPtes,
+                            IN MMSYSTEM_PTE_POOL_TYPE SystemPtePoolType)
 {
     KIRQL OldIrql;
     PMMPTE PreviousPte, NextPte, ReturnPte;
     ULONG ClusterSize;
 
-    //
-    // Sanity check
-    //
-    ASSERT(Alignment <= PAGE_SIZE);
-
     //
     // Acquire the System PTE lock
     //
@@ -231,9 +255,8 @@ MiReserveAlignedSystemPtes(IN ULONG NumberOfPtes,
     KeReleaseQueuedSpinLock(LockQueueSystemSpaceLock, OldIrql);
 
     //
-    // Flush the TLB
+    // Runs on the list were flushed from the TB when they got released
     //
-    KeFlushProcessTb();
 
     //
     // Return the reserved PTEs
@@ -241,6 +264,204 @@ MiReserveAlignedSystemPtes(IN ULONG NumberOfPtes,
     return ReturnPte;
 }
 
+static
+VOID
+MiReleaseSystemPtesToList(IN PMMPTE StartingPte,
+                          IN ULONG NumberOfPtes,
+                          IN MMSYSTEM_PTE_POOL_TYPE SystemPtePoolType);
+
+static
+VOID
+MiFlushReleasedSystemPtes(IN PMMPTE StartingPte,
+                          IN ULONG NumberOfPtes)
+{
+    MMPTE_FLUSH_LIST FlushList;
+    ULONG i;
+
+    //
+    // Flush the whole run with a single IPI, or the entire TB if it is large
+    //
+    FlushList.Count = 0;
+    for (i = 0; i < NumberOfPtes; i++)
+    {
+        MI_QUEUE_TB_FLUSH(&FlushList, MiPteToAddress(StartingPte + i));
+        if (FlushList.Count > MI_MAXIMUM_FLUSH_COUNT) break;
+    }
+    MiFlushPteList(&FlushList, TRUE);
+}
+
+static
+BOOLEAN
+MiIsCachedSystemPteRunFlushed(IN PMI_SYSTEM_PTE_CACHE_ENTRY Entry)
+{
+    //
+    // A flush that completed after the run was released invalidated it
+    //
+    return ((LONG)(MiSystemPteFlushCompleted - Entry->FlushStamp) > 0);
+}
+
+static
+VOID
+MiFlushCachedSystemPteRun(IN PMI_SYSTEM_PTE_CACHE_ENTRY Entry)
+{
+    LONG Stamp;
+
+    //
+    // Serialize the flushes, and check whether somebody else already did it
+    // while we were waiting
+    //
+    KeAcquireSpinLockAtDpcLevel(&MiSystemPteFlushLock);
+    if (!MiIsCachedSystemPteRunFlushed(Entry))
+    {
+        //
+        // Runs released from now on are not covered by this flush, so bump
+        // the start stamp first and only publish completion once it is done
+        //
+        Stamp = MiSystemPteFlushStarted + 1;
+        InterlockedExchange(&MiSystemPteFlushStarted, Stamp);
+        KeFlushEntireTb(TRUE, TRUE);
+        InterlockedExchange(&MiSystemPteFlushCompleted, Stamp);
+    }
+    KeReleaseSpinLockFromDpcLevel(&MiSystemPteFlushLock);
+}
+
+static
+PMMPTE
+MiReserveCachedSystemPtes(IN ULONG Index)
+{
+    PMI_SYSTEM_PTE_CACHE_LIST CacheList;
+    PMI_SYSTEM_PTE_CACHE_ENTRY Entry;
+    PMMPTE PointerPte;
+    ULONG NumberOfPtes, i;
+    KIRQL OldIrql;
+
+    NumberOfPtes = MmSysPteIndex[Index];
+
+    //
+    // Stay on this processor while we use its cache
+    //
+    OldIrql = KeRaiseIrqlToDpcLevel();
+    CacheList = &MiSystemPteCaches[KeGetCurrentProcessorNumber()][Index];
+    if (CacheList->Count)
+    {
+        //
+        // Take the oldest run, which is the most likely to be flushed already
+        //
+        Entry = &CacheList->Entries[CacheList->Head];
+        CacheList->Head = (CacheList->Head + 1) % MI_SYSTEM_PTE_CACHE_DEPTH;
+        CacheList->Count--;
+        InterlockedDecrement(&MmSysPteListBySizeCount[Index]);
+
+        if (!MiIsCachedSystemPteRunFlushed(Entry)) MiFlushCachedSystemPteRun(Entry);
+        PointerPte = Entry->PointerPte;
+        KeLowerIrql(OldIrql);
+        return PointerPte;
+    }
+    KeLowerIrql(OldIrql);
+
+    //
+    // The cache is empty, refill it with a few runs in one go
+    //
+    PointerPte = MiReserveSystemPtesFromList(NumberOfPtes * MI_SYSTEM_PTE_CACHE_REFILL,
+                                             SystemPteSpace);
+    if (!PointerPte)
+    {
+        //
+        // Try again for just what the caller wants
+        //
+        return MiReserveSystemPtesFromList(NumberOfPtes, SystemPteSpace);
+    }
+
+    //
+    // Keep the first run for the caller and cache the others. They come from
+    // the list, so they don't need a flush.
+    //
+    OldIrql = KeRaiseIrqlToDpcLevel();
+    CacheList = &MiSystemPteCaches[KeGetCurrentProcessorNumber()][Index];
+    for (i = 1; i < MI_SYSTEM_PTE_CACHE_REFILL; i++)
+    {
+        if (CacheList->Count == MI_SYSTEM_PTE_CACHE_DEPTH) break;
+
+        Entry = &CacheList->Entries[(CacheList->Head + CacheList->Count) %
+                                    MI_SYSTEM_PTE_CACHE_DEPTH];
+        Entry->PointerPte = PointerPte + i * NumberOfPtes;
+        Entry->FlushStamp = MiSystemPteFlushCompleted - 1;
+        CacheList->Count++;
+        InterlockedIncrement(&MmSysPteListBySizeCount[Index]);
+    }
+    KeLowerIrql(OldIrql);
+
+    //
+    // If we moved to another processor whose cache was full, give back
+    // whatever didn't fit
+    //
+    if (i < MI_SYSTEM_PTE_CACHE_REFILL)
+    {
+        MiReleaseSystemPtesToList(PointerPte + i * NumberOfPtes,
+                                  (MI_SYSTEM_PTE_CACHE_REFILL - i) * NumberOfPtes,
+                                  SystemPteSpace);
+    }
+
+    return PointerPte;
+}
+
+static
+BOOLEAN
+MiReleaseCachedSystemPtes(IN PMMPTE StartingPte,
+                          IN ULONG Index)
+{
+    PMI_SYSTEM_PTE_CACHE_LIST CacheList;
+    PMI_SYSTEM_PTE_CACHE_ENTRY Entry;
+    KIRQL OldIrql;
+
+    OldIrql = KeRaiseIrqlToDpcLevel();
+    CacheList = &MiSystemPteCaches[KeGetCurrentProcessorNumber()][Index];
+    if (CacheList->Count == MI_SYSTEM_PTE_CACHE_DEPTH)
+    {
+        KeLowerIrql(OldIrql);
+        return FALSE;
+    }
+
+    //
+    // The PTEs are already zeroed, record the stamp only after that so the
+    // next flush to start is guaranteed to cover them
+    //
+    Entry = &CacheList->Entries[(CacheList->Head + CacheList->Count) %
+                                MI_SYSTEM_PTE_CACHE_DEPTH];
+    Entry->PointerPte = StartingPte;
+    KeMemoryBarrier();
+    Entry->FlushStamp = MiSystemPteFlushStarted;
+    CacheList->Count++;
+    InterlockedIncrement(&MmSysPteListBySizeCount[Index]);
+    KeLowerIrql(OldIrql);
+
+    return TRUE;
+}
+
+PMMPTE
+NTAPI
+MiReserveAlignedSystemPtes(IN ULONG NumberOfPtes,
+                           IN MMSYSTEM_PTE_POOL_TYPE SystemPtePoolType,
+                           IN ULONG Alignment)
+{
+    //
+    // Sanity check
+    //
+    ASSERT(Alignment <= PAGE_SIZE);
+
+    //
+    // Small system PTE runs are rounded up to the cache sizes, the release
+    // path does the same
+    //
+    if ((SystemPtePoolType == SystemPteSpace) &&
+        (NumberOfPtes <= MmSysPteIndex[MM_SYS_PTE_TABLES_MAX - 1]))
+    {
+        return MiReserveCachedSystemPtes(MmSysPteTables[NumberOfPtes]);
+    }
+
+    return MiReserveSystemPtesFromList(NumberOfPtes, SystemPtePoolType);
+}
+
 PMMPTE
 NTAPI
 MiReserveSystemPtes(IN ULONG NumberOfPtes,
@@ -276,9 +497,7 @@ MiReleaseSystemPtes(IN PMMPTE StartingPte,
                     IN ULONG NumberOfPtes,
                     IN MMSYSTEM_PTE_POOL_TYPE SystemPtePoolType)
 {
-    KIRQL OldIrql;
-    ULONG ClusterSize;
-    PMMPTE PreviousPte, NextPte, InsertPte;
+    ULONG Index;
 
     //
     // Check to make sure the PTE address is within bounds
@@ -288,9 +507,45 @@ MiReleaseSystemPtes(IN PMMPTE StartingPte,
     ASSERT(StartingPte + NumberOfPtes - 1 <= MmSystemPtesEnd[SystemPtePoolType]);
 
     //
-    // Zero PTEs
+    // Small runs were rounded up when they were reserved
     //
-    RtlZeroMemory(StartingPte, NumberOfPtes * sizeof(MMPTE));
+    if ((SystemPtePoolType == SystemPteSpace) &&
+        (NumberOfPtes <= MmSysPteIndex[MM_SYS_PTE_TABLES_MAX - 1]))
+    {
+        Index = MmSysPteTables[NumberOfPtes];
+        NumberOfPtes = MmSysPteIndex[Index];
+
+        //
+        // Zero the PTEs and try to keep the run around
+        //
+        RtlZeroMemory(StartingPte, NumberOfPtes * sizeof(MMPTE));
+        if (MiReleaseCachedSystemPtes(StartingPte, Index)) return;
+    }
+    else
+    {
+        //
+        // Zero PTEs
+        //
+        RtlZeroMemory(StartingPte, NumberOfPtes * sizeof(MMPTE));
+    }
+
+    //
+    // Anybody can pick the run up from the list and map it again right away,
+    // so it has to leave the TB first
+    //
+    MiFlushReleasedSystemPtes(StartingPte, NumberOfPtes);
+    MiReleaseSystemPtesToList(StartingPte, NumberOfPtes, SystemPtePoolType);
+}
+
+static
+VOID
+MiReleaseSystemPtesToList(IN PMMPTE StartingPte,
+                          IN ULONG NumberOfPtes,
+                          IN MMSYSTEM_PTE_POOL_TYPE SystemPtePoolType)
+{
+    KIRQL OldIrql;
+    ULONG ClusterSize;
+    PMMPTE PreviousPte, NextPte, InsertPte;
 
     //
     // Acquire the System PTE lock
@@ -448,6 +703,11 @@ MiInitializeSystemPtes(IN PMMPTE StartingPte,
         // Remember how many PTEs we have
         //
         MmTotalSystemPtes = NumberOfPtes;
+
+        //
+        // And get the cached runs ready
+        //
+        KeInitializeSpinLock(&MiSystemPteFlushLock);
     }
 }
 
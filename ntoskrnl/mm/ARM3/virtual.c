@@ -388,10 +388,37 @@ MiDeleteSystemPageableVm(IN PMMPTE PointerPte,
 
 VOID
 NTAPI
-MiDeletePte(IN PMMPTE PointerPte,
-            IN PVOID VirtualAddress,
-            IN PEPROCESS CurrentProcess,
-            IN PMMPTE PrototypePte)
+MiFlushPteList(IN PMMPTE_FLUSH_LIST FlushList,
+               IN BOOLEAN AllProcessors)
+{
+    /* Nothing to do if nothing got queued */
+    if (!FlushList->Count) return;
+
+    /* Flush the queued addresses, or everything if there were too many */
+    if (FlushList->Count <= MI_MAXIMUM_FLUSH_COUNT)
+    {
+        KeFlushMultipleTb(FlushList->Count, FlushList->FlushVa, AllProcessors);
+    }
+    else if (AllProcessors)
+    {
+        KeFlushEntireTb(TRUE, TRUE);
+    }
+    else
+    {
+        KeFlushMultipleTb(0, NULL, FALSE);
+    }
+
+    /* Start over */
+    FlushList->Count = 0;
+}
+
+static
+VOID
+MiDeletePteWithFlushList(IN PMMPTE PointerPte,
+                         IN PVOID VirtualAddress,
+                         IN PEPROCESS CurrentProcess,
+                         IN PMMPTE PrototypePte,
+                         IN PMMPTE_FLUSH_LIST FlushList)
 {
     PMMPFN Pfn1;
     MMPTE TempPte;
@@ -531,8 +558,29 @@ MiDeletePte(IN PMMPTE PointerPte,
         //CurrentProcess->NumberOfPrivatePages--;
     }
 
-    /* Flush the TLB */
-    KeFlushCurrentTb();
+    /* Flush the TLB, or leave it to the caller */
+    if (FlushList)
+    {
+        MI_QUEUE_TB_FLUSH(FlushList, VirtualAddress);
+    }
+    else
+    {
+        KeFlushCurrentTb();
+    }
+}
+
+VOID
+NTAPI
+MiDeletePte(IN PMMPTE PointerPte,
+            IN PVOID VirtualAddress,
+            IN PEPROCESS CurrentProcess,
+            IN PMMPTE PrototypePte)
+{
+    MiDeletePteWithFlushList(PointerPte,
+                             VirtualAddress,
+                             CurrentProcess,
+                             PrototypePte,
+                             NULL);
 }
 
 VOID
@@ -548,6 +596,7 @@ MiDeleteVirtualAddresses(IN ULONG_PTR Va,
     KIRQL OldIrql;
     BOOLEAN AddressGap = FALSE;
     PSUBSECTION Subsection;
+    MMPTE_FLUSH_LIST FlushList;
 
     /* Get out if this is a fake VAD, RosMm will free the marea pages */
     if ((Vad) && (Vad->u.VadFlags.Spare == 1)) return;
@@ -573,6 +622,9 @@ MiDeleteVirtualAddresses(IN ULONG_PTR Va,
     /* In all cases, we don't support fork() yet */
     ASSERT(CurrentProcess->CloneRoot == NULL);
 
+    /* The TB gets flushed once for each page table worth of PTEs */
+    FlushList.Count = 0;
+
     /* Loop the PTE for each VA */
     while (TRUE)
     {
@@ -668,10 +720,11 @@ MiDeleteVirtualAddresses(IN ULONG_PTR Va,
                     else
                     {
                         /* Delete the PTE proper */
-                        MiDeletePte(PointerPte,
-                                    (PVOID)Va,
-                                    CurrentProcess,
-                                    PrototypePte);
+                        MiDeletePteWithFlushList(PointerPte,
+                                                 (PVOID)Va,
+                                                 CurrentProcess,
+                                                 PrototypePte,
+                                                 &FlushList);
                     }
                 }
                 else
@@ -700,13 +753,17 @@ MiDeleteVirtualAddresses(IN ULONG_PTR Va,
             if (PointerPde->u.Long != 0)
             {
                 /* Delete the PTE proper */
-                MiDeletePte(PointerPde,
-                            MiPteToAddress(PointerPde),
-                            CurrentProcess,
-                            NULL);
+                MiDeletePteWithFlushList(PointerPde,
+                                         MiPteToAddress(PointerPde),
+                                         CurrentProcess,
+                                         NULL,
+                                         &FlushList);
             }
         }
 
+        /* Flush the TB of the processors running us before the pages get reused */
+        MiFlushPteList(&FlushList, FALSE);
+
         /* Release the lock and get out if we're done */
         MiReleasePfnLock(OldIrql);
         if (Va > EndingAddress) return;
@@ -20,6 +20,25 @@
 BOOLEAN MmZeroingPageThreadActive;
 KEVENT MmZeroingPageEvent;
 
+//
+// When the zeroed list falls below the low watermark, the free list code wakes
+// the zeroing workers early and they run at a raised priority until the list
+// is back above the high watermark. Otherwise they only run when idle.
+//
+PFN_NUMBER MmZeroedPageLowWatermark;
+PFN_NUMBER MmZeroedPageHighWatermark;
+
+//
+// Number of workers currently zeroing pages, protected by the PFN lock
+//
+ULONG MiZeroPageWorkersActive;
+
+/* Number of pages a worker takes off the free list under a single lock hold */
+#define MI_ZERO_PAGE_BATCH              16
+
+/* Priority of the workers while the zeroed list is running low */
+#define MI_ZERO_PAGE_BOOST_PRIORITY     (LOW_REALTIME_PRIORITY / 2)
+
 /* PRIVATE FUNCTIONS **********************************************************/
 
 VOID
@@ -32,22 +51,40 @@ NTAPI
 MiFreeInitializationCode(IN PVOID StartVa,
 IN PVOID EndVa);
 
+static
 VOID
-NTAPI
-MmZeroPageThread(VOID)
+MiZeroPageWorker(IN UCHAR Node)
 {
     PKTHREAD Thread = KeGetCurrentThread();
-    PVOID StartAddress, EndAddress;
     PVOID WaitObjects[2];
     KIRQL OldIrql;
+    KAFFINITY Affinity;
     PVOID ZeroAddress;
+    PMMPTE ZeroPte;
+    MMPTE TempPte;
     PFN_NUMBER PageIndex, FreePage;
-    PMMPFN Pfn1;
-
-    /* Get the discardable sections to free them */
-    MiFindInitializationCode(&StartAddress, &EndAddress);
-    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
-    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
+    PFN_NUMBER Pages[MI_ZERO_PAGE_BATCH];
+    ULONG i, Count;
+    BOOLEAN Boosted = FALSE, Boost;
+
+    //
+    // Stick to the first processor of our node. The zeroing PTEs are private
+    // to this worker, so this way they never need more than a local TB flush,
+    // and the pages get zeroed by a processor close to them.
+    //
+    Affinity = KeNodeBlock[Node]->ProcessorMask;
+    Affinity &= ~(Affinity - 1);
+    KeSetSystemAffinityThread(Affinity);
+
+    /* Reserve the PTEs used to map the pages we zero */
+    ZeroPte = MiReserveSystemPtes(MI_ZERO_PAGE_BATCH, SystemPteSpace);
+    if (!ZeroPte)
+    {
+        DPRINT1("No PTEs for the zero page worker of node %u\n", Node);
+        return;
+    }
+    ZeroAddress = MiPteToAddress(ZeroPte);
+    TempPte = ValidKernelPte;
 
     /* Set our priority to 0 */
     Thread->BasePriority = 0;
@@ -68,47 +105,138 @@ MmZeroPageThread(VOID)
                                  NULL,
                                  NULL);
         OldIrql = MiAcquirePfnLock();
+        MiZeroPageWorkersActive++;
         MmZeroingPageThreadActive = TRUE;
 
         while (TRUE)
         {
-            if (!MmFreePageListHead.Total)
+            //
+            // Grab a batch of pages off the free list. The first global free
+            // page should also be the first on its own list.
+            //
+            Count = 0;
+            while ((Count < MI_ZERO_PAGE_BATCH) && (MmFreePageListHead.Total))
+            {
+                PageIndex = MmFreePageListHead.Flink;
+                ASSERT(PageIndex != LIST_HEAD);
+                MI_SET_USAGE(MI_USAGE_ZERO_LOOP);
+                MI_SET_PROCESS2("Kernel 0 Loop");
+                FreePage = MiRemoveAnyPage(MI_GET_PAGE_COLOR(PageIndex));
+                if (FreePage != PageIndex)
+                {
+                    KeBugCheckEx(PFN_LIST_CORRUPT,
+                                 0x8F,
+                                 FreePage,
+                                 PageIndex,
+                                 0);
+                }
+
+                Pages[Count++] = PageIndex;
+            }
+
+            /* Check if there's nothing left to do */
+            if (!Count)
             {
-                MmZeroingPageThreadActive = FALSE;
+                if (--MiZeroPageWorkersActive == 0) MmZeroingPageThreadActive = FALSE;
                 MiReleasePfnLock(OldIrql);
                 break;
             }
 
-            PageIndex = MmFreePageListHead.Flink;
-            ASSERT(PageIndex != LIST_HEAD);
-            Pfn1 = MiGetPfnEntry(PageIndex);
-            MI_SET_USAGE(MI_USAGE_ZERO_LOOP);
-            MI_SET_PROCESS2("Kernel 0 Loop");
-            FreePage = MiRemoveAnyPage(MI_GET_PAGE_COLOR(PageIndex));
+            //
+            // Run boosted while the zeroed list is below the low watermark, and
+            // keep the boost until it is back above the high one
+            //
+            Boost = (MmZeroedPageListHead.Total <
+                     (Boosted ? MmZeroedPageHighWatermark : MmZeroedPageLowWatermark));
+            MiReleasePfnLock(OldIrql);
 
-            /* The first global free page should also be the first on its own list */
-            if (FreePage != PageIndex)
+            if (Boost != Boosted)
             {
-                KeBugCheckEx(PFN_LIST_CORRUPT,
-                             0x8F,
-                             FreePage,
-                             PageIndex,
-                             0);
+                KeSetPriorityThread(Thread, Boost ? MI_ZERO_PAGE_BOOST_PRIORITY : 0);
+                Boosted = Boost;
             }
 
-            Pfn1->u1.Flink = LIST_HEAD;
-            MiReleasePfnLock(OldIrql);
-
-            ZeroAddress = MiMapPagesInZeroSpace(Pfn1, 1);
-            ASSERT(ZeroAddress);
-            RtlZeroMemory(ZeroAddress, PAGE_SIZE);
-            MiUnmapPagesInZeroSpace(ZeroAddress, 1);
+            /* Map the batch, zero it with non-temporal stores and unmap it */
+            for (i = 0; i < Count; i++)
+            {
+                TempPte.u.Hard.PageFrameNumber = Pages[i];
+                MI_WRITE_VALID_PTE(ZeroPte + i, TempPte);
+            }
+            KeZeroPages(ZeroAddress, Count * PAGE_SIZE);
+            for (i = 0; i < Count; i++) MI_ERASE_PTE(ZeroPte + i);
+            KeFlushProcessTb();
 
+            /* And put the pages on the zeroed list */
             OldIrql = MiAcquirePfnLock();
+            for (i = 0; i < Count; i++)
+            {
+                MiInsertPageInList(&MmZeroedPageListHead, Pages[i]);
+            }
+        }
 
-            MiInsertPageInList(&MmZeroedPageListHead, PageIndex);
+        /* Back to idle priority */
+        if (Boosted)
+        {
+            KeSetPriorityThread(Thread, 0);
+            Boosted = FALSE;
+        }
+    }
+}
+
+static
+VOID
+NTAPI
+MiZeroPageWorkerThread(IN PVOID Context)
+{
+    MiZeroPageWorker((UCHAR)(ULONG_PTR)Context);
+}
+
+VOID
+NTAPI
+MmZeroPageThread(VOID)
+{
+    PVOID StartAddress, EndAddress;
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+    UCHAR Node;
+
+    /* Get the discardable sections to free them */
+    MiFindInitializationCode(&StartAddress, &EndAddress);
+    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
+    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
+
+    //
+    // Compute the zeroed list watermarks: keep around 1/256th of memory
+    // zeroed, within sane bounds
+    //
+    MmZeroedPageLowWatermark = MmNumberOfPhysicalPages / 256;
+    if (MmZeroedPageLowWatermark < 32) MmZeroedPageLowWatermark = 32;
+    if (MmZeroedPageLowWatermark > 1024) MmZeroedPageLowWatermark = 1024;
+    MmZeroedPageHighWatermark = MmZeroedPageLowWatermark * 2;
+
+    //
+    // This thread is the worker for the first node, create one for each of
+    // the others
+    //
+    for (Node = 1; Node < KeNumberNodes; Node++)
+    {
+        Status = PsCreateSystemThread(&ThreadHandle,
+                                      THREAD_ALL_ACCESS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      MiZeroPageWorkerThread,
+                                      (PVOID)(ULONG_PTR)Node);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to create zero page worker for node %u: 0x%lx\n", Node, Status);
+            continue;
         }
+        ZwClose(ThreadHandle);
     }
+
+    /* Now become the first worker */
+    MiZeroPageWorker(0);
 }
 
 /* EOF */
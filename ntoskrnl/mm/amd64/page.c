@@ -426,6 +426,27 @@ MmSetCleanPage(PEPROCESS Process, PVOID Address)
     MiFlushTlb(Pte, Address);
 }
 
+BOOLEAN
+NTAPI
+MmTestAndClearAccessedPage(PEPROCESS Process, PVOID Address)
+{
+    PMMPTE Pte;
+    BOOLEAN Accessed;
+
+    Pte = MiGetPteForProcess(Process, Address, FALSE);
+    if (!Pte)
+    {
+        return FALSE;
+    }
+
+    /* Clear the accessed bit */
+    Accessed = Pte->u.Hard.Valid && InterlockedBitTestAndReset64((PVOID)Pte, 5);
+
+    /* The processor only sets the bit again if it misses the TLB */
+    MiFlushTlb(Pte, Address);
+    return Accessed;
+}
+
 VOID
 NTAPI
 MmSetDirtyPage(PEPROCESS Process, PVOID Address)
@@ -45,6 +45,20 @@ static HANDLE MiBalancerThreadHandle = NULL;
 static KEVENT MiBalancerEvent;
 static KTIMER MiBalancerTimer;
 
+/*
+ * User pages are trimmed with a clock sweep over the user page bitmap: pages
+ * referenced since the previous visit are made young again, the others get
+ * older, and only pages left alone for MI_USER_PAGE_TRIM_AGE visits in a row
+ * are paged out.
+ */
+#define MI_USER_PAGE_TRIM_AGE   2
+
+static PFN_NUMBER MiUserClockHand;
+ULONG MiUserPagesScanned;
+ULONG MiUserPagesReferenced;
+ULONG MiUserPagesTrimmed;
+ULONG MiUserPagesRefaulted;
+
 /* FUNCTIONS ****************************************************************/
 
 VOID
@@ -174,38 +188,71 @@ MiTrimMemoryConsumer(ULONG Consumer, ULONG InitialTarget)
     }
 }
 
+static PFN_NUMBER
+MiGetNextClockUserPage(PFN_NUMBER Page)
+{
+    PFN_NUMBER NextPage;
+
+    /* Wrap around at the end of the bitmap */
+    NextPage = Page ? MmGetLRUNextUserPage(Page) : 0;
+    if (NextPage == 0)
+    {
+        NextPage = MmGetLRUFirstUserPage();
+    }
+    return NextPage;
+}
+
 NTSTATUS
 MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
 {
     PFN_NUMBER CurrentPage;
-    PFN_NUMBER NextPage;
+    ULONG Scanned, ScanLimit;
+    BOOLEAN Accessed;
     NTSTATUS Status;
 
     (*NrFreedPages) = 0;
 
-    CurrentPage = MmGetLRUFirstUserPage();
-    while (CurrentPage != 0 && Target > 0)
+    /*
+     * Give up after enough revolutions for every unreferenced page to become
+     * old enough, so that we still make progress when everything is hot.
+     */
+    ScanLimit = MiMemoryConsumers[MC_USER].PagesUsed * (MI_USER_PAGE_TRIM_AGE + 1);
+
+    /* Resume the sweep after the last page we looked at */
+    CurrentPage = MiGetNextClockUserPage(MiUserClockHand);
+    for (Scanned = 0; (CurrentPage != 0) && (Target > 0) && (Scanned < ScanLimit); Scanned++)
     {
-        Status = MmPageOutPhysicalAddress(CurrentPage);
-        if (NT_SUCCESS(Status))
-        {
-            DPRINT("Succeeded\n");
-            Target--;
-            (*NrFreedPages)++;
-        }
+        Accessed = MmTestAndClearAccessedPageRmap(CurrentPage);
+        if (Accessed) MiUserPagesReferenced++;
 
-        NextPage = MmGetLRUNextUserPage(CurrentPage);
-        if (NextPage <= CurrentPage)
+        if (MmAgeUserPage(CurrentPage, Accessed) >= MI_USER_PAGE_TRIM_AGE)
         {
-            /* We wrapped around, so we're done */
-            break;
+            Status = MmPageOutPhysicalAddress(CurrentPage);
+            if (NT_SUCCESS(Status))
+            {
+                DPRINT("Succeeded\n");
+                Target--;
+                (*NrFreedPages)++;
+                MiUserPagesTrimmed++;
+            }
         }
-        CurrentPage = NextPage;
+
+        MiUserClockHand = CurrentPage;
+        CurrentPage = MiGetNextClockUserPage(CurrentPage);
     }
+    MiUserPagesScanned += Scanned;
 
     return STATUS_SUCCESS;
 }
 
+VOID
+NTAPI
+MiNoteUserPageRefault(PEPROCESS Process)
+{
+    InterlockedIncrementUL(&MiUserPagesRefaulted);
+    if (Process) InterlockedIncrementUL(&Process->RefaultPageCount);
+}
+
 static BOOLEAN
 MiIsBalancerThread(VOID)
 {
@@ -489,5 +536,37 @@ MiInitBalancerThread(VOID)
 
 }
 
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtWorkingSetTrim(ULONG Argc, PCHAR Argv[])
+{
+    extern LIST_ENTRY PsActiveProcessHead;
+    PLIST_ENTRY Entry;
+    PEPROCESS Process;
+
+    KdbpPrint("Pages scanned:\t\t%lu\n", MiUserPagesScanned);
+    KdbpPrint("Pages referenced:\t%lu\n", MiUserPagesReferenced);
+    KdbpPrint("Pages trimmed:\t\t%lu\n", MiUserPagesTrimmed);
+    KdbpPrint("Pages refaulted:\t%lu\n", MiUserPagesRefaulted);
+    KdbpPrint("\n  PID\tTrimmed\tRefault\tWS\tName\n");
+
+    for (Entry = PsActiveProcessHead.Flink;
+         Entry != &PsActiveProcessHead;
+         Entry = Entry->Flink)
+    {
+        Process = CONTAINING_RECORD(Entry, EPROCESS, ActiveProcessLinks);
+        if (!Process->TrimmedPageCount && !Process->RefaultPageCount) continue;
+
+        KdbpPrint("%5lu\t%lu\t%lu\t%lu\t%.16s\n",
+                  HandleToUlong(Process->UniqueProcessId),
+                  Process->TrimmedPageCount,
+                  Process->RefaultPageCount,
+                  Process->Vm.WorkingSetSize,
+                  Process->ImageFileName);
+    }
+
+    return TRUE;
+}
+#endif
 
 /* EOF */
@@ -0,0 +1,545 @@
+/*
+ * PROJECT:         ReactOS Kernel
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            ntoskrnl/mm/compstore.c
+ * PURPOSE:         In-memory compressed store in front of the paging files
+ * PROGRAMMERS:     ReactOS Portable Systems Group
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* TYPES **********************************************************************/
+
+//
+// One page worth of paging file data, kept compressed in nonpaged pool. The
+// paging file slot stays allocated to the page, so the data can still go to
+// the disk should the store ever need to give it up
+//
+typedef struct _MM_CSTORE_ENTRY
+{
+    LIST_ENTRY Links;
+    ULONG PageFileIndex;
+    ULONG_PTR PageFileOffset;
+    ULONG Size;
+    UCHAR Data[ANYSIZE_ARRAY];
+} MM_CSTORE_ENTRY, *PMM_CSTORE_ENTRY;
+
+/* GLOBALS ********************************************************************/
+
+#define MI_CSTORE_BUCKETS           256
+#define MI_CSTORE_HASH_BITS         12
+
+//
+// Pages that don't compress to half their size aren't worth keeping around,
+// they go to the paging file as usual
+//
+#define MI_CSTORE_MAXIMUM_SIZE      (PAGE_SIZE / 2)
+
+//
+// Maximum share of physical memory the store may use, from the registry.
+// The store is disabled when this is zero, which is the default
+//
+ULONG MmCompressedStoreMaximumPercent;
+
+static SIZE_T MiCompressedStoreLimit;
+static LIST_ENTRY MiCompressedStoreHash[MI_CSTORE_BUCKETS];
+static KSPIN_LOCK MiCompressedStoreLock;
+
+//
+// The compression workspace is shared, the mutex serializes the writers
+//
+static FAST_MUTEX MiCompressedStoreWorkspaceLock;
+static PUSHORT MiCompressedStoreMatchTable;
+static PUCHAR MiCompressedStoreBuffer;
+
+//
+// Statistics, for the debugger
+//
+SIZE_T MiCompressedStoreBytes;
+ULONG MiCompressedStorePages;
+ULONG MiCompressedStoreInserts;
+ULONG MiCompressedStoreRejects;
+ULONG MiCompressedStoreFull;
+ULONG MiCompressedStoreLookups;
+ULONG MiCompressedStoreHits;
+
+/* PRIVATE FUNCTIONS **********************************************************/
+
+//
+// A minimal LZ77 codec, in the spirit of LZ4. The stream is made of sequences
+// of a token byte giving the literal (high nibble) and match (low nibble)
+// lengths, extra length bytes when a nibble saturates, the literals, then the
+// 16-bit match offset. The last sequence has literals only. This is meant to
+// be fast rather than tight: page contents that don't compress well enough
+// with it are not kept anyway.
+//
+static
+BOOLEAN
+MiCstoreEmitSequence(
+    _Inout_ PUCHAR *Output,
+    _In_ PUCHAR OutputEnd,
+    _In_ PUCHAR Literals,
+    _In_ ULONG LiteralLength,
+    _In_ ULONG Offset,
+    _In_ ULONG MatchLength)
+{
+    PUCHAR Out = *Output, Token;
+    ULONG Length;
+
+    /* Make sure the worst case encoding of this sequence fits */
+    if ((ULONG)(OutputEnd - Out) < (1 + LiteralLength + (LiteralLength / 255) + 1 +
+                                    2 + (MatchLength / 255) + 1))
+    {
+        return FALSE;
+    }
+
+    /* Literal length */
+    Token = Out++;
+    *Token = (UCHAR)(min(LiteralLength, 15) << 4);
+    if (LiteralLength >= 15)
+    {
+        for (Length = LiteralLength - 15; Length >= 255; Length -= 255) *Out++ = 255;
+        *Out++ = (UCHAR)Length;
+    }
+
+    /* Literals */
+    RtlCopyMemory(Out, Literals, LiteralLength);
+    Out += LiteralLength;
+
+    /* Match, unless this is the last sequence */
+    if (MatchLength)
+    {
+        *Out++ = (UCHAR)Offset;
+        *Out++ = (UCHAR)(Offset >> 8);
+
+        Length = MatchLength - 4;
+        *Token |= (UCHAR)min(Length, 15);
+        if (Length >= 15)
+        {
+            for (Length -= 15; Length >= 255; Length -= 255) *Out++ = 255;
+            *Out++ = (UCHAR)Length;
+        }
+    }
+
+    *Output = Out;
+    return TRUE;
+}
+
+static
+ULONG
+MiCstoreCompressPage(
+    _In_reads_bytes_(PAGE_SIZE) PUCHAR Source,
+    _Out_writes_bytes_(OutputSize) PUCHAR Output,
+    _In_ ULONG OutputSize,
+    _Inout_ PUSHORT MatchTable)
+{
+    PUCHAR Input = Source, Anchor = Source, Reference;
+    PUCHAR MatchLimit = Source + PAGE_SIZE - 5;
+    PUCHAR Out = Output, OutputEnd = Output + OutputSize;
+    ULONG Sequence, Hash, MatchLength;
+
+    /* Forget about the previous page */
+    RtlZeroMemory(MatchTable, sizeof(USHORT) << MI_CSTORE_HASH_BITS);
+
+    while (Input + sizeof(ULONG) <= MatchLimit)
+    {
+        /* Look up the last position where these 4 bytes were seen */
+        Sequence = *(ULONG UNALIGNED *)Input;
+        Hash = (Sequence * 2654435761U) >> (32 - MI_CSTORE_HASH_BITS);
+        Reference = Source + MatchTable[Hash];
+        MatchTable[Hash] = (USHORT)(Input - Source);
+
+        if ((Reference >= Input) || (*(ULONG UNALIGNED *)Reference != Sequence))
+        {
+            Input++;
+            continue;
+        }
+
+        /* Extend the match as far as it goes */
+        MatchLength = sizeof(ULONG);
+        while ((Input + MatchLength < MatchLimit) &&
+               (Reference[MatchLength] == Input[MatchLength]))
+        {
+            MatchLength++;
+        }
+
+        if (!MiCstoreEmitSequence(&Out,
+                                  OutputEnd,
+                                  Anchor,
+                                  (ULONG)(Input - Anchor),
+                                  (ULONG)(Input - Reference),
+                                  MatchLength))
+        {
+            return 0;
+        }
+
+        Input += MatchLength;
+        Anchor = Input;
+    }
+
+    /* Whatever is left goes out as literals */
+    if (!MiCstoreEmitSequence(&Out,
+                              OutputEnd,
+                              Anchor,
+                              (ULONG)(Source + PAGE_SIZE - Anchor),
+                              0,
+                              0))
+    {
+        return 0;
+    }
+
+    return (ULONG)(Out - Output);
+}
+
+static
+BOOLEAN
+MiCstoreReadLength(
+    _Inout_ PUCHAR *Input,
+    _In_ PUCHAR InputEnd,
+    _Inout_ PULONG Length)
+{
+    UCHAR Byte;
+
+    do
+    {
+        if (*Input >= InputEnd) return FALSE;
+        Byte = *(*Input)++;
+        *Length += Byte;
+    } while (Byte == 255);
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+MiCstoreDecompressPage(
+    _In_reads_bytes_(Size) PUCHAR Source,
+    _In_ ULONG Size,
+    _Out_writes_bytes_(PAGE_SIZE) PUCHAR Output)
+{
+    PUCHAR Input = Source, InputEnd = Source + Size;
+    PUCHAR Out = Output, OutputEnd = Output + PAGE_SIZE, Reference;
+    ULONG Token, Length, Offset;
+
+    while (Input < InputEnd)
+    {
+        /* Copy the literals */
+        Token = *Input++;
+        Length = Token >> 4;
+        if ((Length == 15) && !MiCstoreReadLength(&Input, InputEnd, &Length)) return FALSE;
+        if ((Length > (ULONG)(InputEnd - Input)) || (Length > (ULONG)(OutputEnd - Out))) return FALSE;
+        RtlCopyMemory(Out, Input, Length);
+        Input += Length;
+        Out += Length;
+
+        /* The last sequence has no match */
+        if (Input == InputEnd) break;
+
+        /* Copy the match, which may overlap what it produces */
+        if ((InputEnd - Input) < 2) return FALSE;
+        Offset = Input[0] | (Input[1] << 8);
+        Input += 2;
+        if (!(Offset) || (Offset > (ULONG)(Out - Output))) return FALSE;
+
+        Length = Token & 15;
+        if ((Length == 15) && !MiCstoreReadLength(&Input, InputEnd, &Length)) return FALSE;
+        Length += 4;
+        if (Length > (ULONG)(OutputEnd - Out)) return FALSE;
+
+        for (Reference = Out - Offset; Length; Length--) *Out++ = *Reference++;
+    }
+
+    return (Out == OutputEnd);
+}
+
+static
+BOOLEAN
+MiCstoreIsZeroPage(
+    _In_reads_bytes_(PAGE_SIZE) PVOID Address)
+{
+    PULONG_PTR Data = Address;
+    ULONG i;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(ULONG_PTR); i++)
+    {
+        if (Data[i]) return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+PLIST_ENTRY
+MiCstoreBucket(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    return &MiCompressedStoreHash[(PageFileOffset ^ (PageFileIndex << 4)) %
+                                  MI_CSTORE_BUCKETS];
+}
+
+static
+PMM_CSTORE_ENTRY
+MiCstoreFindEntry(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    PLIST_ENTRY ListHead, NextEntry;
+    PMM_CSTORE_ENTRY Entry;
+
+    /* The store lock must be held */
+    ListHead = MiCstoreBucket(PageFileIndex, PageFileOffset);
+    for (NextEntry = ListHead->Flink; NextEntry != ListHead; NextEntry = NextEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(NextEntry, MM_CSTORE_ENTRY, Links);
+        if ((Entry->PageFileIndex == PageFileIndex) &&
+            (Entry->PageFileOffset == PageFileOffset))
+        {
+            return Entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* FUNCTIONS ******************************************************************/
+
+VOID
+INIT_FUNCTION
+NTAPI
+MiInitializeCompressedStore(VOID)
+{
+    ULONG i;
+
+    KeInitializeSpinLock(&MiCompressedStoreLock);
+    ExInitializeFastMutex(&MiCompressedStoreWorkspaceLock);
+    for (i = 0; i < MI_CSTORE_BUCKETS; i++) InitializeListHead(&MiCompressedStoreHash[i]);
+
+    /* Nothing else to do unless the store was asked for */
+    if (!MmCompressedStoreMaximumPercent) return;
+    MmCompressedStoreMaximumPercent = min(MmCompressedStoreMaximumPercent, 50);
+
+    /* Get the compression workspace */
+    MiCompressedStoreMatchTable = ExAllocatePoolWithTag(NonPagedPool,
+                                                        sizeof(USHORT) << MI_CSTORE_HASH_BITS,
+                                                        TAG_MM_CSTORE);
+    MiCompressedStoreBuffer = ExAllocatePoolWithTag(NonPagedPool,
+                                                    MI_CSTORE_MAXIMUM_SIZE,
+                                                    TAG_MM_CSTORE);
+    if (!(MiCompressedStoreMatchTable) || !(MiCompressedStoreBuffer))
+    {
+        DPRINT1("Not enough memory for the compressed store\n");
+        if (MiCompressedStoreMatchTable) ExFreePoolWithTag(MiCompressedStoreMatchTable, TAG_MM_CSTORE);
+        if (MiCompressedStoreBuffer) ExFreePoolWithTag(MiCompressedStoreBuffer, TAG_MM_CSTORE);
+        return;
+    }
+
+    /* And enable it */
+    MiCompressedStoreLimit = ((SIZE_T)MmNumberOfPhysicalPages / 100) *
+                             MmCompressedStoreMaximumPercent * PAGE_SIZE;
+    DPRINT1("Compressed store enabled, up to %Iu KB\n", MiCompressedStoreLimit / 1024);
+}
+
+BOOLEAN
+NTAPI
+MiCompressedStoreWrite(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset,
+    _In_ PFN_NUMBER Page)
+{
+    PMM_CSTORE_ENTRY Entry;
+    PEPROCESS Process;
+    PVOID Address;
+    ULONG Size;
+    KIRQL OldIrql;
+
+    /* Whatever was kept for this slot before is out of date now */
+    MiCompressedStoreFree(PageFileIndex, PageFileOffset);
+
+    /* Check if the store is enabled and has some room left */
+    if (!MiCompressedStoreLimit) return FALSE;
+    if (MiCompressedStoreBytes >= MiCompressedStoreLimit)
+    {
+        InterlockedIncrementUL(&MiCompressedStoreFull);
+        return FALSE;
+    }
+
+    /* Compress the page into the shared buffer */
+    ExAcquireFastMutex(&MiCompressedStoreWorkspaceLock);
+    Process = PsGetCurrentProcess();
+    Address = MiMapPageInHyperSpace(Process, Page, &OldIrql);
+    if (MiCstoreIsZeroPage(Address))
+    {
+        /* Zeroed pages are common enough to not need any data at all */
+        Size = 0;
+    }
+    else
+    {
+        Size = MiCstoreCompressPage(Address,
+                                    MiCompressedStoreBuffer,
+                                    MI_CSTORE_MAXIMUM_SIZE,
+                                    MiCompressedStoreMatchTable);
+        if (!Size)
+        {
+            /* It didn't compress well enough, let it go to the disk */
+            MiUnmapPageInHyperSpace(Process, Address, OldIrql);
+            ExReleaseFastMutex(&MiCompressedStoreWorkspaceLock);
+            InterlockedIncrementUL(&MiCompressedStoreRejects);
+            return FALSE;
+        }
+    }
+    MiUnmapPageInHyperSpace(Process, Address, OldIrql);
+
+    /* Build the entry */
+    Entry = ExAllocatePoolWithTag(NonPagedPool,
+                                  FIELD_OFFSET(MM_CSTORE_ENTRY, Data[Size]),
+                                  TAG_MM_CSTORE);
+    if (!Entry)
+    {
+        ExReleaseFastMutex(&MiCompressedStoreWorkspaceLock);
+        InterlockedIncrementUL(&MiCompressedStoreFull);
+        return FALSE;
+    }
+    Entry->PageFileIndex = PageFileIndex;
+    Entry->PageFileOffset = PageFileOffset;
+    Entry->Size = Size;
+    RtlCopyMemory(Entry->Data, MiCompressedStoreBuffer, Size);
+    ExReleaseFastMutex(&MiCompressedStoreWorkspaceLock);
+
+    /* And make it visible */
+    KeAcquireSpinLock(&MiCompressedStoreLock, &OldIrql);
+    InsertHeadList(MiCstoreBucket(PageFileIndex, PageFileOffset), &Entry->Links);
+    MiCompressedStoreBytes += FIELD_OFFSET(MM_CSTORE_ENTRY, Data[Size]);
+    MiCompressedStorePages++;
+    MiCompressedStoreInserts++;
+    KeReleaseSpinLock(&MiCompressedStoreLock, OldIrql);
+
+    return TRUE;
+}
+
+BOOLEAN
+NTAPI
+MiCompressedStoreRead(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset,
+    _In_ PFN_NUMBER Page)
+{
+    PMM_CSTORE_ENTRY Entry;
+    PEPROCESS Process;
+    PVOID Address;
+    KIRQL OldIrql;
+    BOOLEAN Result = FALSE;
+
+    if (!MiCompressedStoreLimit) return FALSE;
+
+    //
+    // Map the target page first, which takes us to DISPATCH_LEVEL so that the
+    // entry can be decompressed straight into it while holding the lock
+    //
+    Process = PsGetCurrentProcess();
+    Address = MiMapPageInHyperSpace(Process, Page, &OldIrql);
+    KeAcquireSpinLockAtDpcLevel(&MiCompressedStoreLock);
+    MiCompressedStoreLookups++;
+    Entry = MiCstoreFindEntry(PageFileIndex, PageFileOffset);
+    if (Entry)
+    {
+        if (!Entry->Size)
+        {
+            RtlZeroMemory(Address, PAGE_SIZE);
+            Result = TRUE;
+        }
+        else
+        {
+            Result = MiCstoreDecompressPage(Entry->Data, Entry->Size, Address);
+            if (!Result) DPRINT1("Corrupted compressed store entry %p\n", Entry);
+            ASSERT(Result);
+        }
+        if (Result) MiCompressedStoreHits++;
+    }
+    KeReleaseSpinLockFromDpcLevel(&MiCompressedStoreLock);
+    MiUnmapPageInHyperSpace(Process, Address, OldIrql);
+
+    return Result;
+}
+
+BOOLEAN
+NTAPI
+MiCompressedStoreContains(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    KIRQL OldIrql;
+    BOOLEAN Result;
+
+    if (!MiCompressedStorePages) return FALSE;
+
+    KeAcquireSpinLock(&MiCompressedStoreLock, &OldIrql);
+    Result = (MiCstoreFindEntry(PageFileIndex, PageFileOffset) != NULL);
+    KeReleaseSpinLock(&MiCompressedStoreLock, OldIrql);
+
+    return Result;
+}
+
+VOID
+NTAPI
+MiCompressedStoreFree(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    PMM_CSTORE_ENTRY Entry;
+    KIRQL OldIrql;
+
+    if (!MiCompressedStorePages) return;
+
+    KeAcquireSpinLock(&MiCompressedStoreLock, &OldIrql);
+    Entry = MiCstoreFindEntry(PageFileIndex, PageFileOffset);
+    if (Entry)
+    {
+        RemoveEntryList(&Entry->Links);
+        MiCompressedStoreBytes -= FIELD_OFFSET(MM_CSTORE_ENTRY, Data[Entry->Size]);
+        MiCompressedStorePages--;
+    }
+    KeReleaseSpinLock(&MiCompressedStoreLock, OldIrql);
+
+    if (Entry) ExFreePoolWithTag(Entry, TAG_MM_CSTORE);
+}
+
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtCompressedStore(ULONG Argc, PCHAR Argv[])
+{
+    if (!MiCompressedStoreLimit)
+    {
+        KdbpPrint("The compressed store is disabled\n");
+        return TRUE;
+    }
+
+    KdbpPrint("Limit:\t\t%Iu Kb\n", MiCompressedStoreLimit / 1024);
+    KdbpPrint("Pages:\t\t%lu (%lu Kb)\n", MiCompressedStorePages,
+              (MiCompressedStorePages * PAGE_SIZE) / 1024);
+    KdbpPrint("Compressed:\t%Iu Kb", MiCompressedStoreBytes / 1024);
+    if (MiCompressedStorePages)
+    {
+        KdbpPrint(" (%lu%% of the original size)",
+                  (ULONG)((MiCompressedStoreBytes * 100) / ((SIZE_T)MiCompressedStorePages * PAGE_SIZE)));
+    }
+    KdbpPrint("\n");
+    KdbpPrint("Inserts:\t%lu\n", MiCompressedStoreInserts);
+    KdbpPrint("Rejects:\t%lu incompressible, %lu store full\n",
+              MiCompressedStoreRejects, MiCompressedStoreFull);
+    KdbpPrint("Lookups:\t%lu, %lu hits", MiCompressedStoreLookups, MiCompressedStoreHits);
+    if (MiCompressedStoreLookups)
+    {
+        KdbpPrint(" (%lu%%)", (ULONG)(((ULONGLONG)MiCompressedStoreHits * 100) / MiCompressedStoreLookups));
+    }
+    KdbpPrint("\n");
+
+    return TRUE;
+}
+#endif
+
+/* EOF */
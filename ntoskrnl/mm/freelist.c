@@ -37,6 +37,9 @@ SIZE_T MmtotalCommitLimitMaximum;
 
 static RTL_BITMAP MiUserPfnBitMap;
 
+/* Number of balancer sweeps each user page went unreferenced for */
+static PUCHAR MiUserPfnAge;
+
 /* FUNCTIONS *************************************************************/
 
 VOID
@@ -56,6 +59,13 @@ MiInitializeUserPfnBitmap(VOID)
                         Bitmap,
                         (ULONG)MmHighestPhysicalPage + 1);
     RtlClearAllBits(&MiUserPfnBitMap);
+
+    /* And the page ages */
+    MiUserPfnAge = ExAllocatePoolWithTag(NonPagedPool,
+                                         MmHighestPhysicalPage + 1,
+                                         TAG_MM);
+    ASSERT(MiUserPfnAge);
+    RtlZeroMemory(MiUserPfnAge, MmHighestPhysicalPage + 1);
 }
 
 PFN_NUMBER
@@ -89,6 +99,7 @@ MmInsertLRULastUserPage(PFN_NUMBER Pfn)
     ASSERT(!RtlCheckBit(&MiUserPfnBitMap, (ULONG)Pfn));
     OldIrql = MiAcquirePfnLock();
     RtlSetBit(&MiUserPfnBitMap, (ULONG)Pfn);
+    MiUserPfnAge[Pfn] = 0;
     MiReleasePfnLock(OldIrql);
 }
 
@@ -111,6 +122,24 @@ MmGetLRUNextUserPage(PFN_NUMBER PreviousPfn)
     return Position;
 }
 
+UCHAR
+NTAPI
+MmAgeUserPage(PFN_NUMBER Page, BOOLEAN Accessed)
+{
+    /* Only the balancer updates the ages, so no lock is needed */
+    ASSERT(Page != 0);
+    if (Accessed)
+    {
+        MiUserPfnAge[Page] = 0;
+    }
+    else if (MiUserPfnAge[Page] < MAXUCHAR)
+    {
+        MiUserPfnAge[Page]++;
+    }
+
+    return MiUserPfnAge[Page];
+}
+
 VOID
 NTAPI
 MmRemoveLRUUserPage(PFN_NUMBER Page)
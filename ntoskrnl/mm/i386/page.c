@@ -532,6 +532,41 @@ MmSetCleanPage(PEPROCESS Process, PVOID Address)
     }
 }
 
+BOOLEAN
+NTAPI
+MmTestAndClearAccessedPage(PEPROCESS Process, PVOID Address)
+{
+    PULONG Pt;
+    ULONG Pte;
+
+    if (Address < MmSystemRangeStart && Process == NULL)
+    {
+        DPRINT1("MmTestAndClearAccessedPage is called for user space without a process.\n");
+        KeBugCheck(MEMORY_MANAGEMENT);
+    }
+
+    Pt = MmGetPageTableForProcess(Process, Address, FALSE);
+    if (Pt == NULL)
+    {
+        return FALSE;
+    }
+
+    do
+    {
+        Pte = *Pt;
+    } while (Pte != InterlockedCompareExchangePte(Pt, Pte & ~PA_ACCESSED, Pte));
+
+    if ((Pte & (PA_PRESENT | PA_ACCESSED)) == (PA_PRESENT | PA_ACCESSED))
+    {
+        /* The processor only sets the bit again if it misses the TLB */
+        MiFlushTlb(Pt, Address);
+        return TRUE;
+    }
+
+    MmUnmapPageTable(Pt);
+    return FALSE;
+}
+
 VOID
 NTAPI
 MmSetDirtyPage(PEPROCESS Process, PVOID Address)
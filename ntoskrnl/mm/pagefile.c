@@ -248,6 +248,9 @@ MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
+    /* Keep the page in memory, compressed, if the store takes it */
+    if (MiCompressedStoreWrite(i, offset, Page)) return STATUS_SUCCESS;
+
     MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
     MmBuildMdlFromPages(Mdl, &Page);
     Mdl->MdlFlags |= MDL_PAGES_LOCKED;
@@ -289,13 +292,25 @@ MiReadPageFile(
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset)
 {
-    LARGE_INTEGER file_offset;
+    return MiReadPageFileCluster(&Page, 1, PageFileIndex, PageFileOffset);
+}
+
+NTSTATUS
+NTAPI
+MiReadPageFileCluster(
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ PFN_COUNT PageCount,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    LARGE_INTEGER file_offset, next_offset;
     IO_STATUS_BLOCK Iosb;
-    NTSTATUS Status;
+    NTSTATUS Status = STATUS_SUCCESS;
     KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(ULONG)];
+    UCHAR MdlBase[sizeof(MDL) + (MM_MAXIMUM_READ_CLUSTER_SIZE + 1) * sizeof(PFN_NUMBER)];
     PMDL Mdl = (PMDL)MdlBase;
     PPAGINGFILE PagingFile;
+    PFN_COUNT RunCount;
 
     DPRINT("MiReadSwapFile\n");
 
@@ -306,6 +321,7 @@ MiReadPageFile(
     }
 
     ASSERT(PageFileIndex < MAX_PAGING_FILES);
+    ASSERT((PageCount != 0) && (PageCount <= MM_MAXIMUM_READ_CLUSTER_SIZE + 1));
 
     PagingFile = PagingFileList[PageFileIndex];
 
@@ -315,28 +331,55 @@ MiReadPageFile(
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
-    Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+    while (PageCount)
+    {
+        /* Pages that were kept in the compressed store don't need any I/O */
+        if (MiCompressedStoreRead(PageFileIndex, PageFileOffset, *Pages))
+        {
+            Pages++;
+            PageCount--;
+            PageFileOffset++;
+            continue;
+        }
 
-    file_offset.QuadPart = PageFileOffset * PAGE_SIZE;
-    file_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, file_offset);
+        file_offset.QuadPart = PageFileOffset * PAGE_SIZE;
+        file_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, file_offset);
 
-    KeInitializeEvent(&Event, NotificationEvent, FALSE);
-    Status = IoPageRead(PagingFile->FileObject,
-                        Mdl,
-                        &file_offset,
-                        &Event,
-                        &Iosb);
-    if (Status == STATUS_PENDING)
-    {
-        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-        Status = Iosb.Status;
-    }
-    if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
-    {
-        MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        /* Read as many pages as are contiguous on the disk in one go */
+        for (RunCount = 1; RunCount < PageCount; RunCount++)
+        {
+            if (MiCompressedStoreContains(PageFileIndex, PageFileOffset + RunCount)) break;
+            next_offset.QuadPart = (PageFileOffset + RunCount) * PAGE_SIZE;
+            next_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, next_offset);
+            if (next_offset.QuadPart != file_offset.QuadPart + RunCount * PAGE_SIZE) break;
+        }
+
+        MmInitializeMdl(Mdl, NULL, RunCount * PAGE_SIZE);
+        MmBuildMdlFromPages(Mdl, Pages);
+        Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+
+        KeInitializeEvent(&Event, NotificationEvent, FALSE);
+        Status = IoPageRead(PagingFile->FileObject,
+                            Mdl,
+                            &file_offset,
+                            &Event,
+                            &Iosb);
+        if (Status == STATUS_PENDING)
+        {
+            KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+            Status = Iosb.Status;
+        }
+        if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+        {
+            MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        }
+        if (!NT_SUCCESS(Status)) break;
+
+        Pages += RunCount;
+        PageCount -= RunCount;
+        PageFileOffset += RunCount;
     }
+
     return(Status);
 }
 
@@ -358,6 +401,8 @@ MmInitPagingFile(VOID)
         PagingFileList[i] = NULL;
     }
     MmNumberOfPagingFiles = 0;
+
+    MiInitializeCompressedStore();
 }
 
 static ULONG
@@ -398,6 +443,9 @@ MmFreeSwapPage(SWAPENTRY Entry)
     i = FILE_FROM_ENTRY(Entry);
     off = OFFSET_FROM_ENTRY(Entry) - 1;
 
+    /* Drop the compressed copy of the page, if there is one */
+    MiCompressedStoreFree(i, off);
+
     KeAcquireSpinLock(&PagingFileListLock, &oldIrql);
     if (PagingFileList[i] == NULL)
     {
@@ -184,6 +184,7 @@ MmPageOutPhysicalAddress(PFN_NUMBER Page)
 
     if (Address < MmSystemRangeStart)
     {
+        if (NT_SUCCESS(Status)) InterlockedIncrementUL(&Process->TrimmedPageCount);
         ExReleaseRundownProtection(&Process->RundownProtect);
         ObDereferenceObject(Process);
     }
@@ -262,6 +263,29 @@ MmIsDirtyPageRmap(PFN_NUMBER Page)
     return(FALSE);
 }
 
+BOOLEAN
+NTAPI
+MmTestAndClearAccessedPageRmap(PFN_NUMBER Page)
+{
+    PMM_RMAP_ENTRY current_entry;
+    BOOLEAN Accessed = FALSE;
+
+    /* Every mapping must be looked at, so that all the accessed bits get cleared */
+    ExAcquireFastMutex(&RmapListLock);
+    current_entry = MmGetRmapListHeadPage(Page);
+    while (current_entry != NULL)
+    {
+        if (!RMAP_IS_SEGMENT(current_entry->Address) &&
+            MmTestAndClearAccessedPage(current_entry->Process, current_entry->Address))
+        {
+            Accessed = TRUE;
+        }
+        current_entry = current_entry->Next;
+    }
+    ExReleaseFastMutex(&RmapListLock);
+    return Accessed;
+}
+
 VOID
 NTAPI
 MmInsertRmap(PFN_NUMBER Page, PEPROCESS Process,
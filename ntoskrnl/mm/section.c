@@ -1095,6 +1095,9 @@ MiReadPage(PMEMORY_AREA MemoryArea,
 
     DPRINT("%S %I64x\n", FileObject->FileName.Buffer, FileOffset);
 
+    /* Let the prefetcher know which pages the scenario needs */
+    CcPfLogPageFault(FileObject, FileOffset, IsImageSection);
+
     /*
      * If the file system is letting us go directly to the cache and the
      * memory area was mapped at an offset in the file which is page aligned
@@ -1423,6 +1426,7 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
                 DPRINT1("MmReadFromSwapPage failed, status = %x\n", Status);
                 KeBugCheck(MEMORY_MANAGEMENT);
             }
+            MiNoteUserPageRefault(Process);
         }
 
         MmLockAddressSpace(AddressSpace);
@@ -1610,6 +1614,7 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
         {
             KeBugCheck(MEMORY_MANAGEMENT);
         }
+        MiNoteUserPageRefault(Process);
 
         /*
          * Relock the address space and segment
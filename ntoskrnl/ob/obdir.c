@@ -20,8 +20,120 @@
 BOOLEAN ObpLUIDDeviceMapsEnabled;
 POBJECT_TYPE ObDirectoryType = NULL;
 
+/* Average bucket length at which a directory gets a larger hash table */
+#define OBP_DIRECTORY_LOAD_FACTOR       4
+
+/* Size of the first hash table past the built-in buckets, and the largest */
+#define OBP_DIRECTORY_MIN_HASH_SHIFT    8
+#define OBP_DIRECTORY_MAX_HASH_SHIFT    16
+
 /* PRIVATE FUNCTIONS ******************************************************/
 
+FORCEINLINE
+ULONG
+ObpGetDirectoryHashIndex(IN POBJECT_DIRECTORY Directory,
+                         IN ULONG HashValue)
+{
+    POBP_DIRECTORY PrivateDirectory = OBP_GET_DIRECTORY(Directory);
+
+    /* Use the built-in buckets until the directory has its own table */
+    if (!PrivateDirectory->HashTable) return HashValue % NUMBER_HASH_BUCKETS;
+
+    /* Mix the hash a bit, our names often only differ in the last characters */
+    return (HashValue * 0x9E3779B1) >> (32 - PrivateDirectory->HashShift);
+}
+
+FORCEINLINE
+POBJECT_DIRECTORY_ENTRY*
+ObpGetDirectoryBuckets(IN POBJECT_DIRECTORY Directory,
+                       OUT PULONG BucketCount)
+{
+    POBP_DIRECTORY PrivateDirectory = OBP_GET_DIRECTORY(Directory);
+
+    /* Return the hash table in use and its size */
+    if (!PrivateDirectory->HashTable)
+    {
+        *BucketCount = NUMBER_HASH_BUCKETS;
+        return Directory->HashBuckets;
+    }
+
+    *BucketCount = 1 << PrivateDirectory->HashShift;
+    return PrivateDirectory->HashTable;
+}
+
+static
+VOID
+ObpGrowDirectoryHashTable(IN POBJECT_DIRECTORY Directory)
+{
+    POBP_DIRECTORY PrivateDirectory = OBP_GET_DIRECTORY(Directory);
+    POBJECT_DIRECTORY_ENTRY *OldBuckets, *NewTable, *OldTable, Entry;
+    ULONG OldCount, NewShift, Index, i;
+
+    /* Pick the new size, and give up if we're already at the largest one */
+    NewShift = PrivateDirectory->HashTable ?
+               PrivateDirectory->HashShift + 2 : OBP_DIRECTORY_MIN_HASH_SHIFT;
+    if (NewShift > OBP_DIRECTORY_MAX_HASH_SHIFT) return;
+
+    /* Allocate the table, we just keep the old one if this fails */
+    NewTable = ExAllocatePoolWithTag(PagedPool,
+                                     (1 << NewShift) * sizeof(POBJECT_DIRECTORY_ENTRY),
+                                     OB_DIR_TAG);
+    if (!NewTable) return;
+    RtlZeroMemory(NewTable, (1 << NewShift) * sizeof(POBJECT_DIRECTORY_ENTRY));
+
+    //
+    // Switch to the new table and move every entry over. The entries keep
+    // their full hash, so nothing needs to be rehashed. The directory is locked
+    // exclusively, so nobody is walking the old buckets.
+    //
+    OldBuckets = ObpGetDirectoryBuckets(Directory, &OldCount);
+    OldTable = PrivateDirectory->HashTable;
+    PrivateDirectory->HashTable = NewTable;
+    PrivateDirectory->HashShift = NewShift;
+    for (i = 0; i < OldCount; i++)
+    {
+        while ((Entry = OldBuckets[i]))
+        {
+            OldBuckets[i] = Entry->ChainLink;
+            Index = ObpGetDirectoryHashIndex(Directory, Entry->HashValue);
+            Entry->ChainLink = NewTable[Index];
+            NewTable[Index] = Entry;
+        }
+    }
+
+    /* Free the previous table, unless it was the built-in one */
+    if (OldTable) ExFreePoolWithTag(OldTable, OB_DIR_TAG);
+}
+
+/*++
+* @name ObpDeleteDirectory
+*
+*     The ObpDeleteDirectory routine is the delete procedure of directory
+*     objects. It frees the hash table the directory may have grown.
+*
+* @param ObjectBody
+*        Pointer to the directory being deleted.
+*
+* @return None.
+*
+* @remarks The directory is empty by then.
+*
+*--*/
+VOID
+NTAPI
+ObpDeleteDirectory(IN PVOID ObjectBody)
+{
+    POBP_DIRECTORY PrivateDirectory = OBP_GET_DIRECTORY((POBJECT_DIRECTORY)ObjectBody);
+
+    /* Free the hash table if we had one */
+    ASSERT(PrivateDirectory->EntryCount == 0);
+    if (PrivateDirectory->HashTable)
+    {
+        ExFreePoolWithTag(PrivateDirectory->HashTable, OB_DIR_TAG);
+        PrivateDirectory->HashTable = NULL;
+    }
+}
+
 /*++
 * @name ObpInsertEntryDirectory
 *
@@ -47,9 +159,11 @@ ObpInsertEntryDirectory(IN POBJECT_DIRECTORY Parent,
                         IN POBP_LOOKUP_CONTEXT Context,
                         IN POBJECT_HEADER ObjectHeader)
 {
+    POBP_DIRECTORY PrivateDirectory = OBP_GET_DIRECTORY(Parent);
     POBJECT_DIRECTORY_ENTRY *AllocatedEntry;
     POBJECT_DIRECTORY_ENTRY NewEntry;
     POBJECT_HEADER_NAME_INFO HeaderNameInfo;
+    ULONG BucketCount;
 
     /* Make sure we have a name */
     ASSERT(ObjectHeader->NameInfoOffset != 0);
@@ -79,7 +193,8 @@ ObpInsertEntryDirectory(IN POBJECT_DIRECTORY Parent,
     HeaderNameInfo = OBJECT_HEADER_TO_NAME_INFO(ObjectHeader);
 
     /* Get the Allocated entry */
-    AllocatedEntry = &Parent->HashBuckets[Context->HashIndex];
+    AllocatedEntry = &ObpGetDirectoryBuckets(Parent, &BucketCount)
+                     [ObpGetDirectoryHashIndex(Parent, Context->HashValue)];
 
     /* Set it */
     NewEntry->ChainLink = *AllocatedEntry;
@@ -90,6 +205,12 @@ ObpInsertEntryDirectory(IN POBJECT_DIRECTORY Parent,
 
     /* Associate the Directory */
     HeaderNameInfo->Directory = Parent;
+
+    /* Get a larger hash table if the chains are getting too long */
+    if (++PrivateDirectory->EntryCount > BucketCount * OBP_DIRECTORY_LOAD_FACTOR)
+    {
+        ObpGrowDirectoryHashTable(Parent);
+    }
     return TRUE;
 }
 
@@ -129,12 +250,13 @@ ObpLookupEntryDirectory(IN POBJECT_DIRECTORY Directory,
     BOOLEAN CaseInsensitive = FALSE;
     POBJECT_HEADER_NAME_INFO HeaderNameInfo;
     POBJECT_HEADER ObjectHeader;
+    POBP_DIRECTORY PrivateDirectory;
     ULONG HashValue;
     ULONG HashIndex;
+    ULONG BucketCount;
     LONG TotalChars;
     WCHAR CurrentChar;
     POBJECT_DIRECTORY_ENTRY *AllocatedEntry;
-    POBJECT_DIRECTORY_ENTRY *LookupBucket;
     POBJECT_DIRECTORY_ENTRY CurrentEntry;
     PVOID FoundObject = NULL;
     PWSTR Buffer;
@@ -171,24 +293,45 @@ ObpLookupEntryDirectory(IN POBJECT_DIRECTORY Directory,
         else HashValue += (CurrentChar - ('a'-'A'));
     }
 
-    /* Merge it with our number of hash buckets */
-    HashIndex = HashValue % 37;
+    /* Check if the directory is already locked */
+    if (!Context->DirectoryLocked)
+    {
+        /* Lock it */
+        ObpAcquireDirectoryLockShared(Directory, Context);
+    }
+
+    //
+    // Merge it with our number of hash buckets. This has to be done with the
+    // lock held, since the directory may switch to a larger hash table.
+    //
+    HashIndex = ObpGetDirectoryHashIndex(Directory, HashValue);
 
     /* Save the result */
     Context->HashValue = HashValue;
     Context->HashIndex = (USHORT)HashIndex;
 
-    /* Get the root entry and set it as our lookup bucket */
-    AllocatedEntry = &Directory->HashBuckets[HashIndex];
-    LookupBucket = AllocatedEntry;
-
-    /* Check if the directory is already locked */
-    if (!Context->DirectoryLocked)
+    /* Check if this is the name that was looked up last time */
+    PrivateDirectory = OBP_GET_DIRECTORY(Directory);
+    CurrentEntry = *(POBJECT_DIRECTORY_ENTRY volatile *)&PrivateDirectory->LastLookup;
+    if ((CurrentEntry) && (CurrentEntry->HashValue == HashValue))
     {
-        /* Lock it */
-        ObpAcquireDirectoryLockShared(Directory, Context);
+        /* Get the name information */
+        ObjectHeader = OBJECT_TO_OBJECT_HEADER(CurrentEntry->Object);
+        ASSERT(ObjectHeader->NameInfoOffset != 0);
+        HeaderNameInfo = OBJECT_HEADER_TO_NAME_INFO(ObjectHeader);
+
+        /* If the names match too, we're done */
+        if ((Name->Length == HeaderNameInfo->Name.Length) &&
+            (RtlEqualUnicodeString(Name, &HeaderNameInfo->Name, CaseInsensitive)))
+        {
+            FoundObject = CurrentEntry->Object;
+            goto Quickie;
+        }
     }
 
+    /* Get the root entry */
+    AllocatedEntry = &ObpGetDirectoryBuckets(Directory, &BucketCount)[HashIndex];
+
     /* Start looping */
     while ((CurrentEntry = *AllocatedEntry))
     {
@@ -217,23 +360,13 @@ ObpLookupEntryDirectory(IN POBJECT_DIRECTORY Directory,
     /* Check if we still have an entry */
     if (CurrentEntry)
     {
-        /* Set this entry as the first, to speed up incoming insertion */
-        if (AllocatedEntry != LookupBucket)
-        {
-            /* Check if the directory was locked or convert the lock */
-            if ((Context->DirectoryLocked) ||
-                (ExConvertPushLockSharedToExclusive(&Directory->Lock)))
-            {
-                /* Set the Current Entry */
-                *AllocatedEntry = CurrentEntry->ChainLink;
-
-                /* Link to the old Hash Entry */
-                CurrentEntry->ChainLink = *LookupBucket;
-
-                /* Set the new Hash Entry */
-                *LookupBucket = CurrentEntry;
-            }
-        }
+        //
+        // Remember it for the next lookup. This is a single pointer write, so it
+        // is fine under the shared lock, and we never have to convert the lock
+        // to move the entry to the front of its bucket. The entry can't go away
+        // under the hint: deleting it needs the lock exclusively, and clears it.
+        //
+        PrivateDirectory->LastLookup = CurrentEntry;
 
         /* Save the found object */
         FoundObject = CurrentEntry->Object;
@@ -310,21 +443,42 @@ NTAPI
 ObpDeleteEntryDirectory(POBP_LOOKUP_CONTEXT Context)
 {
     POBJECT_DIRECTORY Directory;
+    POBP_DIRECTORY PrivateDirectory;
     POBJECT_DIRECTORY_ENTRY *AllocatedEntry;
     POBJECT_DIRECTORY_ENTRY CurrentEntry;
+    ULONG BucketCount;
 
     /* Get the Directory */
     Directory = Context->Directory;
     if (!Directory) return FALSE;
-
-    /* Get the Entry */
-    AllocatedEntry = &Directory->HashBuckets[Context->HashIndex];
-    CurrentEntry = *AllocatedEntry;
+    ASSERT(Context->DirectoryLocked);
+
+    //
+    // Find the entry of the object we looked up. Lookups don't move entries
+    // to the front of their bucket anymore, so we have to search for it.
+    //
+    AllocatedEntry = &ObpGetDirectoryBuckets(Directory, &BucketCount)
+                     [ObpGetDirectoryHashIndex(Directory, Context->HashValue)];
+    while ((CurrentEntry = *AllocatedEntry))
+    {
+        if (CurrentEntry->Object == Context->Object) break;
+        AllocatedEntry = &CurrentEntry->ChainLink;
+    }
+    if (!CurrentEntry)
+    {
+        ASSERT(FALSE);
+        return FALSE;
+    }
 
     /* Unlink the Entry */
     *AllocatedEntry = CurrentEntry->ChainLink;
     CurrentEntry->ChainLink = NULL;
 
+    /* Forget about it if it was the last one looked up */
+    PrivateDirectory = OBP_GET_DIRECTORY(Directory);
+    if (PrivateDirectory->LastLookup == CurrentEntry) PrivateDirectory->LastLookup = NULL;
+    PrivateDirectory->EntryCount--;
+
     /* Free it */
     ExFreePoolWithTag(CurrentEntry, OB_DIR_TAG);
 
@@ -469,8 +623,8 @@ NtQueryDirectoryObject(IN HANDLE DirectoryHandle,
     POBJECT_DIRECTORY_INFORMATION DirectoryInfo;
     ULONG Length, TotalLength;
     ULONG Count, CurrentEntry;
-    ULONG Hash;
-    POBJECT_DIRECTORY_ENTRY Entry;
+    ULONG Hash, BucketCount;
+    POBJECT_DIRECTORY_ENTRY *Buckets, Entry;
     POBJECT_HEADER ObjectHeader;
     POBJECT_HEADER_NAME_INFO ObjectNameInfo;
     UNICODE_STRING Name;
@@ -544,10 +698,11 @@ NtQueryDirectoryObject(IN HANDLE DirectoryHandle,
 
     /* Set default status and start looping */
     Status = STATUS_NO_MORE_ENTRIES;
-    for (Hash = 0; Hash < 37; Hash++)
+    Buckets = ObpGetDirectoryBuckets(Directory, &BucketCount);
+    for (Hash = 0; Hash < BucketCount; Hash++)
     {
         /* Get this entry and loop all of them */
-        Entry = Directory->HashBuckets[Hash];
+        Entry = Buckets[Hash];
         while (Entry)
         {
             /* Check if we should process this entry */
@@ -760,14 +915,14 @@ NtCreateDirectoryObject(OUT PHANDLE DirectoryHandle,
                             ObjectAttributes,
                             PreviousMode,
                             NULL,
-                            sizeof(OBJECT_DIRECTORY),
+                            sizeof(OBP_DIRECTORY),
                             0,
                             0,
                             (PVOID*)&Directory);
     if (!NT_SUCCESS(Status)) return Status;
 
-    /* Setup the object */
-    RtlZeroMemory(Directory, sizeof(OBJECT_DIRECTORY));
+    /* Setup the object, along with our private part */
+    RtlZeroMemory(Directory, sizeof(OBP_DIRECTORY));
     ExInitializePushLock(&Directory->Lock);
     Directory->SessionId = -1;
 
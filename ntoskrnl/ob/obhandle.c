@@ -756,6 +756,7 @@ ObpCloseHandleTableEntry(IN PHANDLE_TABLE HandleTable,
 
     /* Destroy and unlock the handle entry */
     ExDestroyHandle(HandleTable, Handle, HandleEntry);
+    ObpUpdateHandleStatistics(HandleCloses);
 
     /* Now decrement the handle count */
     ObpDecrementHandleCount(Body,
@@ -1407,6 +1408,8 @@ ObpCreateUnnamedHandle(IN PVOID Object,
     /* Make sure we got a handle */
     if (Handle)
     {
+        ObpUpdateHandleStatistics(HandleCreates);
+
         /* Check if this was a kernel handle */
         if (KernelHandle) Handle = ObMarkHandleAsKernelHandle(Handle);
 
@@ -1626,6 +1629,8 @@ ObpCreateHandle(IN OB_OPEN_REASON OpenReason,
     /* Make sure we got a handle */
     if (Handle)
     {
+        ObpUpdateHandleStatistics(HandleCreates);
+
         /* Check if this was a kernel handle */
         if (KernelHandle) Handle = ObMarkHandleAsKernelHandle(Handle);
 
@@ -2456,6 +2461,10 @@ ObDuplicateObject(IN PEPROCESS SourceProcess,
         ObDereferenceObject(SourceObject);
         Status = STATUS_INSUFFICIENT_RESOURCES;
     }
+    else
+    {
+        ObpUpdateHandleStatistics(HandleDuplicates);
+    }
 
     /* Mark it as a kernel handle if requested */
     if (KernelHandle)
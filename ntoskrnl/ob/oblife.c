@@ -1000,6 +1000,7 @@ ObCreateObject(IN KPROCESSOR_MODE ProbeMode OPTIONAL,
             {
                 /* Return the Object */
                 *Object = &Header->Body;
+                ObpUpdateObjectStatistics(Type);
 
                 /* Check if this is a permanent object */
                 if (Header->Flags & OB_FLAG_PERMANENT)
@@ -634,6 +634,7 @@ ObReferenceObjectByHandle(IN HANDLE Handle,
     /* Enter a critical region while we touch the handle table */
     ASSERT(HandleTable != NULL);
     KeEnterCriticalRegion();
+    ObpUpdateHandleStatistics(HandleLookups);
 
     /* Get the handle entry */
     HandleEntry = ExMapHandleToPointer(HandleTable, Handle);
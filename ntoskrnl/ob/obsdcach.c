@@ -17,6 +17,30 @@
 #define SD_CACHE_ENTRIES 0x100
 OB_SD_CACHE_LIST ObsSecurityDescriptorCache[SD_CACHE_ENTRIES];
 
+/* Most references a processor holds back before releasing them for real */
+#define SD_RELEASE_CACHE_MAXIMUM 0x100
+
+//
+// Per-processor batch of released references. Objects created with the same
+// descriptor are usually destroyed with it too, so instead of dropping their
+// references on the shared header right away, each processor holds back the
+// references released on its last descriptor. They are handed out again when
+// that descriptor is logged for a new object, or released for real when the
+// processor moves on to another descriptor. While references are held back,
+// the descriptor stays in the cache. The counters are only approximate.
+//
+typedef struct DECLSPEC_CACHEALIGN _OB_SD_RELEASE_CACHE
+{
+    EX_PUSH_LOCK PushLock;
+    PSECURITY_DESCRIPTOR_HEADER SdHeader;
+    ULONG Count;
+    ULONG Hits;
+    ULONG Misses;
+    ULONG BatchedReleases;
+} OB_SD_RELEASE_CACHE, *POB_SD_RELEASE_CACHE;
+
+OB_SD_RELEASE_CACHE ObsSecurityDescriptorReleaseCache[MAXIMUM_PROCESSORS];
+
 /* PRIVATE FUNCTIONS **********************************************************/
 
 FORCEINLINE
@@ -70,6 +94,12 @@ ObpInitSdCache(VOID)
         ExInitializePushLock(&ObsSecurityDescriptorCache[i].PushLock);
     }
 
+    /* Initialize the per-processor release batches */
+    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    {
+        ExInitializePushLock(&ObsSecurityDescriptorReleaseCache[i].PushLock);
+    }
+
     /* Return success */
     return STATUS_SUCCESS;
 }
@@ -176,6 +206,84 @@ ObpDestroySecurityDescriptorHeader(IN PSECURITY_DESCRIPTOR_HEADER SdHeader)
     return SdHeader;
 }
 
+FORCEINLINE
+POB_SD_RELEASE_CACHE
+ObpSdGetReleaseCache(VOID)
+{
+    /* It doesn't matter if we get moved afterwards, the batch has its lock */
+    return &ObsSecurityDescriptorReleaseCache[KeGetCurrentProcessorNumber()];
+}
+
+FORCEINLINE
+VOID
+ObpSdLockReleaseCache(IN POB_SD_RELEASE_CACHE ReleaseCache)
+{
+    /* Acquire the lock */
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&ReleaseCache->PushLock);
+}
+
+FORCEINLINE
+VOID
+ObpSdUnlockReleaseCache(IN POB_SD_RELEASE_CACHE ReleaseCache)
+{
+    /* Release the lock */
+    ExReleasePushLockExclusive(&ReleaseCache->PushLock);
+    KeLeaveCriticalRegion();
+}
+
+VOID
+NTAPI
+ObpReleaseSecurityDescriptorHeader(IN PSECURITY_DESCRIPTOR_HEADER SdHeader,
+                                   IN ULONG Count)
+{
+    LONG OldValue, NewValue;
+    ULONG Index;
+    POB_SD_CACHE_LIST CacheEntry;
+
+    /* Get the current reference count */
+    OldValue = SdHeader->RefCount;
+
+    /* Check if the caller is destroying this SD -- we need the lock for that */
+    while (OldValue != Count)
+    {
+        /* He isn't, we can just try to derefeference atomically */
+        NewValue = InterlockedCompareExchange((PLONG)&SdHeader->RefCount,
+                                              OldValue - Count,
+                                              OldValue);
+        if (NewValue == OldValue) return;
+
+        /* Try again */
+        OldValue = NewValue;
+    }
+
+    /* At this point, we need the lock, so choose an entry */
+    Index = SdHeader->FullHash % SD_CACHE_ENTRIES;
+    CacheEntry = &ObsSecurityDescriptorCache[Index];
+
+    /* Acquire the lock for it */
+    ObpSdAcquireLock(CacheEntry);
+    ASSERT(SdHeader->RefCount != 0);
+
+    /* Now do the dereference */
+    if (InterlockedExchangeAdd((PLONG)&SdHeader->RefCount, -(LONG)Count) == Count)
+    {
+        /* We're down to zero -- destroy the header */
+        SdHeader = ObpDestroySecurityDescriptorHeader(SdHeader);
+
+        /* Release the lock */
+        ObpSdReleaseLock(CacheEntry);
+
+        /* Free the header */
+        ExFreePool(SdHeader);
+    }
+    else
+    {
+        /* Just release the lock */
+        ObpSdReleaseLock(CacheEntry);
+    }
+}
+
 PSECURITY_DESCRIPTOR
 NTAPI
 ObpReferenceSecurityDescriptor(IN POBJECT_HEADER ObjectHeader)
@@ -287,56 +395,47 @@ NTAPI
 ObDereferenceSecurityDescriptor(IN PSECURITY_DESCRIPTOR SecurityDescriptor,
                                 IN ULONG Count)
 {
-    PSECURITY_DESCRIPTOR_HEADER SdHeader;
-    LONG OldValue, NewValue;
-    ULONG Index;
-    POB_SD_CACHE_LIST CacheEntry;
-    
+    PSECURITY_DESCRIPTOR_HEADER SdHeader, OldHeader;
+    POB_SD_RELEASE_CACHE ReleaseCache;
+    ULONG OldCount;
+
     /* Get the header */
     SdHeader = ObpGetHeaderForSd(SecurityDescriptor);
-    
-    /* Get the current reference count */
-    OldValue = SdHeader->RefCount;
-    
-    /* Check if the caller is destroying this SD -- we need the lock for that */
-    while (OldValue != Count)
+
+    /* Get the release batch of this processor */
+    ReleaseCache = ObpSdGetReleaseCache();
+    ObpSdLockReleaseCache(ReleaseCache);
+
+    /* Check if we're releasing more references on the same descriptor */
+    if ((ReleaseCache->SdHeader == SdHeader) &&
+        (ReleaseCache->Count + Count <= SD_RELEASE_CACHE_MAXIMUM))
     {
-        /* He isn't, we can just try to derefeference atomically */
-        NewValue = InterlockedCompareExchange((PLONG)&SdHeader->RefCount,
-                                              OldValue - Count,
-                                              OldValue);
-        if (NewValue == OldValue) return;
-        
-        /* Try again */
-        OldValue = NewValue;
+        /* Just hold them back with the others */
+        ReleaseCache->Count += Count;
+        ReleaseCache->BatchedReleases++;
+        ObpSdUnlockReleaseCache(ReleaseCache);
+        return;
     }
-    
-    /* At this point, we need the lock, so choose an entry */
-    Index = SdHeader->FullHash % SD_CACHE_ENTRIES;
-    CacheEntry = &ObsSecurityDescriptorCache[Index];
-    
-    /* Acquire the lock for it */
-    ObpSdAcquireLock(CacheEntry);
-    ASSERT(SdHeader->RefCount != 0);
-    
-    /* Now do the dereference */
-    if (InterlockedExchangeAdd((PLONG)&SdHeader->RefCount, -(LONG)Count) == Count)
+
+    /* Otherwise, hold back these references instead of the old ones */
+    OldHeader = ReleaseCache->SdHeader;
+    OldCount = ReleaseCache->Count;
+    if (Count <= SD_RELEASE_CACHE_MAXIMUM)
     {
-        /* We're down to zero -- destroy the header */
-        SdHeader = ObpDestroySecurityDescriptorHeader(SdHeader);
-        
-        /* Release the lock */
-        ObpSdReleaseLock(CacheEntry);
-        
-        /* Free the header */
-        ExFreePool(SdHeader);
+        ReleaseCache->SdHeader = SdHeader;
+        ReleaseCache->Count = Count;
+        Count = 0;
     }
     else
     {
-        /* Just release the lock */
-        ObpSdReleaseLock(CacheEntry);
+        ReleaseCache->SdHeader = NULL;
+        ReleaseCache->Count = 0;
     }
-    
+    ObpSdUnlockReleaseCache(ReleaseCache);
+
+    /* Now release whatever we couldn't keep */
+    if (OldHeader) ObpReleaseSecurityDescriptorHeader(OldHeader, OldCount);
+    if (Count) ObpReleaseSecurityDescriptorHeader(SdHeader, Count);
 }
 
 /*++
@@ -368,6 +467,7 @@ ObLogSecurityDescriptor(IN PSECURITY_DESCRIPTOR InputSecurityDescriptor,
     PSECURITY_DESCRIPTOR_HEADER SdHeader = NULL, NewHeader  = NULL;
     ULONG Length, Hash, Index;
     POB_SD_CACHE_LIST CacheEntry;
+    POB_SD_RELEASE_CACHE ReleaseCache;
     BOOLEAN Result;
     PLIST_ENTRY NextEntry;
 
@@ -376,7 +476,34 @@ ObLogSecurityDescriptor(IN PSECURITY_DESCRIPTOR InputSecurityDescriptor,
     
     /* Get the hash */
     Hash = ObpHashSecurityDescriptor(InputSecurityDescriptor, Length);
-    
+
+    //
+    // Check if this processor is holding back enough references on this very
+    // descriptor. If so, hand them out instead of touching the cache at all.
+    //
+    ReleaseCache = ObpSdGetReleaseCache();
+    ObpSdLockReleaseCache(ReleaseCache);
+    SdHeader = ReleaseCache->SdHeader;
+    if ((SdHeader) &&
+        (SdHeader->FullHash == Hash) &&
+        (ReleaseCache->Count >= RefBias) &&
+        (ObpCompareSecurityDescriptors(InputSecurityDescriptor,
+                                       Length,
+                                       &SdHeader->SecurityDescriptor)))
+    {
+        /* Take the references, and forget the descriptor if none are left */
+        ReleaseCache->Count -= RefBias;
+        if (!ReleaseCache->Count) ReleaseCache->SdHeader = NULL;
+        ReleaseCache->Hits++;
+        ObpSdUnlockReleaseCache(ReleaseCache);
+
+        /* Return the descriptor */
+        *OutputSecurityDescriptor = &SdHeader->SecurityDescriptor;
+        return STATUS_SUCCESS;
+    }
+    ObpSdUnlockReleaseCache(ReleaseCache);
+    SdHeader = NULL;
+
     /* Now select the appropriate cache entry */
     Index = Hash % SD_CACHE_ENTRIES;
     CacheEntry = &ObsSecurityDescriptorCache[Index];
@@ -419,6 +546,7 @@ ObLogSecurityDescriptor(IN PSECURITY_DESCRIPTOR InputSecurityDescriptor,
         {
             /* Increment its reference count */
             InterlockedExchangeAdd((PLONG)&SdHeader->RefCount, RefBias);
+            ReleaseCache->Hits++;
             
             /* Release the lock */
             ObpSdReleaseLockShared(CacheEntry);
@@ -456,6 +584,7 @@ ObLogSecurityDescriptor(IN PSECURITY_DESCRIPTOR InputSecurityDescriptor,
     
     /* Okay, now let's do the insert, we should have the exclusive lock */
     InsertTailList(NextEntry, &NewHeader->Link);
+    ReleaseCache->Misses++;
     
     /* Release the lock */
     ObpSdReleaseLock(CacheEntry);
@@ -465,4 +594,49 @@ ObLogSecurityDescriptor(IN PSECURITY_DESCRIPTOR InputSecurityDescriptor,
     return STATUS_SUCCESS;
 }
 
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtSdCache(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    POB_SD_RELEASE_CACHE ReleaseCache;
+    PLIST_ENTRY NextEntry;
+    ULONG i, Lists = 0, Descriptors = 0, Longest = 0, Length;
+
+    /* Walk the lists without locking, this is only a rough picture */
+    for (i = 0; i < SD_CACHE_ENTRIES; i++)
+    {
+        Length = 0;
+        for (NextEntry = ObsSecurityDescriptorCache[i].Head.Flink;
+             NextEntry != &ObsSecurityDescriptorCache[i].Head;
+             NextEntry = NextEntry->Flink)
+        {
+            Length++;
+        }
+
+        if (Length) Lists++;
+        Descriptors += Length;
+        Longest = max(Longest, Length);
+    }
+
+    KdbpPrint("%lu cached descriptors in %lu of %lu lists, longest list %lu\n",
+              Descriptors, Lists, SD_CACHE_ENTRIES, Longest);
+    KdbpPrint("CPU        Hits      Misses     Batched  Held  Descriptor\n");
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        ReleaseCache = &ObsSecurityDescriptorReleaseCache[i];
+        KdbpPrint("%3lu  %10lu  %10lu  %10lu  %4lu  %p\n",
+                  i,
+                  ReleaseCache->Hits,
+                  ReleaseCache->Misses,
+                  ReleaseCache->BatchedReleases,
+                  ReleaseCache->Count,
+                  ReleaseCache->SdHeader);
+    }
+
+    return TRUE;
+}
+#endif
+
 /* EOF */
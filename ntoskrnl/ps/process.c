@@ -866,6 +866,9 @@ PspCreateProcess(OUT PHANDLE ProcessHandle,
     }
     _SEH2_END;
 
+    /* Notify WMI */
+    WmiTraceProcess(Process, TRUE);
+
     /* Run the Notification Routines */
     PspRunCreateProcessNotifyRoutines(Process, TRUE);
 
@@ -1063,6 +1063,48 @@ NtQueryInformationProcess(IN HANDLE ProcessHandle,
 
         /* Not supported by Server 2003 */
         default:
+
+            /* ReactOS extension: per-process handle and object statistics */
+            if (ProcessInformationClass == ProcessHandleStatistics)
+            {
+                if (ProcessInformationLength != sizeof(PROCESS_HANDLE_STATISTICS))
+                {
+                    Status = STATUS_INFO_LENGTH_MISMATCH;
+                    break;
+                }
+
+                /* Set the return length */
+                Length = sizeof(PROCESS_HANDLE_STATISTICS);
+
+                /* Reference the process */
+                Status = ObReferenceObjectByHandle(ProcessHandle,
+                                                   PROCESS_QUERY_INFORMATION,
+                                                   PsProcessType,
+                                                   PreviousMode,
+                                                   (PVOID*)&Process,
+                                                   NULL);
+                if (!NT_SUCCESS(Status)) break;
+
+                /* Protect write in SEH */
+                _SEH2_TRY
+                {
+                    /* Return a snapshot of the counters */
+                    RtlCopyMemory(ProcessInformation,
+                                  &Process->HandleStatistics,
+                                  sizeof(PROCESS_HANDLE_STATISTICS));
+                }
+                _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+                {
+                    /* Get the exception code */
+                    Status = _SEH2_GetExceptionCode();
+                }
+                _SEH2_END;
+
+                /* Dereference the process */
+                ObDereferenceObject(Process);
+                break;
+            }
+
             DPRINT1("Unsupported info class: %lx\n", ProcessInformationClass);
             Status = STATUS_INVALID_INFO_CLASS;
     }
@@ -15,7 +15,6 @@
 
 /* GLOBALS ******************************************************************/
 
-extern BOOLEAN CcPfEnablePrefetcher;
 extern ULONG MmReadClusterSize;
 POBJECT_TYPE PsThreadType = NULL;
 
@@ -62,11 +61,14 @@ PspUserThreadStartup(IN PKSTART_ROUTINE StartRoutine,
     /* Make sure we're not already dead */
     if (!DeadThread)
     {
+#ifndef NEWCC
         /* Check if the Prefetcher is enabled */
         if (CcPfEnablePrefetcher)
         {
-            /* FIXME: Prepare to prefetch this process */
+            /* Prepare to prefetch this process */
+            CcPfBeginAppLaunch(Thread->ThreadsProcess);
         }
+#endif
 
         /* Raise to APC */
         KeRaiseIrql(APC_LEVEL, &OldIrql);
@@ -406,8 +408,7 @@ PspCreateThread(OUT PHANDLE ThreadHandle,
     ExReleaseRundownProtection(&Process->RundownProtect);
 
     /* Notify WMI */
-    //WmiTraceProcess(Process, TRUE);
-    //WmiTraceThread(Thread, InitialTeb, TRUE);
+    WmiTraceThread(Thread, InitialTeb, TRUE);
 
     /* Notify Thread Creation */
     PspRunCreateThreadNotifyRoutines(Thread, TRUE);
@@ -524,29 +524,38 @@ RtlpGetStackLimits(
 NTSTATUS
 RtlpInitAtomTableLock(PRTL_ATOM_TABLE AtomTable)
 {
-   ExInitializeFastMutex(&AtomTable->FastMutex);
-
-   return STATUS_SUCCESS;
+   return ExInitializeResourceLite(&AtomTable->Resource);
 }
 
 
 VOID
 RtlpDestroyAtomTableLock(PRTL_ATOM_TABLE AtomTable)
 {
+   ExDeleteResourceLite(&AtomTable->Resource);
 }
 
 
 BOOLEAN
 RtlpLockAtomTable(PRTL_ATOM_TABLE AtomTable)
 {
-   ExAcquireFastMutex(&AtomTable->FastMutex);
+   KeEnterCriticalRegion();
+   ExAcquireResourceExclusiveLite(&AtomTable->Resource, TRUE);
+   return TRUE;
+}
+
+BOOLEAN
+RtlpLockAtomTableShared(PRTL_ATOM_TABLE AtomTable)
+{
+   KeEnterCriticalRegion();
+   ExAcquireResourceSharedLite(&AtomTable->Resource, TRUE);
    return TRUE;
 }
 
 VOID
 RtlpUnlockAtomTable(PRTL_ATOM_TABLE AtomTable)
 {
-   ExReleaseFastMutex(&AtomTable->FastMutex);
+   ExReleaseResourceLite(&AtomTable->Resource);
+   KeLeaveCriticalRegion();
 }
 
 BOOLEAN
@@ -601,6 +610,29 @@ RtlpFreeAtomTable(PRTL_ATOM_TABLE AtomTable)
    ExFreePoolWithTag(AtomTable, TAG_ATMT);
 }
 
+PRTL_ATOM_TABLE_ENTRY *
+RtlpAllocAtomTableBuckets(ULONG Count)
+{
+   PRTL_ATOM_TABLE_ENTRY *Buckets;
+
+   Buckets = ExAllocatePoolWithTag(NonPagedPool,
+                                   Count * sizeof(PRTL_ATOM_TABLE_ENTRY),
+                                   TAG_ATMT);
+   if (Buckets != NULL)
+   {
+      RtlZeroMemory(Buckets,
+                    Count * sizeof(PRTL_ATOM_TABLE_ENTRY));
+   }
+
+   return Buckets;
+}
+
+VOID
+RtlpFreeAtomTableBuckets(PRTL_ATOM_TABLE_ENTRY *Buckets)
+{
+   ExFreePoolWithTag(Buckets, TAG_ATMT);
+}
+
 PRTL_ATOM_TABLE_ENTRY
 RtlpAllocAtomTableEntry(ULONG Size)
 {
@@ -676,7 +708,7 @@ RtlpGetAtomEntry(PRTL_ATOM_TABLE AtomTable, ULONG Index)
 
    /* NOTE: There's no need to explicitly enter a critical region because it's
             guaranteed that we're in a critical region right now (as we hold
-            the atom table lock) */
+            the atom table lock, shared or exclusive) */
 
    ExEntry = ExMapHandleToPointer(AtomTable->ExHandleTable,
                                   (HANDLE)((ULONG_PTR)Index << 2));
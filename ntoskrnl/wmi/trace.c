@@ -0,0 +1,1282 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Kernel logger with per-processor trace buffers
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntoskrnl.h>
+#include <wmistr.h>
+
+#include "wmip.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/*
+ * Every processor logs into its own buffer. An event is reserved with a
+ * single interlocked add on the buffer offset, at DISPATCH_LEVEL or above so
+ * the processor can't change under the writer, and the buffer is pinned by
+ * a reference while the event is filled in. The writer whose reservation
+ * goes past the end of the buffer swaps it for a free one and queues it for
+ * the flush thread, which waits for the references to drop and appends it
+ * to the log file. Events are dropped, and counted, when no free buffer is
+ * left; the flush thread puts buffers back once it has written them.
+ */
+
+#define WMIP_DEFAULT_BUFFER_SIZE    64      /* KB */
+#define WMIP_MINIMUM_BUFFER_SIZE    4
+#define WMIP_MAXIMUM_BUFFER_SIZE    1024
+#define WMIP_MAXIMUM_BUFFERS        1024
+#define WMIP_DEFAULT_FLUSH_TIMER    1       /* Seconds */
+
+/* File names in create events are cut to this many characters */
+#define WMIP_MAXIMUM_FILE_NAME      256
+
+#define WMIP_SUPPORTED_FLAGS        (EVENT_TRACE_FLAG_PROCESS | \
+                                     EVENT_TRACE_FLAG_THREAD | \
+                                     EVENT_TRACE_FLAG_CSWITCH | \
+                                     EVENT_TRACE_FLAG_DISK_IO | \
+                                     EVENT_TRACE_FLAG_DISK_IO_INIT | \
+                                     EVENT_TRACE_FLAG_FILE_IO | \
+                                     EVENT_TRACE_FLAG_MEMORY_PAGE_FAULTS)
+
+typedef struct _WMIP_TRACE_BUFFER
+{
+    SLIST_ENTRY ListEntry;
+    volatile LONG Offset;
+    volatile LONG References;
+    ULONG SavedOffset;
+    ULONG Processor;
+    PWMI_TRACE_BUFFER_HEADER Header;    /* BufferSize bytes */
+} WMIP_TRACE_BUFFER, *PWMIP_TRACE_BUFFER;
+
+typedef struct _WMIP_LOGGER
+{
+    PWMIP_TRACE_BUFFER volatile ProcessorBuffers[MAXIMUM_PROCESSORS];
+    SLIST_HEADER FreeList;
+    SLIST_HEADER FlushList;
+    volatile BOOLEAN Active;
+    volatile BOOLEAN Stopping;
+    volatile LONG FlushRequested;
+    volatile LONG EventsLost;
+    ULONG BufferSize;                   /* Bytes */
+    ULONG ClockType;
+    ULONG EnableFlags;
+    ULONG FlushTimer;
+    ULONG NumberOfBuffers;
+    PWMIP_TRACE_BUFFER *Buffers;
+    HANDLE FileHandle;
+    PETHREAD FlushThread;
+    KEVENT FlushEvent;
+    KDPC FlushDpc;
+    ULONG SequenceNumber;
+    ULONG BuffersWritten;
+    NTSTATUS WriteStatus;
+    WMI_TRACE_FILE_HEADER FileHeader;
+    WCHAR LogFileName[RTL_NUMBER_OF(((PWMI_LOGGER_INFORMATION)NULL)->LogFileName)];
+} WMIP_LOGGER, *PWMIP_LOGGER;
+
+/* GLOBALS *******************************************************************/
+
+volatile ULONG WmipKernelLoggerFlags;
+
+static WMIP_LOGGER WmipKernelLogger;
+static KGUARDED_MUTEX WmipLoggerLock;
+
+/* PRIVATE FUNCTIONS *********************************************************/
+
+static
+LONGLONG
+WmipGetTimeStamp(
+    IN ULONG ClockType)
+{
+    LARGE_INTEGER Time;
+
+    switch (ClockType)
+    {
+        case WMICT_SYSTEMTIME:
+            KeQuerySystemTime(&Time);
+            return Time.QuadPart;
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+        case WMICT_CPUCYCLE:
+            return __rdtsc();
+#endif
+
+        default:
+            return KeQueryPerformanceCounter(NULL).QuadPart;
+    }
+}
+
+static
+VOID
+WmipResetBuffer(
+    IN PWMIP_TRACE_BUFFER Buffer,
+    IN ULONG Processor)
+{
+    Buffer->Offset = sizeof(WMI_TRACE_BUFFER_HEADER);
+    Buffer->SavedOffset = 0;
+    Buffer->Processor = Processor;
+}
+
+/*
+ * Replaces the current buffer of a processor with a free one, or with none,
+ * and queues it for flushing. Returns FALSE if someone else switched it
+ * first, that one flushes it then.
+ */
+static
+BOOLEAN
+WmipSwitchBuffer(
+    IN PWMIP_LOGGER Logger,
+    IN ULONG Processor,
+    IN PWMIP_TRACE_BUFFER Buffer,
+    IN BOOLEAN Replace)
+{
+    PWMIP_TRACE_BUFFER NewBuffer = NULL;
+    PSLIST_ENTRY ListEntry;
+
+    if (Replace)
+    {
+        ListEntry = InterlockedPopEntrySList(&Logger->FreeList);
+        if (ListEntry)
+        {
+            NewBuffer = CONTAINING_RECORD(ListEntry, WMIP_TRACE_BUFFER, ListEntry);
+            WmipResetBuffer(NewBuffer, Processor);
+        }
+    }
+
+    if (InterlockedCompareExchangePointer((PVOID*)&Logger->ProcessorBuffers[Processor],
+                                          NewBuffer,
+                                          Buffer) != Buffer)
+    {
+        if (NewBuffer) InterlockedPushEntrySList(&Logger->FreeList, &NewBuffer->ListEntry);
+        return FALSE;
+    }
+
+    InterlockedPushEntrySList(&Logger->FlushList, &Buffer->ListEntry);
+    KeInsertQueueDpc(&Logger->FlushDpc, NULL, NULL);
+    return TRUE;
+}
+
+/* Must be called at DISPATCH_LEVEL or above, returns with the buffer pinned */
+static
+PWMI_TRACE_EVENT_HEADER
+WmipReserveEvent(
+    IN PWMIP_LOGGER Logger,
+    IN ULONG EventSize,
+    OUT PWMIP_TRACE_BUFFER *OutBuffer)
+{
+    ULONG Processor = KeGetCurrentProcessorNumber();
+    ULONG Size = ALIGN_UP_BY(EventSize, WMI_TRACE_EVENT_ALIGNMENT);
+    PWMIP_TRACE_BUFFER Buffer;
+    ULONG Offset;
+
+    if ((EventSize > MAXUSHORT) ||
+        (Size > Logger->BufferSize - sizeof(WMI_TRACE_BUFFER_HEADER)))
+    {
+        InterlockedIncrement(&Logger->EventsLost);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        Buffer = Logger->ProcessorBuffers[Processor];
+        if (!Buffer) break;
+
+        /* Pin the buffer, then make sure it is still the current one */
+        InterlockedIncrement(&Buffer->References);
+        if (Buffer != Logger->ProcessorBuffers[Processor])
+        {
+            InterlockedDecrement(&Buffer->References);
+            continue;
+        }
+
+        Offset = InterlockedExchangeAdd(&Buffer->Offset, Size);
+        if (Offset + Size <= Logger->BufferSize)
+        {
+            *OutBuffer = Buffer;
+            return (PWMI_TRACE_EVENT_HEADER)((PUCHAR)Buffer->Header + Offset);
+        }
+
+        /*
+         * The buffer is full. The event that went past the end first switches
+         * it and tries again. Anything else drops its event, it may have
+         * interrupted the switch on this processor.
+         */
+        if (Offset <= Logger->BufferSize)
+        {
+            Buffer->SavedOffset = Offset;
+            WmipSwitchBuffer(Logger, Processor, Buffer, TRUE);
+            InterlockedDecrement(&Buffer->References);
+            continue;
+        }
+
+        InterlockedDecrement(&Buffer->References);
+        break;
+    }
+
+    InterlockedIncrement(&Logger->EventsLost);
+    return NULL;
+}
+
+static
+VOID
+WmipLogEvent(
+    IN UCHAR Group,
+    IN UCHAR Type,
+    IN PVOID Data,
+    IN ULONG DataSize)
+{
+    PWMIP_LOGGER Logger = &WmipKernelLogger;
+    PWMI_TRACE_EVENT_HEADER Event;
+    PWMIP_TRACE_BUFFER Buffer;
+    KIRQL OldIrql;
+
+    OldIrql = KeGetCurrentIrql();
+    if (OldIrql < DISPATCH_LEVEL) KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    Event = WmipReserveEvent(Logger, sizeof(WMI_TRACE_EVENT_HEADER) + DataSize, &Buffer);
+    if (Event)
+    {
+        Event->Size = (USHORT)(sizeof(WMI_TRACE_EVENT_HEADER) + DataSize);
+        Event->Group = Group;
+        Event->Type = Type;
+        Event->ThreadId = HandleToUlong(PsGetCurrentThreadId());
+        Event->ProcessId = HandleToUlong(PsGetCurrentProcessId());
+        Event->Reserved = 0;
+        Event->TimeStamp.QuadPart = WmipGetTimeStamp(Logger->ClockType);
+        RtlCopyMemory(Event + 1, Data, DataSize);
+
+        InterlockedDecrement(&Buffer->References);
+    }
+
+    if (OldIrql < DISPATCH_LEVEL) KeLowerIrql(OldIrql);
+}
+
+static KDEFERRED_ROUTINE WmipFlushDpc;
+static
+VOID
+NTAPI
+WmipFlushDpc(
+    IN PKDPC Dpc,
+    IN PVOID DeferredContext,
+    IN PVOID SystemArgument1,
+    IN PVOID SystemArgument2)
+{
+    PWMIP_LOGGER Logger = DeferredContext;
+
+    /* Buffers are switched at any IRQL, this is where waking the flush thread is safe */
+    KeSetEvent(&Logger->FlushEvent, IO_NO_INCREMENT, FALSE);
+}
+
+/* Writers run at DISPATCH_LEVEL, once this thread ran on every processor they are done */
+static
+VOID
+WmipWaitForWriters(VOID)
+{
+    ULONG i;
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        KeSetSystemAffinityThread(AFFINITY_MASK(i));
+
+    KeRevertToUserAffinityThread();
+}
+
+static
+VOID
+WmipSwitchAllBuffers(
+    IN PWMIP_LOGGER Logger,
+    IN BOOLEAN Replace)
+{
+    PWMIP_TRACE_BUFFER Buffer;
+    ULONG i;
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        for (;;)
+        {
+            Buffer = Logger->ProcessorBuffers[i];
+            if (!Buffer) break;
+
+            /* Don't write out empty buffers for the timer */
+            if (Replace && ((ULONG)Buffer->Offset == sizeof(WMI_TRACE_BUFFER_HEADER))) break;
+
+            if (WmipSwitchBuffer(Logger, i, Buffer, Replace)) break;
+        }
+    }
+}
+
+/* Gives a written buffer to a processor that ran out of them, or back to the free list */
+static
+VOID
+WmipReleaseBuffer(
+    IN PWMIP_LOGGER Logger,
+    IN PWMIP_TRACE_BUFFER Buffer)
+{
+    ULONG i;
+
+    if (!Logger->Stopping)
+    {
+        for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        {
+            if (Logger->ProcessorBuffers[i]) continue;
+
+            WmipResetBuffer(Buffer, i);
+            if (!InterlockedCompareExchangePointer((PVOID*)&Logger->ProcessorBuffers[i],
+                                                   Buffer,
+                                                   NULL))
+            {
+                return;
+            }
+        }
+    }
+
+    InterlockedPushEntrySList(&Logger->FreeList, &Buffer->ListEntry);
+}
+
+static
+VOID
+WmipWriteBuffer(
+    IN PWMIP_LOGGER Logger,
+    IN PWMIP_TRACE_BUFFER Buffer)
+{
+    PWMI_TRACE_BUFFER_HEADER Header = Buffer->Header;
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER FileOffset;
+    ULONG Used;
+    NTSTATUS Status;
+
+    /* Wait for the events that are still being filled in */
+    while (Buffer->References) YieldProcessor();
+
+    /* Only a reservation that went past the end leaves the offset there */
+    Used = Buffer->SavedOffset ? Buffer->SavedOffset : (ULONG)Buffer->Offset;
+    ASSERT(Used <= Logger->BufferSize);
+
+    Header->SavedOffset = Used;
+    Header->SequenceNumber = Logger->SequenceNumber;
+    Header->Processor = Buffer->Processor;
+    Header->Reserved = 0;
+    Header->TimeStamp.QuadPart = WmipGetTimeStamp(Logger->ClockType);
+    RtlZeroMemory((PUCHAR)Header + Used, Logger->BufferSize - Used);
+
+    /* Stop writing after the first failure, the file would have a hole */
+    if (NT_SUCCESS(Logger->WriteStatus))
+    {
+        FileOffset.QuadPart = (LONGLONG)(Logger->SequenceNumber + 1) * Logger->BufferSize;
+        Status = ZwWriteFile(Logger->FileHandle,
+                             NULL,
+                             NULL,
+                             NULL,
+                             &IoStatusBlock,
+                             Header,
+                             Logger->BufferSize,
+                             &FileOffset,
+                             NULL);
+        if (NT_SUCCESS(Status))
+        {
+            Logger->SequenceNumber++;
+            Logger->BuffersWritten++;
+        }
+        else
+        {
+            DPRINT1("Writing trace buffer failed: 0x%lx\n", Status);
+            Logger->WriteStatus = Status;
+        }
+    }
+}
+
+static
+VOID
+WmipFlushBuffers(
+    IN PWMIP_LOGGER Logger)
+{
+    PSLIST_ENTRY ListEntry, Next, Ordered = NULL;
+    PWMIP_TRACE_BUFFER Buffer;
+
+    /* The list is last in first out, write the buffers in the order they filled up */
+    ListEntry = InterlockedFlushSList(&Logger->FlushList);
+    while (ListEntry)
+    {
+        Next = ListEntry->Next;
+        ListEntry->Next = Ordered;
+        Ordered = ListEntry;
+        ListEntry = Next;
+    }
+
+    while (Ordered)
+    {
+        Buffer = CONTAINING_RECORD(Ordered, WMIP_TRACE_BUFFER, ListEntry);
+        Ordered = Ordered->Next;
+
+        WmipWriteBuffer(Logger, Buffer);
+        WmipReleaseBuffer(Logger, Buffer);
+    }
+}
+
+static
+NTSTATUS
+WmipWriteFileHeader(
+    IN PWMIP_LOGGER Logger,
+    IN PVOID Block,
+    IN ULONG Length)
+{
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER FileOffset;
+
+    FileOffset.QuadPart = 0;
+    return ZwWriteFile(Logger->FileHandle,
+                       NULL,
+                       NULL,
+                       NULL,
+                       &IoStatusBlock,
+                       Block,
+                       Length,
+                       &FileOffset,
+                       NULL);
+}
+
+static KSTART_ROUTINE WmipFlushThread;
+static
+VOID
+NTAPI
+WmipFlushThread(
+    IN PVOID Context)
+{
+    PWMIP_LOGGER Logger = Context;
+    LARGE_INTEGER Timeout;
+    NTSTATUS Status;
+    BOOLEAN Stopping;
+
+    /* Keep up with the writers, events get lost when we don't */
+    KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
+
+    Timeout.QuadPart = -(LONGLONG)Logger->FlushTimer * 10 * 1000 * 1000;
+    do
+    {
+        Status = KeWaitForSingleObject(&Logger->FlushEvent,
+                                       Executive,
+                                       KernelMode,
+                                       FALSE,
+                                       &Timeout);
+        Stopping = Logger->Stopping;
+
+        if (Stopping)
+        {
+            /* Take the buffers away from the processors, and wait for the last writers */
+            WmipSwitchAllBuffers(Logger, FALSE);
+            WmipWaitForWriters();
+        }
+        else if ((Status == STATUS_TIMEOUT) || InterlockedExchange(&Logger->FlushRequested, 0))
+        {
+            /* Write out what was logged so far */
+            WmipSwitchAllBuffers(Logger, TRUE);
+        }
+
+        WmipFlushBuffers(Logger);
+    } while (!Stopping);
+
+    /* The header now has the final counts */
+    KeQuerySystemTime(&Logger->FileHeader.EndTime);
+    Logger->FileHeader.EndTimeStamp.QuadPart = WmipGetTimeStamp(Logger->ClockType);
+    Logger->FileHeader.BuffersWritten = Logger->BuffersWritten;
+    Logger->FileHeader.EventsLost = Logger->EventsLost;
+    if (NT_SUCCESS(Logger->WriteStatus))
+        WmipWriteFileHeader(Logger, &Logger->FileHeader, sizeof(Logger->FileHeader));
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+VOID
+WmipFreeBuffers(
+    IN PWMIP_LOGGER Logger)
+{
+    ULONG i;
+
+    for (i = 0; i < Logger->NumberOfBuffers; i++)
+    {
+        if (!Logger->Buffers[i]) break;
+        if (Logger->Buffers[i]->Header)
+            ExFreePoolWithTag(Logger->Buffers[i]->Header, TAG_WMI_TRACE);
+        ExFreePoolWithTag(Logger->Buffers[i], TAG_WMI_TRACE);
+    }
+
+    ExFreePoolWithTag(Logger->Buffers, TAG_WMI_TRACE);
+    Logger->Buffers = NULL;
+}
+
+static
+NTSTATUS
+WmipAllocateBuffers(
+    IN PWMIP_LOGGER Logger)
+{
+    PWMIP_TRACE_BUFFER Buffer;
+    ULONG i;
+
+    Logger->Buffers = ExAllocatePoolWithTag(PagedPool,
+                                            Logger->NumberOfBuffers * sizeof(PWMIP_TRACE_BUFFER),
+                                            TAG_WMI_TRACE);
+    if (!Logger->Buffers) return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(Logger->Buffers, Logger->NumberOfBuffers * sizeof(PWMIP_TRACE_BUFFER));
+
+    for (i = 0; i < Logger->NumberOfBuffers; i++)
+    {
+        Buffer = ExAllocatePoolWithTag(NonPagedPool, sizeof(WMIP_TRACE_BUFFER), TAG_WMI_TRACE);
+        if (!Buffer) break;
+
+        RtlZeroMemory(Buffer, sizeof(WMIP_TRACE_BUFFER));
+        Logger->Buffers[i] = Buffer;
+
+        Buffer->Header = ExAllocatePoolWithTag(NonPagedPool, Logger->BufferSize, TAG_WMI_TRACE);
+        if (!Buffer->Header) break;
+    }
+
+    if (i != Logger->NumberOfBuffers)
+    {
+        WmipFreeBuffers(Logger);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS
+WmipOpenLogFile(
+    IN PWMIP_LOGGER Logger)
+{
+    UNICODE_STRING FileName;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+
+    RtlInitUnicodeString(&FileName, Logger->LogFileName);
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &FileName,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+
+    /* The name may come from user mode, don't let it overwrite what the caller can't */
+    return IoCreateFile(&Logger->FileHandle,
+                        FILE_GENERIC_WRITE,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        NULL,
+                        FILE_ATTRIBUTE_NORMAL,
+                        FILE_SHARE_READ,
+                        FILE_SUPERSEDE,
+                        FILE_SYNCHRONOUS_IO_NONALERT |
+                        FILE_NON_DIRECTORY_FILE |
+                        FILE_SEQUENTIAL_ONLY,
+                        NULL,
+                        0,
+                        CreateFileTypeNone,
+                        NULL,
+                        IO_FORCE_ACCESS_CHECK);
+}
+
+/* Logs the processes and threads which already run, so that the consumer knows them */
+static
+VOID
+WmipRundownProcesses(
+    IN ULONG Flags)
+{
+    PEPROCESS Process;
+    PETHREAD Thread;
+
+    for (Process = PsGetNextProcess(NULL); Process; Process = PsGetNextProcess(Process))
+    {
+        if (Flags & EVENT_TRACE_FLAG_PROCESS)
+            WmipTraceProcess(Process, EVENT_TRACE_TYPE_DC_START);
+
+        if (Flags & EVENT_TRACE_FLAG_THREAD)
+        {
+            for (Thread = PsGetNextProcessThread(Process, NULL);
+                 Thread;
+                 Thread = PsGetNextProcessThread(Process, Thread))
+            {
+                WmipTraceThread(Thread, NULL, EVENT_TRACE_TYPE_DC_START);
+            }
+        }
+    }
+}
+
+static
+NTSTATUS
+WmipStartKernelLogger(
+    IN PWMIP_LOGGER Logger,
+    IN PWMI_LOGGER_INFORMATION LoggerInfo)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    LARGE_INTEGER Frequency;
+    HANDLE ThreadHandle;
+    PVOID Block;
+    ULONG Processors, i;
+    NTSTATUS Status;
+
+    Processors = KeNumberProcessors;
+
+    /* The name has to be terminated */
+    if (wcsnlen(LoggerInfo->LogFileName, RTL_NUMBER_OF(LoggerInfo->LogFileName)) ==
+        RTL_NUMBER_OF(LoggerInfo->LogFileName))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    switch (LoggerInfo->ClockType)
+    {
+        case WMICT_DEFAULT:
+        case WMICT_PERFCOUNTER:
+            Logger->ClockType = WMICT_PERFCOUNTER;
+            break;
+
+        case WMICT_SYSTEMTIME:
+#if defined(_M_IX86) || defined(_M_AMD64)
+        case WMICT_CPUCYCLE:
+#endif
+            Logger->ClockType = LoggerInfo->ClockType;
+            break;
+
+        default:
+            return STATUS_NOT_SUPPORTED;
+    }
+
+    Logger->BufferSize = LoggerInfo->BufferSize ? LoggerInfo->BufferSize : WMIP_DEFAULT_BUFFER_SIZE;
+    Logger->BufferSize = max(Logger->BufferSize, WMIP_MINIMUM_BUFFER_SIZE);
+    Logger->BufferSize = min(Logger->BufferSize, WMIP_MAXIMUM_BUFFER_SIZE) * 1024;
+
+    /* One for every processor, and some for the ones being written out */
+    Logger->NumberOfBuffers = LoggerInfo->NumberOfBuffers ? LoggerInfo->NumberOfBuffers : 2 * Processors + 2;
+    Logger->NumberOfBuffers = max(Logger->NumberOfBuffers, Processors + 2);
+    Logger->NumberOfBuffers = min(Logger->NumberOfBuffers, WMIP_MAXIMUM_BUFFERS);
+
+    Logger->FlushTimer = LoggerInfo->FlushTimer ? LoggerInfo->FlushTimer : WMIP_DEFAULT_FLUSH_TIMER;
+    Logger->EnableFlags = LoggerInfo->EnableFlags & WMIP_SUPPORTED_FLAGS;
+
+    InitializeSListHead(&Logger->FreeList);
+    InitializeSListHead(&Logger->FlushList);
+    KeClearEvent(&Logger->FlushEvent);
+    Logger->Stopping = FALSE;
+    Logger->FlushRequested = 0;
+    Logger->EventsLost = 0;
+    Logger->SequenceNumber = 0;
+    Logger->BuffersWritten = 0;
+    Logger->WriteStatus = STATUS_SUCCESS;
+    RtlCopyMemory(Logger->LogFileName, LoggerInfo->LogFileName, sizeof(Logger->LogFileName));
+
+    Status = WmipAllocateBuffers(Logger);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    Status = WmipOpenLogFile(Logger);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Could not create the log file %S: 0x%lx\n", Logger->LogFileName, Status);
+        WmipFreeBuffers(Logger);
+        return Status;
+    }
+
+    /* The header has a block of its own, so that buffers stay aligned in the file */
+    RtlZeroMemory(&Logger->FileHeader, sizeof(Logger->FileHeader));
+    Logger->FileHeader.Signature = WMI_TRACE_FILE_SIGNATURE;
+    Logger->FileHeader.Version = WMI_TRACE_FILE_VERSION;
+    Logger->FileHeader.HeaderSize = sizeof(WMI_TRACE_FILE_HEADER);
+    Logger->FileHeader.BufferSize = Logger->BufferSize;
+    Logger->FileHeader.NumberOfProcessors = Processors;
+    Logger->FileHeader.EnableFlags = Logger->EnableFlags;
+    Logger->FileHeader.ClockType = Logger->ClockType;
+    KeQueryPerformanceCounter(&Frequency);
+    Logger->FileHeader.PerfFrequency = Frequency;
+    KeQuerySystemTime(&Logger->FileHeader.StartTime);
+    Logger->FileHeader.StartTimeStamp.QuadPart = WmipGetTimeStamp(Logger->ClockType);
+
+    Block = Logger->Buffers[0]->Header;
+    RtlZeroMemory(Block, Logger->BufferSize);
+    RtlCopyMemory(Block, &Logger->FileHeader, sizeof(Logger->FileHeader));
+    Status = WmipWriteFileHeader(Logger, Block, Logger->BufferSize);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Could not write the log file header: 0x%lx\n", Status);
+        ZwClose(Logger->FileHandle);
+        WmipFreeBuffers(Logger);
+        return Status;
+    }
+
+    /* Give every processor a buffer, the others are free */
+    for (i = 0; i < Logger->NumberOfBuffers; i++)
+    {
+        if (i < Processors)
+        {
+            WmipResetBuffer(Logger->Buffers[i], i);
+            Logger->ProcessorBuffers[i] = Logger->Buffers[i];
+        }
+        else
+        {
+            InterlockedPushEntrySList(&Logger->FreeList, &Logger->Buffers[i]->ListEntry);
+        }
+    }
+
+    InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    Status = PsCreateSystemThread(&ThreadHandle,
+                                  THREAD_ALL_ACCESS,
+                                  &ObjectAttributes,
+                                  NULL,
+                                  NULL,
+                                  WmipFlushThread,
+                                  Logger);
+    if (NT_SUCCESS(Status))
+    {
+        Status = ObReferenceObjectByHandle(ThreadHandle,
+                                           SYNCHRONIZE,
+                                           PsThreadType,
+                                           KernelMode,
+                                           (PVOID*)&Logger->FlushThread,
+                                           NULL);
+        ZwClose(ThreadHandle);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        /* Nothing logged yet, the thread never ran or is gone */
+        for (i = 0; i < Processors; i++) Logger->ProcessorBuffers[i] = NULL;
+        ZwClose(Logger->FileHandle);
+        WmipFreeBuffers(Logger);
+        return Status;
+    }
+
+    Logger->Active = TRUE;
+    WmipKernelLoggerFlags = Logger->EnableFlags;
+    WmipRundownProcesses(Logger->EnableFlags);
+
+    DPRINT1("Kernel logger started, flags 0x%lx, %lu buffers of %lu KB, %S\n",
+            Logger->EnableFlags, Logger->NumberOfBuffers, Logger->BufferSize / 1024, Logger->LogFileName);
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+WmipStopKernelLogger(
+    IN PWMIP_LOGGER Logger)
+{
+    /* No new events, then let the flush thread write out the rest */
+    WmipKernelLoggerFlags = 0;
+    Logger->Stopping = TRUE;
+    KeSetEvent(&Logger->FlushEvent, IO_NO_INCREMENT, FALSE);
+
+    KeWaitForSingleObject(Logger->FlushThread, Executive, KernelMode, FALSE, NULL);
+    ObDereferenceObject(Logger->FlushThread);
+    Logger->FlushThread = NULL;
+
+    ZwClose(Logger->FileHandle);
+    Logger->FileHandle = NULL;
+
+    WmipFreeBuffers(Logger);
+    Logger->Active = FALSE;
+
+    DPRINT1("Kernel logger stopped, %lu buffers written, %ld events lost\n",
+            Logger->BuffersWritten, Logger->EventsLost);
+}
+
+static
+VOID
+WmipQueryKernelLogger(
+    IN PWMIP_LOGGER Logger,
+    OUT PWMI_LOGGER_INFORMATION LoggerInfo)
+{
+    LoggerInfo->Size = sizeof(WMI_LOGGER_INFORMATION);
+    LoggerInfo->EnableFlags = Logger->EnableFlags;
+    LoggerInfo->ClockType = Logger->ClockType;
+    LoggerInfo->BufferSize = Logger->BufferSize / 1024;
+    LoggerInfo->NumberOfBuffers = Logger->NumberOfBuffers;
+    LoggerInfo->FlushTimer = Logger->FlushTimer;
+    LoggerInfo->BuffersWritten = Logger->BuffersWritten;
+    LoggerInfo->EventsLost = Logger->EventsLost;
+    LoggerInfo->WriteStatus = Logger->WriteStatus;
+    LoggerInfo->Reserved = 0;
+    RtlCopyMemory(LoggerInfo->LogFileName, Logger->LogFileName, sizeof(LoggerInfo->LogFileName));
+}
+
+VOID
+NTAPI
+WmipInitializeKernelLogger(VOID)
+{
+    KeInitializeGuardedMutex(&WmipLoggerLock);
+
+    /* Once for good, a DPC may still be queued when the logger is restarted */
+    KeInitializeEvent(&WmipKernelLogger.FlushEvent, SynchronizationEvent, FALSE);
+    KeInitializeDpc(&WmipKernelLogger.FlushDpc, WmipFlushDpc, &WmipKernelLogger);
+}
+
+/* Called from NtTraceEvent and the trace event IOCTL */
+NTSTATUS
+NTAPI
+WmipTraceUserEvent(
+    IN PEVENT_TRACE_HEADER TraceHeader,
+    IN KPROCESSOR_MODE PreviousMode)
+{
+    EVENT_TRACE_HEADER Header;
+    MOF_FIELD MofFields[MAX_MOF_FIELDS];
+    PWMI_TRACE_USER_EVENT Event = NULL;
+    ULONG MofCount = 0, DataSize, i;
+    PUCHAR Data;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PAGED_CODE();
+
+    if (!WmipKernelLogger.Active) return STATUS_INVALID_HANDLE;
+
+    _SEH2_TRY
+    {
+        if (PreviousMode != KernelMode)
+            ProbeForRead(TraceHeader, sizeof(EVENT_TRACE_HEADER), sizeof(ULONG));
+        Header = *TraceHeader;
+
+        if (Header.Size < sizeof(EVENT_TRACE_HEADER))
+            _SEH2_YIELD(return STATUS_INVALID_PARAMETER);
+
+        /* The data either follows the header or is described by MOF fields that do */
+        DataSize = Header.Size - sizeof(EVENT_TRACE_HEADER);
+        if (Header.Flags & WNODE_FLAG_USE_MOF_PTR)
+        {
+            MofCount = DataSize / sizeof(MOF_FIELD);
+            if (MofCount > MAX_MOF_FIELDS)
+                _SEH2_YIELD(return STATUS_INVALID_PARAMETER);
+
+            if (PreviousMode != KernelMode)
+                ProbeForRead(TraceHeader + 1, MofCount * sizeof(MOF_FIELD), sizeof(ULONG));
+            RtlCopyMemory(MofFields, TraceHeader + 1, MofCount * sizeof(MOF_FIELD));
+
+            DataSize = 0;
+            for (i = 0; i < MofCount; i++)
+            {
+                if (MofFields[i].Length > MAXUSHORT - DataSize)
+                    _SEH2_YIELD(return STATUS_BUFFER_OVERFLOW);
+                DataSize += MofFields[i].Length;
+            }
+        }
+        else if (PreviousMode != KernelMode)
+        {
+            ProbeForRead(TraceHeader, Header.Size, sizeof(ULONG));
+        }
+
+        Event = ExAllocatePoolWithTag(NonPagedPool, sizeof(WMI_TRACE_USER_EVENT) + DataSize, TAG_WMI_TRACE);
+        if (!Event)
+            _SEH2_YIELD(return STATUS_INSUFFICIENT_RESOURCES);
+
+        if (Header.Flags & WNODE_FLAG_USE_GUID_PTR)
+        {
+            if (PreviousMode != KernelMode)
+                ProbeForRead((PVOID)(ULONG_PTR)Header.GuidPtr, sizeof(GUID), sizeof(ULONG));
+            Event->Guid = *(LPGUID)(ULONG_PTR)Header.GuidPtr;
+        }
+        else
+        {
+            Event->Guid = Header.Guid;
+        }
+        Event->Type = Header.Class.Type;
+        Event->Level = Header.Class.Level;
+        Event->Version = Header.Class.Version;
+        Event->Reserved = 0;
+
+        Data = (PUCHAR)(Event + 1);
+        if (Header.Flags & WNODE_FLAG_USE_MOF_PTR)
+        {
+            for (i = 0; i < MofCount; i++)
+            {
+                if (PreviousMode != KernelMode)
+                    ProbeForRead((PVOID)(ULONG_PTR)MofFields[i].DataPtr, MofFields[i].Length, sizeof(UCHAR));
+                RtlCopyMemory(Data, (PVOID)(ULONG_PTR)MofFields[i].DataPtr, MofFields[i].Length);
+                Data += MofFields[i].Length;
+            }
+        }
+        else
+        {
+            RtlCopyMemory(Data, TraceHeader + 1, DataSize);
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    if (NT_SUCCESS(Status))
+        WmipLogEvent(WMI_TRACE_GROUP_USER, Header.Class.Type, Event, sizeof(WMI_TRACE_USER_EVENT) + DataSize);
+
+    if (Event) ExFreePoolWithTag(Event, TAG_WMI_TRACE);
+    return Status;
+}
+
+/* KERNEL HOOKS **************************************************************/
+
+VOID
+NTAPI
+WmipTraceProcess(
+    IN PEPROCESS Process,
+    IN UCHAR Type)
+{
+    WMI_TRACE_PROCESS Event;
+
+    Event.ProcessId = HandleToUlong(Process->UniqueProcessId);
+    Event.ParentId = HandleToUlong(Process->InheritedFromUniqueProcessId);
+    Event.SessionId = MmGetSessionId(Process);
+    Event.ExitStatus = (Type == EVENT_TRACE_TYPE_END) ? Process->ExitStatus : STATUS_SUCCESS;
+    RtlCopyMemory(Event.ImageFileName, Process->ImageFileName, sizeof(Event.ImageFileName));
+
+    WmipLogEvent(WMI_TRACE_GROUP_PROCESS, Type, &Event, sizeof(Event));
+}
+
+VOID
+NTAPI
+WmipTraceThread(
+    IN PETHREAD Thread,
+    IN PINITIAL_TEB InitialTeb OPTIONAL,
+    IN UCHAR Type)
+{
+    WMI_TRACE_THREAD Event;
+
+    Event.ThreadId = HandleToUlong(Thread->Cid.UniqueThread);
+    Event.ProcessId = HandleToUlong(Thread->Cid.UniqueProcess);
+    Event.StackBase = InitialTeb ? (ULONG_PTR)InitialTeb->StackBase : 0;
+    Event.StackLimit = InitialTeb ? (ULONG_PTR)InitialTeb->StackLimit : 0;
+    Event.StartAddress = (ULONG_PTR)(Thread->Win32StartAddress ? Thread->Win32StartAddress : Thread->StartAddress);
+
+    WmipLogEvent(WMI_TRACE_GROUP_THREAD, Type, &Event, sizeof(Event));
+}
+
+VOID
+FASTCALL
+WmipTraceContextSwitch(
+    IN PKTHREAD OldThread,
+    IN PKTHREAD NewThread)
+{
+    WMI_TRACE_CONTEXT_SWITCH Event;
+
+    Event.OldThreadId = HandleToUlong(CONTAINING_RECORD(OldThread, ETHREAD, Tcb)->Cid.UniqueThread);
+    Event.NewThreadId = HandleToUlong(CONTAINING_RECORD(NewThread, ETHREAD, Tcb)->Cid.UniqueThread);
+    Event.OldThreadPriority = OldThread->Priority;
+    Event.NewThreadPriority = NewThread->Priority;
+    Event.OldThreadState = OldThread->State;
+    Event.OldThreadWaitReason = (OldThread->State == Waiting) ? OldThread->WaitReason : 0;
+    Event.Reserved = 0;
+
+    WmipLogEvent(WMI_TRACE_GROUP_CONTEXT_SWITCH, WMI_TRACE_TYPE_CONTEXT_SWITCH, &Event, sizeof(Event));
+}
+
+VOID
+NTAPI
+WmipTracePageFault(
+    IN ULONG FaultCode,
+    IN PVOID Address,
+    IN PVOID TrapInformation OPTIONAL)
+{
+    WMI_TRACE_PAGE_FAULT Event;
+
+    Event.VirtualAddress = (ULONG_PTR)Address;
+    Event.ProgramCounter = TrapInformation ? KeGetTrapFramePc((PKTRAP_FRAME)TrapInformation) : 0;
+    Event.FaultCode = FaultCode;
+    Event.Reserved = 0;
+
+    WmipLogEvent(WMI_TRACE_GROUP_PAGE_FAULT, WMI_TRACE_TYPE_PAGE_FAULT, &Event, sizeof(Event));
+}
+
+/*
+ * A read or write is logged at the topmost disk device it goes through, a
+ * partition sits on top of its disk and both are FILE_DEVICE_DISK.
+ */
+static
+BOOLEAN
+WmipIsDiskIoLocation(
+    IN PIRP Irp,
+    IN PIO_STACK_LOCATION StackPtr)
+{
+    PIO_STACK_LOCATION Upper = StackPtr + 1;
+
+    if (!(StackPtr->DeviceObject) ||
+        (StackPtr->DeviceObject->DeviceType != FILE_DEVICE_DISK) ||
+        ((StackPtr->MajorFunction != IRP_MJ_READ) && (StackPtr->MajorFunction != IRP_MJ_WRITE)))
+    {
+        return FALSE;
+    }
+
+    return (Upper == (PIO_STACK_LOCATION)(Irp + 1) + Irp->StackCount) ||
+           !(Upper->DeviceObject) ||
+           (Upper->DeviceObject->DeviceType != FILE_DEVICE_DISK);
+}
+
+VOID
+FASTCALL
+WmipTraceDiskIo(
+    IN PIRP Irp,
+    IN BOOLEAN Completion)
+{
+    PIO_STACK_LOCATION StackPtr, End;
+    WMI_TRACE_DISK_IO Event;
+    UCHAR Type;
+
+    /* Nothing was sent down if it is completed right away */
+    if (Irp->CurrentLocation > Irp->StackCount) return;
+
+    StackPtr = IoGetCurrentIrpStackLocation(Irp);
+    if (Completion)
+    {
+        /* Find where it was logged on the way down */
+        End = (PIO_STACK_LOCATION)(Irp + 1) + Irp->StackCount;
+        while ((StackPtr < End) && !WmipIsDiskIoLocation(Irp, StackPtr)) StackPtr++;
+        if (StackPtr == End) return;
+    }
+    else if (!WmipIsDiskIoLocation(Irp, StackPtr))
+    {
+        return;
+    }
+
+    Event.Irp = (ULONG_PTR)Irp;
+    Event.DeviceObject = (ULONG_PTR)StackPtr->DeviceObject;
+    Event.ByteOffset = StackPtr->Parameters.Read.ByteOffset.QuadPart;
+    Event.IrpFlags = Irp->Flags;
+    Event.Reserved = 0;
+    if (Completion)
+    {
+        Event.TransferSize = (ULONG)Irp->IoStatus.Information;
+        Event.Status = Irp->IoStatus.Status;
+        Type = (StackPtr->MajorFunction == IRP_MJ_READ) ? WMI_TRACE_TYPE_READ : WMI_TRACE_TYPE_WRITE;
+    }
+    else
+    {
+        Event.TransferSize = StackPtr->Parameters.Read.Length;
+        Event.Status = STATUS_PENDING;
+        Type = (StackPtr->MajorFunction == IRP_MJ_READ) ? WMI_TRACE_TYPE_READ_INIT : WMI_TRACE_TYPE_WRITE_INIT;
+    }
+
+    WmipLogEvent(WMI_TRACE_GROUP_DISK_IO, Type, &Event, sizeof(Event));
+}
+
+VOID
+NTAPI
+WmipTraceFileIo(
+    IN UCHAR Type,
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER ByteOffset,
+    IN ULONG Length)
+{
+    WMI_TRACE_FILE_IO Event;
+
+    Event.FileObject = (ULONG_PTR)FileObject;
+    Event.ByteOffset = ByteOffset->QuadPart;
+    Event.Length = Length;
+    Event.Reserved = 0;
+
+    WmipLogEvent(WMI_TRACE_GROUP_FILE_IO, Type, &Event, sizeof(Event));
+}
+
+VOID
+NTAPI
+WmipTraceFileCreate(
+    IN PFILE_OBJECT FileObject)
+{
+    union
+    {
+        WMI_TRACE_FILE_CREATE Event;
+        UCHAR Buffer[FIELD_OFFSET(WMI_TRACE_FILE_CREATE, FileName) + WMIP_MAXIMUM_FILE_NAME * sizeof(WCHAR)];
+    } Data;
+    ULONG Length;
+    PAGED_CODE();
+
+    /* The name is in paged pool, copy it while we still may touch it */
+    Length = min(FileObject->FileName.Length, WMIP_MAXIMUM_FILE_NAME * sizeof(WCHAR));
+    Data.Event.FileObject = (ULONG_PTR)FileObject;
+    RtlCopyMemory(Data.Event.FileName, FileObject->FileName.Buffer, Length);
+
+    WmipLogEvent(WMI_TRACE_GROUP_FILE_IO,
+                 WMI_TRACE_TYPE_FILE_CREATE,
+                 &Data,
+                 FIELD_OFFSET(WMI_TRACE_FILE_CREATE, FileName) + Length);
+}
+
+/* PUBLIC FUNCTIONS **********************************************************/
+
+/*
+ * @implemented
+ */
+LONG64
+FASTCALL
+WmiGetClock(IN WMI_CLOCK_TYPE ClockType,
+            IN PVOID Context)
+{
+    /* The default is the clock of the kernel logger */
+    if (ClockType == WMICT_DEFAULT)
+        ClockType = WmipKernelLogger.Active ? WmipKernelLogger.ClockType : WMICT_PERFCOUNTER;
+
+    return WmipGetTimeStamp(ClockType);
+}
+
+/*
+ * @implemented
+ *
+ * Only the kernel logger is supported, it writes a WMI_TRACE_FILE_HEADER
+ * formatted log, not an ETL file.
+ */
+NTSTATUS
+NTAPI
+WmiStartTrace(IN OUT PWMI_LOGGER_INFORMATION LoggerInfo)
+{
+    NTSTATUS Status;
+    PAGED_CODE();
+
+    if (LoggerInfo->Size != sizeof(WMI_LOGGER_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    KeAcquireGuardedMutex(&WmipLoggerLock);
+
+    if (WmipKernelLogger.Active)
+    {
+        Status = STATUS_OBJECT_NAME_COLLISION;
+    }
+    else
+    {
+        Status = WmipStartKernelLogger(&WmipKernelLogger, LoggerInfo);
+        if (NT_SUCCESS(Status)) WmipQueryKernelLogger(&WmipKernelLogger, LoggerInfo);
+    }
+
+    KeReleaseGuardedMutex(&WmipLoggerLock);
+    return Status;
+}
+
+/*
+ * @implemented
+ */
+NTSTATUS
+NTAPI
+WmiStopTrace(IN PWMI_LOGGER_INFORMATION LoggerInfo)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PAGED_CODE();
+
+    if (LoggerInfo->Size != sizeof(WMI_LOGGER_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    KeAcquireGuardedMutex(&WmipLoggerLock);
+
+    if (!WmipKernelLogger.Active)
+    {
+        Status = STATUS_WMI_INSTANCE_NOT_FOUND;
+    }
+    else
+    {
+        WmipStopKernelLogger(&WmipKernelLogger);
+        WmipQueryKernelLogger(&WmipKernelLogger, LoggerInfo);
+    }
+
+    KeReleaseGuardedMutex(&WmipLoggerLock);
+    return Status;
+}
+
+/*
+ * @implemented
+ */
+NTSTATUS
+NTAPI
+WmiQueryTrace(IN OUT PWMI_LOGGER_INFORMATION LoggerInfo)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PAGED_CODE();
+
+    if (LoggerInfo->Size != sizeof(WMI_LOGGER_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    KeAcquireGuardedMutex(&WmipLoggerLock);
+
+    if (!WmipKernelLogger.Active)
+        Status = STATUS_WMI_INSTANCE_NOT_FOUND;
+    else
+        WmipQueryKernelLogger(&WmipKernelLogger, LoggerInfo);
+
+    KeReleaseGuardedMutex(&WmipLoggerLock);
+    return Status;
+}
+
+/*
+ * @implemented
+ *
+ * Only the enable flags can be changed while the logger runs.
+ */
+NTSTATUS
+NTAPI
+WmiUpdateTrace(IN OUT PWMI_LOGGER_INFORMATION LoggerInfo)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PAGED_CODE();
+
+    if (LoggerInfo->Size != sizeof(WMI_LOGGER_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    KeAcquireGuardedMutex(&WmipLoggerLock);
+
+    if (!WmipKernelLogger.Active)
+    {
+        Status = STATUS_WMI_INSTANCE_NOT_FOUND;
+    }
+    else
+    {
+        WmipKernelLogger.EnableFlags = LoggerInfo->EnableFlags & WMIP_SUPPORTED_FLAGS;
+        WmipKernelLogger.FileHeader.EnableFlags |= WmipKernelLogger.EnableFlags;
+        WmipKernelLoggerFlags = WmipKernelLogger.EnableFlags;
+        WmipQueryKernelLogger(&WmipKernelLogger, LoggerInfo);
+    }
+
+    KeReleaseGuardedMutex(&WmipLoggerLock);
+    return Status;
+}
+
+/*
+ * @implemented
+ *
+ * Queues the buffers the processors are filling for writing, the data ends up
+ * in the file shortly after.
+ */
+NTSTATUS
+NTAPI
+WmiFlushTrace(IN OUT PWMI_LOGGER_INFORMATION LoggerInfo)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PAGED_CODE();
+
+    if (LoggerInfo->Size != sizeof(WMI_LOGGER_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    KeAcquireGuardedMutex(&WmipLoggerLock);
+
+    if (!WmipKernelLogger.Active)
+    {
+        Status = STATUS_WMI_INSTANCE_NOT_FOUND;
+    }
+    else
+    {
+        InterlockedExchange(&WmipKernelLogger.FlushRequested, 1);
+        KeSetEvent(&WmipKernelLogger.FlushEvent, IO_NO_INCREMENT, FALSE);
+        WmipQueryKernelLogger(&WmipKernelLogger, LoggerInfo);
+    }
+
+    KeReleaseGuardedMutex(&WmipLoggerLock);
+    return Status;
+}
+
+/*
+ * @implemented
+ *
+ * Events go to the kernel logger, whatever the handle.
+ */
+NTSTATUS
+NTAPI
+NtTraceEvent(IN ULONG TraceHandle,
+             IN ULONG Flags,
+             IN ULONG TraceHeaderLength,
+             IN struct _EVENT_TRACE_HEADER* TraceHeader)
+{
+    PAGED_CODE();
+
+    return WmipTraceUserEvent(TraceHeader, ExGetPreviousMode());
+}
+
+/* EOF */
@@ -102,8 +102,8 @@ WmiTraceEvent(
     PVOID InputBuffer,
     KPROCESSOR_MODE PreviousMode)
 {
-    UNIMPLEMENTED_DBGBREAK();
-    return STATUS_SUCCESS;
+    /* The buffer is the caller's EVENT_TRACE_HEADER */
+    return WmipTraceUserEvent(InputBuffer, PreviousMode);
 }
 
 static
@@ -443,6 +443,58 @@ WmiSetMark(
     return STATUS_SUCCESS;
 }
 
+static
+NTSTATUS
+WmipKernelLoggerControl(
+    _In_ ULONG IoControlCode,
+    _Inout_ PVOID Buffer,
+    _In_ ULONG InputLength,
+    _Inout_ PULONG OutputLength,
+    _In_ KPROCESSOR_MODE RequestorMode)
+{
+    PWMI_LOGGER_INFORMATION LoggerInfo = Buffer;
+    NTSTATUS Status;
+
+    if ((InputLength < sizeof(WMI_LOGGER_INFORMATION)) ||
+        (*OutputLength < sizeof(WMI_LOGGER_INFORMATION)))
+    {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    /* The kernel logger sees what everyone on the system does */
+    if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, RequestorMode))
+    {
+        return STATUS_PRIVILEGE_NOT_HELD;
+    }
+
+    switch (IoControlCode)
+    {
+        case IOCTL_WMI_START_KERNEL_LOGGER:
+            Status = WmiStartTrace(LoggerInfo);
+            break;
+
+        case IOCTL_WMI_STOP_KERNEL_LOGGER:
+            Status = WmiStopTrace(LoggerInfo);
+            break;
+
+        case IOCTL_WMI_QUERY_KERNEL_LOGGER:
+            Status = WmiQueryTrace(LoggerInfo);
+            break;
+
+        case IOCTL_WMI_UPDATE_KERNEL_LOGGER:
+            Status = WmiUpdateTrace(LoggerInfo);
+            break;
+
+        default:
+            ASSERT(IoControlCode == IOCTL_WMI_FLUSH_KERNEL_LOGGER);
+            Status = WmiFlushTrace(LoggerInfo);
+            break;
+    }
+
+    *OutputLength = sizeof(WMI_LOGGER_INFORMATION);
+    return Status;
+}
+
 NTSTATUS
 NTAPI
 WmipIoControl(
@@ -519,6 +571,20 @@ WmipIoControl(
             break;
         }
 
+        case IOCTL_WMI_START_KERNEL_LOGGER:
+        case IOCTL_WMI_STOP_KERNEL_LOGGER:
+        case IOCTL_WMI_QUERY_KERNEL_LOGGER:
+        case IOCTL_WMI_UPDATE_KERNEL_LOGGER:
+        case IOCTL_WMI_FLUSH_KERNEL_LOGGER:
+        {
+            Status = WmipKernelLoggerControl(IoControlCode,
+                                             Buffer,
+                                             InputLength,
+                                             &OutputLength,
+                                             Irp->RequestorMode);
+            break;
+        }
+
         default:
             DPRINT1("Unsupported yet IOCTL: 0x%lx\n", IoControlCode);
             Status = STATUS_INVALID_DEVICE_REQUEST;
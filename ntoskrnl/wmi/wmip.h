@@ -1,10 +1,22 @@
 
 #pragma once
 
+#include <wmitrace.h>
+
 extern POBJECT_TYPE WmipGuidObjectType;
 
 #define GUID_STRING_LENGTH 36
 
+typedef enum _WMI_CLOCK_TYPE
+{
+    WMICT_DEFAULT,
+    WMICT_SYSTEMTIME,
+    WMICT_PERFCOUNTER,
+    WMICT_PROCESS,
+    WMICT_THREAD,
+    WMICT_CPUCYCLE
+} WMI_CLOCK_TYPE;
+
 typedef struct _WMIP_IRP_CONTEXT
 {
     LIST_ENTRY GuidObjectListHead;
@@ -55,3 +67,38 @@ WmipQueryRawSMBiosTables(
     _Inout_ ULONG *InOutBufferSize,
     _Out_opt_ PVOID OutBuffer);
 
+VOID
+NTAPI
+WmipInitializeKernelLogger(
+    VOID);
+
+NTSTATUS
+NTAPI
+WmipTraceUserEvent(
+    _In_ PEVENT_TRACE_HEADER TraceHeader,
+    _In_ KPROCESSOR_MODE PreviousMode);
+
+NTSTATUS
+NTAPI
+WmiStartTrace(
+    _Inout_ PWMI_LOGGER_INFORMATION LoggerInfo);
+
+NTSTATUS
+NTAPI
+WmiStopTrace(
+    _Inout_ PWMI_LOGGER_INFORMATION LoggerInfo);
+
+NTSTATUS
+NTAPI
+WmiQueryTrace(
+    _Inout_ PWMI_LOGGER_INFORMATION LoggerInfo);
+
+NTSTATUS
+NTAPI
+WmiUpdateTrace(
+    _Inout_ PWMI_LOGGER_INFORMATION LoggerInfo);
+
+NTSTATUS
+NTAPI
+WmiFlushTrace(
+    _Inout_ PWMI_LOGGER_INFORMATION LoggerInfo);
@@ -1280,3 +1280,14 @@ ClassScanForSpecial(
   _In_ PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
   _In_ CLASSPNP_SCAN_FOR_SPECIAL_INFO DeviceList[],
   _In_ PCLASS_SCAN_FOR_SPECIAL_HANDLER Function);
+
+#ifdef __REACTOS__
+struct _DISK_IO_STATISTICS;
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+NTAPI
+ClassQueryIoStatistics(
+  _In_ PDEVICE_OBJECT Fdo,
+  _Out_ struct _DISK_IO_STATISTICS *Statistics);
+#endif
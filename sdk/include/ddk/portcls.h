@@ -1889,6 +1889,8 @@ DECLARE_INTERFACE_(IMiniportWaveRTStreamNotification, IMiniportWaveRTStream)
     )   PURE;
 };
 
+typedef IMiniportWaveRTStreamNotification *PMINIPORTWAVERTSTREAMNOTIFICATION;
+
 /* ===============================================================
     IMiniportWaveRT Interface
 */
@@ -1398,7 +1398,57 @@ typedef struct _SYSTEM_NUMA_INFORMATION
     };
 } SYSTEM_NUMA_INFORMATION, *PSYSTEM_NUMA_INFORMATION;
 
-// FIXME: Class 56-63
+// Class 56
+#define PF_SYSINFO_MAGIC_NUMBER 'kuhC'
+#define PF_CURRENT_VERSION 3
+
+typedef enum _PREFETCHER_INFORMATION_CLASS
+{
+    PrefetcherRetrieveTrace = 1,
+    PrefetcherSystemParameters,
+    PrefetcherBootPhase,
+    PrefetcherRetrieveBootLoaderTrace,
+    PrefetcherBootControl,
+    PrefetcherLogonScenario = 0x100 // ReactOS specific
+} PREFETCHER_INFORMATION_CLASS;
+
+typedef struct _PREFETCHER_INFORMATION
+{
+    ULONG Version;
+    ULONG Magic;
+    PREFETCHER_INFORMATION_CLASS PrefetcherInformationClass;
+    PVOID PrefetcherInformation;
+    ULONG PrefetcherInformationLength;
+} PREFETCHER_INFORMATION, *PPREFETCHER_INFORMATION;
+
+//
+// Boot phases reported with PrefetcherBootPhase
+//
+typedef enum _PF_BOOT_PHASE_ID
+{
+    PfKernelInitPhase = 0,
+    PfBootDriverInitPhase = 90,
+    PfSystemDriverInitPhase = 120,
+    PfSessionManagerInitPhase = 150,
+    PfSMRegistryInitPhase = 180,
+    PfVideoInitPhase = 210,
+    PfPostVideoInitPhase = 240,
+    PfBootAcceptedRegistryInitPhase = 270,
+    PfUserShellReadyPhase = 300,
+    PfMaxBootPhaseId = 900
+} PF_BOOT_PHASE_ID;
+
+//
+// Input for PrefetcherLogonScenario. The logon scenario of the user is
+// prefetched, and traced from now on when Trace is set.
+//
+typedef struct _PF_LOGON_SCENARIO_INFORMATION
+{
+    ULONG UserHash;
+    BOOLEAN Trace;
+} PF_LOGON_SCENARIO_INFORMATION, *PPF_LOGON_SCENARIO_INFORMATION;
+
+// FIXME: Class 57-63
 
 // Class 64
 typedef struct _SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX
@@ -138,6 +138,7 @@ typedef enum
 #define MSR_AMD_ACCESS          0x9C5A203A
 #define MSR_IA32_MISC_ENABLE    0x01A0
 #define MSR_EFER                0xC0000080
+#define MSR_PAT                 0x0277
 
 //
 // MSR internal Values
@@ -146,6 +147,16 @@ typedef enum
 #define XHF_NOEXECUTE           0x100000
 #define MSR_XD_ENABLE_MASK      0xFFFFFFFB
 
+//
+// Caching values for the PAT MSR
+//
+#define PAT_UC                  0ULL
+#define PAT_WC                  1ULL
+#define PAT_WT                  4ULL
+#define PAT_WP                  5ULL
+#define PAT_WB                  6ULL
+#define PAT_UCM                 7ULL
+
 //
 // IPI Types
 //
@@ -96,11 +96,120 @@ typedef enum _SYSDBG_COMMAND
     SysDbgClearUmBreakPid = 34,
     SysDbgGetUmAttachPid = 35,
     SysDbgClearUmAttachPid = 36,
+
+    //
+    // ReactOS Extensions
+    //
+    SysDbgQuerySpinLockProfile = 0x1000,
+    SysDbgSetSpinLockProfile = 0x1001,
+    SysDbgQueryWorkQueueStatistics = 0x1002,
+    SysDbgQuerySchedTrace = 0x1003,
+    SysDbgSetSchedTrace = 0x1004,
+    SysDbgQueryStackProfile = 0x1005,
+    SysDbgSetStackProfile = 0x1006,
 } SYSDBG_COMMAND;
 
 //
 // System Debugger Types
 //
+typedef struct _SYSDBG_SPINLOCK_PROFILE_ENTRY
+{
+    PVOID SpinLock;
+    PVOID Caller;
+    ULONG Processor;
+    ULONG AcquireCount;
+    ULONG ContentionCount;
+    ULONG Reserved;
+    ULONGLONG SpinCount;
+    ULONGLONG HoldTime;
+    ULONGLONG MaxHoldTime;
+} SYSDBG_SPINLOCK_PROFILE_ENTRY, *PSYSDBG_SPINLOCK_PROFILE_ENTRY;
+
+//
+// Latency histogram of an executive work queue. Bucket 0 counts the items
+// that were picked up within a microsecond, bucket n those that waited at
+// least 2^(n-1) microseconds and less than 2^n; the last one is open-ended.
+//
+#define SYSDBG_WORK_QUEUE_LATENCY_BUCKETS 16
+
+typedef struct _SYSDBG_WORK_QUEUE_STATISTICS
+{
+    ULONG Node;
+    ULONG QueueType;
+    ULONG WorkerCount;
+    ULONG DynamicThreadCount;
+    ULONG QueueDepth;
+    ULONG WorkItemsProcessed;
+    ULONG WorkItemsStolen;
+    ULONG MaximumLatency;
+    ULONG LatencyHistogram[SYSDBG_WORK_QUEUE_LATENCY_BUCKETS];
+} SYSDBG_WORK_QUEUE_STATISTICS, *PSYSDBG_WORK_QUEUE_STATISTICS;
+
+//
+// Scheduler trace records. For a context switch, OldThreadId is the thread
+// that stopped running, OldState and WaitReason tell why, and NewThreadId is
+// the thread that took over. For a ready event, OldThreadId is the thread that
+// readied NewThreadId, WaitReason what the latter was waiting for, and
+// TargetProcessor is where it was queued. OldState is always the state of
+// the thread in OldThreadId. A lost
+// record tells how many records (in OldThreadId) were overwritten before they
+// could be read.
+//
+#define SYSDBG_SCHED_TRACE_SWITCH   0
+#define SYSDBG_SCHED_TRACE_READY    1
+#define SYSDBG_SCHED_TRACE_LOST     2
+
+typedef struct _SYSDBG_SCHED_TRACE_ENTRY
+{
+    ULONGLONG TimeStamp;
+    UCHAR Type;
+    UCHAR Processor;
+    UCHAR TargetProcessor;
+    UCHAR OldState;
+    UCHAR WaitReason;
+    CHAR OldPriority;
+    CHAR NewPriority;
+    UCHAR Reserved;
+    ULONG OldThreadId;
+    ULONG NewThreadId;
+} SYSDBG_SCHED_TRACE_ENTRY, *PSYSDBG_SCHED_TRACE_ENTRY;
+
+//
+// Stack profiler samples, taken from the profile interrupt. Frames holds
+// KernelFrames kernel return addresses, innermost first, followed by
+// UserFrames user ones. Either count may be zero: kernel frames when the
+// processor was running user code, user frames for system threads or when
+// the user stack was not resident. A lost sample tells how many samples (in
+// ThreadId) were overwritten before they could be read.
+//
+#define SYSDBG_STACK_PROFILE_SAMPLE     0
+#define SYSDBG_STACK_PROFILE_LOST       1
+
+#define SYSDBG_STACK_PROFILE_FRAMES     30
+
+typedef struct _SYSDBG_STACK_PROFILE_ENTRY
+{
+    ULONGLONG TimeStamp;
+    UCHAR Type;
+    UCHAR Processor;
+    UCHAR KernelFrames;
+    UCHAR UserFrames;
+    ULONG ProcessId;
+    ULONG ThreadId;
+    ULONG Reserved;
+    PVOID Frames[SYSDBG_STACK_PROFILE_FRAMES];
+} SYSDBG_STACK_PROFILE_ENTRY, *PSYSDBG_STACK_PROFILE_ENTRY;
+
+//
+// Input of SysDbgSetStackProfile. Interval is the profile interrupt interval
+// in 100ns units, zero keeps the current one.
+//
+typedef struct _SYSDBG_STACK_PROFILE_CONTROL
+{
+    BOOLEAN Enable;
+    ULONG Interval;
+} SYSDBG_STACK_PROFILE_CONTROL, *PSYSDBG_STACK_PROFILE_CONTROL;
+
 typedef struct _SYSDBG_PHYSICAL
 {
     PHYSICAL_ADDRESS Address;
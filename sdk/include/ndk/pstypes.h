@@ -914,6 +914,24 @@ typedef struct _PROCESS_FOREGROUND_BACKGROUND
     BOOLEAN Foreground;
 } PROCESS_FOREGROUND_BACKGROUND, *PPROCESS_FOREGROUND_BACKGROUND;
 
+//
+// ReactOS Extension: handle and object statistics of a process, returned by
+// the ProcessHandleStatistics class. ObjectCreates is indexed by the object
+// type index minus one.
+//
+#define ProcessHandleStatistics                 ((PROCESSINFOCLASS)0x1000)
+
+#define PROCESS_HANDLE_STATISTICS_TYPES         32
+
+typedef struct _PROCESS_HANDLE_STATISTICS
+{
+    ULONG HandleCreates;
+    ULONG HandleCloses;
+    ULONG HandleDuplicates;
+    ULONG HandleLookups;
+    ULONG ObjectCreates[PROCESS_HANDLE_STATISTICS_TYPES];
+} PROCESS_HANDLE_STATISTICS, *PPROCESS_HANDLE_STATISTICS;
+
 //
 // Apphelp SHIM Cache
 //
@@ -1384,6 +1402,17 @@ typedef struct _EPROCESS
     UCHAR PriorityClass;
     MM_AVL_TABLE VadRoot;
     ULONG Cookie;
+
+    //
+    // ReactOS working set trimming statistics
+    //
+    ULONG TrimmedPageCount;
+    ULONG RefaultPageCount;
+
+    //
+    // ReactOS handle and object statistics
+    //
+    PROCESS_HANDLE_STATISTICS HandleStatistics;
 } EPROCESS;
 
 //
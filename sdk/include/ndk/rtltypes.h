@@ -1631,6 +1631,7 @@ typedef struct DECLSPEC_ALIGN(16) _RTL_UMS_CONTEXT
 typedef struct _RTL_ATOM_TABLE_ENTRY
 {
     struct _RTL_ATOM_TABLE_ENTRY *HashLink;
+    ULONG Hash;
     USHORT HandleIndex;
     USHORT Atom;
     USHORT ReferenceCount;
@@ -1645,9 +1646,9 @@ typedef struct _RTL_ATOM_TABLE
     union
     {
 #ifdef NTOS_MODE_USER
-        RTL_CRITICAL_SECTION CriticalSection;
+        RTL_RESOURCE Resource;
 #else
-        FAST_MUTEX FastMutex;
+        ERESOURCE Resource;
 #endif
     };
     union
@@ -1658,8 +1659,10 @@ typedef struct _RTL_ATOM_TABLE
         PHANDLE_TABLE ExHandleTable;
 #endif
     };
+    ULONG NumberOfAtoms;
     ULONG NumberOfBuckets;
-    PRTL_ATOM_TABLE_ENTRY Buckets[1];
+    PRTL_ATOM_TABLE_ENTRY *Buckets;
+    PRTL_ATOM_TABLE_ENTRY InitialBuckets[1];
 } RTL_ATOM_TABLE, *PRTL_ATOM_TABLE;
 
 #ifndef _WINBASE_
@@ -52,6 +52,292 @@ typedef enum _HTTP_SERVICE_CONFIG_ID
 
 typedef ULONGLONG HTTP_OPAQUE_ID, *PHTTP_OPAQUE_ID;
 typedef HTTP_OPAQUE_ID HTTP_SERVER_SESSION_ID, *PHTTP_SERVER_SESSION_ID;
+typedef HTTP_OPAQUE_ID HTTP_REQUEST_ID, *PHTTP_REQUEST_ID;
+typedef HTTP_OPAQUE_ID HTTP_CONNECTION_ID, *PHTTP_CONNECTION_ID;
+typedef HTTP_OPAQUE_ID HTTP_RAW_CONNECTION_ID, *PHTTP_RAW_CONNECTION_ID;
+typedef ULONGLONG HTTP_URL_CONTEXT;
+
+#define HTTP_NULL_ID            ((ULONGLONG)0)
+#define HTTP_IS_NULL_ID(pid)    (HTTP_NULL_ID == *(pid))
+#define HTTP_SET_NULL_ID(pid)   (*(pid) = HTTP_NULL_ID)
+
+/* HttpReceiveHttpRequest flags */
+#define HTTP_RECEIVE_REQUEST_FLAG_COPY_BODY     0x00000001
+#define HTTP_RECEIVE_REQUEST_FLAG_FLUSH_BODY    0x00000002
+
+/* HTTP_REQUEST flags */
+#define HTTP_REQUEST_FLAG_MORE_ENTITY_BODY_EXISTS 0x00000001
+
+/* HttpSendHttpResponse and HttpSendResponseEntityBody flags */
+#define HTTP_SEND_RESPONSE_FLAG_DISCONNECT      0x00000001
+#define HTTP_SEND_RESPONSE_FLAG_MORE_DATA       0x00000002
+#define HTTP_SEND_RESPONSE_FLAG_BUFFER_DATA     0x00000004
+
+#define HTTP_BYTE_RANGE_TO_EOF ((ULONGLONG)-1)
+
+typedef enum _HTTP_VERB
+{
+    HttpVerbUnparsed,
+    HttpVerbUnknown,
+    HttpVerbInvalid,
+    HttpVerbOPTIONS,
+    HttpVerbGET,
+    HttpVerbHEAD,
+    HttpVerbPOST,
+    HttpVerbPUT,
+    HttpVerbDELETE,
+    HttpVerbTRACE,
+    HttpVerbCONNECT,
+    HttpVerbTRACK,
+    HttpVerbMOVE,
+    HttpVerbCOPY,
+    HttpVerbPROPFIND,
+    HttpVerbPROPPATCH,
+    HttpVerbMKCOL,
+    HttpVerbLOCK,
+    HttpVerbUNLOCK,
+    HttpVerbSEARCH,
+    HttpVerbMaximum,
+} HTTP_VERB, *PHTTP_VERB;
+
+typedef enum _HTTP_HEADER_ID
+{
+    HttpHeaderCacheControl          = 0,
+    HttpHeaderConnection            = 1,
+    HttpHeaderDate                  = 2,
+    HttpHeaderKeepAlive             = 3,
+    HttpHeaderPragma                = 4,
+    HttpHeaderTrailer               = 5,
+    HttpHeaderTransferEncoding      = 6,
+    HttpHeaderUpgrade               = 7,
+    HttpHeaderVia                   = 8,
+    HttpHeaderWarning               = 9,
+
+    HttpHeaderAllow                 = 10,
+    HttpHeaderContentLength         = 11,
+    HttpHeaderContentType           = 12,
+    HttpHeaderContentEncoding       = 13,
+    HttpHeaderContentLanguage       = 14,
+    HttpHeaderContentLocation       = 15,
+    HttpHeaderContentMd5            = 16,
+    HttpHeaderContentRange          = 17,
+    HttpHeaderExpires               = 18,
+    HttpHeaderLastModified          = 19,
+
+    HttpHeaderAccept                = 20,
+    HttpHeaderAcceptCharset         = 21,
+    HttpHeaderAcceptEncoding        = 22,
+    HttpHeaderAcceptLanguage        = 23,
+    HttpHeaderAuthorization         = 24,
+    HttpHeaderCookie                = 25,
+    HttpHeaderExpect                = 26,
+    HttpHeaderFrom                  = 27,
+    HttpHeaderHost                  = 28,
+    HttpHeaderIfMatch               = 29,
+    HttpHeaderIfModifiedSince       = 30,
+    HttpHeaderIfNoneMatch           = 31,
+    HttpHeaderIfRange               = 32,
+    HttpHeaderIfUnmodifiedSince     = 33,
+    HttpHeaderMaxForwards           = 34,
+    HttpHeaderProxyAuthorization    = 35,
+    HttpHeaderReferer               = 36,
+    HttpHeaderRange                 = 37,
+    HttpHeaderTe                    = 38,
+    HttpHeaderTranslate             = 39,
+    HttpHeaderUserAgent             = 40,
+    HttpHeaderRequestMaximum        = 41,
+
+    HttpHeaderAcceptRanges          = 20,
+    HttpHeaderAge                   = 21,
+    HttpHeaderEtag                  = 22,
+    HttpHeaderLocation              = 23,
+    HttpHeaderProxyAuthenticate     = 24,
+    HttpHeaderRetryAfter            = 25,
+    HttpHeaderServer                = 26,
+    HttpHeaderSetCookie             = 27,
+    HttpHeaderVary                  = 28,
+    HttpHeaderWwwAuthenticate       = 29,
+    HttpHeaderResponseMaximum       = 30,
+
+    HttpHeaderMaximum               = 41
+} HTTP_HEADER_ID, *PHTTP_HEADER_ID;
+
+typedef struct _HTTP_VERSION
+{
+    USHORT MajorVersion;
+    USHORT MinorVersion;
+} HTTP_VERSION, *PHTTP_VERSION;
+
+typedef struct _HTTP_KNOWN_HEADER
+{
+    USHORT RawValueLength;
+    PCSTR pRawValue;
+} HTTP_KNOWN_HEADER, *PHTTP_KNOWN_HEADER;
+
+typedef struct _HTTP_UNKNOWN_HEADER
+{
+    USHORT NameLength;
+    USHORT RawValueLength;
+    PCSTR pName;
+    PCSTR pRawValue;
+} HTTP_UNKNOWN_HEADER, *PHTTP_UNKNOWN_HEADER;
+
+typedef struct _HTTP_REQUEST_HEADERS
+{
+    USHORT UnknownHeaderCount;
+    PHTTP_UNKNOWN_HEADER pUnknownHeaders;
+    USHORT TrailerCount;
+    PHTTP_UNKNOWN_HEADER pTrailers;
+    HTTP_KNOWN_HEADER KnownHeaders[HttpHeaderRequestMaximum];
+} HTTP_REQUEST_HEADERS, *PHTTP_REQUEST_HEADERS;
+
+typedef struct _HTTP_RESPONSE_HEADERS
+{
+    USHORT UnknownHeaderCount;
+    PHTTP_UNKNOWN_HEADER pUnknownHeaders;
+    USHORT TrailerCount;
+    PHTTP_UNKNOWN_HEADER pTrailers;
+    HTTP_KNOWN_HEADER KnownHeaders[HttpHeaderResponseMaximum];
+} HTTP_RESPONSE_HEADERS, *PHTTP_RESPONSE_HEADERS;
+
+typedef struct _HTTP_COOKED_URL
+{
+    USHORT FullUrlLength;
+    USHORT HostLength;
+    USHORT AbsPathLength;
+    USHORT QueryStringLength;
+    PCWSTR pFullUrl;
+    PCWSTR pHost;
+    PCWSTR pAbsPath;
+    PCWSTR pQueryString;
+} HTTP_COOKED_URL, *PHTTP_COOKED_URL;
+
+typedef struct _HTTP_TRANSPORT_ADDRESS
+{
+    PSOCKADDR pRemoteAddress;
+    PSOCKADDR pLocalAddress;
+} HTTP_TRANSPORT_ADDRESS, *PHTTP_TRANSPORT_ADDRESS;
+
+typedef enum _HTTP_DATA_CHUNK_TYPE
+{
+    HttpDataChunkFromMemory,
+    HttpDataChunkFromFileHandle,
+    HttpDataChunkFromFragmentCache,
+    HttpDataChunkFromFragmentCacheEx,
+    HttpDataChunkMaximum
+} HTTP_DATA_CHUNK_TYPE, *PHTTP_DATA_CHUNK_TYPE;
+
+typedef struct _HTTP_BYTE_RANGE
+{
+    ULARGE_INTEGER StartingOffset;
+    ULARGE_INTEGER Length;
+} HTTP_BYTE_RANGE, *PHTTP_BYTE_RANGE;
+
+typedef struct _HTTP_DATA_CHUNK
+{
+    HTTP_DATA_CHUNK_TYPE DataChunkType;
+    union
+    {
+        struct
+        {
+            PVOID pBuffer;
+            ULONG BufferLength;
+        } FromMemory;
+        struct
+        {
+            HTTP_BYTE_RANGE ByteRange;
+            HANDLE FileHandle;
+        } FromFileHandle;
+        struct
+        {
+            USHORT FragmentNameLength;
+            PCWSTR pFragmentName;
+        } FromFragmentCache;
+    } DUMMYUNIONNAME;
+} HTTP_DATA_CHUNK, *PHTTP_DATA_CHUNK;
+
+typedef struct _HTTP_SSL_CLIENT_CERT_INFO
+{
+    ULONG CertFlags;
+    ULONG CertEncodedSize;
+    PUCHAR pCertEncoded;
+    HANDLE Token;
+    BOOLEAN CertDeniedByMapper;
+} HTTP_SSL_CLIENT_CERT_INFO, *PHTTP_SSL_CLIENT_CERT_INFO;
+
+typedef struct _HTTP_SSL_INFO
+{
+    USHORT ServerCertKeySize;
+    USHORT ConnectionKeySize;
+    ULONG ServerCertIssuerSize;
+    ULONG ServerCertSubjectSize;
+    PCSTR pServerCertIssuer;
+    PCSTR pServerCertSubject;
+    PHTTP_SSL_CLIENT_CERT_INFO pClientCertInfo;
+    ULONG SslClientCertNegotiated;
+} HTTP_SSL_INFO, *PHTTP_SSL_INFO;
+
+typedef struct _HTTP_REQUEST_V1
+{
+    ULONG Flags;
+    HTTP_CONNECTION_ID ConnectionId;
+    HTTP_REQUEST_ID RequestId;
+    HTTP_URL_CONTEXT UrlContext;
+    HTTP_VERSION Version;
+    HTTP_VERB Verb;
+    USHORT UnknownVerbLength;
+    USHORT RawUrlLength;
+    PCSTR pUnknownVerb;
+    PCSTR pRawUrl;
+    HTTP_COOKED_URL CookedUrl;
+    HTTP_TRANSPORT_ADDRESS Address;
+    HTTP_REQUEST_HEADERS Headers;
+    ULONGLONG BytesReceived;
+    USHORT EntityChunkCount;
+    PHTTP_DATA_CHUNK pEntityChunks;
+    HTTP_RAW_CONNECTION_ID RawConnectionId;
+    PHTTP_SSL_INFO pSslInfo;
+} HTTP_REQUEST_V1, *PHTTP_REQUEST_V1;
+
+typedef HTTP_REQUEST_V1 HTTP_REQUEST, *PHTTP_REQUEST;
+
+typedef struct _HTTP_RESPONSE_V1
+{
+    ULONG Flags;
+    HTTP_VERSION Version;
+    USHORT StatusCode;
+    USHORT ReasonLength;
+    PCSTR pReason;
+    HTTP_RESPONSE_HEADERS Headers;
+    USHORT EntityChunkCount;
+    PHTTP_DATA_CHUNK pEntityChunks;
+} HTTP_RESPONSE_V1, *PHTTP_RESPONSE_V1;
+
+typedef HTTP_RESPONSE_V1 HTTP_RESPONSE, *PHTTP_RESPONSE;
+
+typedef enum _HTTP_CACHE_POLICY_TYPE
+{
+    HttpCachePolicyNocache,
+    HttpCachePolicyUserInvalidates,
+    HttpCachePolicyTimeToLive,
+    HttpCachePolicyMaximum
+} HTTP_CACHE_POLICY_TYPE, *PHTTP_CACHE_POLICY_TYPE;
+
+typedef struct _HTTP_CACHE_POLICY
+{
+    HTTP_CACHE_POLICY_TYPE Policy;
+    ULONG SecondsToLive;
+} HTTP_CACHE_POLICY, *PHTTP_CACHE_POLICY;
+
+typedef enum _HTTP_LOG_DATA_TYPE
+{
+    HttpLogDataTypeFields
+} HTTP_LOG_DATA_TYPE, *PHTTP_LOG_DATA_TYPE;
+
+typedef struct _HTTP_LOG_DATA
+{
+    HTTP_LOG_DATA_TYPE Type;
+} HTTP_LOG_DATA, *PHTTP_LOG_DATA;
 
 ULONG WINAPI HttpInitialize(HTTPAPI_VERSION,ULONG,PVOID);
 ULONG WINAPI HttpTerminate(ULONG,PVOID);
@@ -61,6 +347,11 @@ ULONG WINAPI HttpCreateHttpHandle(PHANDLE,ULONG);
 ULONG WINAPI HttpCreateServerSession(HTTPAPI_VERSION,PHTTP_SERVER_SESSION_ID,ULONG);
 ULONG WINAPI HttpDeleteServiceConfiguration(HANDLE,HTTP_SERVICE_CONFIG_ID,PVOID,ULONG,LPOVERLAPPED);
 ULONG WINAPI HttpQueryServiceConfiguration(HANDLE,HTTP_SERVICE_CONFIG_ID,PVOID,ULONG,PVOID,ULONG,PULONG,LPOVERLAPPED);
+ULONG WINAPI HttpReceiveHttpRequest(HANDLE,HTTP_REQUEST_ID,ULONG,PHTTP_REQUEST,ULONG,PULONG,LPOVERLAPPED);
+ULONG WINAPI HttpReceiveRequestEntityBody(HANDLE,HTTP_REQUEST_ID,ULONG,PVOID,ULONG,PULONG,LPOVERLAPPED);
+ULONG WINAPI HttpRemoveUrl(HANDLE,PCWSTR);
+ULONG WINAPI HttpSendHttpResponse(HANDLE,HTTP_REQUEST_ID,ULONG,PHTTP_RESPONSE,PHTTP_CACHE_POLICY,PULONG,PVOID,ULONG,LPOVERLAPPED,PHTTP_LOG_DATA);
+ULONG WINAPI HttpSendResponseEntityBody(HANDLE,HTTP_REQUEST_ID,ULONG,USHORT,PHTTP_DATA_CHUNK,PULONG,PVOID,ULONG,LPOVERLAPPED,PHTTP_LOG_DATA);
 ULONG WINAPI HttpSetServiceConfiguration(HANDLE,HTTP_SERVICE_CONFIG_ID,PVOID,ULONG,LPOVERLAPPED);
 
 #ifdef __cplusplus
@@ -240,6 +240,35 @@ typedef INT
 #define WSAID_WSARECVMSG \
   {0xf689d7c8,0x6f1f,0x436b,{0x8a,0x53,0xe5,0x4f,0xe3,0x51,0xc3,0x22}}
 
+/* ReactOS extension: datagram batches, one call for many datagrams */
+typedef struct _WSADATAGRAM {
+  WSABUF buf;
+  LPSOCKADDR name;
+  INT namelen;
+  DWORD dwBytesTransferred;
+  DWORD dwFlags;
+} WSADATAGRAM, *PWSADATAGRAM, FAR *LPWSADATAGRAM;
+
+typedef INT
+(PASCAL FAR *LPFN_WSASENDDATAGRAMS)(
+  _In_ SOCKET s,
+  _Inout_updates_(dwCount) LPWSADATAGRAM lpDatagrams,
+  _In_ DWORD dwCount,
+  _In_ DWORD dwFlags);
+
+#define WSAID_WSASENDDATAGRAMS \
+  {0xe7913bf7,0x7d96,0x4682,{0x8e,0x22,0x5c,0x2a,0xb6,0x27,0x5d,0xc2}}
+
+typedef INT
+(PASCAL FAR *LPFN_WSARECVDATAGRAMS)(
+  _In_ SOCKET s,
+  _Inout_updates_(dwCount) LPWSADATAGRAM lpDatagrams,
+  _In_ DWORD dwCount,
+  _In_ DWORD dwFlags);
+
+#define WSAID_WSARECVDATAGRAMS \
+  {0x4718f5c8,0xc7af,0x43db,{0xb2,0x3d,0x3d,0x47,0xf4,0x81,0xfd,0xd9}}
+
 #endif /* (_WIN32_WINNT >= 0x0501) */
 
 #if(_WIN32_WINNT >= 0x0600)
@@ -95,6 +95,8 @@
 
 /* TCP connection options */
 #define TCP_SOCKET_NODELAY 1
+#define TCP_SOCKET_WINDOW  6
+#define TCP_SOCKET_SNDBUF  7
 
 typedef struct IFEntry
 {
@@ -890,6 +890,11 @@ extern "C" {
 #define USER_TIMER_MAXIMUM  2147483647
 #define USER_TIMER_MINIMUM  10
 
+#define TIMERV_DEFAULT_COALESCING   0
+#define TIMERV_NO_COALESCING        0xFFFFFFFF
+#define TIMERV_COALESCING_MIN       1
+#define TIMERV_COALESCING_MAX       0x7FFFFFF5
+
 #define MWMO_WAITALL 1
 #define MWMO_ALERTABLE 2
 #define MWMO_INPUTAVAILABLE 4
@@ -1069,6 +1074,8 @@ extern "C" {
 #define UOI_NAME 2
 #define UOI_TYPE 3
 #define UOI_USER_SID 4
+#define UOI_HEAPSIZE 5
+#define UOI_IO 6
 #define LR_DEFAULTCOLOR 0
 #define LR_MONOCHROME 1
 #define LR_COLOR 2
@@ -5177,6 +5184,9 @@ BOOL WINAPI SetSystemCursor(_In_ HCURSOR, _In_ DWORD);
 BOOL WINAPI SetSystemMenu(HWND,HMENU);
 BOOL WINAPI SetThreadDesktop(_In_ HDESK);
 UINT_PTR WINAPI SetTimer(_In_opt_ HWND, _In_ UINT_PTR, _In_ UINT, _In_opt_ TIMERPROC);
+#if (_WIN32_WINNT >= 0x0602)
+UINT_PTR WINAPI SetCoalescableTimer(_In_opt_ HWND, _In_ UINT_PTR, _In_ UINT, _In_opt_ TIMERPROC, _In_ ULONG);
+#endif
 UINT_PTR WINAPI SetSystemTimer(HWND,UINT_PTR,UINT,TIMERPROC);
 
 BOOL
@@ -0,0 +1,60 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS boot loader
+ * FILE:            include/reactos/bootbundle.h
+ * PURPOSE:         Boot bundle and compressed RAM disk image formats,
+ *                  shared by FreeLoader and the bootbundle host tool
+ */
+
+#ifndef REACTOS_BOOTBUNDLE_H_INCLUDED
+#define REACTOS_BOOTBUNDLE_H_INCLUDED
+
+#define BOOT_BUNDLE_SIGNATURE           0x4C444E42 /* 'BNDL' */
+#define BOOT_BUNDLE_VERSION             1
+
+#define COMPRESSED_IMAGE_SIGNATURE      0x5A444D52 /* 'RMDZ' */
+
+/* Longest file name kept in a bundle entry, including the terminator */
+#define BOOT_BUNDLE_MAX_NAME            120
+
+#include <pshpack4.h>
+
+/*
+ * A boot bundle holds the files the boot loader reads from the system root
+ * (kernel, HAL, SYSTEM hive, NLS files, boot drivers), so that they can be
+ * read with a single sequential read. The header is followed by EntryCount
+ * entries, the file data follows the entries. Names are relative to the
+ * system root and use backslashes, e.g. "system32\drivers\disk.sys".
+ */
+typedef struct _BOOT_BUNDLE_HEADER
+{
+    ULONG Signature;
+    USHORT Version;
+    USHORT HeaderSize;
+    ULONG EntryCount;
+    ULONG TotalSize;        /* Whole bundle, header included */
+} BOOT_BUNDLE_HEADER, *PBOOT_BUNDLE_HEADER;
+
+typedef struct _BOOT_BUNDLE_ENTRY
+{
+    ULONG DataOffset;       /* From the start of the bundle */
+    ULONG DataSize;
+    CHAR Name[BOOT_BUNDLE_MAX_NAME];
+} BOOT_BUNDLE_ENTRY, *PBOOT_BUNDLE_ENTRY;
+
+/*
+ * A compressed RAM disk image is this header followed by CompressedSize
+ * bytes, as produced by RtlCompressBuffer with CompressionFormat.
+ */
+typedef struct _COMPRESSED_IMAGE_HEADER
+{
+    ULONG Signature;
+    USHORT CompressionFormat;   /* COMPRESSION_FORMAT_LZNT1, _XPRESS or _XPRESS_HUFF */
+    USHORT HeaderSize;
+    ULONG UncompressedSize;
+    ULONG CompressedSize;
+} COMPRESSED_IMAGE_HEADER, *PCOMPRESSED_IMAGE_HEADER;
+
+#include <poppack.h>
+
+#endif /* REACTOS_BOOTBUNDLE_H_INCLUDED */
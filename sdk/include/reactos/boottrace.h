@@ -0,0 +1,64 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS kernel
+ * FILE:            include/reactos/boottrace.h
+ * PURPOSE:         Binary boot timeline written by the I/O manager
+ *                  when booting with /BOOTLOG
+ */
+
+#ifndef REACTOS_BOOTTRACE_H_INCLUDED
+#define REACTOS_BOOTTRACE_H_INCLUDED
+
+#define BOOT_TRACE_SIGNATURE        0x43525442 /* 'BTRC' */
+#define BOOT_TRACE_VERSION          2
+
+/* Record types */
+#define BOOT_TRACE_DRIVER_LOAD      1 /* Image load, Name is the service */
+#define BOOT_TRACE_DRIVER_ENTRY     2 /* DriverEntry, Name is the service */
+#define BOOT_TRACE_ADD_DEVICE       3 /* AddDevice, Name is the instance path */
+#define BOOT_TRACE_START_DEVICE     4 /* IRP_MN_START_DEVICE, Name is the instance path */
+#define BOOT_TRACE_FIRST_IO         5 /* First non PnP IRP, Data is the major function */
+#define BOOT_TRACE_PHASE            6 /* Boot phase, Data is the PF_BOOT_PHASE_ID it started with */
+
+/* Data of the phase record covering the boot loader */
+#define BOOT_TRACE_LOADER_PHASE     0xFFFFFFFF
+
+/* Longest name kept in a record, longer names keep their tail */
+#define BOOT_TRACE_MAX_NAME         (128 * sizeof(WCHAR))
+
+#include <pshpack4.h>
+
+/*
+ * The file is a header followed by DataSize bytes of variable sized records.
+ * All times are in 100ns units. StartTime counts from the start of the boot
+ * loader when the file has a loader phase record, from the start of the
+ * kernel (interrupt time) otherwise.
+ */
+typedef struct _BOOT_TRACE_HEADER
+{
+    ULONG Signature;
+    USHORT Version;
+    USHORT HeaderSize;
+    ULONG RecordCount;
+    ULONG DataSize;
+    ULONG DroppedCount;
+    ULONG Reserved;
+} BOOT_TRACE_HEADER, *PBOOT_TRACE_HEADER;
+
+typedef struct _BOOT_TRACE_RECORD
+{
+    USHORT Size;            /* Whole record, a multiple of 4 */
+    UCHAR Type;
+    UCHAR Reserved;
+    ULONG Data;             /* NTSTATUS of the operation, see above for FIRST_IO and PHASE */
+    ULONGLONG StartTime;
+    ULONG Duration;
+    ULONG ThreadId;
+    USHORT NameLength;      /* In bytes, not NULL terminated */
+    USHORT Reserved2;
+    WCHAR Name[1];
+} BOOT_TRACE_RECORD, *PBOOT_TRACE_RECORD;
+
+#include <poppack.h>
+
+#endif /* REACTOS_BOOTTRACE_H_INCLUDED */
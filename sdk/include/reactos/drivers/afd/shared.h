@@ -59,6 +59,74 @@ typedef struct _AFD_POLL_INFO {
     AFD_HANDLE			        Handles[1];
 } AFD_POLL_INFO, *PAFD_POLL_INFO;
 
+/* Poll sets: sockets are registered on a command channel handle once and
+ * readiness changes are queued on it, so a wait only looks at the sockets
+ * that became ready. */
+#define AFD_POLL_SET_ADD		0
+#define AFD_POLL_SET_MODIFY		1
+#define AFD_POLL_SET_REMOVE		2
+
+#define AFD_POLL_SET_ONESHOT		0x00000001 /* Disarm once reported */
+
+typedef struct _AFD_POLL_SET_CONTROL_INFO {
+    ULONG				Operation;
+    ULONG				Flags;
+    SOCKET				Handle;
+    ULONG				Events;
+    ULONG_PTR				Context;
+} AFD_POLL_SET_CONTROL_INFO, *PAFD_POLL_SET_CONTROL_INFO;
+
+typedef struct _AFD_POLL_SET_WAIT_INFO {
+    LARGE_INTEGER		        Timeout;
+} AFD_POLL_SET_WAIT_INFO, *PAFD_POLL_SET_WAIT_INFO;
+
+/* The output buffer of a wait is an array of these */
+typedef struct _AFD_POLL_SET_EVENT {
+    ULONG_PTR				Context;
+    ULONG				Events;
+} AFD_POLL_SET_EVENT, *PAFD_POLL_SET_EVENT;
+
+/* TransmitFile and TransmitPackets: the elements are sent in order, file
+ * data straight from the cache */
+#define AFD_TP_ELEMENT_MEMORY		0x1
+#define AFD_TP_ELEMENT_FILE		0x2
+#define AFD_TP_ELEMENT_EOP		0x4
+
+#define AFD_TP_DISCONNECT		0x1
+#define AFD_TP_REUSE_SOCKET		0x2
+
+typedef struct _AFD_TRANSMIT_ELEMENT {
+    ULONG				Flags;
+    ULONG				Length;     /* 0 sends a file up to its end */
+    LARGE_INTEGER			FileOffset; /* -1 for the current file position */
+    HANDLE				FileHandle;
+    PVOID				Buffer;
+} AFD_TRANSMIT_ELEMENT, *PAFD_TRANSMIT_ELEMENT;
+
+typedef struct _AFD_TRANSMIT_INFO {
+    PAFD_TRANSMIT_ELEMENT		ElementArray;
+    ULONG				ElementCount;
+    ULONG				SendSize;   /* 0 for the default */
+    ULONG				Flags;
+} AFD_TRANSMIT_INFO, *PAFD_TRANSMIT_INFO;
+
+/* Datagram batches: one call sends or receives a whole array of datagrams.
+ * The layout of an element matches WSADATAGRAM in mswsock.h */
+#define AFD_DATAGRAM_TRUNCATED		0x0100 /* MSG_TRUNC */
+
+typedef struct _AFD_DATAGRAM {
+    AFD_WSABUF				Buffer;
+    PVOID				Address;       /* sockaddr */
+    INT					AddressLength; /* Updated on receive */
+    ULONG				BytesTransferred;
+    ULONG				Flags;
+} AFD_DATAGRAM, *PAFD_DATAGRAM;
+
+typedef struct _AFD_DATAGRAM_BATCH_INFO {
+    PAFD_DATAGRAM			DatagramArray;
+    ULONG				DatagramCount;
+} AFD_DATAGRAM_BATCH_INFO, *PAFD_DATAGRAM_BATCH_INFO;
+
 typedef struct _AFD_ACCEPT_DATA {
     ULONG				UseSAN;
     ULONG				SequenceNumber;
@@ -261,6 +329,11 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_DEFER_ACCEPT		35
 #define AFD_GET_PENDING_CONNECT_DATA	41
 #define AFD_VALIDATE_GROUP		42
+#define AFD_POLL_SET_CONTROL		43
+#define AFD_POLL_SET_WAIT		44
+#define AFD_TRANSMIT_PACKETS		45
+#define AFD_SEND_DATAGRAM_BATCH		46
+#define AFD_RECV_DATAGRAM_BATCH		47
 
 /* AFD IOCTLs */
 
@@ -336,6 +409,16 @@ typedef struct _AFD_TDI_HANDLE_DATA
   _AFD_CONTROL_CODE(AFD_ENUM_NETWORK_EVENTS, METHOD_NEITHER)
 #define IOCTL_AFD_VALIDATE_GROUP \
   _AFD_CONTROL_CODE(AFD_VALIDATE_GROUP, METHOD_NEITHER)
+#define IOCTL_AFD_POLL_SET_CONTROL \
+  _AFD_CONTROL_CODE(AFD_POLL_SET_CONTROL, METHOD_BUFFERED )
+#define IOCTL_AFD_POLL_SET_WAIT \
+  _AFD_CONTROL_CODE(AFD_POLL_SET_WAIT, METHOD_BUFFERED )
+#define IOCTL_AFD_TRANSMIT_PACKETS \
+  _AFD_CONTROL_CODE(AFD_TRANSMIT_PACKETS, METHOD_NEITHER)
+#define IOCTL_AFD_SEND_DATAGRAM_BATCH \
+  _AFD_CONTROL_CODE(AFD_SEND_DATAGRAM_BATCH, METHOD_NEITHER)
+#define IOCTL_AFD_RECV_DATAGRAM_BATCH \
+  _AFD_CONTROL_CODE(AFD_RECV_DATAGRAM_BATCH, METHOD_NEITHER)
 
 typedef struct _AFD_SOCKET_INFORMATION {
     BOOL CommandChannel;
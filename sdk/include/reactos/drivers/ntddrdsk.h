@@ -51,6 +51,7 @@ DEFINE_GUID(GUID_BUS_TYPE_RAMDISK, 0x9D6D66A6, 0x0B0C, 0x4563, 0x90, 0x77, 0xA0,
 #define RAMDISK_MEMORY_MAPPED_DISK          2 // Loaded from a file and mapped in memory
 #define RAMDISK_BOOT_DISK                   3 // Used as a boot device "ramdisk(0)"
 #define RAMDISK_WIM_DISK                    4 // Used as an installation device
+#define RAMDISK_SCRATCH_DISK                5 // Backed by memory allocated by the driver
 
 //
 // Options when creating a ramdisk
@@ -63,6 +64,8 @@ typedef struct _RAMDISK_CREATE_OPTIONS
     ULONG NoDosDevice:1;
     ULONG Hidden:1;
     ULONG ExportAsCd:1;
+    ULONG LargePages:1;   // Scratch disk: physically contiguous, large page sized chunks
+    ULONG GrowOnDemand:1; // Scratch disk: allocate the memory on first write
 } RAMDISK_CREATE_OPTIONS;
 
 //
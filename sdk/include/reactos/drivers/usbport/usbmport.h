@@ -97,7 +97,7 @@ typedef struct _USBPORT_TRANSFER_PARAMETERS {
   ULONG TransferBufferLength;
   ULONG TransferCounter;
   BOOL IsTransferSplited;
-  ULONG Reserved2;
+  BOOL IsSplitContinued; // More splits of the same transfer follow this one
   USB_DEFAULT_PIPE_SETUP_PACKET SetupPacket;
 } USBPORT_TRANSFER_PARAMETERS, *PUSBPORT_TRANSFER_PARAMETERS;
 
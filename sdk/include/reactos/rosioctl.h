@@ -17,6 +17,52 @@
 #define PARTITION_EXT2                PARTITION_LINUX // some apps use this identifier
 #define PARTITION_LINUX_LVM           0x8E
 
+/*
+ * Cache residency of a file, answered by the cache manager for any file
+ * system. Output is a FILE_CACHE_RESIDENCY_INFORMATION.
+ */
+#define FSCTL_QUERY_CACHE_RESIDENCY   CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+typedef struct _FILE_CACHE_RESIDENCY_INFORMATION
+{
+    LARGE_INTEGER FileSize;      // File size as known to the cache
+    LARGE_INTEGER ResidentBytes; // Bytes of the file in the cache
+    LARGE_INTEGER DirtyBytes;    // Resident bytes not written back yet
+    ULONG ViewCount;             // Number of cache views of the file
+    ULONG ViewSize;              // Size of a cache view
+} FILE_CACHE_RESIDENCY_INFORMATION, *PFILE_CACHE_RESIDENCY_INFORMATION;
+
+/*
+ * Per disk I/O statistics, kept by the class driver for every read and
+ * write going through it. Output is a DISK_IO_STATISTICS.
+ */
+#define IOCTL_DISK_QUERY_IO_STATISTICS CTL_CODE(FILE_DEVICE_DISK, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define DISK_IO_SIZE_CLASSES          4  // Up to 4KB, 64KB, 1MB, and larger requests
+#define DISK_IO_LATENCY_BUCKETS       16 // Bucket i counts latencies below 2^(i+5) us, the last one all others
+
+typedef struct _DISK_IO_SIZE_CLASS_STATISTICS
+{
+    ULONG ReadCount;                              // Completed reads
+    ULONG WriteCount;                             // Completed writes
+    LARGE_INTEGER BytesRead;                      // Bytes transferred by the reads
+    LARGE_INTEGER BytesWritten;                   // Bytes transferred by the writes
+    ULONG ReadLatency[DISK_IO_LATENCY_BUCKETS];   // Read latency histogram
+    ULONG WriteLatency[DISK_IO_LATENCY_BUCKETS];  // Write latency histogram
+} DISK_IO_SIZE_CLASS_STATISTICS, *PDISK_IO_SIZE_CLASS_STATISTICS;
+
+typedef struct _DISK_IO_STATISTICS
+{
+    LARGE_INTEGER QueryTime;     // System time of the query
+    LARGE_INTEGER ReadTime;      // Total read latency, in 100ns units
+    LARGE_INTEGER WriteTime;     // Total write latency, in 100ns units
+    LARGE_INTEGER IdleTime;      // Time with no request in progress, in 100ns units
+    ULONG QueueDepth;            // Requests queued or in progress at the time of the query
+    ULONG MaxQueueDepth;         // Highest queue depth seen
+    ULONG SplitCount;            // Requests split into several transfers
+    DISK_IO_SIZE_CLASS_STATISTICS SizeClass[DISK_IO_SIZE_CLASSES];
+} DISK_IO_STATISTICS, *PDISK_IO_STATISTICS;
+
 #endif /* __ROSIOCTL_H */
 
 /* EOF */
@@ -35,3 +35,10 @@
 #define IOCTL_WMI_58 CTL_CODE(FILE_DEVICE_UNKNOWN, 0x58, METHOD_BUFFERED, FILE_READ_ACCESS) // 0x224160
 #define IOCTL_WMI_59 CTL_CODE(FILE_DEVICE_UNKNOWN, 0x59, METHOD_BUFFERED, FILE_READ_ACCESS) // 0x224164
 #define IOCTL_WMI_5a CTL_CODE(FILE_DEVICE_UNKNOWN, 0x5a, METHOD_BUFFERED, FILE_WRITE_ACCESS) // 0x228168
+
+/* ReactOS specific, the kernel logger control, with a WMI_LOGGER_INFORMATION from wmitrace.h */
+#define IOCTL_WMI_START_KERNEL_LOGGER CTL_CODE(FILE_DEVICE_UNKNOWN, 0x60, METHOD_BUFFERED, FILE_ANY_ACCESS) // 0x220180
+#define IOCTL_WMI_STOP_KERNEL_LOGGER CTL_CODE(FILE_DEVICE_UNKNOWN, 0x61, METHOD_BUFFERED, FILE_ANY_ACCESS) // 0x220184
+#define IOCTL_WMI_QUERY_KERNEL_LOGGER CTL_CODE(FILE_DEVICE_UNKNOWN, 0x62, METHOD_BUFFERED, FILE_ANY_ACCESS) // 0x220188
+#define IOCTL_WMI_UPDATE_KERNEL_LOGGER CTL_CODE(FILE_DEVICE_UNKNOWN, 0x63, METHOD_BUFFERED, FILE_ANY_ACCESS) // 0x22018C
+#define IOCTL_WMI_FLUSH_KERNEL_LOGGER CTL_CODE(FILE_DEVICE_UNKNOWN, 0x64, METHOD_BUFFERED, FILE_ANY_ACCESS) // 0x220190
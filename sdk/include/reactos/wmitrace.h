@@ -0,0 +1,184 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS kernel
+ * FILE:            include/reactos/wmitrace.h
+ * PURPOSE:         Kernel logger control structure and log file format,
+ *                  shared by the kernel and trace consumers
+ */
+
+#ifndef REACTOS_WMITRACE_H_INCLUDED
+#define REACTOS_WMITRACE_H_INCLUDED
+
+#define WMI_TRACE_FILE_SIGNATURE        0x4C545752 /* 'RWTL' */
+#define WMI_TRACE_FILE_VERSION          1
+
+/* Kernel logger control, see IOCTL_WMI_START_KERNEL_LOGGER */
+typedef struct _WMI_LOGGER_INFORMATION
+{
+    ULONG Size;                 /* sizeof(WMI_LOGGER_INFORMATION) */
+    ULONG EnableFlags;          /* EVENT_TRACE_FLAG_* */
+    ULONG ClockType;            /* WMICT_*, 0 for the performance counter */
+    ULONG BufferSize;           /* In KB, 0 for the default */
+    ULONG NumberOfBuffers;      /* 0 for the default */
+    ULONG FlushTimer;           /* In seconds, 0 for the default */
+
+    /* Returned by query and stop */
+    ULONG BuffersWritten;
+    ULONG EventsLost;
+    LONG WriteStatus;           /* First failed write, STATUS_SUCCESS if none */
+    ULONG Reserved;
+
+    WCHAR LogFileName[260];     /* NT path, e.g. \??\C:\kernel.rtl */
+} WMI_LOGGER_INFORMATION, *PWMI_LOGGER_INFORMATION;
+
+/*
+ * A log file is made of blocks of BufferSize bytes. The first one holds the
+ * file header, every following one a trace buffer flushed by the kernel.
+ * A trace buffer holds the events of a single processor in the order they
+ * were logged, but buffers of several processors are interleaved in the
+ * file, so events have to be sorted by time stamp to get the global order.
+ */
+#include <pshpack8.h>
+
+typedef struct _WMI_TRACE_FILE_HEADER
+{
+    ULONG Signature;
+    USHORT Version;
+    USHORT HeaderSize;
+    ULONG BufferSize;
+    ULONG NumberOfProcessors;
+    ULONG EnableFlags;
+    ULONG ClockType;
+    LARGE_INTEGER PerfFrequency;    /* KeQueryPerformanceCounter frequency */
+    LARGE_INTEGER StartTime;        /* System time when the logger started */
+    LARGE_INTEGER StartTimeStamp;   /* Event clock when the logger started */
+    LARGE_INTEGER EndTime;          /* Filled in when the logger stops */
+    LARGE_INTEGER EndTimeStamp;
+    ULONG BuffersWritten;
+    ULONG EventsLost;
+} WMI_TRACE_FILE_HEADER, *PWMI_TRACE_FILE_HEADER;
+
+typedef struct _WMI_TRACE_BUFFER_HEADER
+{
+    ULONG SavedOffset;              /* Bytes used, this header included */
+    ULONG SequenceNumber;           /* Starts at 0, in the order of flushing */
+    ULONG Processor;
+    ULONG Reserved;
+    LARGE_INTEGER TimeStamp;        /* When the buffer was flushed */
+} WMI_TRACE_BUFFER_HEADER, *PWMI_TRACE_BUFFER_HEADER;
+
+/* Events follow each other, each starts at an 8 byte boundary */
+#define WMI_TRACE_EVENT_ALIGNMENT       8
+
+typedef struct _WMI_TRACE_EVENT_HEADER
+{
+    USHORT Size;                    /* This header and the data, without padding */
+    UCHAR Group;                    /* WMI_TRACE_GROUP_* */
+    UCHAR Type;                     /* EVENT_TRACE_TYPE_* or WMI_TRACE_TYPE_* */
+    ULONG ThreadId;                 /* Thread that logged the event */
+    ULONG ProcessId;
+    ULONG Reserved;
+    LARGE_INTEGER TimeStamp;
+} WMI_TRACE_EVENT_HEADER, *PWMI_TRACE_EVENT_HEADER;
+
+#define WMI_TRACE_GROUP_PROCESS         1   /* WMI_TRACE_PROCESS */
+#define WMI_TRACE_GROUP_THREAD          2   /* WMI_TRACE_THREAD */
+#define WMI_TRACE_GROUP_DISK_IO         3   /* WMI_TRACE_DISK_IO */
+#define WMI_TRACE_GROUP_FILE_IO         4   /* WMI_TRACE_FILE_IO, WMI_TRACE_FILE_CREATE */
+#define WMI_TRACE_GROUP_PAGE_FAULT      5   /* WMI_TRACE_PAGE_FAULT */
+#define WMI_TRACE_GROUP_CONTEXT_SWITCH  6   /* WMI_TRACE_CONTEXT_SWITCH */
+#define WMI_TRACE_GROUP_USER            7   /* WMI_TRACE_USER_EVENT, from NtTraceEvent */
+
+/*
+ * Event types, the values are the ones ETW uses for the same events.
+ * Process and thread events use EVENT_TRACE_TYPE_START, _END and _DC_START
+ * (for the ones already running when the logger starts). Disk events use
+ * EVENT_TRACE_TYPE_IO_READ_INIT and _WRITE_INIT when the request is sent
+ * to the disk, EVENT_TRACE_TYPE_IO_READ and _WRITE when it completes.
+ */
+#define WMI_TRACE_TYPE_READ             0x0A
+#define WMI_TRACE_TYPE_WRITE            0x0B
+#define WMI_TRACE_TYPE_READ_INIT        0x0C
+#define WMI_TRACE_TYPE_WRITE_INIT       0x0D
+#define WMI_TRACE_TYPE_PAGE_FAULT       0x00
+#define WMI_TRACE_TYPE_CONTEXT_SWITCH   0x24
+#define WMI_TRACE_TYPE_FILE_CREATE      0x40
+
+/* Pointers are logged as 64 bit values, the format is the same on all architectures */
+typedef struct _WMI_TRACE_PROCESS
+{
+    ULONG ProcessId;
+    ULONG ParentId;
+    ULONG SessionId;
+    LONG ExitStatus;                /* EVENT_TRACE_TYPE_END only */
+    CHAR ImageFileName[16];
+} WMI_TRACE_PROCESS, *PWMI_TRACE_PROCESS;
+
+typedef struct _WMI_TRACE_THREAD
+{
+    ULONG ThreadId;
+    ULONG ProcessId;
+    ULONG64 StackBase;              /* User stack, 0 for system threads */
+    ULONG64 StackLimit;
+    ULONG64 StartAddress;
+} WMI_TRACE_THREAD, *PWMI_TRACE_THREAD;
+
+typedef struct _WMI_TRACE_CONTEXT_SWITCH
+{
+    ULONG OldThreadId;
+    ULONG NewThreadId;
+    CHAR OldThreadPriority;
+    CHAR NewThreadPriority;
+    UCHAR OldThreadState;           /* KTHREAD_STATE */
+    UCHAR OldThreadWaitReason;      /* KWAIT_REASON, if it is waiting */
+    ULONG Reserved;
+} WMI_TRACE_CONTEXT_SWITCH, *PWMI_TRACE_CONTEXT_SWITCH;
+
+typedef struct _WMI_TRACE_PAGE_FAULT
+{
+    ULONG64 VirtualAddress;
+    ULONG64 ProgramCounter;         /* 0 if the fault has no trap frame */
+    ULONG FaultCode;                /* As passed to MmAccessFault */
+    ULONG Reserved;
+} WMI_TRACE_PAGE_FAULT, *PWMI_TRACE_PAGE_FAULT;
+
+/* Issue and completion events of a request have the same Irp */
+typedef struct _WMI_TRACE_DISK_IO
+{
+    ULONG64 Irp;
+    ULONG64 DeviceObject;
+    ULONG64 ByteOffset;
+    ULONG TransferSize;             /* Requested on issue, transferred on completion */
+    LONG Status;                    /* Completion only */
+    ULONG IrpFlags;
+    ULONG Reserved;
+} WMI_TRACE_DISK_IO, *PWMI_TRACE_DISK_IO;
+
+/* Logged when the request is made, ByteOffset may be FILE_USE_FILE_POINTER_POSITION */
+typedef struct _WMI_TRACE_FILE_IO
+{
+    ULONG64 FileObject;
+    ULONG64 ByteOffset;
+    ULONG Length;
+    ULONG Reserved;
+} WMI_TRACE_FILE_IO, *PWMI_TRACE_FILE_IO;
+
+typedef struct _WMI_TRACE_FILE_CREATE
+{
+    ULONG64 FileObject;
+    WCHAR FileName[1];              /* Up to the end of the event, not terminated */
+} WMI_TRACE_FILE_CREATE, *PWMI_TRACE_FILE_CREATE;
+
+/* EVENT_TRACE_HEADER fields of the event, followed by its data */
+typedef struct _WMI_TRACE_USER_EVENT
+{
+    GUID Guid;
+    UCHAR Type;
+    UCHAR Level;
+    USHORT Version;
+    ULONG Reserved;
+} WMI_TRACE_USER_EVENT, *PWMI_TRACE_USER_EVENT;
+
+#include <poppack.h>
+
+#endif /* REACTOS_WMITRACE_H_INCLUDED */
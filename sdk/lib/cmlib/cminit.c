@@ -73,7 +73,7 @@ CmCreateRootNode(
 static VOID CMAPI
 CmpPrepareKey(
     PHHIVE RegistryHive,
-    PCM_KEY_NODE KeyCell);
+    HCELL_INDEX KeyCellIndex);
 
 static VOID CMAPI
 CmpPrepareIndexOfKeys(
@@ -89,7 +89,7 @@ CmpPrepareIndexOfKeys(
         {
             PCM_KEY_INDEX SubIndexCell = HvGetCell(RegistryHive, IndexCell->List[i]);
             if (SubIndexCell->Signature == CM_KEY_NODE_SIGNATURE)
-                CmpPrepareKey(RegistryHive, (PCM_KEY_NODE)SubIndexCell);
+                CmpPrepareKey(RegistryHive, IndexCell->List[i]);
             else
                 CmpPrepareIndexOfKeys(RegistryHive, SubIndexCell);
         }
@@ -100,8 +100,7 @@ CmpPrepareIndexOfKeys(
         PCM_KEY_FAST_INDEX HashCell = (PCM_KEY_FAST_INDEX)IndexCell;
         for (i = 0; i < HashCell->Count; i++)
         {
-            PCM_KEY_NODE SubKeyCell = HvGetCell(RegistryHive, HashCell->List[i].Cell);
-            CmpPrepareKey(RegistryHive, SubKeyCell);
+            CmpPrepareKey(RegistryHive, HashCell->List[i].Cell);
         }
     }
     else
@@ -114,14 +113,28 @@ CmpPrepareIndexOfKeys(
 static VOID CMAPI
 CmpPrepareKey(
     PHHIVE RegistryHive,
-    PCM_KEY_NODE KeyCell)
+    HCELL_INDEX KeyCellIndex)
 {
+    PCM_KEY_NODE KeyCell;
     PCM_KEY_INDEX IndexCell;
 
+    KeyCell = HvGetCell(RegistryHive, KeyCellIndex);
     ASSERT(KeyCell->Signature == CM_KEY_NODE_SIGNATURE);
 
-    KeyCell->SubKeyLists[Volatile] = HCELL_NIL;
-    KeyCell->SubKeyCounts[Volatile] = 0;
+    /* Drop any volatile subkeys left over from the last session */
+    if ((KeyCell->SubKeyLists[Volatile] != HCELL_NIL) ||
+        (KeyCell->SubKeyCounts[Volatile] != 0))
+    {
+        /*
+         * The bins of a mapped hive may be read back from the file later on,
+         * so make sure the change reaches it.
+         */
+        if (RegistryHive->GetCellRoutine)
+            HvMarkCellDirty(RegistryHive, KeyCellIndex, FALSE);
+
+        KeyCell->SubKeyLists[Volatile] = HCELL_NIL;
+        KeyCell->SubKeyCounts[Volatile] = 0;
+    }
 
     /* Enumerate and add subkeys */
     if (KeyCell->SubKeyCounts[Stable] > 0)
@@ -135,8 +148,5 @@ VOID CMAPI
 CmPrepareHive(
     PHHIVE RegistryHive)
 {
-    PCM_KEY_NODE RootCell;
-
-    RootCell = HvGetCell(RegistryHive, RegistryHive->BaseBlock->RootCell);
-    CmpPrepareKey(RegistryHive, RootCell);
+    CmpPrepareKey(RegistryHive, RegistryHive->BaseBlock->RootCell);
 }
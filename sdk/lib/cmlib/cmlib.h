@@ -53,6 +53,10 @@
     // #define max(a, b)  (((a) > (b)) ? (a) : (b))
     // #endif
 
+    #ifndef RTL_NUMBER_OF
+    #define RTL_NUMBER_OF(A) (sizeof(A) / sizeof((A)[0]))
+    #endif
+
     // Definitions copied from <ntstatus.h>
     // We only want to include host headers, so we define them manually
     #define STATUS_SUCCESS                   ((NTSTATUS)0x00000000)
@@ -61,6 +65,7 @@
     #define STATUS_INSUFFICIENT_RESOURCES    ((NTSTATUS)0xC000009A)
     #define STATUS_REGISTRY_CORRUPT          ((NTSTATUS)0xC000014C)
     #define STATUS_NOT_REGISTRY_FILE         ((NTSTATUS)0xC000015C)
+    #define STATUS_REGISTRY_IO_FAILED        ((NTSTATUS)0xC000014D)
     #define STATUS_REGISTRY_RECOVERED        ((NTSTATUS)0x40000009)
 
     #define REG_OPTION_VOLATILE              1
@@ -444,6 +449,16 @@ BOOLEAN CMAPI
 HvSyncHive(
    PHHIVE RegistryHive);
 
+BOOLEAN CMAPI
+HvReconcileHive(
+   PHHIVE RegistryHive);
+
+BOOLEAN CMAPI
+HvIsRangeDirty(
+   PHHIVE RegistryHive,
+   ULONG BlockIndex,
+   ULONG BlockCount);
+
 BOOLEAN CMAPI
 HvWriteHive(
    PHHIVE RegistryHive);
@@ -476,10 +491,30 @@ NTSTATUS CMAPI
 HvpCreateHiveFreeCellList(
    PHHIVE Hive);
 
+VOID CMAPI
+HvpFreeHiveFreeCellList(
+   PHHIVE Hive);
+
+PVOID CMAPI
+HvpGetBlockAddress(
+   PHHIVE Hive,
+   HSTORAGE_TYPE Storage,
+   ULONG BlockIndex);
+
 ULONG CMAPI
 HvpHiveHeaderChecksum(
    PHBASE_BLOCK HiveHeader);
 
+ULONG CMAPI
+HvpLogEntryChecksum(
+   ULONG Sum,
+   PVOID Buffer,
+   ULONG Length);
+
+NTSTATUS CMAPI
+HvpRecoverFromLog(
+   PHHIVE RegistryHive);
+
 
 /* Old-style Public "Cmlib" functions */
 
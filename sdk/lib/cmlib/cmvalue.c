@@ -297,8 +297,8 @@ CmpSetValueDataNew(IN PHHIVE Hive,
     /* Check if this is a big key */
     ASSERT_VALUE_BIG(Hive, DataSize);
 
-    /* Allocate a data cell */
-    *DataCell = HvAllocateCell(Hive, DataSize, StorageType, HCELL_NIL);
+    /* Allocate a data cell next to its value */
+    *DataCell = HvAllocateCell(Hive, DataSize, StorageType, ValueCell);
     if (*DataCell == HCELL_NIL) return STATUS_INSUFFICIENT_RESOURCES;
 
     /* Get the actual data */
@@ -63,7 +63,10 @@ HvpAddBin(
         RegistryHive->Storage[Storage].BlockList[OldBlockListSize + i].BlockAddress =
             ((ULONG_PTR)Bin + (i * HBLOCK_SIZE));
         RegistryHive->Storage[Storage].BlockList[OldBlockListSize + i].BinAddress = (ULONG_PTR)Bin;
+        RegistryHive->Storage[Storage].BlockList[OldBlockListSize + i].CmView = NULL;
+        RegistryHive->Storage[Storage].BlockList[OldBlockListSize + i].MemAlloc = 0;
     }
+    RegistryHive->Storage[Storage].BlockList[OldBlockListSize].MemAlloc = (ULONG)BinSize;
 
     /* Initialize a free block in this heap. */
     Block = (PHCELL)(Bin + 1);
@@ -27,6 +27,14 @@ HvpGetCellHeader(
         ULONG CellOffset = (CellIndex & HCELL_OFFSET_MASK) >> HCELL_OFFSET_SHIFT;
 
         ASSERT(CellBlock < RegistryHive->Storage[CellType].Length);
+
+        /* The bins of a mapped hive are looked up, and mapped if needed, by the host */
+        if (RegistryHive->GetCellRoutine)
+        {
+            Block = RegistryHive->GetCellRoutine(RegistryHive, CellIndex);
+            return Block ? (PHCELL)Block - 1 : NULL;
+        }
+
         Block = (PVOID)RegistryHive->Storage[CellType].BlockList[CellBlock].BlockAddress;
         ASSERT(Block != NULL);
         return (PVOID)((ULONG_PTR)Block + CellOffset);
@@ -59,6 +67,10 @@ HvIsCellAllocated(IN PHHIVE RegistryHive,
     if (RegistryHive->Storage[Type].BlockList[Block].BlockAddress)
         return TRUE;
 
+    /* The stable bins of a mapped hive may just not be mapped right now */
+    if ((Type == Stable) && (RegistryHive->GetCellRoutine))
+        return TRUE;
+
     /* No valid block, fail */
     return FALSE;
 }
@@ -68,17 +80,27 @@ HvGetCell(
     PHHIVE RegistryHive,
     HCELL_INDEX CellIndex)
 {
+    PHCELL CellHeader;
+
     ASSERT(CellIndex != HCELL_NIL);
-    return (PVOID)(HvpGetCellHeader(RegistryHive, CellIndex) + 1);
+
+    /* This can only fail if the bin of a mapped hive couldn't be read in */
+    CellHeader = HvpGetCellHeader(RegistryHive, CellIndex);
+    if (!CellHeader) return NULL;
+
+    return (PVOID)(CellHeader + 1);
 }
 
-static __inline LONG CMAPI
-HvpGetCellFullSize(
-    PHHIVE RegistryHive,
-    PVOID Cell)
+PVOID CMAPI
+HvpGetBlockAddress(
+    PHHIVE Hive,
+    HSTORAGE_TYPE Storage,
+    ULONG BlockIndex)
 {
-    UNREFERENCED_PARAMETER(RegistryHive);
-    return ((PHCELL)Cell - 1)->Size;
+    /* Offset zero of a block, this maps the bin holding it in if needed */
+    return HvpGetCellHeader(Hive,
+                            (Storage << HCELL_TYPE_SHIFT) |
+                            (BlockIndex << HCELL_BLOCK_SHIFT));
 }
 
 LONG CMAPI
@@ -102,6 +124,8 @@ HvMarkCellDirty(
     HCELL_INDEX CellIndex,
     BOOLEAN HoldingLock)
 {
+    PHCELL CellHeader;
+    LONG CellSize;
     ULONG CellBlock;
     ULONG CellLastBlock;
 
@@ -113,11 +137,17 @@ HvMarkCellDirty(
     if (HvGetCellType(CellIndex) != Stable)
         return TRUE;
 
+    /* Get the size of the cell, free or not, to find all the blocks it spans */
+    CellHeader = HvpGetCellHeader(RegistryHive, CellIndex);
+    if (!CellHeader) return FALSE;
+    CellSize = CellHeader->Size;
+    if (CellSize < 0) CellSize = -CellSize;
+
     CellBlock     = HvGetCellBlock(CellIndex);
-    CellLastBlock = HvGetCellBlock(CellIndex + HBLOCK_SIZE - 1);
+    CellLastBlock = HvGetCellBlock(CellIndex + CellSize - 1);
 
     RtlSetBits(&RegistryHive->DirtyVector,
-               CellBlock, CellLastBlock - CellBlock);
+               CellBlock, CellLastBlock - CellBlock + 1);
     RegistryHive->DirtyCount++;
     return TRUE;
 }
@@ -171,57 +201,106 @@ HvpComputeFreeListIndex(
     return Index;
 }
 
+/* Number of free cells of a size class looked at when searching for a fit */
+#define HV_FREE_SCAN_LIMIT      32
+
+/* Free cells this many blocks around the vicinity cell count as close to it */
+#define HV_VICINITY_BLOCKS      16
+
 static NTSTATUS CMAPI
 HvpAddFree(
     PHHIVE RegistryHive,
     PHCELL FreeBlock,
     HCELL_INDEX FreeIndex)
 {
-    PHCELL_INDEX FreeBlockData;
+    PHFREE_DISPLAY FreeDisplay;
+    PHFREE_CELL Cells;
     HSTORAGE_TYPE Storage;
     ULONG Index;
+    ULONG Size;
 
     ASSERT(RegistryHive != NULL);
     ASSERT(FreeBlock != NULL);
 
     Storage = HvGetCellType(FreeIndex);
     Index = HvpComputeFreeListIndex((ULONG)FreeBlock->Size);
+    FreeDisplay = &RegistryHive->Storage[Storage].FreeDisplay[Index];
 
-    FreeBlockData = (PHCELL_INDEX)(FreeBlock + 1);
-    *FreeBlockData = RegistryHive->Storage[Storage].FreeDisplay[Index];
-    RegistryHive->Storage[Storage].FreeDisplay[Index] = FreeIndex;
+    /* Grow the array of free cells if it is full */
+    if (FreeDisplay->Count == FreeDisplay->Size)
+    {
+        Size = FreeDisplay->Size ? FreeDisplay->Size * 2 : 16;
+        Cells = RegistryHive->Allocate(Size * sizeof(HFREE_CELL), TRUE, TAG_CM);
+        if (Cells == NULL)
+            return STATUS_NO_MEMORY;
+
+        if (FreeDisplay->Cells)
+        {
+            RtlCopyMemory(Cells, FreeDisplay->Cells,
+                          FreeDisplay->Count * sizeof(HFREE_CELL));
+            RegistryHive->Free(FreeDisplay->Cells, 0);
+        }
+
+        FreeDisplay->Cells = Cells;
+        FreeDisplay->Size = Size;
+    }
+
+    FreeDisplay->Cells[FreeDisplay->Count].Cell = FreeIndex;
+    FreeDisplay->Cells[FreeDisplay->Count].Size = (ULONG)FreeBlock->Size;
+    FreeDisplay->Count++;
+
+    /* This size class has free cells now */
+    RegistryHive->Storage[Storage].FreeSummary |= (1 << Index);
 
     /* FIXME: Eventually get rid of free bins. */
 
     return STATUS_SUCCESS;
 }
 
+static VOID CMAPI
+HvpTakeFree(
+    PHHIVE RegistryHive,
+    HSTORAGE_TYPE Storage,
+    ULONG Index,
+    ULONG Entry)
+{
+    PHFREE_DISPLAY FreeDisplay;
+
+    FreeDisplay = &RegistryHive->Storage[Storage].FreeDisplay[Index];
+    ASSERT(Entry < FreeDisplay->Count);
+
+    /* Move the last cell in its place and update the summary */
+    FreeDisplay->Cells[Entry] = FreeDisplay->Cells[--FreeDisplay->Count];
+    if (FreeDisplay->Count == 0)
+        RegistryHive->Storage[Storage].FreeSummary &= ~(1 << Index);
+}
+
 static VOID CMAPI
 HvpRemoveFree(
     PHHIVE RegistryHive,
     PHCELL CellBlock,
     HCELL_INDEX CellIndex)
 {
-    PHCELL_INDEX FreeCellData;
-    PHCELL_INDEX pFreeCellOffset;
+    PHFREE_DISPLAY FreeDisplay;
     HSTORAGE_TYPE Storage;
     ULONG Index, FreeListIndex;
+    ULONG i;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
 
     Storage = HvGetCellType(CellIndex);
     Index = HvpComputeFreeListIndex((ULONG)CellBlock->Size);
+    FreeDisplay = &RegistryHive->Storage[Storage].FreeDisplay[Index];
 
-    pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[Index];
-    while (*pFreeCellOffset != HCELL_NIL)
+    /* Recently freed cells are at the end, so look from there */
+    for (i = FreeDisplay->Count; i-- > 0; )
     {
-        FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-        if (*pFreeCellOffset == CellIndex)
+        if (FreeDisplay->Cells[i].Cell == CellIndex)
         {
-            *pFreeCellOffset = *FreeCellData;
+            ASSERT(FreeDisplay->Cells[i].Size == (ULONG)CellBlock->Size);
+            HvpTakeFree(RegistryHive, Storage, Index, i);
             return;
         }
-        pFreeCellOffset = FreeCellData;
     }
 
     /* Something bad happened, print a useful trace info and bugcheck */
@@ -231,12 +310,10 @@ HvpRemoveFree(
     for (FreeListIndex = 0; FreeListIndex < 24; FreeListIndex++)
     {
         CMLTRACE(CMLIB_HCELL_DEBUG, "free list [%u]: ", FreeListIndex);
-        pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[FreeListIndex];
-        while (*pFreeCellOffset != HCELL_NIL)
+        FreeDisplay = &RegistryHive->Storage[Storage].FreeDisplay[FreeListIndex];
+        for (i = 0; i < FreeDisplay->Count; i++)
         {
-            CMLTRACE(CMLIB_HCELL_DEBUG, "%08x ", *pFreeCellOffset);
-            FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-            pFreeCellOffset = FreeCellData;
+            CMLTRACE(CMLIB_HCELL_DEBUG, "%08x ", FreeDisplay->Cells[i].Cell);
         }
         CMLTRACE(CMLIB_HCELL_DEBUG, "\n");
     }
@@ -245,31 +322,90 @@ HvpRemoveFree(
     ASSERT(FALSE);
 }
 
+static __inline BOOLEAN CMAPI
+HvpIsCellNear(
+    HCELL_INDEX CellIndex,
+    HCELL_INDEX Vicinity)
+{
+    if (Vicinity == HCELL_NIL)
+        return FALSE;
+
+    if (HvGetCellType(CellIndex) != HvGetCellType(Vicinity))
+        return FALSE;
+
+    return (HvGetCellBlock(CellIndex) / HV_VICINITY_BLOCKS) ==
+           (HvGetCellBlock(Vicinity) / HV_VICINITY_BLOCKS);
+}
+
 static HCELL_INDEX CMAPI
 HvpFindFree(
     PHHIVE RegistryHive,
     ULONG Size,
-    HSTORAGE_TYPE Storage)
+    HSTORAGE_TYPE Storage,
+    HCELL_INDEX Vicinity)
 {
-    PHCELL_INDEX FreeCellData;
+    PHFREE_DISPLAY FreeDisplay;
+    PHFREE_CELL FreeCell;
     HCELL_INDEX FreeCellOffset;
-    PHCELL_INDEX pFreeCellOffset;
-    ULONG Index;
+    ULONG Summary;
+    ULONG Index, Last;
+    ULONG Best, BestSize;
+    ULONG i;
+    BOOLEAN Near, BestNear;
 
-    for (Index = HvpComputeFreeListIndex(Size); Index < 24; Index++)
+    /* Only look at the size classes which have free cells */
+    Index = HvpComputeFreeListIndex(Size);
+    Summary = RegistryHive->Storage[Storage].FreeSummary & ~((1 << Index) - 1);
+
+    while (Summary)
     {
-        pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[Index];
-        while (*pFreeCellOffset != HCELL_NIL)
+        Index = RtlFindLeastSignificantBit(Summary);
+        FreeDisplay = &RegistryHive->Storage[Storage].FreeDisplay[Index];
+        ASSERT(FreeDisplay->Count != 0);
+
+        //
+        // Look at the most recently freed cells of this class and pick the
+        // smallest one that fits, preferring cells close to the vicinity.
+        // Cells in the exact size classes are all the same size, so we can
+        // take the first one close by, or the most recent one.
+        //
+        Last = (FreeDisplay->Count > HV_FREE_SCAN_LIMIT) ?
+               FreeDisplay->Count - HV_FREE_SCAN_LIMIT : 0;
+        Best = MAXULONG;
+        BestSize = MAXULONG;
+        BestNear = FALSE;
+        for (i = FreeDisplay->Count; i-- > Last; )
         {
-            FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-            if ((ULONG)HvpGetCellFullSize(RegistryHive, FreeCellData) >= Size)
+            FreeCell = &FreeDisplay->Cells[i];
+            if (FreeCell->Size < Size)
+                continue;
+
+            Near = HvpIsCellNear(FreeCell->Cell, Vicinity);
+            if ((Near && !BestNear) ||
+                ((Near == BestNear) && (FreeCell->Size < BestSize)))
             {
-                FreeCellOffset = *pFreeCellOffset;
-                *pFreeCellOffset = *FreeCellData;
-                return FreeCellOffset;
+                Best = i;
+                BestSize = FreeCell->Size;
+                BestNear = Near;
+            }
+
+            /* A close cell of the exact size can't be beaten */
+            if ((FreeCell->Size == Size) &&
+                (Near || (Vicinity == HCELL_NIL)))
+            {
+                break;
             }
-            pFreeCellOffset = FreeCellData;
         }
+
+        if (Best != MAXULONG)
+        {
+            FreeCellOffset = FreeDisplay->Cells[Best].Cell;
+            HvpTakeFree(RegistryHive, Storage, Index, Best);
+            return FreeCellOffset;
+        }
+
+        /* Nothing fit in this class, go to the next non-empty one */
+        Summary &= Summary - 1;
     }
 
     return HCELL_NIL;
@@ -290,15 +426,19 @@ HvpCreateHiveFreeCellList(
     /* Initialize the free cell list */
     for (Index = 0; Index < 24; Index++)
     {
-        Hive->Storage[Stable].FreeDisplay[Index] = HCELL_NIL;
-        Hive->Storage[Volatile].FreeDisplay[Index] = HCELL_NIL;
+        Hive->Storage[Stable].FreeDisplay[Index].Count = 0;
+        Hive->Storage[Volatile].FreeDisplay[Index].Count = 0;
     }
+    Hive->Storage[Stable].FreeSummary = 0;
+    Hive->Storage[Volatile].FreeSummary = 0;
 
     BlockOffset = 0;
     BlockIndex = 0;
     while (BlockIndex < Hive->Storage[Stable].Length)
     {
-        Bin = (PHBIN)Hive->Storage[Stable].BlockList[BlockIndex].BinAddress;
+        Bin = (PHBIN)HvpGetBlockAddress(Hive, Stable, BlockIndex);
+        if (Bin == NULL)
+            return STATUS_REGISTRY_IO_FAILED;
 
         /* Search free blocks and add to list */
         FreeOffset = sizeof(HBIN);
@@ -326,6 +466,31 @@ HvpCreateHiveFreeCellList(
     return STATUS_SUCCESS;
 }
 
+VOID CMAPI
+HvpFreeHiveFreeCellList(
+    PHHIVE Hive)
+{
+    PHFREE_DISPLAY FreeDisplay;
+    ULONG Storage;
+    ULONG Index;
+
+    for (Storage = 0; Storage < HTYPE_COUNT; Storage++)
+    {
+        for (Index = 0; Index < 24; Index++)
+        {
+            FreeDisplay = &Hive->Storage[Storage].FreeDisplay[Index];
+            if (FreeDisplay->Cells)
+                Hive->Free(FreeDisplay->Cells, 0);
+
+            FreeDisplay->Cells = NULL;
+            FreeDisplay->Count = 0;
+            FreeDisplay->Size = 0;
+        }
+
+        Hive->Storage[Storage].FreeSummary = 0;
+    }
+}
+
 HCELL_INDEX CMAPI
 HvAllocateCell(
     PHHIVE RegistryHive,
@@ -346,8 +511,8 @@ HvAllocateCell(
     /* Round to 16 bytes multiple. */
     Size = ROUND_UP(Size + sizeof(HCELL), 16);
 
-    /* First search in free blocks. */
-    FreeCellOffset = HvpFindFree(RegistryHive, Size, Storage);
+    /* First search in free blocks, close to the vicinity cell if possible */
+    FreeCellOffset = HvpFindFree(RegistryHive, Size, Storage, Vicinity);
 
     /* If no free cell was found we need to extend the hive file. */
     if (FreeCellOffset == HCELL_NIL)
@@ -360,6 +525,8 @@ HvAllocateCell(
     }
 
     FreeCell = HvpGetCellHeader(RegistryHive, FreeCellOffset);
+    if (FreeCell == NULL)
+        return HCELL_NIL;
 
     /* Split the block in two parts */
 
@@ -422,7 +589,7 @@ HvReallocateCell(
      */
     if (Size > (ULONG)OldCellSize)
     {
-        NewCellIndex = HvAllocateCell(RegistryHive, Size, Storage, HCELL_NIL);
+        NewCellIndex = HvAllocateCell(RegistryHive, Size, Storage, CellIndex);
         if (NewCellIndex == HCELL_NIL)
             return HCELL_NIL;
 
@@ -489,15 +656,10 @@ HvFreeCell(
                     ((HCELL_INDEX)((ULONG_PTR)Neighbor - (ULONG_PTR)Bin +
                      Bin->FileOffset)) | (CellIndex & HCELL_TYPE_MASK);
 
-                if (HvpComputeFreeListIndex(Neighbor->Size) !=
-                    HvpComputeFreeListIndex(Neighbor->Size + Free->Size))
-                {
-                   HvpRemoveFree(RegistryHive, Neighbor, NeighborCellIndex);
-                   Neighbor->Size += Free->Size;
-                   HvpAddFree(RegistryHive, Neighbor, NeighborCellIndex);
-                }
-                else
-                    Neighbor->Size += Free->Size;
+                /* The free list keeps the size, so always re-add it */
+                HvpRemoveFree(RegistryHive, Neighbor, NeighborCellIndex);
+                Neighbor->Size += Free->Size;
+                HvpAddFree(RegistryHive, Neighbor, NeighborCellIndex);
 
                 if (CellType == Stable)
                     HvMarkCellDirty(RegistryHive, NeighborCellIndex, FALSE);
@@ -45,6 +45,7 @@
 #define HV_LOG_HEADER_SIZE              FIELD_OFFSET(HBASE_BLOCK, Reserved2)
 #define HV_SIGNATURE                    0x66676572  // "regf"
 #define HV_BIN_SIGNATURE                0x6e696268  // "hbin"
+#define HV_LOG_ENTRY_SIGNATURE          0x454c7648  // "HvLE"
 
 //
 // Hive versions
@@ -185,6 +186,47 @@ typedef struct _HCELL
     LONG Size;
 } HCELL, *PHCELL;
 
+/*
+ * The log of a hive starts with a copy of the base block of the primary as
+ * of the last reconciliation, followed by one entry per flush. Each entry is
+ * this header and its list of runs, padded to whole blocks, followed by the
+ * blocks of the runs in order.
+ */
+typedef struct _HLOG_RUN
+{
+    /* First block of the run, from the first bin */
+    ULONG BlockIndex;
+
+    /* Number of blocks in the run */
+    ULONG BlockCount;
+} HLOG_RUN, *PHLOG_RUN;
+
+typedef struct _HLOG_ENTRY
+{
+    /* Entry identifier "HvLE" (0x454c7648) */
+    ULONG Signature;
+
+    /* Size in bytes of the whole entry, multiple of the block size (4KB) */
+    ULONG Size;
+
+    /* One more than the previous entry, or than the log header Sequence1 */
+    ULONG Sequence;
+
+    /* Length of the hive once this entry is applied */
+    ULONG HiveLength;
+
+    /* Number of runs */
+    ULONG RunCount;
+
+    /* Checksum of the whole entry, computed with this field zeroed */
+    ULONG CheckSum;
+
+    HLOG_RUN Runs[ANYSIZE_ARRAY];
+} HLOG_ENTRY, *PHLOG_ENTRY;
+
+#define HV_LOG_ENTRY_HEADER_SIZE(RunCount) \
+    ROUND_UP(FIELD_OFFSET(HLOG_ENTRY, Runs) + (RunCount) * sizeof(HLOG_RUN), HBLOCK_SIZE)
+
 #include <poppack.h>
 
 struct _HHIVE;
@@ -248,6 +290,11 @@ typedef BOOLEAN
     ULONG Length
 );
 
+//
+// MemAlloc holds the size of the bin on the first block of each bin. For a
+// mapped hive, CmView is the view the bin is currently mapped through, and
+// BlockAddress is zero while the bin is not mapped.
+//
 typedef struct _HMAP_ENTRY
 {
     ULONG_PTR BlockAddress;
@@ -266,14 +313,33 @@ typedef struct _HMAP_DIRECTORY
     PHMAP_TABLE Directory[2048];
 } HMAP_DIRECTORY, *PHMAP_DIRECTORY;
 
+//
+// Free cells of one size class. They are tracked here rather than linked
+// through the cells themselves, so that the bins of a mapped hive can be
+// dropped and read back from the file without losing the list. The size
+// is kept next to the cell so that finding a fit never touches the bins.
+//
+typedef struct _HFREE_CELL
+{
+    HCELL_INDEX Cell;
+    ULONG Size;
+} HFREE_CELL, *PHFREE_CELL;
+
+typedef struct _HFREE_DISPLAY
+{
+    ULONG Count;
+    ULONG Size;
+    PHFREE_CELL Cells;
+} HFREE_DISPLAY, *PHFREE_DISPLAY;
+
 typedef struct _DUAL
 {
     ULONG Length;
     PHMAP_DIRECTORY Map;
     PHMAP_ENTRY BlockList; // PHMAP_TABLE SmallDir;
     ULONG Guard;
-    HCELL_INDEX FreeDisplay[24]; // FREE_DISPLAY FreeDisplay[24];
-    ULONG FreeSummary;
+    HFREE_DISPLAY FreeDisplay[24]; // FREE_DISPLAY FreeDisplay[24];
+    ULONG FreeSummary; // Bit N set when FreeDisplay[N] is not empty
     LIST_ENTRY FreeBins;
 } DUAL, *PDUAL;
 
@@ -320,6 +386,17 @@ typedef struct _HHIVE
     ULONG StorageTypeCount;
     ULONG Version;
     DUAL Storage[HTYPE_COUNT];
+
+    /*
+     * Incremental flush state. With LogAppend set, flushes append the dirty
+     * blocks to the log and move them to UnreconciledVector until they get
+     * written to the primary by HvReconcileHive. LogOffset is where the next
+     * entry goes, zero if the log must be reset first.
+     */
+    BOOLEAN LogAppend;
+    ULONG LogOffset;
+    ULONG LogSequence;
+    RTL_BITMAP UnreconciledVector;
 } HHIVE, *PHHIVE;
 
 #define IsFreeCell(Cell)    ((Cell)->Size >= 0)
@@ -9,6 +9,9 @@
 #define NDEBUG
 #include <debug.h>
 
+/* How much of the file is read at once when scanning the bins of a mapped hive */
+#define HV_MAP_SCAN_SIZE    (64 * HBLOCK_SIZE)
+
 /**
  * @name HvpVerifyHiveHeader
  *
@@ -48,6 +51,8 @@ HvpVerifyHiveHeader(
  * @name HvpFreeHiveBins
  *
  * Internal function to free all bin storage associated with a hive descriptor.
+ * Bins mapped through views of the hive file belong to the host and are left
+ * alone.
  */
 VOID CMAPI
 HvpFreeHiveBins(
@@ -57,12 +62,15 @@ HvpFreeHiveBins(
     PHBIN Bin;
     ULONG Storage;
 
+    HvpFreeHiveFreeCellList(Hive);
+
     for (Storage = 0; Storage < Hive->StorageTypeCount; Storage++)
     {
         Bin = NULL;
         for (i = 0; i < Hive->Storage[Storage].Length; i++)
         {
-            if (Hive->Storage[Storage].BlockList[i].BinAddress == (ULONG_PTR)NULL)
+            if (Hive->Storage[Storage].BlockList[i].BinAddress == (ULONG_PTR)NULL ||
+                Hive->Storage[Storage].BlockList[i].CmView != NULL)
                 continue;
             if (Hive->Storage[Storage].BlockList[i].BinAddress != (ULONG_PTR)Bin)
             {
@@ -162,7 +170,6 @@ HvpCreateHive(
     IN PCUNICODE_STRING FileName OPTIONAL)
 {
     PHBASE_BLOCK BaseBlock;
-    ULONG Index;
 
     /* Allocate the base block */
     BaseBlock = HvpAllocBaseBlockAligned(RegistryHive, FALSE, TAG_CM);
@@ -197,11 +204,7 @@ HvpCreateHive(
     RegistryHive->BaseBlock = BaseBlock;
     RegistryHive->Version = BaseBlock->Minor; // == HSYS_MINOR
 
-    for (Index = 0; Index < 24; Index++)
-    {
-        RegistryHive->Storage[Stable].FreeDisplay[Index] = HCELL_NIL;
-        RegistryHive->Storage[Volatile].FreeDisplay[Index] = HCELL_NIL;
-    }
+    /* The free cell lists start out empty, as HvInitialize cleared them */
 
     HvpInitFileName(BaseBlock, FileName);
 
@@ -267,6 +270,9 @@ HvpInitializeMemoryHive(
         return STATUS_NO_MEMORY;
     }
 
+    RtlZeroMemory(Hive->Storage[Stable].BlockList,
+                  Hive->Storage[Stable].Length * sizeof(HMAP_ENTRY));
+
     for (BlockIndex = 0; BlockIndex < Hive->Storage[Stable].Length; )
     {
         Bin = (PHBIN)((ULONG_PTR)ChunkBase + (BlockIndex + 1) * HBLOCK_SIZE);
@@ -290,6 +296,7 @@ HvpInitializeMemoryHive(
 
         Hive->Storage[Stable].BlockList[BlockIndex].BinAddress = (ULONG_PTR)NewBin;
         Hive->Storage[Stable].BlockList[BlockIndex].BlockAddress = (ULONG_PTR)NewBin;
+        Hive->Storage[Stable].BlockList[BlockIndex].MemAlloc = Bin->Size;
 
         RtlCopyMemory(NewBin, Bin, Bin->Size);
 
@@ -423,6 +430,13 @@ HvLoadHive(IN PHHIVE Hive,
     PVOID HiveData;
     ULONG FileSize;
 
+    /* Replay what the log holds before looking at the primary */
+    if (Hive->Log)
+    {
+        Status = HvpRecoverFromLog(Hive);
+        if (!NT_SUCCESS(Status)) return Status;
+    }
+
     /* Get the hive header */
     Result = HvpGetHiveHeader(Hive, &BaseBlock, &TimeStamp);
     switch (Result)
@@ -488,6 +502,169 @@ HvLoadHive(IN PHHIVE Hive,
     return Status;
 }
 
+/**
+ * @name HvpInitializeMappedHive
+ *
+ * Internal helper function to initialize hive descriptor structure for
+ * a hive whose bins stay in its primary file. Only the layout of the bins
+ * is read here, the bins themselves are mapped in on demand through the
+ * hive GetCellRoutine.
+ *
+ * @see HvInitialize
+ */
+NTSTATUS CMAPI
+HvpInitializeMappedHive(
+    IN PHHIVE Hive,
+    IN PCUNICODE_STRING FileName OPTIONAL)
+{
+    NTSTATUS Status;
+    PHBASE_BLOCK BaseBlock = NULL;
+    LARGE_INTEGER TimeStamp;
+    PHMAP_ENTRY BlockList;
+    PUCHAR Buffer;
+    ULONG BufferOffset, BufferLength;
+    ULONG BlockIndex, BinOffset, Offset;
+    ULONG BitmapSize;
+    PULONG BitmapBuffer;
+    PHBIN Bin;
+    ULONG Result;
+
+    /* Replay what the log holds before looking at the primary */
+    if (Hive->Log)
+    {
+        Status = HvpRecoverFromLog(Hive);
+        if (!NT_SUCCESS(Status)) return Status;
+    }
+
+    /* Get the hive header */
+    Result = HvpGetHiveHeader(Hive, &BaseBlock, &TimeStamp);
+    switch (Result)
+    {
+        /* Out of memory */
+        case NoMemory:
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        /* Not a hive */
+        case NotHive:
+            return STATUS_NOT_REGISTRY_FILE;
+
+        /* Has recovery data */
+        case RecoverData:
+        case RecoverHeader:
+            return STATUS_REGISTRY_CORRUPT;
+    }
+
+    if (BaseBlock->Length % HBLOCK_SIZE)
+    {
+        DPRINT1("Invalid hive length 0x%x\n", BaseBlock->Length);
+        Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+        return STATUS_REGISTRY_CORRUPT;
+    }
+
+    /* Set default boot type */
+    BaseBlock->BootType = 0;
+
+    /* Setup hive data */
+    Hive->BaseBlock = BaseBlock;
+    Hive->Version = BaseBlock->Minor;
+
+    /* Allocate an empty block list, nothing is mapped yet */
+    Hive->Storage[Stable].Length = BaseBlock->Length / HBLOCK_SIZE;
+    BlockList = Hive->Allocate(Hive->Storage[Stable].Length * sizeof(HMAP_ENTRY),
+                               TRUE,
+                               TAG_CM);
+    if (BlockList == NULL)
+    {
+        Hive->Storage[Stable].Length = 0;
+        Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+        return STATUS_NO_MEMORY;
+    }
+
+    RtlZeroMemory(BlockList, Hive->Storage[Stable].Length * sizeof(HMAP_ENTRY));
+    Hive->Storage[Stable].BlockList = BlockList;
+
+    /*
+     * Find out where each bin starts, which is all the host needs to map
+     * them later. The headers are read through a large buffer so that the
+     * file is read sequentially; the offsets and lengths stay multiples of
+     * the block size, as the primary may be opened without buffering.
+     */
+    Buffer = Hive->Allocate(HV_MAP_SCAN_SIZE, TRUE, TAG_CM);
+    if (Buffer == NULL)
+    {
+        Status = STATUS_NO_MEMORY;
+        goto Cleanup;
+    }
+
+    BufferOffset = 0;
+    BufferLength = 0;
+    for (BlockIndex = 0; BlockIndex < Hive->Storage[Stable].Length; )
+    {
+        BinOffset = BlockIndex * HBLOCK_SIZE;
+
+        /* Read the next part of the file if this bin header isn't buffered */
+        if ((BinOffset < BufferOffset) ||
+            (BinOffset + sizeof(HBIN) > BufferOffset + BufferLength))
+        {
+            BufferOffset = BinOffset;
+            BufferLength = min(HV_MAP_SCAN_SIZE, BaseBlock->Length - BinOffset);
+            Offset = HBLOCK_SIZE + BinOffset;
+            if (!Hive->FileRead(Hive, HFILE_TYPE_PRIMARY, &Offset, Buffer, BufferLength))
+            {
+                Hive->Free(Buffer, 0);
+                Status = STATUS_REGISTRY_IO_FAILED;
+                goto Cleanup;
+            }
+        }
+
+        Bin = (PHBIN)(Buffer + BinOffset - BufferOffset);
+        if (Bin->Signature != HV_BIN_SIGNATURE ||
+            Bin->FileOffset != BinOffset ||
+            Bin->Size == 0 ||
+            (Bin->Size % HBLOCK_SIZE) != 0 ||
+            Bin->Size > BaseBlock->Length - BinOffset)
+        {
+            DPRINT1("Invalid bin at BlockIndex %lu, Signature 0x%x, Size 0x%x\n",
+                    BlockIndex, (unsigned)Bin->Signature, (unsigned)Bin->Size);
+            Hive->Free(Buffer, 0);
+            Status = STATUS_REGISTRY_CORRUPT;
+            goto Cleanup;
+        }
+
+        BlockList[BlockIndex].MemAlloc = Bin->Size;
+        BlockIndex += Bin->Size / HBLOCK_SIZE;
+    }
+
+    Hive->Free(Buffer, 0);
+
+    /* This maps every bin once; the host drops the views again afterwards */
+    Status = HvpCreateHiveFreeCellList(Hive);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    BitmapSize = ROUND_UP(Hive->Storage[Stable].Length,
+                          sizeof(ULONG) * 8) / 8;
+    BitmapBuffer = (PULONG)Hive->Allocate(BitmapSize, TRUE, TAG_CM);
+    if (BitmapBuffer == NULL)
+    {
+        Status = STATUS_NO_MEMORY;
+        goto Cleanup;
+    }
+
+    RtlInitializeBitMap(&Hive->DirtyVector, BitmapBuffer, BitmapSize * 8);
+    RtlClearAllBits(&Hive->DirtyVector);
+
+    HvpInitFileName(Hive->BaseBlock, FileName);
+
+    return STATUS_SUCCESS;
+
+Cleanup:
+    HvpFreeHiveBins(Hive);
+    Hive->Free(Hive->BaseBlock, Hive->BaseBlockAlloc);
+    Hive->BaseBlock = NULL;
+    return Status;
+}
+
 /**
  * @name HvInitialize
  *
@@ -506,6 +683,11 @@ HvLoadHive(IN PHHIVE Hive,
  *          Load an in-memory hive for read-only access. The pointer
  *          to data passed to this routine MUSTN'T be freed until
  *          HvFree is called.
+ *        - HINIT_MAPFILE
+ *          Load a hive from its primary file for read/write access,
+ *          leaving the bins in the file. The data passed to this routine
+ *          is the PGET_CELL_ROUTINE through which all the cells of the
+ *          hive are then looked up, which maps their bins in as needed.
  * @param ChunkBase
  *        Pointer to hive data.
  * @param ChunkSize
@@ -588,12 +770,15 @@ HvInitialize(
             break;
         }
 
+        case HINIT_MAPFILE:
+            Hive->GetCellRoutine = (PGET_CELL_ROUTINE)HiveData;
+            Status = HvpInitializeMappedHive(Hive, FileName);
+            break;
+
         case HINIT_MEMORY_INPLACE:
             // Status = HvpInitializeMemoryInplaceHive(Hive, HiveData);
             // break;
 
-        case HINIT_MAPFILE:
-
         default:
         /* FIXME: A better return status value is needed */
         Status = STATUS_NOT_IMPLEMENTED;
@@ -602,6 +787,18 @@ HvInitialize(
 
     if (!NT_SUCCESS(Status)) return Status;
 
+    /*
+     * Hives loaded from a file with a log get their flushes appended to the
+     * log. The others are written through to the primary, either because
+     * there is nothing to replay a log into yet or because their primary
+     * gets read without the log, like the system hive by the boot loader.
+     */
+    if (Hive->Log &&
+        (OperationType == HINIT_FILE || OperationType == HINIT_MAPFILE))
+    {
+        Hive->LogAppend = TRUE;
+    }
+
     /* HACK: ROS: Init root key cell and prepare the hive */
     // r31253
     // if (OperationType == HINIT_CREATE) CmCreateRootNode(Hive, L"");
@@ -628,6 +825,12 @@ HvFree(
             RegistryHive->Free(RegistryHive->DirtyVector.Buffer, 0);
         }
 
+        /* Release the bitmap of the blocks waiting for reconciliation */
+        if (RegistryHive->UnreconciledVector.Buffer)
+        {
+            RegistryHive->Free(RegistryHive->UnreconciledVector.Buffer, 0);
+        }
+
         HvpFreeHiveBins(RegistryHive);
 
         /* Free the BaseBlock */
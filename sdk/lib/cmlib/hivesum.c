@@ -30,3 +30,25 @@ HvpHiveHeaderChecksum(
 
     return Sum;
 }
+
+/**
+ * @name HvpLogEntryChecksum
+ *
+ * Accumulate the checksum of a part of a hive log entry and return it. The
+ * parts of an entry are summed in order, starting from HV_LOG_ENTRY_SIGNATURE.
+ */
+
+ULONG CMAPI
+HvpLogEntryChecksum(
+    ULONG Sum,
+    PVOID Buffer,
+    ULONG Length)
+{
+    PULONG Data = (PULONG)Buffer;
+    ULONG i;
+
+    for (i = 0; i < Length / sizeof(ULONG); i++)
+        Sum = ((Sum << 5) | (Sum >> 27)) + Data[i];
+
+    return Sum;
+}
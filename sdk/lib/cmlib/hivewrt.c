@@ -9,149 +9,274 @@
 #define NDEBUG
 #include <debug.h>
 
-static BOOLEAN CMAPI
-HvpWriteLog(
+/* How many blocks get gathered for a single write to the primary or the log */
+#define HV_WRITE_BATCH_BLOCKS   64
+
+/**
+ * @name HvpFindNextRun
+ *
+ * Internal helper to find the first run of set bits of a block bitmap at
+ * or after BlockIndex, without going past Length blocks.
+ */
+static BOOLEAN
+HvpFindNextRun(
+    PRTL_BITMAP Bitmap,
+    ULONG Length,
+    PULONG BlockIndex,
+    PULONG BlockCount)
+{
+    ULONG Start, End;
+
+    if (Length > Bitmap->SizeOfBitMap)
+        Length = Bitmap->SizeOfBitMap;
+    if (*BlockIndex >= Length)
+        return FALSE;
+
+    Start = RtlFindSetBits(Bitmap, 1, *BlockIndex);
+    if (Start == ~0U || Start < *BlockIndex || Start >= Length)
+        return FALSE;
+
+    End = Start + 1;
+    while (End < Length && RtlCheckBit(Bitmap, End))
+        End++;
+
+    *BlockIndex = Start;
+    *BlockCount = End - Start;
+    return TRUE;
+}
+
+/**
+ * @name HvpWriteBlocks
+ *
+ * Internal helper to write a run of stable blocks at FileOffset, which is
+ * moved past them. The blocks are gathered into Buffer, if there is one, so
+ * that the run takes as few writes as possible.
+ */
+static BOOLEAN
+HvpWriteBlocks(
+    PHHIVE RegistryHive,
+    ULONG FileType,
+    PULONG FileOffset,
+    ULONG BlockIndex,
+    ULONG BlockCount,
+    PUCHAR Buffer OPTIONAL)
+{
+    PVOID BlockPtr = NULL;
+    ULONG Count, i;
+
+    while (BlockCount)
+    {
+        Count = Buffer ? min(BlockCount, HV_WRITE_BATCH_BLOCKS) : 1;
+        for (i = 0; i < Count; i++)
+        {
+            BlockPtr = HvpGetBlockAddress(RegistryHive, Stable, BlockIndex + i);
+            if (BlockPtr == NULL)
+            {
+                return FALSE;
+            }
+
+            if (Buffer)
+            {
+                RtlCopyMemory(Buffer + i * HBLOCK_SIZE, BlockPtr, HBLOCK_SIZE);
+            }
+        }
+
+        if (!RegistryHive->FileWrite(RegistryHive, FileType, FileOffset,
+                                     Buffer ? Buffer : BlockPtr,
+                                     Count * HBLOCK_SIZE))
+        {
+            return FALSE;
+        }
+
+        *FileOffset += Count * HBLOCK_SIZE;
+        BlockIndex += Count;
+        BlockCount -= Count;
+    }
+
+    return TRUE;
+}
+
+/**
+ * @name HvpResetLog
+ *
+ * Internal function to empty the log of a hive, once everything it held is
+ * in the primary. The log header is a copy of the base block, stamped with
+ * the sequence number the first entry follows.
+ */
+static BOOLEAN
+HvpResetLog(
     PHHIVE RegistryHive)
 {
-    ULONG FileOffset;
-    UINT32 BufferSize;
-    UINT32 BitmapSize;
-    PUCHAR Buffer;
-    PUCHAR Ptr;
-    ULONG BlockIndex;
-    ULONG LastIndex;
-    PVOID BlockPtr;
+    PHBASE_BLOCK LogHeader;
+    ULONG FileOffset = 0;
     BOOLEAN Success;
-    static ULONG PrintCount = 0;
 
-    if (PrintCount++ == 0)
+    LogHeader = RegistryHive->Allocate(HBLOCK_SIZE, FALSE, TAG_CM);
+    if (LogHeader == NULL)
     {
-        UNIMPLEMENTED;
+        return FALSE;
     }
+
+    RtlCopyMemory(LogHeader, RegistryHive->BaseBlock, HBLOCK_SIZE);
+    LogHeader->Type = HFILE_TYPE_LOG;
+    LogHeader->Sequence1 = RegistryHive->BaseBlock->Sequence2;
+    LogHeader->Sequence2 = RegistryHive->BaseBlock->Sequence2;
+    LogHeader->CheckSum = HvpHiveHeaderChecksum(LogHeader);
+
+    Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
+                                      &FileOffset, LogHeader, HBLOCK_SIZE) &&
+              RegistryHive->FileSetSize(RegistryHive, HFILE_TYPE_LOG,
+                                        HBLOCK_SIZE, HBLOCK_SIZE) &&
+              RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_LOG, NULL, 0);
+    RegistryHive->Free(LogHeader, 0);
+
+    if (!Success)
+    {
+        DPRINT1("Failed to reset the hive log\n");
+        return FALSE;
+    }
+
+    RegistryHive->LogOffset = HBLOCK_SIZE;
+    RegistryHive->LogSequence = RegistryHive->BaseBlock->Sequence2;
     return TRUE;
+}
+
+/**
+ * @name HvpWriteLog
+ *
+ * Internal function to append the dirty blocks of a hive to its log as a
+ * single entry. The flush is complete once the entry is on disk, the blocks
+ * only reach the primary when the hive gets reconciled.
+ */
+static BOOLEAN CMAPI
+HvpWriteLog(
+    PHHIVE RegistryHive)
+{
+    PHLOG_ENTRY Entry;
+    PUCHAR Buffer;
+    ULONG Length = RegistryHive->Storage[Stable].Length;
+    ULONG BlockIndex, BlockCount;
+    ULONG RunCount = 0, DirtyBlocks = 0;
+    ULONG HeaderSize, FileOffset, Sum, i, j;
+    PVOID BlockPtr;
+    BOOLEAN Success = FALSE;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
+    ASSERT(RegistryHive->LogAppend);
     ASSERT(RegistryHive->BaseBlock->Length ==
            RegistryHive->Storage[Stable].Length * HBLOCK_SIZE);
 
     DPRINT("HvpWriteLog called\n");
 
-    if (RegistryHive->BaseBlock->Sequence1 !=
-        RegistryHive->BaseBlock->Sequence2)
+    /* Start over with an empty log after a load or a reconciliation */
+    if (RegistryHive->LogOffset == 0 && !HvpResetLog(RegistryHive))
     {
         return FALSE;
     }
 
-    BitmapSize = RegistryHive->DirtyVector.SizeOfBitMap;
-    BufferSize = HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize;
-    BufferSize = ROUND_UP(BufferSize, HBLOCK_SIZE);
+    /* Size the entry */
+    BlockIndex = 0;
+    while (HvpFindNextRun(&RegistryHive->DirtyVector, Length, &BlockIndex, &BlockCount))
+    {
+        RunCount++;
+        DirtyBlocks += BlockCount;
+        BlockIndex += BlockCount;
+    }
 
-    DPRINT("Bitmap size %u  buffer size: %u\n", BitmapSize, BufferSize);
+    if (RunCount == 0)
+    {
+        return TRUE;
+    }
 
-    Buffer = RegistryHive->Allocate(BufferSize, TRUE, TAG_CM);
-    if (Buffer == NULL)
+    HeaderSize = HV_LOG_ENTRY_HEADER_SIZE(RunCount);
+    Entry = RegistryHive->Allocate(HeaderSize, TRUE, TAG_CM);
+    if (Entry == NULL)
     {
         return FALSE;
     }
+    RtlZeroMemory(Entry, HeaderSize);
 
-    /* Update first update counter and CheckSum */
-    RegistryHive->BaseBlock->Type = HFILE_TYPE_LOG;
-    RegistryHive->BaseBlock->Sequence1++;
-    RegistryHive->BaseBlock->CheckSum =
-        HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
-
-    /* Copy hive header */
-    RtlCopyMemory(Buffer, RegistryHive->BaseBlock, HV_LOG_HEADER_SIZE);
-    Ptr = Buffer + HV_LOG_HEADER_SIZE;
-    RtlCopyMemory(Ptr, "DIRT", 4);
-    Ptr += 4;
-    RtlCopyMemory(Ptr, RegistryHive->DirtyVector.Buffer, BitmapSize);
+    /* Without a staging buffer the blocks simply get written one by one */
+    Buffer = RegistryHive->Allocate(HV_WRITE_BATCH_BLOCKS * HBLOCK_SIZE, FALSE, TAG_CM);
 
-    /* Write hive block and block bitmap */
-    FileOffset = 0;
-    Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                      &FileOffset, Buffer, BufferSize);
-    RegistryHive->Free(Buffer, 0);
+    Entry->Signature = HV_LOG_ENTRY_SIGNATURE;
+    Entry->Size = HeaderSize + DirtyBlocks * HBLOCK_SIZE;
+    Entry->Sequence = RegistryHive->LogSequence + 1;
+    Entry->HiveLength = RegistryHive->BaseBlock->Length;
+    Entry->RunCount = RunCount;
 
-    if (!Success)
+    BlockIndex = 0;
+    for (i = 0; i < RunCount; i++)
     {
-        return FALSE;
+        HvpFindNextRun(&RegistryHive->DirtyVector, Length, &BlockIndex, &BlockCount);
+        Entry->Runs[i].BlockIndex = BlockIndex;
+        Entry->Runs[i].BlockCount = BlockCount;
+        BlockIndex += BlockCount;
     }
 
-    /* Write dirty blocks */
-    FileOffset = BufferSize;
-    BlockIndex = 0;
-    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    /* Checksum the header, then the blocks in the order they get written */
+    Sum = HvpLogEntryChecksum(HV_LOG_ENTRY_SIGNATURE, Entry, HeaderSize);
+    for (i = 0; i < RunCount; i++)
     {
-        LastIndex = BlockIndex;
-        BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-        if (BlockIndex == ~0U || BlockIndex < LastIndex)
+        for (j = 0; j < Entry->Runs[i].BlockCount; j++)
         {
-            break;
-        }
-
-        BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
+            BlockPtr = HvpGetBlockAddress(RegistryHive, Stable,
+                                          Entry->Runs[i].BlockIndex + j);
+            if (BlockPtr == NULL)
+            {
+                goto Quit;
+            }
 
-        /* Write hive block */
-        Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                         &FileOffset, BlockPtr, HBLOCK_SIZE);
-        if (!Success)
-        {
-            return FALSE;
+            Sum = HvpLogEntryChecksum(Sum, BlockPtr, HBLOCK_SIZE);
         }
-
-        BlockIndex++;
-        FileOffset += HBLOCK_SIZE;
     }
+    Entry->CheckSum = Sum;
 
-    Success = RegistryHive->FileSetSize(RegistryHive, HFILE_TYPE_LOG, FileOffset, FileOffset);
-    if (!Success)
+    /* Append the entry, a failure leaves the next attempt to overwrite it */
+    FileOffset = RegistryHive->LogOffset;
+    Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
+                                      &FileOffset, Entry, HeaderSize);
+    FileOffset += HeaderSize;
+    for (i = 0; Success && i < RunCount; i++)
     {
-        DPRINT("FileSetSize failed\n");
-        return FALSE;
+        Success = HvpWriteBlocks(RegistryHive, HFILE_TYPE_LOG, &FileOffset,
+                                 Entry->Runs[i].BlockIndex,
+                                 Entry->Runs[i].BlockCount,
+                                 Buffer);
     }
 
-    /* Flush the log file */
-    Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_LOG, NULL, 0);
-    if (!Success)
+    /* The flush only counts once the entry is on disk */
+    if (Success)
     {
-        DPRINT("FileFlush failed\n");
+        Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_LOG, NULL, 0);
     }
 
-    /* Update second update counter and CheckSum */
-    RegistryHive->BaseBlock->Sequence2++;
-    RegistryHive->BaseBlock->CheckSum =
-        HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
-
-    /* Write hive header again with updated sequence counter. */
-    FileOffset = 0;
-    Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                      &FileOffset, RegistryHive->BaseBlock,
-                                      HV_LOG_HEADER_SIZE);
-    if (!Success)
+    if (Success)
     {
-        return FALSE;
+        RegistryHive->LogOffset = FileOffset;
+        RegistryHive->LogSequence++;
     }
-
-    /* Flush the log file */
-    Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_LOG, NULL, 0);
-    if (!Success)
+    else
     {
-        DPRINT("FileFlush failed\n");
+        DPRINT1("Failed to append to the hive log\n");
     }
 
-    return TRUE;
+Quit:
+    if (Buffer) RegistryHive->Free(Buffer, 0);
+    RegistryHive->Free(Entry, 0);
+    return Success;
 }
 
 static BOOLEAN CMAPI
 HvpWriteHive(
     PHHIVE RegistryHive,
-    BOOLEAN OnlyDirty)
+    PRTL_BITMAP Blocks OPTIONAL)
 {
     ULONG FileOffset;
     ULONG BlockIndex;
-    ULONG LastIndex;
-    PVOID BlockPtr;
+    ULONG BlockCount;
+    ULONG Length;
+    PUCHAR Buffer;
     BOOLEAN Success;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
@@ -182,33 +307,43 @@ HvpWriteHive(
         return FALSE;
     }
 
+    /* Write the blocks in ascending order, each run in as few writes as possible */
+    Buffer = RegistryHive->Allocate(HV_WRITE_BATCH_BLOCKS * HBLOCK_SIZE, FALSE, TAG_CM);
+    Length = RegistryHive->Storage[Stable].Length;
     BlockIndex = 0;
-    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    while (TRUE)
     {
-        if (OnlyDirty)
+        if (Blocks)
+        {
+            if (!HvpFindNextRun(Blocks, Length, &BlockIndex, &BlockCount))
+            {
+                break;
+            }
+        }
+        else
         {
-            LastIndex = BlockIndex;
-            BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-            if (BlockIndex == ~0U || BlockIndex < LastIndex)
+            if (BlockIndex >= Length)
             {
                 break;
             }
+            BlockCount = Length - BlockIndex;
         }
 
-        BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
+        /* Write hive blocks */
         FileOffset = (BlockIndex + 1) * HBLOCK_SIZE;
-
-        /* Write hive block */
-        Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
-                                          &FileOffset, BlockPtr, HBLOCK_SIZE);
+        Success = HvpWriteBlocks(RegistryHive, HFILE_TYPE_PRIMARY, &FileOffset,
+                                 BlockIndex, BlockCount, Buffer);
         if (!Success)
         {
+            if (Buffer) RegistryHive->Free(Buffer, 0);
             return FALSE;
         }
 
-        BlockIndex++;
+        BlockIndex += BlockCount;
     }
 
+    if (Buffer) RegistryHive->Free(Buffer, 0);
+
     Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_PRIMARY, NULL, 0);
     if (!Success)
     {
@@ -239,10 +374,48 @@ HvpWriteHive(
     return TRUE;
 }
 
+/**
+ * @name HvpGrowUnreconciledVector
+ *
+ * Internal helper to make the unreconciled bitmap of a hive as large as its
+ * dirty bitmap, which grows along with the hive.
+ */
+static BOOLEAN
+HvpGrowUnreconciledVector(
+    PHHIVE RegistryHive)
+{
+    PRTL_BITMAP Unreconciled = &RegistryHive->UnreconciledVector;
+    ULONG BitmapSize = RegistryHive->DirtyVector.SizeOfBitMap / 8;
+    PULONG BitmapBuffer;
+
+    if (Unreconciled->SizeOfBitMap >= RegistryHive->DirtyVector.SizeOfBitMap)
+    {
+        return TRUE;
+    }
+
+    BitmapBuffer = RegistryHive->Allocate(BitmapSize, TRUE, TAG_CM);
+    if (BitmapBuffer == NULL)
+    {
+        return FALSE;
+    }
+
+    RtlZeroMemory(BitmapBuffer, BitmapSize);
+    if (Unreconciled->SizeOfBitMap > 0)
+    {
+        RtlCopyMemory(BitmapBuffer, Unreconciled->Buffer, Unreconciled->SizeOfBitMap / 8);
+        RegistryHive->Free(Unreconciled->Buffer, 0);
+    }
+
+    RtlInitializeBitMap(Unreconciled, BitmapBuffer, BitmapSize * 8);
+    return TRUE;
+}
+
 BOOLEAN CMAPI
 HvSyncHive(
     PHHIVE RegistryHive)
 {
+    ULONG i;
+
     ASSERT(RegistryHive->ReadOnly == FALSE);
 
     if (RtlFindSetBits(&RegistryHive->DirtyVector, 1, 0) == ~0U)
@@ -253,16 +426,33 @@ HvSyncHive(
     /* Update hive header modification time */
     KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
 
-    /* Update log file */
-    if (!HvpWriteLog(RegistryHive))
+    if (RegistryHive->LogAppend)
     {
-        return FALSE;
-    }
+        /* Make sure the blocks can be remembered before logging them */
+        if (!HvpGrowUnreconciledVector(RegistryHive))
+        {
+            return FALSE;
+        }
 
-    /* Update hive file */
-    if (!HvpWriteHive(RegistryHive, TRUE))
+        /* Update log file, the primary only gets them on reconciliation */
+        if (!HvpWriteLog(RegistryHive))
+        {
+            return FALSE;
+        }
+
+        for (i = 0; i < RegistryHive->DirtyVector.SizeOfBitMap / 32; i++)
+        {
+            RegistryHive->UnreconciledVector.Buffer[i] |=
+                RegistryHive->DirtyVector.Buffer[i];
+        }
+    }
+    else
     {
-        return FALSE;
+        /* Update hive file */
+        if (!HvpWriteHive(RegistryHive, &RegistryHive->DirtyVector))
+        {
+            return FALSE;
+        }
     }
 
     /* Clear dirty bitmap. */
@@ -272,6 +462,337 @@ HvSyncHive(
     return TRUE;
 }
 
+/**
+ * @name HvReconcileHive
+ *
+ * Flush a hive, then write everything its log holds to the primary in
+ * sorted batches and empty the log. The caller must keep the hive from
+ * being flushed or dirtied meanwhile.
+ */
+BOOLEAN CMAPI
+HvReconcileHive(
+    PHHIVE RegistryHive)
+{
+    ASSERT(RegistryHive->ReadOnly == FALSE);
+
+    /* Get everything in the log first, the primary only gets logged blocks */
+    if (!HvSyncHive(RegistryHive))
+    {
+        return FALSE;
+    }
+
+    if (!RegistryHive->LogAppend ||
+        RtlFindSetBits(&RegistryHive->UnreconciledVector, 1, 0) == ~0U)
+    {
+        return TRUE;
+    }
+
+    /* Keep the primary sequence above the ones of the log entries */
+    RegistryHive->BaseBlock->Sequence1 = RegistryHive->LogSequence;
+    RegistryHive->BaseBlock->Sequence2 = RegistryHive->LogSequence;
+
+    if (!HvpWriteHive(RegistryHive, &RegistryHive->UnreconciledVector))
+    {
+        return FALSE;
+    }
+
+    RtlClearAllBits(&RegistryHive->UnreconciledVector);
+
+    /* The log is no longer needed, if this fails it is reset on the next flush */
+    RegistryHive->LogOffset = 0;
+    HvpResetLog(RegistryHive);
+
+    return TRUE;
+}
+
+/**
+ * @name HvIsRangeDirty
+ *
+ * Check whether any stable block of a range is dirty, or logged but not
+ * yet reconciled, so the memory holding it must be kept.
+ */
+BOOLEAN CMAPI
+HvIsRangeDirty(
+    PHHIVE RegistryHive,
+    ULONG BlockIndex,
+    ULONG BlockCount)
+{
+    PRTL_BITMAP Bitmaps[2];
+    ULONG i, Count;
+
+    Bitmaps[0] = &RegistryHive->DirtyVector;
+    Bitmaps[1] = &RegistryHive->UnreconciledVector;
+
+    for (i = 0; i < RTL_NUMBER_OF(Bitmaps); i++)
+    {
+        if (BlockIndex >= Bitmaps[i]->SizeOfBitMap)
+            continue;
+
+        Count = min(BlockCount, Bitmaps[i]->SizeOfBitMap - BlockIndex);
+        if (!RtlAreBitsClear(Bitmaps[i], BlockIndex, Count))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * @name HvpReadLogEntry
+ *
+ * Internal helper of HvpRecoverFromLog. Reads the header of the log entry
+ * at FileOffset and checks that it is the entry of the given sequence and
+ * that all of it made it to the log. Returns the header, to be freed by the
+ * caller, or NULL if there's no such entry.
+ */
+static PHLOG_ENTRY
+HvpReadLogEntry(
+    PHHIVE RegistryHive,
+    ULONG FileOffset,
+    ULONG Sequence,
+    PUCHAR Buffer)
+{
+    PHLOG_ENTRY Entry;
+    ULONG HeaderSize, MaxBlocks, DataBlocks, Offset, Count, Sum, CheckSum, i;
+
+    /* Look at the start of the entry first */
+    Offset = FileOffset;
+    RtlZeroMemory(Buffer, HBLOCK_SIZE);
+    if (!RegistryHive->FileRead(RegistryHive, HFILE_TYPE_LOG, &Offset,
+                                Buffer, HBLOCK_SIZE))
+    {
+        return NULL;
+    }
+
+    Entry = (PHLOG_ENTRY)Buffer;
+    MaxBlocks = Entry->HiveLength / HBLOCK_SIZE;
+    if (Entry->Signature != HV_LOG_ENTRY_SIGNATURE ||
+        Entry->Sequence != Sequence ||
+        Entry->HiveLength == 0 ||
+        Entry->HiveLength % HBLOCK_SIZE ||
+        Entry->RunCount == 0 ||
+        Entry->RunCount > MaxBlocks ||
+        Entry->Size % HBLOCK_SIZE)
+    {
+        return NULL;
+    }
+
+    /* Get the whole header */
+    HeaderSize = HV_LOG_ENTRY_HEADER_SIZE(Entry->RunCount);
+    Entry = RegistryHive->Allocate(HeaderSize, FALSE, TAG_CM);
+    if (Entry == NULL)
+    {
+        return NULL;
+    }
+
+    Offset = FileOffset;
+    if (HeaderSize == HBLOCK_SIZE)
+    {
+        RtlCopyMemory(Entry, Buffer, HBLOCK_SIZE);
+    }
+    else if (!RegistryHive->FileRead(RegistryHive, HFILE_TYPE_LOG, &Offset,
+                                     Entry, HeaderSize))
+    {
+        goto Invalid;
+    }
+
+    /* The runs must lie within the hive and add up to the entry size */
+    DataBlocks = 0;
+    for (i = 0; i < Entry->RunCount; i++)
+    {
+        if (Entry->Runs[i].BlockCount == 0 ||
+            Entry->Runs[i].BlockIndex >= MaxBlocks ||
+            Entry->Runs[i].BlockCount > MaxBlocks - Entry->Runs[i].BlockIndex)
+        {
+            goto Invalid;
+        }
+
+        DataBlocks += Entry->Runs[i].BlockCount;
+        if (DataBlocks > MaxBlocks)
+        {
+            goto Invalid;
+        }
+    }
+
+    if (Entry->Size != HeaderSize + DataBlocks * HBLOCK_SIZE)
+    {
+        goto Invalid;
+    }
+
+    /* Now checksum all of it, a torn entry ends the log */
+    CheckSum = Entry->CheckSum;
+    Entry->CheckSum = 0;
+    Sum = HvpLogEntryChecksum(HV_LOG_ENTRY_SIGNATURE, Entry, HeaderSize);
+    Entry->CheckSum = CheckSum;
+
+    Offset = FileOffset + HeaderSize;
+    while (DataBlocks)
+    {
+        Count = min(DataBlocks, HV_WRITE_BATCH_BLOCKS);
+        if (!RegistryHive->FileRead(RegistryHive, HFILE_TYPE_LOG, &Offset,
+                                    Buffer, Count * HBLOCK_SIZE))
+        {
+            goto Invalid;
+        }
+
+        Sum = HvpLogEntryChecksum(Sum, Buffer, Count * HBLOCK_SIZE);
+        Offset += Count * HBLOCK_SIZE;
+        DataBlocks -= Count;
+    }
+
+    if (Sum == CheckSum)
+    {
+        return Entry;
+    }
+
+Invalid:
+    RegistryHive->Free(Entry, 0);
+    return NULL;
+}
+
+/**
+ * @name HvpApplyLogEntry
+ *
+ * Internal helper of HvpRecoverFromLog. Copies the blocks of a validated
+ * log entry to their place in the primary.
+ */
+static BOOLEAN
+HvpApplyLogEntry(
+    PHHIVE RegistryHive,
+    PHLOG_ENTRY Entry,
+    ULONG FileOffset,
+    PUCHAR Buffer)
+{
+    ULONG LogOffset, PrimaryOffset, Left, Count, i;
+
+    LogOffset = FileOffset + HV_LOG_ENTRY_HEADER_SIZE(Entry->RunCount);
+    for (i = 0; i < Entry->RunCount; i++)
+    {
+        PrimaryOffset = (Entry->Runs[i].BlockIndex + 1) * HBLOCK_SIZE;
+        Left = Entry->Runs[i].BlockCount;
+        while (Left)
+        {
+            Count = min(Left, HV_WRITE_BATCH_BLOCKS);
+            if (!RegistryHive->FileRead(RegistryHive, HFILE_TYPE_LOG, &LogOffset,
+                                        Buffer, Count * HBLOCK_SIZE) ||
+                !RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY, &PrimaryOffset,
+                                         Buffer, Count * HBLOCK_SIZE))
+            {
+                return FALSE;
+            }
+
+            LogOffset += Count * HBLOCK_SIZE;
+            PrimaryOffset += Count * HBLOCK_SIZE;
+            Left -= Count;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * @name HvpRecoverFromLog
+ *
+ * Replay the log of a hive into its primary file, before the primary gets
+ * loaded. Entries are applied in sequence order for as long as they are
+ * complete, whatever follows is what was left of an interrupted flush.
+ * Applying an entry twice is harmless, so the log is kept until the next
+ * flush resets it and a crash in here just gets it replayed again.
+ */
+NTSTATUS CMAPI
+HvpRecoverFromLog(
+    PHHIVE RegistryHive)
+{
+    PHBASE_BLOCK LogHeader, BaseBlock;
+    PHLOG_ENTRY Entry;
+    PUCHAR Headers, Buffer;
+    ULONG FileOffset, Sequence, HiveLength = 0, Applied = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    /* Whatever happens, the log gets reset before it is appended to */
+    RegistryHive->LogOffset = 0;
+
+    Headers = RegistryHive->Allocate(2 * HBLOCK_SIZE, FALSE, TAG_CM);
+    Buffer = RegistryHive->Allocate(HV_WRITE_BATCH_BLOCKS * HBLOCK_SIZE, FALSE, TAG_CM);
+    if (Headers == NULL || Buffer == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quit;
+    }
+
+    /* Without a log header there's nothing to replay */
+    LogHeader = (PHBASE_BLOCK)Headers;
+    RtlZeroMemory(LogHeader, HBLOCK_SIZE);
+    FileOffset = 0;
+    if (!RegistryHive->FileRead(RegistryHive, HFILE_TYPE_LOG, &FileOffset,
+                                LogHeader, HBLOCK_SIZE) ||
+        LogHeader->Signature != HV_SIGNATURE ||
+        LogHeader->Type != HFILE_TYPE_LOG ||
+        LogHeader->Sequence1 != LogHeader->Sequence2 ||
+        HvpHiveHeaderChecksum(LogHeader) != LogHeader->CheckSum)
+    {
+        goto Quit;
+    }
+
+    Sequence = LogHeader->Sequence1;
+    FileOffset = HBLOCK_SIZE;
+    while ((Entry = HvpReadLogEntry(RegistryHive, FileOffset, Sequence + 1, Buffer)))
+    {
+        if (!HvpApplyLogEntry(RegistryHive, Entry, FileOffset, Buffer))
+        {
+            RegistryHive->Free(Entry, 0);
+            Status = STATUS_REGISTRY_IO_FAILED;
+            goto Quit;
+        }
+
+        Sequence = Entry->Sequence;
+        HiveLength = Entry->HiveLength;
+        FileOffset += Entry->Size;
+        Applied++;
+        RegistryHive->Free(Entry, 0);
+    }
+
+    if (Applied == 0)
+    {
+        goto Quit;
+    }
+
+    /* Bring the primary base block up to date, or rebuild it from the log if it is torn */
+    BaseBlock = (PHBASE_BLOCK)(Headers + HBLOCK_SIZE);
+    RtlZeroMemory(BaseBlock, HBLOCK_SIZE);
+    FileOffset = 0;
+    if (!RegistryHive->FileRead(RegistryHive, HFILE_TYPE_PRIMARY, &FileOffset,
+                                BaseBlock, HBLOCK_SIZE) ||
+        BaseBlock->Signature != HV_SIGNATURE ||
+        HvpHiveHeaderChecksum(BaseBlock) != BaseBlock->CheckSum)
+    {
+        RtlCopyMemory(BaseBlock, LogHeader, HBLOCK_SIZE);
+    }
+
+    BaseBlock->Type = HFILE_TYPE_PRIMARY;
+    BaseBlock->Length = HiveLength;
+    BaseBlock->Sequence1 = Sequence;
+    BaseBlock->Sequence2 = Sequence;
+    BaseBlock->CheckSum = HvpHiveHeaderChecksum(BaseBlock);
+
+    FileOffset = 0;
+    if (!RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY, &FileOffset,
+                                 BaseBlock, HBLOCK_SIZE) ||
+        !RegistryHive->FileSetSize(RegistryHive, HFILE_TYPE_PRIMARY,
+                                   HBLOCK_SIZE + HiveLength, HBLOCK_SIZE + HiveLength) ||
+        !RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_PRIMARY, NULL, 0))
+    {
+        Status = STATUS_REGISTRY_IO_FAILED;
+        goto Quit;
+    }
+
+    DPRINT1("Recovered %lu hive log entries\n", Applied);
+
+Quit:
+    if (Buffer) RegistryHive->Free(Buffer, 0);
+    if (Headers) RegistryHive->Free(Headers, 0);
+    return Status;
+}
+
 BOOLEAN
 CMAPI
 HvHiveWillShrink(IN PHHIVE RegistryHive)
@@ -291,7 +812,7 @@ HvWriteHive(
     KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
 
     /* Update hive file */
-    if (!HvpWriteHive(RegistryHive, FALSE))
+    if (!HvpWriteHive(RegistryHive, NULL))
     {
         return FALSE;
     }
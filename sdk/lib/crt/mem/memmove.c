@@ -1,6 +1,11 @@
+
 #include <string.h>
 
-/* NOTE: This code is duplicated in memcpy function */
+/* Words are moved whenever source and destination share their alignment */
+#define WORD_SIZE sizeof(size_t)
+#define WORD_MASK (WORD_SIZE - 1)
+
+/* NOTE: memcpy is built from this file too */
 void * __cdecl memmove(void *dest,const void *src,size_t count)
 {
     char *char_dest = (char *)dest;
@@ -9,6 +14,24 @@ void * __cdecl memmove(void *dest,const void *src,size_t count)
     if ((char_dest <= char_src) || (char_dest >= (char_src+count)))
     {
         /*  non-overlapping buffers */
+        if (count >= 2 * WORD_SIZE &&
+            (((size_t)char_dest ^ (size_t)char_src) & WORD_MASK) == 0)
+        {
+            while ((size_t)char_dest & WORD_MASK)
+            {
+                *char_dest++ = *char_src++;
+                count--;
+            }
+
+            while (count >= WORD_SIZE)
+            {
+                *(size_t *)char_dest = *(size_t *)char_src;
+                char_dest += WORD_SIZE;
+                char_src += WORD_SIZE;
+                count -= WORD_SIZE;
+            }
+        }
+
         while(count > 0)
 	{
             *char_dest = *char_src;
@@ -20,14 +43,32 @@ void * __cdecl memmove(void *dest,const void *src,size_t count)
     else
     {
         /* overlaping buffers */
-        char_dest = (char *)dest + count - 1;
-        char_src = (char *)src + count - 1;
+        char_dest = (char *)dest + count;
+        char_src = (char *)src + count;
+
+        if (count >= 2 * WORD_SIZE &&
+            (((size_t)char_dest ^ (size_t)char_src) & WORD_MASK) == 0)
+        {
+            while ((size_t)char_dest & WORD_MASK)
+            {
+                *--char_dest = *--char_src;
+                count--;
+            }
+
+            while (count >= WORD_SIZE)
+            {
+                char_dest -= WORD_SIZE;
+                char_src -= WORD_SIZE;
+                *(size_t *)char_dest = *(size_t *)char_src;
+                count -= WORD_SIZE;
+            }
+        }
 
         while(count > 0)
 	{
-           *char_dest = *char_src;
            char_dest--;
            char_src--;
+           *char_dest = *char_src;
            count--;
 	}
     }
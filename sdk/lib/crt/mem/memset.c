@@ -8,6 +8,25 @@
 void* __cdecl memset(void* src, int val, size_t count)
 {
     char *char_src = (char *)src;
+    size_t pattern;
+
+    if (count >= 2 * sizeof(size_t))
+    {
+        /* Fill up to a word boundary, then a word at a time */
+        while ((size_t)char_src & (sizeof(size_t) - 1))
+        {
+            *char_src++ = val;
+            count--;
+        }
+
+        pattern = ((size_t)-1 / 0xFF) * (unsigned char)val;
+        while (count >= sizeof(size_t))
+        {
+            *(size_t *)char_src = pattern;
+            char_src += sizeof(size_t);
+            count -= sizeof(size_t);
+        }
+    }
 
     while(count>0) {
         *char_src = val;
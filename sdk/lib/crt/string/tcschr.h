@@ -1,15 +1,27 @@
 
 #include <tchar.h>
+#include "tcsword.h"
 
 _TCHAR * _tcschr(const _TCHAR * s, _XINT c)
 {
  _TCHAR cc = c;
+ const size_t * w;
+ size_t pattern;
 
- while(*s)
+ /* Unaligned wide strings never reach a word boundary and end here */
+ for(; !_TCS_IS_WORD_ALIGNED(s); s++)
  {
   if(*s == cc) return (_TCHAR *)s;
+  if(!*s) return 0;
+ }
+
+ /* Skip words holding neither the character nor the terminator */
+ pattern = _TCS_ONES * ((size_t)cc & _TCS_MASK);
+ for(w = (const size_t *)s; !_TCS_HAS_NUL(*w) && !_TCS_HAS_NUL(*w ^ pattern); w++);
 
-  s++;
+ for(s = (const _TCHAR *)w; *s; s++)
+ {
+  if(*s == cc) return (_TCHAR *)s;
  }
 
  if(cc == 0) return (_TCHAR *)s;
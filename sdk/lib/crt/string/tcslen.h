@@ -1,6 +1,7 @@
 
 #include <stddef.h>
 #include <tchar.h>
+#include "tcsword.h"
 
 #ifdef _MSC_VER
 #pragma function(_tcslen)
@@ -9,10 +10,17 @@
 size_t __cdecl _tcslen(const _TCHAR * str)
 {
  const _TCHAR * s;
+ const size_t * w;
 
  if(str == 0) return 0;
 
- for(s = str; *s; ++ s);
+ /* Unaligned wide strings never reach a word boundary and end here */
+ for(s = str; !_TCS_IS_WORD_ALIGNED(s); ++ s)
+  if(!*s) return s - str;
+
+ for(w = (const size_t *)s; !_TCS_HAS_NUL(*w); ++ w);
+
+ for(s = (const _TCHAR *)w; *s; ++ s);
 
  return s - str;
 }
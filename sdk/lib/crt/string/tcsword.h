@@ -0,0 +1,25 @@
+
+#include <stddef.h>
+#include <tchar.h>
+
+/*
+ * Helpers to scan strings a machine word at a time. Reading a whole
+ * aligned word never crosses a page boundary, so it is safe even when
+ * the terminator is in the middle of it.
+ */
+
+#ifdef _UNICODE
+#define _TCS_MASK  0xFFFF
+#define _TCS_HIGHS (_TCS_ONES << 15)
+#else
+#define _TCS_MASK  0xFF
+#define _TCS_HIGHS (_TCS_ONES << 7)
+#endif
+#define _TCS_ONES  ((size_t)-1 / _TCS_MASK)
+
+/* Non-zero if any character in the word is zero */
+#define _TCS_HAS_NUL(w) (((w) - _TCS_ONES) & ~(w) & _TCS_HIGHS)
+
+#define _TCS_IS_WORD_ALIGNED(p) (((size_t)(p) & (sizeof(size_t) - 1)) == 0)
+
+/* EOF */
@@ -36,11 +36,35 @@ ULONG ChecksumCompute(
  *     Seed  = Previously calculated checksum (if any)
  * RETURNS:
  *     Checksum of buffer
+ * NOTES:
+ *     The buffer is summed 32 bits at a time into a 64-bit accumulator,
+ *     so carries only need to be folded back once at the end. Since
+ *     2^16 and 1 are the same in one's complement arithmetic, this gives
+ *     the same result as summing 16-bit words
  */
 {
-  register ULONG Sum = Seed;
+  ULONGLONG Sum = Seed;
+  PULONG Long = (PULONG)Data;
 
-  while (Count > 1)
+  while (Count >= 16)
+    {
+      Sum += Long[0];
+      Sum += Long[1];
+      Sum += Long[2];
+      Sum += Long[3];
+      Long += 4;
+      Count -= 16;
+    }
+
+  while (Count >= 4)
+    {
+      Sum += *Long++;
+      Count -= 4;
+    }
+
+  Data = Long;
+
+  if (Count >= 2)
     {
       Sum += *(PUSHORT)Data;
       Count -= 2;
@@ -53,53 +77,63 @@ ULONG ChecksumCompute(
       Sum += *(PUCHAR)Data;
     }
 
-  return Sum;
+  /* Fold 64-bit sum to 32 bits, twice to absorb the carry of the first */
+  Sum = (Sum >> 32) + (Sum & 0xFFFFFFFF);
+  Sum = (Sum >> 32) + (Sum & 0xFFFFFFFF);
+
+  return (ULONG)Sum;
 }
 
-ULONG
-UDPv4ChecksumCalculate(
+static ULONG
+PseudoHeaderChecksumCalculate(
   PIPv4_HEADER IPHeader,
+  UCHAR Protocol,
   PUCHAR PacketBuffer,
   ULONG DataLength)
+/*
+ * FUNCTION: Calculate the checksum of a TCP or UDP segment
+ * ARGUMENTS:
+ *     IPHeader     = Pointer to the IPv4 header (for the addresses)
+ *     Protocol     = IPPROTO_TCP or IPPROTO_UDP
+ *     PacketBuffer = Pointer to the transport header and data
+ *     DataLength   = Number of bytes at PacketBuffer
+ * RETURNS:
+ *     One's complement checksum in host byte order
+ */
 {
-  ULONG Sum = 0;
-  USHORT TmpSum;
-  ULONG i;
-  BOOLEAN Pad;
-
-  /* Pad the data if needed */
-  Pad = (DataLength & 1);
-  if (Pad)
-      DataLength++;
-
-  /* Add from the UDP header and data */
-  for (i = 0; i < DataLength; i += 2)
-  {
-       TmpSum = ((PacketBuffer[i] << 8) & 0xFF00) +
-                ((Pad && i == DataLength - 2) ? 0 : (PacketBuffer[i+1] & 0x00FF));
-       Sum += TmpSum;
-  }
-
-  /* Add the source address */
-  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
-  {
-       TmpSum = ((((PUCHAR)&IPHeader->SrcAddr)[i] << 8) & 0xFF00) +
-                (((PUCHAR)&IPHeader->SrcAddr)[i+1] & 0x00FF);
-       Sum += TmpSum;
-  }
-
-  /* Add the destination address */
-  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
-  {
-       TmpSum = ((((PUCHAR)&IPHeader->DstAddr)[i] << 8) & 0xFF00) +
-                (((PUCHAR)&IPHeader->DstAddr)[i+1] & 0x00FF);
-       Sum += TmpSum;
-  }
-
-  /* Add the proto number and length */
-  Sum += IPPROTO_UDP + (DataLength - (Pad ? 1 : 0));
+  ULONG Sum;
+
+  /* The pseudo header's length and protocol are summed directly.
+   * Everything is added as it sits in memory and swapped at the end */
+  Sum = ChecksumCompute(&IPHeader->SrcAddr, sizeof(IPv4_RAW_ADDRESS), 0);
+  Sum = ChecksumCompute(&IPHeader->DstAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+  Sum += WH2N((USHORT)Protocol) + WH2N((USHORT)DataLength);
+  Sum = ChecksumCompute(PacketBuffer, DataLength, Sum);
 
   /* Fold the checksum and return the one's complement */
-  return ~ChecksumFold(Sum);
+  return ~WN2H((USHORT)ChecksumFold(Sum));
 }
 
+ULONG
+UDPv4ChecksumCalculate(
+  PIPv4_HEADER IPHeader,
+  PUCHAR PacketBuffer,
+  ULONG DataLength)
+{
+  return PseudoHeaderChecksumCalculate(IPHeader,
+                                       IPPROTO_UDP,
+                                       PacketBuffer,
+                                       DataLength);
+}
+
+ULONG
+TCPv4ChecksumCalculate(
+  PIPv4_HEADER IPHeader,
+  PUCHAR PacketBuffer,
+  ULONG DataLength)
+{
+  return PseudoHeaderChecksumCalculate(IPHeader,
+                                       IPPROTO_TCP,
+                                       PacketBuffer,
+                                       DataLength);
+}
@@ -10,7 +10,267 @@
 
 #include "precomp.h"
 
-NEIGHBOR_CACHE_TABLE NeighborCache[NB_HASHMASK + 1];
+NEIGHBOR_CACHE_TABLE NeighborCache;
+
+/* Used until the table first grows, so startup cannot fail */
+static NEIGHBOR_CACHE_BUCKETS NBInitialBuckets;
+
+/* Every bucket has at least NB_LOCK_COUNT siblings, so all NCEs in a
+ * bucket share one lock whatever size the table is */
+#define NBLockForHash(Hash) (&NeighborCache.Lock[(Hash) & (NB_LOCK_COUNT - 1)])
+
+static ULONG NBHash(
+    PIP_ADDRESS Address)
+/*
+ * FUNCTION: Hashes an IP address for the neighbor cache
+ * NOTES:
+ *     All the bits are mixed into the low ones since the table only uses
+ *     as many of them as it has buckets
+ */
+{
+    ULONG HashValue = *(PULONG)&Address->Address;
+
+    HashValue ^= HashValue >> 16;
+    HashValue *= 0x45D9F3B;
+    HashValue ^= HashValue >> 16;
+
+    return HashValue;
+}
+
+static VOID NBReclaimWorker(
+    PVOID Context)
+/*
+ * FUNCTION: Frees NCEs and bucket arrays unlinked from the table
+ */
+{
+    PSINGLE_LIST_ENTRY Entry, NextEntry;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    for (;;) {
+        TcpipAcquireSpinLock(&NeighborCache.TimerLock, &OldIrql);
+        Entry = NeighborCache.Retired.Next;
+        NeighborCache.Retired.Next = NULL;
+        if (!Entry)
+            NeighborCache.ReclaimPending = FALSE;
+        TcpipReleaseSpinLock(&NeighborCache.TimerLock, OldIrql);
+
+        if (!Entry)
+            break;
+
+        /* Wait out any lookup that could still be walking over them */
+        SynchronizeProcessors();
+
+        while (Entry) {
+            NextEntry = Entry->Next;
+            ExFreePoolWithTag(Entry, NCE_TAG);
+            Entry = NextEntry;
+        }
+    }
+}
+
+static VOID NBRetire(
+    PSINGLE_LIST_ENTRY Entry)
+/*
+ * FUNCTION: Frees an NCE or bucket array once no lookup can see it
+ */
+{
+    KIRQL OldIrql;
+
+    TcpipAcquireSpinLock(&NeighborCache.TimerLock, &OldIrql);
+
+    PushEntryList(&NeighborCache.Retired, Entry);
+
+    /* If the work item can't be queued the memory waits for the next one */
+    if (!NeighborCache.ReclaimPending && ChewCreate(NBReclaimWorker, NULL))
+        NeighborCache.ReclaimPending = TRUE;
+
+    TcpipReleaseSpinLock(&NeighborCache.TimerLock, OldIrql);
+}
+
+static PNEIGHBOR_CACHE_ENTRY NBLookup(
+    ULONG Hash,
+    PIP_ADDRESS Address,
+    PIP_INTERFACE Interface)
+/*
+ * FUNCTION: Finds an NCE without taking a lock
+ * ARGUMENTS:
+ *     Hash      = Hash of Address
+ *     Address   = Pointer to IP address
+ *     Interface = Pointer to interface, NULL matches any
+ * NOTES:
+ *     Must be called at DISPATCH_LEVEL, which keeps what is found from
+ *     being freed until the caller lowers IRQL again
+ */
+{
+    PNEIGHBOR_CACHE_BUCKETS Buckets;
+    PNEIGHBOR_CACHE_ENTRY NCE;
+    LONG Sequence;
+
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    for (;;) {
+        Sequence = NeighborCache.Sequence;
+        if (Sequence & 1) {
+            YieldProcessor();
+            continue;
+        }
+
+        KeMemoryBarrier();
+
+        Buckets = NeighborCache.Buckets;
+        for (NCE = Buckets->Cache[Hash & Buckets->Mask];
+             NCE != NULL;
+             NCE = NCE->Next) {
+            if (NCE->Hash == Hash && !NCE->Removed &&
+                (Interface == NULL || NCE->Interface == Interface) &&
+                AddrIsEqual(Address, &NCE->Address))
+                break;
+        }
+
+        KeMemoryBarrier();
+
+        /* A resize moves NCEs between chains, so a miss during one
+         * doesn't mean anything */
+        if (NCE != NULL || NeighborCache.Sequence == Sequence)
+            return NCE;
+    }
+}
+
+static VOID NBGrowTable(
+    ULONG Size)
+/*
+ * FUNCTION: Grows the table to a given number of hash buckets
+ * NOTES:
+ *     Must be called without any neighbor cache lock held
+ */
+{
+    PNEIGHBOR_CACHE_BUCKETS OldBuckets, NewBuckets;
+    PNEIGHBOR_CACHE_ENTRY NCE;
+    ULONG i;
+    KIRQL OldIrql;
+
+    NewBuckets = ExAllocatePoolWithTag(NonPagedPool,
+                                       sizeof(NEIGHBOR_CACHE_BUCKETS) +
+                                       (Size - NB_MIN_BUCKETS) * sizeof(PNEIGHBOR_CACHE_ENTRY),
+                                       NCE_TAG);
+    if (!NewBuckets)
+    {
+        /* Longer chains are slower, not wrong */
+        TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return;
+    }
+
+    RtlZeroMemory(NewBuckets->Cache, Size * sizeof(PNEIGHBOR_CACHE_ENTRY));
+    NewBuckets->Mask = Size - 1;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    for (i = 0; i < NB_LOCK_COUNT; i++)
+        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache.Lock[i]);
+
+    OldBuckets = NeighborCache.Buckets;
+    if (OldBuckets->Mask >= NewBuckets->Mask)
+    {
+        /* Somebody else grew it first */
+        OldBuckets = NewBuckets;
+    }
+    else
+    {
+        InterlockedIncrement(&NeighborCache.Sequence);
+
+        for (i = 0; i <= OldBuckets->Mask; i++) {
+            while ((NCE = OldBuckets->Cache[i]) != NULL) {
+                OldBuckets->Cache[i] = NCE->Next;
+                NCE->Next = NewBuckets->Cache[NCE->Hash & NewBuckets->Mask];
+                NewBuckets->Cache[NCE->Hash & NewBuckets->Mask] = NCE;
+            }
+        }
+
+        InterlockedExchangePointer((PVOID*)&NeighborCache.Buckets, NewBuckets);
+        InterlockedIncrement(&NeighborCache.Sequence);
+    }
+
+    for (i = NB_LOCK_COUNT; i > 0; i--)
+        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache.Lock[i - 1]);
+
+    KeLowerIrql(OldIrql);
+
+    if (OldBuckets == NewBuckets)
+        ExFreePoolWithTag(NewBuckets, NCE_TAG);
+    else if (OldBuckets != &NBInitialBuckets)
+        NBRetire(&OldBuckets->RetireEntry);
+}
+
+static VOID NBScheduleTimer(
+    PNEIGHBOR_CACHE_ENTRY NCE,
+    ULONG Due)
+/*
+ * FUNCTION: Makes the timeout handler look at an NCE on a given tick
+ */
+{
+    KIRQL OldIrql;
+
+    TcpipAcquireSpinLock(&NeighborCache.TimerLock, &OldIrql);
+
+    if (!IsListEmpty(&NCE->TimerEntry))
+        RemoveEntryList(&NCE->TimerEntry);
+
+    NCE->TimerDue = Due;
+    InsertTailList(&NeighborCache.Wheel[Due & (NB_WHEEL_SIZE - 1)],
+                   &NCE->TimerEntry);
+
+    TcpipReleaseSpinLock(&NeighborCache.TimerLock, OldIrql);
+}
+
+static VOID NBCancelTimer(
+    PNEIGHBOR_CACHE_ENTRY NCE)
+{
+    KIRQL OldIrql;
+
+    TcpipAcquireSpinLock(&NeighborCache.TimerLock, &OldIrql);
+
+    if (!IsListEmpty(&NCE->TimerEntry))
+    {
+        RemoveEntryList(&NCE->TimerEntry);
+        InitializeListHead(&NCE->TimerEntry);
+    }
+
+    TcpipReleaseSpinLock(&NeighborCache.TimerLock, OldIrql);
+}
+
+/* Must be called with the NCE's lock held */
+static VOID NBRearmTimer(
+    PNEIGHBOR_CACHE_ENTRY NCE)
+{
+    ULONG Now = NeighborCache.Ticks;
+    ULONG Due;
+
+    if (NCE->Removed)
+        return;
+
+    if (NCE->State & NUD_INCOMPLETE)
+    {
+        /* Solicited every tick until it resolves */
+        NBScheduleTimer(NCE, Now + 1);
+    }
+    else if (NCE->EventTimer > 0)
+    {
+        /* Nothing happens to a complete NCE until it goes stale, so it
+         * sleeps until then. Traffic from it only moves EventTime, the
+         * handler sees that when it wakes up and goes back to sleep */
+        Due = NCE->EventTime + min(ARP_RATE, NCE->EventTimer);
+        if ((LONG)(Due - Now) <= 0)
+            Due = Now + 1;
+
+        NBScheduleTimer(NCE, Due);
+    }
+    else
+    {
+        NBCancelTimer(NCE);
+    }
+}
 
 VOID NBCompleteSend( PVOID Context,
 		     PNDIS_PACKET NdisPacket,
@@ -28,19 +288,12 @@ VOID NBCompleteSend( PVOID Context,
 VOID NBSendPackets( PNEIGHBOR_CACHE_ENTRY NCE ) {
     PLIST_ENTRY PacketEntry;
     PNEIGHBOR_PACKET Packet;
-    UINT HashValue;
 
     ASSERT(!(NCE->State & NUD_INCOMPLETE));
 
-    HashValue  = *(PULONG)(&NCE->Address.Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
-
     /* Send any waiting packets */
     while ((PacketEntry = ExInterlockedRemoveHeadList(&NCE->PacketQueue,
-                                              &NeighborCache[HashValue].Lock)) != NULL)
+                                              NBLockForHash(NCE->Hash))) != NULL)
     {
 	Packet = CONTAINING_RECORD( PacketEntry, NEIGHBOR_PACKET, Next );
 
@@ -61,7 +314,7 @@ VOID NBSendPackets( PNEIGHBOR_CACHE_ENTRY NCE ) {
     }
 }
 
-/* Must be called with table lock acquired */
+/* Must be called with the NCE's lock held */
 VOID NBFlushPacketQueue( PNEIGHBOR_CACHE_ENTRY NCE,
 			 NTSTATUS ErrorCode ) {
     PLIST_ENTRY PacketEntry;
@@ -88,81 +341,158 @@ VOID NBFlushPacketQueue( PNEIGHBOR_CACHE_ENTRY NCE,
     }
 }
 
+/* Must be called with the NCE's lock held */
+static VOID NBDestroyNeighbor(
+    PNEIGHBOR_CACHE_ENTRY *PrevNCE,
+    PNEIGHBOR_CACHE_ENTRY NCE,
+    NDIS_STATUS Status)
+{
+    /* Lookups already on the NCE can still follow its Next pointer */
+    *PrevNCE = NCE->Next;
+    NCE->Removed = TRUE;
+    InterlockedDecrement(&NeighborCache.Count);
+
+    NBCancelTimer(NCE);
+    NBFlushPacketQueue(NCE, Status);
+
+    RouteInvalidateCache();
+    NBRetire(&NCE->RetireEntry);
+}
+
+/* Must be called with the NCE's lock held */
+static VOID NBUnlinkNeighbor(
+    PNEIGHBOR_CACHE_ENTRY NCE,
+    NDIS_STATUS Status)
+{
+    PNEIGHBOR_CACHE_BUCKETS Buckets = NeighborCache.Buckets;
+    PNEIGHBOR_CACHE_ENTRY *PrevNCE;
+    PNEIGHBOR_CACHE_ENTRY CurNCE;
+
+    for (PrevNCE = &Buckets->Cache[NCE->Hash & Buckets->Mask];
+         (CurNCE = *PrevNCE) != NULL;
+         PrevNCE = &CurNCE->Next) {
+        if (CurNCE == NCE) {
+            NBDestroyNeighbor(PrevNCE, NCE, Status);
+            break;
+        }
+    }
+}
+
+/* Must be called with the NCE's lock held */
+static VOID NBCheckNeighbor(
+    PNEIGHBOR_CACHE_ENTRY NCE,
+    ULONG Now)
+{
+    ULONG Elapsed;
+    NDIS_STATUS Status;
+
+    if ((LONG)(NCE->TimerDue - Now) > 0)
+    {
+        /* Due on a later lap of the wheel */
+        NBScheduleTimer(NCE, NCE->TimerDue);
+        return;
+    }
+
+    Elapsed = Now - NCE->EventTime;
+
+    if (NCE->State & NUD_INCOMPLETE)
+    {
+        /* Solicit for an address */
+        NBSendSolicit(NCE);
+        if (NCE->EventTimer == 0 && Elapsed >= ARP_INCOMPLETE_TIMEOUT)
+        {
+            NBFlushPacketQueue(NCE, NDIS_STATUS_NETWORK_UNREACHABLE);
+            NCE->EventTime = Now;
+        }
+    }
+
+    /* Check if event timer is running */
+    if (NCE->EventTimer > 0)  {
+        ASSERT(!(NCE->State & NUD_PERMANENT));
+
+        if ((Elapsed > ARP_RATE &&
+             Elapsed % ARP_TIMEOUT_RETRANSMISSION == 0) ||
+            (Elapsed == ARP_RATE))
+        {
+            /* We haven't gotten a packet from them in
+             * Elapsed seconds so we mark them as stale
+             * and solicit now */
+            NCE->State |= NUD_STALE;
+            NBSendSolicit(NCE);
+        }
+        if (Elapsed >= NCE->EventTimer) {
+            /* Choose the proper failure status */
+            if (NCE->State & NUD_INCOMPLETE)
+            {
+                /* We couldn't get an address to this IP at all */
+                Status = NDIS_STATUS_HOST_UNREACHABLE;
+            }
+            else
+            {
+                /* This guy was stale for way too long */
+                Status = NDIS_STATUS_REQUEST_ABORTED;
+            }
+
+            /* Unlink and destroy the NCE */
+            NBUnlinkNeighbor(NCE, Status);
+            return;
+        }
+    }
+
+    NBRearmTimer(NCE);
+}
+
 VOID NBTimeout(VOID)
 /*
  * FUNCTION: Neighbor address cache timeout handler
  * NOTES:
  *     This routine is called by IPTimeout to remove outdated cache
- *     entries.
+ *     entries. Only the NCEs in this tick's wheel slot are looked at,
+ *     complete ones are only in a slot when they may be going stale
  */
 {
-    UINT i;
-    PNEIGHBOR_CACHE_ENTRY *PrevNCE;
+    LIST_ENTRY Expired;
+    PLIST_ENTRY Slot, Entry;
     PNEIGHBOR_CACHE_ENTRY NCE;
-    NDIS_STATUS Status;
+    ULONG Now;
 
-    for (i = 0; i <= NB_HASHMASK; i++) {
-        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache[i].Lock);
+    InitializeListHead(&Expired);
 
-        for (PrevNCE = &NeighborCache[i].Cache;
-             (NCE = *PrevNCE) != NULL;) {
-            if (NCE->State & NUD_INCOMPLETE)
-            {
-                /* Solicit for an address */
-                NBSendSolicit(NCE);
-                if (NCE->EventTimer == 0)
-                {
-                    NCE->EventCount++;
-                    if (NCE->EventCount == ARP_INCOMPLETE_TIMEOUT)
-                    {
-                        NBFlushPacketQueue(NCE, NDIS_STATUS_NETWORK_UNREACHABLE);
-                        NCE->EventCount = 0;
-                    }
-                }
-            }
+    TcpipAcquireSpinLockAtDpcLevel(&NeighborCache.TimerLock);
 
-            /* Check if event timer is running */
-            if (NCE->EventTimer > 0)  {
-                ASSERT(!(NCE->State & NUD_PERMANENT));
-                NCE->EventCount++;
+    Now = ++NeighborCache.Ticks;
 
-                if ((NCE->EventCount > ARP_RATE &&
-                     NCE->EventCount % ARP_TIMEOUT_RETRANSMISSION == 0) ||
-                    (NCE->EventCount == ARP_RATE))
-                {
-                    /* We haven't gotten a packet from them in
-                     * EventCount seconds so we mark them as stale
-                     * and solicit now */
-                    NCE->State |= NUD_STALE;
-                    NBSendSolicit(NCE);
-                }
-                if (NCE->EventTimer - NCE->EventCount == 0) {
-                    /* Unlink and destroy the NCE */
-                    *PrevNCE = NCE->Next;
-                    
-                    /* Choose the proper failure status */
-                    if (NCE->State & NUD_INCOMPLETE)
-                    {
-                        /* We couldn't get an address to this IP at all */
-                        Status = NDIS_STATUS_HOST_UNREACHABLE;
-                    }
-                    else
-                    {
-                        /* This guy was stale for way too long */
-                        Status = NDIS_STATUS_REQUEST_ABORTED;
-                    }
-                    
-                    NBFlushPacketQueue(NCE, Status);
-
-                    ExFreePoolWithTag(NCE, NCE_TAG);
+    /* Anything rescheduled from here on lands back on the wheel, not on
+     * the list being worked through */
+    Slot = &NeighborCache.Wheel[Now & (NB_WHEEL_SIZE - 1)];
+    while (!IsListEmpty(Slot)) {
+        Entry = RemoveHeadList(Slot);
+        InsertTailList(&Expired, Entry);
+    }
 
-                    continue;
-                }
-            }
-            PrevNCE = &NCE->Next;
+    TcpipReleaseSpinLockFromDpcLevel(&NeighborCache.TimerLock);
+
+    for (;;) {
+        /* Still under the timer lock, a removal can take NCEs off it */
+        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache.TimerLock);
+        if (IsListEmpty(&Expired)) {
+            TcpipReleaseSpinLockFromDpcLevel(&NeighborCache.TimerLock);
+            break;
         }
+        Entry = RemoveHeadList(&Expired);
+        InitializeListHead(Entry);
+        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache.TimerLock);
+
+        /* Running at DISPATCH_LEVEL keeps it around even if it gets
+         * removed before the lock is taken */
+        NCE = CONTAINING_RECORD(Entry, NEIGHBOR_CACHE_ENTRY, TimerEntry);
+
+        TcpipAcquireSpinLockAtDpcLevel(NBLockForHash(NCE->Hash));
 
-        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache[i].Lock);
+        if (!NCE->Removed)
+            NBCheckNeighbor(NCE, Now);
+
+        TcpipReleaseSpinLockFromDpcLevel(NBLockForHash(NCE->Hash));
     }
 }
 
@@ -175,10 +505,23 @@ VOID NBStartup(VOID)
 
     TI_DbgPrint(DEBUG_NCACHE, ("Called.\n"));
 
-    for (i = 0; i <= NB_HASHMASK; i++) {
-	NeighborCache[i].Cache = NULL;
-	TcpipInitializeSpinLock(&NeighborCache[i].Lock);
-    }
+    RtlZeroMemory(&NBInitialBuckets, sizeof(NBInitialBuckets));
+    NBInitialBuckets.Mask = NB_MIN_BUCKETS - 1;
+
+    NeighborCache.Buckets = &NBInitialBuckets;
+    NeighborCache.Sequence = 0;
+    NeighborCache.Count = 0;
+    NeighborCache.Ticks = 0;
+    NeighborCache.Retired.Next = NULL;
+    NeighborCache.ReclaimPending = FALSE;
+
+    for (i = 0; i < NB_LOCK_COUNT; i++)
+	TcpipInitializeSpinLock(&NeighborCache.Lock[i]);
+
+    TcpipInitializeSpinLock(&NeighborCache.TimerLock);
+
+    for (i = 0; i < NB_WHEEL_SIZE; i++)
+	InitializeListHead(&NeighborCache.Wheel[i]);
 }
 
 VOID NBShutdown(VOID)
@@ -186,34 +529,44 @@ VOID NBShutdown(VOID)
  * FUNCTION: Shuts down the neighbor cache
  */
 {
+  PNEIGHBOR_CACHE_BUCKETS Buckets;
   PNEIGHBOR_CACHE_ENTRY NextNCE;
   PNEIGHBOR_CACHE_ENTRY CurNCE;
   KIRQL OldIrql;
-  UINT i;
+  UINT i, j;
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called.\n"));
 
   /* Remove possible entries from the cache */
-  for (i = 0; i <= NB_HASHMASK; i++)
+  for (i = 0; i < NB_LOCK_COUNT; i++)
     {
-      TcpipAcquireSpinLock(&NeighborCache[i].Lock, &OldIrql);
+      TcpipAcquireSpinLock(&NeighborCache.Lock[i], &OldIrql);
 
-      CurNCE = NeighborCache[i].Cache;
-      while (CurNCE) {
-          NextNCE = CurNCE->Next;
+      Buckets = NeighborCache.Buckets;
+      for (j = i; j <= Buckets->Mask; j += NB_LOCK_COUNT)
+        {
+          CurNCE = Buckets->Cache[j];
+          while (CurNCE) {
+              NextNCE = CurNCE->Next;
 
-          /* Flush wait queue */
-	  NBFlushPacketQueue( CurNCE, NDIS_STATUS_NOT_ACCEPTED );
+              /* Flush wait queue */
+              NBFlushPacketQueue( CurNCE, NDIS_STATUS_NOT_ACCEPTED );
+              NBCancelTimer( CurNCE );
 
-          ExFreePoolWithTag(CurNCE, NCE_TAG);
+              /* Nothing looks NCEs up anymore at this point */
+              RouteInvalidateCache();
+              ExFreePoolWithTag(CurNCE, NCE_TAG);
 
-	  CurNCE = NextNCE;
-      }
+              CurNCE = NextNCE;
+          }
 
-    NeighborCache[i].Cache = NULL;
+          Buckets->Cache[j] = NULL;
+        }
 
-    TcpipReleaseSpinLock(&NeighborCache[i].Lock, OldIrql);
-  }
+      TcpipReleaseSpinLock(&NeighborCache.Lock[i], OldIrql);
+    }
+
+  NeighborCache.Count = 0;
 
   TI_DbgPrint(MAX_TRACE, ("Leaving.\n"));
 }
@@ -237,35 +590,37 @@ VOID NBSendSolicit(PNEIGHBOR_CACHE_ENTRY NCE)
 VOID NBDestroyNeighborsForInterface(PIP_INTERFACE Interface)
 {
     KIRQL OldIrql;
+    PNEIGHBOR_CACHE_BUCKETS Buckets;
     PNEIGHBOR_CACHE_ENTRY *PrevNCE;
     PNEIGHBOR_CACHE_ENTRY NCE;
-    ULONG i;
+    ULONG i, j;
 
     KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
-    for (i = 0; i <= NB_HASHMASK; i++)
+    for (i = 0; i < NB_LOCK_COUNT; i++)
     {
-        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache[i].Lock);
-        
-        for (PrevNCE = &NeighborCache[i].Cache;
-             (NCE = *PrevNCE) != NULL;)
-        {
-            if (NCE->Interface == Interface)
-            {
-                /* Unlink and destroy the NCE */
-                *PrevNCE = NCE->Next;
+        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache.Lock[i]);
 
-                NBFlushPacketQueue(NCE, NDIS_STATUS_REQUEST_ABORTED);
-                ExFreePoolWithTag(NCE, NCE_TAG);
-
-                continue;
-            }
-            else
+        /* Holding any of the locks keeps the table from being resized */
+        Buckets = NeighborCache.Buckets;
+        for (j = i; j <= Buckets->Mask; j += NB_LOCK_COUNT)
+        {
+            for (PrevNCE = &Buckets->Cache[j];
+                 (NCE = *PrevNCE) != NULL;)
             {
-                PrevNCE = &NCE->Next;
+                if (NCE->Interface == Interface)
+                {
+                    /* Unlink and destroy the NCE */
+                    NBDestroyNeighbor(PrevNCE, NCE, NDIS_STATUS_REQUEST_ABORTED);
+                    continue;
+                }
+                else
+                {
+                    PrevNCE = &NCE->Next;
+                }
             }
         }
-        
-        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache[i].Lock);
+
+        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache.Lock[i]);
     }
     KeLowerIrql(OldIrql);
 }
@@ -293,9 +648,12 @@ PNEIGHBOR_CACHE_ENTRY NBAddNeighbor(
  *   responsible for providing this reference
  */
 {
+  PNEIGHBOR_CACHE_BUCKETS Buckets;
+  PNEIGHBOR_CACHE_ENTRY *Chain;
   PNEIGHBOR_CACHE_ENTRY NCE;
   ULONG HashValue;
   KIRQL OldIrql;
+  ULONG Grow = 0;
 
   TI_DbgPrint
       (DEBUG_NCACHE,
@@ -321,24 +679,38 @@ PNEIGHBOR_CACHE_ENTRY NBAddNeighbor(
   else
       memset(NCE->LinkAddress, 0xff, LinkAddressLength);
   NCE->State = State;
+  NCE->Removed = FALSE;
   NCE->EventTimer = EventTimer;
-  NCE->EventCount = 0;
+  InitializeListHead( &NCE->TimerEntry );
   InitializeListHead( &NCE->PacketQueue );
 
   TI_DbgPrint(MID_TRACE,("NCE: %x\n", NCE));
 
-  HashValue = *(PULONG)&Address->Address;
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
+  HashValue = NBHash(Address);
+  NCE->Hash = HashValue;
+
+  TcpipAcquireSpinLock(NBLockForHash(HashValue), &OldIrql);
+
+  NCE->EventTime = NeighborCache.Ticks;
+
+  Buckets = NeighborCache.Buckets;
+  Chain = &Buckets->Cache[HashValue & Buckets->Mask];
+  NCE->Next = *Chain;
 
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  /* Lookups walk the chain without the lock, so the NCE has to be
+   * complete before it shows up there */
+  InterlockedExchangePointer((PVOID*)Chain, NCE);
 
-  NCE->Next = NeighborCache[HashValue].Cache;
-  NeighborCache[HashValue].Cache = NCE;
+  NBRearmTimer(NCE);
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  if ((ULONG)InterlockedIncrement(&NeighborCache.Count) > 2 * (Buckets->Mask + 1) &&
+      Buckets->Mask + 1 < NB_MAX_BUCKETS)
+      Grow = 2 * (Buckets->Mask + 1);
+
+  TcpipReleaseSpinLock(NBLockForHash(HashValue), OldIrql);
+
+  if (Grow)
+      NBGrowTable(Grow);
 
   return NCE;
 }
@@ -358,60 +730,43 @@ VOID NBUpdateNeighbor(
  */
 {
     KIRQL OldIrql;
-    UINT HashValue;
 
     TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X)  LinkAddress (0x%X)  State (0x%X).\n", NCE, LinkAddress, State));
 
-    HashValue  = *(PULONG)(&NCE->Address.Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
-
-    TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+    TcpipAcquireSpinLock(NBLockForHash(NCE->Hash), &OldIrql);
 
     RtlCopyMemory(NCE->LinkAddress, LinkAddress, NCE->LinkAddressLength);
     NCE->State = State;
-    NCE->EventCount = 0;
+    NCE->EventTime = NeighborCache.Ticks;
+
+    if( !(NCE->State & NUD_INCOMPLETE) && NCE->EventTimer )
+        NCE->EventTimer = ARP_COMPLETE_TIMEOUT;
 
-    TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+    NBRearmTimer(NCE);
+
+    TcpipReleaseSpinLock(NBLockForHash(NCE->Hash), OldIrql);
 
     if( !(NCE->State & NUD_INCOMPLETE) )
-    {
-        if (NCE->EventTimer) NCE->EventTimer = ARP_COMPLETE_TIMEOUT;
         NBSendPackets( NCE );
-    }
 }
 
 VOID
 NBResetNeighborTimeout(PIP_ADDRESS Address)
 {
     KIRQL OldIrql;
-    UINT HashValue;
     PNEIGHBOR_CACHE_ENTRY NCE;
 
     TI_DbgPrint(DEBUG_NCACHE, ("Resetting NCE timout for 0x%s\n", A2S(Address)));
 
-    HashValue  = *(PULONG)(&Address->Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
-
-    TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+    /* This runs for every received packet. Only the time stamp is moved,
+     * the timeout handler finds out when the NCE is next due */
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
 
-    for (NCE = NeighborCache[HashValue].Cache;
-         NCE != NULL;
-         NCE = NCE->Next)
-    {
-         if (AddrIsEqual(Address, &NCE->Address))
-         {
-             NCE->EventCount = 0;
-             break;
-         }
-    }
+    NCE = NBLookup(NBHash(Address), Address, NULL);
+    if (NCE != NULL)
+        NCE->EventTime = NeighborCache.Ticks;
 
-    TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+    KeLowerIrql(OldIrql);
 }
 
 PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
@@ -430,19 +785,16 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
  */
 {
   PNEIGHBOR_CACHE_ENTRY NCE;
-  UINT HashValue;
+  ULONG HashValue;
   KIRQL OldIrql;
   PIP_INTERFACE FirstInterface;
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called. Address (0x%X).\n", Address));
 
-  HashValue = *(PULONG)&Address->Address;
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
+  HashValue = NBHash(Address);
 
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  /* No lock is taken, this is on the path of every transmitted packet */
+  KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
 
   /* If there's no adapter specified, we'll look for a match on
    * each one. */
@@ -458,18 +810,7 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
 
   do
   {
-      NCE = NeighborCache[HashValue].Cache;
-      while (NCE != NULL)
-      {
-         if (NCE->Interface == Interface &&
-             AddrIsEqual(Address, &NCE->Address))
-         {
-             break;
-         }
- 
-         NCE = NCE->Next;
-      }
-      
+      NCE = NBLookup(HashValue, Address, Interface);
       if (NCE != NULL)
           break;
   }
@@ -479,19 +820,10 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
   if ((NCE == NULL) && (FirstInterface != NULL))
   {
       /* This time we'll even match loopback NCEs */
-      NCE = NeighborCache[HashValue].Cache;
-      while (NCE != NULL)
-      {
-         if (AddrIsEqual(Address, &NCE->Address))
-         {
-             break;
-         }
-
-         NCE = NCE->Next;
-      }
+      NCE = NBLookup(HashValue, Address, NULL);
   }
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  KeLowerIrql(OldIrql);
 
   TI_DbgPrint(MAX_TRACE, ("Leaving.\n"));
 
@@ -554,32 +886,41 @@ BOOLEAN NBQueuePacket(
 {
   KIRQL OldIrql;
   PNEIGHBOR_PACKET Packet;
-  UINT HashValue;
 
   TI_DbgPrint
       (DEBUG_NCACHE,
        ("Called. NCE (0x%X)  NdisPacket (0x%X).\n", NCE, NdisPacket));
 
+  if( !(NCE->State & NUD_INCOMPLETE) && IsListEmpty(&NCE->PacketQueue) ) {
+      /* Nothing is waiting for the link address, so the packet can go
+       * out right away without the queue, its lock or an allocation */
+      PC(NdisPacket)->DLComplete = PacketComplete;
+      PC(NdisPacket)->Context = PacketContext;
+
+      NCE->Interface->Transmit
+          ( NCE->Interface->Context,
+            NdisPacket,
+            0,
+            NCE->LinkAddress,
+            LAN_PROTO_IPv4 );
+
+      return TRUE;
+  }
+
   Packet = ExAllocatePoolWithTag( NonPagedPool, sizeof(NEIGHBOR_PACKET),
                                   NEIGHBOR_PACKET_TAG );
   if( !Packet ) return FALSE;
 
   /* FIXME: Should we limit the number of queued packets? */
 
-  HashValue  = *(PULONG)(&NCE->Address.Address);
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
-
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  TcpipAcquireSpinLock(NBLockForHash(NCE->Hash), &OldIrql);
 
   Packet->Complete = PacketComplete;
   Packet->Context = PacketContext;
   Packet->Packet = NdisPacket;
   InsertTailList( &NCE->PacketQueue, &Packet->Next );
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  TcpipReleaseSpinLock(NBLockForHash(NCE->Hash), OldIrql);
 
   if( !(NCE->State & NUD_INCOMPLETE) )
       NBSendPackets( NCE );
@@ -597,75 +938,57 @@ VOID NBRemoveNeighbor(
  *   The NCE must be in a safe state
  */
 {
-  PNEIGHBOR_CACHE_ENTRY *PrevNCE;
-  PNEIGHBOR_CACHE_ENTRY CurNCE;
-  ULONG HashValue;
   KIRQL OldIrql;
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X).\n", NCE));
 
-  HashValue  = *(PULONG)(&NCE->Address.Address);
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
-
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  TcpipAcquireSpinLock(NBLockForHash(NCE->Hash), &OldIrql);
 
   /* Search the list and remove the NCE from the list if found */
-  for (PrevNCE = &NeighborCache[HashValue].Cache;
-    (CurNCE = *PrevNCE) != NULL;
-    PrevNCE = &CurNCE->Next)
-    {
-      if (CurNCE == NCE)
-        {
-          /* Found it, now unlink it from the list */
-          *PrevNCE = CurNCE->Next;
-
-	  NBFlushPacketQueue( CurNCE, NDIS_STATUS_REQUEST_ABORTED );
-          ExFreePoolWithTag(CurNCE, NCE_TAG);
-
-	  break;
-        }
-    }
+  if (!NCE->Removed)
+      NBUnlinkNeighbor(NCE, NDIS_STATUS_REQUEST_ABORTED);
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  TcpipReleaseSpinLock(NBLockForHash(NCE->Hash), OldIrql);
 }
 
 ULONG NBCopyNeighbors
 (PIP_INTERFACE Interface,
  PIPARP_ENTRY ArpTable)
 {
+  PNEIGHBOR_CACHE_BUCKETS Buckets;
   PNEIGHBOR_CACHE_ENTRY CurNCE;
   KIRQL OldIrql;
-  UINT Size = 0, i;
-
-  for (i = 0; i <= NB_HASHMASK; i++) {
-      TcpipAcquireSpinLock(&NeighborCache[i].Lock, &OldIrql);
-      for( CurNCE = NeighborCache[i].Cache;
-	   CurNCE;
-	   CurNCE = CurNCE->Next ) {
-	  if( CurNCE->Interface == Interface &&
-              !AddrIsEqual( &CurNCE->Address, &CurNCE->Interface->Unicast ) ) {
-	      if( ArpTable ) {
-		  ArpTable[Size].Index = Interface->Index;
-		  ArpTable[Size].AddrSize = CurNCE->LinkAddressLength;
-		  RtlCopyMemory
-		      (ArpTable[Size].PhysAddr, 
-		       CurNCE->LinkAddress,
-		       CurNCE->LinkAddressLength);
-		  ArpTable[Size].LogAddr = CurNCE->Address.Address.IPv4Address;
-		  if( CurNCE->State & NUD_PERMANENT )
-		      ArpTable[Size].Type = ARP_ENTRY_STATIC;
-		  else if( CurNCE->State & NUD_INCOMPLETE )
-		      ArpTable[Size].Type = ARP_ENTRY_INVALID;
-		  else
-		      ArpTable[Size].Type = ARP_ENTRY_DYNAMIC;
+  UINT Size = 0, i, j;
+
+  for (i = 0; i < NB_LOCK_COUNT; i++) {
+      TcpipAcquireSpinLock(&NeighborCache.Lock[i], &OldIrql);
+      Buckets = NeighborCache.Buckets;
+      for (j = i; j <= Buckets->Mask; j += NB_LOCK_COUNT) {
+	  for( CurNCE = Buckets->Cache[j];
+	       CurNCE;
+	       CurNCE = CurNCE->Next ) {
+	      if( CurNCE->Interface == Interface &&
+	          !AddrIsEqual( &CurNCE->Address, &CurNCE->Interface->Unicast ) ) {
+		  if( ArpTable ) {
+		      ArpTable[Size].Index = Interface->Index;
+		      ArpTable[Size].AddrSize = CurNCE->LinkAddressLength;
+		      RtlCopyMemory
+			  (ArpTable[Size].PhysAddr, 
+			   CurNCE->LinkAddress,
+			   CurNCE->LinkAddressLength);
+		      ArpTable[Size].LogAddr = CurNCE->Address.Address.IPv4Address;
+		      if( CurNCE->State & NUD_PERMANENT )
+			  ArpTable[Size].Type = ARP_ENTRY_STATIC;
+		      else if( CurNCE->State & NUD_INCOMPLETE )
+			  ArpTable[Size].Type = ARP_ENTRY_INVALID;
+		      else
+			  ArpTable[Size].Type = ARP_ENTRY_DYNAMIC;
+		  }
+		  Size++;
 	      }
-	      Size++;
 	  }
       }
-      TcpipReleaseSpinLock(&NeighborCache[i].Lock, OldIrql);
+      TcpipReleaseSpinLock(&NeighborCache.Lock[i], OldIrql);
   }
   
   return Size;
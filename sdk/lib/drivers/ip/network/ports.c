@@ -10,11 +10,126 @@
 
 #include "precomp.h"
 
+/* Ephemeral ports are searched for from a per processor hint that
+ * starts out random and moves forward by a small random step after every
+ * allocation. Concurrent allocations on different processors look at
+ * different parts of the bitmap, successive ones on the same processor
+ * stay within the same few bitmap words, and the next port a connection
+ * gets can't be predicted from the previous one.
+ *
+ * AllocateConnectPort is for connections that don't care which local port
+ * they get. Once the range runs out, such a connection can use a port
+ * already held by other connections, as long as none of them talks to the
+ * same remote address and port. Ports held that way are marked in the
+ * shared bitmap and nobody can bind to them explicitly. */
+
+static ULONG PortsProcessor( VOID ) {
+    return KeGetCurrentProcessorNumber() % MAXIMUM_PROCESSORS;
+}
+
+static VOID PortsAdvanceHint( PPORT_SET PortSet, ULONG Processor,
+                              ULONG Index, ULONG Lowest ) {
+    PortSet->Hint[Processor] = Index - Lowest + 1 +
+        RtlRandomEx( &PortSet->Seed ) % PORT_HINT_STEP;
+}
+
+static ULONG PortsFindClear( PPORT_SET PortSet, ULONG Lowest, ULONG Highest ) {
+    ULONG Processor, Start, Index;
+
+    /* The whole set being in use is the common way to run out, and that
+     * doesn't need the bitmap */
+    if( PortSet->PortsInUse >= PortSet->PortsToOversee ) return (ULONG)-1;
+
+    Processor = PortsProcessor();
+    Start = Lowest + PortSet->Hint[Processor] % (Highest - Lowest + 1);
+
+    Index = RtlFindClearBits( &PortSet->ProtoBitmap, 1, Start );
+    if( Index == (ULONG)-1 ) return (ULONG)-1;
+
+    if( Index < Start || Index > Highest ) {
+        /* Nothing between the hint and the end of the range, try the
+         * part before the hint */
+        Index = RtlFindClearBits( &PortSet->ProtoBitmap, 1, Lowest );
+        if( Index == (ULONG)-1 || Index < Lowest || Index >= Start )
+            return (ULONG)-1;
+    }
+
+    PortsAdvanceHint( PortSet, Processor, Index, Lowest );
+
+    return Index;
+}
+
+static PLIST_ENTRY PortsShareBucket( PPORT_SET PortSet, ULONG Index ) {
+    return &PortSet->Shares[Index % PORT_SHARE_BUCKETS];
+}
+
+static BOOLEAN PortsCanShare( PPORT_SET PortSet, ULONG Index,
+                              ULONG RemoteAddress, USHORT RemotePort ) {
+    PLIST_ENTRY Bucket, Entry;
+    PPORT_SHARE Share;
+
+    Bucket = PortsShareBucket( PortSet, Index );
+
+    for( Entry = Bucket->Flink; Entry != Bucket; Entry = Entry->Flink ) {
+        Share = CONTAINING_RECORD( Entry, PORT_SHARE, ListEntry );
+        if( Share->Port == Index &&
+            Share->RemoteAddress == RemoteAddress &&
+            Share->RemotePort == RemotePort )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static ULONG PortsFindShared( PPORT_SET PortSet, ULONG Lowest, ULONG Highest,
+                              ULONG RemoteAddress, USHORT RemotePort ) {
+    ULONG Processor, Start, Index, Attempts;
+    BOOLEAN Wrapped = FALSE;
+
+    Processor = PortsProcessor();
+    Start = Lowest + PortSet->Hint[Processor] % (Highest - Lowest + 1);
+    Index = Start;
+
+    /* Only a few candidates are looked at, so a destination that already
+     * has a connection on most shared ports fails quickly */
+    for( Attempts = 0; Attempts < PORT_SHARE_ATTEMPTS; Attempts++ ) {
+        Index = RtlFindSetBits( &PortSet->SharedBitmap, 1, Index );
+        if( Index == (ULONG)-1 ) return (ULONG)-1;
+
+        if( Index > Highest ||
+            (!Wrapped && Index < Start) ||
+            (Wrapped && (Index < Lowest || Index >= Start)) ) {
+            /* Nothing up to the end of the range, carry on from its start */
+            if( Wrapped ) return (ULONG)-1;
+            Wrapped = TRUE;
+            Index = Lowest;
+            continue;
+        }
+
+        if( PortsCanShare( PortSet, Index, RemoteAddress, RemotePort ) ) {
+            PortsAdvanceHint( PortSet, Processor, Index, Lowest );
+            return Index;
+        }
+
+        if( ++Index > Highest ) {
+            if( Wrapped ) return (ULONG)-1;
+            Wrapped = TRUE;
+            Index = Lowest;
+        }
+    }
+
+    return (ULONG)-1;
+}
+
 NTSTATUS PortsStartup( PPORT_SET PortSet,
 		   UINT StartingPort,
 		   UINT PortsToManage ) {
+    LARGE_INTEGER Ticks;
+    ULONG i;
+
     PortSet->StartingPort = StartingPort;
     PortSet->PortsToOversee = PortsToManage;
+    PortSet->PortsInUse = 0;
 
     PortSet->ProtoBitBuffer =
 	ExAllocatePoolWithTag( NonPagedPool, (PortSet->PortsToOversee + 7) / 8,
@@ -24,11 +139,44 @@ NTSTATUS PortsStartup( PPORT_SET PortSet,
 			 PortSet->ProtoBitBuffer,
 			 PortSet->PortsToOversee );
     RtlClearAllBits( &PortSet->ProtoBitmap );
+
+    PortSet->SharedBitBuffer =
+	ExAllocatePoolWithTag( NonPagedPool, (PortSet->PortsToOversee + 7) / 8,
+                               PORT_SET_TAG );
+    if(!PortSet->SharedBitBuffer) {
+        ExFreePoolWithTag( PortSet->ProtoBitBuffer, PORT_SET_TAG );
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlInitializeBitMap( &PortSet->SharedBitmap,
+			 PortSet->SharedBitBuffer,
+			 PortSet->PortsToOversee );
+    RtlClearAllBits( &PortSet->SharedBitmap );
+
+    for( i = 0; i < PORT_SHARE_BUCKETS; i++ )
+        InitializeListHead( &PortSet->Shares[i] );
+
+    KeQueryTickCount( &Ticks );
+    PortSet->Seed = Ticks.LowPart ^ (ULONG)(ULONG_PTR)PortSet;
+    for( i = 0; i < MAXIMUM_PROCESSORS; i++ )
+        PortSet->Hint[i] = RtlRandomEx( &PortSet->Seed );
+
     KeInitializeSpinLock( &PortSet->Lock );
     return STATUS_SUCCESS;
 }
 
 VOID PortsShutdown( PPORT_SET PortSet ) {
+    PLIST_ENTRY Entry;
+    ULONG i;
+
+    for( i = 0; i < PORT_SHARE_BUCKETS; i++ ) {
+        while( !IsListEmpty( &PortSet->Shares[i] ) ) {
+            Entry = RemoveHeadList( &PortSet->Shares[i] );
+            ExFreePoolWithTag( CONTAINING_RECORD( Entry, PORT_SHARE, ListEntry ),
+                               PORT_SET_TAG );
+        }
+    }
+
+    ExFreePoolWithTag( PortSet->SharedBitBuffer, PORT_SET_TAG );
     ExFreePoolWithTag( PortSet->ProtoBitBuffer, PORT_SET_TAG );
 }
 
@@ -39,8 +187,14 @@ VOID DeallocatePort( PPORT_SET PortSet, ULONG Port ) {
     ASSERT(Port >= PortSet->StartingPort);
     ASSERT(Port < PortSet->StartingPort + PortSet->PortsToOversee);
 
+    Port -= PortSet->StartingPort;
+
     KeAcquireSpinLock( &PortSet->Lock, &OldIrql );
-    RtlClearBits( &PortSet->ProtoBitmap, Port - PortSet->StartingPort, 1 );
+    ASSERT(!RtlTestBit( &PortSet->SharedBitmap, Port ));
+    if( RtlTestBit( &PortSet->ProtoBitmap, Port ) ) {
+        RtlClearBits( &PortSet->ProtoBitmap, Port, 1 );
+        PortSet->PortsInUse--;
+    }
     KeReleaseSpinLock( &PortSet->Lock, OldIrql );
 }
 
@@ -60,20 +214,40 @@ BOOLEAN AllocatePort( PPORT_SET PortSet, ULONG Port ) {
 
     KeAcquireSpinLock( &PortSet->Lock, &OldIrql );
     Clear = RtlAreBitsClear( &PortSet->ProtoBitmap, Port, 1 );
-    if( Clear ) RtlSetBits( &PortSet->ProtoBitmap, Port, 1 );
+    if( Clear ) {
+        RtlSetBits( &PortSet->ProtoBitmap, Port, 1 );
+        PortSet->PortsInUse++;
+    }
     KeReleaseSpinLock( &PortSet->Lock, OldIrql );
 
     return Clear;
 }
 
 ULONG AllocateAnyPort( PPORT_SET PortSet ) {
+    return AllocatePortFromRange( PortSet,
+                                  PortSet->StartingPort,
+                                  PortSet->StartingPort + PortSet->PortsToOversee - 1 );
+}
+
+ULONG AllocatePortFromRange( PPORT_SET PortSet, ULONG Lowest, ULONG Highest ) {
     ULONG AllocatedPort;
     KIRQL OldIrql;
 
+    if ((Lowest < PortSet->StartingPort) ||
+        (Highest >= PortSet->StartingPort + PortSet->PortsToOversee) ||
+        (Lowest > Highest))
+    {
+        return -1;
+    }
+
+    Lowest -= PortSet->StartingPort;
+    Highest -= PortSet->StartingPort;
+
     KeAcquireSpinLock( &PortSet->Lock, &OldIrql );
-    AllocatedPort = RtlFindClearBits( &PortSet->ProtoBitmap, 1, 0 );
+    AllocatedPort = PortsFindClear( PortSet, Lowest, Highest );
     if( AllocatedPort != (ULONG)-1 ) {
 	RtlSetBit( &PortSet->ProtoBitmap, AllocatedPort );
+	PortSet->PortsInUse++;
 	AllocatedPort += PortSet->StartingPort;
 	KeReleaseSpinLock( &PortSet->Lock, OldIrql );
 	return htons(AllocatedPort);
@@ -83,12 +257,15 @@ ULONG AllocateAnyPort( PPORT_SET PortSet ) {
     return -1;
 }
 
-ULONG AllocatePortFromRange( PPORT_SET PortSet, ULONG Lowest, ULONG Highest ) {
+ULONG AllocateConnectPort( PPORT_SET PortSet, ULONG Lowest, ULONG Highest,
+                           PVOID Owner, ULONG RemoteAddress, USHORT RemotePort ) {
+    PPORT_SHARE Share;
     ULONG AllocatedPort;
     KIRQL OldIrql;
 
     if ((Lowest < PortSet->StartingPort) ||
-        (Highest >= PortSet->StartingPort + PortSet->PortsToOversee))
+        (Highest >= PortSet->StartingPort + PortSet->PortsToOversee) ||
+        (Lowest > Highest))
     {
         return -1;
     }
@@ -96,15 +273,74 @@ ULONG AllocatePortFromRange( PPORT_SET PortSet, ULONG Lowest, ULONG Highest ) {
     Lowest -= PortSet->StartingPort;
     Highest -= PortSet->StartingPort;
 
+    Share = ExAllocatePoolWithTag( NonPagedPool, sizeof(PORT_SHARE), PORT_SET_TAG );
+    if( !Share ) return -1;
+
+    Share->Owner = Owner;
+    Share->RemoteAddress = RemoteAddress;
+    Share->RemotePort = (USHORT)RemotePort;
+
     KeAcquireSpinLock( &PortSet->Lock, &OldIrql );
-    AllocatedPort = RtlFindClearBits( &PortSet->ProtoBitmap, 1, Lowest );
-    if( AllocatedPort != (ULONG)-1 && AllocatedPort <= Highest) {
+    AllocatedPort = PortsFindClear( PortSet, Lowest, Highest );
+    if( AllocatedPort != (ULONG)-1 ) {
 	RtlSetBit( &PortSet->ProtoBitmap, AllocatedPort );
+	RtlSetBit( &PortSet->SharedBitmap, AllocatedPort );
+	PortSet->PortsInUse++;
+    } else {
+	AllocatedPort = PortsFindShared( PortSet, Lowest, Highest,
+	                                 RemoteAddress, RemotePort );
+    }
+
+    if( AllocatedPort != (ULONG)-1 ) {
+	Share->Port = AllocatedPort;
+	InsertTailList( PortsShareBucket( PortSet, AllocatedPort ), &Share->ListEntry );
 	AllocatedPort += PortSet->StartingPort;
 	KeReleaseSpinLock( &PortSet->Lock, OldIrql );
 	return htons(AllocatedPort);
     }
     KeReleaseSpinLock( &PortSet->Lock, OldIrql );
 
+    ExFreePoolWithTag( Share, PORT_SET_TAG );
+
     return -1;
 }
+
+VOID DeallocateConnectPort( PPORT_SET PortSet, ULONG Port, PVOID Owner ) {
+    PLIST_ENTRY Bucket, Entry;
+    PPORT_SHARE Share, Found = NULL;
+    BOOLEAN Shared = FALSE;
+    KIRQL OldIrql;
+
+    Port = htons(Port);
+    ASSERT(Port >= PortSet->StartingPort);
+    ASSERT(Port < PortSet->StartingPort + PortSet->PortsToOversee);
+
+    Port -= PortSet->StartingPort;
+    Bucket = PortsShareBucket( PortSet, Port );
+
+    KeAcquireSpinLock( &PortSet->Lock, &OldIrql );
+    for( Entry = Bucket->Flink; Entry != Bucket; Entry = Entry->Flink ) {
+        Share = CONTAINING_RECORD( Entry, PORT_SHARE, ListEntry );
+        if( Share->Port != Port ) continue;
+
+        if( !Found && Share->Owner == Owner )
+            Found = Share;
+        else
+            Shared = TRUE;
+    }
+
+    ASSERT(Found);
+    if( Found ) {
+        RemoveEntryList( &Found->ListEntry );
+
+        /* The last connection on the port gives it back */
+        if( !Shared ) {
+            RtlClearBit( &PortSet->SharedBitmap, Port );
+            RtlClearBit( &PortSet->ProtoBitmap, Port );
+            PortSet->PortsInUse--;
+        }
+    }
+    KeReleaseSpinLock( &PortSet->Lock, OldIrql );
+
+    if( Found ) ExFreePoolWithTag( Found, PORT_SET_TAG );
+}
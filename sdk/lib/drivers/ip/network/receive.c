@@ -469,6 +469,10 @@ VOID ProcessFragment(
       /* Not enough free resources, discard the packet */
       return;
 
+    /* The adapter's checksum results only hold for an unfragmented datagram */
+    if (FragFirst == 0 && !MoreFragments)
+      Datagram.Flags |= IPPacket->Flags & IP_PACKET_FLAG_CHECKSUM_OK;
+
     DISPLAY_IP_PACKET(&Datagram);
 
     /* Give the packet to the protocol dispatcher */
@@ -612,7 +616,8 @@ VOID IPv4Receive(PIP_INTERFACE IF, PIP_PACKET IPPacket)
     }
 
     /* Checksum IPv4 header */
-    if (!IPv4CorrectChecksum(IPPacket->Header, IPPacket->HeaderSize)) {
+    if (!(IPPacket->Flags & IP_PACKET_FLAG_IP_CHECKSUM_OK) &&
+        !IPv4CorrectChecksum(IPPacket->Header, IPPacket->HeaderSize)) {
         TI_DbgPrint(MIN_TRACE, ("Datagram received with bad checksum. Checksum field (0x%X)\n",
 	      WN2H(((PIPv4_HEADER)IPPacket->Header)->Checksum)));
         /* Discard packet */
@@ -17,6 +17,411 @@
 LIST_ENTRY FIBListHead;
 KSPIN_LOCK FIBLock;
 
+/* The FIB list stays authoritative, but IPv4 routes are also kept in a path
+ * compressed binary trie for the lookups. Writers change it under FIBLock
+ * and only ever publish fully built nodes and route sets, so lookups take
+ * no lock. They run at DISPATCH_LEVEL instead, and whatever a writer
+ * unlinks is freed by FIBReclaimWorker once every processor has been below
+ * DISPATCH_LEVEL since */
+typedef struct _FIB_ROUTE {
+    PFIB_ENTRY FIBE;              /* Owning FIB entry, only used by writers */
+    PNEIGHBOR_CACHE_ENTRY Router; /* NULL if the route is gone */
+    UINT Metric;
+} FIB_ROUTE, *PFIB_ROUTE;
+
+typedef struct _FIB_ROUTE_SET {
+    SINGLE_LIST_ENTRY RetireEntry; /* Must be first */
+    UINT Count;
+    FIB_ROUTE Routes[1];
+} FIB_ROUTE_SET, *PFIB_ROUTE_SET;
+
+typedef struct _FIB_NODE {
+    SINGLE_LIST_ENTRY RetireEntry; /* Must be first */
+    struct _FIB_NODE *Child[2];
+    PFIB_ROUTE_SET Routes;        /* Routes for exactly this prefix */
+    ULONG Prefix;                 /* Host order, zero past PrefixLength */
+    UINT PrefixLength;
+} FIB_NODE, *PFIB_NODE;
+
+#define FIB_MASK(Length) ((Length) ? 0xFFFFFFFF << (32 - (Length)) : 0)
+#define FIB_BIT(Key, Index) (((Key) >> (31 - (Index))) & 1)
+
+static PFIB_NODE FIBRoot;
+static SINGLE_LIST_ENTRY FIBRetired;
+static BOOLEAN FIBReclaimPending;
+
+/* Bumped whenever a route or neighbor goes away or a route is added, so
+ * routes cached by connections can be checked without a lookup */
+volatile LONG RouteGeneration = 1;
+
+VOID RouteInvalidateCache(
+    VOID)
+/*
+ * FUNCTION: Invalidates all routes cached outside the routing subsystem
+ */
+{
+    InterlockedIncrement(&RouteGeneration);
+}
+
+static ULONG FIBKey(
+    PIP_ADDRESS Address)
+{
+    return IPv4NToHl(Address->Address.IPv4Address);
+}
+
+static UINT FIBCommonBits(
+    ULONG Key1,
+    ULONG Key2)
+{
+    ULONG Difference = Key1 ^ Key2;
+    UINT Bits = 0;
+
+    if (!Difference) return 32;
+
+    while (!(Difference & 0x80000000)) {
+        Difference <<= 1;
+        Bits++;
+    }
+
+    return Bits;
+}
+
+static VOID FIBReclaimWorker(
+    PVOID Context)
+/*
+ * FUNCTION: Frees trie nodes and route sets unlinked by writers
+ */
+{
+    PSINGLE_LIST_ENTRY Entry, NextEntry;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    for (;;) {
+        TcpipAcquireSpinLock(&FIBLock, &OldIrql);
+        Entry = FIBRetired.Next;
+        FIBRetired.Next = NULL;
+        if (!Entry)
+            FIBReclaimPending = FALSE;
+        TcpipReleaseSpinLock(&FIBLock, OldIrql);
+
+        if (!Entry)
+            break;
+
+        /* Wait out any lookup that could still see what was unlinked */
+        SynchronizeProcessors();
+
+        while (Entry) {
+            NextEntry = Entry->Next;
+            ExFreePoolWithTag(Entry, FIB_TAG);
+            Entry = NextEntry;
+        }
+    }
+}
+
+static VOID FIBRetire(
+    PSINGLE_LIST_ENTRY Entry)
+/*
+ * FUNCTION: Frees a trie node or route set once no lookup can see it
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PushEntryList(&FIBRetired, Entry);
+
+    /* If this fails the next retirement tries again */
+    if (!FIBReclaimPending && ChewCreate(FIBReclaimWorker, NULL))
+        FIBReclaimPending = TRUE;
+}
+
+static PFIB_NODE FIBFindNode(
+    ULONG Prefix,
+    UINT PrefixLength)
+/*
+ * FUNCTION: Finds the trie node for a prefix
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PFIB_NODE Node = FIBRoot;
+
+    while (Node && Node->PrefixLength <= PrefixLength &&
+           !((Prefix ^ Node->Prefix) & FIB_MASK(Node->PrefixLength))) {
+        if (Node->PrefixLength == PrefixLength)
+            return Node;
+
+        Node = Node->Child[FIB_BIT(Prefix, Node->PrefixLength)];
+    }
+
+    return NULL;
+}
+
+static PFIB_NODE FIBAllocateNode(
+    ULONG Prefix,
+    UINT PrefixLength)
+{
+    PFIB_NODE Node = ExAllocatePoolWithTag(NonPagedPool, sizeof(FIB_NODE), FIB_TAG);
+
+    if (!Node) return NULL;
+
+    RtlZeroMemory(Node, sizeof(FIB_NODE));
+    Node->Prefix = Prefix & FIB_MASK(PrefixLength);
+    Node->PrefixLength = PrefixLength;
+
+    return Node;
+}
+
+static PFIB_NODE FIBCreateNode(
+    ULONG Prefix,
+    UINT PrefixLength)
+/*
+ * FUNCTION: Finds or creates the trie node for a prefix
+ * RETURNS:
+ *     Pointer to the node, NULL if there are not enough resources
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PFIB_NODE *Link = &FIBRoot;
+    PFIB_NODE Node, NewNode, Branch;
+    UINT Common;
+
+    for (;;) {
+        Node = *Link;
+
+        if (!Node) {
+            NewNode = FIBAllocateNode(Prefix, PrefixLength);
+            if (NewNode)
+                InterlockedExchangePointer((PVOID*)Link, NewNode);
+            return NewNode;
+        }
+
+        Common = min(FIBCommonBits(Prefix, Node->Prefix),
+                     min(Node->PrefixLength, PrefixLength));
+
+        if (Common == Node->PrefixLength) {
+            if (Common == PrefixLength)
+                return Node;
+
+            Link = &Node->Child[FIB_BIT(Prefix, Common)];
+            continue;
+        }
+
+        NewNode = FIBAllocateNode(Prefix, PrefixLength);
+        if (!NewNode)
+            return NULL;
+
+        if (Common == PrefixLength) {
+            /* The new prefix covers the node, it goes in above it */
+            NewNode->Child[FIB_BIT(Node->Prefix, Common)] = Node;
+            InterlockedExchangePointer((PVOID*)Link, NewNode);
+            return NewNode;
+        }
+
+        /* They split somewhere in the middle */
+        Branch = FIBAllocateNode(Prefix, Common);
+        if (!Branch) {
+            ExFreePoolWithTag(NewNode, FIB_TAG);
+            return NULL;
+        }
+
+        Branch->Child[FIB_BIT(Node->Prefix, Common)] = Node;
+        Branch->Child[FIB_BIT(Prefix, Common)] = NewNode;
+        InterlockedExchangePointer((PVOID*)Link, Branch);
+        return NewNode;
+    }
+}
+
+static BOOLEAN FIBInsertRoute(
+    PFIB_ENTRY FIBE)
+/*
+ * FUNCTION: Adds a FIB entry to the trie
+ * ARGUMENTS:
+ *     FIBE = Pointer to FIB entry
+ * RETURNS:
+ *     TRUE if the route was added, FALSE if there are not enough resources
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    UINT PrefixLength = AddrCountPrefixBits(&FIBE->Netmask);
+    ULONG Prefix = FIBKey(&FIBE->NetworkAddress) & FIB_MASK(PrefixLength);
+    PFIB_NODE Node;
+    PFIB_ROUTE_SET OldSet, NewSet;
+    UINT Count;
+
+    Node = FIBFindNode(Prefix, PrefixLength);
+    OldSet = Node ? Node->Routes : NULL;
+    Count = OldSet ? OldSet->Count : 0;
+
+    NewSet = ExAllocatePoolWithTag(NonPagedPool,
+                                   FIELD_OFFSET(FIB_ROUTE_SET, Routes[Count + 1]),
+                                   FIB_TAG);
+    if (!NewSet)
+        return FALSE;
+
+    if (!Node && !(Node = FIBCreateNode(Prefix, PrefixLength))) {
+        ExFreePoolWithTag(NewSet, FIB_TAG);
+        return FALSE;
+    }
+
+    if (Count)
+        RtlCopyMemory(NewSet->Routes, OldSet->Routes, Count * sizeof(FIB_ROUTE));
+
+    NewSet->Routes[Count].FIBE = FIBE;
+    NewSet->Routes[Count].Router = FIBE->Router;
+    NewSet->Routes[Count].Metric = FIBE->Metric;
+    NewSet->Count = Count + 1;
+
+    InterlockedExchangePointer((PVOID*)&Node->Routes, NewSet);
+
+    if (OldSet)
+        FIBRetire(&OldSet->RetireEntry);
+
+    return TRUE;
+}
+
+static VOID FIBUnlinkNode(
+    PFIB_NODE *Link)
+/*
+ * FUNCTION: Replaces a node without routes by its only child, if it has one
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PFIB_NODE Node = *Link;
+
+    if (Node->Routes || (Node->Child[0] && Node->Child[1]))
+        return;
+
+    InterlockedExchangePointer((PVOID*)Link,
+                               Node->Child[0] ? Node->Child[0] : Node->Child[1]);
+    FIBRetire(&Node->RetireEntry);
+}
+
+static VOID FIBRemoveRoute(
+    PFIB_ENTRY FIBE)
+/*
+ * FUNCTION: Removes a FIB entry from the trie
+ * ARGUMENTS:
+ *     FIBE = Pointer to FIB entry
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    UINT PrefixLength = AddrCountPrefixBits(&FIBE->Netmask);
+    ULONG Prefix = FIBKey(&FIBE->NetworkAddress) & FIB_MASK(PrefixLength);
+    PFIB_NODE *Link = &FIBRoot, *ParentLink = NULL;
+    PFIB_NODE Node;
+    PFIB_ROUTE_SET OldSet, NewSet = NULL;
+    UINT i, j;
+
+    while ((Node = *Link) && Node->PrefixLength < PrefixLength) {
+        ParentLink = Link;
+        Link = &Node->Child[FIB_BIT(Prefix, Node->PrefixLength)];
+    }
+
+    if (!Node || Node->PrefixLength != PrefixLength || Node->Prefix != Prefix ||
+        !(OldSet = Node->Routes))
+        return;
+
+    for (i = 0; i < OldSet->Count && OldSet->Routes[i].FIBE != FIBE; i++);
+    if (i == OldSet->Count)
+        return;
+
+    if (OldSet->Count > 1) {
+        NewSet = ExAllocatePoolWithTag(NonPagedPool,
+                                       FIELD_OFFSET(FIB_ROUTE_SET, Routes[OldSet->Count - 1]),
+                                       FIB_TAG);
+        if (!NewSet) {
+            /* Lookups skip a route without a router, leave it in place */
+            OldSet->Routes[i].FIBE = NULL;
+            OldSet->Routes[i].Router = NULL;
+            return;
+        }
+
+        for (j = 0, NewSet->Count = 0; j < OldSet->Count; j++) {
+            if (j != i)
+                NewSet->Routes[NewSet->Count++] = OldSet->Routes[j];
+        }
+    }
+
+    InterlockedExchangePointer((PVOID*)&Node->Routes, NewSet);
+    FIBRetire(&OldSet->RetireEntry);
+
+    if (NewSet)
+        return;
+
+    /* Drop the node if it was only there for this prefix, and its parent
+     * if that leaves it as a branch with a single child */
+    FIBUnlinkNode(Link);
+    if (ParentLink)
+        FIBUnlinkNode(ParentLink);
+}
+
+static PNEIGHBOR_CACHE_ENTRY FIBLookup(
+    ULONG Key)
+/*
+ * FUNCTION: Finds the best router for an IPv4 destination in the trie
+ * ARGUMENTS:
+ *     Key = Destination address in host order
+ * RETURNS:
+ *     Pointer to NCE for router, NULL if none was found
+ * NOTES:
+ *     Must be called at DISPATCH_LEVEL, no lock is needed
+ */
+{
+    PFIB_ROUTE_SET Matches[33], Set, FallbackSet = NULL;
+    PFIB_NODE Node = FIBRoot;
+    PNEIGHBOR_CACHE_ENTRY Router, Best, Fallback = NULL;
+    UINT Count = 0, BestMetric = 0, FallbackMetric = 0, i;
+
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    while (Node && !((Key ^ Node->Prefix) & FIB_MASK(Node->PrefixLength))) {
+        if ((Set = Node->Routes))
+            Matches[Count++] = Set;
+
+        if (Node->PrefixLength == 32)
+            break;
+
+        Node = Node->Child[FIB_BIT(Key, Node->PrefixLength)];
+    }
+
+    /* The longest prefix wins, but a router we know is reachable is
+     * preferred over a more specific one that stopped answering */
+    while (Count--) {
+        Set = Matches[Count];
+        Best = NULL;
+
+        for (i = 0; i < Set->Count; i++) {
+            Router = Set->Routes[i].Router;
+            if (!Router)
+                continue;
+
+            /* If nothing is known to be reachable, use the most specific
+             * route regardless */
+            if (!FallbackSet || (FallbackSet == Set &&
+                                 Set->Routes[i].Metric < FallbackMetric)) {
+                FallbackSet = Set;
+                Fallback = Router;
+                FallbackMetric = Set->Routes[i].Metric;
+            }
+
+            if (!(Router->State & (NUD_STALE | NUD_INCOMPLETE)) &&
+                (!Best || Set->Routes[i].Metric < BestMetric)) {
+                Best = Router;
+                BestMetric = Set->Routes[i].Metric;
+            }
+        }
+
+        if (Best)
+            return Best;
+    }
+
+    return Fallback;
+}
+
 void RouterDumpRoutes() {
     PLIST_ENTRY CurrentEntry;
     PLIST_ENTRY NextEntry;
@@ -66,8 +471,12 @@ VOID DestroyFIBE(
 {
     TI_DbgPrint(DEBUG_ROUTER, ("Called. FIBE (0x%X).\n", FIBE));
 
-    /* Unlink the FIB entry from the list */
+    /* Unlink the FIB entry from the list and the trie */
     RemoveEntryList(&FIBE->ListEntry);
+    if (FIBE->NetworkAddress.Type == IP_ADDRESS_V4)
+        FIBRemoveRoute(FIBE);
+
+    RouteInvalidateCache();
 
     /* And free the FIB entry */
     FreeFIB(FIBE);
@@ -207,6 +616,7 @@ PFIB_ENTRY RouterAddRoute(
  */
 {
     PFIB_ENTRY FIBE;
+    KIRQL OldIrql;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. NetworkAddress (0x%X)  Netmask (0x%X) "
         "Router (0x%X)  Metric (%d).\n", NetworkAddress, Netmask, Router, Metric));
@@ -230,21 +640,33 @@ PFIB_ENTRY RouterAddRoute(
     FIBE->Metric         = Metric;
 
     /* Add FIB to the forward information base */
-    TcpipInterlockedInsertTailList(&FIBListHead, &FIBE->ListEntry, &FIBLock);
+    TcpipAcquireSpinLock(&FIBLock, &OldIrql);
+
+    if (FIBE->NetworkAddress.Type == IP_ADDRESS_V4 && !FIBInsertRoute(FIBE)) {
+        TcpipReleaseSpinLock(&FIBLock, OldIrql);
+        TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        FreeFIB(FIBE);
+        return NULL;
+    }
+
+    InsertTailList(&FIBListHead, &FIBE->ListEntry);
+    RouteInvalidateCache();
+
+    TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
     return FIBE;
 }
 
 
-PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
+static PNEIGHBOR_CACHE_ENTRY RouterScanRoutes(PIP_ADDRESS Destination)
 /*
- * FUNCTION: Finds a router to use to get to Destination
+ * FUNCTION: Finds a router to use to get to Destination by walking the FIB
  * ARGUMENTS:
- *     Destination = Pointer to destination address (NULL means don't care)
+ *     Destination = Pointer to destination address
  * RETURNS:
  *     Pointer to NCE for router, NULL if none was found
  * NOTES:
- *     If found the NCE is referenced
+ *     Only used for addresses the trie doesn't hold
  */
 {
     KIRQL OldIrql;
@@ -255,10 +677,6 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
     UINT Length, BestLength = 0, MaskLength;
     PNEIGHBOR_CACHE_ENTRY NCE, BestNCE = NULL;
 
-    TI_DbgPrint(DEBUG_ROUTER, ("Called. Destination (0x%X)\n", Destination));
-
-    TI_DbgPrint(DEBUG_ROUTER, ("Destination (%s)\n", A2S(Destination)));
-
     TcpipAcquireSpinLock(&FIBLock, &OldIrql);
 
     CurrentEntry = FIBListHead.Flink;
@@ -288,6 +706,35 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
+    return BestNCE;
+}
+
+PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
+/*
+ * FUNCTION: Finds a router to use to get to Destination
+ * ARGUMENTS:
+ *     Destination = Pointer to destination address (NULL means don't care)
+ * RETURNS:
+ *     Pointer to NCE for router, NULL if none was found
+ * NOTES:
+ *     If found the NCE is referenced
+ */
+{
+    KIRQL OldIrql;
+    PNEIGHBOR_CACHE_ENTRY BestNCE;
+
+    TI_DbgPrint(DEBUG_ROUTER, ("Called. Destination (0x%X)\n", Destination));
+
+    TI_DbgPrint(DEBUG_ROUTER, ("Destination (%s)\n", A2S(Destination)));
+
+    if (Destination->Type == IP_ADDRESS_V4) {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        BestNCE = FIBLookup(FIBKey(Destination));
+        KeLowerIrql(OldIrql);
+    } else {
+        BestNCE = RouterScanRoutes(Destination);
+    }
+
     if( BestNCE ) {
 	TI_DbgPrint(DEBUG_ROUTER,("Routing to %s\n", A2S(&BestNCE->Address)));
     } else {
@@ -492,6 +939,9 @@ NTSTATUS RouterStartup(
     /* Initialize the Forward Information Base */
     InitializeListHead(&FIBListHead);
     TcpipInitializeSpinLock(&FIBLock);
+    FIBRoot = NULL;
+    FIBRetired.Next = NULL;
+    FIBReclaimPending = FALSE;
 
     return STATUS_SUCCESS;
 }
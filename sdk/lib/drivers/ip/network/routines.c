@@ -26,6 +26,30 @@ UINT Random(
     return RandomNumber;
 }
 
+
+VOID SynchronizeProcessors(
+    VOID)
+/*
+ * FUNCTION: Waits until every processor has been below DISPATCH_LEVEL
+ * NOTES:
+ *     Lockless readers run at DISPATCH_LEVEL, so anything they could see
+ *     before this is called can be freed once it returns. Must be called
+ *     at PASSIVE_LEVEL from a system thread
+ */
+{
+    KAFFINITY Active;
+    ULONG i;
+
+    /* Once this thread has run on a processor, that processor has left
+     * anything it was doing at DISPATCH_LEVEL */
+    Active = KeQueryActiveProcessors();
+    for (i = 0; i < sizeof(KAFFINITY) * 8; i++) {
+        if (Active & ((KAFFINITY)1 << i))
+            KeSetSystemAffinityThread((KAFFINITY)1 << i);
+    }
+    KeRevertToUserAffinityThread();
+}
+
 #if DBG
 static VOID DisplayIPHeader(
     PCHAR Header,
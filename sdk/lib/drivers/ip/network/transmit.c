@@ -196,6 +196,15 @@ NTSTATUS SendFragments(
 
     RtlCopyMemory( IFC->Header, IPPacket->Header, IPPacket->HeaderSize );
 
+    /* A datagram that goes out in one piece keeps its offload requests */
+    if (IFC->BytesLeft <= PathMTU - IFC->HeaderSize)
+    {
+        NDIS_PER_PACKET_INFO_FROM_PACKET(IFC->NdisPacket, TcpIpChecksumPacketInfo) =
+            NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket, TcpIpChecksumPacketInfo);
+        NDIS_PER_PACKET_INFO_FROM_PACKET(IFC->NdisPacket, TcpLargeSendPacketInfo) =
+            NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket, TcpLargeSendPacketInfo);
+    }
+
     while (PrepareNextFragment(IFC))
     {
         NdisStatus = IPSendFragment(IFC->NdisPacket, NCE, IFC);
@@ -234,14 +243,24 @@ NTSTATUS IPSendDatagram(PIP_PACKET IPPacket, PNEIGHBOR_CACHE_ENTRY NCE)
  *     send routine (IPSendFragment)
  */
 {
+    UINT PathMTU;
+
     TI_DbgPrint(MAX_TRACE, ("Called. IPPacket (0x%X)  NCE (0x%X)\n", IPPacket, NCE));
 
     DISPLAY_IP_PACKET(IPPacket);
 
     /* Fetch path MTU now, because it may change */
-    TI_DbgPrint(MID_TRACE,("PathMTU: %d\n", NCE->Interface->MTU));
+    PathMTU = NCE->Interface->MTU;
+    TI_DbgPrint(MID_TRACE,("PathMTU: %d\n", PathMTU));
+
+    /* The adapter cuts a large send into MTU sized segments itself */
+    if (NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket, TcpLargeSendPacketInfo) != NULL &&
+        IPPacket->TotalSize <= NCE->Interface->LargeSendSize)
+    {
+        PathMTU = IPPacket->TotalSize;
+    }
 
-    return SendFragments(IPPacket, NCE, NCE->Interface->MTU);
+    return SendFragments(IPPacket, NCE, PathMTU);
 }
 
 /* EOF */
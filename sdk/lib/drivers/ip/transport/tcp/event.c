@@ -365,6 +365,7 @@ TCPSendEventHandler(void *arg, const u16_t space)
     NTSTATUS Status;
     PMDL Mdl;
     ULONG BytesSent;
+    err_t Error;
     
     ReferenceObject(Connection);
 
@@ -392,9 +393,10 @@ TCPSendEventHandler(void *arg, const u16_t space)
          ("Connection->SocketContext: %x\n",
           Connection->SocketContext));
         
-        Status = TCPTranslateError(LibTCPSend(Connection,
-                                              SendBuffer,
-                                              SendLen, &BytesSent, TRUE));
+        if (!LibTCPLoopbackSend(Connection, SendBuffer, SendLen, &BytesSent, &Error))
+            Error = LibTCPSend(Connection, SendBuffer, SendLen, &BytesSent, TRUE);
+
+        Status = TCPTranslateError(Error);
         
         TI_DbgPrint(DEBUG_TCP,("TCP Bytes: %d\n", BytesSent));
         
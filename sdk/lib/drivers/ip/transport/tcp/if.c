@@ -6,17 +6,188 @@
 #include "lwip/ip.h"
 #include "lwip/api.h"
 #include "lwip/tcpip.h"
+#include "lwip/tcp_impl.h"
 
+#if TCP_LARGE_SEND
+static
+u16_t
+TCPLargeSendPayload(PIP_INTERFACE IF)
+{
+    /* Leave room for the IP header and the largest TCP header */
+    if (IF->LargeSendSize <= IF->MTU)
+        return 0;
+
+    return (u16_t)(IF->LargeSendSize - sizeof(IPv4_HEADER) - 60);
+}
+#endif
+
+static
 err_t
-TCPSendDataCallback(struct netif *netif, struct pbuf *p, struct ip_addr *dest)
+TCPSendSegment(
+    PNEIGHBOR_CACHE_ENTRY NCE,
+    PIP_ADDRESS LocalAddress,
+    PIP_ADDRESS RemoteAddress,
+    struct pbuf *p,
+    ULONG HeaderLength,
+    ULONG DataOffset,
+    ULONG DataLength,
+    USHORT Index)
+/*
+ * FUNCTION: Sends (part of) a packet built by lwIP as one IP packet
+ * ARGUMENTS:
+ *     NCE           = Neighbor to send the packet to
+ *     LocalAddress  = Source address of the packet
+ *     RemoteAddress = Destination address of the packet
+ *     p             = Packet built by lwIP
+ *     HeaderLength  = Length of the IP header, and the TCP header for TCP
+ *     DataOffset    = Where the data to send starts, counted after the headers
+ *     DataLength    = Number of data bytes to send
+ *     Index         = Number of this piece if lwIP's segment is cut up here
+ * RETURNS:
+ *     lwIP error code
+ * NOTES:
+ *     Anything larger than the MTU must be a TCP segment the adapter
+ *     can take as a large send
+ */
 {
     NDIS_STATUS NdisStatus;
-    PNEIGHBOR_CACHE_ENTRY NCE;
     IP_PACKET Packet;
+    PIPv4_HEADER Header;
+    PTCPv4_HEADER TCPHeader;
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
+    ULONG TotalLength, IPHeaderLength, Sum, SequenceNumber;
+
+    IPInitializePacket(&Packet, LocalAddress->Type);
+
+    TotalLength = HeaderLength + DataLength;
+    NdisStatus = AllocatePacketWithBuffer(&Packet.NdisPacket, NULL, TotalLength);
+    if (NdisStatus != NDIS_STATUS_SUCCESS)
+    {
+        return ERR_MEM;
+    }
+
+    GetDataPtr(Packet.NdisPacket, 0, (PCHAR*)&Packet.Header, &Packet.TotalSize);
+    Packet.MappedHeader = TRUE;
+
+    ASSERT(Packet.TotalSize == TotalLength);
+
+    pbuf_copy_partial(p, Packet.Header, (u16_t)HeaderLength, 0);
+    pbuf_copy_partial(p,
+                      (PCHAR)Packet.Header + HeaderLength,
+                      (u16_t)DataLength,
+                      (u16_t)(HeaderLength + DataOffset));
+
+    Header = Packet.Header;
+    IPHeaderLength = (Header->VerIHL & 0x0F) << 2;
+
+    if (Header->Protocol == IPPROTO_TCP)
+    {
+        TCPHeader = (PTCPv4_HEADER)((PCHAR)Header + IPHeaderLength);
+
+        if (TotalLength != p->tot_len)
+        {
+            /* One MSS of a segment built for large send. Only the last
+             * piece keeps PSH and FIN */
+            SequenceNumber = DN2H(TCPHeader->SequenceNumber) + DataOffset;
+            TCPHeader->SequenceNumber = DH2N(SequenceNumber);
+            if (HeaderLength + DataOffset + DataLength < p->tot_len)
+                TCPHeader->Flags &= ~(TCP_PSH | TCP_FIN);
+
+            Header->TotalLength = WH2N((USHORT)TotalLength);
+            Header->Id = WH2N((USHORT)(WN2H(Header->Id) + Index));
+            Header->Checksum = 0;
+            Header->Checksum = (USHORT)IPv4Checksum(Header, IPHeaderLength, 0);
+        }
+
+        /* lwIP leaves the TCP checksum to us (CHECKSUM_GEN_TCP is off) because
+         * only now do we know which adapter the segment goes out on */
+        if (TotalLength > NCE->Interface->MTU)
+        {
+            /* The adapter cuts the segment up and checksums every piece,
+             * starting from the pseudo header sum without the length */
+            Sum = ChecksumCompute(&Header->SrcAddr, sizeof(IPv4_RAW_ADDRESS), 0);
+            Sum = ChecksumCompute(&Header->DstAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+            Sum += WH2N((USHORT)IPPROTO_TCP);
+            TCPHeader->Checksum = (USHORT)ChecksumFold(Sum);
+
+            /* This is NOT a pointer. MSDN explicitly says so. */
+            NDIS_PER_PACKET_INFO_FROM_PACKET(Packet.NdisPacket,
+                                             TcpLargeSendPacketInfo) = UlongToPtr(NCE->Interface->MTU - HeaderLength);
+        }
+        else if ((NCE->Interface->ChecksumOffload & IP_CHECKSUM_OFFLOAD_TX_TCP) &&
+                 IPHeaderLength == sizeof(IPv4_HEADER))
+        {
+            ChecksumInfo.Value = 0;
+            ChecksumInfo.Transmit.NdisPacketChecksumV4 = 1;
+            ChecksumInfo.Transmit.NdisPacketTcpChecksum = 1;
+            NDIS_PER_PACKET_INFO_FROM_PACKET(Packet.NdisPacket,
+                                             TcpIpChecksumPacketInfo) = UlongToPtr(ChecksumInfo.Value);
+        }
+        else
+        {
+            TCPHeader->Checksum = 0;
+            TCPHeader->Checksum = WH2N((USHORT)TCPv4ChecksumCalculate(Header,
+                                                                      (PUCHAR)TCPHeader,
+                                                                      TotalLength - IPHeaderLength));
+        }
+    }
+
+    Packet.HeaderSize = sizeof(IPv4_HEADER);
+    Packet.TotalSize = TotalLength;
+    Packet.SrcAddr = *LocalAddress;
+    Packet.DstAddr = *RemoteAddress;
+
+    NdisStatus = IPSendDatagram(&Packet, NCE);
+    if (!NT_SUCCESS(NdisStatus))
+        return ERR_RTE;
+
+    return ERR_OK;
+}
+
+static
+PNEIGHBOR_CACHE_ENTRY
+TCPGetRoute(struct netif *netif, PIP_ADDRESS RemoteAddress)
+{
+    struct netif_route_hint *Hint = netif->route_hint;
+    PNEIGHBOR_CACHE_ENTRY NCE;
+    LONG Generation;
+
+    /* The hint lives in the pcb and is only used from the lwIP thread. What
+     * it holds is good as long as no route or neighbor changed since, but a
+     * router that went stale may have a better alternative now */
+    if (Hint && Hint->route && Hint->generation == (u32_t)RouteGeneration)
+    {
+        NCE = Hint->route;
+        if (!(NCE->State & NUD_STALE))
+            return NCE;
+    }
+
+    Generation = RouteGeneration;
+    NCE = RouteGetRouteToDestination(RemoteAddress);
+
+    if (Hint)
+    {
+        Hint->route = NCE;
+        Hint->generation = (u32_t)Generation;
+    }
+
+    return NCE;
+}
+
+err_t
+TCPSendDataCallback(struct netif *netif, struct pbuf *p, struct ip_addr *dest)
+{
+    PNEIGHBOR_CACHE_ENTRY NCE;
+    PIP_INTERFACE IF;
     IP_ADDRESS RemoteAddress, LocalAddress;
     PIPv4_HEADER Header;
-    ULONG Length;
-    ULONG TotalLength;
+    PTCPv4_HEADER TCPHeader;
+    ULONG HeaderLength;
+    ULONG DataLength;
+    ULONG Offset;
+    ULONG Mss;
+    USHORT Index;
+    err_t Error;
 
     /* The caller frees the pbuf struct */
 
@@ -35,46 +206,49 @@ TCPSendDataCallback(struct netif *netif, struct pbuf *p, struct ip_addr *dest)
         return ERR_IF;
     }
 
-    IPInitializePacket(&Packet, LocalAddress.Type);
-
-    if (!(NCE = RouteGetRouteToDestination(&RemoteAddress)))
+    if (!(NCE = TCPGetRoute(netif, &RemoteAddress)))
     {
         return ERR_RTE;
     }
 
-    NdisStatus = AllocatePacketWithBuffer(&Packet.NdisPacket, NULL, p->tot_len);
-    if (NdisStatus != NDIS_STATUS_SUCCESS)
+    /* lwIP puts all headers in the first pbuf */
+    HeaderLength = (Header->VerIHL & 0x0F) << 2;
+    if (Header->Protocol == IPPROTO_TCP)
     {
-        return ERR_MEM;
+        TCPHeader = (PTCPv4_HEADER)((PCHAR)Header + HeaderLength);
+        HeaderLength += TCP_DATA_OFFSET(TCPHeader->DataOffset);
     }
+    ASSERT(p->len >= HeaderLength);
+    DataLength = p->tot_len - HeaderLength;
 
-    GetDataPtr(Packet.NdisPacket, 0, (PCHAR*)&Packet.Header, &Packet.TotalSize);
-    Packet.MappedHeader = TRUE;
-
-    ASSERT(Packet.TotalSize == p->tot_len);
-
-    TotalLength = p->tot_len;
-    Length = 0;
-    while (Length < TotalLength)
+    IF = NCE->Interface;
+    if (p->tot_len <= IF->MTU || Header->Protocol != IPPROTO_TCP)
     {
-        ASSERT(p->len <= TotalLength - Length);
-        ASSERT(p->tot_len == TotalLength - Length);
-        RtlCopyMemory((PCHAR)Packet.Header + Length, p->payload, p->len);
-        Length += p->len;
-        p = p->next;
+        return TCPSendSegment(NCE, &LocalAddress, &RemoteAddress, p,
+                              HeaderLength, 0, DataLength, 0);
     }
-    ASSERT(Length == TotalLength);
 
-    Packet.HeaderSize = sizeof(IPv4_HEADER);
-    Packet.TotalSize = TotalLength;
-    Packet.SrcAddr = LocalAddress;
-    Packet.DstAddr = RemoteAddress;
+    /* lwIP built a segment larger than the MTU for an adapter that does
+     * large send. Hand it over whole if this adapter takes it */
+    Mss = IF->MTU - HeaderLength;
+    if (p->tot_len <= IF->LargeSendSize &&
+        ((Header->VerIHL & 0x0F) << 2) == sizeof(IPv4_HEADER) &&
+        DataLength > (IF->LargeSendMinSegments - 1) * Mss)
+    {
+        return TCPSendSegment(NCE, &LocalAddress, &RemoteAddress, p,
+                              HeaderLength, 0, DataLength, 0);
+    }
 
-    NdisStatus = IPSendDatagram(&Packet, NCE);
-    if (!NT_SUCCESS(NdisStatus))
-        return ERR_RTE;
+    /* Otherwise the route changed or the segment is too short, so cut it up here */
+    for (Offset = 0, Index = 0; Offset < DataLength; Offset += Mss, Index++)
+    {
+        Error = TCPSendSegment(NCE, &LocalAddress, &RemoteAddress, p,
+                               HeaderLength, Offset, min(Mss, DataLength - Offset), Index);
+        if (Error != ERR_OK)
+            return Error;
+    }
 
-    return 0;
+    return ERR_OK;
 }
 
 VOID
@@ -102,6 +276,9 @@ TCPInterfaceInit(struct netif *netif)
 
     netif->output = TCPSendDataCallback;
     netif->mtu = IF->MTU;
+#if TCP_LARGE_SEND
+    netif->lso_max = TCPLargeSendPayload(IF);
+#endif
     
     netif->name[0] = 'e';
     netif->name[1] = 'n';
@@ -159,6 +336,11 @@ TCPUpdateInterfaceIPInformation(PIP_INTERFACE IF)
                             (PULONG)&netmask.addr);
     
     netif_set_addr(IF->TCPContext, &ipaddr, &netmask, &gw);
+
+#if TCP_LARGE_SEND
+    /* The adapter's offloads are only known once it is bound */
+    ((struct netif *)IF->TCPContext)->lso_max = TCPLargeSendPayload(IF);
+#endif
     
     if (ipaddr.addr != 0)
     {
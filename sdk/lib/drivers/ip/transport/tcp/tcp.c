@@ -173,11 +173,19 @@ VOID TCPReceive(PIP_INTERFACE Interface, PIP_PACKET IPPacket)
  *     This is the low level interface for receiving TCP data
  */
 {
+    u8_t Flags = 0;
+
     TI_DbgPrint(DEBUG_TCP,("Sending packet %d (%d) to lwIP\n",
                            IPPacket->TotalSize,
                            IPPacket->HeaderSize));
-    
-    LibIPInsertPacket(Interface->TCPContext, IPPacket->Header, IPPacket->TotalSize);
+
+    /* Don't make lwIP redo what the adapter has already checked */
+    if (IPPacket->Flags & IP_PACKET_FLAG_IP_CHECKSUM_OK)
+        Flags |= PBUF_FLAG_IP_CHKSUM_OK;
+    if (IPPacket->Flags & IP_PACKET_FLAG_TCP_CHECKSUM_OK)
+        Flags |= PBUF_FLAG_TCP_CHKSUM_OK;
+
+    LibIPInsertPacket(Interface->TCPContext, IPPacket->Header, IPPacket->TotalSize, Flags);
 }
 
 NTSTATUS TCPStartup(VOID)
@@ -284,7 +292,7 @@ NTSTATUS TCPConnect
     struct ip_addr bindaddr, connaddr;
     IP_ADDRESS RemoteAddress;
     USHORT RemotePort;
-    TA_IP_ADDRESS LocalAddress;
+    UINT Port;
     PTDI_BUCKET Bucket;
     PNEIGHBOR_CACHE_ENTRY NCE;
     KIRQL OldIrql;
@@ -331,6 +339,24 @@ NTSTATUS TCPConnect
         bindaddr.addr = Connection->AddressFile->Address.Address.IPv4Address;
     }
 
+    /* Check if we had an unspecified port */
+    if (!Connection->AddressFile->Port)
+    {
+        /* We did, so pick one. Connections to different destinations can
+         * end up on the same one, lwIP checks the whole tuple is unique */
+        Port = TCPAllocateConnectPort(Connection->AddressFile,
+                                      RemoteAddress.Address.IPv4Address,
+                                      RemotePort);
+        if (Port == (UINT)-1)
+        {
+            UnlockObject(Connection, OldIrql);
+            return STATUS_TOO_MANY_ADDRESSES;
+        }
+
+        Connection->AddressFile->Port = (USHORT)Port;
+        Connection->AddressFile->SharedPort = TRUE;
+    }
+
     Status = TCPTranslateError(LibTCPBind(Connection,
                                           &bindaddr,
                                           Connection->AddressFile->Port));
@@ -339,41 +365,24 @@ NTSTATUS TCPConnect
     {
         /* Copy bind address into connection */
         Connection->AddressFile->Address.Address.IPv4Address = bindaddr.addr;
-        /* Check if we had an unspecified port */
-        if (!Connection->AddressFile->Port)
-        {
-            /* We did, so we need to copy back the port */
-            Status = TCPGetSockAddress(Connection, (PTRANSPORT_ADDRESS)&LocalAddress, FALSE);
-            if (NT_SUCCESS(Status))
-            {
-                /* Allocate the port in the port bitmap */
-                Connection->AddressFile->Port = TCPAllocatePort(LocalAddress.Address[0].Address[0].sin_port);
-                    
-                /* This should never fail */
-                ASSERT(Connection->AddressFile->Port != 0xFFFF);
-            }
-        }
 
-        if (NT_SUCCESS(Status))
+        connaddr.addr = RemoteAddress.Address.IPv4Address;
+
+        Bucket = ExAllocateFromNPagedLookasideList(&TdiBucketLookasideList);
+        if (!Bucket)
         {
-            connaddr.addr = RemoteAddress.Address.IPv4Address;
+            UnlockObject(Connection, OldIrql);
+            return STATUS_NO_MEMORY;
+        }
+        
+        Bucket->Request.RequestNotifyObject = (PVOID)Complete;
+        Bucket->Request.RequestContext = Context;
 
-            Bucket = ExAllocateFromNPagedLookasideList(&TdiBucketLookasideList);
-            if (!Bucket)
-            {
-                UnlockObject(Connection, OldIrql);
-                return STATUS_NO_MEMORY;
-            }
-            
-            Bucket->Request.RequestNotifyObject = (PVOID)Complete;
-            Bucket->Request.RequestContext = Context;
+        InsertTailList( &Connection->ConnectRequest, &Bucket->Entry );
 
-            InsertTailList( &Connection->ConnectRequest, &Bucket->Entry );
-        
-            Status = TCPTranslateError(LibTCPConnect(Connection,
-                                                     &connaddr,
-                                                     RemotePort));
-        }
+        Status = TCPTranslateError(LibTCPConnect(Connection,
+                                                 &connaddr,
+                                                 RemotePort));
     }
 
     UnlockObject(Connection, OldIrql);
@@ -533,8 +542,7 @@ NTSTATUS TCPSendData
     NTSTATUS Status;
     PTDI_BUCKET Bucket;
     KIRQL OldIrql;
-
-    LockObject(Connection, &OldIrql);
+    err_t Error;
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSendData] Called for %d bytes (on socket %x)\n",
                            SendLength, Connection->SocketContext));
@@ -543,11 +551,35 @@ NTSTATUS TCPSendData
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSendData] Connection->SocketContext = %x\n",
                            Connection->SocketContext));
 
-    Status = TCPTranslateError(LibTCPSend(Connection,
-                                          BufferData,
-                                          SendLength,
-                                          BytesSent,
-                                          FALSE));
+    /* Data for the other end of a connection on this host goes straight
+     * onto its receive queue. That takes its lock, so it's done before we
+     * take ours */
+    if (IsListEmpty(&Connection->SendRequest) &&
+        LibTCPLoopbackSend(Connection, BufferData, SendLength, BytesSent, &Error))
+    {
+        Status = TCPTranslateError(Error);
+
+        LockObject(Connection, &OldIrql);
+    }
+    else
+    {
+        LockObject(Connection, &OldIrql);
+
+        if (Connection->LoopbackPeer && !IsListEmpty(&Connection->SendRequest))
+        {
+            /* Wait for our turn, TCPSendEventHandler sends it directly */
+            *BytesSent = 0;
+            Status = STATUS_PENDING;
+        }
+        else
+        {
+            Status = TCPTranslateError(LibTCPSend(Connection,
+                                                  BufferData,
+                                                  SendLength,
+                                                  BytesSent,
+                                                  FALSE));
+        }
+    }
     
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSendData] Send: %x, %d\n", Status, SendLength));
 
@@ -572,6 +604,10 @@ NTSTATUS TCPSendData
 
     UnlockObject(Connection, OldIrql);
 
+    /* The peer might have made room before the request was queued */
+    if (Status == STATUS_PENDING)
+        LibTCPLoopbackSendPending(Connection);
+
     TI_DbgPrint(DEBUG_TCP, ("[IP, TCPSendData] Leaving. Status = %x\n", Status));
 
     return Status;
@@ -598,6 +634,21 @@ VOID TCPFreePort(const UINT Port)
     DeallocatePort(&TCPPorts, Port);
 }
 
+UINT TCPAllocateConnectPort(PVOID Owner, ULONG RemoteAddress, USHORT RemotePort)
+{
+    return AllocateConnectPort(&TCPPorts,
+                               TCP_CONNECT_PORT_LOW,
+                               TCP_CONNECT_PORT_HIGH,
+                               Owner,
+                               RemoteAddress,
+                               RemotePort);
+}
+
+VOID TCPFreeConnectPort(const UINT Port, PVOID Owner)
+{
+    DeallocateConnectPort(&TCPPorts, Port, Owner);
+}
+
 NTSTATUS TCPGetSockAddress
 ( PCONNECTION_ENDPOINT Connection,
   PTRANSPORT_ADDRESS Address,
@@ -691,5 +742,20 @@ TCPSetNoDelay(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+TCPSetBufferSize(
+    PCONNECTION_ENDPOINT Connection,
+    BOOLEAN Receive,
+    ULONG Size)
+{
+    if (!Connection)
+        return STATUS_UNSUCCESSFUL;
+
+    if (Connection->SocketContext == NULL)
+        return STATUS_UNSUCCESSFUL;
+
+    return TCPTranslateError(LibTCPSetBufferSize(Connection, Receive, Size));
+}
+
 
 /* EOF */
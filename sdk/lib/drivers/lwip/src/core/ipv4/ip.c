@@ -363,7 +363,8 @@ ip_input(struct pbuf *p, struct netif *inp)
 
   /* verify checksum */
 #if CHECKSUM_CHECK_IP
-  if (inet_chksum(iphdr, iphdr_hlen) != 0) {
+  if (!(p->flags & PBUF_FLAG_IP_CHKSUM_OK) &&
+      (inet_chksum(iphdr, iphdr_hlen) != 0)) {
 
     LWIP_DEBUGF(IP_DEBUG | LWIP_DBG_LEVEL_SERIOUS,
       ("Checksum (0x%"X16_F") failed, IP packet dropped.\n", inet_chksum(iphdr, iphdr_hlen)));
@@ -879,6 +880,42 @@ ip_output_hinted(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
 }
 #endif /* LWIP_NETIF_HWADDRHINT*/
 
+#if LWIP_NETIF_ROUTEHINT
+/** Like ip_output, but the netif output function gets the route hint of
+ *  the pcb the packet belongs to in netif->route_hint
+ *
+ *  @param route_hint route hint pointer set to netif->route_hint before
+ *         calling ip_output_if()
+ *
+ *  @return ERR_RTE if no route is found
+ *          see ip_output_if() for more return values
+ */
+err_t
+ip_output_route_hinted(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
+          u8_t ttl, u8_t tos, u8_t proto, struct netif_route_hint *route_hint)
+{
+  struct netif *netif;
+  err_t err;
+
+  /* pbufs passed to IP must have a ref-count of 1 as their payload pointer
+     gets altered as the packet is passed down the stack */
+  LWIP_ASSERT("p->ref == 1", p->ref == 1);
+
+  if ((netif = ip_route(dest)) == NULL) {
+    LWIP_DEBUGF(IP_DEBUG, ("ip_output: No route to %"U16_F".%"U16_F".%"U16_F".%"U16_F"\n",
+      ip4_addr1_16(dest), ip4_addr2_16(dest), ip4_addr3_16(dest), ip4_addr4_16(dest)));
+    IP_STATS_INC(ip.rterr);
+    return ERR_RTE;
+  }
+
+  NETIF_SET_ROUTEHINT(netif, route_hint);
+  err = ip_output_if(p, src, dest, ttl, tos, proto, netif);
+  NETIF_SET_ROUTEHINT(netif, NULL);
+
+  return err;
+}
+#endif /* LWIP_NETIF_ROUTEHINT*/
+
 #if IP_DEBUG
 /* Print an IP header by using LWIP_DEBUGF
  * @param p an IP packet, p->payload pointing to the IP header
@@ -172,7 +172,7 @@ tcp_close_shutdown(struct tcp_pcb *pcb, u8_t rst_on_unacked_data)
   err_t err;
 
   if (rst_on_unacked_data && ((pcb->state == ESTABLISHED) || (pcb->state == CLOSE_WAIT))) {
-    if ((pcb->refused_data != NULL) || (pcb->rcv_wnd != TCP_WND)) {
+    if ((pcb->refused_data != NULL) || (pcb->rcv_wnd != TCP_WND_MAX(pcb))) {
       /* Not all data received by application, send RST to tell the remote
          side about this. */
       LWIP_ASSERT("pcb->flags & TF_RXCLOSED", pcb->flags & TF_RXCLOSED);
@@ -580,7 +580,7 @@ u32_t tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
 {
   u32_t new_right_edge = pcb->rcv_nxt + pcb->rcv_wnd;
 
-  if (TCP_SEQ_GEQ(new_right_edge, pcb->rcv_ann_right_edge + LWIP_MIN((TCP_WND / 2), pcb->mss))) {
+  if (TCP_SEQ_GEQ(new_right_edge, pcb->rcv_ann_right_edge + LWIP_MIN((TCP_WND_MAX(pcb) / 2), pcb->mss))) {
     /* we can advertise more window */
     pcb->rcv_ann_wnd = pcb->rcv_wnd;
     return new_right_edge - pcb->rcv_ann_right_edge;
@@ -592,13 +592,104 @@ u32_t tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
     } else {
       /* keep the right edge of window constant */
       u32_t new_rcv_ann_wnd = pcb->rcv_ann_right_edge - pcb->rcv_nxt;
+#if !LWIP_WND_SCALE && !TCP_WND_AUTOTUNE
       LWIP_ASSERT("new_rcv_ann_wnd <= 0xffff", new_rcv_ann_wnd <= 0xffff);
-      pcb->rcv_ann_wnd = (u16_t)new_rcv_ann_wnd;
+#endif
+      pcb->rcv_ann_wnd = (tcpwnd_size_t)new_rcv_ann_wnd;
     }
     return 0;
   }
 }
 
+#if TCP_WND_AUTOTUNE
+/**
+ * Receive window autotuning, called whenever the application has taken
+ * data from a pcb.
+ *
+ * Each round lasts until a full window of data has arrived in order.
+ * A sender can't deliver more than one window per round trip, so if the
+ * application has kept up and most of the window is free again by then,
+ * the window (not the application) is what limits the connection, and
+ * it is doubled, up to TCP_WND.
+ *
+ * @param pcb the tcp_pcb for which data was read
+ */
+static void
+tcp_rcv_autotune(struct tcp_pcb *pcb)
+{
+  tcpwnd_size_t limit, new_max;
+
+  if ((pcb->flags & TF_RCVBUF_LOCK) || TCP_SEQ_LT(pcb->rcv_nxt, pcb->rcv_tune_seq)) {
+    return;
+  }
+
+  limit = TCP_WND_LIMIT(pcb);
+  if ((pcb->rcv_wnd >= pcb->rcv_wnd_max - pcb->rcv_wnd_max / 4) &&
+      (pcb->rcv_wnd_max < limit)) {
+    new_max = (pcb->rcv_wnd_max > limit / 2) ? limit : pcb->rcv_wnd_max * 2;
+    pcb->rcv_wnd += new_max - pcb->rcv_wnd_max;
+    pcb->rcv_wnd_max = new_max;
+    LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_rcv_autotune: window grown to %"TCPWNDSIZE_F"\n",
+                pcb->rcv_wnd_max));
+  }
+  pcb->rcv_tune_seq = pcb->rcv_nxt + pcb->rcv_wnd_max;
+}
+
+/**
+ * Set a fixed receive window for a connection, as SO_RCVBUF does.
+ * The window is clamped to what the connection can announce and
+ * autotuning is turned off for it.
+ *
+ * @param pcb the tcp_pcb to set the window for
+ * @param size the new receive window in bytes
+ */
+void
+tcp_setrcvbuf(struct tcp_pcb *pcb, u32_t size)
+{
+  tcpwnd_size_t used;
+
+  LWIP_ASSERT("don't call tcp_setrcvbuf for listen-pcbs",
+    pcb->state != LISTEN);
+
+  /* less than 2 segments would stall the connection */
+  size = LWIP_MAX(size, 2 * TCP_MSS);
+  /* whether we may scale is only known once the peer's SYN has been seen;
+     until then allow TCP_WND, tcp_process() clamps it if scaling is refused */
+  size = LWIP_MIN(size, (pcb->state <= SYN_SENT) ? TCP_WND : TCP_WND_LIMIT(pcb));
+
+  used = pcb->rcv_wnd_max - pcb->rcv_wnd;
+  pcb->rcv_wnd_max = (tcpwnd_size_t)size;
+  /* the window can't shrink by more than what's free: keep the right
+     edge we've already announced */
+  pcb->rcv_wnd = (pcb->rcv_wnd_max > used) ? pcb->rcv_wnd_max - used : 0;
+  pcb->flags |= TF_RCVBUF_LOCK;
+}
+
+/**
+ * Set a fixed send buffer size for a connection, as SO_SNDBUF does.
+ * Autotuning of the send buffer is turned off for it.
+ *
+ * @param pcb the tcp_pcb to set the send buffer for
+ * @param size the new send buffer size in bytes
+ */
+void
+tcp_setsndbuf(struct tcp_pcb *pcb, u32_t size)
+{
+  tcpwnd_size_t used;
+
+  LWIP_ASSERT("don't call tcp_setsndbuf for listen-pcbs",
+    pcb->state != LISTEN);
+
+  size = LWIP_MAX(size, 2 * TCP_MSS);
+  size = LWIP_MIN(size, TCP_SND_BUF);
+
+  used = pcb->snd_buf_max - pcb->snd_buf;
+  pcb->snd_buf_max = (tcpwnd_size_t)size;
+  pcb->snd_buf = (pcb->snd_buf_max > used) ? pcb->snd_buf_max - used : 0;
+  pcb->flags |= TF_SNDBUF_LOCK;
+}
+#endif /* TCP_WND_AUTOTUNE */
+
 /**
  * This function should be called by the application when it has
  * processed the data. The purpose is to advertise a larger window
@@ -610,32 +701,37 @@ u32_t tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
 void
 tcp_recved(struct tcp_pcb *pcb, u16_t len)
 {
-  int wnd_inflation;
+  u32_t wnd_inflation;
+  tcpwnd_size_t rcv_wnd;
 
   /* pcb->state LISTEN not allowed here */
   LWIP_ASSERT("don't call tcp_recved for listen-pcbs",
     pcb->state != LISTEN);
-  LWIP_ASSERT("tcp_recved: len would wrap rcv_wnd\n",
-              len <= 0xffff - pcb->rcv_wnd );
 
-  pcb->rcv_wnd += len;
-  if (pcb->rcv_wnd > TCP_WND) {
-    pcb->rcv_wnd = TCP_WND;
+  rcv_wnd = pcb->rcv_wnd + len;
+  if ((rcv_wnd > TCP_WND_MAX(pcb)) || (rcv_wnd < pcb->rcv_wnd)) {
+    rcv_wnd = TCP_WND_MAX(pcb);
   }
+  pcb->rcv_wnd = rcv_wnd;
+
+#if TCP_WND_AUTOTUNE
+  tcp_rcv_autotune(pcb);
+#endif /* TCP_WND_AUTOTUNE */
 
   wnd_inflation = tcp_update_rcv_ann_wnd(pcb);
 
   /* If the change in the right edge of window is significant (default
-   * watermark is TCP_WND/4), then send an explicit update now.
+   * watermark is TCP_WND/4, but at most a quarter of the current window),
+   * then send an explicit update now.
    * Otherwise wait for a packet to be sent in the normal course of
    * events (or more window to be available later) */
-  if (wnd_inflation >= TCP_WND_UPDATE_THRESHOLD) {
+  if (wnd_inflation >= LWIP_MIN(TCP_WND_UPDATE_THRESHOLD, TCP_WND_MAX(pcb) / 4)) {
     tcp_ack_now(pcb);
     tcp_output(pcb);
   }
 
-  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"U16_F" (%"U16_F").\n",
-         len, pcb->rcv_wnd, TCP_WND - pcb->rcv_wnd));
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"TCPWNDSIZE_F" (%"TCPWNDSIZE_F").\n",
+         len, pcb->rcv_wnd, TCP_WND_MAX(pcb) - pcb->rcv_wnd));
 }
 
 /**
@@ -743,8 +839,8 @@ tcp_connect(struct tcp_pcb *pcb, ip_addr_t *ipaddr, u16_t port,
   pcb->snd_nxt = iss;
   pcb->lastack = iss - 1;
   pcb->snd_lbb = iss - 1;
-  pcb->rcv_wnd = TCP_WND;
-  pcb->rcv_ann_wnd = TCP_WND;
+  pcb->rcv_wnd = TCP_WND_MAX(pcb);
+  pcb->rcv_ann_wnd = TCP_WND_MAX(pcb);
   pcb->rcv_ann_right_edge = pcb->rcv_nxt;
   pcb->snd_wnd = TCP_WND;
   /* As initial send MSS, we use TCP_MSS but limit it to 536.
@@ -788,7 +884,7 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *prev;
-  u16_t eff_wnd;
+  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   u8_t pcb_reset;       /* flag if a RST should be sent when removing */
   err_t err;
@@ -867,8 +963,8 @@ tcp_slowtmr_start:
             pcb->ssthresh = (pcb->mss << 1);
           }
           pcb->cwnd = pcb->mss;
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"U16_F
-                                       " ssthresh %"U16_F"\n",
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
+                                       " ssthresh %"TCPWNDSIZE_F"\n",
                                        pcb->cwnd, pcb->ssthresh));
  
           /* The following needs to be called AFTER cwnd is set to one
@@ -1098,7 +1194,7 @@ tcp_process_refused_data(struct tcp_pcb *pcb)
     if (refused_flags & PBUF_FLAG_TCP_FIN) {
       /* correct rcv_wnd as the application won't call tcp_recved()
          for the FIN's seqno */
-      if (pcb->rcv_wnd != TCP_WND) {
+      if (pcb->rcv_wnd != TCP_WND_MAX(pcb)) {
         pcb->rcv_wnd++;
       }
       TCP_EVENT_CLOSED(pcb, err);
@@ -1306,10 +1402,17 @@ tcp_alloc(u8_t prio)
   if (pcb != NULL) {
     memset(pcb, 0, sizeof(struct tcp_pcb));
     pcb->prio = prio;
+#if TCP_WND_AUTOTUNE
+    pcb->snd_buf_max = TCP_SND_BUF_INIT;
+    pcb->snd_buf = pcb->snd_buf_max;
+    pcb->rcv_wnd_max = TCPWND16(TCP_WND_INIT);
+#else /* TCP_WND_AUTOTUNE */
     pcb->snd_buf = TCP_SND_BUF;
+#endif /* TCP_WND_AUTOTUNE */
     pcb->snd_queuelen = 0;
-    pcb->rcv_wnd = TCP_WND;
-    pcb->rcv_ann_wnd = TCP_WND;
+    /* until the peer agrees to window scaling we can't announce more */
+    pcb->rcv_wnd = TCPWND16(TCP_WND_MAX(pcb));
+    pcb->rcv_ann_wnd = pcb->rcv_wnd;
     pcb->tos = 0;
     pcb->ttl = TCP_TTL;
     /* As initial send MSS, we use TCP_MSS but limit it to 536.
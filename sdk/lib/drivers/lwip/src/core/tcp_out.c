@@ -105,7 +105,7 @@ tcp_output_alloc_header(struct tcp_pcb *pcb, u16_t optlen, u16_t datalen,
     tcphdr->seqno = seqno_be;
     tcphdr->ackno = htonl(pcb->rcv_nxt);
     TCPH_HDRLEN_FLAGS_SET(tcphdr, (5 + optlen / 4), TCP_ACK);
-    tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+    tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
     tcphdr->chksum = 0;
     tcphdr->urgp = 0;
 
@@ -306,7 +306,7 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
 
   /* fail on too much data */
   if (len > pcb->snd_buf) {
-    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_write: too much data (len=%"U16_F" > snd_buf=%"U16_F")\n",
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_write: too much data (len=%"U16_F" > snd_buf=%"TCPWNDSIZE_F")\n",
       len, pcb->snd_buf));
     pcb->flags |= TF_NAGLEMEMERR;
     return ERR_MEM;
@@ -370,7 +370,10 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 #endif /* TCP_CHECKSUM_ON_COPY */
   err_t err;
   /* don't allocate segments bigger than half the maximum window we ever received */
-  u16_t mss_local = LWIP_MIN(pcb->mss, pcb->snd_wnd_max/2);
+  u16_t mss_local = (u16_t)LWIP_MIN(pcb->mss, pcb->snd_wnd_max/2);
+#if TCP_LARGE_SEND
+  struct netif *netif;
+#endif /* TCP_LARGE_SEND */
 
 #if LWIP_NETIF_TX_SINGLE_PBUF
   /* Always copy to try to create single pbufs for TX */
@@ -382,6 +385,17 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
   LWIP_ERROR("tcp_write: arg == NULL (programmer violates API)", 
              arg != NULL, return ERR_ARG;);
 
+#if TCP_LARGE_SEND
+  /* the netif cuts segments into MSS sized packets itself, so build them
+     as large as it allows, in whole multiples of the MSS */
+  netif = ip_route(&pcb->remote_ip);
+  if ((netif != NULL) && (netif->lso_max >= 2 * pcb->mss) &&
+      (pcb->snd_wnd_max/2 >= 2 * pcb->mss)) {
+    mss_local = (u16_t)LWIP_MIN(netif->lso_max, pcb->snd_wnd_max/2);
+    mss_local -= mss_local % pcb->mss;
+  }
+#endif /* TCP_LARGE_SEND */
+
   err = tcp_write_checks(pcb, len);
   if (err != ERR_OK) {
     return err;
@@ -742,6 +756,13 @@ tcp_enqueue_flags(struct tcp_pcb *pcb, u8_t flags)
 
   if (flags & TCP_SYN) {
     optflags = TF_SEG_OPTS_MSS;
+#if LWIP_WND_SCALE
+    if ((pcb->state != SYN_RCVD) || (pcb->flags & TF_WND_SCALE)) {
+      /* In a <SYN,ACK> (sent in state SYN_RCVD), the window scale option may only
+         be sent if we received a window scale option from the remote host. */
+      optflags |= TF_SEG_OPTS_WND_SCALE;
+    }
+#endif /* LWIP_WND_SCALE */
   }
 #if LWIP_TCP_TIMESTAMPS
   if ((pcb->flags & TF_TIMESTAMP)) {
@@ -818,6 +839,20 @@ tcp_enqueue_flags(struct tcp_pcb *pcb, u8_t flags)
   return ERR_OK;
 }
 
+#if LWIP_WND_SCALE
+/* Build a window scale option (3 bytes long, padded with a NOP) at the
+ * specified options pointer
+ *
+ * @param opts option pointer where to store the window scale option
+ */
+static void
+tcp_build_wnd_scale_option(u32_t *opts)
+{
+  /* Pad with one NOP option to make everything nicely aligned */
+  opts[0] = PP_HTONL(0x01030300 | TCP_RCV_SCALE);
+}
+#endif /* LWIP_WND_SCALE */
+
 #if LWIP_TCP_TIMESTAMPS
 /* Build a timestamp option (12 bytes long) at the specified options pointer)
  *
@@ -875,7 +910,10 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
   tcphdr->chksum = inet_chksum_pseudo(p, &(pcb->local_ip), &(pcb->remote_ip),
         IP_PROTO_TCP, p->tot_len);
 #endif
-#if LWIP_NETIF_HWADDRHINT
+#if LWIP_NETIF_ROUTEHINT
+  ip_output_route_hinted(p, &(pcb->local_ip), &(pcb->remote_ip), pcb->ttl, pcb->tos,
+      IP_PROTO_TCP, &(pcb->route_hint));
+#elif LWIP_NETIF_HWADDRHINT
   ip_output_hinted(p, &(pcb->local_ip), &(pcb->remote_ip), pcb->ttl, pcb->tos,
       IP_PROTO_TCP, &(pcb->addr_hint));
 #else /* LWIP_NETIF_HWADDRHINT*/
@@ -887,6 +925,93 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
   return ERR_OK;
 }
 
+#if TCP_LARGE_SEND
+/**
+ * Split the first unsent segment if it is larger than the MSS and only
+ * part of it fits into the send window. Segments that large are only built
+ * for large send netifs, and splitting them on an MSS boundary keeps both
+ * halves made of full sized packets.
+ *
+ * @param pcb the tcp_pcb whose unsent queue to look at
+ * @param wnd the usable send window
+ */
+static void
+tcp_split_unsent_seg(struct tcp_pcb *pcb, u32_t wnd)
+{
+  struct tcp_seg *seg = pcb->unsent;
+  struct tcp_seg *tail;
+  struct pbuf *p;
+  u32_t inflight, space;
+  u16_t split, remainder, offset, clen;
+  u8_t optflags, optlen, flags;
+
+  if ((seg == NULL) || (seg->len <= pcb->mss)) {
+    return;
+  }
+  inflight = ntohl(seg->tcphdr->seqno) - pcb->lastack;
+  if ((inflight >= wnd) || (inflight + seg->len <= wnd)) {
+    /* nothing of it fits, or all of it does */
+    return;
+  }
+  space = wnd - inflight;
+  if (space < pcb->mss) {
+    return;
+  }
+
+  split = (u16_t)(space - (space % pcb->mss));
+  remainder = seg->len - split;
+  optflags = seg->flags & (TF_SEG_OPTS_MSS | TF_SEG_OPTS_TS | TF_SEG_OPTS_WND_SCALE);
+  optlen = LWIP_TCP_OPT_LENGTH(optflags);
+
+  p = pbuf_alloc(PBUF_TRANSPORT, remainder + optlen, PBUF_RAM);
+  if (p == NULL) {
+    /* send it as a whole once the window opens */
+    return;
+  }
+  offset = seg->p->tot_len - seg->len + split;
+  if (pbuf_copy_partial(seg->p, (u8_t *)p->payload + optlen, remainder, offset) != remainder) {
+    pbuf_free(p);
+    return;
+  }
+
+  /* PSH and FIN belong to the last byte, so they move to the tail */
+  flags = TCPH_FLAGS(seg->tcphdr) & (TCP_PSH | TCP_FIN);
+  tail = tcp_create_segment(pcb, p, flags, ntohl(seg->tcphdr->seqno) + split, optflags);
+  if (tail == NULL) {
+    return;
+  }
+
+  LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_split_unsent_seg: %"U16_F" bytes at %"U32_F" split at %"U16_F"\n",
+    seg->len, ntohl(seg->tcphdr->seqno), split));
+
+  if (flags != 0) {
+    TCPH_UNSET_FLAG(seg->tcphdr, flags);
+  }
+  clen = pbuf_clen(seg->p);
+  pbuf_realloc(seg->p, seg->p->tot_len - remainder);
+  seg->len = split;
+#if TCP_CHECKSUM_ON_COPY
+  /* the data checksum covered the bytes that just moved */
+  seg->flags &= ~TF_SEG_DATA_CHECKSUMMED;
+  seg->chksum = 0;
+  seg->chksum_swapped = 0;
+#endif /* TCP_CHECKSUM_ON_COPY */
+#if TCP_OVERSIZE_DBGCHECK
+  seg->oversize_left = 0;
+#endif /* TCP_OVERSIZE_DBGCHECK */
+  pcb->snd_queuelen = pcb->snd_queuelen - clen + pbuf_clen(seg->p) + pbuf_clen(tail->p);
+
+  tail->next = seg->next;
+  seg->next = tail;
+#if TCP_OVERSIZE
+  if (tail->next == NULL) {
+    /* the new last segment has no spare room to grow into */
+    pcb->unsent_oversize = 0;
+  }
+#endif /* TCP_OVERSIZE */
+}
+#endif /* TCP_LARGE_SEND */
+
 /**
  * Find out what we can send and send it
  *
@@ -917,6 +1042,9 @@ tcp_output(struct tcp_pcb *pcb)
 
   wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
 
+#if TCP_LARGE_SEND
+  tcp_split_unsent_seg(pcb, wnd);
+#endif /* TCP_LARGE_SEND */
   seg = pcb->unsent;
 
   /* If the TF_ACK_NOW flag is set and no data will be sent (either
@@ -945,13 +1073,13 @@ tcp_output(struct tcp_pcb *pcb)
 #endif /* TCP_OUTPUT_DEBUG */
 #if TCP_CWND_DEBUG
   if (seg == NULL) {
-    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"U16_F
-                                 ", cwnd %"U16_F", wnd %"U32_F
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F
+                                 ", cwnd %"TCPWNDSIZE_F", wnd %"U32_F
                                  ", seg == NULL, ack %"U32_F"\n",
                                  pcb->snd_wnd, pcb->cwnd, wnd, pcb->lastack));
   } else {
     LWIP_DEBUGF(TCP_CWND_DEBUG, 
-                ("tcp_output: snd_wnd %"U16_F", cwnd %"U16_F", wnd %"U32_F
+                ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F
                  ", effwnd %"U32_F", seq %"U32_F", ack %"U32_F"\n",
                  pcb->snd_wnd, pcb->cwnd, wnd,
                  ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len,
@@ -975,7 +1103,7 @@ tcp_output(struct tcp_pcb *pcb)
       break;
     }
 #if TCP_CWND_DEBUG
-    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"U16_F", cwnd %"U16_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
                             pcb->snd_wnd, pcb->cwnd, wnd,
                             ntohl(seg->tcphdr->seqno) + seg->len -
                             pcb->lastack,
@@ -1026,6 +1154,9 @@ tcp_output(struct tcp_pcb *pcb)
     } else {
       tcp_seg_free(seg);
     }
+#if TCP_LARGE_SEND
+    tcp_split_unsent_seg(pcb, wnd);
+#endif /* TCP_LARGE_SEND */
     seg = pcb->unsent;
   }
 #if TCP_OVERSIZE
@@ -1060,7 +1191,16 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
 
   /* advertise our receive window size in this TCP segment */
-  seg->tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+#if LWIP_WND_SCALE
+  if (TCPH_FLAGS(seg->tcphdr) & TCP_SYN) {
+    /* The Window field in a SYN segment itself (the only type where we send
+       the window scale option) is never scaled. */
+    seg->tcphdr->wnd = htons(TCPWND16(pcb->rcv_ann_wnd));
+  } else
+#endif /* LWIP_WND_SCALE */
+  {
+    seg->tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+  }
 
   pcb->rcv_ann_right_edge = pcb->rcv_nxt + pcb->rcv_ann_wnd;
 
@@ -1077,6 +1217,12 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
     *opts = TCP_BUILD_MSS_OPTION(mss);
     opts += 1;
   }
+#if LWIP_WND_SCALE
+  if (seg->flags & TF_SEG_OPTS_WND_SCALE) {
+    tcp_build_wnd_scale_option(opts);
+    opts += 1;
+  }
+#endif /* LWIP_WND_SCALE */
 #if LWIP_TCP_TIMESTAMPS
   pcb->ts_lastacksent = pcb->rcv_nxt;
 
@@ -1162,7 +1308,10 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 #endif /* CHECKSUM_GEN_TCP */
   TCP_STATS_INC(tcp.xmit);
 
-#if LWIP_NETIF_HWADDRHINT
+#if LWIP_NETIF_ROUTEHINT
+  ip_output_route_hinted(seg->p, &(pcb->local_ip), &(pcb->remote_ip), pcb->ttl, pcb->tos,
+      IP_PROTO_TCP, &(pcb->route_hint));
+#elif LWIP_NETIF_HWADDRHINT
   ip_output_hinted(seg->p, &(pcb->local_ip), &(pcb->remote_ip), pcb->ttl, pcb->tos,
       IP_PROTO_TCP, &(pcb->addr_hint));
 #else /* LWIP_NETIF_HWADDRHINT*/
@@ -1212,7 +1361,7 @@ tcp_rst(u32_t seqno, u32_t ackno,
   tcphdr->seqno = htonl(seqno);
   tcphdr->ackno = htonl(ackno);
   TCPH_HDRLEN_FLAGS_SET(tcphdr, TCP_HLEN/4, TCP_RST | TCP_ACK);
-  tcphdr->wnd = PP_HTONS(TCP_WND);
+  tcphdr->wnd = PP_HTONS(TCPWND16(TCP_WND));
   tcphdr->chksum = 0;
   tcphdr->urgp = 0;
 
@@ -1340,7 +1489,7 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
     /* The minimum value for ssthresh should be 2 MSS */
     if (pcb->ssthresh < 2*pcb->mss) {
       LWIP_DEBUGF(TCP_FR_DEBUG, 
-                  ("tcp_receive: The minimum value for ssthresh %"U16_F
+                  ("tcp_receive: The minimum value for ssthresh %"TCPWNDSIZE_F
                    " should be min 2 mss %"U16_F"...\n",
                    pcb->ssthresh, 2*pcb->mss));
       pcb->ssthresh = 2*pcb->mss;
@@ -1388,7 +1537,10 @@ tcp_keepalive(struct tcp_pcb *pcb)
   TCP_STATS_INC(tcp.xmit);
 
   /* Send output to IP */
-#if LWIP_NETIF_HWADDRHINT
+#if LWIP_NETIF_ROUTEHINT
+  ip_output_route_hinted(p, &pcb->local_ip, &pcb->remote_ip, pcb->ttl, 0, IP_PROTO_TCP,
+    &(pcb->route_hint));
+#elif LWIP_NETIF_HWADDRHINT
   ip_output_hinted(p, &pcb->local_ip, &pcb->remote_ip, pcb->ttl, 0, IP_PROTO_TCP,
     &(pcb->addr_hint));
 #else /* LWIP_NETIF_HWADDRHINT*/
@@ -1469,7 +1621,10 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
   TCP_STATS_INC(tcp.xmit);
 
   /* Send output to IP */
-#if LWIP_NETIF_HWADDRHINT
+#if LWIP_NETIF_ROUTEHINT
+  ip_output_route_hinted(p, &pcb->local_ip, &pcb->remote_ip, pcb->ttl, 0, IP_PROTO_TCP,
+    &(pcb->route_hint));
+#elif LWIP_NETIF_HWADDRHINT
   ip_output_hinted(p, &pcb->local_ip, &pcb->remote_ip, pcb->ttl, 0, IP_PROTO_TCP,
     &(pcb->addr_hint));
 #else /* LWIP_NETIF_HWADDRHINT*/
@@ -23,6 +23,7 @@ realloc(void *mem, size_t size);
 typedef unsigned char u8_t;
 typedef unsigned short u16_t;
 typedef unsigned long u32_t;
+typedef ULONGLONG u64_t;
 
 /* Signed int types */
 typedef signed char s8_t;
@@ -44,7 +45,7 @@ typedef ULONG_PTR mem_ptr_t;
 #define BYTE_ORDER LITTLE_ENDIAN
 
 /* Checksum calculation algorithm choice */
-#define LWIP_CHKSUM_ALGORITHM 3
+#define LWIP_CHKSUM_ALGORITHM 4
 
 /* Diagnostics */
 #define LWIP_PLATFORM_DIAG(x) (DbgPrint x)
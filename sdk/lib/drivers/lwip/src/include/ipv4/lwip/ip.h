@@ -69,6 +69,12 @@ extern "C" {
 #define IP_PCB_ADDRHINT
 #endif /* LWIP_NETIF_HWADDRHINT */
 
+#if LWIP_NETIF_ROUTEHINT
+#define IP_PCB_ROUTEHINT ;struct netif_route_hint route_hint
+#else
+#define IP_PCB_ROUTEHINT
+#endif /* LWIP_NETIF_ROUTEHINT */
+
 /* This is the common part of all PCB types. It needs to be at the
    beginning of a PCB type definition. It is located here so that
    changes to this common part are made in one location instead of
@@ -84,7 +90,9 @@ extern "C" {
   /* Time To Live */     \
   u8_t ttl               \
   /* link layer address resolution hint */ \
-  IP_PCB_ADDRHINT
+  IP_PCB_ADDRHINT \
+  /* route cached by the netif output function */ \
+  IP_PCB_ROUTEHINT
 
 struct ip_pcb {
 /* Common members of all PCB types */
@@ -183,6 +191,10 @@ err_t ip_output_if(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
 err_t ip_output_hinted(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
        u8_t ttl, u8_t tos, u8_t proto, u8_t *addr_hint);
 #endif /* LWIP_NETIF_HWADDRHINT */
+#if LWIP_NETIF_ROUTEHINT
+err_t ip_output_route_hinted(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
+       u8_t ttl, u8_t tos, u8_t proto, struct netif_route_hint *route_hint);
+#endif /* LWIP_NETIF_ROUTEHINT */
 #if IP_OPTIONS_SEND
 err_t ip_output_if_opt(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
        u8_t ttl, u8_t tos, u8_t proto, struct netif *netif, void *ip_options,
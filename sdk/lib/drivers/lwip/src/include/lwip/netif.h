@@ -130,6 +130,14 @@ typedef void (*netif_status_callback_fn)(struct netif *netif);
 typedef err_t (*netif_igmp_mac_filter_fn)(struct netif *netif,
        ip_addr_t *group, u8_t action);
 
+#if LWIP_NETIF_ROUTEHINT
+/** Routing decision the netif output function cached for one pcb */
+struct netif_route_hint {
+  void *route;
+  u32_t generation;
+};
+#endif /* LWIP_NETIF_ROUTEHINT */
+
 /** Generic data structure used for all lwIP network interfaces.
  *  The following fields should be filled in by the initialization
  *  function for the device driver: hwaddr_len, hwaddr[], mtu, flags */
@@ -184,6 +192,10 @@ struct netif {
 #endif /* LWIP_NETIF_HOSTNAME */
   /** maximum transfer unit (in bytes) */
   u16_t mtu;
+#if TCP_LARGE_SEND
+  /** largest TCP segment payload the netif segments itself, 0 for none */
+  u16_t lso_max;
+#endif /* TCP_LARGE_SEND */
   /** number of bytes used in hwaddr */
   u8_t hwaddr_len;
   /** link level hardware address of this interface */
@@ -219,6 +231,10 @@ struct netif {
 #if LWIP_NETIF_HWADDRHINT
   u8_t *addr_hint;
 #endif /* LWIP_NETIF_HWADDRHINT */
+#if LWIP_NETIF_ROUTEHINT
+  /** route hint of the pcb being output, NULL if there is none */
+  struct netif_route_hint *route_hint;
+#endif /* LWIP_NETIF_ROUTEHINT */
 #if ENABLE_LOOPBACK
   /* List of packets to be queued for ourselves. */
   struct pbuf *loop_first;
@@ -321,6 +337,12 @@ void netif_poll_all(void);
 #define NETIF_SET_HWADDRHINT(netif, hint)
 #endif /* LWIP_NETIF_HWADDRHINT */
 
+#if LWIP_NETIF_ROUTEHINT
+#define NETIF_SET_ROUTEHINT(netif, hint) ((netif)->route_hint = (hint))
+#else /* LWIP_NETIF_ROUTEHINT */
+#define NETIF_SET_ROUTEHINT(netif, hint)
+#endif /* LWIP_NETIF_ROUTEHINT */
+
 #ifdef __cplusplus
 }
 #endif
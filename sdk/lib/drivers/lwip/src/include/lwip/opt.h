@@ -1060,6 +1060,54 @@
 #define LWIP_TCP_TIMESTAMPS             0
 #endif
 
+/**
+ * LWIP_WND_SCALE and TCP_RCV_SCALE:
+ * Set LWIP_WND_SCALE to 1 to enable window scaling (RFC 1323).
+ * Set TCP_RCV_SCALE to the desired scaling factor (shift count in the
+ * range of [0..14]). With window scaling, TCP_WND may be larger than
+ * 0xffff (up to 0xffff << TCP_RCV_SCALE); until the peer has agreed to
+ * scaling, the announced window is limited to 0xffff.
+ */
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE                  0
+#define TCP_RCV_SCALE                   0
+#endif
+
+/**
+ * TCP_WND_AUTOTUNE==1: start each connection with a receive window of
+ * TCP_WND_INIT and a send buffer of TCP_SND_BUF_INIT, and grow them
+ * while the connection keeps them full, up to TCP_WND and TCP_SND_BUF.
+ * tcp_setrcvbuf() and tcp_setsndbuf() set fixed limits for a connection.
+ */
+#ifndef TCP_WND_AUTOTUNE
+#define TCP_WND_AUTOTUNE                0
+#endif
+
+/**
+ * TCP_WND_INIT: The initial receive window of a connection when
+ * TCP_WND_AUTOTUNE is enabled.
+ */
+#ifndef TCP_WND_INIT
+#define TCP_WND_INIT                    TCP_WND
+#endif
+
+/**
+ * TCP_SND_BUF_INIT: The initial send buffer of a connection when
+ * TCP_WND_AUTOTUNE is enabled.
+ */
+#ifndef TCP_SND_BUF_INIT
+#define TCP_SND_BUF_INIT                TCP_SND_BUF
+#endif
+
+/**
+ * TCP_LARGE_SEND==1: let tcp_write() build segments of up to netif->lso_max
+ * bytes for netifs that segment TCP in hardware. tcp_output() cuts them at
+ * an MSS boundary when the send window no longer allows the whole segment.
+ */
+#ifndef TCP_LARGE_SEND
+#define TCP_LARGE_SEND                  0
+#endif
+
 /**
  * TCP_WND_UPDATE_THRESHOLD: difference in window to trigger an
  * explicit window update
@@ -1159,6 +1207,15 @@
 #define LWIP_NETIF_HWADDRHINT           0
 #endif
 
+/**
+ * LWIP_NETIF_ROUTEHINT==1: Give every pcb a struct netif_route_hint that
+ * the netif output function can use to cache its own routing decision for
+ * the connection. lwIP only stores it, TCP passes it down in netif->route_hint.
+ */
+#ifndef LWIP_NETIF_ROUTEHINT
+#define LWIP_NETIF_ROUTEHINT            0
+#endif
+
 /**
  * LWIP_NETIF_LOOPBACK==1: Support sending packets with a destination IP
  * address equal to the netif IP address, looping them back up the stack.
@@ -75,6 +75,10 @@ typedef enum {
 #define PBUF_FLAG_LLMCAST   0x10U
 /** indicates this pbuf includes a TCP FIN flag */
 #define PBUF_FLAG_TCP_FIN   0x20U
+/** indicates the netif already verified this packet's IP header checksum */
+#define PBUF_FLAG_IP_CHKSUM_OK  0x40U
+/** indicates the netif already verified this packet's TCP checksum */
+#define PBUF_FLAG_TCP_CHKSUM_OK 0x80U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -48,6 +48,41 @@ extern "C" {
 
 struct tcp_pcb;
 
+#if LWIP_WND_SCALE || TCP_WND_AUTOTUNE
+typedef u32_t tcpwnd_size_t;
+typedef u16_t tcpflags_t;
+#define TCPWNDSIZE_F U32_F
+#else
+typedef u16_t tcpwnd_size_t;
+typedef u8_t tcpflags_t;
+#define TCPWNDSIZE_F U16_F
+#endif
+
+#if LWIP_WND_SCALE
+#define RCV_WND_SCALE(pcb, wnd) (((wnd) >> (pcb)->rcv_scale))
+#define SND_WND_SCALE(pcb, wnd) ((tcpwnd_size_t)(wnd) << (pcb)->snd_scale)
+#define TCPWND16(x)             ((u16_t)LWIP_MIN((x), 0xFFFF))
+#else
+#define RCV_WND_SCALE(pcb, wnd) (wnd)
+#define SND_WND_SCALE(pcb, wnd) (wnd)
+#define TCPWND16(x)             (x)
+#endif
+
+/** The largest receive window a pcb can use: TCP_WND, or 0xffff if the
+ * peer did not agree to window scaling */
+#if LWIP_WND_SCALE
+#define TCP_WND_LIMIT(pcb)      ((tcpwnd_size_t)(((pcb)->flags & TF_WND_SCALE) ? TCP_WND : TCPWND16(TCP_WND)))
+#else
+#define TCP_WND_LIMIT(pcb)      TCP_WND
+#endif
+
+/** The largest receive window this pcb currently announces */
+#if TCP_WND_AUTOTUNE
+#define TCP_WND_MAX(pcb)        ((pcb)->rcv_wnd_max)
+#else
+#define TCP_WND_MAX(pcb)        TCP_WND_LIMIT(pcb)
+#endif
+
 /** Function prototype for tcp accept callback functions. Called when a new
  * connection can be accepted on a listening pcb.
  *
@@ -174,7 +209,7 @@ struct tcp_pcb {
   /* ports are in host byte order */
   u16_t remote_port;
   
-  u8_t flags;
+  tcpflags_t flags;
 #define TF_ACK_DELAY   ((u8_t)0x01U)   /* Delayed ACK. */
 #define TF_ACK_NOW     ((u8_t)0x02U)   /* Immediate ACK. */
 #define TF_INFR        ((u8_t)0x04U)   /* In fast recovery. */
@@ -183,6 +218,13 @@ struct tcp_pcb {
 #define TF_FIN         ((u8_t)0x20U)   /* Connection was closed locally (FIN segment enqueued). */
 #define TF_NODELAY     ((u8_t)0x40U)   /* Disable Nagle algorithm */
 #define TF_NAGLEMEMERR ((u8_t)0x80U)   /* nagle enabled, memerr, try to output to prevent delayed ACK to happen */
+#if LWIP_WND_SCALE
+#define TF_WND_SCALE   ((tcpflags_t)0x0100U) /* Window Scale option enabled */
+#endif
+#if TCP_WND_AUTOTUNE
+#define TF_RCVBUF_LOCK ((tcpflags_t)0x0200U) /* Receive window set by tcp_setrcvbuf, don't autotune */
+#define TF_SNDBUF_LOCK ((tcpflags_t)0x0400U) /* Send buffer set by tcp_setsndbuf, don't autotune */
+#endif
 
   /* the rest of the fields are in host byte order
      as we have to do some math with them */
@@ -194,8 +236,8 @@ struct tcp_pcb {
 
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
-  u16_t rcv_wnd;   /* receiver window available */
-  u16_t rcv_ann_wnd; /* receiver window to announce */
+  tcpwnd_size_t rcv_wnd;   /* receiver window available */
+  tcpwnd_size_t rcv_ann_wnd; /* receiver window to announce */
   u32_t rcv_ann_right_edge; /* announced right edge of window */
 
   /* Retransmission timer. */
@@ -216,20 +258,20 @@ struct tcp_pcb {
   u32_t lastack; /* Highest acknowledged seqno. */
 
   /* congestion avoidance/control variables */
-  u16_t cwnd;
-  u16_t ssthresh;
+  tcpwnd_size_t cwnd;
+  tcpwnd_size_t ssthresh;
 
   /* sender variables */
   u32_t snd_nxt;   /* next new seqno to be sent */
   u32_t snd_wl1, snd_wl2; /* Sequence and acknowledgement numbers of last
                              window update. */
   u32_t snd_lbb;       /* Sequence number of next byte to be buffered. */
-  u16_t snd_wnd;   /* sender window */
-  u16_t snd_wnd_max; /* the maximum sender window announced by the remote host */
+  tcpwnd_size_t snd_wnd;   /* sender window */
+  tcpwnd_size_t snd_wnd_max; /* the maximum sender window announced by the remote host */
 
-  u16_t acked;
+  tcpwnd_size_t acked;
 
-  u16_t snd_buf;   /* Available buffer space for sending (in bytes). */
+  tcpwnd_size_t snd_buf;   /* Available buffer space for sending (in bytes). */
 #define TCP_SNDQUEUELEN_OVERFLOW (0xffffU-3)
   u16_t snd_queuelen; /* Available buffer space for sending (in tcp_segs). */
 
@@ -265,6 +307,17 @@ struct tcp_pcb {
   u32_t ts_recent;
 #endif /* LWIP_TCP_TIMESTAMPS */
 
+#if LWIP_WND_SCALE
+  u8_t snd_scale;
+  u8_t rcv_scale;
+#endif /* LWIP_WND_SCALE */
+
+#if TCP_WND_AUTOTUNE
+  tcpwnd_size_t rcv_wnd_max; /* current receive window limit */
+  tcpwnd_size_t snd_buf_max; /* current send buffer limit */
+  u32_t rcv_tune_seq;        /* rcv_nxt that ends the current window round */
+#endif /* TCP_WND_AUTOTUNE */
+
   /* idle time before KEEPALIVE is sent */
   u32_t keep_idle;
 #if LWIP_TCP_KEEPALIVE
@@ -339,6 +392,10 @@ void             tcp_err     (struct tcp_pcb *pcb, tcp_err_fn err);
 #endif /* TCP_LISTEN_BACKLOG */
 
 void             tcp_recved  (struct tcp_pcb *pcb, u16_t len);
+#if TCP_WND_AUTOTUNE
+void             tcp_setrcvbuf(struct tcp_pcb *pcb, u32_t size);
+void             tcp_setsndbuf(struct tcp_pcb *pcb, u32_t size);
+#endif /* TCP_WND_AUTOTUNE */
 err_t            tcp_bind    (struct tcp_pcb *pcb, ip_addr_t *ipaddr,
                               u16_t port);
 err_t            tcp_connect (struct tcp_pcb *pcb, ip_addr_t *ipaddr,
@@ -64,10 +64,26 @@
  * add support for other transport mediums */
 #define TCP_MSS                         1460
 
-#define TCP_WND                         0xFFFF
+/* Connections start with a 64K window and send buffer, which grow as
+ * needed up to TCP_WND and TCP_SND_BUF. With a scale of 5 the window
+ * can be announced up to 2MB; 1MB covers 1Gbit/s at 8ms RTT. */
+#define LWIP_WND_SCALE                  1
+
+#define TCP_RCV_SCALE                   5
+
+#define TCP_WND_AUTOTUNE                1
+
+/* Build segments of up to 64K for adapters that do large send offload */
+#define TCP_LARGE_SEND                  1
+
+#define TCP_WND                         (1024 * 1024)
+
+#define TCP_WND_INIT                    0xFFFF
 
 #define TCP_SND_BUF                     TCP_WND
 
+#define TCP_SND_BUF_INIT                0xFFFF
+
 #define TCP_MAXRTX                      8
 
 #define TCP_SYNMAXRTX                   4
@@ -86,6 +102,9 @@
 
 #define LWIP_NETIF_HWADDRHINT           0
 
+/* TCPSendDataCallback caches the route of each connection in its pcb */
+#define LWIP_NETIF_ROUTEHINT            1
+
 #define LWIP_STATS                      0
 
 #define ICMP_STATS                      0
@@ -96,6 +115,10 @@
 
 #define PPPOS_SUPPORT                   0
 
+/* TCP checksums are filled in by TCPSendDataCallback once the outgoing
+ * interface is known, either by the adapter or in software */
+#define CHECKSUM_GEN_TCP                0
+
 /*
    ---------------------------------------
    ---------- Debugging options ----------
@@ -59,6 +59,11 @@ struct lwip_callback_msg
             PCONNECTION_ENDPOINT Connection;
             int Callback;
         } Close;
+        struct {
+            PCONNECTION_ENDPOINT Connection;
+            u32_t Size;
+            BOOLEAN Receive;
+        } BufferSize;
     } Input;
     
     /* Output */
@@ -85,6 +90,9 @@ struct lwip_callback_msg
         struct {
             err_t Error;
         } Close;
+        struct {
+            err_t Error;
+        } BufferSize;
     } Output;
 };
 
@@ -110,10 +118,19 @@ err_t       LibTCPGetPeerName(PTCP_PCB pcb, struct ip_addr *const ipaddr, u16_t
 err_t       LibTCPGetHostName(PTCP_PCB pcb, struct ip_addr *const ipaddr, u16_t *const port);
 void        LibTCPAccept(PTCP_PCB pcb, struct tcp_pcb *listen_pcb, void *arg);
 void        LibTCPSetNoDelay(PTCP_PCB pcb, BOOLEAN Set);
+err_t       LibTCPSetBufferSize(PCONNECTION_ENDPOINT Connection, const BOOLEAN Receive, const u32_t Size);
+BOOLEAN     LibTCPLoopbackSend(PCONNECTION_ENDPOINT Connection, void *const dataptr, const u16_t len, u32_t *sent, err_t *error);
+void        LibTCPLoopbackSendPending(PCONNECTION_ENDPOINT Connection);
+void        LibTCPLoopbackInitialize(void);
 
 /* IP functions */
-void LibIPInsertPacket(void *ifarg, const void *const data, const u32_t size);
+void LibIPInsertPacket(void *ifarg, const void *const data, const u32_t size, const u8_t flags);
 void LibIPInitialize(void);
 void LibIPShutdown(void);
 
+/* rosmem.c */
+void RosMemInitialize(void);
+void RosMemShutdown(void);
+void RosMemDumpStatistics(void);
+
 #endif
@@ -11,7 +11,8 @@ typedef struct netif* PNETIF;
 void
 LibIPInsertPacket(void *ifarg,
                   const void *const data,
-                  const u32_t size)
+                  const u32_t size,
+                  const u8_t flags)
 {
     struct pbuf *p;
 
@@ -27,6 +28,9 @@ LibIPInsertPacket(void *ifarg,
 
         RtlCopyMemory(p->payload, data, p->len);
 
+        /* Checksums the adapter has already verified */
+        p->flags |= flags;
+
         ((PNETIF)ifarg)->input(p, (PNETIF)ifarg);
     }
 }
@@ -34,6 +38,11 @@ LibIPInsertPacket(void *ifarg,
 void
 LibIPInitialize(void)
 {
+    /* The allocator has to be up before lwIP allocates anything */
+    RosMemInitialize();
+
+    LibTCPLoopbackInitialize();
+
     /* This completes asynchronously */
     tcpip_init(NULL, NULL);
 }
@@ -43,4 +52,6 @@ LibIPShutdown(void)
 {
     /* This is synchronous */
     sys_shutdown();
+
+    RosMemShutdown();
 }
\ No newline at end of file
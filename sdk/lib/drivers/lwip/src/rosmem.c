@@ -1,34 +1,272 @@
+#include <ntddk.h>
+
 #include "lwip/opt.h"
 
 #include "lwip/def.h"
 #include "lwip/mem.h"
+#include "lwip/memp.h"
 
 #ifndef LWIP_TAG
     #define LWIP_TAG 'PIwl'
 #endif
 
+/* mem_malloc() is called for every pbuf, segment and pcb lwIP creates, so
+ * going to the pool for each of them is too slow under load. Requests up to
+ * ROSMEM_MAX_SLAB bytes are served from per-CPU lookaside lists, one per
+ * size class. The classes are the MEMP element sizes plus a power-of-two
+ * ladder for PBUF_RAM payloads. Anything larger goes straight to the pool. */
+#define ROSMEM_MAX_SLAB     2048
+#define ROSMEM_GRANULARITY  16
+#define ROSMEM_MAX_CLASSES  32
+#define ROSMEM_LARGE        0xFFFF
+#define ROSMEM_DEPTH        256
+
+/* Every block starts with this header so free() knows where it came from */
+typedef union _ROSMEM_HEADER
+{
+    struct
+    {
+        USHORT Class;
+        USHORT Reserved;
+        ULONG Size;
+    };
+    UCHAR Alignment[MEMORY_ALLOCATION_ALIGNMENT];
+} ROSMEM_HEADER, *PROSMEM_HEADER;
+
+typedef struct _ROSMEM_CLASS
+{
+    ULONG Size;
+    PNPAGED_LOOKASIDE_LIST Lists; /* One per processor */
+} ROSMEM_CLASS, *PROSMEM_CLASS;
+
+static ROSMEM_CLASS RosMemClasses[ROSMEM_MAX_CLASSES];
+static ULONG RosMemClassCount;
+static ULONG RosMemProcessorCount;
+static UCHAR RosMemClassIndex[ROSMEM_MAX_SLAB / ROSMEM_GRANULARITY + 1];
+static PNPAGED_LOOKASIDE_LIST RosMemLists;
+static BOOLEAN RosMemReady;
+
+static LONG RosMemLargeAllocs;
+static LONG RosMemLargeFrees;
+
+static
+VOID
+RosMemAddClass(ULONG Size)
+{
+    ULONG i, j;
+
+    Size = (Size + ROSMEM_GRANULARITY - 1) & ~(ROSMEM_GRANULARITY - 1);
+    if (Size == 0 || Size > ROSMEM_MAX_SLAB)
+        return;
+
+    for (i = 0; i < RosMemClassCount; i++)
+    {
+        if (RosMemClasses[i].Size == Size)
+            return;
+
+        if (RosMemClasses[i].Size > Size)
+            break;
+    }
+
+    if (RosMemClassCount == ROSMEM_MAX_CLASSES)
+        return;
+
+    /* Keep the table sorted so the index below picks the tightest fit */
+    for (j = RosMemClassCount; j > i; j--)
+        RosMemClasses[j] = RosMemClasses[j - 1];
+
+    RosMemClasses[i].Size = Size;
+    RosMemClasses[i].Lists = NULL;
+    RosMemClassCount++;
+}
+
+void
+RosMemInitialize(void)
+{
+    ULONG i, j, Size;
+
+    if (RosMemReady)
+        return;
+
+    RosMemClassCount = 0;
+
+    /* The power-of-two ladder goes in first so it is never crowded out */
+    for (Size = 64; Size <= ROSMEM_MAX_SLAB; Size <<= 1)
+        RosMemAddClass(Size);
+
+    for (i = 0; i < MEMP_MAX; i++)
+        RosMemAddClass(memp_sizes[i]);
+
+    RosMemProcessorCount = KeNumberProcessors;
+    RosMemLists = ExAllocatePoolWithTag(NonPagedPool,
+                                        RosMemClassCount * RosMemProcessorCount * sizeof(NPAGED_LOOKASIDE_LIST),
+                                        LWIP_TAG);
+    if (!RosMemLists)
+    {
+        /* Everything keeps working, just without the slabs */
+        DbgPrint("lwIP: unable to allocate lookaside lists\n");
+        return;
+    }
+
+    for (i = 0; i < RosMemClassCount; i++)
+    {
+        RosMemClasses[i].Lists = &RosMemLists[i * RosMemProcessorCount];
+
+        for (j = 0; j < RosMemProcessorCount; j++)
+        {
+            ExInitializeNPagedLookasideList(&RosMemClasses[i].Lists[j],
+                                            NULL,
+                                            NULL,
+                                            0,
+                                            sizeof(ROSMEM_HEADER) + RosMemClasses[i].Size,
+                                            LWIP_TAG,
+                                            ROSMEM_DEPTH);
+        }
+    }
+
+    /* Map every request size, rounded up to the granularity, to the
+     * smallest class that holds it */
+    for (i = 0, j = 0; i < sizeof(RosMemClassIndex); i++)
+    {
+        while (RosMemClasses[j].Size < i * ROSMEM_GRANULARITY)
+            j++;
+
+        RosMemClassIndex[i] = (UCHAR)j;
+    }
+
+    RosMemLargeAllocs = 0;
+    RosMemLargeFrees = 0;
+    RosMemReady = TRUE;
+}
+
+void
+RosMemDumpStatistics(void)
+{
+    ULONG i, j, Allocates, Misses, Frees;
+
+    if (!RosMemReady)
+        return;
+
+    DbgPrint("lwIP memory: %lu classes on %lu processors\n",
+             RosMemClassCount, RosMemProcessorCount);
+
+    for (i = 0; i < RosMemClassCount; i++)
+    {
+        Allocates = Misses = Frees = 0;
+
+        for (j = 0; j < RosMemProcessorCount; j++)
+        {
+            Allocates += RosMemClasses[i].Lists[j].L.TotalAllocates;
+            Misses += RosMemClasses[i].Lists[j].L.AllocateMisses;
+            Frees += RosMemClasses[i].Lists[j].L.TotalFrees;
+        }
+
+        if (!Allocates)
+            continue;
+
+        DbgPrint("  %4lu bytes: %lu allocs (%lu from pool), %lu frees\n",
+                 RosMemClasses[i].Size, Allocates, Misses, Frees);
+    }
+
+    DbgPrint("  large: %ld allocs, %ld frees\n",
+             RosMemLargeAllocs, RosMemLargeFrees);
+}
+
+void
+RosMemShutdown(void)
+{
+    ULONG i, j;
+
+    if (!RosMemReady)
+        return;
+
+    RosMemDumpStatistics();
+
+    /* Blocks still outstanding came from the pool with our tag, so once
+     * this is cleared free() hands them straight back to it */
+    RosMemReady = FALSE;
+
+    for (i = 0; i < RosMemClassCount; i++)
+    {
+        for (j = 0; j < RosMemProcessorCount; j++)
+            ExDeleteNPagedLookasideList(&RosMemClasses[i].Lists[j]);
+
+        RosMemClasses[i].Lists = NULL;
+    }
+
+    ExFreePoolWithTag(RosMemLists, LWIP_TAG);
+    RosMemLists = NULL;
+}
+
 void *
 malloc(mem_size_t size)
 {
-    return ExAllocatePoolWithTag(NonPagedPool, size, LWIP_TAG);
+    PROSMEM_HEADER Header;
+    ULONG Class, Processor;
+
+    if (RosMemReady && size <= ROSMEM_MAX_SLAB)
+    {
+        Class = RosMemClassIndex[(size + ROSMEM_GRANULARITY - 1) / ROSMEM_GRANULARITY];
+
+        /* Migrating to another processor after this is harmless, the
+         * lookaside lists are interlocked */
+        Processor = KeGetCurrentProcessorNumber();
+        if (Processor >= RosMemProcessorCount)
+            Processor = 0;
+
+        Header = ExAllocateFromNPagedLookasideList(&RosMemClasses[Class].Lists[Processor]);
+    }
+    else
+    {
+        Class = ROSMEM_LARGE;
+        Header = ExAllocatePoolWithTag(NonPagedPool, sizeof(ROSMEM_HEADER) + size, LWIP_TAG);
+        if (Header)
+            InterlockedIncrement(&RosMemLargeAllocs);
+    }
+
+    if (!Header) return NULL;
+
+    Header->Class = (USHORT)Class;
+    Header->Size = (ULONG)size;
+
+    return Header + 1;
 }
 
 void *
 calloc(mem_size_t count, mem_size_t size)
 {
     void *mem = malloc(count * size);
-    
+
     if (!mem) return NULL;
-    
+
     RtlZeroMemory(mem, count * size);
-    
+
     return mem;
 }
 
 void
 free(void *mem)
 {
-    ExFreePoolWithTag(mem, LWIP_TAG);
+    PROSMEM_HEADER Header = (PROSMEM_HEADER)mem - 1;
+    ULONG Processor;
+
+    if (!mem) return;
+
+    if (Header->Class == ROSMEM_LARGE || !RosMemReady)
+    {
+        if (Header->Class == ROSMEM_LARGE)
+            InterlockedIncrement(&RosMemLargeFrees);
+
+        ExFreePoolWithTag(Header, LWIP_TAG);
+        return;
+    }
+
+    /* Any processor's list will do, they all hold the same size */
+    Processor = KeGetCurrentProcessorNumber();
+    if (Processor >= RosMemProcessorCount)
+        Processor = 0;
+
+    ExFreeToNPagedLookasideList(&RosMemClasses[Header->Class].Lists[Processor], Header);
 }
 
 /* This is only used to trim in lwIP */
@@ -36,31 +274,31 @@ void *
 realloc(void *mem, size_t size)
 {
     void* new_mem;
-    
+
     /* realloc() with a NULL mem pointer acts like a call to malloc() */
     if (mem == NULL) {
         return malloc(size);
     }
-    
+
     /* realloc() with a size 0 acts like a call to free() */
     if (size == 0) {
         free(mem);
         return NULL;
     }
-    
+
     /* Allocate the new buffer first */
     new_mem = malloc(size);
     if (new_mem == NULL) {
         /* The old buffer is still intact */
         return NULL;
     }
-    
-    /* Copy the data over */
-    RtlCopyMemory(new_mem, mem, size);
-    
+
+    /* Copy the data over, the old block might be smaller */
+    RtlCopyMemory(new_mem, mem, min(size, ((PROSMEM_HEADER)mem - 1)->Size));
+
     /* Deallocate the old buffer */
     free(mem);
 
     /* Return the newly allocated block */
     return new_mem;
-}
\ No newline at end of file
+}
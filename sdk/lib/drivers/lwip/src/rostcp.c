@@ -2,8 +2,12 @@
 #include "lwip/netif.h"
 #include "lwip/tcpip.h"
 
+#include "lwip/tcp_impl.h"
+
 #include "rosip.h"
 
+#include <chew/chew.h>
+
 #include <debug.h>
 
 static const char * const tcp_state_str[] = {
@@ -32,6 +36,254 @@ extern KEVENT TerminationEvent;
 extern NPAGED_LOOKASIDE_LIST MessageLookasideList;
 extern NPAGED_LOOKASIDE_LIST QueueEntryLookasideList;
 
+/* Connected sockets that are both on this host get paired up as soon as
+ * both ends are established. From then on data sent on one end goes straight
+ * onto the receive queue of the other, without a trip through lwIP, IP and
+ * the loopback interface. lwIP still owns the connection for everything
+ * else. A shutdown or close on either end unpairs them and data goes the
+ * normal way again, which can't overtake anything queued directly. */
+#define LOOPBACK_QUEUE_LIMIT    TCP_WND
+
+static KSPIN_LOCK LoopbackLock;
+
+void
+LibTCPLoopbackInitialize(void)
+{
+    KeInitializeSpinLock(&LoopbackLock);
+}
+
+static
+PCONNECTION_ENDPOINT
+LibTCPReferenceLoopbackPeer(PCONNECTION_ENDPOINT Connection)
+{
+    PCONNECTION_ENDPOINT Peer;
+    KIRQL OldIrql;
+
+    /* Most connections never get a peer, so don't take the lock for them */
+    if (!Connection->LoopbackPeer)
+        return NULL;
+
+    KeAcquireSpinLock(&LoopbackLock, &OldIrql);
+    Peer = Connection->LoopbackPeer;
+    if (Peer)
+        ReferenceObject(Peer);
+    KeReleaseSpinLock(&LoopbackLock, OldIrql);
+
+    return Peer;
+}
+
+static
+void
+LibTCPLoopbackWakeCallback(void *arg)
+{
+    PCONNECTION_ENDPOINT Connection = arg;
+
+    TCPSendEventHandler(Connection, 0);
+
+    DereferenceObject(Connection);
+}
+
+static
+VOID
+LibTCPLoopbackWakeWorker(PVOID Context)
+{
+    /* The sends might have to go through lwIP after all */
+    tcpip_callback_with_block(LibTCPLoopbackWakeCallback, Context, 1);
+}
+
+static
+void
+LibTCPLoopbackWake(PCONNECTION_ENDPOINT Connection)
+{
+    if (IsListEmpty(&Connection->SendRequest))
+        return;
+
+    ReferenceObject(Connection);
+    if (!ChewCreate(LibTCPLoopbackWakeWorker, Connection))
+        DereferenceObject(Connection);
+}
+
+static
+void
+LibTCPPairLoopback(PCONNECTION_ENDPOINT Connection)
+{
+    PTCP_PCB pcb = Connection->SocketContext, cpcb;
+    PCONNECTION_ENDPOINT Peer;
+    KIRQL OldIrql;
+
+    /* We're in the tcpip thread here so the PCB lists can't change */
+    if (!pcb || pcb->state != ESTABLISHED)
+        return;
+
+    if (ip4_addr1(&pcb->remote_ip) != IP_LOOPBACKNET &&
+        !ip_addr_cmp(&pcb->remote_ip, &pcb->local_ip))
+        return;
+
+    for (cpcb = tcp_active_pcbs; cpcb != NULL; cpcb = cpcb->next)
+    {
+        if (cpcb->local_port == pcb->remote_port &&
+            cpcb->remote_port == pcb->local_port &&
+            ip_addr_cmp(&cpcb->local_ip, &pcb->remote_ip) &&
+            ip_addr_cmp(&cpcb->remote_ip, &pcb->local_ip))
+            break;
+    }
+
+    /* The other end has to be accepted already, until then its argument
+     * is the listener */
+    if (!cpcb || cpcb->state != ESTABLISHED || !cpcb->callback_arg)
+        return;
+
+    Peer = cpcb->callback_arg;
+    if (Peer == Connection || Peer->SocketContext != cpcb)
+        return;
+
+    /* Anything still making its way through lwIP would arrive after what
+     * we queue directly */
+    if (pcb->unsent || cpcb->unsent ||
+        pcb->refused_data || cpcb->refused_data ||
+        pcb->snd_nxt != cpcb->rcv_nxt ||
+        cpcb->snd_nxt != pcb->rcv_nxt)
+        return;
+
+    KeAcquireSpinLock(&LoopbackLock, &OldIrql);
+    if (!Connection->LoopbackPeer && !Peer->LoopbackPeer)
+    {
+        /* Each end keeps the other one alive until they're unpaired */
+        ReferenceObject(Connection);
+        ReferenceObject(Peer);
+        Connection->LoopbackPeer = Peer;
+        Peer->LoopbackPeer = Connection;
+    }
+    KeReleaseSpinLock(&LoopbackLock, OldIrql);
+}
+
+static
+void
+LibTCPUnpairLoopback(PCONNECTION_ENDPOINT Connection)
+{
+    PCONNECTION_ENDPOINT Peer;
+    KIRQL OldIrql;
+
+    if (!Connection->LoopbackPeer)
+        return;
+
+    KeAcquireSpinLock(&LoopbackLock, &OldIrql);
+    Peer = Connection->LoopbackPeer;
+    if (Peer)
+    {
+        Connection->LoopbackPeer = NULL;
+        Peer->LoopbackPeer = NULL;
+    }
+    KeReleaseSpinLock(&LoopbackLock, OldIrql);
+
+    if (!Peer)
+        return;
+
+    /* Sends waiting for room on the peer have to go through lwIP now */
+    LibTCPLoopbackWake(Connection);
+    LibTCPLoopbackWake(Peer);
+
+    DereferenceObject(Peer);
+    DereferenceObject(Connection);
+}
+
+BOOLEAN
+LibTCPLoopbackSend(PCONNECTION_ENDPOINT Connection, void *const dataptr, const u16_t len, u32_t *sent, err_t *error)
+{
+    PCONNECTION_ENDPOINT Peer;
+    PQUEUE_ENTRY qp;
+    struct pbuf *p;
+    LONG Space;
+    u16_t SendLength;
+    BOOLEAN Queued;
+    KIRQL OldIrql;
+
+    /* The caller mustn't hold a connection lock, the peer's gets taken here */
+    Peer = LibTCPReferenceLoopbackPeer(Connection);
+    if (!Peer)
+        return FALSE;
+
+    *sent = 0;
+
+    Space = LOOPBACK_QUEUE_LIMIT - Peer->PacketQueueBytes;
+    if (Space <= 0)
+    {
+        /* LibTCPGetDataFromConnectionQueue wakes us up once the peer has read some */
+        *error = ERR_INPROGRESS;
+        DereferenceObject(Peer);
+        return TRUE;
+    }
+
+    SendLength = (u16_t)MIN(len, (ULONG)Space);
+
+    p = pbuf_alloc(PBUF_RAW, SendLength, PBUF_RAM);
+    if (!p)
+    {
+        *error = ERR_MEM;
+        DereferenceObject(Peer);
+        return TRUE;
+    }
+
+    qp = ExAllocateFromNPagedLookasideList(&QueueEntryLookasideList);
+    if (!qp)
+    {
+        pbuf_free_callback(p);
+        *error = ERR_MEM;
+        DereferenceObject(Peer);
+        return TRUE;
+    }
+
+    pbuf_take(p, dataptr, SendLength);
+    qp->p = p;
+    qp->Offset = 0;
+
+    /* TCPClose holds the peer's lock while it gets unpaired and its queue
+     * is emptied, so once we have the lock it either still has us or the
+     * packet would never be read */
+    KeAcquireSpinLock(&Peer->Lock, &OldIrql);
+    Queued = (Peer->LoopbackPeer == Connection);
+    if (Queued)
+    {
+        InterlockedExchangeAdd(&Peer->PacketQueueBytes, SendLength);
+        InsertTailList(&Peer->PacketQueue, &qp->ListEntry);
+    }
+    KeReleaseSpinLock(&Peer->Lock, OldIrql);
+
+    if (!Queued)
+    {
+        /* Unpaired in the meantime, send it through lwIP instead */
+        pbuf_free_callback(p);
+        ExFreeToNPagedLookasideList(&QueueEntryLookasideList, qp);
+        DereferenceObject(Peer);
+        return FALSE;
+    }
+
+    TCPRecvEventHandler(Peer);
+
+    DereferenceObject(Peer);
+
+    *sent = SendLength;
+    *error = ERR_OK;
+
+    return TRUE;
+}
+
+void
+LibTCPLoopbackSendPending(PCONNECTION_ENDPOINT Connection)
+{
+    PCONNECTION_ENDPOINT Peer;
+
+    /* A send got queued after the peer might have made room already */
+    Peer = LibTCPReferenceLoopbackPeer(Connection);
+    if (!Peer)
+        return;
+
+    if (Peer->PacketQueueBytes < LOOPBACK_QUEUE_LIMIT)
+        LibTCPLoopbackWake(Connection);
+
+    DereferenceObject(Peer);
+}
+
 /* Required for ERR_T to NTSTATUS translation in receive error handling */
 NTSTATUS TCPTranslateError(const err_t err);
 
@@ -70,6 +322,8 @@ LibTCPEmptyQueue(PCONNECTION_ENDPOINT Connection)
         ExFreeToNPagedLookasideList(&QueueEntryLookasideList, qp);
     }
 
+    Connection->PacketQueueBytes = 0;
+
     DereferenceObject(Connection);
 }
 
@@ -81,6 +335,7 @@ void LibTCPEnqueuePacket(PCONNECTION_ENDPOINT Connection, struct pbuf *p)
     qp->p = p;
     qp->Offset = 0;
 
+    InterlockedExchangeAdd(&Connection->PacketQueueBytes, p->tot_len);
     ExInterlockedInsertTailList(&Connection->PacketQueue, &qp->ListEntry, &Connection->Lock);
 }
 
@@ -104,6 +359,7 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
     struct pbuf* p;
     NTSTATUS Status;
     UINT ReadLength, PayloadLength, Offset, Copied;
+    PCONNECTION_ENDPOINT Peer;
     KIRQL OldIrql;
 
     (*Received) = 0;
@@ -140,6 +396,7 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
             LockObject(Connection, &OldIrql);
 
             /* Update trackers */
+            InterlockedExchangeAdd(&Connection->PacketQueueBytes, -(LONG)ReadLength);
             RecvLen -= ReadLength;
             RecvBuffer += ReadLength;
             (*Received) += ReadLength;
@@ -174,6 +431,18 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
 
     UnlockObject(Connection, OldIrql);
 
+    /* Let the other end carry on once half of its data has been read */
+    if ((*Received) && Connection->LoopbackPeer &&
+        Connection->PacketQueueBytes <= LOOPBACK_QUEUE_LIMIT / 2)
+    {
+        Peer = LibTCPReferenceLoopbackPeer(Connection);
+        if (Peer)
+        {
+            LibTCPLoopbackWake(Peer);
+            DereferenceObject(Peer);
+        }
+    }
+
     return Status;
 }
 
@@ -293,6 +562,10 @@ InternalConnectEventHandler(void *arg, PTCP_PCB pcb, const err_t err)
     if (!arg)
         return ERR_OK;
 
+    /* Before the connect completes, nothing can have been sent yet */
+    if (err == ERR_OK)
+        LibTCPPairLoopback(arg);
+
     TCPConnectEventHandler(arg, err);
 
     return ERR_OK;
@@ -310,6 +583,8 @@ InternalErrorEventHandler(void *arg, const err_t err)
     /* The PCB is dead now */
     Connection->SocketContext = NULL;
 
+    LibTCPUnpairLoopback(Connection);
+
     /* Give them one shot to receive the remaining data */
     Connection->ReceiveShutdown = TRUE;
     Connection->ReceiveShutdownStatus = TCPTranslateError(err);
@@ -495,6 +770,10 @@ LibTCPSendCallback(void *arg)
         goto done;
     }
 
+    /* This send was on its way here while we got paired, so everything
+     * after it has to come through lwIP too */
+    LibTCPUnpairLoopback(msg->Input.Send.Connection);
+
     SendFlags = TCP_WRITE_FLAG_COPY;
     SendLength = msg->Input.Send.DataLength;
     if (tcp_sndbuf(pcb) == 0)
@@ -656,6 +935,8 @@ LibTCPShutdownCallback(void *arg)
 
     if (!msg->Output.Shutdown.Error)
     {
+        LibTCPUnpairLoopback(msg->Input.Shutdown.Connection);
+
         if (msg->Input.Shutdown.shut_rx)
         {
             msg->Input.Shutdown.Connection->ReceiveShutdown = TRUE;
@@ -716,6 +997,9 @@ LibTCPCloseCallback(void *arg)
     struct lwip_callback_msg *msg = arg;
     PTCP_PCB pcb = msg->Input.Close.Connection->SocketContext;
 
+    /* Nothing gets queued directly once we're unpaired */
+    LibTCPUnpairLoopback(msg->Input.Close.Connection);
+
     /* Empty the queue even if we're already "closed" */
     LibTCPEmptyQueue(msg->Input.Close.Connection);
 
@@ -804,6 +1088,9 @@ LibTCPAccept(PTCP_PCB pcb, struct tcp_pcb *listen_pcb, void *arg)
     tcp_arg(pcb, arg);
 
     tcp_accepted(listen_pcb);
+
+    /* The accept is completed after this so nothing has been sent yet */
+    LibTCPPairLoopback(arg);
 }
 
 err_t
@@ -840,3 +1127,72 @@ LibTCPSetNoDelay(
     else
         pcb->flags &= ~TF_NODELAY;
 }
+
+static
+void
+LibTCPSetBufferSizeCallback(void *arg)
+{
+    struct lwip_callback_msg *msg = arg;
+    PTCP_PCB pcb = msg->Input.BufferSize.Connection->SocketContext;
+
+    if (!pcb)
+    {
+        msg->Output.BufferSize.Error = ERR_CLSD;
+        goto done;
+    }
+
+    /* Listening PCBs have no buffers; accepted connections start with the defaults */
+    if (pcb->state == LISTEN)
+    {
+        msg->Output.BufferSize.Error = ERR_OK;
+        goto done;
+    }
+
+    if (msg->Input.BufferSize.Receive)
+    {
+        tcp_setrcvbuf(pcb, msg->Input.BufferSize.Size);
+
+        /* Announce a larger window right away */
+        if (pcb->state >= ESTABLISHED)
+            tcp_recved(pcb, 0);
+    }
+    else
+    {
+        tcp_setsndbuf(pcb, msg->Input.BufferSize.Size);
+    }
+
+    msg->Output.BufferSize.Error = ERR_OK;
+
+done:
+    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+}
+
+err_t
+LibTCPSetBufferSize(PCONNECTION_ENDPOINT Connection, const BOOLEAN Receive, const u32_t Size)
+{
+    struct lwip_callback_msg *msg;
+    err_t ret;
+
+    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
+    if (msg)
+    {
+        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
+
+        msg->Input.BufferSize.Connection = Connection;
+        msg->Input.BufferSize.Receive = Receive;
+        msg->Input.BufferSize.Size = Size;
+
+        tcpip_callback_with_block(LibTCPSetBufferSizeCallback, msg, 1);
+
+        if (WaitForEventSafely(&msg->Event))
+            ret = msg->Output.BufferSize.Error;
+        else
+            ret = ERR_CLSD;
+
+        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
+
+        return ret;
+    }
+
+    return ERR_MEM;
+}
@@ -1171,6 +1171,7 @@ ElfFlushFile(
         return Status;
     }
 
+    LogFile->DirtyRecords = 0;
     return STATUS_SUCCESS;
 }
 
@@ -1300,6 +1301,26 @@ ElfWriteRecord(
 
     LogFile->Header.Flags |= ELF_LOGFILE_HEADER_DIRTY;
 
+    /*
+     * The header is only rewritten when the log gets flushed. On the first
+     * record since, mark the log dirty on disk, so that in case we don't get
+     * to flush it, the current state gets recovered from the EOF record.
+     */
+    if (LogFile->DirtyRecords == 0)
+    {
+        FileOffset.QuadPart = 0LL;
+        Status = LogFile->FileWrite(LogFile,
+                                    &FileOffset,
+                                    &LogFile->Header,
+                                    sizeof(EVENTLOGHEADER),
+                                    &WrittenLength);
+        if (!NT_SUCCESS(Status))
+        {
+            EVTLTRACE1("FileWrite() failed (Status 0x%08lx)\n", Status);
+            return Status;
+        }
+    }
+
     /* If the event log was empty, it will now contain one record */
     if (LogFile->Header.OldestRecordNumber == 0)
         LogFile->Header.OldestRecordNumber = 1;
@@ -1573,13 +1594,11 @@ ElfWriteRecord(
     }
     FileOffset = NextOffset;
 
-    /* Flush the log file */
-    Status = ElfFlushFile(LogFile);
-    if (!NT_SUCCESS(Status))
-    {
-        EVTLTRACE1("ElfFlushFile() failed (Status 0x%08lx)\n", Status);
-        return STATUS_EVENTLOG_FILE_CORRUPT; // Status;
-    }
+    /*
+     * Don't flush the log file here, the caller does it with ElfFlushFile,
+     * possibly only once for a batch of records.
+     */
+    LogFile->DirtyRecords++;
 
     return Status;
 }
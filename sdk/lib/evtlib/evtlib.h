@@ -214,6 +214,7 @@ typedef struct _EVTLOGFILE
     PEVENT_OFFSET_INFO OffsetInfo;
     ULONG OffsetInfoSize;
     ULONG OffsetInfoNext;
+    ULONG DirtyRecords; /* Records written since the last ElfFlushFile */
     BOOLEAN ReadOnly;
 } EVTLOGFILE, *PEVTLOGFILE;
 
@@ -18,6 +18,7 @@
 extern NTSTATUS RtlpInitAtomTableLock(PRTL_ATOM_TABLE AtomTable);
 extern VOID RtlpDestroyAtomTableLock(PRTL_ATOM_TABLE AtomTable);
 extern BOOLEAN RtlpLockAtomTable(PRTL_ATOM_TABLE AtomTable);
+extern BOOLEAN RtlpLockAtomTableShared(PRTL_ATOM_TABLE AtomTable);
 extern VOID RtlpUnlockAtomTable(PRTL_ATOM_TABLE AtomTable);
 
 extern BOOLEAN RtlpCreateAtomHandleTable(PRTL_ATOM_TABLE AtomTable);
@@ -25,6 +26,8 @@ extern VOID RtlpDestroyAtomHandleTable(PRTL_ATOM_TABLE AtomTable);
 
 extern PRTL_ATOM_TABLE RtlpAllocAtomTable(ULONG Size);
 extern VOID RtlpFreeAtomTable(PRTL_ATOM_TABLE AtomTable);
+extern PRTL_ATOM_TABLE_ENTRY *RtlpAllocAtomTableBuckets(ULONG Count);
+extern VOID RtlpFreeAtomTableBuckets(PRTL_ATOM_TABLE_ENTRY *Buckets);
 extern PRTL_ATOM_TABLE_ENTRY RtlpAllocAtomTableEntry(ULONG Size);
 extern VOID RtlpFreeAtomTableEntry(PRTL_ATOM_TABLE_ENTRY Entry);
 
@@ -34,53 +37,121 @@ extern PRTL_ATOM_TABLE_ENTRY RtlpGetAtomEntry(PRTL_ATOM_TABLE AtomTable, ULONG I
 
 /* FUNCTIONS *****************************************************************/
 
+/* Average number of atoms per bucket above which the table is grown */
+#define RTL_ATOM_TABLE_LOAD_FACTOR      2
+
+/* Don't grow the table past this many buckets, there can't be more atoms */
+#define RTL_ATOM_TABLE_MAX_BUCKETS      0x8000
+
 static
 PRTL_ATOM_TABLE_ENTRY
 RtlpHashAtomName(
     IN PRTL_ATOM_TABLE AtomTable,
     IN PWSTR AtomName,
+    OUT PULONG AtomHash,
     OUT PRTL_ATOM_TABLE_ENTRY **HashLink)
 {
-    UNICODE_STRING Name;
-    ULONG Hash;
+    PRTL_ATOM_TABLE_ENTRY Current;
+    PRTL_ATOM_TABLE_ENTRY *Link;
+    ULONG Hash, Length;
+    PWCHAR p;
 
-    RtlInitUnicodeString(&Name, AtomName);
+    /*
+     * Hash the name the way RtlHashUnicodeString does, case-insensitively,
+     * while we are looking for its end. Only names with the same hash and
+     * length need to be compared char by char then.
+     */
+    Hash = 0;
+    for (p = AtomName; *p; p++)
+    {
+        /* only uppercase characters if they are 'a' ... 'z'! */
+        Hash = (65599 * Hash) +
+               (ULONG)(((*p) >= L'a' && (*p) <= L'z') ? (*p) - L'a' + L'A' : (*p));
+    }
+    Length = (ULONG)(p - AtomName);
+    *AtomHash = Hash;
 
-    if (Name.Length != 0 &&
-            NT_SUCCESS(RtlHashUnicodeString(&Name,
-                                            TRUE,
-                                            HASH_STRING_ALGORITHM_X65599,
-                                            &Hash)))
+    if (Length == 0)
     {
-        PRTL_ATOM_TABLE_ENTRY Current;
-        PRTL_ATOM_TABLE_ENTRY *Link;
+        *HashLink = NULL;
+        return NULL;
+    }
 
-        Link = &AtomTable->Buckets[Hash % AtomTable->NumberOfBuckets];
+    Link = &AtomTable->Buckets[Hash % AtomTable->NumberOfBuckets];
 
-        /* search for an existing entry */
-        Current = *Link;
-        while (Current != NULL)
+    /* search for an existing entry */
+    Current = *Link;
+    while (Current != NULL)
+    {
+        if (Current->Hash == Hash &&
+            Current->NameLength == Length &&
+            !_wcsicmp(Current->Name, AtomName))
         {
-            if (Current->NameLength == Name.Length / sizeof(WCHAR) &&
-                !_wcsicmp(Current->Name, Name.Buffer))
-            {
-                *HashLink = Link;
-                return Current;
-            }
-
-            Link = &Current->HashLink;
-            Current = Current->HashLink;
+            *HashLink = Link;
+            return Current;
         }
 
-        /* no matching atom found, return the hash link */
-        *HashLink = Link;
+        Link = &Current->HashLink;
+        Current = Current->HashLink;
     }
-    else
-        *HashLink = NULL;
 
+    /* no matching atom found, return the hash link */
+    *HashLink = Link;
     return NULL;
 }
 
+static
+VOID
+RtlpGrowAtomTable(
+    IN PRTL_ATOM_TABLE AtomTable)
+{
+    PRTL_ATOM_TABLE_ENTRY *Buckets, *OldBuckets, *Link;
+    PRTL_ATOM_TABLE_ENTRY Entry, NextEntry;
+    ULONG NumberOfBuckets, i;
+
+    if (AtomTable->NumberOfAtoms <=
+        AtomTable->NumberOfBuckets * RTL_ATOM_TABLE_LOAD_FACTOR)
+    {
+        return;
+    }
+
+    if (AtomTable->NumberOfBuckets >= RTL_ATOM_TABLE_MAX_BUCKETS)
+        return;
+
+    /* Keep the number of buckets odd, it spreads the hashes better */
+    NumberOfBuckets = AtomTable->NumberOfBuckets * 2 + 1;
+    Buckets = RtlpAllocAtomTableBuckets(NumberOfBuckets);
+    if (Buckets == NULL)
+    {
+        /* Not a problem, the chains just get longer */
+        return;
+    }
+
+    DPRINT("Growing atom table %p to %lu buckets\n", AtomTable, NumberOfBuckets);
+
+    /* Move all the atoms over, keeping the order of each chain */
+    OldBuckets = AtomTable->Buckets;
+    for (i = 0; i < AtomTable->NumberOfBuckets; i++)
+    {
+        for (Entry = OldBuckets[i]; Entry != NULL; Entry = NextEntry)
+        {
+            NextEntry = Entry->HashLink;
+            Entry->HashLink = NULL;
+
+            Link = &Buckets[Entry->Hash % NumberOfBuckets];
+            while (*Link != NULL) Link = &(*Link)->HashLink;
+            *Link = Entry;
+        }
+    }
+
+    AtomTable->Buckets = Buckets;
+    AtomTable->NumberOfBuckets = NumberOfBuckets;
+
+    /* The initial buckets are part of the table itself */
+    if (OldBuckets != AtomTable->InitialBuckets)
+        RtlpFreeAtomTableBuckets(OldBuckets);
+}
+
 static
 BOOLEAN
 RtlpCheckIntegerAtom(
@@ -173,8 +244,9 @@ RtlCreateAtomTable(
         return STATUS_NO_MEMORY;
     }
 
-    /* initialize atom table */
+    /* initialize atom table, it starts with the buckets allocated along */
     Table->NumberOfBuckets = TableSize;
+    Table->Buckets = Table->InitialBuckets;
 
     Status = RtlpInitAtomTableLock(Table);
     if (!NT_SUCCESS(Status))
@@ -236,6 +308,9 @@ RtlDestroyAtomTable(
 
     RtlpDestroyAtomHandleTable(AtomTable);
 
+    if (AtomTable->Buckets != AtomTable->InitialBuckets)
+        RtlpFreeAtomTableBuckets(AtomTable->Buckets);
+
     RtlpUnlockAtomTable(AtomTable);
 
     RtlpDestroyAtomTableLock(AtomTable);
@@ -283,6 +358,7 @@ RtlEmptyAtomTable(
             if (DeletePinned || !(CurrentEntry->Flags & RTL_ATOM_IS_PINNED))
             {
                 *PtrEntry = NextEntry;
+                AtomTable->NumberOfAtoms--;
 
                 RtlpFreeAtomHandle(AtomTable, CurrentEntry);
 
@@ -312,6 +388,7 @@ RtlAddAtomToAtomTable(IN PRTL_ATOM_TABLE AtomTable,
     USHORT AtomValue;
     PRTL_ATOM_TABLE_ENTRY *HashLink;
     PRTL_ATOM_TABLE_ENTRY Entry = NULL;
+    ULONG Hash;
     NTSTATUS Status = STATUS_SUCCESS;
 
     DPRINT("RtlAddAtomToAtomTable (AtomTable %p AtomName %S Atom %p)\n",
@@ -335,7 +412,7 @@ RtlAddAtomToAtomTable(IN PRTL_ATOM_TABLE AtomTable,
     RtlpLockAtomTable(AtomTable);
 
     /* string atom, hash it and try to find an existing atom with the same name */
-    Entry = RtlpHashAtomName(AtomTable, AtomName, &HashLink);
+    Entry = RtlpHashAtomName(AtomTable, AtomName, &Hash, &HashLink);
 
     if (Entry != NULL)
     {
@@ -376,6 +453,7 @@ RtlAddAtomToAtomTable(IN PRTL_ATOM_TABLE AtomTable,
             if (Entry != NULL)
             {
                 Entry->HashLink = NULL;
+                Entry->Hash = Hash;
                 Entry->ReferenceCount = 1;
                 Entry->Flags = 0x0;
 
@@ -388,11 +466,15 @@ RtlAddAtomToAtomTable(IN PRTL_ATOM_TABLE AtomTable,
                 {
                     /* append the atom to the list */
                     *HashLink = Entry;
+                    AtomTable->NumberOfAtoms++;
 
                     if (Atom != NULL)
                     {
                         *Atom = (RTL_ATOM)Entry->Atom;
                     }
+
+                    /* spread the atoms over more buckets if it got crowded */
+                    RtlpGrowAtomTable(AtomTable);
                 }
                 else
                 {
@@ -448,15 +530,19 @@ RtlDeleteAtomFromAtomTable(
                     PRTL_ATOM_TABLE_ENTRY *HashLink;
 
                     /* it's time to delete the atom. we need to unlink it from
-                       the list. The easiest way is to take the atom name and
-                       hash it again, this way we get the pointer to either
-                       the hash bucket or the previous atom that links to the
-                       one we want to delete. This way we can easily bypass
-                       this item. */
-                    if (RtlpHashAtomName(AtomTable, Entry->Name, &HashLink) != NULL)
+                       the list. The hash is saved in the atom, so we can walk
+                       its bucket to get the pointer to either the hash bucket
+                       or the previous atom that links to the one we want to
+                       delete. This way we can easily bypass this item. */
+                    HashLink = &AtomTable->Buckets[Entry->Hash % AtomTable->NumberOfBuckets];
+                    while (*HashLink != NULL && *HashLink != Entry)
+                        HashLink = &(*HashLink)->HashLink;
+
+                    if (*HashLink != NULL)
                     {
                         /* bypass this atom */
                         *HashLink = Entry->HashLink;
+                        AtomTable->NumberOfAtoms--;
 
                         RtlpFreeAtomHandle(AtomTable, Entry);
 
@@ -498,6 +584,7 @@ RtlLookupAtomInAtomTable(IN PRTL_ATOM_TABLE AtomTable,
 {
     PRTL_ATOM_TABLE_ENTRY Entry, *HashLink;
     USHORT AtomValue;
+    ULONG Hash;
     RTL_ATOM FoundAtom = 0;
     NTSTATUS Status = STATUS_SUCCESS;
 
@@ -519,11 +606,12 @@ RtlLookupAtomInAtomTable(IN PRTL_ATOM_TABLE AtomTable,
         return Status;
     }
 
-    RtlpLockAtomTable(AtomTable);
+    /* lookups don't change the table, so they can run side by side */
+    RtlpLockAtomTableShared(AtomTable);
     Status = STATUS_OBJECT_NAME_NOT_FOUND;
 
     /* string atom */
-    Entry = RtlpHashAtomName(AtomTable, AtomName, &HashLink);
+    Entry = RtlpHashAtomName(AtomTable, AtomName, &Hash, &HashLink);
     if (Entry != NULL)
     {
         Status = STATUS_SUCCESS;
@@ -631,7 +719,7 @@ RtlQueryAtomInAtomTable(
     }
     else
     {
-        RtlpLockAtomTable(AtomTable);
+        RtlpLockAtomTableShared(AtomTable);
         Unlock = TRUE;
 
         Entry = RtlpGetAtomEntry(AtomTable, (ULONG)((USHORT)Atom - 0xC000));
@@ -712,7 +800,7 @@ RtlQueryAtomListInAtomTable(
     ULONG Atoms = 0;
     NTSTATUS Status = STATUS_SUCCESS;
 
-    RtlpLockAtomTable(AtomTable);
+    RtlpLockAtomTableShared(AtomTable);
 
     LastBucket = AtomTable->Buckets + AtomTable->NumberOfBuckets;
     for (CurrentBucket = AtomTable->Buckets;
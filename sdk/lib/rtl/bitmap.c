@@ -852,7 +852,9 @@ RtlFindClearRuns(
         return Run;
     }
 
-    while (1)
+    /* Stop once the rest of the bitmap cannot hold a longer run */
+    while (BitMapHeader->SizeOfBitMap - FromIndex >
+           RunArray[SmallestRun].NumberOfBits)
     {
         /* Look for a run */
         NumberOfBits = RtlFindNextForwardRunClear(BitMapHeader,
@@ -873,7 +875,7 @@ RtlFindClearRuns(
             for (Run = 0; Run < SizeOfRunArray; Run++)
             {
                 /*Is this the new smallest run? */
-                if (NumberOfBits < RunArray[SmallestRun].NumberOfBits)
+                if (RunArray[Run].NumberOfBits < RunArray[SmallestRun].NumberOfBits)
                 {
                     /* Set it as new smallest run */
                     SmallestRun = Run;
@@ -881,11 +883,11 @@ RtlFindClearRuns(
             }
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Advance bits past the run, not just by its length */
+        FromIndex = StartingIndex + NumberOfBits;
     }
 
-    return Run;
+    return SizeOfRunArray;
 }
 
 BITMAP_INDEX
@@ -896,7 +898,8 @@ RtlFindLongestRunClear(
 {
     BITMAP_INDEX NumberOfBits, Index, MaxNumberOfBits = 0, FromIndex = 0;
 
-    while (1)
+    /* Stop once the rest of the bitmap cannot hold a longer run */
+    while (BitMapHeader->SizeOfBitMap - FromIndex > MaxNumberOfBits)
     {
         /* Look for a run */
         NumberOfBits = RtlFindNextForwardRunClear(BitMapHeader,
@@ -914,8 +917,8 @@ RtlFindLongestRunClear(
             *StartingIndex = Index;
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Advance bits past the run, not just by its length */
+        FromIndex = Index + NumberOfBits;
     }
 
     return MaxNumberOfBits;
@@ -929,7 +932,8 @@ RtlFindLongestRunSet(
 {
     BITMAP_INDEX NumberOfBits, Index, MaxNumberOfBits = 0, FromIndex = 0;
 
-    while (1)
+    /* Stop once the rest of the bitmap cannot hold a longer run */
+    while (BitMapHeader->SizeOfBitMap - FromIndex > MaxNumberOfBits)
     {
         /* Look for a run */
         NumberOfBits = RtlFindNextForwardRunSet(BitMapHeader,
@@ -947,8 +951,8 @@ RtlFindLongestRunSet(
             *StartingIndex = Index;
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Advance bits past the run, not just by its length */
+        FromIndex = Index + NumberOfBits;
     }
 
     return MaxNumberOfBits;
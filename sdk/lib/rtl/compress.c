@@ -216,18 +216,251 @@ out:
 }
 
 
+/* LZ77 MATCH FINDER *********************************************************/
+
+/*
+ * Hash chain match finder shared by the compressors. Head holds the last
+ * position (plus one) seen for every hash of three bytes, Prev the distance
+ * from each position to the previous one with the same hash. Positions are
+ * relative to Base and only grow, so the tables never have to be flushed
+ * between LZNT1 chunks; callers bound the search with MinPos instead.
+ */
+
+#define RTLP_LZ_HASH_BITS       12
+#define RTLP_LZ_HASH_SIZE       (1 << RTLP_LZ_HASH_BITS)
+#define RTLP_LZ_DEPTH_STANDARD  16
+#define RTLP_LZ_DEPTH_MAXIMUM   1024
+
+#define RTLP_LZ_HASH(p) \
+    (((((ULONG)(p)[0] << 16) | ((ULONG)(p)[1] << 8) | (p)[2]) * 2654435761U) >> (32 - RTLP_LZ_HASH_BITS))
+
+typedef struct _RTLP_LZ_MATCHER
+{
+    PUCHAR Base;
+    PULONG Head;
+    PUSHORT Prev;
+    ULONG WindowMask;
+    ULONG ChainDepth;
+} RTLP_LZ_MATCHER, *PRTLP_LZ_MATCHER;
+
+/* Workspace used by the LZNT1 and plain Xpress compressors */
+typedef struct _RTLP_LZ_WORKSPACE
+{
+    ULONG Head[RTLP_LZ_HASH_SIZE];
+    USHORT Prev[0x2000];
+} RTLP_LZ_WORKSPACE, *PRTLP_LZ_WORKSPACE;
+
+C_ASSERT(sizeof(RTLP_LZ_WORKSPACE) <= 0x8010);
+
+/* Workspace used by the Xpress Huffman compressor */
+typedef struct _RTLP_XPRESS_HUFF_WORKSPACE
+{
+    ULONG Head[RTLP_LZ_HASH_SIZE];
+    USHORT Prev[0x10000];
+    USHORT TokenLength[0x10000];
+    USHORT TokenOffset[0x10000];
+    ULONG Frequency[512];
+    ULONG Weight[1023];
+    USHORT Parent[1023];
+    USHORT Depth[1023];
+    USHORT Leaves[512];
+    USHORT Code[512];
+    UCHAR CodeLength[512];
+} RTLP_XPRESS_HUFF_WORKSPACE, *PRTLP_XPRESS_HUFF_WORKSPACE;
+
+static VOID
+RtlpLzInitMatcher(PRTLP_LZ_MATCHER Matcher,
+                  PUCHAR Base,
+                  PULONG Head,
+                  PUSHORT Prev,
+                  ULONG WindowSize,
+                  USHORT Engine)
+{
+    Matcher->Base = Base;
+    Matcher->Head = Head;
+    Matcher->Prev = Prev;
+    Matcher->WindowMask = WindowSize - 1;
+    Matcher->ChainDepth = (Engine == COMPRESSION_ENGINE_MAXIMUM) ?
+                          RTLP_LZ_DEPTH_MAXIMUM : RTLP_LZ_DEPTH_STANDARD;
+
+    /* Without tables every byte is emitted as a literal */
+    if (Head)
+        RtlZeroMemory(Head, RTLP_LZ_HASH_SIZE * sizeof(ULONG));
+}
+
+/* Index the position, at least three bytes must follow it */
+static __inline VOID
+RtlpLzInsert(PRTLP_LZ_MATCHER Matcher, ULONG Pos)
+{
+    ULONG Hash, Last, Distance = 0;
+
+    if (!Matcher->Head) return;
+
+    Hash = RTLP_LZ_HASH(Matcher->Base + Pos);
+    Last = Matcher->Head[Hash];
+    if (Last && Pos - (Last - 1) <= Matcher->WindowMask)
+        Distance = Pos - (Last - 1);
+
+    Matcher->Prev[Pos & Matcher->WindowMask] = (USHORT)Distance;
+    Matcher->Head[Hash] = Pos + 1;
+}
+
+/* Find the longest match for Pos, must be called before Pos is indexed */
+static ULONG
+RtlpLzFindMatch(PRTLP_LZ_MATCHER Matcher,
+                ULONG Pos,
+                ULONG MinPos,
+                ULONG MaxOffset,
+                ULONG MaxLength,
+                PULONG Offset)
+{
+    PUCHAR Data, Match;
+    ULONG Last, Candidate, Distance, Length, BestLength = 2, Depth, Step;
+
+    if (!Matcher->Head || MaxLength < 3) return 0;
+
+    Data = Matcher->Base + Pos;
+    Last = Matcher->Head[RTLP_LZ_HASH(Data)];
+    if (!Last) return 0;
+
+    Candidate = Last - 1;
+    for (Depth = Matcher->ChainDepth; Depth; Depth--)
+    {
+        Distance = Pos - Candidate;
+        if (Distance > MaxOffset || Candidate < MinPos) break;
+
+        /* Check the byte that would make this match longer first */
+        Match = Matcher->Base + Candidate;
+        if (Match[BestLength] == Data[BestLength] &&
+            Match[0] == Data[0] && Match[1] == Data[1])
+        {
+            for (Length = 2; Length < MaxLength && Match[Length] == Data[Length]; Length++);
+
+            if (Length > BestLength)
+            {
+                BestLength = Length;
+                *Offset = Distance;
+                if (Length == MaxLength) break;
+            }
+        }
+
+        Step = Matcher->Prev[Candidate & Matcher->WindowMask];
+        if (!Step) break;
+        Candidate -= Step;
+    }
+
+    return (BestLength >= 3) ? BestLength : 0;
+}
+
+/* Copy a back reference, source and destination may overlap */
+static __inline VOID
+RtlpLzCopyMatch(PUCHAR Dest, ULONG Offset, ULONG Length)
+{
+    PUCHAR Source = Dest - Offset;
+
+    if (Offset >= Length)
+    {
+        RtlCopyMemory(Dest, Source, Length);
+        return;
+    }
+
+    while (Length--) *Dest++ = *Source++;
+}
+
+/* LZNT1 *********************************************************************/
+
+/* compress a single LZNT1 chunk, returns 0 if it does not fit into dst_size */
+static ULONG
+lznt1_compress_chunk(PRTLP_LZ_MATCHER matcher, ULONG chunk_pos, ULONG chunk_size,
+                     UCHAR *dst, ULONG dst_size)
+{
+    UCHAR *chunk = matcher->Base + chunk_pos, *dst_cur = dst, *dst_end = dst + dst_size;
+    ULONG pos = 0, length, offset, displacement_bits, max_length, max_offset, i;
+    UCHAR *flags_ptr, flags;
+
+    while (pos < chunk_size)
+    {
+        /* reserve flags header */
+        if (dst_cur >= dst_end) return 0;
+        flags_ptr = dst_cur++;
+        flags = 0;
+
+        for (i = 0; i < 8 && pos < chunk_size; i++)
+        {
+            /* same split of the code word as in lznt1_decompress_chunk */
+            for (displacement_bits = 12; displacement_bits > 4; displacement_bits--)
+                if ((1 << (displacement_bits - 1)) < pos) break;
+            max_length = min((1 << (16 - displacement_bits)) + 2, chunk_size - pos);
+            max_offset = min(1 << displacement_bits, pos);
+
+            length = RtlpLzFindMatch(matcher, chunk_pos + pos, chunk_pos,
+                                     max_offset, max_length, &offset);
+            if (length)
+            {
+                /* backwards reference */
+                if (dst_cur + sizeof(WORD) > dst_end) return 0;
+                *(WORD *)dst_cur = (WORD)(((offset - 1) << (16 - displacement_bits)) | (length - 3));
+                dst_cur += sizeof(WORD);
+                flags |= 1 << i;
+            }
+            else
+            {
+                /* uncompressed data */
+                if (dst_cur >= dst_end) return 0;
+                *dst_cur++ = chunk[pos];
+                length = 1;
+            }
+
+            /* index every position covered by this entity */
+            while (length--)
+            {
+                if (pos + 3 <= chunk_size)
+                    RtlpLzInsert(matcher, chunk_pos + pos);
+                pos++;
+            }
+        }
+
+        *flags_ptr = flags;
+    }
+
+    return dst_cur - dst;
+}
+
 static NTSTATUS
 RtlpCompressBufferLZNT1(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
-                        ULONG chunk_size, ULONG *final_size, UCHAR *workspace)
+                        ULONG chunk_size, ULONG *final_size, UCHAR *workspace,
+                        USHORT engine)
 {
         UCHAR *src_cur = src, *src_end = src + src_size;
         UCHAR *dst_cur = dst, *dst_end = dst + dst_size;
-        ULONG block_size;
+        PRTLP_LZ_WORKSPACE lz = (PRTLP_LZ_WORKSPACE)workspace;
+        ULONG block_size, compressed_size;
+        RTLP_LZ_MATCHER matcher;
+
+        RtlpLzInitMatcher(&matcher, src, lz ? lz->Head : NULL, lz ? lz->Prev : NULL,
+                          0x1000, engine);
 
         while (src_cur < src_end)
         {
             /* determine size of current chunk */
             block_size = min(0x1000, src_end - src_cur);
+            if (dst_cur + sizeof(WORD) > dst_end)
+                return STATUS_BUFFER_TOO_SMALL;
+
+            /* only keep the compressed chunk if it is smaller */
+            compressed_size = lznt1_compress_chunk(&matcher, src_cur - src, block_size,
+                                                   dst_cur + sizeof(WORD),
+                                                   min((ULONG)(dst_end - dst_cur) - sizeof(WORD),
+                                                       block_size - 1));
+            if (compressed_size)
+            {
+                /* write compressed chunk header */
+                *(WORD *)dst_cur = 0xB000 | (compressed_size - 1);
+                dst_cur += sizeof(WORD) + compressed_size;
+                src_cur += block_size;
+                continue;
+            }
+
             if (dst_cur + sizeof(WORD) + block_size > dst_end)
                 return STATUS_BUFFER_TOO_SMALL;
 
@@ -253,22 +486,783 @@ RtlpWorkSpaceSizeLZNT1(USHORT Engine,
                        PULONG BufferAndWorkSpaceSize,
                        PULONG FragmentWorkSpaceSize)
 {
-   if (Engine == COMPRESSION_ENGINE_STANDARD)
+   if (Engine == COMPRESSION_ENGINE_STANDARD ||
+       Engine == COMPRESSION_ENGINE_MAXIMUM)
    {
+      /* Both engines share the match finder, MAXIMUM only searches deeper */
       *BufferAndWorkSpaceSize = 0x8010;
       *FragmentWorkSpaceSize = 0x1000;
       return(STATUS_SUCCESS);
    }
-   else if (Engine == COMPRESSION_ENGINE_MAXIMUM)
-   {
-      *BufferAndWorkSpaceSize = 0x10;
-      *FragmentWorkSpaceSize = 0x1000;
-      return(STATUS_SUCCESS);
-   }
 
    return(STATUS_NOT_SUPPORTED);
 }
 
+/* XPRESS ********************************************************************/
+
+/*
+ * Plain LZ77 Xpress as described in [MS-XCA] 2.3 and 2.4: 32-bit flag
+ * words select between literals and 16-bit match words with a 13-bit
+ * offset. Longer lengths continue in shared nibbles and extra bytes.
+ */
+
+#define RTLP_XPRESS_WINDOW  0x2000
+
+static NTSTATUS
+RtlpCompressBufferXpress(PUCHAR Source,
+                         ULONG SourceSize,
+                         PUCHAR Dest,
+                         ULONG DestSize,
+                         PULONG FinalSize,
+                         PVOID WorkSpace,
+                         USHORT Engine)
+{
+    PRTLP_LZ_WORKSPACE Lz = WorkSpace;
+    RTLP_LZ_MATCHER Matcher;
+    ULONG Pos = 0, Out = sizeof(ULONG), FlagsPos = 0, Flags = 0, FlagCount = 0;
+    ULONG HalfByte = 0, Length, Offset, Value;
+
+    RtlpLzInitMatcher(&Matcher, Source, Lz ? Lz->Head : NULL, Lz ? Lz->Prev : NULL,
+                      RTLP_XPRESS_WINDOW, Engine);
+
+    if (DestSize < sizeof(ULONG))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    while (Pos < SourceSize)
+    {
+        Length = RtlpLzFindMatch(&Matcher, Pos, 0, RTLP_XPRESS_WINDOW,
+                                 SourceSize - Pos, &Offset);
+        if (Length)
+        {
+            Value = Length - 3;
+            if (Out + sizeof(USHORT) > DestSize)
+                return STATUS_BUFFER_TOO_SMALL;
+            *(PUSHORT)(Dest + Out) = (USHORT)(((Offset - 1) << 3) | min(Value, 7));
+            Out += sizeof(USHORT);
+
+            if (Value >= 7)
+            {
+                Value -= 7;
+
+                /* Two consecutive long matches share one byte of nibbles */
+                if (!HalfByte)
+                {
+                    if (Out >= DestSize)
+                        return STATUS_BUFFER_TOO_SMALL;
+                    HalfByte = Out;
+                    Dest[Out++] = (UCHAR)min(Value, 15);
+                }
+                else
+                {
+                    Dest[HalfByte] |= (UCHAR)(min(Value, 15) << 4);
+                    HalfByte = 0;
+                }
+
+                if (Value >= 15)
+                {
+                    Value -= 15;
+                    if (Value < 255)
+                    {
+                        if (Out >= DestSize)
+                            return STATUS_BUFFER_TOO_SMALL;
+                        Dest[Out++] = (UCHAR)Value;
+                    }
+                    else
+                    {
+                        /* The full length minus 3 follows */
+                        Value = Length - 3;
+                        if (Out + 1 + sizeof(USHORT) + sizeof(ULONG) > DestSize)
+                            return STATUS_BUFFER_TOO_SMALL;
+                        Dest[Out++] = 255;
+                        if (Value <= 0xFFFF)
+                        {
+                            *(PUSHORT)(Dest + Out) = (USHORT)Value;
+                            Out += sizeof(USHORT);
+                        }
+                        else
+                        {
+                            *(PUSHORT)(Dest + Out) = 0;
+                            *(PULONG)(Dest + Out + sizeof(USHORT)) = Value;
+                            Out += sizeof(USHORT) + sizeof(ULONG);
+                        }
+                    }
+                }
+            }
+
+            Flags = (Flags << 1) | 1;
+        }
+        else
+        {
+            if (Out >= DestSize)
+                return STATUS_BUFFER_TOO_SMALL;
+            Dest[Out++] = Source[Pos];
+            Flags <<= 1;
+            Length = 1;
+        }
+
+        while (Length--)
+        {
+            if (Pos + 3 <= SourceSize)
+                RtlpLzInsert(&Matcher, Pos);
+            Pos++;
+        }
+
+        /* Flush the flags and reserve the next flags word */
+        if (++FlagCount == 32)
+        {
+            *(PULONG)(Dest + FlagsPos) = Flags;
+            if (Out + sizeof(ULONG) > DestSize)
+                return STATUS_BUFFER_TOO_SMALL;
+            FlagsPos = Out;
+            Out += sizeof(ULONG);
+            FlagCount = 0;
+            Flags = 0;
+        }
+    }
+
+    /* Pad the last flags with matches, which end the stream */
+    if (FlagCount)
+        Flags = (Flags << (32 - FlagCount)) | ((1U << (32 - FlagCount)) - 1);
+    else
+        Flags = 0xFFFFFFFF;
+    *(PULONG)(Dest + FlagsPos) = Flags;
+
+    if (FinalSize)
+        *FinalSize = Out;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+RtlpDecompressBufferXpress(PUCHAR Dest,
+                           ULONG DestSize,
+                           PUCHAR Source,
+                           ULONG SourceSize,
+                           PULONG FinalSize)
+{
+    ULONG In = 0, Out = 0, Flags = 0, FlagCount = 0, HalfByte = 0, Length, Offset;
+
+    while (Out < DestSize)
+    {
+        if (!FlagCount)
+        {
+            if (In + sizeof(ULONG) > SourceSize) break;
+            Flags = *(PULONG)(Source + In);
+            In += sizeof(ULONG);
+            FlagCount = 32;
+        }
+        FlagCount--;
+
+        if (!(Flags & (1U << FlagCount)))
+        {
+            /* Literal */
+            if (In >= SourceSize) break;
+            Dest[Out++] = Source[In++];
+            continue;
+        }
+
+        /* A match flag without data marks the end of the stream */
+        if (In == SourceSize) break;
+        if (In + sizeof(USHORT) > SourceSize)
+            return STATUS_BAD_COMPRESSION_BUFFER;
+
+        Length = *(PUSHORT)(Source + In);
+        In += sizeof(USHORT);
+        Offset = (Length >> 3) + 1;
+        Length &= 7;
+
+        if (Length == 7)
+        {
+            if (!HalfByte)
+            {
+                if (In >= SourceSize)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                HalfByte = In;
+                Length = Source[In++] & 15;
+            }
+            else
+            {
+                Length = Source[HalfByte] >> 4;
+                HalfByte = 0;
+            }
+
+            if (Length == 15)
+            {
+                if (In >= SourceSize)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                Length = Source[In++];
+
+                if (Length == 255)
+                {
+                    if (In + sizeof(USHORT) > SourceSize)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    Length = *(PUSHORT)(Source + In);
+                    In += sizeof(USHORT);
+
+                    if (Length == 0)
+                    {
+                        if (In + sizeof(ULONG) > SourceSize)
+                            return STATUS_BAD_COMPRESSION_BUFFER;
+                        Length = *(PULONG)(Source + In);
+                        In += sizeof(ULONG);
+                    }
+
+                    if (Length < 15 + 7)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    Length -= 15 + 7;
+                }
+                Length += 15;
+            }
+            Length += 7;
+        }
+        Length += 3;
+
+        if (Offset > Out)
+            return STATUS_BAD_COMPRESSION_BUFFER;
+
+        /* Partial decompression is no error */
+        Length = min(Length, DestSize - Out);
+        RtlpLzCopyMatch(Dest + Out, Offset, Length);
+        Out += Length;
+    }
+
+    if (FinalSize)
+        *FinalSize = Out;
+
+    return STATUS_SUCCESS;
+}
+
+/* XPRESS HUFFMAN ************************************************************/
+
+/*
+ * Xpress Huffman as described in [MS-XCA] 2.1 and 2.2. Every 64K of output
+ * starts with 256 bytes holding the 4-bit code lengths of the 512 symbols,
+ * followed by a bit stream of 16-bit words in which extra length bytes
+ * are interleaved. Symbols above 255 encode a match: bits 4-7 give the
+ * number of offset bits, bits 0-3 the length.
+ */
+
+#define RTLP_HUFF_SYMBOLS       512
+#define RTLP_HUFF_MAX_BITS      15
+#define RTLP_HUFF_TABLE_BITS    9
+#define RTLP_HUFF_BLOCK_SIZE    0x10000
+#define RTLP_HUFF_WINDOW        0x10000
+#define RTLP_HUFF_MAX_LENGTH    (0xFFFF + 3)
+#define RTLP_HUFF_END_SYMBOL    256
+
+typedef struct _RTLP_HUFF_BITSTREAM
+{
+    PUCHAR Buffer;
+    ULONG Size;
+    ULONG BitBuffer;
+    ULONG BitCount;
+    ULONG NextBits;
+    ULONG NextBits2;
+    ULONG NextByte;
+    BOOLEAN Overflow;
+} RTLP_HUFF_BITSTREAM, *PRTLP_HUFF_BITSTREAM;
+
+static __inline VOID
+RtlpHuffPutWord(PRTLP_HUFF_BITSTREAM Stream, ULONG Pos, USHORT Value)
+{
+    if (Pos + sizeof(USHORT) > Stream->Size)
+        Stream->Overflow = TRUE;
+    else
+        *(PUSHORT)(Stream->Buffer + Pos) = Value;
+}
+
+static __inline VOID
+RtlpHuffPutByte(PRTLP_HUFF_BITSTREAM Stream, UCHAR Value)
+{
+    if (Stream->NextByte >= Stream->Size)
+        Stream->Overflow = TRUE;
+    else
+        Stream->Buffer[Stream->NextByte] = Value;
+    Stream->NextByte++;
+}
+
+/*
+ * The decoder keeps two words ahead of the bits it consumes and fetches
+ * the next one as soon as it eats into the second. Reserving the slots in
+ * the same order keeps the interleaved bytes where the decoder reads them.
+ */
+static __inline VOID
+RtlpHuffPutBits(PRTLP_HUFF_BITSTREAM Stream, ULONG Bits, ULONG Count)
+{
+    Stream->BitBuffer = (Stream->BitBuffer << Count) | Bits;
+    Stream->BitCount += Count;
+
+    if (Stream->BitCount > 16)
+    {
+        Stream->BitCount -= 16;
+        RtlpHuffPutWord(Stream, Stream->NextBits,
+                        (USHORT)(Stream->BitBuffer >> Stream->BitCount));
+        Stream->NextBits = Stream->NextBits2;
+        Stream->NextBits2 = Stream->NextByte;
+        Stream->NextByte += sizeof(USHORT);
+    }
+}
+
+static VOID
+RtlpHuffStartBlock(PRTLP_HUFF_BITSTREAM Stream, ULONG Pos)
+{
+    Stream->BitBuffer = 0;
+    Stream->BitCount = 0;
+    Stream->NextBits = Pos;
+    Stream->NextBits2 = Pos + sizeof(USHORT);
+    Stream->NextByte = Pos + 2 * sizeof(USHORT);
+}
+
+static VOID
+RtlpHuffEndBlock(PRTLP_HUFF_BITSTREAM Stream)
+{
+    RtlpHuffPutWord(Stream, Stream->NextBits,
+                    (USHORT)(Stream->BitBuffer << (16 - Stream->BitCount)));
+    RtlpHuffPutWord(Stream, Stream->NextBits2, 0);
+}
+
+/* Build Huffman code lengths from the symbol frequencies */
+static ULONG
+RtlpHuffBuildLengths(PRTLP_XPRESS_HUFF_WORKSPACE Ws)
+{
+    ULONG Count = 0, Symbol, i, j, Node, Leaf, Next, Low[2], MaxDepth = 0;
+    LONG k;
+
+    RtlZeroMemory(Ws->CodeLength, sizeof(Ws->CodeLength));
+
+    /* Collect the used symbols, sorted by frequency */
+    for (Symbol = 0; Symbol < RTLP_HUFF_SYMBOLS; Symbol++)
+    {
+        if (!Ws->Frequency[Symbol]) continue;
+
+        for (i = Count; i && Ws->Frequency[Ws->Leaves[i - 1]] > Ws->Frequency[Symbol]; i--)
+            Ws->Leaves[i] = Ws->Leaves[i - 1];
+        Ws->Leaves[i] = (USHORT)Symbol;
+        Count++;
+    }
+
+    if (Count <= 1)
+    {
+        if (Count) Ws->CodeLength[Ws->Leaves[0]] = 1;
+        return Count;
+    }
+
+    /* Merge the sorted leaves and the internal nodes in two queues */
+    for (i = 0; i < Count; i++)
+        Ws->Weight[i] = Ws->Frequency[Ws->Leaves[i]];
+
+    Leaf = 0;
+    Node = Count;
+    for (Next = Count; Next < 2 * Count - 1; Next++)
+    {
+        for (j = 0; j < 2; j++)
+        {
+            if (Leaf < Count && (Node >= Next || Ws->Weight[Leaf] <= Ws->Weight[Node]))
+                Low[j] = Leaf++;
+            else
+                Low[j] = Node++;
+        }
+
+        Ws->Weight[Next] = Ws->Weight[Low[0]] + Ws->Weight[Low[1]];
+        Ws->Parent[Low[0]] = Ws->Parent[Low[1]] = (USHORT)Next;
+    }
+
+    /* The root is the last node, depths follow the parent links */
+    Ws->Depth[2 * Count - 2] = 0;
+    for (k = 2 * Count - 3; k >= 0; k--)
+        Ws->Depth[k] = Ws->Depth[Ws->Parent[k]] + 1;
+
+    for (i = 0; i < Count; i++)
+    {
+        Ws->CodeLength[Ws->Leaves[i]] = (UCHAR)min(Ws->Depth[i], 0xFF);
+        MaxDepth = max(MaxDepth, Ws->Depth[i]);
+    }
+
+    return MaxDepth;
+}
+
+/* Assign length-limited canonical codes, ordered by length and symbol */
+static VOID
+RtlpHuffBuildCodes(PRTLP_XPRESS_HUFF_WORKSPACE Ws)
+{
+    ULONG Counts[RTLP_HUFF_MAX_BITS + 1], NextCode[RTLP_HUFF_MAX_BITS + 1];
+    ULONG Symbol, Bits, Code = 0;
+
+    /* Flatten the frequencies until the tree is shallow enough */
+    while (RtlpHuffBuildLengths(Ws) > RTLP_HUFF_MAX_BITS)
+    {
+        for (Symbol = 0; Symbol < RTLP_HUFF_SYMBOLS; Symbol++)
+        {
+            if (Ws->Frequency[Symbol])
+                Ws->Frequency[Symbol] = (Ws->Frequency[Symbol] >> 1) | 1;
+        }
+    }
+
+    RtlZeroMemory(Counts, sizeof(Counts));
+    for (Symbol = 0; Symbol < RTLP_HUFF_SYMBOLS; Symbol++)
+        Counts[Ws->CodeLength[Symbol]]++;
+
+    Counts[0] = 0;
+    for (Bits = 1; Bits <= RTLP_HUFF_MAX_BITS; Bits++)
+    {
+        Code = (Code + Counts[Bits - 1]) << 1;
+        NextCode[Bits] = Code;
+    }
+
+    for (Symbol = 0; Symbol < RTLP_HUFF_SYMBOLS; Symbol++)
+    {
+        if (Ws->CodeLength[Symbol])
+            Ws->Code[Symbol] = (USHORT)NextCode[Ws->CodeLength[Symbol]]++;
+    }
+}
+
+static NTSTATUS
+RtlpCompressBufferXpressHuff(PUCHAR Source,
+                             ULONG SourceSize,
+                             PUCHAR Dest,
+                             ULONG DestSize,
+                             PULONG FinalSize,
+                             PVOID WorkSpace,
+                             USHORT Engine)
+{
+    PRTLP_XPRESS_HUFF_WORKSPACE Ws = WorkSpace;
+    RTLP_LZ_MATCHER Matcher;
+    RTLP_HUFF_BITSTREAM Stream;
+    ULONG Pos = 0, BlockEnd, Tokens, Token, Length, Offset, OffsetBits, Symbol, Out = 0, i;
+
+    /* The tokens of a block are collected before its codes are known */
+    if (!Ws)
+        return STATUS_INVALID_PARAMETER;
+
+    RtlpLzInitMatcher(&Matcher, Source, Ws->Head, Ws->Prev, RTLP_HUFF_WINDOW, Engine);
+
+    Stream.Buffer = Dest;
+    Stream.Size = DestSize;
+    Stream.Overflow = FALSE;
+
+    do
+    {
+        /* Parse up to 64K of input, a match may run past the block end */
+        BlockEnd = (SourceSize - Pos > RTLP_HUFF_BLOCK_SIZE) ?
+                   Pos + RTLP_HUFF_BLOCK_SIZE : SourceSize;
+        RtlZeroMemory(Ws->Frequency, sizeof(Ws->Frequency));
+
+        for (Tokens = 0; Pos < BlockEnd; Tokens++)
+        {
+            Length = RtlpLzFindMatch(&Matcher, Pos, 0, RTLP_HUFF_WINDOW - 1,
+                                     min(SourceSize - Pos, RTLP_HUFF_MAX_LENGTH), &Offset);
+
+            /* Symbol 256 with no extra data is reserved for the end marker */
+            if (Length == 3 && Offset == 1)
+                Length = 0;
+
+            if (Length)
+            {
+                BitScanReverse(&OffsetBits, Offset);
+                Ws->Frequency[256 + (OffsetBits << 4) + min(Length - 3, 15)]++;
+                Ws->TokenLength[Tokens] = (USHORT)(Length - 3);
+                Ws->TokenOffset[Tokens] = (USHORT)Offset;
+            }
+            else
+            {
+                Ws->Frequency[Source[Pos]]++;
+                Ws->TokenLength[Tokens] = Source[Pos];
+                Ws->TokenOffset[Tokens] = 0;
+                Length = 1;
+            }
+
+            while (Length--)
+            {
+                if (Pos + 3 <= SourceSize)
+                    RtlpLzInsert(&Matcher, Pos);
+                Pos++;
+            }
+        }
+
+        if (Pos >= SourceSize)
+            Ws->Frequency[RTLP_HUFF_END_SYMBOL]++;
+
+        RtlpHuffBuildCodes(Ws);
+
+        /* Write the table of code lengths */
+        if (Out + 256 + 2 * sizeof(USHORT) > DestSize)
+            return STATUS_BUFFER_TOO_SMALL;
+        for (i = 0; i < 256; i++)
+            Dest[Out + i] = Ws->CodeLength[2 * i] | (Ws->CodeLength[2 * i + 1] << 4);
+
+        RtlpHuffStartBlock(&Stream, Out + 256);
+
+        for (Token = 0; Token < Tokens; Token++)
+        {
+            Offset = Ws->TokenOffset[Token];
+            Length = Ws->TokenLength[Token];
+
+            if (!Offset)
+            {
+                RtlpHuffPutBits(&Stream, Ws->Code[Length], Ws->CodeLength[Length]);
+                continue;
+            }
+
+            BitScanReverse(&OffsetBits, Offset);
+            Symbol = 256 + (OffsetBits << 4) + min(Length, 15);
+            RtlpHuffPutBits(&Stream, Ws->Code[Symbol], Ws->CodeLength[Symbol]);
+
+            if (Length >= 15)
+            {
+                if (Length - 15 < 255)
+                {
+                    RtlpHuffPutByte(&Stream, (UCHAR)(Length - 15));
+                }
+                else
+                {
+                    RtlpHuffPutByte(&Stream, 255);
+                    RtlpHuffPutByte(&Stream, (UCHAR)Length);
+                    RtlpHuffPutByte(&Stream, (UCHAR)(Length >> 8));
+                }
+            }
+
+            if (OffsetBits)
+                RtlpHuffPutBits(&Stream, Offset - (1 << OffsetBits), OffsetBits);
+        }
+
+        if (Pos >= SourceSize)
+        {
+            RtlpHuffPutBits(&Stream,
+                            Ws->Code[RTLP_HUFF_END_SYMBOL],
+                            Ws->CodeLength[RTLP_HUFF_END_SYMBOL]);
+        }
+
+        RtlpHuffEndBlock(&Stream);
+        if (Stream.Overflow)
+            return STATUS_BUFFER_TOO_SMALL;
+
+        Out = Stream.NextByte;
+    }
+    while (Pos < SourceSize);
+
+    if (FinalSize)
+        *FinalSize = Out;
+
+    return STATUS_SUCCESS;
+}
+
+typedef struct _RTLP_HUFF_DECODER
+{
+    USHORT Table[1 << RTLP_HUFF_TABLE_BITS];
+    USHORT Sorted[RTLP_HUFF_SYMBOLS];
+    USHORT First[RTLP_HUFF_MAX_BITS + 1];
+    USHORT Count[RTLP_HUFF_MAX_BITS + 1];
+    USHORT Index[RTLP_HUFF_MAX_BITS + 1];
+} RTLP_HUFF_DECODER, *PRTLP_HUFF_DECODER;
+
+/*
+ * Short codes are resolved with a single table lookup, holding the symbol
+ * in the upper and the code length in the lower four bits. The few longer
+ * codes are found by walking the canonical code ranges.
+ */
+static BOOLEAN
+RtlpHuffBuildDecoder(PRTLP_HUFF_DECODER Decoder, PUCHAR Lengths)
+{
+    ULONG Symbol, Bits, Code, Fill, Step, Space = 0, Used = 0, i;
+    USHORT Next[RTLP_HUFF_MAX_BITS + 1];
+
+    RtlZeroMemory(Decoder->Count, sizeof(Decoder->Count));
+    for (Symbol = 0; Symbol < RTLP_HUFF_SYMBOLS; Symbol++)
+        Decoder->Count[(Lengths[Symbol / 2] >> ((Symbol & 1) * 4)) & 15]++;
+
+    /* Reject oversubscribed tables */
+    for (Bits = 1; Bits <= RTLP_HUFF_MAX_BITS; Bits++)
+    {
+        Space += (ULONG)Decoder->Count[Bits] << (RTLP_HUFF_MAX_BITS - Bits);
+        Used += Decoder->Count[Bits];
+    }
+    if (!Used || Space > (1 << RTLP_HUFF_MAX_BITS))
+        return FALSE;
+
+    Code = 0;
+    Decoder->Count[0] = 0;
+    Decoder->Index[0] = 0;
+    for (Bits = 1; Bits <= RTLP_HUFF_MAX_BITS; Bits++)
+    {
+        Code = (Code + Decoder->Count[Bits - 1]) << 1;
+        Decoder->First[Bits] = (USHORT)Code;
+        Decoder->Index[Bits] = Decoder->Index[Bits - 1] + Decoder->Count[Bits - 1];
+        Next[Bits] = Decoder->Index[Bits];
+    }
+
+    for (Symbol = 0; Symbol < RTLP_HUFF_SYMBOLS; Symbol++)
+    {
+        Bits = (Lengths[Symbol / 2] >> ((Symbol & 1) * 4)) & 15;
+        if (Bits) Decoder->Sorted[Next[Bits]++] = (USHORT)Symbol;
+    }
+
+    RtlZeroMemory(Decoder->Table, sizeof(Decoder->Table));
+    for (Bits = 1; Bits <= RTLP_HUFF_TABLE_BITS; Bits++)
+    {
+        Step = 1 << (RTLP_HUFF_TABLE_BITS - Bits);
+        for (i = 0; i < Decoder->Count[Bits]; i++)
+        {
+            Code = (Decoder->First[Bits] + i) << (RTLP_HUFF_TABLE_BITS - Bits);
+            Symbol = Decoder->Sorted[Decoder->Index[Bits] + i];
+            for (Fill = 0; Fill < Step; Fill++)
+                Decoder->Table[Code + Fill] = (USHORT)((Symbol << 4) | Bits);
+        }
+    }
+
+    return TRUE;
+}
+
+static __inline USHORT
+RtlpHuffGetWord(PUCHAR Source, ULONG SourceSize, ULONG Pos)
+{
+    return (Pos + sizeof(USHORT) <= SourceSize) ? *(PUSHORT)(Source + Pos) : 0;
+}
+
+static NTSTATUS
+RtlpDecompressBufferXpressHuff(PUCHAR Dest,
+                               ULONG DestSize,
+                               PUCHAR Source,
+                               ULONG SourceSize,
+                               PULONG FinalSize)
+{
+    RTLP_HUFF_DECODER Decoder;
+    ULONG In = 0, Out = 0, Current, NextBits, BlockEnd, Entry, Bits, Code;
+    ULONG Symbol, Length, Offset, OffsetBits;
+    LONG ExtraBits;
+
+#define CONSUME_BITS(n) \
+    do { \
+        NextBits <<= (n); \
+        ExtraBits -= (n); \
+        if (ExtraBits < 0) \
+        { \
+            NextBits |= (ULONG)RtlpHuffGetWord(Source, SourceSize, Current) << -ExtraBits; \
+            Current += sizeof(USHORT); \
+            ExtraBits += 16; \
+        } \
+    } while (0)
+
+    while (Out < DestSize)
+    {
+        if (In + 256 > SourceSize)
+        {
+            if (!In) return STATUS_BAD_COMPRESSION_BUFFER;
+            break;
+        }
+
+        if (!RtlpHuffBuildDecoder(&Decoder, Source + In))
+            return STATUS_BAD_COMPRESSION_BUFFER;
+
+        Current = In + 256;
+        NextBits = ((ULONG)RtlpHuffGetWord(Source, SourceSize, Current) << 16) |
+                   RtlpHuffGetWord(Source, SourceSize, Current + sizeof(USHORT));
+        Current += 2 * sizeof(USHORT);
+        ExtraBits = 16;
+
+        BlockEnd = (DestSize - Out > RTLP_HUFF_BLOCK_SIZE) ?
+                   Out + RTLP_HUFF_BLOCK_SIZE : DestSize;
+
+        while (Out < BlockEnd)
+        {
+            /* Decode the next symbol */
+            Code = NextBits >> (32 - RTLP_HUFF_MAX_BITS);
+            Entry = Decoder.Table[Code >> (RTLP_HUFF_MAX_BITS - RTLP_HUFF_TABLE_BITS)];
+            if (Entry)
+            {
+                Symbol = Entry >> 4;
+                Bits = Entry & 15;
+            }
+            else
+            {
+                for (Bits = RTLP_HUFF_TABLE_BITS + 1; Bits <= RTLP_HUFF_MAX_BITS; Bits++)
+                {
+                    Entry = (Code >> (RTLP_HUFF_MAX_BITS - Bits)) - Decoder.First[Bits];
+                    if (Entry < Decoder.Count[Bits]) break;
+                }
+                if (Bits > RTLP_HUFF_MAX_BITS)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                Symbol = Decoder.Sorted[Decoder.Index[Bits] + Entry];
+            }
+            CONSUME_BITS(Bits);
+
+            if (Symbol < 256)
+            {
+                Dest[Out++] = (UCHAR)Symbol;
+                continue;
+            }
+
+            /* The end marker is the last symbol of the input */
+            if (Symbol == RTLP_HUFF_END_SYMBOL && Current >= SourceSize)
+                goto out;
+
+            Symbol -= 256;
+            Length = Symbol & 15;
+            OffsetBits = Symbol >> 4;
+
+            if (Length == 15)
+            {
+                if (Current >= SourceSize)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                Length = Source[Current++];
+
+                if (Length == 255)
+                {
+                    if (Current + sizeof(USHORT) > SourceSize)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    Length = *(PUSHORT)(Source + Current);
+                    Current += sizeof(USHORT);
+
+                    if (Length < 15)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    Length -= 15;
+                }
+                Length += 15;
+            }
+            Length += 3;
+
+            Offset = OffsetBits ? (NextBits >> (32 - OffsetBits)) : 0;
+            Offset += 1 << OffsetBits;
+            CONSUME_BITS(OffsetBits);
+
+            if (Offset > Out)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+
+            /* Partial decompression is no error */
+            Length = min(Length, DestSize - Out);
+            RtlpLzCopyMatch(Dest + Out, Offset, Length);
+            Out += Length;
+        }
+
+        In = Current;
+    }
+
+#undef CONSUME_BITS
+
+out:
+    if (FinalSize)
+        *FinalSize = Out;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+RtlpWorkSpaceSizeXpress(USHORT Format,
+                        USHORT Engine,
+                        PULONG BufferAndWorkSpaceSize,
+                        PULONG FragmentWorkSpaceSize)
+{
+   if (Engine != COMPRESSION_ENGINE_STANDARD &&
+       Engine != COMPRESSION_ENGINE_MAXIMUM)
+      return(STATUS_NOT_SUPPORTED);
+
+   /* Decompression works in place and needs no workspace */
+   *BufferAndWorkSpaceSize = (Format == COMPRESSION_FORMAT_XPRESS_HUFF) ?
+                             sizeof(RTLP_XPRESS_HUFF_WORKSPACE) :
+                             sizeof(RTLP_LZ_WORKSPACE);
+   *FragmentWorkSpaceSize = 0;
+   return(STATUS_SUCCESS);
+}
+
 
 /*
  * @implemented
@@ -284,7 +1278,7 @@ RtlCompressBuffer(IN USHORT CompressionFormatAndEngine,
                   IN PVOID WorkSpace)
 {
    USHORT Format = CompressionFormatAndEngine & COMPRESSION_FORMAT_MASK;
-   /* USHORT Engine = CompressionFormatAndEngine & COMPRESSION_ENGINE_MASK; */
+   USHORT Engine = CompressionFormatAndEngine & COMPRESSION_ENGINE_MASK;
 
    if ((Format == COMPRESSION_FORMAT_NONE) ||
          (Format == COMPRESSION_FORMAT_DEFAULT))
@@ -297,7 +1291,26 @@ RtlCompressBuffer(IN USHORT CompressionFormatAndEngine,
                                      CompressedBufferSize,
                                      UncompressedChunkSize,
                                      FinalCompressedSize,
-                                     WorkSpace));
+                                     WorkSpace,
+                                     Engine));
+
+   if (Format == COMPRESSION_FORMAT_XPRESS)
+      return(RtlpCompressBufferXpress(UncompressedBuffer,
+                                      UncompressedBufferSize,
+                                      CompressedBuffer,
+                                      CompressedBufferSize,
+                                      FinalCompressedSize,
+                                      WorkSpace,
+                                      Engine));
+
+   if (Format == COMPRESSION_FORMAT_XPRESS_HUFF)
+      return(RtlpCompressBufferXpressHuff(UncompressedBuffer,
+                                          UncompressedBufferSize,
+                                          CompressedBuffer,
+                                          CompressedBufferSize,
+                                          FinalCompressedSize,
+                                          WorkSpace,
+                                          Engine));
 
    return(STATUS_UNSUPPORTED_COMPRESSION);
 }
@@ -357,6 +1370,17 @@ RtlDecompressFragment(IN USHORT format,
             return lznt1_decompress(uncompressed, uncompressed_size, compressed,
                                     compressed_size, offset, final_size, workspace);
 
+        /* Xpress streams can only be decoded from their start */
+        case COMPRESSION_FORMAT_XPRESS:
+            if (offset) return STATUS_NOT_SUPPORTED;
+            return RtlpDecompressBufferXpress(uncompressed, uncompressed_size, compressed,
+                                              compressed_size, final_size);
+
+        case COMPRESSION_FORMAT_XPRESS_HUFF:
+            if (offset) return STATUS_NOT_SUPPORTED;
+            return RtlpDecompressBufferXpressHuff(uncompressed, uncompressed_size, compressed,
+                                                  compressed_size, final_size);
+
         case COMPRESSION_FORMAT_NONE:
         case COMPRESSION_FORMAT_DEFAULT:
             return STATUS_INVALID_PARAMETER;
@@ -417,6 +1441,13 @@ RtlGetCompressionWorkSpaceSize(IN USHORT CompressionFormatAndEngine,
                                     CompressBufferAndWorkSpaceSize,
                                     CompressFragmentWorkSpaceSize));
 
+   if ((Format == COMPRESSION_FORMAT_XPRESS) ||
+         (Format == COMPRESSION_FORMAT_XPRESS_HUFF))
+      return(RtlpWorkSpaceSizeXpress(Format,
+                                     Engine,
+                                     CompressBufferAndWorkSpaceSize,
+                                     CompressFragmentWorkSpaceSize));
+
    return(STATUS_UNSUPPORTED_COMPRESSION);
 }
 
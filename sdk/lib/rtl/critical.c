@@ -16,6 +16,10 @@
 
 #define MAX_STATIC_CS_DEBUG_OBJECTS 64
 
+/* The upper bits of the spin count are flags */
+#define RTL_CRITSECT_SPIN_MASK 0x00FFFFFF
+#define RTL_CRITSECT_MIN_SPINS 16
+
 static RTL_CRITICAL_SECTION RtlCriticalSectionLock;
 static LIST_ENTRY RtlCriticalSectionList;
 static BOOLEAN RtlpCritSectInitialized = FALSE;
@@ -29,72 +33,67 @@ extern HANDLE LdrpShutdownThreadId;
 /* FUNCTIONS *****************************************************************/
 
 /*++
- * RtlpCreateCriticalSectionSem
+ * RtlpSpinOnCriticalSection
  *
- *     Checks if an Event has been created for the critical section.
+ *     Spins for a while trying to acquire a critical section owned by
+ *     another thread.
  *
  * Params:
- *     None
+ *     CriticalSection - Critical section to acquire.
  *
  * Returns:
- *     None. Raises an exception if the system call failed.
+ *     TRUE if the critical section was acquired, FALSE otherwise.
  *
  * Remarks:
- *     None
+ *     The spin count set for the critical section is the upper limit. The
+ *     actual limit is twice the average number of spins recently needed,
+ *     so that sections held for short times don't spin for the full
+ *     count when the owner goes away. The average is kept in the debug
+ *     data, if there is any.
  *
  *--*/
-_At_(CriticalSection->LockSemaphore, _Post_notnull_)
-VOID
-NTAPI
-RtlpCreateCriticalSectionSem(PRTL_CRITICAL_SECTION CriticalSection)
+static
+BOOLEAN
+RtlpSpinOnCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
 {
-    HANDLE hEvent = CriticalSection->LockSemaphore;
-    HANDLE hNewEvent;
-    NTSTATUS Status;
+    PRTL_CRITICAL_SECTION_DEBUG DebugInfo = CriticalSection->DebugInfo;
+    ULONG MaxSpins = (ULONG)CriticalSection->SpinCount & RTL_CRITSECT_SPIN_MASK;
+    ULONG Average, Limit, Spins;
 
-    /* Check if we have an event */
-    if (!hEvent)
+    /* Without debug data there's no history, use half of the spin count */
+    Average = DebugInfo ? DebugInfo->SpareWORD : MaxSpins / 2;
+    Limit = min(MaxSpins, Average * 2 + RTL_CRITSECT_MIN_SPINS);
+
+    for (Spins = 0; Spins < Limit; Spins++)
     {
-        /* No, so create it */
-        Status = NtCreateEvent(&hNewEvent,
-                               EVENT_ALL_ACCESS,
-                               NULL,
-                               SynchronizationEvent,
-                               FALSE);
-        if (!NT_SUCCESS(Status))
+        if (CriticalSection->LockCount == -1 &&
+            InterlockedCompareExchange(&CriticalSection->LockCount, 0, -1) == -1)
         {
-            DPRINT1("Failed to Create Event!\n");
-
-            /*
-             * Use INVALID_HANDLE_VALUE (-1) to signal that
-             * the global keyed event must be used.
-             */
-            hNewEvent = INVALID_HANDLE_VALUE;
+            break;
         }
 
-        DPRINT("Created Event: %p \n", hNewEvent);
+        YieldProcessor();
+    }
 
-        /* Exchange the LockSemaphore field with the new handle, if it is still 0 */
-        if (InterlockedCompareExchangePointer((PVOID*)&CriticalSection->LockSemaphore,
-                                              (PVOID)hNewEvent,
-                                               NULL) != NULL)
-        {
-            /* Someone else just created an event */
-            if (hEvent != INVALID_HANDLE_VALUE)
-            {
-                DPRINT("Closing already created event: %p\n", hNewEvent);
-                NtClose(hNewEvent);
-            }
-        }
+    /* The section wasn't contended at all, nothing to learn from that */
+    if (!Spins) return TRUE;
+
+    /* Move the average towards the number of spins this time. No need for
+       interlocked operations, it is only a hint. */
+    if (DebugInfo)
+    {
+        DebugInfo->ContentionCount++;
+        Average += ((LONG)Spins - (LONG)Average) / 8;
+        DebugInfo->SpareWORD = (WORD)min(Average, MAXWORD);
     }
 
-    return;
+    return (Spins < Limit);
 }
 
 /*++
  * RtlpWaitForCriticalSection
  *
- *     Slow path of RtlEnterCriticalSection. Waits on an Event Object.
+ *     Slow path of RtlEnterCriticalSection. Waits on the global keyed event.
  *
  * Params:
  *     CriticalSection - Critical section to acquire.
@@ -114,16 +113,8 @@ RtlpWaitForCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
     EXCEPTION_RECORD ExceptionRecord;
     BOOLEAN LastChance = FALSE;
 
-    /* Do we have an Event yet? */
-    if (!CriticalSection->LockSemaphore)
-    {
-        RtlpCreateCriticalSectionSem(CriticalSection);
-    }
-
     /* Increase the Debug Entry count */
-    DPRINT("Waiting on Critical Section Event: %p %p\n",
-            CriticalSection,
-            CriticalSection->LockSemaphore);
+    DPRINT("Waiting on Critical Section: %p\n", CriticalSection);
 
     if (CriticalSection->DebugInfo)
         CriticalSection->DebugInfo->EntryCount++;
@@ -146,22 +137,14 @@ RtlpWaitForCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
         if (CriticalSection->DebugInfo)
             CriticalSection->DebugInfo->ContentionCount++;
 
-        /* Check if allocating the event failed */
-        if (CriticalSection->LockSemaphore == INVALID_HANDLE_VALUE)
-        {
-            /* Use the global keyed event (NULL as keyed event handle) */
-            Status = NtWaitForKeyedEvent(NULL,
-                                         CriticalSection,
-                                         FALSE,
-                                         &RtlpTimeout);
-        }
-        else
-        {
-            /* Wait on the Event */
-            Status = NtWaitForSingleObject(CriticalSection->LockSemaphore,
-                                           FALSE,
-                                           &RtlpTimeout);
-        }
+        /*
+         * Use the global keyed event (NULL as keyed event handle), so that
+         * no critical section needs an event handle of its own
+         */
+        Status = NtWaitForKeyedEvent(NULL,
+                                     CriticalSection,
+                                     FALSE,
+                                     &RtlpTimeout);
 
         /* We have Timed out */
         if (Status == STATUS_TIMEOUT)
@@ -195,7 +178,8 @@ RtlpWaitForCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
 /*++
  * RtlpUnWaitCriticalSection
  *
- *     Slow path of RtlLeaveCriticalSection. Fires an Event Object.
+ *     Slow path of RtlLeaveCriticalSection. Releases a waiter from the
+ *     global keyed event.
  *
  * Params:
  *     CriticalSection - Critical section to release.
@@ -213,35 +197,19 @@ RtlpUnWaitCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
 {
     NTSTATUS Status;
 
-    /* Do we have an Event yet? */
-    if (!CriticalSection->LockSemaphore)
-    {
-        RtlpCreateCriticalSectionSem(CriticalSection);
-    }
+    DPRINT("Signaling Critical Section: %p\n", CriticalSection);
 
-    /* Signal the Event */
-    DPRINT("Signaling Critical Section Event: %p, %p\n",
-            CriticalSection,
-            CriticalSection->LockSemaphore);
-
-    /* Check if this critical section needs to use the keyed event */
-    if (CriticalSection->LockSemaphore == INVALID_HANDLE_VALUE)
-    {
-        /* Release keyed event */
-        Status = NtReleaseKeyedEvent(NULL, CriticalSection, FALSE, &RtlpTimeout);
-    }
-    else
-    {
-        /* Set the event */
-        Status = NtSetEvent(CriticalSection->LockSemaphore, NULL);
-    }
+    /*
+     * The waiter has incremented the lock count already, so it is going to
+     * wait for sure. Don't time out, a release that timed out would be lost.
+     */
+    Status = NtReleaseKeyedEvent(NULL, CriticalSection, FALSE, NULL);
 
     if (!NT_SUCCESS(Status))
     {
         /* We've failed */
-        DPRINT1("Signaling Failed for: %p, %p, 0x%08lx\n",
+        DPRINT1("Signaling Failed for: %p, 0x%08lx\n",
                 CriticalSection,
-                CriticalSection->LockSemaphore,
                 Status);
         RtlRaiseStatus(Status);
     }
@@ -398,8 +366,9 @@ RtlDeleteCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
 
     DPRINT("Deleting Critical Section: %p\n", CriticalSection);
 
-    /* Close the Event Object Handle if it exists */
-    if (CriticalSection->LockSemaphore)
+    /* Close the Event Object Handle if someone set one */
+    if (CriticalSection->LockSemaphore &&
+        CriticalSection->LockSemaphore != INVALID_HANDLE_VALUE)
     {
         /* In case NtClose fails, return the status */
         Status = NtClose(CriticalSection->LockSemaphore);
@@ -486,6 +455,16 @@ RtlEnterCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
 {
     HANDLE Thread = (HANDLE)NtCurrentTeb()->ClientId.UniqueThread;
 
+    /* Spin for a while first if we have a spin count, and don't own it */
+    if ((CriticalSection->SpinCount & RTL_CRITSECT_SPIN_MASK) &&
+        Thread != CriticalSection->OwningThread &&
+        RtlpSpinOnCriticalSection(CriticalSection))
+    {
+        CriticalSection->OwningThread = Thread;
+        CriticalSection->RecursionCount = 1;
+        return STATUS_SUCCESS;
+    }
+
     /* Try to lock it */
     if (InterlockedIncrement(&CriticalSection->LockCount) != 0)
     {
@@ -598,6 +577,7 @@ RtlInitializeCriticalSectionAndSpinCount(PRTL_CRITICAL_SECTION CriticalSection,
     CritcalSectionDebugData->EntryCount = 0;
     CritcalSectionDebugData->CriticalSection = CriticalSection;
     CritcalSectionDebugData->Flags = 0;
+    CritcalSectionDebugData->SpareWORD = (WORD)min((CriticalSection->SpinCount & RTL_CRITSECT_SPIN_MASK) / 2, MAXWORD);
     CriticalSection->DebugInfo = CritcalSectionDebugData;
 
     /*
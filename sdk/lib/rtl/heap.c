@@ -24,6 +24,8 @@
 #define NDEBUG
 #include <debug.h>
 
+static BOOLEAN RtlpLfhDrain(PHEAP Heap);
+
 /* Bitmaps stuff */
 
 /* How many least significant bits are clear */
@@ -1563,6 +1565,19 @@ RtlDestroyHeap(HANDLE HeapPtr) /* [in] Handle of heap */
     if (RtlpGetMode() == UserMode &&
         HeapPtr == NtCurrentPeb()->ProcessHeap) return HeapPtr;
 
+    /* Free the front end heap, the blocks it caches go away with the segments */
+    if (Heap->FrontEndHeap)
+    {
+        BaseAddress = Heap->FrontEndHeap;
+        Size = 0;
+        ZwFreeVirtualMemory(NtCurrentProcess(),
+                            &BaseAddress,
+                            &Size,
+                            MEM_RELEASE);
+        Heap->FrontEndHeap = NULL;
+        Heap->FrontEndHeapType = 0;
+    }
+
     /* Free up all big allocations */
     Current = Heap->VirtualAllocdBlocks.Flink;
     while (Current != &Heap->VirtualAllocdBlocks)
@@ -1770,7 +1785,9 @@ RtlpAllocateNonDedicated(PHEAP Heap,
     PHEAP_ENTRY InUseEntry;
     PHEAP_ENTRY_EXTRA Extra;
     EXCEPTION_RECORD ExceptionRecord;
+    BOOLEAN Drained = FALSE;
 
+Retry:
     /* Go through the zero list to find a place where to insert the new entry */
     FreeListHead = &Heap->FreeLists[0];
 
@@ -1880,6 +1897,14 @@ RtlpAllocateNonDedicated(PHEAP Heap,
         return InUseEntry + 1;
     }
 
+    /* Blocks kept by the front end heap may coalesce into something that
+       fits once they are back, try that once before giving up */
+    if (!Drained && RtlpLfhDrain(Heap))
+    {
+        Drained = TRUE;
+        goto Retry;
+    }
+
     /* Really unfortunate, out of memory condition */
     RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_NO_MEMORY);
 
@@ -1902,6 +1927,292 @@ RtlpAllocateNonDedicated(PHEAP Heap,
     return NULL;
 }
 
+FORCEINLINE
+PSLIST_HEADER
+RtlpLfhGetBucket(PHEAP_LFH Lfh, SIZE_T Index)
+{
+    ULONG Slot;
+
+    /* Spread the threads over the slots */
+    Slot = (HandleToUlong(NtCurrentTeb()->ClientId.UniqueThread) >> 2) & (HEAP_LFH_SLOTS - 1);
+
+    return &Lfh->Slots[Slot].Buckets[Index];
+}
+
+static
+VOID
+RtlpLfhFreeBlocks(PHEAP Heap, ULONG Flags, PVOID Block)
+{
+    PVOID Next;
+
+    /* Walk a local list or a depot batch */
+    while (Block)
+    {
+        Next = ((PVOID *)Block)[1];
+        RtlFreeHeap(Heap, Flags, Block);
+        Block = Next;
+    }
+}
+
+static
+PHEAP_THREAD_CACHE
+RtlpLfhGetThreadCache(PHEAP Heap, PHEAP_LFH Lfh)
+{
+    PHEAP_THREAD_CACHE Cache;
+    PVOID *Slot;
+    SIZE_T Index;
+    PVOID Block;
+
+    if (!Lfh->CacheIndex) return NULL;
+
+    Slot = &NtCurrentTeb()->TlsSlots[Lfh->CacheIndex - 1];
+    Cache = *Slot;
+    if (Cache == HEAP_CACHE_DISABLED) return NULL;
+
+    if (!Cache)
+    {
+        /* Disable the cache while allocating it, so the allocation doesn't
+           come back here */
+        *Slot = HEAP_CACHE_DISABLED;
+        Cache = RtlAllocateHeap(Heap, HEAP_ZERO_MEMORY, sizeof(HEAP_THREAD_CACHE));
+        if (Cache)
+        {
+            Cache->Heap = Heap;
+            Cache->Generation = Lfh->Generation;
+        }
+        *Slot = Cache;
+    }
+    else if (Cache->Generation != Lfh->Generation)
+    {
+        /* The heap ran short of memory since the last call, give everything
+           back. The frees go to the shared lists or to the heap itself */
+        *Slot = HEAP_CACHE_DISABLED;
+        Cache->Generation = Lfh->Generation;
+        for (Index = 0; Index < HEAP_LFH_BUCKETS; Index++)
+        {
+            Block = Cache->Blocks[Index];
+            Cache->Blocks[Index] = NULL;
+            Cache->Depth[Index] = 0;
+            RtlpLfhFreeBlocks(Heap, 0, Block);
+        }
+        *Slot = Cache;
+    }
+
+    return Cache;
+}
+
+static
+BOOLEAN
+RtlpLfhFree(PHEAP Heap, PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_LFH Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+    PHEAP_THREAD_CACHE Cache;
+    PSLIST_HEADER Bucket;
+    PVOID Block, *Link, *Slot;
+    SIZE_T Index;
+    ULONG i;
+
+    /* Everything goes back to the heap while the lists are drained */
+    if (Lfh->Draining) return FALSE;
+
+    /* Only plain busy blocks are kept, anything with extra stuff, a fill
+       pattern or user flags goes back to the heap */
+    if ((HeapEntry->Flags & ~HEAP_ENTRY_LAST_ENTRY) != HEAP_ENTRY_BUSY ||
+        ((ULONG_PTR)(HeapEntry + 1) & 0x7) != 0 ||
+        HeapEntry->SegmentOffset >= HEAP_SEGMENTS ||
+        HeapEntry->Size >= HEAP_LFH_BUCKETS)
+    {
+        return FALSE;
+    }
+
+    Index = HeapEntry->Size;
+    Block = HeapEntry + 1;
+
+    /* The local lists need two pointers in the block */
+    Cache = (Index >= 2) ? RtlpLfhGetThreadCache(Heap, Lfh) : NULL;
+    if (Cache)
+    {
+        ((PVOID *)Block)[1] = Cache->Blocks[Index];
+        Cache->Blocks[Index] = Block;
+        if (++Cache->Depth[Index] < HEAP_CACHE_DEPTH) return TRUE;
+
+        /* Keep the recently freed blocks, the older ones go to the depot
+           as one batch for whichever thread allocates this size next */
+        Link = Block;
+        for (i = 1; i < HEAP_CACHE_DEPTH - HEAP_CACHE_BATCH; i++)
+            Link = Link[1];
+        Block = Link[1];
+        Link[1] = NULL;
+        Cache->Depth[Index] = HEAP_CACHE_DEPTH - HEAP_CACHE_BATCH;
+
+        if (RtlQueryDepthSList(&Lfh->Depot[Index]) < HEAP_CACHE_DEPOT_DEPTH)
+        {
+            RtlInterlockedPushEntrySList(&Lfh->Depot[Index], Block);
+        }
+        else
+        {
+            /* Nobody is taking them, the batch goes back to the heap */
+            Slot = &NtCurrentTeb()->TlsSlots[Lfh->CacheIndex - 1];
+            *Slot = HEAP_CACHE_DISABLED;
+            RtlpLfhFreeBlocks(Heap, 0, Block);
+            *Slot = Cache;
+        }
+
+        return TRUE;
+    }
+
+    Bucket = RtlpLfhGetBucket(Lfh, Index);
+    if (RtlQueryDepthSList(Bucket) >= HEAP_LFH_DEPTH) return FALSE;
+
+    /* The block stays busy as far as the heap is concerned */
+    RtlInterlockedPushEntrySList(Bucket, (PSLIST_ENTRY)(HeapEntry + 1));
+    return TRUE;
+}
+
+static
+PHEAP_ENTRY
+RtlpLfhAllocate(PHEAP Heap,
+                ULONG Flags,
+                SIZE_T Size,
+                SIZE_T Index)
+{
+    PHEAP_LFH Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+    PSLIST_HEADER Bucket = RtlpLfhGetBucket(Lfh, Index);
+    PHEAP_THREAD_CACHE Cache;
+    PHEAP_ENTRY InUseEntry;
+    PVOID Block;
+    ULONG i;
+
+    Cache = (Index >= 2) ? RtlpLfhGetThreadCache(Heap, Lfh) : NULL;
+    if (Cache)
+    {
+        Block = Cache->Blocks[Index];
+        if (!Block)
+        {
+            /* Take over a batch handed back by some thread */
+            Block = RtlInterlockedPopEntrySList(&Lfh->Depot[Index]);
+            if (Block) Cache->Depth[Index] = HEAP_CACHE_BATCH;
+        }
+
+        if (Block)
+        {
+            Cache->Blocks[Index] = ((PVOID *)Block)[1];
+            Cache->Depth[Index]--;
+
+            InUseEntry = (PHEAP_ENTRY)Block - 1;
+            InUseEntry->UnusedBytes = (UCHAR)((InUseEntry->Size << HEAP_ENTRY_SHIFT) - Size);
+            return InUseEntry;
+        }
+    }
+
+    Block = RtlInterlockedPopEntrySList(Bucket);
+    if (Block)
+    {
+        InUseEntry = (PHEAP_ENTRY)Block - 1;
+        InUseEntry->UnusedBytes = (UCHAR)((InUseEntry->Size << HEAP_ENTRY_SHIFT) - Size);
+        return InUseEntry;
+    }
+
+    /* Nothing cached. A caller who doesn't serialize gets the block from the
+       heap directly, which also keeps the refill below from recursing */
+    if (Flags & HEAP_NO_SERIALIZE) return NULL;
+
+    /* Take a batch of blocks under one lock acquisition, return the first one
+       and cache the rest. They come from the same free block most of the time,
+       so the cached ones are next to each other too */
+    InUseEntry = NULL;
+    RtlEnterHeapLock(Heap->LockVariable, TRUE);
+    for (i = 0; i < HEAP_LFH_BATCH; i++)
+    {
+        Block = RtlAllocateHeap(Heap, HEAP_NO_SERIALIZE, Size);
+        if (!Block) break;
+
+        if (!InUseEntry)
+            InUseEntry = (PHEAP_ENTRY)Block - 1;
+        else
+            RtlFreeHeap(Heap, HEAP_NO_SERIALIZE, Block);
+    }
+    RtlLeaveHeapLock(Heap->LockVariable);
+
+    return InUseEntry;
+}
+
+/* Gives everything kept by the front end back to the heap, the caller
+   serializes the heap */
+static
+BOOLEAN
+RtlpLfhDrain(PHEAP Heap)
+{
+    PHEAP_LFH Lfh;
+    PSLIST_ENTRY Entry, Next;
+    BOOLEAN Drained = FALSE;
+    SIZE_T Index;
+    ULONG i;
+
+    if (Heap->FrontEndHeapType != HEAP_FRONT_END_LFH) return FALSE;
+    Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+
+    /* The thread caches notice the new generation on their next call and
+       give their blocks back too */
+    InterlockedIncrement(&Lfh->Generation);
+    InterlockedExchange(&Lfh->Draining, TRUE);
+
+    for (Index = 0; Index < HEAP_LFH_BUCKETS; Index++)
+    {
+        for (i = 0; i < HEAP_LFH_SLOTS; i++)
+        {
+            Entry = RtlInterlockedFlushSList(&Lfh->Slots[i].Buckets[Index]);
+            while (Entry)
+            {
+                Next = Entry->Next;
+                RtlFreeHeap(Heap, HEAP_NO_SERIALIZE, Entry);
+                Entry = Next;
+                Drained = TRUE;
+            }
+        }
+
+        Entry = RtlInterlockedFlushSList(&Lfh->Depot[Index]);
+        while (Entry)
+        {
+            Next = Entry->Next;
+            RtlpLfhFreeBlocks(Heap, HEAP_NO_SERIALIZE, Entry);
+            Entry = Next;
+            Drained = TRUE;
+        }
+    }
+
+    InterlockedExchange(&Lfh->Draining, FALSE);
+    return Drained;
+}
+
+/* Called by the loader when a thread exits */
+VOID
+NTAPI
+RtlpFreeHeapThreadCache(VOID)
+{
+    PHEAP Heap = NtCurrentPeb()->ProcessHeap;
+    PHEAP_THREAD_CACHE Cache;
+    PHEAP_LFH Lfh;
+    PVOID *Slot;
+    SIZE_T Index;
+
+    if (!Heap || Heap->FrontEndHeapType != HEAP_FRONT_END_LFH) return;
+
+    Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+    if (!Lfh->CacheIndex) return;
+
+    /* Whatever the thread frees from now on goes to the shared lists */
+    Slot = &NtCurrentTeb()->TlsSlots[Lfh->CacheIndex - 1];
+    Cache = *Slot;
+    *Slot = HEAP_CACHE_DISABLED;
+    if (!Cache || Cache == HEAP_CACHE_DISABLED) return;
+
+    for (Index = 0; Index < HEAP_LFH_BUCKETS; Index++)
+        RtlpLfhFreeBlocks(Heap, 0, Cache->Blocks[Index]);
+
+    RtlFreeHeap(Heap, 0, Cache);
+}
+
 /***********************************************************************
  *           HeapAlloc   (KERNEL32.334)
  * RETURNS
@@ -1977,6 +2288,24 @@ RtlAllocateHeap(IN PVOID HeapPtr,
 
     Index = AllocationSize >> HEAP_ENTRY_SHIFT;
 
+    /* Small blocks without extra stuff can come from the front end heap */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH &&
+        !(EntryFlags & HEAP_ENTRY_EXTRA_PRESENT) &&
+        Index < HEAP_LFH_BUCKETS)
+    {
+        InUseEntry = RtlpLfhAllocate(Heap, Flags, Size, Index);
+        if (InUseEntry)
+        {
+            InUseEntry->Flags = EntryFlags | (InUseEntry->Flags & HEAP_ENTRY_LAST_ENTRY);
+            InUseEntry->SmallTagIndex = 0;
+
+            if (Flags & HEAP_ZERO_MEMORY)
+                RtlZeroMemory(InUseEntry + 1, Size);
+
+            return InUseEntry + 1;
+        }
+    }
+
     /* Acquire the lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2180,6 +2509,16 @@ BOOLEAN NTAPI RtlFreeHeap(
     if (RtlpHeapIsSpecial(Flags))
         return RtlDebugFreeHeap(Heap, Flags, Ptr);
 
+    /* Get pointer to the heap entry */
+    HeapEntry = (PHEAP_ENTRY)Ptr - 1;
+
+    /* Keep small blocks in the front end heap without taking the lock */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH &&
+        RtlpLfhFree(Heap, HeapEntry))
+    {
+        return TRUE;
+    }
+
     /* Lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2187,9 +2526,6 @@ BOOLEAN NTAPI RtlFreeHeap(
         Locked = TRUE;
     }
 
-    /* Get pointer to the heap entry */
-    HeapEntry = (PHEAP_ENTRY)Ptr - 1;
-
     /* Check this entry, fail if it's invalid */
     if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY) ||
         (((ULONG_PTR)Ptr & 0x7) != 0) ||
@@ -2956,9 +3292,22 @@ RtlReAllocateHeap(HANDLE HeapPtr,
  * @unimplemented
  */
 ULONG NTAPI
-RtlCompactHeap(HANDLE Heap,
+RtlCompactHeap(HANDLE HeapPtr,
 		ULONG Flags)
 {
+   PHEAP Heap = (PHEAP)HeapPtr;
+
+   /* Give the blocks kept by the front end heap back, so at least they can
+      coalesce */
+   Flags |= Heap->ForceFlags;
+   if (!RtlpHeapIsSpecial(Flags) &&
+       Heap->FrontEndHeapType == HEAP_FRONT_END_LFH)
+   {
+      if (!(Flags & HEAP_NO_SERIALIZE)) RtlEnterHeapLock(Heap->LockVariable, TRUE);
+      RtlpLfhDrain(Heap);
+      if (!(Flags & HEAP_NO_SERIALIZE)) RtlLeaveHeapLock(Heap->LockVariable);
+   }
+
    UNIMPLEMENTED;
    return 0;
 }
@@ -3907,6 +4256,12 @@ RtlSetHeapInformation(IN HANDLE HeapHandle OPTIONAL,
                       IN PVOID HeapInformation,
                       IN SIZE_T HeapInformationLength)
 {
+    PHEAP Heap = (PHEAP)HeapHandle;
+    PVOID FrontEndHeap = NULL;
+    SIZE_T Size = sizeof(HEAP_LFH);
+    ULONG CacheIndex = MAXULONG;
+    NTSTATUS Status;
+
     /* Setting heap information is not really supported except for enabling LFH */
     if (HeapInformationClass == HeapCompatibilityInformation)
     {
@@ -3923,7 +4278,68 @@ RtlSetHeapInformation(IN HANDLE HeapHandle OPTIONAL,
             return STATUS_UNSUCCESSFUL;
         }
 
-        DPRINT1("RtlSetHeapInformation() needs to enable LFH\n");
+        if (!Heap) return STATUS_INVALID_PARAMETER;
+
+        /* The front end heap needs the heap lock for refilling, and keeps
+           blocks away from debug heaps' checks */
+        if (RtlpGetMode() != UserMode ||
+            (Heap->Flags & (HEAP_NO_SERIALIZE |
+                            HEAP_FREE_CHECKING_ENABLED |
+                            HEAP_TAIL_CHECKING_ENABLED)) ||
+            RtlpHeapIsSpecial(Heap->Flags | Heap->ForceFlags))
+        {
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        /* Nothing to do if it's enabled already */
+        if (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH) return STATUS_SUCCESS;
+
+        Status = ZwAllocateVirtualMemory(NtCurrentProcess(),
+                                         &FrontEndHeap,
+                                         0,
+                                         &Size,
+                                         MEM_COMMIT,
+                                         PAGE_READWRITE);
+        if (!NT_SUCCESS(Status)) return Status;
+
+        /* The process heap also caches blocks per thread, which takes a TLS
+           slot. Code holding the PEB lock may use the heap, so it is taken
+           before the heap lock, not under it */
+        if (Heap == NtCurrentPeb()->ProcessHeap && NtCurrentPeb()->TlsBitmap)
+        {
+            RtlAcquirePebLock();
+            CacheIndex = RtlFindClearBitsAndSet(NtCurrentPeb()->TlsBitmap, 1, 0);
+            RtlReleasePebLock();
+
+            if (CacheIndex != MAXULONG)
+                ((PHEAP_LFH)FrontEndHeap)->CacheIndex = CacheIndex + 1;
+        }
+
+        /* Zeroed memory is a set of empty lists already */
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        if (Heap->FrontEndHeapType != HEAP_FRONT_END_LFH)
+        {
+            /* The lists must be visible before the type is */
+            InterlockedExchangePointer(&Heap->FrontEndHeap, FrontEndHeap);
+            Heap->FrontEndHeapType = HEAP_FRONT_END_LFH;
+            FrontEndHeap = NULL;
+        }
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+        /* Someone else enabled it meanwhile */
+        if (FrontEndHeap)
+        {
+            if (CacheIndex != MAXULONG)
+            {
+                RtlAcquirePebLock();
+                RtlClearBits(NtCurrentPeb()->TlsBitmap, CacheIndex, 1);
+                RtlReleasePebLock();
+            }
+
+            Size = 0;
+            ZwFreeVirtualMemory(NtCurrentProcess(), &FrontEndHeap, &Size, MEM_RELEASE);
+        }
+
         return STATUS_SUCCESS;
     }
 
@@ -269,6 +269,48 @@ typedef struct _HEAP
     HEAP_TUNING_PARAMETERS TuningParameters;
 } HEAP, *PHEAP;
 
+/* Front end heap: lock-free lists of recently freed small blocks, indexed by
+   the block size in heap entries. Threads are spread over several slots so
+   they don't all contend on the same list heads */
+#define HEAP_FRONT_END_LFH 2
+#define HEAP_LFH_SLOTS 4
+#define HEAP_LFH_BUCKETS 64
+#define HEAP_LFH_DEPTH 16
+#define HEAP_LFH_BATCH 8
+
+typedef struct _HEAP_LFH_SLOT
+{
+    SLIST_HEADER Buckets[HEAP_LFH_BUCKETS];
+} HEAP_LFH_SLOT, *PHEAP_LFH_SLOT;
+
+/* Per-thread caches in front of the lists, process heap only. A thread keeps
+   up to HEAP_CACHE_DEPTH blocks per size and hands the older ones over in
+   batches through the depot, so a thread that frees what another one
+   allocated doesn't take the lists one block at a time. The local lists are
+   linked through the second pointer of the block, the first one is the
+   depot link of a batch */
+#define HEAP_CACHE_DEPTH 32
+#define HEAP_CACHE_BATCH 16
+#define HEAP_CACHE_DEPOT_DEPTH 8
+#define HEAP_CACHE_DISABLED ((PHEAP_THREAD_CACHE)1)
+
+typedef struct _HEAP_LFH
+{
+    HEAP_LFH_SLOT Slots[HEAP_LFH_SLOTS];
+    SLIST_HEADER Depot[HEAP_LFH_BUCKETS];
+    ULONG CacheIndex; /* TLS slot of the thread caches plus one, 0 if none */
+    LONG Generation;
+    LONG Draining;
+} HEAP_LFH, *PHEAP_LFH;
+
+typedef struct _HEAP_THREAD_CACHE
+{
+    PHEAP Heap;
+    LONG Generation;
+    PVOID Blocks[HEAP_LFH_BUCKETS];
+    UCHAR Depth[HEAP_LFH_BUCKETS];
+} HEAP_THREAD_CACHE, *PHEAP_THREAD_CACHE;
+
 typedef struct _HEAP_SEGMENT
 {
     HEAP_ENTRY Entry;
@@ -485,4 +527,8 @@ VOID
 NTAPI
 RtlInitializeHeapManager(VOID);
 
+VOID
+NTAPI
+RtlpFreeHeapThreadCache(VOID);
+
 #endif
@@ -0,0 +1,370 @@
+/*
+ * PROJECT:     ReactOS host tools
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * PURPOSE:     Creates FreeLoader boot bundles and compressed RAM disk images
+ */
+
+#include <rtl.h>
+#include <bootbundle.h>
+
+/* Bundle entries are aligned on this, it keeps the file data readable in a hex dump */
+#define BUNDLE_ALIGNMENT    16
+
+static
+void
+Usage(void)
+{
+    printf("Creates FreeLoader boot bundles and compressed RAM disk images.\n"
+           "Syntax: bootbundle create <bundle> <system root directory> <file>...\n"
+           "        bootbundle compress [lznt1|xpress|xpress_huff] <image> <compressed image>\n"
+           "Bundle files are given relative to the system root, e.g. system32\\ntoskrnl.exe.\n"
+           "A file name starting with @ is a list of files, one per line.\n");
+}
+
+static
+unsigned char *
+ReadFileData(const char *FileName, size_t *Size)
+{
+    FILE *File;
+    unsigned char *Data;
+    long Length;
+
+    File = fopen(FileName, "rb");
+    if (!File)
+    {
+        fprintf(stderr, "Could not open %s\n", FileName);
+        return NULL;
+    }
+
+    fseek(File, 0, SEEK_END);
+    Length = ftell(File);
+    fseek(File, 0, SEEK_SET);
+    if (Length < 0 || (unsigned long)Length > 0xFFFFFFF0UL)
+    {
+        fprintf(stderr, "%s is too big\n", FileName);
+        fclose(File);
+        return NULL;
+    }
+
+    Data = malloc(Length ? Length : 1);
+    if (!Data)
+    {
+        fprintf(stderr, "Out of memory\n");
+        fclose(File);
+        return NULL;
+    }
+
+    if (fread(Data, 1, Length, File) != (size_t)Length)
+    {
+        fprintf(stderr, "Could not read %s\n", FileName);
+        free(Data);
+        fclose(File);
+        return NULL;
+    }
+
+    fclose(File);
+    *Size = Length;
+    return Data;
+}
+
+static
+int
+WriteFileData(const char *FileName, const void *Data, size_t Size)
+{
+    FILE *File;
+
+    File = fopen(FileName, "wb");
+    if (!File)
+    {
+        fprintf(stderr, "Could not create %s\n", FileName);
+        return 0;
+    }
+
+    if (fwrite(Data, 1, Size, File) != Size)
+    {
+        fprintf(stderr, "Could not write %s\n", FileName);
+        fclose(File);
+        return 0;
+    }
+
+    return (fclose(File) == 0);
+}
+
+typedef struct _BUNDLE_BUILDER
+{
+    PBOOT_BUNDLE_ENTRY Entries;
+    ULONG EntryCount;
+    ULONG MaxEntries;
+    unsigned char **Data;
+    const char *SystemRoot;
+} BUNDLE_BUILDER, *PBUNDLE_BUILDER;
+
+static
+int
+AddFile(PBUNDLE_BUILDER Builder, const char *Name)
+{
+    char HostPath[1024];
+    PBOOT_BUNDLE_ENTRY Entry;
+    size_t Size, i;
+
+    while (*Name == '\\' || *Name == '/')
+        Name++;
+
+    if (strlen(Name) >= BOOT_BUNDLE_MAX_NAME)
+    {
+        fprintf(stderr, "File name %s is too long\n", Name);
+        return 0;
+    }
+    if (strlen(Builder->SystemRoot) + strlen(Name) + 2 > sizeof(HostPath))
+    {
+        fprintf(stderr, "Path of %s is too long\n", Name);
+        return 0;
+    }
+
+    if (Builder->EntryCount == Builder->MaxEntries)
+    {
+        ULONG MaxEntries = Builder->MaxEntries ? Builder->MaxEntries * 2 : 64;
+        void *Entries = realloc(Builder->Entries, MaxEntries * sizeof(BOOT_BUNDLE_ENTRY));
+        void *Data = realloc(Builder->Data, MaxEntries * sizeof(unsigned char *));
+
+        if (Entries) Builder->Entries = Entries;
+        if (Data) Builder->Data = Data;
+        if (!Entries || !Data)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return 0;
+        }
+        Builder->MaxEntries = MaxEntries;
+    }
+
+    /* The bundle uses backslashes, the host file system may not */
+    Entry = &Builder->Entries[Builder->EntryCount];
+    memset(Entry, 0, sizeof(*Entry));
+    for (i = 0; Name[i]; i++)
+        Entry->Name[i] = (Name[i] == '/') ? '\\' : Name[i];
+    sprintf(HostPath, "%s/%s", Builder->SystemRoot, Name);
+#ifndef _WIN32
+    for (i = strlen(Builder->SystemRoot); HostPath[i]; i++)
+    {
+        if (HostPath[i] == '\\')
+            HostPath[i] = '/';
+    }
+#endif
+
+    Builder->Data[Builder->EntryCount] = ReadFileData(HostPath, &Size);
+    if (!Builder->Data[Builder->EntryCount])
+        return 0;
+    Entry->DataSize = (ULONG)Size;
+
+    Builder->EntryCount++;
+    return 1;
+}
+
+static
+int
+AddFileList(PBUNDLE_BUILDER Builder, const char *ListName)
+{
+    char Line[1024];
+    FILE *List;
+    size_t Length;
+    int Success = 1;
+
+    List = fopen(ListName, "r");
+    if (!List)
+    {
+        fprintf(stderr, "Could not open %s\n", ListName);
+        return 0;
+    }
+
+    while (Success && fgets(Line, sizeof(Line), List))
+    {
+        Length = strlen(Line);
+        while (Length && (Line[Length - 1] == '\n' || Line[Length - 1] == '\r' || Line[Length - 1] == ' '))
+            Line[--Length] = 0;
+        if (Length == 0 || Line[0] == ';' || Line[0] == '#')
+            continue;
+        Success = AddFile(Builder, Line);
+    }
+
+    fclose(List);
+    return Success;
+}
+
+static
+int
+CreateBundle(const char *BundleName, const char *SystemRoot, int FileCount, char *Files[])
+{
+    BUNDLE_BUILDER Builder;
+    BOOT_BUNDLE_HEADER Header;
+    unsigned char *Bundle;
+    ULONG Offset, i;
+    int Success = 1;
+
+    memset(&Builder, 0, sizeof(Builder));
+    Builder.SystemRoot = SystemRoot;
+
+    for (i = 0; Success && i < (ULONG)FileCount; i++)
+    {
+        if (Files[i][0] == '@')
+            Success = AddFileList(&Builder, Files[i] + 1);
+        else
+            Success = AddFile(&Builder, Files[i]);
+    }
+
+    Bundle = NULL;
+    if (Success)
+    {
+        /* Lay the files out after the entries */
+        Offset = sizeof(Header) + Builder.EntryCount * sizeof(BOOT_BUNDLE_ENTRY);
+        for (i = 0; i < Builder.EntryCount; i++)
+        {
+            Offset = (Offset + BUNDLE_ALIGNMENT - 1) & ~(BUNDLE_ALIGNMENT - 1);
+            Builder.Entries[i].DataOffset = Offset;
+            Offset += Builder.Entries[i].DataSize;
+        }
+
+        memset(&Header, 0, sizeof(Header));
+        Header.Signature = BOOT_BUNDLE_SIGNATURE;
+        Header.Version = BOOT_BUNDLE_VERSION;
+        Header.HeaderSize = sizeof(Header);
+        Header.EntryCount = Builder.EntryCount;
+        Header.TotalSize = Offset;
+
+        Bundle = calloc(1, Offset);
+        if (!Bundle)
+        {
+            fprintf(stderr, "Out of memory\n");
+            Success = 0;
+        }
+    }
+
+    if (Success)
+    {
+        memcpy(Bundle, &Header, sizeof(Header));
+        memcpy(Bundle + sizeof(Header), Builder.Entries, Builder.EntryCount * sizeof(BOOT_BUNDLE_ENTRY));
+        for (i = 0; i < Builder.EntryCount; i++)
+        {
+            memcpy(Bundle + Builder.Entries[i].DataOffset,
+                   Builder.Data[i],
+                   Builder.Entries[i].DataSize);
+        }
+
+        Success = WriteFileData(BundleName, Bundle, Header.TotalSize);
+        if (Success)
+        {
+            printf("%s: %lu files, %lu bytes\n", BundleName,
+                   (unsigned long)Header.EntryCount, (unsigned long)Header.TotalSize);
+        }
+    }
+
+    for (i = 0; i < Builder.EntryCount; i++)
+        free(Builder.Data[i]);
+    free(Builder.Data);
+    free(Builder.Entries);
+    free(Bundle);
+
+    return Success;
+}
+
+static
+int
+CompressImage(const char *FormatName, const char *InputName, const char *OutputName)
+{
+    COMPRESSED_IMAGE_HEADER Header;
+    unsigned char *Image, *Output;
+    PVOID WorkSpace;
+    ULONG WorkSpaceSize, FragmentWorkSpaceSize, CompressedSize, OutputSize;
+    USHORT Format;
+    NTSTATUS Status;
+    size_t Size;
+    int Success;
+
+    if (!strcmp(FormatName, "lznt1"))
+        Format = COMPRESSION_FORMAT_LZNT1;
+    else if (!strcmp(FormatName, "xpress"))
+        Format = COMPRESSION_FORMAT_XPRESS;
+    else if (!strcmp(FormatName, "xpress_huff"))
+        Format = COMPRESSION_FORMAT_XPRESS_HUFF;
+    else
+    {
+        fprintf(stderr, "Unknown compression format %s\n", FormatName);
+        return 0;
+    }
+
+    Image = ReadFileData(InputName, &Size);
+    if (!Image)
+        return 0;
+
+    Status = RtlGetCompressionWorkSpaceSize(Format | COMPRESSION_ENGINE_MAXIMUM,
+                                            &WorkSpaceSize,
+                                            &FragmentWorkSpaceSize);
+    if (Status != STATUS_SUCCESS)
+    {
+        fprintf(stderr, "Compression format %s is not supported\n", FormatName);
+        free(Image);
+        return 0;
+    }
+
+    /* Data which does not compress is stored with a small overhead */
+    OutputSize = (ULONG)(Size + Size / 8 + 65536);
+    WorkSpace = malloc(WorkSpaceSize);
+    Output = malloc(sizeof(Header) + OutputSize);
+    if (!WorkSpace || !Output)
+    {
+        fprintf(stderr, "Out of memory\n");
+        free(WorkSpace);
+        free(Output);
+        free(Image);
+        return 0;
+    }
+
+    Status = RtlCompressBuffer(Format | COMPRESSION_ENGINE_MAXIMUM,
+                               Image,
+                               (ULONG)Size,
+                               Output + sizeof(Header),
+                               OutputSize,
+                               4096,
+                               &CompressedSize,
+                               WorkSpace);
+    free(WorkSpace);
+    free(Image);
+    if (Status != STATUS_SUCCESS)
+    {
+        fprintf(stderr, "Compressing %s failed (0x%08lx)\n", InputName, (unsigned long)Status);
+        free(Output);
+        return 0;
+    }
+
+    memset(&Header, 0, sizeof(Header));
+    Header.Signature = COMPRESSED_IMAGE_SIGNATURE;
+    Header.CompressionFormat = Format;
+    Header.HeaderSize = sizeof(Header);
+    Header.UncompressedSize = (ULONG)Size;
+    Header.CompressedSize = CompressedSize;
+    memcpy(Output, &Header, sizeof(Header));
+
+    Success = WriteFileData(OutputName, Output, sizeof(Header) + CompressedSize);
+    if (Success)
+    {
+        printf("%s: %lu bytes compressed to %lu bytes\n", OutputName,
+               (unsigned long)Size, (unsigned long)CompressedSize);
+    }
+
+    free(Output);
+    return Success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 4 && !strcmp(argv[1], "create"))
+        return CreateBundle(argv[2], argv[3], argc - 4, argv + 4) ? 0 : 1;
+
+    if (argc == 4 && !strcmp(argv[1], "compress"))
+        return CompressImage("xpress_huff", argv[2], argv[3]) ? 0 : 1;
+
+    if (argc == 5 && !strcmp(argv[1], "compress"))
+        return CompressImage(argv[2], argv[3], argv[4]) ? 0 : 1;
+
+    Usage();
+    return 1;
+}
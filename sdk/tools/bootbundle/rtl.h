@@ -0,0 +1,80 @@
+/*
+ * PROJECT:     ReactOS host tools
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * PURPOSE:     Lets the RTL compression code build as part of bootbundle
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <typedefs.h>
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000)
+#define STATUS_NOT_IMPLEMENTED          ((NTSTATUS)0xC0000002)
+#define STATUS_ACCESS_VIOLATION         ((NTSTATUS)0xC0000005)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000D)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023)
+#define STATUS_NOT_SUPPORTED            ((NTSTATUS)0xC00000BB)
+#define STATUS_BAD_COMPRESSION_BUFFER   ((NTSTATUS)0xC0000242)
+#define STATUS_UNSUPPORTED_COMPRESSION  ((NTSTATUS)0xC000025F)
+
+#define COMPRESSION_FORMAT_NONE         0x0000
+#define COMPRESSION_FORMAT_DEFAULT      0x0001
+#define COMPRESSION_FORMAT_LZNT1        0x0002
+#define COMPRESSION_FORMAT_XPRESS       0x0003
+#define COMPRESSION_FORMAT_XPRESS_HUFF  0x0004
+#define COMPRESSION_ENGINE_STANDARD     0x0000
+#define COMPRESSION_ENGINE_MAXIMUM      0x0100
+#define COMPRESSION_ENGINE_HIBER        0x0200
+
+#ifndef C_ASSERT
+#define C_ASSERT(e) typedef char __C_ASSERT__[(e)?1:-1]
+#endif
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef struct _COMPRESSED_DATA_INFO *PCOMPRESSED_DATA_INFO;
+
+static __inline
+BOOLEAN
+BitScanReverse(ULONG *Index, ULONG Mask)
+{
+    ULONG Bit = 31;
+
+    if (!Mask)
+        return FALSE;
+    while (!(Mask & (1UL << Bit)))
+        Bit--;
+    *Index = Bit;
+    return TRUE;
+}
+
+NTSTATUS NTAPI
+RtlCompressBuffer(USHORT CompressionFormatAndEngine,
+                  PUCHAR UncompressedBuffer,
+                  ULONG UncompressedBufferSize,
+                  PUCHAR CompressedBuffer,
+                  ULONG CompressedBufferSize,
+                  ULONG UncompressedChunkSize,
+                  PULONG FinalCompressedSize,
+                  PVOID WorkSpace);
+
+NTSTATUS NTAPI
+RtlDecompressBuffer(USHORT CompressionFormat,
+                    PUCHAR UncompressedBuffer,
+                    ULONG UncompressedBufferSize,
+                    PUCHAR CompressedBuffer,
+                    ULONG CompressedBufferSize,
+                    PULONG FinalUncompressedSize);
+
+NTSTATUS NTAPI
+RtlGetCompressionWorkSpaceSize(USHORT CompressionFormatAndEngine,
+                               PULONG CompressBufferWorkSpaceSize,
+                               PULONG CompressFragmentWorkSpaceSize);
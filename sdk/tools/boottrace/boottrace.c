@@ -0,0 +1,341 @@
+/*
+ * PROJECT:     ReactOS host tools
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * PURPOSE:     Converts the binary boot timeline (rosboot.trc) into a report
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <typedefs.h>
+#include <boottrace.h>
+
+/* Times in the file are 100ns units */
+#define TICKS_PER_MS    10000
+
+#define DEFAULT_TOP     20
+
+typedef struct _TRACE_EVENT
+{
+    ULONGLONG StartTime;
+    ULONGLONG EndTime;
+    ULONG Type;
+    ULONG Data;
+    ULONG ThreadId;
+    char Name[BOOT_TRACE_MAX_NAME / sizeof(WCHAR) + 1];
+} TRACE_EVENT, *PTRACE_EVENT;
+
+static const char *TypeNames[] =
+{
+    "?",
+    "Load",
+    "DriverEntry",
+    "AddDevice",
+    "StartDevice",
+    "FirstIo",
+    "Phase"
+};
+
+#define TYPE_COUNT  (sizeof(TypeNames) / sizeof(TypeNames[0]))
+
+static
+void
+Usage(void)
+{
+    printf("Converts a boot timeline file into a sorted report.\n"
+           "Syntax: boottrace <rosboot.trc> [number of longest operations]\n");
+}
+
+static
+const char *
+TypeName(ULONG Type)
+{
+    return (Type < TYPE_COUNT) ? TypeNames[Type] : TypeNames[0];
+}
+
+static
+int
+CompareStart(const void *a, const void *b)
+{
+    const TRACE_EVENT *Event1 = a, *Event2 = b;
+
+    if (Event1->StartTime != Event2->StartTime)
+        return (Event1->StartTime < Event2->StartTime) ? -1 : 1;
+    return (Event1->Type < Event2->Type) ? -1 : (Event1->Type > Event2->Type);
+}
+
+static
+int
+CompareDuration(const void *a, const void *b)
+{
+    const TRACE_EVENT *Event1 = *(const TRACE_EVENT **)a;
+    const TRACE_EVENT *Event2 = *(const TRACE_EVENT **)b;
+    ULONGLONG Duration1 = Event1->EndTime - Event1->StartTime;
+    ULONGLONG Duration2 = Event2->EndTime - Event2->StartTime;
+
+    if (Duration1 != Duration2)
+        return (Duration1 > Duration2) ? -1 : 1;
+    return 0;
+}
+
+static
+void
+PrintTime(ULONGLONG Time)
+{
+    printf("%8lu.%01lu", (unsigned long)(Time / TICKS_PER_MS),
+           (unsigned long)((Time % TICKS_PER_MS) / (TICKS_PER_MS / 10)));
+}
+
+static
+void
+PrintEvent(const TRACE_EVENT *Event)
+{
+    PrintTime(Event->StartTime);
+    PrintTime(Event->EndTime - Event->StartTime);
+    if (Event->Type == BOOT_TRACE_FIRST_IO)
+        printf("  %5lu  %-12s  mj %-6lu  %s\n", (unsigned long)Event->ThreadId,
+               TypeName(Event->Type), (unsigned long)Event->Data, Event->Name);
+    else if (Event->Type == BOOT_TRACE_PHASE && Event->Data == BOOT_TRACE_LOADER_PHASE)
+        printf("  %5lu  %-12s  loader    %s\n", (unsigned long)Event->ThreadId,
+               TypeName(Event->Type), Event->Name);
+    else if (Event->Type == BOOT_TRACE_PHASE)
+        printf("  %5lu  %-12s  ph %-6lu  %s\n", (unsigned long)Event->ThreadId,
+               TypeName(Event->Type), (unsigned long)Event->Data, Event->Name);
+    else
+        printf("  %5lu  %-12s  %08lx  %s\n", (unsigned long)Event->ThreadId,
+               TypeName(Event->Type), (unsigned long)Event->Data, Event->Name);
+}
+
+static
+unsigned char *
+ReadFileData(const char *FileName, size_t *Size)
+{
+    FILE *File;
+    unsigned char *Data;
+    long Length;
+
+    File = fopen(FileName, "rb");
+    if (!File)
+    {
+        fprintf(stderr, "Could not open %s\n", FileName);
+        return NULL;
+    }
+
+    fseek(File, 0, SEEK_END);
+    Length = ftell(File);
+    fseek(File, 0, SEEK_SET);
+    if (Length <= 0)
+    {
+        fprintf(stderr, "%s is empty\n", FileName);
+        fclose(File);
+        return NULL;
+    }
+
+    Data = malloc(Length);
+    if (!Data)
+    {
+        fprintf(stderr, "Out of memory\n");
+        fclose(File);
+        return NULL;
+    }
+
+    if (fread(Data, 1, Length, File) != (size_t)Length)
+    {
+        fprintf(stderr, "Could not read %s\n", FileName);
+        free(Data);
+        fclose(File);
+        return NULL;
+    }
+
+    fclose(File);
+    *Size = Length;
+    return Data;
+}
+
+static
+ULONG
+ParseRecords(const unsigned char *Data, ULONG DataSize, PTRACE_EVENT Events, ULONG MaxEvents)
+{
+    const BOOT_TRACE_RECORD *Record;
+    ULONG Offset = 0, Count = 0, i, Length;
+
+    while ((Offset + FIELD_OFFSET(BOOT_TRACE_RECORD, Name) <= DataSize) && (Count < MaxEvents))
+    {
+        Record = (const BOOT_TRACE_RECORD *)(Data + Offset);
+        if ((Record->Size < FIELD_OFFSET(BOOT_TRACE_RECORD, Name)) ||
+            (Offset + Record->Size > DataSize) ||
+            (FIELD_OFFSET(BOOT_TRACE_RECORD, Name) + Record->NameLength > Record->Size))
+        {
+            fprintf(stderr, "Corrupt record at offset %lu\n", (unsigned long)Offset);
+            break;
+        }
+
+        Events[Count].StartTime = Record->StartTime;
+        Events[Count].EndTime = Record->StartTime + Record->Duration;
+        Events[Count].Type = Record->Type;
+        Events[Count].Data = Record->Data;
+        Events[Count].ThreadId = Record->ThreadId;
+
+        /* Names are UTF-16, device and service names are plain ASCII */
+        Length = Record->NameLength / sizeof(WCHAR);
+        if (Length > BOOT_TRACE_MAX_NAME / sizeof(WCHAR))
+            Length = BOOT_TRACE_MAX_NAME / sizeof(WCHAR);
+        for (i = 0; i < Length; i++)
+        {
+            WCHAR Char = Record->Name[i];
+            Events[Count].Name[i] = (Char >= 0x20 && Char < 0x7F) ? (char)Char : '?';
+        }
+        Events[Count].Name[Length] = 0;
+
+        Count++;
+        Offset += Record->Size;
+    }
+
+    return Count;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char *Data;
+    size_t Size;
+    const BOOT_TRACE_HEADER *Header;
+    PTRACE_EVENT Events;
+    PTRACE_EVENT *Longest;
+    ULONG Count, LongestCount = 0, i, Top = DEFAULT_TOP;
+    ULONGLONG TypeTotal[TYPE_COUNT] = {0};
+    ULONG TypeCount[TYPE_COUNT] = {0};
+    ULONGLONG Busy = 0, CoveredUntil = 0, Sum = 0, FirstTime = 0, LastTime = 0, BootEnd = 0;
+    BOOLEAN HaveDriverWork = FALSE;
+
+    if (argc < 2)
+    {
+        Usage();
+        return 1;
+    }
+    if (argc > 2) Top = strtoul(argv[2], NULL, 0);
+
+    Data = ReadFileData(argv[1], &Size);
+    if (!Data) return 1;
+
+    Header = (const BOOT_TRACE_HEADER *)Data;
+    if ((Size < sizeof(*Header)) ||
+        (Header->Signature != BOOT_TRACE_SIGNATURE) ||
+        (Header->Version < 1) || (Header->Version > BOOT_TRACE_VERSION) ||
+        (Header->HeaderSize < sizeof(*Header)) ||
+        (Header->HeaderSize + (size_t)Header->DataSize > Size))
+    {
+        fprintf(stderr, "%s is not a boot timeline\n", argv[1]);
+        free(Data);
+        return 1;
+    }
+
+    Events = calloc(Header->RecordCount + 1, sizeof(TRACE_EVENT));
+    Longest = calloc(Header->RecordCount + 1, sizeof(PTRACE_EVENT));
+    if (!Events || !Longest)
+    {
+        fprintf(stderr, "Out of memory\n");
+        free(Events);
+        free(Longest);
+        free(Data);
+        return 1;
+    }
+
+    Count = ParseRecords(Data + Header->HeaderSize, Header->DataSize, Events, Header->RecordCount);
+    qsort(Events, Count, sizeof(TRACE_EVENT), CompareStart);
+
+    /* Timeline */
+    printf("Boot timeline: %lu records", (unsigned long)Count);
+    if (Header->DroppedCount)
+        printf(", %lu dropped (buffer full)", (unsigned long)Header->DroppedCount);
+    printf("\n\n   Start(ms) Length(ms) Thread  Type          Status    Name\n");
+    for (i = 0; i < Count; i++)
+    {
+        PrintEvent(&Events[i]);
+
+        /* Phases cover everything else, they get their own summary */
+        if (Events[i].Type != BOOT_TRACE_PHASE)
+            Longest[LongestCount++] = &Events[i];
+    }
+
+    /* Where the time went from the loader to the user shell */
+    printf("\nBoot phases\n\n   Start(ms) Length(ms)  Phase\n");
+    for (i = 0; i < Count; i++)
+    {
+        if (Events[i].Type != BOOT_TRACE_PHASE) continue;
+        PrintTime(Events[i].StartTime);
+        PrintTime(Events[i].EndTime - Events[i].StartTime);
+        printf("  %s\n", Events[i].Name);
+        if (Events[i].EndTime > BootEnd) BootEnd = Events[i].EndTime;
+    }
+    if (BootEnd)
+    {
+        printf("  Last phase ended at ");
+        PrintTime(BootEnd);
+        printf(" ms\n");
+    }
+
+    /*
+     * Summary. Nested operations (DriverEntry inside a StartDevice...) are
+     * counted in the busy time once, so Sum / Busy tells how much of the
+     * driver work overlapped.
+     */
+    for (i = 0; i < Count; i++)
+    {
+        ULONGLONG Duration = Events[i].EndTime - Events[i].StartTime;
+
+        TypeTotal[Events[i].Type < TYPE_COUNT ? Events[i].Type : 0] += Duration;
+        TypeCount[Events[i].Type < TYPE_COUNT ? Events[i].Type : 0]++;
+
+        if (Events[i].Type == BOOT_TRACE_FIRST_IO) continue;
+        if (Events[i].Type == BOOT_TRACE_PHASE) continue;
+        Sum += Duration;
+
+        if (!HaveDriverWork)
+        {
+            FirstTime = Events[i].StartTime;
+            HaveDriverWork = TRUE;
+        }
+
+        if (Events[i].EndTime > CoveredUntil)
+        {
+            Busy += Events[i].EndTime - ((Events[i].StartTime > CoveredUntil) ?
+                                         Events[i].StartTime : CoveredUntil);
+            CoveredUntil = Events[i].EndTime;
+        }
+        if (Events[i].EndTime > LastTime) LastTime = Events[i].EndTime;
+    }
+
+    printf("\nTotals per operation\n");
+    for (i = 1; i < TYPE_COUNT; i++)
+    {
+        if (i == BOOT_TRACE_FIRST_IO || i == BOOT_TRACE_PHASE) continue;
+        printf("  %-12s %5lu ops ", TypeNames[i], (unsigned long)TypeCount[i]);
+        PrintTime(TypeTotal[i]);
+        printf(" ms\n");
+    }
+
+    if (HaveDriverWork)
+    {
+        printf("\nDriver work from ");
+        PrintTime(FirstTime);
+        printf(" to ");
+        PrintTime(LastTime);
+        printf(" ms, busy ");
+        PrintTime(Busy);
+        printf(" ms, concurrency %lu%%\n", (unsigned long)(Busy ? (Sum * 100 / Busy) : 0));
+    }
+
+    /* The long serial operations are what holds the boot up */
+    qsort(Longest, LongestCount, sizeof(PTRACE_EVENT), CompareDuration);
+    if (Top > LongestCount) Top = LongestCount;
+    printf("\nLongest operations\n\n   Start(ms) Length(ms) Thread  Type          Status    Name\n");
+    for (i = 0; i < Top; i++)
+    {
+        PrintEvent(Longest[i]);
+    }
+
+    free(Longest);
+    free(Events);
+    free(Data);
+    return 0;
+}
@@ -0,0 +1,296 @@
+/*
+ * PROJECT:     ReactOS cabinet manager
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     CBlockCompressor class, compresses data blocks on worker threads
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <system_error>
+
+#include "cabinet.h"
+#include "raw.h"
+#include "mszip.h"
+
+#if !defined(CAB_READ_ONLY)
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Default constructor
+*/
+CBlockCompressor::CBlockCompressor()
+{
+    Blocks = NULL;
+    BlockCount = 0;
+    Oldest = 0;
+    NextToCompress = 0;
+    NextToQueue = 0;
+    CodecId = CAB_CODEC_RAW;
+    Stopping = false;
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Default destructor
+*/
+CBlockCompressor::~CBlockCompressor()
+{
+    Stop();
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Returns the number of threads to use by default, one per processor
+*
+* @return
+* Number of threads
+*/
+ULONG CBlockCompressor::GetDefaultThreadCount()
+{
+    ULONG Count = std::thread::hardware_concurrency();
+
+    return (Count != 0) ? Count : 1;
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Starts the worker threads
+*
+* @param CodecId
+* Codec to compress with, either CAB_CODEC_RAW or CAB_CODEC_MSZIP
+*
+* @param ThreadCount
+* Number of worker threads
+*
+* @return
+* Status of operation
+*/
+ULONG CBlockCompressor::Start(LONG CodecId, ULONG ThreadCount)
+{
+    ULONG i;
+
+    ASSERT(Blocks == NULL);
+    ASSERT(CodecId == CAB_CODEC_RAW || CodecId == CAB_CODEC_MSZIP);
+
+    this->CodecId = CodecId;
+    Stopping = false;
+    Oldest = NextToCompress = NextToQueue = 0;
+
+    /* Two blocks per thread keep the workers busy while the oldest one is written */
+    BlockCount = ThreadCount * 2;
+    Blocks = (PCAB_COMPRESSED_BLOCK)calloc(BlockCount, sizeof(CAB_COMPRESSED_BLOCK));
+    if (!Blocks)
+        return CAB_STATUS_NOMEMORY;
+
+    for (i = 0; i < BlockCount; i++)
+    {
+        Blocks[i].InputBuffer = malloc(CAB_BLOCKSIZE);
+        Blocks[i].OutputBuffer = malloc(CAB_MAX_COMPRESSED_BLOCKSIZE);
+        if (!Blocks[i].InputBuffer || !Blocks[i].OutputBuffer)
+        {
+            Stop();
+            return CAB_STATUS_NOMEMORY;
+        }
+    }
+
+    try
+    {
+        for (i = 0; i < ThreadCount; i++)
+            Threads.push_back(std::thread(&CBlockCompressor::WorkerThread, this));
+    }
+    catch (const std::system_error&)
+    {
+        DPRINT(MIN_TRACE, ("Cannot create worker thread.\n"));
+        Stop();
+        return CAB_STATUS_NOMEMORY;
+    }
+
+    return CAB_STATUS_SUCCESS;
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Stops the worker threads and frees the blocks
+*/
+void CBlockCompressor::Stop()
+{
+    ULONG i;
+
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        Stopping = true;
+    }
+    WorkQueued.notify_all();
+
+    for (i = 0; i < Threads.size(); i++)
+        Threads[i].join();
+    Threads.clear();
+
+    if (Blocks)
+    {
+        for (i = 0; i < BlockCount; i++)
+        {
+            free(Blocks[i].InputBuffer);
+            free(Blocks[i].OutputBuffer);
+        }
+        free(Blocks);
+        Blocks = NULL;
+    }
+    BlockCount = 0;
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Returns whether all blocks are in use
+*
+* @return
+* true if the oldest block must be collected before queueing another one
+*/
+bool CBlockCompressor::IsFull()
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    return (NextToQueue - Oldest) == BlockCount;
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Queues a copy of a data block for compression
+*
+* @param Buffer
+* Pointer to the uncompressed data
+*
+* @param Length
+* Length of the data, at most CAB_BLOCKSIZE bytes
+*
+* @param Context
+* Caller data returned with the compressed block
+*/
+void CBlockCompressor::Queue(void* Buffer, ULONG Length, void* Context)
+{
+    PCAB_COMPRESSED_BLOCK Block;
+
+    ASSERT(Length <= CAB_BLOCKSIZE);
+    ASSERT(!IsFull());
+
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+
+        Block = &Blocks[NextToQueue % BlockCount];
+        memcpy(Block->InputBuffer, Buffer, Length);
+        Block->InputLength = Length;
+        Block->OutputLength = 0;
+        Block->Context = Context;
+        Block->Status = CS_SUCCESS;
+        Block->Done = false;
+        NextToQueue++;
+    }
+    WorkQueued.notify_one();
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Returns the oldest queued block
+*
+* @param Wait
+* true to wait until the block is compressed
+*
+* @return
+* Pointer to the block, NULL if no block is queued, or if the oldest block
+* is not compressed yet and Wait is false
+*/
+PCAB_COMPRESSED_BLOCK CBlockCompressor::Collect(bool Wait)
+{
+    std::unique_lock<std::mutex> Guard(Lock);
+    PCAB_COMPRESSED_BLOCK Block;
+
+    if (Oldest == NextToQueue)
+        return NULL;
+
+    Block = &Blocks[Oldest % BlockCount];
+    if (Wait)
+        WorkDone.wait(Guard, [Block] { return Block->Done; });
+    else if (!Block->Done)
+        return NULL;
+
+    return Block;
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Makes the block returned by Collect() available again
+*/
+void CBlockCompressor::Release()
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    ASSERT(Oldest != NextToQueue && Blocks[Oldest % BlockCount].Done);
+    Oldest++;
+}
+
+/**
+* @name CBlockCompressor class
+* @implemented
+*
+* Compresses queued blocks until the compressor is stopped.
+* Each thread has its own codec
+*/
+void CBlockCompressor::WorkerThread()
+{
+    PCAB_COMPRESSED_BLOCK Block;
+    CCABCodec* Codec;
+    ULONG Status;
+
+    if (CodecId == CAB_CODEC_MSZIP)
+        Codec = new CMSZipCodec();
+    else
+        Codec = new CRawCodec();
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> Guard(Lock);
+
+            WorkQueued.wait(Guard, [this] { return Stopping || NextToCompress != NextToQueue; });
+            if (Stopping)
+                break;
+
+            Block = &Blocks[NextToCompress % BlockCount];
+            NextToCompress++;
+        }
+
+        Status = Codec->Compress(Block->OutputBuffer,
+                                 Block->InputBuffer,
+                                 Block->InputLength,
+                                 &Block->OutputLength);
+
+        {
+            std::lock_guard<std::mutex> Guard(Lock);
+            Block->Status = Status;
+            Block->Done = true;
+        }
+        WorkDone.notify_all();
+    }
+
+    delete Codec;
+}
+
+#endif /* CAB_READ_ONLY */
@@ -26,6 +26,7 @@
 #include "cabinet.h"
 #include "raw.h"
 #include "mszip.h"
+#include "lzx.h"
 
 #ifndef CAB_READ_ONLY
 
@@ -94,12 +95,17 @@ CCabinet::CCabinet()
     Codec          = NULL;
     CodecId        = -1;
     CodecSelected  = false;
+    LZXWindowBits  = LZX_DEFAULT_WINDOW_BITS;
 
     OutputBuffer = NULL;
     InputBuffer  = NULL;
     MaxDiskSize  = 0;
     BlockIsSplit = false;
     ScratchFile  = NULL;
+#ifndef CAB_READ_ONLY
+    Compressor   = NULL;
+    CompressionThreads = 0;
+#endif
 
     FolderUncompSize = 0;
     BytesLeftInBlock = 0;
@@ -365,10 +371,37 @@ bool CCabinet::SetCompressionCodec(char* CodecName)
  *    CodecName = Pointer to a string with the name of the codec
  */
 {
+    ULONG WindowBits;
+    char* End;
+
     if( !strcasecmp(CodecName, "raw") )
         SelectCodec(CAB_CODEC_RAW);
     else if( !strcasecmp(CodecName, "mszip") )
         SelectCodec(CAB_CODEC_MSZIP);
+    else if( !strncasecmp(CodecName, "lzx", 3) )
+    {
+        /* "lzx" or "lzx:<window bits>" */
+        WindowBits = LZX_DEFAULT_WINDOW_BITS;
+        if (CodecName[3] == ':')
+        {
+            WindowBits = strtoul(&CodecName[4], &End, 10);
+            if (End == &CodecName[4] || *End != '\0' ||
+                WindowBits < LZX_MIN_WINDOW_BITS || WindowBits > LZX_MAX_WINDOW_BITS)
+            {
+                printf("ERROR: The LZX window must be between %u and %u bits!\n",
+                       LZX_MIN_WINDOW_BITS, LZX_MAX_WINDOW_BITS);
+                return false;
+            }
+        }
+        else if (CodecName[3] != '\0')
+        {
+            printf("ERROR: Invalid codec specified!\n");
+            return false;
+        }
+
+        LZXWindowBits = WindowBits;
+        SelectCodec(CAB_CODEC_LZX);
+    }
     else
     {
         printf("ERROR: Invalid codec specified!\n");
@@ -631,6 +664,9 @@ void CCabinet::Close()
         fclose(FileHandle);
         FileOpen = false;
     }
+
+    /* OutputBuffer no longer holds a block of this cabinet */
+    CurrentDataNode = NULL;
 }
 
 
@@ -757,6 +793,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
     PUCHAR CurrentBuffer;
     FILE* DestFile;
     PCFFILE_NODE File;
+    PCFDATA_NODE NextDataNode;
     CFDATA CFData;
     ULONG Status;
     bool Skip;
@@ -785,6 +822,10 @@ ULONG CCabinet::ExtractFile(char* FileName)
             SelectCodec(CAB_CODEC_MSZIP);
             break;
 
+        case CAB_COMP_LZX:
+            SelectCodec(CAB_CODEC_LZX);
+            break;
+
         default:
             return CAB_STATUS_UNSUPPCOMP;
     }
@@ -835,7 +876,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
 
     SetAttributesOnFile(DestName, File->File.Attributes);
 
-    Buffer = (PUCHAR)malloc(CAB_BLOCKSIZE + 12); // This should be enough
+    Buffer = (PUCHAR)malloc(CAB_MAX_COMPRESSED_BLOCKSIZE);
     if (!Buffer)
     {
         fclose(DestFile);
@@ -846,6 +887,18 @@ ULONG CCabinet::ExtractFile(char* FileName)
     /* Call OnExtract event handler */
     OnExtract(&File->File, FileName);
 
+    if (CodecId == CAB_CODEC_LZX)
+    {
+        /* The blocks in front of the file have to be uncompressed first */
+        Status = SeekLZXBlock(File->DataBlock, Buffer);
+        if (Status != CAB_STATUS_SUCCESS)
+        {
+            fclose(DestFile);
+            free(Buffer);
+            return Status;
+        }
+    }
+
     /* Search to start of file */
     if (fseek(FileHandle, (off_t)File->DataBlock->AbsoluteOffset, SEEK_SET) != 0)
     {
@@ -861,6 +914,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
 
     Skip = true;
 
+    NextDataNode = File->DataBlock;
     ReuseBlock = (CurrentDataNode == File->DataBlock);
     if (Size > 0)
     {
@@ -894,7 +948,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
                         CFData.CompSize,
                         CFData.UncompSize));
 
-                    ASSERT(CFData.CompSize <= CAB_BLOCKSIZE + 12);
+                    ASSERT(CFData.CompSize <= CAB_MAX_COMPRESSED_BLOCKSIZE);
 
                     BytesToRead = CFData.CompSize;
 
@@ -970,6 +1024,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
 
                         /* The file is continued in the first data block in the folder */
                         File->DataBlock = CurrentFolderNode->DataListHead;
+                        NextDataNode = File->DataBlock;
 
                         /* Search to start of file */
                         if (fseek(FileHandle, (off_t)File->DataBlock->AbsoluteOffset, SEEK_SET) != 0)
@@ -995,9 +1050,11 @@ ULONG CCabinet::ExtractFile(char* FileName)
 
                 DPRINT(MAX_TRACE, ("TotalBytesRead (%u).\n", (UINT)TotalBytesRead));
 
+                BytesToWrite = CFData.UncompSize;
                 Status = Codec->Uncompress(OutputBuffer, Buffer, TotalBytesRead, &BytesToWrite);
                 if (Status != CS_SUCCESS)
                 {
+                    CurrentDataNode = NULL;
                     fclose(DestFile);
                     free(Buffer);
                     DPRINT(MID_TRACE, ("Cannot uncompress block.\n"));
@@ -1016,6 +1073,11 @@ ULONG CCabinet::ExtractFile(char* FileName)
                 }
 
                 BytesLeftInBlock = BytesToWrite;
+
+                /* Remember the block, the next file may start in it */
+                CurrentDataNode = NextDataNode;
+                if (NextDataNode)
+                    NextDataNode = NextDataNode->Next;
             }
             else
             {
@@ -1048,6 +1110,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
                     return CAB_STATUS_INVALID_CAB;
                 }
 
+                NextDataNode = CurrentDataNode->Next;
                 ReuseBlock = false;
             }
 
@@ -1119,6 +1182,9 @@ void CCabinet::SelectCodec(LONG Id)
 
         CodecSelected = false;
         delete Codec;
+
+        /* The state the old codec had after the last block is gone */
+        CurrentDataNode = NULL;
     }
 
     switch (Id)
@@ -1131,6 +1197,10 @@ void CCabinet::SelectCodec(LONG Id)
             Codec = new CMSZipCodec();
             break;
 
+        case CAB_CODEC_LZX:
+            Codec = new CLZXCodec();
+            break;
+
         default:
             return;
     }
@@ -1155,8 +1225,8 @@ ULONG CCabinet::NewCabinet()
 
     CurrentDiskNumber = 0;
 
-    OutputBuffer = malloc(CAB_BLOCKSIZE + 12); // This should be enough
-    InputBuffer  = malloc(CAB_BLOCKSIZE + 12); // This should be enough
+    OutputBuffer = malloc(CAB_MAX_COMPRESSED_BLOCKSIZE);
+    InputBuffer  = malloc(CAB_MAX_COMPRESSED_BLOCKSIZE);
     if ((!OutputBuffer) || (!InputBuffer))
     {
         DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
@@ -1204,6 +1274,25 @@ ULONG CCabinet::NewCabinet()
     }
 
     Status = ScratchFile->Create();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
+    /* LZX blocks depend on each other and split blocks are
+       written as they are made, so those are compressed here */
+    if (CompressionThreads == 0)
+        CompressionThreads = CBlockCompressor::GetDefaultThreadCount();
+    if (CompressionThreads > 1 && CodecId != CAB_CODEC_LZX && MaxDiskSize == 0)
+    {
+        Compressor = new CBlockCompressor();
+        Status = Compressor->Start(CodecId, CompressionThreads);
+        if (Status != CAB_STATUS_SUCCESS)
+        {
+            DPRINT(MIN_TRACE, ("Compressing on a single thread (%u).\n", (UINT)Status));
+            delete Compressor;
+            Compressor = NULL;
+            Status = CAB_STATUS_SUCCESS;
+        }
+    }
 
     CreateNewFolder = false;
 
@@ -1246,8 +1335,15 @@ ULONG CCabinet::NewFolder()
  *     Status of operation
  */
 {
+    ULONG Status;
+
     DPRINT(MAX_TRACE, ("Creating new folder.\n"));
 
+    /* Blocks still being compressed belong to the previous folder */
+    Status = FlushDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     CurrentFolderNode = NewFolderNode();
     if (!CurrentFolderNode)
     {
@@ -1264,10 +1360,18 @@ ULONG CCabinet::NewFolder()
             CurrentFolderNode->Folder.CompressionType = CAB_COMP_MSZIP;
             break;
 
+        case CAB_CODEC_LZX:
+            CurrentFolderNode->Folder.CompressionType =
+                (USHORT)(CAB_COMP_LZX | (LZXWindowBits << 8));
+            break;
+
         default:
             return CAB_STATUS_UNSUPPCOMP;
     }
 
+    if (Codec->Reset(CurrentFolderNode->Folder.CompressionType) != CS_SUCCESS)
+        return CAB_STATUS_UNSUPPCOMP;
+
     /* FIXME: This won't work if no files are added to the new folder */
 
     DiskSize += sizeof(CFFOLDER);
@@ -1496,6 +1600,10 @@ ULONG CCabinet::CommitDisk(ULONG MoreDisks)
     PCFFOLDER_NODE FolderNode;
     ULONG Status;
 
+    Status = FlushDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     OnCabinetName(CurrentDiskNumber, CabinetName);
 
     /* Create file, fail if it already exists */
@@ -1580,6 +1688,14 @@ ULONG CCabinet::CloseCabinet()
 {
     ULONG Status;
 
+#ifndef CAB_READ_ONLY
+    if (Compressor)
+    {
+        delete Compressor;
+        Compressor = NULL;
+    }
+#endif
+
     DestroyFileNodes();
 
     DestroyFolderNodes();
@@ -1837,6 +1953,16 @@ void CCabinet::SetMaxDiskSize(ULONG Size)
     MaxDiskSize = Size;
 }
 
+void CCabinet::SetCompressionThreads(ULONG Count)
+/*
+ * FUNCTION: Sets the number of threads compressing data blocks
+ * ARGUMENTS:
+ *     Count = Number of threads (0 means one per processor)
+ */
+{
+    CompressionThreads = Count;
+}
+
 #endif /* CAB_READ_ONLY */
 
 
@@ -2546,6 +2672,74 @@ ULONG CCabinet::ReadBlock(void* Buffer,
     return CAB_STATUS_SUCCESS;
 }
 
+ULONG CCabinet::SeekLZXBlock(PCFDATA_NODE DataNode, void* Buffer)
+/*
+ * FUNCTION: Brings the LZX codec to the state it has in front of a data block
+ * ARGUMENTS:
+ *     DataNode = Pointer to the data block of the current folder to uncompress next
+ *     Buffer   = Pointer to buffer of CAB_MAX_COMPRESSED_BLOCKSIZE bytes
+ * RETURNS:
+ *     Status of operation
+ * NOTES:
+ *     An LZX folder is one stream, so all blocks in front of DataNode have to
+ *     be uncompressed. Nothing is done if DataNode is the block in OutputBuffer
+ *     or the one that follows it
+ */
+{
+    PCFDATA_NODE Node;
+    CFDATA CFData;
+    ULONG BytesRead;
+    ULONG Size;
+    ULONG Status;
+
+    if (CurrentDataNode && (CurrentDataNode == DataNode || CurrentDataNode->Next == DataNode))
+        return CAB_STATUS_SUCCESS;
+
+    /* The stream starts in the previous cabinet */
+    if ((CABHeader.Flags & CAB_FLAG_HASPREV) && CurrentFolderNode == FolderListHead)
+    {
+        DPRINT(MIN_TRACE, ("Cannot uncompress an LZX folder continued from the previous cabinet.\n"));
+        return CAB_STATUS_UNSUPPCOMP;
+    }
+
+    CurrentDataNode = NULL;
+    if (Codec->Reset(CurrentFolderNode->Folder.CompressionType) != CS_SUCCESS)
+        return CAB_STATUS_UNSUPPCOMP;
+
+    for (Node = CurrentFolderNode->DataListHead; Node && Node != DataNode; Node = Node->Next)
+    {
+        if (fseek(FileHandle, (off_t)Node->AbsoluteOffset, SEEK_SET) != 0)
+        {
+            DPRINT(MIN_TRACE, ("fseek() failed.\n"));
+            return CAB_STATUS_INVALID_CAB;
+        }
+
+        if (((Status = ReadBlock(&CFData, sizeof(CFDATA), &BytesRead)) != CAB_STATUS_SUCCESS) ||
+            (CFData.CompSize > CAB_MAX_COMPRESSED_BLOCKSIZE) ||
+            ((Status = ReadBlock(Buffer, CFData.CompSize, &BytesRead)) != CAB_STATUS_SUCCESS))
+        {
+            DPRINT(MIN_TRACE, ("Cannot read from file (%u).\n", (UINT)Status));
+            return CAB_STATUS_INVALID_CAB;
+        }
+
+        Size = CFData.UncompSize;
+        Status = Codec->Uncompress(OutputBuffer, Buffer, CFData.CompSize, &Size);
+        if (Status != CS_SUCCESS)
+        {
+            DPRINT(MID_TRACE, ("Cannot uncompress block.\n"));
+            return (Status == CS_NOMEMORY) ? CAB_STATUS_NOMEMORY : CAB_STATUS_INVALID_CAB;
+        }
+
+        CurrentDataNode  = Node;
+        BytesLeftInBlock = Size;
+    }
+
+    if (Node != DataNode)
+        return CAB_STATUS_INVALID_CAB;
+
+    return CAB_STATUS_SUCCESS;
+}
+
 bool CCabinet::MatchFileNamePattern(char* FileName, char* Pattern)
 /*
  * FUNCTION: Matches a wildcard character pattern against a file
@@ -2984,12 +3178,25 @@ ULONG CCabinet::WriteDataBlock()
     ULONG BytesWritten;
     PCFDATA_NODE DataNode;
 
+    if (Compressor && !BlockIsSplit && MaxDiskSize == 0)
+        return QueueDataBlock();
+
+    /* Keep the blocks in order */
+    Status = FlushDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     if (!BlockIsSplit)
     {
         Status = Codec->Compress(OutputBuffer,
             InputBuffer,
             CurrentIBufferSize,
             &TotalCompSize);
+        if (Status != CS_SUCCESS)
+        {
+            DPRINT(MIN_TRACE, ("Cannot compress block (%u).\n", (UINT)Status));
+            return (Status == CS_NOMEMORY) ? CAB_STATUS_NOMEMORY : CAB_STATUS_FAILURE;
+        }
 
         DPRINT(MAX_TRACE, ("Block compressed. CurrentIBufferSize (%u)  TotalCompSize(%u).\n",
             (UINT)CurrentIBufferSize, (UINT)TotalCompSize));
@@ -3060,6 +3267,122 @@ ULONG CCabinet::WriteDataBlock()
     return CAB_STATUS_SUCCESS;
 }
 
+
+ULONG CCabinet::QueueDataBlock()
+/*
+ * FUNCTION: Queues the current data block for compression on a worker thread
+ * RETURNS:
+ *     Status of operation
+ * NOTES:
+ *     The data node is created now so the blocks stay in order. Blocks
+ *     that are already compressed are written to the scratch file
+ */
+{
+    PCAB_COMPRESSED_BLOCK Block;
+    PCFDATA_NODE DataNode;
+    ULONG Status;
+
+    DataNode = NewDataNode(CurrentFolderNode);
+    if (!DataNode)
+    {
+        DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+        return CAB_STATUS_NOMEMORY;
+    }
+
+    while (Compressor->IsFull())
+    {
+        Status = WriteCompressedBlock(Compressor->Collect(true));
+        if (Status != CAB_STATUS_SUCCESS)
+            return Status;
+    }
+
+    Compressor->Queue(InputBuffer, CurrentIBufferSize, DataNode);
+
+    CurrentIBufferSize = 0;
+    CurrentIBuffer     = InputBuffer;
+
+    while ((Block = Compressor->Collect(false)) != NULL)
+    {
+        Status = WriteCompressedBlock(Block);
+        if (Status != CAB_STATUS_SUCCESS)
+            return Status;
+    }
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
+ULONG CCabinet::WriteCompressedBlock(PCAB_COMPRESSED_BLOCK Block)
+/*
+ * FUNCTION: Writes a data block compressed by a worker thread to the scratch file
+ * ARGUMENTS:
+ *     Block = Pointer to the block returned by CBlockCompressor::Collect()
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    PCFDATA_NODE DataNode = (PCFDATA_NODE)Block->Context;
+    ULONG BytesWritten;
+    ULONG Status;
+
+    if (Block->Status != CS_SUCCESS)
+    {
+        DPRINT(MIN_TRACE, ("Cannot compress block (%u).\n", (UINT)Block->Status));
+        Status = (Block->Status == CS_NOMEMORY) ? CAB_STATUS_NOMEMORY : CAB_STATUS_FAILURE;
+        Compressor->Release();
+        return Status;
+    }
+
+    DataNode->Data.CompSize   = (USHORT)Block->OutputLength;
+    DataNode->Data.UncompSize = (USHORT)Block->InputLength;
+    DataNode->Data.Checksum   = 0;
+    DataNode->ScratchFilePosition = ScratchFile->Position();
+
+    DPRINT(MAX_TRACE, ("Writing block. Checksum (0x%X)  CompSize (%u)  UncompSize (%u).\n",
+        (UINT)DataNode->Data.Checksum,
+        DataNode->Data.CompSize,
+        DataNode->Data.UncompSize));
+
+    Status = ScratchFile->WriteBlock(&DataNode->Data,
+        Block->OutputBuffer, &BytesWritten);
+    Compressor->Release();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
+    DiskSize += sizeof(CFDATA) + BytesWritten;
+
+    CurrentFolderNode->TotalFolderSize += (BytesWritten + sizeof(CFDATA));
+    CurrentFolderNode->Folder.DataBlockCount++;
+
+    LastBlockStart += DataNode->Data.UncompSize;
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
+ULONG CCabinet::FlushDataBlocks()
+/*
+ * FUNCTION: Waits for the queued data blocks and writes them to the scratch file
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    PCAB_COMPRESSED_BLOCK Block;
+    ULONG Status;
+
+    if (!Compressor)
+        return CAB_STATUS_SUCCESS;
+
+    while ((Block = Compressor->Collect(true)) != NULL)
+    {
+        Status = WriteCompressedBlock(Block);
+        if (Status != CAB_STATUS_SUCCESS)
+            return Status;
+    }
+
+    return CAB_STATUS_SUCCESS;
+}
+
 #if !defined(_WIN32)
 
 void CCabinet::ConvertDateAndTime(time_t* Time,
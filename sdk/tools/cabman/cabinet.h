@@ -25,6 +25,13 @@
 #include <string.h>
 #include <limits.h>
 
+#ifndef CAB_READ_ONLY
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
 #ifndef PATH_MAX
 #define PATH_MAX MAX_PATH
 #endif
@@ -34,6 +41,7 @@
 #define DIR_SEPARATOR_STRING "\\"
 
 #define strcasecmp _stricmp
+#define strncasecmp _strnicmp
 #define strdup _strdup
 #else
 #define DIR_SEPARATOR_CHAR '/'
@@ -101,6 +109,8 @@ extern ULONG DebugTraceLevel;
 #define CAB_SIGNATURE        0x4643534D // "MSCF"
 #define CAB_VERSION          0x0103
 #define CAB_BLOCKSIZE        32768
+/* Largest compressed data block, they can grow that much with LZX */
+#define CAB_MAX_COMPRESSED_BLOCKSIZE (CAB_BLOCKSIZE + 6144)
 
 #define CAB_COMP_MASK        0x00FF
 #define CAB_COMP_NONE        0x0000
@@ -258,6 +268,12 @@ typedef struct _CAB_SEARCH
 
 
 
+/* Codec status codes */
+#define CS_SUCCESS      0x0000  /* All data consumed */
+#define CS_NOMEMORY     0x0001  /* Not enough free memory */
+#define CS_BADSTREAM    0x0002  /* Bad data stream */
+
+
 /* Codecs */
 
 class CCABCodec
@@ -267,12 +283,15 @@ public:
     CCABCodec() {};
     /* Default destructor */
     virtual ~CCABCodec() {};
+    /* Starts a new folder, for codecs that keep state from one data block to the next */
+    virtual ULONG Reset(USHORT CompressionType) { return CS_SUCCESS; };
     /* Compresses a data block */
     virtual ULONG Compress(void* OutputBuffer,
                            void* InputBuffer,
                            ULONG InputLength,
                            PULONG OutputLength) = 0;
-    /* Uncompresses a data block */
+    /* Uncompresses a data block. On entry *OutputLength is the uncompressed size
+       given by the CFDATA structure of the block */
     virtual ULONG Uncompress(void* OutputBuffer,
                              void* InputBuffer,
                              ULONG InputLength,
@@ -280,12 +299,6 @@ public:
 };
 
 
-/* Codec status codes */
-#define CS_SUCCESS      0x0000  /* All data consumed */
-#define CS_NOMEMORY     0x0001  /* Not enough free memory */
-#define CS_BADSTREAM    0x0002  /* Bad data stream */
-
-
 /* Codec indentifiers */
 #define CAB_CODEC_RAW   0x00
 #define CAB_CODEC_LZX   0x01
@@ -316,6 +329,56 @@ private:
     FILE* FileHandle;
 };
 
+typedef struct _CAB_COMPRESSED_BLOCK
+{
+    void* Context;              // Passed to Queue()
+    void* InputBuffer;
+    ULONG InputLength;
+    void* OutputBuffer;
+    ULONG OutputLength;
+    ULONG Status;               // CS_*
+    bool Done;
+} CAB_COMPRESSED_BLOCK, *PCAB_COMPRESSED_BLOCK;
+
+/* Compresses data blocks on worker threads. Blocks are
+   collected in the order they were queued */
+class CBlockCompressor
+{
+public:
+    /* Default constructor */
+    CBlockCompressor();
+    /* Default destructor */
+    virtual ~CBlockCompressor();
+    /* Returns the number of threads to use by default */
+    static ULONG GetDefaultThreadCount();
+    /* Starts the worker threads, the codec must not keep state between blocks */
+    ULONG Start(LONG CodecId, ULONG ThreadCount);
+    /* Stops the worker threads, queued blocks are dropped */
+    void Stop();
+    /* Returns whether a block must be collected before the next one is queued */
+    bool IsFull();
+    /* Queues a copy of a data block */
+    void Queue(void* Buffer, ULONG Length, void* Context);
+    /* Returns the oldest queued block once it is compressed, NULL if there is none
+       or it is not done and Wait is false */
+    PCAB_COMPRESSED_BLOCK Collect(bool Wait);
+    /* Frees the block returned by Collect() */
+    void Release();
+private:
+    void WorkerThread();
+    std::vector<std::thread> Threads;
+    std::mutex Lock;
+    std::condition_variable WorkQueued;
+    std::condition_variable WorkDone;
+    PCAB_COMPRESSED_BLOCK Blocks;
+    ULONG BlockCount;
+    ULONG Oldest;               // Running block numbers, the slot
+    ULONG NextToCompress;       // is the number modulo BlockCount
+    ULONG NextToQueue;
+    LONG CodecId;
+    bool Stopping;
+};
+
 #endif /* CAB_READ_ONLY */
 
 class CCabinet
@@ -395,6 +458,8 @@ public:
     ULONG AddFile(char* FileName);
     /* Sets the maximum size of the current disk */
     void SetMaxDiskSize(ULONG Size);
+    /* Sets the number of threads compressing data blocks */
+    void SetCompressionThreads(ULONG Count);
 #endif /* CAB_READ_ONLY */
 
     /* Default event handlers */
@@ -430,6 +495,7 @@ private:
     void DestroyDeletedFolderNodes();
     ULONG ComputeChecksum(void* Buffer, ULONG Size, ULONG Seed);
     ULONG ReadBlock(void* Buffer, ULONG Size, PULONG BytesRead);
+    ULONG SeekLZXBlock(PCFDATA_NODE DataNode, void* Buffer);
     bool MatchFileNamePattern(char* FileName, char* Pattern);
 #ifndef CAB_READ_ONLY
     ULONG InitCabinetHeader();
@@ -438,6 +504,9 @@ private:
     ULONG WriteFileEntries();
     ULONG CommitDataBlocks(PCFFOLDER_NODE FolderNode);
     ULONG WriteDataBlock();
+    ULONG QueueDataBlock();
+    ULONG WriteCompressedBlock(PCAB_COMPRESSED_BLOCK Block);
+    ULONG FlushDataBlocks();
     ULONG GetAttributesOnFile(PCFFILE_NODE File);
     ULONG SetAttributesOnFile(char* FileName, USHORT FileAttributes);
     ULONG GetFileTimes(FILE* FileHandle, PCFFILE_NODE File);
@@ -479,6 +548,7 @@ private:
     CCABCodec *Codec;
     LONG CodecId;
     bool CodecSelected;
+    ULONG LZXWindowBits;
     void* InputBuffer;
     void* CurrentIBuffer;               // Current offset in input buffer
     ULONG CurrentIBufferSize;   // Bytes left in input buffer
@@ -503,6 +573,8 @@ private:
     ULONG TotalBytesLeft;
     bool BlockIsSplit;                  // true if current data block is split
     ULONG NextFolderNumber;     // Zero based folder number
+    CBlockCompressor *Compressor;
+    ULONG CompressionThreads;   // 0 for the default
 #endif /* CAB_READ_ONLY */
 };
 
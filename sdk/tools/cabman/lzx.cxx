@@ -0,0 +1,1324 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS cabinet manager
+ * FILE:        tools/cabman/lzx.cxx
+ * PURPOSE:     CAB codec for LZX compressed data
+ * NOTES:       The decoder is based on the one of dll/win32/cabinet (fdi.c),
+ *              written by Stuart Caie. The encoder only writes verbatim and
+ *              uncompressed blocks, one block per CFDATA frame, and never
+ *              uses the repeated offsets.
+ *
+ *              A folder is a single LZX stream: the window is kept from one
+ *              data block to the next, so the blocks of a folder have to be
+ *              compressed and uncompressed in order. Reset() starts a new
+ *              folder.
+ */
+#include <stdio.h>
+#include "lzx.h"
+
+
+typedef struct _LZX_HUFFMAN_LEAF
+{
+    ULONG Weight;
+    ULONG Symbol;
+} LZX_HUFFMAN_LEAF, *PLZX_HUFFMAN_LEAF;
+
+static int CompareLeaves(const void* A, const void* B)
+{
+    const LZX_HUFFMAN_LEAF* Leaf1 = (const LZX_HUFFMAN_LEAF*)A;
+    const LZX_HUFFMAN_LEAF* Leaf2 = (const LZX_HUFFMAN_LEAF*)B;
+
+    if (Leaf1->Weight != Leaf2->Weight)
+        return (Leaf1->Weight < Leaf2->Weight) ? -1 : 1;
+
+    return (Leaf1->Symbol < Leaf2->Symbol) ? -1 : 1;
+}
+
+static inline ULONG GetHash(PUCHAR Data)
+{
+    ULONG Value = ((ULONG)Data[0] << 16) | ((ULONG)Data[1] << 8) | Data[2];
+
+    return (Value * 2654435761U) >> (32 - LZX_HASH_BITS);
+}
+
+static inline LONG GetLong(PUCHAR Data)
+{
+    return (LONG)((ULONG)Data[0] | ((ULONG)Data[1] << 8) |
+                  ((ULONG)Data[2] << 16) | ((ULONG)Data[3] << 24));
+}
+
+static inline void PutLong(PUCHAR Data, LONG Value)
+{
+    Data[0] = (UCHAR)Value;
+    Data[1] = (UCHAR)(Value >> 8);
+    Data[2] = (UCHAR)(Value >> 16);
+    Data[3] = (UCHAR)(Value >> 24);
+}
+
+
+/* CLZXCodec */
+
+CLZXCodec::CLZXCodec()
+/*
+ * FUNCTION: Default constructor
+ */
+{
+    WindowBits = 0;
+    WindowSize = 0;
+    History    = NULL;
+    HashHead   = NULL;
+    HashPrev   = NULL;
+    Tokens     = NULL;
+    Window     = NULL;
+
+    Reset(CAB_COMP_LZX | (LZX_DEFAULT_WINDOW_BITS << 8));
+}
+
+
+CLZXCodec::~CLZXCodec()
+/*
+ * FUNCTION: Default destructor
+ */
+{
+    Free();
+}
+
+
+void CLZXCodec::Free()
+/*
+ * FUNCTION: Frees the buffers, they are allocated again when needed
+ */
+{
+    free(History);
+    free(HashHead);
+    free(HashPrev);
+    free(Tokens);
+    free(Window);
+
+    History  = NULL;
+    HashHead = NULL;
+    HashPrev = NULL;
+    Tokens   = NULL;
+    Window   = NULL;
+}
+
+
+ULONG CLZXCodec::Reset(USHORT CompressionType)
+/*
+ * FUNCTION: Starts a new folder
+ * ARGUMENTS:
+ *     CompressionType = Compression type of the folder, the window
+ *                       size is in bits 8-12
+ */
+{
+    ULONG Bits = (CompressionType >> 8) & 0x1F;
+    ULONG i, j;
+
+    if ((Bits < LZX_MIN_WINDOW_BITS) || (Bits > LZX_MAX_WINDOW_BITS))
+    {
+        DPRINT(MIN_TRACE, ("Bad LZX window size (%u).\n", (UINT)Bits));
+        return CS_BADSTREAM;
+    }
+
+    if (Bits != WindowBits)
+    {
+        Free();
+        WindowBits = Bits;
+        WindowSize = 1 << Bits;
+    }
+
+    if (Bits == 21)
+        PositionSlots = 50;
+    else if (Bits == 20)
+        PositionSlots = 42;
+    else
+        PositionSlots = Bits << 1;
+
+    MainElements = LZX_NUM_CHARS + (PositionSlots << 3);
+
+    for (i = 0, j = 0; i < LZX_MAX_POSITION_SLOTS; i += 2)
+    {
+        ExtraBits[i] = ExtraBits[i + 1] = (UCHAR)j;
+        if ((i != 0) && (j < 17))
+            j++;
+    }
+
+    for (i = 0, j = 0; i <= LZX_MAX_POSITION_SLOTS; i++)
+    {
+        PositionBase[i] = j;
+        j += 1 << ExtraBits[i];
+    }
+
+    HeaderDone = false;
+    FramesDone = 0;
+    E8FileSize = 0;
+    E8Position = 0;
+    E8Started  = false;
+
+    HistoryBase   = 0;
+    HistoryLength = 0;
+    if (HashHead)
+        memset(HashHead, 0, sizeof(ULONG) << LZX_HASH_BITS);
+    memset(MainLengths, 0, sizeof(MainLengths));
+    memset(LengthLengths, 0, sizeof(LengthLengths));
+
+    WindowPosition = 0;
+    R0 = R1 = R2   = 1;
+    BlockType      = 0;
+    BlockLength    = 0;
+    BlockRemaining = 0;
+    memset(MainTreeLengths, 0, sizeof(MainTreeLengths));
+    memset(LengthTreeLengths, 0, sizeof(LengthTreeLengths));
+
+    return CS_SUCCESS;
+}
+
+
+/* Compression */
+
+void CLZXCodec::TranslateE8(PUCHAR Data, ULONG Length)
+/*
+ * FUNCTION: Turns the relative targets of E8 (call) instructions into
+ *           absolute ones, which repeat a lot more
+ * NOTES:    This is exactly undone by UndoE8(). The decoder only starts
+ *           translating once it has seen a E8 byte, until then there is
+ *           nothing to translate here either.
+ */
+{
+    LONG CurrentPosition;
+    LONG Offset;
+    ULONG i;
+
+    if (FramesDone++ >= 32768)
+        return;
+
+    CurrentPosition = E8Position;
+    E8Position += Length;
+
+    if (Length <= 6)
+        return;
+
+    for (i = 0; i + 10 < Length; )
+    {
+        if (Data[i++] != 0xE8)
+        {
+            CurrentPosition++;
+            continue;
+        }
+
+        Offset = GetLong(&Data[i]);
+        if ((Offset >= -CurrentPosition) && (Offset < E8FileSize))
+        {
+            if (Offset < E8FileSize - CurrentPosition)
+                PutLong(&Data[i], Offset + CurrentPosition);
+            else
+                PutLong(&Data[i], Offset - E8FileSize);
+        }
+
+        i += 4;
+        CurrentPosition += 5;
+    }
+}
+
+
+ULONG CLZXCodec::GetPositionSlot(ULONG FormattedOffset)
+{
+    ULONG Low = 0, High = PositionSlots - 1, Middle;
+
+    while (Low < High)
+    {
+        Middle = (Low + High + 1) >> 1;
+        if (PositionBase[Middle] <= FormattedOffset)
+            Low = Middle;
+        else
+            High = Middle - 1;
+    }
+
+    return Low;
+}
+
+
+void CLZXCodec::InsertHash(ULONG Position)
+{
+    ULONG Index = Position - HistoryBase;
+    ULONG Hash;
+
+    if (Index + 2 >= HistoryLength)
+        return;
+
+    Hash = GetHash(&History[Index]);
+    HashPrev[Position & (WindowSize - 1)] = HashHead[Hash];
+    HashHead[Hash] = Position + 1;
+}
+
+
+ULONG CLZXCodec::FindMatch(ULONG Position, ULONG End, PULONG Distance)
+/*
+ * FUNCTION: Finds the longest match for the data at a position
+ * ARGUMENTS:
+ *     Position = Folder offset of the data
+ *     End      = Folder offset of the end of the frame, matches stop there
+ *     Distance = Address of buffer to place the distance of the match
+ * RETURNS:
+ *     Length of the match, 0 if there is none worth it
+ */
+{
+    PUCHAR Current = &History[Position - HistoryBase];
+    PUCHAR Match;
+    ULONG MaxLength = End - Position;
+    ULONG Chain = LZX_MAX_CHAIN;
+    ULONG Best = 0;
+    ULONG Oldest;
+    ULONG Entry, Next, Candidate, Length;
+
+    if (MaxLength > LZX_MAX_MATCH)
+        MaxLength = LZX_MAX_MATCH;
+    if (MaxLength < 3)
+        return 0;
+
+    /* The farthest offset LZX can code is the window size - 3 */
+    Oldest = (Position > WindowSize - 3) ? Position - (WindowSize - 3) : 0;
+    if (Oldest < HistoryBase)
+        Oldest = HistoryBase;
+
+    Entry = HashHead[GetHash(Current)];
+    while ((Entry != 0) && (Chain-- > 0))
+    {
+        Candidate = Entry - 1;
+        if ((Candidate < Oldest) || (Candidate >= Position))
+            break;
+
+        Match = &History[Candidate - HistoryBase];
+        if ((Match[Best] == Current[Best]) && (Match[0] == Current[0]) && (Match[1] == Current[1]))
+        {
+            for (Length = 0; (Length < MaxLength) && (Match[Length] == Current[Length]); Length++);
+
+            if (Length > Best)
+            {
+                Best = Length;
+                *Distance = Position - Candidate;
+                if ((Best >= MaxLength) || (Best >= LZX_NICE_MATCH))
+                    break;
+            }
+        }
+
+        /* Entries older than a window have been overwritten */
+        Next = HashPrev[Candidate & (WindowSize - 1)];
+        if (Next >= Entry)
+            break;
+        Entry = Next;
+    }
+
+    if ((Best < 3) || ((Best == 3) && (*Distance > LZX_TOO_FAR)))
+        return 0;
+
+    return Best;
+}
+
+
+ULONG CLZXCodec::Tokenize(ULONG Position, ULONG End)
+/*
+ * FUNCTION: Splits a frame into literals and matches, with lazy matching
+ * ARGUMENTS:
+ *     Position = Folder offset of the frame
+ *     End      = Folder offset of the end of the frame
+ * RETURNS:
+ *     Number of tokens
+ */
+{
+    ULONG Count = 0;
+    ULONG MatchLength, MatchDistance;
+    ULONG NextLength, NextDistance;
+    ULONG i;
+
+    while (Position < End)
+    {
+        MatchLength = FindMatch(Position, End, &MatchDistance);
+        InsertHash(Position);
+
+        /* A literal and a longer match at the next position is better */
+        while ((MatchLength != 0) && (MatchLength < LZX_NICE_MATCH) && (Position + 1 < End))
+        {
+            NextLength = FindMatch(Position + 1, End, &NextDistance);
+            if (NextLength <= MatchLength)
+                break;
+
+            Tokens[Count].Length  = 0;
+            Tokens[Count].Literal = History[Position - HistoryBase];
+            Count++;
+
+            Position++;
+            InsertHash(Position);
+
+            MatchLength   = NextLength;
+            MatchDistance = NextDistance;
+        }
+
+        if (MatchLength != 0)
+        {
+            Tokens[Count].Length   = (USHORT)MatchLength;
+            Tokens[Count].Distance = MatchDistance;
+            Count++;
+
+            for (i = 1; i < MatchLength; i++)
+                InsertHash(Position + i);
+            Position += MatchLength;
+        }
+        else
+        {
+            Tokens[Count].Length  = 0;
+            Tokens[Count].Literal = History[Position - HistoryBase];
+            Count++;
+
+            Position++;
+        }
+    }
+
+    return Count;
+}
+
+
+void CLZXCodec::BuildLengths(PULONG Frequencies, ULONG Count, ULONG MaxBits, PUCHAR Lengths)
+/*
+ * FUNCTION: Computes the code lengths of a Huffman tree
+ * ARGUMENTS:
+ *     Frequencies = Number of occurrences of each symbol
+ *     Count       = Number of symbols
+ *     MaxBits     = Maximum code length
+ *     Lengths     = Address of buffer to place the code lengths
+ * NOTES:    The decoder wants a complete code unless no symbol is used, so
+ *           a second symbol is given a code when a single one is used. The
+ *           frequencies are halved until the code is short enough.
+ */
+{
+    LZX_HUFFMAN_LEAF Leaves[LZX_MAINTREE_MAXSYMBOLS];
+    ULONG Weight[LZX_MAINTREE_MAXSYMBOLS * 2];
+    ULONG Parent[LZX_MAINTREE_MAXSYMBOLS * 2];
+    ULONG Depth[LZX_MAINTREE_MAXSYMBOLS * 2];
+    ULONG Used, Shift, Leaf, Node, Next, Root;
+    ULONG Child[2];
+    ULONG i, k;
+    bool TooLong;
+
+    memset(Lengths, 0, Count);
+
+    for (i = 0, Used = 0; i < Count; i++)
+    {
+        if (Frequencies[i] != 0)
+            Leaves[Used++].Symbol = i;
+    }
+
+    if (Used == 0)
+        return;
+
+    if (Used == 1)
+    {
+        Lengths[Leaves[0].Symbol] = 1;
+        Lengths[(Leaves[0].Symbol == 0) ? 1 : 0] = 1;
+        return;
+    }
+
+    for (Shift = 0; ; Shift++)
+    {
+        for (i = 0; i < Used; i++)
+        {
+            Leaves[i].Weight = Frequencies[Leaves[i].Symbol] >> Shift;
+            if (Leaves[i].Weight == 0)
+                Leaves[i].Weight = 1;
+        }
+        qsort(Leaves, Used, sizeof(Leaves[0]), CompareLeaves);
+
+        /* Sorted leaves come first, the internal nodes are
+           created in order of weight after them */
+        for (i = 0; i < Used; i++)
+            Weight[i] = Leaves[i].Weight;
+
+        Leaf = 0;
+        Node = Next = Used;
+        while (Next < Used * 2 - 1)
+        {
+            for (k = 0; k < 2; k++)
+            {
+                if ((Leaf < Used) && ((Node >= Next) || (Weight[Leaf] <= Weight[Node])))
+                    Child[k] = Leaf++;
+                else
+                    Child[k] = Node++;
+            }
+
+            Weight[Next] = Weight[Child[0]] + Weight[Child[1]];
+            Parent[Child[0]] = Parent[Child[1]] = Next;
+            Next++;
+        }
+
+        Root = Next - 1;
+        Depth[Root] = 0;
+        TooLong = false;
+        for (i = Root; i-- > 0; )
+        {
+            Depth[i] = Depth[Parent[i]] + 1;
+            if ((i < Used) && (Depth[i] > MaxBits))
+                TooLong = true;
+        }
+
+        if (!TooLong)
+            break;
+    }
+
+    for (i = 0; i < Used; i++)
+        Lengths[Leaves[i].Symbol] = (UCHAR)Depth[i];
+}
+
+
+void CLZXCodec::BuildCodes(PUCHAR Lengths, ULONG Count, PUSHORT Codes)
+/*
+ * FUNCTION: Assigns the canonical Huffman codes the decoder expects
+ */
+{
+    ULONG LengthCount[17];
+    USHORT NextCode[17];
+    USHORT Code = 0;
+    ULONG i;
+
+    memset(LengthCount, 0, sizeof(LengthCount));
+    for (i = 0; i < Count; i++)
+        LengthCount[Lengths[i]]++;
+    LengthCount[0] = 0;
+
+    for (i = 1; i <= 16; i++)
+    {
+        Code = (USHORT)((Code + LengthCount[i - 1]) << 1);
+        NextCode[i] = Code;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Lengths[i] != 0)
+            Codes[i] = NextCode[Lengths[i]]++;
+    }
+}
+
+
+void CLZXCodec::PutBits(PLZX_BIT_WRITER Writer, ULONG Value, ULONG Count)
+/*
+ * FUNCTION: Writes up to 17 bits. LZX streams are made of 16 bit little
+ *           endian words, which are filled from their most significant bit
+ */
+{
+    USHORT Word;
+
+    if (Count == 0)
+        return;
+
+    Writer->Bits = (Writer->Bits << Count) | (Value & ((1 << Count) - 1));
+    Writer->BitCount += Count;
+
+    while (Writer->BitCount >= 16)
+    {
+        Writer->BitCount -= 16;
+        Word = (USHORT)(Writer->Bits >> Writer->BitCount);
+
+        if (Writer->Position + 2 > Writer->Limit)
+        {
+            Writer->Overflow = true;
+            continue;
+        }
+
+        Writer->Buffer[Writer->Position++] = (UCHAR)Word;
+        Writer->Buffer[Writer->Position++] = (UCHAR)(Word >> 8);
+    }
+}
+
+
+void CLZXCodec::AlignBits(PLZX_BIT_WRITER Writer)
+/*
+ * FUNCTION: Pads the stream to a word boundary before uncompressed data.
+ *           If it already is on one, the decoder skips a whole word
+ */
+{
+    PutBits(Writer, 0, 16 - Writer->BitCount);
+}
+
+
+void CLZXCodec::FlushBits(PLZX_BIT_WRITER Writer)
+/*
+ * FUNCTION: Pads the stream to a word boundary at the end of a frame
+ */
+{
+    if (Writer->BitCount != 0)
+        PutBits(Writer, 0, 16 - Writer->BitCount);
+}
+
+
+void CLZXCodec::WriteLengths(PLZX_BIT_WRITER Writer, PUCHAR Lengths, PUCHAR PrevLengths, ULONG Count)
+/*
+ * FUNCTION: Writes code lengths through a pretree, as differences
+ *           from the lengths of the previous block
+ */
+{
+    UCHAR Symbols[LZX_MAINTREE_MAXSYMBOLS];
+    UCHAR Extra[LZX_MAINTREE_MAXSYMBOLS];
+    ULONG Frequencies[LZX_PRETREE_NUM_ELEMENTS];
+    UCHAR PretreeLengths[LZX_PRETREE_NUM_ELEMENTS];
+    USHORT PretreeCodes[LZX_PRETREE_NUM_ELEMENTS];
+    ULONG Items = 0;
+    ULONG i, Run;
+
+    for (i = 0; i < Count; )
+    {
+        if (Lengths[i] == 0)
+        {
+            for (Run = 1; (i + Run < Count) && (Lengths[i + Run] == 0) && (Run < 51); Run++);
+
+            if (Run >= 20)
+            {
+                Symbols[Items] = 18;
+                Extra[Items++] = (UCHAR)(Run - 20);
+                i += Run;
+                continue;
+            }
+
+            if (Run >= 4)
+            {
+                Symbols[Items] = 17;
+                Extra[Items++] = (UCHAR)(Run - 4);
+                i += Run;
+                continue;
+            }
+        }
+
+        Symbols[Items++] = (UCHAR)((PrevLengths[i] - Lengths[i] + 17) % 17);
+        i++;
+    }
+
+    memset(Frequencies, 0, sizeof(Frequencies));
+    for (i = 0; i < Items; i++)
+        Frequencies[Symbols[i]]++;
+
+    BuildLengths(Frequencies, LZX_PRETREE_NUM_ELEMENTS, 15, PretreeLengths);
+    BuildCodes(PretreeLengths, LZX_PRETREE_NUM_ELEMENTS, PretreeCodes);
+
+    for (i = 0; i < LZX_PRETREE_NUM_ELEMENTS; i++)
+        PutBits(Writer, PretreeLengths[i], 4);
+
+    for (i = 0; i < Items; i++)
+    {
+        PutBits(Writer, PretreeCodes[Symbols[i]], PretreeLengths[Symbols[i]]);
+        if (Symbols[i] == 17)
+            PutBits(Writer, Extra[i], 4);
+        else if (Symbols[i] == 18)
+            PutBits(Writer, Extra[i], 5);
+    }
+}
+
+
+bool CLZXCodec::WriteVerbatimBlock(PLZX_BIT_WRITER Writer, ULONG TokenCount, ULONG Length)
+/*
+ * FUNCTION: Writes the tokens of a frame as a verbatim block
+ * RETURNS:
+ *     false if the block does not fit in the writer, the code
+ *     lengths of the previous block are then left as they were
+ */
+{
+    ULONG MainFrequencies[LZX_MAINTREE_MAXSYMBOLS];
+    ULONG LengthFrequencies[LZX_NUM_SECONDARY_LENGTHS];
+    UCHAR NewMainLengths[LZX_MAINTREE_MAXSYMBOLS];
+    UCHAR NewLengthLengths[LZX_NUM_SECONDARY_LENGTHS];
+    USHORT MainCodes[LZX_MAINTREE_MAXSYMBOLS];
+    USHORT LengthCodes[LZX_NUM_SECONDARY_LENGTHS];
+    ULONG i, Slot, Header, Symbol, FormattedOffset;
+    PLZX_TOKEN Token;
+
+    memset(MainFrequencies, 0, sizeof(MainFrequencies));
+    memset(LengthFrequencies, 0, sizeof(LengthFrequencies));
+
+    for (i = 0; i < TokenCount; i++)
+    {
+        Token = &Tokens[i];
+        if (Token->Length == 0)
+        {
+            MainFrequencies[Token->Literal]++;
+            continue;
+        }
+
+        Slot   = GetPositionSlot(Token->Distance + 2);
+        Header = Token->Length - LZX_MIN_MATCH;
+        if (Header >= LZX_NUM_PRIMARY_LENGTHS)
+        {
+            LengthFrequencies[Header - LZX_NUM_PRIMARY_LENGTHS]++;
+            Header = LZX_NUM_PRIMARY_LENGTHS;
+        }
+        MainFrequencies[LZX_NUM_CHARS + (Slot << 3) + Header]++;
+    }
+
+    BuildLengths(MainFrequencies, MainElements, 16, NewMainLengths);
+    BuildLengths(LengthFrequencies, LZX_NUM_SECONDARY_LENGTHS, 16, NewLengthLengths);
+    BuildCodes(NewMainLengths, MainElements, MainCodes);
+    BuildCodes(NewLengthLengths, LZX_NUM_SECONDARY_LENGTHS, LengthCodes);
+
+    PutBits(Writer, LZX_BLOCKTYPE_VERBATIM, 3);
+    PutBits(Writer, Length >> 8, 16);
+    PutBits(Writer, Length & 0xFF, 8);
+
+    WriteLengths(Writer, NewMainLengths, MainLengths, LZX_NUM_CHARS);
+    WriteLengths(Writer, &NewMainLengths[LZX_NUM_CHARS], &MainLengths[LZX_NUM_CHARS],
+                 MainElements - LZX_NUM_CHARS);
+    WriteLengths(Writer, NewLengthLengths, LengthLengths, LZX_NUM_SECONDARY_LENGTHS);
+
+    for (i = 0; (i < TokenCount) && !Writer->Overflow; i++)
+    {
+        Token = &Tokens[i];
+        if (Token->Length == 0)
+        {
+            PutBits(Writer, MainCodes[Token->Literal], NewMainLengths[Token->Literal]);
+            continue;
+        }
+
+        FormattedOffset = Token->Distance + 2;
+        Slot   = GetPositionSlot(FormattedOffset);
+        Header = Token->Length - LZX_MIN_MATCH;
+
+        Symbol = LZX_NUM_CHARS + (Slot << 3) +
+                 ((Header >= LZX_NUM_PRIMARY_LENGTHS) ? LZX_NUM_PRIMARY_LENGTHS : Header);
+        PutBits(Writer, MainCodes[Symbol], NewMainLengths[Symbol]);
+
+        if (Header >= LZX_NUM_PRIMARY_LENGTHS)
+        {
+            Symbol = Header - LZX_NUM_PRIMARY_LENGTHS;
+            PutBits(Writer, LengthCodes[Symbol], NewLengthLengths[Symbol]);
+        }
+
+        PutBits(Writer, FormattedOffset - PositionBase[Slot], ExtraBits[Slot]);
+    }
+
+    if (Writer->Overflow)
+        return false;
+
+    memcpy(MainLengths, NewMainLengths, MainElements);
+    memcpy(LengthLengths, NewLengthLengths, LZX_NUM_SECONDARY_LENGTHS);
+    return true;
+}
+
+
+void CLZXCodec::WriteUncompressedBlock(PLZX_BIT_WRITER Writer, PUCHAR Data, ULONG Length)
+/*
+ * FUNCTION: Stores a frame that does not compress
+ */
+{
+    ULONG i;
+
+    PutBits(Writer, LZX_BLOCKTYPE_UNCOMPRESSED, 3);
+    PutBits(Writer, Length >> 8, 16);
+    PutBits(Writer, Length & 0xFF, 8);
+    AlignBits(Writer);
+
+    /* R0, R1 and R2, the encoder does not use them */
+    for (i = 0; i < 3; i++)
+    {
+        PutLong(&Writer->Buffer[Writer->Position], 1);
+        Writer->Position += 4;
+    }
+
+    memcpy(&Writer->Buffer[Writer->Position], Data, Length);
+    Writer->Position += Length;
+}
+
+
+ULONG CLZXCodec::Compress(void* OutputBuffer,
+                          void* InputBuffer,
+                          ULONG InputLength,
+                          PULONG OutputLength)
+/*
+ * FUNCTION: Compresses data in a buffer
+ * ARGUMENTS:
+ *     OutputBuffer   = Pointer to buffer to place compressed data
+ *     InputBuffer    = Pointer to buffer with data to be compressed
+ *     InputLength    = Length of input buffer
+ *     OutputLength   = Address of buffer to place size of compressed data
+ * NOTES:    The output buffer must hold CAB_MAX_COMPRESSED_BLOCKSIZE bytes
+ */
+{
+    LZX_BIT_WRITER Writer;
+    LZX_BIT_WRITER Saved;
+    PUCHAR Data;
+    ULONG Position;
+    ULONG Shift;
+    ULONG TokenCount;
+
+    DPRINT(MAX_TRACE, ("InputLength (%u).\n", (UINT)InputLength));
+
+    if ((InputLength == 0) || (InputLength > CAB_BLOCKSIZE))
+        return CS_BADSTREAM;
+
+    if (!History)
+    {
+        History  = (PUCHAR)malloc(WindowSize * 2);
+        HashHead = (PULONG)calloc((size_t)1 << LZX_HASH_BITS, sizeof(ULONG));
+        HashPrev = (PULONG)malloc(WindowSize * sizeof(ULONG));
+        Tokens   = (PLZX_TOKEN)malloc(CAB_BLOCKSIZE * sizeof(LZX_TOKEN));
+        if (!History || !HashHead || !HashPrev || !Tokens)
+        {
+            DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+            Free();
+            return CS_NOMEMORY;
+        }
+    }
+
+    if (HistoryLength + InputLength > WindowSize * 2)
+    {
+        Shift = HistoryLength - WindowSize;
+        memmove(History, &History[Shift], WindowSize);
+        HistoryBase  += Shift;
+        HistoryLength = WindowSize;
+    }
+
+    Data = &History[HistoryLength];
+    memcpy(Data, InputBuffer, InputLength);
+    HistoryLength += InputLength;
+    Position = HistoryBase + HistoryLength - InputLength;
+
+    Writer.Buffer   = (PUCHAR)OutputBuffer;
+    Writer.Position = 0;
+    Writer.Limit    = CAB_MAX_COMPRESSED_BLOCKSIZE;
+    Writer.Bits     = 0;
+    Writer.BitCount = 0;
+    Writer.Overflow = false;
+
+    if (!HeaderDone)
+    {
+        E8FileSize = LZX_E8_TRANSLATION_SIZE;
+        PutBits(&Writer, 1, 1);
+        PutBits(&Writer, E8FileSize >> 16, 16);
+        PutBits(&Writer, E8FileSize & 0xFFFF, 16);
+        HeaderDone = true;
+    }
+
+    TranslateE8(Data, InputLength);
+    TokenCount = Tokenize(Position, Position + InputLength);
+
+    /* Fall back to an uncompressed block if that is smaller */
+    Saved = Writer;
+    Writer.Limit = Writer.Position + InputLength + 16;
+    if (!WriteVerbatimBlock(&Writer, TokenCount, InputLength))
+    {
+        Writer = Saved;
+        WriteUncompressedBlock(&Writer, Data, InputLength);
+    }
+    FlushBits(&Writer);
+
+    *OutputLength = Writer.Position;
+
+    return CS_SUCCESS;
+}
+
+
+/* Decompression */
+
+bool CLZXCodec::MakeDecodeTable(ULONG Symbols, ULONG TableBits, PUCHAR Lengths, PUSHORT Table)
+/*
+ * FUNCTION: Builds a fast lookup table for a Huffman code. Codes up to
+ *           TableBits long are looked up directly, the entries of longer
+ *           ones point to a binary tree following the table
+ * RETURNS:
+ *     false if the code lengths do not make a valid code
+ */
+{
+    USHORT Symbol;
+    ULONG Leaf;
+    UCHAR BitNumber = 1;
+    ULONG Fill;
+    ULONG Position   = 0;
+    ULONG TableMask  = 1 << TableBits;
+    ULONG BitMask    = TableMask >> 1;
+    ULONG NextSymbol = BitMask;
+
+    while (BitNumber <= TableBits)
+    {
+        for (Symbol = 0; Symbol < Symbols; Symbol++)
+        {
+            if (Lengths[Symbol] == BitNumber)
+            {
+                Leaf = Position;
+
+                if ((Position += BitMask) > TableMask)
+                    return false;
+
+                for (Fill = BitMask; Fill-- > 0; )
+                    Table[Leaf++] = Symbol;
+            }
+        }
+        BitMask >>= 1;
+        BitNumber++;
+    }
+
+    if (Position != TableMask)
+    {
+        for (Symbol = (USHORT)Position; Symbol < TableMask; Symbol++)
+            Table[Symbol] = 0;
+
+        Position  <<= 16;
+        TableMask <<= 16;
+        BitMask     = 1 << 15;
+
+        while (BitNumber <= 16)
+        {
+            for (Symbol = 0; Symbol < Symbols; Symbol++)
+            {
+                if (Lengths[Symbol] == BitNumber)
+                {
+                    Leaf = Position >> 16;
+                    for (Fill = 0; Fill < BitNumber - TableBits; Fill++)
+                    {
+                        if (Table[Leaf] == 0)
+                        {
+                            Table[(NextSymbol << 1)] = 0;
+                            Table[(NextSymbol << 1) + 1] = 0;
+                            Table[Leaf] = (USHORT)NextSymbol++;
+                        }
+                        Leaf = Table[Leaf] << 1;
+                        if ((Position >> (15 - Fill)) & 1)
+                            Leaf++;
+                    }
+                    Table[Leaf] = Symbol;
+
+                    if ((Position += BitMask) > TableMask)
+                        return false;
+                }
+            }
+            BitMask >>= 1;
+            BitNumber++;
+        }
+    }
+
+    if (Position == TableMask)
+        return true;
+
+    /* An empty code is fine too */
+    for (Symbol = 0; Symbol < Symbols; Symbol++)
+    {
+        if (Lengths[Symbol] != 0)
+            return false;
+    }
+
+    return true;
+}
+
+
+void CLZXCodec::EnsureBits(PLZX_BIT_READER Reader, LONG Count)
+{
+    ULONG Word;
+
+    while (Reader->BitCount < Count)
+    {
+        /* Reading past the end gives zeroes, the callers check for it */
+        if (Reader->Position + 1 < Reader->End)
+            Word = Reader->Position[0] | (Reader->Position[1] << 8);
+        else if (Reader->Position < Reader->End)
+            Word = Reader->Position[0];
+        else
+            Word = 0;
+
+        Reader->Bits |= Word << (16 - Reader->BitCount);
+        Reader->BitCount += 16;
+        Reader->Position += 2;
+    }
+}
+
+
+ULONG CLZXCodec::ReadBits(PLZX_BIT_READER Reader, LONG Count)
+{
+    ULONG Value;
+
+    if (Count == 0)
+        return 0;
+
+    EnsureBits(Reader, Count);
+    Value = Reader->Bits >> (32 - Count);
+    Reader->Bits <<= Count;
+    Reader->BitCount -= Count;
+
+    return Value;
+}
+
+
+bool CLZXCodec::ReadSymbol(PLZX_BIT_READER Reader, PUSHORT Table, ULONG TableBits,
+                           PUCHAR Lengths, ULONG Symbols, PULONG Symbol)
+{
+    ULONG i, j;
+
+    EnsureBits(Reader, 16);
+
+    i = Table[Reader->Bits >> (32 - TableBits)];
+    if (i >= Symbols)
+    {
+        j = 1 << (32 - TableBits);
+        do
+        {
+            j >>= 1;
+            i <<= 1;
+            i |= (Reader->Bits & j) ? 1 : 0;
+            if (!j)
+                return false;
+        } while ((i = Table[i]) >= Symbols);
+    }
+
+    *Symbol = i;
+    Reader->Bits <<= Lengths[i];
+    Reader->BitCount -= Lengths[i];
+
+    return true;
+}
+
+
+bool CLZXCodec::ReadLengths(PLZX_BIT_READER Reader, PUCHAR Lengths, ULONG First, ULONG Last)
+/*
+ * FUNCTION: Reads code lengths written through a pretree
+ */
+{
+    ULONG x, y, z;
+    LONG Value;
+
+    for (x = 0; x < LZX_PRETREE_NUM_ELEMENTS; x++)
+        PretreeLengths[x] = (UCHAR)ReadBits(Reader, 4);
+
+    if (!MakeDecodeTable(LZX_PRETREE_MAXSYMBOLS, LZX_PRETREE_TABLEBITS, PretreeLengths, PretreeTable))
+        return false;
+
+    /* A run may go up to 50 lengths past Last, the tables have room for it */
+    for (x = First; x < Last; )
+    {
+        if (!ReadSymbol(Reader, PretreeTable, LZX_PRETREE_TABLEBITS, PretreeLengths, LZX_PRETREE_MAXSYMBOLS, &z))
+            return false;
+
+        if (z == 17)
+        {
+            y = ReadBits(Reader, 4) + 4;
+            while (y--)
+                Lengths[x++] = 0;
+        }
+        else if (z == 18)
+        {
+            y = ReadBits(Reader, 5) + 20;
+            while (y--)
+                Lengths[x++] = 0;
+        }
+        else if (z == 19)
+        {
+            y = ReadBits(Reader, 1) + 4;
+            if (!ReadSymbol(Reader, PretreeTable, LZX_PRETREE_TABLEBITS, PretreeLengths, LZX_PRETREE_MAXSYMBOLS, &z))
+                return false;
+            Value = Lengths[x] - (LONG)z;
+            if (Value < 0)
+                Value += 17;
+            while (y--)
+                Lengths[x++] = (UCHAR)Value;
+        }
+        else
+        {
+            Value = Lengths[x] - (LONG)z;
+            if (Value < 0)
+                Value += 17;
+            Lengths[x++] = (UCHAR)Value;
+        }
+    }
+
+    return true;
+}
+
+
+void CLZXCodec::UndoE8(PUCHAR Data, ULONG Length)
+/*
+ * FUNCTION: Turns the absolute call targets back into relative ones
+ */
+{
+    LONG CurrentPosition;
+    LONG Absolute;
+    ULONG i;
+
+    if ((FramesDone++ >= 32768) || (E8FileSize == 0))
+        return;
+
+    CurrentPosition = E8Position;
+    E8Position += Length;
+
+    if ((Length <= 6) || !E8Started)
+        return;
+
+    for (i = 0; i + 10 < Length; )
+    {
+        if (Data[i++] != 0xE8)
+        {
+            CurrentPosition++;
+            continue;
+        }
+
+        Absolute = GetLong(&Data[i]);
+        if ((Absolute >= -CurrentPosition) && (Absolute < E8FileSize))
+        {
+            if (Absolute >= 0)
+                PutLong(&Data[i], Absolute - CurrentPosition);
+            else
+                PutLong(&Data[i], Absolute + E8FileSize);
+        }
+
+        i += 4;
+        CurrentPosition += 5;
+    }
+}
+
+
+ULONG CLZXCodec::Uncompress(void* OutputBuffer,
+                            void* InputBuffer,
+                            ULONG InputLength,
+                            PULONG OutputLength)
+/*
+ * FUNCTION: Uncompresses data in a buffer
+ * ARGUMENTS:
+ *     OutputBuffer = Pointer to buffer to place uncompressed data
+ *     InputBuffer  = Pointer to buffer with data to be uncompressed
+ *     InputLength  = Length of input buffer
+ *     OutputLength = Address of buffer with the uncompressed size of the
+ *                    block, as given by its CFDATA structure
+ */
+{
+    LZX_BIT_READER Reader;
+    PUCHAR RunSource, RunDestination;
+    ULONG OutputSize = *OutputLength;
+    ULONG MainElement, MatchLength, MatchOffset;
+    ULONG Footer, Extra, CopyLength;
+    ULONG i, j;
+    LONG ToGo, ThisRun;
+
+    DPRINT(MAX_TRACE, ("InputLength (%u).\n", (UINT)InputLength));
+
+    if ((OutputSize == 0) || (OutputSize > CAB_BLOCKSIZE))
+    {
+        DPRINT(MID_TRACE, ("Bad LZX block size (%u).\n", (UINT)OutputSize));
+        return CS_BADSTREAM;
+    }
+
+    if (!Window)
+    {
+        Window = (PUCHAR)calloc(1, WindowSize);
+        if (!Window)
+        {
+            DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+            return CS_NOMEMORY;
+        }
+    }
+
+    Reader.Position = (PUCHAR)InputBuffer;
+    Reader.End      = Reader.Position + InputLength;
+    Reader.Bits     = 0;
+    Reader.BitCount = 0;
+
+    if (!HeaderDone)
+    {
+        i = j = 0;
+        if (ReadBits(&Reader, 1))
+        {
+            i = ReadBits(&Reader, 16);
+            j = ReadBits(&Reader, 16);
+        }
+        E8FileSize = (LONG)((i << 16) | j);
+        HeaderDone = true;
+    }
+
+    ToGo = (LONG)OutputSize;
+    while (ToGo > 0)
+    {
+        if (BlockRemaining == 0)
+        {
+            if (BlockType == LZX_BLOCKTYPE_UNCOMPRESSED)
+            {
+                if (BlockLength & 1)
+                    Reader.Position++;
+                Reader.Bits     = 0;
+                Reader.BitCount = 0;
+            }
+
+            BlockType = ReadBits(&Reader, 3);
+            i = ReadBits(&Reader, 16);
+            j = ReadBits(&Reader, 8);
+            BlockRemaining = BlockLength = (i << 8) | j;
+
+            switch (BlockType)
+            {
+                case LZX_BLOCKTYPE_ALIGNED:
+                    for (i = 0; i < LZX_ALIGNED_NUM_ELEMENTS; i++)
+                        AlignedLengths[i] = (UCHAR)ReadBits(&Reader, 3);
+                    if (!MakeDecodeTable(LZX_ALIGNED_MAXSYMBOLS, LZX_ALIGNED_TABLEBITS, AlignedLengths, AlignedTable))
+                        return CS_BADSTREAM;
+                    /* The rest of the header is the same as for verbatim blocks */
+
+                case LZX_BLOCKTYPE_VERBATIM:
+                    if (!ReadLengths(&Reader, MainTreeLengths, 0, LZX_NUM_CHARS) ||
+                        !ReadLengths(&Reader, MainTreeLengths, LZX_NUM_CHARS, MainElements))
+                        return CS_BADSTREAM;
+                    if (!MakeDecodeTable(LZX_MAINTREE_MAXSYMBOLS, LZX_MAINTREE_TABLEBITS, MainTreeLengths, MainTable))
+                        return CS_BADSTREAM;
+                    if (MainTreeLengths[0xE8] != 0)
+                        E8Started = true;
+
+                    if (!ReadLengths(&Reader, LengthTreeLengths, 0, LZX_NUM_SECONDARY_LENGTHS))
+                        return CS_BADSTREAM;
+                    if (!MakeDecodeTable(LZX_LENGTH_MAXSYMBOLS, LZX_LENGTH_TABLEBITS, LengthTreeLengths, LengthTable))
+                        return CS_BADSTREAM;
+                    break;
+
+                case LZX_BLOCKTYPE_UNCOMPRESSED:
+                    E8Started = true;
+                    EnsureBits(&Reader, 16);
+                    if (Reader.BitCount > 16)
+                        Reader.Position -= 2;
+                    if (Reader.Position + 12 > Reader.End)
+                        return CS_BADSTREAM;
+                    R0 = (ULONG)GetLong(&Reader.Position[0]);
+                    R1 = (ULONG)GetLong(&Reader.Position[4]);
+                    R2 = (ULONG)GetLong(&Reader.Position[8]);
+                    Reader.Position += 12;
+                    break;
+
+                default:
+                    DPRINT(MID_TRACE, ("Bad LZX block type (%u).\n", (UINT)BlockType));
+                    return CS_BADSTREAM;
+            }
+        }
+
+        /* The last symbols of a frame may be less than 16 bits long, the
+           table reads can go up to a word past the end but no further */
+        if ((Reader.Position > Reader.End) &&
+            ((Reader.Position > Reader.End + 2) || (Reader.BitCount < 16)))
+            return CS_BADSTREAM;
+
+        while (((ThisRun = (LONG)BlockRemaining) > 0) && (ToGo > 0))
+        {
+            if (ThisRun > ToGo)
+                ThisRun = ToGo;
+            ToGo -= ThisRun;
+            BlockRemaining -= ThisRun;
+
+            /* Runs can't straddle the wraparound of the window */
+            WindowPosition &= WindowSize - 1;
+            if (WindowPosition + ThisRun > WindowSize)
+                return CS_BADSTREAM;
+
+            if (BlockType == LZX_BLOCKTYPE_UNCOMPRESSED)
+            {
+                if (Reader.Position + ThisRun > Reader.End)
+                    return CS_BADSTREAM;
+                memcpy(&Window[WindowPosition], Reader.Position, ThisRun);
+                Reader.Position += ThisRun;
+                WindowPosition  += ThisRun;
+                continue;
+            }
+
+            while (ThisRun > 0)
+            {
+                if (!ReadSymbol(&Reader, MainTable, LZX_MAINTREE_TABLEBITS, MainTreeLengths,
+                                LZX_MAINTREE_MAXSYMBOLS, &MainElement))
+                    return CS_BADSTREAM;
+
+                if (MainElement < LZX_NUM_CHARS)
+                {
+                    Window[WindowPosition++] = (UCHAR)MainElement;
+                    ThisRun--;
+                    continue;
+                }
+
+                MainElement -= LZX_NUM_CHARS;
+
+                MatchLength = MainElement & LZX_NUM_PRIMARY_LENGTHS;
+                if (MatchLength == LZX_NUM_PRIMARY_LENGTHS)
+                {
+                    if (!ReadSymbol(&Reader, LengthTable, LZX_LENGTH_TABLEBITS, LengthTreeLengths,
+                                    LZX_LENGTH_MAXSYMBOLS, &Footer))
+                        return CS_BADSTREAM;
+                    MatchLength += Footer;
+                }
+                MatchLength += LZX_MIN_MATCH;
+
+                MatchOffset = MainElement >> 3;
+                if (MatchOffset > 2)
+                {
+                    Extra = ExtraBits[MatchOffset];
+                    MatchOffset = PositionBase[MatchOffset] - 2;
+
+                    if ((BlockType == LZX_BLOCKTYPE_ALIGNED) && (Extra >= 3))
+                    {
+                        /* The low 3 bits are Huffman coded */
+                        MatchOffset += ReadBits(&Reader, Extra - 3) << 3;
+                        if (!ReadSymbol(&Reader, AlignedTable, LZX_ALIGNED_TABLEBITS, AlignedLengths,
+                                        LZX_ALIGNED_MAXSYMBOLS, &Footer))
+                            return CS_BADSTREAM;
+                        MatchOffset += Footer;
+                    }
+                    else
+                    {
+                        MatchOffset += ReadBits(&Reader, Extra);
+                    }
+
+                    R2 = R1;
+                    R1 = R0;
+                    R0 = MatchOffset;
+                }
+                else if (MatchOffset == 0)
+                {
+                    MatchOffset = R0;
+                }
+                else if (MatchOffset == 1)
+                {
+                    MatchOffset = R1;
+                    R1 = R0;
+                    R0 = MatchOffset;
+                }
+                else
+                {
+                    MatchOffset = R2;
+                    R2 = R0;
+                    R0 = MatchOffset;
+                }
+
+                if ((MatchOffset > WindowSize) || (WindowPosition + MatchLength > WindowSize))
+                    return CS_BADSTREAM;
+
+                RunDestination = &Window[WindowPosition];
+                ThisRun -= (LONG)MatchLength;
+
+                /* Copy any wrapped around source data first */
+                if (WindowPosition >= MatchOffset)
+                {
+                    RunSource = RunDestination - MatchOffset;
+                }
+                else
+                {
+                    RunSource = RunDestination + (WindowSize - MatchOffset);
+                    CopyLength = MatchOffset - WindowPosition;
+                    if (CopyLength < MatchLength)
+                    {
+                        MatchLength    -= CopyLength;
+                        WindowPosition += CopyLength;
+                        while (CopyLength-- > 0)
+                            *RunDestination++ = *RunSource++;
+                        RunSource = Window;
+                    }
+                }
+                WindowPosition += MatchLength;
+
+                while (MatchLength-- > 0)
+                    *RunDestination++ = *RunSource++;
+            }
+        }
+    }
+
+    if (ToGo != 0)
+        return CS_BADSTREAM;
+
+    memcpy(OutputBuffer, &Window[(WindowPosition ? WindowPosition : WindowSize) - OutputSize], OutputSize);
+    UndoE8((PUCHAR)OutputBuffer, OutputSize);
+
+    *OutputLength = OutputSize;
+
+    return CS_SUCCESS;
+}
+
+/* EOF */
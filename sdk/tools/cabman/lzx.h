@@ -0,0 +1,165 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS cabinet manager
+ * FILE:        tools/cabman/lzx.h
+ * PURPOSE:     CAB codec for LZX compressed data
+ */
+
+#pragma once
+
+#include "cabinet.h"
+
+#define LZX_MIN_WINDOW_BITS         15
+#define LZX_MAX_WINDOW_BITS         21
+#define LZX_DEFAULT_WINDOW_BITS     21
+
+#define LZX_MIN_MATCH               2
+#define LZX_MAX_MATCH               257
+#define LZX_NUM_CHARS               256
+#define LZX_NUM_PRIMARY_LENGTHS     7
+#define LZX_NUM_SECONDARY_LENGTHS   249
+#define LZX_PRETREE_NUM_ELEMENTS    20
+#define LZX_ALIGNED_NUM_ELEMENTS    8
+#define LZX_MAX_POSITION_SLOTS      51
+
+#define LZX_BLOCKTYPE_VERBATIM      1
+#define LZX_BLOCKTYPE_ALIGNED       2
+#define LZX_BLOCKTYPE_UNCOMPRESSED  3
+
+/* Huffman tables */
+#define LZX_PRETREE_MAXSYMBOLS      LZX_PRETREE_NUM_ELEMENTS
+#define LZX_PRETREE_TABLEBITS       6
+#define LZX_MAINTREE_MAXSYMBOLS     (LZX_NUM_CHARS + 50 * 8)
+#define LZX_MAINTREE_TABLEBITS      12
+#define LZX_LENGTH_MAXSYMBOLS       (LZX_NUM_SECONDARY_LENGTHS + 1)
+#define LZX_LENGTH_TABLEBITS        12
+#define LZX_ALIGNED_MAXSYMBOLS      LZX_ALIGNED_NUM_ELEMENTS
+#define LZX_ALIGNED_TABLEBITS       7
+#define LZX_LENTABLE_SAFETY         64
+
+/* Size of the input for the E8 call translation, the one makecab uses */
+#define LZX_E8_TRANSLATION_SIZE     12000000
+
+/* Match finder */
+#define LZX_HASH_BITS               16
+#define LZX_MAX_CHAIN               128
+#define LZX_NICE_MATCH              128
+#define LZX_TOO_FAR                 4096    /* Farthest worthwhile 3 byte match */
+
+
+/* Classes */
+
+class CLZXCodec : public CCABCodec
+{
+public:
+    /* Default constructor */
+    CLZXCodec();
+    /* Default destructor */
+    virtual ~CLZXCodec();
+    /* Starts a new folder */
+    virtual ULONG Reset(USHORT CompressionType);
+    /* Compresses a data block */
+    virtual ULONG Compress(void* OutputBuffer,
+                           void* InputBuffer,
+                           ULONG InputLength,
+                           PULONG OutputLength);
+    /* Uncompresses a data block */
+    virtual ULONG Uncompress(void* OutputBuffer,
+                             void* InputBuffer,
+                             ULONG InputLength,
+                             PULONG OutputLength);
+private:
+    typedef struct _LZX_TOKEN
+    {
+        USHORT Length;      /* 0 for a literal */
+        USHORT Literal;
+        ULONG Distance;
+    } LZX_TOKEN, *PLZX_TOKEN;
+
+    typedef struct _LZX_BIT_WRITER
+    {
+        PUCHAR Buffer;
+        ULONG Position;
+        ULONG Limit;
+        ULONG Bits;
+        ULONG BitCount;
+        bool Overflow;
+    } LZX_BIT_WRITER, *PLZX_BIT_WRITER;
+
+    typedef struct _LZX_BIT_READER
+    {
+        PUCHAR Position;
+        PUCHAR End;
+        ULONG Bits;
+        LONG BitCount;
+    } LZX_BIT_READER, *PLZX_BIT_READER;
+
+    void Free();
+
+    /* Compression */
+    void TranslateE8(PUCHAR Data, ULONG Length);
+    ULONG GetPositionSlot(ULONG FormattedOffset);
+    void InsertHash(ULONG Position);
+    ULONG FindMatch(ULONG Position, ULONG End, PULONG Distance);
+    ULONG Tokenize(ULONG Position, ULONG End);
+    static void BuildLengths(PULONG Frequencies, ULONG Count, ULONG MaxBits, PUCHAR Lengths);
+    static void BuildCodes(PUCHAR Lengths, ULONG Count, PUSHORT Codes);
+    static void PutBits(PLZX_BIT_WRITER Writer, ULONG Value, ULONG Count);
+    static void AlignBits(PLZX_BIT_WRITER Writer);
+    static void FlushBits(PLZX_BIT_WRITER Writer);
+    static void WriteLengths(PLZX_BIT_WRITER Writer, PUCHAR Lengths, PUCHAR PrevLengths, ULONG Count);
+    bool WriteVerbatimBlock(PLZX_BIT_WRITER Writer, ULONG TokenCount, ULONG Length);
+    void WriteUncompressedBlock(PLZX_BIT_WRITER Writer, PUCHAR Data, ULONG Length);
+
+    /* Decompression */
+    static bool MakeDecodeTable(ULONG Symbols, ULONG TableBits, PUCHAR Lengths, PUSHORT Table);
+    static void EnsureBits(PLZX_BIT_READER Reader, LONG Count);
+    static ULONG ReadBits(PLZX_BIT_READER Reader, LONG Count);
+    static bool ReadSymbol(PLZX_BIT_READER Reader, PUSHORT Table, ULONG TableBits,
+                           PUCHAR Lengths, ULONG Symbols, PULONG Symbol);
+    bool ReadLengths(PLZX_BIT_READER Reader, PUCHAR Lengths, ULONG First, ULONG Last);
+    void UndoE8(PUCHAR Data, ULONG Length);
+
+    ULONG WindowBits;
+    ULONG WindowSize;
+    ULONG PositionSlots;
+    ULONG MainElements;
+    ULONG PositionBase[LZX_MAX_POSITION_SLOTS + 1];
+    UCHAR ExtraBits[LZX_MAX_POSITION_SLOTS + 1];
+
+    /* Stream header and E8 translation, handled the same way on both sides */
+    bool HeaderDone;
+    ULONG FramesDone;
+    LONG E8FileSize;
+    LONG E8Position;
+    bool E8Started;
+
+    /* Encoder state. The frame being compressed is appended to the
+       history, which keeps at least a window of data in front of it */
+    PUCHAR History;
+    ULONG HistoryBase;          /* Folder offset of History[0] */
+    ULONG HistoryLength;
+    PULONG HashHead;
+    PULONG HashPrev;
+    PLZX_TOKEN Tokens;
+    UCHAR MainLengths[LZX_MAINTREE_MAXSYMBOLS];
+    UCHAR LengthLengths[LZX_NUM_SECONDARY_LENGTHS];
+
+    /* Decoder state */
+    PUCHAR Window;
+    ULONG WindowPosition;
+    ULONG R0, R1, R2;
+    ULONG BlockType;
+    ULONG BlockLength;
+    ULONG BlockRemaining;
+    USHORT PretreeTable[(1 << LZX_PRETREE_TABLEBITS) + (LZX_PRETREE_MAXSYMBOLS << 1)];
+    UCHAR PretreeLengths[LZX_PRETREE_MAXSYMBOLS + LZX_LENTABLE_SAFETY];
+    USHORT MainTable[(1 << LZX_MAINTREE_TABLEBITS) + (LZX_MAINTREE_MAXSYMBOLS << 1)];
+    UCHAR MainTreeLengths[LZX_MAINTREE_MAXSYMBOLS + LZX_LENTABLE_SAFETY];
+    USHORT LengthTable[(1 << LZX_LENGTH_TABLEBITS) + (LZX_LENGTH_MAXSYMBOLS << 1)];
+    UCHAR LengthTreeLengths[LZX_LENGTH_MAXSYMBOLS + LZX_LENTABLE_SAFETY];
+    USHORT AlignedTable[(1 << LZX_ALIGNED_TABLEBITS) + (LZX_ALIGNED_MAXSYMBOLS << 1)];
+    UCHAR AlignedLengths[LZX_ALIGNED_MAXSYMBOLS + LZX_LENTABLE_SAFETY];
+};
+
+/* EOF */
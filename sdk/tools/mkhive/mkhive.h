@@ -105,6 +105,10 @@ RegOpenKeyW(
     IN LPCWSTR lpSubKey,
     OUT PHKEY phkResult);
 
+LONG WINAPI
+RegCloseKey(
+    IN HKEY hKey);
+
 #define CMLIB_HOST
 #include <cmlib.h>
 #include <infhost.h>
@@ -392,12 +392,13 @@ static BOOL
 registry_callback(HINF hInf, PWCHAR Section, BOOL Delete)
 {
     WCHAR Buffer[MAX_INF_STRING_LENGTH];
+    WCHAR KeyName[MAX_INF_STRING_LENGTH];
     PWCHAR ValuePtr;
     ULONG Flags;
     size_t Length;
 
     PINFCONTEXT Context = NULL;
-    HKEY KeyHandle;
+    HKEY KeyHandle = NULL;
     BOOL Ok;
 
 
@@ -433,21 +434,36 @@ registry_callback(HINF hInf, PWCHAR Section, BOOL Delete)
 
         DPRINT("Flags: 0x%x\n", Flags);
 
-        if (Delete || (Flags & FLG_ADDREG_OVERWRITEONLY))
+        /*
+         * Most lines add a value to the same key as the line before,
+         * keep that key open instead of looking up its path again.
+         */
+        if (!KeyHandle || strcmpiW(Buffer, KeyName))
         {
-            if (RegOpenKeyW(NULL, Buffer, &KeyHandle) != ERROR_SUCCESS)
+            if (KeyHandle)
             {
-                DPRINT("RegOpenKey(%S) failed\n", Buffer);
-                continue;  /* ignore if it doesn't exist */
+                RegCloseKey(KeyHandle);
+                KeyHandle = NULL;
             }
-        }
-        else
-        {
-            if (RegCreateKeyW(NULL, Buffer, &KeyHandle) != ERROR_SUCCESS)
+
+            if (Delete || (Flags & FLG_ADDREG_OVERWRITEONLY))
             {
-                DPRINT("RegCreateKey(%S) failed\n", Buffer);
-                continue;
+                if (RegOpenKeyW(NULL, Buffer, &KeyHandle) != ERROR_SUCCESS)
+                {
+                    DPRINT("RegOpenKey(%S) failed\n", Buffer);
+                    continue;  /* ignore if it doesn't exist */
+                }
             }
+            else
+            {
+                if (RegCreateKeyW(NULL, Buffer, &KeyHandle) != ERROR_SUCCESS)
+                {
+                    DPRINT("RegCreateKey(%S) failed\n", Buffer);
+                    continue;
+                }
+            }
+
+            strcpyW(KeyName, Buffer);
         }
 
         /* get value name */
@@ -463,10 +479,14 @@ registry_callback(HINF hInf, PWCHAR Section, BOOL Delete)
         /* and now do it */
         if (!do_reg_operation(KeyHandle, ValuePtr, Context, Flags))
         {
+            RegCloseKey(KeyHandle);
             return FALSE;
         }
     }
 
+    if (KeyHandle)
+        RegCloseKey(KeyHandle);
+
     InfHostFreeContext(Context);
 
     return TRUE;
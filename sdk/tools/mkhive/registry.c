@@ -492,6 +492,15 @@ RegOpenKeyW(
     return RegpOpenOrCreateKey(hKey, lpSubKey, FALSE, FALSE, phkResult);
 }
 
+LONG WINAPI
+RegCloseKey(
+    IN HKEY hKey)
+{
+    /* Only the in-memory structure goes away, the key stays in its hive */
+    free(HKEY_TO_MEMKEY(hKey));
+    return ERROR_SUCCESS;
+}
+
 LONG WINAPI
 RegCreateKeyExW(
     IN HKEY hKey,
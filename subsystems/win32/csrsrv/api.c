@@ -23,6 +23,18 @@ UNICODE_STRING CsrApiPortName;
 volatile ULONG CsrpStaticThreadCount;
 volatile ULONG CsrpDynamicThreadTotal;
 extern ULONG CsrMaxApiRequestThreads;
+PCSR_API_COUNTERS CsrApiCounters[CSR_SERVER_DLL_MAX];
+LARGE_INTEGER CsrpPerformanceFrequency;
+
+/*
+ * The request threads grow as soon as fewer than CSR_MIN_IDLE_API_THREADS
+ * of them are left listening on the port, so a burst of calls finds one
+ * ready instead of waiting for it to be created. Dynamic threads that stay
+ * idle for CSR_IDLE_API_THREAD_TIMEOUT (in seconds) retire again, as long
+ * as that many are still left.
+ */
+#define CSR_MIN_IDLE_API_THREADS    2
+#define CSR_IDLE_API_THREAD_TIMEOUT 60
 
 /* FUNCTIONS ******************************************************************/
 
@@ -234,11 +246,63 @@ CsrApiHandleConnectionRequest(IN PCSR_API_MESSAGE ApiMessage)
     return Status;
 }
 
+/*++
+ * @name CsrpUpdateApiCounters
+ *
+ * The CsrpUpdateApiCounters routine accounts a completed CSR API call in
+ * the counters of its Server DLL.
+ *
+ * @param ServerId
+ *        Index of the Server DLL which handled the call.
+ *
+ * @param ApiId
+ *        API ID of the call, relative to the Server DLL's API base.
+ *
+ * @param StartTime
+ *        Performance counter value taken right before the call.
+ *
+ * @return None.
+ *
+ * @remarks None.
+ *
+ *--*/
+VOID
+NTAPI
+CsrpUpdateApiCounters(IN ULONG ServerId,
+                      IN ULONG ApiId,
+                      IN PLARGE_INTEGER StartTime)
+{
+    PCSR_API_COUNTERS Counters = CsrApiCounters[ServerId];
+    LARGE_INTEGER EndTime;
+    ULONGLONG Elapsed;
+    LONG Time, MaxTime;
+
+    if (!Counters || !CsrpPerformanceFrequency.QuadPart) return;
+    Counters += ApiId;
+
+    /* Get the elapsed time in microseconds */
+    NtQueryPerformanceCounter(&EndTime, NULL);
+    Elapsed = (ULONGLONG)(EndTime.QuadPart - StartTime->QuadPart) * 1000000 /
+              CsrpPerformanceFrequency.QuadPart;
+    Time = (Elapsed > MAXLONG) ? MAXLONG : (LONG)Elapsed;
+
+    InterlockedIncrement(&Counters->Calls);
+    InterlockedExchangeAdd(&Counters->TotalTime, Time);
+    if (Time >= CSR_SLOW_API_TIME) InterlockedIncrement(&Counters->SlowCalls);
+
+    /* Raise the maximum, unless another thread raised it further meanwhile */
+    do
+    {
+        MaxTime = Counters->MaxTime;
+        if (Time <= MaxTime) break;
+    } while (InterlockedCompareExchange(&Counters->MaxTime, Time, MaxTime) != MaxTime);
+}
+
 /*++
  * @name CsrpCheckRequestThreads
  *
- * The CsrpCheckRequestThreads routine checks if there are no more threads
- * to handle CSR API Requests, and creates a new thread if possible, to
+ * The CsrpCheckRequestThreads routine checks if there are too few threads
+ * left to handle CSR API Requests, and creates a new thread if possible, to
  * avoid starvation.
  *
  * @param None.
@@ -257,8 +321,8 @@ CsrpCheckRequestThreads(VOID)
     CLIENT_ID ClientId;
     NTSTATUS Status;
 
-    /* Decrease the count, and see if we're out */
-    if (InterlockedDecrementUL(&CsrpStaticThreadCount) == 0)
+    /* Decrease the count, and see if we're running short */
+    if (InterlockedDecrementUL(&CsrpStaticThreadCount) < CSR_MIN_IDLE_API_THREADS)
     {
         /* Check if we've still got space for a Dynamic Thread */
         if (CsrpDynamicThreadTotal < CsrMaxApiRequestThreads)
@@ -331,7 +395,8 @@ NTAPI
 CsrApiRequestThread(IN PVOID Parameter)
 {
     PTEB Teb = NtCurrentTeb();
-    LARGE_INTEGER TimeOut;
+    LARGE_INTEGER TimeOut, IdleTimeOut, StartTime;
+    PLARGE_INTEGER WaitTimeOut;
     PCSR_THREAD CurrentThread, CsrThread;
     NTSTATUS Status;
     CSR_REPLY_CODE ReplyCode;
@@ -374,6 +439,15 @@ CsrApiRequestThread(IN PVOID Parameter)
         /* Increase the Thread Counts */
         InterlockedIncrementUL(&CsrpStaticThreadCount);
         InterlockedIncrementUL(&CsrpDynamicThreadTotal);
+
+        /* We're the initial thread, we stay around for good */
+        WaitTimeOut = NULL;
+    }
+    else
+    {
+        /* We're a dynamic thread, we may retire when idle */
+        IdleTimeOut.QuadPart = -CSR_IDLE_API_THREAD_TIMEOUT * 1000 * 1000 * 10LL;
+        WaitTimeOut = &IdleTimeOut;
     }
 
     /* Now start the loop */
@@ -393,10 +467,29 @@ CsrApiRequestThread(IN PVOID Parameter)
         }
 
         /* Wait for a message to come through */
-        Status = NtReplyWaitReceivePort(ReplyPort,
-                                        &PortContext,
-                                        &ReplyMsg->Header,
-                                        &ReceiveMsg.Header);
+        Status = NtReplyWaitReceivePortEx(ReplyPort,
+                                          &PortContext,
+                                          &ReplyMsg->Header,
+                                          &ReceiveMsg.Header,
+                                          WaitTimeOut);
+
+        /* Nothing came through for a while, check if we can retire */
+        if (Status == STATUS_TIMEOUT)
+        {
+            /* Any reply has been sent already */
+            ReplyMsg = NULL;
+            ReplyPort = CsrApiPort;
+
+            /* Leave only if enough threads are still listening */
+            if (InterlockedDecrementUL(&CsrpStaticThreadCount) >= CSR_MIN_IDLE_API_THREADS)
+            {
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            InterlockedIncrementUL(&CsrpStaticThreadCount);
+            continue;
+        }
 
         /* Check if we didn't get success */
         if (Status != STATUS_SUCCESS)
@@ -583,7 +676,9 @@ CsrApiRequestThread(IN PVOID Parameter)
                     /* Call the API and get the reply code */
                     ReplyMsg = NULL;
                     ReplyPort = CsrApiPort;
+                    NtQueryPerformanceCounter(&StartTime, NULL);
                     ServerDll->DispatchTable[ApiId](&ReceiveMsg, &ReplyCode);
+                    CsrpUpdateApiCounters(ServerId, ApiId, &StartTime);
 
                     /* Increase the static thread count */
                     InterlockedIncrementUL(&CsrpStaticThreadCount);
@@ -808,7 +903,9 @@ CsrApiRequestThread(IN PVOID Parameter)
 
             /* Call the API, get the reply code and return the result */
             ReplyCode = CsrReplyImmediately;
+            NtQueryPerformanceCounter(&StartTime, NULL);
             ReplyMsg->Status = ServerDll->DispatchTable[ApiId](&ReceiveMsg, &ReplyCode);
+            CsrpUpdateApiCounters(ServerId, ApiId, &StartTime);
 
             /* Increase the static thread count */
             InterlockedIncrementUL(&CsrpStaticThreadCount);
@@ -858,6 +955,16 @@ CsrApiRequestThread(IN PVOID Parameter)
         _SEH2_END;
     }
 
+    /* We retired, drop out of the thread count and destroy our CSR Thread */
+    InterlockedDecrementUL(&CsrpDynamicThreadTotal);
+    if (CurrentThread)
+    {
+        CsrAcquireProcessLock();
+        CurrentThread->Flags |= CsrThreadTerminated;
+        CsrLockedDereferenceThread(CurrentThread);
+        CsrReleaseProcessLock();
+    }
+
     /* We're out of the loop for some reason, terminate! */
     NtTerminateThread(NtCurrentThread(), Status);
     return Status;
@@ -888,6 +995,7 @@ CsrApiPortInitialize(VOID)
     CLIENT_ID ClientId;
     PLIST_ENTRY ListHead, NextEntry;
     PCSR_THREAD ServerThread;
+    LARGE_INTEGER Counter;
 
     /* Calculate how much space we'll need for the Port Name */
     Size = CsrDirectoryName.Length + sizeof(CSR_PORT_NAME) + sizeof(WCHAR);
@@ -918,6 +1026,9 @@ CsrApiPortInitialize(VOID)
                                NULL,
                                NULL /* FIXME: Use the Security Descriptor */);
 
+    /* Get the performance counter frequency for the API counters */
+    NtQueryPerformanceCounter(&Counter, &CsrpPerformanceFrequency);
+
     /* Create the Port Object */
     Status = NtCreatePort(&CsrApiPort,
                           &ObjectAttributes,
@@ -33,6 +33,22 @@ extern RTL_CRITICAL_SECTION CsrProcessLock, CsrWaitListsLock;
 
 #define CSR_SERVER_DLL_MAX  4
 
+/*
+ * Per-API call counters, one array per loaded Server DLL, indexed by the
+ * API ID. Times are in microseconds. The counters wrap around, so look at
+ * the difference between two samples.
+ */
+typedef struct _CSR_API_COUNTERS
+{
+    volatile LONG Calls;
+    volatile LONG SlowCalls;
+    volatile LONG TotalTime;
+    volatile LONG MaxTime;
+} CSR_API_COUNTERS, *PCSR_API_COUNTERS;
+
+/* Calls taking longer than this many microseconds are counted as slow */
+#define CSR_SLOW_API_TIME   (100 * 1000)
+
 
 // Debug Flag
 extern ULONG CsrDebug;
@@ -52,6 +68,7 @@ extern PVOID CsrSrvSharedSectionHeap;
 extern PVOID *CsrSrvSharedStaticServerData;
 extern HANDLE CsrInitializationEvent;
 extern PCSR_SERVER_DLL CsrLoadedServerDll[CSR_SERVER_DLL_MAX];
+extern PCSR_API_COUNTERS CsrApiCounters[CSR_SERVER_DLL_MAX];
 extern ULONG CsrMaxApiRequestThreads;
 
 /****************************************************/
@@ -225,6 +225,16 @@ CsrLoadServerDll(IN PCHAR DllString,
             /* Save the pointer in our list */
             CsrLoadedServerDll[ServerDll->ServerId] = ServerDll;
 
+            /* Allocate its API counters. They are only statistics, so a
+               failure here is not fatal */
+            if (ServerDll->HighestApiSupported)
+            {
+                CsrApiCounters[ServerDll->ServerId] =
+                    RtlAllocateHeap(CsrHeap,
+                                    HEAP_ZERO_MEMORY,
+                                    ServerDll->HighestApiSupported * sizeof(CSR_API_COUNTERS));
+            }
+
             /* Does it use our generic heap? */
             if (ServerDll->SharedSection != CsrSrvSharedSectionHeap)
             {
@@ -0,0 +1,260 @@
+/*
+ * ReactOS Generic Framebuffer display driver
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "framebuf.h"
+
+/*
+ * GDI draws into a copy of the screen in system memory, so that the
+ * operations reading the destination don't read from the video memory.
+ * The drawing functions are hooked only to find out which part of the
+ * screen changed, and that part is then copied to the frame buffer.
+ */
+
+/*
+ * IntShadowFlush
+ *
+ * Copies a rectangle of the shadow surface to the frame buffer.
+ */
+
+VOID
+IntShadowFlush(
+   IN PPDEV ppdev,
+   IN RECTL *prcl)
+{
+   ULONG BytesPerPixel = (ppdev->BitsPerPixel + 7) >> 3;
+   ULONG Offset, Width;
+   PBYTE Source, Destination;
+   LONG y;
+
+   Offset = prcl->top * ppdev->ScreenDelta + prcl->left * BytesPerPixel;
+   Width = (prcl->right - prcl->left) * BytesPerPixel;
+   Source = (PBYTE)ppdev->ShadowPtr + Offset;
+   Destination = (PBYTE)ppdev->ScreenPtr + Offset;
+
+   /* Only sequential writes go to the frame buffer, so they can be combined */
+   for (y = prcl->top; y < prcl->bottom; y++)
+   {
+      memcpy(Destination, Source, Width);
+      Source += ppdev->ScreenDelta;
+      Destination += ppdev->ScreenDelta;
+   }
+}
+
+/*
+ * IntShadowUpdate
+ *
+ * Copies the part of a drawing operation's destination rectangle that can
+ * have changed. Nothing is done if the destination isn't the screen.
+ */
+
+static VOID
+IntShadowUpdate(
+   IN SURFOBJ *pso,
+   IN CLIPOBJ *pco,
+   IN RECTL *prcl)
+{
+   PPDEV ppdev = (PPDEV)pso->dhpdev;
+   RECTL Rect;
+
+   if (ppdev == NULL || ppdev->ShadowPtr == NULL || pso->hsurf != ppdev->hSurfEng)
+      return;
+
+   /* Stretched destinations can be upside down */
+   Rect.left = min(prcl->left, prcl->right);
+   Rect.right = max(prcl->left, prcl->right);
+   Rect.top = min(prcl->top, prcl->bottom);
+   Rect.bottom = max(prcl->top, prcl->bottom);
+
+   if (pco != NULL && pco->iDComplexity != DC_TRIVIAL)
+   {
+      Rect.left = max(Rect.left, pco->rclBounds.left);
+      Rect.top = max(Rect.top, pco->rclBounds.top);
+      Rect.right = min(Rect.right, pco->rclBounds.right);
+      Rect.bottom = min(Rect.bottom, pco->rclBounds.bottom);
+   }
+
+   Rect.left = max(Rect.left, 0);
+   Rect.top = max(Rect.top, 0);
+   Rect.right = min(Rect.right, (LONG)ppdev->ScreenWidth);
+   Rect.bottom = min(Rect.bottom, (LONG)ppdev->ScreenHeight);
+
+   if (Rect.left >= Rect.right || Rect.top >= Rect.bottom)
+      return;
+
+   IntShadowFlush(ppdev, &Rect);
+}
+
+BOOL APIENTRY
+DrvBitBlt(
+   IN SURFOBJ *psoTrg,
+   IN SURFOBJ *psoSrc,
+   IN SURFOBJ *psoMask,
+   IN CLIPOBJ *pco,
+   IN XLATEOBJ *pxlo,
+   IN RECTL *prclTrg,
+   IN POINTL *pptlSrc,
+   IN POINTL *pptlMask,
+   IN BRUSHOBJ *pbo,
+   IN POINTL *pptlBrush,
+   IN ROP4 rop4)
+{
+   BOOL Result;
+
+   Result = EngBitBlt(psoTrg, psoSrc, psoMask, pco, pxlo, prclTrg, pptlSrc,
+                      pptlMask, pbo, pptlBrush, rop4);
+   if (Result)
+      IntShadowUpdate(psoTrg, pco, prclTrg);
+
+   return Result;
+}
+
+BOOL APIENTRY
+DrvCopyBits(
+   OUT SURFOBJ *psoDest,
+   IN SURFOBJ *psoSrc,
+   IN CLIPOBJ *pco,
+   IN XLATEOBJ *pxlo,
+   IN RECTL *prclDest,
+   IN POINTL *pptlSrc)
+{
+   BOOL Result;
+
+   Result = EngCopyBits(psoDest, psoSrc, pco, pxlo, prclDest, pptlSrc);
+   if (Result)
+      IntShadowUpdate(psoDest, pco, prclDest);
+
+   return Result;
+}
+
+BOOL APIENTRY
+DrvStretchBltROP(
+   IN SURFOBJ *psoDest,
+   IN SURFOBJ *psoSrc,
+   IN SURFOBJ *psoMask,
+   IN CLIPOBJ *pco,
+   IN XLATEOBJ *pxlo,
+   IN COLORADJUSTMENT *pca,
+   IN POINTL *pptlHTOrg,
+   IN RECTL *prclDest,
+   IN RECTL *prclSrc,
+   IN POINTL *pptlMask,
+   IN ULONG iMode,
+   IN BRUSHOBJ *pbo,
+   IN DWORD rop4)
+{
+   BOOL Result;
+
+   Result = EngStretchBltROP(psoDest, psoSrc, psoMask, pco, pxlo, pca, pptlHTOrg,
+                             prclDest, prclSrc, pptlMask, iMode, pbo, rop4);
+   if (Result)
+      IntShadowUpdate(psoDest, pco, prclDest);
+
+   return Result;
+}
+
+BOOL APIENTRY
+DrvAlphaBlend(
+   IN SURFOBJ *psoDest,
+   IN SURFOBJ *psoSrc,
+   IN CLIPOBJ *pco,
+   IN XLATEOBJ *pxlo,
+   IN RECTL *prclDest,
+   IN RECTL *prclSrc,
+   IN BLENDOBJ *pBlendObj)
+{
+   BOOL Result;
+
+   Result = EngAlphaBlend(psoDest, psoSrc, pco, pxlo, prclDest, prclSrc, pBlendObj);
+   if (Result)
+      IntShadowUpdate(psoDest, pco, prclDest);
+
+   return Result;
+}
+
+BOOL APIENTRY
+DrvTransparentBlt(
+   IN SURFOBJ *psoDst,
+   IN SURFOBJ *psoSrc,
+   IN CLIPOBJ *pco,
+   IN XLATEOBJ *pxlo,
+   IN RECTL *prclDst,
+   IN RECTL *prclSrc,
+   IN ULONG iTransColor,
+   IN ULONG ulReserved)
+{
+   BOOL Result;
+
+   Result = EngTransparentBlt(psoDst, psoSrc, pco, pxlo, prclDst, prclSrc,
+                              iTransColor, ulReserved);
+   if (Result)
+      IntShadowUpdate(psoDst, pco, prclDst);
+
+   return Result;
+}
+
+BOOL APIENTRY
+DrvGradientFill(
+   IN SURFOBJ *psoDest,
+   IN CLIPOBJ *pco,
+   IN XLATEOBJ *pxlo,
+   IN TRIVERTEX *pVertex,
+   IN ULONG nVertex,
+   IN PVOID pMesh,
+   IN ULONG nMesh,
+   IN RECTL *prclExtents,
+   IN POINTL *pptlDitherOrg,
+   IN ULONG ulMode)
+{
+   BOOL Result;
+
+   Result = EngGradientFill(psoDest, pco, pxlo, pVertex, nVertex, pMesh, nMesh,
+                            prclExtents, pptlDitherOrg, ulMode);
+   if (Result)
+      IntShadowUpdate(psoDest, pco, prclExtents);
+
+   return Result;
+}
+
+BOOL APIENTRY
+DrvLineTo(
+   IN SURFOBJ *pso,
+   IN CLIPOBJ *pco,
+   IN BRUSHOBJ *pbo,
+   IN LONG x1,
+   IN LONG y1,
+   IN LONG x2,
+   IN LONG y2,
+   IN RECTL *prclBounds,
+   IN MIX mix)
+{
+   BOOL Result;
+   RECTL Bounds;
+
+   Result = EngLineTo(pso, pco, pbo, x1, y1, x2, y2, prclBounds, mix);
+   if (Result)
+   {
+      /* The bounds are inclusive of both ends */
+      Bounds.left = min(x1, x2);
+      Bounds.top = min(y1, y2);
+      Bounds.right = max(x1, x2) + 1;
+      Bounds.bottom = max(y1, y2) + 1;
+      IntShadowUpdate(pso, pco, &Bounds);
+   }
+
+   return Result;
+}
@@ -23,8 +23,8 @@
 /*
  * DrvEnableSurface
  *
- * Create engine bitmap around frame buffer and set the video mode requested
- * when PDEV was initialized.
+ * Create engine bitmap around a shadow of the frame buffer and set the video
+ * mode requested when PDEV was initialized.
  *
  * Status
  *    @implemented
@@ -38,6 +38,7 @@ DrvEnableSurface(
    HSURF hSurface;
    ULONG BitmapType;
    SIZEL ScreenSize;
+   FLONG Hooks = 0;
    VIDEO_MEMORY VideoMemory;
    VIDEO_MEMORY_INFORMATION VideoMemoryInfo;
    ULONG ulTemp;
@@ -96,11 +97,26 @@ DrvEnableSurface(
    ScreenSize.cx = ppdev->ScreenWidth;
    ScreenSize.cy = ppdev->ScreenHeight;
 
+   /*
+    * Draw into system memory and copy what changed to the frame buffer.
+    * Without the memory GDI draws into the frame buffer itself.
+    */
+
+   ppdev->ShadowPtr = EngAllocMem(FL_ZERO_MEMORY,
+                                  ppdev->ScreenDelta * ppdev->ScreenHeight,
+                                  ALLOC_TAG);
+   if (ppdev->ShadowPtr != NULL)
+   {
+      Hooks = SHADOW_HOOKS;
+   }
+
    hSurface = (HSURF)EngCreateBitmap(ScreenSize, ppdev->ScreenDelta, BitmapType,
                                      (ppdev->ScreenDelta > 0) ? BMF_TOPDOWN : 0,
-                                     ppdev->ScreenPtr);
+                                     ppdev->ShadowPtr ? ppdev->ShadowPtr : ppdev->ScreenPtr);
    if (hSurface == NULL)
    {
+      if (ppdev->ShadowPtr) EngFreeMem(ppdev->ShadowPtr);
+      ppdev->ShadowPtr = NULL;
       return FALSE;
    }
 
@@ -108,9 +124,11 @@ DrvEnableSurface(
     * Associate the surface with our device.
     */
 
-   if (!EngAssociateSurface(hSurface, ppdev->hDevEng, 0))
+   if (!EngAssociateSurface(hSurface, ppdev->hDevEng, Hooks))
    {
       EngDeleteSurface(hSurface);
+      if (ppdev->ShadowPtr) EngFreeMem(ppdev->ShadowPtr);
+      ppdev->ShadowPtr = NULL;
       return FALSE;
    }
 
@@ -140,6 +158,12 @@ DrvDisableSurface(
    EngDeleteSurface(ppdev->hSurfEng);
    ppdev->hSurfEng = NULL;
 
+   if (ppdev->ShadowPtr)
+   {
+      EngFreeMem(ppdev->ShadowPtr);
+      ppdev->ShadowPtr = NULL;
+   }
+
 #ifdef EXPERIMENTAL_MOUSE_CURSOR_SUPPORT
    /* Clear all mouse pointer surfaces. */
    DrvSetPointerShape(NULL, NULL, NULL, NULL, 0, 0, 0, 0, NULL, 0);
@@ -186,6 +210,13 @@ DrvAssertMode(
 	     IntSetPalette(dhpdev, ppdev->PaletteEntries, 0, 256);
       }
 
+      /* The frame buffer contents are gone after the mode set */
+      if (ppdev->ShadowPtr)
+      {
+         RECTL Rect = { 0, 0, ppdev->ScreenWidth, ppdev->ScreenHeight };
+         IntShadowFlush(ppdev, &Rect);
+      }
+
       return Result;
 
    }
@@ -768,6 +768,8 @@ VBEMapVideoMemory(
       FrameBuffer.QuadPart =
          DeviceExtension->ModeInfo[DeviceExtension->CurrentMode].PhysBasePtr;
       MapInformation->VideoRamBase = RequestedAddress->RequestedVirtualAddress;
+      /* The linear frame buffer is only written, so combine the writes */
+      inIoSpace |= VIDEO_MEMORY_SPACE_P6CACHE;
       if (DeviceExtension->VbeInfo.Version < 0x300)
       {
          MapInformation->VideoRamLength =
@@ -239,6 +239,61 @@ IntVideoPortMapPhysicalMemory(
 }
 
 
+static
+PVOID
+IntVideoPortMapUserWriteCombined(
+   IN PHYSICAL_ADDRESS PhysicalAddress,
+   IN ULONG SizeInBytes,
+   OUT PVOID *SystemAddress,
+   OUT PMDL *Mdl)
+{
+   PVOID KernelAddress;
+   PVOID UserAddress = NULL;
+   PMDL NewMdl;
+
+   /*
+    * Views of \Device\PhysicalMemory cannot be write combined, so describe
+    * the aperture with an MDL and map that into the current process.
+    */
+   KernelAddress = MmMapIoSpace(PhysicalAddress, SizeInBytes, MmWriteCombined);
+   if (KernelAddress == NULL)
+      return NULL;
+
+   NewMdl = IoAllocateMdl(KernelAddress, SizeInBytes, FALSE, FALSE, NULL);
+   if (NewMdl == NULL)
+   {
+      MmUnmapIoSpace(KernelAddress, SizeInBytes);
+      return NULL;
+   }
+   MmBuildMdlForNonPagedPool(NewMdl);
+
+   _SEH2_TRY
+   {
+      UserAddress = MmMapLockedPagesSpecifyCache(NewMdl,
+                                                 UserMode,
+                                                 MmWriteCombined,
+                                                 NULL,
+                                                 FALSE,
+                                                 NormalPagePriority);
+   }
+   _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+   {
+      UserAddress = NULL;
+   }
+   _SEH2_END;
+
+   if (UserAddress == NULL)
+   {
+      IoFreeMdl(NewMdl);
+      MmUnmapIoSpace(KernelAddress, SizeInBytes);
+      return NULL;
+   }
+
+   *SystemAddress = KernelAddress;
+   *Mdl = NewMdl;
+   return UserAddress;
+}
+
 PVOID NTAPI
 IntVideoPortMapMemory(
    IN PVIDEO_PORT_DEVICE_EXTENSION DeviceExtension,
@@ -253,6 +308,9 @@ IntVideoPortMapMemory(
    ULONG AddressSpace;
    PVOID MappedAddress;
    PLIST_ENTRY Entry;
+   MEMORY_CACHING_TYPE CacheType = MmNonCached;
+   PVOID SystemAddress = NULL;
+   PMDL Mdl = NULL;
 
    INFO_(VIDEOPRT, "- IoAddress: %lx\n", IoAddress.u.LowPart);
    INFO_(VIDEOPRT, "- NumberOfUchars: %lx\n", NumberOfUchars);
@@ -261,7 +319,9 @@ IntVideoPortMapMemory(
    InIoSpace &= ~VIDEO_MEMORY_SPACE_DENSE;
    if ((InIoSpace & VIDEO_MEMORY_SPACE_P6CACHE) != 0)
    {
-      INFO_(VIDEOPRT, "VIDEO_MEMORY_SPACE_P6CACHE not supported, turning off\n");
+      /* User mappings are only write combined in the current process */
+      INFO_(VIDEOPRT, "VIDEO_MEMORY_SPACE_P6CACHE: mapping write combined\n");
+      CacheType = MmWriteCombined;
       InIoSpace &= ~VIDEO_MEMORY_SPACE_P6CACHE;
    }
 
@@ -292,7 +352,8 @@ IntVideoPortMapMemory(
             Entry,
             VIDEO_PORT_ADDRESS_MAPPING,
             List);
-         if (IoAddress.QuadPart == AddressMapping->IoAddress.QuadPart &&
+         if (AddressMapping->Mdl == NULL &&
+             IoAddress.QuadPart == AddressMapping->IoAddress.QuadPart &&
              NumberOfUchars <= AddressMapping->NumberOfUchars)
          {
             {
@@ -336,17 +397,31 @@ IntVideoPortMapMemory(
    {
       NTSTATUS NtStatus;
       MappedAddress = NULL;
-      NtStatus = IntVideoPortMapPhysicalMemory(ProcessHandle,
-                                               TranslatedAddress,
-                                               NumberOfUchars,
-                                               PAGE_READWRITE/* | PAGE_WRITECOMBINE*/,
-                                               &MappedAddress);
-      if (!NT_SUCCESS(NtStatus))
+
+      if (CacheType == MmWriteCombined && ProcessHandle == NtCurrentProcess())
+      {
+         MappedAddress = IntVideoPortMapUserWriteCombined(TranslatedAddress,
+                                                          NumberOfUchars,
+                                                          &SystemAddress,
+                                                          &Mdl);
+         if (MappedAddress == NULL)
+            WARN_(VIDEOPRT, "Write combined user mapping failed, mapping uncached\n");
+      }
+
+      if (MappedAddress == NULL)
       {
-         WARN_(VIDEOPRT, "IntVideoPortMapPhysicalMemory() failed! (0x%x)\n", NtStatus);
-         if (Status)
-            *Status = NO_ERROR;
-         return NULL;
+         NtStatus = IntVideoPortMapPhysicalMemory(ProcessHandle,
+                                                  TranslatedAddress,
+                                                  NumberOfUchars,
+                                                  PAGE_READWRITE,
+                                                  &MappedAddress);
+         if (!NT_SUCCESS(NtStatus))
+         {
+            WARN_(VIDEOPRT, "IntVideoPortMapPhysicalMemory() failed! (0x%x)\n", NtStatus);
+            if (Status)
+               *Status = NO_ERROR;
+            return NULL;
+         }
       }
       INFO_(VIDEOPRT, "Mapped user address = 0x%08x\n", MappedAddress);
    }
@@ -355,7 +430,7 @@ IntVideoPortMapMemory(
       MappedAddress = MmMapIoSpace(
          TranslatedAddress,
          NumberOfUchars,
-         MmNonCached);
+         CacheType);
    }
 
    if (MappedAddress != NULL)
@@ -364,7 +439,7 @@ IntVideoPortMapMemory(
       {
          *Status = NO_ERROR;
       }
-      if ((InIoSpace & VIDEO_MEMORY_SPACE_USER_MODE) == 0)
+      if ((InIoSpace & VIDEO_MEMORY_SPACE_USER_MODE) == 0 || Mdl != NULL)
       {
          AddressMapping = ExAllocatePoolWithTag(
             PagedPool,
@@ -372,7 +447,19 @@ IntVideoPortMapMemory(
             TAG_VIDEO_PORT);
 
          if (AddressMapping == NULL)
+         {
+            /* The MDL mapping could not be found again for unmapping */
+            if (Mdl != NULL)
+            {
+               MmUnmapLockedPages(MappedAddress, Mdl);
+               IoFreeMdl(Mdl);
+               MmUnmapIoSpace(SystemAddress, NumberOfUchars);
+               if (Status)
+                  *Status = ERROR_NOT_ENOUGH_MEMORY;
+               return NULL;
+            }
             return MappedAddress;
+         }
 
          RtlZeroMemory(AddressMapping, sizeof(VIDEO_PORT_ADDRESS_MAPPING));
          AddressMapping->NumberOfUchars = NumberOfUchars;
@@ -380,6 +467,8 @@ IntVideoPortMapMemory(
          AddressMapping->SystemIoBusNumber = DeviceExtension->SystemIoBusNumber;
          AddressMapping->MappedAddress = MappedAddress;
          AddressMapping->MappingCount = 1;
+         AddressMapping->SystemAddress = SystemAddress;
+         AddressMapping->Mdl = Mdl;
          InsertHeadList(
             &DeviceExtension->AddressMappingListHead,
             &AddressMapping->List);
@@ -416,9 +505,20 @@ IntVideoPortUnmapMemory(
          AddressMapping->MappingCount--;
          if (AddressMapping->MappingCount == 0)
          {
-            MmUnmapIoSpace(
-               AddressMapping->MappedAddress,
-               AddressMapping->NumberOfUchars);
+            if (AddressMapping->Mdl != NULL)
+            {
+               MmUnmapLockedPages(AddressMapping->MappedAddress, AddressMapping->Mdl);
+               IoFreeMdl(AddressMapping->Mdl);
+               MmUnmapIoSpace(
+                  AddressMapping->SystemAddress,
+                  AddressMapping->NumberOfUchars);
+            }
+            else
+            {
+               MmUnmapIoSpace(
+                  AddressMapping->MappedAddress,
+                  AddressMapping->NumberOfUchars);
+            }
             RemoveEntryList(Entry);
             ExFreePool(AddressMapping);
          }
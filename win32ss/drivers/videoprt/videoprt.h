@@ -31,6 +31,7 @@
 #include <dderror.h>
 #include <windef.h>
 #include <wdmguid.h>
+#include <pseh/pseh2.h>
 
 #define TAG_VIDEO_PORT  'PDIV'
 #define TAG_VIDEO_PORT_BUFFER  '\0mpV'
@@ -46,6 +47,9 @@ typedef struct _VIDEO_PORT_ADDRESS_MAPPING
    PHYSICAL_ADDRESS IoAddress;
    ULONG SystemIoBusNumber;
    UINT MappingCount;
+   /* Write combined user mappings go through a system mapping and an MDL */
+   PVOID SystemAddress;
+   PMDL Mdl;
 } VIDEO_PORT_ADDRESS_MAPPING, *PVIDEO_PORT_ADDRESS_MAPPING;
 
 struct _VIDEO_PORT_AGP_VIRTUAL_MAPPING;
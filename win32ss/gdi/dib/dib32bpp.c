@@ -117,16 +117,9 @@ DIB_32BPP_BitBltSrcCopy(PBLTINFO BltInfo)
 
     for (j = BltInfo->DestRect.top; j < BltInfo->DestRect.bottom; j++)
     {
-      SourceBits = SourceLine;
-      DestBits = DestLine;
-
-      for (i = BltInfo->DestRect.left; i < BltInfo->DestRect.right; i++)
-      {
-        xColor = *SourceBits;
-        *((PDWORD) DestBits) = (DWORD)XLATEOBJ_iXlate(BltInfo->XlateSourceToDest, xColor);
-        SourceBits += 1;
-        DestBits += 4;
-      }
+      EXLATEOBJ_vXlateRow8to32((PEXLATEOBJ)BltInfo->XlateSourceToDest,
+                               (PULONG)DestLine, SourceLine,
+                               BltInfo->DestRect.right - BltInfo->DestRect.left);
 
       SourceLine += BltInfo->SourceSurface->lDelta;
       DestLine += BltInfo->DestSurface->lDelta;
@@ -139,16 +132,9 @@ DIB_32BPP_BitBltSrcCopy(PBLTINFO BltInfo)
 
     for (j = BltInfo->DestRect.top; j < BltInfo->DestRect.bottom; j++)
     {
-      SourceBits = SourceLine;
-      DestBits = DestLine;
-
-      for (i = BltInfo->DestRect.left; i < BltInfo->DestRect.right; i++)
-      {
-        xColor = *((PWORD) SourceBits);
-        *((PDWORD) DestBits) = (DWORD)XLATEOBJ_iXlate(BltInfo->XlateSourceToDest, xColor);
-        SourceBits += 2;
-        DestBits += 4;
-      }
+      EXLATEOBJ_vXlateRow16to32((PEXLATEOBJ)BltInfo->XlateSourceToDest,
+                                (PULONG)DestLine, (PUSHORT)SourceLine,
+                                BltInfo->DestRect.right - BltInfo->DestRect.left);
 
       SourceLine += BltInfo->SourceSurface->lDelta;
       DestLine += BltInfo->DestSurface->lDelta;
@@ -341,6 +327,93 @@ Clamp8(ULONG val)
   return (val > 255) ? 255 : (UCHAR)val;
 }
 
+/* Multiplies all four channels by Alpha / 255, two channels at a time.
+ * (x + 1 + (x >> 8)) >> 8 is x / 255 rounded down for any x <= 255 * 255 */
+static __inline ULONG
+Scale32(ULONG Color, ULONG Alpha)
+{
+  ULONG RedBlue = (Color & 0x00FF00FF) * Alpha;
+  ULONG AlphaGreen = ((Color >> 8) & 0x00FF00FF) * Alpha;
+
+  RedBlue = ((RedBlue + 0x00010001 + ((RedBlue >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+  AlphaGreen = (AlphaGreen + 0x00010001 + ((AlphaGreen >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+
+  return RedBlue | AlphaGreen;
+}
+
+/* Adds all four channels, clamping each to 255 */
+static __inline ULONG
+AddClamp32(ULONG a, ULONG b)
+{
+  ULONG RedBlue = (a & 0x00FF00FF) + (b & 0x00FF00FF);
+  ULONG AlphaGreen = ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF);
+  ULONG Carry;
+
+  Carry = RedBlue & 0x01000100;
+  RedBlue = (RedBlue | (Carry - (Carry >> 8))) & 0x00FF00FF;
+  Carry = AlphaGreen & 0x01000100;
+  AlphaGreen = (AlphaGreen | (Carry - (Carry >> 8))) & 0x00FF00FF;
+
+  return RedBlue | (AlphaGreen << 8);
+}
+
+/* Unstretched 32bpp source with no color translation. Gives the same result
+ * as the per-pixel loop below, without going through DIB_GetSource */
+static VOID
+DIB_32BPP_AlphaBlendRows(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
+                         RECTL* SourceRect, BLENDFUNCTION BlendFunc)
+{
+  LONG Rows, Cols, Width;
+  PULONG Dst, Src;
+  ULONG SrcPixel, Alpha;
+  ULONG ConstantAlpha = BlendFunc.SourceConstantAlpha;
+  BOOLEAN PerPixelAlpha = (BlendFunc.AlphaFormat & AC_SRC_ALPHA) != 0;
+
+  Width = DestRect->right - DestRect->left;
+
+  for (Rows = 0; Rows < DestRect->bottom - DestRect->top; Rows++)
+  {
+    Dst = (PULONG)((ULONG_PTR)Dest->pvScan0 + ((DestRect->top + Rows) * Dest->lDelta) +
+      (DestRect->left << 2));
+    Src = (PULONG)((ULONG_PTR)Source->pvScan0 + ((SourceRect->top + Rows) * Source->lDelta) +
+      (SourceRect->left << 2));
+
+    if (!PerPixelAlpha)
+    {
+      if (ConstantAlpha == 255)
+      {
+        RtlMoveMemory(Dst, Src, Width << 2);
+        continue;
+      }
+
+      for (Cols = 0; Cols < Width; Cols++)
+      {
+        Dst[Cols] = AddClamp32(Scale32(Dst[Cols], 255 - ConstantAlpha),
+                               Scale32(Src[Cols], ConstantAlpha));
+      }
+      continue;
+    }
+
+    for (Cols = 0; Cols < Width; Cols++)
+    {
+      SrcPixel = Src[Cols];
+
+      /* Fully transparent pixels leave the destination alone */
+      if (SrcPixel == 0)
+        continue;
+
+      if (ConstantAlpha != 255)
+        SrcPixel = Scale32(SrcPixel, ConstantAlpha);
+
+      Alpha = SrcPixel >> 24;
+      if (Alpha == 255)
+        Dst[Cols] = SrcPixel;
+      else
+        Dst[Cols] = AddClamp32(Scale32(Dst[Cols], 255 - Alpha), SrcPixel);
+    }
+  }
+}
+
 BOOLEAN
 DIB_32BPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
                      RECTL* SourceRect, CLIPOBJ* ClipRegion,
@@ -379,6 +452,18 @@ DIB_32BPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
     return FALSE;
   }
 
+  if (BlendFunc.SourceConstantAlpha == 0)
+    return TRUE;
+
+  if (Source->iBitmapFormat == BMF_32BPP &&
+      (ColorTranslation == NULL || (ColorTranslation->flXlate & XO_TRIVIAL)) &&
+      SourceRect->right - SourceRect->left == DestRect->right - DestRect->left &&
+      SourceRect->bottom - SourceRect->top == DestRect->bottom - DestRect->top)
+  {
+    DIB_32BPP_AlphaBlendRows(Dest, Source, DestRect, SourceRect, BlendFunc);
+    return TRUE;
+  }
+
   Dst = (PULONG)((ULONG_PTR)Dest->pvScan0 + (DestRect->top * Dest->lDelta) +
     (DestRect->left << 2));
   SrcBpp = BitsPerFormat(Source->iBitmapFormat);
@@ -17,14 +17,10 @@ DIB_32BPP_HLine(SURFOBJ *SurfObj, LONG x1, LONG x2, LONG y, ULONG c)
 {
   PBYTE byteaddr = (PBYTE)((ULONG_PTR)SurfObj->pvScan0 + y * SurfObj->lDelta);
   PDWORD addr = (PDWORD)byteaddr + x1;
-  LONG cx = x1;
 
-  while(cx < x2)
-  {
-    *addr = (DWORD)c;
-    ++addr;
-    ++cx;
-  }
+  /* The rep stosd of the i386 version, inlined as rep stosq on amd64 */
+  if (x1 < x2)
+    RtlFillMemoryUlong(addr, (x2 - x1) * sizeof(DWORD), c);
 }
 
 BOOLEAN
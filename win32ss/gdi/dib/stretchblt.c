@@ -13,6 +13,319 @@
 #define NDEBUG
 #include <debug.h>
 
+/* Source column or row used for a destination one, -1 if it's outside the
+ * source bitmap. Same mapping as the per-pixel loop */
+static PLONG
+DIB_BuildNearestTable(LONG DstStart, LONG DstCount, LONG SrcStart, LONG SrcCount,
+                      LONG SrcLimit, PBOOLEAN AllInside)
+{
+  PLONG Table;
+  LONG i, s;
+
+  Table = ExAllocatePoolWithTag(PagedPool, DstCount * sizeof(LONG), TAG_DIB);
+  if (!Table)
+    return NULL;
+
+  *AllInside = TRUE;
+  for (i = 0; i < DstCount; i++)
+  {
+    s = SrcStart + i * SrcCount / DstCount;
+    if (s < 0 || s >= SrcLimit)
+    {
+      s = -1;
+      *AllInside = FALSE;
+    }
+    Table[i] = s;
+  }
+
+  return Table;
+}
+
+/* SRCCOPY between two different surfaces of the same format without color
+ * translation, a row at a time. A destination row that uses the same source
+ * row as the one above it is copied from there */
+static BOOLEAN
+DIB_StretchRowsNearest(SURFOBJ *DestSurf, SURFOBJ *SourceSurf,
+                       RECTL *DestRect, RECTL *SourceRect)
+{
+  LONG DstWidth = DestRect->right - DestRect->left;
+  LONG DstHeight = DestRect->bottom - DestRect->top;
+  LONG SrcWidth = SourceRect->right - SourceRect->left;
+  LONG SrcHeight = SourceRect->bottom - SourceRect->top;
+  LONG Bpp = BitsPerFormat(DestSurf->iBitmapFormat) >> 3;
+  LONG DesX, DesY, sy, LastSy = -1;
+  PLONG XTable;
+  BOOLEAN AllColumns;
+  PBYTE SrcLine, DstLine, LastLine = NULL, s, d;
+
+  XTable = DIB_BuildNearestTable(0, DstWidth, SourceRect->left, SrcWidth,
+                                 SourceSurf->sizlBitmap.cx, &AllColumns);
+  if (!XTable)
+    return FALSE;
+
+  for (DesY = 0; DesY < DstHeight; DesY++)
+  {
+    sy = SourceRect->top + DesY * SrcHeight / DstHeight;
+    if (sy < 0 || sy >= abs(SourceSurf->sizlBitmap.cy))
+      continue;
+
+    DstLine = (PBYTE)DestSurf->pvScan0 + (DestRect->top + DesY) * DestSurf->lDelta +
+              DestRect->left * Bpp;
+
+    /* Skipped columns keep what the destination had, so only whole rows
+     * can be reused */
+    if (sy == LastSy && AllColumns)
+    {
+      RtlCopyMemory(DstLine, LastLine, DstWidth * Bpp);
+      LastLine = DstLine;
+      continue;
+    }
+
+    SrcLine = (PBYTE)SourceSurf->pvScan0 + sy * SourceSurf->lDelta;
+
+    switch (Bpp)
+    {
+    case 1:
+      for (DesX = 0; DesX < DstWidth; DesX++)
+        if (XTable[DesX] >= 0)
+          DstLine[DesX] = SrcLine[XTable[DesX]];
+      break;
+
+    case 2:
+      for (DesX = 0; DesX < DstWidth; DesX++)
+        if (XTable[DesX] >= 0)
+          ((PUSHORT)DstLine)[DesX] = ((PUSHORT)SrcLine)[XTable[DesX]];
+      break;
+
+    case 3:
+      for (DesX = 0; DesX < DstWidth; DesX++)
+      {
+        if (XTable[DesX] < 0)
+          continue;
+        s = SrcLine + XTable[DesX] * 3;
+        d = DstLine + DesX * 3;
+        d[0] = s[0];
+        d[1] = s[1];
+        d[2] = s[2];
+      }
+      break;
+
+    default:
+      for (DesX = 0; DesX < DstWidth; DesX++)
+        if (XTable[DesX] >= 0)
+          ((PULONG)DstLine)[DesX] = ((PULONG)SrcLine)[XTable[DesX]];
+      break;
+    }
+
+    LastSy = sy;
+    LastLine = DstLine;
+  }
+
+  ExFreePoolWithTag(XTable, TAG_DIB);
+  return TRUE;
+}
+
+/* One tap of the HALFTONE filter. Enlarging interpolates between Start and
+ * Start + 1 with Weight / 256 of the second; shrinking averages Count source
+ * pixels, Weight being 65536 / Count */
+typedef struct _STRETCH_TAP
+{
+  LONG Start;
+  LONG Count;
+  ULONG Weight;
+} STRETCH_TAP, *PSTRETCH_TAP;
+
+static VOID
+DIB_BuildFilterTaps(PSTRETCH_TAP Taps, LONG DstCount, LONG SrcStart, LONG SrcCount)
+{
+  LONGLONG Position;
+  LONG i;
+
+  for (i = 0; i < DstCount; i++)
+  {
+    if (SrcCount > DstCount)
+    {
+      Taps[i].Start = SrcStart + (LONG)((LONGLONG)i * SrcCount / DstCount);
+      Taps[i].Count = SrcStart + (LONG)((LONGLONG)(i + 1) * SrcCount / DstCount) - Taps[i].Start;
+      Taps[i].Weight = 65536 / Taps[i].Count;
+    }
+    else
+    {
+      /* Center of the destination pixel in source pixels, 16.16 fixed point */
+      Position = ((LONGLONG)(2 * i + 1) * SrcCount << 16) / (2 * DstCount) - 0x8000;
+      Position += (LONGLONG)SrcStart << 16;
+      Taps[i].Start = (LONG)(Position >> 16);
+      Taps[i].Count = 0;
+      Taps[i].Weight = (ULONG)(Position >> 8) & 0xFF;
+    }
+  }
+}
+
+/* (256 - Weight) / 256 of a plus Weight / 256 of b, two channels at a time */
+static __inline ULONG
+Lerp32(ULONG a, ULONG b, ULONG Weight)
+{
+  ULONG RedBlue, AlphaGreen;
+
+  RedBlue = (a & 0x00FF00FF) * (256 - Weight) + (b & 0x00FF00FF) * Weight;
+  AlphaGreen = ((a >> 8) & 0x00FF00FF) * (256 - Weight) + ((b >> 8) & 0x00FF00FF) * Weight;
+
+  return (((RedBlue + 0x00800080) >> 8) & 0x00FF00FF) |
+         ((AlphaGreen + 0x00800080) & 0xFF00FF00);
+}
+
+static __inline LONG
+ClampIndex(LONG i, LONG Limit)
+{
+  return (i < 0) ? 0 : ((i >= Limit) ? Limit - 1 : i);
+}
+
+/* Filters source row y horizontally into Row */
+static VOID
+DIB_FilterRow32(SURFOBJ *SourceSurf, LONG y, PSTRETCH_TAP XTaps, LONG DstWidth, PULONG Row)
+{
+  PULONG Src = (PULONG)((PBYTE)SourceSurf->pvScan0 + y * SourceSurf->lDelta);
+  LONG Limit = SourceSurf->sizlBitmap.cx;
+  LONG i, j;
+  ULONG Pixel, Red, Green, Blue, Alpha;
+
+  for (i = 0; i < DstWidth; i++)
+  {
+    if (XTaps[i].Count == 0)
+    {
+      Row[i] = Lerp32(Src[ClampIndex(XTaps[i].Start, Limit)],
+                      Src[ClampIndex(XTaps[i].Start + 1, Limit)],
+                      XTaps[i].Weight);
+      continue;
+    }
+
+    Red = Green = Blue = Alpha = 0;
+    for (j = 0; j < XTaps[i].Count; j++)
+    {
+      Pixel = Src[ClampIndex(XTaps[i].Start + j, Limit)];
+      Red += Pixel & 0xFF;
+      Green += (Pixel >> 8) & 0xFF;
+      Blue += (Pixel >> 16) & 0xFF;
+      Alpha += Pixel >> 24;
+    }
+
+    Row[i] = ((Red * XTaps[i].Weight + 0x8000) >> 16) |
+             (((Green * XTaps[i].Weight + 0x8000) >> 16) << 8) |
+             (((Blue * XTaps[i].Weight + 0x8000) >> 16) << 16) |
+             (((Alpha * XTaps[i].Weight + 0x8000) >> 16) << 24);
+  }
+}
+
+/* HALFTONE SRCCOPY between two different 32bpp surfaces without color
+ * translation. Shrinking averages the source pixels that fall into a
+ * destination pixel, enlarging interpolates bilinearly. The filter is
+ * separable: source rows are filtered horizontally first, then combined */
+BOOLEAN
+DIB_32BPP_StretchBltHalftone(SURFOBJ *DestSurf, SURFOBJ *SourceSurf,
+                             RECTL *DestRect, RECTL *SourceRect)
+{
+  LONG DstWidth = DestRect->right - DestRect->left;
+  LONG DstHeight = DestRect->bottom - DestRect->top;
+  LONG SrcWidth = SourceRect->right - SourceRect->left;
+  LONG SrcHeight = SourceRect->bottom - SourceRect->top;
+  LONG SourceCy = abs(SourceSurf->sizlBitmap.cy);
+  PSTRETCH_TAP XTaps, YTaps;
+  PULONG Rows[2], Accum, Dst, Temp;
+  LONG RowY[2] = { -1, -1 };
+  LONG DesX, DesY, j, y0, y1;
+  ULONG Weight, Pixel;
+  PVOID Buffer;
+
+  if (DstWidth <= 0 || DstHeight <= 0 || SrcWidth <= 0 || SrcHeight <= 0 ||
+      SourceSurf->sizlBitmap.cx <= 0 || SourceCy <= 0)
+    return FALSE;
+
+  Buffer = ExAllocatePoolWithTag(PagedPool,
+                                 (DstWidth + DstHeight) * sizeof(STRETCH_TAP) +
+                                 DstWidth * 6 * sizeof(ULONG),
+                                 TAG_DIB);
+  if (!Buffer)
+    return FALSE;
+
+  XTaps = Buffer;
+  YTaps = XTaps + DstWidth;
+  Rows[0] = (PULONG)(YTaps + DstHeight);
+  Rows[1] = Rows[0] + DstWidth;
+  Accum = Rows[1] + DstWidth;
+
+  DIB_BuildFilterTaps(XTaps, DstWidth, SourceRect->left, SrcWidth);
+  DIB_BuildFilterTaps(YTaps, DstHeight, SourceRect->top, SrcHeight);
+
+  for (DesY = 0; DesY < DstHeight; DesY++)
+  {
+    Dst = (PULONG)((PBYTE)DestSurf->pvScan0 + (DestRect->top + DesY) * DestSurf->lDelta) +
+          DestRect->left;
+
+    if (YTaps[DesY].Count == 0)
+    {
+      y0 = ClampIndex(YTaps[DesY].Start, SourceCy);
+      y1 = ClampIndex(YTaps[DesY].Start + 1, SourceCy);
+
+      /* Going down, the lower row of one destination row is usually the
+       * upper row of the next */
+      if (RowY[0] != y0)
+      {
+        if (RowY[1] == y0)
+        {
+          Temp = Rows[0];
+          Rows[0] = Rows[1];
+          Rows[1] = Temp;
+          RowY[1] = RowY[0];
+          RowY[0] = y0;
+        }
+        else
+        {
+          DIB_FilterRow32(SourceSurf, y0, XTaps, DstWidth, Rows[0]);
+          RowY[0] = y0;
+        }
+      }
+      if (RowY[1] != y1)
+      {
+        DIB_FilterRow32(SourceSurf, y1, XTaps, DstWidth, Rows[1]);
+        RowY[1] = y1;
+      }
+
+      Weight = YTaps[DesY].Weight;
+      for (DesX = 0; DesX < DstWidth; DesX++)
+        Dst[DesX] = Lerp32(Rows[0][DesX], Rows[1][DesX], Weight);
+      continue;
+    }
+
+    RtlZeroMemory(Accum, DstWidth * 4 * sizeof(ULONG));
+    for (j = 0; j < YTaps[DesY].Count; j++)
+    {
+      DIB_FilterRow32(SourceSurf, ClampIndex(YTaps[DesY].Start + j, SourceCy),
+                      XTaps, DstWidth, Rows[0]);
+      for (DesX = 0; DesX < DstWidth; DesX++)
+      {
+        Pixel = Rows[0][DesX];
+        Accum[4 * DesX] += Pixel & 0xFF;
+        Accum[4 * DesX + 1] += (Pixel >> 8) & 0xFF;
+        Accum[4 * DesX + 2] += (Pixel >> 16) & 0xFF;
+        Accum[4 * DesX + 3] += Pixel >> 24;
+      }
+    }
+    RowY[0] = RowY[1] = -1;
+
+    Weight = YTaps[DesY].Weight;
+    for (DesX = 0; DesX < DstWidth; DesX++)
+    {
+      Dst[DesX] = ((Accum[4 * DesX] * Weight + 0x8000) >> 16) |
+                  (((Accum[4 * DesX + 1] * Weight + 0x8000) >> 16) << 8) |
+                  (((Accum[4 * DesX + 2] * Weight + 0x8000) >> 16) << 16) |
+                  (((Accum[4 * DesX + 3] * Weight + 0x8000) >> 16) << 24);
+    }
+  }
+
+  ExFreePoolWithTag(Buffer, TAG_DIB);
+  return TRUE;
+}
+
 BOOLEAN DIB_XXBPP_StretchBlt(SURFOBJ *DestSurf, SURFOBJ *SourceSurf, SURFOBJ *MaskSurf,
                             SURFOBJ *PatternSurface,
                             RECTL *DestRect, RECTL *SourceRect,
@@ -75,6 +388,17 @@ BOOLEAN DIB_XXBPP_StretchBlt(SURFOBJ *DestSurf, SURFOBJ *SourceSurf, SURFOBJ *Ma
   SrcHeight = SourceRect->bottom - SourceRect->top;
   SrcWidth = SourceRect->right - SourceRect->left;
 
+  if (ROP == ROP4_FROM_INDEX(R3_OPINDEX_SRCCOPY) && !MaskSurf &&
+      SourceSurf != DestSurf &&
+      SourceSurf->iBitmapFormat == DestSurf->iBitmapFormat &&
+      DestSurf->iBitmapFormat >= BMF_8BPP && DestSurf->iBitmapFormat <= BMF_32BPP &&
+      (ColorTranslation == NULL || (ColorTranslation->flXlate & XO_TRIVIAL)) &&
+      DstWidth > 0 && DstHeight > 0)
+  {
+    if (DIB_StretchRowsNearest(DestSurf, SourceSurf, DestRect, SourceRect))
+      return TRUE;
+  }
+
   /* FIXME: MaskOrigin? */
 
   switch(DestSurf->iBitmapFormat)
@@ -1020,11 +1020,15 @@ IntEngMaskBlt(
     RECTL rcDest;
     POINTL ptMask = {0,0};
     PSURFACE psurfTemp;
+    PSURFACE psurfDest;
     RECTL rcTemp;
+    POINTL ptTemp = {0,0};
 
     ASSERT(psoDest);
     ASSERT(psoMask);
 
+    psurfDest = CONTAINING_RECORD(psoDest, SURFACE, SurfObj);
+
     /* Is this a 1 BPP mask? */
     if (psoMask->iBitmapFormat == BMF_1BPP)
     {
@@ -1068,8 +1072,9 @@ IntEngMaskBlt(
         rcDest = *prclDest;
     }
 
-    /* Check if the target surface is device managed */
-    if (psoDest->iType != STYPE_BITMAP)
+    /* Check if the target surface is device managed, or if the driver
+     * has to see what is drawn on it */
+    if (psoDest->iType != STYPE_BITMAP || (psurfDest->flags & HOOK_BITBLT))
     {
         rcTemp.left = 0;
         rcTemp.top = 0;
@@ -1115,12 +1120,29 @@ IntEngMaskBlt(
         if (ret)
         {
             /* Copy the result back to the dest surface */
-            ret = EngCopyBits(psoDest,
-                              &psurfTemp->SurfObj,
-                              pco,
-                              NULL,
-                              &rcDest,
-                              (PPOINTL)&rcTemp);
+            if (psoDest->iType != STYPE_BITMAP)
+            {
+                ret = EngCopyBits(psoDest,
+                                  &psurfTemp->SurfObj,
+                                  pco,
+                                  NULL,
+                                  &rcDest,
+                                  (PPOINTL)&rcTemp);
+            }
+            else
+            {
+                ret = IntEngBitBlt(psoDest,
+                                   &psurfTemp->SurfObj,
+                                   NULL,
+                                   pco,
+                                   NULL,
+                                   &rcDest,
+                                   &ptTemp,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   ROP4_SRCCOPY);
+            }
         }
 
         /* Delete the temp surface */
@@ -123,6 +123,8 @@ typedef struct _SHARED_FACE_CACHE {
     UINT OutlineRequiredSize;
     UNICODE_STRING FontFamily;
     UNICODE_STRING FullName;
+    ULONG FontFamilyHash;
+    ULONG FullNameHash;
 } SHARED_FACE_CACHE, *PSHARED_FACE_CACHE;
 
 typedef struct _SHARED_FACE {
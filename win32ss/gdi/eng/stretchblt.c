@@ -20,7 +20,8 @@ typedef BOOLEAN (APIENTRY *PSTRETCHRECTFUNC)(SURFOBJ* OutputObj,
                                             POINTL* MaskOrigin,
                                             BRUSHOBJ* pbo,
                                             POINTL* BrushOrigin,
-                                            ROP4 Rop4);
+                                            ROP4 Rop4,
+                                            ULONG Mode);
 
 static BOOLEAN APIENTRY
 CallDibStretchBlt(SURFOBJ* psoDest,
@@ -32,7 +33,8 @@ CallDibStretchBlt(SURFOBJ* psoDest,
                   POINTL* MaskOrigin,
                   BRUSHOBJ* pbo,
                   POINTL* BrushOrigin,
-                  ROP4 Rop4)
+                  ROP4 Rop4,
+                  ULONG Mode)
 {
     POINTL RealBrushOrigin;
     SURFOBJ* psoPattern;
@@ -59,6 +61,18 @@ CallDibStretchBlt(SURFOBJ* psoDest,
         psoPattern = NULL;
     }
 
+    /* HALFTONE filters the source instead of picking the nearest pixel */
+    if (Mode == HALFTONE &&
+        Rop4 == ROP4_FROM_INDEX(R3_OPINDEX_SRCCOPY) && !Mask &&
+        psoSource != psoDest &&
+        psoDest->iBitmapFormat == BMF_32BPP &&
+        psoSource->iBitmapFormat == BMF_32BPP &&
+        (!ColorTranslation || (ColorTranslation->flXlate & XO_TRIVIAL)))
+    {
+        if (DIB_32BPP_StretchBltHalftone(psoDest, psoSource, OutputRect, InputRect))
+            return TRUE;
+    }
+
     bResult = DibFunctionsForBitmapFormat[psoDest->iBitmapFormat].DIB_StretchBlt(
                psoDest, psoSource, Mask, psoPattern,
                OutputRect, InputRect, MaskOrigin, pbo, &RealBrushOrigin,
@@ -242,7 +256,7 @@ EngStretchBltROP(
         case DC_TRIVIAL:
             Ret = (*BltRectFunc)(psoOutput, psoInput, Mask,
                          ColorTranslation, &OutputRect, &InputRect, MaskOrigin,
-                         pbo, &AdjustedBrushOrigin, Rop4);
+                         pbo, &AdjustedBrushOrigin, Rop4, Mode);
             break;
         case DC_RECT:
             // Clip the blt to the clip rectangle
@@ -263,7 +277,8 @@ EngStretchBltROP(
                            MaskOrigin,
                            pbo,
                            &AdjustedBrushOrigin,
-                           Rop4);
+                           Rop4,
+                           Mode);
             }
             break;
         case DC_COMPLEX:
@@ -308,7 +323,8 @@ EngStretchBltROP(
                            MaskOrigin,
                            pbo,
                            &AdjustedBrushOrigin,
-                           Rop4);
+                           Rop4,
+                           Mode);
                     }
                 }
             }
@@ -371,7 +387,8 @@ IntEngStretchBlt(SURFOBJ *psoDest,
                  POINTL *pMaskOrigin,
                  BRUSHOBJ *pbo,
                  POINTL *BrushOrigin,
-                 DWORD Rop4)
+                 DWORD Rop4,
+                 ULONG Mode)
 {
     BOOLEAN ret;
     POINTL MaskOrigin = {0, 0};
@@ -491,7 +508,7 @@ IntEngStretchBlt(SURFOBJ *psoDest,
                                                  &OutputRect,
                                                  &InputRect,
                                                  &MaskOrigin,
-                                                 COLORONCOLOR,
+                                                 Mode,
                                                  pbo,
                                                  Rop4);
     }
@@ -508,7 +525,7 @@ IntEngStretchBlt(SURFOBJ *psoDest,
                                &OutputRect,
                                &InputRect,
                                &MaskOrigin,
-                               COLORONCOLOR,
+                               Mode,
                                pbo,
                                Rop4);
     }
@@ -25,6 +25,25 @@ EXLATEOBJ gexloTrivial = {{0, XO_TRIVIAL, 0, 0, 0, 0}, EXLATEOBJ_iXlateTrivial};
 
 static ULONG giUniqueXlate = 0;
 
+/* Tables from indexed palettes are expensive to build (a nearest color search
+   per entry), and the same pairs of palettes come back all the time. The
+   palette stamps tell whether a cached table is still valid. */
+#define XLATE_CACHE_ENTRIES 8
+
+typedef struct _XLATE_CACHE_ENTRY
+{
+    PPALETTE ppalSrc;
+    PPALETTE ppalDst;
+    ULONG ulTimeSrc;
+    ULONG ulTimeDst;
+    ULONG cEntries; // 0 for a trivial translation
+    ULONG aulXlate[256];
+} XLATE_CACHE_ENTRY, *PXLATE_CACHE_ENTRY;
+
+static HSEMAPHORE ghsemXlateCache;
+static XLATE_CACHE_ENTRY gaXlateCache[XLATE_CACHE_ENTRIES];
+static ULONG giXlateCacheNext = 0;
+
 static const BYTE gajXlate5to8[32] =
 {  0,  8, 16, 25, 33, 41, 49, 58, 66, 74, 82, 90, 99,107,115,123,
  132,140,148,156,165,173,181,189,197,206,214,222,231,239,247,255};
@@ -36,6 +55,85 @@ static const BYTE gajXlate6to8[64] =
 194,198,202,207,210,215,219,223,227,231,235,239,243,247,251,255};
 
 
+/** Translation cache *********************************************************/
+
+INIT_FUNCTION
+NTSTATUS
+NTAPI
+InitXlateImpl(VOID)
+{
+    ghsemXlateCache = EngCreateSemaphore();
+    if (!ghsemXlateCache) return STATUS_INSUFFICIENT_RESOURCES;
+    return STATUS_SUCCESS;
+}
+
+static
+BOOL
+EXLATEOBJ_bLookupCache(
+    _Inout_ PEXLATEOBJ pexlo,
+    _In_ PPALETTE ppalSrc,
+    _In_ PPALETTE ppalDst,
+    _In_ ULONG ulTimeSrc,
+    _In_ ULONG ulTimeDst,
+    _Out_ PULONG pcEntries)
+{
+    PXLATE_CACHE_ENTRY pEntry;
+    ULONG i;
+    BOOL bFound = FALSE;
+
+    EngAcquireSemaphore(ghsemXlateCache);
+
+    for (i = 0; i < XLATE_CACHE_ENTRIES; i++)
+    {
+        pEntry = &gaXlateCache[i];
+        if ((pEntry->ppalSrc == ppalSrc) && (pEntry->ppalDst == ppalDst) &&
+            (pEntry->ulTimeSrc == ulTimeSrc) && (pEntry->ulTimeDst == ulTimeDst))
+        {
+            /* The caller made room for the whole table */
+            RtlCopyMemory(pexlo->xlo.pulXlate,
+                          pEntry->aulXlate,
+                          pEntry->cEntries * sizeof(ULONG));
+            *pcEntries = pEntry->cEntries;
+            bFound = TRUE;
+            break;
+        }
+    }
+
+    EngReleaseSemaphore(ghsemXlateCache);
+
+    return bFound;
+}
+
+static
+VOID
+EXLATEOBJ_vInsertCache(
+    _In_ PEXLATEOBJ pexlo,
+    _In_ PPALETTE ppalSrc,
+    _In_ PPALETTE ppalDst,
+    _In_ ULONG ulTimeSrc,
+    _In_ ULONG ulTimeDst,
+    _In_ ULONG cEntries)
+{
+    PXLATE_CACHE_ENTRY pEntry;
+
+    ASSERT(cEntries <= _countof(pEntry->aulXlate));
+
+    EngAcquireSemaphore(ghsemXlateCache);
+
+    /* Replace the oldest entry */
+    pEntry = &gaXlateCache[giXlateCacheNext];
+    giXlateCacheNext = (giXlateCacheNext + 1) % XLATE_CACHE_ENTRIES;
+
+    pEntry->ppalSrc = ppalSrc;
+    pEntry->ppalDst = ppalDst;
+    pEntry->ulTimeSrc = ulTimeSrc;
+    pEntry->ulTimeDst = ulTimeDst;
+    pEntry->cEntries = cEntries;
+    RtlCopyMemory(pEntry->aulXlate, pexlo->xlo.pulXlate, cEntries * sizeof(ULONG));
+
+    EngReleaseSemaphore(ghsemXlateCache);
+}
+
 /** iXlate functions **********************************************************/
 
 _Post_satisfies_(return==iColor)
@@ -363,8 +461,10 @@ EXLATEOBJ_vInitialize(
     _In_ COLORREF crDstBackColor,
     _In_ COLORREF crDstForeColor)
 {
-    ULONG cEntries;
+    ULONG cEntries, cCached;
     ULONG i, ulColor;
+    ULONG ulTimeSrc, ulTimeDst;
+    BOOL bCache;
 
     if (!ppalSrc) ppalSrc = &gpalRGB;
     if (!ppalDst) ppalDst = &gpalRGB;
@@ -474,7 +574,30 @@ EXLATEOBJ_vInitialize(
         pexlo->xlo.cEntries = cEntries;
         pexlo->xlo.flXlate |= XO_TABLE;
 
-        if (ppalDst->flFlags & PAL_INDEXED)
+        /* Read the stamps first, a change while we build the table
+           then only leaves an entry nobody will find */
+        ulTimeSrc = ppalSrc->ulTime;
+        ulTimeDst = ppalDst->ulTime;
+        bCache = (cEntries <= _countof(gaXlateCache[0].aulXlate));
+
+        if (bCache &&
+            EXLATEOBJ_bLookupCache(pexlo, ppalSrc, ppalDst, ulTimeSrc, ulTimeDst, &cCached))
+        {
+            if (cCached == 0)
+            {
+                /* Cached as trivial, see below */
+                if (pexlo->xlo.pulXlate != pexlo->aulXlate)
+                {
+                    EngFreeMem(pexlo->xlo.pulXlate);
+                    pexlo->xlo.pulXlate = pexlo->aulXlate;
+                }
+                pexlo->pfnXlate = EXLATEOBJ_iXlateTrivial;
+                pexlo->xlo.flXlate = XO_TRIVIAL;
+                pexlo->xlo.cEntries = 0;
+                return;
+            }
+        }
+        else if (ppalDst->flFlags & PAL_INDEXED)
         {
             ULONG cDiff = 0;
 
@@ -493,6 +616,9 @@ EXLATEOBJ_vInitialize(
             /* Check if we have only trivial mappings */
             if (cDiff == 0)
             {
+                if (bCache)
+                    EXLATEOBJ_vInsertCache(pexlo, ppalSrc, ppalDst, ulTimeSrc, ulTimeDst, 0);
+
                 if (pexlo->xlo.pulXlate != pexlo->aulXlate)
                 {
                     EngFreeMem(pexlo->xlo.pulXlate);
@@ -503,6 +629,9 @@ EXLATEOBJ_vInitialize(
                 pexlo->xlo.cEntries = 0;
                 return;
             }
+
+            if (bCache)
+                EXLATEOBJ_vInsertCache(pexlo, ppalSrc, ppalDst, ulTimeSrc, ulTimeDst, cEntries);
         }
         else
         {
@@ -513,6 +642,9 @@ EXLATEOBJ_vInitialize(
                               ppalSrc->IndexedColors[i].peBlue);
                 pexlo->xlo.pulXlate[i] = PALETTE_ulGetNearestBitFieldsIndex(ppalDst, ulColor);
             }
+
+            if (bCache)
+                EXLATEOBJ_vInsertCache(pexlo, ppalSrc, ppalDst, ulTimeSrc, ulTimeDst, cEntries);
         }
     }
     else if (ppalSrc->flFlags & PAL_RGB)
@@ -656,6 +788,227 @@ EXLATEOBJ_vCleanup(
     pexlo->xlo.pulXlate = pexlo->aulXlate;
 }
 
+/*
+ * Translate a row of 16 bpp pixels to 32 bpp. The conversions between the
+ * 16 bpp and 32 bpp formats are done inline instead of with a call per pixel,
+ * which leaves loops the compiler can vectorize.
+ */
+VOID
+NTAPI
+EXLATEOBJ_vXlateRow16to32(
+    _In_opt_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDst,
+    _In_reads_(cPixels) const USHORT *pusSrc,
+    _In_ ULONG cPixels)
+{
+    PFN_XLATE pfnXlate;
+    ULONG ulRedMask, ulGreenMask, ulBlueMask;
+    ULONG ulRedShift, ulGreenShift, ulBlueShift;
+    ULONG i, iColor;
+
+    pfnXlate = pexlo ? pexlo->pfnXlate : EXLATEOBJ_iXlateTrivial;
+
+    if (pfnXlate == EXLATEOBJ_iXlateTrivial)
+    {
+        for (i = 0; i < cPixels; i++)
+            pulDst[i] = pusSrc[i];
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlate555toRGB)
+    {
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pusSrc[i];
+            pulDst[i] = (gajXlate5to8[iColor & 0x1F] << 16) |
+                        (gajXlate5to8[(iColor >> 5) & 0x1F] << 8) |
+                        gajXlate5to8[(iColor >> 10) & 0x1F];
+        }
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlate555toBGR)
+    {
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pusSrc[i];
+            pulDst[i] = gajXlate5to8[iColor & 0x1F] |
+                        (gajXlate5to8[(iColor >> 5) & 0x1F] << 8) |
+                        (gajXlate5to8[(iColor >> 10) & 0x1F] << 16);
+        }
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlate565toRGB)
+    {
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pusSrc[i];
+            pulDst[i] = (gajXlate5to8[iColor & 0x1F] << 16) |
+                        (gajXlate6to8[(iColor >> 5) & 0x3F] << 8) |
+                        gajXlate5to8[(iColor >> 11) & 0x1F];
+        }
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlate565toBGR)
+    {
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pusSrc[i];
+            pulDst[i] = gajXlate5to8[iColor & 0x1F] |
+                        (gajXlate6to8[(iColor >> 5) & 0x3F] << 8) |
+                        (gajXlate5to8[(iColor >> 11) & 0x1F] << 16);
+        }
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlateShiftAndMask)
+    {
+        ulRedMask = pexlo->ulRedMask;
+        ulGreenMask = pexlo->ulGreenMask;
+        ulBlueMask = pexlo->ulBlueMask;
+        ulRedShift = pexlo->ulRedShift;
+        ulGreenShift = pexlo->ulGreenShift;
+        ulBlueShift = pexlo->ulBlueShift;
+
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pusSrc[i];
+            pulDst[i] = (_rotl(iColor, ulRedShift) & ulRedMask) |
+                        (_rotl(iColor, ulGreenShift) & ulGreenMask) |
+                        (_rotl(iColor, ulBlueShift) & ulBlueMask);
+        }
+    }
+    else
+    {
+        for (i = 0; i < cPixels; i++)
+            pulDst[i] = pfnXlate(pexlo, pusSrc[i]);
+    }
+}
+
+/*
+ * Translate a row of 8 bpp pixels to 32 bpp. With a full table no index can
+ * be out of range, so the lookups are done four at a time without checks.
+ */
+VOID
+NTAPI
+EXLATEOBJ_vXlateRow8to32(
+    _In_opt_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDst,
+    _In_reads_(cPixels) const BYTE *pjSrc,
+    _In_ ULONG cPixels)
+{
+    PFN_XLATE pfnXlate;
+    const ULONG *pulXlate;
+    ULONG i;
+
+    pfnXlate = pexlo ? pexlo->pfnXlate : EXLATEOBJ_iXlateTrivial;
+
+    if (pfnXlate == EXLATEOBJ_iXlateTrivial)
+    {
+        for (i = 0; i < cPixels; i++)
+            pulDst[i] = pjSrc[i];
+    }
+    else if ((pfnXlate == EXLATEOBJ_iXlateTable) && (pexlo->xlo.cEntries >= 256))
+    {
+        pulXlate = pexlo->xlo.pulXlate;
+
+        for (i = 0; i + 4 <= cPixels; i += 4)
+        {
+            pulDst[i] = pulXlate[pjSrc[i]];
+            pulDst[i + 1] = pulXlate[pjSrc[i + 1]];
+            pulDst[i + 2] = pulXlate[pjSrc[i + 2]];
+            pulDst[i + 3] = pulXlate[pjSrc[i + 3]];
+        }
+
+        for (; i < cPixels; i++)
+            pulDst[i] = pulXlate[pjSrc[i]];
+    }
+    else
+    {
+        for (i = 0; i < cPixels; i++)
+            pulDst[i] = pfnXlate(pexlo, pjSrc[i]);
+    }
+}
+
+/*
+ * Translate a row of 32 bpp pixels to 16 bpp, see EXLATEOBJ_vXlateRow16to32.
+ */
+VOID
+NTAPI
+EXLATEOBJ_vXlateRow32to16(
+    _In_opt_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PUSHORT pusDst,
+    _In_reads_(cPixels) const ULONG *pulSrc,
+    _In_ ULONG cPixels)
+{
+    PFN_XLATE pfnXlate;
+    ULONG ulRedMask, ulGreenMask, ulBlueMask;
+    ULONG ulRedShift, ulGreenShift, ulBlueShift;
+    ULONG i, iColor;
+
+    pfnXlate = pexlo ? pexlo->pfnXlate : EXLATEOBJ_iXlateTrivial;
+
+    if (pfnXlate == EXLATEOBJ_iXlateTrivial)
+    {
+        for (i = 0; i < cPixels; i++)
+            pusDst[i] = (USHORT)pulSrc[i];
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlateRGBto555)
+    {
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pulSrc[i];
+            pusDst[i] = (USHORT)(((iColor << 7) & 0x7C00) |
+                                 ((iColor >> 6) & 0x3E0) |
+                                 ((iColor >> 19) & 0x1F));
+        }
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlateBGRto555)
+    {
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pulSrc[i];
+            pusDst[i] = (USHORT)(((iColor >> 3) & 0x1F) |
+                                 ((iColor >> 6) & 0x3E0) |
+                                 ((iColor >> 9) & 0x7C00));
+        }
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlateRGBto565)
+    {
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pulSrc[i];
+            pusDst[i] = (USHORT)(((iColor << 8) & 0xF800) |
+                                 ((iColor >> 5) & 0x7E0) |
+                                 ((iColor >> 19) & 0x1F));
+        }
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlateBGRto565)
+    {
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pulSrc[i];
+            pusDst[i] = (USHORT)(((iColor >> 3) & 0x1F) |
+                                 ((iColor >> 5) & 0x7E0) |
+                                 ((iColor >> 8) & 0xF800));
+        }
+    }
+    else if (pfnXlate == EXLATEOBJ_iXlateShiftAndMask)
+    {
+        ulRedMask = pexlo->ulRedMask;
+        ulGreenMask = pexlo->ulGreenMask;
+        ulBlueMask = pexlo->ulBlueMask;
+        ulRedShift = pexlo->ulRedShift;
+        ulGreenShift = pexlo->ulGreenShift;
+        ulBlueShift = pexlo->ulBlueShift;
+
+        for (i = 0; i < cPixels; i++)
+        {
+            iColor = pulSrc[i];
+            pusDst[i] = (USHORT)((_rotl(iColor, ulRedShift) & ulRedMask) |
+                                 (_rotl(iColor, ulGreenShift) & ulGreenMask) |
+                                 (_rotl(iColor, ulBlueShift) & ulBlueMask));
+        }
+    }
+    else
+    {
+        for (i = 0; i < cPixels; i++)
+            pusDst[i] = (USHORT)pfnXlate(pexlo, pulSrc[i]);
+    }
+}
+
 /** Public DDI Functions ******************************************************/
 
 #undef XLATEOBJ_iXlate
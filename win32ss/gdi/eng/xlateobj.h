@@ -45,6 +45,11 @@ typedef struct _EXLATEOBJ
 
 extern EXLATEOBJ gexloTrivial;
 
+INIT_FUNCTION
+NTSTATUS
+NTAPI
+InitXlateImpl(VOID);
+
 _Notnull_
 FORCEINLINE
 PFN_XLATE
@@ -84,3 +89,27 @@ NTAPI
 EXLATEOBJ_vCleanup(
     _Inout_ PEXLATEOBJ pexlo);
 
+VOID
+NTAPI
+EXLATEOBJ_vXlateRow8to32(
+    _In_opt_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDst,
+    _In_reads_(cPixels) const BYTE *pjSrc,
+    _In_ ULONG cPixels);
+
+VOID
+NTAPI
+EXLATEOBJ_vXlateRow16to32(
+    _In_opt_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDst,
+    _In_reads_(cPixels) const USHORT *pusSrc,
+    _In_ ULONG cPixels);
+
+VOID
+NTAPI
+EXLATEOBJ_vXlateRow32to16(
+    _In_opt_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PUSHORT pusDst,
+    _In_reads_(cPixels) const ULONG *pulSrc,
+    _In_ ULONG cPixels);
+
@@ -315,12 +315,12 @@ BOOL FASTCALL LoadTheSpoolerDrv(VOID);
 
 FORCEINLINE
 PVOID
-GdiAllocBatchCommand(
+GdiAllocBatchCommandSize(
     HDC hdc,
-    USHORT Cmd)
+    USHORT Cmd,
+    USHORT cjSize)
 {
     PTEB pTeb;
-    USHORT cjSize;
     PGDIBATCHHDR pHdr;
 
     /* Get a pointer to the TEB */
@@ -329,40 +329,23 @@ GdiAllocBatchCommand(
     /* Check if we have a valid environment */
     if (!pTeb || !pTeb->Win32ThreadInfo) return NULL;
 
-    /* Do we use a DC? */
-    if (hdc)
-    {
-        /* If the batch DC is NULL, we set this one as the new one */
-        if (!pTeb->GdiTebBatch.HDC) pTeb->GdiTebBatch.HDC = hdc;
-
-        /* If not, check if the batch DC equal to our DC */
-        else if (pTeb->GdiTebBatch.HDC != hdc) return NULL;
-    }
+    /* Check if the entry can fit at all */
+    if ((cjSize == 0) || (cjSize > GDIBATCHBUFSIZE)) return NULL;
 
-    /* Get the size of the entry */
-    if      (Cmd == GdiBCPatBlt) cjSize = 0;
-    else if (Cmd == GdiBCPolyPatBlt) cjSize = 0;
-    else if (Cmd == GdiBCTextOut) cjSize = 0;
-    else if (Cmd == GdiBCExtTextOut) cjSize = 0;
-    else if (Cmd == GdiBCSetBrushOrg) cjSize = sizeof(GDIBSSETBRHORG);
-    else if (Cmd == GdiBCExtSelClipRgn) cjSize = 0;
-    else if (Cmd == GdiBCSelObj) cjSize = sizeof(GDIBSOBJECT);
-    else if (Cmd == GdiBCDelRgn) cjSize = sizeof(GDIBSOBJECT);
-    else if (Cmd == GdiBCDelObj) cjSize = sizeof(GDIBSOBJECT);
-    else cjSize = 0;
-
-    /* Unsupported operation */
-    if (cjSize == 0) return NULL;
-
-    /* Check if the buffer is full */
+    /* Check if the buffer is full or the batch belongs to another DC. The
+       batch is replayed on a single DC, so it has to go before we switch */
     if ((pTeb->GdiBatchCount >= GDI_BatchLimit) ||
-        ((pTeb->GdiTebBatch.Offset + cjSize) > GDIBATCHBUFSIZE))
+        ((pTeb->GdiTebBatch.Offset + cjSize) > GDIBATCHBUFSIZE) ||
+        (hdc && pTeb->GdiTebBatch.HDC && (pTeb->GdiTebBatch.HDC != hdc)))
     {
         /* Call win32k, the kernel will call NtGdiFlushUserBatch to flush
            the current batch */
         NtGdiFlush();
     }
 
+    /* If the batch DC is NULL, we set this one as the new one */
+    if (hdc && !pTeb->GdiTebBatch.HDC) pTeb->GdiTebBatch.HDC = hdc;
+
     /* Get the head of the entry */
     pHdr = (PVOID)((PUCHAR)pTeb->GdiTebBatch.Buffer + pTeb->GdiTebBatch.Offset);
 
@@ -377,6 +360,34 @@ GdiAllocBatchCommand(
     return pHdr;
 }
 
+FORCEINLINE
+PVOID
+GdiAllocBatchCommand(
+    HDC hdc,
+    USHORT Cmd)
+{
+    USHORT cjSize;
+
+    /* Get the size of the entry */
+    if      (Cmd == GdiBCPatBlt) cjSize = sizeof(GDIBSPATBLT);
+    else if (Cmd == GdiBCPolyPatBlt) cjSize = 0;
+    else if (Cmd == GdiBCTextOut) cjSize = 0;
+    else if (Cmd == GdiBCExtTextOut) cjSize = 0;
+    else if (Cmd == GdiBCSetBrushOrg) cjSize = sizeof(GDIBSSETBRHORG);
+    else if (Cmd == GdiBCExtSelClipRgn) cjSize = 0;
+    else if (Cmd == GdiBCSelObj) cjSize = sizeof(GDIBSOBJECT);
+    else if (Cmd == GdiBCDelRgn) cjSize = sizeof(GDIBSOBJECT);
+    else if (Cmd == GdiBCDelObj) cjSize = sizeof(GDIBSOBJECT);
+    else if (Cmd == GdiBCLineTo) cjSize = sizeof(GDIBSLINETO);
+    else if (Cmd == GdiBCSetPixel) cjSize = sizeof(GDIBSSETPIXEL);
+    else cjSize = 0;
+
+    /* Unsupported operation */
+    if (cjSize == 0) return NULL;
+
+    return GdiAllocBatchCommandSize(hdc, Cmd, cjSize);
+}
+
 FORCEINLINE
 PDC_ATTR
 GdiGetDcAttr(HDC hdc)
@@ -1046,6 +1046,16 @@ SetBkMode(
         return 0;
     }
 
+    /* Batched lines must still be drawn with the old mode */
+    if (NtCurrentTeb()->GdiTebBatch.HDC == hdc)
+    {
+        if (pdcattr->ulDirty_ & DC_MODE_DIRTY)
+        {
+            NtGdiFlush();
+            pdcattr->ulDirty_ &= ~DC_MODE_DIRTY;
+        }
+    }
+
     iOldMode = pdcattr->lBkMode;
     pdcattr->jBkMode = iBkMode; // Processed
     pdcattr->lBkMode = iBkMode; // Raw
@@ -1,5 +1,26 @@
 #include <precomp.h>
 
+/*
+ * Returns the DC attribute if drawing on the DC can be queued on the
+ * thread's batch. Meta DCs draw in user mode and the bits of a DIB section
+ * can be read by the application at any time, so those are not batched.
+ */
+static
+PDC_ATTR
+GdiGetBatchDcAttr(
+    _In_ HDC hdc)
+{
+    PDC_ATTR pdcattr;
+
+    if (GDI_HANDLE_GET_TYPE(hdc) != GDILoObjType_LO_DC_TYPE)
+        return NULL;
+
+    pdcattr = GdiGetDcAttr(hdc);
+    if ((pdcattr == NULL) || (pdcattr->ulDirty_ & DC_DIBSECTION))
+        return NULL;
+
+    return pdcattr;
+}
 
 /*
  * @implemented
@@ -11,8 +32,34 @@ LineTo(
     _In_ INT x,
     _In_ INT y )
 {
+    PDC_ATTR pdcattr;
+    PGDIBSLINETO pgLT;
+
     HANDLE_METADC(BOOL, LineTo, FALSE, hdc, x, y);
 
+    /* The start point must be known in logical coordinates */
+    pdcattr = GdiGetBatchDcAttr(hdc);
+    if ((pdcattr != NULL) && !(pdcattr->ulDirty_ & DIRTY_PTLCURRENT))
+    {
+        pgLT = GdiAllocBatchCommand(hdc, GdiBCLineTo);
+        if (pgLT != NULL)
+        {
+            /* Record the pen and colors, they can change before the flush */
+            pgLT->ptlStart = pdcattr->ptlCurrent;
+            pgLT->ptlEnd.x = x;
+            pgLT->ptlEnd.y = y;
+            pgLT->hpen = pdcattr->hpen;
+            pgLT->crForegroundClr = pdcattr->crForegroundClr;
+            pgLT->crBackgroundClr = pdcattr->crBackgroundClr;
+            pgLT->crPenClr = pdcattr->crPenClr;
+
+            /* Move the current position like the kernel would */
+            pdcattr->ptlCurrent = pgLT->ptlEnd;
+            pdcattr->ulDirty_ |= (DIRTY_PTFXCURRENT|DC_MODE_DIRTY);
+            return TRUE;
+        }
+    }
+
     return NtGdiLineTo(hdc, x, y);
 }
 
@@ -161,6 +208,24 @@ SetPixelV(
     _In_ INT y,
     _In_ COLORREF crColor)
 {
+    PDC_ATTR pdcattr;
+    PGDIBSSETPIXEL pgSP;
+
+    /* Unlike SetPixel no color is returned, so the pixel can be batched */
+    pdcattr = GdiGetBatchDcAttr(hdc);
+    if (pdcattr != NULL)
+    {
+        pgSP = GdiAllocBatchCommand(hdc, GdiBCSetPixel);
+        if (pgSP != NULL)
+        {
+            pgSP->x = x;
+            pgSP->y = y;
+            pgSP->crColor = crColor;
+            pdcattr->ulDirty_ |= DC_MODE_DIRTY;
+            return TRUE;
+        }
+    }
+
     return SetPixel(hdc, x, y, crColor) != CLR_INVALID;
 }
 
@@ -456,9 +521,38 @@ PatBlt(
     _In_ INT nHeight,
     _In_ DWORD dwRop)
 {
+    PDC_ATTR pdcattr;
+    PGDIBSPATBLT pgPB;
+
     HANDLE_METADC(BOOL, PatBlt, FALSE, hdc, nXLeft, nYLeft, nWidth, nHeight, dwRop);
 
-    /* FIXME some part need be done in user mode */
+    /* Only pattern ROPs can be batched, the kernel fails the others */
+    pdcattr = GdiGetBatchDcAttr(hdc);
+    if ((pdcattr != NULL) && !ROP_USES_SOURCE(dwRop))
+    {
+        pgPB = GdiAllocBatchCommand(hdc, GdiBCPatBlt);
+        if (pgPB != NULL)
+        {
+            /* Record the brush and colors, they can change before the flush */
+            pgPB->nXLeft = nXLeft;
+            pgPB->nYLeft = nYLeft;
+            pgPB->nWidth = nWidth;
+            pgPB->nHeight = nHeight;
+            pgPB->hbrush = pdcattr->hbrush;
+            pgPB->dwRop = dwRop;
+            pgPB->crForegroundClr = pdcattr->crForegroundClr;
+            pgPB->crBackgroundClr = pdcattr->crBackgroundClr;
+            pgPB->crBrushClr = pdcattr->crBrushClr;
+            pgPB->IcmBrushColor = 0;
+            pgPB->ptlViewportOrg = pdcattr->ptlViewportOrg;
+            pgPB->ulForegroundClr = pdcattr->ulForegroundClr;
+            pgPB->ulBackgroundClr = pdcattr->ulBackgroundClr;
+            pgPB->ulBrushClr = pdcattr->ulBrushClr;
+            pdcattr->ulDirty_ |= DC_MODE_DIRTY;
+            return TRUE;
+        }
+    }
+
     return NtGdiPatBlt( hdc,  nXLeft,  nYLeft,  nWidth,  nHeight,  dwRop);
 }
 
@@ -474,6 +568,9 @@ PolyPatBlt(
     UINT i;
     BOOL bResult;
     HBRUSH hbrOld;
+    PDC_ATTR pdcattr;
+    PGDIBSPPATBLT pgPPB;
+    SIZE_T cjSize;
 
     /* Handle meta DCs */
     if ((GDI_HANDLE_GET_TYPE(hdc) == GDILoObjType_LO_METADC16_TYPE) ||
@@ -511,7 +608,34 @@ PolyPatBlt(
         return bResult;
     }
 
-    /* FIXME some part need be done in user mode */
+    /* Batch the rects if they fit, the kernel fails ROPs that use a source */
+    pdcattr = GdiGetBatchDcAttr(hdc);
+    cjSize = FIELD_OFFSET(GDIBSPPATBLT, pRect) + (SIZE_T)nCount * sizeof(PATRECT);
+    if ((pdcattr != NULL) && (nCount > 0) && !ROP_USES_SOURCE(dwRop) &&
+        (nCount <= GDIBATCHBUFSIZE / sizeof(PATRECT)) &&
+        (cjSize <= GDIBATCHBUFSIZE))
+    {
+        pgPPB = GdiAllocBatchCommandSize(hdc, GdiBCPolyPatBlt, (USHORT)cjSize);
+        if (pgPPB != NULL)
+        {
+            pgPPB->rop4 = dwRop;
+            pgPPB->Mode = dwMode;
+            pgPPB->Count = nCount;
+            pgPPB->crForegroundClr = pdcattr->crForegroundClr;
+            pgPPB->crBackgroundClr = pdcattr->crBackgroundClr;
+            pgPPB->crBrushClr = pdcattr->crBrushClr;
+            pgPPB->ulForegroundClr = pdcattr->ulForegroundClr;
+            pgPPB->ulBackgroundClr = pdcattr->ulBackgroundClr;
+            pgPPB->ulBrushClr = pdcattr->ulBrushClr;
+            pgPPB->ptlViewportOrg = pdcattr->ptlViewportOrg;
+
+            /* POLYPATBLT and PATRECT have the same layout */
+            RtlCopyMemory(pgPPB->pRect, pPoly, nCount * sizeof(PATRECT));
+            pdcattr->ulDirty_ |= DC_MODE_DIRTY;
+            return TRUE;
+        }
+    }
+
     return NtGdiPolyPatBlt(hdc, dwRop, pPoly, nCount, dwMode);
 }
 
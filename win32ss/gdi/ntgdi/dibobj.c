@@ -1338,7 +1338,8 @@ NtGdiStretchDIBitsInternal(
                                NULL,
                                &pdc->eboFill.BrushObject,
                                NULL,
-                               WIN32_ROP3_TO_ENG_ROP4(dwRop));
+                               WIN32_ROP3_TO_ENG_ROP4(dwRop),
+                               pdc->pdcattr->jStretchBltMode);
 
     /* Cleanup */
     DC_vFinishBlit(pdc, NULL);
@@ -2039,6 +2040,8 @@ DIB_MapPaletteColors(PPALETTE ppalDc, CONST BITMAPINFO* lpbmi)
         lpIndex++;
     }
 
+    PALETTE_vChanged(ppalNew);
+
     hpal = ppalNew->BaseObject.hHmgr;
     PALETTE_UnlockPalette(ppalNew);
 
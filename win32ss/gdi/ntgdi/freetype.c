@@ -86,10 +86,15 @@ static BOOL RenderingEnabled = TRUE;
 #define ASSERT_FREETYPE_LOCK_NOT_HELD() \
   ASSERT(FreeTypeLock->Owner != KeGetCurrentThread())
 
-#define MAX_FONT_CACHE 256
+/* The glyph cache is limited by the memory its bitmaps take, so that it
+ * holds many more glyphs of the small sizes text is mostly drawn in */
+#define MAX_FONT_CACHE_SIZE (1024 * 1024)
+#define FONT_CACHE_HASH_SIZE 512
 
 static LIST_ENTRY FontCacheListHead;
+static LIST_ENTRY FontCacheHashTable[FONT_CACHE_HASH_SIZE];
 static UINT FontCacheNumEntries;
+static SIZE_T FontCacheSize;
 
 static PWCHAR ElfScripts[32] =   /* These are in the order of the fsCsb[0] bits */
 {
@@ -177,6 +182,8 @@ SharedFaceCache_Init(PSHARED_FACE_CACHE Cache)
     Cache->OutlineRequiredSize = 0;
     RtlInitUnicodeString(&Cache->FontFamily, NULL);
     RtlInitUnicodeString(&Cache->FullName, NULL);
+    Cache->FontFamilyHash = 0;
+    Cache->FullNameHash = 0;
 }
 
 static PSHARED_FACE
@@ -229,9 +236,11 @@ RemoveCachedEntry(PFONT_CACHE_ENTRY Entry)
 
     FT_Done_Glyph((FT_Glyph)Entry->BitmapGlyph);
     RemoveEntryList(&Entry->ListEntry);
+    RemoveEntryList(&Entry->HashEntry);
+    ASSERT(FontCacheSize >= Entry->cjSize);
+    FontCacheSize -= Entry->cjSize;
     ExFreePoolWithTag(Entry, TAG_FONT);
     FontCacheNumEntries--;
-    ASSERT(FontCacheNumEntries <= MAX_FONT_CACHE);
 }
 
 static void
@@ -454,10 +463,16 @@ BOOL FASTCALL
 InitFontSupport(VOID)
 {
     ULONG ulError;
+    UINT i;
 
     InitializeListHead(&FontListHead);
     InitializeListHead(&FontCacheListHead);
+    for (i = 0; i < FONT_CACHE_HASH_SIZE; i++)
+    {
+        InitializeListHead(&FontCacheHashTable[i]);
+    }
     FontCacheNumEntries = 0;
+    FontCacheSize = 0;
     /* Fast Mutexes must be allocated from non paged pool */
     FontListLock = ExAllocatePoolWithTag(NonPagedPool, sizeof(FAST_MUTEX), TAG_INTERNAL_SYNC);
     if (FontListLock == NULL)
@@ -2085,6 +2100,26 @@ DuplicateUnicodeString(PUNICODE_STRING Source, PUNICODE_STRING Destination)
     return Status;
 }
 
+/*
+ * IntFaceNameHash
+ *
+ * Hash a face name the way _wcsicmp compares it, so that names that
+ * GetFontPenalty takes as equal hash the same.
+ */
+static ULONG
+IntFaceNameHash(PCWSTR pszName, SIZE_T cchMax)
+{
+    ULONG Hash = 0;
+
+    while (cchMax-- > 0 && *pszName)
+    {
+        Hash = Hash * 65599 + towlower(*pszName);
+        ++pszName;
+    }
+
+    return Hash;
+}
+
 static NTSTATUS
 IntGetFontLocalizedName(PUNICODE_STRING pNameW, PSHARED_FACE SharedFace,
                         FT_UShort NameID, FT_UShort LangID)
@@ -2228,16 +2263,24 @@ IntGetFontLocalizedName(PUNICODE_STRING pNameW, PSHARED_FACE SharedFace,
         {
             ASSERT_FREETYPE_LOCK_NOT_HELD();
             IntLockFreeType;
-            if (!Cache->FontFamily.Buffer)
-                DuplicateUnicodeString(pNameW, &Cache->FontFamily);
+            if (!Cache->FontFamily.Buffer &&
+                NT_SUCCESS(DuplicateUnicodeString(pNameW, &Cache->FontFamily)))
+            {
+                Cache->FontFamilyHash = IntFaceNameHash(pNameW->Buffer,
+                                                        pNameW->Length / sizeof(WCHAR));
+            }
             IntUnLockFreeType;
         }
         else if (NameID == TT_NAME_ID_FULL_NAME)
         {
             ASSERT_FREETYPE_LOCK_NOT_HELD();
             IntLockFreeType;
-            if (!Cache->FullName.Buffer)
-                DuplicateUnicodeString(pNameW, &Cache->FullName);
+            if (!Cache->FullName.Buffer &&
+                NT_SUCCESS(DuplicateUnicodeString(pNameW, &Cache->FullName)))
+            {
+                Cache->FullNameHash = IntFaceNameHash(pNameW->Buffer,
+                                                      pNameW->Length / sizeof(WCHAR));
+            }
             IntUnLockFreeType;
         }
     }
@@ -2614,6 +2657,27 @@ SameScaleMatrix(
             FLOATOBJ_Equal(&pmx1->efM22, &pmx2->efM22));
 }
 
+static __inline
+PLIST_ENTRY
+FontCacheBucket(
+    FT_Face Face,
+    INT GlyphIndex,
+    INT Height,
+    FT_Render_Mode RenderMode)
+{
+    ULONG Hash;
+
+    /* The transformation is left out, it rarely differs between the
+     * glyphs of a bucket and is compared on lookup anyway */
+    Hash = (ULONG)((ULONG_PTR)Face >> 4);
+    Hash = Hash * 31 + (ULONG)Height;
+    Hash = Hash * 31 + (ULONG)RenderMode;
+    Hash = Hash * 31 + (ULONG)GlyphIndex;
+    Hash ^= Hash >> 16;
+
+    return &FontCacheHashTable[Hash & (FONT_CACHE_HASH_SIZE - 1)];
+}
+
 FT_BitmapGlyph APIENTRY
 ftGdiGlyphCacheGet(
     FT_Face Face,
@@ -2622,32 +2686,32 @@ ftGdiGlyphCacheGet(
     FT_Render_Mode RenderMode,
     PMATRIX pmx)
 {
-    PLIST_ENTRY CurrentEntry;
+    PLIST_ENTRY Bucket, CurrentEntry;
     PFONT_CACHE_ENTRY FontEntry;
 
     ASSERT_FREETYPE_LOCK_HELD();
 
-    CurrentEntry = FontCacheListHead.Flink;
-    while (CurrentEntry != &FontCacheListHead)
+    Bucket = FontCacheBucket(Face, GlyphIndex, Height, RenderMode);
+
+    for (CurrentEntry = Bucket->Flink;
+         CurrentEntry != Bucket;
+         CurrentEntry = CurrentEntry->Flink)
     {
-        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, ListEntry);
+        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, HashEntry);
         if ((FontEntry->Face == Face) &&
             (FontEntry->GlyphIndex == GlyphIndex) &&
             (FontEntry->Height == Height) &&
             (FontEntry->RenderMode == RenderMode) &&
             (SameScaleMatrix(&FontEntry->mxWorldToDevice, pmx)))
-            break;
-        CurrentEntry = CurrentEntry->Flink;
-    }
-
-    if (CurrentEntry == &FontCacheListHead)
-    {
-        return NULL;
+        {
+            /* Most recently used at the head */
+            RemoveEntryList(&FontEntry->ListEntry);
+            InsertHeadList(&FontCacheListHead, &FontEntry->ListEntry);
+            return FontEntry->BitmapGlyph;
+        }
     }
 
-    RemoveEntryList(CurrentEntry);
-    InsertHeadList(&FontCacheListHead, CurrentEntry);
-    return FontEntry->BitmapGlyph;
+    return NULL;
 }
 
 /* no cache */
@@ -2752,12 +2816,23 @@ ftGdiGlyphCacheSet(
     NewEntry->Height = Height;
     NewEntry->RenderMode = RenderMode;
     NewEntry->mxWorldToDevice = *pmx;
+    NewEntry->cjSize = sizeof(FONT_CACHE_ENTRY) +
+                       abs(BitmapGlyph->bitmap.pitch) * BitmapGlyph->bitmap.rows;
 
     InsertHeadList(&FontCacheListHead, &NewEntry->ListEntry);
-    if (++FontCacheNumEntries > MAX_FONT_CACHE)
+    InsertHeadList(FontCacheBucket(Face, GlyphIndex, Height, RenderMode),
+                   &NewEntry->HashEntry);
+    FontCacheNumEntries++;
+    FontCacheSize += NewEntry->cjSize;
+
+    /* Drop the least recently used glyphs until the cache fits again, but
+     * never the one the caller is about to draw */
+    while ((FontCacheSize > MAX_FONT_CACHE_SIZE) &&
+           (FontCacheListHead.Blink != &NewEntry->ListEntry))
     {
-        NewEntry = CONTAINING_RECORD(FontCacheListHead.Blink, FONT_CACHE_ENTRY, ListEntry);
-        RemoveCachedEntry(NewEntry);
+        RemoveCachedEntry(CONTAINING_RECORD(FontCacheListHead.Blink,
+                                            FONT_CACHE_ENTRY,
+                                            ListEntry));
     }
 
     return BitmapGlyph;
@@ -4355,9 +4430,48 @@ GetFontPenalty(const LOGFONTW *               LogFont,
     return Penalty;     /* success */
 }
 
+/*
+ * IntFaceNameMayMatch
+ *
+ * Tell from the cached names of a face, without building its metrics,
+ * whether its family or full name can be the one hashed to NameHash.
+ */
+static BOOL
+IntFaceNameMayMatch(PSHARED_FACE SharedFace, ULONG NameHash)
+{
+    PSHARED_FACE_CACHE Cache;
+    UNICODE_STRING NameW;
+
+    /* The same names IntGetOutlineTextMetrics puts into the metrics */
+    if (PRIMARYLANGID(gusLanguageID) == LANG_ENGLISH)
+        Cache = &SharedFace->EnglishUS;
+    else
+        Cache = &SharedFace->UserLanguage;
+
+    if (!Cache->FontFamily.Buffer)
+    {
+        RtlInitUnicodeString(&NameW, NULL);
+        IntGetFontLocalizedName(&NameW, SharedFace, TT_NAME_ID_FONT_FAMILY, gusLanguageID);
+        RtlFreeUnicodeString(&NameW);
+    }
+    if (!Cache->FullName.Buffer)
+    {
+        RtlInitUnicodeString(&NameW, NULL);
+        IntGetFontLocalizedName(&NameW, SharedFace, TT_NAME_ID_FULL_NAME, gusLanguageID);
+        RtlFreeUnicodeString(&NameW);
+    }
+
+    /* Without the names, let GetFontPenalty decide */
+    if (!Cache->FontFamily.Buffer || !Cache->FullName.Buffer)
+        return TRUE;
+
+    return (Cache->FontFamilyHash == NameHash || Cache->FullNameHash == NameHash);
+}
+
 static __inline VOID
 FindBestFontFromList(FONTOBJ **FontObj, ULONG *MatchPenalty,
                      const LOGFONTW *LogFont,
+                     const ULONG *pNameHash,
                      const PLIST_ENTRY Head)
 {
     ULONG Penalty;
@@ -4388,6 +4502,10 @@ FindBestFontFromList(FONTOBJ **FontObj, ULONG *MatchPenalty,
         ASSERT(FontGDI);
         Face = FontGDI->SharedFace->Face;
 
+        /* only look at the faces of the requested name, if asked to */
+        if (pNameHash && !IntFaceNameMayMatch(FontGDI->SharedFace, *pNameHash))
+            continue;
+
         /* get text metrics */
         OtmSize = IntGetOutlineTextMetrics(FontGDI, 0, NULL);
         if (OtmSize > OldOtmSize)
@@ -4462,6 +4580,7 @@ TextIntRealizeFont(HFONT FontHandle, PTEXTOBJ pTextObj)
     LOGFONTW *pLogFont;
     LOGFONTW SubstitutedLogFont;
     FT_Face Face;
+    ULONG NameHash;
 
     if (!pTextObj)
     {
@@ -4495,17 +4614,44 @@ TextIntRealizeFont(HFONT FontHandle, PTEXTOBJ pTextObj)
 
     Win32Process = PsGetCurrentProcessWin32Process();
 
-    /* Search private fonts */
-    IntLockProcessPrivateFonts(Win32Process);
-    FindBestFontFromList(&TextObj->Font, &MatchPenalty, &SubstitutedLogFont,
-                         &Win32Process->PrivateFontListHead);
-    IntUnLockProcessPrivateFonts(Win32Process);
+    /* A face of the requested name has no FaceName penalty, which every
+       other face has. If one of them is good enough to stay under it, no
+       other face can beat it and the rest don't need to be looked at. */
+    if (SubstitutedLogFont.lfFaceName[0])
+    {
+        NameHash = IntFaceNameHash(SubstitutedLogFont.lfFaceName, LF_FACESIZE);
 
-    /* Search system fonts */
-    IntLockGlobalFonts;
-    FindBestFontFromList(&TextObj->Font, &MatchPenalty, &SubstitutedLogFont,
-                         &FontListHead);
-    IntUnLockGlobalFonts;
+        IntLockProcessPrivateFonts(Win32Process);
+        FindBestFontFromList(&TextObj->Font, &MatchPenalty, &SubstitutedLogFont,
+                             &NameHash, &Win32Process->PrivateFontListHead);
+        IntUnLockProcessPrivateFonts(Win32Process);
+
+        IntLockGlobalFonts;
+        FindBestFontFromList(&TextObj->Font, &MatchPenalty, &SubstitutedLogFont,
+                             &NameHash, &FontListHead);
+        IntUnLockGlobalFonts;
+
+        if (MatchPenalty >= 10000)
+        {
+            MatchPenalty = 0xFFFFFFFF;
+            TextObj->Font = NULL;
+        }
+    }
+
+    if (NULL == TextObj->Font)
+    {
+        /* Search private fonts */
+        IntLockProcessPrivateFonts(Win32Process);
+        FindBestFontFromList(&TextObj->Font, &MatchPenalty, &SubstitutedLogFont,
+                             NULL, &Win32Process->PrivateFontListHead);
+        IntUnLockProcessPrivateFonts(Win32Process);
+
+        /* Search system fonts */
+        IntLockGlobalFonts;
+        FindBestFontFromList(&TextObj->Font, &MatchPenalty, &SubstitutedLogFont,
+                             NULL, &FontListHead);
+        IntUnLockGlobalFonts;
+    }
 
     if (NULL == TextObj->Font)
     {
@@ -5737,15 +5883,15 @@ GreExtTextOutW(
             }
             for (i = -thickness / 2; i < -thickness / 2 + thickness; ++i)
             {
-                EngLineTo(SurfObj,
-                          (CLIPOBJ *)&dc->co,
-                          &dc->eboText.BrushObject,
-                          (TextLeft >> 6),
-                          TextTop + yoff - position + i,
-                          ((TextLeft + (realglyph->root.advance.x >> 10)) >> 6),
-                          TextTop + yoff - position + i,
-                          NULL,
-                          ROP2_TO_MIX(R2_COPYPEN));
+                IntEngLineTo(SurfObj,
+                             (CLIPOBJ *)&dc->co,
+                             &dc->eboText.BrushObject,
+                             (TextLeft >> 6),
+                             TextTop + yoff - position + i,
+                             ((TextLeft + (realglyph->root.advance.x >> 10)) >> 6),
+                             TextTop + yoff - position + i,
+                             NULL,
+                             ROP2_TO_MIX(R2_COPYPEN));
             }
         }
         if (plf->lfStrikeOut)
@@ -5753,15 +5899,15 @@ GreExtTextOutW(
             int i;
             for (i = -thickness / 2; i < -thickness / 2 + thickness; ++i)
             {
-                EngLineTo(SurfObj,
-                          (CLIPOBJ *)&dc->co,
-                          &dc->eboText.BrushObject,
-                          (TextLeft >> 6),
-                          TextTop + yoff - (fixAscender >> 6) / 3 + i,
-                          ((TextLeft + (realglyph->root.advance.x >> 10)) >> 6),
-                          TextTop + yoff - (fixAscender >> 6) / 3 + i,
-                          NULL,
-                          ROP2_TO_MIX(R2_COPYPEN));
+                IntEngLineTo(SurfObj,
+                             (CLIPOBJ *)&dc->co,
+                             &dc->eboText.BrushObject,
+                             (TextLeft >> 6),
+                             TextTop + yoff - (fixAscender >> 6) / 3 + i,
+                             ((TextLeft + (realglyph->root.advance.x >> 10)) >> 6),
+                             TextTop + yoff - (fixAscender >> 6) / 3 + i,
+                             NULL,
+                             ROP2_TO_MIX(R2_COPYPEN));
             }
         }
 
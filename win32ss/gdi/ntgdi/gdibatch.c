@@ -59,6 +59,53 @@ SynchonizeDriver(FLONG Flags)
   return;
 }
 
+//
+// Replay a batched PatBlt. The brush is realized with the colors that
+// were current when the call was batched, not the ones of the DC now.
+//
+static
+BOOL
+FASTCALL
+GdiBatchPatBlt(
+    PDC dc,
+    HBRUSH hbrush,
+    INT x,
+    INT y,
+    INT cx,
+    INT cy,
+    DWORD dwRop,
+    COLORREF crForegroundClr,
+    COLORREF crBackgroundClr,
+    COLORREF crBrushClr)
+{
+  PBRUSH pbrush;
+  EBRUSHOBJ eboFill;
+  BOOL Ret;
+
+  /* Like NtGdiPatBlt, ROPs that use a source are not possible */
+  if (WIN32_ROP4_USES_SOURCE(MAKEROP4(dwRop & 0xFF0000, dwRop)))
+     return FALSE;
+
+  pbrush = BRUSH_ShareLockBrush(hbrush);
+  if (!pbrush) return FALSE;
+
+  EBRUSHOBJ_vInit(&eboFill,
+                  pbrush,
+                  dc->dclevel.pSurface,
+                  crBackgroundClr,
+                  crForegroundClr,
+                  dc->dclevel.ppal);
+
+  if (hbrush == StockObjects[DC_BRUSH])
+     EBRUSHOBJ_vSetSolidRGBColor(&eboFill, crBrushClr);
+
+  Ret = IntPatBlt(dc, x, y, cx, cy, dwRop, &eboFill);
+
+  EBRUSHOBJ_vCleanup(&eboFill);
+  BRUSH_ShareUnlockBrush(pbrush);
+  return Ret;
+}
+
 //
 // Process the batch.
 //
@@ -89,10 +136,59 @@ GdiFlushUserBatch(PDC dc, PGDIBATCHHDR pHdr)
   switch(Cmd)
   {
      case GdiBCPatBlt:
+     {
+        PGDIBSPATBLT pgPB;
+
+        /* Nothing to draw on empty mem or info DCs */
+        if (!dc || !dc->dclevel.pSurface) break;
+        pgPB = (PGDIBSPATBLT) pHdr;
+
+        GdiBatchPatBlt(dc,
+                       pgPB->hbrush,
+                       pgPB->nXLeft,
+                       pgPB->nYLeft,
+                       pgPB->nWidth,
+                       pgPB->nHeight,
+                       pgPB->dwRop,
+                       pgPB->crForegroundClr,
+                       pgPB->crBackgroundClr,
+                       pgPB->crBrushClr);
         break;
+     }
 
      case GdiBCPolyPatBlt:
+     {
+        PGDIBSPPATBLT pgPPB;
+        PATRECT PatRect;
+        ULONG i, Count;
+
+        if (!dc || !dc->dclevel.pSurface) break;
+        pgPPB = (PGDIBSPPATBLT) pHdr;
+
+        /* Don't trust the count to stay within the entry */
+        Count = pgPPB->Count;
+        if (Size < FIELD_OFFSET(GDIBSPPATBLT, pRect) ||
+            Count > (Size - FIELD_OFFSET(GDIBSPPATBLT, pRect)) / sizeof(PATRECT))
+        {
+           break;
+        }
+
+        for (i = 0; i < Count; i++)
+        {
+           PatRect = pgPPB->pRect[i];
+           GdiBatchPatBlt(dc,
+                          PatRect.hBrush,
+                          PatRect.r.left,
+                          PatRect.r.top,
+                          PatRect.r.right,
+                          PatRect.r.bottom,
+                          pgPPB->rop4,
+                          pgPPB->crForegroundClr,
+                          pgPPB->crBackgroundClr,
+                          pgPPB->crBrushClr);
+        }
         break;
+     }
 
      case GdiBCTextOut:
         break;
@@ -124,6 +220,75 @@ GdiFlushUserBatch(PDC dc, PGDIBATCHHDR pHdr)
         break;
      }
 
+     case GdiBCLineTo:
+     {
+        PGDIBSLINETO pgLT;
+        POINTL ptlCurrent, ptfxCurrent;
+        HANDLE hpen;
+        COLORREF crForegroundClr, crBackgroundClr, crPenClr;
+        ULONG ulDirty;
+        RECT rcLockRect;
+
+        if (!dc) break;
+        pgLT = (PGDIBSLINETO) pHdr;
+
+        /* Save what gdi32 has changed since the line was batched */
+        ptlCurrent = pdcattr->ptlCurrent;
+        ptfxCurrent = pdcattr->ptfxCurrent;
+        hpen = pdcattr->hpen;
+        crForegroundClr = pdcattr->crForegroundClr;
+        crBackgroundClr = pdcattr->crBackgroundClr;
+        crPenClr = pdcattr->crPenClr;
+        ulDirty = pdcattr->ulDirty_;
+
+        /* Draw with the state the DC had at the time of the call */
+        pdcattr->ptlCurrent = pgLT->ptlStart;
+        pdcattr->hpen = pgLT->hpen;
+        pdcattr->crForegroundClr = pgLT->crForegroundClr;
+        pdcattr->crBackgroundClr = pgLT->crBackgroundClr;
+        pdcattr->crPenClr = pgLT->crPenClr;
+        pdcattr->ulDirty_ |= (DIRTY_LINE|DC_PEN_DIRTY|DIRTY_PTFXCURRENT);
+
+        rcLockRect.left = pgLT->ptlStart.x;
+        rcLockRect.top = pgLT->ptlStart.y;
+        rcLockRect.right = pgLT->ptlEnd.x;
+        rcLockRect.bottom = pgLT->ptlEnd.y;
+
+        IntLPtoDP(dc, (LPPOINT)&rcLockRect, 2);
+
+        rcLockRect.left += dc->ptlDCOrig.x;
+        rcLockRect.top += dc->ptlDCOrig.y;
+        rcLockRect.right += dc->ptlDCOrig.x;
+        rcLockRect.bottom += dc->ptlDCOrig.y;
+
+        DC_vPrepareDCsForBlit(dc, &rcLockRect, NULL, NULL);
+
+        IntGdiLineTo(dc, pgLT->ptlEnd.x, pgLT->ptlEnd.y);
+
+        DC_vFinishBlit(dc, NULL);
+
+        /* Restore the DC, the line brush has to be realized again */
+        pdcattr->ptlCurrent = ptlCurrent;
+        pdcattr->ptfxCurrent = ptfxCurrent;
+        pdcattr->hpen = hpen;
+        pdcattr->crForegroundClr = crForegroundClr;
+        pdcattr->crBackgroundClr = crBackgroundClr;
+        pdcattr->crPenClr = crPenClr;
+        pdcattr->ulDirty_ = ulDirty | DIRTY_LINE;
+        break;
+     }
+
+     case GdiBCSetPixel:
+     {
+        PGDIBSSETPIXEL pgSP;
+
+        if (!dc || !dc->dclevel.pSurface) break;
+        pgSP = (PGDIBSSETPIXEL) pHdr;
+
+        IntSetPixel(dc, pgSP->x, pgSP->y, TranslateCOLORREF(dc, pgSP->crColor));
+        break;
+     }
+
      case GdiBCDelRgn:
         DPRINT("Delete Region Object!\n");
         /* Fall through */
@@ -199,6 +364,8 @@ NtGdiFlushUserBatch(VOID)
 
        if (pDC)
        {
+           /* Everything gdi32 batched on the DC has been drawn */
+           pDC->pdcattr->ulDirty_ &= ~DC_MODE_DIRTY;
            DC_UnlockDc(pDC);
        }
 
@@ -381,9 +381,20 @@ ENTRY_pentPopFreeEntry(VOID)
 {
     ULONG iFirst, iNext, iPrev;
     PENTRY pentFree;
+    PW32THREAD pw32thread;
 
     DPRINT("Enter InterLockedPopFreeEntry\n");
 
+    /* Reuse an entry this thread freed, if it kept one */
+    pw32thread = PsGetCurrentThreadWin32Thread();
+    if (pw32thread && pw32thread->cGdiFreeEntries > 0)
+    {
+        pw32thread->cGdiFreeEntries--;
+        pentFree = &gpentHmgr[pw32thread->aulGdiFreeEntries[pw32thread->cGdiFreeEntries]];
+        ASSERT(pentFree->einfo.pobj == NULL);
+        return pentFree;
+    }
+
     do
     {
         /* Get the index and sequence number of the first free entry */
@@ -430,13 +441,42 @@ ENTRY_pentPopFreeEntry(VOID)
     return pentFree;
 }
 
+/* Links an initialized free entry into the global free list */
+static
+VOID
+ENTRY_vLinkFreeEntry(PENTRY pentFree)
+{
+    ULONG iToFree, iFirst, iPrev, idxToFree;
+
+    idxToFree = pentFree - gpentHmgr;
+
+    do
+    {
+        /* Get the current first free index and sequence number */
+        iFirst = InterlockedReadUlong(&gulFirstFree);
+
+        /* Set the einfo.pobj member to the index of the first free entry */
+        pentFree->einfo.pobj = UlongToPtr(iFirst & GDI_HANDLE_INDEX_MASK);
+
+        /* Combine new index and increased sequence number in iToFree */
+        iToFree = idxToFree | ((iFirst & ~GDI_HANDLE_INDEX_MASK) + 0x10000);
+
+        /* Try to atomically update the first free entry */
+        iPrev = InterlockedCompareExchange((LONG*)&gulFirstFree,
+                                           iToFree,
+                                           iFirst);
+    }
+    while (iPrev != iFirst);
+}
+
 /* Pushes an entry of the handle table to the free list,
    The entry must not have any references left */
 static
 VOID
 ENTRY_vPushFreeEntry(PENTRY pentFree)
 {
-    ULONG iToFree, iFirst, iPrev, idxToFree;
+    ULONG idxToFree;
+    PW32THREAD pw32thread;
 
     DPRINT("Enter ENTRY_vPushFreeEntry\n");
 
@@ -452,23 +492,31 @@ ENTRY_vPushFreeEntry(PENTRY pentFree)
     InterlockedExchangeAdd((LONG*)&gpaulRefCount[idxToFree], REF_INC_REUSE);
     pentFree->FullUnique += 0x0100;
 
-    do
+    /* Keep it for the next object of this thread, if there's room. This
+       saves the interlocked operations on the global list head, that all
+       threads creating and deleting objects fight over. */
+    pw32thread = PsGetCurrentThreadWin32Thread();
+    if (pw32thread && pw32thread->cGdiFreeEntries < W32THREAD_GDI_FREE_ENTRIES)
     {
-        /* Get the current first free index and sequence number */
-        iFirst = InterlockedReadUlong(&gulFirstFree);
-
-        /* Set the einfo.pobj member to the index of the first free entry */
-        pentFree->einfo.pobj = UlongToPtr(iFirst & GDI_HANDLE_INDEX_MASK);
+        pentFree->einfo.pobj = NULL;
+        pw32thread->aulGdiFreeEntries[pw32thread->cGdiFreeEntries] = idxToFree;
+        pw32thread->cGdiFreeEntries++;
+        return;
+    }
 
-        /* Combine new index and increased sequence number in iToFree */
-        iToFree = idxToFree | ((iFirst & ~GDI_HANDLE_INDEX_MASK) + 0x10000);
+    ENTRY_vLinkFreeEntry(pentFree);
+}
 
-        /* Try to atomically update the first free entry */
-        iPrev = InterlockedCompareExchange((LONG*)&gulFirstFree,
-                                           iToFree,
-                                           iFirst);
+/* Gives the free entries kept by an exiting thread back to the free list */
+VOID
+NTAPI
+GDIOBJ_vCleanupThread(struct _W32THREAD *pw32thread)
+{
+    while (pw32thread->cGdiFreeEntries > 0)
+    {
+        pw32thread->cGdiFreeEntries--;
+        ENTRY_vLinkFreeEntry(&gpentHmgr[pw32thread->aulGdiFreeEntries[pw32thread->cGdiFreeEntries]]);
     }
-    while (iPrev != iFirst);
 }
 
 static
@@ -1490,7 +1538,9 @@ GDIOBJ_AllocObjWithHandle(ULONG ObjectType, ULONG cjSize)
         (objt == GDIObjType_PAL_TYPE && cjSize == sizeof(PALETTE)) ||
         (objt == GDIObjType_RGN_TYPE && cjSize == sizeof(REGION)) ||
         (objt == GDIObjType_SURF_TYPE && cjSize == sizeof(SURFACE)) ||
-        (objt == GDIObjType_PATH_TYPE && cjSize == sizeof(PATH)))
+        (objt == GDIObjType_PATH_TYPE && cjSize == sizeof(PATH)) ||
+        (objt == GDIObjType_LFONT_TYPE && cjSize == sizeof(TEXTOBJ)) ||
+        (objt == GDIObjType_ICMLCS_TYPE && cjSize == sizeof(COLORSPACE)))
     {
         fl |= BASEFLAG_LOOKASIDE;
     }
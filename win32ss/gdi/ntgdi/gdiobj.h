@@ -196,5 +196,6 @@ GDIOBJ_pvGetObjectAttr(
 
 BOOL    NTAPI GDIOBJ_ConvertToStockObj(HGDIOBJ *hObj);
 POBJ    NTAPI GDIOBJ_AllocObjWithHandle(ULONG ObjectType, ULONG cjSize);
+VOID    NTAPI GDIOBJ_vCleanupThread(struct _W32THREAD *pw32thread);
 PGDIOBJ NTAPI GDIOBJ_ShareLockObj(HGDIOBJ hObj, DWORD ObjectType);
 PVOID   NTAPI GDI_MapHandleTable(PEPROCESS Process);
@@ -73,6 +73,11 @@ GdiThreadCreate(PETHREAD Thread)
 NTSTATUS
 GdiThreadDestroy(PETHREAD Thread)
 {
+    PW32THREAD pw32thread = PsGetThreadWin32Thread(Thread);
+
+    REGION_vCleanupThread(pw32thread);
+    GDIOBJ_vCleanupThread(pw32thread);
+
     return STATUS_SUCCESS;
 }
 
@@ -61,6 +61,21 @@ GreMoveTo( HDC hdc,
 
 /* Shape functions */
 
+BOOL FASTCALL
+IntPatBlt(PDC pdc,
+          INT XLeft,
+          INT YLeft,
+          INT Width,
+          INT Height,
+          DWORD dwRop3,
+          PEBRUSHOBJ pebo);
+
+BOOL FASTCALL
+IntSetPixel(PDC pdc,
+            INT x,
+            INT y,
+            ULONG iSolidColor);
+
 BOOL
 NTAPI
 GreGradientFill(
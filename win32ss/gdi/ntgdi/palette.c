@@ -16,6 +16,7 @@ static UINT SystemPaletteUse = SYSPAL_NOSTATIC;  /* The program need save the pa
 
 PALETTE gpalRGB, gpalBGR, gpalRGB555, gpalRGB565, *gppalMono, *gppalDefault;
 PPALETTE appalSurfaceDefault[11];
+ULONG gulPaletteTime = 0;
 
 const PALETTEENTRY g_sysPalTemplate[NB_RESERVED_COLORS] =
 {
@@ -198,6 +199,9 @@ PALETTE_AllocPalette(
             ppal->flFlags |= PAL_RGB;
     }
 
+    /* The palette gets a stamp no earlier palette had */
+    PALETTE_vChanged(ppal);
+
     return ppal;
 }
 
@@ -504,6 +508,7 @@ NtGdiCreatePaletteInternal(
     _SEH2_END;
 
     PALETTE_ValidateFlags(ppal->IndexedColors, cEntries);
+    PALETTE_vChanged(ppal);
     hpal = ppal->BaseObject.hHmgr;
     PALETTE_UnlockPalette(ppal);
 
@@ -774,6 +779,8 @@ IntGdiRealizePalette(HDC hDC)
         InterlockedExchange((LONG*)&ppalSurf->IndexedColors[i], *(LONG*)&ppalDC->IndexedColors[i]);
     }
 
+    PALETTE_vChanged(ppalSurf);
+
 cleanup:
     DC_UnlockDc(pdc);
     return realize;
@@ -816,6 +823,8 @@ IntAnimatePalette(HPALETTE hPal,
             }
         }
 
+        if (ret) PALETTE_vChanged(palPtr);
+
         PALETTE_ShareUnlockPalette(palPtr);
 
 #if 0
@@ -982,6 +991,7 @@ IntSetPaletteEntries(
         Entries = numEntries - Start;
     }
     memcpy(palGDI->IndexedColors + Start, pe, Entries * sizeof(PALETTEENTRY));
+    PALETTE_vChanged(palGDI);
     PALETTE_ShareUnlockPalette(palGDI);
 
     return Entries;
@@ -1042,6 +1052,8 @@ GreGetSetColorTable(
                 ppal->IndexedColors[i].peBlue = prgbColors->rgbBlue;
             }
 
+            PALETTE_vChanged(ppal);
+
             /* Mark the dc brushes invalid */
             pdc->pdcattr->ulDirty_ |= DIRTY_FILL|DIRTY_LINE|
                                       DIRTY_BACKGROUND|DIRTY_TEXT;
@@ -47,11 +47,21 @@ typedef struct _PALETTE
     ULONG ulGreenShift;
     ULONG ulBlueShift;
     HDEV  hPDev;
+    ULONG ulTime; // Unique stamp, changes whenever the colors change
     PALETTEENTRY apalColors[0];
 } PALETTE, *PPALETTE;
 
 extern PALETTE gpalRGB, gpalBGR, gpalRGB555, gpalRGB565, *gppalMono, *gppalDefault;
 extern PPALETTE appalSurfaceDefault[];
+extern ULONG gulPaletteTime;
+
+/* Must be called after the colors of a palette were changed */
+FORCEINLINE
+VOID
+PALETTE_vChanged(PPALETTE ppal)
+{
+    ppal->ulTime = InterlockedIncrement((LONG*)&gulPaletteTime);
+}
 
 #define  PALETTE_UnlockPalette(pPalette) GDIOBJ_vUnlockObject((POBJ)pPalette)
 #define  PALETTE_ShareLockPalette(hpal) \
@@ -35,6 +35,9 @@ typedef struct _tagFILL_EDGE
     int ErrorMax;
     int XDirection, YDirection;
 
+    /* Position in the polygon, among the edges that aren't horizontal */
+    int Index;
+
     /* The next edge in the active Edge List */
     struct _tagFILL_EDGE * pNext;
 } FILL_EDGE;
@@ -42,7 +45,11 @@ typedef struct _tagFILL_EDGE
 typedef struct _FILL_EDGE_LIST
 {
     int Count;
-    FILL_EDGE** Edges;
+    FILL_EDGE* EdgeData;    /* The edges in polygon order */
+    FILL_EDGE** Edges;      /* The edge table, sorted by FromY */
+    FILL_EDGE** Active;     /* The edges crossing the current scanline */
+    int ActiveCount;
+    int NextEdge;           /* First edge of the table not activated yet */
 } FILL_EDGE_LIST;
 
 #if 0
@@ -76,38 +83,27 @@ void
 FASTCALL
 POLYGONFILL_DestroyEdgeList(FILL_EDGE_LIST* list)
 {
-    int i;
-
     if (list)
     {
         if (list->Edges)
-        {
-            for (i = 0; i < list->Count; i++)
-            {
-                _PRAGMA_WARNING_SUPPRESS(__WARNING_USING_UNINIT_VAR)
-                if (list->Edges[i])
-                    EngFreeMem(list->Edges[i]);
-            }
-
             EngFreeMem(list->Edges);
-        }
+
+        if (list->EdgeData)
+            EngFreeMem(list->EdgeData);
 
         EngFreeMem(list);
     }
 }
 
 /*
-** This makes and initializes an Edge struct for a line between two points.
+** This initializes an Edge struct for a line between two points.
 */
 static
-FILL_EDGE*
+void
 FASTCALL
-POLYGONFILL_MakeEdge(POINT From, POINT To)
+POLYGONFILL_InitEdge(FILL_EDGE* rc, POINT From, POINT To)
 {
-    FILL_EDGE* rc = (FILL_EDGE*)EngAllocMem(FL_ZERO_MEMORY, sizeof(FILL_EDGE), FILL_EDGE_ALLOC_TAG);
-
-    if (0 == rc)
-        return NULL;
+    RtlZeroMemory(rc, sizeof(FILL_EDGE));
 
     //DPRINT1("Making Edge: (%d, %d) to (%d, %d)\n", From.x, From.y, To.x, To.y);
     // Now fill the struct.
@@ -153,17 +149,13 @@ POLYGONFILL_MakeEdge(POINT From, POINT To)
 
     //DPRINT("MakeEdge (%i,%i)->(%i,%i) d=(%i,%i) dir=(%i,%i) err=%i max=%i\n",
     //  From.x, From.y, To.x, To.y, rc->dx, rc->dy, rc->XDirection, rc->YDirection, rc->Error, rc->ErrorMax );
-
-    return rc;
 }
 /*
 ** My Edge comparison routine.
 ** This is for scan converting polygon fill.
-** First sort by MinY, then Minx, then slope.
-**
-** This comparison will help us determine which
-** lines will become active first when scanning from
-** top (min y) to bottom (max y).
+** Sort by the x intercepts on the current scanline. Edges with the
+** same intercepts are ordered by falling index, which is the order
+** they used to get from being inserted into the list one by one.
 **
 ** Return Value Meaning
 ** Negative integer element1 < element2
@@ -178,53 +170,27 @@ FILL_EDGE_Compare(FILL_EDGE* Edge1, FILL_EDGE* Edge2)
     int e1 = Edge1->XIntercept[0] + Edge1->XIntercept[1];
     int e2 = Edge2->XIntercept[0] + Edge2->XIntercept[1];
 
-    return e1 - e2;
-}
+    if (e1 != e2)
+        return e1 - e2;
 
+    return Edge2->Index - Edge1->Index;
+}
 
 /*
-** Insert an edge into a list keeping the list in order.
+** Sort the edge table by the scanline the edges start on.
 */
 static
-void
-FASTCALL
-POLYGONFILL_ActiveListInsert(FILL_EDGE** activehead, FILL_EDGE* NewEdge )
+int
+__cdecl
+FILL_EDGE_CompareFromY(const void* pv1, const void* pv2)
 {
-    FILL_EDGE *pPrev, *pThis;
-    //DPRINT1("In POLYGONFILL_ActiveListInsert()\n");
-    ASSERT(activehead && NewEdge);
+    FILL_EDGE* Edge1 = *(FILL_EDGE**)pv1;
+    FILL_EDGE* Edge2 = *(FILL_EDGE**)pv2;
 
-    if (!*activehead)
-    {
-        NewEdge->pNext = NULL;
-        *activehead = NewEdge;
-        return;
-    }
-    /*
-    ** First lets check to see if we have a new smallest value.
-    */
-    if (FILL_EDGE_Compare(NewEdge, *activehead) <= 0)
-    {
-        NewEdge->pNext = *activehead;
-        *activehead = NewEdge;
-        return;
-    }
-
-    /*
-    ** Ok, now scan to the next spot to put this item.
-    */
-    pThis = *activehead;
-    pPrev = NULL;
-    while ( pThis && FILL_EDGE_Compare(pThis, NewEdge) < 0 )
-    {
-        pPrev = pThis;
-        pThis = pThis->pNext;
-    }
+    if (Edge1->FromY != Edge2->FromY)
+        return Edge1->FromY - Edge2->FromY;
 
-    ASSERT(pPrev);
-    NewEdge->pNext = pPrev->pNext;
-    pPrev->pNext = NewEdge;
-    //DEBUG_PRINT_ACTIVE_EDGELIST(*activehead);
+    return Edge1->Index - Edge2->Index;
 }
 
 /*
@@ -246,32 +212,32 @@ POLYGONFILL_MakeEdgeList(PPOINT Points, int Count)
     if ( 0 == list )
         goto fail;
     list->Count = 0;
-    list->Edges = (FILL_EDGE**)EngAllocMem(FL_ZERO_MEMORY, Count*sizeof(FILL_EDGE*), FILL_EDGE_ALLOC_TAG);
-    if ( !list->Edges )
+
+    /* All the edges go into one block */
+    list->EdgeData = (FILL_EDGE*)EngAllocMem(0, Count*sizeof(FILL_EDGE), FILL_EDGE_ALLOC_TAG);
+    list->Edges = (FILL_EDGE**)EngAllocMem(FL_ZERO_MEMORY, 2*Count*sizeof(FILL_EDGE*), FILL_EDGE_ALLOC_TAG);
+    if ( !list->EdgeData || !list->Edges )
         goto fail;
 
-    memset(list->Edges, 0, Count * sizeof(FILL_EDGE*));
+    list->Active = list->Edges + Count;
 
-    for (CurPt = 1; CurPt < Count; ++CurPt)
+    for (CurPt = 0; CurPt < Count; ++CurPt)
     {
-        e = POLYGONFILL_MakeEdge ( Points[CurPt-1], Points[CurPt] );
-        if (!e)
-            goto fail;
+        e = &list->EdgeData[list->Count];
+        POLYGONFILL_InitEdge ( e, Points[CurPt], Points[(CurPt + 1) % Count] );
 
         // If a straight horizontal line - who cares?
-        if (!e->absdy)
-            EngFreeMem(e);
-        else
+        if (e->absdy)
+        {
+            e->Index = list->Count;
             list->Edges[list->Count++] = e;
+        }
     }
-    e = POLYGONFILL_MakeEdge ( Points[CurPt-1], Points[0] );
-    if ( !e )
-        goto fail;
 
-    if (!e->absdy)
-        EngFreeMem(e);
-    else
-        list->Edges[list->Count++] = e;
+    /* Sort the edge table once, the scanlines then only have to look
+       at the edges that start next */
+    EngSort((PBYTE)list->Edges, sizeof(FILL_EDGE*), list->Count, FILL_EDGE_CompareFromY);
+
     return list;
 
 fail:
@@ -354,6 +320,7 @@ POLYGONFILL_UpdateScanline(FILL_EDGE* pEdge, int Scanline)
 
 /*
  * This method updates the Active edge collection for the scanline Scanline.
+ * The scanlines must be walked from top to bottom.
  */
 static
 void
@@ -363,20 +330,183 @@ POLYGONFILL_BuildActiveList(
     FILL_EDGE_LIST* list,
     FILL_EDGE** ActiveHead)
 {
-    int i;
+    FILL_EDGE* pEdge;
+    int i, j;
 
     ASSERT(list && ActiveHead);
+
+    /* Drop the edges that ended above this scanline */
+    for (i = 0, j = 0; i < list->ActiveCount; i++)
+    {
+        if (list->Active[i]->ToY > Scanline)
+            list->Active[j++] = list->Active[i];
+    }
+    list->ActiveCount = j;
+
+    /* Add the ones that start on it, from the edge table */
+    while (list->NextEdge < list->Count &&
+           list->Edges[list->NextEdge]->FromY <= Scanline)
+    {
+        pEdge = list->Edges[list->NextEdge++];
+        if (pEdge->ToY > Scanline)
+            list->Active[list->ActiveCount++] = pEdge;
+    }
+
+    /* Step the edges onto the scanline and sort them. The order hardly
+       changes from one scanline to the next, so the insertion sort has
+       little to do */
+    for (i = 0; i < list->ActiveCount; i++)
+    {
+        pEdge = list->Active[i];
+        POLYGONFILL_UpdateScanline(pEdge, Scanline);
+
+        for (j = i; j > 0 && FILL_EDGE_Compare(list->Active[j - 1], pEdge) > 0; j--)
+            list->Active[j] = list->Active[j - 1];
+        list->Active[j] = pEdge;
+    }
+
+    /* Link them for the fill routines */
     *ActiveHead = 0;
+    for (i = list->ActiveCount; i > 0; i--)
+    {
+        list->Active[i - 1]->pNext = *ActiveHead;
+        *ActiveHead = list->Active[i - 1];
+    }
+}
+
+/*
+ * Check if every scanline crosses the polygon exactly twice, that is the
+ * edges form one chain going down and one going up, like the edges of a
+ * convex polygon do. The first edge of both chains and the bottom of the
+ * polygon are returned.
+ */
+static
+BOOL
+FASTCALL
+POLYGONFILL_GetMonotoneChains(
+    FILL_EDGE_LIST* list,
+    int* pDown,
+    int* pUp,
+    int* pBottom)
+{
+    int i, Next, Changes = 0;
+
+    if (list->Count < 2)
+        return FALSE;
+
+    *pDown = *pUp = -1;
+    *pBottom = list->EdgeData[0].ToY;
+
     for (i = 0; i < list->Count; i++)
     {
-        FILL_EDGE* pEdge = list->Edges[i];
-        ASSERT(pEdge);
-        if (pEdge->FromY <= Scanline && pEdge->ToY > Scanline)
+        *pBottom = max(*pBottom, list->EdgeData[i].ToY);
+
+        Next = (i + 1) % list->Count;
+        if (list->EdgeData[i].YDirection != list->EdgeData[Next].YDirection)
         {
-            POLYGONFILL_UpdateScanline(pEdge, Scanline);
-            POLYGONFILL_ActiveListInsert(ActiveHead, pEdge);
+            if (++Changes > 2)
+                return FALSE;
+
+            if (list->EdgeData[Next].YDirection > 0)
+                *pDown = Next;
+            else
+                *pUp = Next;
         }
     }
+
+    if (Changes != 2)
+        return FALSE;
+
+    /* The up chain is walked backwards, from its top edge, which is the
+       last one before the down chain starts */
+    *pUp = (*pDown + list->Count - 1) % list->Count;
+    return TRUE;
+}
+
+/*
+ * Rows with the same spans are drawn as one rect per span.
+ */
+typedef struct _FILL_SPANS
+{
+    PDC dc;
+    SURFACE* psurf;
+    BRUSHOBJ* BrushObj;
+    POINTL* BrushOrigin;
+    RECTL* Pending;     /* Spans of the rows not drawn yet */
+    RECTL* Current;     /* Spans of the row being built */
+    ULONG cPending;
+    ULONG cCurrent;
+} FILL_SPANS;
+
+static
+void
+FASTCALL
+POLYGONFILL_FlushSpans(FILL_SPANS* Spans)
+{
+    ULONG i;
+
+    for (i = 0; i < Spans->cPending; i++)
+    {
+        IntEngBitBlt(&Spans->psurf->SurfObj,
+                     NULL,
+                     NULL,
+                     (CLIPOBJ *)&Spans->dc->co,
+                     NULL,
+                     &Spans->Pending[i],
+                     NULL,
+                     NULL,
+                     Spans->BrushObj,
+                     Spans->BrushOrigin,
+                     ROP4_FROM_INDEX(R3_OPINDEX_PATCOPY));
+    }
+
+    Spans->cPending = 0;
+}
+
+static
+void
+FASTCALL
+POLYGONFILL_AddSpan(FILL_SPANS* Spans, int ScanLine, int x1, int x2)
+{
+    RECTL* prcl = &Spans->Current[Spans->cCurrent++];
+
+    prcl->left = x1;
+    prcl->top = ScanLine;
+    prcl->right = x2;
+    prcl->bottom = ScanLine + 1;
+}
+
+static
+void
+FASTCALL
+POLYGONFILL_EndRow(FILL_SPANS* Spans, int ScanLine)
+{
+    ULONG i;
+    BOOL Same;
+
+    Same = (Spans->cPending == Spans->cCurrent) &&
+           (Spans->cPending == 0 || Spans->Pending[0].bottom == ScanLine);
+
+    for (i = 0; Same && i < Spans->cCurrent; i++)
+    {
+        Same = (Spans->Pending[i].left == Spans->Current[i].left) &&
+               (Spans->Pending[i].right == Spans->Current[i].right);
+    }
+
+    if (Same)
+    {
+        /* Grow the pending rects by this row */
+        for (i = 0; i < Spans->cPending; i++)
+            Spans->Pending[i].bottom = ScanLine + 1;
+    }
+    else
+    {
+        POLYGONFILL_FlushSpans(Spans);
+        RtlCopyMemory(Spans->Pending, Spans->Current, Spans->cCurrent * sizeof(RECTL));
+        Spans->cPending = Spans->cCurrent;
+    }
+
+    Spans->cCurrent = 0;
 }
 
 /*
@@ -599,7 +729,10 @@ IntFillPolygon(
     FILL_EDGE_LIST *list = 0;
     FILL_EDGE *ActiveHead = 0;
     FILL_EDGE *pLeft, *pRight;
-    int ScanLine;
+    int ScanLine, Down, Up, Bottom;
+    FILL_SPANS Spans;
+    RECTL SpanRects[2];
+    BOOL Ret = TRUE;
 
     //DPRINT("IntFillPolygon\n");
 
@@ -609,6 +742,62 @@ IntFillPolygon(
     if (NULL == list)
         return FALSE;
 
+    Spans.dc = dc;
+    Spans.psurf = psurf;
+    Spans.BrushObj = BrushObj;
+    Spans.BrushOrigin = BrushOrigin;
+    Spans.cPending = 0;
+    Spans.cCurrent = 0;
+
+    if (POLYGONFILL_GetMonotoneChains(list, &Down, &Up, &Bottom) &&
+        list->Edges[0]->FromY == DestRect.top && DestRect.bottom <= Bottom)
+    {
+        /* Every scanline has one span between an edge of either chain.
+           Just follow the chains, there's nothing to sort */
+        Spans.Pending = &SpanRects[0];
+        Spans.Current = &SpanRects[1];
+
+        for (ScanLine = DestRect.top; ScanLine < DestRect.bottom; ++ScanLine)
+        {
+            while (list->EdgeData[Down].ToY <= ScanLine)
+                Down = (Down + 1) % list->Count;
+            while (list->EdgeData[Up].ToY <= ScanLine)
+                Up = (Up + list->Count - 1) % list->Count;
+
+            pLeft = &list->EdgeData[Down];
+            pRight = &list->EdgeData[Up];
+            ASSERT(pLeft->FromY <= ScanLine && pRight->FromY <= ScanLine);
+
+            POLYGONFILL_UpdateScanline(pLeft, ScanLine);
+            POLYGONFILL_UpdateScanline(pRight, ScanLine);
+
+            if (FILL_EDGE_Compare(pLeft, pRight) > 0)
+            {
+                FILL_EDGE *pTemp = pLeft;
+                pLeft = pRight;
+                pRight = pTemp;
+            }
+
+            if (pRight->XIntercept[1] > pLeft->XIntercept[0])
+                POLYGONFILL_AddSpan(&Spans, ScanLine, pLeft->XIntercept[0], pRight->XIntercept[1]);
+
+            POLYGONFILL_EndRow(&Spans, ScanLine);
+        }
+
+        POLYGONFILL_FlushSpans(&Spans);
+        POLYGONFILL_DestroyEdgeList(list);
+        return TRUE;
+    }
+
+    /* A scanline has at most one span per pair of edges */
+    Spans.Pending = EngAllocMem(0, (list->Count / 2 + 1) * 2 * sizeof(RECTL), FILL_EDGE_ALLOC_TAG);
+    if (!Spans.Pending)
+    {
+        POLYGONFILL_DestroyEdgeList(list);
+        return FALSE;
+    }
+    Spans.Current = Spans.Pending + list->Count / 2 + 1;
+
     /* For each Scanline from DestRect.top to DestRect.bottom, determine line segments to draw */
     for (ScanLine = DestRect.top; ScanLine < DestRect.bottom; ++ScanLine)
     {
@@ -617,8 +806,8 @@ IntFillPolygon(
 
         if (!ActiveHead)
         {
-            POLYGONFILL_DestroyEdgeList(list);
-            return FALSE;
+            Ret = FALSE;
+            break;
         }
 
         pLeft = ActiveHead;
@@ -631,35 +820,23 @@ IntFillPolygon(
             int x2 = pRight->XIntercept[1];
 
             if (x2 > x1)
-            {
-                RECTL LineRect;
-                LineRect.top = ScanLine;
-                LineRect.bottom = ScanLine + 1;
-                LineRect.left = x1;
-                LineRect.right = x2;
-
-                IntEngBitBlt(&psurf->SurfObj,
-                             NULL,
-                             NULL,
-                             (CLIPOBJ *)&dc->co,
-                             NULL,
-                             &LineRect,
-                             NULL,
-                             NULL,
-                             BrushObj,
-                             BrushOrigin,
-                             ROP4_FROM_INDEX(R3_OPINDEX_PATCOPY));
-            }
+                POLYGONFILL_AddSpan(&Spans, ScanLine, x1, x2);
 
             pLeft = pRight->pNext;
             pRight = pLeft ? pLeft->pNext : NULL;
         }
+
+        POLYGONFILL_EndRow(&Spans, ScanLine);
     }
 
+    /* Draw what is left, also when we stopped early */
+    POLYGONFILL_FlushSpans(&Spans);
+    EngFreeMem(Spans.Pending);
+
     /* Free Edge List. If any are left. */
     POLYGONFILL_DestroyEdgeList(list);
 
-    return TRUE;
+    return Ret;
 }
 
 /* EOF */
@@ -147,6 +147,9 @@ HRGN    hrgnDefault = NULL;
 
 #define REGION_NOT_EMPTY(pReg) pReg->rdh.nCount
 
+/* Largest buffer REGION_RegionOp keeps on the thread for the next call */
+#define REGION_SCRATCH_MAX_SIZE (1024 * sizeof(RECTL))
+
 #define INRECT(r, x, y) \
       ( ( ((r).right >  x)) && \
         ( ((r).left <= x)) && \
@@ -946,6 +949,79 @@ REGION_Coalesce(
  *      to reduce the number of rectangles in the region.
  *
  */
+/*!
+ * Get a buffer for REGION_RegionOp to build its result in. The buffer of the
+ * previous operation is kept on the thread, so most operations don't need
+ * to go to the pool for it.
+ */
+static
+PRECTL
+REGION_pAllocWorkBuffer(
+    _In_ ULONG cjSize,
+    _Out_ PULONG pcjAllocated)
+{
+    PW32THREAD pw32thread = PsGetCurrentThreadWin32Thread();
+    PRECTL prclBuffer;
+
+    if ((pw32thread != NULL) && (pw32thread->pRgnScratch != NULL))
+    {
+        /* Take it off the thread, so that it can't be handed out twice */
+        prclBuffer = pw32thread->pRgnScratch;
+        pw32thread->pRgnScratch = NULL;
+
+        if (pw32thread->cjRgnScratch >= cjSize)
+        {
+            *pcjAllocated = pw32thread->cjRgnScratch;
+            return prclBuffer;
+        }
+
+        ExFreePoolWithTag(prclBuffer, TAG_REGION);
+    }
+
+    *pcjAllocated = cjSize;
+    return ExAllocatePoolWithTag(PagedPool, cjSize, TAG_REGION);
+}
+
+/*!
+ * Give a work buffer back to the thread, or free it if it's too large to be
+ * worth keeping.
+ */
+static
+VOID
+REGION_vFreeWorkBuffer(
+    _In_ PRECTL prclBuffer,
+    _In_ ULONG cjSize)
+{
+    PW32THREAD pw32thread = PsGetCurrentThreadWin32Thread();
+
+    if ((pw32thread != NULL) &&
+        (pw32thread->pRgnScratch == NULL) &&
+        (cjSize <= REGION_SCRATCH_MAX_SIZE))
+    {
+        pw32thread->pRgnScratch = prclBuffer;
+        pw32thread->cjRgnScratch = cjSize;
+        return;
+    }
+
+    ExFreePoolWithTag(prclBuffer, TAG_REGION);
+}
+
+/*!
+ * Free the work buffer kept on an exiting thread.
+ */
+VOID
+FASTCALL
+REGION_vCleanupThread(
+    _Inout_ PW32THREAD pw32thread)
+{
+    if (pw32thread->pRgnScratch != NULL)
+    {
+        ExFreePoolWithTag(pw32thread->pRgnScratch, TAG_REGION);
+        pw32thread->pRgnScratch = NULL;
+        pw32thread->cjRgnScratch = 0;
+    }
+}
+
 static
 VOID
 FASTCALL
@@ -964,6 +1040,10 @@ REGION_RegionOp(
     INT ybot;                          /* Bottom of intersection */
     INT ytop;                          /* Top of intersection */
     RECTL *oldRects;                   /* Old rects for newReg */
+    ULONG oldSize;                     /* Size of oldRects */
+    RECTL *workRects;                  /* Rects the result is built in */
+    ULONG workSize;                    /* Size of workRects */
+    ULONG newSize;                     /* Size of the result */
     ULONG prevBand;                    /* Index of start of
                                         * Previous band in newReg */
     ULONG curBand;                     /* Index of start of current band in newReg */
@@ -986,18 +1066,16 @@ REGION_RegionOp(
      * note of its rects pointer (so that we can free them later), preserve its
      * extents and simply set numRects to zero. */
     oldRects = newReg->Buffer;
+    oldSize = newReg->rdh.nRgnSize;
     newReg->rdh.nCount = 0;
 
-    /* Allocate a reasonable number of rectangles for the new region. The idea
-     * is to allocate enough so the individual functions don't need to
+    /* Get a reasonable number of rectangles for the new region. The idea
+     * is to have enough so the individual functions don't need to
      * reallocate and copy the array, which is time consuming, yet we don't
-     * have to worry about using too much memory. I hope to be able to
-     * nuke the Xrealloc() at the end of this function eventually. */
-    newReg->rdh.nRgnSize = max(reg1->rdh.nCount + 1, reg2->rdh.nCount) * 2 * sizeof(RECT);
-
-    newReg->Buffer = ExAllocatePoolWithTag(PagedPool,
-                                           newReg->rdh.nRgnSize,
-                                           TAG_REGION);
+     * have to worry about using too much memory. The result is normally
+     * built in the buffer the previous operation on this thread used. */
+    newReg->Buffer = REGION_pAllocWorkBuffer(max(reg1->rdh.nCount + 1, reg2->rdh.nCount) * 2 * sizeof(RECT),
+                                             &newReg->rdh.nRgnSize);
     if (newReg->Buffer == NULL)
     {
         newReg->rdh.nRgnSize = 0;
@@ -1169,53 +1247,49 @@ REGION_RegionOp(
         (VOID)REGION_Coalesce(newReg, prevBand, curBand);
     }
 
-    /* A bit of cleanup. To keep regions from growing without bound,
-     * we shrink the array of rectangles to match the new number of
-     * rectangles in the region. This never goes to 0, however...
-     *
-     * Only do this stuff if the number of rectangles allocated is more than
-     * twice the number of rectangles in the region (a simple optimization...). */
-    if ((newReg->rdh.nRgnSize > (2 * newReg->rdh.nCount * sizeof(RECT))) &&
-        (newReg->rdh.nCount > 2))
+    newReg->rdh.iType = RDH_RECTANGLES;
+
+    /* Move the result out of the work buffer. To keep regions from growing
+     * without bound, the old rectangles are only reused if they aren't more
+     * than twice the size of the result, otherwise the region gets a buffer
+     * that fits. This never goes to 0, however... */
+    workRects = newReg->Buffer;
+    workSize = newReg->rdh.nRgnSize;
+    newSize = newReg->rdh.nCount * sizeof(RECT);
+
+    if ((oldRects != NULL) &&
+        (oldRects != &newReg->rdh.rcBound) &&
+        (oldSize >= newSize) &&
+        ((oldSize <= 2 * newSize) || (newReg->rdh.nCount <= 2)))
     {
-        if (REGION_NOT_EMPTY(newReg))
+        COPY_RECTS(oldRects, workRects, newReg->rdh.nCount);
+        newReg->Buffer = oldRects;
+        newReg->rdh.nRgnSize = oldSize;
+    }
+    else
+    {
+        newReg->Buffer = ExAllocatePoolWithTag(PagedPool,
+                                               max(newSize, sizeof(RECT)),
+                                               TAG_REGION);
+        if (newReg->Buffer == NULL)
         {
-            RECTL *prev_rects = newReg->Buffer;
-            newReg->Buffer = ExAllocatePoolWithTag(PagedPool,
-                                                   newReg->rdh.nCount * sizeof(RECT),
-                                                   TAG_REGION);
-
-            if (newReg->Buffer == NULL)
-            {
-                newReg->Buffer = prev_rects;
-            }
-            else
-            {
-                newReg->rdh.nRgnSize = newReg->rdh.nCount*sizeof(RECT);
-                COPY_RECTS(newReg->Buffer, prev_rects, newReg->rdh.nCount);
-                if (prev_rects != &newReg->rdh.rcBound)
-                    ExFreePoolWithTag(prev_rects, TAG_REGION);
-            }
+            /* Keep the work buffer then */
+            newReg->Buffer = workRects;
+            workRects = NULL;
         }
         else
         {
-            /* No point in doing the extra work involved in an Xrealloc if
-             * the region is empty */
-            newReg->rdh.nRgnSize = sizeof(RECT);
-            if (newReg->Buffer != &newReg->rdh.rcBound)
-                ExFreePoolWithTag(newReg->Buffer, TAG_REGION);
-
-            newReg->Buffer = ExAllocatePoolWithTag(PagedPool,
-                                                   sizeof(RECT),
-                                                   TAG_REGION);
-            ASSERT(newReg->Buffer);
+            newReg->rdh.nRgnSize = max(newSize, sizeof(RECT));
+            COPY_RECTS(newReg->Buffer, workRects, newReg->rdh.nCount);
         }
+
+        if ((oldRects != NULL) && (oldRects != &newReg->rdh.rcBound))
+            ExFreePoolWithTag(oldRects, TAG_REGION);
     }
 
-    newReg->rdh.iType = RDH_RECTANGLES;
+    if (workRects != NULL)
+        REGION_vFreeWorkBuffer(workRects, workSize);
 
-    if (oldRects != &newReg->rdh.rcBound)
-        ExFreePoolWithTag(oldRects, TAG_REGION);
     return;
 }
 
@@ -1298,6 +1372,8 @@ REGION_IntersectRegion(
     PREGION reg1,
     PREGION reg2)
 {
+    RECTL rcl;
+
     /* Check for trivial reject */
     if ((reg1->rdh.nCount == 0) ||
         (reg2->rdh.nCount == 0) ||
@@ -1305,6 +1381,42 @@ REGION_IntersectRegion(
     {
         newReg->rdh.nCount = 0;
     }
+    /* Two rectangles intersect in a rectangle */
+    else if ((reg1->rdh.nCount == 1) && (reg2->rdh.nCount == 1))
+    {
+        rcl.left = max(reg1->rdh.rcBound.left, reg2->rdh.rcBound.left);
+        rcl.top = max(reg1->rdh.rcBound.top, reg2->rdh.rcBound.top);
+        rcl.right = min(reg1->rdh.rcBound.right, reg2->rdh.rcBound.right);
+        rcl.bottom = min(reg1->rdh.rcBound.bottom, reg2->rdh.rcBound.bottom);
+
+        if (!REGION_bEnsureBufferSize(newReg, 1))
+        {
+            return;
+        }
+
+        newReg->Buffer[0] = rcl;
+        newReg->rdh.nCount = 1;
+    }
+    /* Region 1 completely covers region 2 */
+    else if ((reg1->rdh.nCount == 1) &&
+             (reg1->rdh.rcBound.left <= reg2->rdh.rcBound.left) &&
+             (reg1->rdh.rcBound.top <= reg2->rdh.rcBound.top) &&
+             (reg2->rdh.rcBound.right <= reg1->rdh.rcBound.right) &&
+             (reg2->rdh.rcBound.bottom <= reg1->rdh.rcBound.bottom))
+    {
+        REGION_CopyRegion(newReg, reg2);
+        return;
+    }
+    /* Region 2 completely covers region 1 */
+    else if ((reg2->rdh.nCount == 1) &&
+             (reg2->rdh.rcBound.left <= reg1->rdh.rcBound.left) &&
+             (reg2->rdh.rcBound.top <= reg1->rdh.rcBound.top) &&
+             (reg1->rdh.rcBound.right <= reg2->rdh.rcBound.right) &&
+             (reg1->rdh.rcBound.bottom <= reg2->rdh.rcBound.bottom))
+    {
+        REGION_CopyRegion(newReg, reg1);
+        return;
+    }
     else
     {
         REGION_RegionOp(newReg,
@@ -1727,6 +1839,17 @@ REGION_SubtractRegion(
         return;
     }
 
+    /* Nothing is left if regS is a rectangle that covers regM */
+    if ((regS->rdh.nCount == 1) &&
+        (regS->rdh.rcBound.left <= regM->rdh.rcBound.left) &&
+        (regS->rdh.rcBound.top <= regM->rdh.rcBound.top) &&
+        (regM->rdh.rcBound.right <= regS->rdh.rcBound.right) &&
+        (regM->rdh.rcBound.bottom <= regS->rdh.rcBound.bottom))
+    {
+        EMPTY_REGION(regD);
+        return;
+    }
+
     REGION_RegionOp(regD,
                     regM,
                     regS,
@@ -1753,35 +1876,24 @@ REGION_XorRegion(
     PREGION sra,
     PREGION srb)
 {
-    HRGN htra, htrb;
-    PREGION tra, trb;
-
-    // FIXME: Don't use a handle
-    tra = REGION_AllocRgnWithHandle(sra->rdh.nCount + 1);
-    if (tra == NULL)
-    {
-        return;
-    }
-    htra = tra->BaseObject.hHmgr;
-
-    // FIXME: Don't use a handle
-    trb = REGION_AllocRgnWithHandle(srb->rdh.nCount + 1);
-    if (trb == NULL)
-    {
-        REGION_UnlockRgn(tra);
-        GreDeleteObject(htra);
-        return;
-    }
-    htrb = trb->BaseObject.hHmgr;
-
-    REGION_SubtractRegion(tra, sra, srb);
-    REGION_SubtractRegion(trb, srb, sra);
-    REGION_UnionRegion(dr, tra, trb);
-    REGION_UnlockRgn(tra);
-    REGION_UnlockRgn(trb);
-
-    GreDeleteObject(htra);
-    GreDeleteObject(htrb);
+    REGION tra, trb;
+
+    /* The temporaries only need their rectangles, not a handle */
+    tra.Buffer = &tra.rdh.rcBound;
+    tra.rdh.nRgnSize = sizeof(RECT);
+    EMPTY_REGION(&tra);
+    trb.Buffer = &trb.rdh.rcBound;
+    trb.rdh.nRgnSize = sizeof(RECT);
+    EMPTY_REGION(&trb);
+
+    REGION_SubtractRegion(&tra, sra, srb);
+    REGION_SubtractRegion(&trb, srb, sra);
+    REGION_UnionRegion(dr, &tra, &trb);
+
+    if ((tra.Buffer != NULL) && (tra.Buffer != &tra.rdh.rcBound))
+        ExFreePoolWithTag(tra.Buffer, TAG_REGION);
+    if ((trb.Buffer != NULL) && (trb.Buffer != &trb.rdh.rcBound))
+        ExFreePoolWithTag(trb.Buffer, TAG_REGION);
     return;
 }
 
@@ -34,6 +34,7 @@ INT FASTCALL REGION_CropRegion(PREGION rgnDst, PREGION rgnSrc, const RECTL *rect
 VOID FASTCALL REGION_SetRectRgn(PREGION pRgn, INT LeftRect, INT TopRect, INT RightRect, INT BottomRect);
 VOID NTAPI REGION_vCleanup(PVOID ObjectBody);
 VOID FASTCALL REGION_Delete(PREGION);
+VOID FASTCALL REGION_vCleanupThread(struct _W32THREAD *pw32thread);
 INT APIENTRY IntGdiGetRgnBox(HRGN, RECTL*);
 
 PREGION
@@ -48,6 +48,15 @@ typedef struct _CALL_BACK_INFO
 } CALL_BACK_INFO, * PCALL_BACK_INFO;
 
 
+/* Most hooks passed on with the one being called */
+#define HOOKPROC_CHAIN_MAX 8
+
+typedef struct _HOOKPROC_CHAIN_ENTRY
+{
+  HHOOK hHook;
+  HOOKPROC Proc;
+} HOOKPROC_CHAIN_ENTRY, *PHOOKPROC_CHAIN_ENTRY;
+
 typedef struct _HOOKPROC_CALLBACK_ARGUMENTS
 {
   INT HookId;
@@ -59,6 +68,8 @@ typedef struct _HOOKPROC_CALLBACK_ARGUMENTS
   ULONG_PTR offPfn;
   BOOLEAN Ansi;
   LRESULT Result;
+  UINT cChain; /* The rest of the chain, for CallNextHookEx to run without the kernel */
+  HOOKPROC_CHAIN_ENTRY Chain[HOOKPROC_CHAIN_MAX];
   WCHAR ModuleName[512];
 } HOOKPROC_CALLBACK_ARGUMENTS, *PHOOKPROC_CALLBACK_ARGUMENTS;
 
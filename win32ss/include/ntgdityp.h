@@ -91,6 +91,10 @@ typedef enum _GDIBATCHCMD
     GdiBCSelObj,
     GdiBCDelObj,
     GdiBCDelRgn,
+
+    /* ReactOS specific */
+    GdiBCLineTo,
+    GdiBCSetPixel,
 } GDIBATCHCMD, *PGDIBATCHCMD;
 
 typedef enum _TRANSFORMTYPE
@@ -546,6 +550,25 @@ typedef struct _GDIBSOBJECT
   HGDIOBJ hgdiobj;
 } GDIBSOBJECT, *PGDIBSOBJECT;
 
+typedef struct _GDIBSLINETO
+{
+  GDIBATCHHDR gbHdr;
+  POINTL ptlStart;
+  POINTL ptlEnd;
+  HANDLE hpen;
+  COLORREF crForegroundClr;
+  COLORREF crBackgroundClr;
+  COLORREF crPenClr;
+} GDIBSLINETO, *PGDIBSLINETO;
+
+typedef struct _GDIBSSETPIXEL
+{
+  GDIBATCHHDR gbHdr;
+  int x;
+  int y;
+  COLORREF crColor;
+} GDIBSSETPIXEL, *PGDIBSSETPIXEL;
+
 /* Declaration missing in ddk/winddi.h */
 typedef VOID (APIENTRY *PFN_DrvMovePanning)(LONG, LONG, FLONG);
 
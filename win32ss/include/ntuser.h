@@ -157,6 +157,24 @@ typedef struct _DESKTOPINFO
     WCHAR szDesktopName[1];
 } DESKTOPINFO, *PDESKTOPINFO;
 
+/* ReactOS specific: GetUserObjectInformation index returning the
+ * DESKTOP_HEAP_STATS of a desktop */
+#define UOI_HEAPSTATS 0x1000
+
+#define DESKTOP_HEAP_SIZE_CLASSES 8
+
+typedef struct _DESKTOP_HEAP_STATS
+{
+    ULONG_PTR cbHeapSize;   /* Size of the desktop heap section */
+    ULONG_PTR cbInUse;      /* Bytes currently allocated */
+    ULONG_PTR cbPeakInUse;
+    ULONG_PTR cbSlabs;      /* Bytes of the heap held by size class slabs */
+    ULONG cAllocations;     /* Blocks currently allocated */
+    ULONG cFailures;        /* Allocations the heap couldn't satisfy */
+    ULONG acbClassSize[DESKTOP_HEAP_SIZE_CLASSES];
+    ULONG acClassBlocks[DESKTOP_HEAP_SIZE_CLASSES]; /* Blocks allocated per class */
+} DESKTOP_HEAP_STATS, *PDESKTOP_HEAP_STATS;
+
 #define CTI_THREADSYSLOCK 0x0001
 #define CTI_INSENDMESSAGE 0x0002
 
@@ -3221,6 +3239,15 @@ NtUserSetTimer(
     UINT uElapse,
     TIMERPROC lpTimerFunc);
 
+UINT_PTR
+NTAPI
+NtUserSetCoalescableTimer(
+    HWND hWnd,
+    UINT_PTR nIDEvent,
+    UINT uElapse,
+    TIMERPROC lpTimerFunc,
+    ULONG uToleranceDelay);
+
 BOOL
 NTAPI
 NtUserSetWindowFNID(
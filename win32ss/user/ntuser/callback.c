@@ -509,16 +509,18 @@ co_IntLoadDefaultCursors(VOID)
    return TRUE;
 }
 
+static
 LRESULT APIENTRY
-co_IntCallHookProc(INT HookId,
-                   INT Code,
-                   WPARAM wParam,
-                   LPARAM lParam,
-                   HOOKPROC Proc,
-                   INT Mod,
-                   ULONG_PTR offPfn,
-                   BOOLEAN Ansi,
-                   PUNICODE_STRING ModuleName)
+co_IntCallHookProcEx(INT HookId,
+                     INT Code,
+                     WPARAM wParam,
+                     LPARAM lParam,
+                     HOOKPROC Proc,
+                     INT Mod,
+                     ULONG_PTR offPfn,
+                     BOOLEAN Ansi,
+                     PUNICODE_STRING ModuleName,
+                     PHOOK Hook)
 {
    ULONG ArgumentLength;
    PVOID Argument = NULL;
@@ -647,6 +649,7 @@ co_IntCallHookProc(INT HookId,
    Common->Mod = Mod;
    Common->offPfn = offPfn;
    Common->Ansi = Ansi;
+   Common->cChain = Hook ? IntGetHookChain(Hook, Common->Chain) : 0;
    RtlZeroMemory(&Common->ModuleName, sizeof(Common->ModuleName));
    if (ModuleName->Buffer && ModuleName->Length)
    {
@@ -816,6 +819,42 @@ Fault_Exit:
    return Result;
 }
 
+LRESULT APIENTRY
+co_IntCallHookProc(INT HookId,
+                   INT Code,
+                   WPARAM wParam,
+                   LPARAM lParam,
+                   HOOKPROC Proc,
+                   INT Mod,
+                   ULONG_PTR offPfn,
+                   BOOLEAN Ansi,
+                   PUNICODE_STRING ModuleName)
+{
+   return co_IntCallHookProcEx(HookId, Code, wParam, lParam, Proc, Mod, offPfn, Ansi, ModuleName, NULL);
+}
+
+//
+// Calls the first hook of a thread chain, the rest of the chain goes along
+// when user mode can run it through by itself.
+//
+LRESULT APIENTRY
+co_IntCallHookChain(PHOOK Hook,
+                    INT Code,
+                    WPARAM wParam,
+                    LPARAM lParam)
+{
+   return co_IntCallHookProcEx(Hook->HookId,
+                               Code,
+                               wParam,
+                               lParam,
+                               Hook->Proc,
+                               Hook->ihmod,
+                               Hook->offPfn,
+                               Hook->Ansi,
+                              &Hook->ModuleName,
+                               Hook);
+}
+
 //
 // Events are notifications w/o results.
 //
@@ -881,6 +920,40 @@ co_IntCallEventProc(HWINEVENTHOOK hook,
    return Result;
 }
 
+/*
+ * Hands a batch of out of context events to user mode at once, they are
+ * called in order by the same callback.
+ */
+LRESULT
+APIENTRY
+co_IntCallEventProcs(PEVENTPROC_CALLBACK_ARGUMENTS Events,
+                     ULONG cEvents)
+{
+   NTSTATUS Status;
+   ULONG ResultLength;
+   PVOID ResultPointer;
+
+   ResultPointer = NULL;
+   ResultLength = sizeof(LRESULT);
+
+   UserLeaveCo();
+
+   Status = KeUserModeCallback(USER32_CALLBACK_EVENTPROC,
+                               Events,
+                               cEvents * sizeof(EVENTPROC_CALLBACK_ARGUMENTS),
+                               &ResultPointer,
+                               &ResultLength);
+
+   UserEnterCo();
+
+   if (!NT_SUCCESS(Status))
+   {
+      ERR("Failure to make Callback! Status 0x%x\n", Status);
+   }
+
+   return 0;
+}
+
 //
 // Callback Load Menu and results.
 //
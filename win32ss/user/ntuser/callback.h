@@ -34,6 +34,12 @@ co_IntCallHookProc(INT HookId,
                 BOOLEAN Ansi,
                 PUNICODE_STRING ModuleName);
 
+LRESULT APIENTRY
+co_IntCallHookChain(PHOOK Hook,
+                    INT Code,
+                    WPARAM wParam,
+                    LPARAM lParam);
+
 LRESULT APIENTRY
 co_IntCallEventProc(HWINEVENTHOOK hook,
                            DWORD event,
@@ -46,6 +52,10 @@ co_IntCallEventProc(HWINEVENTHOOK hook,
                                INT Mod,
                      ULONG_PTR offPfn);
 
+LRESULT APIENTRY
+co_IntCallEventProcs(PEVENTPROC_CALLBACK_ARGUMENTS Events,
+                     ULONG cEvents);
+
 VOID FASTCALL
 IntCleanupThreadCallbacks(PTHREADINFO W32Thread);
 
@@ -32,6 +32,27 @@ static PWSTR ControlsList[] =
 
 static NTSTATUS IntDeregisterClassAtom(IN RTL_ATOM Atom);
 
+/* Class lookups go through a hash of the base classes in the process lists,
+   keyed by atom. It is built again once any class list changed. */
+#define CLASS_HASH_SIZE 64
+#define CLASS_HASH_BUCKET(Atom, Global) \
+    (((Global) ? CLASS_HASH_SIZE : 0) + ((Atom) & (CLASS_HASH_SIZE - 1)))
+
+typedef struct _CLASS_HASH
+{
+    ULONG ulTime;
+    ULONG aiFirst[2 * CLASS_HASH_SIZE + 1];
+    PCLS apcls[ANYSIZE_ARRAY];
+} CLASS_HASH, *PCLASS_HASH;
+
+static ULONG gulClassTime = 0;
+
+static __inline VOID
+IntInvalidateClassHash(VOID)
+{
+    gulClassTime++;
+}
+
 REGISTER_SYSCLASS DefaultServerClasses[] =
 {
   { ((PWSTR)((ULONG_PTR)(WORD)(0x8001))),
@@ -233,6 +254,8 @@ IntDestroyClass(IN OUT PCLS Class)
     ASSERT(Class->cWndReferenceCount == 0);
     ASSERT(Class->pclsClone == NULL);
 
+    IntInvalidateClassHash();
+
     if (Class->pclsBase == Class)
     {
         PCALLPROCDATA CallProc, NextCallProc;
@@ -327,6 +350,12 @@ void FASTCALL DestroyProcessClasses(PPROCESSINFO Process )
 
             Class = pi->pclsPublicList;
         }
+
+        if (pi->pClassHash != NULL)
+        {
+            ExFreePoolWithTag(pi->pClassHash, USERTAG_CLASS);
+            pi->pClassHash = NULL;
+        }
     }
 }
 
@@ -785,6 +814,7 @@ IntMakeCloneBaseClass(IN OUT PCLS Class,
     /* Link in the new base class */
     (void)InterlockedExchangePointer((PVOID*)BaseClassLink,
                                      Class);
+    IntInvalidateClassHash();
 }
 
 
@@ -906,6 +936,7 @@ IntMoveClassToSharedHeap(IN OUT PCLS Class,
         (void)InterlockedExchangePointer((PVOID*)*ClassLinkPtr,
                                          NewClass);
         *ClassLinkPtr = &NewClass->pclsNext;
+        IntInvalidateClassHash();
 
         /* Free the obsolete class on the desktop heap */
         Class->pclsBase = NULL;
@@ -1234,6 +1265,16 @@ NoMem:
     return Class;
 }
 
+static __inline BOOL
+IntIsClassMatch(IN PCLS Class,
+                IN RTL_ATOM Atom,
+                IN HINSTANCE hInstance)
+{
+    return Class->atomClassName == Atom &&
+           (hInstance == NULL || Class->hModule == hInstance) &&
+           !(Class->CSF_flags & CSF_WOWDEFERDESTROY);
+}
+
 static PCLS
 IntFindClass(IN RTL_ATOM Atom,
              IN HINSTANCE hInstance,
@@ -1245,9 +1286,7 @@ IntFindClass(IN RTL_ATOM Atom,
     Class = *PrevLink;
     while (Class != NULL)
     {
-        if (Class->atomClassName == Atom &&
-            (hInstance == NULL || Class->hModule == hInstance) &&
-            !(Class->CSF_flags & CSF_WOWDEFERDESTROY))
+        if (IntIsClassMatch(Class, Atom, hInstance))
         {
             ASSERT(Class->pclsBase == Class);
 
@@ -1263,6 +1302,100 @@ IntFindClass(IN RTL_ATOM Atom,
     return Class;
 }
 
+static PCLASS_HASH
+IntBuildClassHash(IN PPROCESSINFO pi)
+{
+    PCLASS_HASH Hash;
+    PCLS Class, ClassLists[2];
+    ULONG aiNext[2 * CLASS_HASH_SIZE];
+    ULONG cClasses = 0, i, Bucket;
+
+    ClassLists[0] = pi->pclsPrivateList;
+    ClassLists[1] = pi->pclsPublicList;
+
+    RtlZeroMemory(aiNext, sizeof(aiNext));
+    for (i = 0; i < 2; i++)
+    {
+        for (Class = ClassLists[i]; Class != NULL; Class = Class->pclsNext)
+        {
+            aiNext[CLASS_HASH_BUCKET(Class->atomClassName, i)]++;
+            cClasses++;
+        }
+    }
+
+    Hash = ExAllocatePoolWithTag(PagedPool,
+                                 FIELD_OFFSET(CLASS_HASH, apcls[cClasses]),
+                                 USERTAG_CLASS);
+    if (Hash == NULL)
+        return NULL;
+
+    Hash->ulTime = gulClassTime;
+
+    /* Each bucket keeps the classes in list order, so the same class as
+       with a walk of the list is found first */
+    Hash->aiFirst[0] = 0;
+    for (Bucket = 0; Bucket < 2 * CLASS_HASH_SIZE; Bucket++)
+    {
+        Hash->aiFirst[Bucket + 1] = Hash->aiFirst[Bucket] + aiNext[Bucket];
+        aiNext[Bucket] = Hash->aiFirst[Bucket];
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Class = ClassLists[i]; Class != NULL; Class = Class->pclsNext)
+        {
+            Hash->apcls[aiNext[CLASS_HASH_BUCKET(Class->atomClassName, i)]++] = Class;
+        }
+    }
+
+    return Hash;
+}
+
+/* Finds a base class in the local or global list of the process. The lists
+   are only walked when the caller needs the link to unlink the class. */
+static PCLS
+IntLookupClass(IN PPROCESSINFO pi,
+               IN RTL_ATOM Atom,
+               IN HINSTANCE hInstance,
+               IN BOOL Global,
+               OUT PCLS **Link  OPTIONAL)
+{
+    PCLASS_HASH Hash;
+    PCLS Class;
+    ULONG i, Bucket;
+
+    if (Link == NULL)
+    {
+        Hash = pi->pClassHash;
+        if (Hash == NULL || Hash->ulTime != gulClassTime)
+        {
+            if (Hash != NULL)
+                ExFreePoolWithTag(Hash, USERTAG_CLASS);
+            Hash = pi->pClassHash = IntBuildClassHash(pi);
+        }
+
+        if (Hash != NULL)
+        {
+            Bucket = CLASS_HASH_BUCKET(Atom, Global);
+            for (i = Hash->aiFirst[Bucket]; i < Hash->aiFirst[Bucket + 1]; i++)
+            {
+                Class = Hash->apcls[i];
+                if (IntIsClassMatch(Class, Atom, hInstance))
+                {
+                    ASSERT(Class->pclsBase == Class);
+                    return Class;
+                }
+            }
+            return NULL;
+        }
+    }
+
+    return IntFindClass(Atom,
+                        hInstance,
+                        Global ? &pi->pclsPublicList : &pi->pclsPrivateList,
+                        Link);
+}
+
 _Success_(return)
 BOOL
 NTAPI
@@ -1352,10 +1485,11 @@ IntGetClassAtom(
         ASSERT(pi != NULL);
 
         /* Step 1: Try to find an exact match of locally registered classes */
-        Class = IntFindClass(Atom,
-                             hInstance,
-                             &pi->pclsPrivateList,
-                             Link);
+        Class = IntLookupClass(pi,
+                               Atom,
+                               hInstance,
+                               FALSE,
+                               Link);
         if (Class != NULL)
         {  TRACE("Step 1: 0x%p\n",Class );
             goto FoundClass;
@@ -1363,30 +1497,33 @@ IntGetClassAtom(
 
         /* Step 2: Try to find any globally registered class. The hInstance
                    is not relevant for global classes */
-        Class = IntFindClass(Atom,
-                             NULL,
-                             &pi->pclsPublicList,
-                             Link);
+        Class = IntLookupClass(pi,
+                               Atom,
+                               NULL,
+                               TRUE,
+                               Link);
         if (Class != NULL)
         { TRACE("Step 2: 0x%p 0x%p\n",Class, Class->hModule);
             goto FoundClass;
         }
 
         /* Step 3: Try to find any local class registered by user32 */
-        Class = IntFindClass(Atom,
-                             hModClient,
-                             &pi->pclsPrivateList,
-                             Link);
+        Class = IntLookupClass(pi,
+                               Atom,
+                               hModClient,
+                               FALSE,
+                               Link);
         if (Class != NULL)
         { TRACE("Step 3: 0x%p\n",Class );
             goto FoundClass;
         }
 
         /* Step 4: Try to find any global class registered by user32 */
-        Class = IntFindClass(Atom,
-                             hModClient,
-                             &pi->pclsPublicList,
-                             Link);
+        Class = IntLookupClass(pi,
+                               Atom,
+                               hModClient,
+                               TRUE,
+                               Link);
         if (Class == NULL)
         {
             return (RTL_ATOM)0;
@@ -1482,10 +1619,11 @@ UserRegisterClass(IN CONST WNDCLASSEXW* lpwcx,
                                      ClassAtom != (RTL_ATOM)0 &&
                                     !(dwFlags & CSF_SERVERSIDEPROC) ) // Bypass Server Sides
     {
-       Class = IntFindClass( ClassAtom,
-                             lpwcx->hInstance,
-                            &pi->pclsPrivateList,
-                             NULL);
+       Class = IntLookupClass( pi,
+                               ClassAtom,
+                               lpwcx->hInstance,
+                               FALSE,
+                               NULL);
 
        if (Class != NULL && !Class->Global)
        {
@@ -1497,10 +1635,11 @@ UserRegisterClass(IN CONST WNDCLASSEXW* lpwcx,
 
        if (lpwcx->style & CS_GLOBALCLASS)
        {
-          Class = IntFindClass( ClassAtom,
-                                NULL,
-                               &pi->pclsPublicList,
-                                NULL);
+          Class = IntLookupClass( pi,
+                                  ClassAtom,
+                                  NULL,
+                                  TRUE,
+                                  NULL);
 
           if (Class != NULL && Class->Global)
           {
@@ -1533,6 +1672,7 @@ UserRegisterClass(IN CONST WNDCLASSEXW* lpwcx,
         Class->pclsNext = *List;
         (void)InterlockedExchangePointer((PVOID*)List,
                                          Class);
+        IntInvalidateClassHash();
 
         Ret = Class->atomNVClassName;
     }
@@ -1586,6 +1726,7 @@ UserUnregisterClass(IN PUNICODE_STRING ClassName,
 
     /* Unlink the class */
     *Link = Class->pclsNext;
+    IntInvalidateClassHash();
 
     if (NT_SUCCESS(IntDeregisterClassAtom(Class->atomClassName)))
     {
@@ -2363,6 +2504,7 @@ UserRegisterSystemClasses(VOID)
             Class->pclsNext = ppi->pclsPublicList;
             (void)InterlockedExchangePointer((PVOID*)&ppi->pclsPublicList,
                                              Class);
+            IntInvalidateClassHash();
 
             ppi->dwRegisteredClasses |= ICLASS_TO_MASK(DefaultServerClasses[i].iCls);
         }
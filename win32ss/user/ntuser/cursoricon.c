@@ -328,6 +328,29 @@ IntDestroyCurIconObject(
     return TRUE;
 }
 
+static
+VOID
+IntFreeScaledCurIcon(
+    _Inout_ PCURICON_SCALED pScaled)
+{
+    if (pScaled->hbmMask)
+    {
+        GreSetObjectOwner(pScaled->hbmMask, GDI_OBJ_HMGR_POWNED);
+        NT_VERIFY(GreDeleteObject(pScaled->hbmMask) == TRUE);
+    }
+    if (pScaled->hbmColor)
+    {
+        GreSetObjectOwner(pScaled->hbmColor, GDI_OBJ_HMGR_POWNED);
+        NT_VERIFY(GreDeleteObject(pScaled->hbmColor) == TRUE);
+    }
+    if (pScaled->hbmAlpha)
+    {
+        GreSetObjectOwner(pScaled->hbmAlpha, GDI_OBJ_HMGR_POWNED);
+        NT_VERIFY(GreDeleteObject(pScaled->hbmAlpha) == TRUE);
+    }
+    RtlZeroMemory(pScaled, sizeof(*pScaled));
+}
+
 VOID
 FreeCurIconObject(
     _In_ PVOID Object)
@@ -339,6 +362,11 @@ FreeCurIconObject(
         HBITMAP bmpMask = CurIcon->hbmMask;
         HBITMAP bmpColor = CurIcon->hbmColor;
         HBITMAP bmpAlpha = CurIcon->hbmAlpha;
+        UINT i;
+
+        /* Delete the stretched copies */
+        for (i = 0; i < CURICON_SCALED_COUNT; i++)
+            IntFreeScaledCurIcon(&CurIcon->aScaled[i]);
 
         /* Delete bitmaps */
         if (bmpMask)
@@ -1676,6 +1704,128 @@ Exit:
     return bResult;
 }
 
+static
+HBITMAP
+IntCreateScaledBitmap(
+    _In_ PSURFACE psurfSrc,
+    _In_ PRECTL prclSrc,
+    _In_ ULONG cx,
+    _In_ ULONG cy)
+{
+    HBITMAP hbm;
+    PSURFACE psurf;
+    RECTL rcDest;
+    EXLATEOBJ exlo;
+    BOOL Ret;
+
+    hbm = GreCreateBitmapEx(cx,
+                            cy,
+                            0,
+                            psurfSrc->SurfObj.iBitmapFormat,
+                            psurfSrc->SurfObj.fjBitmap & BMF_TOPDOWN,
+                            0,
+                            NULL,
+                            psurfSrc->flags);
+    if (!hbm)
+        return NULL;
+
+    psurf = SURFACE_ShareLockSurface(hbm);
+    if (!psurf)
+    {
+        GreDeleteObject(hbm);
+        return NULL;
+    }
+
+    /* Same palette, so the bits are only stretched, not translated */
+    SURFACE_vSetPalette(psurf, psurfSrc->ppal);
+    EXLATEOBJ_vInitialize(&exlo, psurfSrc->ppal, psurf->ppal, 0, 0, 0);
+
+    RECTL_vSetRect(&rcDest, 0, 0, cx, cy);
+    Ret = IntEngStretchBlt(&psurf->SurfObj,
+                           &psurfSrc->SurfObj,
+                           NULL,
+                           NULL,
+                           &exlo.xlo,
+                           NULL,
+                           &rcDest,
+                           prclSrc,
+                           NULL,
+                           NULL,
+                           NULL,
+                           ROP4_SRCCOPY,
+                           COLORONCOLOR);
+
+    EXLATEOBJ_vCleanup(&exlo);
+    SURFACE_ShareUnlockSurface(psurf);
+
+    if (!Ret)
+    {
+        GreDeleteObject(hbm);
+        return NULL;
+    }
+
+    GreSetObjectOwner(hbm, GDI_OBJ_HMGR_PUBLIC);
+    return hbm;
+}
+
+/*
+ * Icons drawn at another size than their own, like shell icons in the
+ * list views, are stretched once and kept at that size. The copies use
+ * the same nearest color stretching, so the result is the same as
+ * stretching the icon on every draw.
+ */
+static
+PCURICON_SCALED
+IntGetScaledCurIcon(
+    _Inout_ PCURICON_OBJECT pIcon,
+    _In_ PSURFACE psurfMask,
+    _In_ PSURFACE psurfColor,
+    _In_ ULONG cx,
+    _In_ ULONG cy)
+{
+    PCURICON_SCALED pScaled;
+    PSURFACE psurfAlpha;
+    RECTL rcSrc;
+    UINT i;
+
+    for (i = 0; i < CURICON_SCALED_COUNT; i++)
+    {
+        pScaled = &pIcon->aScaled[i];
+        if (pScaled->hbmMask && pScaled->cx == cx && pScaled->cy == cy)
+            return pScaled;
+    }
+
+    /* Replace the oldest one */
+    pScaled = &pIcon->aScaled[pIcon->iScaledNext];
+    pIcon->iScaledNext = (pIcon->iScaledNext + 1) % CURICON_SCALED_COUNT;
+    IntFreeScaledCurIcon(pScaled);
+
+    RECTL_vSetRect(&rcSrc, 0, 0, pIcon->cx, pIcon->cy);
+
+    pScaled->hbmMask = IntCreateScaledBitmap(psurfMask, &rcSrc, cx, cy);
+    pScaled->hbmColor = IntCreateScaledBitmap(psurfColor, &rcSrc, cx, cy);
+    if (pIcon->hbmAlpha)
+    {
+        psurfAlpha = SURFACE_ShareLockSurface(pIcon->hbmAlpha);
+        if (psurfAlpha)
+        {
+            pScaled->hbmAlpha = IntCreateScaledBitmap(psurfAlpha, &rcSrc, cx, cy);
+            SURFACE_ShareUnlockSurface(psurfAlpha);
+        }
+    }
+
+    if (!pScaled->hbmMask || !pScaled->hbmColor ||
+        (pIcon->hbmAlpha && !pScaled->hbmAlpha))
+    {
+        IntFreeScaledCurIcon(pScaled);
+        return NULL;
+    }
+
+    pScaled->cx = cx;
+    pScaled->cy = cy;
+    return pScaled;
+}
+
 /* Mostly inspired from wine code.
  * We use low level functions because:
  *  - at this point, the icon bitmap could have a different bit depth than the DC,
@@ -1702,6 +1852,7 @@ UserDrawIconEx(
     HBITMAP hbmMask, hbmColor, hbmAlpha;
     BOOL bOffScreen;
     RECTL rcDest, rcSrc;
+    LONG cxDest, cyDest;
     CLIPOBJ* pdcClipObj = NULL;
     EXLATEOBJ exlo;
 
@@ -1805,6 +1956,40 @@ UserDrawIconEx(
     /* Set source rect */
     RECTL_vSetRect(&rcSrc, 0, 0, pIcon->cx, pIcon->cy);
 
+    /* Draw from a copy already stretched to the destination size.
+       Icons with the image in the bottom half of the mask aren't kept. */
+    cxDest = rcDest.right - rcDest.left;
+    cyDest = rcDest.bottom - rcDest.top;
+    if (psurfColor &&
+        (cxDest != (LONG)pIcon->cx || cyDest != (LONG)pIcon->cy) &&
+        cxDest > 0 && cxDest <= CURICON_SCALED_MAX &&
+        cyDest > 0 && cyDest <= CURICON_SCALED_MAX)
+    {
+        PCURICON_SCALED pScaled;
+        PSURFACE psurfScaledMask, psurfScaledColor;
+
+        pScaled = IntGetScaledCurIcon(pIcon, psurfMask, psurfColor, cxDest, cyDest);
+        if (pScaled)
+        {
+            psurfScaledMask = SURFACE_ShareLockSurface(pScaled->hbmMask);
+            psurfScaledColor = SURFACE_ShareLockSurface(pScaled->hbmColor);
+            if (psurfScaledMask && psurfScaledColor)
+            {
+                SURFACE_ShareUnlockSurface(psurfMask);
+                SURFACE_ShareUnlockSurface(psurfColor);
+                psurfMask = psurfScaledMask;
+                psurfColor = psurfScaledColor;
+                hbmAlpha = pScaled->hbmAlpha;
+                RECTL_vSetRect(&rcSrc, 0, 0, cxDest, cyDest);
+            }
+            else
+            {
+                if (psurfScaledMask) SURFACE_ShareUnlockSurface(psurfScaledMask);
+                if (psurfScaledColor) SURFACE_ShareUnlockSurface(psurfScaledColor);
+            }
+        }
+    }
+
     /* Should we render off-screen? */
     bOffScreen = hbrFlickerFreeDraw &&
         (GDI_HANDLE_GET_TYPE(hbrFlickerFreeDraw) == GDI_OBJECT_TYPE_BRUSH);
@@ -1946,7 +2131,8 @@ NoAlpha:
                                NULL,
                                NULL,
                                NULL,
-                               rop4);
+                               rop4,
+                               COLORONCOLOR);
 
         EXLATEOBJ_vCleanup(&exlo);
 
@@ -1976,7 +2162,8 @@ NoAlpha:
                                    NULL,
                                    NULL,
                                    NULL,
-                                   rop4);
+                                   rop4,
+                                   COLORONCOLOR);
 
             EXLATEOBJ_vCleanup(&exlo);
 
@@ -2005,7 +2192,8 @@ NoAlpha:
                                    NULL,
                                    NULL,
                                    NULL,
-                                   rop4);
+                                   rop4,
+                                   COLORONCOLOR);
 
             EXLATEOBJ_vCleanup(&exlo);
 
@@ -6,6 +6,19 @@
 #define CURSORF_USER_MASK \
     (CURSORF_FROMRESOURCE | CURSORF_LRSHARED | CURSORF_ACON)
 
+/* Copies of the icon bitmaps stretched to a size it is drawn at */
+#define CURICON_SCALED_COUNT 2
+#define CURICON_SCALED_MAX 256
+
+typedef struct _CURICON_SCALED
+{
+    ULONG cx;
+    ULONG cy;
+    HBITMAP hbmMask;
+    HBITMAP hbmColor;
+    HBITMAP hbmAlpha;
+} CURICON_SCALED, *PCURICON_SCALED;
+
 typedef struct _CURICON_OBJECT
 {
     PROCMARKHEAD head;
@@ -24,6 +37,8 @@ typedef struct _CURICON_OBJECT
     ULONG bpp;
     ULONG cx;
     ULONG cy;
+    CURICON_SCALED aScaled[CURICON_SCALED_COUNT];
+    UINT iScaledNext;
 } CURICON_OBJECT, *PCURICON_OBJECT;
 
 typedef struct tagACON
@@ -161,6 +161,8 @@ IntDesktopObjectDelete(
     if (pdesk->spwndMessage)
         co_UserDestroyWindow(pdesk->spwndMessage);
 
+    IntFreeHitIndex(pdesk);
+
     /* Remove the desktop from the window station's list of associcated desktops */
     RemoveEntryList(&pdesk->ListEntry);
 
@@ -1000,6 +1002,7 @@ IntHideDesktop(PDESKTOP Desktop)
         return ERROR_INVALID_WINDOW_HANDLE;
     }
     DesktopWnd->style &= ~WS_VISIBLE;
+    VIS_InvalidateCache();
 
     return STATUS_SUCCESS;
 }
@@ -1633,6 +1636,8 @@ UserInitializeDesktop(PDESKTOP pdesk, PUNICODE_STRING DesktopName, PWINSTATION_O
         ERR("Failed to create desktop heap!\n");
         return STATUS_NO_MEMORY;
     }
+    pdesk->ulHeapSize = HeapSize;
+    DesktopHeapInitialize(pdesk, HeapSize);
 
     /* Create DESKTOPINFO */
     DesktopInfoSize = sizeof(DESKTOPINFO) + DesktopName->Length + sizeof(WCHAR);
@@ -41,6 +41,11 @@ typedef struct _DESKTOP
     /* Thread blocking input */
     PVOID BlockInputThread;
     LIST_ENTRY ShellHookWindows;
+    /* Top level windows sorted by position for hit testing */
+    struct _WND_HIT_INDEX *pHitIndex;
+    /* Small blocks of the desktop heap and its usage */
+    DESKTOP_HEAP_CLASS HeapClasses[DESKTOP_HEAP_SIZE_CLASSES];
+    DESKTOP_HEAP_STATS HeapStats;
 } DESKTOP, *PDESKTOP;
 
 // Desktop flags
@@ -211,66 +216,22 @@ UserIsMessageWindow(IN PWND pWnd)
 #endif
 
 
-static __inline PVOID
+VOID
+DesktopHeapInitialize(IN PDESKTOP Desktop,
+                      IN SIZE_T HeapSize);
+
+PVOID
 DesktopHeapAlloc(IN PDESKTOP Desktop,
-                 IN SIZE_T Bytes)
-{
-    return RtlAllocateHeap(Desktop->pheapDesktop,
-                           HEAP_NO_SERIALIZE,
-                           Bytes);
-}
+                 IN SIZE_T Bytes);
 
-static __inline BOOL
+BOOL
 DesktopHeapFree(IN PDESKTOP Desktop,
-                IN PVOID lpMem)
-{
-    return RtlFreeHeap(Desktop->pheapDesktop,
-                       HEAP_NO_SERIALIZE,
-                       lpMem);
-}
+                IN PVOID lpMem);
 
-static __inline PVOID
+PVOID
 DesktopHeapReAlloc(IN PDESKTOP Desktop,
                    IN PVOID lpMem,
-                   IN SIZE_T Bytes)
-{
-#if 0
-    /* NOTE: ntoskrnl doesn't export RtlReAllocateHeap... */
-    return RtlReAllocateHeap(Desktop->pheapDesktop,
-                             HEAP_NO_SERIALIZE,
-                             lpMem,
-                             Bytes);
-#else
-    SIZE_T PrevSize;
-    PVOID pNew;
-
-    PrevSize = RtlSizeHeap(Desktop->pheapDesktop,
-                           HEAP_NO_SERIALIZE,
-                           lpMem);
-
-    if (PrevSize == Bytes)
-        return lpMem;
-
-    pNew = RtlAllocateHeap(Desktop->pheapDesktop,
-                           HEAP_NO_SERIALIZE,
-                           Bytes);
-    if (pNew != NULL)
-    {
-        if (PrevSize < Bytes)
-            Bytes = PrevSize;
-
-        RtlCopyMemory(pNew,
-                      lpMem,
-                      Bytes);
-
-        RtlFreeHeap(Desktop->pheapDesktop,
-                    HEAP_NO_SERIALIZE,
-                    lpMem);
-    }
-
-    return pNew;
-#endif
-}
+                   IN SIZE_T Bytes);
 
 static __inline ULONG_PTR
 DesktopHeapGetUserDelta(VOID)
@@ -15,8 +15,12 @@ typedef struct _EVENTPACK
   LONG idObject;
   LONG idChild;
   LONG idThread;
+  DWORD dwmsEventTime;
 } EVENTPACK, *PEVENTPACK;
 
+/* Most out of context events a listener gets in one callback */
+#define EVENT_BATCH_MAX 32
+
 static PEVENTTABLE GlobalEvents = NULL;
 
 /* PRIVATE FUNCTIONS *********************************************************/
@@ -112,6 +116,7 @@ IntCallLowLevelEvent( PEVENTHOOK pEH,
    pEP->idObject = idObject;
    pEP->idChild = idChild;
    pEP->idThread = idThread;
+   pEP->dwmsEventTime = (DWORD)EngGetTickCount();
 
    Msg.message = event;
    Msg.hwnd = hwnd;
@@ -143,35 +148,79 @@ IntRemoveEvent(PVOID Object)
 
 /* FUNCTIONS *****************************************************************/
 
+static
+VOID
+FASTCALL
+IntUnpackEvent( PEVENTPROC_CALLBACK_ARGUMENTS Event,
+                DWORD event,
+                HWND hwnd,
+                PEVENTPACK pEP)
+{
+   PEVENTHOOK pEH = pEP->pEH;
+
+   Event->hook = UserHMGetHandle(pEH);
+   Event->event = event;
+   Event->hwnd = hwnd;
+   Event->idObject = pEP->idObject;
+   Event->idChild = pEP->idChild;
+   Event->dwEventThread = pEP->idThread;
+   Event->dwmsEventTime = pEP->dwmsEventTime;
+   Event->Proc = pEH->Proc;
+   Event->Mod = pEH->ihmod;
+   Event->offPfn = pEH->offPfn;
+
+   ExFreePoolWithTag(pEP, TAG_HOOK);
+}
+
 //
 // Dispatch MsgQueue Event Call processor!
 //
+// Out of context events pile up in the queue of the listener thread while it
+// is busy, so the ones waiting behind this one go to user mode with it in a
+// single callback.
+//
 LRESULT
 APIENTRY
-co_EVENT_CallEvents( DWORD event,
+co_EVENT_CallEvents( PTHREADINFO pti,
+                     PWND Window,
+                     DWORD event,
                      HWND hwnd,
-                     UINT_PTR idObject,
-                     LONG_PTR idChild)
+                     LONG_PTR ExtraInfo)
 {
-   PEVENTHOOK pEH;
-   LRESULT Result;
-   PEVENTPACK pEP = (PEVENTPACK)idChild;
-
-   pEH = pEP->pEH;
-   TRACE("Dispatch Event 0x%lx, idObject %uI hwnd %p\n", event, idObject, hwnd);
-   Result = co_IntCallEventProc( UserHMGetHandle(pEH),
-                                 event,
-                                 hwnd,
-                                 pEP->idObject,
-                                 pEP->idChild,
-                                 pEP->idThread,
-                                (DWORD)EngGetTickCount(),
-                                 pEH->Proc,
-                                 pEH->ihmod,
-                                 pEH->offPfn);
+   PEVENTPROC_CALLBACK_ARGUMENTS Events;
+   EVENTPROC_CALLBACK_ARGUMENTS Event;
+   ULONG cEvents;
+   DWORD dwQEvent;
+   MSG Msg;
 
-   ExFreePoolWithTag(pEP, TAG_HOOK);
-   return Result;
+   TRACE("Dispatch Event 0x%lx, hwnd %p\n", event, hwnd);
+
+   Events = ExAllocatePoolWithTag(PagedPool,
+                                  EVENT_BATCH_MAX * sizeof(EVENTPROC_CALLBACK_ARGUMENTS),
+                                  TAG_HOOK);
+   if (!Events)
+   {
+      IntUnpackEvent(&Event, event, hwnd, (PEVENTPACK)ExtraInfo);
+      return co_IntCallEventProcs(&Event, 1);
+   }
+
+   IntUnpackEvent(&Events[0], event, hwnd, (PEVENTPACK)ExtraInfo);
+   cEvents = 1;
+
+   /* Only take what directly follows, the other internal events stay in order. */
+   while ( cEvents < EVENT_BATCH_MAX &&
+           MsqPeekMessage( pti, FALSE, Window, 0, 0, QS_EVENT, &ExtraInfo, &dwQEvent, &Msg) &&
+           dwQEvent == POSTEVENT_NWE )
+   {
+      MsqPeekMessage( pti, TRUE, Window, 0, 0, QS_EVENT, &ExtraInfo, &dwQEvent, &Msg);
+      IntUnpackEvent(&Events[cEvents++], Msg.message, Msg.hwnd, (PEVENTPACK)ExtraInfo);
+   }
+
+   TRACE("Dispatch %lu Events\n", cEvents);
+   co_IntCallEventProcs(Events, cEvents);
+
+   ExFreePoolWithTag(Events, TAG_HOOK);
+   return 0;
 }
 
 VOID
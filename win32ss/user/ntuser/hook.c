@@ -1016,6 +1016,46 @@ IntGetNextHook(PHOOK Hook)
     return NULL;
 }
 
+/* Pass on the rest of a thread chain with the first hook. User mode runs
+   through it on CallNextHookEx without coming back here, so it is only
+   done when every hook left can be called straight from there. */
+UINT
+FASTCALL
+IntGetHookChain(PHOOK Hook, PHOOKPROC_CHAIN_ENTRY Chain)
+{
+    PHOOK Next;
+    UINT Count = 0;
+
+    switch (Hook->HookId)
+    {
+       case WH_KEYBOARD:
+       case WH_MOUSE:
+       case WH_GETMESSAGE:
+       case WH_MSGFILTER:
+       case WH_SYSMSGFILTER:
+       case WH_FOREGROUNDIDLE:
+       case WH_SHELL:
+          break;
+       default: /* The parameters are converted or copied on the way. */
+          return 0;
+    }
+
+    for (Next = IntGetNextHook(Hook); Next; Next = IntGetNextHook(Next))
+    {
+       if ( Count == HOOKPROC_CHAIN_MAX ||
+            Next->offPfn ||
+            Next->Ansi != Hook->Ansi ||
+            UserObjectInDestroy(UserHMGetHandle(Next)) )
+       {
+          return 0;
+       }
+       Chain[Count].hHook = UserHMGetHandle(Next);
+       Chain[Count].Proc = Next->Proc;
+       Count++;
+    }
+    return Count;
+}
+
 /* Free a hook, removing it from its chain */
 static
 VOID
@@ -1181,15 +1221,7 @@ co_HOOK_CallHooks( INT HookId,
           }
           _SEH2_END;
        }
-       Result = co_IntCallHookProc( HookId,
-                                    Code,
-                                    wParam,
-                                    lParam,
-                                    Hook->Proc,
-                                    Hook->ihmod,
-                                    Hook->offPfn,
-                                    Hook->Ansi,
-                                   &Hook->ModuleName);
+       Result = co_IntCallHookChain(Hook, Code, wParam, lParam);
        if (ClientInfo)
        {
           _SEH2_TRY
@@ -42,9 +42,10 @@ typedef struct _NOTIFYEVENT
 
 LRESULT APIENTRY co_CallHook(INT HookId, INT Code, WPARAM wParam, LPARAM lParam);
 LRESULT APIENTRY co_HOOK_CallHooks(INT HookId, INT Code, WPARAM wParam, LPARAM lParam);
-LRESULT APIENTRY co_EVENT_CallEvents(DWORD, HWND, UINT_PTR, LONG_PTR);
+LRESULT APIENTRY co_EVENT_CallEvents(PTHREADINFO, PWND, DWORD, HWND, LONG_PTR);
 PHOOK FASTCALL IntGetHookObject(HHOOK);
 PHOOK FASTCALL IntGetNextHook(PHOOK Hook);
+UINT FASTCALL IntGetHookChain(PHOOK Hook, PHOOKPROC_CHAIN_ENTRY Chain);
 LRESULT APIENTRY UserCallNextHookEx( PHOOK pHook, int Code, WPARAM wParam, LPARAM lParam, BOOL Ansi);
 BOOL FASTCALL IntUnhookWindowsHook(int,HOOKPROC);
 BOOLEAN IntRemoveHook(PVOID Object);
@@ -17,8 +17,136 @@ typedef struct _LRD_PROP
    BYTE     is_Layered;
    BYTE     NoUsed[2];
    DWORD    Flags;
+   /* Contents last given to UpdateLayeredWindow */
+   HDC      hdcBuffer;
+   HBITMAP  hbmBuffer;
+   HBITMAP  hbmOld;
+   SIZE     szBuffer;
+   ULONG    iFormat;
 } LRD_PROP, *PLRD_PROP;
 
+static PLRD_PROP FASTCALL
+IntGetLayeredProp(PWND pWnd)
+{
+   PLRD_PROP pLrdProp = UserGetProp(pWnd, AtomLayer, TRUE);
+
+   if (!pLrdProp)
+   {
+      pLrdProp = ExAllocatePoolWithTag(PagedPool, sizeof(LRD_PROP), USERTAG_REDIRECT);
+      if (pLrdProp == NULL)
+      {
+         ERR("failed to allocate LRD_PROP\n");
+         return NULL;
+      }
+      RtlZeroMemory(pLrdProp, sizeof(LRD_PROP));
+      if (!UserSetProp(pWnd, AtomLayer, (HANDLE)pLrdProp, TRUE))
+      {
+         ExFreePoolWithTag(pLrdProp, USERTAG_REDIRECT);
+         return NULL;
+      }
+   }
+   return pLrdProp;
+}
+
+static VOID FASTCALL
+IntFreeLayeredBuffer(PLRD_PROP pLrdProp)
+{
+   if (pLrdProp->hdcBuffer)
+   {
+      NtGdiSelectBitmap(pLrdProp->hdcBuffer, pLrdProp->hbmOld);
+      GreSetDCOwner(pLrdProp->hdcBuffer, GDI_OBJ_HMGR_POWNED);
+      IntGdiDeleteDC(pLrdProp->hdcBuffer, TRUE);
+   }
+   if (pLrdProp->hbmBuffer)
+   {
+      GreSetObjectOwner(pLrdProp->hbmBuffer, GDI_OBJ_HMGR_POWNED);
+      GreDeleteObject(pLrdProp->hbmBuffer);
+   }
+   pLrdProp->hdcBuffer = NULL;
+   pLrdProp->hbmBuffer = NULL;
+   pLrdProp->hbmOld = NULL;
+   pLrdProp->szBuffer.cx = pLrdProp->szBuffer.cy = 0;
+   pLrdProp->iFormat = 0;
+}
+
+/*
+ * The buffer keeps the window contents between UpdateLayeredWindow calls,
+ * so that a call with a dirty rectangle only copies and blends that part.
+ * It is made again when the window size or the source format changes;
+ * *pbNew tells the caller that it holds nothing yet.
+ */
+static BOOL FASTCALL
+IntGetLayeredBuffer(PLRD_PROP pLrdProp,
+                    HDC hdcSrc,
+                    LONG cx,
+                    LONG cy,
+                    BOOL *pbNew)
+{
+   PDC pdc;
+   ULONG iFormat = 0;
+   HDC hdcBuffer;
+   HBITMAP hbmBuffer;
+
+   *pbNew = FALSE;
+
+   pdc = DC_LockDc(hdcSrc);
+   if (!pdc)
+   {
+      EngSetLastError(ERROR_INVALID_HANDLE);
+      return FALSE;
+   }
+   if (pdc->dclevel.pSurface)
+      iFormat = pdc->dclevel.pSurface->SurfObj.iBitmapFormat;
+   DC_UnlockDc(pdc);
+
+   if (pLrdProp->hdcBuffer &&
+       pLrdProp->szBuffer.cx == cx &&
+       pLrdProp->szBuffer.cy == cy &&
+       pLrdProp->iFormat == iFormat)
+   {
+      return TRUE;
+   }
+
+   IntFreeLayeredBuffer(pLrdProp);
+
+   hbmBuffer = NtGdiCreateCompatibleBitmap(hdcSrc, cx, cy);
+   if (!hbmBuffer)
+      return FALSE;
+
+   hdcBuffer = NtGdiCreateCompatibleDC(hdcSrc);
+   if (!hdcBuffer)
+   {
+      GreDeleteObject(hbmBuffer);
+      return FALSE;
+   }
+
+   /* The window can be destroyed from another process */
+   GreSetObjectOwner(hbmBuffer, GDI_OBJ_HMGR_PUBLIC);
+   GreSetDCOwner(hdcBuffer, GDI_OBJ_HMGR_PUBLIC);
+
+   pLrdProp->hdcBuffer = hdcBuffer;
+   pLrdProp->hbmBuffer = hbmBuffer;
+   pLrdProp->hbmOld = (HBITMAP)NtGdiSelectBitmap(hdcBuffer, hbmBuffer);
+   pLrdProp->szBuffer.cx = cx;
+   pLrdProp->szBuffer.cy = cy;
+   pLrdProp->iFormat = iFormat;
+
+   *pbNew = TRUE;
+   return TRUE;
+}
+
+VOID FASTCALL
+IntDestroyLayeredProp(PWND pWnd)
+{
+   PLRD_PROP pLrdProp = UserRemoveProp(pWnd, AtomLayer, TRUE);
+
+   if (pLrdProp)
+   {
+      IntFreeLayeredBuffer(pLrdProp);
+      ExFreePoolWithTag(pLrdProp, USERTAG_REDIRECT);
+   }
+}
+
 BOOL FASTCALL
 GetLayeredStatus(PWND pWnd)
 {
@@ -57,18 +185,10 @@ IntSetLayeredWindowAttributes(PWND pWnd,
       return FALSE;
    }
 
-   pLrdProp = UserGetProp(pWnd, AtomLayer, TRUE);
-
+   pLrdProp = IntGetLayeredProp(pWnd);
    if (!pLrdProp)
    {
-      pLrdProp = ExAllocatePoolWithTag(PagedPool, sizeof(LRD_PROP), USERTAG_REDIRECT);
-      if (pLrdProp == NULL)
-      {
-         ERR("failed to allocate LRD_PROP\n");
-         return FALSE;
-      }
-      RtlZeroMemory(pLrdProp, sizeof(LRD_PROP));
-      UserSetProp(pWnd, AtomLayer, (HANDLE)pLrdProp, TRUE);
+      return FALSE;
    }
 
    if (pLrdProp)
@@ -150,12 +270,12 @@ IntUpdateLayeredWindowI( PWND pWnd,
 
    if (info->hdcSrc)
    {
-      HDC hdc, hdcBuffer;
+      HDC hdc;
       RECT Rect;
       BLENDFUNCTION blend = { AC_SRC_OVER, 0, 255, 0 };
       COLORREF color_key = (info->dwFlags & ULW_COLORKEY) ? info->crKey : CLR_INVALID;
-      HBITMAP hOldBitmap, hOldBitmap1, hbmSrc, hbmDst;
-      DIBSECTION dibs;
+      PLRD_PROP pLrdProp;
+      BOOL bNew;
 
       Rect = Window;
 
@@ -163,67 +283,70 @@ IntUpdateLayeredWindowI( PWND pWnd,
 
       TRACE("H %d W %d\n",Rect.bottom - Rect.top,Rect.right - Rect.left);
 
-      if (!info->hdcDst) hdc = UserGetDCEx(pWnd, NULL, DCX_USESTYLE);
-      else hdc = info->hdcDst;
-
-      hbmSrc = NtGdiCreateCompatibleBitmap(info->hdcSrc, Rect.right - Rect.left, Rect.bottom - Rect.top);
-      hbmDst = NtGdiCreateCompatibleBitmap(info->hdcSrc, Rect.right - Rect.left, Rect.bottom - Rect.top);
-
-      GreGetObject(hbmSrc, sizeof(DIBSECTION), &dibs);
-
-      TRACE("Source Bitmap bc %d\n",dibs.dsBmih.biBitCount);
-
-      hdcBuffer = NtGdiCreateCompatibleDC(hdc);
-
-      hOldBitmap = (HBITMAP)NtGdiSelectBitmap(hdcBuffer, hbmSrc);
-      hOldBitmap1 = (HBITMAP)NtGdiSelectBitmap(hdc, hbmDst);
-
-      NtGdiStretchBlt( hdcBuffer,
-                       Rect.left,
-                       Rect.top,
-                       Rect.right - Rect.left,
-                       Rect.bottom - Rect.top,
-                       info->hdcSrc,
-                       Rect.left + (info->pptSrc ? info->pptSrc->x : 0),
-                       Rect.top  + (info->pptSrc ? info->pptSrc->y : 0),
-                       Rect.right - Rect.left,
-                       Rect.bottom - Rect.top,
-                       SRCCOPY,
-                       color_key );
+      pLrdProp = IntGetLayeredProp(pWnd);
+      if (!pLrdProp ||
+          !IntGetLayeredBuffer(pLrdProp, info->hdcSrc, Rect.right, Rect.bottom, &bNew))
+      {
+         ERR("No layered window buffer\n");
+         return FALSE;
+      }
 
-      // Need to test this, Dirty before or after StretchBlt?
-      if (info->prcDirty)
+      /* Only the dirty part changed since the last update */
+      if (info->prcDirty && !bNew)
       {
-         ERR("prcDirty\n");
          RECTL_bIntersectRect( &Rect, &Rect, info->prcDirty );
-         NtGdiPatBlt( hdc, Rect.left, Rect.top, Rect.right - Rect.left, Rect.bottom - Rect.top, BLACKNESS );
       }
 
-      if (info->dwFlags & ULW_ALPHA)
+      if (RECTL_bIsEmptyRect(&Rect))
       {
-         blend = *info->pblend;
-         TRACE("ULW_ALPHA bop %d Alpha %d aF %d\n", blend.BlendOp, blend.SourceConstantAlpha, blend.AlphaFormat);
+         ret = TRUE;
+      }
+      else
+      {
+         if (!info->hdcDst) hdc = UserGetDCEx(pWnd, NULL, DCX_USESTYLE);
+         else hdc = info->hdcDst;
+
+         NtGdiStretchBlt( pLrdProp->hdcBuffer,
+                          Rect.left,
+                          Rect.top,
+                          Rect.right - Rect.left,
+                          Rect.bottom - Rect.top,
+                          info->hdcSrc,
+                          Rect.left + (info->pptSrc ? info->pptSrc->x : 0),
+                          Rect.top  + (info->pptSrc ? info->pptSrc->y : 0),
+                          Rect.right - Rect.left,
+                          Rect.bottom - Rect.top,
+                          SRCCOPY,
+                          color_key );
+
+         if (info->prcDirty)
+         {
+            NtGdiPatBlt( hdc, Rect.left, Rect.top, Rect.right - Rect.left, Rect.bottom - Rect.top, BLACKNESS );
+         }
+
+         if (info->dwFlags & ULW_ALPHA)
+         {
+            blend = *info->pblend;
+            TRACE("ULW_ALPHA bop %d Alpha %d aF %d\n", blend.BlendOp, blend.SourceConstantAlpha, blend.AlphaFormat);
+         }
+
+         /* The buffer has the window's own coordinates, and the same size
+            as the destination, so this takes the unstretched blend path */
+         ret = NtGdiAlphaBlend( hdc,
+                                Rect.left,
+                                Rect.top,
+                                Rect.right - Rect.left,
+                                Rect.bottom - Rect.top,
+                                pLrdProp->hdcBuffer,
+                                Rect.left,
+                                Rect.top,
+                                Rect.right - Rect.left,
+                                Rect.bottom - Rect.top,
+                                blend,
+                                0);
+
+         if (!info->hdcDst) UserReleaseDC(pWnd, hdc, FALSE);
       }
-
-      ret = NtGdiAlphaBlend( hdc,
-                             Rect.left,
-                             Rect.top,
-                             Rect.right - Rect.left,
-                             Rect.bottom - Rect.top,
-                             hdcBuffer,
-                             Rect.left + (info->pptSrc ? info->pptSrc->x : 0),
-                             Rect.top  + (info->pptSrc ? info->pptSrc->y : 0),
-                             Rect.right - Rect.left,
-                             Rect.bottom - Rect.top,
-                             blend,
-                             0);
-
-      NtGdiSelectBitmap(hdc, hOldBitmap1);
-      NtGdiSelectBitmap(hdcBuffer, hOldBitmap);
-      if (hbmSrc) GreDeleteObject(hbmSrc);
-      if (hbmDst) GreDeleteObject(hbmDst);
-      if (hdcBuffer) IntGdiDeleteDC(hdcBuffer, FALSE);
-      if (!info->hdcDst) UserReleaseDC(pWnd, hdc, FALSE);
    }
    else
       ret = TRUE;
@@ -113,6 +113,10 @@ UserDeleteW32Process(
     if (ppiCurrent->rpdeskStartup)
         ObDereferenceObject(ppiCurrent->rpdeskStartup);
 
+    /* Free the class lookup hash, in case the classes weren't destroyed */
+    if (ppiCurrent->pClassHash)
+        ExFreePoolWithTag(ppiCurrent->pClassHash, USERTAG_CLASS);
+
 #if DBG
     if (DBG_IS_CHANNEL_ENABLED(ppiCurrent, DbgChUserObj, WARN_LEVEL))
     {
@@ -836,6 +840,8 @@ ExitThreadCallback(PETHREAD Thread)
     }
     ptiCurrent->hEventQueueClient = NULL;
 
+    GdiThreadDestroy(Thread);
+
     /* The thread is dying */
     PsSetThreadWin32Thread(Thread /*ptiCurrent->pEThread*/, NULL, ptiCurrent);
     ptiCurrent->pEThread = NULL;
@@ -979,6 +985,7 @@ DriverEntry(
 
     NT_ROF(InitGdiHandleTable());
     NT_ROF(InitPaletteImpl());
+    NT_ROF(InitXlateImpl());
 
     /* Create stock objects, ie. precreated objects commonly
        used by win32 applications */
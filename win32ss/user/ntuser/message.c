@@ -659,7 +659,7 @@ static LRESULT handle_internal_events( PTHREADINFO pti, PWND pWnd, DWORD dwQEven
     {
        case POSTEVENT_NWE:
        {
-          co_EVENT_CallEvents( pMsg->message, pMsg->hwnd, pMsg->wParam, ExtraInfo);
+          co_EVENT_CallEvents( pti, pWnd, pMsg->message, pMsg->hwnd, ExtraInfo);
        }
        break;
        case POSTEVENT_SAW:
@@ -57,30 +57,51 @@ MsqInitializeImpl(VOID)
    return(STATUS_SUCCESS);
 }
 
+static BOOL
+IntIsHitTopLevelWindow(PWND pWnd, INT x, INT y)
+{
+    if (pWnd->state2 & WNDS2_INDESTROY || pWnd->state & WNDS_DESTROYED)
+    {
+        TRACE("The Window is in DESTROY!\n");
+        return FALSE;
+    }
+
+    return (pWnd->style & WS_VISIBLE) &&
+           (pWnd->ExStyle & (WS_EX_LAYERED|WS_EX_TRANSPARENT)) != (WS_EX_LAYERED|WS_EX_TRANSPARENT) &&
+           IntPtInWindow(pWnd, x, y);
+}
+
 PWND FASTCALL
 IntTopLevelWindowFromPoint(INT x, INT y)
 {
     PWND pWnd, pwndDesktop;
+    PWND *apwnd;
+    ULONG cWindows, i;
 
     /* Get the desktop window */
     pwndDesktop = UserGetDesktopWindow();
     if (!pwndDesktop)
         return NULL;
 
+    /* Only look at the windows overlapping the point if they are indexed */
+    apwnd = IntHitIndexLookup(pwndDesktop, x, y, &cWindows);
+    if (apwnd)
+    {
+        for (i = 0; i < cWindows; i++)
+        {
+            if (IntIsHitTopLevelWindow(apwnd[i], x, y))
+                return apwnd[i];
+        }
+
+        return pwndDesktop;
+    }
+
     /* Loop all top level windows */
     for (pWnd = pwndDesktop->spwndChild;
          pWnd != NULL;
          pWnd = pWnd->spwndNext)
     {
-        if (pWnd->state2 & WNDS2_INDESTROY || pWnd->state & WNDS_DESTROYED)
-        {
-            TRACE("The Window is in DESTROY!\n");
-            continue;
-        }
-
-        if ((pWnd->style & WS_VISIBLE) &&
-            (pWnd->ExStyle & (WS_EX_LAYERED|WS_EX_TRANSPARENT)) != (WS_EX_LAYERED|WS_EX_TRANSPARENT) &&
-            IntPtInWindow(pWnd, x, y))
+        if (IntIsHitTopLevelWindow(pWnd, x, y))
             return pWnd;
     }
 
@@ -437,7 +458,9 @@ MsqWakeQueue(PTHREADINFO pti, DWORD MessageBits, BOOL KeyEvent)
    if (MessageBits & QS_HOTKEY)      pti->nCntsQBits[QSRosHotKey]++;
    if (MessageBits & QS_EVENT)       pti->nCntsQBits[QSRosEvent]++;
 
-   if (KeyEvent)
+   /* The event is auto reset, so while it is still set the thread has not
+      waited since the last wake up and will see these bits anyway */
+   if (KeyEvent && !KeReadStateEvent(pti->pEventQueueServer))
       KeSetEvent(pti->pEventQueueServer, IO_NO_INCREMENT, FALSE);
 }
 
@@ -732,14 +755,22 @@ co_MsqInsertMouseMessage(MSG* Msg, DWORD flags, ULONG_PTR dwExtraInfo, BOOL Hook
 }
 
 PUSER_MESSAGE FASTCALL
-MsqCreateMessage(LPMSG Msg)
+MsqCreateMessage(PTHREADINFO pti, LPMSG Msg)
 {
    PUSER_MESSAGE Message;
 
-   Message = ExAllocateFromPagedLookasideList(pgMessageLookasideList);
-   if (!Message)
+   if (pti->FreeMessagesList.Next)
    {
-      return NULL;
+      Message = CONTAINING_RECORD(PopEntryList(&pti->FreeMessagesList), USER_MESSAGE, ListEntry);
+      pti->cFreeMessages--;
+   }
+   else
+   {
+      Message = ExAllocateFromPagedLookasideList(pgMessageLookasideList);
+      if (!Message)
+      {
+         return NULL;
+      }
    }
 
    RtlZeroMemory(Message, sizeof(*Message));
@@ -751,6 +782,8 @@ MsqCreateMessage(LPMSG Msg)
 VOID FASTCALL
 MsqDestroyMessage(PUSER_MESSAGE Message)
 {
+   PTHREADINFO pti;
+
    TRACE("Post Destroy %d\n",PostMsgCount)
    if (Message->pti == NULL)
    {
@@ -758,8 +791,22 @@ MsqDestroyMessage(PUSER_MESSAGE Message)
       return;
    }
    RemoveEntryList(&Message->ListEntry);
+   pti = Message->pti;
    Message->pti = NULL;
-   ExFreeToPagedLookasideList(pgMessageLookasideList, Message);
+
+   /* Keep it for the next message posted to this thread. Only the thread
+      itself does that, so the list is gone with it. */
+   if (pti == PsGetCurrentThreadWin32Thread() &&
+       !(pti->TIF_flags & TIF_INCLEANUP) &&
+       pti->cFreeMessages < MSQ_FREE_MESSAGES_MAX)
+   {
+      PushEntryList(&pti->FreeMessagesList, (PSINGLE_LIST_ENTRY)&Message->ListEntry);
+      pti->cFreeMessages++;
+   }
+   else
+   {
+      ExFreeToPagedLookasideList(pgMessageLookasideList, Message);
+   }
    PostMsgCount--;
 }
 
@@ -1355,7 +1402,7 @@ MsqPostMessage(PTHREADINFO pti,
       return;
    }
 
-   if(!(Message = MsqCreateMessage(Msg)))
+   if(!(Message = MsqCreateMessage(pti, Msg)))
    {
       return;
    }
@@ -2361,6 +2408,14 @@ MsqCleanupThreadMsgs(PTHREADINFO pti)
          }
       }
    }
+
+   /* free the messages kept for reuse */
+   while (pti->FreeMessagesList.Next)
+   {
+      CurrentMessage = CONTAINING_RECORD(PopEntryList(&pti->FreeMessagesList), USER_MESSAGE, ListEntry);
+      ExFreeToPagedLookasideList(pgMessageLookasideList, CurrentMessage);
+   }
+   pti->cFreeMessages = 0;
 }
 
 VOID FASTCALL
@@ -5,6 +5,9 @@
 #define MSQ_ISHOOK      1
 #define MSQ_INJECTMODULE 2
 
+/* Freed posted messages kept by each thread */
+#define MSQ_FREE_MESSAGES_MAX 16
+
 typedef struct _USER_MESSAGE
 {
   LIST_ENTRY ListEntry;
@@ -132,7 +135,7 @@ VOID CALLBACK HungAppSysTimerProc(HWND,UINT,UINT_PTR,DWORD);
 NTSTATUS FASTCALL co_MsqSendMessage(PTHREADINFO ptirec,
            HWND Wnd, UINT Msg, WPARAM wParam, LPARAM lParam,
            UINT uTimeout, BOOL Block, INT HookMessage, ULONG_PTR *uResult);
-PUSER_MESSAGE FASTCALL MsqCreateMessage(LPMSG Msg);
+PUSER_MESSAGE FASTCALL MsqCreateMessage(PTHREADINFO pti, LPMSG Msg);
 VOID FASTCALL MsqDestroyMessage(PUSER_MESSAGE Message);
 VOID FASTCALL MsqPostMessage(PTHREADINFO, MSG*, BOOLEAN, DWORD, DWORD, LONG_PTR);
 VOID FASTCALL MsqPostQuitMessage(PTHREADINFO pti, ULONG ExitCode);
@@ -14,7 +14,16 @@ DBG_DEFAULT_CHANNEL(UserTimer);
 /* GLOBALS *******************************************************************/
 
 static LIST_ENTRY TimersListHead;
-static LONG TimeLast = 0;
+
+/* Timers waiting to expire, the next one first. MasterTimer is only set
+ * for the time the first of them has to be handled */
+static LIST_ENTRY TimersDueListHead;
+static ULONG TimeWake;
+static BOOL MasterTimerArmed = FALSE;
+
+/* How late a timer may fire by default, to share a wakeup with others.
+ * Timers used to be checked every 10 ms on a fixed tick. */
+#define TIMER_DEFAULT_TOLERANCE 10
 
 /* Windows 2000 has room for 32768 window-less timers */
 #define NUM_WINDOW_LESS_TIMERS   32768
@@ -59,11 +68,98 @@ CreateTimer(VOID)
   {
      Ret->head.h = Handle;
      InsertTailList(&TimersListHead, &Ret->ptmrList);
+     InitializeListHead(&Ret->ptmrDueList);
   }
 
   return Ret;
 }
 
+static
+ULONG
+FASTCALL
+GetTimerTime(VOID)
+{
+  LARGE_INTEGER TickCount;
+
+  KeQueryTickCount(&TickCount);
+  return (ULONG)MsqCalculateMessageTime(&TickCount);
+}
+
+static
+VOID
+FASTCALL
+InsertDueTimer(PTIMER pTmr)
+{
+  PLIST_ENTRY pLE;
+  PTIMER pPrev;
+
+  /* Rescheduled timers mostly go last, so look from the end */
+  for (pLE = TimersDueListHead.Blink; pLE != &TimersDueListHead; pLE = pLE->Blink)
+  {
+     pPrev = CONTAINING_RECORD(pLE, TIMER, ptmrDueList);
+     if ((LONG)(pPrev->tmDue - pTmr->tmDue) <= 0)
+        break;
+  }
+
+  InsertHeadList(pLE, &pTmr->ptmrDueList);
+}
+
+static
+VOID
+FASTCALL
+RemoveDueTimer(PTIMER pTmr)
+{
+  RemoveEntryList(&pTmr->ptmrDueList);
+  InitializeListHead(&pTmr->ptmrDueList);
+}
+
+//
+// Set MasterTimer for the latest time all pending timers can still wait
+// for, so timers due close to each other are handled in one go. Unless
+// forced, the timer is only moved to an earlier time.
+//
+static
+VOID
+FASTCALL
+ArmMasterTimer(ULONG Time, BOOL Force)
+{
+  LARGE_INTEGER DueTime;
+  PLIST_ENTRY pLE;
+  PTIMER pTmr;
+  ULONG Wake;
+  LONG Delay;
+
+  if (IsListEmpty(&TimersDueListHead))
+     return;
+
+  pTmr = CONTAINING_RECORD(TimersDueListHead.Flink, TIMER, ptmrDueList);
+  Wake = pTmr->tmDue + pTmr->cmsTolerance;
+
+  for (pLE = pTmr->ptmrDueList.Flink; pLE != &TimersDueListHead; pLE = pLE->Flink)
+  {
+     pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrDueList);
+     if ((LONG)(pTmr->tmDue - Wake) >= 0)
+        break;
+
+     if ((LONG)(pTmr->tmDue + pTmr->cmsTolerance - Wake) < 0)
+        Wake = pTmr->tmDue + pTmr->cmsTolerance;
+  }
+
+  if (!Force && MasterTimerArmed && (LONG)(Wake - TimeWake) >= 0)
+     return;
+
+  Delay = (LONG)(Wake - Time);
+  if (Delay < 1)
+     Delay = 1;
+
+  ASSERT(MasterTimer != NULL);
+  DueTime.QuadPart = (LONGLONG)Delay * -10000;
+  KeSetTimer(MasterTimer, DueTime, NULL);
+
+  TimeWake = Wake;
+  MasterTimerArmed = TRUE;
+}
+
 static
 BOOL
 FASTCALL
@@ -74,6 +170,7 @@ RemoveTimer(PTIMER pTmr)
   {
      /* Set the flag, it will be removed when ready */
      RemoveEntryList(&pTmr->ptmrList);
+     RemoveEntryList(&pTmr->ptmrDueList);
      if ((pTmr->pWnd == NULL) && (!(pTmr->flags & TMRF_SYSTEM))) // System timers are reusable.
      {
         UINT_PTR IDEvent;
@@ -174,16 +271,16 @@ ValidateTimerCallback(PTHREADINFO pti,
 }
 
 UINT_PTR FASTCALL
-IntSetTimer( PWND Window,
-                  UINT_PTR IDEvent,
-                  UINT Elapse,
-                  TIMERPROC TimerFunc,
-                  INT Type)
+IntSetCoalescableTimer( PWND Window,
+                        UINT_PTR IDEvent,
+                        UINT Elapse,
+                        TIMERPROC TimerFunc,
+                        INT Type,
+                        ULONG ToleranceDelay)
 {
   PTIMER pTmr;
   UINT Ret = IDEvent;
-  LARGE_INTEGER DueTime;
-  DueTime.QuadPart = (LONGLONG)(-97656); // 1024hz .9765625 ms set to 10.0 ms
+  ULONG Time;
 
 #if 0
   /* Windows NT/2k/XP behaviour */
@@ -208,6 +305,16 @@ IntSetTimer( PWND Window,
      Elapse = USER_TIMER_MINIMUM; // 1024hz .9765625 ms, set to 10.0 ms (+/-)1 ms
   }
 
+  if (ToleranceDelay == TIMERV_DEFAULT_COALESCING)
+     ToleranceDelay = TIMER_DEFAULT_TOLERANCE;
+  else if (ToleranceDelay == TIMERV_NO_COALESCING)
+     ToleranceDelay = 0;
+
+  /* Never wait past the next period, that also keeps the wakeup time
+   * within reach of the message time comparisons */
+  ToleranceDelay = min(ToleranceDelay, Elapse);
+  ToleranceDelay = min(ToleranceDelay, (ULONG)(MAXLONG - Elapse));
+
   /* Passing an IDEvent of 0 and the SetTimer returns 1.
      It will create the timer with an ID of 0 */
   if ((Window) && (IDEvent == 0))
@@ -236,10 +343,16 @@ IntSetTimer( PWND Window,
       IntUnlockWindowlessTimerBitmap();
   }
 
+  TimerEnterExclusive();
+
   if (!pTmr)
   {
      pTmr = CreateTimer();
-     if (!pTmr) return 0;
+     if (!pTmr)
+     {
+        TimerLeave();
+        return 0;
+     }
 
      if (Window && (Type & TMRF_TIFROMWND))
         pTmr->pti = Window->head.pti->pEThread->Tcb.Win32Thread;
@@ -252,26 +365,43 @@ IntSetTimer( PWND Window,
      }
 
      pTmr->pWnd    = Window;
-     pTmr->cmsCountdown = Elapse;
      pTmr->cmsRate = Elapse;
      pTmr->pfn     = TimerFunc;
      pTmr->nID     = IDEvent;
-     pTmr->flags   = Type|TMRF_INIT;
+     pTmr->flags   = Type;
   }
   else
   {
-     pTmr->cmsCountdown = Elapse;
      pTmr->cmsRate = Elapse;
+     RemoveDueTimer(pTmr);
   }
 
-  ASSERT(MasterTimer != NULL);
-  // Start the timer thread!
-  if (TimersListHead.Flink == TimersListHead.Blink) // There is only one timer
-     KeSetTimer(MasterTimer, DueTime, NULL);
+  Time = GetTimerTime();
+  pTmr->tmDue = Time + Elapse;
+  pTmr->cmsTolerance = ToleranceDelay;
+
+  /* Fired one-shot timers stay off until they are killed */
+  if (!(pTmr->flags & TMRF_WAITING))
+  {
+     InsertDueTimer(pTmr);
+     ArmMasterTimer(Time, FALSE);
+  }
+
+  TimerLeave();
 
   return Ret;
 }
 
+UINT_PTR FASTCALL
+IntSetTimer( PWND Window,
+             UINT_PTR IDEvent,
+             UINT Elapse,
+             TIMERPROC TimerFunc,
+             INT Type)
+{
+  return IntSetCoalescableTimer(Window, IDEvent, Elapse, TimerFunc, Type, TIMERV_DEFAULT_COALESCING);
+}
+
 //
 // Process win32k system timers.
 //
@@ -444,75 +574,63 @@ VOID
 FASTCALL
 ProcessTimers(VOID)
 {
-  LARGE_INTEGER TickCount, DueTime;
-  LONG Time;
-  PLIST_ENTRY pLE;
+  ULONG Time;
   PTIMER pTmr;
   LONG TimerCount = 0;
 
   TimerEnterExclusive();
-  pLE = TimersListHead.Flink;
-  KeQueryTickCount(&TickCount);
-  Time = MsqCalculateMessageTime(&TickCount);
-
-  DueTime.QuadPart = (LONGLONG)(-97656); // 1024hz .9765625 ms set to 10.0 ms
+  Time = GetTimerTime();
+  MasterTimerArmed = FALSE;
 
-  while(pLE != &TimersListHead)
+  /* Only the expired timers are looked at */
+  while (!IsListEmpty(&TimersDueListHead))
   {
-    pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrList);
+    pTmr = CONTAINING_RECORD(TimersDueListHead.Flink, TIMER, ptmrDueList);
+    if ((LONG)(pTmr->tmDue - Time) > 0)
+       break;
+
     TimerCount++;
-    if (pTmr->flags & TMRF_WAITING)
-    {
-       pLE = pTmr->ptmrList.Flink;
-       pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrList);
-       continue;
-    }
+    RemoveDueTimer(pTmr);
 
-    if (pTmr->flags & TMRF_INIT)
+    ASSERT(pTmr->pti);
+    if ((!(pTmr->flags & TMRF_READY)) && (!(pTmr->pti->TIF_flags & TIF_INCLEANUP)))
     {
-       pTmr->flags &= ~TMRF_INIT; // Skip this run.
-    }
-    else
-    {
-       if (pTmr->cmsCountdown < 0)
+       if (pTmr->flags & TMRF_ONESHOT)
+          pTmr->flags |= TMRF_WAITING;
+
+       /* Queue the next expiry first, the timer proc may kill the timer */
+       if (!(pTmr->flags & TMRF_WAITING))
        {
-          ASSERT(pTmr->pti);
-          if ((!(pTmr->flags & TMRF_READY)) && (!(pTmr->pti->TIF_flags & TIF_INCLEANUP)))
-          {
-             if (pTmr->flags & TMRF_ONESHOT)
-                pTmr->flags |= TMRF_WAITING;
+          pTmr->tmDue = Time + pTmr->cmsRate;
+          InsertDueTimer(pTmr);
+       }
 
-             if (pTmr->flags & TMRF_RIT)
-             {
-                // Hard coded call here, inside raw input thread.
-                pTmr->pfn(NULL, WM_SYSTIMER, pTmr->nID, (LPARAM)pTmr);
-             }
-             else
-             {
-                pTmr->flags |= TMRF_READY; // Set timer ready to be ran.
-                // Set thread message queue for this timer.
-                if (pTmr->pti)
-                {  // Wakeup thread
-                   pTmr->pti->cTimersReady++;
-                   ASSERT(pTmr->pti->pEventQueueServer != NULL);
-                   MsqWakeQueue(pTmr->pti, QS_TIMER, TRUE);
-                }
-             }
-          }
-          pTmr->cmsCountdown = pTmr->cmsRate;
+       if (pTmr->flags & TMRF_RIT)
+       {
+          // Hard coded call here, inside raw input thread.
+          pTmr->pfn(NULL, WM_SYSTIMER, pTmr->nID, (LPARAM)pTmr);
        }
        else
-          pTmr->cmsCountdown -= Time - TimeLast;
+       {
+          pTmr->flags |= TMRF_READY; // Set timer ready to be ran.
+          // Set thread message queue for this timer.
+          if (pTmr->pti)
+          {  // Wakeup thread
+             pTmr->pti->cTimersReady++;
+             ASSERT(pTmr->pti->pEventQueueServer != NULL);
+             MsqWakeQueue(pTmr->pti, QS_TIMER, TRUE);
+          }
+       }
+    }
+    else
+    {
+       pTmr->tmDue = Time + pTmr->cmsRate;
+       InsertDueTimer(pTmr);
     }
-
-    pLE = pLE->Flink;
   }
 
-  // Restart the timer thread!
-  ASSERT(MasterTimer != NULL);
-  KeSetTimer(MasterTimer, DueTime, NULL);
-
-  TimeLast = Time;
+  // Restart the timer thread for the next timer!
+  ArmMasterTimer(Time, TRUE);
 
   TimerLeave();
   TRACE("TimerCount = %d\n", TimerCount);
@@ -620,6 +738,7 @@ InitTimerImpl(VOID)
 
    ExInitializeResourceLite(&TimerLock);
    InitializeListHead(&TimersListHead);
+   InitializeListHead(&TimersDueListHead);
 
    return STATUS_SUCCESS;
 }
@@ -651,6 +770,42 @@ CLEANUP:
 }
 
 
+UINT_PTR
+APIENTRY
+NtUserSetCoalescableTimer
+(
+   HWND hWnd,
+   UINT_PTR nIDEvent,
+   UINT uElapse,
+   TIMERPROC lpTimerFunc,
+   ULONG uToleranceDelay
+)
+{
+   PWND Window = NULL;
+   DECLARE_RETURN(UINT_PTR);
+
+   TRACE("Enter NtUserSetCoalescableTimer\n");
+
+   if (uToleranceDelay > TIMERV_COALESCING_MAX &&
+       uToleranceDelay != TIMERV_NO_COALESCING)
+   {
+      EngSetLastError(ERROR_INVALID_PARAMETER);
+      RETURN(0);
+   }
+
+   UserEnterExclusive();
+   if (hWnd) Window = UserGetWindowObject(hWnd);
+   UserLeave();
+
+   RETURN(IntSetCoalescableTimer(Window, nIDEvent, uElapse, lpTimerFunc, TMRF_TIFROMWND, uToleranceDelay));
+
+CLEANUP:
+   TRACE("Leave NtUserSetCoalescableTimer, ret=%u\n", _ret_);
+
+   END_CLEANUP;
+}
+
+
 BOOL
 APIENTRY
 NtUserKillTimer
@@ -150,5 +150,6 @@ BOOL UserPaintCaption(PWND pWnd, INT Flags);
 
 BOOL FASTCALL SetLayeredStatus(PWND pWnd, BYTE set);
 BOOL FASTCALL GetLayeredStatus(PWND pWnd);
+VOID FASTCALL IntDestroyLayeredProp(PWND pWnd);
 
 /* EOF */
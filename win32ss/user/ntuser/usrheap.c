@@ -334,4 +334,261 @@ MapGlobalUserHeap(IN  PEPROCESS Process,
     return STATUS_SUCCESS;
 }
 
+/*
+ * Desktop heap blocks of up to 512 bytes, which is most windows, menus,
+ * properties and strings, come from slabs: pages of the heap cut into
+ * blocks of a single size class. Creating and destroying many objects
+ * then reuses the same blocks instead of leaving holes of every size in
+ * the heap. Every block starts with a DESKTOP_HEAP_BLOCK telling where it
+ * came from and how large it is, larger blocks come from the heap itself.
+ */
+#define DESKTOP_HEAP_SLAB_SIZE 0x1000
+
+typedef struct _DESKTOP_HEAP_SLAB
+{
+    LIST_ENTRY ListEntry;
+    PVOID FreeList;
+    ULONG iClass;
+    ULONG cFree;
+    ULONG cBlocks;
+} DESKTOP_HEAP_SLAB, *PDESKTOP_HEAP_SLAB;
+
+typedef struct _DESKTOP_HEAP_BLOCK
+{
+    PDESKTOP_HEAP_SLAB Slab; /* NULL if allocated from the heap */
+    SIZE_T cbSize;
+} DESKTOP_HEAP_BLOCK, *PDESKTOP_HEAP_BLOCK;
+
+C_ASSERT(sizeof(DESKTOP_HEAP_BLOCK) % MEMORY_ALLOCATION_ALIGNMENT == 0);
+
+#define DESKTOP_HEAP_SLAB_HEADER \
+    ALIGN_UP_BY(sizeof(DESKTOP_HEAP_SLAB), MEMORY_ALLOCATION_ALIGNMENT)
+
+/* Multiples of MEMORY_ALLOCATION_ALIGNMENT */
+static const ULONG DesktopHeapClassSize[DESKTOP_HEAP_SIZE_CLASSES] =
+{
+    32, 64, 96, 128, 192, 256, 384, 512
+};
+
+VOID
+DesktopHeapInitialize(IN PDESKTOP Desktop,
+                      IN SIZE_T HeapSize)
+{
+    ULONG i;
+
+    for (i = 0; i < DESKTOP_HEAP_SIZE_CLASSES; i++)
+    {
+        InitializeListHead(&Desktop->HeapClasses[i].SlabListHead);
+        Desktop->HeapClasses[i].cEmptySlabs = 0;
+        Desktop->HeapStats.acbClassSize[i] = DesktopHeapClassSize[i];
+    }
+
+    Desktop->HeapStats.cbHeapSize = HeapSize;
+}
+
+static ULONG
+DesktopHeapGetClass(IN SIZE_T Bytes)
+{
+    ULONG i;
+
+    for (i = 0; i < DESKTOP_HEAP_SIZE_CLASSES; i++)
+    {
+        if (Bytes <= DesktopHeapClassSize[i])
+            break;
+    }
+
+    return i;
+}
+
+static PDESKTOP_HEAP_SLAB
+DesktopHeapAllocSlab(IN PDESKTOP Desktop,
+                     IN ULONG iClass)
+{
+    PDESKTOP_HEAP_SLAB Slab;
+    PDESKTOP_HEAP_BLOCK Block;
+    SIZE_T Stride;
+    ULONG i;
+
+    Slab = RtlAllocateHeap(Desktop->pheapDesktop,
+                           HEAP_NO_SERIALIZE,
+                           DESKTOP_HEAP_SLAB_SIZE);
+    if (Slab == NULL)
+        return NULL;
+
+    Stride = sizeof(DESKTOP_HEAP_BLOCK) + DesktopHeapClassSize[iClass];
+
+    Slab->iClass = iClass;
+    Slab->cBlocks = (ULONG)((DESKTOP_HEAP_SLAB_SIZE - DESKTOP_HEAP_SLAB_HEADER) / Stride);
+    Slab->cFree = Slab->cBlocks;
+    Slab->FreeList = NULL;
+
+    /* Chain the blocks so that the first one is handed out first. The link
+     * of a free block is stored where its data goes */
+    for (i = Slab->cBlocks; i-- > 0;)
+    {
+        Block = (PDESKTOP_HEAP_BLOCK)((ULONG_PTR)Slab + DESKTOP_HEAP_SLAB_HEADER + i * Stride);
+        Block->Slab = Slab;
+        *(PVOID*)(Block + 1) = Slab->FreeList;
+        Slab->FreeList = Block;
+    }
+
+    InsertHeadList(&Desktop->HeapClasses[iClass].SlabListHead, &Slab->ListEntry);
+    Desktop->HeapClasses[iClass].cEmptySlabs++;
+    Desktop->HeapStats.cbSlabs += DESKTOP_HEAP_SLAB_SIZE;
+
+    return Slab;
+}
+
+PVOID
+DesktopHeapAlloc(IN PDESKTOP Desktop,
+                 IN SIZE_T Bytes)
+{
+    PDESKTOP_HEAP_CLASS Class = NULL;
+    PDESKTOP_HEAP_SLAB Slab = NULL;
+    PDESKTOP_HEAP_BLOCK Block;
+    PDESKTOP_HEAP_STATS Stats = &Desktop->HeapStats;
+    ULONG iClass;
+
+    iClass = DesktopHeapGetClass(Bytes);
+    if (iClass < DESKTOP_HEAP_SIZE_CLASSES)
+    {
+        Class = &Desktop->HeapClasses[iClass];
+
+        if (!IsListEmpty(&Class->SlabListHead))
+            Slab = CONTAINING_RECORD(Class->SlabListHead.Flink, DESKTOP_HEAP_SLAB, ListEntry);
+        else
+            Slab = DesktopHeapAllocSlab(Desktop, iClass);
+    }
+
+    if (Slab != NULL)
+    {
+        if (Slab->cFree == Slab->cBlocks)
+            Class->cEmptySlabs--;
+
+        Block = Slab->FreeList;
+        Slab->FreeList = *(PVOID*)(Block + 1);
+
+        /* Full slabs are only found again through their blocks */
+        if (--Slab->cFree == 0)
+            RemoveEntryList(&Slab->ListEntry);
+
+        Stats->acClassBlocks[iClass]++;
+    }
+    else
+    {
+        /* Large block, or no room left for another slab */
+        if (Bytes > MAXULONG_PTR - sizeof(DESKTOP_HEAP_BLOCK))
+            Block = NULL;
+        else
+            Block = RtlAllocateHeap(Desktop->pheapDesktop,
+                                    HEAP_NO_SERIALIZE,
+                                    sizeof(DESKTOP_HEAP_BLOCK) + Bytes);
+        if (Block == NULL)
+        {
+            Stats->cFailures++;
+            return NULL;
+        }
+
+        Block->Slab = NULL;
+    }
+
+    Block->cbSize = Bytes;
+
+    Stats->cAllocations++;
+    Stats->cbInUse += Bytes;
+    if (Stats->cbInUse > Stats->cbPeakInUse)
+        Stats->cbPeakInUse = Stats->cbInUse;
+
+    return Block + 1;
+}
+
+BOOL
+DesktopHeapFree(IN PDESKTOP Desktop,
+                IN PVOID lpMem)
+{
+    PDESKTOP_HEAP_CLASS Class;
+    PDESKTOP_HEAP_SLAB Slab;
+    PDESKTOP_HEAP_BLOCK Block;
+
+    if (lpMem == NULL)
+        return TRUE;
+
+    Block = (PDESKTOP_HEAP_BLOCK)lpMem - 1;
+
+    Desktop->HeapStats.cAllocations--;
+    Desktop->HeapStats.cbInUse -= Block->cbSize;
+
+    Slab = Block->Slab;
+    if (Slab == NULL)
+    {
+        return RtlFreeHeap(Desktop->pheapDesktop,
+                           HEAP_NO_SERIALIZE,
+                           Block);
+    }
+
+    Class = &Desktop->HeapClasses[Slab->iClass];
+    Desktop->HeapStats.acClassBlocks[Slab->iClass]--;
+
+    *(PVOID*)lpMem = Slab->FreeList;
+    Slab->FreeList = Block;
+
+    if (Slab->cFree++ == 0)
+        InsertHeadList(&Class->SlabListHead, &Slab->ListEntry);
+
+    if (Slab->cFree == Slab->cBlocks)
+    {
+        /* Keep one empty slab per class, so that a block allocated and
+         * freed over and over doesn't cost a slab every time */
+        if (Class->cEmptySlabs != 0)
+        {
+            RemoveEntryList(&Slab->ListEntry);
+            Desktop->HeapStats.cbSlabs -= DESKTOP_HEAP_SLAB_SIZE;
+            return RtlFreeHeap(Desktop->pheapDesktop,
+                               HEAP_NO_SERIALIZE,
+                               Slab);
+        }
+
+        Class->cEmptySlabs++;
+    }
+
+    return TRUE;
+}
+
+PVOID
+DesktopHeapReAlloc(IN PDESKTOP Desktop,
+                   IN PVOID lpMem,
+                   IN SIZE_T Bytes)
+{
+    PDESKTOP_HEAP_BLOCK Block = (PDESKTOP_HEAP_BLOCK)lpMem - 1;
+    SIZE_T PrevSize = Block->cbSize;
+    PVOID pNew;
+
+    if (PrevSize == Bytes)
+        return lpMem;
+
+    /* Stay in the block if it's still the right size class */
+    if (Block->Slab != NULL &&
+        DesktopHeapGetClass(Bytes) == Block->Slab->iClass)
+    {
+        Desktop->HeapStats.cbInUse += Bytes - PrevSize;
+        if (Desktop->HeapStats.cbInUse > Desktop->HeapStats.cbPeakInUse)
+            Desktop->HeapStats.cbPeakInUse = Desktop->HeapStats.cbInUse;
+        Block->cbSize = Bytes;
+        return lpMem;
+    }
+
+    pNew = DesktopHeapAlloc(Desktop, Bytes);
+    if (pNew != NULL)
+    {
+        if (PrevSize < Bytes)
+            Bytes = PrevSize;
+
+        RtlCopyMemory(pNew, lpMem, Bytes);
+
+        DesktopHeapFree(Desktop, lpMem);
+    }
+
+    return pNew;
+}
+
 /* EOF */
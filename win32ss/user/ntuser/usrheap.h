@@ -13,6 +13,13 @@ typedef struct _W32HEAP_USER_MAPPING
 } W32HEAP_USER_MAPPING, *PW32HEAP_USER_MAPPING;
 */
 
+/* Size class of the desktop heap, see usrheap.c */
+typedef struct _DESKTOP_HEAP_CLASS
+{
+    LIST_ENTRY SlabListHead; /* Slabs with free blocks */
+    ULONG cEmptySlabs;
+} DESKTOP_HEAP_CLASS, *PDESKTOP_HEAP_CLASS;
+
 /* User heap */
 extern HANDLE GlobalUserHeap;
 extern PVOID GlobalUserHeapSection;
@@ -9,6 +9,25 @@
 #include <win32k.h>
 DBG_DEFAULT_CHANNEL(UserWinpos);
 
+/*
+ * The visible regions computed last are kept for as long as gulVisRgnTime
+ * doesn't change, so windows repainting or getting DCs while nothing moves
+ * don't go through all their siblings and ancestors again.
+ */
+#define VIS_CACHE_SIZE 16
+
+typedef struct _VIS_CACHE_ENTRY
+{
+    PWND Wnd;
+    ULONG ulTime;
+    ULONG Flags;
+    PREGION Rgn; /* NULL if the window isn't visible */
+} VIS_CACHE_ENTRY, *PVIS_CACHE_ENTRY;
+
+ULONG gulVisRgnTime = 1;
+static VIS_CACHE_ENTRY VisCache[VIS_CACHE_SIZE];
+static ULONG VisCacheNext;
+
 PREGION FASTCALL
 VIS_ComputeVisibleRegion(
    PWND Wnd,
@@ -141,6 +160,86 @@ VIS_ComputeVisibleRegion(
    return VisRgn;
 }
 
+static PREGION
+VIS_CopyRegion(PREGION Rgn)
+{
+   PREGION Copy;
+
+   Copy = IntSysCreateRectpRgn(0, 0, 0, 0);
+   if (Copy)
+      IntGdiCombineRgn(Copy, Rgn, NULL, RGN_COPY);
+
+   return Copy;
+}
+
+/*
+ * Same as VIS_ComputeVisibleRegion, but reuses the region computed for
+ * the same window and flags if no window changed in between.
+ */
+PREGION FASTCALL
+VIS_GetVisibleRegion(
+   PWND Wnd,
+   BOOLEAN ClientArea,
+   BOOLEAN ClipChildren,
+   BOOLEAN ClipSiblings)
+{
+   PVIS_CACHE_ENTRY Entry = NULL;
+   PREGION VisRgn;
+   ULONG Flags, i;
+
+   if (!Wnd || !(Wnd->style & WS_VISIBLE))
+   {
+      return NULL;
+   }
+
+   Flags = (ClientArea ? 1 : 0) | (ClipChildren ? 2 : 0) | (ClipSiblings ? 4 : 0);
+
+   for (i = 0; i < VIS_CACHE_SIZE; i++)
+   {
+      if (VisCache[i].ulTime != gulVisRgnTime)
+      {
+         /* Stale, reuse it first */
+         Entry = &VisCache[i];
+         continue;
+      }
+
+      if (VisCache[i].Wnd == Wnd && VisCache[i].Flags == Flags)
+      {
+         return VisCache[i].Rgn ? VIS_CopyRegion(VisCache[i].Rgn) : NULL;
+      }
+   }
+
+   VisRgn = VIS_ComputeVisibleRegion(Wnd, ClientArea, ClipChildren, ClipSiblings);
+
+   if (!Entry)
+   {
+      Entry = &VisCache[VisCacheNext];
+      VisCacheNext = (VisCacheNext + 1) % VIS_CACHE_SIZE;
+   }
+
+   if (Entry->Rgn)
+   {
+      REGION_Delete(Entry->Rgn);
+      Entry->Rgn = NULL;
+   }
+
+   if (VisRgn)
+   {
+      Entry->Rgn = VIS_CopyRegion(VisRgn);
+      if (!Entry->Rgn)
+      {
+         Entry->ulTime = 0;
+         return VisRgn;
+      }
+   }
+
+   Entry->Wnd = Wnd;
+   Entry->Flags = Flags;
+   Entry->ulTime = gulVisRgnTime;
+
+   return VisRgn;
+}
+
 VOID FASTCALL
 co_VIS_WindowLayoutChanged(
    PWND Wnd,
@@ -9,7 +9,19 @@
 
 #pragma once
 
+extern ULONG gulVisRgnTime;
+
 PREGION FASTCALL VIS_ComputeVisibleRegion(PWND Window, BOOLEAN ClientArea, BOOLEAN ClipChildren, BOOLEAN ClipSiblings);
+PREGION FASTCALL VIS_GetVisibleRegion(PWND Window, BOOLEAN ClientArea, BOOLEAN ClipChildren, BOOLEAN ClipSiblings);
 VOID FASTCALL co_VIS_WindowLayoutChanged(PWND Window, PREGION UncoveredRgn);
 
+/* Must be called whenever a window is linked, moved, sized or gets a new
+ * style or window region, since that may change any visible region */
+FORCEINLINE
+VOID
+VIS_InvalidateCache(VOID)
+{
+    gulVisRgnTime++;
+}
+
 /* EOF */
@@ -61,6 +61,9 @@ typedef struct _TL
     PVOID pfnFree;
 } TL, *PTL;
 
+/* Number of free GDI handle entries a thread keeps for its next objects */
+#define W32THREAD_GDI_FREE_ENTRIES 16
+
 typedef struct _W32THREAD
 {
     PETHREAD pEThread;
@@ -73,6 +76,10 @@ typedef struct _W32THREAD
     DWORD dwEngAcquireCount;
     PVOID pSemTable;
     PVOID pUMPDObj;
+    PVOID pRgnScratch;
+    ULONG cjRgnScratch;
+    ULONG cGdiFreeEntries;
+    ULONG aulGdiFreeEntries[W32THREAD_GDI_FREE_ENTRIES];
 } W32THREAD, *PW32THREAD;
 
 #ifdef __cplusplus
@@ -146,6 +153,10 @@ typedef struct _THREADINFO
     // Accounting of queue bit sets, the rest are flags. QS_TIMER QS_PAINT counts are handled in thread information.
     DWORD nCntsQBits[QSIDCOUNTS]; // QS_KEY QS_MOUSEMOVE QS_MOUSEBUTTON QS_POSTMESSAGE QS_SENDMESSAGE QS_HOTKEY
 
+    /* Posted messages retrieved by the thread, reused for the next ones posted to it */
+    SINGLE_LIST_ENTRY FreeMessagesList;
+    UINT cFreeMessages;
+
     LIST_ENTRY WindowListHead;
     LIST_ENTRY W32CallbackListHead;
     SINGLE_LIST_ENTRY  ReferencesList;
@@ -249,6 +260,7 @@ typedef struct _PROCESSINFO
     struct _DESKTOP* rpdeskStartup;
     struct _CLS *pclsPrivateList;
     struct _CLS *pclsPublicList;
+    struct _CLASS_HASH *pClassHash;
     PPROCESSINFO ppiNext;
     INT cThreads;
     HDESK hdeskStartup;
@@ -71,7 +71,7 @@ PREGION FASTCALL
 DceGetVisRgn(PWND Window, ULONG Flags, HWND hWndChild, ULONG CFlags)
 {
     PREGION Rgn;
-    Rgn = VIS_ComputeVisibleRegion( Window,
+    Rgn = VIS_GetVisibleRegion( Window,
                                     0 == (Flags & DCX_WINDOW),
                                     0 != (Flags & DCX_CLIPCHILDREN),
                                     0 != (Flags & DCX_CLIPSIBLINGS));
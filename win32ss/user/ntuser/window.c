@@ -128,6 +128,7 @@ IntSetStyle( PWND pwnd, ULONG set_bits, ULONG clear_bits )
     styleNew = (pwnd->style | set_bits) & ~clear_bits;
     if (styleNew == styleOld) return styleNew;
     pwnd->style = styleNew;
+    VIS_InvalidateCache();
     if ((styleOld ^ styleNew) & WS_VISIBLE) // State Change.
     {
        if (styleOld & WS_VISIBLE) pwnd->head.pti->cVisWindows--;
@@ -524,6 +525,7 @@ LRESULT co_UserFreeWindow(PWND Window,
    Window->state2 |= WNDS2_INDESTROY;
    Window->style &= ~WS_VISIBLE;
    Window->head.pti->cVisWindows--;
+   VIS_InvalidateCache();
 
 
    /* remove the window already at this point from the thread window list so we
@@ -646,6 +648,8 @@ LRESULT co_UserFreeWindow(PWND Window,
 
    IntUnlinkWindow(Window);
 
+   IntDestroyLayeredProp(Window);
+
    if (Window->PropListItems)
    {
       UserRemoveWindowProps(Window);
@@ -676,6 +680,7 @@ LRESULT co_UserFreeWindow(PWND Window,
       IntGdiSetRegionOwner(Window->hrgnClip, GDI_OBJ_HMGR_POWNED);
       GreDeleteObject(Window->hrgnClip);
       Window->hrgnClip = NULL;
+      VIS_InvalidateCache();
    }
    Window->head.pti->cWindows--;
 
@@ -864,6 +869,9 @@ IntLinkWindow(
    PWND WndInsertAfter /* set to NULL if top sibling */
 )
 {
+  IntInvalidateHitIndex(Wnd);
+  VIS_InvalidateCache();
+
   if ((Wnd->spwndPrev = WndInsertAfter))
    {
       /* link after WndInsertAfter */
@@ -1144,6 +1152,7 @@ co_IntSetParent(PWND Wnd, PWND WndNewParent)
        !(Wnd->style & WS_CLIPSIBLINGS) )
    {
       Wnd->style |= WS_CLIPSIBLINGS;
+      VIS_InvalidateCache();
       DceResetActiveDCEs(Wnd);
    }
 
@@ -1251,6 +1260,9 @@ co_UserSetParent(HWND hWndChild, HWND hWndNewParent)
 VOID FASTCALL
 IntUnlinkWindow(PWND Wnd)
 {
+   IntInvalidateHitIndex(Wnd);
+   VIS_InvalidateCache();
+
    if (Wnd->spwndNext)
        Wnd->spwndNext->spwndPrev = Wnd->spwndPrev;
 
@@ -2190,7 +2202,10 @@ co_UserCreateWindowEx(CREATESTRUCTW* Cs,
    if (!(Window->state2 & WNDS2_WIN31COMPAT))
    {
       if (Class->style & CS_PARENTDC && !(ParentWindow->style & WS_CLIPCHILDREN))
+      {
          Window->style &= ~(WS_CLIPSIBLINGS | WS_CLIPCHILDREN);
+         VIS_InvalidateCache();
+      }
    }
 
    if ((Window->style & (WS_CHILD | WS_POPUP)) == WS_CHILD)
@@ -2226,6 +2241,8 @@ co_UserCreateWindowEx(CREATESTRUCTW* Cs,
 
    RECTL_vOffsetRect(&Window->rcWindow, MaxPos.x - Window->rcWindow.left,
                                      MaxPos.y - Window->rcWindow.top);
+   IntInvalidateHitIndex(Window);
+   VIS_InvalidateCache();
    }
 
    /* Send the WM_CREATE message. */
@@ -3655,6 +3672,7 @@ co_IntSetWindowLongPtr(HWND hWnd, DWORD Index, LONG_PTR NewValue, BOOL Ansi, ULO
             }
 
             Window->ExStyle = (DWORD)Style.styleNew;
+            VIS_InvalidateCache();
 
             co_IntSendMessage(hWnd, WM_STYLECHANGED, GWL_EXSTYLE, (LPARAM) &Style);
             break;
@@ -3708,6 +3726,7 @@ co_IntSetWindowLongPtr(HWND hWnd, DWORD Index, LONG_PTR NewValue, BOOL Ansi, ULO
                DceResetActiveDCEs( Window );
             }
             Window->style = (DWORD)Style.styleNew;
+            VIS_InvalidateCache();
 
             if (!bAlter)
                 co_IntSendMessage(hWnd, WM_STYLECHANGED, GWL_STYLE, (LPARAM) &Style);
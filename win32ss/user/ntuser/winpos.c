@@ -259,6 +259,8 @@ PWND FASTCALL IntGetLastTopMostWindow(VOID)
 VOID
 SelectWindowRgn(PWND Window, HRGN hRgnClip)
 {
+    VIS_InvalidateCache();
+
     if (Window->hrgnClip)
     {
         /* Delete no longer needed region handle */
@@ -1495,6 +1497,8 @@ WinPosInternalMoveWindow(PWND Window, INT MoveX, INT MoveY)
    Window->rcWindow.right += MoveX;
    Window->rcWindow.top += MoveY;
    Window->rcWindow.bottom += MoveY;
+   IntInvalidateHitIndex(Window);
+   VIS_InvalidateCache();
 
    Window->rcClient.left += MoveX;
    Window->rcClient.right += MoveX;
@@ -1817,6 +1821,8 @@ co_WinPosSetWindowPos(
    }
 
    Window->rcWindow = NewWindowRect;
+   IntInvalidateHitIndex(Window);
+   VIS_InvalidateCache();
    Window->rcClient = NewClientRect;
 
    /* erase parent when hiding or resizing child */
@@ -1832,6 +1838,7 @@ co_WinPosSetWindowPos(
          co_IntShellHookNotify(HSHELL_WINDOWDESTROYED, (WPARAM)Window->head.h, 0);
 
       Window->style &= ~WS_VISIBLE; //IntSetStyle( Window, 0, WS_VISIBLE );
+      VIS_InvalidateCache();
       Window->head.pti->cVisWindows--;
       IntNotifyWinEvent(EVENT_OBJECT_HIDE, Window, OBJID_WINDOW, CHILDID_SELF, WEF_SETBYWNDPTI);
    }
@@ -1844,6 +1851,7 @@ co_WinPosSetWindowPos(
          co_IntShellHookNotify(HSHELL_WINDOWCREATED, (WPARAM)Window->head.h, 0);
 
       Window->style |= WS_VISIBLE; //IntSetStyle( Window, WS_VISIBLE, 0 );
+      VIS_InvalidateCache();
       Window->head.pti->cVisWindows++;
       IntNotifyWinEvent(EVENT_OBJECT_SHOW, Window, OBJID_WINDOW, CHILDID_SELF, WEF_SETBYWNDPTI);
    }
@@ -2650,6 +2658,195 @@ co_WinPosShowWindow(PWND Wnd, INT Cmd)
    return WasVisible;
 }
 
+/*
+ * The top level windows of a desktop are sorted into a grid of cells laid
+ * over the desktop window. Each cell lists, in z-order, the windows whose
+ * rectangle overlaps it, so hit testing only looks at the windows of the
+ * cell under the point. The index is dropped whenever a top level window
+ * is moved, sized, linked or unlinked and built again on the next lookup.
+ * Visibility and styles aren't indexed, the callers still check them.
+ */
+#define HIT_INDEX_GRID 16
+#define HIT_INDEX_CELLS (HIT_INDEX_GRID * HIT_INDEX_GRID)
+
+typedef struct _WND_HIT_INDEX
+{
+    RECTL rcDesktop;
+    LONG cxCell;
+    LONG cyCell;
+    /* Cell i lists apwnd[aiFirst[i]] up to apwnd[aiFirst[i + 1]] */
+    ULONG aiFirst[HIT_INDEX_CELLS + 1];
+    PWND apwnd[ANYSIZE_ARRAY];
+} WND_HIT_INDEX, *PWND_HIT_INDEX;
+
+VOID FASTCALL
+IntFreeHitIndex(PDESKTOP pdesk)
+{
+    if (pdesk->pHitIndex)
+    {
+        ExFreePoolWithTag(pdesk->pHitIndex, USERTAG_WINDOWLIST);
+        pdesk->pHitIndex = NULL;
+    }
+}
+
+VOID FASTCALL
+IntInvalidateHitIndex(PWND Wnd)
+{
+    PWND pwndParent = Wnd->spwndParent;
+
+    if (pwndParent && pwndParent->fnid == FNID_DESKTOP && pwndParent->head.rpdesk)
+        IntFreeHitIndex(pwndParent->head.rpdesk);
+}
+
+static BOOL
+IntHitIndexCells(PRECTL prcDesktop, LONG cxCell, LONG cyCell, PRECTL prc, PRECTL prcCells)
+{
+    RECTL rc;
+
+    if (!RECTL_bIntersectRect(&rc, prc, prcDesktop))
+        return FALSE;
+
+    prcCells->left = min((rc.left - prcDesktop->left) / cxCell, HIT_INDEX_GRID - 1);
+    prcCells->right = min((rc.right - 1 - prcDesktop->left) / cxCell, HIT_INDEX_GRID - 1);
+    prcCells->top = min((rc.top - prcDesktop->top) / cyCell, HIT_INDEX_GRID - 1);
+    prcCells->bottom = min((rc.bottom - 1 - prcDesktop->top) / cyCell, HIT_INDEX_GRID - 1);
+    return TRUE;
+}
+
+static PWND_HIT_INDEX
+IntBuildHitIndex(PWND pwndDesktop)
+{
+    PWND_HIT_INDEX pIndex;
+    PWND pWnd, pwndLast = NULL;
+    RECTL rcDesktop = pwndDesktop->rcWindow;
+    RECTL rcCells;
+    LONG cxCell, cyCell, x, y;
+    ULONG cEntries = 0;
+
+    if (RECTL_bIsEmptyRect(&rcDesktop))
+        return NULL;
+
+    cxCell = max((rcDesktop.right - rcDesktop.left + HIT_INDEX_GRID - 1) / HIT_INDEX_GRID, 1);
+    cyCell = max((rcDesktop.bottom - rcDesktop.top + HIT_INDEX_GRID - 1) / HIT_INDEX_GRID, 1);
+
+    for (pWnd = pwndDesktop->spwndChild; pWnd; pWnd = pWnd->spwndNext)
+    {
+        if (IntHitIndexCells(&rcDesktop, cxCell, cyCell, &pWnd->rcWindow, &rcCells))
+        {
+            cEntries += (rcCells.right - rcCells.left + 1) *
+                        (rcCells.bottom - rcCells.top + 1);
+        }
+        pwndLast = pWnd;
+    }
+
+    pIndex = ExAllocatePoolWithTag(PagedPool,
+                                   FIELD_OFFSET(WND_HIT_INDEX, apwnd[cEntries]),
+                                   USERTAG_WINDOWLIST);
+    if (!pIndex)
+        return NULL;
+
+    pIndex->rcDesktop = rcDesktop;
+    pIndex->cxCell = cxCell;
+    pIndex->cyCell = cyCell;
+
+    /* Count the windows of each cell and make aiFirst point past the end of
+     * its cell, then fill the cells backwards from the bottom window so they
+     * end up in z-order with aiFirst at their start */
+    RtlZeroMemory(pIndex->aiFirst, sizeof(pIndex->aiFirst));
+    for (pWnd = pwndDesktop->spwndChild; pWnd; pWnd = pWnd->spwndNext)
+    {
+        if (!IntHitIndexCells(&rcDesktop, cxCell, cyCell, &pWnd->rcWindow, &rcCells))
+            continue;
+
+        for (y = rcCells.top; y <= rcCells.bottom; y++)
+            for (x = rcCells.left; x <= rcCells.right; x++)
+                pIndex->aiFirst[y * HIT_INDEX_GRID + x]++;
+    }
+
+    for (x = 1; x <= HIT_INDEX_CELLS; x++)
+        pIndex->aiFirst[x] += pIndex->aiFirst[x - 1];
+
+    for (pWnd = pwndLast; pWnd; pWnd = pWnd->spwndPrev)
+    {
+        if (!IntHitIndexCells(&rcDesktop, cxCell, cyCell, &pWnd->rcWindow, &rcCells))
+            continue;
+
+        for (y = rcCells.top; y <= rcCells.bottom; y++)
+            for (x = rcCells.left; x <= rcCells.right; x++)
+                pIndex->apwnd[--pIndex->aiFirst[y * HIT_INDEX_GRID + x]] = pWnd;
+    }
+
+    return pIndex;
+}
+
+/*
+ * Returns the top level windows of pwndDesktop whose rectangle may contain
+ * the point, topmost first, or NULL if the caller has to look at all of
+ * them. The array is only valid until windows are moved or relinked.
+ */
+PWND* FASTCALL
+IntHitIndexLookup(PWND pwndDesktop, LONG x, LONG y, PULONG pcWindows)
+{
+    PDESKTOP pdesk = pwndDesktop->head.rpdesk;
+    PWND_HIT_INDEX pIndex;
+    ULONG iCell;
+
+    if (!pdesk || pwndDesktop->fnid != FNID_DESKTOP)
+        return NULL;
+
+    pIndex = pdesk->pHitIndex;
+    if (pIndex && !IntEqualRect(&pIndex->rcDesktop, &pwndDesktop->rcWindow))
+    {
+        IntFreeHitIndex(pdesk);
+        pIndex = NULL;
+    }
+
+    if (!pIndex)
+    {
+        pIndex = IntBuildHitIndex(pwndDesktop);
+        if (!pIndex)
+            return NULL;
+        pdesk->pHitIndex = pIndex;
+    }
+
+    if (!RECTL_bPointInRect(&pIndex->rcDesktop, x, y))
+        return NULL;
+
+    iCell = ((y - pIndex->rcDesktop.top) / pIndex->cyCell) * HIT_INDEX_GRID +
+            (x - pIndex->rcDesktop.left) / pIndex->cxCell;
+
+    *pcWindows = pIndex->aiFirst[iCell + 1] - pIndex->aiFirst[iCell];
+    return &pIndex->apwnd[pIndex->aiFirst[iCell]];
+}
+
+/* Like IntWinListChildren, but for the desktop only lists the windows that
+ * may contain the point */
+static HWND*
+IntWinListChildrenFromPoint(PWND Window, POINT *Point)
+{
+    PWND *apwnd;
+    HWND *List;
+    ULONG cWindows, i;
+
+    apwnd = IntHitIndexLookup(Window, Point->x, Point->y, &cWindows);
+    if (!apwnd)
+        return IntWinListChildren(Window);
+
+    List = ExAllocatePoolWithTag(PagedPool, (cWindows + 1) * sizeof(HWND), USERTAG_WINDOWLIST);
+    if (!List)
+    {
+        ERR("Failed to allocate memory for children array\n");
+        EngSetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    for (i = 0; i < cWindows; i++)
+        List[i] = UserHMGetHandle(apwnd[i]);
+    List[i] = NULL;
+
+    return List;
+}
+
 static PWND
 co_WinPosSearchChildren(
    IN PWND ScopeWin,
@@ -2693,7 +2890,7 @@ co_WinPosSearchChildren(
     {
         UserReferenceObject(ScopeWin);
 
-        List = IntWinListChildren(ScopeWin);
+        List = IntWinListChildrenFromPoint(ScopeWin, Point);
         if (List)
         {
             for (phWnd = List; *phWnd; ++phWnd)
@@ -675,6 +675,8 @@ NtUserGetObjectInformation(
     PWINSTATION_OBJECT WinStaObject = NULL;
     PDESKTOP DesktopObject = NULL;
     USEROBJECTFLAGS ObjectFlags;
+    DESKTOP_HEAP_STATS HeapStats;
+    ULONG HeapSize;
     PVOID pvData = NULL;
     SIZE_T nDataSize = 0;
 
@@ -810,6 +812,41 @@ NtUserGetObjectInformation(
             ERR("UOI_USER_SID unimplemented!\n");
             break;
 
+        case UOI_HEAPSIZE:
+        {
+            if (DesktopObject != NULL)
+            {
+                /* In KB, like the SharedSection setting */
+                HeapSize = (ULONG)(DesktopObject->ulHeapSize / 1024);
+                pvData = &HeapSize;
+                nDataSize = sizeof(HeapSize);
+                Status = STATUS_SUCCESS;
+            }
+            else
+            {
+                Status = STATUS_INVALID_PARAMETER;
+            }
+            break;
+        }
+
+        case UOI_HEAPSTATS:
+        {
+            if (DesktopObject != NULL)
+            {
+                UserEnterShared();
+                HeapStats = DesktopObject->HeapStats;
+                UserLeave();
+                pvData = &HeapStats;
+                nDataSize = sizeof(HeapStats);
+                Status = STATUS_SUCCESS;
+            }
+            else
+            {
+                Status = STATUS_INVALID_PARAMETER;
+            }
+            break;
+        }
+
         default:
             Status = STATUS_INVALID_PARAMETER;
             break;
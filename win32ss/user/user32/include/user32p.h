@@ -44,6 +44,7 @@ typedef struct
 
 /* global variables */
 extern HINSTANCE User32Instance;
+extern ULONG User32TlsIndex;
 #define user32_module User32Instance
 extern PPROCESSINFO g_ppi;
 extern ULONG_PTR g_ulSharedDelta;
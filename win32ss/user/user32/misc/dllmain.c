@@ -6,7 +6,7 @@ WINE_DEFAULT_DEBUG_CHANNEL(user32);
 
 #define KEY_LENGTH 1024
 
-static ULONG User32TlsIndex;
+ULONG User32TlsIndex;
 HINSTANCE User32Instance;
 
 PPROCESSINFO g_ppi = NULL;
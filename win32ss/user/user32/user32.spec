@@ -599,6 +599,7 @@
 592 stdcall SetClassWord(long long long) ; Direct call NtUserSetClassWord
 593 stdcall SetClipboardData(long long)
 594 stdcall SetClipboardViewer(long) NtUserSetClipboardViewer
+@ stdcall SetCoalescableTimer(long long long ptr long) NtUserSetCoalescableTimer
 595 stdcall SetConsoleReserveKeys(long long) NtUserSetConsoleReserveKeys
 596 stdcall SetCursor(long) NtUserSetCursor
 597 stdcall SetCursorContents(ptr ptr) NtUserSetCursorContents
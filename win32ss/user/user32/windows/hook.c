@@ -38,6 +38,27 @@ typedef struct _NOTIFYEVENT
    DWORD flags;
 } NOTIFYEVENT, *PNOTIFYEVENT;
 
+/* The hook callback running on this thread */
+typedef struct _HOOK_CHAIN_FRAME
+{
+   PHOOKPROC_CALLBACK_ARGUMENTS Common;
+   UINT iNext;
+} HOOK_CHAIN_FRAME, *PHOOK_CHAIN_FRAME;
+
+static
+PHOOK_CHAIN_FRAME
+IntGetHookChainFrame(VOID)
+{
+   PHOOK_CHAIN_FRAME Frame;
+   DWORD dwError;
+
+   /* Leave the last error of the hook alone */
+   dwError = GetLastError();
+   Frame = TlsGetValue(User32TlsIndex);
+   SetLastError(dwError);
+   return Frame;
+}
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 static
@@ -205,8 +226,24 @@ CallNextHookEx(
   PCLIENTINFO ClientInfo;
   DWORD Flags, Save;
   PHOOK pHook, phkNext;
+  PHOOK_CHAIN_FRAME Frame;
+  PHOOKPROC_CHAIN_ENTRY Entry;
   LRESULT lResult = 0;
 
+  /* The kernel passed the rest of the chain on, no need to go back there. */
+  Frame = IntGetHookChainFrame();
+  if (Frame && Frame->Common->cChain)
+  {
+     while (Frame->iNext < Frame->Common->cChain)
+     {
+        Entry = &Frame->Common->Chain[Frame->iNext++];
+        /* Skip the ones unhooked in the meantime */
+        if (ValidateHandleNoErr(Entry->hHook, TYPE_HOOK))
+           return Entry->Proc(Code, wParam, lParam);
+     }
+     return 0;
+  }
+
   ClientInfo = GetWin32ClientInfo();
 
   if (!ClientInfo->phkCurrent) return 0;
@@ -572,6 +609,8 @@ User32CallHookProcFromKernel(PVOID Arguments, ULONG ArgumentLength)
   BOOL Hit = FALSE, Loaded = FALSE;
   HMODULE mod = NULL;
   NTSTATUS Status = STATUS_SUCCESS;
+  HOOK_CHAIN_FRAME Frame;
+  PHOOK_CHAIN_FRAME PrevFrame;
 
   Common = (PHOOKPROC_CALLBACK_ARGUMENTS) Arguments;
 
@@ -598,6 +637,11 @@ User32CallHookProcFromKernel(PVOID Arguments, ULONG ArgumentLength)
      }
   }
 
+  Frame.Common = Common;
+  Frame.iNext = 0;
+  PrevFrame = IntGetHookChainFrame();
+  TlsSetValue(User32TlsIndex, &Frame);
+
   switch(Common->HookId)
   {
     case WH_CBT:
@@ -641,6 +685,7 @@ User32CallHookProcFromKernel(PVOID Arguments, ULONG ArgumentLength)
             lParam = Common->lParam;
             break;
         default:
+          TlsSetValue(User32TlsIndex, PrevFrame);
           if (Loaded) FreeLibrary(mod);
           ERR("HCBT_ not supported = %d\n", Common->Code);
           return ZwCallbackReturn(NULL, 0, STATUS_NOT_SUPPORTED);
@@ -765,10 +810,12 @@ User32CallHookProcFromKernel(PVOID Arguments, ULONG ArgumentLength)
       _SEH2_END;
       break;
     default:
+      TlsSetValue(User32TlsIndex, PrevFrame);
       if (Loaded) FreeLibrary(mod);
       ERR("WH_ not supported = %d\n", Common->HookId);
       return ZwCallbackReturn(NULL, 0, STATUS_NOT_SUPPORTED);
   }
+  TlsSetValue(User32TlsIndex, PrevFrame);
   if (Hit)
   {
      ERR("Hook Exception! Id: %d, Code %d, Proc 0x%x\n",Common->HookId,Common->Code,Proc);
@@ -779,18 +826,16 @@ User32CallHookProcFromKernel(PVOID Arguments, ULONG ArgumentLength)
   return ZwCallbackReturn(Arguments, ArgumentLength, Status);
 }
 
-NTSTATUS WINAPI
-User32CallEventProcFromKernel(PVOID Arguments, ULONG ArgumentLength)
+static
+VOID
+IntCallEventProc(PEVENTPROC_CALLBACK_ARGUMENTS Common)
 {
-  PEVENTPROC_CALLBACK_ARGUMENTS Common;
   WINEVENTPROC Proc;
   WCHAR module[MAX_PATH];
   DWORD len;
   HMODULE mod = NULL;
   BOOL Loaded = FALSE;
 
-  Common = (PEVENTPROC_CALLBACK_ARGUMENTS) Arguments;
-
   Proc = Common->Proc;
 
   if (Common->offPfn && Common->Mod)
@@ -830,6 +875,27 @@ User32CallEventProcFromKernel(PVOID Arguments, ULONG ArgumentLength)
        Common->dwmsEventTime);
 
   if (Loaded) FreeLibrary(mod);
+}
+
+NTSTATUS WINAPI
+User32CallEventProcFromKernel(PVOID Arguments, ULONG ArgumentLength)
+{
+  PEVENTPROC_CALLBACK_ARGUMENTS Common;
+  ULONG i, Count;
+
+  Common = (PEVENTPROC_CALLBACK_ARGUMENTS) Arguments;
+
+  /* Out of context events come in batches */
+  Count = ArgumentLength / sizeof(EVENTPROC_CALLBACK_ARGUMENTS);
+
+  for (i = 0; i < Count; i++)
+  {
+     /* An earlier one may have unhooked it */
+     if (i && !ValidateHandleNoErr(Common[i].hook, TYPE_WINEVENTHOOK))
+        continue;
+
+     IntCallEventProc(&Common[i]);
+  }
 
   return ZwCallbackReturn(NULL, 0, STATUS_SUCCESS);
 }